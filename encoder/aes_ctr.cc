@@ -0,0 +1,313 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/aes_ctr.h"
+
+#include <cstring>
+
+// AES-NI is not part of the x86-64 baseline, so GCC and Clang compile its
+// kernel for the "aes" target alone, and run it only where the processor
+// reports it. MSVC accepts the intrinsics without flags.
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define WEBMLIVE_HAVE_AESNI
+#define WEBMLIVE_AESNI_TARGET __attribute__((target("aes,sse2")))
+#include <wmmintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define WEBMLIVE_HAVE_AESNI
+#define WEBMLIVE_AESNI_TARGET
+#include <intrin.h>
+#include <wmmintrin.h>
+#elif defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES)
+#define WEBMLIVE_HAVE_ARMV8_AES
+#include <arm_neon.h>
+#endif
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+const int kRounds = 10;
+const int kBatchBlocks = AesCtr::kBatchBlocks;
+
+const uint8 kSbox[256] = {
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b,
+  0xfe, 0xd7, 0xab, 0x76, 0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+  0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0, 0xb7, 0xfd, 0x93, 0x26,
+  0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2,
+  0xeb, 0x27, 0xb2, 0x75, 0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+  0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84, 0x53, 0xd1, 0x00, 0xed,
+  0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f,
+  0x50, 0x3c, 0x9f, 0xa8, 0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+  0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2, 0xcd, 0x0c, 0x13, 0xec,
+  0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14,
+  0xde, 0x5e, 0x0b, 0xdb, 0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+  0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79, 0xe7, 0xc8, 0x37, 0x6d,
+  0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f,
+  0x4b, 0xbd, 0x8b, 0x8a, 0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+  0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e, 0xe1, 0xf8, 0x98, 0x11,
+  0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f,
+  0xb0, 0x54, 0xbb, 0x16,
+};
+
+const uint8 kRcon[kRounds] = {
+  0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36,
+};
+
+// Stores |value| big endian at |ptr_out|.
+void StoreBigEndian64(uint64 value, uint8* ptr_out) {
+  for (int i = 7; i >= 0; --i) {
+    ptr_out[i] = static_cast<uint8>(value);
+    value >>= 8;
+  }
+}
+
+// Writes the |num_blocks| counter blocks of |iv| from |block_counter| on to
+// |ptr_blocks|.
+void FillCounterBlocks(uint64 iv, uint64 block_counter, int num_blocks,
+                       uint8* ptr_blocks) {
+  for (int i = 0; i < num_blocks; ++i) {
+    StoreBigEndian64(iv, ptr_blocks + i * AesCtr::kBlockSize);
+    StoreBigEndian64(block_counter + i,
+                     ptr_blocks + i * AesCtr::kBlockSize + AesCtr::kIvSize);
+  }
+}
+
+uint8 MultiplyBy2(uint8 value) {
+  return static_cast<uint8>((value << 1) ^ ((value & 0x80) ? 0x1b : 0));
+}
+
+// FIPS-197 encryption of one block, one byte at a time.
+void EncryptBlockPortable(const uint8* round_keys, const uint8* ptr_src,
+                          uint8* ptr_dst) {
+  uint8 state[AesCtr::kBlockSize];
+  for (int i = 0; i < AesCtr::kBlockSize; ++i) {
+    state[i] = ptr_src[i] ^ round_keys[i];
+  }
+  for (int round = 1; round <= kRounds; ++round) {
+    // SubBytes and ShiftRows. The state is column major: byte |4 * c + r|
+    // holds row |r| of column |c|, and row |r| rotates left by |r|.
+    uint8 shifted[AesCtr::kBlockSize];
+    for (int c = 0; c < 4; ++c) {
+      for (int r = 0; r < 4; ++r) {
+        shifted[4 * c + r] = kSbox[state[4 * ((c + r) % 4) + r]];
+      }
+    }
+    // MixColumns, skipped by the last round.
+    if (round < kRounds) {
+      for (int c = 0; c < 4; ++c) {
+        const uint8* const col = shifted + 4 * c;
+        const uint8 all = col[0] ^ col[1] ^ col[2] ^ col[3];
+        state[4 * c + 0] = col[0] ^ all ^ MultiplyBy2(col[0] ^ col[1]);
+        state[4 * c + 1] = col[1] ^ all ^ MultiplyBy2(col[1] ^ col[2]);
+        state[4 * c + 2] = col[2] ^ all ^ MultiplyBy2(col[2] ^ col[3]);
+        state[4 * c + 3] = col[3] ^ all ^ MultiplyBy2(col[3] ^ col[0]);
+      }
+    } else {
+      memcpy(state, shifted, sizeof(state));
+    }
+    const uint8* const round_key = round_keys + round * AesCtr::kBlockSize;
+    for (int i = 0; i < AesCtr::kBlockSize; ++i) {
+      state[i] ^= round_key[i];
+    }
+  }
+  memcpy(ptr_dst, state, sizeof(state));
+}
+
+#if defined(WEBMLIVE_HAVE_AESNI)
+bool CpuHasAesNi() {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 25)) != 0;
+#else
+  return __builtin_cpu_supports("aes");
+#endif
+}
+
+// Encrypts the |num_blocks| blocks of |ptr_blocks|, at most |kBatchBlocks|,
+// in place. The blocks go through each round together, so that the rounds
+// of different blocks overlap in the pipeline.
+WEBMLIVE_AESNI_TARGET
+void EncryptBlocksAesNi(const uint8* round_keys, int num_blocks,
+                        uint8* ptr_blocks) {
+  __m128i keys[kRounds + 1];
+  for (int i = 0; i <= kRounds; ++i) {
+    keys[i] = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(round_keys + i * 16));
+  }
+  __m128i blocks[kBatchBlocks];
+  for (int b = 0; b < num_blocks; ++b) {
+    blocks[b] = _mm_xor_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_blocks + b * 16)),
+        keys[0]);
+  }
+  for (int round = 1; round < kRounds; ++round) {
+    for (int b = 0; b < num_blocks; ++b) {
+      blocks[b] = _mm_aesenc_si128(blocks[b], keys[round]);
+    }
+  }
+  for (int b = 0; b < num_blocks; ++b) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ptr_blocks + b * 16),
+                     _mm_aesenclast_si128(blocks[b], keys[kRounds]));
+  }
+}
+#endif  // WEBMLIVE_HAVE_AESNI
+
+#if defined(WEBMLIVE_HAVE_ARMV8_AES)
+// |EncryptBlocksAesNi()| for the ARMv8 cryptography extension, whose AESE
+// adds the round key before SubBytes and ShiftRows rather than after.
+void EncryptBlocksArmv8(const uint8* round_keys, int num_blocks,
+                        uint8* ptr_blocks) {
+  uint8x16_t keys[kRounds + 1];
+  for (int i = 0; i <= kRounds; ++i) {
+    keys[i] = vld1q_u8(round_keys + i * 16);
+  }
+  uint8x16_t blocks[kBatchBlocks];
+  for (int b = 0; b < num_blocks; ++b) {
+    blocks[b] = vld1q_u8(ptr_blocks + b * 16);
+  }
+  for (int round = 0; round < kRounds - 1; ++round) {
+    for (int b = 0; b < num_blocks; ++b) {
+      blocks[b] = vaesmcq_u8(vaeseq_u8(blocks[b], keys[round]));
+    }
+  }
+  for (int b = 0; b < num_blocks; ++b) {
+    blocks[b] = veorq_u8(vaeseq_u8(blocks[b], keys[kRounds - 1]),
+                         keys[kRounds]);
+    vst1q_u8(ptr_blocks + b * 16, blocks[b]);
+  }
+}
+#endif  // WEBMLIVE_HAVE_ARMV8_AES
+}  // namespace
+
+AesCtr::AesCtr()
+    : initialized_(false),
+      hardware_(false),
+      iv_(0),
+      block_counter_(0),
+      key_stream_used_(kBlockSize) {
+  memset(round_keys_, 0, sizeof(round_keys_));
+  memset(key_stream_, 0, sizeof(key_stream_));
+}
+
+int AesCtr::Init(const uint8* key, int32 key_length) {
+  if (!key || key_length != kKeySize) {
+    LOG(ERROR) << "AesCtr needs a " << kKeySize << " byte key, got "
+               << key_length << " bytes.";
+    return kInvalidArg;
+  }
+
+  // FIPS-197 key expansion: each 4 byte word is the word before it XOR the
+  // word one key length back, and the first word of each round key first
+  // goes through RotWord, SubWord and the round constant.
+  memcpy(round_keys_, key, kKeySize);
+  for (int i = kKeySize; i < static_cast<int>(sizeof(round_keys_)); i += 4) {
+    uint8 word[4];
+    memcpy(word, round_keys_ + i - 4, sizeof(word));
+    if (i % kKeySize == 0) {
+      const uint8 first = word[0];
+      word[0] = static_cast<uint8>(kSbox[word[1]] ^ kRcon[i / kKeySize - 1]);
+      word[1] = kSbox[word[2]];
+      word[2] = kSbox[word[3]];
+      word[3] = kSbox[first];
+    }
+    for (int j = 0; j < 4; ++j) {
+      round_keys_[i + j] = round_keys_[i - kKeySize + j] ^ word[j];
+    }
+  }
+#if defined(WEBMLIVE_HAVE_AESNI)
+  hardware_ = CpuHasAesNi();
+#elif defined(WEBMLIVE_HAVE_ARMV8_AES)
+  hardware_ = true;
+#endif
+  initialized_ = true;
+  Start(0);
+  return kSuccess;
+}
+
+void AesCtr::Start(uint64 iv) {
+  iv_ = iv;
+  block_counter_ = 0;
+  key_stream_used_ = kBlockSize;
+}
+
+void AesCtr::Process(const uint8* ptr_src, uint8* ptr_dst, int32 length) {
+  if (!initialized_) {
+    LOG(ERROR) << "AesCtr not initialized.";
+    return;
+  }
+
+  // Finish the block the previous call started.
+  while (length > 0 && key_stream_used_ < kBlockSize) {
+    *ptr_dst++ = *ptr_src++ ^ key_stream_[key_stream_used_++];
+    --length;
+  }
+
+  const int32 num_blocks = length / kBlockSize;
+  ProcessBlocks(ptr_src, ptr_dst, num_blocks);
+  ptr_src += num_blocks * kBlockSize;
+  ptr_dst += num_blocks * kBlockSize;
+  length -= num_blocks * kBlockSize;
+
+  // Keep the rest of the last, partial, block's key stream for the next
+  // call.
+  if (length > 0) {
+    GenerateKeyStream(1, key_stream_);
+    for (key_stream_used_ = 0; key_stream_used_ < length;
+         ++key_stream_used_) {
+      ptr_dst[key_stream_used_] =
+          ptr_src[key_stream_used_] ^ key_stream_[key_stream_used_];
+    }
+  }
+}
+
+void AesCtr::EncryptBlock(const uint8* ptr_src, uint8* ptr_dst) const {
+  EncryptBlockPortable(round_keys_, ptr_src, ptr_dst);
+}
+
+void AesCtr::GenerateKeyStream(int num_blocks, uint8* ptr_key_stream) {
+  FillCounterBlocks(iv_, block_counter_, num_blocks, ptr_key_stream);
+  block_counter_ += num_blocks;
+#if defined(WEBMLIVE_HAVE_AESNI)
+  if (hardware_) {
+    EncryptBlocksAesNi(round_keys_, num_blocks, ptr_key_stream);
+    return;
+  }
+#elif defined(WEBMLIVE_HAVE_ARMV8_AES)
+  EncryptBlocksArmv8(round_keys_, num_blocks, ptr_key_stream);
+  return;
+#endif
+  for (int b = 0; b < num_blocks; ++b) {
+    EncryptBlockPortable(round_keys_, ptr_key_stream + b * kBlockSize,
+                         ptr_key_stream + b * kBlockSize);
+  }
+}
+
+void AesCtr::ProcessBlocks(const uint8* ptr_src, uint8* ptr_dst,
+                           int32 num_blocks) {
+  uint8 key_stream[kBatchBlocks * kBlockSize];
+  while (num_blocks > 0) {
+    const int batch = num_blocks < kBatchBlocks ? num_blocks : kBatchBlocks;
+    GenerateKeyStream(batch, key_stream);
+    const int32 batch_length = batch * kBlockSize;
+    for (int32 i = 0; i < batch_length; ++i) {
+      ptr_dst[i] = ptr_src[i] ^ key_stream[i];
+    }
+    ptr_src += batch_length;
+    ptr_dst += batch_length;
+    num_blocks -= batch;
+  }
+}
+
+}  // namespace webmlive
@@ -0,0 +1,89 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_AES_CTR_H_
+#define WEBMLIVE_ENCODER_AES_CTR_H_
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// AES-128 in counter mode, as WebM encryption and CENC's "cenc" scheme use
+// it: the counter block of a frame is its 8 byte IV followed by a 64 bit big
+// endian block counter starting at 0. Encryption and decryption are the same
+// operation.
+//
+// Notes
+// - Uses AES-NI on x86 processors that have it, checked at run time, and the
+//   ARMv8 cryptography extension when the build targets it. Otherwise a
+//   portable implementation, fast enough for live bitrates, runs instead.
+//   All give the same output.
+// - Not thread safe; each muxer owns its own instance.
+class AesCtr {
+ public:
+  enum {
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+  static const int kKeySize = 16;
+  static const int kBlockSize = 16;
+  static const int kIvSize = 8;
+
+  // Blocks of key stream generated at once: enough to keep the AES units of
+  // current processors busy.
+  static const int kBatchBlocks = 8;
+
+  AesCtr();
+  ~AesCtr() {}
+
+  // Expands |key|, |kKeySize| bytes long. Returns |kSuccess| when
+  // successful.
+  int Init(const uint8* key, int32 key_length);
+
+  // Starts the key stream of the frame encrypted with |iv|.
+  void Start(uint64 iv);
+
+  // Encrypts |length| bytes from |ptr_src| to |ptr_dst|, continuing the key
+  // stream where the previous call left it. |ptr_src| and |ptr_dst| may be
+  // equal.
+  void Process(const uint8* ptr_src, uint8* ptr_dst, int32 length);
+
+  // Encrypts the single block |ptr_src| to |ptr_dst| with the portable
+  // implementation, for checks of the hardware kernels.
+  void EncryptBlock(const uint8* ptr_src, uint8* ptr_dst) const;
+
+  // Returns true when |Process()| uses AES-NI or the ARMv8 extension.
+  bool hardware() const { return hardware_; }
+
+ private:
+  // Encrypts the counter blocks |block_counter_| to |block_counter_| +
+  // |num_blocks| - 1, at most |kBatchBlocks|, into |ptr_key_stream|, and
+  // advances |block_counter_| past them.
+  void GenerateKeyStream(int num_blocks, uint8* ptr_key_stream);
+
+  // XORs the key stream of the next |num_blocks| blocks into |ptr_src| and
+  // stores the result at |ptr_dst|.
+  void ProcessBlocks(const uint8* ptr_src, uint8* ptr_dst, int32 num_blocks);
+
+  // Round keys of the 11 rounds, in the byte order of FIPS-197, which is
+  // also the order AES-NI and ARMv8 load them in.
+  uint8 round_keys_[11 * kBlockSize];
+  bool initialized_;
+  bool hardware_;
+
+  // Key stream state: the IV of the frame, the counter of the next block,
+  // and the unused bytes of the last block generated.
+  uint64 iv_;
+  uint64 block_counter_;
+  uint8 key_stream_[kBlockSize];
+  int key_stream_used_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(AesCtr);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_AES_CTR_H_
@@ -0,0 +1,151 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/alpha_blend.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WEBMLIVE_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace webmlive {
+
+namespace {
+// Scalar loop. Blends the samples from |first| to |width|.
+void BlendRowScalar(const uint8* ptr_src, uint8* ptr_dst, int32 first,
+                    int32 width, int alpha) {
+  const int inverse = kOpaqueAlpha - alpha;
+  for (int32 x = first; x < width; ++x) {
+    ptr_dst[x] = static_cast<uint8>(
+        (ptr_src[x] * alpha + ptr_dst[x] * inverse + 128) >> 8);
+  }
+}
+
+// Vector loop. Returns the number of samples it blended, a multiple of 16.
+// Each sum is at most 255 * 256 + 128, so it fits unsigned 16 bit lanes.
+#if defined(WEBMLIVE_HAVE_SSE2)
+int32 BlendRowSimd(const uint8* ptr_src, uint8* ptr_dst, int32 width,
+                   int alpha) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i src_weight = _mm_set1_epi16(static_cast<int16>(alpha));
+  const __m128i dst_weight =
+      _mm_set1_epi16(static_cast<int16>(kOpaqueAlpha - alpha));
+  const __m128i rounding = _mm_set1_epi16(128);
+  int32 x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const __m128i src =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_src + x));
+    const __m128i dst =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_dst + x));
+    __m128i low = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpacklo_epi8(src, zero), src_weight),
+        _mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), dst_weight));
+    __m128i high = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpackhi_epi8(src, zero), src_weight),
+        _mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), dst_weight));
+    low = _mm_srli_epi16(_mm_add_epi16(low, rounding), 8);
+    high = _mm_srli_epi16(_mm_add_epi16(high, rounding), 8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ptr_dst + x),
+                     _mm_packus_epi16(low, high));
+  }
+  return x;
+}
+#else
+int32 BlendRowSimd(const uint8*, uint8*, int32, int) {
+  return 0;
+}
+#endif
+
+// Per sample alpha loops, as above.
+void BlendRowAlphaScalar(const uint8* ptr_src, const uint8* ptr_alpha,
+                         uint8* ptr_dst, int32 first, int32 width) {
+  for (int32 x = first; x < width; ++x) {
+    const int alpha = ptr_alpha[x] + (ptr_alpha[x] >> 7);
+    ptr_dst[x] = static_cast<uint8>(
+        (ptr_src[x] * alpha + ptr_dst[x] * (kOpaqueAlpha - alpha) + 128) >> 8);
+  }
+}
+
+#if defined(WEBMLIVE_HAVE_SSE2)
+int32 BlendRowAlphaSimd(const uint8* ptr_src, const uint8* ptr_alpha,
+                        uint8* ptr_dst, int32 width) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i opaque = _mm_set1_epi16(kOpaqueAlpha);
+  const __m128i rounding = _mm_set1_epi16(128);
+  int32 x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const __m128i src =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_src + x));
+    const __m128i alpha =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_alpha + x));
+    const __m128i dst =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_dst + x));
+    __m128i alpha_low = _mm_unpacklo_epi8(alpha, zero);
+    __m128i alpha_high = _mm_unpackhi_epi8(alpha, zero);
+    alpha_low = _mm_add_epi16(alpha_low, _mm_srli_epi16(alpha_low, 7));
+    alpha_high = _mm_add_epi16(alpha_high, _mm_srli_epi16(alpha_high, 7));
+    __m128i low = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpacklo_epi8(src, zero), alpha_low),
+        _mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero),
+                        _mm_sub_epi16(opaque, alpha_low)));
+    __m128i high = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpackhi_epi8(src, zero), alpha_high),
+        _mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero),
+                        _mm_sub_epi16(opaque, alpha_high)));
+    low = _mm_srli_epi16(_mm_add_epi16(low, rounding), 8);
+    high = _mm_srli_epi16(_mm_add_epi16(high, rounding), 8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ptr_dst + x),
+                     _mm_packus_epi16(low, high));
+  }
+  return x;
+}
+#else
+int32 BlendRowAlphaSimd(const uint8*, const uint8*, uint8*, int32) {
+  return 0;
+}
+#endif
+}  // namespace
+
+void BlendPlane(const uint8* ptr_src, int32 src_stride,
+                uint8* ptr_dst, int32 dst_stride,
+                int32 width, int32 height, int alpha) {
+  if (alpha <= 0 || width <= 0) {
+    return;
+  }
+  for (int32 y = 0; y < height; ++y) {
+    const uint8* const ptr_src_row = ptr_src + y * src_stride;
+    uint8* const ptr_dst_row = ptr_dst + y * dst_stride;
+    if (alpha >= kOpaqueAlpha) {
+      memcpy(ptr_dst_row, ptr_src_row, width);
+      continue;
+    }
+    const int32 done = BlendRowSimd(ptr_src_row, ptr_dst_row, width, alpha);
+    BlendRowScalar(ptr_src_row, ptr_dst_row, done, width, alpha);
+  }
+}
+
+void BlendPlaneWithAlpha(const uint8* ptr_src, int32 src_stride,
+                         const uint8* ptr_alpha, int32 alpha_stride,
+                         uint8* ptr_dst, int32 dst_stride,
+                         int32 width, int32 height) {
+  if (width <= 0) {
+    return;
+  }
+  for (int32 y = 0; y < height; ++y) {
+    const uint8* const ptr_src_row = ptr_src + y * src_stride;
+    const uint8* const ptr_alpha_row = ptr_alpha + y * alpha_stride;
+    uint8* const ptr_dst_row = ptr_dst + y * dst_stride;
+    const int32 done =
+        BlendRowAlphaSimd(ptr_src_row, ptr_alpha_row, ptr_dst_row, width);
+    BlendRowAlphaScalar(ptr_src_row, ptr_alpha_row, ptr_dst_row, done, width);
+  }
+}
+
+}  // namespace webmlive
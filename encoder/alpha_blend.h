@@ -0,0 +1,42 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_ALPHA_BLEND_H_
+#define WEBMLIVE_ENCODER_ALPHA_BLEND_H_
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Opacity at which |BlendPlane()| copies the source.
+const int kOpaqueAlpha = 256;
+
+// Blends |height| rows of |width| 8 bit samples at |ptr_src| over those at
+// |ptr_dst|: dst = (src * alpha + dst * (256 - alpha) + 128) >> 8, where
+// |alpha| is in [0, |kOpaqueAlpha|]. Strides are in bytes. The vector and
+// scalar loops give identical results.
+//
+// Uses SSE2 when the target supports it.
+void BlendPlane(const uint8* ptr_src, int32 src_stride,
+                uint8* ptr_dst, int32 dst_stride,
+                int32 width, int32 height, int alpha);
+
+// Blends as |BlendPlane()| does, with a separate opacity for each sample:
+// the 8 bit sample at the same position of the |alpha_stride| plane at
+// |ptr_alpha|, where 0 is transparent and 255 opaque. Alpha a is used as
+// a + (a >> 7), which maps 255 to |kOpaqueAlpha|. The vector and scalar
+// loops give identical results.
+//
+// Uses SSE2 when the target supports it.
+void BlendPlaneWithAlpha(const uint8* ptr_src, int32 src_stride,
+                         const uint8* ptr_alpha, int32 alpha_stride,
+                         uint8* ptr_dst, int32 dst_stride,
+                         int32 width, int32 height);
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_ALPHA_BLEND_H_
@@ -0,0 +1,486 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/aom_encoder.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "encoder/av1_codec_config.h"
+#include "encoder/buffer_pool-inl.h"
+#include "encoder/resource_planner.h"
+#include "encoder/webm_encoder.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Automatic threading never uses more threads than this per encoder.
+const int kMaxAutoThreads = 8;
+
+// Narrowest tile column used by automatic tiling, in pixels, and the largest
+// tile column count, log2.
+const int kMinTileWidth = 256;
+const int kMaxTileColumnsLog2 = 6;
+
+// Cyclic refresh adaptive quantization, which recodes a band of blocks in
+// every frame. Used by intra refresh and the ultra low latency profile.
+const int kAqModeCyclicRefresh = 3;
+
+// Temporal delimiter OBU, without payload, that begins every temporal unit
+// libaom produces. WebM blocks must not carry it.
+const uint8 kTemporalDelimiter[] = {0x12, 0x00};
+}  // namespace
+
+AomEncoder::AomEncoder()
+    : frames_in_(0),
+      frames_out_(0),
+      last_keyframe_time_(0),
+      last_timestamp_(0),
+      requested_bitrate_(0),
+      speed_(kMinSpeed),
+      requested_speed_boost_(0),
+      speed_boost_(0),
+      frame_capacity_(0) {
+  memset(&aom_context_, 0, sizeof(aom_context_));
+  memset(&aom_config_, 0, sizeof(aom_config_));
+}
+
+AomEncoder::~AomEncoder() {
+  if (aom_context_.iface) {
+    aom_codec_destroy(&aom_context_);
+  }
+}
+
+int AomEncoder::Init(const WebmEncoderConfig& user_config) {
+  config_ = user_config.vpx_config;
+  if (config_.codec != kVideoFormatAV1) {
+    LOG(ERROR) << "AomEncoder requires AV1.";
+    return kInvalidArg;
+  }
+  if (config_.profile != kVideoEncodeProfileDefault &&
+      config_.profile != kVideoEncodeProfileUltraLowLatency) {
+    LOG(ERROR) << "AV1 encode requires a realtime CBR encode profile.";
+    return kInvalidArg;
+  }
+  if (config_.temporal_layers != 1 || config_.lag_in_frames > 0) {
+    LOG(ERROR) << "AV1 encode supports neither temporal layers nor "
+               << "lookahead.";
+    return kInvalidArg;
+  }
+  if (config_.bit_depth != 8 && config_.bit_depth != 10) {
+    LOG(ERROR) << "unsupported bit depth " << config_.bit_depth;
+    return kInvalidArg;
+  }
+  const bool high_bit_depth = config_.bit_depth > 8;
+  if (high_bit_depth !=
+      (user_config.actual_video_config.format == kVideoFormatI42016)) {
+    LOG(ERROR) << "bit depth " << config_.bit_depth
+               << " does not match input format "
+               << user_config.actual_video_config.format;
+    return kInvalidArg;
+  }
+  if (high_bit_depth &&
+      !(aom_codec_get_caps(aom_codec_av1_cx()) & AOM_CODEC_CAP_HIGHBITDEPTH)) {
+    LOG(ERROR) << "libaom was built without high bit depth support.";
+    return kCodecError;
+  }
+
+  aom_codec_enc_cfg_t libaom_config;
+  aom_codec_err_t status = aom_codec_enc_config_default(
+      aom_codec_av1_cx(), &libaom_config, AOM_USAGE_REALTIME);
+  if (status) {
+    LOG(ERROR) << "aom_codec_enc_config_default failed: "
+               << aom_codec_err_to_string(status);
+    return kCodecError;
+  }
+  const int width = user_config.actual_video_config.width;
+  const int height = user_config.actual_video_config.height;
+  libaom_config.g_w = width;
+  libaom_config.g_h = height;
+
+  // The main profile covers 8 and 10 bit 4:2:0.
+  libaom_config.g_profile = 0;
+  if (high_bit_depth) {
+    libaom_config.g_bit_depth = AOM_BITS_10;
+    libaom_config.g_input_bit_depth = 10;
+  }
+  libaom_config.g_pass = AOM_RC_ONE_PASS;
+  libaom_config.g_lag_in_frames = 0;
+  libaom_config.g_timebase.num = 1;
+  libaom_config.g_timebase.den = kMicrosecondTimebase;
+  libaom_config.rc_end_usage = AOM_CBR;
+  libaom_config.rc_target_bitrate = config_.bitrate;
+  libaom_config.rc_min_quantizer = config_.min_quantizer;
+  libaom_config.rc_max_quantizer = config_.max_quantizer;
+  if (config_.undershoot != VpxConfig::kUseDefault) {
+    libaom_config.rc_undershoot_pct = config_.undershoot;
+  }
+  if (config_.overshoot != VpxConfig::kUseDefault) {
+    libaom_config.rc_overshoot_pct = config_.overshoot;
+  }
+  if (config_.total_buffer_time != VpxConfig::kUseDefault) {
+    libaom_config.rc_buf_sz = config_.total_buffer_time;
+  }
+  if (config_.initial_buffer_time != VpxConfig::kUseDefault) {
+    libaom_config.rc_buf_initial_sz = config_.initial_buffer_time;
+  }
+  if (config_.optimal_buffer_time != VpxConfig::kUseDefault) {
+    libaom_config.rc_buf_optimal_sz = config_.optimal_buffer_time;
+  }
+  if (config_.error_resilient) {
+    libaom_config.g_error_resilient = 1;
+  }
+
+  // As with libvpx, scheduled keyframes are all forced, and intra refresh
+  // keeps keyframes to those forced.
+  if (config_.scheduled_keyframes || config_.intra_refresh) {
+    libaom_config.kf_mode = AOM_KF_DISABLED;
+  }
+
+  // Representations of a multi-bitrate encode share the cores. Tiles are
+  // added up to one per thread, and row based multithreading keeps threads
+  // busy beyond them.
+  const int num_encoders = std::max(
+      1, static_cast<int>(user_config.video_representations.size()));
+  const int num_cores = user_config.encode_cores > 0 ?
+      user_config.encode_cores : AvailableCpuThreads();
+  const int max_threads =
+      std::max(1, std::min(num_cores / num_encoders, kMaxAutoThreads));
+  if (config_.tile_columns == VpxConfig::kUseDefault) {
+    config_.tile_columns = 0;
+    while (config_.tile_columns < kMaxTileColumnsLog2 &&
+           (2 << config_.tile_columns) <= max_threads &&
+           (kMinTileWidth << (config_.tile_columns + 1)) <= width) {
+      ++config_.tile_columns;
+    }
+  }
+  if (config_.row_mt == VpxConfig::kUseDefault) {
+    config_.row_mt = 1;
+  }
+  if (config_.thread_count == VpxConfig::kUseDefault) {
+    config_.thread_count = max_threads;
+  }
+  libaom_config.g_threads = config_.thread_count;
+
+  if (aom_context_.iface) {
+    aom_codec_destroy(&aom_context_);
+    memset(&aom_context_, 0, sizeof(aom_context_));
+  }
+  status = aom_codec_enc_init(&aom_context_, aom_codec_av1_cx(),
+                              &libaom_config,
+                              high_bit_depth ? AOM_CODEC_USE_HIGHBITDEPTH : 0);
+  if (status) {
+    LOG(ERROR) << "aom_codec_enc_init failed: "
+               << aom_codec_err_to_string(status);
+    return kCodecError;
+  }
+  aom_config_ = libaom_config;
+
+  speed_ = std::max(kMinSpeed, std::min(std::abs(config_.speed), kMaxSpeed));
+  speed_boost_ = 0;
+  if (config_.screen_content == VpxConfig::kUseDefault) {
+    config_.screen_content = user_config.video_capture_desktop ? 1 : 0;
+  }
+
+  // The level is chosen from the same limits |DashWriter| uses for the
+  // codecs parameter, so that the manifest matches the sequence header.
+  const int level_index = Av1LevelIndex(
+      width, height, user_config.actual_video_config.frame_rate,
+      config_.bitrate);
+  if (CodecControl(AOME_SET_CPUUSED, speed_) ||
+      CodecControl(AV1E_SET_TILE_COLUMNS, config_.tile_columns) ||
+      CodecControl(AV1E_SET_ROW_MT, config_.row_mt) ||
+      CodecControl(AV1E_SET_TARGET_SEQ_LEVEL_IDX, level_index) ||
+      ((config_.intra_refresh ||
+        config_.profile == kVideoEncodeProfileUltraLowLatency) &&
+       CodecControl(AV1E_SET_AQ_MODE, kAqModeCyclicRefresh)) ||
+      (config_.max_keyframe_bitrate != VpxConfig::kUseDefault &&
+       CodecControl(AOME_SET_MAX_INTRA_BITRATE_PCT,
+                    config_.max_keyframe_bitrate)) ||
+      (config_.screen_content == 1 &&
+       CodecControl(AV1E_SET_TUNE_CONTENT,
+                    static_cast<int>(AOM_CONTENT_SCREEN)))) {
+    return kCodecError;
+  }
+  LOG(INFO) << "AomEncoder threads=" << config_.thread_count
+            << " tile_columns=" << config_.tile_columns
+            << " row_mt=" << config_.row_mt << " speed=" << speed_
+            << " bit_depth=" << config_.bit_depth
+            << " level_index=" << level_index;
+
+  const int build_status = BuildCodecPrivate();
+  if (build_status) {
+    return build_status;
+  }
+  const int queue_status =
+      output_queue_.Init(true, BufferPool<VideoFrame>::kDefaultBufferCount);
+  if (queue_status &&
+      queue_status != BufferPool<VideoFrame>::kAlreadyInitialized) {
+    LOG(ERROR) << "AomEncoder output queue Init failed.";
+    return kNoMemory;
+  }
+  frame_capacity_ =
+      CompressedFrameCapacity(config_, user_config.actual_video_config);
+  return kSuccess;
+}
+
+int AomEncoder::EncodeFrame(const VideoFrame& raw_frame,
+                            VideoFrame* ptr_vpx_frame) {
+  if (raw_frame.empty()) {
+    LOG(ERROR) << "NULL raw VideoFrame buffer!";
+    return kInvalidArg;
+  }
+  const bool high_bit_depth = config_.bit_depth > 8;
+  if ((high_bit_depth && raw_frame.format() != kVideoFormatI42016) ||
+      (!high_bit_depth && raw_frame.format() != kVideoFormatI420 &&
+       raw_frame.format() != kVideoFormatYV12)) {
+    LOG(ERROR) << "Unsupported VideoFrame format!";
+    return kInvalidArg;
+  }
+  ++frames_in_;
+
+  if (ApplyRequestedBitrate() || ApplyRequestedSpeedBoost()) {
+    return kCodecError;
+  }
+
+  // Frames due to be keyframes are never dropped by decimation.
+  if (config_.decimate > 1 &&
+      !keyframe_request_.Pending(raw_frame.timestamp()) &&
+      frames_in_ % config_.decimate) {
+    return kDropped;
+  }
+
+  // Keyframes are due as with |VpxEncoder|: on request, after the keyframe
+  // interval unless keyframes are scheduled or intra refresh is on, and at
+  // scene cuts found by frame analysis unless keyframes are scheduled.
+  const VideoFrameAnalysis& analysis = raw_frame.analysis();
+  const bool keyframe_due = !config_.scheduled_keyframes &&
+      ((!config_.intra_refresh &&
+        raw_frame.timestamp() - last_keyframe_time_ >
+            config_.keyframe_interval) ||
+       (analysis.valid && analysis.scene_cut));
+  const bool force_keyframe =
+      keyframe_request_.Take(raw_frame.timestamp()) || keyframe_due;
+
+  // Wrap the planes of |raw_frame| in |aom_image| as they are, padded rows
+  // and separate planes included. Strides are in bytes for I42016 too.
+  aom_img_fmt_t aom_image_format = AOM_IMG_FMT_YV12;
+  if (raw_frame.format() == kVideoFormatI420) {
+    aom_image_format = AOM_IMG_FMT_I420;
+  } else if (raw_frame.format() == kVideoFormatI42016) {
+    aom_image_format = AOM_IMG_FMT_I42016;
+  }
+  const VideoPlane y_plane = raw_frame.plane(VideoFrame::kPlaneY);
+  const VideoPlane u_plane = raw_frame.plane(VideoFrame::kPlaneU);
+  const VideoPlane v_plane = raw_frame.plane(VideoFrame::kPlaneV);
+  aom_image_t aom_image;
+  if (!aom_img_wrap(&aom_image, aom_image_format, raw_frame.width(),
+                    raw_frame.height(), 1, y_plane.data)) {
+    LOG(ERROR) << "EncodeFrame aom_img_wrap failed.";
+    return kEncoderError;
+  }
+  aom_image.planes[AOM_PLANE_Y] = y_plane.data;
+  aom_image.planes[AOM_PLANE_U] = u_plane.data;
+  aom_image.planes[AOM_PLANE_V] = v_plane.data;
+  aom_image.stride[AOM_PLANE_Y] = y_plane.stride;
+  aom_image.stride[AOM_PLANE_U] = u_plane.stride;
+  aom_image.stride[AOM_PLANE_V] = v_plane.stride;
+  if (high_bit_depth) {
+    aom_image.bit_depth = config_.bit_depth;
+  }
+
+  const aom_codec_err_t status = aom_codec_encode(
+      &aom_context_, &aom_image, raw_frame.timestamp_us(),
+      static_cast<unsigned long>(raw_frame.duration_us()),  // NOLINT
+      force_keyframe ? AOM_EFLAG_FORCE_KF : 0);
+  if (status) {
+    LOG(ERROR) << "EncodeFrame aom_codec_encode failed: "
+               << aom_codec_err_to_string(status) << ": "
+               << aom_codec_error_detail(&aom_context_);
+    return kCodecError;
+  }
+  last_raw_config_ = raw_frame.config();
+  const int queue_status = QueuePackets();
+  if (queue_status) {
+    return queue_status;
+  }
+  const int read_status = ReadQueuedFrame(ptr_vpx_frame);
+  return read_status == kNoFrame ? kDropped : read_status;
+}
+
+int AomEncoder::ReadQueuedFrame(VideoFrame* ptr_vpx_frame) {
+  const int status = output_queue_.Decommit(ptr_vpx_frame);
+  if (status == BufferPool<VideoFrame>::kEmpty) {
+    return kNoFrame;
+  } else if (status) {
+    LOG(ERROR) << "AomEncoder output Decommit failed: " << status;
+    return kNoMemory;
+  }
+  last_timestamp_ = ptr_vpx_frame->timestamp();
+  return kSuccess;
+}
+
+int AomEncoder::Flush() {
+  for (;;) {
+    const int64 frames_queued = frames_out_;
+    const aom_codec_err_t status =
+        aom_codec_encode(&aom_context_, NULL, -1, 1, 0);
+    if (status) {
+      LOG(ERROR) << "Flush aom_codec_encode failed: "
+                 << aom_codec_err_to_string(status);
+      return kCodecError;
+    }
+    const int queue_status = QueuePackets();
+    if (queue_status) {
+      return queue_status;
+    }
+    if (frames_out_ == frames_queued) {
+      break;
+    }
+  }
+  return kSuccess;
+}
+
+int AomEncoder::SetTargetBitrate(int kbps) {
+  if (kbps <= 0) {
+    LOG(ERROR) << "invalid target bitrate " << kbps;
+    return kInvalidArg;
+  }
+  requested_bitrate_.store(kbps);
+  return kSuccess;
+}
+
+int AomEncoder::CodecControl(int control_id, int val) {
+  const aom_codec_err_t status =
+      aom_codec_control(&aom_context_, control_id, val);
+  if (status) {
+    LOG(ERROR) << "aom_codec_control (" << control_id << ") failed: "
+               << aom_codec_err_to_string(status);
+    return kCodecError;
+  }
+  return kSuccess;
+}
+
+int AomEncoder::BuildCodecPrivate() {
+  aom_fixed_buf_t* const ptr_headers =
+      aom_codec_get_global_headers(&aom_context_);
+  if (!ptr_headers) {
+    LOG(ERROR) << "aom_codec_get_global_headers failed.";
+    return kCodecError;
+  }
+  const uint8* const ptr_obus = static_cast<const uint8*>(ptr_headers->buf);
+  const int32 length = static_cast<int32>(ptr_headers->sz);
+  Av1CodecConfig av1_config;
+  av1_config.bit_depth = config_.bit_depth;
+  const bool parsed = ParseAv1SequenceHeader(ptr_obus, length, &av1_config);
+  if (parsed) {
+    BuildAv1CodecConfigRecord(av1_config, ptr_obus, length, &codec_private_);
+  }
+  free(ptr_headers->buf);
+  free(ptr_headers);
+  if (!parsed) {
+    LOG(ERROR) << "libaom returned an invalid sequence header.";
+    return kCodecError;
+  }
+  return kSuccess;
+}
+
+int AomEncoder::ApplyRequestedBitrate() {
+  const int kbps = requested_bitrate_.exchange(0);
+  if (kbps == 0 ||
+      static_cast<unsigned int>(kbps) == aom_config_.rc_target_bitrate) {
+    return kSuccess;
+  }
+  aom_codec_enc_cfg_t libaom_config = aom_config_;
+  libaom_config.rc_target_bitrate = kbps;
+  const aom_codec_err_t status =
+      aom_codec_enc_config_set(&aom_context_, &libaom_config);
+  if (status) {
+    LOG(ERROR) << "aom_codec_enc_config_set failed: "
+               << aom_codec_err_to_string(status);
+    return kCodecError;
+  }
+  LOG(INFO) << "target bitrate " << aom_config_.rc_target_bitrate << " -> "
+            << kbps << " kbps";
+  aom_config_ = libaom_config;
+  config_.bitrate = kbps;
+  return kSuccess;
+}
+
+int AomEncoder::ApplyRequestedSpeedBoost() {
+  const int boost = requested_speed_boost_.load();
+  if (boost == speed_boost_) {
+    return kSuccess;
+  }
+  const int old_speed = std::min(speed_ + speed_boost_, kMaxSpeed);
+  const int speed = std::min(speed_ + boost, kMaxSpeed);
+  speed_boost_ = boost;
+  if (speed != old_speed && CodecControl(AOME_SET_CPUUSED, speed)) {
+    return kCodecError;
+  }
+  LOG(INFO) << "speed boost " << boost << ", speed " << old_speed << " -> "
+            << speed;
+  return kSuccess;
+}
+
+int AomEncoder::QueuePackets() {
+  aom_codec_iter_t iter = NULL;
+  for (;;) {
+    const aom_codec_cx_pkt_t* const pkt =
+        aom_codec_get_cx_data(&aom_context_, &iter);
+    if (!pkt) {
+      break;
+    }
+    if (pkt->kind != AOM_CODEC_CX_FRAME_PKT) {
+      continue;
+    }
+    const uint8* ptr_data = static_cast<const uint8*>(pkt->data.frame.buf);
+    int32 frame_size = static_cast<int32>(pkt->data.frame.sz);
+    if (frame_size >= static_cast<int32>(sizeof(kTemporalDelimiter)) &&
+        !memcmp(ptr_data, kTemporalDelimiter, sizeof(kTemporalDelimiter))) {
+      ptr_data += sizeof(kTemporalDelimiter);
+      frame_size -= sizeof(kTemporalDelimiter);
+    }
+    if (frame_size <= 0) {
+      continue;
+    }
+    const bool is_keyframe = !!(pkt->data.frame.flags & AOM_FRAME_IS_KEY);
+    if (frame_size > frame_capacity_) {
+      frame_capacity_ = frame_size + frame_size / 2;
+      VLOG(1) << "compressed frame capacity now " << frame_capacity_;
+    }
+    if (packet_frame_.Allocate(frame_capacity_)) {
+      LOG(ERROR) << "cannot allocate compressed frame storage.";
+      return kEncoderError;
+    }
+    memcpy(packet_frame_.buffer(), ptr_data, frame_size);
+    VideoConfig av1_config = last_raw_config_;
+    av1_config.format = kVideoFormatAV1;
+    const int32 status =
+        packet_frame_.InitInPlace(av1_config, is_keyframe, 0, 0, frame_size);
+    if (status) {
+      LOG(ERROR) << "VideoFrame InitInPlace failed: " << status;
+      return kEncoderError;
+    }
+    packet_frame_.SetTimeUs(pkt->data.frame.pts, pkt->data.frame.duration);
+    if (is_keyframe) {
+      last_keyframe_time_ = packet_frame_.timestamp();
+      LOG(INFO) << "keyframe @ " << last_keyframe_time_ / 1000.0 << "sec ("
+                << last_keyframe_time_ << "ms)";
+    }
+    if (output_queue_.Commit(&packet_frame_)) {
+      LOG(ERROR) << "AomEncoder output Commit failed.";
+      return kNoMemory;
+    }
+    ++frames_out_;
+  }
+  return kSuccess;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,162 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_AOM_ENCODER_H_
+#define WEBMLIVE_ENCODER_AOM_ENCODER_H_
+
+#include <atomic>
+#include <vector>
+
+#include "aom/aom_encoder.h"
+#include "aom/aomcx.h"
+#include "encoder/basictypes.h"
+#include "encoder/buffer_pool.h"
+#include "encoder/video_encoder.h"
+#include "encoder/video_encoder_backend.h"
+
+namespace webmlive {
+
+// AV1 encoder using libaom in its realtime mode: one pass CBR without
+// lookahead, at the realtime speed presets.
+//
+// Notes
+// - The magnitude of |VpxConfig::speed| selects the libaom speed, raised to
+//   at least |kMinSpeed|, the slowest realtime preset.
+// - |keyframe_interval|, |bitrate|, |decimate|, |min_quantizer|,
+//   |max_quantizer|, |thread_count|, |tile_columns|, |row_mt|, |undershoot|,
+//   |overshoot|, the buffer times, |max_keyframe_bitrate|,
+//   |error_resilient|, |screen_content|, |intra_refresh|,
+//   |scheduled_keyframes| and |bit_depth| from |VpxConfig| apply. Temporal
+//   layers, lookahead and the broadcast and capped quality profiles are
+//   rejected.
+// - Temporal delimiter OBUs are stripped from the frames, as WebM requires,
+//   and the sequence header is exported as an av1C record through
+//   |GetCodecPrivate()|.
+class AomEncoder : public VideoEncoderBackendInterface {
+ public:
+  enum {
+    // libaom reported an error.
+    kCodecError = VideoEncoder::kCodecError,
+    // Error within |AomEncoder|, but not reported by libaom.
+    kEncoderError = VideoEncoder::kEncoderError,
+    kNoMemory = VideoEncoder::kNoMemory,
+    kInvalidArg = VideoEncoder::kInvalidArg,
+    kSuccess = VideoEncoder::kSuccess,
+    kDropped = VideoEncoder::kDropped,
+    kNoFrame = VideoEncoder::kNoFrame,
+  };
+
+  // Range of the libaom realtime speed presets used.
+  static const int kMinSpeed = 7;
+  static const int kMaxSpeed = 10;
+
+  AomEncoder();
+  virtual ~AomEncoder();
+
+  // Initializes libaom for AV1 encoding of |config|, and builds the av1C
+  // record from the sequence header. Returns |kInvalidArg| for settings the
+  // realtime mode does not support, and |kCodecError| when libaom fails.
+  virtual int Init(const WebmEncoderConfig& config);
+
+  // Encodes |raw_frame| and returns the compressed data via |ptr_vpx_frame|.
+  // Returns |kDropped| when decimation or rate control dropped the frame.
+  virtual int EncodeFrame(const VideoFrame& raw_frame,
+                          VideoFrame* ptr_vpx_frame);
+
+  // Moves the oldest compressed frame left queued by |EncodeFrame()| or
+  // |Flush()| into |ptr_vpx_frame|. Returns |kNoFrame| when none is queued.
+  virtual int ReadQueuedFrame(VideoFrame* ptr_vpx_frame);
+
+  // Drains the frames libaom still holds into the output queue.
+  virtual int Flush();
+
+  // Requests a new target bitrate in kilobits per second. libaom is
+  // reconfigured before the next frame is encoded. Returns |kInvalidArg|
+  // when |kbps| is not greater than 0.
+  virtual int SetTargetBitrate(int kbps);
+
+  // Forces a keyframe at the first frame at or after |timestamp|. May be
+  // called from any thread.
+  virtual void RequestKeyframe(int64 timestamp) {
+    keyframe_request_.Request(timestamp);
+  }
+
+  // Raises the libaom speed by |steps|, up to |kMaxSpeed|. May be called
+  // from any thread.
+  virtual void SetSpeedBoost(int steps) {
+    requested_speed_boost_ = steps < 0 ? 0 : steps;
+  }
+
+  virtual void GetCodecPrivate(std::vector<uint8>* ptr_data) const {
+    *ptr_data = codec_private_;
+  }
+
+  // Accessors.
+  virtual int64 frames_in() const { return frames_in_; }
+  virtual int64 frames_out() const { return frames_out_; }
+  virtual int64 last_keyframe_time() const { return last_keyframe_time_; }
+  virtual int64 last_timestamp() const { return last_timestamp_; }
+
+ private:
+  // Passes |val| to libaom's aom_codec_control for |control_id|. Returns
+  // |kCodecError| when libaom rejects it.
+  int CodecControl(int control_id, int val);
+
+  // Builds |codec_private_| from the sequence header of the libaom context.
+  // Returns |kCodecError| when libaom does not return a valid one.
+  int BuildCodecPrivate();
+
+  // Applies |requested_bitrate_| and |requested_speed_boost_| when they
+  // changed. Returns |kCodecError| when libaom rejects a change.
+  int ApplyRequestedBitrate();
+  int ApplyRequestedSpeedBoost();
+
+  // Moves every compressed frame libaom has ready into |output_queue_|.
+  int QueuePackets();
+
+  int64 frames_in_;
+  int64 frames_out_;
+  int64 last_keyframe_time_;
+
+  // Timestamp of the most recent compressed frame returned, in milliseconds.
+  int64 last_timestamp_;
+
+  VpxConfig config_;
+
+  // libaom encoder context, and the configuration it was last given.
+  aom_codec_ctx_t aom_context_;
+  aom_codec_enc_cfg_t aom_config_;
+
+  // Bitrate requested by |SetTargetBitrate()|, or 0 when there is no pending
+  // request.
+  std::atomic<int> requested_bitrate_;
+  KeyframeRequest keyframe_request_;
+
+  // Configured libaom speed, and the boost requested by |SetSpeedBoost()|
+  // and applied.
+  int speed_;
+  std::atomic<int> requested_speed_boost_;
+  int speed_boost_;
+
+  // The av1C record of the stream.
+  std::vector<uint8> codec_private_;
+
+  // Compressed frames not yet returned, the frame packets are copied into
+  // before they are queued, and the configuration of the latest input frame.
+  BufferPool<VideoFrame> output_queue_;
+  VideoFrame packet_frame_;
+  VideoConfig last_raw_config_;
+
+  // Storage reserved in output frames, from |CompressedFrameCapacity()|.
+  // Grows when a frame does not fit.
+  int32 frame_capacity_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(AomEncoder);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_AOM_ENCODER_H_
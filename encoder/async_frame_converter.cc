@@ -0,0 +1,263 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/async_frame_converter.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/thread_placement.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+AsyncFrameConverter::AsyncFrameConverter()
+    : ptr_callback_(NULL),
+      output_width_(0),
+      output_height_(0),
+      stop_(false),
+      running_(false),
+      dropped_frames_(0),
+      plan_ready_(false) {
+}
+
+AsyncFrameConverter::~AsyncFrameConverter() {
+  Stop();
+}
+
+int AsyncFrameConverter::Init(VideoFrameCallbackInterface* ptr_callback,
+                              int num_slots,
+                              int32 output_width, int32 output_height) {
+  if (!ptr_callback || num_slots < 1) {
+    LOG(ERROR) << "AsyncFrameConverter needs a callback and slots.";
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (running_) {
+    LOG(ERROR) << "AsyncFrameConverter cannot Init while running.";
+    return kInvalidArg;
+  }
+  ptr_callback_ = ptr_callback;
+  output_width_ = output_width;
+  output_height_ = output_height;
+  plan_ready_ = false;
+  slots_.clear();
+  free_slots_.clear();
+  queued_slots_.clear();
+  for (int i = 0; i < num_slots; ++i) {
+    std::unique_ptr<Slot> slot(new (std::nothrow) Slot());  // NOLINT
+    if (!slot) {
+      return kNoMemory;
+    }
+    slots_.push_back(std::move(slot));
+    free_slots_.push_back(i);
+  }
+  return kSuccess;
+}
+
+int AsyncFrameConverter::Start() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (running_) {
+    return kSuccess;
+  }
+  if (!ptr_callback_) {
+    LOG(ERROR) << "AsyncFrameConverter cannot Start before Init.";
+    return kInvalidArg;
+  }
+  stop_ = false;
+  thread_.reset(new (std::nothrow) std::thread(  // NOLINT
+      &AsyncFrameConverter::ConvertThread, this));
+  if (!thread_) {
+    LOG(ERROR) << "AsyncFrameConverter cannot start its thread.";
+    return kThreadError;
+  }
+  running_ = true;
+  return kSuccess;
+}
+
+void AsyncFrameConverter::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+      return;
+    }
+    stop_ = true;
+  }
+  frame_queued_.notify_all();
+  thread_->join();
+  thread_.reset();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  dropped_frames_ += queued_slots_.size();
+  while (!queued_slots_.empty()) {
+    free_slots_.push_back(queued_slots_.front());
+    queued_slots_.pop_front();
+  }
+  running_ = false;
+}
+
+int AsyncFrameConverter::Submit(const VideoConfig& config,
+                                int64 timestamp_us, int64 duration_us,
+                                const uint8* ptr_data, int32 data_length) {
+  if (!ptr_data || data_length <= 0) {
+    return kInvalidArg;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!running_) {
+    return kNotRunning;
+  }
+  const int slot = TakeFreeSlot();
+  if (slot < 0) {
+    return kDropped;
+  }
+
+  // The slot belongs to this thread until it is queued; copy unlocked.
+  lock.unlock();
+  VideoFrame& storage = slots_[slot]->storage;
+  if (storage.buffer_capacity() < data_length &&
+      storage.Allocate(data_length)) {
+    LOG(ERROR) << "AsyncFrameConverter cannot allocate a raw frame.";
+    lock.lock();
+    free_slots_.push_back(slot);
+    return kNoMemory;
+  }
+  memcpy(storage.buffer(), ptr_data, data_length);
+  lock.lock();
+  QueueSlot(slot, config, timestamp_us, duration_us, data_length);
+  return kSuccess;
+}
+
+int AsyncFrameConverter::SubmitFrame(const VideoConfig& config,
+                                     int64 timestamp_us, int64 duration_us,
+                                     int32 data_length,
+                                     VideoFrame* ptr_frame) {
+  if (!ptr_frame || !ptr_frame->buffer() || data_length <= 0 ||
+      data_length > ptr_frame->buffer_capacity()) {
+    return kInvalidArg;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!running_) {
+    return kNotRunning;
+  }
+  const int slot = TakeFreeSlot();
+  if (slot < 0) {
+    return kDropped;
+  }
+  lock.unlock();
+
+  // |VideoFrame::Swap()| needs storage on both sides, and the caller needs
+  // back storage as large as what it gave.
+  VideoFrame& storage = slots_[slot]->storage;
+  if (storage.buffer_capacity() < ptr_frame->buffer_capacity() &&
+      storage.Allocate(ptr_frame->buffer_capacity())) {
+    LOG(ERROR) << "AsyncFrameConverter cannot allocate a raw frame.";
+    lock.lock();
+    free_slots_.push_back(slot);
+    return kNoMemory;
+  }
+  storage.Swap(ptr_frame);
+  lock.lock();
+  QueueSlot(slot, config, timestamp_us, duration_us, data_length);
+  return kSuccess;
+}
+
+bool AsyncFrameConverter::ScalesFrame(const VideoConfig& config, int32 width,
+                                      int32 height) {
+  return VideoFrame::NeedsConversion(config.format) &&
+      config.format != kVideoFormatMJPEG &&
+      config.format != kVideoFormatV210 &&
+      width > 0 && height > 0 &&
+      width <= config.width && height <= abs(config.height) &&
+      (width != config.width || height != abs(config.height));
+}
+
+int64 AsyncFrameConverter::dropped_frames() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_frames_;
+}
+
+int AsyncFrameConverter::TakeFreeSlot() {
+  if (free_slots_.empty()) {
+    ++dropped_frames_;
+    VLOG(1) << "AsyncFrameConverter dropped a frame (no free slot).";
+    return -1;
+  }
+  const int slot = free_slots_.back();
+  free_slots_.pop_back();
+  return slot;
+}
+
+void AsyncFrameConverter::QueueSlot(int slot, const VideoConfig& config,
+                                    int64 timestamp_us, int64 duration_us,
+                                    int32 data_length) {
+  Slot& queued = *slots_[slot];
+  queued.config = config;
+  queued.timestamp_us = timestamp_us;
+  queued.duration_us = duration_us;
+  queued.length = data_length;
+  queued_slots_.push_back(slot);
+  frame_queued_.notify_one();
+}
+
+void AsyncFrameConverter::ConvertThread() {
+  LOG(INFO) << "AsyncFrameConverter thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kCapture);
+  ScopedCpuStage cpu_stage(kCpuConversion);
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    frame_queued_.wait(lock, [this] {
+      return stop_ || !queued_slots_.empty();
+    });
+    if (stop_) {
+      break;
+    }
+    const int slot = queued_slots_.front();
+    queued_slots_.pop_front();
+    lock.unlock();
+    Convert(*slots_[slot]);
+    lock.lock();
+    free_slots_.push_back(slot);
+  }
+  LOG(INFO) << "AsyncFrameConverter thread done.";
+}
+
+void AsyncFrameConverter::Convert(const Slot& slot) {
+  const VideoConfig& planned = plan_.source_config();
+  if (!plan_ready_ || slot.config.format != planned.format ||
+      slot.config.width != planned.width ||
+      slot.config.height != planned.height ||
+      slot.config.stride != planned.stride) {
+    const bool scale = ScalesFrame(slot.config, output_width_, output_height_);
+    plan_ready_ = !plan_.Init(slot.config,
+                              scale ? output_width_ : slot.config.width,
+                              scale ? output_height_ : abs(slot.config.height));
+    if (!plan_ready_) {
+      LOG(ERROR) << "AsyncFrameConverter cannot plan format "
+                 << slot.config.format;
+      return;
+    }
+  }
+  const int status = frame_.Init(plan_,
+                                 true,  // always "keyframes"
+                                 0,
+                                 0,
+                                 slot.storage.buffer(),
+                                 slot.length);
+  if (status) {
+    LOG(ERROR) << "AsyncFrameConverter frame init failed: " << status;
+    return;
+  }
+  frame_.SetTimeUs(slot.timestamp_us, slot.duration_us);
+  const int frame_status = ptr_callback_->OnVideoFrameReceived(&frame_);
+  if (frame_status && frame_status != VideoFrameCallbackInterface::kDropped) {
+    LOG(ERROR) << "OnVideoFrameReceived failed, status=" << frame_status;
+  }
+}
+
+}  // namespace webmlive
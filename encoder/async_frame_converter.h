@@ -0,0 +1,141 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_ASYNC_FRAME_CONVERTER_H_
+#define WEBMLIVE_ENCODER_ASYNC_FRAME_CONVERTER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+#include "encoder/video_ingest_plan.h"
+
+namespace webmlive {
+
+// Converts captured frames to I420 on a thread of its own, so that capture
+// threads only hand frames over and return. Raw frames wait in a few slots;
+// the conversion thread initializes a |VideoFrame| from each in turn, scaling
+// it when an output size is set, and passes it to the frame callback.
+//
+// Notes
+// - Frames arriving while every slot is waiting or being converted are
+//   dropped, as capture devices drop frames nobody reads in time. They are
+//   counted by |dropped_frames()|.
+// - |SubmitFrame()| takes the raw frame by exchanging storage with a slot,
+//   so capture sources whose frames are |VideoFrame| storage hand them over
+//   without a copy.
+// - The callback is called only from the conversion thread.
+class AsyncFrameConverter {
+ public:
+  enum {
+    // Cannot start the conversion thread.
+    kThreadError = -4,
+    kNoMemory = -3,
+    kNotRunning = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+    // Every slot is in use; the frame was dropped.
+    kDropped = 1,
+  };
+
+  // Raw frames held: one converting, and the rest absorbing capture bursts.
+  static const int kDefaultSlots = 3;
+
+  AsyncFrameConverter();
+  ~AsyncFrameConverter();
+
+  // Stores |ptr_callback|, the number of slots, and the size frames are
+  // scaled to as |VideoFrame::InitScaled()| does when they need conversion
+  // and |ScalesFrame()| says so. Returns |kSuccess| when successful.
+  int Init(VideoFrameCallbackInterface* ptr_callback, int num_slots,
+           int32 output_width, int32 output_height);
+
+  // Starts the conversion thread. Returns |kSuccess| when successful, or
+  // when already running.
+  int Start();
+
+  // Stops and joins the conversion thread. Frames not yet converted are
+  // dropped.
+  void Stop();
+
+  // Copies the |data_length| bytes of raw frame at |ptr_data| to a free slot.
+  // Returns |kSuccess| when the frame is queued, |kDropped| when no slot is
+  // free, and |kNotRunning| before |Start()|.
+  int Submit(const VideoConfig& config, int64 timestamp_us,
+             int64 duration_us, const uint8* ptr_data, int32 data_length);
+
+  // Behaves as |Submit()| for the |data_length| bytes of raw frame in
+  // |ptr_frame->buffer()|, which are taken by swapping storage with a free
+  // slot. |ptr_frame| then holds storage of at least the same capacity.
+  int SubmitFrame(const VideoConfig& config, int64 timestamp_us,
+                  int64 duration_us, int32 data_length, VideoFrame* ptr_frame);
+
+  // Returns true when frames of |config| are scaled while they are converted
+  // to |width| x |height|: formats |VideoFrame::InitScaled()| accepts, and
+  // sizes that are smaller, but not larger, in both dimensions.
+  static bool ScalesFrame(const VideoConfig& config, int32 width,
+                          int32 height);
+
+  int64 dropped_frames() const;
+
+ private:
+  // Raw frame waiting for conversion. |storage| only holds the bytes.
+  struct Slot {
+    VideoFrame storage;
+    VideoConfig config;
+    int64 timestamp_us;
+    int64 duration_us;
+    int32 length;
+  };
+
+  // Returns the index of a free slot, or -1 after counting a dropped frame.
+  // |mutex_| must be held.
+  int TakeFreeSlot();
+
+  // Queues |slot| for conversion. |mutex_| must be held.
+  void QueueSlot(int slot, const VideoConfig& config, int64 timestamp_us,
+                 int64 duration_us, int32 data_length);
+
+  // Converts queued slots until |Stop()|. Thread function.
+  void ConvertThread();
+
+  // Converts |slot| to |frame_| and passes it to the callback.
+  void Convert(const Slot& slot);
+
+  VideoFrameCallbackInterface* ptr_callback_;
+  int32 output_width_;
+  int32 output_height_;
+
+  // Slot state. Protected by |mutex_|; a slot taken by |ConvertThread()| is
+  // in neither list.
+  mutable std::mutex mutex_;
+  std::condition_variable frame_queued_;
+  std::vector<std::unique_ptr<Slot>> slots_;
+  std::vector<int> free_slots_;
+  std::deque<int> queued_slots_;
+  bool stop_;
+  bool running_;
+  int64 dropped_frames_;
+
+  // Converted frame passed to the callback, and the plan for the format of
+  // the last frame converted, rebuilt when the format changes. Used only by
+  // |ConvertThread()|.
+  VideoFrame frame_;
+  VideoIngestPlan plan_;
+  bool plan_ready_;
+  std::unique_ptr<std::thread> thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(AsyncFrameConverter);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_ASYNC_FRAME_CONVERTER_H_
@@ -0,0 +1,237 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/async_log_sink.h"
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <new>
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/metrics.h"
+#include "encoder/thread_placement.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+// One message. |sequence| tells who owns the slot: it equals the position of
+// the next |Put()| into the slot when the slot is free, and that position
+// plus one once the message is in it.
+struct AsyncLogSink::Slot {
+  Slot() : sequence(0), severity(0), force_flush(false), timestamp(0),
+           length(0) {}
+  std::atomic<uint64> sequence;
+  int severity;
+  bool force_flush;
+  time_t timestamp;
+  int length;
+  char message[kMaxMessageBytes];
+};
+
+// Installed in place of glog's file logger of one severity. Deleted by glog
+// when replaced.
+class AsyncLogSink::RingLogger : public google::base::Logger {
+ public:
+  RingLogger(AsyncLogSink* ptr_sink, int severity)
+      : ptr_sink_(ptr_sink), severity_(severity) {}
+  virtual ~RingLogger() {}
+
+  virtual void Write(bool force_flush, time_t timestamp, const char* message,
+                     int message_len) {
+    if (!ptr_sink_->Put(severity_, force_flush, timestamp, message,
+                        message_len)) {
+      ptr_sink_->dropped_messages_.fetch_add(1);
+    }
+    if (severity_ == GLOG_FATAL) {
+      // glog aborts once this returns.
+      ptr_sink_->Drain();
+      ptr_sink_->file_loggers_[severity_]->Flush();
+    }
+  }
+
+  virtual void Flush() {
+    ptr_sink_->Drain();
+    ptr_sink_->file_loggers_[severity_]->Flush();
+  }
+
+  virtual uint32 LogSize() {
+    return ptr_sink_->file_loggers_[severity_]->LogSize();
+  }
+
+ private:
+  AsyncLogSink* const ptr_sink_;
+  const int severity_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(RingLogger);
+};
+
+AsyncLogSink::AsyncLogSink()
+    : put_position_(0),
+      take_position_(0),
+      running_(false),
+      stop_(false),
+      dropped_messages_(0),
+      reported_drops_(0),
+      ptr_dropped_messages_(NULL) {
+  for (int i = 0; i < kNumSeverities; ++i) {
+    file_loggers_[i] = NULL;
+  }
+}
+
+AsyncLogSink::~AsyncLogSink() {
+}
+
+AsyncLogSink& AsyncLogSink::Instance() {
+  static AsyncLogSink sink;
+  return sink;
+}
+
+int AsyncLogSink::Start() {
+  if (running_) {
+    LOG(ERROR) << "AsyncLogSink already started.";
+    return kInvalidArg;
+  }
+  if (!slots_) {
+    slots_.reset(new (std::nothrow) Slot[kRingSlots]);  // NOLINT
+    if (!slots_) {
+      LOG(ERROR) << "out of memory allocating the log ring.";
+      return kNoMemory;
+    }
+  }
+  for (int i = 0; i < kRingSlots; ++i) {
+    slots_[i].sequence = i;
+  }
+  put_position_ = 0;
+  take_position_ = 0;
+  ptr_dropped_messages_ = MetricsRegistry::Instance().GetCounter(
+      "webmlive_log_dropped_messages_total", "",
+      "Log messages dropped because the asynchronous log ring was full.");
+  if (!ptr_dropped_messages_) {
+    return kNoMemory;
+  }
+
+  stop_ = false;
+  using std::bind;
+  writer_thread_.reset(new (std::nothrow) std::thread(  // NOLINT
+      bind(&AsyncLogSink::WriterThread, this)));
+  if (!writer_thread_) {
+    LOG(ERROR) << "cannot create log writer thread.";
+    return kNoMemory;
+  }
+  for (int i = 0; i < kNumSeverities; ++i) {
+    file_loggers_[i] = google::base::GetLogger(i);
+    RingLogger* const ptr_logger =
+        new (std::nothrow) RingLogger(this, i);  // NOLINT
+    if (ptr_logger)
+      google::base::SetLogger(i, ptr_logger);
+  }
+  running_ = true;
+  LOG(INFO) << "asynchronous logging started.";
+  return kSuccess;
+}
+
+void AsyncLogSink::Stop() {
+  if (!running_) {
+    return;
+  }
+  // Messages logged from here on go straight to the files.
+  for (int i = 0; i < kNumSeverities; ++i) {
+    google::base::SetLogger(i, file_loggers_[i]);
+  }
+  stop_ = true;
+  if (writer_thread_->joinable())
+    writer_thread_->join();
+  writer_thread_.reset();
+  running_ = false;
+}
+
+bool AsyncLogSink::Put(int severity, bool force_flush, time_t timestamp,
+                       const char* message, int message_len) {
+  uint64 position = put_position_.load(std::memory_order_relaxed);
+  Slot* ptr_slot = NULL;
+  for (;;) {
+    ptr_slot = &slots_[position % kRingSlots];
+    const uint64 sequence = ptr_slot->sequence.load(std::memory_order_acquire);
+    if (sequence == position) {
+      if (put_position_.compare_exchange_weak(position, position + 1,
+                                              std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (sequence < position) {
+      // The slot still holds the message put one lap ago: the ring is full.
+      return false;
+    } else {
+      position = put_position_.load(std::memory_order_relaxed);
+    }
+  }
+
+  int length = message_len;
+  if (length > kMaxMessageBytes) {
+    length = kMaxMessageBytes;
+  }
+  memcpy(ptr_slot->message, message, length);
+  if (length < message_len && length > 0) {
+    ptr_slot->message[length - 1] = '\n';
+  }
+  ptr_slot->severity = severity;
+  ptr_slot->force_flush = force_flush;
+  ptr_slot->timestamp = timestamp;
+  ptr_slot->length = length;
+  ptr_slot->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+void AsyncLogSink::Drain() {
+  const uint64 position = put_position_.load();
+  const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(kDrainTimeoutMs);
+  while (take_position_.load() < position &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+int AsyncLogSink::WriteQueuedMessages() {
+  int num_written = 0;
+  for (;;) {
+    const uint64 position = take_position_.load(std::memory_order_relaxed);
+    Slot& slot = slots_[position % kRingSlots];
+    if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+      break;
+    }
+    file_loggers_[slot.severity]->Write(slot.force_flush, slot.timestamp,
+                                        slot.message, slot.length);
+    slot.sequence.store(position + kRingSlots, std::memory_order_release);
+    take_position_.store(position + 1);
+    ++num_written;
+  }
+
+  const int64 dropped_messages = dropped_messages_.load();
+  if (dropped_messages > reported_drops_) {
+    ptr_dropped_messages_->Increment(dropped_messages - reported_drops_);
+    reported_drops_ = dropped_messages;
+    // Logged through the ring like any other message.
+    LOG(WARNING) << "log ring full, " << dropped_messages
+                 << " log messages dropped so far.";
+  }
+  return num_written;
+}
+
+void AsyncLogSink::WriterThread() {
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kUpload);
+  ScopedCpuStage cpu_stage(kCpuUpload);
+  while (!stop_) {
+    if (WriteQueuedMessages() == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(kIdleWaitMs));
+    }
+  }
+  // |Stop()| removed the ring loggers; write what is left.
+  WriteQueuedMessages();
+}
+
+}  // namespace webmlive
@@ -0,0 +1,133 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_ASYNC_LOG_SINK_H_
+#define WEBMLIVE_ENCODER_ASYNC_LOG_SINK_H_
+
+#include <time.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "encoder/basictypes.h"
+
+namespace google {
+namespace base {
+class Logger;
+}  // namespace base
+}  // namespace google
+
+namespace webmlive {
+
+class Metric;
+
+// Moves glog's log file writes off the threads that log. Once started, the
+// file logger of each severity is replaced by one that copies the formatted
+// message into a lock free ring and returns; a writer thread takes messages
+// from the ring and hands them to glog's own file loggers, which write,
+// flush and rotate the log files (see --max_log_size). A slow disk, or a
+// burst of messages, then delays only the writer thread, never the capture,
+// encode or upload threads.
+//
+//   google::InitGoogleLogging(argv[0]);
+//   AsyncLogSink::Instance().Start();
+//   ...
+//   AsyncLogSink::Instance().Stop();
+//   google::ShutdownGoogleLogging();
+//
+// Notes
+// - Producers never wait: when the ring is full the message is dropped. The
+//   writer logs how many were dropped, and they are counted by the
+//   webmlive_log_dropped_messages_total metric.
+// - Messages longer than |kMaxMessageBytes| are truncated.
+// - A FATAL message waits for the ring to drain, so it, and the messages
+//   before it, reach the file before glog aborts. |google::FlushLogFiles()|
+//   waits the same way.
+// - Only file output is moved. Output glog writes to stderr
+//   (--logtostderr, --alsologtostderr, --stderrthreshold) stays synchronous.
+class AsyncLogSink {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Messages the ring holds.
+  static const int kRingSlots = 1024;
+
+  // Longest message copied into the ring, including its newline.
+  static const int kMaxMessageBytes = 1024;
+
+  static AsyncLogSink& Instance();
+
+  // Starts the writer thread and installs the ring loggers. Returns
+  // |kSuccess|, or |kInvalidArg| when already started.
+  int Start();
+
+  // Writes the messages left in the ring, stops the writer thread, and gives
+  // glog back its file loggers. Must be called before
+  // |google::ShutdownGoogleLogging()|.
+  void Stop();
+
+  bool running() const { return running_.load(); }
+
+  // Returns the number of messages dropped because the ring was full.
+  int64 dropped_messages() const { return dropped_messages_.load(); }
+
+ private:
+  class RingLogger;
+  struct Slot;
+
+  // glog's INFO, WARNING, ERROR and FATAL.
+  static const int kNumSeverities = 4;
+
+  // Longest wait of |Drain()|.
+  static const int kDrainTimeoutMs = 1000;
+
+  // Writer thread sleep when the ring is empty.
+  static const int kIdleWaitMs = 10;
+
+  AsyncLogSink();
+  ~AsyncLogSink();
+
+  // Copies a message into the ring. Returns false when the ring is full.
+  bool Put(int severity, bool force_flush, time_t timestamp,
+           const char* message, int message_len);
+
+  // Waits, for up to |kDrainTimeoutMs|, until the writer thread has written
+  // the messages put before the call.
+  void Drain();
+
+  // Writes the messages in the ring to the file loggers. Returns the number
+  // written.
+  int WriteQueuedMessages();
+
+  // Writer thread function.
+  void WriterThread();
+
+  // glog's file loggers, written by the writer thread. Set by |Start()|.
+  google::base::Logger* file_loggers_[kNumSeverities];
+
+  // Ring of |kRingSlots| messages. Positions only grow; a position's slot is
+  // its value modulo |kRingSlots|.
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<uint64> put_position_;
+  std::atomic<uint64> take_position_;
+  std::atomic<bool> running_;
+  std::atomic<bool> stop_;
+  std::atomic<int64> dropped_messages_;
+  int64 reported_drops_;
+  Metric* ptr_dropped_messages_;
+  std::unique_ptr<std::thread> writer_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(AsyncLogSink);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_ASYNC_LOG_SINK_H_
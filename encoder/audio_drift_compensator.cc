@@ -0,0 +1,317 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/audio_drift_compensator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "encoder/pcm_deinterleave.h"
+#include "glog/logging.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WEBMLIVE_HAVE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define WEBMLIVE_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace webmlive {
+
+namespace {
+// Frames of the previous buffer kept ahead of each plane: the cubic needs one
+// frame before the output position and two after it.
+const int kHistory = 3;
+
+// Catmull-Rom interpolation between |x0| and |x1| at |f| in [0, 1).
+inline float Cubic(float xm1, float x0, float x1, float x2, float f) {
+  const float c0 = x1 - xm1;
+  const float c1 = 2.0f * xm1 - 5.0f * x0 + 4.0f * x1 - x2;
+  const float c2 = 3.0f * (x0 - x1) + x2 - xm1;
+  return x0 + 0.5f * f * (c0 + f * (c1 + f * c2));
+}
+
+// Interpolates |ptr_plane|, |length| frames, at |*ptr_position|, advancing
+// |step| frames per output frame until the position leaves the frames the
+// cubic can reach. Returns the number of frames written to |ptr_output|, and
+// the position after the last in |*ptr_position|.
+//
+// |step| is within a fraction of a percent of 1, so four consecutive outputs
+// nearly always read four consecutive groups of input frames; those are
+// interpolated together with contiguous loads, and the rest one at a time.
+int ResamplePlane(const float* ptr_plane, int length, double step,
+                  double* ptr_position, float* ptr_output) {
+  double position = *ptr_position;
+  const double block_drift = 3.0 * (step - 1.0);
+  int num_output = 0;
+#if defined(WEBMLIVE_HAVE_SSE2) || defined(WEBMLIVE_HAVE_NEON)
+  const float d = static_cast<float>(step - 1.0);
+  const float offsets[4] = {0.0f, d, 2.0f * d, 3.0f * d};
+#endif
+  for (;;) {
+    const int k = static_cast<int>(position);
+    const double f0 = position - k;
+#if defined(WEBMLIVE_HAVE_SSE2)
+    if (k + 5 < length && f0 + block_drift >= 0.0 &&
+        f0 + block_drift < 1.0) {
+      const float* const w = ptr_plane + k;
+      const __m128 xm1 = _mm_loadu_ps(w - 1);
+      const __m128 x0 = _mm_loadu_ps(w);
+      const __m128 x1 = _mm_loadu_ps(w + 1);
+      const __m128 x2 = _mm_loadu_ps(w + 2);
+      const __m128 f = _mm_add_ps(_mm_set1_ps(static_cast<float>(f0)),
+                                  _mm_loadu_ps(offsets));
+      const __m128 c0 = _mm_sub_ps(x1, xm1);
+      const __m128 c1 = _mm_sub_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.0f), xm1),
+                     _mm_mul_ps(_mm_set1_ps(4.0f), x1)),
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(5.0f), x0), x2));
+      const __m128 c2 = _mm_sub_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_sub_ps(x0, x1)), x2),
+          xm1);
+      __m128 y = _mm_add_ps(c1, _mm_mul_ps(f, c2));
+      y = _mm_add_ps(c0, _mm_mul_ps(f, y));
+      y = _mm_add_ps(x0, _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), f), y));
+      _mm_storeu_ps(ptr_output + num_output, y);
+      num_output += 4;
+      position += 4.0 * step;
+      continue;
+    }
+#elif defined(WEBMLIVE_HAVE_NEON)
+    if (k + 5 < length && f0 + block_drift >= 0.0 &&
+        f0 + block_drift < 1.0) {
+      const float* const w = ptr_plane + k;
+      const float32x4_t xm1 = vld1q_f32(w - 1);
+      const float32x4_t x0 = vld1q_f32(w);
+      const float32x4_t x1 = vld1q_f32(w + 1);
+      const float32x4_t x2 = vld1q_f32(w + 2);
+      const float32x4_t f =
+          vaddq_f32(vdupq_n_f32(static_cast<float>(f0)), vld1q_f32(offsets));
+      const float32x4_t c0 = vsubq_f32(x1, xm1);
+      const float32x4_t c1 = vsubq_f32(
+          vaddq_f32(vmulq_n_f32(xm1, 2.0f), vmulq_n_f32(x1, 4.0f)),
+          vaddq_f32(vmulq_n_f32(x0, 5.0f), x2));
+      const float32x4_t c2 = vsubq_f32(
+          vaddq_f32(vmulq_n_f32(vsubq_f32(x0, x1), 3.0f), x2), xm1);
+      float32x4_t y = vmlaq_f32(c1, f, c2);
+      y = vmlaq_f32(c0, f, y);
+      y = vmlaq_f32(x0, vmulq_n_f32(f, 0.5f), y);
+      vst1q_f32(ptr_output + num_output, y);
+      num_output += 4;
+      position += 4.0 * step;
+      continue;
+    }
+#else
+    (void)block_drift;
+#endif
+    if (position >= length - 2) {
+      break;
+    }
+    const float* const w = ptr_plane + k;
+    ptr_output[num_output++] =
+        Cubic(w[-1], w[0], w[1], w[2], static_cast<float>(f0));
+    position += step;
+  }
+  *ptr_position = position;
+  return num_output;
+}
+}  // namespace
+
+const double AudioDriftCompensator::kMaxRatioDeviation = 0.002;
+
+AudioDriftCompensator::AudioDriftCompensator()
+    : initialized_(false),
+      sample_rate_(0),
+      channels_(0),
+      anchor_timestamp_(0),
+      input_frames_(0),
+      output_frames_(0),
+      rate_(1.0),
+      ratio_(1.0),
+      sync_error_ms_(0),
+      position_(0) {}
+
+int AudioDriftCompensator::Process(AudioBuffer* ptr_buffer) {
+  if (!ptr_buffer || !ptr_buffer->buffer()) {
+    LOG(ERROR) << "AudioDriftCompensator cannot Process an empty buffer.";
+    return kInvalidArg;
+  }
+  const AudioConfig config = ptr_buffer->config();
+  const bool planar = ptr_buffer->planar();
+  const bool s16 = config.format_tag == kAudioFormatPcm &&
+                   config.bits_per_sample == 16;
+  const bool f32 = config.format_tag == kAudioFormatIeeeFloat &&
+                   config.bits_per_sample == 32;
+  const int channels = config.channels;
+  if ((!s16 && !f32) || channels <= 0 ||
+      channels > AudioBuffer::kMaxPlanarChannels ||
+      config.block_align != channels * (config.bits_per_sample / 8) ||
+      config.sample_rate == 0) {
+    LOG(ERROR) << "AudioDriftCompensator supports 16 bit PCM and 32 bit "
+               << "float audio of up to 8 channels.";
+    return kInvalidArg;
+  }
+  if (initialized_ && (channels != channels_ ||
+                       static_cast<int>(config.sample_rate) != sample_rate_)) {
+    LOG(ERROR) << "AudioDriftCompensator audio format changed.";
+    return kInvalidArg;
+  }
+  const int32 num_frames = ptr_buffer->num_frames();
+  if (num_frames <= 0) {
+    return kSuccess;
+  }
+
+  // Each plane of |work_| is the history followed by the buffer.
+  const int length = kHistory + num_frames;
+  if (work_.size() < static_cast<size_t>(length) * channels) {
+    work_.resize(static_cast<size_t>(length) * channels);
+  }
+  float* ptr_planes[AudioBuffer::kMaxPlanarChannels];
+  float* ptr_inputs[AudioBuffer::kMaxPlanarChannels];
+  for (int c = 0; c < channels; ++c) {
+    ptr_planes[c] = &work_[c * length];
+    ptr_inputs[c] = ptr_planes[c] + kHistory;
+  }
+  if (planar) {
+    for (int c = 0; c < channels; ++c) {
+      memcpy(ptr_inputs[c], ptr_buffer->plane(c),
+             num_frames * sizeof(ptr_inputs[c][0]));
+    }
+  } else if (s16) {
+    DeinterleaveS16ToFloat(reinterpret_cast<const int16*>(ptr_buffer->buffer()),
+                           num_frames, channels, ptr_inputs);
+  } else {
+    DeinterleaveFloat(reinterpret_cast<const float*>(ptr_buffer->buffer()),
+                      num_frames, channels, ptr_inputs);
+  }
+  if (!initialized_) {
+    // Start on the first frame, repeated as history.
+    history_.resize(kHistory * channels);
+    for (int c = 0; c < channels; ++c) {
+      std::fill(&history_[c * kHistory], &history_[c * kHistory] + kHistory,
+                ptr_inputs[c][0]);
+    }
+    sample_rate_ = config.sample_rate;
+    channels_ = channels;
+    position_ = 1.0;
+  }
+  for (int c = 0; c < channels; ++c) {
+    memcpy(ptr_planes[c], &history_[c * kHistory],
+           kHistory * sizeof(history_[0]));
+  }
+
+  UpdateRatio(ptr_buffer->timestamp(), num_frames);
+  initialized_ = true;
+
+  // Resample every plane from the same position.
+  const double step = 1.0 / ratio_;
+  const int max_output = static_cast<int>(
+      (length - position_) * (1.0 + 2 * kMaxRatioDeviation)) + 8;
+  if (output_.size() < static_cast<size_t>(max_output) * channels) {
+    output_.resize(static_cast<size_t>(max_output) * channels);
+  }
+  int num_output = 0;
+  double end_position = position_;
+  for (int c = 0; c < channels; ++c) {
+    end_position = position_;
+    num_output = ResamplePlane(ptr_planes[c], length, step, &end_position,
+                               &output_[c * max_output]);
+    // Keep the last frames as history of the next buffer.
+    memcpy(&history_[c * kHistory], ptr_planes[c] + length - kHistory,
+           kHistory * sizeof(history_[0]));
+  }
+  position_ = end_position - (length - kHistory);
+  input_frames_ += num_frames;
+  output_frames_ += num_output;
+  if (num_output == 0) {
+    // A buffer of a frame or two can end before the next output frame.
+    return kNoOutput;
+  }
+  return WriteOutput(config, planar, ptr_buffer->timestamp(), num_output,
+                     max_output, ptr_buffer);
+}
+
+int64 AudioDriftCompensator::drift_ppm() const {
+  return static_cast<int64>(std::floor((rate_ - 1.0) * 1e6 + 0.5));
+}
+
+void AudioDriftCompensator::UpdateRatio(int64 timestamp, int32 num_frames) {
+  if (!initialized_) {
+    anchor_timestamp_ = timestamp;
+    input_frames_ = 0;
+    output_frames_ = 0;
+  } else {
+    const double output_time_ms =
+        anchor_timestamp_ + output_frames_ * 1000.0 / sample_rate_;
+    const double error_ms = timestamp - output_time_ms;
+    if (std::fabs(error_ms - sync_error_ms_) > kDiscontinuityMs) {
+      LOG(INFO) << "AudioDriftCompensator timestamps jumped by "
+                << (error_ms - sync_error_ms_) << " ms; restarting.";
+      anchor_timestamp_ = timestamp;
+      input_frames_ = 0;
+      output_frames_ = 0;
+      sync_error_ms_ = 0;
+    } else {
+      const double buffer_ms = num_frames * 1000.0 / sample_rate_;
+      const double weight =
+          std::min(1.0, buffer_ms / static_cast<double>(kSmoothingTimeMs));
+      sync_error_ms_ += (error_ms - sync_error_ms_) * weight;
+    }
+    const double input_time_ms = input_frames_ * 1000.0 / sample_rate_;
+    if (input_time_ms >= kWarmupMs) {
+      rate_ = (timestamp - anchor_timestamp_) / input_time_ms;
+    }
+  }
+  const double ratio =
+      rate_ * (1.0 + sync_error_ms_ / static_cast<double>(kCorrectionTimeMs));
+  ratio_ = std::max(1.0 - kMaxRatioDeviation,
+                    std::min(1.0 + kMaxRatioDeviation, ratio));
+}
+
+int AudioDriftCompensator::WriteOutput(const AudioConfig& config, bool planar,
+                                       int64 timestamp, int32 num_frames,
+                                       int32 stride, AudioBuffer* ptr_buffer) {
+  const int channels = config.channels;
+  const size_t sample_size = config.bits_per_sample / 8;
+  interleaved_.resize(static_cast<size_t>(num_frames) * channels * sample_size);
+  if (!planar && config.bits_per_sample == 16) {
+    int16* const ptr_out = reinterpret_cast<int16*>(&interleaved_[0]);
+    for (int c = 0; c < channels; ++c) {
+      const float* const ptr_in = &output_[c * stride];
+      for (int i = 0; i < num_frames; ++i) {
+        const float s = std::floor(ptr_in[i] * 32768.0f + 0.5f);
+        ptr_out[i * channels + c] =
+            static_cast<int16>(std::max(-32768.0f, std::min(32767.0f, s)));
+      }
+    }
+  } else {
+    float* const ptr_out = reinterpret_cast<float*>(&interleaved_[0]);
+    for (int c = 0; c < channels; ++c) {
+      const float* const ptr_in = &output_[c * stride];
+      for (int i = 0; i < num_frames; ++i) {
+        ptr_out[i * channels + c] = ptr_in[i];
+      }
+    }
+  }
+  const int64 duration = num_frames * 1000LL / sample_rate_;
+  const int32 length = static_cast<int32>(interleaved_.size());
+  const int status =
+      planar ? ptr_buffer->InitPlanar(config, timestamp, duration,
+                                      &interleaved_[0], length)
+             : ptr_buffer->Init(config, timestamp, duration, &interleaved_[0],
+                                length);
+  if (status) {
+    LOG(ERROR) << "AudioDriftCompensator cannot write output: " << status;
+    return status == AudioBuffer::kNoMemory ? kNoMemory : kInvalidArg;
+  }
+  return kSuccess;
+}
+
+}  // namespace webmlive
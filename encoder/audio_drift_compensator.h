@@ -0,0 +1,120 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_AUDIO_DRIFT_COMPENSATOR_H_
+#define WEBMLIVE_ENCODER_AUDIO_DRIFT_COMPENSATOR_H_
+
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Keeps the audio sample clock locked to the capture clock that timestamps
+// audio buffers and video frames.
+//
+// Audio encoders timestamp their output by counting samples from the first
+// input buffer, so a capture device whose sample clock runs fast or slow
+// relative to the capture clock moves audio away from video by a constant
+// rate: 100 ppm is 8.6 seconds a day, which the muxers absorb by buffering
+// ever more audio. |Process()| measures the rate from the buffer timestamps,
+// and resamples each buffer by a ratio that cancels it, so that the sample
+// count tracks the timestamps and A/V sync and buffering stay bounded however
+// long the encode runs.
+//
+// Notes
+// - The ratio is the measured rate, times a correction that removes the
+//   remaining sync error over |kCorrectionTimeMs|. The error is smoothed to
+//   ignore capture jitter, and the ratio stays within |kMaxRatioDeviation|
+//   of 1, which is inaudible.
+// - Until |kWarmupMs| of audio has been seen, the rate is assumed to be 1.
+// - A timestamp jump larger than |kDiscontinuityMs|, for example after the
+//   source restarts, is accepted as it is: measurement starts over.
+// - Resampling uses 4 point cubic interpolation, with SSE2 or NEON when the
+//   target supports them. It delays audio by 2 samples.
+// - Buffers keep their layout: interleaved 16 bit or float, or planar.
+class AudioDriftCompensator {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+    // The buffer produced no output frames, and must not be encoded.
+    kNoOutput = 1,
+  };
+
+  // Audio measured before the rate is trusted.
+  static const int64 kWarmupMs = 10000;
+
+  // Time over which a sync error is corrected.
+  static const int64 kCorrectionTimeMs = 30000;
+
+  // Time constant of the sync error smoothing.
+  static const int64 kSmoothingTimeMs = 5000;
+
+  // Sync error beyond which the timestamps are assumed to have jumped.
+  static const int64 kDiscontinuityMs = 250;
+
+  // Largest deviation of the resampling ratio from 1.
+  static const double kMaxRatioDeviation;
+
+  AudioDriftCompensator();
+  ~AudioDriftCompensator() {}
+
+  // Resamples the samples in |ptr_buffer| in place. The first buffer sets the
+  // sample rate and channel count; buffers with others are rejected. Returns
+  // |kSuccess| when successful, and |kNoOutput| when |ptr_buffer| was too
+  // short to produce a frame.
+  int Process(AudioBuffer* ptr_buffer);
+
+  // Rate of the sample clock relative to the capture clock, in parts per
+  // million, and the smoothed sync error in milliseconds: positive when the
+  // audio timeline lags the timestamps.
+  int64 drift_ppm() const;
+  double sync_error_ms() const { return sync_error_ms_; }
+
+ private:
+  // Updates |ratio_| from the buffer starting at |timestamp| holding
+  // |num_frames| frames.
+  void UpdateRatio(int64 timestamp, int32 num_frames);
+
+  // Writes |num_frames| frames from |output_|, whose planes are |stride|
+  // frames apart, into |ptr_buffer| in the layout of |config| and |planar|.
+  // Returns |kSuccess| when successful.
+  int WriteOutput(const AudioConfig& config, bool planar, int64 timestamp,
+                  int32 num_frames, int32 stride, AudioBuffer* ptr_buffer);
+
+  bool initialized_;
+  int sample_rate_;
+  int channels_;
+
+  // Timestamp and frame counts of the measurement: the first buffer since
+  // the last discontinuity, the frames read since, and the frames written.
+  int64 anchor_timestamp_;
+  int64 input_frames_;
+  int64 output_frames_;
+
+  double rate_;
+  double ratio_;
+  double sync_error_ms_;
+
+  // Position of the next output frame in the planes of |work_|, which hold
+  // the last frames of the previous buffer, kept in |history_|, followed by
+  // the current buffer. |output_| holds the resampled planes, and
+  // |interleaved_| the output in the buffer's sample format.
+  double position_;
+  std::vector<float> history_;
+  std::vector<float> work_;
+  std::vector<float> output_;
+  std::vector<uint8> interleaved_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(AudioDriftCompensator);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_AUDIO_DRIFT_COMPENSATOR_H_
@@ -0,0 +1,256 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/audio_encode_worker.h"
+
+#include <chrono>
+#include <functional>
+
+#include "encoder/buffer_pool-inl.h"
+#include "encoder/cpu_accounting.h"
+#include "encoder/thread_placement.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+AudioEncodeWorker::AudioEncodeWorker()
+    : codec_(kAudioFormatVorbis),
+      sample_rate_(0),
+      input_signaled_(false),
+      stop_(false),
+      status_(kSuccess),
+      ptr_scheduler_(NULL) {
+}
+
+AudioEncodeWorker::~AudioEncodeWorker() {
+  if (worker_thread_ || strand_) {
+    Stop();
+  }
+}
+
+int AudioEncodeWorker::Init(const WebmEncoderConfig& config) {
+  const int default_count = BufferPool<AudioBuffer>::kDefaultBufferCount;
+  if (input_pool_.Init(true, default_count) ||
+      output_pool_.Init(true, default_count)) {
+    LOG(ERROR) << "AudioEncodeWorker buffer pool Init failed.";
+    return kNoMemory;
+  }
+
+  codec_ = config.audio_codec;
+  sample_rate_ = config.actual_audio_config.sample_rate;
+  ptr_scheduler_ = config.task_scheduler;
+  int status = VorbisEncoder::kUnsupportedFormat;
+  if (codec_ == kAudioFormatVorbis) {
+    status = vorbis_encoder_.Init(config.actual_audio_config,
+                                  config.vorbis_config);
+  } else if (codec_ == kAudioFormatOpus) {
+    status = opus_encoder_.Init(config.actual_audio_config,
+                                config.opus_config);
+  }
+  if (status) {
+    LOG(ERROR) << "AudioEncodeWorker audio encoder Init failed: " << status;
+    return kAudioEncoderError;
+  }
+  return kSuccess;
+}
+
+int AudioEncodeWorker::Run() {
+  if (worker_thread_ || strand_) {
+    LOG(ERROR) << "AudioEncodeWorker already running.";
+    return kThreadError;
+  }
+  if (ptr_scheduler_) {
+    strand_.reset(new (std::nothrow) TaskStrand(ptr_scheduler_));  // NOLINT
+    if (!strand_) {
+      LOG(ERROR) << "AudioEncodeWorker cannot construct task strand.";
+      return kThreadError;
+    }
+    return kSuccess;
+  }
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  worker_thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&AudioEncodeWorker::WorkerThread,  // NOLINT
+                                this)));
+  if (!worker_thread_) {
+    LOG(ERROR) << "AudioEncodeWorker cannot construct thread.";
+    return kThreadError;
+  }
+  return kSuccess;
+}
+
+void AudioEncodeWorker::Stop() {
+  CHECK(worker_thread_ || strand_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  input_ready_.notify_one();
+  if (worker_thread_) {
+    worker_thread_->join();
+    worker_thread_.reset();
+    return;
+  }
+
+  // Compress what the cancelled tasks left behind.
+  strand_->Cancel();
+  strand_.reset();
+  if (CheckStatus() == kSuccess) {
+    const int status = EncodeQueuedBuffers();
+    std::lock_guard<std::mutex> lock(mutex_);
+    status_ = status;
+  }
+}
+
+int AudioEncodeWorker::EncodeBuffer(AudioBuffer* ptr_buffer) {
+  if (!ptr_buffer) {
+    LOG(ERROR) << "AudioEncodeWorker cannot encode NULL buffer.";
+    return kInvalidArg;
+  }
+  const int status = input_pool_.Commit(ptr_buffer);
+  if (status) {
+    LOG(ERROR) << "AudioEncodeWorker input Commit failed: " << status;
+    return kNoMemory;
+  }
+  if (strand_) {
+    strand_->Post(TaskScheduler::NowMilliseconds(),
+                  std::bind(&AudioEncodeWorker::EncodeTask, this));
+    return kSuccess;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    input_signaled_ = true;
+  }
+  input_ready_.notify_one();
+  return kSuccess;
+}
+
+int AudioEncodeWorker::ReadEncodedBuffer(AudioBuffer* ptr_buffer) {
+  const int status = output_pool_.Decommit(ptr_buffer);
+  if (status == BufferPool<AudioBuffer>::kEmpty) {
+    return kNoBuffers;
+  } else if (status) {
+    LOG(ERROR) << "AudioEncodeWorker output Decommit failed: " << status;
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+int AudioEncodeWorker::CheckStatus() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return status_;
+}
+
+bool AudioEncodeWorker::WaitForInput() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  input_ready_.wait_for(lock, std::chrono::milliseconds(kMaxIdleWaitMs),
+                        [this] { return stop_ || input_signaled_; });
+  input_signaled_ = false;
+  return stop_ && input_pool_.IsEmpty();
+}
+
+int AudioEncodeWorker::EncodeRawBuffer() {
+  const AudioConfig& raw_config = raw_buffer_.config();
+  if (raw_config.sample_rate != sample_rate_) {
+    if (resampler_.input_rate() != static_cast<int>(raw_config.sample_rate) &&
+        resampler_.Init(raw_config.sample_rate, sample_rate_,
+                        raw_config.channels)) {
+      return VorbisEncoder::kUnsupportedFormat;
+    }
+    if (codec_ != kAudioFormatOpus) {
+      return vorbis_encoder_.EncodeResampled(raw_buffer_, &resampler_);
+    }
+    const int status = resampler_.Resample(raw_buffer_, &resampled_buffer_);
+    if (status == AudioResampler::kNoOutput) {
+      return VorbisEncoder::kSuccess;
+    } else if (status) {
+      return VorbisEncoder::kUnsupportedFormat;
+    }
+    return opus_encoder_.Encode(resampled_buffer_);
+  }
+  if (codec_ == kAudioFormatOpus) {
+    return opus_encoder_.Encode(raw_buffer_);
+  }
+  return vorbis_encoder_.Encode(raw_buffer_);
+}
+
+int AudioEncodeWorker::ReadCompressedBuffer() {
+  if (codec_ == kAudioFormatOpus) {
+    return opus_encoder_.ReadCompressedAudio(&compressed_buffer_);
+  }
+  return vorbis_encoder_.ReadCompressedAudio(&compressed_buffer_);
+}
+
+int AudioEncodeWorker::EncodeQueuedBuffers() {
+  int status = kSuccess;
+  while (status == kSuccess &&
+         input_pool_.Decommit(&raw_buffer_) == kSuccess) {
+    status = EncodeRawBuffer();
+    if (status) {
+      LOG(ERROR) << "AudioEncodeWorker audio encode failed: " << status;
+      return kAudioEncoderError;
+    }
+    while ((status = ReadCompressedBuffer()) == kSuccess) {
+      if (output_pool_.Commit(&compressed_buffer_)) {
+        LOG(ERROR) << "AudioEncodeWorker output Commit failed.";
+        return kNoMemory;
+      }
+    }
+    if (status == VorbisEncoder::kNoSamples) {
+      status = kSuccess;
+    } else {
+      LOG(ERROR) << "AudioEncodeWorker reading audio samples failed: "
+                 << status;
+      status = kAudioEncoderError;
+    }
+  }
+  return status;
+}
+
+void AudioEncodeWorker::EncodeTask() {
+  ScopedCpuStage cpu_stage(kCpuAudioEncode);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_ || status_ != kSuccess) {
+      return;
+    }
+  }
+  const int status = EncodeQueuedBuffers();
+  if (status) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    status_ = status;
+  }
+  if (output_callback_) {
+    output_callback_();
+  }
+}
+
+void AudioEncodeWorker::WorkerThread() {
+  LOG(INFO) << "AudioEncodeWorker thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kEncode);
+  ScopedCpuStage cpu_stage(kCpuAudioEncode);
+  int status = kSuccess;
+  bool done = false;
+  while (!done) {
+    done = WaitForInput();
+
+    // Compress everything queued, and hand the compressed buffers to the
+    // caller.
+    status = EncodeQueuedBuffers();
+    if (status) {
+      break;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  status_ = status;
+  LOG(INFO) << "AudioEncodeWorker thread finished, status=" << status;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,165 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_AUDIO_ENCODE_WORKER_H_
+#define WEBMLIVE_ENCODER_AUDIO_ENCODE_WORKER_H_
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/audio_resampler.h"
+#include "encoder/basictypes.h"
+#include "encoder/buffer_pool.h"
+#include "encoder/opus_encoder.h"
+#include "encoder/task_scheduler.h"
+#include "encoder/vorbis_encoder.h"
+#include "encoder/webm_encoder.h"
+
+namespace webmlive {
+
+// Compresses audio on its own thread. Raw buffers are passed in via
+// |EncodeBuffer()|, compressed by a |VorbisEncoder| or an |OpusAudioEncoder|,
+// and made available to the caller via |ReadEncodedBuffer()|.
+//
+// Notes
+// - |EncodeBuffer()| and |ReadEncodedBuffer()| must be called from the same
+//   thread; |WebmEncoder::EncoderThread()| in practice.
+// - Audio is never dropped: both buffer pools grow as needed.
+// - With |WebmEncoderConfig::task_scheduler| set, queued buffers are
+//   compressed by tasks on the scheduler instead of on a worker thread.
+// - Buffers at another sample rate than |actual_audio_config|'s are
+//   converted by an |AudioResampler|, straight into libvorbis's analysis
+//   buffer for Vorbis. See |WebmEncoderConfig::audio_encode_sample_rate|.
+class AudioEncodeWorker {
+ public:
+  enum {
+    // Worker thread could not be started.
+    kThreadError = -4,
+    // Encoding a buffer failed.
+    kAudioEncoderError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+    // No compressed buffers available from |ReadEncodedBuffer()|.
+    kNoBuffers = 1,
+  };
+
+  // Maximum time the worker thread sleeps while waiting for input. Bounds
+  // the delay in noticing |Stop()|.
+  static const int kMaxIdleWaitMs = 100;
+
+  AudioEncodeWorker();
+  ~AudioEncodeWorker();
+
+  // Initializes the buffer pools and the encoder selected by
+  // |config.audio_codec| for |config.actual_audio_config| input. Returns
+  // |kSuccess| when successful.
+  int Init(const WebmEncoderConfig& config);
+
+  // Sets a function called after compressed buffers are made available to
+  // |ReadEncodedBuffer()|. Only called when the worker runs on a task
+  // scheduler, from its tasks. Must be called before |Run()|.
+  void set_output_callback(const std::function<void()>& callback) {
+    output_callback_ = callback;
+  }
+
+  // Starts the worker thread, or prepares the task strand when running on a
+  // task scheduler. Returns |kSuccess| when successful.
+  int Run();
+
+  // Stops and joins the worker thread. Buffers already passed to
+  // |EncodeBuffer()| are compressed before the thread exits, so the caller
+  // can read the tail of the stream via |ReadEncodedBuffer()|.
+  void Stop();
+
+  // Queues |ptr_buffer| for encoding. Its contents are swapped into the
+  // input pool. Returns |kSuccess| when the buffer is queued.
+  int EncodeBuffer(AudioBuffer* ptr_buffer);
+
+  // Reads the next compressed buffer into |ptr_buffer|. Returns |kSuccess|
+  // when a buffer is available, and |kNoBuffers| when there are none.
+  int ReadEncodedBuffer(AudioBuffer* ptr_buffer);
+
+  // Returns |kSuccess| while the worker thread is healthy, or the error that
+  // stopped it.
+  int CheckStatus() const;
+
+  // Returns the encoders. Only their codec private data may be used, and
+  // only before |Run()|. The encoder not selected by |Init()| is unused.
+  AudioFormat codec() const { return codec_; }
+  const VorbisEncoder& vorbis_encoder() const { return vorbis_encoder_; }
+  const OpusAudioEncoder& opus_encoder() const { return opus_encoder_; }
+
+ private:
+  // Idles the worker thread until |EncodeBuffer()| or |Stop()| signals it,
+  // or until |kMaxIdleWaitMs| elapses. Returns true when the thread should
+  // exit: |Stop()| has been called and the input pool is empty.
+  bool WaitForInput();
+
+  // Pass |raw_buffer_| to, and read a compressed buffer from, the encoder
+  // selected by |codec_|. Return codes are those of |VorbisEncoder|, which
+  // match |OpusAudioEncoder|'s.
+  int EncodeRawBuffer();
+  int ReadCompressedBuffer();
+
+  // Compresses every buffer in |input_pool_| into |output_pool_|. Returns
+  // |kSuccess| when successful.
+  int EncodeQueuedBuffers();
+
+  // Task scheduler task: runs |EncodeQueuedBuffers()| and records failures.
+  // Audio tasks are short, and are due as soon as they are posted.
+  void EncodeTask();
+
+  // Worker thread function.
+  void WorkerThread();
+
+  // Raw buffers waiting for the worker thread, and compressed buffers
+  // waiting for the caller.
+  BufferPool<AudioBuffer> input_pool_;
+  BufferPool<AudioBuffer> output_pool_;
+
+  // Buffer storage owned by the worker thread.
+  AudioBuffer raw_buffer_;
+  AudioBuffer compressed_buffer_;
+  AudioFormat codec_;
+
+  // Converts raw buffers to |sample_rate_|, the rate the encoder runs at.
+  // |resampled_buffer_| holds the converted buffer for Opus.
+  uint32 sample_rate_;
+  AudioResampler resampler_;
+  AudioBuffer resampled_buffer_;
+  VorbisEncoder vorbis_encoder_;
+  OpusAudioEncoder opus_encoder_;
+
+  // Stop flag, wake up event and worker status. All protected by |mutex_|.
+  // |input_signaled_| is set by |EncodeBuffer()| to ensure the wake up is not
+  // lost while the worker is between its pool check and its wait.
+  mutable std::mutex mutex_;
+  std::condition_variable input_ready_;
+  bool input_signaled_;
+  bool stop_;
+  int status_;
+
+  // Called after buffers are committed to |output_pool_| by |EncodeTask()|.
+  std::function<void()> output_callback_;
+
+  // Runs |EncodeTask()| on |WebmEncoderConfig::task_scheduler|; NULL when
+  // the worker has its own thread. |ptr_scheduler_| is that scheduler.
+  TaskScheduler* ptr_scheduler_;
+  std::unique_ptr<TaskStrand> strand_;
+
+  std::shared_ptr<std::thread> worker_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(AudioEncodeWorker);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_AUDIO_ENCODE_WORKER_H_
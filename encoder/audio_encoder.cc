@@ -7,17 +7,38 @@
 // be found in the AUTHORS file in the root of the source tree.
 #include "encoder/audio_encoder.h"
 
-#include <new>
+#include <cstring>
 
+#include "encoder/pcm_deinterleave.h"
 #include "glog/logging.h"
 
 namespace webmlive {
 
+namespace {
+// Smallest storage allocated by |AudioBuffer::Init()|.
+const int32 kMinBufferCapacity = 1024;
+
+// Returns the power of two capacity used to store |data_length| bytes.
+// Compressed packet sizes vary from one packet to the next, and buffers are
+// swapped between pools, so growing to the exact length would reallocate
+// every time a buffer meets a slightly larger packet.
+int32 BufferCapacityForLength(int32 data_length) {
+  int32 capacity = kMinBufferCapacity;
+  while (capacity < data_length && capacity <= (0x7fffffff >> 1)) {
+    capacity <<= 1;
+  }
+  return (capacity < data_length) ? data_length : capacity;
+}
+}  // namespace
+
 AudioBuffer::AudioBuffer()
     : timestamp_(0),
       duration_(0),
+      timestamp_us_(0),
+      duration_us_(0),
       buffer_capacity_(0),
-      buffer_length_(0) {
+      buffer_length_(0),
+      planar_(false) {
 }
 
 AudioBuffer::~AudioBuffer() {
@@ -36,31 +57,142 @@ int AudioBuffer::Init(const AudioConfig& config,
     LOG(ERROR) << "AudioBuffer cannot Init with a NULL or empty buffer.";
     return kInvalidArg;
   }
-  if (data_length > buffer_capacity_) {
-    buffer_.reset(new (std::nothrow) uint8[data_length]);  // NOLINT
-    if (!buffer_) {
-      LOG(ERROR) << "AudioBuffer Init cannot allocate buffer.";
-      return kNoMemory;
-    }
-    buffer_capacity_ = data_length;
+  const int status = Reserve(data_length);
+  if (status) {
+    return status;
   }
   config_ = config;
   buffer_length_ = data_length;
   timestamp_ = timestamp;
   duration_ = duration;
+  timestamp_us_ = timestamp * 1000;
+  duration_us_ = duration * 1000;
+  planar_ = false;
   memcpy(buffer_.get(), ptr_data, data_length);
   return kSuccess;
 }
 
+int AudioBuffer::InitPlanar(const AudioConfig& config,
+                            int64 timestamp,
+                            int64 duration,
+                            const uint8* ptr_data,
+                            int32 data_length) {
+  if (duration < 0) {
+    LOG(ERROR) << "AudioBuffer duration cannot be less than 0.";
+    return kInvalidArg;
+  }
+  if (!ptr_data || data_length <= 0 || config.block_align == 0) {
+    LOG(ERROR) << "AudioBuffer cannot InitPlanar with a NULL or empty buffer.";
+    return kInvalidArg;
+  }
+  const int channels = config.channels;
+  const bool s16 = config.bits_per_sample == 16;
+  const bool f32 = config.bits_per_sample == 32 &&
+                   config.format_tag != kAudioFormatPcm;
+  if (channels <= 0 || channels > kMaxPlanarChannels || (!s16 && !f32) ||
+      config.block_align != channels * (config.bits_per_sample / 8)) {
+    return kInvalidArg;
+  }
+  const int num_frames = data_length / config.block_align;
+  const int status = AllocatePlanar(config, timestamp, duration, num_frames);
+  if (status) {
+    return status;
+  }
+  float* ptr_planes[kMaxPlanarChannels];
+  for (int i = 0; i < channels; ++i) {
+    ptr_planes[i] = plane(i);
+  }
+  if (s16) {
+    DeinterleaveS16ToFloat(reinterpret_cast<const int16*>(ptr_data),
+                           num_frames, channels, ptr_planes);
+  } else {
+    DeinterleaveFloat(reinterpret_cast<const float*>(ptr_data), num_frames,
+                      channels, ptr_planes);
+  }
+  return kSuccess;
+}
+
+int AudioBuffer::AllocatePlanar(const AudioConfig& config,
+                                int64 timestamp,
+                                int64 duration,
+                                int32 num_frames) {
+  const int channels = config.channels;
+  if (duration < 0 || num_frames <= 0 || channels <= 0 ||
+      channels > kMaxPlanarChannels) {
+    return kInvalidArg;
+  }
+  const int32 planar_length =
+      num_frames * channels * static_cast<int32>(sizeof(float));
+  const int status = Reserve(planar_length);
+  if (status) {
+    return status;
+  }
+  config_ = config;
+  config_.format_tag = kAudioFormatIeeeFloat;
+  config_.bits_per_sample = sizeof(float) * 8;  // NOLINT(runtime/sizeof)
+  config_.valid_bits_per_sample = 0;
+  config_.block_align = channels * sizeof(float);  // NOLINT(runtime/sizeof)
+  config_.bytes_per_second = config_.block_align * config.sample_rate;
+  buffer_length_ = planar_length;
+  timestamp_ = timestamp;
+  duration_ = duration;
+  timestamp_us_ = timestamp * 1000;
+  duration_us_ = duration * 1000;
+  planar_ = true;
+  return kSuccess;
+}
+
 int AudioBuffer::Clone(AudioBuffer* ptr_buffer) const {
   if (!ptr_buffer) {
     return kInvalidArg;
   }
-  return ptr_buffer->Init(config_,
-                          timestamp_,
-                          duration_,
-                          buffer_.get(),
-                          buffer_length_);
+  const int status = ptr_buffer->Init(config_,
+                                      timestamp_,
+                                      duration_,
+                                      buffer_.get(),
+                                      buffer_length_);
+  if (status == kSuccess) {
+    ptr_buffer->planar_ = planar_;
+    ptr_buffer->timestamp_us_ = timestamp_us_;
+    ptr_buffer->duration_us_ = duration_us_;
+  }
+  return status;
+}
+
+void AudioBuffer::Free() {
+  buffer_.reset();
+  buffer_capacity_ = 0;
+  buffer_length_ = 0;
+}
+
+void AudioBuffer::SetTimeUs(int64 timestamp_us, int64 duration_us) {
+  timestamp_us_ = timestamp_us;
+  duration_us_ = duration_us;
+  timestamp_ = MicrosecondsToMilliseconds(timestamp_us);
+  duration_ =
+      MicrosecondsToMilliseconds(timestamp_us + duration_us) - timestamp_;
+}
+
+int32 AudioBuffer::num_frames() const {
+  return config_.block_align ? buffer_length_ / config_.block_align : 0;
+}
+
+float* AudioBuffer::plane(int channel) const {
+  CHECK(planar_);
+  return reinterpret_cast<float*>(buffer_.get()) + channel * num_frames();
+}
+
+int AudioBuffer::Reserve(int32 data_length) {
+  if (data_length > buffer_capacity_) {
+    const int32 capacity = BufferCapacityForLength(data_length);
+    buffer_.reset(SlabAllocator::Instance().Allocate(capacity));
+    if (!buffer_) {
+      LOG(ERROR) << "AudioBuffer cannot allocate buffer.";
+      return kNoMemory;
+    }
+    buffer_capacity_ = capacity;
+  }
+  return kSuccess;
 }
 
 void AudioBuffer::Swap(AudioBuffer* ptr_buffer) {
@@ -77,7 +209,15 @@ void AudioBuffer::Swap(AudioBuffer* ptr_buffer) {
 
   temp_time = timestamp_;
   timestamp_ = ptr_buffer->timestamp_;
-  ptr_buffer->duration_ = temp_time;
+  ptr_buffer->timestamp_ = temp_time;
+
+  temp_time = duration_us_;
+  duration_us_ = ptr_buffer->duration_us_;
+  ptr_buffer->duration_us_ = temp_time;
+
+  temp_time = timestamp_us_;
+  timestamp_us_ = ptr_buffer->timestamp_us_;
+  ptr_buffer->timestamp_us_ = temp_time;
 
   int32 temp_size = buffer_length_;
   buffer_length_ = ptr_buffer->buffer_length_;
@@ -87,6 +227,10 @@ void AudioBuffer::Swap(AudioBuffer* ptr_buffer) {
   buffer_capacity_ = ptr_buffer->buffer_capacity_;
   ptr_buffer->buffer_capacity_ = temp_size;
 
+  const bool temp_planar = planar_;
+  planar_ = ptr_buffer->planar_;
+  ptr_buffer->planar_ = temp_planar;
+
   buffer_.swap(ptr_buffer->buffer_);
 }
 
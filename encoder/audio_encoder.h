@@ -12,6 +12,7 @@
 
 #include "encoder/basictypes.h"
 #include "encoder/encoder_base.h"
+#include "encoder/slab_allocator.h"
 
 namespace webmlive {
 
@@ -19,6 +20,7 @@ enum AudioFormat {
   kAudioFormatPcm = 1,
   kAudioFormatVorbis = 2,
   kAudioFormatIeeeFloat = 3,
+  kAudioFormatOpus = 4,
 };
 
 // Audio configuration control structure. Values set to 0 mean use default.
@@ -52,18 +54,46 @@ class AudioBuffer {
     kInvalidArg = -1,
     kSuccess = 0,
   };
+  // Largest channel count |InitPlanar()| accepts.
+  static const int kMaxPlanarChannels = 8;
+
   AudioBuffer();
   ~AudioBuffer();
 
   // Allocates storage for |ptr_data|, sets internal fields to values of
   // caller's args, and returns |kSuccess|. Returns |kInvalidArg| when
-  // |ptr_data| is NULL.
+  // |ptr_data| is NULL. Storage is reused when large enough, and grows in
+  // powers of two otherwise.
   int Init(const AudioConfig& config,
            int64 timestamp,
            int64 duration,
            const uint8* ptr_data,
            int32 data_length);
 
+  // Stores the interleaved 16 bit PCM or 32 bit float samples at |ptr_data|
+  // as planar 32 bit float: each channel's samples follow the previous
+  // channel's, and |config()| describes 32 bit float samples. Deinterleaving
+  // and conversion happen in the same pass as the copy. Returns
+  // |kInvalidArg| when |config| describes another sample format or more than
+  // |kMaxPlanarChannels| channels. Other return values match those of
+  // |Init()|.
+  int InitPlanar(const AudioConfig& config,
+                 int64 timestamp,
+                 int64 duration,
+                 const uint8* ptr_data,
+                 int32 data_length);
+
+  // Sizes the buffer for |num_frames| frames of planar 32 bit float samples
+  // with the channel count and sample rate of |config|, as |InitPlanar()|
+  // does, and leaves the samples for the caller to write through |plane()|.
+  // Returns |kInvalidArg| when |num_frames| is not positive or |config| has
+  // more than |kMaxPlanarChannels| channels, and |kNoMemory| when storage
+  // cannot be allocated.
+  int AllocatePlanar(const AudioConfig& config,
+                     int64 timestamp,
+                     int64 duration,
+                     int32 num_frames);
+
   // Copies |AudioBuffer| data to |ptr_buffer|. Performs allocation if
   // necessary. Returns |kSuccess| when successful. Returns |kInvalidArg| when
   // |ptr_buffer| is NULL. Returns |kNoMemory| when memory allocation fails.
@@ -75,19 +105,52 @@ class AudioBuffer {
 
   // Accessors/Mutators.
   int64 timestamp() const { return timestamp_; }
-  void set_timestamp(int64 timestamp) { timestamp_ = timestamp; }
+  void set_timestamp(int64 timestamp) {
+    timestamp_us_ += (timestamp - timestamp_) * 1000;
+    timestamp_ = timestamp;
+  }
   int64 duration() const { return duration_; }
   uint8* buffer() const { return buffer_.get(); }
   int32 buffer_length() const { return buffer_length_; }
   int32 buffer_capacity() const { return buffer_capacity_; }
   const AudioConfig& config() const { return config_; }
 
+  // Returns true when the buffer holds no storage.
+  bool empty() const { return !buffer_; }
+
+  // Frees the storage, leaving the buffer |empty()|.
+  void Free();
+
+  // Returns true when the buffer was filled by |InitPlanar()|.
+  bool planar() const { return planar_; }
+
+  // Returns the number of sample frames in the buffer.
+  int32 num_frames() const;
+
+  // Returns the samples of |channel| in a planar buffer.
+  float* plane(int channel) const;
+
+  // Time and duration of the buffer in microseconds, set from the
+  // millisecond values by |Init()| and |InitPlanar()|, and by sources with
+  // finer clocks through |SetTimeUs()|, which behaves as
+  // |VideoFrame::SetTimeUs()|.
+  int64 timestamp_us() const { return timestamp_us_; }
+  int64 duration_us() const { return duration_us_; }
+  void SetTimeUs(int64 timestamp_us, int64 duration_us);
+
  private:
+  // Allocates storage for |data_length| bytes unless |buffer_| can hold
+  // them. Returns |kSuccess| when successful.
+  int Reserve(int32 data_length);
+
   int64 timestamp_;
   int64 duration_;
-  std::unique_ptr<uint8[]> buffer_;
+  int64 timestamp_us_;
+  int64 duration_us_;
+  SlabBuffer buffer_;
   int32 buffer_capacity_;
   int32 buffer_length_;
+  bool planar_;
   AudioConfig config_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(AudioBuffer);
 };
@@ -103,6 +166,8 @@ class AudioSamplesCallbackInterface {
     // empty.
     kInvalidArg = -2,
     kSuccess = 0,
+    // The buffer was dropped because the receiver is at its buffer limit.
+    kDropped = 1,
   };
   virtual ~AudioSamplesCallbackInterface() {}
 
@@ -121,7 +186,8 @@ struct VorbisConfig {
         maximum_bitrate(kUseDefault),
         bitrate_based_quality(true),
         impulse_block_bias(kUseDefault),
-        lowpass_frequency(kUseDefault) {}
+        lowpass_frequency(kUseDefault),
+        skip_silence(false) {}
 
   // Rate control values. Set the min and max values to |kUseDefault| to
   // encode at an average bitrate. Use the same value for minimum, average, and
@@ -147,6 +213,46 @@ struct VorbisConfig {
 
   // Hard-lowpass frequency. Valid range is 2 to 99.
   double lowpass_frequency;
+
+  // Skips libvorbis analysis of digital silence. Once libvorbis has encoded a
+  // silent long block, later silent input is sent as copies of that packet
+  // until the input is no longer silent.
+  bool skip_silence;
+};
+
+struct OpusConfig {
+  // Special value that means use the default value for the current option.
+  static const int kUseDefault = -200;
+  OpusConfig()
+      : bitrate(64),
+        frame_duration(20),
+        frames_per_packet(1),
+        complexity(kUseDefault),
+        low_delay(false),
+        dtx(false) {}
+
+  // Target bitrate in kilobits.
+  int bitrate;
+
+  // Duration of each Opus frame in milliseconds, 10 or 20.
+  int frame_duration;
+
+  // Frames combined into each packet, and therefore into each WebM block.
+  // Packets may hold up to 120 ms of audio. Values above 1 reduce container
+  // overhead and muxer work per second of audio, at the cost of latency.
+  int frames_per_packet;
+
+  // Encoder complexity, 0 to 10.
+  int complexity;
+
+  // Uses the restricted low delay mode of libopus: CELT only, with 2.5 ms of
+  // lookahead instead of 6.5 ms.
+  bool low_delay;
+
+  // Enables discontinuous transmission: libopus sends silence as 1 byte
+  // packets. Once it does, later digitally silent packets skip libopus and
+  // repeat that packet until the input is no longer silent.
+  bool dtx;
 };
 
 }  // namespace webmlive
@@ -0,0 +1,98 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/audio_fan_out.h"
+
+#include "encoder/audio_encode_worker.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+AudioFanOut::AudioFanOut() {
+}
+
+void AudioFanOut::AddWorker(AudioEncodeWorker* ptr_worker, bool planar) {
+  CHECK_NOTNULL(ptr_worker);
+  workers_.push_back(ptr_worker);
+  planar_.push_back(planar);
+}
+
+bool AudioFanOut::needs_interleaved() const {
+  for (size_t i = 0; i < planar_.size(); ++i) {
+    if (!planar_[i])
+      return true;
+  }
+  return false;
+}
+
+int AudioFanOut::EncodeBuffer(AudioBuffer* ptr_buffer) {
+  if (!ptr_buffer || !ptr_buffer->buffer()) {
+    LOG(ERROR) << "AudioFanOut cannot encode an empty buffer.";
+    return kInvalidArg;
+  }
+  if (ptr_buffer->planar() && needs_interleaved()) {
+    LOG(ERROR) << "AudioFanOut cannot pass planar input to an encoder that "
+               << "takes interleaved input.";
+    return kInvalidArg;
+  }
+
+  // Convert once for all of the workers that take planar input. A single
+  // one converts on its own thread instead. Formats |InitPlanar()| rejects
+  // stay interleaved; Vorbis accepts them too.
+  int num_planar = 0;
+  for (size_t i = 0; i < planar_.size(); ++i) {
+    if (planar_[i])
+      ++num_planar;
+  }
+  bool converted = false;
+  if (!ptr_buffer->planar() && num_planar > 1) {
+    const int status = planar_buffer_.InitPlanar(ptr_buffer->config(),
+                                                 ptr_buffer->timestamp(),
+                                                 ptr_buffer->duration(),
+                                                 ptr_buffer->buffer(),
+                                                 ptr_buffer->buffer_length());
+    if (status == AudioBuffer::kNoMemory) {
+      LOG(ERROR) << "AudioFanOut planar conversion failed.";
+      return kNoMemory;
+    }
+    converted = status == AudioBuffer::kSuccess;
+    if (converted) {
+      planar_buffer_.SetTimeUs(ptr_buffer->timestamp_us(),
+                               ptr_buffer->duration_us());
+    }
+  }
+
+  std::vector<AudioBuffer*> sources(workers_.size(), ptr_buffer);
+  if (converted) {
+    for (size_t i = 0; i < workers_.size(); ++i) {
+      if (planar_[i])
+        sources[i] = &planar_buffer_;
+    }
+  }
+
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    // Copy the source unless no later worker reads it.
+    AudioBuffer* ptr_input = sources[i];
+    for (size_t j = i + 1; j < workers_.size(); ++j) {
+      if (sources[j] == sources[i]) {
+        if (sources[i]->Clone(&copy_buffer_)) {
+          LOG(ERROR) << "AudioFanOut cannot copy a buffer.";
+          return kNoMemory;
+        }
+        ptr_input = &copy_buffer_;
+        break;
+      }
+    }
+    if (workers_[i]->EncodeBuffer(ptr_input)) {
+      LOG(ERROR) << "AudioFanOut EncodeBuffer failed for encoder " << i;
+      return kAudioEncoderError;
+    }
+  }
+  return kSuccess;
+}
+
+}  // namespace webmlive
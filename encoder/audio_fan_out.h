@@ -0,0 +1,75 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_AUDIO_FAN_OUT_H_
+#define WEBMLIVE_ENCODER_AUDIO_FAN_OUT_H_
+
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+class AudioEncodeWorker;
+
+// Passes each captured audio buffer to several |AudioEncodeWorker|s, the
+// representations of an audio bitrate ladder.
+//
+// Vorbis encoders take planar float input, which they copy into libvorbis a
+// channel at a time; given interleaved PCM, each would deinterleave and
+// convert it again. |EncodeBuffer()| converts interleaved buffers once, with
+// |AudioBuffer::InitPlanar()|, and hands copies of the planar buffer to the
+// workers that take planar input. Opus encoders take the interleaved buffer.
+//
+// Notes
+// - A single worker that takes planar input is given interleaved buffers
+//   instead, and converts them on its own thread.
+// - The last worker given each buffer takes its contents; the others are
+//   given copies, which cost a memcpy each.
+// - Planar input cannot be given to workers that take interleaved input.
+class AudioFanOut {
+ public:
+  enum {
+    kAudioEncoderError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  AudioFanOut();
+  ~AudioFanOut() {}
+
+  // Adds |ptr_worker|, which is given planar float buffers when |planar| is
+  // true and interleaved buffers otherwise. |ptr_worker| is not owned, and
+  // must outlive the |AudioFanOut|.
+  void AddWorker(AudioEncodeWorker* ptr_worker, bool planar);
+
+  // Passes the samples in |ptr_buffer| to every worker, converting them to
+  // planar float first when needed. |ptr_buffer| may be left with the
+  // contents of another buffer. Returns |kSuccess| when successful.
+  int EncodeBuffer(AudioBuffer* ptr_buffer);
+
+  // Returns true when |AddWorker()| added a worker that takes interleaved
+  // buffers.
+  bool needs_interleaved() const;
+
+ private:
+  std::vector<AudioEncodeWorker*> workers_;
+  std::vector<bool> planar_;
+
+  // The converted buffer, and copies made for all but the last worker of
+  // each layout. The workers' pools take their contents, leaving storage
+  // to reuse for the next buffer.
+  AudioBuffer planar_buffer_;
+  AudioBuffer copy_buffer_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(AudioFanOut);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_AUDIO_FAN_OUT_H_
@@ -0,0 +1,264 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/audio_mixer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "encoder/pcm_mix.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+const int64 kMicrosecondsPerSecond = 1000000;
+
+// Returns the frame of a |sample_rate| timeline starting at |start_time_us|
+// that is captured at |time_us|, rounded to the nearest frame.
+int64 TimeToFrame(int64 time_us, int64 start_time_us, int sample_rate) {
+  return static_cast<int64>(std::floor(
+      (time_us - start_time_us) * static_cast<double>(sample_rate) /
+          kMicrosecondsPerSecond + 0.5));
+}
+}  // namespace
+
+int AudioMixer::Input::OnSamplesReceived(AudioBuffer* ptr_buffer) {
+  if (!ptr_buffer || !ptr_buffer->buffer() || ptr_buffer->num_frames() <= 0) {
+    return kInvalidArg;
+  }
+  if (drift_compensator) {
+    const int status = drift_compensator->Process(ptr_buffer);
+    if (status == AudioDriftCompensator::kNoOutput) {
+      return kSuccess;
+    } else if (status) {
+      LOG(ERROR) << "AudioMixer input " << index << " drift compensation "
+                 << "failed: " << status << "; disabling it.";
+      drift_compensator.reset();
+    }
+  }
+  const AudioBuffer* ptr_planar = ptr_buffer;
+  if (!ptr_buffer->planar()) {
+    const int status = planar_buffer.InitPlanar(ptr_buffer->config(),
+                                                ptr_buffer->timestamp(),
+                                                ptr_buffer->duration(),
+                                                ptr_buffer->buffer(),
+                                                ptr_buffer->buffer_length());
+    if (status) {
+      LOG(ERROR) << "AudioMixer input " << index << " cannot convert "
+                 << "samples: " << status;
+      return status == AudioBuffer::kNoMemory ? kNoMemory : kInvalidArg;
+    }
+    planar_buffer.SetTimeUs(ptr_buffer->timestamp_us(),
+                            ptr_buffer->duration_us());
+    ptr_planar = &planar_buffer;
+  }
+  const int status = mixer->AddSamples(this, *ptr_planar);
+  if (status == AudioMixer::kNoMemory) {
+    return kNoMemory;
+  }
+  return status ? kInvalidArg : kSuccess;
+}
+
+AudioMixer::AudioMixer()
+    : ptr_callback_(NULL),
+      max_latency_ms_(AudioMixConfig::kDefaultMaxLatencyMs),
+      start_time_us_(-1),
+      mixed_frames_(0) {
+}
+
+int AudioMixer::Init(const AudioMixConfig& config,
+                     AudioSamplesCallbackInterface* ptr_callback) {
+  if (!ptr_callback || config.max_latency_ms < 0 ||
+      config.inputs.size() >= static_cast<size_t>(kMaxInputs)) {
+    LOG(ERROR) << "AudioMixer invalid config.";
+    return kInvalidArg;
+  }
+  inputs_.clear();
+  for (size_t i = 0; i <= config.inputs.size(); ++i) {
+    const double gain_db = i == 0 ? config.main_gain_db :
+        config.inputs[i - 1].gain_db;
+    const float gain = static_cast<float>(std::pow(10.0, gain_db / 20));
+    std::unique_ptr<Input> input(
+        new (std::nothrow) Input(this, static_cast<int>(i), gain));  // NOLINT
+    if (!input) {
+      return kNoMemory;
+    }
+    input->drift_compensator.reset(
+        new (std::nothrow) AudioDriftCompensator());  // NOLINT
+    if (!input->drift_compensator) {
+      return kNoMemory;
+    }
+    inputs_.push_back(std::move(input));
+  }
+  ptr_callback_ = ptr_callback;
+  max_latency_ms_ = config.max_latency_ms;
+  start_time_us_ = -1;
+  mixed_frames_ = 0;
+  return kSuccess;
+}
+
+int AudioMixer::SetOutputConfig(const AudioConfig& capture_config) {
+  if (capture_config.sample_rate == 0 || capture_config.channels == 0 ||
+      capture_config.channels > AudioBuffer::kMaxPlanarChannels) {
+    LOG(ERROR) << "AudioMixer cannot mix " << capture_config.channels
+               << " channels at " << capture_config.sample_rate << " Hz.";
+    return kInvalidArg;
+  }
+  output_config_ = AudioConfig();
+  output_config_.format_tag = kAudioFormatIeeeFloat;
+  output_config_.channels = capture_config.channels;
+  output_config_.sample_rate = capture_config.sample_rate;
+  output_config_.bits_per_sample = sizeof(float) * 8;  // NOLINT
+  output_config_.block_align =
+      output_config_.channels * sizeof(float);  // NOLINT(runtime/sizeof)
+  output_config_.bytes_per_second =
+      output_config_.block_align * output_config_.sample_rate;
+  for (size_t i = 0; i < inputs_.size(); ++i) {
+    inputs_[i]->planes.assign(output_config_.channels, std::vector<float>());
+  }
+  return kSuccess;
+}
+
+AudioSamplesCallbackInterface* AudioMixer::input(int index) {
+  return index >= 0 && index < num_inputs() ? inputs_[index].get() : NULL;
+}
+
+int AudioMixer::AddSamples(Input* ptr_input, const AudioBuffer& buffer) {
+  if (ptr_input->planes.empty()) {
+    LOG(ERROR) << "AudioMixer received samples before SetOutputConfig.";
+    return kInvalidArg;
+  }
+  const int sample_rate = static_cast<int>(output_config_.sample_rate);
+  if (static_cast<int>(buffer.config().sample_rate) != sample_rate) {
+    LOG(ERROR) << "AudioMixer input " << ptr_input->index << " is at "
+               << buffer.config().sample_rate << " Hz; the mix is at "
+               << sample_rate << " Hz.";
+    return kInvalidArg;
+  }
+  const int32 num_frames = buffer.num_frames();
+  const int in_channels = buffer.config().channels;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (start_time_us_ < 0) {
+    start_time_us_ = buffer.timestamp_us();
+  }
+
+  // Buffers follow one another unless the timestamps jump, as they do when
+  // the source starts or restarts.
+  Input& input = *ptr_input;
+  const int64 time_frame =
+      TimeToFrame(buffer.timestamp_us(), start_time_us_, sample_rate);
+  const int64 max_jump_frames =
+      AudioDriftCompensator::kDiscontinuityMs * sample_rate / 1000;
+  int64 position = input.next_frame;
+  if (position < 0 || std::abs(time_frame - position) > max_jump_frames) {
+    if (position >= 0) {
+      LOG(INFO) << "AudioMixer input " << input.index << " timestamps jumped "
+                << "by " << (time_frame - position) * 1000 / sample_rate
+                << " ms; realigning.";
+    }
+    position = time_frame;
+  }
+  input.next_frame = position + num_frames;
+
+  // Frames already mixed are late, and dropped. The queue is cut or padded
+  // with silence so that it ends where the buffer starts.
+  const int64 first = std::max(position, mixed_frames_);
+  if (first < position + num_frames) {
+    const int64 keep = input.planes[0].empty() ?
+        0 : std::max<int64>(0, first - input.queue_start);
+    const int32 offset = static_cast<int32>(first - position);
+    for (size_t c = 0; c < input.planes.size(); ++c) {
+      std::vector<float>& plane = input.planes[c];
+      plane.resize(static_cast<size_t>(keep), 0.0f);
+      const float* const ptr_samples =
+          buffer.plane(static_cast<int>(c) % in_channels);
+      plane.insert(plane.end(), ptr_samples + offset,
+                   ptr_samples + num_frames);
+    }
+    if (keep == 0) {
+      input.queue_start = first;
+    }
+  }
+
+  // Mix what every input that has started has delivered, or, when one falls
+  // behind, what the others delivered more than |max_latency_ms_| ago.
+  int64 ready_end = -1;
+  int64 newest_end = mixed_frames_;
+  for (size_t i = 0; i < inputs_.size(); ++i) {
+    const Input& other = *inputs_[i];
+    if (other.next_frame < 0) {
+      continue;
+    }
+    const size_t queued = other.planes[0].size();
+    const int64 end = queued > 0 ?
+        other.queue_start + static_cast<int64>(queued) : mixed_frames_;
+    ready_end = ready_end < 0 ? end : std::min(ready_end, end);
+    newest_end = std::max(newest_end, end);
+  }
+  const int64 max_latency_frames =
+      static_cast<int64>(max_latency_ms_) * sample_rate / 1000;
+  ready_end = std::max(ready_end, newest_end - max_latency_frames);
+  if (ready_end <= mixed_frames_) {
+    return kSuccess;
+  }
+  return Mix(static_cast<int32>(ready_end - mixed_frames_));
+}
+
+int AudioMixer::Mix(int32 num_frames) {
+  const int sample_rate = static_cast<int>(output_config_.sample_rate);
+  const int64 timestamp_us = start_time_us_ +
+      mixed_frames_ * kMicrosecondsPerSecond / sample_rate;
+  const int64 end_us = start_time_us_ +
+      (mixed_frames_ + num_frames) * kMicrosecondsPerSecond / sample_rate;
+  int status = mix_buffer_.AllocatePlanar(output_config_, 0, 0, num_frames);
+  if (status) {
+    LOG(ERROR) << "AudioMixer cannot allocate the mix: " << status;
+    return status == AudioBuffer::kNoMemory ? kNoMemory : kInvalidArg;
+  }
+  mix_buffer_.SetTimeUs(timestamp_us, end_us - timestamp_us);
+
+  const int channels = output_config_.channels;
+  for (int c = 0; c < channels; ++c) {
+    memset(mix_buffer_.plane(c), 0, num_frames * sizeof(float));
+  }
+  for (size_t i = 0; i < inputs_.size(); ++i) {
+    Input& input = *inputs_[i];
+    const int64 queued = static_cast<int64>(input.planes[0].size());
+    const int64 offset = input.queue_start - mixed_frames_;
+    if (queued == 0 || offset >= num_frames) {
+      continue;
+    }
+    const int32 count =
+        static_cast<int32>(std::min<int64>(queued, num_frames - offset));
+    for (int c = 0; c < channels; ++c) {
+      std::vector<float>& plane = input.planes[c];
+      MixPlane(&plane[0], input.gain, mix_buffer_.plane(c) + offset, count);
+      plane.erase(plane.begin(), plane.begin() + count);
+    }
+    input.queue_start += count;
+  }
+  for (int c = 0; c < channels; ++c) {
+    ClampPlane(mix_buffer_.plane(c), num_frames);
+  }
+  mixed_frames_ += num_frames;
+
+  status = ptr_callback_->OnSamplesReceived(&mix_buffer_);
+  if (status == AudioSamplesCallbackInterface::kDropped) {
+    VLOG(1) << "AudioMixer output dropped.";
+  } else if (status) {
+    LOG(ERROR) << "AudioMixer output callback failed: " << status;
+    return kInvalidArg;
+  }
+  return kSuccess;
+}
+
+}  // namespace webmlive
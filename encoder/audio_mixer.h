@@ -0,0 +1,170 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_AUDIO_MIXER_H_
+#define WEBMLIVE_ENCODER_AUDIO_MIXER_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "encoder/audio_drift_compensator.h"
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// An audio input mixed into the main one.
+struct AudioMixInputConfig {
+  AudioMixInputConfig() : gain_db(0) {}
+
+  // Capture device; an ALSA PCM name on Linux.
+  std::string device_name;
+
+  // Gain applied to the input before mixing, in decibels.
+  double gain_db;
+};
+
+struct AudioMixConfig {
+  static const int kDefaultMaxLatencyMs = 100;
+
+  AudioMixConfig()
+      : main_gain_db(0),
+        max_latency_ms(kDefaultMaxLatencyMs) {}
+
+  // Inputs mixed into the main audio device, a system audio loopback mixed
+  // with a microphone for example. Empty disables mixing.
+  std::vector<AudioMixInputConfig> inputs;
+
+  // Gain applied to the main audio device before mixing, in decibels.
+  double main_gain_db;
+
+  // Longest time the mix waits for an input that falls behind the others.
+  // Its samples are replaced by silence once the others are this far ahead.
+  int max_latency_ms;
+};
+
+// Mixes several audio sources into the planar float buffers passed to one
+// audio callback, so that a microphone and a system audio loopback, for
+// example, are encoded as one track without an external mixer.
+//
+// Each input runs its buffers through its own |AudioDriftCompensator|, which
+// locks its sample clock to the capture clock, converts them to planar
+// float, and places them on a common timeline by their timestamps. Frames
+// are mixed once every input has delivered them, each scaled by its gain,
+// and the sum is clamped to [-1, 1]; see |MixPlane()|.
+//
+//   AudioMixer mixer;
+//   mixer.Init(mix_config, ptr_encoder_callback);
+//   main_source.Init(..., mixer.input(0));
+//   loopback_source.Init(..., mixer.input(1));
+//   mixer.SetOutputConfig(main_source.actual_config());
+//
+// Notes
+// - All sources must timestamp buffers on the same clock, and capture at the
+//   output sample rate; buffers at other rates are rejected.
+// - Output channel c is taken from input channel c modulo the input's
+//   channel count: a mono input feeds every channel, and the extra channels
+//   of an input with more than the output are left out.
+// - Inputs that have not delivered a buffer yet are silent. After that, an
+//   input that stalls holds the mix back by at most |max_latency_ms|.
+// - Output timestamps count mixed frames from the first buffer received.
+// - Thread safe: each input may be called from its own thread. Buffers are
+//   passed to the callback from the thread of the input that completed
+//   them, one at a time.
+class AudioMixer {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Maximum number of inputs, the main one included.
+  static const int kMaxInputs = 8;
+
+  AudioMixer();
+  ~AudioMixer() {}
+
+  // Creates input 0 for the main device and one input for each of
+  // |config.inputs|, and stores |ptr_callback|, which receives the mixed
+  // buffers. Returns |kSuccess| when successful.
+  int Init(const AudioMixConfig& config,
+           AudioSamplesCallbackInterface* ptr_callback);
+
+  // Sets the sample rate and channel count of the mix to those of
+  // |capture_config|, normally the main device's. Must be called before the
+  // inputs receive samples. Returns |kSuccess| when successful.
+  int SetOutputConfig(const AudioConfig& capture_config);
+
+  // Format of the mixed buffers: planar 32 bit float.
+  const AudioConfig& output_config() const { return output_config_; }
+
+  // Audio callbacks of the inputs; |index| is in [0, |num_inputs()|).
+  int num_inputs() const { return static_cast<int>(inputs_.size()); }
+  AudioSamplesCallbackInterface* input(int index);
+
+ private:
+  // Routes the buffers of one source to the mixer. The drift compensation
+  // and planar conversion members are used only by the source's thread; the
+  // queue is protected by |AudioMixer::mutex_|.
+  struct Input : public AudioSamplesCallbackInterface {
+    Input(AudioMixer* ptr_audio_mixer, int input_index, float input_gain)
+        : mixer(ptr_audio_mixer),
+          index(input_index),
+          gain(input_gain),
+          next_frame(-1),
+          queue_start(0) {}
+    virtual ~Input() {}
+    virtual int OnSamplesReceived(AudioBuffer* ptr_buffer);
+
+    AudioMixer* const mixer;
+    const int index;
+    const float gain;
+
+    std::unique_ptr<AudioDriftCompensator> drift_compensator;
+    AudioBuffer planar_buffer;
+
+    // Position on the mix timeline, in frames, where the next buffer is
+    // expected; -1 before the first.
+    int64 next_frame;
+
+    // Samples waiting to be mixed, one plane per output channel, starting
+    // at frame |queue_start| of the mix timeline.
+    int64 queue_start;
+    std::vector<std::vector<float>> planes;
+  };
+
+  // Places the planar samples of |buffer| on the timeline of |ptr_input|,
+  // and mixes the frames every input has delivered. Returns |kSuccess| when
+  // successful.
+  int AddSamples(Input* ptr_input, const AudioBuffer& buffer);
+
+  // Mixes the next |num_frames| frames of every input into |mix_buffer_|,
+  // and passes it to |ptr_callback_|. Requires |mutex_|.
+  int Mix(int32 num_frames);
+
+  std::vector<std::unique_ptr<Input>> inputs_;
+  AudioSamplesCallbackInterface* ptr_callback_;
+  int max_latency_ms_;
+  AudioConfig output_config_;
+
+  // Protects the mix timeline and the input queues.
+  std::mutex mutex_;
+
+  // Capture time of frame 0 of the mix timeline, -1 before the first
+  // buffer, and the number of frames mixed so far.
+  int64 start_time_us_;
+  int64 mixed_frames_;
+  AudioBuffer mix_buffer_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(AudioMixer);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_AUDIO_MIXER_H_
@@ -0,0 +1,311 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/audio_resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "encoder/pcm_deinterleave.h"
+#include "glog/logging.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WEBMLIVE_HAVE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define WEBMLIVE_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace webmlive {
+
+namespace {
+const double kPi = 3.14159265358979323846;
+
+// Frames of the previous buffer kept ahead of each plane.
+const int kHistory = AudioResampler::kTaps - 1;
+
+// Kaiser window shape. 7 gives about 70 dB of stopband attenuation.
+const double kKaiserBeta = 7.0;
+
+int Gcd(int a, int b) {
+  while (b) {
+    const int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+// Zeroth order modified Bessel function of the first kind, by its series.
+double BesselI0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 50 && term > sum * 1e-12; ++k) {
+    const double t = x / (2.0 * k);
+    term *= t * t;
+    sum += term;
+  }
+  return sum;
+}
+
+// Returns the dot product of the |AudioResampler::kTaps| frames at
+// |ptr_input| with the tap row at |ptr_taps|.
+inline float DotProduct(const float* ptr_input, const float* ptr_taps) {
+#if defined(WEBMLIVE_HAVE_SSE2)
+  __m128 acc0 = _mm_setzero_ps();
+  __m128 acc1 = _mm_setzero_ps();
+  for (int j = 0; j < AudioResampler::kTaps; j += 8) {
+    acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(ptr_input + j),
+                                       _mm_loadu_ps(ptr_taps + j)));
+    acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(ptr_input + j + 4),
+                                       _mm_loadu_ps(ptr_taps + j + 4)));
+  }
+  __m128 acc = _mm_add_ps(acc0, acc1);
+  acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+  acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+  return _mm_cvtss_f32(acc);
+#elif defined(WEBMLIVE_HAVE_NEON)
+  float32x4_t acc0 = vdupq_n_f32(0.0f);
+  float32x4_t acc1 = vdupq_n_f32(0.0f);
+  for (int j = 0; j < AudioResampler::kTaps; j += 8) {
+    acc0 = vmlaq_f32(acc0, vld1q_f32(ptr_input + j), vld1q_f32(ptr_taps + j));
+    acc1 = vmlaq_f32(acc1, vld1q_f32(ptr_input + j + 4),
+                     vld1q_f32(ptr_taps + j + 4));
+  }
+  const float32x4_t acc = vaddq_f32(acc0, acc1);
+  float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+  sum = vpadd_f32(sum, sum);
+  return vget_lane_f32(sum, 0);
+#else
+  float sum = 0.0f;
+  for (int j = 0; j < AudioResampler::kTaps; ++j) {
+    sum += ptr_input[j] * ptr_taps[j];
+  }
+  return sum;
+#endif
+}
+}  // namespace
+
+const double AudioResampler::kCutoff = 0.93;
+
+AudioResampler::AudioResampler()
+    : input_rate_(0),
+      output_rate_(0),
+      channels_(0),
+      up_(1),
+      down_(1),
+      index_(0),
+      phase_(0) {}
+
+int AudioResampler::Init(int input_rate, int output_rate, int channels) {
+  if (input_rate <= 0 || output_rate <= 0 || channels <= 0 ||
+      channels > AudioBuffer::kMaxPlanarChannels) {
+    LOG(ERROR) << "AudioResampler invalid rates or channel count.";
+    return kInvalidArg;
+  }
+  const int gcd = Gcd(input_rate, output_rate);
+  const int up = output_rate / gcd;
+  const int down = input_rate / gcd;
+  if (up > kMaxPhases) {
+    LOG(ERROR) << "AudioResampler cannot convert " << input_rate << " Hz to "
+               << output_rate << " Hz: the ratio needs " << up << " phases.";
+    return kInvalidArg;
+  }
+
+  // Cutoff in cycles per input frame, below the lower of the two Nyquist
+  // frequencies.
+  const double cutoff =
+      0.5 * kCutoff * std::min(1.0, static_cast<double>(up) / down);
+  const double half_width = kTaps / 2;
+  const double i0_beta = BesselI0(kKaiserBeta);
+  taps_.resize(static_cast<size_t>(up) * kTaps);
+  for (int p = 0; p < up; ++p) {
+    float* const ptr_row = &taps_[p * kTaps];
+    double sum = 0;
+    for (int j = 0; j < kTaps; ++j) {
+      // Distance from the output position to input frame |j| of the window,
+      // which starts |half_width| - 1 frames before the output's frame.
+      const double d = static_cast<double>(p) / up + half_width - 1 - j;
+      const double x = 2.0 * cutoff * d;
+      const double sinc = x == 0 ? 1.0 : std::sin(kPi * x) / (kPi * x);
+      const double r = d / half_width;
+      const double window =
+          r * r >= 1.0 ? 0.0
+                       : BesselI0(kKaiserBeta * std::sqrt(1.0 - r * r)) /
+                             i0_beta;
+      const double tap = 2.0 * cutoff * sinc * window;
+      ptr_row[j] = static_cast<float>(tap);
+      sum += tap;
+    }
+    // Unity gain at DC for every phase.
+    for (int j = 0; j < kTaps; ++j) {
+      ptr_row[j] = static_cast<float>(ptr_row[j] / sum);
+    }
+  }
+
+  input_rate_ = input_rate;
+  output_rate_ = output_rate;
+  channels_ = channels;
+  up_ = up;
+  down_ = down;
+  index_ = kHistory;
+  phase_ = 0;
+  history_.assign(static_cast<size_t>(kHistory) * channels, 0.0f);
+  LOG(INFO) << "AudioResampler " << input_rate << " Hz to " << output_rate
+            << " Hz, " << up << " phases.";
+  return kSuccess;
+}
+
+int32 AudioResampler::MaxOutputFrames(int32 input_frames) const {
+  return static_cast<int32>(
+      (static_cast<int64>(input_frames) + kTaps) * up_ / down_ + 2);
+}
+
+int AudioResampler::ResampleToPlanes(const AudioBuffer& input,
+                                     int32 max_frames,
+                                     float* const* ptr_planes,
+                                     int32* ptr_num_frames) {
+  if (!ptr_planes || !ptr_num_frames || !input.buffer() || !channels_) {
+    LOG(ERROR) << "AudioResampler cannot resample: invalid arguments, or not "
+               << "initialized.";
+    return kInvalidArg;
+  }
+  const AudioConfig& config = input.config();
+  const bool s16 = config.format_tag == kAudioFormatPcm &&
+                   config.bits_per_sample == 16;
+  const bool f32 = config.format_tag == kAudioFormatIeeeFloat &&
+                   config.bits_per_sample == 32;
+  if ((!s16 && !f32) || config.channels != channels_ ||
+      static_cast<int>(config.sample_rate) != input_rate_ ||
+      config.block_align != channels_ * (config.bits_per_sample / 8)) {
+    LOG(ERROR) << "AudioResampler input format does not match Init().";
+    return kInvalidArg;
+  }
+  const int32 num_frames = input.num_frames();
+  if (max_frames < MaxOutputFrames(num_frames)) {
+    LOG(ERROR) << "AudioResampler output too small.";
+    return kInvalidArg;
+  }
+
+  // Each plane of |work_| is the history followed by the buffer.
+  const int length = kHistory + num_frames;
+  if (work_.size() < static_cast<size_t>(length) * channels_) {
+    work_.resize(static_cast<size_t>(length) * channels_);
+  }
+  float* ptr_work[AudioBuffer::kMaxPlanarChannels];
+  float* ptr_inputs[AudioBuffer::kMaxPlanarChannels];
+  for (int c = 0; c < channels_; ++c) {
+    ptr_work[c] = &work_[c * length];
+    ptr_inputs[c] = ptr_work[c] + kHistory;
+    memcpy(ptr_work[c], &history_[c * kHistory],
+           kHistory * sizeof(history_[0]));
+  }
+  if (input.planar()) {
+    for (int c = 0; c < channels_; ++c) {
+      memcpy(ptr_inputs[c], input.plane(c),
+             num_frames * sizeof(ptr_inputs[c][0]));
+    }
+  } else if (s16) {
+    DeinterleaveS16ToFloat(reinterpret_cast<const int16*>(input.buffer()),
+                           num_frames, channels_, ptr_inputs);
+  } else {
+    DeinterleaveFloat(reinterpret_cast<const float*>(input.buffer()),
+                      num_frames, channels_, ptr_inputs);
+  }
+
+  // Every plane takes the same path through the phases; the last one's end
+  // state is kept.
+  const int last_frame = length - kTaps / 2;
+  int32 num_output = 0;
+  int index = index_;
+  int phase = phase_;
+  for (int c = 0; c < channels_; ++c) {
+    const float* const ptr_plane = ptr_work[c];
+    float* const ptr_output = ptr_planes[c];
+    index = index_;
+    phase = phase_;
+    num_output = 0;
+    while (index < last_frame) {
+      ptr_output[num_output++] =
+          DotProduct(ptr_plane + index - kTaps / 2 + 1, &taps_[phase * kTaps]);
+      phase += down_;
+      index += phase / up_;
+      phase %= up_;
+    }
+    memcpy(&history_[c * kHistory], ptr_plane + length - kHistory,
+           kHistory * sizeof(history_[0]));
+  }
+  index_ = index - (length - kHistory);
+  phase_ = phase;
+  *ptr_num_frames = num_output;
+  return kSuccess;
+}
+
+int AudioResampler::Resample(const AudioBuffer& input,
+                             AudioBuffer* ptr_output) {
+  if (!ptr_output || !channels_) {
+    LOG(ERROR) << "AudioResampler cannot resample: NULL output, or not "
+               << "initialized.";
+    return kInvalidArg;
+  }
+  const int32 stride = MaxOutputFrames(input.num_frames());
+  output_.resize(static_cast<size_t>(stride) * channels_);
+  float* ptr_planes[AudioBuffer::kMaxPlanarChannels];
+  for (int c = 0; c < channels_; ++c) {
+    ptr_planes[c] = &output_[c * stride];
+  }
+  int32 num_frames = 0;
+  int status = ResampleToPlanes(input, stride, ptr_planes, &num_frames);
+  if (status) {
+    return status;
+  }
+  if (num_frames == 0) {
+    return kNoOutput;
+  }
+
+  // Interleave into the input's sample format. Planar buffers are rebuilt by
+  // |AudioBuffer::InitPlanar()| from interleaved float.
+  AudioConfig config = input.config();
+  config.sample_rate = output_rate_;
+  config.bytes_per_second = config.block_align * output_rate_;
+  const bool s16 = !input.planar() && config.bits_per_sample == 16;
+  interleaved_.resize(static_cast<size_t>(num_frames) * config.block_align);
+  if (s16) {
+    int16* const ptr_out = reinterpret_cast<int16*>(&interleaved_[0]);
+    for (int c = 0; c < channels_; ++c) {
+      for (int i = 0; i < num_frames; ++i) {
+        const float s = std::floor(ptr_planes[c][i] * 32768.0f + 0.5f);
+        ptr_out[i * channels_ + c] =
+            static_cast<int16>(std::max(-32768.0f, std::min(32767.0f, s)));
+      }
+    }
+  } else {
+    float* const ptr_out = reinterpret_cast<float*>(&interleaved_[0]);
+    for (int c = 0; c < channels_; ++c) {
+      for (int i = 0; i < num_frames; ++i) {
+        ptr_out[i * channels_ + c] = ptr_planes[c][i];
+      }
+    }
+  }
+  const int64 duration = num_frames * 1000LL / output_rate_;
+  const int32 length = static_cast<int32>(interleaved_.size());
+  status = input.planar() ?
+      ptr_output->InitPlanar(config, input.timestamp(), duration,
+                             &interleaved_[0], length) :
+      ptr_output->Init(config, input.timestamp(), duration, &interleaved_[0],
+                       length);
+  if (status) {
+    LOG(ERROR) << "AudioResampler cannot write output: " << status;
+    return status == AudioBuffer::kNoMemory ? kNoMemory : kInvalidArg;
+  }
+  return kSuccess;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,102 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_AUDIO_RESAMPLER_H_
+#define WEBMLIVE_ENCODER_AUDIO_RESAMPLER_H_
+
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Converts audio between fixed sample rates, for example from the 44.1 kHz
+// some capture devices are limited to, to the 48 kHz encodes use.
+//
+// A polyphase FIR filter: the rate ratio is reduced to |L| / |M|, and each of
+// the |L| output phases has its own |kTaps| tap row of a Kaiser windowed sinc
+// low pass filter, computed once by |Init()|. Each output frame is then a
+// single dot product of a tap row with |kTaps| consecutive input frames,
+// computed with SSE2 or NEON when the target supports them.
+//
+// Notes
+// - State carries across calls, so consecutive buffers are filtered as one
+//   stream; the last |kTaps| / 2 frames of each buffer wait for the next.
+//   The output timeline is not shifted: the stream starts as if preceded by
+//   silence.
+// - The filter cuts off at |kCutoff| of the lower Nyquist frequency, with a
+//   transition about 3 kHz wide at 44.1 kHz and 70 dB of stopband
+//   attenuation.
+// - Ratios that reduce to more than |kMaxPhases| phases are rejected.
+class AudioResampler {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+    // The input produced no output frames.
+    kNoOutput = 1,
+  };
+
+  // Taps per phase. A multiple of 8 for the vector loops.
+  static const int kTaps = 64;
+  static const int kMaxPhases = 1024;
+  static const double kCutoff;
+
+  AudioResampler();
+  ~AudioResampler() {}
+
+  // Builds the filter tables for |channels| channel audio, and resets the
+  // stream state. Returns |kSuccess| when successful.
+  int Init(int input_rate, int output_rate, int channels);
+
+  // Returns the largest number of frames the next call can produce from
+  // |input_frames| input frames.
+  int32 MaxOutputFrames(int32 input_frames) const;
+
+  // Resamples |input|, 16 bit PCM or 32 bit float, interleaved or planar, to
+  // the float planes at |ptr_planes|, which hold |max_frames| frames. Stores
+  // the number of frames written in |*ptr_num_frames|. Returns |kSuccess|
+  // when successful.
+  int ResampleToPlanes(const AudioBuffer& input, int32 max_frames,
+                       float* const* ptr_planes, int32* ptr_num_frames);
+
+  // Resamples |input| into |ptr_output|, in the sample format and layout of
+  // |input|. Returns |kSuccess| when successful, and |kNoOutput| when
+  // |ptr_output| was left untouched because there was no output yet.
+  int Resample(const AudioBuffer& input, AudioBuffer* ptr_output);
+
+  int input_rate() const { return input_rate_; }
+  int output_rate() const { return output_rate_; }
+
+ private:
+  int input_rate_;
+  int output_rate_;
+  int channels_;
+
+  // The rate ratio, output over input, reduced to |up_| / |down_|. Tap row
+  // |p| of |taps_| filters phase |p| / |up_| between two input frames.
+  int up_;
+  int down_;
+  std::vector<float> taps_;
+
+  // Position of the next output frame: input frame |index_| of the planes of
+  // |work_|, plus |phase_| / |up_|. |work_| holds the last |kTaps| - 1 frames
+  // of the previous buffer, kept in |history_|, followed by the buffer.
+  int index_;
+  int phase_;
+  std::vector<float> history_;
+  std::vector<float> work_;
+  std::vector<float> output_;
+  std::vector<uint8> interleaved_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(AudioResampler);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_AUDIO_RESAMPLER_H_
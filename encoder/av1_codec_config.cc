@@ -0,0 +1,234 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/av1_codec_config.h"
+
+#include <cstdio>
+
+namespace webmlive {
+
+namespace {
+const uint8 kObuTypeSequenceHeader = 1;
+
+// First byte of the av1C record: the marker bit and version 1.
+const uint8 kAv1cMarkerAndVersion = 0x81;
+
+// Limits of the defined AV1 levels (AV1 specification, annex A.3), with the
+// main tier bitrate limit.
+struct Av1Level {
+  int index;
+  int64 max_pic_size;
+  int max_h_size;
+  int max_v_size;
+  int64 max_display_rate;
+  int max_bitrate_kbps;
+};
+const Av1Level kAv1Levels[] = {
+  {0, 147456, 2048, 1152, 4423680LL, 1500},
+  {1, 278784, 2816, 1584, 8363520LL, 3000},
+  {4, 665856, 4352, 2448, 19975680LL, 6000},
+  {5, 1065024, 5504, 3096, 31950720LL, 10000},
+  {8, 2359296, 6144, 3456, 70778880LL, 12000},
+  {9, 2359296, 6144, 3456, 141557760LL, 20000},
+  {12, 8912896, 8192, 4352, 267386880LL, 30000},
+  {13, 8912896, 8192, 4352, 534773760LL, 40000},
+  {14, 8912896, 8192, 4352, 1069547520LL, 60000},
+  {15, 8912896, 8192, 4352, 1069547520LL, 60000},
+  {16, 35651584, 16384, 8704, 1069547520LL, 60000},
+  {17, 35651584, 16384, 8704, 2139095040LL, 100000},
+  {18, 35651584, 16384, 8704, 4278190080LL, 160000},
+  {19, 35651584, 16384, 8704, 4278190080LL, 160000},
+};
+
+// Reads bits most significant first, as the AV1 f(n) descriptor does.
+class BitReader {
+ public:
+  BitReader(const uint8* ptr_data, int32 length)
+      : ptr_data_(ptr_data), length_(length), position_(0) {}
+
+  // Returns the next |num_bits| bits, at most 32, or false when the data
+  // ends first.
+  bool Read(int num_bits, uint32* ptr_value) {
+    if (position_ + num_bits > static_cast<int64>(length_) * 8) {
+      return false;
+    }
+    uint32 value = 0;
+    for (int i = 0; i < num_bits; ++i, ++position_) {
+      const uint8 byte = ptr_data_[position_ / 8];
+      value = (value << 1) | ((byte >> (7 - position_ % 8)) & 1);
+    }
+    *ptr_value = value;
+    return true;
+  }
+
+  // Reads a uvlc() value.
+  bool ReadUvlc(uint32* ptr_value) {
+    int leading_zeros = 0;
+    uint32 bit = 0;
+    for (;;) {
+      if (!Read(1, &bit)) {
+        return false;
+      }
+      if (bit) {
+        break;
+      }
+      ++leading_zeros;
+    }
+    if (leading_zeros >= 32) {
+      *ptr_value = 0xFFFFFFFF;
+      return true;
+    }
+    uint32 value = 0;
+    if (!Read(leading_zeros, &value)) {
+      return false;
+    }
+    *ptr_value = value + (1u << leading_zeros) - 1;
+    return true;
+  }
+
+ private:
+  const uint8* ptr_data_;
+  int32 length_;
+  int64 position_;
+};
+}  // namespace
+
+int Av1LevelIndex(int width, int height, double frame_rate,
+                  int bitrate_kbps) {
+  const int64 pic_size = static_cast<int64>(width) * height;
+  const double display_rate = pic_size * frame_rate;
+  for (const Av1Level& level : kAv1Levels) {
+    if (pic_size <= level.max_pic_size && width <= level.max_h_size &&
+        height <= level.max_v_size &&
+        display_rate <= static_cast<double>(level.max_display_rate) &&
+        bitrate_kbps <= level.max_bitrate_kbps) {
+      return level.index;
+    }
+  }
+  return kAv1MaxLevelIndex;
+}
+
+std::string Av1CodecsString(const Av1CodecConfig& config) {
+  char codecs[32] = {0};
+  snprintf(codecs, sizeof(codecs), "av01.%d.%02d%c.%02d", config.profile,
+           config.level_index, config.tier ? 'H' : 'M', config.bit_depth);
+  return codecs;
+}
+
+bool ParseAv1SequenceHeader(const uint8* ptr_obu, int32 length,
+                            Av1CodecConfig* ptr_config) {
+  if (!ptr_obu || length < 2 || !ptr_config) {
+    return false;
+  }
+
+  // OBU header: forbidden bit, type, extension flag, size flag, reserved bit;
+  // then the extension byte and the leb128 size when flagged.
+  const uint8 header = ptr_obu[0];
+  if ((header >> 3 & 0x0F) != kObuTypeSequenceHeader) {
+    return false;
+  }
+  int32 offset = (header & 0x04) ? 2 : 1;
+  int32 payload_length = length - offset;
+  if (header & 0x02) {
+    uint64 size = 0;
+    for (int i = 0;; ++i) {
+      if (i == 8 || offset >= length) {
+        return false;
+      }
+      const uint8 byte = ptr_obu[offset++];
+      size |= static_cast<uint64>(byte & 0x7F) << (i * 7);
+      if (!(byte & 0x80)) {
+        break;
+      }
+    }
+    if (size > static_cast<uint64>(length - offset)) {
+      return false;
+    }
+    payload_length = static_cast<int32>(size);
+  }
+
+  BitReader reader(ptr_obu + offset, payload_length);
+  uint32 profile = 0;
+  uint32 still_picture = 0;
+  uint32 reduced_still_picture_header = 0;
+  if (!reader.Read(3, &profile) || !reader.Read(1, &still_picture) ||
+      !reader.Read(1, &reduced_still_picture_header)) {
+    return false;
+  }
+  uint32 level_index = 0;
+  uint32 tier = 0;
+  if (reduced_still_picture_header) {
+    if (!reader.Read(5, &level_index)) {
+      return false;
+    }
+  } else {
+    uint32 value = 0;
+    uint32 timing_info_present = 0;
+    uint32 decoder_model_info_present = 0;
+    if (!reader.Read(1, &timing_info_present)) {
+      return false;
+    }
+    if (timing_info_present) {
+      // num_units_in_display_tick, time_scale, equal_picture_interval and
+      // num_ticks_per_picture_minus_1.
+      uint32 equal_picture_interval = 0;
+      if (!reader.Read(32, &value) || !reader.Read(32, &value) ||
+          !reader.Read(1, &equal_picture_interval) ||
+          (equal_picture_interval && !reader.ReadUvlc(&value)) ||
+          !reader.Read(1, &decoder_model_info_present)) {
+        return false;
+      }
+      if (decoder_model_info_present) {
+        // buffer_delay_length_minus_1, num_units_in_decoding_tick,
+        // buffer_removal_time_length_minus_1 and
+        // frame_presentation_time_length_minus_1.
+        if (!reader.Read(5, &value) || !reader.Read(32, &value) ||
+            !reader.Read(5, &value) || !reader.Read(5, &value)) {
+          return false;
+        }
+      }
+    }
+
+    // initial_display_delay_present_flag, operating_points_cnt_minus_1 and
+    // operating_point_idc[0], followed by the level and tier of operating
+    // point 0.
+    if (!reader.Read(1, &value) || !reader.Read(5, &value) ||
+        !reader.Read(12, &value) || !reader.Read(5, &level_index) ||
+        (level_index > 7 && !reader.Read(1, &tier))) {
+      return false;
+    }
+  }
+  ptr_config->profile = static_cast<int>(profile);
+  ptr_config->level_index = static_cast<int>(level_index);
+  ptr_config->tier = static_cast<int>(tier);
+  return true;
+}
+
+void BuildAv1CodecConfigRecord(const Av1CodecConfig& config,
+                               const uint8* ptr_obus, int32 length,
+                               std::vector<uint8>* ptr_record) {
+  std::vector<uint8>& record = *ptr_record;
+  record.clear();
+  record.push_back(kAv1cMarkerAndVersion);
+  record.push_back(static_cast<uint8>((config.profile & 0x07) << 5 |
+                                      (config.level_index & 0x1F)));
+
+  // seq_tier_0, high_bitdepth, twelve_bit, monochrome, chroma_subsampling_x,
+  // chroma_subsampling_y and chroma_sample_position, left unknown.
+  record.push_back(static_cast<uint8>(
+      (config.tier ? 0x80 : 0) | (config.bit_depth > 8 ? 0x40 : 0) |
+      (config.bit_depth == 12 ? 0x20 : 0) | (config.monochrome ? 0x10 : 0) |
+      (config.subsampling_x ? 0x08 : 0) | (config.subsampling_y ? 0x04 : 0)));
+
+  // No initial_presentation_delay.
+  record.push_back(0);
+  if (ptr_obus && length > 0) {
+    record.insert(record.end(), ptr_obus, ptr_obus + length);
+  }
+}
+
+}  // namespace webmlive
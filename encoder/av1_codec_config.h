@@ -0,0 +1,75 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_AV1_CODEC_CONFIG_H_
+#define WEBMLIVE_ENCODER_AV1_CODEC_CONFIG_H_
+
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Sequence level index meaning no level limits.
+const int kAv1MaxLevelIndex = 31;
+
+// The AV1 sequence header fields carried by the av1C record, which is the
+// WebM CodecPrivate of AV1 tracks, and by the codecs parameter of DASH
+// manifests. Values are those of the first operating point.
+struct Av1CodecConfig {
+  Av1CodecConfig()
+      : profile(0),
+        level_index(kAv1MaxLevelIndex),
+        tier(0),
+        bit_depth(8),
+        monochrome(false),
+        subsampling_x(1),
+        subsampling_y(1) {}
+
+  // seq_profile; 0 is the main profile, 8 or 10 bit 4:2:0.
+  int profile;
+
+  // seq_level_idx: 0 is level 2.0, 1 level 2.1, and so on, four per major
+  // level. |kAv1MaxLevelIndex| removes the limits.
+  int level_index;
+
+  // seq_tier; 0 is the main tier.
+  int tier;
+
+  int bit_depth;
+  bool monochrome;
+  int subsampling_x;
+  int subsampling_y;
+};
+
+// Returns the index of the lowest AV1 level whose main tier limits admit
+// |width| x |height| frames at |frame_rate| and |bitrate_kbps|, or
+// |kAv1MaxLevelIndex| when no level does.
+int Av1LevelIndex(int width, int height, double frame_rate,
+                  int bitrate_kbps);
+
+// Returns the codecs parameter of |config|, as in "av01.0.08M.08".
+std::string Av1CodecsString(const Av1CodecConfig& config);
+
+// Reads the profile, and the level and tier of the first operating point,
+// from the sequence header OBU at the start of the |length| bytes at
+// |ptr_obu| into |ptr_config|. Returns false when the data does not start
+// with a complete sequence header OBU.
+bool ParseAv1SequenceHeader(const uint8* ptr_obu, int32 length,
+                            Av1CodecConfig* ptr_config);
+
+// Replaces the contents of |ptr_record| with the av1C record of |config|,
+// followed by the |length| bytes of OBUs at |ptr_obus|: the sequence header
+// OBU, and any metadata OBUs that apply to the whole stream.
+void BuildAv1CodecConfigRecord(const Av1CodecConfig& config,
+                               const uint8* ptr_obus, int32 length,
+                               std::vector<uint8>* ptr_record);
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_AV1_CODEC_CONFIG_H_
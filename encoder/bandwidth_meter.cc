@@ -0,0 +1,61 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/bandwidth_meter.h"
+
+#include <algorithm>
+
+namespace webmlive {
+
+namespace {
+const int64 kBitsPerByte = 8;
+const int64 kMillisecondsPerSecond = 1000;
+}  // namespace
+
+BandwidthMeter::BandwidthMeter(int window_chunks)
+    : window_chunks_(std::max(1, window_chunks)),
+      total_bytes_(0),
+      total_duration_ms_(0) {
+}
+
+void BandwidthMeter::AddChunk(int64 bytes, int64 duration_ms) {
+  if (bytes < 0 || duration_ms <= 0)
+    return;
+  const Chunk chunk = {bytes, duration_ms};
+  chunks_.push_back(chunk);
+  total_bytes_ += bytes;
+  total_duration_ms_ += duration_ms;
+  while (chunks_.size() > window_chunks_) {
+    total_bytes_ -= chunks_.front().bytes;
+    total_duration_ms_ -= chunks_.front().duration_ms;
+    chunks_.pop_front();
+  }
+}
+
+void BandwidthMeter::Reset() {
+  chunks_.clear();
+  total_bytes_ = 0;
+  total_duration_ms_ = 0;
+}
+
+int64 BandwidthMeter::peak_bps() const {
+  int64 peak = 0;
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    peak = std::max(peak, chunks_[i].bytes * kBitsPerByte *
+                              kMillisecondsPerSecond / chunks_[i].duration_ms);
+  }
+  return peak;
+}
+
+int64 BandwidthMeter::average_bps() const {
+  if (total_duration_ms_ <= 0)
+    return 0;
+  return total_bytes_ * kBitsPerByte * kMillisecondsPerSecond /
+         total_duration_ms_;
+}
+
+}  // namespace webmlive
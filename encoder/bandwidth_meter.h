@@ -0,0 +1,56 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_BANDWIDTH_METER_H_
+#define WEBMLIVE_ENCODER_BANDWIDTH_METER_H_
+
+#include <cstddef>
+#include <deque>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Measures the bitrate one representation actually produces from the sizes
+// and durations of its last |window_chunks| finished chunks. The peak is the
+// bitrate of the largest chunk relative to its duration, which is what a
+// player fetching chunk by chunk must sustain; the average is the total size
+// of the window over its total duration.
+class BandwidthMeter {
+ public:
+  explicit BandwidthMeter(int window_chunks);
+  ~BandwidthMeter() {}
+
+  // Adds a chunk of |bytes| lasting |duration_ms| milliseconds. Chunks
+  // without a duration are ignored.
+  void AddChunk(int64 bytes, int64 duration_ms);
+
+  // Forgets every chunk.
+  void Reset();
+
+  // Returns true when no chunk is in the window.
+  bool empty() const { return chunks_.empty(); }
+
+  // Bitrates of the window in bits per second, 0 when it is empty.
+  int64 peak_bps() const;
+  int64 average_bps() const;
+
+ private:
+  struct Chunk {
+    int64 bytes;
+    int64 duration_ms;
+  };
+
+  const size_t window_chunks_;
+  std::deque<Chunk> chunks_;
+  int64 total_bytes_;
+  int64 total_duration_ms_;
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_BANDWIDTH_METER_H_
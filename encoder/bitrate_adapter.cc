@@ -0,0 +1,89 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/bitrate_adapter.h"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Upward probing step, as a fraction of |BitrateAdapterConfig::max_kbps|.
+const double kStepUpFraction = 0.05;
+}  // namespace
+
+BitrateAdapter::BitrateAdapter()
+    : target_kbps_(0),
+      start_time_ms_(-1),
+      backed_up_(false) {
+}
+
+int BitrateAdapter::Init(const BitrateAdapterConfig& config,
+                         int initial_kbps) {
+  if (config.min_kbps <= 0 || config.max_kbps < config.min_kbps ||
+      config.update_interval_ms <= 0 ||
+      config.headroom <= 0 || config.headroom > 1) {
+    LOG(ERROR) << "BitrateAdapter invalid config.";
+    return kInvalidArg;
+  }
+  config_ = config;
+  target_kbps_ = std::min(std::max(initial_kbps, config_.min_kbps),
+                          config_.max_kbps);
+  start_time_ms_ = -1;
+  backed_up_ = false;
+  return kSuccess;
+}
+
+bool BitrateAdapter::Update(int64 time_ms, const UplinkEstimate& uplink,
+                            bool backed_up, int* ptr_kbps) {
+  if (!ptr_kbps) {
+    return false;
+  }
+  if (start_time_ms_ < 0) {
+    start_time_ms_ = time_ms;
+    return false;
+  }
+  backed_up_ = backed_up_ || backed_up;
+  if (time_ms - start_time_ms_ < config_.update_interval_ms) {
+    return false;
+  }
+
+  // The low percentile keeps one fast upload from hiding a congested
+  // uplink; the average stands in until enough uploads were measured.
+  const int64 capacity_kbps = uplink.low_capacity_kbps > 0 ?
+      uplink.low_capacity_kbps : uplink.capacity_kbps;
+  const int64 usable_kbps =
+      static_cast<int64>(capacity_kbps * config_.headroom);
+  int new_kbps = target_kbps_;
+  if (uplink.uploads > 0 && uplink.congested() && backed_up_) {
+    new_kbps = static_cast<int>(std::min<int64>(
+        usable_kbps, static_cast<int64>(target_kbps_ * config_.headroom)));
+  } else if (uplink.uploads > 0 && !uplink.congested() && !backed_up_ &&
+             usable_kbps >= target_kbps_) {
+    new_kbps += std::max(1, static_cast<int>(config_.max_kbps *
+                                             kStepUpFraction));
+  }
+  new_kbps = std::min(std::max(new_kbps, config_.min_kbps), config_.max_kbps);
+
+  VLOG(1) << "BitrateAdapter uplink " << capacity_kbps << " kbps, ratio "
+          << uplink.upload_ratio << ", queue growth "
+          << uplink.queue_growth_kbps << " kbps, target " << target_kbps_
+          << " -> " << new_kbps << " kbps";
+
+  start_time_ms_ = time_ms;
+  backed_up_ = false;
+  if (new_kbps == target_kbps_) {
+    return false;
+  }
+  target_kbps_ = new_kbps;
+  *ptr_kbps = new_kbps;
+  return true;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,87 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_BITRATE_ADAPTER_H_
+#define WEBMLIVE_ENCODER_BITRATE_ADAPTER_H_
+
+#include "encoder/basictypes.h"
+#include "encoder/uplink_estimator.h"
+
+namespace webmlive {
+
+struct BitrateAdapterConfig {
+  static const int32 kDefaultUpdateIntervalMs = 2000;
+
+  BitrateAdapterConfig()
+      : min_kbps(0),
+        max_kbps(0),
+        update_interval_ms(kDefaultUpdateIntervalMs),
+        headroom(0.85) {}
+
+  // Bitrate limits in kilobits per second.
+  int min_kbps;
+  int max_kbps;
+
+  // Time between bitrate changes.
+  int32 update_interval_ms;
+
+  // Fraction of the uplink capacity used as the new bitrate when the uplink
+  // is congested, and below which the bitrate is probed upward.
+  double headroom;
+};
+
+// Picks a video bitrate that fits the uplink, as estimated by the uploader's
+// |UplinkEstimator|.
+//
+// Every |update_interval_ms|:
+// - When the uplink is congested and the uploader was backed up, the
+//   bitrate is lowered to |headroom| times the low percentile of the
+//   capacity, and at least by the same fraction.
+// - When the uplink is not congested, the uploader was never backed up, and
+//   the capacity leaves |headroom| above the bitrate, it is raised by 5% of
+//   |max_kbps| to probe for more bandwidth.
+// - Otherwise, for example before uploads were measured, the bitrate is
+//   left alone.
+// Note: the class is not thread safe.
+class BitrateAdapter {
+ public:
+  enum {
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  BitrateAdapter();
+  ~BitrateAdapter() {}
+
+  // Starts adapting from |initial_kbps|. Returns |kSuccess| when |config| is
+  // valid.
+  int Init(const BitrateAdapterConfig& config, int initial_kbps);
+
+  // Reports the |uplink| estimate at |time_ms|, and whether the uploader is
+  // |backed_up|. Returns true and stores the new bitrate in |ptr_kbps| when
+  // the bitrate should change.
+  bool Update(int64 time_ms, const UplinkEstimate& uplink, bool backed_up,
+              int* ptr_kbps);
+
+  int target_kbps() const { return target_kbps_; }
+
+ private:
+  BitrateAdapterConfig config_;
+  int target_kbps_;
+
+  // Start of the current interval. Negative until the first |Update()|.
+  int64 start_time_ms_;
+
+  // Set when the uploader was backed up at any update in the interval.
+  bool backed_up_;
+
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(BitrateAdapter);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_BITRATE_ADAPTER_H_
@@ -8,18 +8,23 @@
 #ifndef WEBMLIVE_ENCODER_BUFFER_POOL_INL_H_
 #define WEBMLIVE_ENCODER_BUFFER_POOL_INL_H_
 
+#include <algorithm>
+#include <atomic>
+#include <limits>
 #include <mutex>
 #include <queue>
+#include <vector>
 
 #include "encoder/basictypes.h"
 #include "encoder/buffer_pool.h"
 #include "encoder/encoder_base.h"
+#include "encoder/lock_profiler.h"
 
 namespace webmlive {
 
 template <class Type>
 inline BufferPool<Type>::~BufferPool() {
-  std::lock_guard<std::mutex> lock(mutex_);
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
   while (!inactive_buffers_.empty()) {
     delete inactive_buffers_.front();
     inactive_buffers_.pop();
@@ -28,6 +33,23 @@ inline BufferPool<Type>::~BufferPool() {
     delete active_buffers_.front();
     active_buffers_.pop();
   }
+
+  // |ring_| slots outside [read, write) hold stale pointers to buffer objects
+  // that have moved on to |free_ring_|.
+  if (lock_free_) {
+    const int32 write_index = write_index_.load(std::memory_order_acquire);
+    for (int32 i = read_index_.load(std::memory_order_acquire);
+         i != write_index; i = NextRingIndex(i)) {
+      delete ring_[i];
+    }
+    const int32 free_write_index =
+        free_write_index_.load(std::memory_order_acquire);
+    for (int32 i = free_read_index_.load(std::memory_order_acquire);
+         i != free_write_index; i = NextRingIndex(i)) {
+      delete free_ring_[i];
+    }
+    delete ptr_spare_buffer_;
+  }
 }
 
 // Obtains lock and populates |inactive_buffers_| with |Type| pointers.
@@ -36,8 +58,9 @@ inline int BufferPool<Type>::Init(bool allow_growth, int num_buffers) {
   if (num_buffers <= 0) {
     return kInvalidArg;
   }
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (!inactive_buffers_.empty() || !active_buffers_.empty()) {
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
+  if (!inactive_buffers_.empty() || !active_buffers_.empty() ||
+      !ring_.empty()) {
     return kAlreadyInitialized;
   }
   for (int i = 0; i < num_buffers; ++i) {
@@ -46,41 +69,113 @@ inline int BufferPool<Type>::Init(bool allow_growth, int num_buffers) {
       return kNoMemory;
     }
     inactive_buffers_.push(ptr_buffer);
+    allocated_.fetch_add(1, std::memory_order_relaxed);
   }
   allow_growth_ = allow_growth;
   return kSuccess;
 }
 
+template <class Type>
+inline int BufferPool<Type>::InitLockFree(int num_buffers) {
+  return InitLockFree(num_buffers, num_buffers);
+}
+
+// Obtains lock, sizes |ring_| and |free_ring_| for |max_buffers|, and
+// populates |free_ring_| with |num_buffers| |Type| pointers. The lock is only
+// needed to guard against concurrent initialization; the producer and
+// consumer threads must not touch the pool until this returns.
+template <class Type>
+inline int BufferPool<Type>::InitLockFree(int num_buffers, int max_buffers) {
+  if (num_buffers <= 0 || max_buffers < num_buffers) {
+    return kInvalidArg;
+  }
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
+  if (!inactive_buffers_.empty() || !active_buffers_.empty() ||
+      !ring_.empty()) {
+    return kAlreadyInitialized;
+  }
+  const int ring_size = max_buffers + 1;
+  ring_.assign(ring_size, NULL);
+  free_ring_.assign(ring_size, NULL);
+  read_index_.store(0, std::memory_order_relaxed);
+  write_index_.store(0, std::memory_order_relaxed);
+  free_read_index_.store(0, std::memory_order_relaxed);
+  free_write_index_.store(0, std::memory_order_relaxed);
+  allow_growth_ = false;
+  lock_free_ = true;
+  max_buffers_ = max_buffers;
+  limit_.store(num_buffers, std::memory_order_relaxed);
+  for (int i = 0; i < num_buffers; ++i) {
+    Type* const ptr_buffer = new (std::nothrow) Type;  // NOLINT
+    if (!ptr_buffer) {
+      return kNoMemory;
+    }
+    free_ring_[i] = ptr_buffer;
+    free_write_index_.store(i + 1, std::memory_order_relaxed);
+    allocated_.fetch_add(1, std::memory_order_relaxed);
+    empty_buffers_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return kSuccess;
+}
+
+template <class Type>
+inline void BufferPool<Type>::SetLimit(int32 limit) {
+  if (lock_free_) {
+    limit = std::max(1, std::min(limit, max_buffers_));
+  } else if (limit < 0) {
+    limit = 0;
+  }
+  limit_.store(limit, std::memory_order_relaxed);
+}
+
+template <class Type>
+inline void BufferPool<Type>::SetPolicy(BufferPoolPolicy policy,
+                                        int64 max_age) {
+  policy_.store(policy, std::memory_order_relaxed);
+  max_age_.store(max_age > 0 ? max_age : 0, std::memory_order_relaxed);
+}
+
+template <class Type>
+inline BufferPoolStats BufferPool<Type>::stats() const {
+  BufferPoolStats stats;
+  stats.grow_count = grow_count_.load(std::memory_order_relaxed);
+  stats.shrink_count = shrink_count_.load(std::memory_order_relaxed);
+  stats.full_count = full_count_.load(std::memory_order_relaxed);
+  stats.dropped_count = dropped_count_.load(std::memory_order_relaxed);
+  stats.high_water = high_water_.load(std::memory_order_relaxed);
+  return stats;
+}
+
 // Obtains lock, copies |ptr_buffer| data into front buffer object from
 // |inactive_buffers_|, and moves the filled buffer object into
 // |active_buffers_|.
 template <class Type>
 inline int BufferPool<Type>::Commit(Type* ptr_buffer) {
-  if (!ptr_buffer || !ptr_buffer->buffer()) {
+  if (!ptr_buffer || ptr_buffer->empty()) {
     return kInvalidArg;
   }
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (inactive_buffers_.empty()) {
-    if (allow_growth_) {
-      Type* const ptr_buffer = new (std::nothrow) Type;  // NOLINT
-      if (!ptr_buffer) {
-        return kNoMemory;
-      }
-      inactive_buffers_.push(ptr_buffer);
-    } else {
-      return kFull;
-    }
+  if (lock_free_) {
+    return CommitLockFree(ptr_buffer);
+  }
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
+  if (ActiveFull()) {
+    return kFull;
+  }
+  Type* ptr_pool_buffer = NULL;
+  const int status = TakeInactiveBuffer(&ptr_pool_buffer);
+  if (status) {
+    return status;
   }
 
-  // Copy user data into front buffer object from |inactive_buffers_|.
-  Type* const ptr_pool_buffer = inactive_buffers_.front();
+  // Copy user data into the buffer object, and move it into the active
+  // queue.
   if (Exchange(ptr_buffer, ptr_pool_buffer)) {
+    inactive_buffers_.push(ptr_pool_buffer);
     return kNoMemory;
   }
-
-  // Move the now active buffer object into the active queue.
-  inactive_buffers_.pop();
   active_buffers_.push(ptr_pool_buffer);
+  UpdateNewestTimestamp(ptr_pool_buffer->timestamp());
+  UpdateHighWater(static_cast<int32>(active_buffers_.size()));
   return kSuccess;
 }
 
@@ -92,7 +187,11 @@ inline int BufferPool<Type>::Decommit(Type* ptr_buffer) {
   if (!ptr_buffer) {
     return kInvalidArg;
   }
-  std::lock_guard<std::mutex> lock(mutex_);
+  if (lock_free_) {
+    return DecommitLockFree(ptr_buffer);
+  }
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
+  DropStaleBuffers();
   if (active_buffers_.empty()) {
     return kEmpty;
   }
@@ -105,16 +204,176 @@ inline int BufferPool<Type>::Decommit(Type* ptr_buffer) {
 
   // Put the now inactive buffer back in the pool.
   active_buffers_.pop();
-  inactive_buffers_.push(ptr_active_buffer);
+  ReleaseInactiveBuffer(ptr_active_buffer);
+  return kSuccess;
+}
+
+template <class Type>
+inline int BufferPool<Type>::Acquire(Lease* ptr_lease) {
+  if (!ptr_lease) {
+    return kInvalidArg;
+  }
+  ptr_lease->Release();
+  Type* ptr_buffer = NULL;
+  int status = kSuccess;
+  if (lock_free_) {
+    int32 active_count = 0;
+    if (RingFull(&active_count)) {
+      return kFull;
+    }
+    status = TakeFreeBuffer(&ptr_buffer);
+  } else {
+    WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
+    if (ActiveFull()) {
+      return kFull;
+    }
+    status = TakeInactiveBuffer(&ptr_buffer);
+  }
+  if (status) {
+    return status;
+  }
+  ptr_lease->ptr_pool_ = this;
+  ptr_lease->ptr_buffer_ = ptr_buffer;
+  ptr_lease->producer_ = true;
+  return kSuccess;
+}
+
+// Publishes the leased buffer object as |Commit(Type*)| does, without the
+// |Exchange()|.
+template <class Type>
+inline int BufferPool<Type>::Commit(Lease* ptr_lease) {
+  if (!ptr_lease || ptr_lease->ptr_pool_ != this || !ptr_lease->producer_) {
+    return kInvalidArg;
+  }
+  Type* const ptr_buffer = ptr_lease->ptr_buffer_;
+  if (lock_free_) {
+    int32 active_count = 0;
+    if (RingFull(&active_count)) {
+      return kFull;
+    }
+    const int32 write_index = write_index_.load(std::memory_order_relaxed);
+    ring_[write_index] = ptr_buffer;
+    UpdateNewestTimestamp(ptr_buffer->timestamp());
+    write_index_.store(NextRingIndex(write_index), std::memory_order_release);
+    UpdateHighWater(active_count + 1);
+  } else {
+    WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
+    if (ActiveFull()) {
+      return kFull;
+    }
+    active_buffers_.push(ptr_buffer);
+    UpdateNewestTimestamp(ptr_buffer->timestamp());
+    UpdateHighWater(static_cast<int32>(active_buffers_.size()));
+  }
+  ptr_lease->ptr_pool_ = NULL;
+  ptr_lease->ptr_buffer_ = NULL;
   return kSuccess;
 }
 
+template <class Type>
+inline int BufferPool<Type>::Decommit(Lease* ptr_lease) {
+  if (!ptr_lease) {
+    return kInvalidArg;
+  }
+  ptr_lease->Release();
+  Type* ptr_buffer = NULL;
+  if (lock_free_) {
+    DropStaleBuffers();
+    const int32 read_index = read_index_.load(std::memory_order_relaxed);
+    if (read_index == write_index_.load(std::memory_order_acquire)) {
+      return kEmpty;
+    }
+    ptr_buffer = ring_[read_index];
+    read_index_.store(NextRingIndex(read_index), std::memory_order_release);
+  } else {
+    WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
+    DropStaleBuffers();
+    if (active_buffers_.empty()) {
+      return kEmpty;
+    }
+    ptr_buffer = active_buffers_.front();
+    active_buffers_.pop();
+  }
+  ptr_lease->ptr_pool_ = this;
+  ptr_lease->ptr_buffer_ = ptr_buffer;
+  ptr_lease->producer_ = false;
+  return kSuccess;
+}
+
+template <class Type>
+inline int BufferPool<Type>::DecommitBatch(Batch* ptr_batch) {
+  return DecommitBatch(std::numeric_limits<int64>::max(), ptr_batch);
+}
+
+template <class Type>
+inline int BufferPool<Type>::DecommitBatch(int64 max_timestamp,
+                                           Batch* ptr_batch) {
+  if (!ptr_batch) {
+    return kInvalidArg;
+  }
+  const size_t batch_size = ptr_batch->size();
+  if (lock_free_) {
+    DropStaleBuffers();
+
+    // Publish the new |read_index_| once, after the last slot is read.
+    const int32 write_index = write_index_.load(std::memory_order_acquire);
+    int32 read_index = read_index_.load(std::memory_order_relaxed);
+    while (read_index != write_index &&
+           ring_[read_index]->timestamp() <= max_timestamp) {
+      ptr_batch->push_back(ring_[read_index]);
+      read_index = NextRingIndex(read_index);
+    }
+    read_index_.store(read_index, std::memory_order_release);
+  } else {
+    WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
+    DropStaleBuffers();
+    while (!active_buffers_.empty() &&
+           active_buffers_.front()->timestamp() <= max_timestamp) {
+      ptr_batch->push_back(active_buffers_.front());
+      active_buffers_.pop();
+    }
+  }
+  return ptr_batch->size() > batch_size ? kSuccess : kEmpty;
+}
+
+template <class Type>
+inline void BufferPool<Type>::ReleaseBatch(Batch* ptr_batch) {
+  if (!ptr_batch) {
+    return;
+  }
+  if (lock_free_) {
+    for (size_t i = 0; i < ptr_batch->size(); ++i) {
+      ReleaseBuffer((*ptr_batch)[i]);
+    }
+  } else {
+    WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
+    for (size_t i = 0; i < ptr_batch->size(); ++i) {
+      ReleaseInactiveBuffer((*ptr_batch)[i]);
+    }
+  }
+  ptr_batch->clear();
+}
+
+// In lock free mode the consumer drops everything the producer has published
+// by releasing the buffer objects up to the current |write_index_|.
 template <class Type>
 inline void BufferPool<Type>::Flush() {
-  std::lock_guard<std::mutex> lock(mutex_);
+  if (lock_free_) {
+    const int32 write_index = write_index_.load(std::memory_order_acquire);
+    int32 read_index = read_index_.load(std::memory_order_relaxed);
+    while (read_index != write_index) {
+      Type* const ptr_buffer = ring_[read_index];
+      read_index = NextRingIndex(read_index);
+      read_index_.store(read_index, std::memory_order_release);
+      ReleaseBuffer(ptr_buffer);
+    }
+    return;
+  }
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
   while (!active_buffers_.empty()) {
-    inactive_buffers_.push(active_buffers_.front());
+    Type* const ptr_buffer = active_buffers_.front();
     active_buffers_.pop();
+    ReleaseInactiveBuffer(ptr_buffer);
   }
 }
 
@@ -140,7 +399,17 @@ inline int BufferPool<Type>::ActiveBufferTimestamp(int64* ptr_timestamp) {
     return kInvalidArg;
   }
   int status = kEmpty;
-  std::lock_guard<std::mutex> lock(mutex_);
+  if (lock_free_) {
+    DropStaleBuffers();
+    const int32 read_index = read_index_.load(std::memory_order_relaxed);
+    if (read_index != write_index_.load(std::memory_order_acquire)) {
+      *ptr_timestamp = ring_[read_index]->timestamp();
+      status = kSuccess;
+    }
+    return status;
+  }
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
+  DropStaleBuffers();
   if (!active_buffers_.empty()) {
     *ptr_timestamp = active_buffers_.front()->timestamp();
     status = kSuccess;
@@ -150,19 +419,329 @@ inline int BufferPool<Type>::ActiveBufferTimestamp(int64* ptr_timestamp) {
 
 template <class Type>
 inline void BufferPool<Type>::DropActiveBuffer() {
-  std::lock_guard<std::mutex> lock(mutex_);
+  if (lock_free_) {
+    const int32 read_index = read_index_.load(std::memory_order_relaxed);
+    if (read_index != write_index_.load(std::memory_order_acquire)) {
+      Type* const ptr_buffer = ring_[read_index];
+      read_index_.store(NextRingIndex(read_index), std::memory_order_release);
+      ReleaseBuffer(ptr_buffer);
+    }
+    return;
+  }
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
   if (!active_buffers_.empty()) {
-    inactive_buffers_.push(active_buffers_.front());
+    Type* const ptr_buffer = active_buffers_.front();
     active_buffers_.pop();
+    ReleaseInactiveBuffer(ptr_buffer);
   }
 }
 
 template <class Type>
 inline bool BufferPool<Type>::IsEmpty() const {
-  std::lock_guard<std::mutex> lock(mutex_);
+  if (lock_free_) {
+    return read_index_.load(std::memory_order_acquire) ==
+        write_index_.load(std::memory_order_acquire);
+  }
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
   return active_buffers_.empty();
 }
 
+template <class Type>
+inline int32 BufferPool<Type>::ActiveCount() const {
+  if (lock_free_) {
+    const int32 ring_size = static_cast<int32>(ring_.size());
+    const int32 read_index = read_index_.load(std::memory_order_acquire);
+    const int32 write_index = write_index_.load(std::memory_order_acquire);
+    return (write_index - read_index + ring_size) % ring_size;
+  }
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
+  return static_cast<int32>(active_buffers_.size());
+}
+
+template <class Type>
+inline int32 BufferPool<Type>::Capacity() const {
+  if (lock_free_) {
+    return limit_.load(std::memory_order_relaxed);
+  }
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
+  return static_cast<int32>(active_buffers_.size() + inactive_buffers_.size());
+}
+
+template <class Type>
+inline int32 BufferPool<Type>::NextRingIndex(int32 index) const {
+  ++index;
+  return index == static_cast<int32>(ring_.size()) ? 0 : index;
+}
+
+// Copies |ptr_buffer| data into a free buffer object, stores it at
+// |write_index_|, and then publishes it to the consumer by advancing
+// |write_index_|. Returns |kFull| when the limit is reached, or when every
+// allocated buffer object is in use and no more may be allocated.
+template <class Type>
+inline int BufferPool<Type>::CommitLockFree(Type* ptr_buffer) {
+  int32 active_count = 0;
+  if (RingFull(&active_count)) {
+    return kFull;
+  }
+  Type* ptr_pool_buffer = NULL;
+  const int status = TakeFreeBuffer(&ptr_pool_buffer);
+  if (status) {
+    return status;
+  }
+  if (Exchange(ptr_buffer, ptr_pool_buffer)) {
+    ptr_spare_buffer_ = ptr_pool_buffer;
+    return kNoMemory;
+  }
+  const int32 write_index = write_index_.load(std::memory_order_relaxed);
+  ring_[write_index] = ptr_pool_buffer;
+  UpdateNewestTimestamp(ptr_pool_buffer->timestamp());
+  write_index_.store(NextRingIndex(write_index), std::memory_order_release);
+  UpdateHighWater(active_count + 1);
+  return kSuccess;
+}
+
+// Copies the buffer object at |read_index_| to |ptr_buffer|, returns the slot
+// to the producer by advancing |read_index_|, and then releases the buffer
+// object.
+template <class Type>
+inline int BufferPool<Type>::DecommitLockFree(Type* ptr_buffer) {
+  DropStaleBuffers();
+  const int32 read_index = read_index_.load(std::memory_order_relaxed);
+  if (read_index == write_index_.load(std::memory_order_acquire)) {
+    return kEmpty;
+  }
+  Type* const ptr_active_buffer = ring_[read_index];
+  if (Exchange(ptr_active_buffer, ptr_buffer)) {
+    return kNoMemory;
+  }
+  read_index_.store(NextRingIndex(read_index), std::memory_order_release);
+  ReleaseBuffer(ptr_active_buffer);
+  return kSuccess;
+}
+
+template <class Type>
+inline bool BufferPool<Type>::ActiveFull() {
+  const int32 limit = limit_.load(std::memory_order_relaxed);
+  if (limit <= 0 || static_cast<int32>(active_buffers_.size()) < limit) {
+    return false;
+  }
+  if (policy_.load(std::memory_order_relaxed) == kPoolRejectNewest) {
+    full_count_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  while (static_cast<int32>(active_buffers_.size()) >= limit) {
+    Type* const ptr_buffer = active_buffers_.front();
+    active_buffers_.pop();
+    ReleaseInactiveBuffer(ptr_buffer);
+    dropped_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return false;
+}
+
+template <class Type>
+inline bool BufferPool<Type>::RingFull(int32* ptr_active_count) {
+  const int32 write_index = write_index_.load(std::memory_order_relaxed);
+  const int32 read_index = read_index_.load(std::memory_order_acquire);
+  const int32 ring_size = static_cast<int32>(ring_.size());
+  *ptr_active_count = (write_index - read_index + ring_size) % ring_size;
+  const bool at_limit =
+      *ptr_active_count >= limit_.load(std::memory_order_relaxed) &&
+      policy_.load(std::memory_order_relaxed) == kPoolRejectNewest;
+  if (NextRingIndex(write_index) == read_index || at_limit) {
+    full_count_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+template <class Type>
+inline void BufferPool<Type>::DropStaleBuffers() {
+  const BufferPoolPolicy policy = policy_.load(std::memory_order_relaxed);
+  const int64 max_age = max_age_.load(std::memory_order_relaxed);
+  if (policy == kPoolRejectNewest && max_age == 0) {
+    return;
+  }
+
+  // Waiting buffer objects beyond |max_count|, and those older than
+  // |max_age|, are dropped oldest first. The newest is never too old.
+  int32 max_count = std::numeric_limits<int32>::max();
+  const int32 limit = limit_.load(std::memory_order_relaxed);
+  if (policy == kPoolKeepLatest) {
+    max_count = 1;
+  } else if (policy == kPoolDropOldest && limit > 0) {
+    max_count = limit;
+  }
+  if (lock_free_) {
+    const int32 write_index = write_index_.load(std::memory_order_acquire);
+    const int64 newest_timestamp =
+        newest_timestamp_.load(std::memory_order_relaxed);
+    const int32 ring_size = static_cast<int32>(ring_.size());
+    int32 read_index = read_index_.load(std::memory_order_relaxed);
+    int32 active_count = (write_index - read_index + ring_size) % ring_size;
+    while (active_count > 0 &&
+           (active_count > max_count ||
+            (max_age > 0 &&
+             newest_timestamp - ring_[read_index]->timestamp() > max_age))) {
+      Type* const ptr_buffer = ring_[read_index];
+      read_index = NextRingIndex(read_index);
+      read_index_.store(read_index, std::memory_order_release);
+      ReleaseBuffer(ptr_buffer);
+      --active_count;
+      dropped_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return;
+  }
+  const int64 newest_timestamp =
+      newest_timestamp_.load(std::memory_order_relaxed);
+  while (!active_buffers_.empty() &&
+         (static_cast<int32>(active_buffers_.size()) > max_count ||
+          (max_age > 0 && newest_timestamp -
+               active_buffers_.front()->timestamp() > max_age))) {
+    Type* const ptr_buffer = active_buffers_.front();
+    active_buffers_.pop();
+    ReleaseInactiveBuffer(ptr_buffer);
+    dropped_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+template <class Type>
+inline void BufferPool<Type>::UpdateNewestTimestamp(int64 timestamp) {
+  newest_timestamp_.store(timestamp, std::memory_order_relaxed);
+}
+
+template <class Type>
+inline int BufferPool<Type>::TakeInactiveBuffer(Type** ptr_buffer) {
+  if (inactive_buffers_.empty()) {
+    if (!allow_growth_) {
+      full_count_.fetch_add(1, std::memory_order_relaxed);
+      return kFull;
+    }
+    Type* const ptr_new_buffer = new (std::nothrow) Type;  // NOLINT
+    if (!ptr_new_buffer) {
+      return kNoMemory;
+    }
+    allocated_.fetch_add(1, std::memory_order_relaxed);
+    grow_count_.fetch_add(1, std::memory_order_relaxed);
+    *ptr_buffer = ptr_new_buffer;
+    return kSuccess;
+  }
+  *ptr_buffer = inactive_buffers_.front();
+  inactive_buffers_.pop();
+  return kSuccess;
+}
+
+template <class Type>
+inline int BufferPool<Type>::TakeFreeBuffer(Type** ptr_buffer) {
+  Type* ptr_free_buffer = ptr_spare_buffer_;
+  ptr_spare_buffer_ = NULL;
+  if (!ptr_free_buffer) {
+    ptr_free_buffer = PopFreeBuffer();
+  }
+  if (!ptr_free_buffer) {
+    if (allocated_.load(std::memory_order_acquire) >= max_buffers_) {
+      full_count_.fetch_add(1, std::memory_order_relaxed);
+      return kFull;
+    }
+    ptr_free_buffer = new (std::nothrow) Type;  // NOLINT
+    if (!ptr_free_buffer) {
+      return kNoMemory;
+    }
+    allocated_.fetch_add(1, std::memory_order_acq_rel);
+    grow_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+  *ptr_buffer = ptr_free_buffer;
+  return kSuccess;
+}
+
+// Producer leases in lock free mode go back to |ptr_spare_buffer_|, which
+// only the producer touches; the free list only flows from the consumer.
+template <class Type>
+inline void BufferPool<Type>::ReleaseLease(Lease* ptr_lease) {
+  Type* const ptr_buffer = ptr_lease->ptr_buffer_;
+  ptr_lease->ptr_pool_ = NULL;
+  ptr_lease->ptr_buffer_ = NULL;
+  if (!ptr_buffer) {
+    return;
+  }
+  if (!lock_free_) {
+    WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
+    ReleaseInactiveBuffer(ptr_buffer);
+  } else if (!ptr_lease->producer_) {
+    ReleaseBuffer(ptr_buffer);
+  } else if (!ptr_spare_buffer_) {
+    ptr_spare_buffer_ = ptr_buffer;
+  } else {
+    delete ptr_buffer;
+    allocated_.fetch_sub(1, std::memory_order_acq_rel);
+    shrink_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+template <class Type>
+inline Type* BufferPool<Type>::PopFreeBuffer() {
+  const int32 free_read_index =
+      free_read_index_.load(std::memory_order_relaxed);
+  if (free_read_index == free_write_index_.load(std::memory_order_acquire)) {
+    return NULL;
+  }
+  Type* const ptr_buffer = free_ring_[free_read_index];
+  if (ptr_buffer->empty()) {
+    empty_buffers_.fetch_sub(1, std::memory_order_acq_rel);
+  }
+  free_read_index_.store(NextRingIndex(free_read_index),
+                         std::memory_order_release);
+  return ptr_buffer;
+}
+
+// |free_ring_| holds at most |max_buffers_| buffer objects, and so is never
+// full; the check only guards against misuse. Buffer objects over the limit
+// stay in the free list without their payloads, and are filled again by
+// |Exchange()| when the producer next takes them.
+template <class Type>
+inline void BufferPool<Type>::ReleaseBuffer(Type* ptr_buffer) {
+  const int32 free_write_index =
+      free_write_index_.load(std::memory_order_relaxed);
+  const int32 next_index = NextRingIndex(free_write_index);
+  if (next_index == free_read_index_.load(std::memory_order_acquire)) {
+    delete ptr_buffer;
+    allocated_.fetch_sub(1, std::memory_order_acq_rel);
+    shrink_count_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  if (!ptr_buffer->empty()) {
+    const int32 loaded = allocated_.load(std::memory_order_acquire) -
+                         empty_buffers_.load(std::memory_order_acquire);
+    if (loaded > limit_.load(std::memory_order_relaxed)) {
+      ptr_buffer->Free();
+      shrink_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  if (ptr_buffer->empty()) {
+    empty_buffers_.fetch_add(1, std::memory_order_acq_rel);
+  }
+  free_ring_[free_write_index] = ptr_buffer;
+  free_write_index_.store(next_index, std::memory_order_release);
+}
+
+template <class Type>
+inline void BufferPool<Type>::ReleaseInactiveBuffer(Type* ptr_buffer) {
+  const int32 limit = limit_.load(std::memory_order_relaxed);
+  if (limit > 0 && allocated_.load(std::memory_order_relaxed) > limit) {
+    delete ptr_buffer;
+    allocated_.fetch_sub(1, std::memory_order_relaxed);
+    shrink_count_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  inactive_buffers_.push(ptr_buffer);
+}
+
+template <class Type>
+inline void BufferPool<Type>::UpdateHighWater(int32 count) {
+  if (count > high_water_.load(std::memory_order_relaxed)) {
+    high_water_.store(count, std::memory_order_relaxed);
+  }
+}
+
 }  // namespace webmlive
 
 #endif  // WEBMLIVE_ENCODER_BUFFER_POOL_INL_H_
@@ -8,20 +8,94 @@
 #ifndef WEBMLIVE_ENCODER_BUFFER_POOL_H_
 #define WEBMLIVE_ENCODER_BUFFER_POOL_H_
 
+#include <atomic>
+#include <deque>
 #include <mutex>
 #include <queue>
+#include <vector>
 
 #include "encoder/basictypes.h"
 #include "encoder/encoder_base.h"
 
 namespace webmlive {
 
+// Counts of |BufferPool| events since initialization.
+struct BufferPoolStats {
+  BufferPoolStats()
+      : grow_count(0), shrink_count(0), full_count(0), dropped_count(0),
+        high_water(0) {}
+
+  // Buffer objects allocated after initialization, and freed, or in lock
+  // free mode emptied of their payload, because the pool held more than its
+  // limit.
+  int64 grow_count;
+  int64 shrink_count;
+
+  // |Commit()| and |Acquire()| calls that returned |kFull|.
+  int64 full_count;
+
+  // Buffer objects dropped unread by the |BufferPoolPolicy| or the maximum
+  // age.
+  int64 dropped_count;
+
+  // Largest number of buffer objects ever waiting to be decommitted.
+  int32 high_water;
+};
+
+// What |BufferPool| does with a buffer object committed at the limit.
+enum BufferPoolPolicy {
+  // Reject it: |Commit()| and |Acquire()| return |kFull|.
+  kPoolRejectNewest = 0,
+
+  // Drop the oldest waiting buffer object to make room for it.
+  kPoolDropOldest = 1,
+
+  // Drop every older waiting buffer object, so that the consumer only ever
+  // reads the latest one.
+  kPoolKeepLatest = 2,
+};
+
 // Buffer pooling object used to pass data between threads. In order to be
 // managed by this class Buffer objects must implement the following methods:
 //   uint8* buffer() const;
 //   int64 timestamp() const;
+//   bool empty() const;
+//   void Free();
 //   int Clone(Type*);
 //   int Swap(Type*);
+// |Free()| releases the payload and leaves the buffer object |empty()|.
+//
+// |Acquire()|, |Commit(Lease*)| and |Decommit(Lease*)| lend buffer objects
+// through a |Lease| instead, so that producers fill them and consumers read
+// them in place. Buffer objects used only that way need no |Clone()| or
+// |Swap()|.
+//
+// Two modes of operation are supported, selected by the method used to
+// initialize the pool:
+// - |Init()| creates a mutex protected pool that can optionally grow, and that
+//   can be used with any number of producer and consumer threads.
+// - |InitLockFree()| creates a single-producer/single-consumer ring. In this
+//   mode |Commit()| and |Acquire()| must only be called from one thread, and
+//   |Decommit()|, |DecommitBatch()|, |ReleaseBatch()|, |Flush()|,
+//   |ActiveBufferTimestamp()|, |DropActiveBuffer()| and |SetLimit()| must
+//   only be called from one other thread. Leases are released by the
+//   thread that obtained them. No locks are taken. Buffer objects beyond the
+//   initial count are allocated by |Commit()| and |Acquire()|, up to the
+//   |max_buffers| passed to |InitLockFree()|.
+//
+// |SetLimit()| bounds the number of buffer objects waiting to be decommitted.
+// Growth stops at the limit, and buffer objects returned to the pool while
+// more than the limit exist are freed, so lowering the limit gives memory
+// back as the consumer catches up. In lock free mode the free list keeps
+// every buffer object, up to |max_buffers|, and only their payloads are
+// freed, so that the producer does not allocate a buffer object per commit
+// while the pool stays over the limit.
+//
+// |SetPolicy()| selects what happens at the limit, and can bound the age of
+// waiting buffer objects, so that consumers of live data read fresh data
+// instead of falling behind. In lock free mode the producer cannot take
+// buffer objects back from the ring: it commits past the limit, up to
+// |max_buffers|, and the consumer drops the oldest when it next decommits.
 template <class Type>
 class BufferPool {
  public:
@@ -42,7 +116,81 @@ class BufferPool {
   };
 
   static const int32 kDefaultBufferCount = 4;
-  BufferPool() : allow_growth_(false) {}
+
+  // Buffer objects taken from the pool by |DecommitBatch()|, oldest first.
+  typedef std::deque<Type*> Batch;
+
+  // Move only handle to a buffer object lent by |Acquire()| or
+  // |Decommit(Lease*)|. The buffer object returns to the pool when the lease
+  // is released, destroyed, or assigned another lease, or when |Commit()|
+  // publishes it. A lease must not outlive its pool.
+  class Lease {
+   public:
+    Lease() : ptr_pool_(NULL), ptr_buffer_(NULL), producer_(false) {}
+    Lease(Lease&& other)
+        : ptr_pool_(other.ptr_pool_),
+          ptr_buffer_(other.ptr_buffer_),
+          producer_(other.producer_) {
+      other.ptr_pool_ = NULL;
+      other.ptr_buffer_ = NULL;
+    }
+    ~Lease() { Release(); }
+
+    Lease& operator=(Lease&& other) {
+      if (this != &other) {
+        Release();
+        ptr_pool_ = other.ptr_pool_;
+        ptr_buffer_ = other.ptr_buffer_;
+        producer_ = other.producer_;
+        other.ptr_pool_ = NULL;
+        other.ptr_buffer_ = NULL;
+      }
+      return *this;
+    }
+
+    // Returns the buffer object to the pool. Does nothing when the lease is
+    // empty.
+    void Release() {
+      if (ptr_pool_) {
+        ptr_pool_->ReleaseLease(this);
+      }
+    }
+
+    Type* get() const { return ptr_buffer_; }
+    Type* operator->() const { return ptr_buffer_; }
+    Type& operator*() const { return *ptr_buffer_; }
+    explicit operator bool() const { return ptr_buffer_ != NULL; }
+
+   private:
+    friend class BufferPool;
+    BufferPool* ptr_pool_;
+    Type* ptr_buffer_;
+
+    // True for leases from |Acquire()|, which belong to the producer.
+    bool producer_;
+    WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(Lease);
+  };
+
+  BufferPool()
+      : allow_growth_(false),
+        lock_free_(false),
+        max_buffers_(0),
+        ptr_spare_buffer_(NULL),
+        limit_(0),
+        allocated_(0),
+        empty_buffers_(0),
+        read_index_(0),
+        write_index_(0),
+        free_read_index_(0),
+        free_write_index_(0),
+        policy_(kPoolRejectNewest),
+        max_age_(0),
+        newest_timestamp_(0),
+        grow_count_(0),
+        shrink_count_(0),
+        full_count_(0),
+        dropped_count_(0),
+        high_water_(0) {}
   ~BufferPool();
 
   // Allocates |num_buffers| buffer objects, pushes them into
@@ -51,6 +199,35 @@ class BufferPool {
   // already been called.
   int Init(bool allow_growth, int num_buffers);
 
+  // Allocates |num_buffers| buffer objects for a lock free pool that never
+  // grows, and returns |kSuccess|. Return values match those of |Init()|.
+  int InitLockFree(int num_buffers);
+
+  // Allocates |num_buffers| buffer objects for a lock free pool that can grow
+  // to |max_buffers|, sets the limit to |num_buffers|, and returns |kSuccess|.
+  // Returns |kInvalidArg| when |max_buffers| is less than |num_buffers|.
+  // Other return values match those of |Init()|.
+  int InitLockFree(int num_buffers, int max_buffers);
+
+  // Sets the number of buffer objects that may wait to be decommitted.
+  // |Commit()| returns |kFull| at the limit. In lock free mode |limit| is
+  // clamped to [1, max_buffers]; otherwise values <= 0 remove the limit.
+  void SetLimit(int32 limit);
+  int32 limit() const { return limit_.load(std::memory_order_relaxed); }
+
+  // Sets the policy applied at the limit, and the maximum age of waiting
+  // buffer objects: those older than the newest committed buffer object by
+  // more than |max_age|, in |Type::timestamp()| units, are dropped instead
+  // of decommitted. No maximum age when |max_age| is <= 0. May be called
+  // from any thread; defaults to |kPoolRejectNewest| and no maximum age.
+  void SetPolicy(BufferPoolPolicy policy, int64 max_age);
+  BufferPoolPolicy policy() const {
+    return policy_.load(std::memory_order_relaxed);
+  }
+
+  // Returns counts of pool events since initialization.
+  BufferPoolStats stats() const;
+
   // Grabs a buffer object pointer from |inactive_buffers_|, copies the data
   // from |ptr_buffer|, and pushes it into |active_buffers_|. Returns |kSuccess|
   // when able to store the data. Returns |kFull| when |inactive_buffers_| is
@@ -63,6 +240,38 @@ class BufferPool {
   // |active_buffers_| contains no buffer objects.
   int Decommit(Type* ptr_buffer);
 
+  // Lends an unused buffer object to the producer through |ptr_lease|, after
+  // releasing what |ptr_lease| held. The caller fills it in place and passes
+  // it to |Commit(Lease*)|, or releases the lease to give it back unused.
+  // Returns |kSuccess|, or |kFull| under the same conditions as |Commit()|
+  // so that a frame about to be dropped is not filled.
+  int Acquire(Lease* ptr_lease);
+
+  // Publishes the buffer object filled through |ptr_lease|, a lease from
+  // |Acquire()| on this pool, and empties |ptr_lease|. Returns |kSuccess|, or
+  // |kFull| when the limit was reached after |Acquire()|; |ptr_lease| keeps
+  // the buffer object then. Returns |kInvalidArg| for other leases.
+  int Commit(Lease* ptr_lease);
+
+  // Lends the oldest buffer object waiting to be decommitted to the consumer
+  // through |ptr_lease|, after releasing what |ptr_lease| held. The caller
+  // reads it in place, and may swap its data elsewhere. Returns |kSuccess|
+  // when successful, and |kEmpty| when no buffer object is waiting.
+  int Decommit(Lease* ptr_lease);
+
+  // Moves the buffer objects waiting to be decommitted to the back of
+  // |ptr_batch| in one operation, taking the lock once. The second form stops
+  // at the first buffer object with a timestamp after |max_timestamp|. The
+  // caller reads the buffer objects in place, and must return them with
+  // |ReleaseBatch()| before the pool is destroyed. Returns |kSuccess| when at
+  // least one buffer object was moved, and |kEmpty| when none were.
+  int DecommitBatch(Batch* ptr_batch);
+  int DecommitBatch(int64 max_timestamp, Batch* ptr_batch);
+
+  // Returns the buffer objects in |ptr_batch| to the pool, taking the lock
+  // once, and clears |ptr_batch|.
+  void ReleaseBatch(Batch* ptr_batch);
+
   // Drops all queued buffer objects by moving them all from |active_buffers_|
   // to |inactive_buffers_|.
   void Flush();
@@ -80,16 +289,115 @@ class BufferPool {
   // Returns true when |active_buffers_| is empty.
   bool IsEmpty() const;
 
+  // Returns the number of buffer objects waiting to be decommitted, and the
+  // number the pool can hold without growing. In lock free mode
+  // |Capacity()| is the limit.
+  int32 ActiveCount() const;
+  int32 Capacity() const;
+
  private:
   // Moves or copies |ptr_source| to |ptr_target| using |Type::Swap| or
   // |Type::Clone| based on presence of non-NULL buffer pointer in
   // |ptr_target|.
   int Exchange(Type* ptr_source, Type* ptr_target);
 
+  // Returns the |ring_| index that follows |index|.
+  int32 NextRingIndex(int32 index) const;
+
+  // Lock free mode implementations of the public methods.
+  int CommitLockFree(Type* ptr_buffer);
+  int DecommitLockFree(Type* ptr_buffer);
+
+  // Returns true, and counts a |kFull| event, when the limit leaves no room
+  // for another committed buffer object. Under |kPoolDropOldest| and
+  // |kPoolKeepLatest| drops the oldest buffer object to make room instead.
+  // |mutex_| must be held.
+  bool ActiveFull();
+
+  // Lock free mode counterpart of |ActiveFull()|, called only by the
+  // producer. Stores the number of buffer objects waiting to be decommitted
+  // in |ptr_active_count|. Only a full ring counts under |kPoolDropOldest|
+  // and |kPoolKeepLatest|.
+  bool RingFull(int32* ptr_active_count);
+
+  // Drops the waiting buffer objects the policy and the maximum age leave no
+  // room for, oldest first. Called by consumers before reading the oldest
+  // buffer object: with |mutex_| held, or from the consumer thread in lock
+  // free mode.
+  void DropStaleBuffers();
+
+  // Records the timestamp of a committed buffer object for the maximum age.
+  // Called by producers.
+  void UpdateNewestTimestamp(int64 timestamp);
+
+  // Takes a buffer object for the producer to fill: from |inactive_buffers_|
+  // with |mutex_| held, or from |ptr_spare_buffer_| or the free list in lock
+  // free mode, allocating one when allowed. Returns |kSuccess|, |kFull| when
+  // none is available, or |kNoMemory|.
+  int TakeInactiveBuffer(Type** ptr_buffer);
+  int TakeFreeBuffer(Type** ptr_buffer);
+
+  // Returns the buffer object of |ptr_lease| to the pool, and empties
+  // |ptr_lease|. Called by |Lease|.
+  void ReleaseLease(Lease* ptr_lease);
+
+  // Lock free mode free list. |PopFreeBuffer()| is called only by the
+  // producer, and returns NULL when the list is empty. |ReleaseBuffer()| is
+  // called only by the consumer; it returns |ptr_buffer| to the free list,
+  // after freeing its payload when more than the limit hold one.
+  Type* PopFreeBuffer();
+  void ReleaseBuffer(Type* ptr_buffer);
+
+  // Mutex mode counterpart of |ReleaseBuffer()|. |mutex_| must be held.
+  void ReleaseInactiveBuffer(Type* ptr_buffer);
+
+  // Raises |high_water_| to |count|. Only called by producers.
+  void UpdateHighWater(int32 count);
+
   bool allow_growth_;
+  bool lock_free_;
   mutable std::mutex mutex_;
   std::queue<Type*> inactive_buffers_;
   std::queue<Type*> active_buffers_;
+
+  // Lock free mode storage. |ring_| holds pointers to the committed buffer
+  // objects, and has one more slot than |max_buffers_| so that a full ring can
+  // be told apart from an empty ring. |read_index_| is written only by the
+  // consumer, and |write_index_| only by the producer. The ring is empty when
+  // the indexes are equal. |free_ring_| passes decommitted buffer objects
+  // back to the producer in the same way, with the roles swapped.
+  // |ptr_spare_buffer_| holds a free buffer object the producer failed to
+  // fill.
+  int32 max_buffers_;
+  std::vector<Type*> ring_;
+  std::vector<Type*> free_ring_;
+  Type* ptr_spare_buffer_;
+
+  // Buffer object limit, and the number of buffer objects allocated.
+  std::atomic<int32> limit_;
+  std::atomic<int32> allocated_;
+
+  // Lock free mode count of |empty()| buffer objects in |free_ring_|. The
+  // other |allocated_| buffer objects hold payloads.
+  std::atomic<int32> empty_buffers_;
+
+  std::atomic<int32> read_index_;
+  std::atomic<int32> write_index_;
+  std::atomic<int32> free_read_index_;
+  std::atomic<int32> free_write_index_;
+
+  // Policy, maximum age, and the timestamp of the last buffer object
+  // committed.
+  std::atomic<BufferPoolPolicy> policy_;
+  std::atomic<int64> max_age_;
+  std::atomic<int64> newest_timestamp_;
+
+  // Event counts returned by |stats()|.
+  std::atomic<int64> grow_count_;
+  std::atomic<int64> shrink_count_;
+  std::atomic<int64> full_count_;
+  std::atomic<int64> dropped_count_;
+  std::atomic<int32> high_water_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(BufferPool);
 };
 
@@ -7,7 +7,10 @@
 // be found in the AUTHORS file in the root of the source tree.
 #include "encoder/buffer_util.h"
 
+#include <algorithm>
+#include <cstring>
 #include <mutex>
+#include <new>
 #include <thread>
 
 #include "encoder/webm_buffer_parser.h"
@@ -85,6 +88,279 @@ int LockableBuffer::Unlock() {
   return status;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// BlockBuffer
+//
+
+BlockBuffer::BlockBuffer()
+    : block_size_(kDefaultBlockSize),
+      read_offset_(0),
+      block_ended_(false),
+      size_(0) {
+}
+
+BlockBuffer::BlockBuffer(int32 block_size)
+    : block_size_(block_size > 0 ? block_size : kDefaultBlockSize),
+      read_offset_(0),
+      block_ended_(false),
+      size_(0) {
+}
+
+int BlockBuffer::Append(const uint8* ptr_data, int32 length) {
+  return AppendWith(ptr_data, length, NULL);
+}
+
+// Fills the last block, then continues in recycled or newly allocated blocks.
+int BlockBuffer::AppendWith(const uint8* ptr_data, int32 length,
+                            CopyInterface* ptr_copy) {
+  if (!ptr_data || length < 0) {
+    LOG(ERROR) << "BlockBuffer invalid arg(s).";
+    return kInvalidArg;
+  }
+  while (length > 0) {
+    if (blocks_.empty() || block_ended_ ||
+        blocks_.back().length == block_size_) {
+      BlockEntry entry;
+      if (free_blocks_.empty()) {
+        entry.data.reset(new (std::nothrow) uint8[block_size_]);  // NOLINT
+        if (!entry.data) {
+          LOG(ERROR) << "BlockBuffer cannot allocate block.";
+          return kNoMemory;
+        }
+      } else {
+        entry.data = std::move(free_blocks_.back());
+        free_blocks_.pop_back();
+      }
+      blocks_.push_back(std::move(entry));
+      block_ended_ = false;
+    }
+    BlockEntry& tail = blocks_.back();
+    const int32 copy_length = std::min(length, block_size_ - tail.length);
+    if (ptr_copy) {
+      ptr_copy->Copy(ptr_data, tail.data.get() + tail.length, copy_length);
+    } else {
+      memcpy(tail.data.get() + tail.length, ptr_data, copy_length);
+    }
+    tail.length += copy_length;
+    ptr_data += copy_length;
+    length -= copy_length;
+    size_ += copy_length;
+  }
+  return kSuccess;
+}
+
+void BlockBuffer::EndBlock() {
+  if (!blocks_.empty())
+    block_ended_ = true;
+}
+
+int BlockBuffer::GetSpans(int64 length, std::vector<Span>* ptr_spans) const {
+  if (!ptr_spans || length < 0 || length > size_) {
+    LOG(ERROR) << "BlockBuffer invalid arg(s).";
+    return kInvalidArg;
+  }
+  ptr_spans->clear();
+  for (size_t i = 0; length > 0 && i < blocks_.size(); ++i) {
+    const int32 offset = (i == 0) ? read_offset_ : 0;
+    const int32 span_length =
+        static_cast<int32>(std::min<int64>(length, BlockLength(i)));
+    ptr_spans->push_back(Span(blocks_[i].data.get() + offset, span_length));
+    length -= span_length;
+  }
+  return kSuccess;
+}
+
+int BlockBuffer::Read(int64 length, uint8* ptr_buf) const {
+  if (!ptr_buf || length < 0 || length > size_) {
+    LOG(ERROR) << "BlockBuffer invalid arg(s).";
+    return kInvalidArg;
+  }
+  for (size_t i = 0; length > 0 && i < blocks_.size(); ++i) {
+    const int32 offset = (i == 0) ? read_offset_ : 0;
+    const int32 copy_length =
+        static_cast<int32>(std::min<int64>(length, BlockLength(i)));
+    memcpy(ptr_buf, blocks_[i].data.get() + offset, copy_length);
+    ptr_buf += copy_length;
+    length -= copy_length;
+  }
+  return kSuccess;
+}
+
+// Moves fully consumed blocks to |free_blocks_|; no buffered bytes are moved.
+void BlockBuffer::Discard(int64 length) {
+  length = std::min(length, size_);
+  while (length > 0) {
+    const int32 block_length = BlockLength(0);
+    if (length < block_length) {
+      read_offset_ += static_cast<int32>(length);
+      size_ -= length;
+      break;
+    }
+    length -= block_length;
+    size_ -= block_length;
+    ReleaseFrontBlock();
+  }
+}
+
+int BlockBuffer::Detach(int64 length, DataChunk* ptr_chunk) {
+  if (!ptr_chunk || length < 0 || length > size_) {
+    LOG(ERROR) << "BlockBuffer invalid arg(s).";
+    return kInvalidArg;
+  }
+  ptr_chunk->Reset();
+  while (length > 0) {
+    const int32 block_length = BlockLength(0);
+    const uint8* const ptr_data = blocks_.front().data.get() + read_offset_;
+    if (length < block_length) {
+      // The block continues past the chunk: copy the chunk's part of it.
+      const int32 copy_length = static_cast<int32>(length);
+      Block block(new (std::nothrow) uint8[copy_length]);  // NOLINT
+      if (!block) {
+        LOG(ERROR) << "BlockBuffer cannot allocate chunk block.";
+        ptr_chunk->Reset();
+        return kNoMemory;
+      }
+      memcpy(block.get(), ptr_data, copy_length);
+      ptr_chunk->spans_.push_back(Span(block.get(), copy_length));
+      ptr_chunk->blocks_.push_back(std::move(block));
+      ptr_chunk->length_ += copy_length;
+      Discard(copy_length);
+      break;
+    }
+    ptr_chunk->spans_.push_back(Span(ptr_data, block_length));
+    ptr_chunk->blocks_.push_back(std::move(blocks_.front().data));
+    ptr_chunk->length_ += block_length;
+    length -= block_length;
+    size_ -= block_length;
+    blocks_.pop_front();
+    read_offset_ = 0;
+  }
+  if (blocks_.empty())
+    block_ended_ = false;
+  return kSuccess;
+}
+
+int32 BlockBuffer::BlockLength(size_t index) const {
+  const int32 begin = (index == 0) ? read_offset_ : 0;
+  return blocks_[index].length - begin;
+}
+
+void BlockBuffer::ReleaseFrontBlock() {
+  free_blocks_.push_back(std::move(blocks_.front().data));
+  blocks_.pop_front();
+  read_offset_ = 0;
+  if (blocks_.empty())
+    block_ended_ = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// DataChunk
+//
+
+int DataChunk::Init(const uint8* ptr_data, int32 length) {
+  if (!ptr_data || length <= 0) {
+    LOG(ERROR) << "DataChunk invalid arg(s).";
+    return kInvalidArg;
+  }
+  Reset();
+  std::unique_ptr<uint8[]> block(new (std::nothrow) uint8[length]);  // NOLINT
+  if (!block) {
+    LOG(ERROR) << "DataChunk cannot allocate block.";
+    return kNoMemory;
+  }
+  memcpy(block.get(), ptr_data, length);
+  spans_.push_back(Span(block.get(), length));
+  blocks_.push_back(std::move(block));
+  length_ = length;
+  return kSuccess;
+}
+
+int DataChunk::CopyTo(int64 buffer_capacity, uint8* ptr_buf) const {
+  if (!ptr_buf || buffer_capacity < length_) {
+    LOG(ERROR) << "DataChunk invalid arg(s).";
+    return kInvalidArg;
+  }
+  for (size_t i = 0; i < spans_.size(); ++i) {
+    memcpy(ptr_buf, spans_[i].ptr_data, spans_[i].length);
+    ptr_buf += spans_[i].length;
+  }
+  return kSuccess;
+}
+
+void DataChunk::Reset() {
+  blocks_.clear();
+  spans_.clear();
+  length_ = 0;
+  starts_with_keyframe_ = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// StreamingChunk
+//
+
+int StreamingChunk::Append(const uint8* ptr_data, int32 length) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (finished_) {
+    LOG(ERROR) << "StreamingChunk Append after Finish.";
+    return kInvalidArg;
+  }
+  const int status = buffer_.Append(ptr_data, length);
+  if (status) {
+    return status == BlockBuffer::kNoMemory ? kNoMemory : kInvalidArg;
+  }
+  return kSuccess;
+}
+
+void StreamingChunk::Finish() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  finished_ = true;
+}
+
+// Data is never discarded from |buffer_|, so the span list of the first
+// |offset + buffer_capacity| bytes always starts at the chunk's first byte.
+int StreamingChunk::Read(int64 offset, int32 buffer_capacity, uint8* ptr_buf,
+                         int32* ptr_length) const {
+  if (!ptr_buf || !ptr_length || offset < 0 || buffer_capacity <= 0) {
+    LOG(ERROR) << "StreamingChunk invalid arg(s).";
+    return kInvalidArg;
+  }
+  *ptr_length = 0;
+  std::lock_guard<std::mutex> lock(mutex_);
+  const int64 available = buffer_.size() - offset;
+  if (available <= 0) {
+    return finished_ ? kEndOfChunk : kNoData;
+  }
+  const int32 read_length =
+      static_cast<int32>(std::min<int64>(available, buffer_capacity));
+  std::vector<BlockBuffer::Span> spans;
+  if (buffer_.GetSpans(offset + read_length, &spans)) {
+    return kInvalidArg;
+  }
+  int64 span_start = 0;
+  for (size_t i = 0; i < spans.size(); ++i) {
+    const int64 span_end = span_start + spans[i].length;
+    if (span_end > offset) {
+      const int32 skip =
+          static_cast<int32>(std::max<int64>(0, offset - span_start));
+      const int32 copy_length = spans[i].length - skip;
+      memcpy(ptr_buf + *ptr_length, spans[i].ptr_data + skip, copy_length);
+      *ptr_length += copy_length;
+    }
+    span_start = span_end;
+  }
+  return kSuccess;
+}
+
+bool StreamingChunk::Readable(int64 offset) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return finished_ || buffer_.size() > offset;
+}
+
+int64 StreamingChunk::length() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return buffer_.size();
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // WebmChunkBuffer
 //
@@ -8,6 +8,7 @@
 #ifndef WEBMLIVE_ENCODER_BUFFER_UTIL_H_
 #define WEBMLIVE_ENCODER_BUFFER_UTIL_H_
 
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -59,6 +60,214 @@ class LockableBuffer {
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(LockableBuffer);
 };
 
+class DataChunk;
+
+// FIFO byte buffer built from a chain of fixed size blocks. Appending never
+// moves buffered data, and discarding data from the front releases whole
+// blocks to a free list that later appends reuse, so once the buffer reaches
+// its working size neither operation allocates or copies buffered bytes.
+// Buffered data can be read in place as a list of contiguous |Span|s, or moved
+// into a |DataChunk| without copying.
+// Note: the class is not thread safe.
+class BlockBuffer {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+  static const int32 kDefaultBlockSize = 64 * 1024;
+
+  // Contiguous run of buffered bytes. Valid until the bytes are discarded.
+  struct Span {
+    Span() : ptr_data(NULL), length(0) {}
+    Span(const uint8* data, int32 data_length)
+        : ptr_data(data), length(data_length) {}
+    const uint8* ptr_data;
+    int32 length;
+  };
+
+  // Copies the runs of bytes |AppendWith()| stores, and may transform them
+  // on the way: encrypt them, for example, in the pass that buffers them.
+  class CopyInterface {
+   public:
+    virtual ~CopyInterface() {}
+
+    // Writes the |length| bytes of |ptr_src| to |ptr_dst|. Called once per
+    // block the data lands in, in order.
+    virtual void Copy(const uint8* ptr_src, uint8* ptr_dst, int32 length) = 0;
+  };
+
+  BlockBuffer();
+  explicit BlockBuffer(int32 block_size);
+  ~BlockBuffer() {}
+
+  // Copies |length| bytes from |ptr_data| to the end of the buffer. Returns
+  // |kSuccess| when successful.
+  int Append(const uint8* ptr_data, int32 length);
+
+  // |Append()| through |ptr_copy|, or like |Append()| when it is NULL.
+  // Returns |kSuccess| when successful.
+  int AppendWith(const uint8* ptr_data, int32 length,
+                 CopyInterface* ptr_copy);
+
+  // Ends the last block: the next |Append()| starts a new block. Used to keep
+  // data that will be detached by |Detach()| in blocks of its own.
+  void EndBlock();
+
+  // Stores the spans covering the first |length| buffered bytes in
+  // |ptr_spans|. Returns |kInvalidArg| when |length| exceeds |size()|.
+  int GetSpans(int64 length, std::vector<Span>* ptr_spans) const;
+
+  // Copies the first |length| buffered bytes to |ptr_buf| without discarding
+  // them. Returns |kInvalidArg| when |length| exceeds |size()|.
+  int Read(int64 length, uint8* ptr_buf) const;
+
+  // Discards up to |length| bytes from the front of the buffer.
+  void Discard(int64 length);
+
+  // Moves the first |length| buffered bytes into |ptr_chunk|, replacing its
+  // contents. Whole blocks change owner. Only a block shared with the data
+  // that follows |length| is copied, which never happens when |length| ends
+  // at a block ended by |EndBlock()|. Returns |kInvalidArg| when |length|
+  // exceeds |size()|.
+  int Detach(int64 length, DataChunk* ptr_chunk);
+
+  // Returns the number of buffered bytes.
+  int64 size() const { return size_; }
+  int32 block_size() const { return block_size_; }
+
+ private:
+  typedef std::unique_ptr<uint8[]> Block;
+  struct BlockEntry {
+    BlockEntry() : length(0) {}
+    Block data;
+    // Bytes stored in |data|, including bytes before |read_offset_|.
+    int32 length;
+  };
+
+  // Returns the number of readable bytes in |blocks_[index]|, starting at
+  // |read_offset_| for the first block.
+  int32 BlockLength(size_t index) const;
+
+  // Moves the first block to |free_blocks_|.
+  void ReleaseFrontBlock();
+
+  const int32 block_size_;
+
+  // Blocks holding buffered data, oldest first.
+  std::deque<BlockEntry> blocks_;
+
+  // Blocks released by |Discard()|.
+  std::vector<Block> free_blocks_;
+
+  // Offset of the first buffered byte in |blocks_.front()|.
+  int32 read_offset_;
+
+  // True when |EndBlock()| ended |blocks_.back()|.
+  bool block_ended_;
+
+  int64 size_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(BlockBuffer);
+};
+
+// Immutable data chunk passed from |LiveWebmMuxer| to |DataSinkInterface|
+// implementations. The data is stored in one or more contiguous spans, and
+// |SharedDataChunk| handles allow the chunk to be passed between threads
+// without copying it.
+class DataChunk {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+  typedef BlockBuffer::Span Span;
+
+  DataChunk() : length_(0), starts_with_keyframe_(false) {}
+  ~DataChunk() {}
+
+  // Copies |length| bytes from |ptr_data| into the chunk, replacing its
+  // contents. Returns |kSuccess| when successful.
+  int Init(const uint8* ptr_data, int32 length);
+
+  // Copies the chunk to |ptr_buf|. Returns |kInvalidArg| when
+  // |buffer_capacity| is less than |length()|.
+  int CopyTo(int64 buffer_capacity, uint8* ptr_buf) const;
+
+  // True for a media chunk a decoder can start with: its first video block
+  // is a keyframe, or it has no video. Set by the muxer that produced the
+  // chunk; false for metadata chunks and for data of unknown kind.
+  bool starts_with_keyframe() const { return starts_with_keyframe_; }
+  void set_starts_with_keyframe(bool keyframe) {
+    starts_with_keyframe_ = keyframe;
+  }
+
+  // Accessors.
+  const std::vector<Span>& spans() const { return spans_; }
+  int64 length() const { return length_; }
+
+ private:
+  friend class BlockBuffer;
+  void Reset();
+  std::vector<std::unique_ptr<uint8[]>> blocks_;
+  std::vector<Span> spans_;
+  int64 length_;
+  bool starts_with_keyframe_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(DataChunk);
+};
+
+// Reference counted read only handle to a |DataChunk|.
+typedef std::shared_ptr<const DataChunk> SharedDataChunk;
+
+// Data chunk that is still being written. One thread appends data while
+// another reads it, which allows a chunk to be sent before it is complete.
+// Readers track their own offset into the chunk.
+class StreamingChunk {
+ public:
+  enum {
+    // |Read()| found no data past the offset, and the chunk is not finished.
+    kNoData = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+    // |Read()| reached the end of a finished chunk.
+    kEndOfChunk = 1,
+  };
+
+  StreamingChunk() : finished_(false) {}
+  ~StreamingChunk() {}
+
+  // Copies |length| bytes from |ptr_data| to the end of the chunk. Returns
+  // |kInvalidArg| after |Finish()|.
+  int Append(const uint8* ptr_data, int32 length);
+
+  // Marks the chunk complete. Readers see |kEndOfChunk| once they have read
+  // all of the data.
+  void Finish();
+
+  // Copies up to |buffer_capacity| bytes starting at |offset| to |ptr_buf|,
+  // and stores the number of bytes copied in |ptr_length|. Returns |kSuccess|
+  // when data was copied, |kNoData| when the reader has caught up with the
+  // writer, and |kEndOfChunk| when the chunk is finished and fully read.
+  int Read(int64 offset, int32 buffer_capacity, uint8* ptr_buf,
+           int32* ptr_length) const;
+
+  // Returns true when |Read()| at |offset| would not return |kNoData|.
+  bool Readable(int64 offset) const;
+
+  // Returns the number of bytes appended so far.
+  int64 length() const;
+
+ private:
+  mutable std::mutex mutex_;
+  BlockBuffer buffer_;
+  bool finished_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(StreamingChunk);
+};
+
+typedef std::shared_ptr<StreamingChunk> SharedStreamingChunk;
+
 // Class for buffering unparsed WebM data that provides users with access to
 // complete WebM "chunks" for consumption of data in manageable bits. Stores
 // unparsed WebM data in a vector until a "chunk" is ready for consumption.
@@ -94,6 +303,8 @@ class WebmChunkBuffer {
   // Returns the length of the currently parsed and buffered chunk, or 0 if
   // a complete chunk is not buffered.
   int32 chunk_length() const { return chunk_length_; }
+  // Returns the number of bytes held in |buffer_|.
+  int64 buffered_bytes() const { return buffer_.size(); }
 
  private:
   typedef std::vector<uint8> Buffer;
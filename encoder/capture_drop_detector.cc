@@ -0,0 +1,89 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/capture_drop_detector.h"
+
+#include "encoder/metrics.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+CaptureDropDetector::CaptureDropDetector()
+    : next_timestamp_us_(-1),
+      last_duration_us_(0),
+      discontinuities_(0),
+      gaps_(0),
+      lost_samples_(0),
+      lost_us_(0),
+      ptr_discontinuities_(NULL),
+      ptr_gaps_(NULL),
+      ptr_lost_samples_(NULL),
+      ptr_lost_us_(NULL) {
+}
+
+int CaptureDropDetector::Init(const std::string& source) {
+  const std::string labels = "source=\"" + source + "\"";
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  ptr_discontinuities_ = registry.GetCounter(
+      "webmlive_capture_discontinuities_total", labels,
+      "Captured samples the capture filter flagged as discontinuous.");
+  ptr_gaps_ = registry.GetCounter(
+      "webmlive_capture_gaps_total", labels,
+      "Gaps in the times of captured samples.");
+  ptr_lost_samples_ = registry.GetCounter(
+      "webmlive_capture_lost_samples_total", labels,
+      "Frames, or audio buffers, lost in capture before delivery.");
+  ptr_lost_us_ = registry.GetCounter(
+      "webmlive_capture_lost_microseconds_total", labels,
+      "Media time lost in capture before delivery.");
+  if (!ptr_discontinuities_ || !ptr_gaps_ || !ptr_lost_samples_ ||
+      !ptr_lost_us_) {
+    LOG(ERROR) << "cannot create " << source << " capture drop metrics.";
+    return kInitFailed;
+  }
+  return kSuccess;
+}
+
+void CaptureDropDetector::Reset() {
+  next_timestamp_us_ = -1;
+  last_duration_us_ = 0;
+}
+
+// Samples arriving early, or after a clock restart, move the expected time
+// back without counting anything.
+int64 CaptureDropDetector::OnSample(int64 timestamp_us, int64 duration_us,
+                                    bool discontinuity) {
+  const bool first_sample = next_timestamp_us_ < 0;
+  if (discontinuity && !first_sample) {
+    // The first sample of a run is flagged by most filters.
+    ++discontinuities_;
+    ptr_discontinuities_->Increment(1);
+  }
+  if (duration_us > 0) {
+    last_duration_us_ = duration_us;
+  }
+  int64 lost_samples = 0;
+  if (!first_sample && last_duration_us_ > 0) {
+    const int64 gap_us = timestamp_us - next_timestamp_us_;
+    if (gap_us > last_duration_us_ / 2) {
+      lost_samples = (gap_us + last_duration_us_ / 2) / last_duration_us_;
+      ++gaps_;
+      lost_samples_ += lost_samples;
+      lost_us_ += gap_us;
+      ptr_gaps_->Increment(1);
+      ptr_lost_samples_->Increment(lost_samples);
+      ptr_lost_us_->Increment(gap_us);
+      VLOG(1) << "capture gap of " << gap_us << " us before sample at "
+              << timestamp_us << " us, " << lost_samples << " lost.";
+    }
+  }
+  next_timestamp_us_ =
+      timestamp_us + (duration_us > 0 ? duration_us : last_duration_us_);
+  return lost_samples;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,90 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_CAPTURE_DROP_DETECTOR_H_
+#define WEBMLIVE_ENCODER_CAPTURE_DROP_DETECTOR_H_
+
+#include <string>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+class Metric;
+
+// Accounts for samples lost before the encoder sees them: frames a capture
+// filter discards when the sink holds all of its buffers, and gaps the device
+// itself leaves. Losses of the encoder's own pools are counted by
+// |BufferPool|; together they account for every dropped sample.
+//
+// Each delivered sample is compared with the end of the one before it. A
+// sample starting more than half a sample duration late follows a gap, whose
+// length is divided by the duration into the number of samples lost. Samples
+// flagged as discontinuities by the capture filter are counted apart: filters
+// set the flag after discarding data, and also when their clock restarts.
+//
+// Exports, through |MetricsRegistry|, with a "source" label:
+//   webmlive_capture_discontinuities_total     samples flagged discontinuous;
+//   webmlive_capture_gaps_total                gaps in the sample times;
+//   webmlive_capture_lost_samples_total        frames, or audio buffers, lost
+//                                              in the gaps;
+//   webmlive_capture_lost_microseconds_total   media time lost in the gaps.
+//
+// Notes
+// - Not thread safe: samples are reported by the capture thread, and the
+//   totals read once it is stopped.
+class CaptureDropDetector {
+ public:
+  enum {
+    kInitFailed = -1,
+    kSuccess = 0,
+  };
+
+  CaptureDropDetector();
+  ~CaptureDropDetector() {}
+
+  // Creates the metrics of capture |source|, for example "video". Returns
+  // |kSuccess| when successful.
+  int Init(const std::string& source);
+
+  // Forgets the last sample, so the first sample of the next run of the
+  // capture graph is not taken for a gap.
+  void Reset();
+
+  // Records a sample starting at |timestamp_us| and lasting |duration_us|,
+  // 0 when unknown, which the capture filter marked with |discontinuity|.
+  // Returns the number of samples lost in front of it.
+  int64 OnSample(int64 timestamp_us, int64 duration_us, bool discontinuity);
+
+  // Totals since |Init()|.
+  int64 discontinuities() const { return discontinuities_; }
+  int64 gaps() const { return gaps_; }
+  int64 lost_samples() const { return lost_samples_; }
+  int64 lost_us() const { return lost_us_; }
+
+ private:
+  // End time of the last sample, and the last known sample duration; -1 and
+  // 0 when unknown.
+  int64 next_timestamp_us_;
+  int64 last_duration_us_;
+
+  int64 discontinuities_;
+  int64 gaps_;
+  int64 lost_samples_;
+  int64 lost_us_;
+
+  // Metrics exported through |MetricsRegistry|. Set by |Init()|.
+  Metric* ptr_discontinuities_;
+  Metric* ptr_gaps_;
+  Metric* ptr_lost_samples_;
+  Metric* ptr_lost_us_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(CaptureDropDetector);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_CAPTURE_DROP_DETECTOR_H_
@@ -0,0 +1,164 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/capture_format_policy.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace webmlive {
+
+namespace {
+// Devices report frame intervals in 100 ns units or as fractions; rates this
+// close to the requested one are treated as equal.
+const double kFrameRateTolerance = 0.01;
+
+// Returns true when |candidate| offers the size in |requested|. Candidates of
+// size 0 offer any size.
+bool MatchesSize(const VideoConfig& requested,
+                 const CaptureFormatCandidate& candidate) {
+  if (candidate.width == 0 && candidate.height == 0)
+    return true;
+  return (requested.width <= 0 || candidate.width == requested.width) &&
+         (requested.height <= 0 ||
+          abs(candidate.height) == abs(requested.height));
+}
+
+// Returns true when |candidate| reaches the frame rate in |requested|.
+// Candidates that do not report a rate are assumed to reach it.
+bool MatchesFrameRate(const VideoConfig& requested,
+                      const CaptureFormatCandidate& candidate) {
+  return requested.frame_rate <= 0 || candidate.max_frame_rate <= 0 ||
+         candidate.max_frame_rate >=
+             requested.frame_rate - kFrameRateTolerance;
+}
+
+// Returns the cost used to rank |format| candidates for |requested|: that of
+// |CaptureFormatPolicy::ConversionCost()|, except that compressed VP8 and VP9
+// frames of the requested format are passed through, and cost nothing.
+int RankCost(const VideoConfig& requested, VideoFormat format,
+             int bit_depth) {
+  if ((format == kVideoFormatVP8 || format == kVideoFormatVP9) &&
+      format == requested.format) {
+    return -1;
+  }
+  return CaptureFormatPolicy::ConversionCost(format, bit_depth);
+}
+}  // namespace
+
+int CaptureFormatPolicy::ConversionCost(VideoFormat format, int bit_depth) {
+  if (bit_depth > 8) {
+    if (format == kVideoFormatI42016)
+      return 0;
+    return format == kVideoFormatV210 ? 2 : kUnsupportedCost;
+  }
+  switch (format) {
+    case kVideoFormatI420:
+    case kVideoFormatYV12:
+      return 0;
+    case kVideoFormatNV12:
+    case kVideoFormatNV21:
+      return 1;
+    case kVideoFormatYUY2:
+    case kVideoFormatYUYV:
+    case kVideoFormatUYVY:
+      return 2;
+    case kVideoFormatRGB:
+    case kVideoFormatRGBA:
+      return 3;
+    case kVideoFormatMJPEG:
+#ifdef WEBMLIVE_HAVE_MJPEG
+      return 4;
+#else
+      return kUnsupportedCost;
+#endif
+    case kVideoFormatVP8:
+    case kVideoFormatVP9:
+    case kVideoFormatAV1:
+    case kVideoFormatV210:
+    case kVideoFormatI42016:
+    case kVideoFormatCount:
+      break;
+  }
+  return kUnsupportedCost;
+}
+
+void CaptureFormatPolicy::Rank(
+    const VideoConfig& requested, int bit_depth,
+    std::vector<CaptureFormatCandidate>* ptr_candidates) {
+  std::vector<CaptureFormatCandidate>& candidates = *ptr_candidates;
+  candidates.erase(
+      std::remove_if(candidates.begin(), candidates.end(),
+                     [&requested,
+                      bit_depth](const CaptureFormatCandidate& candidate) {
+                       return RankCost(requested, candidate.format,
+                                       bit_depth) >= kUnsupportedCost;
+                     }),
+      candidates.end());
+  std::stable_sort(
+      candidates.begin(), candidates.end(),
+      [&requested, bit_depth](const CaptureFormatCandidate& a,
+                              const CaptureFormatCandidate& b) {
+        const bool a_size = MatchesSize(requested, a);
+        const bool b_size = MatchesSize(requested, b);
+        if (a_size != b_size)
+          return a_size;
+        const bool a_rate = MatchesFrameRate(requested, a);
+        const bool b_rate = MatchesFrameRate(requested, b);
+        if (a_rate != b_rate)
+          return a_rate;
+        const int a_cost = RankCost(requested, a.format, bit_depth);
+        const int b_cost = RankCost(requested, b.format, bit_depth);
+        if (a_cost != b_cost)
+          return a_cost < b_cost;
+        // Among equal costs prefer the faster mode.
+        return a.max_frame_rate > b.max_frame_rate;
+      });
+}
+
+std::string CaptureFormatPolicy::DescribePath(VideoFormat format) {
+  const std::string name = FormatName(format);
+  const VideoFormat converted = VideoFrame::ConvertedFormat(format);
+  if (converted == format)
+    return name + " (native)";
+  const std::string target = FormatName(converted);
+  switch (format) {
+    case kVideoFormatNV12:
+    case kVideoFormatNV21:
+      return name + " -> " + target + " (chroma deinterleave)";
+    case kVideoFormatV210:
+      return name + " -> " + target + " (unpack)";
+    case kVideoFormatMJPEG:
+      return name + " -> " + target + " (decode)";
+    default:
+      return name + " -> " + target + " (convert)";
+  }
+}
+
+const char* CaptureFormatPolicy::FormatName(VideoFormat format) {
+  switch (format) {
+    case kVideoFormatI420: return "I420";
+    case kVideoFormatVP8: return "VP8";
+    case kVideoFormatYV12: return "YV12";
+    case kVideoFormatYUY2: return "YUY2";
+    case kVideoFormatYUYV: return "YUYV";
+    case kVideoFormatUYVY: return "UYVY";
+    case kVideoFormatRGB: return "RGB24";
+    case kVideoFormatRGBA: return "RGB32";
+    case kVideoFormatVP9: return "VP9";
+    case kVideoFormatNV12: return "NV12";
+    case kVideoFormatNV21: return "NV21";
+    case kVideoFormatMJPEG: return "MJPG";
+    case kVideoFormatV210: return "V210";
+    case kVideoFormatI42016: return "I42016";
+    case kVideoFormatAV1: return "AV1";
+    case kVideoFormatCount: break;
+  }
+  return "unknown";
+}
+
+}  // namespace webmlive
@@ -0,0 +1,75 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_CAPTURE_FORMAT_POLICY_H_
+#define WEBMLIVE_ENCODER_CAPTURE_FORMAT_POLICY_H_
+
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+// A pixel format a capture device offers at one frame size, and the highest
+// frame rate it offers at that size. |width| and |height| are 0 when the
+// device takes any size, and |max_frame_rate| is 0 when it does not say.
+struct CaptureFormatCandidate {
+  CaptureFormatCandidate()
+      : format(kVideoFormatI420), width(0), height(0), max_frame_rate(0) {}
+  CaptureFormatCandidate(VideoFormat candidate_format, int32 candidate_width,
+                         int32 candidate_height, double candidate_frame_rate)
+      : format(candidate_format),
+        width(candidate_width),
+        height(candidate_height),
+        max_frame_rate(candidate_frame_rate) {}
+
+  VideoFormat format;
+  int32 width;
+  int32 height;
+  double max_frame_rate;
+};
+
+// Picks capture formats by what it costs to turn their frames into encoder
+// input. Cheapest first:
+//   0 - I420, YV12 and I42016, which the encoders take as they are.
+//   1 - NV12 and NV21, which only need their chroma deinterleaved.
+//   2 - Packed YUV (YUY2, YUYV, UYVY, V210).
+//   3 - RGB, which needs a color space conversion.
+//   4 - MJPEG, which must be decoded.
+// Formats the encoders cannot take at all cost |kUnsupportedCost|.
+class CaptureFormatPolicy {
+ public:
+  static const int kUnsupportedCost = 100;
+
+  // Returns the conversion cost of |format|. V210 is supported only when
+  // |bit_depth| is above 8, and every other format only when it is 8.
+  static int ConversionCost(VideoFormat format, int bit_depth);
+
+  // Sorts |ptr_candidates| best first for |requested|, and removes the
+  // unsupported ones. Candidates at the requested size come first, then those
+  // that reach the requested frame rate, then the cheapest. A device that can
+  // deliver the requested rate only as MJPEG, because the uncompressed formats
+  // need more bandwidth than its bus has, therefore captures MJPEG. Zero
+  // |requested| fields match every candidate. VP8 and VP9 candidates are kept
+  // only when |requested.format| names their format, and are then cheapest:
+  // their frames are muxed without encoding.
+  static void Rank(const VideoConfig& requested, int bit_depth,
+                   std::vector<CaptureFormatCandidate>* ptr_candidates);
+
+  // Returns a description of the conversion |format| frames go through, for
+  // logging; "YUY2 -> I420 (convert)" for example.
+  static std::string DescribePath(VideoFormat format);
+
+  // Returns the name of |format|.
+  static const char* FormatName(VideoFormat format);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_CAPTURE_FORMAT_POLICY_H_
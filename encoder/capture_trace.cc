@@ -0,0 +1,655 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/capture_trace.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/latency_tracer.h"
+#include "encoder/thread_placement.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Returns the bytes taken by a record with |length| bytes of payload.
+uint64 RecordSize(int32 length) {
+  return sizeof(CaptureTraceRecord) + ((static_cast<uint64>(length) + 7) & ~7);
+}
+}  // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// CaptureTraceFile
+//
+CaptureTraceFile::CaptureTraceFile()
+    : ptr_data_(NULL),
+      size_(0),
+      writable_(false),
+#ifdef _WIN32
+      file_(INVALID_HANDLE_VALUE),
+      mapping_(NULL) {
+#else
+      fd_(-1) {
+#endif
+}
+
+CaptureTraceFile::~CaptureTraceFile() {
+  Close(size_);
+}
+
+bool CaptureTraceFile::Create(const std::string& file_name, uint64 capacity) {
+  writable_ = true;
+#ifdef _WIN32
+  file_ = CreateFileA(file_name.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                      CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    LOG(ERROR) << "CreateFile failed: " << GetLastError();
+    return false;
+  }
+  mapping_ = CreateFileMappingA(file_, NULL, PAGE_READWRITE,
+                                static_cast<DWORD>(capacity >> 32),
+                                static_cast<DWORD>(capacity), NULL);
+  if (!mapping_) {
+    LOG(ERROR) << "CreateFileMapping failed: " << GetLastError();
+    return false;
+  }
+  ptr_data_ = reinterpret_cast<uint8*>(
+      MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, 0));
+  if (!ptr_data_) {
+    LOG(ERROR) << "MapViewOfFile failed: " << GetLastError();
+    return false;
+  }
+#else
+  fd_ = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    LOG(ERROR) << "open failed: " << strerror(errno);
+    return false;
+  }
+  if (ftruncate(fd_, capacity)) {
+    LOG(ERROR) << "ftruncate failed: " << strerror(errno);
+    return false;
+  }
+  void* const ptr_view =
+      mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (ptr_view == MAP_FAILED) {
+    LOG(ERROR) << "mmap failed: " << strerror(errno);
+    return false;
+  }
+  ptr_data_ = reinterpret_cast<uint8*>(ptr_view);
+#endif
+  size_ = capacity;
+  return true;
+}
+
+bool CaptureTraceFile::Open(const std::string& file_name) {
+  writable_ = false;
+#ifdef _WIN32
+  file_ = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file_ == INVALID_HANDLE_VALUE) {
+    LOG(ERROR) << "CreateFile failed: " << GetLastError();
+    return false;
+  }
+  LARGE_INTEGER file_size = {0};
+  if (!GetFileSizeEx(file_, &file_size) || file_size.QuadPart <= 0) {
+    LOG(ERROR) << "capture trace file is empty.";
+    return false;
+  }
+  mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!mapping_) {
+    LOG(ERROR) << "CreateFileMapping failed: " << GetLastError();
+    return false;
+  }
+  ptr_data_ = reinterpret_cast<uint8*>(
+      MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+  if (!ptr_data_) {
+    LOG(ERROR) << "MapViewOfFile failed: " << GetLastError();
+    return false;
+  }
+  size_ = file_size.QuadPart;
+#else
+  fd_ = open(file_name.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    LOG(ERROR) << "open failed: " << strerror(errno);
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd_, &file_stat) || file_stat.st_size <= 0) {
+    LOG(ERROR) << "capture trace file is empty.";
+    return false;
+  }
+  void* const ptr_view =
+      mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+  if (ptr_view == MAP_FAILED) {
+    LOG(ERROR) << "mmap failed: " << strerror(errno);
+    return false;
+  }
+  ptr_data_ = reinterpret_cast<uint8*>(ptr_view);
+  size_ = file_stat.st_size;
+#endif
+  return true;
+}
+
+void CaptureTraceFile::Close(uint64 length) {
+#ifdef _WIN32
+  if (ptr_data_) {
+    UnmapViewOfFile(ptr_data_);
+  }
+  if (mapping_) {
+    CloseHandle(mapping_);
+    mapping_ = NULL;
+  }
+  if (file_ != INVALID_HANDLE_VALUE) {
+    if (writable_) {
+      LARGE_INTEGER end = {0};
+      end.QuadPart = length;
+      if (!SetFilePointerEx(file_, end, NULL, FILE_BEGIN) ||
+          !SetEndOfFile(file_)) {
+        LOG(ERROR) << "cannot cut capture trace file: " << GetLastError();
+      }
+    }
+    CloseHandle(file_);
+    file_ = INVALID_HANDLE_VALUE;
+  }
+#else
+  if (ptr_data_) {
+    munmap(ptr_data_, size_);
+  }
+  if (fd_ >= 0) {
+    if (writable_ && ftruncate(fd_, length)) {
+      LOG(ERROR) << "cannot cut capture trace file: " << strerror(errno);
+    }
+    close(fd_);
+    fd_ = -1;
+  }
+#endif
+  ptr_data_ = NULL;
+  size_ = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CaptureTraceRecorder
+//
+CaptureTraceRecorder::CaptureTraceRecorder(
+    std::unique_ptr<MediaSourceInterface> ptr_source)
+    : ptr_source_(std::move(ptr_source)),
+      ptr_audio_callback_(NULL),
+      ptr_video_callback_(NULL),
+      recording_(false),
+      records_length_(0),
+      video_records_(0),
+      audio_records_(0),
+      dropped_records_(0) {
+}
+
+CaptureTraceRecorder::~CaptureTraceRecorder() {
+  Stop();
+}
+
+int CaptureTraceRecorder::Init(
+    const WebmEncoderConfig& config,
+    AudioSamplesCallbackInterface* ptr_audio_callback,
+    VideoFrameCallbackInterface* ptr_video_callback) {
+  if (config.capture_trace_file.empty() || config.capture_trace_max_mb <= 0) {
+    LOG(ERROR) << "CaptureTraceRecorder has no file name or size.";
+    return WebmEncoder::kInvalidArg;
+  }
+  const uint64 capacity =
+      static_cast<uint64>(config.capture_trace_max_mb) * 1024 * 1024;
+  if (!file_.Create(config.capture_trace_file, capacity)) {
+    LOG(ERROR) << "CaptureTraceRecorder cannot create "
+               << config.capture_trace_file;
+    return WebmEncoder::kInitFailed;
+  }
+  CaptureTraceHeader* const ptr_header =
+      reinterpret_cast<CaptureTraceHeader*>(file_.data());
+  memset(ptr_header, 0, sizeof(*ptr_header));
+  ptr_header->magic = CaptureTraceHeader::kMagic;
+  ptr_header->version = CaptureTraceHeader::kVersion;
+
+  ptr_audio_callback_ = ptr_audio_callback;
+  ptr_video_callback_ = ptr_video_callback;
+  return ptr_source_->Init(config, ptr_audio_callback ? this : NULL,
+                           ptr_video_callback ? this : NULL);
+}
+
+int CaptureTraceRecorder::Run() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    start_time_ = std::chrono::steady_clock::now();
+    recording_ = file_.data() != NULL;
+  }
+  return ptr_source_->Run();
+}
+
+int CaptureTraceRecorder::CheckStatus() {
+  return ptr_source_->CheckStatus();
+}
+
+void CaptureTraceRecorder::Stop() {
+  ptr_source_->Stop();
+  Finish();
+}
+
+int CaptureTraceRecorder::Restart() {
+  return ptr_source_->Restart();
+}
+
+AudioConfig CaptureTraceRecorder::actual_audio_config() const {
+  return ptr_source_->actual_audio_config();
+}
+
+VideoConfig CaptureTraceRecorder::actual_video_config() const {
+  return ptr_source_->actual_video_config();
+}
+
+int CaptureTraceRecorder::InitExtraAudio(
+    const WebmEncoderConfig& config,
+    const std::vector<AudioSamplesCallbackInterface*>& callbacks) {
+  return ptr_source_->InitExtraAudio(config, callbacks);
+}
+
+AudioConfig CaptureTraceRecorder::actual_extra_audio_config(
+    size_t index) const {
+  return ptr_source_->actual_extra_audio_config(index);
+}
+
+int CaptureTraceRecorder::OnSamplesReceived(AudioBuffer* ptr_buffer) {
+  CaptureTraceRecord* ptr_record = NULL;
+  if (ptr_buffer && ptr_buffer->buffer() && ptr_buffer->buffer_length() > 0 &&
+      !ptr_buffer->planar()) {
+    ptr_record = Reserve(CaptureTraceRecord::kAudio,
+                         ptr_buffer->buffer_length());
+  }
+  if (ptr_record) {
+    const AudioConfig& config = ptr_buffer->config();
+    ptr_record->length = ptr_buffer->buffer_length();
+    ptr_record->timestamp = ptr_buffer->timestamp();
+    ptr_record->duration = ptr_buffer->duration();
+    ptr_record->audio_format = config.format_tag;
+    ptr_record->channels = config.channels;
+    ptr_record->sample_rate = config.sample_rate;
+    ptr_record->bits_per_sample = config.bits_per_sample;
+    memcpy(ptr_record + 1, ptr_buffer->buffer(), ptr_record->length);
+  }
+  const int status = ptr_audio_callback_->OnSamplesReceived(ptr_buffer);
+  if (ptr_record) {
+    ptr_record->callback_status = status;
+    ptr_record->type = CaptureTraceRecord::kAudio;
+  }
+  return status;
+}
+
+int CaptureTraceRecorder::OnVideoFrameReceived(VideoFrame* ptr_frame) {
+  CaptureTraceRecord* ptr_record = NULL;
+  // Records hold contiguous frames; frames of external planes or surfaces
+  // are copied into one first.
+  if (ptr_frame && ptr_frame->Pack()) {
+    LOG(ERROR) << "CaptureTraceRecorder cannot pack video frame.";
+  }
+  if (ptr_frame && ptr_frame->buffer() && ptr_frame->buffer_length() > 0) {
+    ptr_record = Reserve(CaptureTraceRecord::kVideo,
+                         ptr_frame->buffer_length());
+  }
+  if (ptr_record) {
+    const VideoConfig& config = ptr_frame->config();
+    ptr_record->length = ptr_frame->buffer_length();
+    ptr_record->timestamp = ptr_frame->timestamp();
+    ptr_record->duration = ptr_frame->duration();
+    ptr_record->keyframe = ptr_frame->keyframe();
+    ptr_record->video_format = config.format;
+    ptr_record->width = config.width;
+    ptr_record->height = config.height;
+    ptr_record->stride = config.stride;
+    ptr_record->frame_rate = config.frame_rate;
+    memcpy(ptr_record + 1, ptr_frame->buffer(), ptr_record->length);
+  }
+  const int status = ptr_video_callback_->OnVideoFrameReceived(ptr_frame);
+  if (ptr_record) {
+    ptr_record->callback_status = status;
+    ptr_record->type = CaptureTraceRecord::kVideo;
+  }
+  return status;
+}
+
+CaptureTraceRecord* CaptureTraceRecorder::Reserve(uint32 type, int32 length) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!recording_) {
+    return NULL;
+  }
+  const uint64 offset = sizeof(CaptureTraceHeader) + records_length_;
+  const uint64 record_size = RecordSize(length);
+  if (offset + record_size > file_.size()) {
+    ++dropped_records_;
+    return NULL;
+  }
+  records_length_ += record_size;
+  if (type == CaptureTraceRecord::kVideo) {
+    ++video_records_;
+  } else {
+    ++audio_records_;
+  }
+  CaptureTraceRecord* const ptr_record =
+      reinterpret_cast<CaptureTraceRecord*>(file_.data() + offset);
+  memset(ptr_record, 0, sizeof(*ptr_record));
+  ptr_record->arrival_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start_time_).count();
+  return ptr_record;
+}
+
+void CaptureTraceRecorder::Finish() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!file_.data()) {
+    return;
+  }
+  recording_ = false;
+  CaptureTraceHeader* const ptr_header =
+      reinterpret_cast<CaptureTraceHeader*>(file_.data());
+  ptr_header->records_length = records_length_;
+  ptr_header->video_records = video_records_;
+  ptr_header->audio_records = audio_records_;
+  file_.Close(sizeof(CaptureTraceHeader) + records_length_);
+  LOG(INFO) << "CaptureTraceRecorder recorded " << video_records_
+            << " video frames and " << audio_records_ << " audio buffers, "
+            << records_length_ << " bytes.";
+  if (dropped_records_ > 0) {
+    LOG(WARNING) << "CaptureTraceRecorder file full: " << dropped_records_
+                 << " samples not recorded.";
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// CaptureTraceSource
+//
+CaptureTraceSource::CaptureTraceSource()
+    : ptr_audio_callback_(NULL),
+      ptr_video_callback_(NULL),
+      records_length_(0),
+      stop_(false),
+      running_threads_(0) {
+}
+
+CaptureTraceSource::~CaptureTraceSource() {
+  Stop();
+}
+
+int CaptureTraceSource::Init(const WebmEncoderConfig& config,
+                             AudioSamplesCallbackInterface* ptr_audio_callback,
+                             VideoFrameCallbackInterface* ptr_video_callback) {
+  if (config.input_capture_trace.empty()) {
+    LOG(ERROR) << "CaptureTraceSource has no file name.";
+    return WebmEncoder::kInvalidArg;
+  }
+  if (!file_.Open(config.input_capture_trace)) {
+    LOG(ERROR) << "CaptureTraceSource cannot open "
+               << config.input_capture_trace;
+    return WebmEncoder::kInitFailed;
+  }
+  const CaptureTraceHeader* const ptr_header =
+      reinterpret_cast<const CaptureTraceHeader*>(file_.data());
+  if (file_.size() < sizeof(*ptr_header) ||
+      ptr_header->magic != CaptureTraceHeader::kMagic ||
+      ptr_header->version != CaptureTraceHeader::kVersion) {
+    LOG(ERROR) << "CaptureTraceSource file has no valid header.";
+    return WebmEncoder::kInitFailed;
+  }
+  const uint64 available = file_.size() - sizeof(*ptr_header);
+  if (ptr_header->records_length > available) {
+    LOG(ERROR) << "CaptureTraceSource file is truncated.";
+    return WebmEncoder::kInitFailed;
+  }
+  const uint64 length =
+      ptr_header->records_length ? ptr_header->records_length : available;
+
+  // Check every record, and take the stream settings from the first of each
+  // kind.
+  const CaptureTraceRecord* ptr_first_video = NULL;
+  const CaptureTraceRecord* ptr_first_audio = NULL;
+  uint64 offset = 0;
+  while (length - offset >= sizeof(CaptureTraceRecord)) {
+    const CaptureTraceRecord* const ptr_record = Record(offset);
+    if (ptr_record->type == CaptureTraceRecord::kEnd) {
+      break;
+    }
+    if ((ptr_record->type != CaptureTraceRecord::kVideo &&
+         ptr_record->type != CaptureTraceRecord::kAudio) ||
+        ptr_record->length <= 0 ||
+        RecordSize(ptr_record->length) > length - offset) {
+      LOG(ERROR) << "CaptureTraceSource malformed record at offset "
+                 << offset;
+      return WebmEncoder::kInitFailed;
+    }
+    if (ptr_record->type == CaptureTraceRecord::kVideo && !ptr_first_video) {
+      ptr_first_video = ptr_record;
+    }
+    if (ptr_record->type == CaptureTraceRecord::kAudio && !ptr_first_audio) {
+      ptr_first_audio = ptr_record;
+    }
+    offset += RecordSize(ptr_record->length);
+  }
+  records_length_ = offset;
+
+  if (!config.disable_video) {
+    if (!ptr_video_callback) {
+      LOG(ERROR) << "CaptureTraceSource NULL video callback.";
+      return WebmEncoder::kInvalidArg;
+    }
+    if (!ptr_first_video || ptr_first_video->width <= 0 ||
+        ptr_first_video->height == 0) {
+      LOG(ERROR) << "CaptureTraceSource trace has no video.";
+      return WebmEncoder::kNoVideoSource;
+    }
+    actual_video_config_.format =
+        static_cast<VideoFormat>(ptr_first_video->video_format);
+    actual_video_config_.width = ptr_first_video->width;
+    actual_video_config_.height = ptr_first_video->height;
+    actual_video_config_.stride = ptr_first_video->stride;
+    actual_video_config_.frame_rate = ptr_first_video->frame_rate;
+    ptr_video_callback_ = ptr_video_callback;
+  }
+
+  if (!config.disable_audio) {
+    if (!ptr_audio_callback) {
+      LOG(ERROR) << "CaptureTraceSource NULL audio callback.";
+      return WebmEncoder::kInvalidArg;
+    }
+    if (!ptr_first_audio || ptr_first_audio->channels <= 0 ||
+        ptr_first_audio->sample_rate <= 0 ||
+        ptr_first_audio->bits_per_sample <= 0) {
+      LOG(ERROR) << "CaptureTraceSource trace has no audio.";
+      return WebmEncoder::kNoAudioSource;
+    }
+    AudioConfig& ac = actual_audio_config_;
+    ac.format_tag = static_cast<uint16>(ptr_first_audio->audio_format);
+    ac.channels = static_cast<uint16>(ptr_first_audio->channels);
+    ac.sample_rate = ptr_first_audio->sample_rate;
+    ac.bits_per_sample = static_cast<uint16>(ptr_first_audio->bits_per_sample);
+    ac.block_align = ac.channels * ac.bits_per_sample / 8;
+    ac.bytes_per_second = ac.block_align * ac.sample_rate;
+    ptr_audio_callback_ = ptr_audio_callback;
+  }
+  LOG(INFO) << "CaptureTraceSource opened " << config.input_capture_trace
+            << ", " << records_length_ << " bytes of records.";
+  return WebmEncoder::kSuccess;
+}
+
+int CaptureTraceSource::Run() {
+  if (video_thread_ || audio_thread_) {
+    LOG(ERROR) << "CaptureTraceSource already running.";
+    return WebmEncoder::kRunFailed;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = false;
+    running_threads_ = (ptr_video_callback_ != NULL) +
+                       (ptr_audio_callback_ != NULL);
+  }
+  start_time_ = std::chrono::steady_clock::now();
+  using std::bind;
+  using std::nothrow;
+  using std::thread;
+  if (ptr_video_callback_) {
+    video_thread_.reset(new (nothrow) thread(  // NOLINT
+        bind(&CaptureTraceSource::DeliveryThread, this,
+             CaptureTraceRecord::kVideo)));
+  }
+  if (ptr_audio_callback_) {
+    audio_thread_.reset(new (nothrow) thread(  // NOLINT
+        bind(&CaptureTraceSource::DeliveryThread, this,
+             CaptureTraceRecord::kAudio)));
+  }
+  if ((ptr_video_callback_ && !video_thread_) ||
+      (ptr_audio_callback_ && !audio_thread_)) {
+    LOG(ERROR) << "CaptureTraceSource cannot construct thread.";
+    Stop();
+    return WebmEncoder::kRunFailed;
+  }
+  return WebmEncoder::kSuccess;
+}
+
+int CaptureTraceSource::CheckStatus() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if ((video_thread_ || audio_thread_) && running_threads_ == 0) {
+    return kInputEnded;
+  }
+  return kSuccess;
+}
+
+void CaptureTraceSource::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_event_.notify_all();
+  if (video_thread_) {
+    video_thread_->join();
+    video_thread_.reset();
+  }
+  if (audio_thread_) {
+    audio_thread_->join();
+    audio_thread_.reset();
+  }
+}
+
+const CaptureTraceRecord* CaptureTraceSource::Record(uint64 offset) const {
+  return reinterpret_cast<const CaptureTraceRecord*>(
+      file_.data() + sizeof(CaptureTraceHeader) + offset);
+}
+
+void CaptureTraceSource::DeliveryThread(uint32 type) {
+  const bool video = type == CaptureTraceRecord::kVideo;
+  LOG(INFO) << "CaptureTraceSource " << (video ? "video" : "audio")
+            << " thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(
+      video ? ThreadPlacement::kCapture : ThreadPlacement::kAudioCapture);
+  ScopedCpuStage cpu_stage(kCpuCapture);
+  VideoFrame frame;
+  AudioBuffer buffer;
+  int64 samples = 0;
+  int64 recorded_drops = 0;
+  int64 replay_drops = 0;
+  int64 max_late_us = 0;
+  // |kDropped| has the same value for both callback interfaces.
+  const int kDropped = VideoFrameCallbackInterface::kDropped;
+  for (uint64 offset = 0; offset < records_length_;) {
+    const CaptureTraceRecord& record = *Record(offset);
+    offset += RecordSize(record.length);
+    if (record.type != type) {
+      continue;
+    }
+    const std::chrono::steady_clock::time_point due =
+        start_time_ + std::chrono::microseconds(record.arrival_us);
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (stop_event_.wait_until(lock, due, [this] { return stop_; })) {
+        break;
+      }
+    }
+    const int64 late_us =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - due).count();
+    max_late_us = std::max(max_late_us, late_us);
+    const int status = Deliver(record, &frame, &buffer);
+    ++samples;
+    recorded_drops += record.callback_status == kDropped;
+    replay_drops += status == kDropped;
+  }
+  LOG(INFO) << "CaptureTraceSource " << (video ? "video" : "audio")
+            << " thread finished: " << samples << " samples, "
+            << recorded_drops << " dropped when recorded, " << replay_drops
+            << " dropped now, delivered up to " << max_late_us / 1000
+            << " ms late.";
+  std::lock_guard<std::mutex> lock(mutex_);
+  --running_threads_;
+}
+
+int CaptureTraceSource::Deliver(const CaptureTraceRecord& record,
+                                VideoFrame* ptr_frame,
+                                AudioBuffer* ptr_buffer) {
+  const uint8* const ptr_payload = reinterpret_cast<const uint8*>(&record + 1);
+  if (record.type == CaptureTraceRecord::kVideo) {
+    VideoConfig config;
+    config.format = static_cast<VideoFormat>(record.video_format);
+    config.width = record.width;
+    config.height = record.height;
+    config.stride = record.stride;
+    config.frame_rate = record.frame_rate;
+    const int status = ptr_frame->Init(config, record.keyframe != 0,
+                                       record.timestamp, record.duration,
+                                       ptr_payload, record.length);
+    if (status) {
+      LOG(ERROR) << "CaptureTraceSource video frame Init failed: " << status;
+      return status;
+    }
+    LatencyTracer::Stamp(LatencyTracer::kCapture, record.timestamp);
+    const int callback_status =
+        ptr_video_callback_->OnVideoFrameReceived(ptr_frame);
+    if (callback_status &&
+        callback_status != VideoFrameCallbackInterface::kDropped) {
+      LOG(ERROR) << "OnVideoFrameReceived failed, status=" << callback_status;
+    }
+    return callback_status;
+  }
+
+  AudioConfig config;
+  config.format_tag = static_cast<uint16>(record.audio_format);
+  config.channels = static_cast<uint16>(record.channels);
+  config.sample_rate = record.sample_rate;
+  config.bits_per_sample = static_cast<uint16>(record.bits_per_sample);
+  config.block_align = config.channels * config.bits_per_sample / 8;
+  config.bytes_per_second = config.block_align * config.sample_rate;
+  const int status = ptr_buffer->Init(config, record.timestamp,
+                                      record.duration, ptr_payload,
+                                      record.length);
+  if (status) {
+    LOG(ERROR) << "CaptureTraceSource audio buffer Init failed: " << status;
+    return status;
+  }
+  const int callback_status =
+      ptr_audio_callback_->OnSamplesReceived(ptr_buffer);
+  if (callback_status &&
+      callback_status != AudioSamplesCallbackInterface::kDropped) {
+    LOG(ERROR) << "OnSamplesReceived failed, status=" << callback_status;
+  }
+  return callback_status;
+}
+
+}  // namespace webmlive
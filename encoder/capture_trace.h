@@ -0,0 +1,274 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_CAPTURE_TRACE_H_
+#define WEBMLIVE_ENCODER_CAPTURE_TRACE_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/media_source.h"
+#include "encoder/video_encoder.h"
+#include "encoder/webm_encoder.h"
+
+namespace webmlive {
+
+// Header at the start of a capture trace file. Records follow it, each a
+// |CaptureTraceRecord| and its payload padded to a multiple of 8 bytes.
+struct CaptureTraceHeader {
+  static const uint32 kMagic = 0x54434c57;  // "WLCT"
+  static const uint32 kVersion = 1;
+
+  uint32 magic;
+  uint32 version;
+
+  // Bytes of records following the header, and the records of each kind.
+  // All 0 when the recording did not finish; records are then read up to
+  // the first one with type |CaptureTraceRecord::kEnd|.
+  uint64 records_length;
+  int64 video_records;
+  int64 audio_records;
+};
+
+// One video frame or audio block as the media source delivered it.
+struct CaptureTraceRecord {
+  enum {
+    kEnd = 0,
+    kVideo = 1,
+    kAudio = 2,
+  };
+
+  // Written last, so that records of a recording that did not finish are
+  // complete up to the first |kEnd|.
+  uint32 type;
+
+  // Payload bytes following the record.
+  int32 length;
+
+  // Time the callback was entered, in microseconds from the start of the
+  // recording, and the sample timestamp and duration in milliseconds.
+  int64 arrival_us;
+  int64 timestamp;
+  int64 duration;
+
+  // What the encoder's callback returned for the sample: |kSuccess|, or
+  // |kDropped| when its pool was full.
+  int32 callback_status;
+  int32 keyframe;
+
+  // |VideoConfig| of video records.
+  int32 video_format;
+  int32 width;
+  int32 height;
+  int32 stride;
+  double frame_rate;
+
+  // |AudioConfig| of audio records.
+  int32 audio_format;
+  int32 channels;
+  int32 sample_rate;
+  int32 bits_per_sample;
+};
+
+// Memory-mapped capture trace file, for writing by |CaptureTraceRecorder| or
+// reading by |CaptureTraceSource|.
+class CaptureTraceFile {
+ public:
+  CaptureTraceFile();
+  ~CaptureTraceFile();
+
+  // Creates |file_name|, |capacity| bytes long, and maps it for writing.
+  // Returns true when successful.
+  bool Create(const std::string& file_name, uint64 capacity);
+
+  // Opens and maps |file_name| for reading. Returns true when successful.
+  bool Open(const std::string& file_name);
+
+  // Unmaps the file. Files from |Create()| are cut to |length| bytes.
+  void Close(uint64 length);
+
+  uint8* data() const { return ptr_data_; }
+  uint64 size() const { return size_; }
+
+ private:
+  uint8* ptr_data_;
+  uint64 size_;
+  bool writable_;
+#ifdef _WIN32
+  void* file_;
+  void* mapping_;
+#else
+  int fd_;
+#endif
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(CaptureTraceFile);
+};
+
+// Media source that records everything another media source delivers to a
+// capture trace file: raw video frames and audio blocks, with their
+// timestamps, the time each reached the encoder, and whether the encoder
+// dropped it. |CaptureTraceSource| replays the file with the same timing, so
+// that stalls depending on capture timing can be reproduced without the
+// capture devices.
+//
+// Notes
+// - Samples are copied into the mapped file on the capture threads, before
+//   they are passed on. Nothing is written through the file system until
+//   |Stop()|, so recording costs a copy of each sample.
+// - The file is created |WebmEncoderConfig::capture_trace_max_mb| long;
+//   samples arriving once it is full are not recorded. |Stop()| cuts the
+//   file to the records it holds.
+// - Extra audio tracks, planar audio buffers and video region hints are not
+//   recorded.
+class CaptureTraceRecorder : public MediaSourceInterface,
+                             public AudioSamplesCallbackInterface,
+                             public VideoFrameCallbackInterface {
+ public:
+  explicit CaptureTraceRecorder(
+      std::unique_ptr<MediaSourceInterface> ptr_source);
+  virtual ~CaptureTraceRecorder();
+
+  // Creates |config.capture_trace_file|, and initializes the recorded source
+  // with the recorder as its callbacks. Returns |kSuccess| upon success, or
+  // a |WebmEncoder| status code upon failure.
+  virtual int Init(const WebmEncoderConfig& config,
+                   AudioSamplesCallbackInterface* ptr_audio_callback,
+                   VideoFrameCallbackInterface* ptr_video_callback);
+
+  // Starts the recording clock, and runs the recorded source.
+  virtual int Run();
+  virtual int CheckStatus();
+
+  // Stops the recorded source, and finishes the trace file.
+  virtual void Stop();
+
+  // Restarts the recorded source; recording continues.
+  virtual int Restart();
+
+  virtual AudioConfig actual_audio_config() const;
+  virtual VideoConfig actual_video_config() const;
+  virtual int InitExtraAudio(
+      const WebmEncoderConfig& config,
+      const std::vector<AudioSamplesCallbackInterface*>& callbacks);
+  virtual AudioConfig actual_extra_audio_config(size_t index) const;
+
+  // AudioSamplesCallbackInterface and VideoFrameCallbackInterface methods.
+  // Record the sample, and pass it on.
+  virtual int OnSamplesReceived(AudioBuffer* ptr_buffer);
+  virtual int OnVideoFrameReceived(VideoFrame* ptr_frame);
+
+ private:
+  // Returns room for a record of |type| with |length| bytes of payload, its
+  // arrival time set, or NULL when the file is full or not recording. The
+  // caller writes |type| last.
+  CaptureTraceRecord* Reserve(uint32 type, int32 length);
+
+  // Writes the header and closes the file.
+  void Finish();
+
+  std::unique_ptr<MediaSourceInterface> ptr_source_;
+  AudioSamplesCallbackInterface* ptr_audio_callback_;
+  VideoFrameCallbackInterface* ptr_video_callback_;
+
+  // File and recording state. Guarded by |mutex_|; record payloads are
+  // written outside it.
+  std::mutex mutex_;
+  CaptureTraceFile file_;
+  bool recording_;
+  uint64 records_length_;
+  int64 video_records_;
+  int64 audio_records_;
+  int64 dropped_records_;
+  std::chrono::steady_clock::time_point start_time_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(CaptureTraceRecorder);
+};
+
+// Media source that replays a capture trace file written by
+// |CaptureTraceRecorder|. Each sample is delivered with its recorded
+// timestamp, at its recorded arrival time after |Run()|.
+//
+// Notes
+// - Video and audio are delivered by threads of their own, as capture
+//   devices do, so that a callback blocking one stream does not delay the
+//   other.
+// - Samples whose time has passed, because a callback blocked, are delivered
+//   at once. The largest such delay is logged, together with the samples
+//   the encoder dropped during the recording and during the replay.
+// - Streams are enabled and disabled as for capture devices; enabled
+//   streams must be present in the trace.
+class CaptureTraceSource : public MediaSourceInterface {
+ public:
+  CaptureTraceSource();
+  virtual ~CaptureTraceSource();
+
+  // Maps |config.input_capture_trace| and checks its records. Returns
+  // |kSuccess| upon success, or a |WebmEncoder| status code upon failure.
+  virtual int Init(const WebmEncoderConfig& config,
+                   AudioSamplesCallbackInterface* ptr_audio_callback,
+                   VideoFrameCallbackInterface* ptr_video_callback);
+
+  // Starts the delivery threads. Returns |kSuccess| upon success, or a
+  // |WebmEncoder| status code upon failure.
+  virtual int Run();
+
+  // Returns |kSuccess| while delivering samples, and |kInputEnded| once
+  // every record has been delivered.
+  virtual int CheckStatus();
+
+  // Stops and joins the delivery threads.
+  virtual void Stop();
+
+  virtual AudioConfig actual_audio_config() const {
+    return actual_audio_config_;
+  }
+  virtual VideoConfig actual_video_config() const {
+    return actual_video_config_;
+  }
+
+ private:
+  // Returns the record at |offset| from the start of the records.
+  const CaptureTraceRecord* Record(uint64 offset) const;
+
+  // Delivers the records of |type| in order. Thread function.
+  void DeliveryThread(uint32 type);
+
+  // Delivers |record| through its callback. Returns the callback status.
+  int Deliver(const CaptureTraceRecord& record, VideoFrame* ptr_frame,
+              AudioBuffer* ptr_buffer);
+
+  AudioSamplesCallbackInterface* ptr_audio_callback_;
+  VideoFrameCallbackInterface* ptr_video_callback_;
+  AudioConfig actual_audio_config_;
+  VideoConfig actual_video_config_;
+
+  CaptureTraceFile file_;
+  uint64 records_length_;
+
+  // Time at which |Run()| started delivery, which arrival times count from.
+  std::chrono::steady_clock::time_point start_time_;
+
+  // Stop flag and wake up event, and the delivery threads still running.
+  // Protected by |mutex_|.
+  std::mutex mutex_;
+  std::condition_variable stop_event_;
+  bool stop_;
+  int running_threads_;
+
+  std::unique_ptr<std::thread> video_thread_;
+  std::unique_ptr<std::thread> audio_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(CaptureTraceSource);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_CAPTURE_TRACE_H_
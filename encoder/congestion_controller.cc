@@ -0,0 +1,99 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/congestion_controller.h"
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+CongestionController::CongestionController()
+    : level_(kNormal),
+      min_level_(kNormal),
+      skip_next_frame_(false) {
+}
+
+int CongestionController::Init(const CongestionControllerConfig& config,
+                               int num_video_streams) {
+  if (config.decimate_backlog_ms <= 0 ||
+      config.drop_backlog_ms < config.decimate_backlog_ms ||
+      num_video_streams < 0) {
+    LOG(ERROR) << "CongestionController invalid config.";
+    return kInvalidArg;
+  }
+  config_ = config;
+  dropping_gop_.assign(num_video_streams, false);
+  return kSuccess;
+}
+
+void CongestionController::Update(int64 backlog_bytes,
+                                  int32 pool_frames,
+                                  int32 pool_capacity) {
+  // Without a bitrate the backlog cannot be expressed in time; only the pool
+  // state is considered.
+  int64 backlog_ms = 0;
+  if (config_.video_bitrate_kbps > 0) {
+    backlog_ms = backlog_bytes * 8 / config_.video_bitrate_kbps;
+  }
+  const bool pool_full = pool_capacity > 0 && pool_frames >= pool_capacity;
+
+  Level level = kNormal;
+  if (backlog_ms >= config_.drop_backlog_ms) {
+    level = kDropGops;
+  } else if (level_ == kDropGops &&
+             backlog_ms >= config_.drop_backlog_ms / 2) {
+    level = kDropGops;
+  } else if (backlog_ms >= config_.decimate_backlog_ms || pool_full) {
+    level = kDecimate;
+  } else if (level_ != kNormal &&
+             backlog_ms >= config_.decimate_backlog_ms / 2) {
+    level = kDecimate;
+  }
+  if (level < min_level_)
+    level = min_level_;
+  SetLevel(level);
+}
+
+bool CongestionController::ShouldSkipRawFrame() {
+  if (level_ == kNormal) {
+    skip_next_frame_ = false;
+    return false;
+  }
+  const bool skip = skip_next_frame_;
+  skip_next_frame_ = !skip_next_frame_;
+  if (skip)
+    ++stats_.frames_decimated;
+  return skip;
+}
+
+bool CongestionController::ShouldDropEncodedFrame(int video_stream,
+                                                  bool keyframe) {
+  if (video_stream < 0 ||
+      video_stream >= static_cast<int>(dropping_gop_.size())) {
+    return false;
+  }
+  if (keyframe) {
+    // GOP boundary: start or stop dropping.
+    const bool drop = (level_ == kDropGops);
+    if (drop)
+      ++stats_.gops_dropped;
+    dropping_gop_[video_stream] = drop;
+  }
+  if (dropping_gop_[video_stream])
+    ++stats_.frames_dropped;
+  return dropping_gop_[video_stream];
+}
+
+void CongestionController::SetLevel(Level level) {
+  if (level == level_)
+    return;
+  LOG(INFO) << "CongestionController level " << level_ << " -> " << level;
+  level_ = level;
+  ++stats_.level_changes;
+}
+
+}  // namespace webmlive
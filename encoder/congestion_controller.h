@@ -0,0 +1,130 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_CONGESTION_CONTROLLER_H_
+#define WEBMLIVE_ENCODER_CONGESTION_CONTROLLER_H_
+
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+struct CongestionControllerConfig {
+  static const int32 kDefaultDecimateBacklogMs = 2000;
+  static const int32 kDefaultDropBacklogMs = 4000;
+
+  CongestionControllerConfig()
+      : decimate_backlog_ms(kDefaultDecimateBacklogMs),
+        drop_backlog_ms(kDefaultDropBacklogMs),
+        video_bitrate_kbps(0) {}
+
+  // Output backlog, in milliseconds of video at |video_bitrate_kbps|, at
+  // which the controller starts decimating frames, and at which it starts
+  // dropping GOPs. Each level is left once the backlog falls below half of
+  // its threshold.
+  int32 decimate_backlog_ms;
+  int32 drop_backlog_ms;
+
+  // Video bitrate used to convert buffered bytes to time.
+  int32 video_bitrate_kbps;
+};
+
+// Counts of the decisions made by |CongestionController|.
+struct CongestionStats {
+  CongestionStats()
+      : level_changes(0),
+        frames_decimated(0),
+        gops_dropped(0),
+        frames_dropped(0),
+        capture_frames_dropped(0) {}
+
+  int64 level_changes;
+
+  // Raw frames skipped by decimation.
+  int64 frames_decimated;
+
+  // Compressed GOPs dropped, and the frames within them.
+  int64 gops_dropped;
+  int64 frames_dropped;
+
+  // Raw frames lost because the input pool was full. Counted by the capture
+  // callback, not by |CongestionController|.
+  int64 capture_frames_dropped;
+};
+
+// Decides how the encoder degrades when its output cannot keep up. The
+// encoder reports the bytes waiting in its muxers and the state of its raw
+// frame pool, and asks the controller whether to encode each raw frame and
+// whether to mux each compressed frame.
+//
+// Levels, from least to most severe:
+// - |kNormal|: everything is encoded and muxed.
+// - |kDecimate|: every other raw frame is skipped, which halves both encoder
+//   load and output rate. Also entered while the raw frame pool is full.
+// - |kDropGops|: compressed frames are dropped from a keyframe up to the next
+//   keyframe seen once the level drops, so whole GOPs (and the clusters they
+//   start) are lost instead of random frames, and the stream stays decodable.
+//
+// Note: the class is not thread safe; it is used by the encoder thread only.
+class CongestionController {
+ public:
+  enum Level {
+    kNormal = 0,
+    kDecimate = 1,
+    kDropGops = 2,
+  };
+  enum {
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  CongestionController();
+  ~CongestionController() {}
+
+  // Configures the controller for |num_video_streams| independently muxed
+  // video streams. Returns |kSuccess| when successful.
+  int Init(const CongestionControllerConfig& config, int num_video_streams);
+
+  // Updates the level from |backlog_bytes| buffered in the muxers, and from
+  // the raw frame pool state.
+  void Update(int64 backlog_bytes, int32 pool_frames, int32 pool_capacity);
+
+  // Sets the level |Update()| never goes below, such as the level asked for
+  // by memory pressure. Applies from the next |Update()|.
+  void set_min_level(Level level) { min_level_ = level; }
+
+  // Returns true when the next raw frame should be skipped.
+  bool ShouldSkipRawFrame();
+
+  // Returns true when a compressed frame of |video_stream| should be dropped
+  // instead of muxed.
+  bool ShouldDropEncodedFrame(int video_stream, bool keyframe);
+
+  Level level() const { return level_; }
+  const CongestionStats& stats() const { return stats_; }
+
+ private:
+  void SetLevel(Level level);
+
+  CongestionControllerConfig config_;
+  Level level_;
+  Level min_level_;
+  CongestionStats stats_;
+
+  // Toggled per raw frame while decimating.
+  bool skip_next_frame_;
+
+  // Per stream flag set while a GOP is being dropped.
+  std::vector<bool> dropping_gop_;
+
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(CongestionController);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_CONGESTION_CONTROLLER_H_
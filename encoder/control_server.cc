@@ -0,0 +1,209 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/control_server.h"
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <sstream>
+
+#include "encoder/metrics.h"
+#include "encoder/socket_util.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Interval at which the listening thread checks for |Stop()|.
+const int kPollMs = 100;
+}  // namespace
+
+ControlServer::ControlServer()
+    : ptr_handler_(NULL),
+      stop_(true),
+      listen_socket_(static_cast<SocketHandle>(kInvalidSocket)),
+      ptr_commands_(NULL),
+      ptr_command_errors_(NULL) {
+}
+
+ControlServer::~ControlServer() {
+  Stop();
+}
+
+int ControlServer::Run(const ControlServerSettings& settings,
+                       ControlHandlerInterface* ptr_handler) {
+  if (listen_thread_) {
+    return kInvalidArg;
+  }
+  if (!ptr_handler || settings.port < 0 || settings.port > 65535) {
+    LOG(ERROR) << "invalid control server settings, port=" << settings.port;
+    return kInvalidArg;
+  }
+  settings_ = settings;
+  ptr_handler_ = ptr_handler;
+
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  ptr_commands_ = registry.GetCounter(
+      "webmlive_control_commands_total", settings_.metrics_labels,
+      "Commands received by the control server.");
+  ptr_command_errors_ = registry.GetCounter(
+      "webmlive_control_command_errors_total", settings_.metrics_labels,
+      "Control server commands that were rejected or failed.");
+  if (!ptr_commands_ || !ptr_command_errors_) {
+    LOG(ERROR) << "cannot create control server metrics.";
+    return kNoMemory;
+  }
+
+  if (!StartupSockets()) {
+    LOG(ERROR) << "cannot initialize sockets.";
+    return kSocketError;
+  }
+  const NativeSocket listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_socket == kInvalidSocket) {
+    LOG(ERROR) << "cannot create control socket.";
+    return kSocketError;
+  }
+  listen_socket_ = static_cast<SocketHandle>(listen_socket);
+  const int reuse = 1;
+  setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR,
+             reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(static_cast<uint16>(settings_.port));
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (!settings_.bind_address.empty() &&
+      inet_pton(AF_INET, settings_.bind_address.c_str(),
+                &address.sin_addr) != 1) {
+    LOG(ERROR) << "invalid control bind address " << settings_.bind_address;
+    Stop();
+    return kInvalidArg;
+  }
+  if (bind(listen_socket, reinterpret_cast<const sockaddr*>(&address),
+           sizeof(address)) ||
+      listen(listen_socket, SOMAXCONN)) {
+    LOG(ERROR) << "cannot listen on control port " << settings_.port;
+    Stop();
+    return kSocketError;
+  }
+
+  stop_ = false;
+  listen_thread_.reset(new (std::nothrow) std::thread(  // NOLINT
+      std::bind(&ControlServer::ListenThread, this)));
+  if (!listen_thread_) {
+    LOG(ERROR) << "cannot start control listening thread.";
+    Stop();
+    return kThreadError;
+  }
+  LOG(INFO) << "control server listening on " << settings_.bind_address
+            << ":" << settings_.port;
+  return kSuccess;
+}
+
+void ControlServer::Stop() {
+  stop_ = true;
+  if (listen_thread_) {
+    listen_thread_->join();
+    listen_thread_.reset();
+  }
+  const NativeSocket listen_socket = static_cast<NativeSocket>(listen_socket_);
+  if (listen_socket != kInvalidSocket) {
+    CloseSocket(listen_socket);
+    listen_socket_ = static_cast<SocketHandle>(kInvalidSocket);
+    CleanupSockets();
+  }
+}
+
+void ControlServer::ListenThread() {
+  const NativeSocket listen_socket = static_cast<NativeSocket>(listen_socket_);
+  while (!stop_) {
+    if (!WaitReadable(listen_socket, kPollMs)) {
+      continue;
+    }
+    const NativeSocket client = accept(listen_socket, NULL, NULL);
+    if (client == kInvalidSocket) {
+      continue;
+    }
+    ServeConnection(static_cast<SocketHandle>(client));
+    CloseSocket(client);
+  }
+}
+
+void ControlServer::ServeConnection(SocketHandle socket_handle) {
+  const NativeSocket socket = static_cast<NativeSocket>(socket_handle);
+  std::string buffer;
+  std::chrono::steady_clock::time_point last_activity =
+      std::chrono::steady_clock::now();
+  while (!stop_) {
+    if (!WaitReadable(socket, kPollMs)) {
+      const int64 idle_ms =
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - last_activity).count();
+      if (idle_ms >= kIdleTimeoutMs) {
+        return;
+      }
+      continue;
+    }
+    char read_buffer[512];
+    const int bytes_read = recv(socket, read_buffer, sizeof(read_buffer), 0);
+    if (bytes_read <= 0) {
+      return;
+    }
+    last_activity = std::chrono::steady_clock::now();
+    buffer.append(read_buffer, bytes_read);
+
+    size_t line_end = buffer.find('\n');
+    while (line_end != std::string::npos) {
+      std::string line = buffer.substr(0, line_end);
+      buffer.erase(0, line_end + 1);
+      if (!line.empty() && line[line.size() - 1] == '\r') {
+        line.erase(line.size() - 1);
+      }
+      if (!SendAll(socket, ExecuteLine(line))) {
+        return;
+      }
+      line_end = buffer.find('\n');
+    }
+    if (buffer.size() > kMaxLineBytes) {
+      LOG(WARNING) << "control command too long, closing connection.";
+      SendAll(socket, "error command too long\n");
+      return;
+    }
+  }
+}
+
+std::string ControlServer::ExecuteLine(const std::string& line) {
+  std::istringstream stream(line);
+  std::vector<std::string> words;
+  std::string word;
+  while (stream >> word) {
+    words.push_back(word);
+  }
+  if (words.empty()) {
+    return "error empty command\n";
+  }
+
+  ptr_commands_->Increment(1);
+  std::string reply;
+  const bool ok = ptr_handler_->HandleControlCommand(words, &reply);
+  if (!ok) {
+    ptr_command_errors_->Increment(1);
+    LOG(WARNING) << "control command failed: " << line << ": " << reply;
+  } else {
+    LOG(INFO) << "control command: " << line;
+  }
+  std::string response = ok ? "ok" : "error";
+  if (!reply.empty()) {
+    response += " " + reply;
+  }
+  return response + "\n";
+}
+
+}  // namespace webmlive
@@ -0,0 +1,122 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_CONTROL_SERVER_H_
+#define WEBMLIVE_ENCODER_CONTROL_SERVER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+class Metric;
+
+// Pure interface implemented by the application to execute the commands
+// |ControlServer| receives.
+class ControlHandlerInterface {
+ public:
+  virtual ~ControlHandlerInterface() {}
+
+  // Executes the command in |words|, the whitespace separated words of one
+  // command line, which is never empty, and stores the text returned to the
+  // client in |ptr_reply|. Returns true when the command succeeded. Called on
+  // the server's thread.
+  virtual bool HandleControlCommand(const std::vector<std::string>& words,
+                                    std::string* ptr_reply) = 0;
+};
+
+struct ControlServerSettings {
+  static const int kDefaultPort = 8091;
+
+  ControlServerSettings() : bind_address("127.0.0.1"), port(kDefaultPort) {}
+
+  // Address and TCP port the server listens on. Loopback by default: the
+  // protocol has no authentication, so only local processes should reach it.
+  std::string bind_address;
+  int port;
+
+  // Labels added to the server's metrics; see |MetricsRegistry|.
+  std::string metrics_labels;
+};
+
+// Line based control endpoint, through which orchestration changes a running
+// encoder in milliseconds instead of restarting it with new flags.
+//
+// Clients connect over TCP and send one command per line, such as
+// "bitrate 2500" or "keyframe". Each line is split into words and passed to
+// the |ControlHandlerInterface|, and answered with one line: "ok" or
+// "error", followed by the handler's reply. Connections stay open for
+// further commands until the client closes them or idles.
+//
+// Notes
+// - Connections are served one at a time by the listening thread; a client
+//   holding its connection idle delays others by up to |kIdleTimeoutMs|.
+// - Lines longer than |kMaxLineBytes| close the connection.
+class ControlServer {
+ public:
+  enum {
+    // Socket setup failed.
+    kSocketError = -4,
+    // Cannot start the listening thread.
+    kThreadError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  static const int kIdleTimeoutMs = 10000;
+  static const size_t kMaxLineBytes = 4096;
+
+  ControlServer();
+  ~ControlServer();
+
+  // Binds the listening socket and starts serving commands to
+  // |ptr_handler|, which must outlive the server. Returns |kSuccess| when
+  // successful.
+  int Run(const ControlServerSettings& settings,
+          ControlHandlerInterface* ptr_handler);
+
+  // Closes the listening socket and the connection being served, and joins
+  // the listening thread.
+  void Stop();
+
+ private:
+  // Socket handle: a SOCKET on Windows, and a file descriptor elsewhere.
+  typedef std::intptr_t SocketHandle;
+
+  // Accepts connections and serves them in turn.
+  void ListenThread();
+
+  // Serves the commands of |socket| until the client closes it, it idles, or
+  // |Stop()| is called.
+  void ServeConnection(SocketHandle socket);
+
+  // Splits |line| into words, runs it through |ptr_handler_|, and returns
+  // the response line.
+  std::string ExecuteLine(const std::string& line);
+
+  ControlServerSettings settings_;
+  ControlHandlerInterface* ptr_handler_;
+  std::atomic<bool> stop_;
+  SocketHandle listen_socket_;
+  std::unique_ptr<std::thread> listen_thread_;
+
+  // Metrics exported through |MetricsRegistry|. Set by |Run()|.
+  Metric* ptr_commands_;
+  Metric* ptr_command_errors_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(ControlServer);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_CONTROL_SERVER_H_
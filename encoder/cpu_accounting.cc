@@ -0,0 +1,240 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/cpu_accounting.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+#include <new>
+
+#include "encoder/metrics.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+const char* const kStageNames[kNumCpuStages] = {
+  "capture",
+  "conversion",
+  "video_encode",
+  "audio_encode",
+  "mux",
+  "upload",
+  "background",
+  "other",
+};
+
+#ifdef _WIN32
+// Returns the user and kernel time of |thread| in microseconds, or -1.
+int64 ThreadTimesUs(HANDLE thread) {
+  FILETIME creation_time, exit_time, kernel_time, user_time;
+  if (!GetThreadTimes(thread, &creation_time, &exit_time, &kernel_time,
+                      &user_time)) {
+    return -1;
+  }
+  ULARGE_INTEGER kernel, user;
+  kernel.LowPart = kernel_time.dwLowDateTime;
+  kernel.HighPart = kernel_time.dwHighDateTime;
+  user.LowPart = user_time.dwLowDateTime;
+  user.HighPart = user_time.dwHighDateTime;
+  // FILETIME counts 100 nanosecond intervals.
+  return static_cast<int64>((kernel.QuadPart + user.QuadPart) / 10);
+}
+#else
+// Returns the time of |clock| in microseconds, or -1.
+int64 ClockUs(clockid_t clock) {
+  timespec time;
+  if (clock_gettime(clock, &time)) {
+    return -1;
+  }
+  return static_cast<int64>(time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+#endif
+}  // namespace
+
+// A registered thread. |stage| and |mark_us|, the thread time of the last
+// switch, are written by the thread and read by |Sample()|, both under
+// |mutex|.
+struct CpuAccounting::ThreadEntry {
+  ThreadEntry() : live(false), stage(kCpuOther), mark_us(0) {}
+  std::mutex mutex;
+  bool live;
+  CpuStage stage;
+  int64 mark_us;
+#ifdef _WIN32
+  HANDLE thread;
+#else
+  clockid_t clock;
+#endif
+};
+
+// Unregisters the thread when it exits.
+struct CpuAccounting::ThreadRegistration {
+  ThreadRegistration() : ptr_entry(NULL) {}
+  ~ThreadRegistration() {
+    if (ptr_entry)
+      CpuAccounting::Instance().Unregister(ptr_entry);
+  }
+  ThreadEntry* ptr_entry;
+};
+
+CpuAccounting::CpuAccounting() {
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  for (int i = 0; i < kNumCpuStages; ++i) {
+    charged_us_[i] = 0;
+    sampled_us_[i] = 0;
+    ptr_stage_cpu_us_[i] = registry.GetCounter(
+        "webmlive_cpu_microseconds_total",
+        std::string("stage=\"") + kStageNames[i] + "\"",
+        "CPU time of the threads of a pipeline stage.");
+  }
+}
+
+CpuAccounting::~CpuAccounting() {
+}
+
+CpuAccounting& CpuAccounting::Instance() {
+  static CpuAccounting accounting;
+  return accounting;
+}
+
+void CpuAccounting::Sample() {
+  int64 totals[kNumCpuStages];
+  for (int i = 0; i < kNumCpuStages; ++i) {
+    totals[i] = charged_us_[i].load();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < threads_.size(); ++i) {
+      ThreadEntry& entry = *threads_[i];
+      std::lock_guard<std::mutex> entry_lock(entry.mutex);
+      if (!entry.live)
+        continue;
+#ifdef _WIN32
+      const int64 now_us = ThreadTimesUs(entry.thread);
+#else
+      const int64 now_us = ClockUs(entry.clock);
+#endif
+      if (now_us > entry.mark_us)
+        totals[entry.stage] += now_us - entry.mark_us;
+    }
+  }
+  for (int i = 0; i < kNumCpuStages; ++i) {
+    if (totals[i] > sampled_us_[i])
+      sampled_us_[i] = totals[i];
+    if (ptr_stage_cpu_us_[i])
+      ptr_stage_cpu_us_[i]->Set(sampled_us_[i]);
+  }
+}
+
+int64 CpuAccounting::stage_cpu_us(CpuStage stage) const {
+  if (stage < 0 || stage >= kNumCpuStages) {
+    return 0;
+  }
+  return sampled_us_[stage].load();
+}
+
+const char* CpuAccounting::StageName(CpuStage stage) {
+  if (stage < 0 || stage >= kNumCpuStages) {
+    return "unknown";
+  }
+  return kStageNames[stage];
+}
+
+int64 CpuAccounting::CurrentThreadCpuUs() {
+#ifdef _WIN32
+  return ThreadTimesUs(GetCurrentThread());
+#else
+  return ClockUs(CLOCK_THREAD_CPUTIME_ID);
+#endif
+}
+
+CpuAccounting::ThreadEntry* CpuAccounting::CurrentThread() {
+  static thread_local ThreadRegistration t_registration;
+  if (t_registration.ptr_entry) {
+    return t_registration.ptr_entry;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  ThreadEntry* ptr_entry = NULL;
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    if (!threads_[i]->live) {
+      ptr_entry = threads_[i].get();
+      break;
+    }
+  }
+  if (!ptr_entry) {
+    std::unique_ptr<ThreadEntry> entry(
+        new (std::nothrow) ThreadEntry());  // NOLINT
+    if (!entry) {
+      LOG(ERROR) << "out of memory registering thread for CPU accounting.";
+      return NULL;
+    }
+    threads_.push_back(std::move(entry));
+    ptr_entry = threads_.back().get();
+  }
+
+  std::lock_guard<std::mutex> entry_lock(ptr_entry->mutex);
+#ifdef _WIN32
+  if (!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(),
+                       GetCurrentProcess(), &ptr_entry->thread, 0, FALSE,
+                       DUPLICATE_SAME_ACCESS)) {
+    LOG(ERROR) << "cannot open thread for CPU accounting.";
+    return NULL;
+  }
+#else
+  if (pthread_getcpuclockid(pthread_self(), &ptr_entry->clock)) {
+    LOG(ERROR) << "cannot read thread clock for CPU accounting.";
+    return NULL;
+  }
+#endif
+  ptr_entry->live = true;
+  ptr_entry->stage = kCpuOther;
+  ptr_entry->mark_us = CurrentThreadCpuUs();
+  t_registration.ptr_entry = ptr_entry;
+  return ptr_entry;
+}
+
+CpuStage CpuAccounting::Switch(ThreadEntry* ptr_entry, CpuStage stage) {
+  const int64 now_us = CurrentThreadCpuUs();
+  std::lock_guard<std::mutex> entry_lock(ptr_entry->mutex);
+  const CpuStage previous_stage = ptr_entry->stage;
+  if (now_us > ptr_entry->mark_us) {
+    charged_us_[previous_stage].fetch_add(now_us - ptr_entry->mark_us);
+    ptr_entry->mark_us = now_us;
+  }
+  ptr_entry->stage = stage;
+  return previous_stage;
+}
+
+void CpuAccounting::Unregister(ThreadEntry* ptr_entry) {
+  Switch(ptr_entry, kCpuOther);
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::lock_guard<std::mutex> entry_lock(ptr_entry->mutex);
+#ifdef _WIN32
+  CloseHandle(ptr_entry->thread);
+#endif
+  ptr_entry->live = false;
+}
+
+ScopedCpuStage::ScopedCpuStage(CpuStage stage)
+    : ptr_entry_(CpuAccounting::Instance().CurrentThread()),
+      previous_stage_(kCpuOther) {
+  if (ptr_entry_)
+    previous_stage_ = CpuAccounting::Instance().Switch(ptr_entry_, stage);
+}
+
+ScopedCpuStage::~ScopedCpuStage() {
+  if (ptr_entry_)
+    CpuAccounting::Instance().Switch(ptr_entry_, previous_stage_);
+}
+
+}  // namespace webmlive
@@ -0,0 +1,131 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_CPU_ACCOUNTING_H_
+#define WEBMLIVE_ENCODER_CPU_ACCOUNTING_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+class Metric;
+
+// Pipeline stages CPU time is charged to.
+enum CpuStage {
+  // Capture threads and callbacks, and file input delivery.
+  kCpuCapture = 0,
+  // Pixel format conversion off the capture threads.
+  kCpuConversion = 1,
+  // VPx, and other video, encoding.
+  kCpuVideoEncode = 2,
+  // Vorbis and Opus encoding.
+  kCpuAudioEncode = 3,
+  // The encoder thread: input pools, muxing and writes to the data sink.
+  kCpuMux = 4,
+  // Uploads, file output and other network and disk writes.
+  kCpuUpload = 5,
+  // Work the stream does not wait for, such as preview thumbnails.
+  kCpuBackground = 6,
+  // Time of registered threads outside every stage, such as task scheduler
+  // bookkeeping or DirectShow between callbacks.
+  kCpuOther = 7,
+  kNumCpuStages = 8,
+};
+
+// Splits the CPU time of the process between pipeline stages. Threads charge
+// their CPU time, as measured by the OS thread clock
+// (CLOCK_THREAD_CPUTIME_ID, GetThreadTimes), to the stage of the innermost
+// |ScopedCpuStage| they are in. |Sample()| adds up the time charged so far,
+// including the running time of live threads, and exports it as
+// webmlive_cpu_microseconds_total{stage="..."}.
+//
+//   void VideoEncodeWorker::WorkerThread() {
+//     ScopedCpuStage cpu_stage(kCpuVideoEncode);
+//     ...
+//   }
+//
+// Notes
+// - A thread is registered by its first |ScopedCpuStage| and unregistered
+//   when it exits. Time it spends outside every scope is charged to
+//   |kCpuOther|, so scopes may be used around callbacks on threads owned by
+//   others.
+// - Entering and leaving a scope read the thread clock, a system call on
+//   Linux: scopes belong around thread functions and tasks, not per packet
+//   work.
+// - On Windows thread times advance in clock ticks of about 15 ms.
+class CpuAccounting {
+ public:
+  static CpuAccounting& Instance();
+
+  // Updates the stage metrics. Call before writing the metrics.
+  void Sample();
+
+  // Returns the CPU time charged to |stage|, in microseconds, as of the last
+  // |Sample()|.
+  int64 stage_cpu_us(CpuStage stage) const;
+
+  // Returns the name of |stage|, as used in the metric label.
+  static const char* StageName(CpuStage stage);
+
+  // Returns the CPU time used by the current thread, in microseconds.
+  static int64 CurrentThreadCpuUs();
+
+ private:
+  friend class ScopedCpuStage;
+  struct ThreadEntry;
+  struct ThreadRegistration;
+
+  CpuAccounting();
+  ~CpuAccounting();
+
+  // Returns the entry of the current thread, registering the thread on first
+  // use. Returns NULL when out of memory.
+  ThreadEntry* CurrentThread();
+
+  // Charges the time the thread of |ptr_entry| ran since the last switch to
+  // its stage, and moves it to |stage|. Returns the previous stage. Called
+  // by the thread of |ptr_entry|.
+  CpuStage Switch(ThreadEntry* ptr_entry, CpuStage stage);
+
+  // Charges the last running time of an exiting thread, and frees its
+  // entry for reuse.
+  void Unregister(ThreadEntry* ptr_entry);
+
+  // Time charged by stage switches and exited threads.
+  std::atomic<int64> charged_us_[kNumCpuStages];
+
+  // Stage totals exported by |Sample()|, which never lets them decrease.
+  std::atomic<int64> sampled_us_[kNumCpuStages];
+  Metric* ptr_stage_cpu_us_[kNumCpuStages];
+
+  // Registered threads, and entries free for reuse. Protected by |mutex_|.
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadEntry>> threads_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(CpuAccounting);
+};
+
+// Charges the CPU time of the current thread to a stage while in scope.
+class ScopedCpuStage {
+ public:
+  explicit ScopedCpuStage(CpuStage stage);
+  ~ScopedCpuStage();
+
+ private:
+  CpuAccounting::ThreadEntry* ptr_entry_;
+  CpuStage previous_stage_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(ScopedCpuStage);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_CPU_ACCOUNTING_H_
@@ -7,9 +7,19 @@
 // be found in the AUTHORS file in the root of the source tree.
 #include "encoder/dash_writer.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
 #include <ios>
+#include <limits>
 #include <sstream>
 
+#include "encoder/av1_codec_config.h"
 #include "glog/logging.h"
 
 namespace webmlive {
@@ -22,6 +32,8 @@ const char kDefaultSchema[] = "urn:mpeg:dash:schema:mpd:2011";
 const int kDefaultMinBufferTime = 1;
 const int kDefaultMediaPresentationDuration = 36000;  // 10 hours.
 const char kDefaultType[] = "static";
+const char kDynamicType[] = "dynamic";
+const int kDefaultMinimumUpdatePeriod = 5;
 const char kDefaultProfiles[] = "urn:mpeg:dash:profile:isoff-live:2011";
 const int kDefaultStartTime = 0;
 const int kDefaultMaxWidth = 1920;
@@ -36,6 +48,12 @@ const int kDefaultChunkDuration = 5000;  // milliseconds.
 const std::string kDefaultStartNumber = "1";
 const int kDefaultStartWithSap = 1;
 const int kDefaultBandwidth = 1000000;  // Bits.
+
+// Measured bandwidth attributes are rounded up to a multiple of this, and
+// lowered only when the peak falls below |kBandwidthLowerFraction| of them,
+// so that the manifest is not rewritten for every small change.
+const int64 kBandwidthStep = 1000;
+const double kBandwidthLowerFraction = 0.9;
 const int kDefaultFrameRate = 30;
 const int kDefaultAudioSampleRate = 44100;
 const int kDefaultAudioChannels = 2;
@@ -43,6 +61,8 @@ const int kDefaultAudioChannels = 2;
 const char kAudioMimeType[] = "audio/webm";
 const char kVideoMimeType[] = "video/webm";
 const char kAudioCodecs[] = "vorbis";
+const char kOpusAudioCodecs[] = "opus";
+const int kOpusSampleRate = 48000;
 const char kVideoCodecs[] = "vp9";
 const char kAudioId[] = "1";
 const char kVideoId[] = "2";
@@ -54,6 +74,102 @@ const char kInitializationPattern[] = "_$RepresentationID$.hdr";
 const char kAudioSchemeUri[] =
   "urn:mpeg:dash:23003:3:audio_channel_configuration:2011";
 
+// Common Encryption signalling of encrypted AdaptationSets.
+const char kCencSchema[] = "urn:mpeg:cenc:2013";
+const char kPatchSchema[] = "urn:mpeg:dash:schema:mpd-patch:2020";
+const char kMp4ProtectionSchemeUri[] = "urn:mpeg:dash:mp4protection:2011";
+const char kCencScheme[] = "cenc";
+const size_t kCencKeyIdLength = 16;
+
+// Dynamic manifest templates mark variable values with |kValueMarker|
+// followed by a |DashWriter::FragmentValue| offset by |kValueMarkerBase|.
+// Neither byte can appear in the XML written for a manifest.
+const char kValueMarker = '\x01';
+const char kValueMarkerBase = '\x02';
+
+// Length of an xs:dateTime in UTC written by |FormatUtcTime()|, including the
+// terminating null.
+const size_t kUtcTimeLength = sizeof("YYYY-MM-DDThh:mm:ssZ");
+
+// Length of a publishTime written by |FormatPublishTime()|, which adds
+// milliseconds.
+const size_t kPublishTimeLength = sizeof("YYYY-MM-DDThh:mm:ss.mmmZ");
+
+// Formats |time| as an xs:dateTime in UTC and stores it in |buffer|.
+void FormatUtcTime(time_t time, char (&buffer)[kUtcTimeLength]) {
+  struct tm utc_time = {};
+#ifdef _WIN32
+  gmtime_s(&utc_time, &time);
+#else
+  gmtime_r(&time, &utc_time);
+#endif
+  if (!strftime(buffer, kUtcTimeLength, "%Y-%m-%dT%H:%M:%SZ", &utc_time))
+    buffer[0] = '\0';
+}
+
+// Formats |time_ms|, in milliseconds since the epoch, as an xs:dateTime in
+// UTC with milliseconds and stores it in |out|.
+void FormatPublishTime(int64 time_ms, std::string* out) {
+  char seconds[kUtcTimeLength];
+  FormatUtcTime(static_cast<time_t>(time_ms / 1000), seconds);
+  char buffer[kPublishTimeLength];
+  snprintf(buffer, sizeof(buffer), "%.19s.%03dZ", seconds,
+           static_cast<int>(time_ms % 1000));
+  out->assign(buffer);
+}
+
+// Appends the decimal form of |value| to |out|. Unlike a stream insertion,
+// this does not allocate when |out| has capacity for the digits.
+void AppendInt64(int64 value, std::string* out) {
+  char digits[24];
+  size_t pos = sizeof(digits);
+  const bool negative = value < 0;
+  uint64 magnitude = negative ?
+      static_cast<uint64>(-(value + 1)) + 1 : static_cast<uint64>(value);
+  do {
+    digits[--pos] = static_cast<char>('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude > 0);
+  if (negative)
+    digits[--pos] = '-';
+  out->append(digits + pos, sizeof(digits) - pos);
+}
+
+// Returns the 16 byte |key_id| as a UUID string, or an empty string when
+// |key_id| has another length.
+std::string FormatKeyIdUuid(const std::string& key_id) {
+  if (key_id.size() != kCencKeyIdLength)
+    return std::string();
+  static const char kHexDigits[] = "0123456789abcdef";
+  std::string uuid;
+  for (size_t i = 0; i < key_id.size(); ++i) {
+    if (i == 4 || i == 6 || i == 8 || i == 10)
+      uuid += '-';
+    const uint8 byte = static_cast<uint8>(key_id[i]);
+    uuid += kHexDigits[byte >> 4];
+    uuid += kHexDigits[byte & 0xF];
+  }
+  return uuid;
+}
+
+// Returns the codecs parameter of a |width| x |height| representation
+// encoded as |codec| at |bitrate_kbps| under |webm_config|. AV1 levels come
+// from the limits |AomEncoder| picks its level by.
+std::string VideoCodecs(VideoFormat codec, int width, int height,
+                        int bitrate_kbps,
+                        const WebmEncoderConfig& webm_config) {
+  if (codec == kVideoFormatVP8)
+    return "vp8";
+  if (codec != kVideoFormatAV1)
+    return kVideoCodecs;
+  Av1CodecConfig av1_config;
+  av1_config.level_index =
+      Av1LevelIndex(width, height, webm_config.actual_video_config.frame_rate,
+                    bitrate_kbps);
+  av1_config.bit_depth = webm_config.vpx_config.bit_depth;
+  return Av1CodecsString(av1_config);
+}
+
 //
 // AdaptationSet
 //
@@ -99,6 +215,22 @@ VideoAdaptationSet::VideoAdaptationSet()
   codecs = kVideoCodecs;
 }
 
+//
+// AudioRepresentation
+//
+AudioRepresentation::AudioRepresentation()
+    : codecs(kAudioCodecs),
+      bandwidth(kDefaultBandwidth),
+      audio_sampling_rate(kDefaultAudioSampleRate) {}
+
+//
+// VideoRepresentation
+//
+VideoRepresentation::VideoRepresentation()
+    : width(kDefaultMaxWidth),
+      height(kDefaultMaxHeight),
+      bandwidth(kDefaultBandwidth) {}
+
 //
 // DashConfig
 //
@@ -106,6 +238,9 @@ DashConfig::DashConfig()
       : type(kDefaultType),
         min_buffer_time(kDefaultMinBufferTime),
         media_presentation_duration(kDefaultMediaPresentationDuration),
+        minimum_update_period(kDefaultMinimumUpdatePeriod),
+        time_shift_buffer_depth(0),
+        patch_ttl(0),
         start_time(kDefaultStartTime),
         period_duration(kDefaultPeriodDuration) {}
 
@@ -113,6 +248,8 @@ DashConfig::DashConfig()
 // DashWriter
 //
 
+const char DashWriter::kPatchLocation[] = "webmlive.mpp";
+
 bool DashWriter::Init(const WebmEncoderConfig& webm_config) {
   if (webm_config.dash_name.empty()) {
     LOG(ERROR) << "name empty in DashWriter::Init()";
@@ -120,50 +257,213 @@ bool DashWriter::Init(const WebmEncoderConfig& webm_config) {
   }
 
   name_ = webm_config.dash_name;
+  bandwidth_window_ = std::max(0, webm_config.dash_bandwidth_window);
+
+  // Common Encryption key ids are UUIDs; other WebM key ids go unsignalled.
+  config_.default_kid.clear();
+  if (!webm_config.encryption_key.empty()) {
+    config_.default_kid = FormatKeyIdUuid(webm_config.encryption_key_id);
+    if (config_.default_kid.empty()) {
+      LOG(WARNING) << "encryption key id is not " << kCencKeyIdLength
+                   << " bytes; the manifest will not signal encryption.";
+    }
+  }
+  bandwidth_meters_.clear();
 
   if (!webm_config.disable_audio) {
     config_.audio_as.enabled = true;
-    config_.audio_as.bandwidth =
-        webm_config.vorbis_config.average_bitrate * 1000;
     config_.audio_as.media = name_ + kChunkPattern;
     config_.audio_as.initialization = name_ + kInitializationPattern;
     config_.audio_as.rep_id = kAudioId;
-    config_.audio_as.audio_sampling_rate =
-        webm_config.actual_audio_config.sample_rate;
+    if (webm_config.audio_codec == kAudioFormatOpus) {
+      config_.audio_as.codecs = kOpusAudioCodecs;
+      config_.audio_as.bandwidth = webm_config.opus_config.bitrate * 1000;
+      config_.audio_as.audio_sampling_rate = kOpusSampleRate;
+    } else {
+      config_.audio_as.bandwidth =
+          webm_config.vorbis_config.average_bitrate * 1000;
+      config_.audio_as.audio_sampling_rate =
+          webm_config.actual_audio_config.sample_rate;
+    }
     config_.audio_as.value = webm_config.actual_audio_config.channels;
     config_.audio_as.start_number = webm_config.dash_start_number;
+    config_.audio_as.lang = webm_config.audio_language;
   }
-  if (!webm_config.disable_video) {
-    config_.video_as.enabled = true;
-    config_.video_as.bandwidth = webm_config.vpx_config.bitrate * 1000;
-    config_.video_as.media = name_ + kChunkPattern;
-    config_.video_as.initialization = name_ + kInitializationPattern;
-    config_.video_as.rep_id = kVideoId;
-    config_.video_as.width = webm_config.actual_video_config.width;
-    config_.video_as.height = webm_config.actual_video_config.height;
-    config_.video_as.start_number = webm_config.dash_start_number;
-
-    if (webm_config.vpx_config.decimate != VpxConfig::kUseDefault) {
-      config_.video_as.frame_rate = static_cast<int>(
-          std::ceil(webm_config.actual_video_config.frame_rate /
-                    webm_config.vpx_config.decimate));
-    } else {
-      config_.video_as.frame_rate = static_cast<int>(
-          std::ceil(webm_config.actual_video_config.frame_rate));
+
+  // Each extra audio track is an AdaptationSet of its own, so that players
+  // choose among them by language. They share the codec settings of the
+  // main track.
+  config_.extra_audio_as.clear();
+  if (!webm_config.disable_audio) {
+    const std::vector<AudioTrackConfig>& tracks =
+        webm_config.extra_audio_tracks;
+    for (size_t i = 0; i < tracks.size(); ++i) {
+      AudioAdaptationSet audio_as = config_.audio_as;
+      audio_as.rep_id = AudioRepresentationId(static_cast<int>(i + 1));
+      audio_as.value = tracks[i].actual_audio_config.channels;
+      if (webm_config.audio_codec != kAudioFormatOpus) {
+        audio_as.audio_sampling_rate =
+            tracks[i].actual_audio_config.sample_rate;
+      }
+      audio_as.lang = tracks[i].language;
+      config_.extra_audio_as.push_back(audio_as);
     }
+  }
 
-    if (config_.video_as.frame_rate > config_.video_as.max_frame_rate) {
-      config_.video_as.max_frame_rate = config_.video_as.frame_rate;
+  // Audio bitrate ladder steps follow the main track's Representation in its
+  // AdaptationSet. Each has its own codec and sampling rate.
+  config_.audio_as.extra_representations.clear();
+  if (!webm_config.disable_audio) {
+    const std::vector<AudioRepresentationConfig>& reps =
+        webm_config.audio_representations;
+    for (size_t i = 0; i < reps.size(); ++i) {
+      AudioRepresentation rep;
+      rep.rep_id = AudioLadderRepresentationId(static_cast<int>(i + 1));
+      if (reps[i].codec == kAudioFormatOpus) {
+        rep.codecs = kOpusAudioCodecs;
+        rep.bandwidth = (reps[i].bitrate > 0 ?
+            reps[i].bitrate : webm_config.opus_config.bitrate) * 1000;
+        rep.audio_sampling_rate = kOpusSampleRate;
+      } else {
+        rep.codecs = kAudioCodecs;
+        rep.bandwidth = (reps[i].bitrate > 0 ?
+            reps[i].bitrate : webm_config.vorbis_config.average_bitrate) *
+            1000;
+        rep.audio_sampling_rate = webm_config.actual_audio_config.sample_rate;
+      }
+      if (rep.codecs != config_.audio_as.codecs)
+        config_.audio_as.bitstream_switching = false;
+      config_.audio_as.extra_representations.push_back(rep);
     }
   }
+  video_name_ = name_;
+  if (!webm_config.disable_video) {
+    InitVideoAdaptationSet(webm_config);
+  }
 
   config_.audio_as.chunk_duration = webm_config.vpx_config.keyframe_interval;
-  config_.video_as.chunk_duration = webm_config.vpx_config.keyframe_interval;
+  for (size_t i = 0; i < config_.extra_audio_as.size(); ++i) {
+    config_.extra_audio_as[i].chunk_duration =
+        webm_config.vpx_config.keyframe_interval;
+  }
+
+  if (webm_config.dash_dynamic) {
+    config_.type = kDynamicType;
+    availability_start_ = time(NULL);
+    char start_time[kUtcTimeLength];
+    FormatUtcTime(static_cast<time_t>(availability_start_), start_time);
+    config_.availability_start_time = start_time;
+    config_.time_shift_buffer_depth =
+        webm_config.dash_time_shift_buffer_depth;
+
+    // Clients need not look for a new manifest more often than chunks are
+    // added to it.
+    config_.minimum_update_period =
+        std::max(1, (webm_config.vpx_config.keyframe_interval + 999) / 1000);
+
+    config_.patch_location.clear();
+    if (webm_config.dash_patch_interval > 0) {
+      config_.patch_location = kPatchLocation;
+      config_.patch_ttl = webm_config.dash_patch_interval;
+    }
+  }
+  const int64 start_number =
+      strtoll(webm_config.dash_start_number.c_str(), NULL, 10);
+  audio_timeline_.first_number = std::max<int64>(1, start_number);
+  video_timeline_.first_number = audio_timeline_.first_number;
+  extra_audio_timelines_.assign(config_.extra_audio_as.size(),
+                                SegmentTimeline());
+  for (size_t i = 0; i < extra_audio_timelines_.size(); ++i)
+    extra_audio_timelines_[i].first_number = audio_timeline_.first_number;
 
+  fragments_.clear();
+  fragment_values_.clear();
+  publish_time_ = 0;
+  publish_time_text_.clear();
+  patch_.clear();
   initialized_ = true;
+
+  // Format the fixed parts of a dynamic manifest now; this also sets the
+  // indentation of SegmentTimeline entries written by |AddChunk()|.
+  if (dynamic() && !BuildFragments()) {
+    LOG(ERROR) << "cannot build dynamic manifest fragments.";
+    return false;
+  }
   return true;
 }
 
+void DashWriter::InitVideoAdaptationSet(
+    const WebmEncoderConfig& webm_config) {
+  config_.video_as = VideoAdaptationSet();
+  config_.video_as.enabled = true;
+  config_.video_as.bandwidth = webm_config.vpx_config.bitrate * 1000;
+  config_.video_as.media = video_name_ + kChunkPattern;
+  config_.video_as.initialization = video_name_ + kInitializationPattern;
+  config_.video_as.rep_id = kVideoId;
+  config_.video_as.width = webm_config.actual_video_config.width;
+  config_.video_as.height = webm_config.actual_video_config.height;
+  config_.video_as.start_number = webm_config.dash_start_number;
+  config_.video_as.codecs = VideoCodecs(
+      webm_config.vpx_config.codec, config_.video_as.width,
+      config_.video_as.height, webm_config.vpx_config.bitrate, webm_config);
+  config_.video_as.chunk_duration = webm_config.vpx_config.keyframe_interval;
+
+  // Chunks split by the byte budget start between keyframes.
+  if (webm_config.chunk_byte_budget > 0) {
+    config_.video_as.start_with_sap = 0;
+  }
+
+  if (webm_config.vpx_config.decimate != VpxConfig::kUseDefault) {
+    config_.video_as.frame_rate = static_cast<int>(
+        std::ceil(webm_config.actual_video_config.frame_rate /
+                  webm_config.vpx_config.decimate));
+  } else {
+    config_.video_as.frame_rate = static_cast<int>(
+        std::ceil(webm_config.actual_video_config.frame_rate));
+  }
+
+  if (config_.video_as.frame_rate > config_.video_as.max_frame_rate) {
+    config_.video_as.max_frame_rate = config_.video_as.frame_rate;
+  }
+
+  // Representations for multi-bitrate encodes. The first entry replaces the
+  // values stored above; the rest follow it in the AdaptationSet.
+  const std::vector<VideoRepresentationConfig>& reps =
+      webm_config.video_representations;
+  config_.video_as.extra_representations.clear();
+  for (size_t i = 0; i < reps.size(); ++i) {
+    VideoRepresentation rep;
+    rep.rep_id = VideoRepresentationId(static_cast<int>(i));
+    rep.width = reps[i].width > 0 ?
+        reps[i].width : webm_config.actual_video_config.width;
+    rep.height = reps[i].height > 0 ?
+        reps[i].height : webm_config.actual_video_config.height;
+    const int bitrate = reps[i].bitrate > 0 ?
+        reps[i].bitrate : webm_config.vpx_config.bitrate;
+    rep.bandwidth = bitrate * 1000;
+    const VideoFormat codec =
+        RepresentationCodec(reps[i], webm_config.vpx_config);
+    rep.codecs =
+        VideoCodecs(codec, rep.width, rep.height, bitrate, webm_config);
+    if (i == 0) {
+      config_.video_as.width = rep.width;
+      config_.video_as.height = rep.height;
+      config_.video_as.bandwidth = rep.bandwidth;
+      config_.video_as.codecs = rep.codecs;
+    } else {
+      // Switching to a representation of another codec needs its own
+      // initialization segment.
+      if (codec != RepresentationCodec(reps[0], webm_config.vpx_config))
+        config_.video_as.bitstream_switching = false;
+      config_.video_as.extra_representations.push_back(rep);
+    }
+    config_.video_as.max_width =
+        std::max(config_.video_as.max_width, rep.width);
+    config_.video_as.max_height =
+        std::max(config_.video_as.max_height, rep.height);
+  }
+}
+
 bool DashWriter::WriteManifest(std::string* out_manifest) {
   CHECK_NOTNULL(out_manifest);
   if (!initialized_) {
@@ -171,52 +471,640 @@ bool DashWriter::WriteManifest(std::string* out_manifest) {
     return false;
   }
 
+  if (!timelines()) {
+    WriteManifestTemplate(out_manifest);
+    LOG(INFO) << "\nmanifest:\n" << *out_manifest;
+    return true;
+  }
+
+  if (!Publish())
+    return false;
+
+  // Size |out_manifest| once so callers that keep their string see no
+  // allocations after the first few updates.
+  size_t length = 0;
+  for (size_t i = 0; i < fragments_.size(); ++i)
+    length += fragments_[i].length() + kPublishTimeLength;
+  const std::vector<SegmentTimeline*> timelines = all_timelines();
+  for (size_t i = 0; i < timelines.size(); ++i)
+    length += timelines[i]->xml.length();
+  for (size_t i = 0; i < previous_periods_.size(); ++i)
+    length += previous_periods_[i].length();
+  std::string& manifest = *out_manifest;
+  manifest.clear();
+  manifest.reserve(length);
+  AppendFragments(fragments_, fragment_values_, publish_time_text_.c_str(),
+                  &manifest);
+  VLOG(1) << "\nmanifest:\n" << manifest;
+  return true;
+}
+
+bool DashWriter::WritePatch(std::string* out_patch) {
+  CHECK_NOTNULL(out_patch);
+  if (!initialized_ || !dynamic() || config_.patch_location.empty()) {
+    LOG(ERROR) << "WritePatch() requires a dynamic DashWriter with patches.";
+    return false;
+  }
+  if (!Publish() || patch_.empty())
+    return false;
+  out_patch->assign(patch_);
+  VLOG(1) << "\npatch:\n" << *out_patch;
+  return true;
+}
+
+bool DashWriter::AddChunk(AdaptationSet::MediaType media_type, int64 start,
+                          int64 duration) {
+  if (!initialized_ || ended_) {
+    LOG(ERROR) << "AddChunk() requires an initialized DashWriter.";
+    return false;
+  }
+  return AddTimelineChunk(timeline(media_type), start, duration);
+}
+
+bool DashWriter::AddAudioChunk(int track_index, int64 start,
+                               int64 duration) {
+  if (!initialized_ || ended_) {
+    LOG(ERROR) << "AddAudioChunk() requires an initialized DashWriter.";
+    return false;
+  }
+  SegmentTimeline* const ptr_timeline = audio_timeline(track_index);
+  if (!ptr_timeline) {
+    LOG(ERROR) << "no audio track " << track_index;
+    return false;
+  }
+  return AddTimelineChunk(ptr_timeline, start, duration);
+}
+
+bool DashWriter::AddTimelineChunk(SegmentTimeline* ptr_timeline, int64 start,
+                                  int64 duration) {
+  if (start < 0 || duration <= 0) {
+    LOG(WARNING) << "ignoring chunk with invalid timing, start=" << start
+                 << " duration=" << duration;
+    return false;
+  }
+
+  // Format the entry in place at the end of the timeline.
+  std::string& xml = ptr_timeline->xml;
+  const size_t entry_start = xml.length();
+  xml.append(ptr_timeline->indent);
+  xml.append("<S t=\"");
+  AppendInt64(start, &xml);
+  xml.append("\" d=\"");
+  AppendInt64(duration, &xml);
+  xml.append("\"/>\n");
+  ptr_timeline->entry_lengths.push_back(xml.length() - entry_start);
+  ptr_timeline->end_time = start + duration;
+  ptr_timeline->entry_end_times.push_back(ptr_timeline->end_time);
+
+  if (dynamic() && config_.time_shift_buffer_depth > 0) {
+    // Drop entries that left the time shift buffer. Removing them from the
+    // front of |xml| keeps each update proportional to the buffer depth.
+    const int64 window_start = ptr_timeline->end_time -
+        static_cast<int64>(config_.time_shift_buffer_depth) * 1000;
+    size_t erase_length = 0;
+    while (ptr_timeline->entry_end_times.size() > 1 &&
+           ptr_timeline->entry_end_times.front() < window_start) {
+      erase_length += ptr_timeline->entry_lengths.front();
+      ptr_timeline->entry_lengths.pop_front();
+      ptr_timeline->entry_end_times.pop_front();
+      ++ptr_timeline->first_number;
+    }
+    if (erase_length > 0)
+      ptr_timeline->xml.erase(0, erase_length);
+
+    // Earlier Periods go once they have left the buffer entirely. Patches
+    // do not remove them; clients fetch the full manifest.
+    while (!previous_period_ends_.empty() &&
+           previous_period_ends_.front() < window_start) {
+      previous_periods_.pop_front();
+      previous_period_ends_.pop_front();
+      fixed_changed_ = true;
+    }
+  }
+  changed_ = true;
+  return true;
+}
+
+bool DashWriter::EndPresentation() {
+  if (!initialized_ || ended_) {
+    LOG(ERROR) << "EndPresentation() requires an initialized DashWriter.";
+    return false;
+  }
+  const std::vector<SegmentTimeline*> timelines = all_timelines();
+  bool have_chunks = false;
+  for (size_t i = 0; i < timelines.size(); ++i)
+    have_chunks |= !timelines[i]->entry_lengths.empty();
+  if (!have_chunks) {
+    LOG(ERROR) << "cannot end a presentation without chunks.";
+    return false;
+  }
+  ended_ = true;
+
+  // Static manifests formatted no timeline before now, so their entries
+  // were added without indentation. |BuildFragments()| sets it.
+  const bool indent_entries = !dynamic();
+  if (!BuildFragments()) {
+    LOG(ERROR) << "cannot build static manifest fragments.";
+    return false;
+  }
+  if (indent_entries) {
+    for (size_t i = 0; i < timelines.size(); ++i) {
+      std::string indented;
+      const std::string& xml = timelines[i]->xml;
+      size_t line_start = 0;
+      while (line_start < xml.length()) {
+        const size_t line_end = xml.find('\n', line_start);
+        const size_t next = line_end == std::string::npos ?
+            xml.length() : line_end + 1;
+        indented.append(timelines[i]->indent);
+        indented.append(xml, line_start, next - line_start);
+        line_start = next;
+      }
+      timelines[i]->xml.swap(indented);
+    }
+  }
+  LOG(INFO) << "presentation ended at " << presentation_end() << "ms.";
+  return true;
+}
+
+bool DashWriter::StartPeriod(const WebmEncoderConfig& webm_config) {
+  if (!initialized_ || !dynamic() || ended_) {
+    LOG(ERROR) << "StartPeriod() requires an initialized dynamic DashWriter.";
+    return false;
+  }
+
+  // Keep the current Period as written so far. A Period that ended before
+  // its first video chunk is dropped instead: it would start with its
+  // successor.
+  const int64 start = video_timeline_.end_time;
+  if (start > period_start_) {
+    std::string period_template;
+    ResetIndent();
+    IncreaseIndent();
+    WritePeriod(&period_template);
+    ResetIndent();
+    std::vector<std::string> fragments;
+    std::vector<FragmentRef> values;
+    if (!SplitTemplate(period_template, &fragments, &values)) {
+      LOG(ERROR) << "cannot split Period " << period_index_ << ".";
+      return false;
+    }
+    std::string period;
+    AppendFragments(fragments, values, NULL, &period);
+    previous_periods_.push_back(period);
+    previous_period_ends_.push_back(start);
+  }
+
+  // The new encoders are measured afresh.
+  bandwidth_meters_.erase(config_.video_as.rep_id);
+  const std::vector<VideoRepresentation>& video_reps =
+      config_.video_as.extra_representations;
+  for (size_t i = 0; i < video_reps.size(); ++i)
+    bandwidth_meters_.erase(video_reps[i].rep_id);
+
+  ++period_index_;
+  period_start_ = start;
+  std::ostringstream video_name;
+  video_name << name_ << "_p" << period_index_;
+  video_name_ = video_name.str();
+  if (!webm_config.disable_video) {
+    InitVideoAdaptationSet(webm_config);
+  }
+
+  // Audio numbering carries on from the chunks of the earlier Period; video
+  // restarts with the new chunk names.
+  for (int i = 0; i <= static_cast<int>(extra_audio_timelines_.size()); ++i) {
+    SegmentTimeline* const ptr_timeline = audio_timeline(i);
+    SegmentTimeline audio_timeline;
+    audio_timeline.first_number = ptr_timeline->first_number +
+        static_cast<int64>(ptr_timeline->entry_lengths.size());
+    audio_timeline.end_time = ptr_timeline->end_time;
+    *ptr_timeline = audio_timeline;
+  }
+  video_timeline_ = SegmentTimeline();
+  video_timeline_.end_time = start;
+
+  if (!BuildFragments()) {
+    LOG(ERROR) << "cannot build dynamic manifest fragments.";
+    return false;
+  }
+  LOG(INFO) << "Period " << period_index_ << " starts at " << start << "ms.";
+  return true;
+}
+
+bool DashWriter::MeasureChunk(const std::string& rep_id, int64 bytes,
+                              int64 duration) {
+  if (!initialized_ || bandwidth_window_ <= 0 || duration <= 0)
+    return false;
+  int* const ptr_bandwidth = RepresentationBandwidth(rep_id);
+  if (!ptr_bandwidth)
+    return false;
+
+  std::map<std::string, BandwidthMeter>::iterator meter =
+      bandwidth_meters_.find(rep_id);
+  if (meter == bandwidth_meters_.end()) {
+    meter = bandwidth_meters_.insert(
+        std::make_pair(rep_id, BandwidthMeter(bandwidth_window_))).first;
+  }
+  meter->second.AddChunk(bytes, duration);
+  const int64 peak = meter->second.peak_bps();
+  const int64 bandwidth = std::min<int64>(
+      ((peak + kBandwidthStep - 1) / kBandwidthStep) * kBandwidthStep,
+      std::numeric_limits<int>::max());
+  if (bandwidth <= 0 || bandwidth == *ptr_bandwidth ||
+      (bandwidth < *ptr_bandwidth &&
+       bandwidth >= *ptr_bandwidth * kBandwidthLowerFraction)) {
+    return false;
+  }
+  VLOG(1) << "Representation " << rep_id << " bandwidth " << *ptr_bandwidth
+          << " -> " << bandwidth << " (average "
+          << meter->second.average_bps() << ")";
+  *ptr_bandwidth = static_cast<int>(bandwidth);
+
+  // The bandwidth attributes are part of the fixed fragments;
+  // |WriteManifest()| formats them again.
+  fragments_.clear();
+  fragment_values_.clear();
+  return true;
+}
+
+int* DashWriter::RepresentationBandwidth(const std::string& rep_id) {
+  if (config_.video_as.enabled) {
+    VideoAdaptationSet& video_as = config_.video_as;
+    if (video_as.rep_id == rep_id)
+      return &video_as.bandwidth;
+    for (size_t i = 0; i < video_as.extra_representations.size(); ++i) {
+      if (video_as.extra_representations[i].rep_id == rep_id)
+        return &video_as.extra_representations[i].bandwidth;
+    }
+  }
+  if (config_.audio_as.enabled) {
+    AudioAdaptationSet& audio_as = config_.audio_as;
+    if (audio_as.rep_id == rep_id)
+      return &audio_as.bandwidth;
+    for (size_t i = 0; i < audio_as.extra_representations.size(); ++i) {
+      if (audio_as.extra_representations[i].rep_id == rep_id)
+        return &audio_as.extra_representations[i].bandwidth;
+    }
+    for (size_t i = 0; i < config_.extra_audio_as.size(); ++i) {
+      if (config_.extra_audio_as[i].rep_id == rep_id)
+        return &config_.extra_audio_as[i].bandwidth;
+    }
+  }
+  return NULL;
+}
+
+bool DashWriter::SetFirstNumber(AdaptationSet::MediaType media_type,
+                                int64 number) {
+  SegmentTimeline* const ptr_timeline = timeline(media_type);
+  if (!initialized_ || !ptr_timeline->entry_lengths.empty()) {
+    return false;
+  }
+  ptr_timeline->first_number = number;
+  return true;
+}
+
+bool DashWriter::SetAvailabilityStartTime(int64 start) {
+  if (!initialized_ || !dynamic() || start <= 0) {
+    LOG(ERROR) << "SetAvailabilityStartTime() requires an initialized "
+               << "dynamic DashWriter.";
+    return false;
+  }
+  availability_start_ = start;
+  char start_time[kUtcTimeLength];
+  FormatUtcTime(static_cast<time_t>(availability_start_), start_time);
+  config_.availability_start_time = start_time;
+
+  // The attribute is in the fixed parts of the manifest.
+  if (!BuildFragments()) {
+    LOG(ERROR) << "cannot build dynamic manifest fragments.";
+    return false;
+  }
+  return true;
+}
+
+bool DashWriter::dynamic() const {
+  return config_.type == kDynamicType;
+}
+
+void DashWriter::WriteManifestTemplate(std::string* out_manifest) {
+  CHECK_NOTNULL(out_manifest);
+  const bool is_dynamic = dynamic() && !ended_;
   std::ostringstream manifest;
 
   manifest << "<?xml version=\"1.0\"?>\n";
 
   // Open the MPD element.
   manifest << "<MPD "
-           << "xmlns=\"" << kDefaultSchema << "\" "
-           << "type=\"" << config_.type << "\" "
-           << "minBufferTime=\"PT" << config_.min_buffer_time << "S\" "
-           << "mediaPresentationDuration=\"PT"
-           << config_.media_presentation_duration << "S\" "
-           << "profiles=\"" << kDefaultProfiles << "\">"
+           << "xmlns=\"" << kDefaultSchema << "\" ";
+  if (!config_.default_kid.empty())
+    manifest << "xmlns:cenc=\"" << kCencSchema << "\" ";
+  const bool patches = is_dynamic && !config_.patch_location.empty();
+  if (patches)
+    manifest << "id=\"" << name_ << "\" ";
+  manifest << "type=\"" << (is_dynamic ? config_.type : kDefaultType)
+           << "\" ";
+  if (is_dynamic) {
+    manifest << "availabilityStartTime=\""
+             << config_.availability_start_time << "\" "
+             << "publishTime=\"" << kValueMarker
+             << static_cast<char>(kValueMarkerBase + kPublishTime) << "\" "
+             << "minimumUpdatePeriod=\"PT" << config_.minimum_update_period
+             << "S\" ";
+    if (config_.time_shift_buffer_depth > 0) {
+      manifest << "timeShiftBufferDepth=\"PT"
+               << config_.time_shift_buffer_depth << "S\" ";
+    }
+  }
+  manifest << "minBufferTime=\"PT" << config_.min_buffer_time << "S\" ";
+  if (ended_) {
+    // The presentation lasts until its last chunk ends.
+    const int64 end = presentation_end();
+    manifest << "mediaPresentationDuration=\"PT" << end / 1000 << "."
+             << std::setw(3) << std::setfill('0') << end % 1000 << "S\" ";
+  } else if (!is_dynamic) {
+    manifest << "mediaPresentationDuration=\"PT"
+             << config_.media_presentation_duration << "S\" ";
+  }
+  manifest << "profiles=\"" << kDefaultProfiles << "\">"
            << "\n";
   IncreaseIndent();
 
-  // Open the Period element.
-  manifest << indent_
-           << "<Period "
-           << "start=\"PT" << config_.start_time << "S\" "
-           << "duration=\"PT" << config_.period_duration << "S\">"
-           << "\n";
+  if (patches) {
+    manifest << indent_ << "<PatchLocation ttl=\"" << config_.patch_ttl
+             << "\">" << config_.patch_location << "</PatchLocation>\n";
+  }
+  if (dynamic()) {
+    manifest << kValueMarker
+             << static_cast<char>(kValueMarkerBase + kPreviousPeriods);
+  }
+  std::string period;
+  WritePeriod(&period);
+  manifest << period;
+
+  DecreaseIndent();
+  manifest << indent_ << "</MPD>\n";
+
+  *out_manifest = manifest.str();
+}
+
+void DashWriter::WritePeriod(std::string* out_period) {
+  CHECK_NOTNULL(out_period);
+  const bool is_dynamic = dynamic();
+  std::ostringstream period;
+
+  // Open the Period element. Live Periods have no duration, and start with
+  // millisecond precision after a |StartPeriod()|. Neither has the last
+  // Period of an ended presentation, which ends with the presentation.
+  period << indent_ << "<Period ";
+  if (is_dynamic)
+    period << "id=\"" << period_index_ << "\" ";
+  if (period_start_ > 0) {
+    period << "start=\"PT" << period_start_ / 1000 << "."
+           << std::setw(3) << std::setfill('0') << period_start_ % 1000
+           << "S\"";
+  } else {
+    period << "start=\"PT" << config_.start_time << "S\"";
+  }
+  if (!is_dynamic && !ended_)
+    period << " duration=\"PT" << config_.period_duration << "S\"";
+  period << ">\n";
   IncreaseIndent();
 
   if (config_.audio_as.enabled) {
     std::string audio_as;
-    WriteAudioAdaptationSet(&audio_as);
-    manifest << audio_as;
+    WriteAudioAdaptationSet(config_.audio_as, 0, &audio_as);
+    period << audio_as;
+    for (size_t i = 0; i < config_.extra_audio_as.size(); ++i) {
+      WriteAudioAdaptationSet(config_.extra_audio_as[i],
+                              static_cast<int>(i + 1), &audio_as);
+      period << audio_as;
+    }
   }
 
   if (config_.video_as.enabled) {
     std::string video_as;
     WriteVideoAdaptationSet(&video_as);
-    manifest << video_as;
+    period << video_as;
   }
 
-  // Close open elements.
+  // Close the Period element.
   DecreaseIndent();
-  manifest << indent_ << "</Period>\n";
-  DecreaseIndent();
-  manifest << indent_ << "</MPD>\n";
+  period << indent_ << "</Period>\n";
+  *out_period = period.str();
+}
 
-  LOG(INFO) << "\nmanifest:\n" << manifest.str();
-  *out_manifest = manifest.str();
+bool DashWriter::BuildFragments() {
+  std::string manifest_template;
+  WriteManifestTemplate(&manifest_template);
+  fragments_.clear();
+  fragment_values_.clear();
+  changed_ = true;
+  fixed_changed_ = true;
+  return SplitTemplate(manifest_template, &fragments_, &fragment_values_);
+}
+
+bool DashWriter::SplitTemplate(const std::string& manifest_template,
+                               std::vector<std::string>* fragments,
+                               std::vector<FragmentRef>* values) {
+  size_t fragment_start = 0;
+  for (;;) {
+    const size_t marker_pos =
+        manifest_template.find(kValueMarker, fragment_start);
+    if (marker_pos == std::string::npos) {
+      fragments->push_back(manifest_template.substr(fragment_start));
+      values->push_back(FragmentRef(kNoValue, 0));
+      break;
+    }
+    if (marker_pos + 1 >= manifest_template.length())
+      return false;
+    const int value = manifest_template[marker_pos + 1] - kValueMarkerBase;
+    if (value < kPublishTime || value >= kNoValue)
+      return false;
+
+    // Extra audio values are followed by the track index.
+    size_t marker_length = 2;
+    int track = 0;
+    if (value == kExtraAudioStartNumber || value == kExtraAudioTimeline) {
+      if (marker_pos + 2 >= manifest_template.length())
+        return false;
+      track = manifest_template[marker_pos + 2] - kValueMarkerBase;
+      marker_length = 3;
+    }
+    fragments->push_back(manifest_template.substr(
+        fragment_start, marker_pos - fragment_start));
+    values->push_back(FragmentRef(static_cast<FragmentValue>(value), track));
+    fragment_start = marker_pos + marker_length;
+  }
   return true;
 }
 
+void DashWriter::AppendFragments(const std::vector<std::string>& fragments,
+                                 const std::vector<FragmentRef>& values,
+                                 const char* publish_time,
+                                 std::string* out) const {
+  for (size_t i = 0; i < fragments.size(); ++i) {
+    out->append(fragments[i]);
+    const SegmentTimeline* const extra_timeline =
+        values[i].track > 0 &&
+        values[i].track <= static_cast<int>(extra_audio_timelines_.size()) ?
+        &extra_audio_timelines_[values[i].track - 1] : NULL;
+    switch (values[i].value) {
+      case kPublishTime:
+        if (publish_time)
+          out->append(publish_time);
+        break;
+      case kAudioStartNumber:
+        AppendInt64(audio_timeline_.first_number, out);
+        break;
+      case kVideoStartNumber:
+        AppendInt64(video_timeline_.first_number, out);
+        break;
+      case kAudioTimeline:
+        out->append(audio_timeline_.xml);
+        break;
+      case kVideoTimeline:
+        out->append(video_timeline_.xml);
+        break;
+      case kPreviousPeriods:
+        for (size_t j = 0; j < previous_periods_.size(); ++j)
+          out->append(previous_periods_[j]);
+        break;
+      case kExtraAudioStartNumber:
+        if (extra_timeline)
+          AppendInt64(extra_timeline->first_number, out);
+        break;
+      case kExtraAudioTimeline:
+        if (extra_timeline)
+          out->append(extra_timeline->xml);
+        break;
+      case kNoValue:
+        break;
+    }
+  }
+}
+
+bool DashWriter::Publish() {
+  if (fragments_.empty() && !BuildFragments()) {
+    LOG(ERROR) << "cannot build dynamic manifest fragments.";
+    return false;
+  }
+  if (publish_time_ > 0 && !changed_)
+    return true;
+
+  // Patches name the version they apply to by its publishTime, so versions
+  // written within the same millisecond still get different ones.
+  const int64 now = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  const int64 previous_publish_time = publish_time_;
+  const std::string original_publish_time = publish_time_text_;
+  publish_time_ = std::max(now, publish_time_ + 1);
+  FormatPublishTime(publish_time_, &publish_time_text_);
+
+  patch_.clear();
+  if (!config_.patch_location.empty()) {
+    if (previous_publish_time > 0 && !fixed_changed_ && !ended_)
+      BuildPatch(original_publish_time);
+    const std::vector<SegmentTimeline*> timelines = all_timelines();
+    for (size_t i = 0; i < timelines.size(); ++i) {
+      SegmentTimeline* const ptr_timeline = timelines[i];
+      ptr_timeline->published_first_number = ptr_timeline->first_number;
+      ptr_timeline->published_end_number = ptr_timeline->first_number +
+          static_cast<int64>(ptr_timeline->entry_lengths.size());
+    }
+  }
+  changed_ = false;
+  fixed_changed_ = false;
+  return true;
+}
+
+void DashWriter::BuildPatch(const std::string& original_publish_time) {
+  std::string& patch = patch_;
+  patch.append("<?xml version=\"1.0\"?>\n");
+  patch.append("<Patch xmlns=\"");
+  patch.append(kPatchSchema);
+  patch.append("\" mpdId=\"");
+  patch.append(name_);
+  patch.append("\" originalPublishTime=\"");
+  patch.append(original_publish_time);
+  patch.append("\" publishTime=\"");
+  patch.append(publish_time_text_);
+  patch.append("\">\n");
+  patch.append(kIndentStep);
+  patch.append("<replace sel=\"/MPD/@publishTime\">");
+  patch.append(publish_time_text_);
+  patch.append("</replace>\n");
+  if (config_.audio_as.enabled) {
+    for (int i = 0; i <= static_cast<int>(extra_audio_timelines_.size());
+         ++i) {
+      AppendTimelinePatch(*audio_timeline(i), AudioAdaptationSetId(i),
+                          &patch);
+    }
+  }
+  if (config_.video_as.enabled)
+    AppendTimelinePatch(video_timeline_, VideoAdaptationSetId(), &patch);
+  patch.append("</Patch>\n");
+}
+
+void DashWriter::AppendTimelinePatch(const SegmentTimeline& timeline,
+                                     int as_id, std::string* patch) const {
+  const int64 end_number = timeline.first_number +
+      static_cast<int64>(timeline.entry_lengths.size());
+  if (timeline.first_number == timeline.published_first_number &&
+      end_number == timeline.published_end_number) {
+    return;
+  }
+  std::string selector = "/MPD/Period[@id='";
+  AppendInt64(period_index_, &selector);
+  selector.append("']/AdaptationSet[@id='");
+  AppendInt64(as_id, &selector);
+  selector.append("']/SegmentTemplate");
+
+  // Entries that left the time shift buffer are the first ones, and each
+  // removal makes the next one first.
+  const int64 removed = std::max<int64>(
+      0, std::min(timeline.first_number, timeline.published_end_number) -
+          timeline.published_first_number);
+  for (int64 i = 0; i < removed; ++i) {
+    patch->append(kIndentStep);
+    patch->append("<remove sel=\"");
+    patch->append(selector);
+    patch->append("/SegmentTimeline/S[1]\"/>\n");
+  }
+  if (timeline.first_number != timeline.published_first_number) {
+    patch->append(kIndentStep);
+    patch->append("<replace sel=\"");
+    patch->append(selector);
+    patch->append("/@startNumber\">");
+    AppendInt64(timeline.first_number, patch);
+    patch->append("</replace>\n");
+  }
+
+  // New entries are the last ones of |timeline.xml|.
+  const int64 added = end_number -
+      std::max(timeline.first_number, timeline.published_end_number);
+  if (added <= 0)
+    return;
+  size_t offset = timeline.xml.length();
+  for (int64 i = 0; i < added; ++i)
+    offset -= timeline.entry_lengths[timeline.entry_lengths.size() - 1 - i];
+  patch->append(kIndentStep);
+  patch->append("<add sel=\"");
+  patch->append(selector);
+  patch->append("/SegmentTimeline\">\n");
+  patch->append(timeline.xml, offset, std::string::npos);
+  patch->append(kIndentStep);
+  patch->append("</add>\n");
+}
+
+int DashWriter::AudioAdaptationSetId(int track_index) const {
+  return track_index + 1;
+}
+
+int DashWriter::VideoAdaptationSetId() const {
+  return static_cast<int>(config_.extra_audio_as.size()) + 2;
+}
+
 std::string DashWriter::IdForChunk(AdaptationSet::MediaType media_type,
                                    int64 chunk_num) const {
   CHECK(initialized_);
@@ -226,8 +1114,8 @@ std::string DashWriter::IdForChunk(AdaptationSet::MediaType media_type,
     initialization = name_ + "_" + kAudioId + ".hdr";
     media  = name_ + "_" + kAudioId + "_";
   } else {
-    initialization = name_ + "_" + kVideoId + ".hdr";
-    media  = name_ + "_" + kVideoId + "_";
+    initialization = video_name_ + "_" + kVideoId + ".hdr";
+    media  = video_name_ + "_" + kVideoId + "_";
   }
 
   std::ostringstream id;
@@ -239,15 +1127,131 @@ std::string DashWriter::IdForChunk(AdaptationSet::MediaType media_type,
   return id.str();
 }
 
-void DashWriter::WriteAudioAdaptationSet(std::string* adaptation_set) {
+std::string DashWriter::IdForVideoChunk(int rep_index,
+                                        int64 chunk_num) const {
+  CHECK(initialized_);
+  const std::string rep_id = VideoRepresentationId(rep_index);
+  std::ostringstream id;
+  if (chunk_num == 0) {
+    id << video_name_ << "_" << rep_id << ".hdr";
+  } else {
+    id << video_name_ << "_" << rep_id << "_" << chunk_num << ".chk";
+  }
+  return id.str();
+}
+
+std::string DashWriter::IdForAudioChunk(int track_index,
+                                        int64 chunk_num) const {
+  CHECK(initialized_);
+  const std::string rep_id = AudioRepresentationId(track_index);
+  std::ostringstream id;
+  if (chunk_num == 0) {
+    id << name_ << "_" << rep_id << ".hdr";
+  } else {
+    id << name_ << "_" << rep_id << "_" << chunk_num << ".chk";
+  }
+  return id.str();
+}
+
+std::string DashWriter::IdForAudioRepresentationChunk(int rep_index,
+                                                      int64 chunk_num) const {
+  CHECK(initialized_);
+  const std::string rep_id = AudioLadderRepresentationId(rep_index);
+  std::ostringstream id;
+  if (chunk_num == 0) {
+    id << name_ << "_" << rep_id << ".hdr";
+  } else {
+    id << name_ << "_" << rep_id << "_" << chunk_num << ".chk";
+  }
+  return id.str();
+}
+
+// Representation 0 keeps the historical video id, |kVideoId|. The others
+// append their index to it.
+std::string DashWriter::VideoRepresentationId(int rep_index) {
+  std::ostringstream rep_id;
+  rep_id << kVideoId;
+  if (rep_index > 0) {
+    rep_id << "-" << rep_index;
+  }
+  return rep_id.str();
+}
+
+// Audio tracks are numbered as video representations are, from |kAudioId|.
+std::string DashWriter::AudioRepresentationId(int track_index) {
+  std::ostringstream rep_id;
+  rep_id << kAudioId;
+  if (track_index > 0) {
+    rep_id << "-" << track_index;
+  }
+  return rep_id.str();
+}
+
+// Audio ladder steps append their index to |kAudioId| after a period, which
+// keeps them apart from the extra tracks.
+std::string DashWriter::AudioLadderRepresentationId(int rep_index) {
+  std::ostringstream rep_id;
+  rep_id << kAudioId;
+  if (rep_index > 0) {
+    rep_id << "." << rep_index;
+  }
+  return rep_id.str();
+}
+
+// Chunk ids end in "_<rep_id>.hdr" or "_<rep_id>_<chunk_num>.chk". Audio uses
+// |kAudioId| and video |kVideoId|, each optionally followed by "-<index>";
+// audio ladder steps use "." instead of "-".
+bool DashWriter::ParseChunkId(const std::string& id,
+                              AdaptationSet::MediaType* ptr_media_type,
+                              bool* ptr_init) {
+  const char kInitSuffix[] = ".hdr";
+  const char kMediaSuffix[] = ".chk";
+  const size_t suffix_length = sizeof(kInitSuffix) - 1;
+  if (!ptr_media_type || !ptr_init || id.size() <= suffix_length) {
+    return false;
+  }
+  const std::string suffix = id.substr(id.size() - suffix_length);
+  std::string stem = id.substr(0, id.size() - suffix_length);
+  if (suffix == kMediaSuffix) {
+    const size_t num_pos = stem.rfind('_');
+    if (num_pos == std::string::npos) {
+      return false;
+    }
+    stem.resize(num_pos);
+    *ptr_init = false;
+  } else if (suffix == kInitSuffix) {
+    *ptr_init = true;
+  } else {
+    return false;
+  }
+  const size_t rep_pos = stem.rfind('_');
+  if (rep_pos == std::string::npos) {
+    return false;
+  }
+  const std::string rep_id = stem.substr(rep_pos + 1);
+  if (rep_id.compare(0, strlen(kAudioId), kAudioId) == 0) {
+    *ptr_media_type = AdaptationSet::kAudio;
+  } else if (rep_id.compare(0, strlen(kVideoId), kVideoId) == 0) {
+    *ptr_media_type = AdaptationSet::kVideo;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void DashWriter::WriteAudioAdaptationSet(const AudioAdaptationSet& audio_as,
+                                         int track_index,
+                                         std::string* adaptation_set) {
   CHECK_NOTNULL(adaptation_set);
   std::ostringstream a_stream;
-  const AudioAdaptationSet& audio_as = config_.audio_as;
 
   // Open the AdaptationSet element.
   a_stream << indent_
            << "<AdaptationSet "
-           << "segmentAlignment=\""
+           << "id=\"" << AudioAdaptationSetId(track_index) << "\" ";
+  if (!audio_as.lang.empty())
+    a_stream << "lang=\"" << audio_as.lang << "\" ";
+  a_stream << "segmentAlignment=\""
            << std::boolalpha << audio_as.segment_alignment << "\" "
            << "audioSamplingRate=\"" << audio_as.audio_sampling_rate << "\" "
            << "bitstreamSwitching=\"" << audio_as.bitstream_switching << "\">"
@@ -261,6 +1265,7 @@ void DashWriter::WriteAudioAdaptationSet(std::string* adaptation_set) {
            << "value=\"" << audio_as.value << "\">"
            << "</AudioChannelConfiguration>"
            << "\n";
+  WriteContentProtection(&a_stream);
 
   // Write ContentComponent element.
   a_stream << indent_
@@ -270,14 +1275,9 @@ void DashWriter::WriteAudioAdaptationSet(std::string* adaptation_set) {
            << "\n";
 
   // Write SegmentTemplate element.
-  a_stream << indent_
-           << "<SegmentTemplate "
-           << "timescale=\"" << audio_as.timescale << "\" "
-           << "duration=\"" << audio_as.chunk_duration << "\" "
-           << "media=\"" << audio_as.media << "\" "
-           << "startNumber=\"" << audio_as.start_number << "\" "
-           << "initialization=\"" << audio_as.initialization << "\"/>"
-           << "\n";
+  std::string segment_template;
+  WriteSegmentTemplate(audio_as, track_index, &segment_template);
+  a_stream << segment_template;
 
   // Write the Representation element.
   a_stream << indent_
@@ -290,12 +1290,37 @@ void DashWriter::WriteAudioAdaptationSet(std::string* adaptation_set) {
            << "></Representation>"
            << "\n";
 
+  for (size_t i = 0; i < audio_as.extra_representations.size(); ++i) {
+    const AudioRepresentation& rep = audio_as.extra_representations[i];
+    a_stream << indent_
+             << "<Representation "
+             << "id=\"" << rep.rep_id << "\" "
+             << "mimeType=\"" << audio_as.mimetype << "\" "
+             << "codecs=\"" << rep.codecs << "\" "
+             << "audioSamplingRate=\"" << rep.audio_sampling_rate << "\" "
+             << "startWithSAP=\"" << audio_as.start_with_sap << "\" "
+             << "bandwidth=\"" << rep.bandwidth << "\" "
+             << "></Representation>"
+             << "\n";
+  }
+
   // Close open the AdaptationSet element.
   DecreaseIndent();
   a_stream << indent_ << "</AdaptationSet>\n";
   *adaptation_set = a_stream.str();
 }
 
+void DashWriter::WriteContentProtection(std::ostringstream* ptr_stream) {
+  if (config_.default_kid.empty())
+    return;
+  *ptr_stream << indent_
+              << "<ContentProtection "
+              << "schemeIdUri=\"" << kMp4ProtectionSchemeUri << "\" "
+              << "value=\"" << kCencScheme << "\" "
+              << "cenc:default_KID=\"" << config_.default_kid << "\"/>"
+              << "\n";
+}
+
 void DashWriter::WriteVideoAdaptationSet(std::string* adaptation_set) {
   CHECK_NOTNULL(adaptation_set);
   std::ostringstream v_stream;
@@ -304,6 +1329,7 @@ void DashWriter::WriteVideoAdaptationSet(std::string* adaptation_set) {
   // Open the AdaptationSet element.
   v_stream << indent_
            << "<AdaptationSet "
+           << "id=\"" << VideoAdaptationSetId() << "\" "
            << "segmentAlignment=\""
            << std::boolalpha << video_as.segment_alignment << "\" "
            << "bitstreamSwitching=\"" << video_as.bitstream_switching << "\" "
@@ -312,6 +1338,7 @@ void DashWriter::WriteVideoAdaptationSet(std::string* adaptation_set) {
            << "maxFrameRate=\"" << video_as.max_frame_rate << "\">"
            << "\n";
   IncreaseIndent();
+  WriteContentProtection(&v_stream);
 
   // Write ContentComponent element.
   v_stream << indent_
@@ -321,14 +1348,9 @@ void DashWriter::WriteVideoAdaptationSet(std::string* adaptation_set) {
            << "\n";
 
   // Write SegmentTemplate element.
-  v_stream << indent_
-           << "<SegmentTemplate "
-           << "timescale=\"" << video_as.timescale << "\" "
-           << "duration=\"" << video_as.chunk_duration << "\" "
-           << "media=\"" << video_as.media << "\" "
-           << "startNumber=\"" << video_as.start_number << "\" "
-           << "initialization=\"" << video_as.initialization << "\"/>"
-           << "\n";
+  std::string segment_template;
+  WriteSegmentTemplate(video_as, 0, &segment_template);
+  v_stream << segment_template;
 
   // Write the Representation element.
   v_stream << indent_
@@ -344,12 +1366,122 @@ void DashWriter::WriteVideoAdaptationSet(std::string* adaptation_set) {
            << "></Representation>"
            << "\n";
 
+  for (size_t i = 0; i < video_as.extra_representations.size(); ++i) {
+    const VideoRepresentation& rep = video_as.extra_representations[i];
+    v_stream << indent_
+             << "<Representation "
+             << "id=\"" << rep.rep_id << "\" "
+             << "mimeType=\"" << video_as.mimetype << "\" "
+             << "codecs=\"" << rep.codecs << "\" "
+             << "width=\"" << rep.width << "\" "
+             << "height=\"" << rep.height << "\" "
+             << "startWithSAP=\"" << video_as.start_with_sap << "\" "
+             << "bandwidth=\"" << rep.bandwidth << "\" "
+             << "frameRate=\"" << video_as.frame_rate << "\" "
+             << "></Representation>"
+             << "\n";
+  }
+
   // Close open the AdaptationSet element.
   DecreaseIndent();
   v_stream << indent_ << "</AdaptationSet>\n";
   *adaptation_set = v_stream.str();
 }
 
+void DashWriter::WriteSegmentTemplate(const AdaptationSet& as,
+                                      int track_index,
+                                      std::string* segment_template) {
+  CHECK_NOTNULL(segment_template);
+  std::ostringstream t_stream;
+  t_stream << indent_
+           << "<SegmentTemplate "
+           << "timescale=\"" << as.timescale << "\" ";
+
+  if (!timelines()) {
+    t_stream << "duration=\"" << as.chunk_duration << "\" "
+             << "media=\"" << as.media << "\" "
+             << "startNumber=\"" << as.start_number << "\" "
+             << "initialization=\"" << as.initialization << "\"/>"
+             << "\n";
+    *segment_template = t_stream.str();
+    return;
+  }
+
+  // Extra audio tracks add their index to the markers.
+  const bool audio = as.media_type == AdaptationSet::kAudio;
+  const bool extra_audio = audio && track_index > 0;
+  std::string start_number_marker(1, kValueMarker);
+  std::string timeline_marker(1, kValueMarker);
+  if (extra_audio) {
+    start_number_marker +=
+        static_cast<char>(kValueMarkerBase + kExtraAudioStartNumber);
+    start_number_marker += static_cast<char>(kValueMarkerBase + track_index);
+    timeline_marker +=
+        static_cast<char>(kValueMarkerBase + kExtraAudioTimeline);
+    timeline_marker += static_cast<char>(kValueMarkerBase + track_index);
+  } else {
+    start_number_marker += static_cast<char>(
+        kValueMarkerBase + (audio ? kAudioStartNumber : kVideoStartNumber));
+    timeline_marker += static_cast<char>(
+        kValueMarkerBase + (audio ? kAudioTimeline : kVideoTimeline));
+  }
+
+  // Chunk times are those of the whole presentation; offset them to the
+  // Period.
+  if (period_start_ > 0) {
+    t_stream << "presentationTimeOffset=\""
+             << period_start_ * as.timescale / 1000 << "\" ";
+  }
+  t_stream << "media=\"" << as.media << "\" "
+           << "startNumber=\"" << start_number_marker << "\" "
+           << "initialization=\"" << as.initialization << "\">"
+           << "\n";
+  IncreaseIndent();
+  t_stream << indent_ << "<SegmentTimeline>\n";
+  IncreaseIndent();
+  SegmentTimeline* const ptr_timeline = audio ?
+      audio_timeline(track_index) : &video_timeline_;
+  if (ptr_timeline)
+    ptr_timeline->indent = indent_;
+  t_stream << timeline_marker;
+  DecreaseIndent();
+  t_stream << indent_ << "</SegmentTimeline>\n";
+  DecreaseIndent();
+  t_stream << indent_ << "</SegmentTemplate>\n";
+  *segment_template = t_stream.str();
+}
+
+DashWriter::SegmentTimeline* DashWriter::timeline(
+    AdaptationSet::MediaType media_type) {
+  return media_type == AdaptationSet::kAudio ?
+      &audio_timeline_ : &video_timeline_;
+}
+
+DashWriter::SegmentTimeline* DashWriter::audio_timeline(int track_index) {
+  if (track_index == 0)
+    return &audio_timeline_;
+  if (track_index < 0 ||
+      track_index > static_cast<int>(extra_audio_timelines_.size()))
+    return NULL;
+  return &extra_audio_timelines_[track_index - 1];
+}
+
+std::vector<DashWriter::SegmentTimeline*> DashWriter::all_timelines() {
+  std::vector<SegmentTimeline*> timelines;
+  timelines.push_back(&audio_timeline_);
+  timelines.push_back(&video_timeline_);
+  for (size_t i = 0; i < extra_audio_timelines_.size(); ++i)
+    timelines.push_back(&extra_audio_timelines_[i]);
+  return timelines;
+}
+
+int64 DashWriter::presentation_end() const {
+  int64 end = std::max(audio_timeline_.end_time, video_timeline_.end_time);
+  for (size_t i = 0; i < extra_audio_timelines_.size(); ++i)
+    end = std::max(end, extra_audio_timelines_[i].end_time);
+  return end;
+}
+
 void DashWriter::IncreaseIndent() {
   indent_ = indent_ + kIndentStep;
 }
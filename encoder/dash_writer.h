@@ -8,8 +8,14 @@
 #ifndef WEBMLIVE_ENCODER_DASH_WRITER_H_
 #define WEBMLIVE_ENCODER_DASH_WRITER_H_
 
+#include <deque>
+#include <map>
+#include <sstream>
 #include <string>
+#include <vector>
 
+#include "encoder/bandwidth_meter.h"
+#include "encoder/basictypes.h"
 #include "encoder/webm_encoder.h"
 
 namespace webmlive {
@@ -50,17 +56,45 @@ public:
  int bandwidth;
 };
 
+// Per Representation properties for audio AdaptationSets with more than one
+// Representation.
+struct AudioRepresentation {
+  AudioRepresentation();
+
+  std::string rep_id;
+  std::string codecs;
+  int bandwidth;
+  int audio_sampling_rate;
+};
+
 class AudioAdaptationSet : public AdaptationSet {
  public:
   AudioAdaptationSet();
   virtual ~AudioAdaptationSet() {}
 
-  // Audio AdaptationSet properties.
+  // Audio AdaptationSet properties. |lang| is omitted when empty.
   int audio_sampling_rate;
+  std::string lang;
 
   // AudioChannelConfiguration.
   std::string scheme_id_uri;
   int value;  // Audio channels.
+
+  // Additional Representations written after the one described by |rep_id|,
+  // |codecs| and |bandwidth|. Used for audio bitrate ladders.
+  std::vector<AudioRepresentation> extra_representations;
+};
+
+// Per Representation properties for video AdaptationSets with more than one
+// Representation.
+struct VideoRepresentation {
+  VideoRepresentation();
+
+  std::string rep_id;
+  std::string codecs;
+  int width;
+  int height;
+  int bandwidth;
 };
 
 class VideoAdaptationSet : public AdaptationSet {
@@ -77,33 +111,67 @@ class VideoAdaptationSet : public AdaptationSet {
   int width;
   int height;
   int frame_rate;
+
+  // Additional Representations written after the one described by |rep_id|,
+  // |width|, |height| and |bandwidth|. Used for multi-bitrate encodes.
+  std::vector<VideoRepresentation> extra_representations;
 };
 
 struct DashConfig {
   DashConfig();
 
-  // MPD properties.
+  // MPD properties. |media_presentation_duration| is used for static MPDs.
+  // Dynamic MPDs use |availability_start_time| (an xs:dateTime string),
+  // |minimum_update_period|, and |time_shift_buffer_depth|, which is omitted
+  // when 0 or less. Durations are in seconds.
   std::string type;
   int min_buffer_time;
   int media_presentation_duration;
+  std::string availability_start_time;
+  int minimum_update_period;
+  int time_shift_buffer_depth;
+
+  // MPD Patch location of a dynamic MPD, relative to the MPD, and the
+  // seconds after publishTime that clients may use it. The MPD then has an
+  // id and a PatchLocation element. Patches are not offered when
+  // |patch_location| is empty.
+  std::string patch_location;
+  int patch_ttl;
 
   // Period properties.
   int start_time;
   int period_duration;
 
-  // Audio/Video adaptation sets.
-  // TODO(tomfinegan): Support multiple adaptation sets per media type.
+  // Audio/Video adaptation sets. |extra_audio_as| describes the tracks of
+  // |WebmEncoderConfig::extra_audio_tracks|, and follows |audio_as|.
   AudioAdaptationSet audio_as;
+  std::vector<AudioAdaptationSet> extra_audio_as;
   VideoAdaptationSet video_as;
+
+  // Key id of encrypted output as a UUID. Every AdaptationSet then has a
+  // Common Encryption ContentProtection element naming it. Empty for clear
+  // output.
+  std::string default_kid;
 };
 
 class DashWriter {
  public:
-  DashWriter() : initialized_(false){}
+  DashWriter()
+      : initialized_(false), ended_(false), availability_start_(0),
+        bandwidth_window_(0), period_index_(0), period_start_(0),
+        publish_time_(0), changed_(false), fixed_changed_(false) {}
   ~DashWriter() {}
 
   DashConfig config() const { return config_; }
-  void config(DashConfig& config) { config_ = config; }
+  void config(DashConfig& config) {
+    config_ = config;
+    fragments_.clear();
+    fragment_values_.clear();
+  }
+
+  // Location of the MPD Patch documents of dynamic manifests written with
+  // |WebmEncoderConfig::dash_patch_interval|, relative to the manifest.
+  static const char kPatchLocation[];
 
   // Builds the SegmentTemplate media and initialization strings and then stores
   // them in |config|. Must be called before |WriteManifest()|. Returns true
@@ -112,24 +180,294 @@ class DashWriter {
 
   // Writes the DASH manifest built from |config| to |manifest|. Returns true
   // when successful.
+  //
+  // Dynamic manifests describe segments with a SegmentTimeline built from
+  // |AddChunk()| calls. The parts of the manifest that do not change are
+  // formatted by |Init()|; later calls only join them with publishTime, the
+  // start numbers and the timelines. |manifest| is overwritten in place, so
+  // callers that pass the same string each time reuse its storage.
+  //
+  // Each change to a dynamic manifest makes a new version with a later
+  // publishTime. Writing the same version again keeps its publishTime.
   bool WriteManifest(std::string* manifest);
 
+  // Writes to |patch| the MPD Patch document that updates the previous
+  // version of a dynamic manifest to the current one, so that clients
+  // holding the previous version fetch only the SegmentTimeline entries
+  // added and removed since. Returns false when the manifest offers no
+  // patches, and when no patch describes the current version: the first
+  // one, and those whose other parts changed, such as a new Period or
+  // bandwidth. Clients then need the full manifest from |WriteManifest()|.
+  bool WritePatch(std::string* patch);
+
+  // Appends a chunk starting at |start| and lasting |duration| milliseconds
+  // to the SegmentTimeline of |media_type|. In dynamic manifests, entries
+  // that end more than |DashConfig::time_shift_buffer_depth| before the
+  // newest chunk ends are removed, and the SegmentTemplate startNumber
+  // advances past them. Static manifests describe chunks with a nominal
+  // duration instead, and use the timelines only after |EndPresentation()|.
+  // Returns false when the chunk timing is invalid.
+  bool AddChunk(AdaptationSet::MediaType media_type, int64 start,
+                int64 duration);
+
+  // |AddChunk()| for the audio track at |track_index|. Index 0 is the track
+  // described by |DashConfig::audio_as|, and index N is
+  // |DashConfig::extra_audio_as[N - 1]|.
+  bool AddAudioChunk(int track_index, int64 start, int64 duration);
+
+  // Measures the bitrate of the Representation identified by |rep_id|, as
+  // returned by |VideoRepresentationId()|, |AudioRepresentationId()| or
+  // |AudioLadderRepresentationId()|, from a finished chunk of |bytes|
+  // lasting |duration| milliseconds. Once chunks were measured, the
+  // Representation's bandwidth attribute is the peak chunk bitrate of the
+  // last |WebmEncoderConfig::dash_bandwidth_window| chunks instead of the
+  // configured bitrate: keyframes and rate control overshoot make chunks
+  // larger than the configured bitrate says, and players choosing by it
+  // pick Representations they cannot sustain. The attribute follows the
+  // peak up at once, and down when it falls more than 10% below it. Returns
+  // true when the attribute changed and the manifest should be rewritten.
+  bool MeasureChunk(const std::string& rep_id, int64 bytes, int64 duration);
+
+  // Ends the presentation. Later calls to |WriteManifest()| write a static
+  // manifest of the chunks added: their SegmentTimelines, the Periods of a
+  // dynamic manifest, and a mediaPresentationDuration ending with the last
+  // chunk. Returns false when no chunk was added.
+  bool EndPresentation();
+
+  // Ends the current Period and starts another with the video settings of
+  // |webm_config|, for encodes whose video is reconfigured while running.
+  // The new Period starts where the video SegmentTimeline ends. Its video
+  // chunks are named after the Period, so clients fetch the new
+  // initialization segments, and are numbered from 1. Audio chunks keep
+  // their names and numbers. Earlier Periods stay in the manifest until they
+  // leave the time shift buffer. Returns false when the manifest is not
+  // dynamic.
+  bool StartPeriod(const WebmEncoderConfig& webm_config);
+
+  // Sets the number of the first chunk of |media_type|, for encoders that
+  // number chunks by their place in the stream rather than from
+  // |WebmEncoderConfig::dash_start_number|. Returns false, and changes
+  // nothing, once the SegmentTimeline of |media_type| has entries.
+  bool SetFirstNumber(AdaptationSet::MediaType media_type, int64 number);
+
+  // Makes a dynamic manifest available from |start|, in seconds since the
+  // epoch, instead of from the time of |Init()|, so that an encoder taking
+  // over a stream keeps its timing. Returns false when the manifest is not
+  // dynamic.
+  bool SetAvailabilityStartTime(int64 start);
+
+  // Returns the availability start of a dynamic manifest in seconds since
+  // the epoch, or 0.
+  int64 availability_start_time() const { return availability_start_; }
+
+  // Returns true when the manifest is dynamic. Stays true after
+  // |EndPresentation()|, although the manifest written is then static.
+  bool dynamic() const;
+
   // Returns a string suitable for identifying a chunk.
   std::string IdForChunk(AdaptationSet::MediaType media_type,
                          int64 chunk_num) const;
 
+  // Returns a string suitable for identifying a chunk from the video
+  // Representation at |rep_index|. Index 0 is the Representation described by
+  // |VideoAdaptationSet::rep_id|, and index N is
+  // |VideoAdaptationSet::extra_representations[N - 1]|.
+  std::string IdForVideoChunk(int rep_index, int64 chunk_num) const;
+
+  // Returns a string suitable for identifying a chunk from the audio track at
+  // |track_index|, numbered as by |AddAudioChunk()|.
+  std::string IdForAudioChunk(int track_index, int64 chunk_num) const;
+
+  // Returns a string suitable for identifying a chunk from the main audio
+  // track's Representation at |rep_index|. Index N is
+  // |AudioAdaptationSet::extra_representations[N - 1]| of
+  // |DashConfig::audio_as|; index 0 is that of |IdForAudioChunk(0, ...)|.
+  std::string IdForAudioRepresentationChunk(int rep_index,
+                                            int64 chunk_num) const;
+
+  // Returns the Representation id used for the video representation at
+  // |rep_index|, and for the audio track at |track_index|.
+  static std::string VideoRepresentationId(int rep_index);
+  static std::string AudioRepresentationId(int track_index);
+
+  // Returns the Representation id used for the main audio track's
+  // representation at |rep_index|.
+  static std::string AudioLadderRepresentationId(int rep_index);
+
+  // Parses an id returned by |IdForChunk|, |IdForVideoChunk| or
+  // |IdForAudioChunk|. Stores the
+  // media type of the chunk in |ptr_media_type|, and whether it is an
+  // initialization segment in |ptr_init|. Returns false when |id| is not a
+  // chunk id.
+  static bool ParseChunkId(const std::string& id,
+                           AdaptationSet::MediaType* ptr_media_type,
+                           bool* ptr_init);
+
  private:
-  void WriteAudioAdaptationSet(std::string* adaptation_set);
+  // SegmentTimeline of one AdaptationSet in a dynamic manifest. |xml| holds
+  // one S element per entry of |entry_lengths|, oldest first.
+  // |published_first_number| and |published_end_number| are the numbers of
+  // the first entry and past the last one in the version last written.
+  struct SegmentTimeline {
+    SegmentTimeline()
+        : first_number(1), end_time(0), published_first_number(1),
+          published_end_number(1) {}
+    std::string xml;
+    std::deque<size_t> entry_lengths;
+    std::deque<int64> entry_end_times;
+    std::string indent;
+    int64 first_number;
+    int64 end_time;
+    int64 published_first_number;
+    int64 published_end_number;
+  };
+
+  // Parts of a dynamic manifest. Each fixed string in |fragments_| is
+  // followed by the variable value identified by the matching entry of
+  // |fragment_values_|. The extra audio values belong to the track at
+  // |FragmentRef::track|.
+  enum FragmentValue {
+    kPublishTime,
+    kAudioStartNumber,
+    kAudioTimeline,
+    kVideoStartNumber,
+    kVideoTimeline,
+    kPreviousPeriods,
+    kExtraAudioStartNumber,
+    kExtraAudioTimeline,
+    kNoValue,
+  };
+  struct FragmentRef {
+    FragmentRef(FragmentValue ref_value, int ref_track)
+        : value(ref_value), track(ref_track) {}
+    FragmentValue value;
+    int track;
+  };
+
+  // Starts a new version of a dynamic manifest when it changed since the
+  // last one written, and formats its patch. Builds the fragments when
+  // needed. Returns false when they cannot be built.
+  bool Publish();
+
+  // Formats in |patch_| the MPD Patch from the version published at
+  // |original_publish_time| to the current one.
+  void BuildPatch(const std::string& original_publish_time);
+
+  // Appends to |patch| the operations updating the SegmentTimeline
+  // |timeline| of the AdaptationSet with id |as_id| to the current version.
+  void AppendTimelinePatch(const SegmentTimeline& timeline, int as_id,
+                           std::string* patch) const;
+
+  // Returns the id of the AdaptationSet of the audio track at
+  // |track_index|, and of the video AdaptationSet.
+  int AudioAdaptationSetId(int track_index) const;
+  int VideoAdaptationSetId() const;
+
+  // Stores the video AdaptationSet settings of |webm_config| in |config_|.
+  void InitVideoAdaptationSet(const WebmEncoderConfig& webm_config);
+
+  // Writes the manifest. In dynamic mode, the variable values are replaced by
+  // markers that |BuildFragments()| uses to split the manifest.
+  void WriteManifestTemplate(std::string* manifest);
+  bool BuildFragments();
+
+  // Writes the current Period element, with markers in dynamic mode.
+  void WritePeriod(std::string* period);
+
+  // Splits |manifest_template| at its markers into |fragments| and |values|.
+  // Returns false when a marker is malformed.
+  static bool SplitTemplate(const std::string& manifest_template,
+                            std::vector<std::string>* fragments,
+                            std::vector<FragmentRef>* values);
+
+  // Appends |fragments| to |out|, each followed by its value from |values|.
+  // |publish_time| may be NULL when |values| holds no |kPublishTime|.
+  void AppendFragments(const std::vector<std::string>& fragments,
+                       const std::vector<FragmentRef>& values,
+                       const char* publish_time, std::string* out) const;
+
+  // Writes the AdaptationSet of |audio_as|, the audio track at
+  // |track_index|.
+  void WriteAudioAdaptationSet(const AudioAdaptationSet& audio_as,
+                               int track_index, std::string* adaptation_set);
   void WriteVideoAdaptationSet(std::string* adaptation_set);
 
+  // Writes the ContentProtection element of an AdaptationSet to
+  // |ptr_stream|, or nothing when |DashConfig::default_kid| is empty.
+  void WriteContentProtection(std::ostringstream* ptr_stream);
+
+  // Writes the SegmentTemplate element for |as|, and its SegmentTimeline
+  // when the manifest is dynamic. |track_index| selects the audio track.
+  void WriteSegmentTemplate(const AdaptationSet& as, int track_index,
+                            std::string* segment_template);
+
+  // Appends a chunk to |ptr_timeline|. See |AddChunk()|.
+  bool AddTimelineChunk(SegmentTimeline* ptr_timeline, int64 start,
+                        int64 duration);
+
+  // Returns the bandwidth attribute of the Representation identified by
+  // |rep_id| in the current Period, or NULL when there is none.
+  int* RepresentationBandwidth(const std::string& rep_id);
+
+  // Returns the timeline of |media_type|, and of the audio track at
+  // |track_index|.
+  SegmentTimeline* timeline(AdaptationSet::MediaType media_type);
+  SegmentTimeline* audio_timeline(int track_index);
+
+  // Returns every timeline, and the time the last chunk of any ends.
+  std::vector<SegmentTimeline*> all_timelines();
+  int64 presentation_end() const;
+
+  // Returns true when SegmentTemplates describe chunks with SegmentTimelines:
+  // in dynamic manifests, and once the presentation has ended.
+  bool timelines() const { return dynamic() || ended_; }
+
   void IncreaseIndent();
   void DecreaseIndent();
   void ResetIndent();
 
   bool initialized_;
+
+  // Set by |EndPresentation()|.
+  bool ended_;
   DashConfig config_;
+
+  // |config_.availability_start_time| in seconds since the epoch.
+  int64 availability_start_;
   std::string indent_;
   std::string name_;
+  SegmentTimeline audio_timeline_;
+  SegmentTimeline video_timeline_;
+  std::vector<SegmentTimeline> extra_audio_timelines_;
+  std::vector<std::string> fragments_;
+  std::vector<FragmentRef> fragment_values_;
+
+  // Measured bitrates by Representation id; see |MeasureChunk()|. Disabled
+  // when |bandwidth_window_| is 0.
+  int bandwidth_window_;
+  std::map<std::string, BandwidthMeter> bandwidth_meters_;
+
+  // Periods of a dynamic manifest. |period_index_| is the id of the current
+  // Period, and |period_start_| its start in milliseconds. Earlier Periods
+  // are kept fully written in |previous_periods_|, oldest first, with their
+  // ends in |previous_period_ends_|. Video chunks of Periods after the first
+  // are named |video_name_| rather than |name_|.
+  int period_index_;
+  int64 period_start_;
+  std::string video_name_;
+  std::deque<std::string> previous_periods_;
+  std::deque<int64> previous_period_ends_;
+
+  // Versions of a dynamic manifest. |publish_time_| is the publishTime of
+  // the current version in milliseconds since the epoch, 0 before the
+  // first, and |publish_time_text_| its xs:dateTime. |changed_| is set when
+  // the manifest changed since, and |fixed_changed_| when its fragments
+  // did. |patch_| holds the patch to the current version, or nothing.
+  int64 publish_time_;
+  std::string publish_time_text_;
+  bool changed_;
+  bool fixed_changed_;
+  std::string patch_;
 };
 
 }  // namespace webmlive
@@ -8,9 +8,13 @@
 #ifndef WEBMLIVE_ENCODER_DATA_SINK_H_
 #define WEBMLIVE_ENCODER_DATA_SINK_H_
 
+#include <chrono>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "encoder/basictypes.h"
+#include "encoder/buffer_util.h"
 
 namespace webmlive {
 
@@ -22,9 +26,64 @@ class DataSinkInterface {
   // receive data via a call to |WriteData()|.
   virtual bool Ready() const = 0;
 
+  // Waits up to |timeout_ms| milliseconds for |Ready()| to return true, and
+  // returns the last value of |Ready()|. The default implementation polls;
+  // sinks able to signal readiness should override it so that callers do not
+  // have to spin.
+  virtual bool WaitUntilReady(int32 timeout_ms) const {
+    const std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(timeout_ms);
+    bool ready = Ready();
+    while (!ready && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      ready = Ready();
+    }
+    return ready;
+  }
+
   // Writes data to the sink and returns true when successful.
   virtual bool WriteData(const uint8* ptr_data, int32 data_length,
                          const std::string& id) = 0;
+
+  // Writes |chunk| to the sink and returns true when successful. The sink
+  // shares ownership of |chunk|, and may keep it for as long as it needs the
+  // data. The default implementation passes single span chunks directly to
+  // |WriteData()|, and gathers the spans of other chunks into one buffer;
+  // sinks able to consume spans should override it to avoid the copy.
+  virtual bool WriteChunk(const SharedDataChunk& chunk,
+                          const std::string& id) {
+    if (!chunk || chunk->spans().empty()) {
+      return false;
+    }
+    if (chunk->spans().size() == 1) {
+      const DataChunk::Span& span = chunk->spans()[0];
+      return WriteData(span.ptr_data, span.length, id);
+    }
+    std::vector<uint8> data(static_cast<size_t>(chunk->length()));
+    if (chunk->CopyTo(chunk->length(), &data[0])) {
+      return false;
+    }
+    return WriteData(&data[0], static_cast<int32>(data.size()), id);
+  }
+
+  // Starts sending |chunk| while its writer is still appending to it, and
+  // returns true when the sink accepted the chunk. The sink shares ownership
+  // of |chunk|. Sinks unable to send incomplete chunks return false, which is
+  // the default.
+  virtual bool WriteStreamingChunk(const SharedStreamingChunk& /*chunk*/,
+                                   const std::string& /*id*/) {
+    return false;
+  }
+
+  // Waits up to |timeout_ms| milliseconds for the writes the sink accepted
+  // to be delivered, and returns the number still undelivered. Called before
+  // stopping the sink so that a stop takes bounded time and can report what
+  // it abandons. The default returns 0, for sinks that deliver data before
+  // their write methods return.
+  virtual int Drain(int32 /*timeout_ms*/) {
+    return 0;
+  }
 };
 
 }  // namespace webmlive
@@ -0,0 +1,173 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/deinterlacer.h"
+
+#include <cstring>
+
+#include "encoder/field_interpolate.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+const int64 kMicrosecondsPerSecond = 1000000;
+
+// Writes the |height| rows of the |width| x |height| plane at |ptr_cur| to
+// |ptr_dst|, copying the rows of field |kept_field| and interpolating the
+// others. |ptr_prev| is the same plane of the previous frame, or NULL. All
+// planes have |stride| bytes per row. Planes one row tall are copied.
+void DeinterlacePlane(const uint8* ptr_cur, const uint8* ptr_prev,
+                      int32 stride, int32 width, int32 height,
+                      int kept_field, bool average, uint8* ptr_dst) {
+  for (int32 y = 0; y < height; ++y) {
+    uint8* const ptr_dst_row = ptr_dst + y * stride;
+    if ((y & 1) == kept_field || height < 2) {
+      memcpy(ptr_dst_row, ptr_cur + y * stride, width);
+      continue;
+    }
+    const int32 above = y > 0 ? y - 1 : y + 1;
+    const int32 below = y + 1 < height ? y + 1 : y - 1;
+    FieldRows rows;
+    rows.above = ptr_cur + above * stride;
+    rows.below = ptr_cur + below * stride;
+    rows.cur = ptr_cur + y * stride;
+    if (ptr_prev) {
+      rows.prev = ptr_prev + y * stride;
+      rows.prev_above = ptr_prev + above * stride;
+      rows.prev_below = ptr_prev + below * stride;
+    }
+    InterpolateFieldRow(rows, average, ptr_dst_row, width);
+  }
+}
+
+bool SameLayout(const VideoFrame& a, const VideoFrame& b) {
+  return a.format() == b.format() && a.width() == b.width() &&
+         a.height() == b.height() && a.stride() == b.stride() &&
+         a.buffer_length() == b.buffer_length();
+}
+}  // namespace
+
+Deinterlacer::Deinterlacer()
+    : mode_(DeinterlaceConfig::kOff),
+      top_field_first_(true),
+      frame_rate_(0),
+      have_prev_(false) {
+}
+
+int Deinterlacer::Init(const DeinterlaceConfig& config, double frame_rate) {
+  if (config.mode != DeinterlaceConfig::kOff &&
+      config.mode != DeinterlaceConfig::kFrameRate &&
+      config.mode != DeinterlaceConfig::kFieldRate) {
+    LOG(ERROR) << "Deinterlacer invalid mode " << config.mode;
+    return kInvalidArg;
+  }
+  mode_ = config.mode;
+  top_field_first_ = config.top_field_first;
+  frame_rate_ = frame_rate;
+  have_prev_ = false;
+  return kSuccess;
+}
+
+int Deinterlacer::Deinterlace(VideoFrame* ptr_frame,
+                              VideoFrame* ptr_field_frame) {
+  if (!ptr_frame || !ptr_frame->buffer() ||
+      (field_rate() && !ptr_field_frame)) {
+    return kInvalidArg;
+  }
+  if (!enabled()) {
+    return kSuccess;
+  }
+  if ((ptr_frame->format() != kVideoFormatI420 &&
+       ptr_frame->format() != kVideoFormatYV12) || ptr_frame->height() < 2) {
+    LOG_FIRST_N(WARNING, 1) << "Deinterlacer passing through format "
+                            << ptr_frame->format() << " frames.";
+    return kSuccess;
+  }
+
+  // Keep the captured frame, and write the output to the buffer given back
+  // in exchange.
+  if (!input_.buffer() && input_.Allocate(ptr_frame->buffer_capacity())) {
+    return kNoMemory;
+  }
+  input_.Swap(ptr_frame);
+  if (have_prev_ && !SameLayout(input_, prev_)) {
+    LOG(INFO) << "Deinterlacer frame size changed to " << input_.width()
+              << "x" << input_.height() << ".";
+    have_prev_ = false;
+  }
+
+  const int first_field = top_field_first_ ? 0 : 1;
+  int status = DeinterlaceField(input_, first_field, true, ptr_frame);
+  if (status) {
+    return status;
+  }
+  const int64 timestamp_us = input_.timestamp_us();
+  if (field_rate()) {
+    status = DeinterlaceField(input_, 1 - first_field, false,
+                              ptr_field_frame);
+    if (status) {
+      return status;
+    }
+    int64 duration_us = input_.duration_us();
+    if (duration_us <= 0 && frame_rate_ > 0) {
+      duration_us = static_cast<int64>(kMicrosecondsPerSecond / frame_rate_);
+    }
+    const int64 first_duration_us = duration_us / 2;
+    ptr_frame->SetTimeUs(timestamp_us, first_duration_us);
+    ptr_field_frame->SetTimeUs(timestamp_us + first_duration_us,
+                               duration_us - first_duration_us);
+  } else {
+    ptr_frame->SetTimeUs(timestamp_us, input_.duration_us());
+  }
+
+  // The captured frame becomes the previous one, and the previous one's
+  // buffer receives the next captured frame.
+  if (!prev_.buffer() && prev_.Allocate(input_.buffer_capacity())) {
+    have_prev_ = false;
+    return kNoMemory;
+  }
+  prev_.Swap(&input_);
+  have_prev_ = true;
+  return kSuccess;
+}
+
+int Deinterlacer::DeinterlaceField(const VideoFrame& frame, int kept_field,
+                                   bool average, VideoFrame* ptr_out) const {
+  int status = ptr_out->Allocate(frame.buffer_length());
+  if (status) {
+    LOG(ERROR) << "Deinterlacer cannot allocate a frame: " << status;
+    return status == VideoFrame::kNoMemory ? kNoMemory : kInvalidArg;
+  }
+  const int32 width = frame.width();
+  const int32 height = frame.height();
+  const int32 y_stride = frame.stride();
+  const int32 uv_stride = y_stride / 2;
+  const int32 uv_width = (width + 1) / 2;
+  const int32 uv_height = (height + 1) / 2;
+  const uint8* const ptr_prev = have_prev_ ? prev_.buffer() : NULL;
+  const int32 plane_offsets[] = {
+    0,
+    y_stride * height,
+    y_stride * height + uv_stride * uv_height,
+  };
+  for (int plane = 0; plane < 3; ++plane) {
+    const int32 offset = plane_offsets[plane];
+    const bool luma = plane == 0;
+    DeinterlacePlane(frame.buffer() + offset,
+                     ptr_prev ? ptr_prev + offset : NULL,
+                     luma ? y_stride : uv_stride, luma ? width : uv_width,
+                     luma ? height : uv_height, kept_field, average,
+                     ptr_out->buffer() + offset);
+  }
+  status = ptr_out->InitInPlace(frame.config(), frame.keyframe(),
+                                frame.timestamp(), frame.duration(),
+                                frame.buffer_length());
+  return status ? kInvalidArg : kSuccess;
+}
+
+}  // namespace webmlive
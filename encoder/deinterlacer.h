@@ -0,0 +1,115 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_DEINTERLACER_H_
+#define WEBMLIVE_ENCODER_DEINTERLACER_H_
+
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+struct DeinterlaceConfig {
+  enum Mode {
+    // Frames pass unchanged.
+    kOff = 0,
+    // One progressive frame per interlaced frame, at the time of its first
+    // field.
+    kFrameRate = 1,
+    // One progressive frame per field: twice the capture frame rate.
+    kFieldRate = 2,
+  };
+
+  DeinterlaceConfig() : mode(kOff), top_field_first(true) {}
+
+  Mode mode;
+
+  // Field order of the source: true when the field of the even rows is
+  // captured first, as in most 1080i formats.
+  bool top_field_first;
+};
+
+// Deinterlaces the raw frames of interlaced capture, 1080i from SDI and HDMI
+// capture cards for example, so that the encoders receive progressive frames
+// without combing.
+//
+// Each output frame keeps one field of a captured frame and interpolates the
+// rows of the other with |InterpolateFieldRow()|, from the field kept and
+// from the other field in the captured frame and in the one before it. No
+// frame after the captured one is needed, so the deinterlacer adds no
+// latency in either mode: in |DeinterlaceConfig::kFieldRate| mode, the
+// second field of a frame is interpolated from its first field instead of
+// the first field of the next frame.
+//
+// The captured frame is kept for the next one by exchanging buffers with
+// |VideoFrame::Swap()|, and the output is written straight into the buffer
+// handed back to the caller, normally the one committed to the raw frame
+// pool next, so frames are not copied besides the deinterlacing pass itself.
+//
+// Notes
+// - Only 8 bit I420 and YV12 frames are deinterlaced; others pass unchanged.
+// - Chroma rows are taken to alternate fields as luma rows do, as they do
+//   for interlaced 4:2:0 sources converted row by row.
+// - Frames scaled vertically during conversion no longer have separate
+//   fields; leave scaling to the encoders when deinterlacing.
+// - The first frame after |Init()| or a change of frame size is
+//   interpolated from its kept field alone.
+// - Not thread safe.
+class Deinterlacer {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  Deinterlacer();
+  ~Deinterlacer() {}
+
+  // Stores |config|. Frames without a duration are taken to last
+  // 1 / |frame_rate| seconds, the capture frame rate, when split into
+  // fields. Returns |kSuccess| when successful, and |kInvalidArg| when
+  // |config.mode| is not a |DeinterlaceConfig::Mode| value.
+  int Init(const DeinterlaceConfig& config, double frame_rate);
+
+  // Returns true when |Init()| enabled deinterlacing.
+  bool enabled() const { return mode_ != DeinterlaceConfig::kOff; }
+
+  // Returns true when each captured frame yields two output frames.
+  bool field_rate() const { return mode_ == DeinterlaceConfig::kFieldRate; }
+
+  // Replaces the captured frame in |ptr_frame| with its first field
+  // deinterlaced. In field rate mode, also stores its second field
+  // deinterlaced in |ptr_field_frame|, and splits the capture time and
+  // duration between both; |ptr_field_frame| is ignored otherwise. Returns
+  // |kSuccess| when successful, |kInvalidArg| when |ptr_frame| has no
+  // buffer or |ptr_field_frame| is NULL in field rate mode, and |kNoMemory|
+  // when a buffer cannot be allocated.
+  int Deinterlace(VideoFrame* ptr_frame, VideoFrame* ptr_field_frame);
+
+ private:
+  // Writes |frame| to |ptr_out| with the rows of field |kept_field|, 0 for
+  // the even rows, copied and the others interpolated. |average| is passed
+  // to |InterpolateFieldRow()|. Uses |prev_| when |have_prev_| is set.
+  // Returns |kSuccess| when successful.
+  int DeinterlaceField(const VideoFrame& frame, int kept_field, bool average,
+                       VideoFrame* ptr_out) const;
+
+  DeinterlaceConfig::Mode mode_;
+  bool top_field_first_;
+  double frame_rate_;
+
+  // The captured frame being deinterlaced, and the one before it.
+  VideoFrame input_;
+  VideoFrame prev_;
+  bool have_prev_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(Deinterlacer);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_DEINTERLACER_H_
@@ -0,0 +1,413 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/dvr_tier_store.h"
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <new>
+#include <vector>
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/metrics.h"
+#include "encoder/socket_util.h"
+#include "encoder/thread_placement.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Interval at which blocked writes check for |Stop()|, and time the
+// migration thread waits for a batch of files or uploads to complete.
+const int kPollMs = 100;
+const int kDrainTimeoutMs = 30000;
+
+// Segments moved to a lower tier at a time.
+const size_t kMaxBatchSegments = 8;
+}  // namespace
+
+DvrTierStore::DvrTierStore()
+    : disk_bytes_(0),
+      stop_(true),
+      ptr_disk_bytes_(NULL),
+      ptr_disk_segments_(NULL),
+      ptr_object_segments_(NULL),
+      ptr_dropped_(NULL) {
+}
+
+DvrTierStore::~DvrTierStore() {
+  Stop();
+}
+
+int DvrTierStore::Init(const DvrTierSettings& settings) {
+  if (settings.disk_directory.empty() || settings.disk_max_bytes < 1 ||
+      settings.max_pending_segments < 1 || settings.max_object_segments < 1) {
+    LOG(ERROR) << "invalid DVR tier settings, directory="
+               << settings.disk_directory
+               << " disk_max_bytes=" << settings.disk_max_bytes
+               << " max_pending=" << settings.max_pending_segments
+               << " max_objects=" << settings.max_object_segments;
+    return kInvalidArg;
+  }
+  const bool object_tier = !settings.object_settings.url_template.empty();
+  if (object_tier && settings.object_settings.post_mode != HTTP_PUT) {
+    LOG(ERROR) << "the DVR object tier requires HTTP_PUT uploads.";
+    return kInvalidArg;
+  }
+  settings_ = settings;
+  if (settings_.object_read_url_template.empty()) {
+    settings_.object_read_url_template = settings_.object_settings.url_template;
+  }
+
+  FileDataSinkSettings file_settings;
+  file_settings.directory = settings_.disk_directory;
+  file_settings.max_pending_writes = static_cast<int>(kMaxBatchSegments);
+  int status = file_sink_.Init(file_settings);
+  if (status) {
+    LOG(ERROR) << "DVR disk tier Init failed, status=" << status;
+    return status;
+  }
+  if (object_tier) {
+    uploader_.reset(new (std::nothrow) HttpUploader());  // NOLINT
+    if (!uploader_) {
+      return kNoMemory;
+    }
+    status = uploader_->Init(settings_.object_settings);
+    if (status) {
+      LOG(ERROR) << "DVR object tier Init failed, status=" << status;
+      uploader_.reset();
+      return status;
+    }
+  }
+
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  ptr_disk_bytes_ = registry.GetGauge(
+      "webmlive_dvr_disk_bytes", settings_.metrics_labels,
+      "Bytes of segments held by the DVR disk tier.");
+  ptr_disk_segments_ = registry.GetGauge(
+      "webmlive_dvr_disk_segments", settings_.metrics_labels,
+      "Segments held by the DVR disk tier.");
+  ptr_object_segments_ = registry.GetGauge(
+      "webmlive_dvr_object_segments", settings_.metrics_labels,
+      "Segments moved to the DVR object tier and still remembered.");
+  ptr_dropped_ = registry.GetCounter(
+      "webmlive_dvr_dropped_total", settings_.metrics_labels,
+      "Segments evicted from memory and dropped while the disk was behind.");
+  if (!ptr_disk_bytes_ || !ptr_disk_segments_ || !ptr_object_segments_ ||
+      !ptr_dropped_) {
+    LOG(ERROR) << "cannot create DVR tier metrics.";
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+int DvrTierStore::Run() {
+  if (migration_thread_) {
+    return kInvalidArg;
+  }
+  if (file_sink_.Run()) {
+    LOG(ERROR) << "cannot start DVR disk tier writer.";
+    return kThreadError;
+  }
+  if (uploader_ && uploader_->Run()) {
+    LOG(ERROR) << "cannot start DVR object tier uploader.";
+    file_sink_.Stop();
+    return kThreadError;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = false;
+  }
+  migration_thread_.reset(new (std::nothrow) std::thread(  // NOLINT
+      std::bind(&DvrTierStore::MigrationThread, this)));
+  if (!migration_thread_) {
+    LOG(ERROR) << "cannot start DVR migration thread.";
+    Stop();
+    return kThreadError;
+  }
+  return kSuccess;
+}
+
+void DvrTierStore::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_ && !migration_thread_) {
+      return;
+    }
+    stop_ = true;
+  }
+  segment_queued_.notify_all();
+  if (migration_thread_) {
+    migration_thread_->join();
+    migration_thread_.reset();
+  }
+  file_sink_.Stop();
+  if (uploader_) {
+    uploader_->Stop();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (std::deque<DiskSegment>::const_iterator it = disk_segments_.begin();
+       it != disk_segments_.end(); ++it) {
+    RemoveFile(it->id);
+  }
+  pending_.clear();
+  writing_.clear();
+  disk_segments_.clear();
+  disk_ids_.clear();
+  disk_bytes_ = 0;
+  object_order_.clear();
+  object_ids_.clear();
+}
+
+DvrTierStore::Tier DvrTierStore::Find(const std::string& id,
+                                      SharedDataChunk* ptr_chunk,
+                                      std::string* ptr_url) const {
+  if (!ptr_chunk || !ptr_url) {
+    return kNotFound;
+  }
+
+  // A segment read from disk may move to the object tier before its file is
+  // opened; look it up again once when the read fails.
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (std::deque<PendingSegment>::const_iterator it = pending_.begin();
+           it != pending_.end(); ++it) {
+        if (it->id == id) {
+          *ptr_chunk = it->chunk;
+          return kMemory;
+        }
+      }
+      std::map<std::string, SharedDataChunk>::const_iterator writing =
+          writing_.find(id);
+      if (writing != writing_.end()) {
+        *ptr_chunk = writing->second;
+        return kMemory;
+      }
+      if (object_ids_.count(id)) {
+        std::string url = settings_.object_read_url_template;
+        ReplaceAll("{stream_name}", settings_.object_settings.stream_name,
+                   &url);
+        ReplaceAll("{stream_id}", settings_.object_settings.stream_id, &url);
+        ReplaceAll("{id}", id, &url);
+        *ptr_url = url;
+        return kObjectStore;
+      }
+      if (!disk_ids_.count(id)) {
+        return kNotFound;
+      }
+    }
+    *ptr_chunk = ReadFile(id);
+    if (*ptr_chunk) {
+      return kDisk;
+    }
+  }
+  return kNotFound;
+}
+
+int64 DvrTierStore::disk_bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return disk_bytes_;
+}
+
+bool DvrTierStore::WriteData(const uint8* ptr_data, int32 data_length,
+                             const std::string& id) {
+  std::shared_ptr<DataChunk> chunk(new (std::nothrow) DataChunk());  // NOLINT
+  if (!chunk || chunk->Init(ptr_data, data_length)) {
+    LOG(ERROR) << "DvrTierStore cannot copy data for " << id;
+    return false;
+  }
+  return WriteChunk(chunk, id);
+}
+
+bool DvrTierStore::WriteChunk(const SharedDataChunk& chunk,
+                              const std::string& id) {
+  if (!chunk || id.empty()) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_) {
+      return false;
+    }
+    if (pending_.size() >=
+        static_cast<size_t>(settings_.max_pending_segments)) {
+      LOG(WARNING) << "DVR disk tier behind, dropping " << pending_.front().id;
+      pending_.pop_front();
+      ptr_dropped_->Increment(1);
+    }
+    PendingSegment segment;
+    segment.id = id;
+    segment.chunk = chunk;
+    pending_.push_back(segment);
+  }
+  segment_queued_.notify_one();
+  return true;
+}
+
+void DvrTierStore::MigrationThread() {
+  LOG(INFO) << "DVR migration thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kUpload);
+  ScopedCpuStage cpu_stage(kCpuUpload);
+  for (;;) {
+    std::deque<PendingSegment> batch;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      segment_queued_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+      if (stop_) {
+        break;
+      }
+      while (!pending_.empty() && batch.size() < kMaxBatchSegments) {
+        const PendingSegment& segment = pending_.front();
+        writing_[segment.id] = segment.chunk;
+        batch.push_back(segment);
+        pending_.pop_front();
+      }
+    }
+    MigrateToDisk(batch);
+    TrimDisk();
+  }
+  LOG(INFO) << "DVR migration thread finished.";
+}
+
+void DvrTierStore::MigrateToDisk(const std::deque<PendingSegment>& segments) {
+  std::vector<bool> queued(segments.size(), false);
+  for (size_t i = 0; i < segments.size(); ++i) {
+    while (!file_sink_.WaitUntilReady(kPollMs)) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stop_) {
+        break;
+      }
+    }
+    queued[i] = file_sink_.WriteChunk(segments[i].chunk, segments[i].id);
+  }
+  if (file_sink_.Drain(kDrainTimeoutMs)) {
+    LOG(WARNING) << "DVR disk tier writes still pending after "
+                 << kDrainTimeoutMs << " ms.";
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < segments.size(); ++i) {
+    writing_.erase(segments[i].id);
+    if (!queued[i]) {
+      ptr_dropped_->Increment(1);
+      continue;
+    }
+    DiskSegment segment;
+    segment.id = segments[i].id;
+    segment.bytes = segments[i].chunk->length();
+    disk_segments_.push_back(segment);
+    disk_ids_.insert(segment.id);
+    disk_bytes_ += segment.bytes;
+  }
+  ptr_disk_bytes_->Set(disk_bytes_);
+  ptr_disk_segments_->Set(static_cast<int64>(disk_segments_.size()));
+}
+
+// Segments being uploaded stay in the disk tier until the upload completes;
+// a failed upload is retried, and spooled, by the uploader.
+void DvrTierStore::TrimDisk() {
+  for (;;) {
+    std::vector<DiskSegment> batch;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      int64 bytes = disk_bytes_;
+      for (size_t i = 0; i < disk_segments_.size() &&
+                         batch.size() < kMaxBatchSegments &&
+                         bytes > settings_.disk_max_bytes;
+           ++i) {
+        batch.push_back(disk_segments_[i]);
+        bytes -= disk_segments_[i].bytes;
+      }
+    }
+    if (batch.empty()) {
+      return;
+    }
+
+    std::vector<bool> uploaded(batch.size(), false);
+    if (uploader_) {
+      for (size_t i = 0; i < batch.size(); ++i) {
+        const SharedDataChunk chunk = ReadFile(batch[i].id);
+        if (!chunk) {
+          continue;
+        }
+        while (!uploader_->WaitUntilReady(kPollMs)) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if (stop_) {
+            return;
+          }
+        }
+        uploaded[i] = uploader_->WriteChunk(chunk, batch[i].id);
+      }
+      if (uploader_->Drain(kDrainTimeoutMs)) {
+        LOG(WARNING) << "DVR object tier uploads still pending after "
+                     << kDrainTimeoutMs << " ms.";
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < batch.size(); ++i) {
+      disk_segments_.pop_front();
+      disk_ids_.erase(batch[i].id);
+      disk_bytes_ -= batch[i].bytes;
+      RemoveFile(batch[i].id);
+      if (!uploaded[i]) {
+        continue;
+      }
+      object_order_.push_back(batch[i].id);
+      object_ids_.insert(batch[i].id);
+      if (object_order_.size() >
+          static_cast<size_t>(settings_.max_object_segments)) {
+        object_ids_.erase(object_order_.front());
+        object_order_.pop_front();
+      }
+    }
+    ptr_disk_bytes_->Set(disk_bytes_);
+    ptr_disk_segments_->Set(static_cast<int64>(disk_segments_.size()));
+    ptr_object_segments_->Set(static_cast<int64>(object_order_.size()));
+    if (stop_) {
+      return;
+    }
+  }
+}
+
+SharedDataChunk DvrTierStore::ReadFile(const std::string& id) const {
+  const std::string file_name = settings_.disk_directory + id;
+  FILE* const file = fopen(file_name.c_str(), "rb");
+  if (!file) {
+    return SharedDataChunk();
+  }
+  std::vector<uint8> data;
+  if (!fseek(file, 0, SEEK_END)) {
+    const long length = ftell(file);  // NOLINT
+    if (length > 0 && !fseek(file, 0, SEEK_SET)) {
+      data.resize(static_cast<size_t>(length));
+      if (fread(&data[0], 1, data.size(), file) != data.size()) {
+        data.clear();
+      }
+    }
+  }
+  fclose(file);
+  std::shared_ptr<DataChunk> chunk(new (std::nothrow) DataChunk());  // NOLINT
+  if (data.empty() || !chunk ||
+      chunk->Init(&data[0], static_cast<int32>(data.size()))) {
+    LOG(ERROR) << "DvrTierStore cannot read " << file_name;
+    return SharedDataChunk();
+  }
+  return chunk;
+}
+
+void DvrTierStore::RemoveFile(const std::string& id) const {
+  const std::string file_name = settings_.disk_directory + id;
+  if (remove(file_name.c_str())) {
+    LOG(WARNING) << "DvrTierStore cannot remove " << file_name;
+  }
+}
+
+}  // namespace webmlive
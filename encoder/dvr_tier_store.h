@@ -0,0 +1,195 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_DVR_TIER_STORE_H_
+#define WEBMLIVE_ENCODER_DVR_TIER_STORE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "encoder/basictypes.h"
+#include "encoder/data_sink.h"
+#include "encoder/file_data_sink.h"
+#include "encoder/http_uploader.h"
+
+namespace webmlive {
+
+class Metric;
+
+struct DvrTierSettings {
+  static const int64 kDefaultDiskMaxBytes = 4LL * 1024 * 1024 * 1024;
+  static const int kDefaultMaxPendingSegments = 64;
+  static const int kDefaultMaxObjectSegments = 500000;
+
+  DvrTierSettings()
+      : disk_max_bytes(kDefaultDiskMaxBytes),
+        max_pending_segments(kDefaultMaxPendingSegments),
+        max_object_segments(kDefaultMaxObjectSegments) {}
+
+  // Directory of the disk tier, ending with a path separator. Empty disables
+  // tiering: segments evicted from memory are dropped.
+  std::string disk_directory;
+
+  // Bytes of segments the disk tier may hold. The oldest segments move to
+  // the object tier, or are deleted without one, when it is exceeded.
+  int64 disk_max_bytes;
+
+  // Segments evicted from memory and waiting for the disk, each holding a
+  // reference to its chunk. The oldest is dropped when the disk falls this
+  // far behind, so a slow disk cannot grow memory without bound.
+  int max_pending_segments;
+
+  // Upload of the object tier. Enabled when |object_settings.url_template|
+  // is set, in which case |object_settings.post_mode| must be |HTTP_PUT|.
+  HttpUploaderSettings object_settings;
+
+  // URL players are redirected to for segments in the object tier, with
+  // "{id}" replaced by the segment id, for example a CDN in front of the
+  // bucket. Defaults to |object_settings.url_template|.
+  std::string object_read_url_template;
+
+  // Segment ids the object tier remembers; the oldest are forgotten past it.
+  // Expiring the objects themselves is left to the store, for example with a
+  // bucket lifecycle rule.
+  int max_object_segments;
+
+  // Labels added to the tier metrics; see |MetricsRegistry|.
+  std::string metrics_labels;
+};
+
+// Lower tiers of a DVR window too large for a |SegmentCache|: media segments
+// evicted from memory move to local disk, and the oldest ones on disk move to
+// an object store.
+//
+// Segments are written to the disk through a |FileDataSink| and to the store
+// through an |HttpUploader|, from a migration thread, so the writer evicting
+// them never waits on I/O. A segment stays readable from its current tier
+// until its copy in the next one is complete: from memory until its file is
+// written, and from disk until its upload completes.
+//
+// Notes
+// - Thread safe. |WriteChunk()| only queues the segment, and may be called
+//   with the |SegmentCache| lock held.
+// - Disk reads happen on the caller's thread; memory stays bounded by
+//   |DvrTierSettings::max_pending_segments| and the segment being read.
+// - The disk tier does not survive |Stop()|: its files are deleted.
+class DvrTierStore : public DataSinkInterface {
+ public:
+  enum {
+    // Cannot start the migration thread, the file sink or the uploader.
+    kThreadError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Tier holding a segment, from |Find()|.
+  enum Tier {
+    kNotFound = 0,
+    kMemory = 1,
+    kDisk = 2,
+    kObjectStore = 3,
+  };
+
+  DvrTierStore();
+  virtual ~DvrTierStore();
+
+  // Copies |settings|, and initializes the file sink and the uploader.
+  // Returns |kSuccess| when successful.
+  int Init(const DvrTierSettings& settings);
+
+  // Starts the file sink, the uploader and the migration thread.
+  int Run();
+
+  // Stops migrating, stops the file sink and the uploader, and deletes the
+  // files of the disk tier.
+  void Stop();
+
+  // Looks up segment |id| in the lower tiers. Returns |kMemory| or |kDisk|
+  // with |ptr_chunk| set, |kObjectStore| with |ptr_url| set to the URL the
+  // store serves it from, or |kNotFound|.
+  Tier Find(const std::string& id, SharedDataChunk* ptr_chunk,
+            std::string* ptr_url) const;
+
+  // Bytes held by the disk tier.
+  int64 disk_bytes() const;
+
+  // |DataSinkInterface| methods. |WriteChunk()| queues an evicted segment
+  // for the disk tier.
+  virtual bool Ready() const { return true; }
+  virtual bool WriteData(const uint8* ptr_data, int32 data_length,
+                         const std::string& id);
+  virtual bool WriteChunk(const SharedDataChunk& chunk,
+                          const std::string& id);
+
+ private:
+  struct PendingSegment {
+    std::string id;
+    SharedDataChunk chunk;
+  };
+
+  struct DiskSegment {
+    DiskSegment() : bytes(0) {}
+    std::string id;
+    int64 bytes;
+  };
+
+  // Writes the pending segments to disk, then moves segments to the object
+  // tier while the disk is over budget, until |Stop()|.
+  void MigrationThread();
+
+  // Writes |segments| through |file_sink_|, waits for the files, and adds
+  // them to the disk tier.
+  void MigrateToDisk(const std::deque<PendingSegment>& segments);
+
+  // Moves the oldest disk segments out until the disk tier fits its budget:
+  // uploads them when the object tier is enabled, then deletes their files.
+  void TrimDisk();
+
+  // Reads the file of disk segment |id|. Returns NULL when it cannot be read.
+  SharedDataChunk ReadFile(const std::string& id) const;
+
+  // Removes the file of disk segment |id|.
+  void RemoveFile(const std::string& id) const;
+
+  DvrTierSettings settings_;
+  FileDataSink file_sink_;
+  std::unique_ptr<HttpUploader> uploader_;
+  std::unique_ptr<std::thread> migration_thread_;
+
+  // Segments waiting for the disk, and those being written, by id; segments
+  // on disk, oldest first, and their total size; and the ids in the object
+  // tier, oldest first. Protected by |mutex_|; |segment_queued_| is notified
+  // by |WriteChunk()| and |Stop()|.
+  mutable std::mutex mutex_;
+  std::condition_variable segment_queued_;
+  std::deque<PendingSegment> pending_;
+  std::map<std::string, SharedDataChunk> writing_;
+  std::deque<DiskSegment> disk_segments_;
+  std::set<std::string> disk_ids_;
+  int64 disk_bytes_;
+  std::deque<std::string> object_order_;
+  std::set<std::string> object_ids_;
+  bool stop_;
+
+  // Metrics exported through |MetricsRegistry|. Set by |Init|.
+  Metric* ptr_disk_bytes_;
+  Metric* ptr_disk_segments_;
+  Metric* ptr_object_segments_;
+  Metric* ptr_dropped_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(DvrTierStore);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_DVR_TIER_STORE_H_
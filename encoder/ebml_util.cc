@@ -0,0 +1,122 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/ebml_util.h"
+
+#include <cstring>
+
+namespace webmlive {
+
+int32 VintLength(uint8 first_byte) {
+  for (int32 length = 1; length <= 8; ++length) {
+    if (first_byte & (0x80 >> (length - 1)))
+      return length;
+  }
+  return 0;
+}
+
+bool ReadVint(const uint8* ptr_data, const uint8* ptr_end, bool keep_marker,
+              int64* ptr_value, int32* ptr_length) {
+  if (ptr_data >= ptr_end)
+    return false;
+  const int32 length = VintLength(ptr_data[0]);
+  if (length == 0 || ptr_end - ptr_data < length)
+    return false;
+  uint64 value = keep_marker ?
+      ptr_data[0] : ptr_data[0] & (0xFF >> length);
+  bool all_ones = value == (0xFFu >> length);
+  for (int32 i = 1; i < length; ++i) {
+    value = (value << 8) | ptr_data[i];
+    all_ones = all_ones && ptr_data[i] == 0xFF;
+  }
+  *ptr_value = (!keep_marker && all_ones) ? -1 : static_cast<int64>(value);
+  *ptr_length = length;
+  return true;
+}
+
+bool ReadElementHeader(const uint8** ptr_pos, const uint8* ptr_end,
+                       uint32* ptr_id, int64* ptr_size) {
+  int64 id = 0;
+  int32 length = 0;
+  if (!ReadVint(*ptr_pos, ptr_end, true, &id, &length) || length > 4)
+    return false;
+  *ptr_pos += length;
+  if (!ReadVint(*ptr_pos, ptr_end, false, ptr_size, &length))
+    return false;
+  *ptr_pos += length;
+  *ptr_id = static_cast<uint32>(id);
+  return *ptr_size < 0 || *ptr_size <= ptr_end - *ptr_pos;
+}
+
+uint64 ReadUnsigned(const uint8* ptr_data, int64 length) {
+  uint64 value = 0;
+  for (int64 i = 0; i < length && i < 8; ++i)
+    value = (value << 8) | ptr_data[i];
+  return value;
+}
+
+double ReadFloat(const uint8* ptr_data, int64 length) {
+  const uint64 bits = ReadUnsigned(ptr_data, length);
+  if (length == 4) {
+    const uint32 bits32 = static_cast<uint32>(bits);
+    float value;
+    memcpy(&value, &bits32, sizeof(value));
+    return value;
+  } else if (length == 8) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+  return 0;
+}
+
+void AppendBigEndian(uint64 value, int32 length, std::vector<uint8>* ptr_out) {
+  for (int32 i = length - 1; i >= 0; --i)
+    ptr_out->push_back(static_cast<uint8>(value >> (i * 8)));
+}
+
+void AppendId(uint32 id, std::vector<uint8>* ptr_out) {
+  int32 length = 1;
+  if (id > 0xFFFFFF)
+    length = 4;
+  else if (id > 0xFFFF)
+    length = 3;
+  else if (id > 0xFF)
+    length = 2;
+  AppendBigEndian(id, length, ptr_out);
+}
+
+void AppendSize(uint64 size, int32 length, std::vector<uint8>* ptr_out) {
+  if (length == 0) {
+    length = 1;
+    // All value bits set means unknown, so a vint holds 2^(7n) - 2 at most.
+    while (length < 8 && size >= (1ULL << (7 * length)) - 1)
+      ++length;
+  }
+  AppendBigEndian(size | (1ULL << (7 * length)), length, ptr_out);
+}
+
+void AppendUInt(uint32 id, uint64 value, int32 length,
+                std::vector<uint8>* ptr_out) {
+  if (length == 0) {
+    length = 1;
+    while (length < 8 && (value >> (8 * length)) != 0)
+      ++length;
+  }
+  AppendId(id, ptr_out);
+  AppendSize(length, 0, ptr_out);
+  AppendBigEndian(value, length, ptr_out);
+}
+
+void AppendMaster(uint32 id, const std::vector<uint8>& payload,
+                  std::vector<uint8>* ptr_out) {
+  AppendId(id, ptr_out);
+  AppendSize(payload.size(), 0, ptr_out);
+  ptr_out->insert(ptr_out->end(), payload.begin(), payload.end());
+}
+
+}  // namespace webmlive
@@ -0,0 +1,110 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+//
+// EBML element IDs, readers and writers used to parse and build WebM data
+// without libwebm: remuxed input, and finalized on demand files.
+#ifndef WEBMLIVE_ENCODER_EBML_UTIL_H_
+#define WEBMLIVE_ENCODER_EBML_UTIL_H_
+
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// EBML element IDs, with their length markers.
+const uint32 kEbmlId = 0x1A45DFA3;
+const uint32 kSegmentId = 0x18538067;
+const uint32 kSeekHeadId = 0x114D9B74;
+const uint32 kSeekId = 0x4DBB;
+const uint32 kSeekIdId = 0x53AB;
+const uint32 kSeekPositionId = 0x53AC;
+const uint32 kInfoId = 0x1549A966;
+const uint32 kTimecodeScaleId = 0x2AD7B1;
+const uint32 kDurationId = 0x4489;
+const uint32 kTracksId = 0x1654AE6B;
+const uint32 kTrackEntryId = 0xAE;
+const uint32 kTrackNumberId = 0xD7;
+const uint32 kTrackTypeId = 0x83;
+const uint32 kCodecIdId = 0x86;
+const uint32 kCodecPrivateId = 0x63A2;
+const uint32 kCodecDelayId = 0x56AA;
+const uint32 kSeekPreRollId = 0x56BB;
+const uint32 kDefaultDurationId = 0x23E383;
+const uint32 kVideoElementId = 0xE0;
+const uint32 kPixelWidthId = 0xB0;
+const uint32 kPixelHeightId = 0xBA;
+const uint32 kAudioElementId = 0xE1;
+const uint32 kSamplingFrequencyId = 0xB5;
+const uint32 kChannelsId = 0x9F;
+const uint32 kClusterId = 0x1F43B675;
+const uint32 kTimecodeId = 0xE7;
+const uint32 kSimpleBlockId = 0xA3;
+const uint32 kBlockGroupId = 0xA0;
+const uint32 kBlockId = 0xA1;
+const uint32 kReferenceBlockId = 0xFB;
+const uint32 kCuesId = 0x1C53BB6B;
+const uint32 kCuePointId = 0xBB;
+const uint32 kCueTimeId = 0xB3;
+const uint32 kCueTrackPositionsId = 0xB7;
+const uint32 kCueTrackId = 0xF7;
+const uint32 kCueClusterPositionId = 0xF1;
+
+// TrackType values.
+const uint64 kTrackTypeVideo = 1;
+const uint64 kTrackTypeAudio = 2;
+
+// Returns the length of the EBML variable length integer that starts with
+// |first_byte|, or 0 when |first_byte| is invalid: all zero, which no vint of
+// at most 8 bytes begins with.
+int32 VintLength(uint8 first_byte);
+
+// Reads the EBML variable length integer at |ptr_data|, which must end before
+// |ptr_end|. Stores its value in |ptr_value| and its length in
+// |ptr_length|. The length marker is kept for element IDs and removed for
+// sizes and track numbers, where |ptr_value| is set to -1 when all value bits
+// are set: an unknown size. Returns false when the vint is malformed or
+// truncated.
+bool ReadVint(const uint8* ptr_data, const uint8* ptr_end, bool keep_marker,
+              int64* ptr_value, int32* ptr_length);
+
+// Reads the element header at |*ptr_pos|, and advances |*ptr_pos| past it.
+// |*ptr_size| is -1 for unknown sizes. Returns false when the header is
+// malformed, or when a known size element extends past |ptr_end|.
+bool ReadElementHeader(const uint8** ptr_pos, const uint8* ptr_end,
+                       uint32* ptr_id, int64* ptr_size);
+
+// Returns the big endian unsigned integer of |length| bytes at |ptr_data|.
+uint64 ReadUnsigned(const uint8* ptr_data, int64 length);
+
+// Returns the big endian float or double at |ptr_data|, or 0 when |length|
+// is neither 4 nor 8.
+double ReadFloat(const uint8* ptr_data, int64 length);
+
+// Appends the |length| low bytes of |value| to |ptr_out|, big endian.
+void AppendBigEndian(uint64 value, int32 length, std::vector<uint8>* ptr_out);
+
+// Appends element ID |id|, which includes its length marker.
+void AppendId(uint32 id, std::vector<uint8>* ptr_out);
+
+// Appends |size| as a vint of |length| bytes, or of the fewest bytes that
+// hold it when |length| is 0.
+void AppendSize(uint64 size, int32 length, std::vector<uint8>* ptr_out);
+
+// Appends an unsigned integer element of |length| bytes, or of the fewest
+// bytes that hold |value| when |length| is 0.
+void AppendUInt(uint32 id, uint64 value, int32 length,
+                std::vector<uint8>* ptr_out);
+
+// Appends a master element holding |payload|.
+void AppendMaster(uint32 id, const std::vector<uint8>& payload,
+                  std::vector<uint8>* ptr_out);
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_EBML_UTIL_H_
@@ -0,0 +1,293 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/encode_calibrator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+#include "encoder/resource_planner.h"
+#include "encoder/video_encoder.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Realtime speeds of each codec, slowest first.
+const int kVp8Speeds[] = {-4, -6, -8, -10, -12, -16};
+const int kVp9Speeds[] = {-5, -6, -7, -8, -9};
+const int kAv1Speeds[] = {-7, -8, -9, -10};
+
+// Widest VP9 and AV1 tile layout, as a log2 column count. The encoders narrow
+// it to what the frame width allows.
+const int kVp9MaxTileColumnsLog2 = 6;
+
+// Fixed seed of the clip's noise texture.
+const uint32 kNoiseSeed = 0x2545f491;
+}  // namespace
+
+int EncodeCalibrator::Calibrate(const WebmEncoderConfig& config,
+                                double headroom,
+                                EncodeCalibration* ptr_result) {
+  if (!ptr_result || headroom < 0 || headroom >= 1) {
+    LOG(ERROR) << "EncodeCalibrator invalid headroom " << headroom;
+    return kInvalidArg;
+  }
+  video_config_ = VideoConfig();
+  video_config_.width = config.output_video_width > 0 ?
+      config.output_video_width : config.requested_video_config.width;
+  video_config_.height = config.output_video_height > 0 ?
+      config.output_video_height : config.requested_video_config.height;
+  video_config_.frame_rate = config.requested_video_config.frame_rate > 0 ?
+      config.requested_video_config.frame_rate : kDefaultFrameRate;
+  if (!config.video_representations.empty()) {
+    const VideoRepresentationConfig& rep = config.video_representations[0];
+    if (rep.width > 0)
+      video_config_.width = rep.width;
+    if (rep.height > 0)
+      video_config_.height = rep.height;
+  }
+  if (video_config_.width <= 0 || video_config_.height <= 0) {
+    LOG(ERROR) << "EncodeCalibrator requires a configured video size.";
+    return kNoResolution;
+  }
+  video_config_.stride = video_config_.width;
+
+  const int32 frame_size =
+      VideoFrame::PlanarFrameSize(video_config_.width, video_config_.height);
+  const int32 luma_size = video_config_.width * video_config_.height;
+  noise_.resize(luma_size);
+  frame_data_.resize(frame_size);
+  uint32 state = kNoiseSeed;
+  for (int32 i = 0; i < luma_size; ++i) {
+    state = state * 1664525 + 1013904223;
+    noise_[i] = static_cast<uint8>(state >> 24);
+  }
+
+  std::vector<int> speeds;
+  if (config.vpx_config.codec == kVideoFormatVP9) {
+    speeds.assign(kVp9Speeds,
+                  kVp9Speeds + sizeof(kVp9Speeds) / sizeof(kVp9Speeds[0]));
+  } else if (config.vpx_config.codec == kVideoFormatAV1) {
+    speeds.assign(kAv1Speeds,
+                  kAv1Speeds + sizeof(kAv1Speeds) / sizeof(kAv1Speeds[0]));
+  } else {
+    speeds.assign(kVp8Speeds,
+                  kVp8Speeds + sizeof(kVp8Speeds) / sizeof(kVp8Speeds[0]));
+  }
+  const int num_encoders =
+      std::max(1, static_cast<int>(config.video_representations.size()));
+  const int num_cores = config.encode_cores > 0 ?
+      config.encode_cores : AvailableCpuThreads();
+  const int core_threads = std::max(1, num_cores / num_encoders);
+
+  const double budget_ms =
+      (1.0 - headroom) * 1000.0 / video_config_.frame_rate;
+  EncodeCalibration fastest;
+  for (size_t i = 0; i < speeds.size(); ++i) {
+    for (int threading = 0; threading < 2; ++threading) {
+      EncodeCalibration candidate;
+      candidate.speed = speeds[i];
+      if (threading) {
+        if (core_threads <= 1)
+          break;
+        candidate.thread_count = core_threads;
+        if (config.vpx_config.codec != kVideoFormatVP8)
+          candidate.tile_columns = kVp9MaxTileColumnsLog2;
+      }
+      const int status = Measure(config, &candidate);
+      if (status) {
+        return status;
+      }
+      LOG(INFO) << "EncodeCalibrator speed=" << candidate.speed
+                << " threads=" << candidate.thread_count
+                << " tile_columns=" << candidate.tile_columns << ": "
+                << candidate.ms_per_frame << " ms/frame, budget "
+                << budget_ms << " ms";
+      if (candidate.ms_per_frame <= budget_ms) {
+        *ptr_result = candidate;
+        return kSuccess;
+      }
+      if (fastest.ms_per_frame <= 0 ||
+          candidate.ms_per_frame < fastest.ms_per_frame) {
+        fastest = candidate;
+      }
+    }
+  }
+  LOG(WARNING) << "EncodeCalibrator: no candidate encodes "
+               << video_config_.width << "x" << video_config_.height << " @ "
+               << video_config_.frame_rate << " fps in real time; using the "
+               << "fastest.";
+  *ptr_result = fastest;
+  return kNotRealtime;
+}
+
+std::string EncodeCalibrator::CacheKey(const WebmEncoderConfig& config,
+                                       double headroom) {
+  int32 width = config.output_video_width > 0 ?
+      config.output_video_width : config.requested_video_config.width;
+  int32 height = config.output_video_height > 0 ?
+      config.output_video_height : config.requested_video_config.height;
+  if (!config.video_representations.empty()) {
+    const VideoRepresentationConfig& rep = config.video_representations[0];
+    width = rep.width > 0 ? rep.width : width;
+    height = rep.height > 0 ? rep.height : height;
+  }
+  const double frame_rate = config.requested_video_config.frame_rate > 0 ?
+      config.requested_video_config.frame_rate : kDefaultFrameRate;
+  const int num_cores = config.encode_cores > 0 ?
+      config.encode_cores : AvailableCpuThreads();
+  std::ostringstream key;
+  const VideoFormat codec = config.vpx_config.codec;
+  key << (codec == kVideoFormatVP9 ? "vp9" :
+          codec == kVideoFormatAV1 ? "av1" : "vp8") << "_"
+      << width << "x" << height << "@" << frame_rate
+      << "_reps" << std::max<size_t>(1, config.video_representations.size())
+      << "_cores" << num_cores << "_headroom" << headroom;
+  return key.str();
+}
+
+int EncodeCalibrator::ReadCache(const std::string& path,
+                                const std::string& key,
+                                EncodeCalibration* ptr_result) {
+  if (!ptr_result) {
+    return kInvalidArg;
+  }
+  std::ifstream file(path.c_str());
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    std::string line_key;
+    EncodeCalibration result;
+    if ((fields >> line_key >> result.speed >> result.thread_count >>
+         result.tile_columns >> result.ms_per_frame) && line_key == key) {
+      *ptr_result = result;
+      return kSuccess;
+    }
+  }
+  return kNotCached;
+}
+
+int EncodeCalibrator::WriteCache(const std::string& path,
+                                 const std::string& key,
+                                 const EncodeCalibration& result) {
+  // Keep the results of other configurations.
+  std::vector<std::string> lines;
+  {
+    std::ifstream file(path.c_str());
+    std::string line;
+    while (std::getline(file, line)) {
+      std::istringstream fields(line);
+      std::string line_key;
+      if ((fields >> line_key) && line_key != key)
+        lines.push_back(line);
+    }
+  }
+  std::ofstream file(path.c_str(), std::ios::trunc);
+  for (size_t i = 0; i < lines.size(); ++i) {
+    file << lines[i] << "\n";
+  }
+  file << key << " " << result.speed << " " << result.thread_count << " "
+       << result.tile_columns << " " << result.ms_per_frame << "\n";
+  file.close();
+  if (!file) {
+    LOG(ERROR) << "EncodeCalibrator cannot write " << path;
+    return kInvalidArg;
+  }
+  return kSuccess;
+}
+
+void EncodeCalibrator::Apply(const EncodeCalibration& result,
+                             VpxConfig* ptr_config) {
+  ptr_config->speed = result.speed;
+  ptr_config->thread_count = result.thread_count;
+  ptr_config->tile_columns = result.tile_columns;
+}
+
+int EncodeCalibrator::Measure(const WebmEncoderConfig& config,
+                              EncodeCalibration* ptr_candidate) {
+  WebmEncoderConfig enc_config = config;
+  enc_config.actual_video_config = video_config_;
+  if (!config.video_representations.empty() &&
+      config.video_representations[0].bitrate > 0) {
+    enc_config.vpx_config.bitrate = config.video_representations[0].bitrate;
+  }
+  Apply(*ptr_candidate, &enc_config.vpx_config);
+  enc_config.vpx_config.decimate = VpxConfig::kUseDefault;
+  enc_config.vpx_config.adaptive_speed = false;
+  enc_config.vpx_config.bit_depth = 8;
+  enc_config.vpx_config.backend = kVideoEncoderBackendLibvpx;
+  // Spatial SVC encodes are measured by their first layer alone.
+  enc_config.video_svc = false;
+
+  VideoEncoder encoder;
+  int status = encoder.Init(enc_config);
+  if (status) {
+    LOG(ERROR) << "EncodeCalibrator VideoEncoder Init failed: " << status;
+    return kEncodeError;
+  }
+
+  const int64 duration =
+      static_cast<int64>(1000.0 / video_config_.frame_rate);
+  VideoFrame raw_frame;
+  VideoFrame vpx_frame;
+  int64 encode_time_us = 0;
+  for (int i = 0; i < kCalibrationFrames; ++i) {
+    BuildFrame(i);
+    status = raw_frame.Init(video_config_, i == 0, i * duration, duration,
+                            &frame_data_[0],
+                            static_cast<int32>(frame_data_.size()));
+    if (status) {
+      LOG(ERROR) << "EncodeCalibrator VideoFrame Init failed: " << status;
+      return kNoMemory;
+    }
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    status = encoder.EncodeFrame(raw_frame, &vpx_frame);
+    if (i > 0) {
+      encode_time_us += std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start).count();
+    }
+    if (status != VideoEncoder::kSuccess && status != VideoEncoder::kDropped) {
+      LOG(ERROR) << "EncodeCalibrator EncodeFrame failed: " << status;
+      return kEncodeError;
+    }
+    while (encoder.ReadQueuedFrame(&vpx_frame) == VideoEncoder::kSuccess) {
+    }
+  }
+  ptr_candidate->ms_per_frame =
+      encode_time_us / 1000.0 / (kCalibrationFrames - 1);
+  return kSuccess;
+}
+
+void EncodeCalibrator::BuildFrame(int index) {
+  const int32 width = video_config_.width;
+  const int32 height = video_config_.height;
+  uint8* const ptr_y = &frame_data_[0];
+  for (int32 y = 0; y < height; ++y) {
+    const uint8* const ptr_noise = &noise_[y * width];
+    uint8* const ptr_row = ptr_y + y * width;
+    for (int32 x = 0; x < width; ++x) {
+      const int gradient = (x + y + index * 4) & 0xff;
+      ptr_row[x] = static_cast<uint8>((gradient * 3 + ptr_noise[x]) / 4);
+    }
+  }
+  const int32 uv_stride = width / 2;
+  const int32 uv_height = (height + 1) / 2;
+  uint8* const ptr_u = ptr_y + width * height;
+  uint8* const ptr_v = ptr_u + uv_stride * uv_height;
+  for (int32 y = 0; y < uv_height; ++y) {
+    for (int32 x = 0; x < uv_stride; ++x) {
+      ptr_u[y * uv_stride + x] = static_cast<uint8>((x + index) & 0xff);
+      ptr_v[y * uv_stride + x] = static_cast<uint8>((y + index) & 0xff);
+    }
+  }
+}
+
+}  // namespace webmlive
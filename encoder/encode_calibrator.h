@@ -0,0 +1,119 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_ENCODE_CALIBRATOR_H_
+#define WEBMLIVE_ENCODER_ENCODE_CALIBRATOR_H_
+
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/webm_encoder.h"
+
+namespace webmlive {
+
+// libvpx settings chosen by |EncodeCalibrator|, in |VpxConfig| units.
+// |thread_count| and |tile_columns| may be |VpxConfig::kUseDefault|.
+struct EncodeCalibration {
+  EncodeCalibration()
+      : speed(VpxConfig::kUseDefault),
+        thread_count(VpxConfig::kUseDefault),
+        tile_columns(VpxConfig::kUseDefault),
+        ms_per_frame(0) {}
+  int speed;
+  int thread_count;
+  int tile_columns;
+
+  // Average encode time measured for the settings.
+  double ms_per_frame;
+};
+
+// Picks the libvpx speed and threading settings for a machine by encoding a
+// synthetic clip with each candidate, in order of decreasing quality, until
+// one encodes in real time with room to spare.
+//
+// Notes
+// - The clip is |kCalibrationFrames| I420 frames at the output size and frame
+//   rate of the config: a gradient moving under a fixed noise texture, so
+//   that motion search and residual coding both cost something.
+// - Candidates are the realtime speeds of the codec, slowest first. Each is
+//   tried with the automatic threading of |VpxEncoder|, then with a thread
+//   per core and, for VP9, the widest tile layout. Speed decides quality;
+//   threading settings only decide whether the speed is fast enough.
+// - Only the first video representation is encoded, but the encoder shares
+//   the cores with the others as it would in the live encode.
+// - Results are cached in a text file, one line per configuration, so that
+//   later starts with the same configuration skip the probe.
+class EncodeCalibrator {
+ public:
+  enum {
+    // The config has no output size.
+    kNoResolution = -4,
+    // A candidate failed to encode.
+    kEncodeError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+    // Returned by |ReadCache()| when the cache has no result for the key.
+    kNotCached = 1,
+    // Returned by |Calibrate()| when no candidate encodes in real time.
+    kNotRealtime = 2,
+  };
+
+  // Frames encoded per candidate. The first frame, a keyframe, is not timed.
+  static const int kCalibrationFrames = 60;
+
+  // Frame rate assumed when the config has none.
+  static const int kDefaultFrameRate = 30;
+
+  EncodeCalibrator() {}
+  ~EncodeCalibrator() {}
+
+  // Probes the candidates for |config|. A candidate qualifies when it encodes
+  // a frame in at most |1 - headroom| of the frame duration. Stores the first
+  // that qualifies in |ptr_result| and returns |kSuccess|, or stores the
+  // fastest and returns |kNotRealtime| when none qualifies.
+  int Calibrate(const WebmEncoderConfig& config, double headroom,
+                EncodeCalibration* ptr_result);
+
+  // Returns the cache key of |config| and |headroom|: the codec, output size,
+  // frame rate, representation count, cores and headroom.
+  static std::string CacheKey(const WebmEncoderConfig& config,
+                              double headroom);
+
+  // Reads the result stored for |key| from the cache file |path|. Returns
+  // |kNotCached| when the file or the key is absent.
+  static int ReadCache(const std::string& path, const std::string& key,
+                       EncodeCalibration* ptr_result);
+
+  // Stores |result| for |key| in the cache file |path|, replacing any earlier
+  // result for |key|. Returns |kInvalidArg| when the file cannot be written.
+  static int WriteCache(const std::string& path, const std::string& key,
+                        const EncodeCalibration& result);
+
+  // Copies the settings of |result| into |ptr_config|.
+  static void Apply(const EncodeCalibration& result, VpxConfig* ptr_config);
+
+ private:
+  // Encodes the clip with |candidate| applied to |config|, and
+  // stores the average encode time in |candidate.ms_per_frame|.
+  int Measure(const WebmEncoderConfig& config,
+              EncodeCalibration* ptr_candidate);
+
+  // Builds frame |index| of the clip in |frame_data_|.
+  void BuildFrame(int index);
+
+  // Output size of the encode, and storage of one I420 frame.
+  VideoConfig video_config_;
+  std::vector<uint8> noise_;
+  std::vector<uint8> frame_data_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(EncodeCalibrator);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_ENCODE_CALIBRATOR_H_
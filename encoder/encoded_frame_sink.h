@@ -0,0 +1,37 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_ENCODED_FRAME_SINK_H_
+#define WEBMLIVE_ENCODER_ENCODED_FRAME_SINK_H_
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+// Pure interface of outputs that take compressed frames straight from the
+// encoders, ahead of the muxers, such as realtime RTP senders. See
+// |WebmEncoderConfig::realtime_sink|.
+class EncodedFrameSinkInterface {
+ public:
+  virtual ~EncodedFrameSinkInterface() {}
+
+  // Takes the compressed VP8 or VP9 frame |frame| of the first video
+  // representation. The sink copies what it keeps. Called on the encode
+  // thread as each frame leaves its encoder; must not block. Returns true
+  // when the frame was accepted.
+  virtual bool WriteVideoFrame(const VideoFrame& frame) = 0;
+
+  // Takes the compressed buffer |buffer| of the main audio track, as
+  // |WriteVideoFrame()| does frames.
+  virtual bool WriteAudioBuffer(const AudioBuffer& buffer) = 0;
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_ENCODED_FRAME_SINK_H_
@@ -24,12 +24,26 @@
 
 #endif  // _WIN32
 
+#include "encoder/basictypes.h"
+
 // App Version/Identity
 namespace webmlive {
 
 static const char* kEncoderName = "webmlive encoder";
 static const char* kEncoderVersion = "2.0.0.0";
 
+// Units per second of the precise frame and sample times kept next to the
+// millisecond timestamps; see |VideoFrame::timestamp_us()|.
+const int64 kMicrosecondTimebase = 1000000;
+
+// Returns |microseconds| rounded to the nearest millisecond. Times rounded
+// this way never collide at frame rates up to 1000 fps, and consecutive
+// frames rounded this way tile without gaps.
+inline int64 MicrosecondsToMilliseconds(int64 microseconds) {
+  return microseconds >= 0 ? (microseconds + 500) / 1000 :
+      -((-microseconds + 499) / 1000);
+}
+
 }  // namespace webmlive
 
 #endif  // WEBMLIVE_ENCODER_ENCODER_BASE_H_
@@ -0,0 +1,339 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+//
+// Offline encode benchmark: runs the encode pipeline on a Y4M or raw I420
+// file, and optionally a WAV file, through |FileMediaSource|, or on the
+// pattern and tone of |SyntheticMediaSource|, into a sink that only counts
+// what it receives, then reports throughput and latency.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "encoder/basictypes.h"
+#include "encoder/cpu_accounting.h"
+#include "encoder/data_sink.h"
+#include "encoder/latency_tracer.h"
+#include "encoder/memory_governor.h"
+#include "encoder/metrics.h"
+#include "encoder/webm_encoder.h"
+#include "glog/logging.h"
+
+namespace {
+
+const std::string kCodecVp8 = "vp8";
+const std::string kCodecVp9 = "vp9";
+const std::string kCodecOpus = "opus";
+const std::string kCodecVorbis = "vorbis";
+
+// Interval at which the main thread checks whether the encode finished.
+const int kPollIntervalMs = 100;
+
+// Length of synthetic input when --duration is not given.
+const int64 kDefaultSyntheticDurationMs = 10000;
+
+// Data sink that discards everything written to it, counting bytes and
+// chunks. Always ready, so the encoder never waits on it.
+class CountingDataSink : public webmlive::DataSinkInterface {
+ public:
+  CountingDataSink() : bytes_(0), chunks_(0) {}
+  virtual ~CountingDataSink() {}
+
+  virtual bool Ready() const { return true; }
+
+  virtual bool WriteData(const uint8* /*ptr_data*/, int32 data_length,
+                         const std::string& /*id*/) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bytes_ += data_length;
+    ++chunks_;
+    return true;
+  }
+
+  virtual bool WriteChunk(const webmlive::SharedDataChunk& chunk,
+                          const std::string& /*id*/) {
+    if (!chunk) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    bytes_ += chunk->length();
+    ++chunks_;
+    return true;
+  }
+
+  int64 bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+  }
+  int64 chunks() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return chunks_;
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  int64 bytes_;
+  int64 chunks_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(CountingDataSink);
+};
+
+void usage(const char** argv) {
+  printf("Usage: %s --video <file>|--synthetic [args]\n", argv[0]);
+  printf("  Input options:\n");
+  printf("    --video <file>                 Y4M, or raw I420 when the name\n");
+  printf("                                   does not end in .y4m.\n");
+  printf("    --width <width>                Raw I420 frame width.\n");
+  printf("    --height <height>              Raw I420 frame height.\n");
+  printf("    --fps <frame rate>             Raw I420 frame rate. Default\n");
+  printf("                                   is 30.\n");
+  printf("    --audio <file>                 PCM16 or float WAV file.\n");
+  printf("    --synthetic                    Encodes generated color bars,\n");
+  printf("                                   noise and text instead of a\n");
+  printf("                                   file, sized by --width,\n");
+  printf("                                   --height and --fps.\n");
+  printf("    --synthetic_audio              Adds a generated tone to\n");
+  printf("                                   --synthetic.\n");
+  printf("    --duration <ms>                Length of synthetic input.\n");
+  printf("                                   Default is 10000.\n");
+  printf("    --paced                        Delivers input in real time\n");
+  printf("                                   instead of as fast as the\n");
+  printf("                                   encoder consumes it.\n");
+  printf("  Encoder options:\n");
+  printf("    --vpx_codec <vp8|vp9>          Video codec.\n");
+  printf("    --vpx_bitrate <kbps>           Video bitrate.\n");
+  printf("    --vpx_speed <speed value>      Speed.\n");
+  printf("    --vpx_threads <num threads>    Number of encode threads.\n");
+  printf("    --vpx_keyframe_interval <ms>   Time between keyframes.\n");
+  printf("    --vpx_width <width>            Output width.\n");
+  printf("    --vpx_height <height>          Output height.\n");
+  printf("    --audio_codec <vorbis|opus>    Audio codec.\n");
+}
+
+bool arg_has_value(int arg_index, int argc, const char** argv) {
+  const int val_index = arg_index + 1;
+  const bool has_value = ((val_index < argc) && (argv[val_index] != NULL));
+  if (!has_value) {
+    LOG(WARNING) << "argument missing value: " << argv[arg_index];
+  }
+  return has_value;
+}
+
+// Parses the command line into |ptr_config|. Returns false when the
+// benchmark cannot run.
+bool parse_command_line(int argc, const char** argv,
+                        webmlive::WebmEncoderConfig* ptr_config) {
+  webmlive::WebmEncoderConfig& config = *ptr_config;
+  config.input_paced = false;
+  config.input_synthetic_duration_ms = kDefaultSyntheticDurationMs;
+  bool synthetic_audio = false;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp("-h", argv[i]) || !strcmp("--help", argv[i])) {
+      usage(argv);
+      exit(EXIT_SUCCESS);
+    } else if (!strcmp("--video", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.input_video_file = argv[++i];
+    } else if (!strcmp("--width", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.requested_video_config.width = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--height", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.requested_video_config.height = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--fps", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.requested_video_config.frame_rate = strtod(argv[++i], NULL);
+    } else if (!strcmp("--audio", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.input_audio_file = argv[++i];
+    } else if (!strcmp("--synthetic", argv[i])) {
+      config.input_synthetic = true;
+    } else if (!strcmp("--synthetic_audio", argv[i])) {
+      synthetic_audio = true;
+    } else if (!strcmp("--duration", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.input_synthetic_duration_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--paced", argv[i])) {
+      config.input_paced = true;
+    } else if (!strcmp("--vpx_codec", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      const std::string codec = argv[++i];
+      if (codec == kCodecVp8) {
+        config.vpx_config.codec = webmlive::kVideoFormatVP8;
+      } else if (codec == kCodecVp9) {
+        config.vpx_config.codec = webmlive::kVideoFormatVP9;
+      } else {
+        LOG(ERROR) << "Invalid --vpx_codec value: " << codec;
+        return false;
+      }
+    } else if (!strcmp("--vpx_bitrate", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.vpx_config.bitrate = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vpx_speed", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.vpx_config.speed = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vpx_threads", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.vpx_config.thread_count = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vpx_keyframe_interval", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.vpx_config.keyframe_interval = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vpx_width", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.output_video_width = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vpx_height", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.output_video_height = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--audio_codec", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      const std::string codec = argv[++i];
+      if (codec == kCodecVorbis) {
+        config.audio_codec = webmlive::kAudioFormatVorbis;
+      } else if (codec == kCodecOpus) {
+        config.audio_codec = webmlive::kAudioFormatOpus;
+      } else {
+        LOG(ERROR) << "Invalid --audio_codec value: " << codec;
+        return false;
+      }
+    } else {
+      LOG(WARNING) << "argument unknown or unparseable: " << argv[i];
+    }
+  }
+  if (config.input_synthetic) {
+    if (!config.input_video_file.empty() ||
+        !config.input_audio_file.empty()) {
+      LOG(ERROR) << "--synthetic excludes --video and --audio.";
+      return false;
+    }
+    if (config.input_synthetic_duration_ms <= 0) {
+      LOG(ERROR) << "--duration must be positive.";
+      return false;
+    }
+    config.disable_audio = !synthetic_audio;
+    return true;
+  }
+  if (config.input_video_file.empty()) {
+    LOG(ERROR) << "--video or --synthetic is required.";
+    return false;
+  }
+  return true;
+}
+
+// Returns the value of the video encode worker counter |name| for the
+// representation of |config|.
+int64 video_counter_value(const webmlive::WebmEncoderConfig& config,
+                          const std::string& name) {
+  int32 width = config.actual_video_config.width;
+  int32 height = config.actual_video_config.height;
+  if (!config.video_representations.empty()) {
+    const webmlive::VideoRepresentationConfig& rep =
+        config.video_representations[0];
+    width = rep.width > 0 ? rep.width : width;
+    height = rep.height > 0 ? rep.height : height;
+  }
+  std::ostringstream labels;
+  labels << "representation=\"" << width << "x" << height << "\"";
+  const webmlive::Metric* const ptr_metric =
+      webmlive::MetricsRegistry::Instance().GetCounter(name, labels.str(),
+                                                       "");
+  return ptr_metric ? ptr_metric->value() : 0;
+}
+
+int benchmark_main(const webmlive::WebmEncoderConfig& bench_config) {
+  webmlive::WebmEncoderConfig config = bench_config;
+  config.latency_trace = true;
+
+  CountingDataSink sink;
+  webmlive::WebmEncoder encoder;
+  int status = encoder.Init(config, &sink);
+  if (status) {
+    LOG(ERROR) << "WebmEncoder Init failed, status=" << status;
+    return EXIT_FAILURE;
+  }
+
+  const std::chrono::steady_clock::time_point start_time =
+      std::chrono::steady_clock::now();
+  status = encoder.Run();
+  if (status) {
+    LOG(ERROR) << "WebmEncoder Run failed, status=" << status;
+    return EXIT_FAILURE;
+  }
+  while (!encoder.Finished()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(kPollIntervalMs));
+  }
+  const double elapsed_seconds =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start_time).count() / 1000000.0;
+  encoder.Stop();
+
+  const webmlive::WebmEncoderConfig& actual_config = encoder.config();
+  const int64 frames = video_counter_value(
+      actual_config, "webmlive_video_frames_encoded_total");
+  const int64 encode_us = video_counter_value(
+      actual_config, "webmlive_video_encode_microseconds_total");
+  const webmlive::LatencyStats stats = encoder.latency_stats();
+  const webmlive::LatencyHistogram& encode_latency =
+      stats.stages[webmlive::LatencyTracer::kEncode];
+  const webmlive::LatencyHistogram& chunk_latency =
+      stats.stages[webmlive::LatencyTracer::kChunkReady];
+
+  printf("input:            %s\n", config.input_synthetic ?
+         "synthetic" : config.input_video_file.c_str());
+  printf("resolution:       %dx%d @ %.2f fps\n",
+         actual_config.actual_video_config.width,
+         actual_config.actual_video_config.height,
+         actual_config.actual_video_config.frame_rate);
+  printf("elapsed:          %.3f seconds\n", elapsed_seconds);
+  printf("encoded duration: %.3f seconds\n",
+         encoder.encoded_duration() / 1000.0);
+  printf("frames encoded:   %lld (%.2f frames/s)\n",
+         static_cast<long long>(frames),  // NOLINT
+         elapsed_seconds > 0 ? frames / elapsed_seconds : 0.0);
+  printf("encode time:      %.3f ms/frame\n",
+         frames > 0 ? encode_us / 1000.0 / frames : 0.0);
+  printf("capture->encode:  p50 <= %lld ms, p99 <= %lld ms\n",
+         static_cast<long long>(encode_latency.Percentile(50)),  // NOLINT
+         static_cast<long long>(encode_latency.Percentile(99)));  // NOLINT
+  printf("capture->chunk:   p50 <= %lld ms, p99 <= %lld ms\n",
+         static_cast<long long>(chunk_latency.Percentile(50)),  // NOLINT
+         static_cast<long long>(chunk_latency.Percentile(99)));  // NOLINT
+  printf("output:           %lld bytes in %lld chunks\n",
+         static_cast<long long>(sink.bytes()),  // NOLINT
+         static_cast<long long>(sink.chunks()));  // NOLINT
+  const webmlive::MemoryGovernor& governor =
+      webmlive::MemoryGovernor::Instance();
+  printf("memory:           %lld peak tracked bytes, %lld resident bytes\n",
+         static_cast<long long>(governor.peak_total_bytes()),  // NOLINT
+         static_cast<long long>(  // NOLINT
+             webmlive::MemoryGovernor::ResidentBytes()));
+  webmlive::CpuAccounting& cpu = webmlive::CpuAccounting::Instance();
+  cpu.Sample();
+  for (int i = 0; i < webmlive::kNumCpuStages; ++i) {
+    const webmlive::CpuStage stage = static_cast<webmlive::CpuStage>(i);
+    const int64 stage_us = cpu.stage_cpu_us(stage);
+    if (stage_us == 0)
+      continue;
+    printf("cpu %-13s %.3f s (%.1f%% of a core)\n",
+           webmlive::CpuAccounting::StageName(stage),
+           stage_us / 1000000.0,
+           elapsed_seconds > 0 ? stage_us / 10000.0 / elapsed_seconds : 0.0);
+  }
+  return EXIT_SUCCESS;
+}
+
+}  // anonymous namespace
+
+int main(int argc, const char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  webmlive::WebmEncoderConfig config = webmlive::WebmEncoder::DefaultConfig();
+  if (!parse_command_line(argc, argv, &config)) {
+    usage(argv);
+    return EXIT_FAILURE;
+  }
+  const int exit_code = benchmark_main(config);
+  google::ShutdownGoogleLogging();
+  return exit_code;
+}
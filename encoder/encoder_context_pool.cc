@@ -0,0 +1,260 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/encoder_context_pool.h"
+
+#include <deque>
+#include <new>
+#include <utility>
+
+#include "glog/logging.h"
+
+#if defined _MSC_VER
+// Disable warning C4505(unreferenced local function has been removed) in MSVC,
+// emitted for vp8.h and vp8cx.h (included by vpx_encoder.h).
+#pragma warning(disable:4505)
+#endif
+#include "encoder/metrics.h"
+#include "encoder/vpx_encoder.h"
+
+namespace webmlive {
+
+struct EncoderContextPool::Profile {
+  // Encoder configuration the contexts are initialized with.
+  WebmEncoderConfig config;
+
+  // Initialized encoders, oldest first.
+  std::deque<std::unique_ptr<VideoEncoderBackendInterface>> contexts;
+};
+
+EncoderContextPool& EncoderContextPool::Instance() {
+  static EncoderContextPool pool;
+  return pool;
+}
+
+EncoderContextPool::EncoderContextPool()
+    : running_(false),
+      stop_(false),
+      ptr_warm_contexts_(NULL),
+      ptr_hits_(NULL),
+      ptr_misses_(NULL) {
+}
+
+EncoderContextPool::~EncoderContextPool() {
+  Stop();
+}
+
+int EncoderContextPool::Start(const EncoderContextPoolSettings& settings) {
+  if (settings.contexts_per_profile < 1 || settings.max_profiles < 1) {
+    LOG(ERROR) << "EncoderContextPool invalid settings.";
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (running_) {
+    LOG(ERROR) << "EncoderContextPool already running.";
+    return kInvalidArg;
+  }
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  ptr_warm_contexts_ = registry.GetGauge(
+      "webmlive_encoder_pool_contexts", "",
+      "Video encoders initialized ahead of use.");
+  ptr_hits_ = registry.GetCounter(
+      "webmlive_encoder_pool_hits_total", "",
+      "Video encoders started from an initialized encoder.");
+  ptr_misses_ = registry.GetCounter(
+      "webmlive_encoder_pool_misses_total", "",
+      "Video encoders started without an initialized encoder ready.");
+  if (!ptr_warm_contexts_ || !ptr_hits_ || !ptr_misses_) {
+    LOG(ERROR) << "cannot create encoder pool metrics.";
+    return kNoMemory;
+  }
+  settings_ = settings;
+  stop_ = false;
+  warm_thread_.reset(new (std::nothrow) std::thread(  // NOLINT
+      &EncoderContextPool::WarmThread, this));
+  if (!warm_thread_) {
+    LOG(ERROR) << "cannot start the encoder pool thread.";
+    return kNoMemory;
+  }
+  running_ = true;
+  return kSuccess;
+}
+
+void EncoderContextPool::Stop() {
+  std::unique_ptr<std::thread> warm_thread;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_)
+      return;
+    stop_ = true;
+    running_ = false;
+    warm_thread.swap(warm_thread_);
+  }
+  wake_.notify_one();
+  warm_thread->join();
+
+  // The encoders are freed outside the lock; freeing large VP9 contexts
+  // takes a while.
+  ProfileList profiles;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    profiles.swap(profiles_);
+    UpdateMetricsLocked();
+  }
+}
+
+int EncoderContextPool::AddProfile(const WebmEncoderConfig& config) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+      LOG(ERROR) << "EncoderContextPool not running.";
+      return kInvalidArg;
+    }
+    if (FindProfile(config) == profiles_.end())
+      AddProfileLocked(config);
+  }
+  wake_.notify_one();
+  return kSuccess;
+}
+
+std::unique_ptr<VideoEncoderBackendInterface> EncoderContextPool::Take(
+    const WebmEncoderConfig& config) {
+  std::unique_ptr<VideoEncoderBackendInterface> encoder;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_)
+      return encoder;
+    ProfileList::iterator profile = FindProfile(config);
+    if (profile == profiles_.end()) {
+      AddProfileLocked(config);
+    } else {
+      // Most recently used first.
+      profiles_.splice(profiles_.begin(), profiles_, profile);
+      std::deque<std::unique_ptr<VideoEncoderBackendInterface>>& contexts =
+          profiles_.front()->contexts;
+      if (!contexts.empty()) {
+        encoder = std::move(contexts.front());
+        contexts.pop_front();
+      }
+    }
+    if (encoder) {
+      ptr_hits_->Increment(1);
+    } else {
+      ptr_misses_->Increment(1);
+    }
+    UpdateMetricsLocked();
+  }
+  wake_.notify_one();
+  return encoder;
+}
+
+bool EncoderContextPool::SameProfile(const WebmEncoderConfig& a,
+                                     const WebmEncoderConfig& b) {
+  const VpxConfig& vpx_a = a.vpx_config;
+  const VpxConfig& vpx_b = b.vpx_config;
+  return vpx_a.codec == vpx_b.codec &&
+         a.actual_video_config.width == b.actual_video_config.width &&
+         a.actual_video_config.height == b.actual_video_config.height &&
+         a.actual_video_config.format == b.actual_video_config.format &&
+         vpx_a.bit_depth == vpx_b.bit_depth && vpx_a.speed == vpx_b.speed &&
+         vpx_a.profile == vpx_b.profile &&
+         vpx_a.lag_in_frames == vpx_b.lag_in_frames &&
+         vpx_a.temporal_layers == vpx_b.temporal_layers &&
+         vpx_a.thread_count == vpx_b.thread_count &&
+         vpx_a.tile_columns == vpx_b.tile_columns &&
+         vpx_a.row_mt == vpx_b.row_mt && a.encode_cores == b.encode_cores &&
+         a.video_representations.size() == b.video_representations.size() &&
+         a.video_svc == b.video_svc;
+}
+
+EncoderContextPool::ProfileList::iterator EncoderContextPool::FindProfile(
+    const WebmEncoderConfig& config) {
+  for (ProfileList::iterator it = profiles_.begin(); it != profiles_.end();
+       ++it) {
+    if (SameProfile((*it)->config, config))
+      return it;
+  }
+  return profiles_.end();
+}
+
+void EncoderContextPool::AddProfileLocked(const WebmEncoderConfig& config) {
+  std::unique_ptr<Profile> profile(new (std::nothrow) Profile());  // NOLINT
+  if (!profile) {
+    LOG(ERROR) << "cannot allocate encoder pool profile.";
+    return;
+  }
+  profile->config = config;
+
+  // Warm encoders belong to no stream until taken; |VpxEncoder::Init()|
+  // attaches telemetry and the quality probe when a stream takes one.
+  profile->config.rate_control_telemetry = NULL;
+  profile->config.task_scheduler = NULL;
+  profile->config.vpx_config.quality_probe_interval = 0;
+  profile->config.metrics_labels.clear();
+  profiles_.push_front(std::move(profile));
+  while (static_cast<int>(profiles_.size()) > settings_.max_profiles)
+    profiles_.pop_back();
+  LOG(INFO) << "encoder pool profile " << config.actual_video_config.width
+            << "x" << config.actual_video_config.height << " codec "
+            << config.vpx_config.codec << " speed "
+            << config.vpx_config.speed << " added.";
+}
+
+void EncoderContextPool::UpdateMetricsLocked() {
+  int64 warm_contexts = 0;
+  for (ProfileList::const_iterator it = profiles_.begin();
+       it != profiles_.end(); ++it) {
+    warm_contexts += static_cast<int64>((*it)->contexts.size());
+  }
+  if (ptr_warm_contexts_)
+    ptr_warm_contexts_->Set(warm_contexts);
+}
+
+void EncoderContextPool::WarmThread() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    // The most recently used profile short of encoders is filled first.
+    WebmEncoderConfig config;
+    bool found = false;
+    for (ProfileList::const_iterator it = profiles_.begin();
+         it != profiles_.end() && !found; ++it) {
+      if (static_cast<int>((*it)->contexts.size()) <
+          settings_.contexts_per_profile) {
+        config = (*it)->config;
+        found = true;
+      }
+    }
+    if (!found) {
+      wake_.wait(lock);
+      continue;
+    }
+
+    lock.unlock();
+    std::unique_ptr<VideoEncoderBackendInterface> encoder(
+        new (std::nothrow) VpxEncoder());  // NOLINT
+    int status = encoder ? encoder->Init(config) : kNoMemory;
+    lock.lock();
+    if (status) {
+      // Dropping the profile keeps the thread from retrying it forever;
+      // streams of the profile initialize their own encoders.
+      LOG(ERROR) << "encoder pool cannot initialize an encoder: " << status;
+      ProfileList::iterator profile = FindProfile(config);
+      if (profile != profiles_.end())
+        profiles_.erase(profile);
+      continue;
+    }
+    ProfileList::iterator profile = FindProfile(config);
+    if (profile != profiles_.end() &&
+        static_cast<int>((*profile)->contexts.size()) <
+            settings_.contexts_per_profile) {
+      (*profile)->contexts.push_back(std::move(encoder));
+      UpdateMetricsLocked();
+    }
+  }
+}
+
+}  // namespace webmlive
@@ -0,0 +1,135 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_ENCODER_CONTEXT_POOL_H_
+#define WEBMLIVE_ENCODER_ENCODER_CONTEXT_POOL_H_
+
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "encoder/basictypes.h"
+#include "encoder/webm_encoder.h"
+
+namespace webmlive {
+
+class Metric;
+class VideoEncoderBackendInterface;
+
+struct EncoderContextPoolSettings {
+  static const int kDefaultMaxProfiles = 8;
+
+  EncoderContextPoolSettings()
+      : contexts_per_profile(0), max_profiles(kDefaultMaxProfiles) {}
+
+  // Initialized encoders kept ready for each profile. 0 disables the pool.
+  int contexts_per_profile;
+
+  // Profiles kept warm. Beyond it the least recently used is dropped.
+  int max_profiles;
+};
+
+// Keeps libvpx encoders initialized ahead of time, so that streams started
+// on demand, and representations restarted by |WebmEncoder::Reconfigure()|,
+// begin encoding with their first frame instead of waiting for
+// vpx_codec_enc_init() to allocate the encoder's buffers. That takes long
+// for VP9 at high resolutions.
+//
+// A profile is the encoder configuration of one representation: the codec,
+// frame size, bit depth, speed and threading of the |WebmEncoderConfig|
+// passed to |VideoEncoder::Init()|. Profiles are added up front with
+// |AddProfile()|, and learned from every |Take()| that finds none ready. A
+// thread keeps |contexts_per_profile| encoders initialized for each.
+//
+//   EncoderContextPool::Instance().Start(settings);
+//   EncoderContextPool::Instance().AddProfile(config);
+//   ...
+//   EncoderContextPool::Instance().Stop();
+//
+// Notes
+// - |VpxEncoder::Init()| reconfigures a taken encoder for the settings of
+//   its stream, its bitrate or rate control mode for example; only the
+//   context allocation is saved.
+// - Each warm encoder holds its full libvpx buffers; the memory is spent
+//   whether or not a stream starts.
+// - Hardware encoders are not pooled.
+class EncoderContextPool {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  static EncoderContextPool& Instance();
+
+  // Starts the thread initializing encoders. Returns |kSuccess|, or
+  // |kInvalidArg| when |settings| are invalid or the pool runs already.
+  int Start(const EncoderContextPoolSettings& settings);
+
+  // Stops the thread and frees the encoders not taken.
+  void Stop();
+
+  // Keeps encoders ready for |config|, as passed to |VideoEncoder::Init()|.
+  // Returns |kSuccess|, or |kInvalidArg| when the pool is not running.
+  int AddProfile(const WebmEncoderConfig& config);
+
+  // Returns an initialized libvpx encoder of the profile of |config|, or
+  // NULL when none is ready; the caller then initializes its own. The caller
+  // must call |Init(config)| on the encoder returned.
+  std::unique_ptr<VideoEncoderBackendInterface> Take(
+      const WebmEncoderConfig& config);
+
+  bool running() const { return running_; }
+
+ private:
+  struct Profile;
+  typedef std::list<std::unique_ptr<Profile>> ProfileList;
+
+  EncoderContextPool();
+  ~EncoderContextPool();
+
+  // Returns true when encoders initialized for |a| suit |b|.
+  static bool SameProfile(const WebmEncoderConfig& a,
+                          const WebmEncoderConfig& b);
+
+  // Returns the profile matching |config|, or |profiles_.end()|. Requires
+  // |mutex_|.
+  ProfileList::iterator FindProfile(const WebmEncoderConfig& config);
+
+  // Adds a profile for |config| at the front of |profiles_|, dropping the
+  // last beyond |max_profiles|. Requires |mutex_|.
+  void AddProfileLocked(const WebmEncoderConfig& config);
+
+  // Updates the warm encoder gauge. Requires |mutex_|.
+  void UpdateMetricsLocked();
+
+  // Initializes encoders until every profile has |contexts_per_profile|.
+  void WarmThread();
+
+  EncoderContextPoolSettings settings_;
+
+  // Profiles, most recently used first. Protected by |mutex_|, which is not
+  // held while an encoder initializes.
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  ProfileList profiles_;
+  bool running_;
+  bool stop_;
+  std::unique_ptr<std::thread> warm_thread_;
+
+  Metric* ptr_warm_contexts_;
+  Metric* ptr_hits_;
+  Metric* ptr_misses_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(EncoderContextPool);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_ENCODER_CONTEXT_POOL_H_
@@ -7,17 +7,55 @@
 // be found in the AUTHORS file in the root of the source tree.
 #include "encoder/encoder_base.h"
 
+#ifdef _WIN32
 #include <conio.h>
+#else
+#include <sys/select.h>
+#include <unistd.h>
+#endif
+#include <ctype.h>
+#include <signal.h>
 #include <stdio.h>
-#include <tchar.h>
+#include <stdlib.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
 #include <memory>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "encoder/async_log_sink.h"
+#include "encoder/bitrate_adapter.h"
 #include "encoder/buffer_util.h"
+#include "encoder/control_server.h"
+#include "encoder/cpu_accounting.h"
+#include "encoder/encode_calibrator.h"
+#include "encoder/encoder_context_pool.h"
+#include "encoder/fan_out_data_sink.h"
+#include "encoder/file_data_sink.h"
+#include "encoder/http_origin.h"
 #include "encoder/http_uploader.h"
+#include "encoder/ladder_controller.h"
+#include "encoder/memory_governor.h"
+#include "encoder/metrics.h"
+#include "encoder/rate_control_telemetry.h"
+#include "encoder/resource_planner.h"
+#include "encoder/slice_pool.h"
+#include "encoder/srt_data_sink.h"
+#include "encoder/task_scheduler.h"
+#include "encoder/thread_placement.h"
+#include "encoder/trace_log.h"
+#include "encoder/tracepoints.h"
+#include "encoder/vod_webm_builder.h"
+#include "encoder/webm_archive_writer.h"
 #include "encoder/webm_encoder.h"
+#include "encoder/webm_remuxer.h"
+#include "encoder/websocket_data_sink.h"
+#include "encoder/whip_sender.h"
 #include "glog/logging.h"
 
 namespace {
@@ -33,12 +71,191 @@ const std::string kMetadataQueryFragment = "&metadata=1";
 const std::string kWebmItagQueryFragment = "&itag=43";
 const std::string kCodecVp8 = "vp8";
 const std::string kCodecVp9 = "vp9";
+const std::string kCodecAv1 = "av1";
+const std::string kCodecOpus = "opus";
+const std::string kCodecVorbis = "vorbis";
+const std::string kBackendLibvpx = "libvpx";
+const std::string kBackendHardware = "hardware";
+const std::string kBackendAuto = "auto";
+const std::string kProfileDefault = "default";
+const std::string kProfileUltraLowLatency = "ull";
+const std::string kProfileBroadcast = "broadcast";
+const std::string kProfileCappedQuality = "capped_quality";
+const std::string kQueueReject = "reject";
+const std::string kQueueDropOldest = "drop_oldest";
+const std::string kQueueLatest = "latest";
+const std::string kDeinterlaceFrame = "frame";
+const std::string kDeinterlaceField = "field";
 typedef std::vector<std::string> StringVector;
 
+// Returns true when input is waiting on the console. Outside Windows the
+// terminal is line buffered, so a key press is seen once Enter is pressed.
+bool key_pressed() {
+#ifdef _WIN32
+  return _kbhit() != 0;
+#else
+  if (!isatty(STDIN_FILENO)) {
+    return false;
+  }
+  fd_set read_fds;
+  FD_ZERO(&read_fds);
+  FD_SET(STDIN_FILENO, &read_fds);
+  timeval timeout = {0, 0};
+  return select(STDIN_FILENO + 1, &read_fds, NULL, NULL, &timeout) > 0;
+#endif
+}
+
+// Encoder profile kept warm by |webmlive::EncoderContextPool|, from
+// --encoder_pool_profile.
+struct EncoderPoolProfile {
+  webmlive::VideoFormat codec;
+  int width;
+  int height;
+  int speed;
+};
+
 struct WebmEncoderClientConfig {
+  WebmEncoderClientConfig()
+      : write_files(false),
+        file_sync_interval_ms(0),
+        file_retention(false),
+        vod_webm(false),
+        serve(false),
+        origin_window_ms(-1),
+        control(false),
+        srt(false),
+        push_stream(false),
+        whip(false),
+        adaptive_bitrate(false),
+        min_video_kbps(0),
+        ladder_pruning(false),
+        pacing_headroom(0),
+        live_window_ms(-1),
+        trace_level(webmlive::TraceLog::kOff),
+        async_log(false),
+        rate_control_telemetry(false),
+        metrics_interval(5),
+        memory_limit_mb(0),
+        stream_memory_limit_mb(0),
+        calibrate(false),
+        calibration_cache("webmlive_calibration.txt"),
+        calibration_headroom(0.2),
+        host_cpus(0),
+        host_cpu_headroom(0.15) {}
+
   // Target for HTTP POSTs.
   std::string target_url;
 
+  // Also write DASH files to |enc_config.dash_dir| while uploading.
+  bool write_files;
+
+  // Interval at which written DASH files are synced to disk; 0 leaves it to
+  // the operating system. See |FileDataSinkSettings::sync_interval_ms|.
+  int file_sync_interval_ms;
+
+  // Delete the DASH chunks written to |enc_config.dash_dir| once they leave
+  // the dynamic MPD's time shift buffer. See
+  // |FileDataSinkSettings::retention_window_ms|.
+  bool file_retention;
+
+  // Once the stream stops, build <dash_name>.webm in |enc_config.dash_dir|
+  // from the muxed DASH chunks written there; see |build_vod_webm()|.
+  bool vod_webm;
+
+  // Serve the stream from memory with an embedded HTTP origin configured by
+  // |origin_settings|. The origin keeps |origin_window_ms| of media; -1 uses
+  // the DASH time shift buffer depth when it is set.
+  bool serve;
+  webmlive::HttpOriginSettings origin_settings;
+  int origin_window_ms;
+
+  // Accept runtime commands on the loopback endpoint configured by
+  // |control_settings|; see |StreamController|.
+  bool control;
+  webmlive::ControlServerSettings control_settings;
+
+  // Keep video encoders initialized ahead of use for |encoder_pool_profiles|
+  // and for the profiles streams start with; see
+  // |webmlive::EncoderContextPool|. Disabled when
+  // |encoder_pool_settings.contexts_per_profile| is 0.
+  webmlive::EncoderContextPoolSettings encoder_pool_settings;
+  std::vector<EncoderPoolProfile> encoder_pool_profiles;
+
+  // Stream the muxed WebM byte stream over SRT as |srt_settings| says. DASH
+  // encodes turn on |WebmEncoderConfig::dash_muxed_output| for it.
+  bool srt;
+  webmlive::SrtDataSinkSettings srt_settings;
+
+  // Push the muxed WebM byte stream over one WebSocket or chunked POST as
+  // |stream_sink_settings| says. DASH encodes turn on
+  // |WebmEncoderConfig::dash_muxed_output| for it.
+  bool push_stream;
+  webmlive::WebSocketDataSinkSettings stream_sink_settings;
+
+  // Publish the first video representation and the main audio track to an
+  // SFU over WebRTC as |whip_settings| says, alongside the muxed outputs.
+  bool whip;
+  webmlive::WhipSenderSettings whip_settings;
+
+  // Adapt the video bitrate to upload throughput, down to |min_video_kbps|.
+  // 0 means a quarter of the configured bitrate.
+  bool adaptive_bitrate;
+  int min_video_kbps;
+
+  // Pause the highest video representations of a dynamic DASH encode while
+  // the uplink cannot carry them all, and resume them as it recovers. Takes
+  // precedence over |adaptive_bitrate|.
+  bool ladder_pruning;
+
+  // Pace uploads at |pacing_headroom| times the configured audio and video
+  // bitrate. 0 disables pacing.
+  double pacing_headroom;
+
+  // Age at which queued media segments are dropped instead of uploaded. -1
+  // uses the DASH time shift buffer depth, and 0 keeps every segment.
+  int live_window_ms;
+
+  // Level of the per chunk and per frame trace events; see
+  // |webmlive::TraceLog|.
+  int trace_level;
+
+  // Write log files from a thread of their own; see
+  // |webmlive::AsyncLogSink|.
+  bool async_log;
+
+  // Log rate control histograms of each video representation when stopped;
+  // see |webmlive::RateControlTelemetry|.
+  bool rate_control_telemetry;
+
+  // Rewrite |metrics_file| with the contents of |webmlive::MetricsRegistry|
+  // every |metrics_interval| seconds. Disabled when |metrics_file| is empty.
+  std::string metrics_file;
+  int metrics_interval;
+
+  // Memory the capture pools, muxer buffers and upload queues of all streams,
+  // and of each stream, may hold; see |webmlive::MemoryGovernor|. 0 removes
+  // the limit.
+  int memory_limit_mb;
+  int stream_memory_limit_mb;
+
+  // Pick the libvpx speed and threading settings with
+  // |webmlive::EncodeCalibrator| before encoding, leaving
+  // |calibration_headroom| of each frame duration unused. Results are cached
+  // in |calibration_cache|.
+  bool calibrate;
+  std::string calibration_cache;
+  double calibration_headroom;
+
+  // File describing the streams run by host mode; see |read_host_config()|.
+  // Runs a single stream when empty.
+  std::string host_config;
+
+  // CPUs the streams of host mode are planned against by
+  // |webmlive::ResourcePlanner|, or 0 for the CPUs the container allows, and
+  // the share of them left unplanned.
+  double host_cpus;
+  double host_cpu_headroom;
+
   // Uploader settings.
   webmlive::HttpUploaderSettings uploader_settings;
 
@@ -46,6 +263,59 @@ struct WebmEncoderClientConfig {
   webmlive::WebmEncoderConfig enc_config;
 };
 
+// Encoder and data sinks of one stream.
+struct Stream {
+  Stream()
+      : upload(false), write_files(false), serve(false), srt(false),
+        push_stream(false), whip(false), adapt_bitrate(false),
+        prune_ladder(false), remux(false),
+        ptr_data_sink(NULL) {}
+
+  WebmEncoderClientConfig config;
+
+  // Outlives |encoder|, which records into it.
+  webmlive::RateControlTelemetry rate_control;
+  webmlive::HttpUploader uploader;
+  webmlive::FileDataSink file_sink;
+  webmlive::HttpOrigin origin;
+  webmlive::SrtDataSink srt_sink;
+  webmlive::WebSocketDataSink stream_sink;
+  webmlive::FanOutDataSink fan_out;
+  webmlive::WhipSender whip_sender;
+  webmlive::WebmEncoder encoder;
+  webmlive::WebmRemuxer remuxer;
+  webmlive::BitrateAdapter bitrate_adapter;
+  webmlive::LadderController ladder_controller;
+
+  // Chunks go to |uploader| when |upload| is true, to |file_sink| when
+  // |write_files| is true, to |origin| when |serve| is true, to |srt_sink|
+  // when |srt| is true, and to |stream_sink| when |push_stream| is true. They
+  // go through |fan_out| when more than one is.
+  bool upload;
+  bool write_files;
+  bool serve;
+  bool srt;
+  bool push_stream;
+
+  // Encoded frames also go to |whip_sender| when |whip| is true.
+  bool whip;
+
+  // Adapt the video bitrate using |bitrate_adapter|.
+  bool adapt_bitrate;
+
+  // Pause and resume the representations of |ladder| as |ladder_controller|
+  // decides.
+  bool prune_ladder;
+  std::vector<webmlive::VideoRepresentationConfig> ladder;
+
+  // Chunks come from |remuxer| instead of |encoder|.
+  bool remux;
+
+  // The sink chunks are written to: |fan_out|, or the only sink in use.
+  webmlive::DataSinkInterface* ptr_data_sink;
+};
+typedef std::vector<std::unique_ptr<Stream>> StreamVector;
+
 }  // anonymous namespace
 
 // Prints usage.
@@ -55,13 +325,30 @@ void usage(const char** argv) {
   printf("  Notes:\n");
   printf("    - DASH output is currently hard coded on and cannot be\n");
   printf("      disabled.\n");
-  printf("    - Uploading is currently DISABLED! The --url parameter will\n");
-  printf("      be ignored. DASH file output to the is the only currently\n");
-  printf("      supported output method. The following note still applies.\n");
+  printf("    - DASH chunks and the MPD are written to --dash_dir on a\n");
+  printf("      background thread when --url is not present, and uploaded\n");
+  printf("      to --url otherwise. Use --write_files to do both.\n");
+  printf("    - --origin_port serves the stream over HTTP from memory, and\n");
+  printf("      --srt_port streams it over SRT, and --stream_url pushes it\n");
+  printf("      over a WebSocket, in place of or in addition to the above.\n");
   printf("    - If an URL is provided without a query string present in the\n");
   printf("      URL, the stream_id and stream_name args are required.\n");
   printf("  General options:\n");
   printf("    -h | -? | --help               Show this message and exit.\n");
+  printf("    --host_config <file>           Runs the streams described in\n");
+  printf("                                   the file, one per line as the\n");
+  printf("                                   options of a single stream,\n");
+  printf("                                   in one process. General\n");
+  printf("                                   options given here apply to\n");
+  printf("                                   all streams.\n");
+  printf("    --host_cpus <cpus>             CPUs the streams of\n");
+  printf("                                   --host_config may use.\n");
+  printf("                                   Defaults to the CPU quota or\n");
+  printf("                                   affinity of the process.\n");
+  printf("                                   Streams that do not fit are\n");
+  printf("                                   sped up, or refused.\n");
+  printf("    --host_cpu_headroom <0-0.9>    Share of --host_cpus left\n");
+  printf("                                   unplanned. Defaults to 0.15.\n");
   printf("    --adev <audio source name>     Audio capture device name.\n");
   printf("    --adevidx <source index>       Select audio capture device by\n");
   printf("                                   index. Ignored when --adev is\n");
@@ -70,6 +357,96 @@ void usage(const char** argv) {
   printf("    --vdevidx <source index>       Select video capture device by\n");
   printf("                                   index. Ignored when --vdev is\n");
   printf("                                   used.\n");
+  printf("    --vdesktop                     Capture the screen instead of\n");
+  printf("                                   a device (Windows). --vdevidx\n");
+  printf("                                   selects the monitor.\n");
+  printf("    --vmf                          Capture video through Media\n");
+  printf("                                   Foundation, converting on the\n");
+  printf("                                   GPU (Windows).\n");
+  printf("    --vmf_cpu                      Like --vmf, converting on the\n");
+  printf("                                   CPU.\n");
+  printf("    --vasync_convert               Converts DirectShow frames on\n");
+  printf("                                   a thread of their own, off the\n");
+  printf("                                   capture thread (Windows).\n");
+  printf("    --vbuffer_count <frames>       Frames requested from the\n");
+  printf("                                   video capture filter's\n");
+  printf("                                   allocator (Windows).\n");
+  printf("    --pip_dev <video source name>  Draws a second video device\n");
+  printf("                                   over the captured video, as\n");
+  printf("                                   picture in picture (Linux).\n");
+  printf("    --pip_rect <x,y,WxH>           Overlay position and size.\n");
+  printf("                                   Negative x and y are margins\n");
+  printf("                                   from the right and bottom; a\n");
+  printf("                                   size of 0 is a quarter of the\n");
+  printf("                                   video width and the overlay's\n");
+  printf("                                   aspect ratio. Default:\n");
+  printf("                                   -16,-16,0x0.\n");
+  printf("    --pip_opacity <percent>        Overlay opacity. Default 100.\n");
+  printf("    --overlay_image <file>         Burns a raw I420 image with a\n");
+  printf("                                   trailing full size alpha plane\n");
+  printf("                                   into the video, a logo for\n");
+  printf("                                   example.\n");
+  printf("    --overlay_rect <x,y,WxH>       Image position and size; the\n");
+  printf("                                   size is required and even.\n");
+  printf("                                   Negative x and y are margins\n");
+  printf("                                   from the right and bottom.\n");
+  printf("                                   Default position: -16,16.\n");
+  printf("    --timecode                     Burns the stream time into the\n");
+  printf("                                   video as HH:MM:SS:FF.\n");
+  printf("    --timecode_pos <x,y>           Timecode position, as for\n");
+  printf("                                   --overlay_rect. Default\n");
+  printf("                                   16,-16.\n");
+  printf("    --timecode_scale <n>           Timecode font scale, 1 to 16.\n");
+  printf("                                   Default 2.\n");
+  printf("    --latency_code                 Burns the capture wall clock\n");
+  printf("                                   time into the video for\n");
+  printf("                                   latency_checker.\n");
+  printf("    --deinterlace <frame|field>    Deinterlaces interlaced\n");
+  printf("                                   capture: one frame per frame,\n");
+  printf("                                   or one per field at twice the\n");
+  printf("                                   frame rate.\n");
+  printf("    --bottom_field_first           The source sends the field of\n");
+  printf("                                   the odd rows first.\n");
+  printf("    --input_video_file <file>      Reads video from a Y4M or raw\n");
+  printf("                                   I420 file (sized by --vwidth,\n");
+  printf("                                   --vheight and --vframe_rate)\n");
+  printf("                                   instead of a capture device.\n");
+  printf("    --input_audio_file <file>      Reads audio from a PCM16 or\n");
+  printf("                                   float WAV file instead of a\n");
+  printf("                                   capture device.\n");
+  printf("    --input_unpaced                Reads input files, or generates\n");
+  printf("                                   synthetic input, as fast as\n");
+  printf("                                   the encoder consumes them.\n");
+  printf("    --input_shared_memory <name>   Reads frames and audio another\n");
+  printf("                                   process writes to the named\n");
+  printf("                                   shared memory region.\n");
+  printf("    --standby_heartbeat <name>     Beat through the named shared\n");
+  printf("                                   memory region, and cut\n");
+  printf("                                   segments that a hot standby\n");
+  printf("                                   can continue.\n");
+  printf("    --standby                      Watch the primary encoder's\n");
+  printf("                                   --input_shared_memory and\n");
+  printf("                                   take over its stream when\n");
+  printf("                                   --standby_heartbeat stops.\n");
+  printf("    --standby_timeout <ms>         Time without a beat before the\n");
+  printf("                                   standby takes over. Default\n");
+  printf("                                   1000.\n");
+  printf("    --input_capture_trace <file>   Replays a capture trace\n");
+  printf("                                   recorded by --capture_trace,\n");
+  printf("                                   with its original timing.\n");
+  printf("    --input_synthetic              Generates color bars, noise,\n");
+  printf("                                   scrolling text and a 1 kHz\n");
+  printf("                                   tone instead of capturing.\n");
+  printf("    --input_synthetic_duration <ms> Ends synthetic input after\n");
+  printf("                                   <ms>. Default 0: until stopped.\n");
+  printf("    --capture_trace <file>         Records the captured frames\n");
+  printf("                                   and audio, and when they\n");
+  printf("                                   arrived, to <file>.\n");
+  printf("    --capture_trace_max_mb <MB>    Largest capture trace. Default\n");
+  printf("                                   is 1024.\n");
+  printf("    --remux_input <file|-|URL>     Re-segments an encoded WebM\n");
+  printf("                                   stream for DASH without\n");
+  printf("                                   transcoding. Requires --dash.\n");
   printf("  DASH encoding options:\n");
   printf("    When the --dash argument is present an MPD file is produced\n");
   printf("    that allows the WebM output to be consumed by DASH WebM\n");
@@ -86,10 +463,84 @@ void usage(const char** argv) {
   printf("    --dash_start_number <string>   Use string specified instead \n");
   printf("                                   of the value 1 for the\n");
   printf("                                   SegmentTemplate startNumber.\n");
+  printf("    --dash_rep <w>x<h>:<kbps>[:<codec>]\n");
+  printf("                                   Adds a video representation.\n");
+  printf("                                   Repeat for multi-bitrate\n");
+  printf("                                   output. 0 values use the\n");
+  printf("                                   capture size or --vpx_bitrate.\n");
+  printf("                                   codec is vp8, vp9 or av1, and\n");
+  printf("                                   defaults to --vpx_codec.\n");
+  printf("    --dash_svc                     Encodes the --dash_rep\n");
+  printf("                                   representations as VP9 spatial\n");
+  printf("                                   layers of one encode. List 2\n");
+  printf("                                   or 3, smallest first, with\n");
+  printf("                                   sizes; each kbps is the total\n");
+  printf("                                   up to that layer.\n");
+  printf("    --dash_arep <codec>:<kbps>     Adds an audio representation,\n");
+  printf("                                   e.g. vorbis:64 or opus:96,\n");
+  printf("                                   besides the --audio_codec one.\n");
+  printf("                                   May be repeated. 0 kbps uses\n");
+  printf("                                   the codec's bitrate option.\n");
+  printf("    --dash_dynamic                 Writes a live MPD with a\n");
+  printf("                                   SegmentTimeline, updated after\n");
+  printf("                                   each chunk.\n");
+  printf("    --dash_time_shift_buffer_depth <seconds> Chunks kept in the\n");
+  printf("                                   dynamic MPD. Default keeps\n");
+  printf("                                   all chunks.\n");
+  printf("    --dash_bandwidth_window <chunks> Chunks over which each\n");
+  printf("                                   representation's bitrate is\n");
+  printf("                                   measured for the MPD\n");
+  printf("                                   bandwidth. 0 writes the\n");
+  printf("                                   configured bitrates. Default\n");
+  printf("                                   is %d.\n",
+         webmlive::WebmEncoderConfig::kDefaultDashBandwidthWindow);
+  printf("    --dash_patch_interval <seconds> Publishes dynamic MPD updates\n");
+  printf("                                   as MPD Patches, and the full\n");
+  printf("                                   MPD at this interval.\n");
+  printf("    --dash_publish_early           Sends the MPD and headers\n");
+  printf("                                   before capture starts.\n");
+  printf("    --dash_muxed_output            Also writes a single muxed\n");
+  printf("                                   WebM stream of audio and the\n");
+  printf("                                   first representation.\n");
+  printf("    --dash_vod_manifest            Replaces the MPD with a static\n");
+  printf("                                   one listing every chunk when\n");
+  printf("                                   the encode stops.\n");
+  printf("    --dash_vod_webm                Builds a seekable\n");
+  printf("                                   <dash_name>.webm in --dash_dir\n");
+  printf("                                   from the muxed chunks when the\n");
+  printf("                                   encode stops. Implies\n");
+  printf("                                   --dash_muxed_output and\n");
+  printf("                                   --cluster_index.\n");
+  printf("    --thumbnail_interval <frames>  Writes a JPEG thumbnail of\n");
+  printf("                                   every Nth captured frame, and\n");
+  printf("                                   sprite sheets of them indexed\n");
+  printf("                                   by <dash_name>_sprites.vtt.\n");
+  printf("                                   Needs a libjpeg build.\n");
+  printf("    --thumbnail_size <w>x<h>       Thumbnail size. Default is\n");
+  printf("                                   160 wide; a height of 0 keeps\n");
+  printf("                                   the aspect ratio.\n");
+  printf("    --thumbnail_sprite <c>x<r>     Thumbnails per sprite sheet\n");
+  printf("                                   row, and rows. Default is\n");
+  printf("                                   10x10; 0x0 writes no sheets.\n");
+  printf("    --thumbnail_quality <1-100>    JPEG quality. Default is 75.\n");
   printf("  HTTP uploader options:\n");
   printf("    Sends WebM chunks to an HTTP server via HTTP POST. Enabled\n");
   printf("    when the --url argument is present.\n");
-  printf("    --url <target URL>             Target for HTTP POSTs.\n");
+  printf("    --url <target URL>             Target for HTTP POSTs. An URL\n");
+  printf("                                   containing {id} is a template\n");
+  printf("                                   expanded per chunk; it may\n");
+  printf("                                   also use {stream_id} and\n");
+  printf("                                   {stream_name}.\n");
+  printf("    --write_files                  Also write DASH files to\n");
+  printf("                                   --dash_dir while uploading.\n");
+  printf("    --file_sync_interval <ms>      Sync files written to\n");
+  printf("                                   --dash_dir in batches every\n");
+  printf("                                   <ms> milliseconds. Off by\n");
+  printf("                                   default.\n");
+  printf("    --dash_retention               Delete chunks in --dash_dir\n");
+  printf("                                   once they leave the MPD's\n");
+  printf("                                   time shift buffer. Needs\n");
+  printf("                                   a time shift buffer depth.\n");
   printf("    --header <name:value>          Adds HTTP header and value.\n");
   printf("                                   Sent with all POSTs.\n");
   printf("    --form_post                    Send WebM chunks as file data\n");
@@ -100,12 +551,327 @@ void usage(const char** argv) {
   printf("                                   query string.\n");
   printf("    --stream_name <stream name>    Stream name to include in POST\n");
   printf("                                   query string.\n");
+  printf("    --max_uploads <count>          Number of concurrent POSTs.\n");
+  printf("                                   Default 4; 1 keeps uploads\n");
+  printf("                                   in order.\n");
+  printf("    --max_pending_uploads <count>  Number of queued and active\n");
+  printf("                                   POSTs. Default 8.\n");
+  printf("    --http2                        Use HTTP/2 when the server\n");
+  printf("                                   supports it.\n");
+  printf("    --http3                        Use HTTP/3 when libcurl and\n");
+  printf("                                   the server support it, and\n");
+  printf("                                   fall back to HTTP/2.\n");
+  printf("    --upload_retries <count>       Retries of a failed POST.\n");
+  printf("                                   Default 4.\n");
+  printf("    --upload_deadline <ms>         Drop POSTs not done this long\n");
+  printf("                                   after they are queued.\n");
+  printf("                                   Default 0, no deadline.\n");
+  printf("    --resume_uploads               Resume failed POSTs where the\n");
+  printf("                                   server reports it stopped.\n");
+  printf("    --upload_pacing <factor>       Send POSTs no faster than the\n");
+  printf("                                   stream bitrate times factor,\n");
+  printf("                                   for example 1.5.\n");
+  printf("    --upload_live_window <ms>      Drop queued media segments\n");
+  printf("                                   older than this. Default is\n");
+  printf("                                   the DASH time shift buffer\n");
+  printf("                                   depth; 0 keeps all segments.\n");
+  printf("    --upload_spool <dir>           Spool dropped POSTs in dir,\n");
+  printf("                                   and POST them again once the\n");
+  printf("                                   server is reachable.\n");
+  printf("    --upload_spool_size <MB>       Spool size limit. Default\n");
+  printf("                                   1024.\n");
+  printf("    --catch_up_kbps <kbps>         Rate of spooled POSTs.\n");
+  printf("                                   Default 0, no limit.\n");
+  printf("    --gzip_manifests               Send MPD POSTs gzip encoded.\n");
+  printf("                                   Needs a zlib build.\n");
+  printf("    --object_store                 PUT each chunk to an S3\n");
+  printf("                                   compatible object store as\n");
+  printf("                                   the object named by the\n");
+  printf("                                   target URL, which must be a\n");
+  printf("                                   template.\n");
+  printf("    --aws_sigv4 <provider>         Sign PUTs with AWS SigV4, for\n");
+  printf("                                   example aws:amz:us-east-1:s3.\n");
+  printf("    --aws_credentials <id:secret>  SigV4 access key. Default is\n");
+  printf("                                   AWS_ACCESS_KEY_ID and\n");
+  printf("                                   AWS_SECRET_ACCESS_KEY.\n");
+  printf("    --multipart_threshold <MB>     Send larger PUTs as parallel\n");
+  printf("                                   multipart uploads. Default 0,\n");
+  printf("                                   off.\n");
+  printf("    --multipart_part_size <MB>     Multipart part size. Default\n");
+  printf("                                   5, the smallest allowed.\n");
+  printf("    --coalesce_uploads <KB>        POST chunks this small, such\n");
+  printf("                                   as audio segments and MPDs,\n");
+  printf("                                   together in one request.\n");
+  printf("                                   Needs a target URL template.\n");
+  printf("                                   Default 0, off.\n");
+  printf("    --coalesce_max_chunks <n>      Chunks per request. Default\n");
+  printf("                                   8.\n");
+  printf("    --adaptive_bitrate             Lower the video bitrate when\n");
+  printf("                                   uploads fall behind, and raise\n");
+  printf("                                   it again as they keep up.\n");
+  printf("    --min_vpx_bitrate <kbps>       Lowest adaptive bitrate.\n");
+  printf("                                   Default is a quarter of the\n");
+  printf("                                   configured bitrate.\n");
+  printf("    --ladder_pruning               Stop encoding the highest\n");
+  printf("                                   video representations while\n");
+  printf("                                   uploads fall behind, and\n");
+  printf("                                   resume them as they keep up.\n");
+  printf("                                   Dynamic DASH ladders only.\n");
+  printf("    --low_latency_upload           POST chunks while they are\n");
+  printf("                                   muxed using chunked transfer\n");
+  printf("                                   encoding. Not supported with\n");
+  printf("                                   --form_post.\n");
+  printf("    --cluster_index                Write a sidecar index of\n");
+  printf("                                   cluster offsets, timecodes\n");
+  printf("                                   and keyframe flags when the\n");
+  printf("                                   stream ends.\n");
+  printf("    --native_clusters              Write clusters without\n");
+  printf("                                   libwebm, copying each block\n");
+  printf("                                   once.\n");
+  printf("    --encryption_key <hex>         Encrypt all frames with this\n");
+  printf("                                   16 byte AES key (WebM\n");
+  printf("                                   encryption, AES-CTR).\n");
+  printf("    --encryption_key_id <hex>      Key id written to the tracks\n");
+  printf("                                   and manifest. Required with\n");
+  printf("                                   --encryption_key.\n");
+  printf("    --archive <file>               Also record a seekable WebM\n");
+  printf("                                   file with Cues, finalized when\n");
+  printf("                                   the encode stops.\n");
+  printf("    --archive_mmap                 Write the archive through\n");
+  printf("                                   mapped pages with a crash\n");
+  printf("                                   safe index (Linux only).\n");
+  printf("    --archive_recover <file>       Repair an archive written with\n");
+  printf("                                   --archive_mmap that was not\n");
+  printf("                                   finalized, and exit.\n");
+  printf("    --latency_trace                Log per stage video latency\n");
+  printf("                                   histograms when stopped.\n");
+  printf("    --rate_control_telemetry       Log per representation rate\n");
+  printf("                                   control histograms when\n");
+  printf("                                   stopped.\n");
+  printf("    --trace_level <level>          Log trace events: 1 per chunk,\n");
+  printf("                                   2 also per frame (sampled).\n");
+  printf("    --async_log                    Write log files from a thread\n");
+  printf("                                   of their own, so slow disks\n");
+  printf("                                   do not stall the encoder.\n");
+  printf("                                   Messages are dropped when it\n");
+  printf("                                   falls behind.\n");
+  printf("    --metrics_file <path>          Periodically write encoder,\n");
+  printf("                                   pool and uploader metrics to\n");
+  printf("                                   this file in the Prometheus\n");
+  printf("                                   text format.\n");
+  printf("    --metrics_interval <seconds>   Time between metrics file\n");
+  printf("                                   writes. Default is 5.\n");
+  printf("                                   Outside Windows, SIGUSR1 logs\n");
+  printf("                                   a memory report and rewrites\n");
+  printf("                                   the metrics file at once.\n");
+  printf("    --control_port <port>          Accept commands changing the\n");
+  printf("                                   running encode on this\n");
+  printf("                                   loopback TCP port, one per\n");
+  printf("                                   line: bitrate <kbps>,\n");
+  printf("                                   keyframe, speed <steps>,\n");
+  printf("                                   target <url>, status, stop.\n");
+  printf("                                   In host mode, an optional\n");
+  printf("                                   last word selects the stream\n");
+  printf("                                   by number.\n");
+  printf("    --encoder_pool <count>         Keep this many video encoders\n");
+  printf("                                   initialized ahead of use for\n");
+  printf("                                   each encoder profile, so\n");
+  printf("                                   that streams and ladder\n");
+  printf("                                   changes start at once.\n");
+  printf("                                   Default 0, off.\n");
+  printf("    --encoder_pool_profile <codec>:<width>x<height>:<speed>\n");
+  printf("                                   Profile to warm before any\n");
+  printf("                                   stream uses it; the other\n");
+  printf("                                   encoder options apply.\n");
+  printf("                                   Repeatable.\n");
+  printf("    --calibrate                    Choose the VPx speed and\n");
+  printf("                                   threads for this machine by\n");
+  printf("                                   encoding a synthetic clip,\n");
+  printf("                                   or from the cached result.\n");
+  printf("    --calibration_cache <path>     Calibration cache file.\n");
+  printf("                                   Default is\n");
+  printf("                                   webmlive_calibration.txt.\n");
+  printf("    --calibration_headroom <0-0.9> Share of each frame duration\n");
+  printf("                                   left unused. Default is 0.2.\n");
+  printf("    --pool_memory_budget_mb <MB>   Memory each raw sample pool\n");
+  printf("                                   may grow to. Default is 256.\n");
+  printf("    --memory_limit <MB>            Memory all streams may hold in\n");
+  printf("                                   capture pools, muxer buffers\n");
+  printf("                                   and upload queues. Streams\n");
+  printf("                                   shed load near the limit.\n");
+  printf("                                   Default is unlimited.\n");
+  printf("    --stream_memory_limit <MB>     Like --memory_limit, for each\n");
+  printf("                                   stream.\n");
+  printf("    --cluster_duration <ms>        Split chunks into clusters of\n");
+  printf("                                   this duration. Chunks still\n");
+  printf("                                   start at keyframes.\n");
+  printf("    --chunk_max_bytes <bytes>      End video chunks at the next\n");
+  printf("                                   frame once they hold this\n");
+  printf("                                   many bytes, even between\n");
+  printf("                                   keyframes. Default is 0, off.\n");
+  printf("    --fast_start                   Start capture while the\n");
+  printf("                                   encoders initialize, and\n");
+  printf("                                   initialize them in parallel.\n");
+  printf("    --capture_stall_timeout <ms>   Reopen the capture devices\n");
+  printf("                                   when they fail or deliver\n");
+  printf("                                   nothing for this long, and\n");
+  printf("                                   keep encoding. Default is 0,\n");
+  printf("                                   off. Windows only.\n");
+  printf("    --slate <file>                 Y4M or raw I420 picture shown\n");
+  printf("                                   in place of lost video.\n");
+  printf("    --slate_delay <ms>             Time without a video frame\n");
+  printf("                                   before the slate shows.\n");
+  printf("                                   Default is 1000.\n");
+  printf("    --stop_timeout <ms>            Give up on final chunks and\n");
+  printf("                                   uploads still pending this\n");
+  printf("                                   long after a stop, and log\n");
+  printf("                                   them. Default is 0, no limit.\n");
+  printf("    --video_queue <policy>         Full raw frame queue policy:\n");
+  printf("                                   reject (the new frame, the\n");
+  printf("                                   default), drop_oldest, or\n");
+  printf("                                   latest (keep only the newest).\n");
+  printf("    --video_queue_max_age <ms>     Drop queued frames this much\n");
+  printf("                                   older than the newest frame.\n");
+  printf("                                   Default is 0, off.\n");
+  printf("    --audio_deadline <ms>          Degrade video while captured\n");
+  printf("                                   audio waits longer than this\n");
+  printf("                                   to be muxed. Default is 0,\n");
+  printf("                                   off.\n");
+  printf("    --capture_cpus <list>          Pin video capture threads to\n");
+  printf("                                   CPUs, e.g. 0-3,8.\n");
+  printf("    --audio_cpus <list>            Pin audio capture threads.\n");
+  printf("    --encode_cpus <list>           Pin encode and mux threads.\n");
+  printf("    --upload_cpus <list>           Pin upload and output\n");
+  printf("                                   threads.\n");
+  printf("    --realtime_capture             Run audio and video capture\n");
+  printf("                                   threads at real time\n");
+  printf("                                   priority.\n");
+  printf("    --numa_node <node>             Allocate raw frames on this\n");
+  printf("                                   NUMA node.\n");
+  printf("    --slice_threads <n>            Split conversion and scaling\n");
+  printf("                                   of 1440p and larger frames\n");
+  printf("                                   among n helper threads; 0\n");
+  printf("                                   uses all hardware threads.\n");
+  printf("  HTTP origin options:\n");
+  printf("    Serves the MPD and recent chunks to players over HTTP from\n");
+  printf("    memory. Enabled when --origin_port is present.\n");
+  printf("    --origin_port <port>           TCP port to listen on.\n");
+  printf("    --origin_bind <address>        IPv4 address to listen on.\n");
+  printf("                                   Default is all interfaces.\n");
+  printf("    --origin_window <seconds>      Media time kept in memory.\n");
+  printf("                                   Default is the time shift\n");
+  printf("                                   buffer depth, or 60.\n");
+  printf("    --origin_memory_mb <MB>        Memory the kept chunks may\n");
+  printf("                                   use. Default is 256.\n");
+  printf("    --origin_clients <count>       Connections served at once.\n");
+  printf("                                   Default is 16.\n");
+  printf("    --origin_dvr_dir <dir>         Move segments evicted from\n");
+  printf("                                   memory to this directory, and\n");
+  printf("                                   serve them from it. Directory\n");
+  printf("                                   must exist.\n");
+  printf("    --origin_dvr_disk_mb <MB>      Disk the moved segments may\n");
+  printf("                                   use. Default is 4096.\n");
+  printf("    --origin_dvr_store <url>       PUT the oldest segments on\n");
+  printf("                                   disk to an object store, at\n");
+  printf("                                   this URL template, signed as\n");
+  printf("                                   set by --aws_sigv4.\n");
+  printf("    --origin_dvr_store_read <url>  URL template players are\n");
+  printf("                                   redirected to for segments in\n");
+  printf("                                   the object store. Default is\n");
+  printf("                                   the --origin_dvr_store URL.\n");
+  printf("    With --low_latency_upload, chunks still being muxed are\n");
+  printf("    served using chunked transfer encoding as they grow.\n");
+  printf("  SRT output options:\n");
+  printf("    Streams the muxed WebM stream over SRT in live mode, for\n");
+  printf("    sub-second contribution links. Enabled when --srt_port is\n");
+  printf("    present; needs a build with WEBMLIVE_ENABLE_SRT. With --dash,\n");
+  printf("    --dash_muxed_output is implied. Use --low_latency_upload to\n");
+  printf("    send clusters as they are muxed.\n");
+  printf("    --srt_port <port>              UDP port of the receiver, or\n");
+  printf("                                   to listen on.\n");
+  printf("    --srt_host <host>              Receiver to connect to.\n");
+  printf("                                   Default is to listen for one.\n");
+  printf("    --srt_latency <ms>             Time allowed to recover lost\n");
+  printf("                                   packets. Default is 120.\n");
+  printf("    --srt_overhead <percent>       Bandwidth allowed for\n");
+  printf("                                   retransmissions, 5 to 100.\n");
+  printf("                                   Default is 25.\n");
+  printf("    --srt_passphrase <phrase>      Encrypts the stream.\n");
+  printf("    --srt_stream_id <id>           Stream id sent to the\n");
+  printf("                                   receiver.\n");
+  printf("  WHIP output options:\n");
+  printf("    Publishes VP8 or VP9 video and Opus audio to an SFU over\n");
+  printf("    WebRTC, straight from the encoders, for interactive\n");
+  printf("    latency. Enabled when --whip_url is present; needs a build\n");
+  printf("    with WEBMLIVE_ENABLE_WHIP, and --audio_codec opus or\n");
+  printf("    --adisable. Combine with --vpx_profile ull,\n");
+  printf("    --vpx_intra_refresh and --vpx_temporal_layers so that\n");
+  printf("    losses heal without keyframes and the SFU can drop layers.\n");
+  printf("    --whip_url <url>               WHIP endpoint of the SFU.\n");
+  printf("    --whip_token <token>           Bearer token of the endpoint.\n");
+  printf("    --whip_ice_server <url>        STUN or TURN server, as\n");
+  printf("                                   stun:host:port or\n");
+  printf("                                   turn:user:pass@host:port.\n");
+  printf("                                   May be repeated.\n");
+  printf("    --whip_pacing <percent>        Pacing rate in percent of the\n");
+  printf("                                   stream bitrate. Default is\n");
+  printf("                                   250.\n");
+  printf("    --whip_max_queue <ms>          Longest time video waits to\n");
+  printf("                                   be sent before it is dropped\n");
+  printf("                                   for a keyframe. Default is\n");
+  printf("                                   300.\n");
+  printf("  Stream push options:\n");
+  printf("    Pushes the muxed WebM stream over one long-lived connection,\n");
+  printf("    for browser monitoring through a relay. Enabled when\n");
+  printf("    --stream_url is present. With --dash, --dash_muxed_output is\n");
+  printf("    implied. Use --low_latency_upload to push clusters as they\n");
+  printf("    are muxed. Each connection starts with the stream header.\n");
+  printf("    --stream_url <url>             ws://host[:port]/path opens a\n");
+  printf("                                   WebSocket; http:// URLs get\n");
+  printf("                                   one chunked POST.\n");
+  printf("    --stream_max_buffered <bytes>  Bytes queued behind the\n");
+  printf("                                   connection before writes are\n");
+  printf("                                   held back. Default is 4 MB.\n");
+  printf("    --stream_send_buffer <bytes>   Socket send buffer size.\n");
+  printf("                                   Default is the system's.\n");
   printf("  Audio source configuration options:\n");
   printf("    --adisable                     Disable audio capture.\n");
   printf("    --amanual                      Attempt manual configuration.\n");
   printf("    --achannels <channels>         Number of audio channels.\n");
   printf("    --arate <sample rate>          Audio sample rate.\n");
   printf("    --asize <sample size>          Audio bits per sample.\n");
+  printf("    --awasapi                      Capture audio through WASAPI\n");
+  printf("                                   in 10 ms periods (Windows).\n");
+  printf("                                   --adevidx counts WASAPI\n");
+  printf("                                   endpoints.\n");
+  printf("    --awasapi_exclusive            Use WASAPI exclusive mode.\n");
+  printf("                                   Implies --awasapi.\n");
+  printf("    --abuffer_ms <ms>              DirectShow capture buffer\n");
+  printf("                                   length. Default is 20. 0\n");
+  printf("                                   uses the device default.\n");
+  printf("    --abuffer_count <count>        DirectShow capture buffers.\n");
+  printf("                                   Default is 8.\n");
+  printf("    --adrift                       Resample audio to follow the\n");
+  printf("                                   capture clock, so that A/V\n");
+  printf("                                   sync holds in long streams.\n");
+  printf("    --aencode_rate <rate>          Encode audio at this sample\n");
+  printf("                                   rate, e.g. 48000, resampling\n");
+  printf("                                   the capture rate.\n");
+  printf("    --alang <language>             Language of the audio track,\n");
+  printf("                                   e.g. en, for the manifest.\n");
+  printf("    --aextra <device>              Capture and encode another\n");
+  printf("                                   audio track from this device,\n");
+  printf("                                   in its own DASH adaptation\n");
+  printf("                                   set. May be repeated.\n");
+  printf("    --aextra_lang <language>       Language of the last --aextra\n");
+  printf("                                   track.\n");
+  printf("    --amix <device>                Mix audio from this device\n");
+  printf("                                   into the audio track. May be\n");
+  printf("                                   repeated. Linux and Vorbis\n");
+  printf("                                   only.\n");
+  printf("    --amix_gain <dB>               Gain of the last --amix input,\n");
+  printf("                                   or of the main device when\n");
+  printf("                                   given before any. Default 0.\n");
   printf("  Vorbis encoder options:\n");
   printf("    --vorbis_bitrate <kbps>            Average bitrate.\n");
   printf("    --vorbis_minimum_bitrate <kbps>    Minimum bitrate.\n");
@@ -115,6 +881,26 @@ void usage(const char** argv) {
   printf("                                       bitrate.\n");
   printf("    --vorbis_iblock_bias <-15.0-0.0>   Impulse block bias.\n");
   printf("    --vorbis_lowpass_frequency <2-99>  Hard-low pass frequency.\n");
+  printf("    --vorbis_skip_silence              Send digital silence as\n");
+  printf("                                       copies of one silent\n");
+  printf("                                       packet, without libvorbis\n");
+  printf("                                       analysis.\n");
+  printf("  Opus encoder options:\n");
+  printf("    --audio_codec <vorbis|opus>        Default vorbis. Opus\n");
+  printf("                                       requires capture at 8, 12,\n");
+  printf("                                       16, 24 or 48 kHz.\n");
+  printf("    --opus_bitrate <kbps>              Target bitrate.\n");
+  printf("    --opus_frame_duration <10|20>      Frame duration in ms.\n");
+  printf("    --opus_frames_per_packet <count>   Frames in each packet and\n");
+  printf("                                       WebM block. Default 1, up\n");
+  printf("                                       to 120 ms per packet.\n");
+  printf("    --opus_complexity <0-10>           Encoder complexity.\n");
+  printf("    --opus_low_delay                   Use the restricted low\n");
+  printf("                                       delay mode.\n");
+  printf("    --opus_dtx                         Enable discontinuous\n");
+  printf("                                       transmission, and skip\n");
+  printf("                                       libopus for digital\n");
+  printf("                                       silence.\n");
   printf("  Video source configuration options:\n");
   printf("    --vdisable                         Disable video capture.\n");
   printf("    --vmanual                          Attempt manual\n");
@@ -122,10 +908,63 @@ void usage(const char** argv) {
   printf("    --vwidth <width>                   Width in pixels.\n");
   printf("    --vheight <height>                 Height in pixels.\n");
   printf("    --vframe_rate <width>              Frames per second.\n");
+  printf("    --vmax_frame_rate <fps>            Drops captured frames\n");
+  printf("                                       beyond this rate.\n");
+  printf("    --vsmooth_timestamps               Locks frame times to the\n");
+  printf("                                       frame rate, removing\n");
+  printf("                                       capture jitter.\n");
   printf("  VPx encoder options:\n");
   printf("    --vpx_bitrate <kbps>               Video bitrate.\n");
-  printf("    --vpx_codec <codec>                Video codec, vp8 or vp9.\n");
+  printf("    --vpx_width <width>                Encoded width in pixels.\n");
+  printf("                                       Video is scaled when this\n");
+  printf("                                       differs from the capture\n");
+  printf("                                       width.\n");
+  printf("    --vpx_height <height>              Encoded height in pixels.\n");
+  printf("    --vpx_codec <codec>                Video codec, vp8, vp9 or\n");
+  printf("                                       av1. av1 needs libaom.\n");
   printf("                                       The default codec is vp8.\n");
+  printf("    --video_passthrough                Muxes frames the camera\n");
+  printf("                                       compresses in the\n");
+  printf("                                       --vpx_codec format without\n");
+  printf("                                       encoding them.\n");
+  printf("    --vpx_backend <backend>            Video encoder: libvpx,\n");
+  printf("                                       hardware, or auto to use\n");
+  printf("                                       hardware when available.\n");
+  printf("                                       Hardware supports only\n");
+  printf("                                       vp9. Default is libvpx.\n");
+  printf("    --vpx_profile <profile>            Encode profile: default,\n");
+  printf("                                       ull (ultra low latency\n");
+  printf("                                       realtime CBR), broadcast\n");
+  printf("                                       (lookahead, alt-ref and\n");
+  printf("                                       VBR, for deep player\n");
+  printf("                                       buffers), or\n");
+  printf("                                       capped_quality (realtime\n");
+  printf("                                       constrained quality with\n");
+  printf("                                       the bitrate as a cap).\n");
+  printf("    --vpx_cq_level <0-63>              Constrained quality level\n");
+  printf("                                       for the broadcast and\n");
+  printf("                                       capped_quality profiles.\n");
+  printf("                                       Default 32 for\n");
+  printf("                                       capped_quality.\n");
+  printf("    --vpx_scene_cut_keyframes          Adds keyframes at scene\n");
+  printf("                                       cuts.\n");
+  printf("    --vpx_frame_analysis               Analyzes each frame once\n");
+  printf("                                       for every representation:\n");
+  printf("                                       scene cuts, motion and\n");
+  printf("                                       changed regions.\n");
+  printf("    --vpx_skip_static_frames           Skips frames repeating\n");
+  printf("                                       the last frame encoded.\n");
+  printf("    --vpx_intra_refresh                Cyclic refresh instead of\n");
+  printf("                                       periodic keyframes, which\n");
+  printf("                                       only start DASH segments.\n");
+  printf("    --vpx_adaptive_speed               Raises the speed while\n");
+  printf("                                       encoding falls behind.\n");
+  printf("    --vpx_quality_probe <frames>       Measures PSNR and SSIM of\n");
+  printf("                                       every Nth encoded frame\n");
+  printf("                                       into the metrics.\n");
+  printf("    --vpx_bit_depth <8|10>             Bits per sample. 10 encodes\n");
+  printf("                                       VP9 profile 2 from V210\n");
+  printf("                                       capture.\n");
   printf("    --vpx_decimate <decimate factor>   FPS reduction factor.\n");
   printf("    --vpx_keyframe_interval <milliseconds>  Time between\n");
   printf("                                            keyframes.\n");
@@ -137,6 +976,8 @@ void usage(const char** argv) {
   printf("    --vpx_static_threshold <threshold> Static threshold.\n");
   printf("    --vpx_speed <speed value>          Speed.\n");
   printf("    --vpx_threads <num threads>        Number of encode threads.\n");
+  printf("                                       Derived from the core\n");
+  printf("                                       count by default.\n");
   printf("    --vpx_overshoot <percent>          Overshoot percentage.\n");
   printf("    --vpx_undershoot <percent>         Undershoot percentage.\n");
   printf("    --vpx_max_buffer <length>          Client buffer length (ms).\n");
@@ -145,6 +986,15 @@ void usage(const char** argv) {
   printf("    --vpx_max_kf_bitrate <percent>     Max keyframe bitrate.\n");
   printf("    --vpx_sharpness <0-7>              Loop filter sharpness.\n");
   printf("    --vpx_error_resilience             Enables error resilience.\n");
+  printf("    --vpx_temporal_layers <1-3>        Temporal layers. Frames\n");
+  printf("                                       above layer 0 can be\n");
+  printf("                                       dropped by relays.\n");
+  printf("    --vpx_lag_in_frames <frames>       Lookahead, which adds\n");
+  printf("                                       latency but enables\n");
+  printf("                                       alt-ref frames.\n");
+  printf("    --vpx_screen_content <0|1>         Screen content tuning.\n");
+  printf("                                       Default is on with\n");
+  printf("                                       --vdesktop.\n");
   printf("  VP8 specific encoder options:\n");
   printf("    --vp8_token_partitions <0-3>       Number of token\n");
   printf("                                       partitions.\n");
@@ -167,6 +1017,9 @@ void usage(const char** argv) {
   printf("                                       Image size controls max\n");
   printf("                                       tile count; min tile width\n");
   printf("                                       is 256 while max is 4096\n");
+  printf("                                       Derived from the width and\n");
+  printf("                                       threads by default.\n");
+  printf("    --vp9_row_mt <0-1>                 Row based multithreading.\n");
   printf("    --vp9_disable_fpd                  Disables frame parallel\n");
   printf("                                       decoding.\n");
 }
@@ -206,6 +1059,36 @@ bool arg_has_value(int arg_index, int argc, const char** argv) {
   return has_value;
 }
 
+// Decodes the hexadecimal string |hex| into |ptr_bytes|. Returns false when
+// |hex| is empty, has an odd length, or holds a non-hex character.
+bool parse_hex(const char* hex, std::string* ptr_bytes) {
+  const size_t length = strlen(hex);
+  if (length == 0 || length % 2 != 0)
+    return false;
+  std::string bytes;
+  for (size_t i = 0; i < length; i += 2) {
+    if (!isxdigit(static_cast<unsigned char>(hex[i])) ||
+        !isxdigit(static_cast<unsigned char>(hex[i + 1]))) {
+      return false;
+    }
+    const char digits[3] = {hex[i], hex[i + 1], '\0'};
+    bytes += static_cast<char>(strtol(digits, NULL, 16));
+  }
+  ptr_bytes->swap(bytes);
+  return true;
+}
+
+// Restricts threads of |stage| to the CPUs in |cpu_list|.
+void set_stage_cpus(webmlive::ThreadPlacement::Stage stage,
+                    const char* cpu_list) {
+  std::vector<int> cpus;
+  if (webmlive::ThreadPlacement::ParseCpuList(cpu_list, &cpus)) {
+    LOG(ERROR) << "Ignoring invalid CPU list: " << cpu_list;
+    return;
+  }
+  webmlive::ThreadPlacement::Instance().SetCpus(stage, cpus);
+}
+
 // Parses command line and stores user settings.
 void parse_command_line(int argc, const char** argv,
                         WebmEncoderClientConfig& config) {
@@ -220,6 +1103,16 @@ void parse_command_line(int argc, const char** argv,
       usage(argv);
       exit(EXIT_SUCCESS);
     }
+    if (!strcmp("--archive_recover", argv[i]) &&
+        arg_has_value(i, argc, argv)) {
+      const char* const archive = argv[++i];
+      if (webmlive::WebmArchiveWriter::Recover(archive)) {
+        fprintf(stderr, "Cannot recover %s.\n", archive);
+        exit(EXIT_FAILURE);
+      }
+      printf("Recovered %s.\n", archive);
+      exit(EXIT_SUCCESS);
+    }
 
     //
     // DASH encoder options.
@@ -238,6 +1131,83 @@ void parse_command_line(int argc, const char** argv,
     } else if (!strcmp("--dash_start_number", argv[i]) &&
                arg_has_value(i, argc, argv)) {
       enc_config.dash_start_number = argv[++i];
+    } else if (!strcmp("--dash_dynamic", argv[i])) {
+      enc_config.dash_dynamic = true;
+    } else if (!strcmp("--dash_publish_early", argv[i])) {
+      enc_config.publish_headers_early = true;
+    } else if (!strcmp("--dash_svc", argv[i])) {
+      enc_config.video_svc = true;
+    } else if (!strcmp("--dash_muxed_output", argv[i])) {
+      enc_config.dash_muxed_output = true;
+    } else if (!strcmp("--dash_vod_manifest", argv[i])) {
+      enc_config.dash_vod_manifest = true;
+    } else if (!strcmp("--dash_vod_webm", argv[i])) {
+      config.vod_webm = true;
+      enc_config.dash_muxed_output = true;
+      enc_config.cluster_index = true;
+    } else if (!strcmp("--dash_time_shift_buffer_depth", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.dash_time_shift_buffer_depth = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--dash_bandwidth_window", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.dash_bandwidth_window = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--dash_patch_interval", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.dash_patch_interval = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--dash_rep", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      const char* const rep_value = argv[++i];
+      webmlive::VideoRepresentationConfig rep;
+      char codec[16] = {0};
+      const int num_fields = sscanf(rep_value, "%dx%d:%d:%15s", &rep.width,
+                                    &rep.height, &rep.bitrate, codec);
+      if (num_fields == 4 && kCodecVp8 == codec) {
+        rep.codec = webmlive::kVideoFormatVP8;
+      } else if (num_fields == 4 && kCodecVp9 == codec) {
+        rep.codec = webmlive::kVideoFormatVP9;
+      } else if (num_fields == 4 && kCodecAv1 == codec) {
+        rep.codec = webmlive::kVideoFormatAV1;
+      }
+      if (num_fields == 3 ||
+          (num_fields == 4 && rep.codec != webmlive::kVideoFormatI420)) {
+        enc_config.video_representations.push_back(rep);
+      } else {
+        LOG(ERROR) << "Invalid --dash_rep value: " << rep_value;
+      }
+    } else if (!strcmp("--dash_arep", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      const char* const rep_value = argv[++i];
+      webmlive::AudioRepresentationConfig rep;
+      char codec[16] = {0};
+      if (sscanf(rep_value, "%15[^:]:%d", codec, &rep.bitrate) == 2 &&
+          (kCodecVorbis == codec || kCodecOpus == codec)) {
+        rep.codec = kCodecOpus == codec ?
+            webmlive::kAudioFormatOpus : webmlive::kAudioFormatVorbis;
+        enc_config.audio_representations.push_back(rep);
+      } else {
+        LOG(ERROR) << "Invalid --dash_arep value: " << rep_value;
+      }
+    } else if (!strcmp("--thumbnail_interval", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.thumbnails.frame_interval = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--thumbnail_size", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      const char* const size_value = argv[++i];
+      if (sscanf(size_value, "%dx%d", &enc_config.thumbnails.width,
+                 &enc_config.thumbnails.height) != 2) {
+        LOG(ERROR) << "Invalid --thumbnail_size value: " << size_value;
+      }
+    } else if (!strcmp("--thumbnail_sprite", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      const char* const sprite_value = argv[++i];
+      if (sscanf(sprite_value, "%dx%d",
+                 &enc_config.thumbnails.sprite_columns,
+                 &enc_config.thumbnails.sprite_rows) != 2) {
+        LOG(ERROR) << "Invalid --thumbnail_sprite value: " << sprite_value;
+      }
+    } else if (!strcmp("--thumbnail_quality", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.thumbnails.quality = strtol(argv[++i], NULL, 10);
     }
 
     //
@@ -245,6 +1215,13 @@ void parse_command_line(int argc, const char** argv,
     //
     else if (!strcmp("--url", argv[i]) && arg_has_value(i, argc, argv)) {
       config.target_url = argv[++i];
+    } else if (!strcmp("--write_files", argv[i])) {
+      config.write_files = true;
+    } else if (!strcmp("--file_sync_interval", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.file_sync_interval_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--dash_retention", argv[i])) {
+      config.file_retention = true;
     } else if (!strcmp("--header", argv[i]) && arg_has_value(i, argc, argv)) {
       unparsed_headers.push_back(argv[++i]);
     } else if (!strcmp("--form_post", argv[i]) &&
@@ -258,6 +1235,370 @@ void parse_command_line(int argc, const char** argv,
     } else if (!strcmp("--stream_id", argv[i]) &&
                arg_has_value(i, argc, argv)) {
       uploader_settings.stream_id = argv[++i];
+    } else if (!strcmp("--max_uploads", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      uploader_settings.max_concurrent_uploads = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--max_pending_uploads", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      uploader_settings.max_pending_uploads = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--http2", argv[i])) {
+      uploader_settings.enable_http2 = true;
+    } else if (!strcmp("--http3", argv[i])) {
+      uploader_settings.enable_http3 = true;
+    } else if (!strcmp("--upload_retries", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      uploader_settings.max_upload_retries = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--upload_deadline", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      uploader_settings.chunk_deadline_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--resume_uploads", argv[i])) {
+      uploader_settings.resume_uploads = true;
+    } else if (!strcmp("--upload_pacing", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.pacing_headroom = strtod(argv[++i], NULL);
+    } else if (!strcmp("--upload_live_window", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.live_window_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--upload_spool", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      std::string& spool_directory = uploader_settings.spool_directory;
+      spool_directory = argv[++i];
+      if (!spool_directory.empty() &&
+          spool_directory.back() != '/' && spool_directory.back() != '\\') {
+        spool_directory.append("/");
+      }
+    } else if (!strcmp("--upload_spool_size", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      uploader_settings.spool_max_bytes =
+          strtol(argv[++i], NULL, 10) * 1024LL * 1024LL;
+    } else if (!strcmp("--catch_up_kbps", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      uploader_settings.catch_up_kbps = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--gzip_manifests", argv[i])) {
+      uploader_settings.gzip_manifests = true;
+    } else if (!strcmp("--object_store", argv[i])) {
+      uploader_settings.post_mode = webmlive::HTTP_PUT;
+    } else if (!strcmp("--aws_sigv4", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      uploader_settings.aws_sigv4 = argv[++i];
+    } else if (!strcmp("--aws_credentials", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      uploader_settings.aws_credentials = argv[++i];
+    } else if (!strcmp("--multipart_threshold", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      uploader_settings.multipart_threshold_bytes =
+          strtol(argv[++i], NULL, 10) * 1024LL * 1024LL;
+    } else if (!strcmp("--multipart_part_size", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      uploader_settings.multipart_part_bytes =
+          strtol(argv[++i], NULL, 10) * 1024LL * 1024LL;
+    } else if (!strcmp("--coalesce_uploads", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      uploader_settings.coalesce_max_bytes =
+          strtol(argv[++i], NULL, 10) * 1024;
+    } else if (!strcmp("--coalesce_max_chunks", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      uploader_settings.coalesce_max_objects = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--adaptive_bitrate", argv[i])) {
+      config.adaptive_bitrate = true;
+    } else if (!strcmp("--min_vpx_bitrate", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.min_video_kbps = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--ladder_pruning", argv[i])) {
+      config.ladder_pruning = true;
+    } else if (!strcmp("--low_latency_upload", argv[i])) {
+      enc_config.low_latency_upload = true;
+    } else if (!strcmp("--cluster_index", argv[i])) {
+      enc_config.cluster_index = true;
+    } else if (!strcmp("--native_clusters", argv[i])) {
+      enc_config.native_clusters = true;
+    } else if ((!strcmp("--encryption_key", argv[i]) ||
+                !strcmp("--encryption_key_id", argv[i])) &&
+               arg_has_value(i, argc, argv)) {
+      std::string* const ptr_value = !strcmp("--encryption_key", argv[i]) ?
+          &enc_config.encryption_key : &enc_config.encryption_key_id;
+      if (!parse_hex(argv[i + 1], ptr_value)) {
+        fprintf(stderr, "Invalid hex value for %s.\n", argv[i]);
+        exit(EXIT_FAILURE);
+      }
+      ++i;
+    } else if (!strcmp("--archive", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.archive_path = argv[++i];
+    } else if (!strcmp("--archive_mmap", argv[i])) {
+      enc_config.archive_memory_mapped = true;
+    } else if (!strcmp("--latency_trace", argv[i])) {
+      enc_config.latency_trace = true;
+    } else if (!strcmp("--rate_control_telemetry", argv[i])) {
+      config.rate_control_telemetry = true;
+    } else if (!strcmp("--trace_level", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.trace_level = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--async_log", argv[i])) {
+      config.async_log = true;
+    } else if (!strcmp("--pool_memory_budget_mb", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.pool_memory_budget_mb = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--memory_limit", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.memory_limit_mb = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--stream_memory_limit", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.stream_memory_limit_mb = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--host_config", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.host_config = argv[++i];
+    } else if (!strcmp("--host_cpus", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.host_cpus = strtod(argv[++i], NULL);
+    } else if (!strcmp("--host_cpu_headroom", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.host_cpu_headroom = strtod(argv[++i], NULL);
+    } else if (!strcmp("--metrics_file", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.metrics_file = argv[++i];
+    } else if (!strcmp("--metrics_interval", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.metrics_interval = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--control_port", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.control = true;
+      config.control_settings.port = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--encoder_pool", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.encoder_pool_settings.contexts_per_profile =
+          strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--encoder_pool_profile", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      const char* const profile_value = argv[++i];
+      EncoderPoolProfile profile;
+      char codec[16] = {0};
+      if (sscanf(profile_value, "%15[^:]:%dx%d:%d", codec, &profile.width,
+                 &profile.height, &profile.speed) == 4 &&
+          (kCodecVp8 == codec || kCodecVp9 == codec) && profile.width > 0 &&
+          profile.height > 0) {
+        profile.codec = kCodecVp9 == codec ? webmlive::kVideoFormatVP9 :
+                                             webmlive::kVideoFormatVP8;
+        config.encoder_pool_profiles.push_back(profile);
+      } else {
+        LOG(ERROR) << "Invalid --encoder_pool_profile value: "
+                   << profile_value;
+      }
+    } else if (!strcmp("--calibrate", argv[i])) {
+      config.calibrate = true;
+    } else if (!strcmp("--calibration_cache", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.calibration_cache = argv[++i];
+    } else if (!strcmp("--calibration_headroom", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.calibration_headroom = strtod(argv[++i], NULL);
+    } else if (!strcmp("--cluster_duration", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.cluster_duration = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--chunk_max_bytes", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.chunk_byte_budget = strtoll(argv[++i], NULL, 10);
+    } else if (!strcmp("--fast_start", argv[i])) {
+      enc_config.fast_start = true;
+    } else if (!strcmp("--capture_stall_timeout", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.capture_stall_timeout_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--slate", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.slate_file = argv[++i];
+    } else if (!strcmp("--slate_delay", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.slate_delay_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--stop_timeout", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.stop_timeout_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--video_queue", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      std::string queue_value = argv[++i];
+      if (queue_value == kQueueReject)
+        enc_config.video_queue_policy = webmlive::kPoolRejectNewest;
+      else if (queue_value == kQueueDropOldest)
+        enc_config.video_queue_policy = webmlive::kPoolDropOldest;
+      else if (queue_value == kQueueLatest)
+        enc_config.video_queue_policy = webmlive::kPoolKeepLatest;
+      else
+        LOG(ERROR) << "Invalid --video_queue value: " << queue_value;
+    } else if (!strcmp("--video_queue_max_age", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.video_queue_max_age_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--audio_deadline", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.audio_deadline_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--capture_cpus", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      set_stage_cpus(webmlive::ThreadPlacement::kCapture, argv[++i]);
+    } else if (!strcmp("--audio_cpus", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      set_stage_cpus(webmlive::ThreadPlacement::kAudioCapture, argv[++i]);
+    } else if (!strcmp("--encode_cpus", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      set_stage_cpus(webmlive::ThreadPlacement::kEncode, argv[i + 1]);
+      set_stage_cpus(webmlive::ThreadPlacement::kVideoEncode, argv[++i]);
+    } else if (!strcmp("--upload_cpus", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      set_stage_cpus(webmlive::ThreadPlacement::kUpload, argv[++i]);
+    } else if (!strcmp("--realtime_capture", argv[i])) {
+      webmlive::ThreadPlacement& placement =
+          webmlive::ThreadPlacement::Instance();
+      placement.SetRealtime(webmlive::ThreadPlacement::kCapture, true);
+      placement.SetRealtime(webmlive::ThreadPlacement::kAudioCapture, true);
+    } else if (!strcmp("--numa_node", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      webmlive::ThreadPlacement::Instance().SetNumaNode(
+          strtol(argv[++i], NULL, 10));
+    } else if (!strcmp("--slice_threads", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      if (webmlive::SlicePool::Instance().Init(strtol(argv[++i], NULL, 10))) {
+        LOG(ERROR) << "cannot start slice threads.";
+        exit(EXIT_FAILURE);
+      }
+    } else if (!strcmp("--input_video_file", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.input_video_file = argv[++i];
+    } else if (!strcmp("--input_audio_file", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.input_audio_file = argv[++i];
+    } else if (!strcmp("--input_unpaced", argv[i])) {
+      enc_config.input_paced = false;
+    } else if (!strcmp("--input_shared_memory", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.input_shared_memory = argv[++i];
+    } else if (!strcmp("--standby_heartbeat", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.standby_heartbeat = argv[++i];
+    } else if (!strcmp("--standby", argv[i])) {
+      enc_config.standby = true;
+    } else if (!strcmp("--standby_timeout", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.standby_timeout_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--input_capture_trace", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.input_capture_trace = argv[++i];
+    } else if (!strcmp("--input_synthetic", argv[i])) {
+      enc_config.input_synthetic = true;
+    } else if (!strcmp("--input_synthetic_duration", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.input_synthetic_duration_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--capture_trace", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.capture_trace_file = argv[++i];
+    } else if (!strcmp("--capture_trace_max_mb", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.capture_trace_max_mb = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--remux_input", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.remux_input = argv[++i];
+    }
+
+    //
+    // HTTP origin options.
+    //
+    else if (!strcmp("--origin_port", argv[i]) &&
+             arg_has_value(i, argc, argv)) {
+      config.serve = true;
+      config.origin_settings.port = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--origin_bind", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.origin_settings.bind_address = argv[++i];
+    } else if (!strcmp("--origin_window", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.origin_window_ms = strtol(argv[++i], NULL, 10) * 1000;
+    } else if (!strcmp("--origin_memory_mb", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.origin_settings.cache_settings.max_bytes =
+          strtol(argv[++i], NULL, 10) * 1024LL * 1024LL;
+    } else if (!strcmp("--origin_clients", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.origin_settings.max_clients = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--origin_dvr_dir", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      std::string& directory =
+          config.origin_settings.dvr_settings.disk_directory;
+      directory = argv[++i];
+      if (!directory.empty() && directory[directory.length() - 1] != '/' &&
+          directory[directory.length() - 1] != '\\') {
+        directory.append("/");
+      }
+    } else if (!strcmp("--origin_dvr_disk_mb", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.origin_settings.dvr_settings.disk_max_bytes =
+          strtol(argv[++i], NULL, 10) * 1024LL * 1024LL;
+    } else if (!strcmp("--origin_dvr_store", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      webmlive::HttpUploaderSettings& object_settings =
+          config.origin_settings.dvr_settings.object_settings;
+      object_settings.post_mode = webmlive::HTTP_PUT;
+      object_settings.url_template = argv[++i];
+    } else if (!strcmp("--origin_dvr_store_read", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.origin_settings.dvr_settings.object_read_url_template = argv[++i];
+    }
+
+    //
+    // SRT output options.
+    //
+    else if (!strcmp("--srt_port", argv[i]) &&
+             arg_has_value(i, argc, argv)) {
+      config.srt = true;
+      config.srt_settings.port = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--srt_host", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.srt_settings.host = argv[++i];
+    } else if (!strcmp("--srt_latency", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.srt_settings.latency_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--srt_overhead", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.srt_settings.overhead_percent = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--srt_passphrase", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.srt_settings.passphrase = argv[++i];
+    } else if (!strcmp("--srt_stream_id", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.srt_settings.stream_id = argv[++i];
+    }
+
+    //
+    // WHIP output options.
+    //
+    else if (!strcmp("--whip_url", argv[i]) &&
+             arg_has_value(i, argc, argv)) {
+      config.whip = true;
+      config.whip_settings.url = argv[++i];
+    } else if (!strcmp("--whip_token", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.whip_settings.bearer_token = argv[++i];
+    } else if (!strcmp("--whip_ice_server", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.whip_settings.ice_servers.push_back(argv[++i]);
+    } else if (!strcmp("--whip_pacing", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.whip_settings.pacing_percent = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--whip_max_queue", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.whip_settings.max_queue_delay_ms = strtol(argv[++i], NULL, 10);
+    }
+
+    //
+    // Stream push options.
+    //
+    else if (!strcmp("--stream_url", argv[i]) &&
+             arg_has_value(i, argc, argv)) {
+      config.push_stream = true;
+      config.stream_sink_settings.url = argv[++i];
+    } else if (!strcmp("--stream_max_buffered", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.stream_sink_settings.max_buffered_bytes =
+          strtoll(argv[++i], NULL, 10);
+    } else if (!strcmp("--stream_send_buffer", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.stream_sink_settings.send_buffer_bytes =
+          strtol(argv[++i], NULL, 10);
     }
 
     //
@@ -281,6 +1622,47 @@ void parse_command_line(int argc, const char** argv,
     } else if (!strcmp("--asize", argv[i]) && arg_has_value(i, argc, argv)) {
       enc_config.requested_audio_config.bits_per_sample =
           static_cast<uint16>(strtol(argv[++i], NULL, 10));
+    } else if (!strcmp("--awasapi", argv[i])) {
+      enc_config.audio_capture_wasapi = true;
+    } else if (!strcmp("--awasapi_exclusive", argv[i])) {
+      enc_config.audio_capture_wasapi = true;
+      enc_config.audio_wasapi_exclusive = true;
+    } else if (!strcmp("--abuffer_ms", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.audio_buffer_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--abuffer_count", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.audio_buffer_count = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--adrift", argv[i])) {
+      enc_config.audio_drift_correction = true;
+    } else if (!strcmp("--aencode_rate", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.audio_encode_sample_rate = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--alang", argv[i]) && arg_has_value(i, argc, argv)) {
+      enc_config.audio_language = argv[++i];
+    } else if (!strcmp("--aextra", argv[i]) && arg_has_value(i, argc, argv)) {
+      webmlive::AudioTrackConfig track;
+      track.device_name = argv[++i];
+      enc_config.extra_audio_tracks.push_back(track);
+    } else if (!strcmp("--aextra_lang", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      const char* const language = argv[++i];
+      if (enc_config.extra_audio_tracks.empty()) {
+        LOG(ERROR) << "--aextra_lang must follow --aextra.";
+      } else {
+        enc_config.extra_audio_tracks.back().language = language;
+      }
+    } else if (!strcmp("--amix", argv[i]) && arg_has_value(i, argc, argv)) {
+      webmlive::AudioMixInputConfig input;
+      input.device_name = argv[++i];
+      enc_config.audio_mix.inputs.push_back(input);
+    } else if (!strcmp("--amix_gain", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      const double gain_db = strtod(argv[++i], NULL);
+      if (enc_config.audio_mix.inputs.empty())
+        enc_config.audio_mix.main_gain_db = gain_db;
+      else
+        enc_config.audio_mix.inputs.back().gain_db = gain_db;
     }
 
     //
@@ -292,6 +1674,68 @@ void parse_command_line(int argc, const char** argv,
       enc_config.video_device_name = argv[++i];
     } else if (!strcmp("--vdevidx", argv[i]) && arg_has_value(i, argc, argv)) {
       enc_config.video_device_index = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vdesktop", argv[i])) {
+      enc_config.video_capture_desktop = true;
+    } else if (!strcmp("--vmf", argv[i])) {
+      enc_config.video_capture_media_foundation = true;
+    } else if (!strcmp("--vasync_convert", argv[i])) {
+      enc_config.video_async_conversion = true;
+    } else if (!strcmp("--vbuffer_count", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.video_buffer_count = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--pip_dev", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.pip.device_name = argv[++i];
+    } else if (!strcmp("--pip_rect", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      const char* const rect_value = argv[++i];
+      if (sscanf(rect_value, "%d,%d,%dx%d", &enc_config.pip.x,
+                 &enc_config.pip.y, &enc_config.pip.width,
+                 &enc_config.pip.height) != 4) {
+        LOG(ERROR) << "Invalid --pip_rect value: " << rect_value;
+      }
+    } else if (!strcmp("--pip_opacity", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.pip.opacity_percent = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--overlay_image", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.overlay.image_path = argv[++i];
+    } else if (!strcmp("--overlay_rect", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      const char* const rect_value = argv[++i];
+      if (sscanf(rect_value, "%d,%d,%dx%d", &enc_config.overlay.image_x,
+                 &enc_config.overlay.image_y, &enc_config.overlay.image_width,
+                 &enc_config.overlay.image_height) != 4) {
+        LOG(ERROR) << "Invalid --overlay_rect value: " << rect_value;
+      }
+    } else if (!strcmp("--timecode", argv[i])) {
+      enc_config.overlay.timecode = true;
+    } else if (!strcmp("--timecode_pos", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      const char* const pos_value = argv[++i];
+      if (sscanf(pos_value, "%d,%d", &enc_config.overlay.timecode_x,
+                 &enc_config.overlay.timecode_y) != 2) {
+        LOG(ERROR) << "Invalid --timecode_pos value: " << pos_value;
+      }
+    } else if (!strcmp("--timecode_scale", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.overlay.timecode_scale = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--latency_code", argv[i])) {
+      enc_config.overlay.latency_code = true;
+    } else if (!strcmp("--deinterlace", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      std::string deinterlace_value = argv[++i];
+      if (deinterlace_value == kDeinterlaceFrame)
+        enc_config.deinterlace.mode = webmlive::DeinterlaceConfig::kFrameRate;
+      else if (deinterlace_value == kDeinterlaceField)
+        enc_config.deinterlace.mode = webmlive::DeinterlaceConfig::kFieldRate;
+      else
+        LOG(ERROR) << "Invalid --deinterlace value: " << deinterlace_value;
+    } else if (!strcmp("--bottom_field_first", argv[i])) {
+      enc_config.deinterlace.top_field_first = false;
+    } else if (!strcmp("--vmf_cpu", argv[i])) {
+      enc_config.video_capture_media_foundation = true;
+      enc_config.video_mf_disable_gpu = true;
     } else if (!strcmp("--vmanual", argv[i])) {
       enc_config.ui_opts.manual_video_config = true;
     } else if (!strcmp("--vwidth", argv[i]) && arg_has_value(i, argc, argv)) {
@@ -301,6 +1745,11 @@ void parse_command_line(int argc, const char** argv,
     } else if (!strcmp("--vframe_rate", argv[i]) &&
                arg_has_value(i, argc, argv)) {
       enc_config.requested_video_config.frame_rate = strtod(argv[++i], NULL);
+    } else if (!strcmp("--vmax_frame_rate", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.max_video_frame_rate = strtod(argv[++i], NULL);
+    } else if (!strcmp("--vsmooth_timestamps", argv[i])) {
+      enc_config.video_timestamp_smoothing = true;
     }
 
     //
@@ -323,6 +1772,38 @@ void parse_command_line(int argc, const char** argv,
     } else if (!strcmp("--vorbis_lowpass_frequency", argv[i]) &&
                arg_has_value(i, argc, argv)) {
       enc_config.vorbis_config.lowpass_frequency = strtod(argv[++i], NULL);
+    } else if (!strcmp("--vorbis_skip_silence", argv[i])) {
+      enc_config.vorbis_config.skip_silence = true;
+    }
+
+    //
+    // Opus encoder options.
+    //
+    else if (!strcmp("--audio_codec", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      std::string audio_codec_value = argv[++i];
+      if (audio_codec_value == kCodecOpus)
+        enc_config.audio_codec = webmlive::kAudioFormatOpus;
+      else if (audio_codec_value == kCodecVorbis)
+        enc_config.audio_codec = webmlive::kAudioFormatVorbis;
+      else
+        LOG(ERROR) << "Invalid --audio_codec value: " << audio_codec_value;
+    } else if (!strcmp("--opus_bitrate", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.opus_config.bitrate = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--opus_frame_duration", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.opus_config.frame_duration = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--opus_frames_per_packet", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.opus_config.frames_per_packet = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--opus_complexity", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.opus_config.complexity = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--opus_low_delay", argv[i])) {
+      enc_config.opus_config.low_delay = true;
+    } else if (!strcmp("--opus_dtx", argv[i])) {
+      enc_config.opus_config.dtx = true;
     }
 
     //
@@ -333,6 +1814,12 @@ void parse_command_line(int argc, const char** argv,
     } else if (!strcmp("--vpx_bitrate", argv[i]) &&
                arg_has_value(i, argc, argv)) {
       enc_config.vpx_config.bitrate = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vpx_width", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.output_video_width = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vpx_height", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.output_video_height = strtol(argv[++i], NULL, 10);
     } else if (!strcmp("--vpx_codec", argv[i]) &&
                arg_has_value(i, argc, argv)) {
       std::string vpx_codec_value = argv[++i];
@@ -340,8 +1827,60 @@ void parse_command_line(int argc, const char** argv,
         enc_config.vpx_config.codec = webmlive::kVideoFormatVP8;
       else if (vpx_codec_value == kCodecVp9)
         enc_config.vpx_config.codec = webmlive::kVideoFormatVP9;
+      else if (vpx_codec_value == kCodecAv1)
+        enc_config.vpx_config.codec = webmlive::kVideoFormatAV1;
       else
         LOG(ERROR) << "Invalid --vpx_codec value: " << vpx_codec_value;
+    } else if (!strcmp("--video_passthrough", argv[i])) {
+      enc_config.video_passthrough = true;
+    } else if (!strcmp("--vpx_backend", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      std::string backend_value = argv[++i];
+      if (backend_value == kBackendLibvpx)
+        enc_config.vpx_config.backend = webmlive::kVideoEncoderBackendLibvpx;
+      else if (backend_value == kBackendHardware)
+        enc_config.vpx_config.backend =
+            webmlive::kVideoEncoderBackendHardware;
+      else if (backend_value == kBackendAuto)
+        enc_config.vpx_config.backend = webmlive::kVideoEncoderBackendAuto;
+      else
+        LOG(ERROR) << "Invalid --vpx_backend value: " << backend_value;
+    } else if (!strcmp("--vpx_profile", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      std::string profile_value = argv[++i];
+      if (profile_value == kProfileDefault)
+        enc_config.vpx_config.profile = webmlive::kVideoEncodeProfileDefault;
+      else if (profile_value == kProfileUltraLowLatency)
+        enc_config.vpx_config.profile =
+            webmlive::kVideoEncodeProfileUltraLowLatency;
+      else if (profile_value == kProfileBroadcast)
+        enc_config.vpx_config.profile =
+            webmlive::kVideoEncodeProfileBroadcast;
+      else if (profile_value == kProfileCappedQuality)
+        enc_config.vpx_config.profile =
+            webmlive::kVideoEncodeProfileCappedQuality;
+      else
+        LOG(ERROR) << "Invalid --vpx_profile value: " << profile_value;
+    } else if (!strcmp("--vpx_cq_level", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.vpx_config.cq_level = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vpx_scene_cut_keyframes", argv[i])) {
+      enc_config.vpx_config.scene_cut_keyframes = true;
+    } else if (!strcmp("--vpx_frame_analysis", argv[i])) {
+      enc_config.vpx_config.frame_analysis = true;
+    } else if (!strcmp("--vpx_skip_static_frames", argv[i])) {
+      enc_config.vpx_config.skip_static_frames = true;
+    } else if (!strcmp("--vpx_intra_refresh", argv[i])) {
+      enc_config.vpx_config.intra_refresh = true;
+    } else if (!strcmp("--vpx_adaptive_speed", argv[i])) {
+      enc_config.vpx_config.adaptive_speed = true;
+    } else if (!strcmp("--vpx_quality_probe", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.vpx_config.quality_probe_interval =
+          strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vpx_bit_depth", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.vpx_config.bit_depth = strtol(argv[++i], NULL, 10);
     } else if (!strcmp("--vpx_decimate", argv[i]) &&
                arg_has_value(i, argc, argv)) {
       enc_config.vpx_config.decimate = strtol(argv[++i], NULL, 10);
@@ -386,6 +1925,15 @@ void parse_command_line(int argc, const char** argv,
       enc_config.vpx_config.sharpness = strtol(argv[++i], NULL, 10);
     } else if (!strcmp("--vpx_error_resilience", argv[i])) {
       enc_config.vpx_config.error_resilient = true;
+    } else if (!strcmp("--vpx_temporal_layers", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.vpx_config.temporal_layers = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vpx_lag_in_frames", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.vpx_config.lag_in_frames = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vpx_screen_content", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.vpx_config.screen_content = strtol(argv[++i], NULL, 10);
     }
 
     //
@@ -409,6 +1957,9 @@ void parse_command_line(int argc, const char** argv,
     } else if (!strcmp("--vp9_tile_cols", argv[i]) &&
                arg_has_value(i, argc, argv)) {
       enc_config.vpx_config.tile_columns = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vp9_row_mt", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      enc_config.vpx_config.row_mt = strtol(argv[++i], NULL, 10);
     } else if (!strcmp("--vp9_disable_fpd", argv[i]) &&
                arg_has_value(i, argc, argv)) {
       enc_config.vpx_config.frame_parallel_mode = false;
@@ -422,17 +1973,86 @@ void parse_command_line(int argc, const char** argv,
 
   // Store user form variables.
   store_string_map_entries(unparsed_vars, uploader_settings.form_variables);
+
+  // Keep the secret key off the command line when the environment holds it.
+  const char* const access_key_id = getenv("AWS_ACCESS_KEY_ID");
+  const char* const secret_access_key = getenv("AWS_SECRET_ACCESS_KEY");
+  if (!uploader_settings.aws_sigv4.empty() &&
+      uploader_settings.aws_credentials.empty() && access_key_id &&
+      secret_access_key) {
+    uploader_settings.aws_credentials =
+        std::string(access_key_id) + ":" + secret_access_key;
+  }
 }
 
-// Calls |Init| and |Run| on |uploader| to start the uploader thread, which
-// uploads buffers when |UploadBuffer| is called on the uploader.
+// Returns true when |url| is an URL template; see
+// |webmlive::HttpUploaderSettings::url_template|.
+bool is_url_template(const std::string& url) {
+  return url.find("{id}") != std::string::npos;
+}
+
+// Returns true when |config| names its stream: an URL without a query string
+// requires |stream_id| and |stream_name|, unless it is a template.
+bool validate_config(const WebmEncoderClientConfig& config) {
+  if (!config.target_url.empty() && !is_url_template(config.target_url)) {
+    // Confirm |stream_id| and |stream_name| are present when no query string
+    // is present in |target_url|.
+    if ((config.uploader_settings.stream_id.empty() ||
+        config.uploader_settings.stream_name.empty()) &&
+        config.target_url.find('?') == std::string::npos) {
+      LOG(ERROR) << "stream_id and stream_name are required when the target "
+                 << "URL lacks a query string!\n";
+      return false;
+    }
+  }
+  if (config.uploader_settings.post_mode == webmlive::HTTP_PUT &&
+      !config.target_url.empty() && !is_url_template(config.target_url)) {
+    LOG(ERROR) << "--object_store needs a target URL template naming each "
+               << "object with {id}.";
+    return false;
+  }
+  if (config.uploader_settings.coalesce_max_bytes > 0 &&
+      ((!config.target_url.empty() && !is_url_template(config.target_url)) ||
+       config.uploader_settings.post_mode != webmlive::HTTP_POST)) {
+    LOG(ERROR) << "--coalesce_uploads needs plain POSTs to a target URL "
+               << "template.";
+    return false;
+  }
+  if (config.file_retention &&
+      config.enc_config.dash_time_shift_buffer_depth <= 0) {
+    LOG(ERROR) << "--dash_retention needs --dash_time_shift_buffer_depth.";
+    return false;
+  }
+  if (config.file_retention && config.vod_webm) {
+    LOG(ERROR) << "--dash_vod_webm needs every chunk, which --dash_retention "
+               << "deletes.";
+    return false;
+  }
+  return true;
+}
+
+// Calls |Init| and |Run| on |uploader| to start uploading, on |ptr_engine|
+// when it is not NULL, when |UploadBuffer| is called on the uploader.
 int start_uploader(WebmEncoderClientConfig* ptr_config,
+                   webmlive::HttpUploadEngine* ptr_engine,
                    webmlive::HttpUploader* ptr_uploader) {
-  int status = ptr_uploader->Init(ptr_config->uploader_settings);
+  // Templated URLs name each chunk themselves, and need no URL queue.
+  const bool url_template = is_url_template(ptr_config->target_url);
+  if (url_template) {
+    ptr_config->uploader_settings.url_template = ptr_config->target_url;
+  }
+  int status = ptr_uploader->Init(ptr_config->uploader_settings, ptr_engine);
   if (status) {
     LOG(ERROR) << "uploader Init failed, status=" << status;
     return status;
   }
+  if (url_template) {
+    status = ptr_uploader->Run();
+    if (status) {
+      LOG(ERROR) << "uploader Run failed, status=" << status;
+    }
+    return status;
+  }
 
   if (ptr_config->target_url.find('?') == std::string::npos) {
     // When the URL lacks a query string the URL must be reconstructed.
@@ -468,52 +2088,1096 @@ int start_uploader(WebmEncoderClientConfig* ptr_config,
   return status;
 }
 
-int encoder_main(WebmEncoderClientConfig* ptr_config) {
+// Calls |Init| and |Run| on |file_sink| to start the file writer thread,
+// which writes files to |enc_config.dash_dir|.
+int start_file_sink(const WebmEncoderClientConfig& config,
+                    webmlive::FileDataSink* ptr_file_sink) {
+  webmlive::FileDataSinkSettings settings;
+  settings.directory = config.enc_config.dash_dir;
+  settings.sync_interval_ms = config.file_sync_interval_ms;
+  if (config.file_retention) {
+    settings.retention_window_ms =
+        config.enc_config.dash_time_shift_buffer_depth * 1000;
+  }
+  int status = ptr_file_sink->Init(settings);
+  if (status) {
+    LOG(ERROR) << "file sink Init failed, status=" << status;
+    return status;
+  }
+  status = ptr_file_sink->Run();
+  if (status) {
+    LOG(ERROR) << "file sink Run failed, status=" << status;
+  }
+  return status;
+}
+
+// Returns the total video bitrate configured in |config|.
+int configured_video_kbps(const webmlive::WebmEncoderConfig& config) {
+  const std::vector<webmlive::VideoRepresentationConfig>& reps =
+      config.video_representations;
+  if (reps.empty())
+    return config.vpx_config.bitrate;
+  int total_kbps = 0;
+  for (size_t i = 0; i < reps.size(); ++i)
+    total_kbps += reps[i].bitrate > 0 ? reps[i].bitrate :
+                                        config.vpx_config.bitrate;
+  return total_kbps;
+}
+
+// Returns the total audio and video bitrate configured in |config|.
+int configured_stream_kbps(const webmlive::WebmEncoderConfig& config) {
+  int audio_kbps = 0;
+  if (!config.disable_audio) {
+    audio_kbps = config.audio_codec == webmlive::kAudioFormatOpus ?
+        config.opus_config.bitrate : config.vorbis_config.average_bitrate;
+    audio_kbps *= 1 + static_cast<int>(config.extra_audio_tracks.size());
+    for (size_t i = 0; i < config.audio_representations.size(); ++i) {
+      const webmlive::AudioRepresentationConfig& rep =
+          config.audio_representations[i];
+      if (rep.bitrate > 0) {
+        audio_kbps += rep.bitrate;
+      } else {
+        audio_kbps += rep.codec == webmlive::kAudioFormatOpus ?
+            config.opus_config.bitrate :
+            config.vorbis_config.average_bitrate;
+      }
+    }
+  }
+  return configured_video_kbps(config) + audio_kbps;
+}
+
+// Calls |Init| and |Run| on |origin| to start serving on
+// |origin_settings.port|.
+int start_origin(const WebmEncoderClientConfig& config,
+                 webmlive::HttpOrigin* ptr_origin) {
+  int status = ptr_origin->Init(config.origin_settings);
+  if (status) {
+    LOG(ERROR) << "origin Init failed, status=" << status;
+    return status;
+  }
+  status = ptr_origin->Run();
+  if (status) {
+    LOG(ERROR) << "origin Run failed, status=" << status;
+  }
+  return status;
+}
+
+// Calls |Init| and |Run| on |srt_sink| to start streaming over SRT.
+int start_srt_sink(const WebmEncoderClientConfig& config,
+                   webmlive::SrtDataSink* ptr_srt_sink) {
+  int status = ptr_srt_sink->Init(config.srt_settings);
+  if (status) {
+    LOG(ERROR) << "SRT sink Init failed, status=" << status;
+    return status;
+  }
+  status = ptr_srt_sink->Run();
+  if (status) {
+    LOG(ERROR) << "SRT sink Run failed, status=" << status;
+  }
+  return status;
+}
+
+// Calls |Init| and |Run| on |stream_sink| to start pushing the stream.
+int start_stream_sink(const WebmEncoderClientConfig& config,
+                      webmlive::WebSocketDataSink* ptr_stream_sink) {
+  int status = ptr_stream_sink->Init(config.stream_sink_settings);
+  if (status) {
+    LOG(ERROR) << "stream sink Init failed, status=" << status;
+    return status;
+  }
+  status = ptr_stream_sink->Run();
+  if (status) {
+    LOG(ERROR) << "stream sink Run failed, status=" << status;
+  }
+  return status;
+}
+
+// Calls |Init| and |Run| on |whip_sender| to publish the encoded frames of
+// |encoder| over WebRTC.
+int start_whip_sender(const WebmEncoderClientConfig& config,
+                      webmlive::WebmEncoder* ptr_encoder,
+                      webmlive::WhipSender* ptr_whip_sender) {
+  int status = ptr_whip_sender->Init(config.whip_settings);
+  if (status) {
+    LOG(ERROR) << "WHIP sender Init failed, status=" << status;
+    return status;
+  }
+  ptr_whip_sender->set_keyframe_callback(
+      [ptr_encoder] { ptr_encoder->RequestKeyframe(); });
+  status = ptr_whip_sender->Run();
+  if (status) {
+    LOG(ERROR) << "WHIP sender Run failed, status=" << status;
+  }
+  return status;
+}
+
+// Returns the number of sinks |stream| writes chunks to.
+int num_sinks(const Stream& stream) {
+  return (stream.upload ? 1 : 0) + (stream.write_files ? 1 : 0) +
+         (stream.serve ? 1 : 0) + (stream.srt ? 1 : 0) +
+         (stream.push_stream ? 1 : 0);
+}
+
+// Stops the sinks of |ptr_stream| started by |start_stream()|, in the order
+// data flows through them. |fan_out| is stopped when |stop_fan_out| is true.
+void stop_sinks(Stream* ptr_stream, bool stop_fan_out) {
+  if (stop_fan_out) {
+    LOG(INFO) << "stopping fan out sink...";
+    ptr_stream->fan_out.Stop();
+  }
+  if (ptr_stream->upload) {
+    LOG(INFO) << "stopping uploader...";
+    ptr_stream->uploader.Stop();
+  }
+  if (ptr_stream->write_files) {
+    LOG(INFO) << "stopping file sink...";
+    ptr_stream->file_sink.Stop();
+  }
+  if (ptr_stream->serve) {
+    LOG(INFO) << "stopping origin...";
+    ptr_stream->origin.Stop();
+  }
+  if (ptr_stream->srt) {
+    LOG(INFO) << "stopping SRT sink...";
+    ptr_stream->srt_sink.Stop();
+  }
+  if (ptr_stream->push_stream) {
+    LOG(INFO) << "stopping stream sink...";
+    ptr_stream->stream_sink.Stop();
+  }
+  if (ptr_stream->whip) {
+    LOG(INFO) << "stopping WHIP sender...";
+    ptr_stream->whip_sender.Stop();
+  }
+}
+
+// Initializes and runs the encoder and data sinks of |ptr_stream|. Uploads
+// run on |ptr_engine| when it is not NULL. Returns |kSuccess| when
+// successful; nothing is left running otherwise.
+// Applies the libvpx settings calibrated for |ptr_config->enc_config| to it,
+// from the cache when present, or by running |webmlive::EncodeCalibrator|
+// and caching its result. Returns false when calibration fails.
+bool calibrate_encoder(WebmEncoderClientConfig* ptr_config) {
   webmlive::WebmEncoderConfig& enc_config = ptr_config->enc_config;
-  webmlive::HttpUploader uploader;
+  if (enc_config.disable_video || enc_config.video_passthrough ||
+      !enc_config.remux_input.empty() ||
+      enc_config.vpx_config.backend != webmlive::kVideoEncoderBackendLibvpx) {
+    LOG(INFO) << "calibration skipped: no libvpx encode.";
+    return true;
+  }
+  const std::string key = webmlive::EncodeCalibrator::CacheKey(
+      enc_config, ptr_config->calibration_headroom);
+  webmlive::EncodeCalibration result;
+  if (webmlive::EncodeCalibrator::ReadCache(ptr_config->calibration_cache,
+                                            key, &result) ==
+      webmlive::EncodeCalibrator::kSuccess) {
+    LOG(INFO) << "calibration cached for " << key;
+  } else {
+    LOG(INFO) << "calibrating " << key << "...";
+    webmlive::EncodeCalibrator calibrator;
+    const int status = calibrator.Calibrate(
+        enc_config, ptr_config->calibration_headroom, &result);
+    if (status != webmlive::EncodeCalibrator::kSuccess &&
+        status != webmlive::EncodeCalibrator::kNotRealtime) {
+      LOG(ERROR) << "calibration failed, status=" << status;
+      return false;
+    }
+    webmlive::EncodeCalibrator::WriteCache(ptr_config->calibration_cache, key,
+                                           result);
+  }
+  LOG(INFO) << "calibrated speed=" << result.speed
+            << " threads=" << result.thread_count
+            << " tile_columns=" << result.tile_columns << " ("
+            << result.ms_per_frame << " ms/frame)";
+  webmlive::EncodeCalibrator::Apply(result, &enc_config.vpx_config);
+  return true;
+}
 
-  // Init the WebM encoder.
-  webmlive::WebmEncoder encoder;
-  int status = encoder.Init(enc_config, &uploader);
+int start_stream(Stream* ptr_stream, webmlive::HttpUploadEngine* ptr_engine) {
+  WebmEncoderClientConfig* const ptr_config = &ptr_stream->config;
+  webmlive::WebmEncoderConfig& enc_config = ptr_config->enc_config;
+  webmlive::HttpUploader& uploader = ptr_stream->uploader;
+  webmlive::FileDataSink& file_sink = ptr_stream->file_sink;
+  webmlive::HttpOrigin& origin = ptr_stream->origin;
+  webmlive::SrtDataSink& srt_sink = ptr_stream->srt_sink;
+  webmlive::WebSocketDataSink& stream_sink = ptr_stream->stream_sink;
+  webmlive::FanOutDataSink& fan_out = ptr_stream->fan_out;
+  webmlive::WebmEncoder& encoder = ptr_stream->encoder;
+
+  // Chunks go to the uploader when an URL is present, to the origin and the
+  // SRT sink when their ports are, to the stream sink when its URL is, and
+  // to files otherwise. Using several
+  // sinks tees the chunks through |fan_out|, which keeps a slow disk from
+  // delaying uploads and vice versa.
+  const bool upload = !ptr_config->target_url.empty();
+  const bool serve = ptr_config->serve;
+  const bool srt = ptr_config->srt;
+  const bool push_stream = ptr_config->push_stream;
+  const bool write_files =
+      (!upload && !serve && !srt && !push_stream) || ptr_config->write_files;
+  ptr_stream->upload = upload;
+  ptr_stream->write_files = write_files;
+  ptr_stream->serve = serve;
+  ptr_stream->srt = srt;
+  ptr_stream->push_stream = push_stream;
+  const bool use_fan_out = num_sinks(*ptr_stream) > 1;
+  webmlive::DataSinkInterface* ptr_data_sink = &file_sink;
+  if (use_fan_out) {
+    webmlive::FanOutOutputSettings upload_settings;
+    upload_settings.max_queued_chunks =
+        ptr_config->uploader_settings.max_pending_uploads;
+    webmlive::FanOutOutputSettings file_settings;
+    file_settings.drop_policy = webmlive::kDropNewest;
+    webmlive::FanOutOutputSettings origin_settings;
+    webmlive::FanOutOutputSettings srt_settings;
+    webmlive::FanOutOutputSettings stream_settings;
+    if ((upload && fan_out.AddOutput(&uploader, upload_settings)) ||
+        (write_files && fan_out.AddOutput(&file_sink, file_settings)) ||
+        (serve && fan_out.AddOutput(&origin, origin_settings)) ||
+        (srt && fan_out.AddOutput(&srt_sink, srt_settings)) ||
+        (push_stream && fan_out.AddOutput(&stream_sink, stream_settings))) {
+      LOG(ERROR) << "fan out sink AddOutput failed.";
+      return kInvalidArg;
+    }
+    ptr_data_sink = &fan_out;
+  } else if (upload) {
+    ptr_data_sink = &uploader;
+  } else if (serve) {
+    ptr_data_sink = &origin;
+  } else if (srt) {
+    ptr_data_sink = &srt_sink;
+  } else if (push_stream) {
+    ptr_data_sink = &stream_sink;
+  }
+  ptr_stream->ptr_data_sink = ptr_data_sink;
+
+  // The SRT and stream sinks send the one muxed WebM stream.
+  if ((srt || push_stream) && enc_config.dash_encode)
+    enc_config.dash_muxed_output = true;
+
+  if (ptr_config->calibrate && !calibrate_encoder(ptr_config)) {
+    return kInvalidArg;
+  }
+
+  if (ptr_config->rate_control_telemetry)
+    enc_config.rate_control_telemetry = &ptr_stream->rate_control;
+
+  // The WHIP sender takes frames straight from the encoders, so it needs
+  // codecs WebRTC receivers decode and an encode to take them from.
+  const bool whip = ptr_config->whip;
+  if (whip) {
+    const webmlive::VideoFormat codec =
+        enc_config.video_representations.empty() ?
+            enc_config.vpx_config.codec :
+            webmlive::RepresentationCodec(enc_config.video_representations[0],
+                                          enc_config.vpx_config);
+    if (!enc_config.remux_input.empty() || enc_config.disable_video ||
+        (codec != webmlive::kVideoFormatVP8 &&
+         codec != webmlive::kVideoFormatVP9) ||
+        (!enc_config.disable_audio &&
+         enc_config.audio_codec != webmlive::kAudioFormatOpus)) {
+      LOG(ERROR) << "WHIP output needs a VP8 or VP9 encode, and Opus audio "
+                 << "or none.";
+      return kInvalidArg;
+    }
+    webmlive::WhipSenderSettings& whip_settings = ptr_config->whip_settings;
+    whip_settings.video_codec = codec;
+    whip_settings.temporal_layers = enc_config.vpx_config.temporal_layers;
+    whip_settings.audio = !enc_config.disable_audio;
+    const std::vector<webmlive::VideoRepresentationConfig>& reps =
+        enc_config.video_representations;
+    whip_settings.bitrate_kbps =
+        (!reps.empty() && reps[0].bitrate > 0 ? reps[0].bitrate :
+                                                enc_config.vpx_config.bitrate) +
+        (whip_settings.audio ? enc_config.opus_config.bitrate : 0);
+    enc_config.realtime_sink = &ptr_stream->whip_sender;
+  }
+
+  // Init the WebM encoder, or the remuxer that replaces it.
+  ptr_stream->remux = !enc_config.remux_input.empty();
+  int status = ptr_stream->remux ?
+      ptr_stream->remuxer.Init(enc_config, ptr_data_sink) :
+      encoder.Init(enc_config, ptr_data_sink);
   if (status) {
     LOG(ERROR) << "WebmEncoder Run failed, status=" << status;
-    return EXIT_FAILURE;
+    return status;
   }
 
-  // Start the uploader thread.
-  status = start_uploader(ptr_config, &uploader);
-  if (status) {
-    LOG(ERROR) << "start_uploader failed, status=" << status;
-    return EXIT_FAILURE;
+  // Start the data sink threads. The flags of |ptr_stream| are set as each
+  // sink starts, so that failures stop only the sinks already running.
+  ptr_stream->upload = false;
+  ptr_stream->write_files = false;
+  ptr_stream->serve = false;
+  ptr_stream->srt = false;
+  ptr_stream->push_stream = false;
+  ptr_stream->whip = false;
+  if (upload) {
+    if (ptr_config->pacing_headroom > 0) {
+      ptr_config->uploader_settings.pacing_kbps = static_cast<int>(
+          configured_stream_kbps(enc_config) * ptr_config->pacing_headroom);
+    }
+    // Lets the uplink estimator compare upload times to segment durations.
+    if (enc_config.dash_encode) {
+      ptr_config->uploader_settings.segment_duration_ms =
+          enc_config.vpx_config.keyframe_interval;
+    }
+    ptr_config->uploader_settings.live_window_ms =
+        ptr_config->live_window_ms >= 0 ? ptr_config->live_window_ms :
+        enc_config.dash_time_shift_buffer_depth * 1000;
+    status = start_uploader(ptr_config, ptr_engine, &uploader);
+    if (status) {
+      LOG(ERROR) << "start_uploader failed, status=" << status;
+      return status;
+    }
+    ptr_stream->upload = true;
+  }
+  if (write_files) {
+    status = start_file_sink(*ptr_config, &file_sink);
+    if (status) {
+      LOG(ERROR) << "start_file_sink failed, status=" << status;
+      stop_sinks(ptr_stream, false);
+      return status;
+    }
+    ptr_stream->write_files = true;
+  }
+  if (serve) {
+    webmlive::SegmentCacheSettings& cache_settings =
+        ptr_config->origin_settings.cache_settings;
+    if (ptr_config->origin_window_ms >= 0) {
+      cache_settings.window_ms = ptr_config->origin_window_ms;
+    } else if (enc_config.dash_time_shift_buffer_depth > 0) {
+      cache_settings.window_ms = enc_config.dash_time_shift_buffer_depth * 1000;
+    }
+
+    // The object tier signs its PUTs as the uploader does.
+    webmlive::HttpUploaderSettings& object_settings =
+        ptr_config->origin_settings.dvr_settings.object_settings;
+    object_settings.aws_sigv4 = ptr_config->uploader_settings.aws_sigv4;
+    object_settings.aws_credentials =
+        ptr_config->uploader_settings.aws_credentials;
+    object_settings.stream_name = ptr_config->uploader_settings.stream_name;
+    object_settings.stream_id = ptr_config->uploader_settings.stream_id;
+    status = start_origin(*ptr_config, &origin);
+    if (status) {
+      LOG(ERROR) << "start_origin failed, status=" << status;
+      stop_sinks(ptr_stream, false);
+      return status;
+    }
+    ptr_stream->serve = true;
+  }
+  if (srt) {
+    status = start_srt_sink(*ptr_config, &srt_sink);
+    if (status) {
+      LOG(ERROR) << "start_srt_sink failed, status=" << status;
+      stop_sinks(ptr_stream, false);
+      return status;
+    }
+    ptr_stream->srt = true;
+  }
+  if (push_stream) {
+    status = start_stream_sink(*ptr_config, &stream_sink);
+    if (status) {
+      LOG(ERROR) << "start_stream_sink failed, status=" << status;
+      stop_sinks(ptr_stream, false);
+      return status;
+    }
+    ptr_stream->push_stream = true;
+  }
+  if (whip) {
+    status = start_whip_sender(*ptr_config, &encoder, &ptr_stream->whip_sender);
+    if (status) {
+      LOG(ERROR) << "start_whip_sender failed, status=" << status;
+      stop_sinks(ptr_stream, false);
+      return status;
+    }
+    ptr_stream->whip = true;
+  }
+  if (use_fan_out) {
+    status = fan_out.Run();
+    if (status) {
+      LOG(ERROR) << "fan out sink Run failed, status=" << status;
+      stop_sinks(ptr_stream, false);
+      return status;
+    }
   }
 
   // Start the WebM encoder.
-  status = encoder.Run();
+  status = ptr_stream->remux ? ptr_stream->remuxer.Run() : encoder.Run();
   if (status) {
     LOG(ERROR) << "start_encoder failed, status=" << status;
-    uploader.Stop();
+    stop_sinks(ptr_stream, use_fan_out);
+    return status;
+  }
+
+  // Ladder pruning changes the representations of a running encode, which
+  // only dynamic DASH encodes of a ladder support.
+  const webmlive::WebmEncoderConfig running_config = encoder.config();
+  ptr_stream->prune_ladder =
+      upload && ptr_config->ladder_pruning && !enc_config.disable_video &&
+      !ptr_stream->remux && enc_config.dash_encode && enc_config.dash_dynamic &&
+      running_config.video_representations.size() > 1;
+  if (ptr_config->ladder_pruning && !ptr_stream->prune_ladder) {
+    LOG(WARNING) << "--ladder_pruning requires an upload of a dynamic DASH "
+                 << "encode with more than one video representation.";
+  }
+  if (ptr_stream->prune_ladder) {
+    ptr_stream->ladder = running_config.video_representations;
+    webmlive::LadderControllerConfig ladder_config;
+    for (size_t i = 0; i < ptr_stream->ladder.size(); ++i) {
+      const int kbps = ptr_stream->ladder[i].bitrate;
+      ladder_config.rep_kbps.push_back(
+          kbps > 0 ? kbps : running_config.vpx_config.bitrate);
+    }
+    ladder_config.base_kbps = configured_stream_kbps(running_config) -
+                              configured_video_kbps(running_config);
+    if (ptr_stream->ladder_controller.Init(ladder_config)) {
+      LOG(ERROR) << "LadderController Init failed.";
+      encoder.Stop();
+      stop_sinks(ptr_stream, use_fan_out);
+      return kInvalidArg;
+    }
+  }
+
+  // Throughput based bitrate adaptation needs uploads to measure, and an
+  // encoder to adapt. It would fight ladder pruning over the same uplink.
+  if (ptr_stream->prune_ladder && ptr_config->adaptive_bitrate) {
+    LOG(WARNING) << "--adaptive_bitrate is ignored with --ladder_pruning.";
+  }
+  ptr_stream->adapt_bitrate = upload && ptr_config->adaptive_bitrate &&
+                              !enc_config.disable_video &&
+                              !ptr_stream->remux && !ptr_stream->prune_ladder;
+  if (ptr_stream->adapt_bitrate) {
+    webmlive::BitrateAdapterConfig adapter_config;
+    adapter_config.max_kbps = configured_video_kbps(encoder.config());
+    adapter_config.min_kbps = ptr_config->min_video_kbps > 0 ?
+        ptr_config->min_video_kbps : adapter_config.max_kbps / 4;
+    if (ptr_stream->bitrate_adapter.Init(adapter_config,
+                                         adapter_config.max_kbps)) {
+      LOG(ERROR) << "BitrateAdapter Init failed.";
+      encoder.Stop();
+      stop_sinks(ptr_stream, use_fan_out);
+      return kInvalidArg;
+    }
+  }
+  return kSuccess;
+}
+
+// Reads the upload stats of |ptr_stream| into |ptr_stats|, and adapts its
+// video bitrate to them. Returns false when the stream does not upload.
+bool update_stream(Stream* ptr_stream, int64 elapsed_ms,
+                   webmlive::HttpUploaderStats* ptr_stats) {
+  if (!ptr_stream->upload ||
+      ptr_stream->uploader.GetStats(ptr_stats) !=
+          webmlive::HttpUploader::kSuccess) {
+    return false;
+  }
+  int new_kbps = 0;
+  if (ptr_stream->adapt_bitrate &&
+      ptr_stream->bitrate_adapter.Update(
+          elapsed_ms, ptr_stats->uplink,
+          !ptr_stream->uploader.UploadComplete(), &new_kbps)) {
+    LOG(INFO) << "adapting video bitrate to " << new_kbps << " kbps";
+    ptr_stream->encoder.SetVideoBitrate(new_kbps);
+
+    // Pacing follows the adapted bitrate rather than the measured capacity:
+    // paced uploads measure only the pacing rate.
+    const WebmEncoderClientConfig& config = ptr_stream->config;
+    if (config.pacing_headroom > 0) {
+      const int audio_kbps = configured_stream_kbps(config.enc_config) -
+                             configured_video_kbps(config.enc_config);
+      ptr_stream->uploader.SetPacingRate(static_cast<int>(
+          (audio_kbps + new_kbps) * config.pacing_headroom));
+    }
+  }
+
+  // Representation changes take effect in a new manifest Period. Pacing is
+  // left at the rate of the whole ladder, so that uploads can measure the
+  // capacity representations need to resume.
+  int active_count = 0;
+  if (ptr_stream->prune_ladder &&
+      ptr_stream->ladder_controller.Update(
+          elapsed_ms, ptr_stats->uplink,
+          !ptr_stream->uploader.UploadComplete(), &active_count)) {
+    std::vector<webmlive::VideoRepresentationConfig> representations;
+    for (size_t i = 0; i < ptr_stream->ladder.size(); ++i) {
+      if (ptr_stream->ladder_controller.IsActive(static_cast<int>(i)))
+        representations.push_back(ptr_stream->ladder[i]);
+    }
+    LOG(INFO) << "encoding " << active_count << " of "
+              << ptr_stream->ladder.size() << " video representations";
+    if (ptr_stream->encoder.Reconfigure(
+            representations,
+            ptr_stream->config.enc_config.vpx_config.codec)) {
+      LOG(ERROR) << "cannot change the video representations.";
+    }
+  }
+  return true;
+}
+
+// Returns true once the input of |stream| has ended.
+bool stream_finished(const Stream& stream) {
+  return stream.remux ? stream.remuxer.Finished() : stream.encoder.Finished();
+}
+
+// Returns the duration of |stream| encoded or remuxed so far, in
+// milliseconds.
+int64 stream_duration(const Stream& stream) {
+  return stream.remux ? stream.remuxer.remuxed_duration() :
+                        stream.encoder.encoded_duration();
+}
+
+// Builds the seekable WebM file of |stream| from the muxed chunks, the
+// header and the cluster index its file sink wrote, once the sink has
+// stopped. The chunks are copied rather than remuxed.
+void build_vod_webm(const Stream& stream) {
+  const webmlive::WebmEncoderConfig& enc_config = stream.config.enc_config;
+  if (stream.remux || !stream.write_files || !enc_config.dash_encode) {
+    LOG(WARNING) << "--dash_vod_webm requires a DASH encode written to "
+                 << "files; no VOD WebM built.";
+    return;
+  }
+  const std::string output =
+      enc_config.dash_dir + enc_config.dash_name + ".webm";
+  LOG(INFO) << "building " << output << "...";
+  webmlive::VodWebmBuilder builder;
+  const int status = builder.Build(enc_config.dash_dir,
+                                   enc_config.dash_name + "_muxed",
+                                   stream_duration(stream), output);
+  if (status) {
+    LOG(ERROR) << "VodWebmBuilder Build failed, status=" << status;
+  }
+}
+
+// Stops the encoder and data sinks started by |start_stream()|. With a stop
+// timeout the encoder's final writes and the sinks' deliveries share one
+// deadline, and what is left at the deadline is logged before the sinks
+// abort it.
+void stop_stream(Stream* ptr_stream) {
+  const int stop_timeout_ms = ptr_stream->config.enc_config.stop_timeout_ms;
+  const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(stop_timeout_ms);
+  LOG(INFO) << "stopping encoder...";
+  if (ptr_stream->remux)
+    ptr_stream->remuxer.Stop();
+  else
+    ptr_stream->encoder.Stop();
+  if (stop_timeout_ms > 0 && ptr_stream->ptr_data_sink) {
+    const int64 remaining_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+    const int undelivered = ptr_stream->ptr_data_sink->Drain(
+        static_cast<int32>(remaining_ms > 0 ? remaining_ms : 0));
+    const int abandoned =
+        ptr_stream->remux ? 0 : ptr_stream->encoder.stop_abandoned_writes();
+    if (undelivered > 0 || abandoned > 0) {
+      LOG(WARNING) << "stop timeout of " << stop_timeout_ms << " ms passed: "
+                   << abandoned << " final writes not made, "
+                   << undelivered << " writes not delivered.";
+    }
+  }
+  stop_sinks(ptr_stream, num_sinks(*ptr_stream) > 1);
+  if (ptr_stream->config.vod_webm) {
+    build_vod_webm(*ptr_stream);
+  }
+  if (!ptr_stream->remux && ptr_stream->config.enc_config.latency_trace) {
+    LOG(INFO) << "latency since capture:\n"
+              << ptr_stream->encoder.latency_stats().ToString();
+  }
+  if (!ptr_stream->remux && ptr_stream->config.rate_control_telemetry) {
+    LOG(INFO) << "video rate control:\n"
+              << ptr_stream->rate_control.stats().ToString();
+  }
+}
+
+// Splits |line| into words at whitespace. Double quotes group words, and are
+// removed.
+StringVector split_config_line(const std::string& line) {
+  StringVector words;
+  std::string word;
+  bool in_word = false;
+  bool quoted = false;
+  for (size_t i = 0; i < line.size(); ++i) {
+    const char c = line[i];
+    if (c == '"') {
+      quoted = !quoted;
+      in_word = true;
+    } else if (!quoted && isspace(static_cast<unsigned char>(c))) {
+      if (in_word)
+        words.push_back(word);
+      word.clear();
+      in_word = false;
+    } else {
+      word += c;
+      in_word = true;
+    }
+  }
+  if (in_word)
+    words.push_back(word);
+  return words;
+}
+
+// Reads the streams of host mode from |file_name|. Each line describes one
+// stream with the options of a single stream encode; blank lines and lines
+// starting with '#' are skipped. Streams are named by --stream_name, or by
+// their line number, and their metrics are labelled with the name.
+int read_host_config(const std::string& file_name, const char* argv0,
+                     StreamVector* ptr_streams) {
+  std::ifstream file(file_name.c_str());
+  if (!file) {
+    LOG(ERROR) << "cannot open host config " << file_name;
+    return kInvalidArg;
+  }
+  std::string line;
+  for (int line_number = 1; std::getline(file, line); ++line_number) {
+    const StringVector words = split_config_line(line);
+    if (words.empty() || words[0][0] == '#')
+      continue;
+    std::vector<const char*> args;
+    args.push_back(argv0);
+    for (size_t i = 0; i < words.size(); ++i)
+      args.push_back(words[i].c_str());
+
+    std::unique_ptr<Stream> stream(new (std::nothrow) Stream());  // NOLINT
+    if (!stream) {
+      LOG(ERROR) << "cannot construct Stream.";
+      return kNoMemory;
+    }
+    WebmEncoderClientConfig& config = stream->config;
+    parse_command_line(static_cast<int>(args.size()), &args[0], config);
+    if (!validate_config(config)) {
+      LOG(ERROR) << file_name << ":" << line_number << ": invalid stream.";
+      return kBadFormat;
+    }
+    std::string name = config.uploader_settings.stream_name;
+    if (name.empty()) {
+      std::ostringstream line_name;
+      line_name << "line" << line_number;
+      name = line_name.str();
+    }
+    const std::string labels = "stream=\"" + name + "\"";
+    config.enc_config.metrics_labels = labels;
+    config.uploader_settings.metrics_labels = labels;
+    config.origin_settings.metrics_labels = labels;
+    config.srt_settings.metrics_labels = labels;
+    config.whip_settings.metrics_labels = labels;
+    config.stream_sink_settings.metrics_labels = labels;
+    ptr_streams->push_back(std::move(stream));
+  }
+  if (ptr_streams->empty()) {
+    LOG(ERROR) << "host config " << file_name << " describes no streams.";
+    return kBadFormat;
+  }
+  return kSuccess;
+}
+
+// Set by SIGUSR1 to ask the main loop for a memory report.
+volatile sig_atomic_t g_memory_report_requested = 0;
+
+#ifndef _WIN32
+void request_memory_report(int) {
+  g_memory_report_requested = 1;
+}
+#endif
+
+// Makes SIGUSR1 request a memory report; see |write_metrics()|.
+void install_memory_report_handler() {
+#ifndef _WIN32
+  signal(SIGUSR1, request_memory_report);
+#endif
+}
+
+// Rewrites |config.metrics_file| when |config.metrics_interval| has passed
+// since |*ptr_metrics_time|. A memory report requested by SIGUSR1 is logged,
+// and rewrites the file at once.
+void write_metrics(const WebmEncoderClientConfig& config,
+                   std::chrono::steady_clock::time_point* ptr_metrics_time) {
+  webmlive::MemoryGovernor& governor = webmlive::MemoryGovernor::Instance();
+  const bool report = g_memory_report_requested != 0;
+  if (report) {
+    g_memory_report_requested = 0;
+    std::string text;
+    governor.WriteReport(&text);
+    LOG(INFO) << text;
+  }
+  if (config.metrics_file.empty() ||
+      (!report && std::chrono::steady_clock::now() - *ptr_metrics_time <
+                      std::chrono::seconds(config.metrics_interval))) {
+    return;
+  }
+  *ptr_metrics_time = std::chrono::steady_clock::now();
+  governor.UpdateProcessMetrics();
+  webmlive::CpuAccounting::Instance().Sample();
+  webmlive::MetricsRegistry::Instance().WriteFile(config.metrics_file);
+}
+
+// Executes the commands of the control server on the streams of this
+// process. Commands taking a stream accept its 1-based number as an optional
+// last word, and default to the first stream.
+class StreamController : public webmlive::ControlHandlerInterface {
+ public:
+  explicit StreamController(const std::vector<Stream*>& streams)
+      : streams_(streams), stop_requested_(false) {}
+  virtual ~StreamController() {}
+
+  // Returns true once a client sent "stop".
+  bool stop_requested() const { return stop_requested_; }
+
+  virtual bool HandleControlCommand(const StringVector& words,
+                                    std::string* ptr_reply) {
+    const std::string& command = words[0];
+    std::string& reply = *ptr_reply;
+    if (command == "help") {
+      reply = "bitrate <kbps> [stream], keyframe [stream], "
+              "speed <steps> [stream], target <url> [stream], status, stop";
+      return true;
+    }
+    if (command == "stop") {
+      stop_requested_ = true;
+      return true;
+    }
+    if (command == "status") {
+      std::ostringstream status;
+      for (size_t i = 0; i < streams_.size(); ++i) {
+        status << (i ? " " : "") << "stream" << i + 1 << "="
+               << stream_duration(*streams_[i]) / 1000.0 << "s";
+      }
+      reply = status.str();
+      return true;
+    }
+
+    if (command != "keyframe" && command != "target" &&
+        command != "bitrate" && command != "speed") {
+      reply = "unknown command " + command;
+      return false;
+    }
+    const bool has_value = command != "keyframe";
+    Stream* const ptr_stream =
+        FindStream(words, has_value ? 2 : 1, &reply);
+    if (!ptr_stream) {
+      return false;
+    }
+    if (ptr_stream->remux) {
+      reply = "remuxed streams are not encoded";
+      return false;
+    }
+    webmlive::WebmEncoder& encoder = ptr_stream->encoder;
+    if (command == "keyframe") {
+      encoder.RequestKeyframe();
+      return true;
+    }
+    if (command == "target") {
+      if (!ptr_stream->upload ||
+          !ptr_stream->config.uploader_settings.url_template.empty()) {
+        reply = "stream does not upload to a target URL";
+        return false;
+      }
+      ptr_stream->uploader.EnqueueTargetUrl(words[1]);
+      return true;
+    }
+
+    int value = 0;
+    if (!ParseInt(words[1], &value)) {
+      reply = "invalid value " + words[1];
+      return false;
+    }
+    if (command == "bitrate") {
+      if (encoder.SetVideoBitrate(value)) {
+        reply = "cannot set bitrate";
+        return false;
+      }
+      return true;
+    }
+    if (encoder.SetVideoSpeedBoost(value)) {
+      reply = "cannot set speed boost";
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  // Returns the stream selected by |words|, which hold |num_words| words
+  // before the optional stream number, or NULL after describing the error in
+  // |ptr_reply|.
+  Stream* FindStream(const StringVector& words, size_t num_words,
+                     std::string* ptr_reply) const {
+    if (words.size() < num_words || words.size() > num_words + 1) {
+      *ptr_reply = "wrong number of arguments";
+      return NULL;
+    }
+    int index = 1;
+    if (words.size() > num_words &&
+        (!ParseInt(words[num_words], &index) || index < 1 ||
+         index > static_cast<int>(streams_.size()))) {
+      *ptr_reply = "no stream " + words[num_words];
+      return NULL;
+    }
+    return streams_[index - 1];
+  }
+
+  static bool ParseInt(const std::string& word, int* ptr_value) {
+    char* ptr_end = NULL;
+    const long value = strtol(word.c_str(), &ptr_end, 10);  // NOLINT
+    if (word.empty() || *ptr_end != '\0') {
+      return false;
+    }
+    *ptr_value = static_cast<int>(value);
+    return true;
+  }
+
+  const std::vector<Stream*> streams_;
+  std::atomic<bool> stop_requested_;
+};
+
+// Starts |ptr_server| when |config| enables it. Returns false when it is
+// enabled and cannot start.
+bool start_control(const WebmEncoderClientConfig& config,
+                   StreamController* ptr_controller,
+                   webmlive::ControlServer* ptr_server) {
+  if (!config.control) {
+    return true;
+  }
+  const int status = ptr_server->Run(config.control_settings, ptr_controller);
+  if (status) {
+    LOG(ERROR) << "ControlServer Run failed, status=" << status;
+    return false;
+  }
+  return true;
+}
+
+// Starts |webmlive::EncoderContextPool| when |config| enables it, and adds
+// its --encoder_pool_profile profiles. They take the other encoder settings
+// of |config|, with |encode_cores| cores, so that they match the encoders
+// streams start. Returns false when the pool is enabled and cannot start.
+bool start_encoder_pool(const WebmEncoderClientConfig& config,
+                        int encode_cores) {
+  if (config.encoder_pool_settings.contexts_per_profile <= 0) {
+    return true;
+  }
+  webmlive::EncoderContextPool& pool = webmlive::EncoderContextPool::Instance();
+  if (pool.Start(config.encoder_pool_settings)) {
+    LOG(ERROR) << "EncoderContextPool Start failed.";
+    return false;
+  }
+  for (size_t i = 0; i < config.encoder_pool_profiles.size(); ++i) {
+    const EncoderPoolProfile& profile = config.encoder_pool_profiles[i];
+    webmlive::WebmEncoderConfig enc_config = config.enc_config;
+    enc_config.vpx_config.codec = profile.codec;
+    enc_config.vpx_config.speed = profile.speed;
+    enc_config.actual_video_config.width = profile.width;
+    enc_config.actual_video_config.height = profile.height;
+    enc_config.actual_video_config.format =
+        enc_config.vpx_config.bit_depth > 8 ? webmlive::kVideoFormatI42016 :
+                                              webmlive::kVideoFormatI420;
+    enc_config.encode_cores = encode_cores;
+    pool.AddProfile(enc_config);
+  }
+  return true;
+}
+
+int encoder_main(WebmEncoderClientConfig* ptr_config) {
+  webmlive::TraceLog::set_level(ptr_config->trace_level);
+  if (!start_encoder_pool(*ptr_config, ptr_config->enc_config.encode_cores)) {
     return EXIT_FAILURE;
   }
+  Stream stream;
+  stream.config = *ptr_config;
+  if (start_stream(&stream, NULL)) {
+    return EXIT_FAILURE;
+  }
+  StreamController controller(std::vector<Stream*>(1, &stream));
+  webmlive::ControlServer control_server;
+  if (!start_control(*ptr_config, &controller, &control_server)) {
+    stop_stream(&stream);
+    return EXIT_FAILURE;
+  }
+  const std::chrono::steady_clock::time_point start_time =
+      std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point metrics_time = start_time;
 
   webmlive::HttpUploaderStats stats;
+  webmlive::FileDataSinkStats file_stats;
   printf("\nPress the any key to quit...\n");
 
-  while (!_kbhit()) {
+  // File input ends on its own.
+  while (!key_pressed() && !stream_finished(stream) &&
+         !controller.stop_requested()) {
     // Output current duration and upload progress
-    if (uploader.GetStats(&stats) == webmlive::HttpUploader::kSuccess) {
-      printf("\rencoded duration: %04f seconds, uploaded: %I64d @ %d kBps",
-             (encoder.encoded_duration() / 1000.0),
-             stats.bytes_sent_current + stats.total_bytes_uploaded,
+    const int64 elapsed_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start_time).count();
+    if (update_stream(&stream, elapsed_ms, &stats)) {
+      printf("\rencoded duration: %04f seconds, uploaded: %lld @ %d kBps",
+             (stream_duration(stream) / 1000.0),
+             static_cast<long long>(  // NOLINT
+                 stats.bytes_sent_current + stats.total_bytes_uploaded),
              static_cast<int>(stats.bytes_per_second / 1000));
+    } else if (!stream.upload &&
+               stream.file_sink.GetStats(&file_stats) ==
+                   webmlive::FileDataSink::kSuccess) {
+      printf("\rencoded duration: %04f seconds, written: %lld bytes",
+             (stream_duration(stream) / 1000.0),
+             static_cast<long long>(file_stats.bytes_written));  // NOLINT
     }
-    Sleep(100);
+
+    write_metrics(*ptr_config, &metrics_time);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
   }
 
-  LOG(INFO) << "stopping encoder...";
-  encoder.Stop();
-  LOG(INFO) << "stopping uploader...";
-  uploader.Stop();
+  control_server.Stop();
+  stop_stream(&stream);
+  return EXIT_SUCCESS;
+}
 
+// Runs every stream described by |ptr_config->host_config| in this process.
+// The streams share one upload engine, so uploads of all streams run on one
+// thread and share its connection cache, and share one metrics registry,
+// written to |ptr_config->metrics_file|. Their encode loops and encodes run
+// as tasks on one scheduler with a thread per CPU the container allows.
+// |webmlive::ResourcePlanner| admits the streams in the order of the file,
+// with the threads and libvpx speed their share of the CPUs allows; streams
+// that do not fit at any speed are not started, so that those admitted keep
+// real time.
+int host_main(WebmEncoderClientConfig* ptr_config, const char* argv0) {
+  webmlive::TraceLog::set_level(ptr_config->trace_level);
+
+  // The scheduler and engine must outlive the encoders and uploaders using
+  // them: those of |streams|.
+  webmlive::TaskScheduler scheduler;
+  webmlive::HttpUploadEngine engine;
+  StreamVector streams;
+  if (read_host_config(ptr_config->host_config, argv0, &streams)) {
+    return EXIT_FAILURE;
+  }
+
+  webmlive::ResourcePlanner planner;
+  if (planner.Init(ptr_config->host_cpus, ptr_config->host_cpu_headroom)) {
+    return EXIT_FAILURE;
+  }
+  StreamVector admitted;
+  for (size_t i = 0; i < streams.size(); ++i) {
+    webmlive::WebmEncoderConfig& enc_config = streams[i]->config.enc_config;
+    webmlive::StreamBudget budget;
+    const int status =
+        planner.Admit(enc_config.metrics_labels, enc_config, &budget);
+    if (status == webmlive::ResourcePlanner::kNoCapacity) {
+      LOG(ERROR) << "stream " << enc_config.metrics_labels
+                 << " refused: not enough CPU for real time.";
+      continue;
+    }
+    webmlive::ResourcePlanner::Apply(budget, &enc_config);
+    admitted.push_back(std::move(streams[i]));
+  }
+  if (admitted.empty()) {
+    LOG(ERROR) << "no stream fits the CPU of this host.";
+    return EXIT_FAILURE;
+  }
+  streams.swap(admitted);
+
+  const int stream_cores =
+      std::max(1, planner.threads() / static_cast<int>(streams.size()));
+  int max_connections = 0;
+  bool enable_http2 = false;
+  for (size_t i = 0; i < streams.size(); ++i) {
+    WebmEncoderClientConfig& config = streams[i]->config;
+    if (!config.target_url.empty()) {
+      max_connections += config.uploader_settings.max_concurrent_uploads;
+      enable_http2 |= config.uploader_settings.enable_http2 ||
+          config.uploader_settings.enable_http3;
+    }
+  }
+
+  if (!start_encoder_pool(*ptr_config,
+                          ptr_config->enc_config.encode_cores > 0 ?
+                              ptr_config->enc_config.encode_cores :
+                              stream_cores)) {
+    return EXIT_FAILURE;
+  }
+  if (scheduler.Init(planner.threads()) || scheduler.Run()) {
+    LOG(ERROR) << "task scheduler start failed.";
+    return EXIT_FAILURE;
+  }
+  for (size_t i = 0; i < streams.size(); ++i)
+    streams[i]->config.enc_config.task_scheduler = &scheduler;
+  webmlive::HttpUploadEngine* ptr_engine = NULL;
+  if (max_connections > 0) {
+    if (engine.Init(max_connections, enable_http2) || engine.Run()) {
+      LOG(ERROR) << "upload engine start failed.";
+      scheduler.Stop();
+      return EXIT_FAILURE;
+    }
+    ptr_engine = &engine;
+  }
+
+  size_t num_started = 0;
+  for (; num_started < streams.size(); ++num_started) {
+    if (start_stream(streams[num_started].get(), ptr_engine)) {
+      LOG(ERROR) << "stream " << num_started + 1 << " failed to start.";
+      break;
+    }
+  }
+  std::vector<Stream*> stream_ptrs;
+  for (size_t i = 0; i < num_started; ++i)
+    stream_ptrs.push_back(streams[i].get());
+  StreamController controller(stream_ptrs);
+  webmlive::ControlServer control_server;
+  if (num_started < streams.size() ||
+      !start_control(*ptr_config, &controller, &control_server)) {
+    for (size_t i = 0; i < num_started; ++i)
+      stop_stream(streams[i].get());
+    if (ptr_engine)
+      engine.Stop();
+    scheduler.Stop();
+    return EXIT_FAILURE;
+  }
+
+  const std::chrono::steady_clock::time_point start_time =
+      std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point metrics_time = start_time;
+  printf("\nRunning %d streams. Press the any key to quit...\n",
+         static_cast<int>(streams.size()));
+
+  // File input ends on its own; run until every stream has finished.
+  for (;;) {
+    const int64 elapsed_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start_time).count();
+    int num_running = 0;
+    int64 total_uploaded = 0;
+    for (size_t i = 0; i < streams.size(); ++i) {
+      if (!stream_finished(*streams[i]))
+        ++num_running;
+      webmlive::HttpUploaderStats stats;
+      if (update_stream(streams[i].get(), elapsed_ms, &stats))
+        total_uploaded += stats.bytes_sent_current + stats.total_bytes_uploaded;
+    }
+    if (key_pressed() || num_running == 0 || controller.stop_requested())
+      break;
+    printf("\rstreams running: %d, uploaded: %lld", num_running,
+           static_cast<long long>(total_uploaded));  // NOLINT
+
+    write_metrics(*ptr_config, &metrics_time);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  control_server.Stop();
+
+  // Stop the streams concurrently, so that they drain within one stop
+  // timeout instead of one each.
+  std::vector<std::unique_ptr<std::thread>> stop_threads(streams.size());
+  for (size_t i = 0; i < streams.size(); ++i) {
+    stop_threads[i].reset(new (std::nothrow) std::thread(  // NOLINT
+        stop_stream, streams[i].get()));
+    if (!stop_threads[i])
+      stop_stream(streams[i].get());
+  }
+  for (size_t i = 0; i < stop_threads.size(); ++i) {
+    if (stop_threads[i])
+      stop_threads[i]->join();
+  }
+  if (ptr_engine)
+    engine.Stop();
+  scheduler.Stop();
   return EXIT_SUCCESS;
 }
 
@@ -522,21 +3186,27 @@ int main(int argc, const char** argv) {
   WebmEncoderClientConfig config;
   parse_command_line(argc, argv, config);
 
-  // validate params
-  if (!config.target_url.empty()) {
-    // Confirm |stream_id| and |stream_name| are present when no query string
-    // is present in |target_url|.
-    if ((config.uploader_settings.stream_id.empty() ||
-        config.uploader_settings.stream_name.empty()) &&
-        config.target_url.find('?') == std::string::npos) {
-      LOG(ERROR) << "stream_id and stream_name are required when the target "
-                 << "URL lacks a query string!\n";
-      return EXIT_FAILURE;
-    }
+  webmlive::MemoryGovernorSettings memory_settings;
+  memory_settings.process_limit_bytes =
+      static_cast<int64>(config.memory_limit_mb) * 1024 * 1024;
+  memory_settings.stream_limit_bytes =
+      static_cast<int64>(config.stream_memory_limit_mb) * 1024 * 1024;
+  install_memory_report_handler();
+  webmlive::Tracepoints::Register();
+  if (config.async_log)
+    webmlive::AsyncLogSink::Instance().Start();
+  int exit_code = EXIT_FAILURE;
+  if (webmlive::MemoryGovernor::Instance().Configure(memory_settings)) {
+    LOG(ERROR) << "invalid --memory_limit or --stream_memory_limit.";
+  } else if (!config.host_config.empty()) {
+    exit_code = host_main(&config, argv[0]);
+  } else if (validate_config(config)) {
+    LOG(INFO) << "url: " << config.target_url.c_str();
+    exit_code = encoder_main(&config);
   }
-
-  LOG(INFO) << "url: " << config.target_url.c_str();
-  int exit_code = encoder_main(&config);
+  webmlive::EncoderContextPool::Instance().Stop();
+  webmlive::Tracepoints::Unregister();
+  webmlive::AsyncLogSink::Instance().Stop();
   google::ShutdownGoogleLogging();
   return exit_code;
 }
@@ -0,0 +1,296 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/fan_out_data_sink.h"
+
+#include <chrono>
+#include <functional>
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/thread_placement.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Time an output thread waits for its sink to become ready before checking
+// for a stop request.
+const int32 kMaxReadyWaitMs = 10;
+}  // namespace
+
+FanOutDataSink::FanOutDataSink() : running_(false) {
+}
+
+FanOutDataSink::~FanOutDataSink() {
+  if (running_) {
+    Stop();
+  }
+}
+
+int FanOutDataSink::AddOutput(DataSinkInterface* ptr_sink,
+                              const FanOutOutputSettings& settings) {
+  if (!ptr_sink || settings.max_queued_chunks < 1) {
+    LOG(ERROR) << "FanOutDataSink invalid output.";
+    return kInvalidArg;
+  }
+  std::unique_ptr<Output> output(new (std::nothrow) Output());  // NOLINT
+  if (!output) {
+    LOG(ERROR) << "FanOutDataSink cannot construct output.";
+    return kNoMemory;
+  }
+  output->ptr_sink = ptr_sink;
+  output->settings = settings;
+
+  std::lock_guard<std::mutex> lock(outputs_mutex_);
+  if (running_) {
+    // The priming chunks bypass |max_queued_chunks|: dropping any of them
+    // would leave the output without a decodable start.
+    std::vector<InitSegmentCache::Entry> entries;
+    init_segment_cache_.GetEntries(&entries);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      QueuedChunk queued_chunk;
+      queued_chunk.chunk = entries[i].chunk;
+      queued_chunk.id = entries[i].id;
+      output->queue.push_back(queued_chunk);
+    }
+    if (!StartOutput(output.get())) {
+      return kThreadError;
+    }
+    LOG(INFO) << "FanOutDataSink output added while running, primed with "
+              << entries.size() << " chunks.";
+  }
+  outputs_.push_back(std::move(output));
+  return kSuccess;
+}
+
+int FanOutDataSink::Run() {
+  std::unique_lock<std::mutex> lock(outputs_mutex_);
+  if (running_ || outputs_.empty()) {
+    LOG(ERROR) << "FanOutDataSink already running or has no outputs.";
+    return kInvalidArg;
+  }
+  init_segment_cache_.Init(InitSegmentCache::kDefaultMaxChunks);
+  for (size_t i = 0; i < outputs_.size(); ++i) {
+    if (!StartOutput(outputs_[i].get())) {
+      running_ = true;
+      lock.unlock();
+      Stop();
+      return kThreadError;
+    }
+  }
+  running_ = true;
+  return kSuccess;
+}
+
+void FanOutDataSink::Stop() {
+  // Outputs added from here on are not started.
+  {
+    std::lock_guard<std::mutex> lock(outputs_mutex_);
+    running_ = false;
+  }
+  const std::vector<Output*> outputs = OutputList();
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    Output* const ptr_output = outputs[i];
+    {
+      std::lock_guard<std::mutex> lock(ptr_output->mutex);
+      ptr_output->stop = true;
+    }
+    ptr_output->chunk_queued.notify_one();
+  }
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    Output* const ptr_output = outputs[i];
+    if (ptr_output->thread) {
+      ptr_output->thread->join();
+      ptr_output->thread.reset();
+    }
+  }
+}
+
+int FanOutDataSink::GetOutputStats(int index,
+                                   FanOutOutputStats* ptr_stats) const {
+  const std::vector<Output*> outputs = OutputList();
+  if (index < 0 || index >= static_cast<int>(outputs.size()) || !ptr_stats) {
+    return kInvalidArg;
+  }
+  Output* const ptr_output = outputs[index];
+  std::lock_guard<std::mutex> lock(ptr_output->mutex);
+  *ptr_stats = ptr_output->stats;
+  return kSuccess;
+}
+
+int FanOutDataSink::num_outputs() const {
+  std::lock_guard<std::mutex> lock(outputs_mutex_);
+  return static_cast<int>(outputs_.size());
+}
+
+bool FanOutDataSink::Ready() const {
+  return running_;
+}
+
+bool FanOutDataSink::WriteData(const uint8* ptr_data, int32 data_length,
+                               const std::string& id) {
+  std::shared_ptr<DataChunk> chunk(new (std::nothrow) DataChunk());  // NOLINT
+  if (!chunk || chunk->Init(ptr_data, data_length)) {
+    LOG(ERROR) << "FanOutDataSink cannot copy data for " << id;
+    return false;
+  }
+  return WriteChunk(chunk, id);
+}
+
+bool FanOutDataSink::WriteChunk(const SharedDataChunk& chunk,
+                                const std::string& id) {
+  if (!running_ || !chunk) {
+    return false;
+  }
+  QueuedChunk queued_chunk;
+  queued_chunk.chunk = chunk;
+  queued_chunk.id = id;
+  std::lock_guard<std::mutex> lock(outputs_mutex_);
+  init_segment_cache_.Put(chunk, id);
+  for (size_t i = 0; i < outputs_.size(); ++i) {
+    QueueChunk(queued_chunk, outputs_[i].get());
+  }
+  return true;
+}
+
+bool FanOutDataSink::WriteStreamingChunk(const SharedStreamingChunk& chunk,
+                                         const std::string& id) {
+  if (!running_ || !chunk) {
+    return false;
+  }
+  const std::vector<Output*> outputs = OutputList();
+  bool accepted = false;
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    if (outputs[i]->ptr_sink->WriteStreamingChunk(chunk, id)) {
+      accepted = true;
+    }
+  }
+  return accepted;
+}
+
+int FanOutDataSink::Drain(int32 timeout_ms) {
+  const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  int undelivered = 0;
+  const std::vector<Output*> outputs = OutputList();
+
+  // The output threads run concurrently, so waiting for each in turn takes
+  // as long as the slowest.
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    Output* const ptr_output = outputs[i];
+    std::unique_lock<std::mutex> lock(ptr_output->mutex);
+    ptr_output->chunk_done.wait_until(lock, deadline, [ptr_output] {
+      return ptr_output->queue.empty() && !ptr_output->busy;
+    });
+    undelivered += static_cast<int>(ptr_output->queue.size()) +
+                   (ptr_output->busy ? 1 : 0);
+  }
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    const int64 remaining_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+    undelivered += outputs[i]->ptr_sink->Drain(
+        static_cast<int32>(remaining_ms > 0 ? remaining_ms : 0));
+  }
+  return undelivered;
+}
+
+bool FanOutDataSink::StartOutput(Output* ptr_output) {
+  ptr_output->thread.reset(
+      new (std::nothrow) std::thread(  // NOLINT
+          std::bind(&FanOutDataSink::OutputThread, this, ptr_output)));
+  if (!ptr_output->thread) {
+    LOG(ERROR) << "FanOutDataSink cannot construct thread.";
+    return false;
+  }
+  return true;
+}
+
+std::vector<FanOutDataSink::Output*> FanOutDataSink::OutputList() const {
+  std::lock_guard<std::mutex> lock(outputs_mutex_);
+  std::vector<Output*> outputs(outputs_.size());
+  for (size_t i = 0; i < outputs_.size(); ++i) {
+    outputs[i] = outputs_[i].get();
+  }
+  return outputs;
+}
+
+void FanOutDataSink::QueueChunk(const QueuedChunk& chunk, Output* ptr_output) {
+  {
+    std::lock_guard<std::mutex> lock(ptr_output->mutex);
+    const size_t max_queued =
+        static_cast<size_t>(ptr_output->settings.max_queued_chunks);
+    if (ptr_output->queue.size() >= max_queued) {
+      ++ptr_output->stats.chunks_dropped;
+      if (ptr_output->settings.drop_policy == kDropNewest) {
+        VLOG(1) << "FanOutDataSink output full, dropped " << chunk.id;
+        return;
+      }
+      VLOG(1) << "FanOutDataSink output full, dropped "
+              << ptr_output->queue.front().id;
+      ptr_output->queue.pop_front();
+    }
+    ptr_output->queue.push_back(chunk);
+  }
+  ptr_output->chunk_queued.notify_one();
+}
+
+void FanOutDataSink::OutputThread(Output* ptr_output) {
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kUpload);
+  ScopedCpuStage cpu_stage(kCpuUpload);
+  DataSinkInterface* const ptr_sink = ptr_output->ptr_sink;
+  for (;;) {
+    QueuedChunk chunk;
+    bool stopping = false;
+    {
+      std::unique_lock<std::mutex> lock(ptr_output->mutex);
+      ptr_output->chunk_queued.wait(lock, [ptr_output] {
+        return ptr_output->stop || !ptr_output->queue.empty();
+      });
+      if (ptr_output->queue.empty()) {
+        break;
+      }
+      chunk = ptr_output->queue.front();
+      ptr_output->queue.pop_front();
+      ptr_output->busy = true;
+      stopping = ptr_output->stop;
+    }
+
+    // Wait for the sink. Once stopping, give up on a sink that stays busy
+    // for |kMaxStopWaitMs|.
+    bool ready = false;
+    if (stopping) {
+      ready = ptr_sink->WaitUntilReady(kMaxStopWaitMs);
+    } else {
+      for (;;) {
+        ready = ptr_sink->WaitUntilReady(kMaxReadyWaitMs);
+        if (ready)
+          break;
+        std::lock_guard<std::mutex> lock(ptr_output->mutex);
+        if (ptr_output->stop)
+          break;
+      }
+      if (!ready)
+        ready = ptr_sink->WaitUntilReady(kMaxStopWaitMs);
+    }
+
+    const bool write_ok = ready && ptr_sink->WriteChunk(chunk.chunk, chunk.id);
+    std::lock_guard<std::mutex> lock(ptr_output->mutex);
+    if (!ready) {
+      ++ptr_output->stats.chunks_dropped;
+    } else if (write_ok) {
+      ++ptr_output->stats.chunks_written;
+    } else {
+      LOG(ERROR) << "FanOutDataSink output write failed for " << chunk.id;
+      ++ptr_output->stats.write_failures;
+    }
+    ptr_output->busy = false;
+    ptr_output->chunk_done.notify_all();
+  }
+}
+
+}  // namespace webmlive
@@ -0,0 +1,168 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_FAN_OUT_DATA_SINK_H_
+#define WEBMLIVE_ENCODER_FAN_OUT_DATA_SINK_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/data_sink.h"
+#include "encoder/init_segment_cache.h"
+
+namespace webmlive {
+
+// What a |FanOutDataSink| output does with a chunk when its queue is full.
+enum FanOutDropPolicy {
+  // Drop the oldest queued chunk to make room; favors fresh data for live
+  // outputs.
+  kDropOldest = 0,
+
+  // Drop the new chunk; keeps the queued chunks contiguous.
+  kDropNewest = 1,
+};
+
+struct FanOutOutputSettings {
+  static const int kDefaultMaxQueuedChunks = 16;
+
+  FanOutOutputSettings()
+      : max_queued_chunks(kDefaultMaxQueuedChunks),
+        drop_policy(kDropOldest) {}
+
+  // Number of chunks waiting for the output before |drop_policy| applies.
+  int max_queued_chunks;
+  FanOutDropPolicy drop_policy;
+};
+
+struct FanOutOutputStats {
+  FanOutOutputStats()
+      : chunks_written(0), chunks_dropped(0), write_failures(0) {}
+
+  int64 chunks_written;
+  int64 chunks_dropped;
+  int64 write_failures;
+};
+
+// Data sink that passes every chunk to a list of output sinks. All outputs
+// share the same immutable chunk, and each output is fed from its own queue
+// by its own thread, so a slow output never delays the others or the writer.
+//
+// Notes
+// - Outputs must outlive the fan-out sink, which does not start or stop
+//   them. Outputs added while running are primed from an |InitSegmentCache|
+//   of the chunks written so far: they receive each muxer's metadata chunk
+//   and its chunks since the newest keyframe before anything new.
+// - |Ready()| returns true while running: outputs that fall behind drop
+//   chunks according to their |FanOutDropPolicy| instead of blocking writes.
+// - |WriteStreamingChunk()| is passed directly to the outputs, which do not
+//   block when accepting streaming chunks.
+class FanOutDataSink : public DataSinkInterface {
+ public:
+  enum {
+    // Cannot start an output thread.
+    kThreadError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Time |Stop()| waits for an output to accept each remaining chunk before
+  // dropping it.
+  static const int32 kMaxStopWaitMs = 1000;
+
+  FanOutDataSink();
+  virtual ~FanOutDataSink();
+
+  // Adds |ptr_sink| to the outputs, and starts its thread when running.
+  // Returns |kSuccess| when successful.
+  int AddOutput(DataSinkInterface* ptr_sink,
+                const FanOutOutputSettings& settings);
+
+  // Starts one thread per output.
+  int Run();
+
+  // Passes queued chunks to the outputs, and stops the output threads.
+  void Stop();
+
+  // Copies the stats of the output at |index|, in |AddOutput()| order, to
+  // |ptr_stats|.
+  int GetOutputStats(int index, FanOutOutputStats* ptr_stats) const;
+
+  int num_outputs() const;
+
+  // DataSinkInterface methods.
+  virtual bool Ready() const;
+  virtual bool WriteData(const uint8* ptr_data, int32 data_length,
+                         const std::string& id);
+  virtual bool WriteChunk(const SharedDataChunk& chunk,
+                          const std::string& id);
+  virtual bool WriteStreamingChunk(const SharedStreamingChunk& chunk,
+                                   const std::string& id);
+
+  // Waits for the outputs to accept their queued chunks, and then for each
+  // output to drain, within |timeout_ms| overall. Returns the number of
+  // chunks left in the queues plus those the outputs left undelivered.
+  virtual int Drain(int32 timeout_ms);
+
+ private:
+  struct QueuedChunk {
+    SharedDataChunk chunk;
+    std::string id;
+  };
+
+  // Output sink, its queue, and the thread feeding it.
+  struct Output {
+    Output() : ptr_sink(NULL), busy(false), stop(false) {}
+
+    DataSinkInterface* ptr_sink;
+    FanOutOutputSettings settings;
+    std::deque<QueuedChunk> queue;
+    FanOutOutputStats stats;
+    // True while the output thread passes a chunk to |ptr_sink|.
+    bool busy;
+    bool stop;
+    std::mutex mutex;
+    std::condition_variable chunk_queued;
+    // Signalled each time the output thread is done with a chunk.
+    std::condition_variable chunk_done;
+    std::unique_ptr<std::thread> thread;
+  };
+
+  // Adds |chunk| to the queue of |ptr_output|, applying its drop policy.
+  void QueueChunk(const QueuedChunk& chunk, Output* ptr_output);
+
+  // Passes chunks from the queue of |ptr_output| to its sink until stopped.
+  void OutputThread(Output* ptr_output);
+
+  // Starts the thread of |ptr_output|. Returns false upon failure.
+  bool StartOutput(Output* ptr_output);
+
+  // Returns the outputs, under |outputs_mutex_|. Outputs are never removed,
+  // so the pointers stay valid after it is released.
+  std::vector<Output*> OutputList() const;
+
+  // |outputs_mutex_| protects |outputs_|, and orders |AddOutput()| with
+  // |WriteChunk()| so that a new output is primed with exactly the chunks
+  // written before it.
+  mutable std::mutex outputs_mutex_;
+  std::vector<std::unique_ptr<Output>> outputs_;
+  std::atomic<bool> running_;
+  InitSegmentCache init_segment_cache_;
+
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(FanOutDataSink);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_FAN_OUT_DATA_SINK_H_
@@ -0,0 +1,186 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/field_interpolate.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WEBMLIVE_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace webmlive {
+
+namespace {
+// Samples the widest direction reaches on either side of |x|. Samples
+// closer than this to either end use the vertical direction only.
+const int32 kEdgeReach = 3;
+
+// Widest direction tried, in samples from vertical.
+const int kMaxDirection = 2;
+
+int AbsDiff(int a, int b) {
+  return a > b ? a - b : b - a;
+}
+
+// Sum of the differences between the three samples of |ptr_above| centered
+// on |x| + |j| and those of |ptr_below| centered on |x| - |j|.
+int DirectionScore(const uint8* ptr_above, const uint8* ptr_below, int32 x,
+                   int j) {
+  return AbsDiff(ptr_above[x - 1 + j], ptr_below[x - 1 - j]) +
+         AbsDiff(ptr_above[x + j], ptr_below[x - j]) +
+         AbsDiff(ptr_above[x + 1 + j], ptr_below[x + 1 - j]);
+}
+
+// Scalar loop. Interpolates the samples from |first| to |last|.
+void InterpolateRowScalar(const FieldRows& rows, bool average, uint8* ptr_dst,
+                          int32 first, int32 last, int32 width) {
+  const uint8* const ptr_above = rows.above;
+  const uint8* const ptr_below = rows.below;
+  for (int32 x = first; x < last; ++x) {
+    const int c = ptr_above[x];
+    const int e = ptr_below[x];
+    int spatial = (c + e) >> 1;
+    if (x >= kEdgeReach && x < width - kEdgeReach) {
+      int score = DirectionScore(ptr_above, ptr_below, x, 0) - 1;
+
+      // Left leaning directions, then right leaning ones; the wider one is
+      // tried only when the narrower one scores better.
+      for (int side = -1; side <= 1; side += 2) {
+        for (int j = side; std::abs(j) <= kMaxDirection; j += side) {
+          const int direction_score =
+              DirectionScore(ptr_above, ptr_below, x, j);
+          if (direction_score >= score) {
+            break;
+          }
+          score = direction_score;
+          spatial = (ptr_above[x + j] + ptr_below[x - j]) >> 1;
+        }
+      }
+    }
+    if (rows.prev) {
+      const int a = rows.prev[x];
+      const int b = rows.cur[x];
+      const int temporal = average ? (a + b) >> 1 : b;
+      const int diff = std::max(
+          AbsDiff(a, b) >> 1,
+          (AbsDiff(rows.prev_above[x], c) + AbsDiff(rows.prev_below[x], e)) >>
+              1);
+      if (spatial > temporal + diff) {
+        spatial = temporal + diff;
+      } else if (spatial < temporal - diff) {
+        spatial = temporal - diff;
+      }
+    }
+    ptr_dst[x] = static_cast<uint8>(spatial);
+  }
+}
+
+#if defined(WEBMLIVE_HAVE_SSE2)
+// Loads 8 samples into 16 bit lanes.
+__m128i LoadWide(const uint8* ptr_samples) {
+  return _mm_unpacklo_epi8(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(ptr_samples)),
+      _mm_setzero_si128());
+}
+
+__m128i AbsDiffWide(__m128i a, __m128i b) {
+  return _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a));
+}
+
+__m128i Select(__m128i mask, __m128i a, __m128i b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+__m128i DirectionScoreWide(const uint8* ptr_above, const uint8* ptr_below,
+                           int32 x, int j) {
+  return _mm_add_epi16(
+      _mm_add_epi16(AbsDiffWide(LoadWide(ptr_above + x - 1 + j),
+                                LoadWide(ptr_below + x - 1 - j)),
+                    AbsDiffWide(LoadWide(ptr_above + x + j),
+                                LoadWide(ptr_below + x - j))),
+      AbsDiffWide(LoadWide(ptr_above + x + 1 + j),
+                  LoadWide(ptr_below + x + 1 - j)));
+}
+
+// Vector loop. Interpolates 8 samples at a time in signed 16 bit lanes from
+// |first|, and returns the sample after the last it interpolated. Stops
+// |kEdgeReach| samples from the end of the row. Scores are at most 765, so
+// signed comparisons are safe.
+int32 InterpolateRowSimd(const FieldRows& rows, bool average, uint8* ptr_dst,
+                         int32 first, int32 width) {
+  const uint8* const ptr_above = rows.above;
+  const uint8* const ptr_below = rows.below;
+  const __m128i one = _mm_set1_epi16(1);
+  const __m128i all = _mm_cmpeq_epi16(one, one);
+  int32 x = first;
+  for (; x + 8 <= width - kEdgeReach; x += 8) {
+    const __m128i c = LoadWide(ptr_above + x);
+    const __m128i e = LoadWide(ptr_below + x);
+    __m128i spatial = _mm_srli_epi16(_mm_add_epi16(c, e), 1);
+    __m128i score =
+        _mm_sub_epi16(DirectionScoreWide(ptr_above, ptr_below, x, 0), one);
+    for (int side = -1; side <= 1; side += 2) {
+      __m128i better = all;
+      for (int j = side; std::abs(j) <= kMaxDirection; j += side) {
+        const __m128i direction_score =
+            DirectionScoreWide(ptr_above, ptr_below, x, j);
+        better = _mm_and_si128(better,
+                               _mm_cmplt_epi16(direction_score, score));
+        score = Select(better, direction_score, score);
+        const __m128i direction_pred = _mm_srli_epi16(
+            _mm_add_epi16(LoadWide(ptr_above + x + j),
+                          LoadWide(ptr_below + x - j)), 1);
+        spatial = Select(better, direction_pred, spatial);
+      }
+    }
+
+    const __m128i a = LoadWide(rows.prev + x);
+    const __m128i b = LoadWide(rows.cur + x);
+    const __m128i temporal =
+        average ? _mm_srli_epi16(_mm_add_epi16(a, b), 1) : b;
+    const __m128i diff = _mm_max_epi16(
+        _mm_srli_epi16(AbsDiffWide(a, b), 1),
+        _mm_srli_epi16(
+            _mm_add_epi16(AbsDiffWide(LoadWide(rows.prev_above + x), c),
+                          AbsDiffWide(LoadWide(rows.prev_below + x), e)), 1));
+    spatial = _mm_max_epi16(
+        _mm_min_epi16(spatial, _mm_add_epi16(temporal, diff)),
+        _mm_sub_epi16(temporal, diff));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(ptr_dst + x),
+                     _mm_packus_epi16(spatial, spatial));
+  }
+  return x;
+}
+#else
+int32 InterpolateRowSimd(const FieldRows&, bool, uint8*, int32 first,
+                         int32) {
+  return first;
+}
+#endif
+}  // namespace
+
+void InterpolateFieldRow(const FieldRows& rows, bool average, uint8* ptr_dst,
+                         int32 width) {
+  if (width <= 0) {
+    return;
+  }
+
+  // The vector loop covers the middle of rows that have a previous frame;
+  // the first frame of a stream is rare enough to leave to the scalar loop.
+  int32 x = 0;
+  if (rows.prev && width > 2 * kEdgeReach) {
+    InterpolateRowScalar(rows, average, ptr_dst, 0, kEdgeReach, width);
+    x = InterpolateRowSimd(rows, average, ptr_dst, kEdgeReach, width);
+  }
+  InterpolateRowScalar(rows, average, ptr_dst, x, width, width);
+}
+
+}  // namespace webmlive
@@ -0,0 +1,62 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_FIELD_INTERPOLATE_H_
+#define WEBMLIVE_ENCODER_FIELD_INTERPOLATE_H_
+
+#include <cstddef>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Rows of 8 bit samples around a row of an interlaced frame that belongs to
+// the field being replaced. |above| and |below| are the neighboring rows of
+// the field kept, in the current frame, and |prev_above| and |prev_below|
+// the same rows of the previous frame. |cur| and |prev| are the replaced row
+// itself in the current and previous frames. The |prev| rows are NULL when
+// there is no previous frame.
+struct FieldRows {
+  FieldRows()
+      : above(NULL),
+        below(NULL),
+        cur(NULL),
+        prev(NULL),
+        prev_above(NULL),
+        prev_below(NULL) {}
+  const uint8* above;
+  const uint8* below;
+  const uint8* cur;
+  const uint8* prev;
+  const uint8* prev_above;
+  const uint8* prev_below;
+};
+
+// Writes |width| samples of the row of |rows| to |ptr_dst|, interpolated at
+// the capture time of the field kept, as yadif does without its spatial
+// interlacing check:
+// - The spatial prediction averages the samples of |above| and |below|
+//   along the direction, within two samples of vertical, whose samples
+//   differ least.
+// - The temporal prediction is the average of |prev| and |cur| when
+//   |average| is true, for a field kept that was captured between them, and
+//   |cur| otherwise, for one captured right after |cur|.
+// - The spatial prediction is clamped to the temporal prediction plus or
+//   minus the larger of half the difference between |prev| and |cur|, and
+//   the mean difference between the kept rows of both frames. Static areas
+//   therefore keep their full vertical resolution, and moving ones are
+//   interpolated from the field kept alone.
+// Without previous rows, the spatial prediction is written as it is.
+//
+// Uses SSE2 when the target supports it; the vector and scalar loops give
+// identical results.
+void InterpolateFieldRow(const FieldRows& rows, bool average, uint8* ptr_dst,
+                         int32 width);
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_FIELD_INTERPOLATE_H_
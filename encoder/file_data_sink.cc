@@ -0,0 +1,350 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/file_data_sink.h"
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/segment_cache.h"
+#include "encoder/thread_placement.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+const char kTempFileSuffix[] = ".tmp";
+
+// Files the I/O thread deletes between checks for queued writes.
+const size_t kMaxDeletesPerBatch = 4;
+}  // namespace
+
+FileDataSink::FileDataSink() : stop_(false), active_writes_(0) {
+}
+
+FileDataSink::~FileDataSink() {
+  if (io_thread_) {
+    Stop();
+  }
+}
+
+int FileDataSink::Init(const FileDataSinkSettings& settings) {
+  if (settings.max_pending_writes < 1 || settings.sync_interval_ms < 0 ||
+      settings.retention_window_ms < 0) {
+    LOG(ERROR) << "FileDataSink max_pending_writes must be at least 1, and "
+               << "sync_interval_ms and retention_window_ms 0 or more.";
+    return kInvalidArg;
+  }
+  settings_ = settings;
+  write_buffer_.reset(new (std::nothrow) char[kWriteBufferSize]);  // NOLINT
+  if (!write_buffer_) {
+    LOG(ERROR) << "FileDataSink cannot allocate write buffer.";
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+int FileDataSink::Run() {
+  if (io_thread_) {
+    LOG(ERROR) << "FileDataSink already running.";
+    return kThreadError;
+  }
+  using std::bind;
+  using std::nothrow;
+  using std::thread;
+  io_thread_.reset(
+      new (nothrow) thread(bind(&FileDataSink::IoThread, this)));  // NOLINT
+  if (!io_thread_) {
+    LOG(ERROR) << "FileDataSink cannot construct thread.";
+    return kThreadError;
+  }
+  return kSuccess;
+}
+
+void FileDataSink::Stop() {
+  CHECK(io_thread_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  write_queued_.notify_one();
+  io_thread_->join();
+  io_thread_.reset();
+}
+
+int FileDataSink::GetStats(FileDataSinkStats* ptr_stats) const {
+  if (!ptr_stats) {
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  *ptr_stats = stats_;
+  return kSuccess;
+}
+
+bool FileDataSink::Ready() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return CanQueueWrite();
+}
+
+bool FileDataSink::WaitUntilReady(int32 timeout_ms) const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return write_complete_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                                  [this] { return CanQueueWrite(); });
+}
+
+int FileDataSink::Drain(int32 timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  write_complete_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] {
+    return pending_writes_.empty() && active_writes_ == 0;
+  });
+  return static_cast<int>(pending_writes_.size()) + active_writes_;
+}
+
+bool FileDataSink::WriteData(const uint8* ptr_data, int32 data_length,
+                             const std::string& id) {
+  std::shared_ptr<DataChunk> chunk(new (std::nothrow) DataChunk());  // NOLINT
+  if (!chunk || chunk->Init(ptr_data, data_length)) {
+    LOG(ERROR) << "FileDataSink cannot copy data for " << id;
+    return false;
+  }
+  return WriteChunk(chunk, id);
+}
+
+bool FileDataSink::WriteChunk(const SharedDataChunk& chunk,
+                              const std::string& id) {
+  if (!chunk || id.empty()) {
+    LOG(ERROR) << "FileDataSink cannot write NULL chunk or empty id.";
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_) {
+      return false;
+    }
+    PendingWrite write;
+    write.file_name = settings_.directory + id;
+    write.chunk = chunk;
+
+    // Drop a queued write to the same file; this one supersedes it. The
+    // queue is short, so a scan costs less than keeping an index of it.
+    for (std::deque<PendingWrite>::iterator it = pending_writes_.begin();
+         it != pending_writes_.end(); ++it) {
+      if (it->file_name == write.file_name) {
+        pending_writes_.erase(it);
+        ++stats_.writes_coalesced;
+        break;
+      }
+    }
+    if (!CanQueueWrite()) {
+      return false;
+    }
+    pending_writes_.push_back(write);
+  }
+  write_queued_.notify_one();
+  return true;
+}
+
+bool FileDataSink::CanQueueWrite() const {
+  const size_t pending = pending_writes_.size() + active_writes_;
+  return pending < static_cast<size_t>(settings_.max_pending_writes);
+}
+
+bool FileDataSink::WriteFile(const PendingWrite& write) {
+  const std::string temp_name = write.file_name + kTempFileSuffix;
+  FILE* const file = fopen(temp_name.c_str(), "wb");
+  if (!file) {
+    LOG(ERROR) << "FileDataSink cannot open " << temp_name;
+    return false;
+  }
+  setvbuf(file, write_buffer_.get(), _IOFBF, kWriteBufferSize);
+
+  int64 bytes_written = 0;
+  const std::vector<DataChunk::Span>& spans = write.chunk->spans();
+  for (size_t i = 0; i < spans.size(); ++i) {
+    bytes_written += fwrite(spans[i].ptr_data, 1, spans[i].length, file);
+  }
+  const bool close_ok = (fclose(file) == 0);
+  if (!close_ok || bytes_written != write.chunk->length()) {
+    LOG(ERROR) << "FileDataSink write failed for " << temp_name;
+    remove(temp_name.c_str());
+    return false;
+  }
+
+  // rename() does not replace existing files on all platforms, and files
+  // such as the manifest are rewritten.
+  remove(write.file_name.c_str());
+  if (rename(temp_name.c_str(), write.file_name.c_str())) {
+    LOG(ERROR) << "FileDataSink cannot rename " << temp_name;
+    return false;
+  }
+  return true;
+}
+
+void FileDataSink::TrackSegment(const PendingWrite& write) {
+  std::string rep_id;
+  int64 number = 0;
+  const size_t name_pos = settings_.directory.size();
+  if (!SegmentCache::ParseSegmentId(write.file_name.substr(name_pos), &rep_id,
+                                    &number)) {
+    return;
+  }
+  WrittenSegment segment;
+  segment.file_name = write.file_name;
+  segment.media_time_ms = SegmentCache::ReadMediaTime(*write.chunk);
+  if (segment.media_time_ms < 0) {
+    LOG(WARNING) << "FileDataSink cannot read media time of "
+                 << write.file_name << ", keeping it.";
+    return;
+  }
+
+  // A rewritten segment replaces its entry instead of adding one.
+  std::deque<WrittenSegment>& segments = written_segments_[rep_id];
+  for (std::deque<WrittenSegment>::iterator it = segments.begin();
+       it != segments.end(); ++it) {
+    if (it->file_name == segment.file_name) {
+      segments.erase(it);
+      break;
+    }
+  }
+  segments.push_back(segment);
+  const int64 window_start =
+      segment.media_time_ms - settings_.retention_window_ms;
+  while (segments.size() > 1 && segments[1].media_time_ms < window_start) {
+    expired_files_.push_back(segments.front().file_name);
+    segments.pop_front();
+  }
+}
+
+void FileDataSink::DeleteExpiredFiles(size_t max_files) {
+  int64 files_deleted = 0;
+  for (size_t i = 0; i < max_files && !expired_files_.empty(); ++i) {
+    const std::string& file_name = expired_files_.front();
+    if (remove(file_name.c_str())) {
+      LOG(WARNING) << "FileDataSink cannot delete " << file_name;
+    } else {
+      ++files_deleted;
+    }
+    unsynced_files_.erase(file_name);
+    expired_files_.pop_front();
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.files_deleted += files_deleted;
+}
+
+// fsync() of each file written in the interval, then of the directory, which
+// makes the renames durable. A file that cannot be opened was replaced or
+// removed since; its successor is in the set, or it no longer matters.
+void FileDataSink::SyncFiles() {
+#ifndef _WIN32
+  for (std::set<std::string>::const_iterator it = unsynced_files_.begin();
+       it != unsynced_files_.end(); ++it) {
+    const int fd = open(it->c_str(), O_RDONLY);
+    if (fd < 0) {
+      continue;
+    }
+    if (fsync(fd)) {
+      LOG(WARNING) << "FileDataSink cannot sync " << *it;
+    }
+    close(fd);
+  }
+  const std::string directory =
+      settings_.directory.empty() ? "." : settings_.directory;
+  const int dir_fd = open(directory.c_str(), O_RDONLY);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+#endif
+  unsynced_files_.clear();
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++stats_.syncs;
+}
+
+void FileDataSink::IoThread() {
+  LOG(INFO) << "FileDataSink thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kUpload);
+  ScopedCpuStage cpu_stage(kCpuUpload);
+  const std::chrono::milliseconds sync_interval(settings_.sync_interval_ms);
+  for (;;) {
+    PendingWrite write;
+    bool sync_due = false;
+    bool delete_due = false;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      const auto write_ready = [this] {
+        return stop_ || !pending_writes_.empty() || !expired_files_.empty();
+      };
+      if (unsynced_files_.empty()) {
+        write_queued_.wait(lock, write_ready);
+      } else {
+        sync_due = !write_queued_.wait_until(lock, next_sync_time_,
+                                             write_ready);
+      }
+      if (!sync_due && pending_writes_.empty()) {
+        if (stop_) {
+          // Every queued file has been written.
+          break;
+        }
+        // Only expired files are waiting; writes go first.
+        delete_due = true;
+      }
+      if (!sync_due && !delete_due) {
+        write = pending_writes_.front();
+        pending_writes_.pop_front();
+        ++active_writes_;
+      }
+    }
+    if (sync_due ||
+        (!unsynced_files_.empty() &&
+         std::chrono::steady_clock::now() >= next_sync_time_)) {
+      SyncFiles();
+    }
+    if (delete_due) {
+      DeleteExpiredFiles(kMaxDeletesPerBatch);
+      continue;
+    }
+    if (sync_due) {
+      continue;
+    }
+
+    const bool write_ok = WriteFile(write);
+    if (write_ok && settings_.sync_interval_ms > 0) {
+      if (unsynced_files_.empty()) {
+        next_sync_time_ = std::chrono::steady_clock::now() + sync_interval;
+      }
+      unsynced_files_.insert(write.file_name);
+    }
+    if (write_ok && settings_.retention_window_ms > 0) {
+      TrackSegment(write);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --active_writes_;
+      if (write_ok) {
+        ++stats_.files_written;
+        stats_.bytes_written += write.chunk->length();
+      } else {
+        ++stats_.write_errors;
+      }
+    }
+    write_complete_.notify_all();
+  }
+  DeleteExpiredFiles(expired_files_.size());
+  if (!unsynced_files_.empty()) {
+    SyncFiles();
+  }
+  LOG(INFO) << "FileDataSink thread finished.";
+}
+
+}  // namespace webmlive
@@ -0,0 +1,211 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_FILE_DATA_SINK_H_
+#define WEBMLIVE_ENCODER_FILE_DATA_SINK_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/data_sink.h"
+
+namespace webmlive {
+
+struct FileDataSinkSettings {
+  static const int kDefaultMaxPendingWrites = 16;
+
+  FileDataSinkSettings()
+      : max_pending_writes(kDefaultMaxPendingWrites),
+        sync_interval_ms(0),
+        retention_window_ms(0) {}
+
+  // Output directory. Prepended to the id passed with each write to form the
+  // file name, so it must end with a path separator.
+  std::string directory;
+
+  // Maximum number of files queued or being written. |Ready()| returns false
+  // while the limit is reached.
+  int max_pending_writes;
+
+  // Interval in milliseconds at which the files written since the last
+  // interval are synced to disk, together with the directory. A file
+  // rewritten several times in an interval, such as the manifest, is synced
+  // once. Durability is left to the operating system when 0.
+  int sync_interval_ms;
+
+  // Media time of media segments kept on disk, usually the DASH time shift
+  // buffer depth. A segment is deleted once the segment after it in its
+  // representation starts more than |retention_window_ms| before the newest
+  // one, so every segment the manifest still lists stays. Manifests and
+  // initialization segments are kept. 0 keeps every file.
+  int retention_window_ms;
+};
+
+struct FileDataSinkStats {
+  FileDataSinkStats()
+      : files_written(0), bytes_written(0), write_errors(0),
+        writes_coalesced(0), syncs(0), files_deleted(0) {}
+
+  int64 files_written;
+  int64 bytes_written;
+
+  // Number of files that could not be written.
+  int64 write_errors;
+
+  // Number of queued writes replaced by a later write to the same file
+  // before the I/O thread reached them.
+  int64 writes_coalesced;
+
+  // Number of sync batches performed.
+  int64 syncs;
+
+  // Number of media segments deleted by the retention window.
+  int64 files_deleted;
+};
+
+// Data sink that writes each chunk to its own file on a dedicated I/O thread.
+// Writes are queued without copying |SharedDataChunk|s, so callers never wait
+// on the disk.
+//
+// Notes
+// - Files are written under a temporary name and renamed once complete, which
+//   keeps readers such as DASH players from seeing partial files.
+// - A write queued for a file that already has a write waiting replaces it,
+//   and moves to the back of the queue so that a manifest still follows the
+//   chunks it lists. Repeated manifest updates cost one file write while the
+//   disk is behind.
+// - Each file is written through one large stdio buffer, so a chunk made of
+//   many spans reaches the disk in few writes.
+// - With |FileDataSinkSettings::sync_interval_ms| set, durability is batched:
+//   files renamed during an interval are synced at its end, so a crash can
+//   lose at most the files of the last interval, never tear one.
+// - With |FileDataSinkSettings::retention_window_ms| set, the sink tracks the
+//   media segments it writes, and deletes those that left the window a few
+//   at a time, from the I/O thread, once no write is waiting. The directory
+//   is never listed, so files of earlier runs are left alone.
+// - Write failures are logged and counted in |FileDataSinkStats|; they do not
+//   stop the sink.
+// - |Stop()| writes all queued files before returning.
+class FileDataSink : public DataSinkInterface {
+ public:
+  enum {
+    // Cannot start the I/O thread.
+    kThreadError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Size of the stdio buffer used by the I/O thread. Allocated once and
+  // reused for every file.
+  static const int32 kWriteBufferSize = 256 * 1024;
+
+  FileDataSink();
+  virtual ~FileDataSink();
+
+  // Copies |settings|. Returns |kSuccess| when successful.
+  int Init(const FileDataSinkSettings& settings);
+
+  // Starts the I/O thread.
+  int Run();
+
+  // Writes all queued files, and stops the I/O thread.
+  void Stop();
+
+  // Copies the current stats to |ptr_stats|.
+  int GetStats(FileDataSinkStats* ptr_stats) const;
+
+  // DataSinkInterface methods.
+  virtual bool Ready() const;
+  virtual bool WaitUntilReady(int32 timeout_ms) const;
+  virtual bool WriteData(const uint8* ptr_data, int32 data_length,
+                         const std::string& id);
+  virtual bool WriteChunk(const SharedDataChunk& chunk,
+                          const std::string& id);
+  virtual int Drain(int32 timeout_ms);
+
+ private:
+  struct PendingWrite {
+    std::string file_name;
+    SharedDataChunk chunk;
+  };
+
+  // Returns true when |pending_writes_| has room. |mutex_| must be held.
+  bool CanQueueWrite() const;
+
+  // Media segment written to disk, tracked for the retention window.
+  struct WrittenSegment {
+    WrittenSegment() : media_time_ms(0) {}
+    std::string file_name;
+    int64 media_time_ms;
+  };
+
+  // Writes |write| to disk, and returns true when successful.
+  bool WriteFile(const PendingWrite& write);
+
+  // Tracks |write| when it is a media segment, and moves the segments of its
+  // representation that left the retention window to |expired_files_|.
+  // Called by the I/O thread only.
+  void TrackSegment(const PendingWrite& write);
+
+  // Deletes up to |max_files| of |expired_files_|, oldest first. Called by
+  // the I/O thread only.
+  void DeleteExpiredFiles(size_t max_files);
+
+  // Syncs the files in |unsynced_files_| and the directory to disk. Called by
+  // the I/O thread only.
+  void SyncFiles();
+
+  // Waits for queued writes and performs them until |stop_| is set and the
+  // queue is empty.
+  void IoThread();
+
+  FileDataSinkSettings settings_;
+  bool stop_;
+
+  // Files waiting for the I/O thread, and the number being written.
+  std::deque<PendingWrite> pending_writes_;
+  int active_writes_;
+  FileDataSinkStats stats_;
+
+  // stdio buffer owned by the I/O thread.
+  std::unique_ptr<char[]> write_buffer_;
+
+  // Files written since the last sync, and the time of the next sync. Owned
+  // by the I/O thread.
+  std::set<std::string> unsynced_files_;
+  std::chrono::steady_clock::time_point next_sync_time_;
+
+  // Media segments on disk by representation, oldest first, and the files
+  // waiting to be deleted. Owned by the I/O thread.
+  std::map<std::string, std::deque<WrittenSegment>> written_segments_;
+  std::deque<std::string> expired_files_;
+
+  mutable std::mutex mutex_;
+
+  // Signaled when a write is queued, and when |stop_| is set.
+  std::condition_variable write_queued_;
+
+  // Signaled when a write completes.
+  mutable std::condition_variable write_complete_;
+  std::unique_ptr<std::thread> io_thread_;
+
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(FileDataSink);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_FILE_DATA_SINK_H_
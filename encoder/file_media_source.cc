@@ -0,0 +1,594 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/file_media_source.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/latency_tracer.h"
+#include "encoder/thread_placement.h"
+#include "encoder/trace_log.h"
+#include "glog/logging.h"
+
+namespace {
+
+const char kY4mMagic[] = "YUV4MPEG2";
+const char kY4mFrameMagic[] = "FRAME";
+const char kY4mSuffix[] = ".y4m";
+
+// Longest Y4M header line accepted.
+const int kMaxY4mLineLength = 1024;
+
+// Frame rate of raw I420 input when none is requested.
+const double kDefaultFrameRate = 30.0;
+
+// WAVE format tag meaning the real format tag is in the SubFormat GUID.
+const uint16 kWaveFormatExtensible = 0xFFFE;
+
+// Size of the WAVEFORMATEX part of a fmt chunk, and of the
+// WAVEFORMATEXTENSIBLE fields that follow it.
+const int kWaveFormatSize = 16;
+const int kWaveFormatExtensibleSize = 40;
+
+// Reads a line from |file| into |ptr_line|, without the newline. Returns
+// false at the end of the file or when the line exceeds
+// |kMaxY4mLineLength|.
+bool ReadLine(FILE* file, std::string* ptr_line) {
+  ptr_line->clear();
+  for (;;) {
+    const int c = fgetc(file);
+    if (c == EOF) {
+      return false;
+    }
+    if (c == '\n') {
+      return true;
+    }
+    if (ptr_line->length() >= kMaxY4mLineLength) {
+      return false;
+    }
+    ptr_line->push_back(static_cast<char>(c));
+  }
+}
+
+// Little endian field readers for WAV headers.
+uint16 ReadLe16(const uint8* ptr_data) {
+  return static_cast<uint16>(ptr_data[0] | (ptr_data[1] << 8));
+}
+
+uint32 ReadLe32(const uint8* ptr_data) {
+  return static_cast<uint32>(ptr_data[0]) |
+         (static_cast<uint32>(ptr_data[1]) << 8) |
+         (static_cast<uint32>(ptr_data[2]) << 16) |
+         (static_cast<uint32>(ptr_data[3]) << 24);
+}
+
+// Returns true when |file_name| ends with |kY4mSuffix|, ignoring case.
+bool IsY4mFileName(const std::string& file_name) {
+  const size_t suffix_length = sizeof(kY4mSuffix) - 1;
+  if (file_name.length() < suffix_length) {
+    return false;
+  }
+  const std::string suffix = file_name.substr(file_name.length() -
+                                              suffix_length);
+  for (size_t i = 0; i < suffix_length; ++i) {
+    if (tolower(suffix[i]) != kY4mSuffix[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // anonymous namespace
+
+namespace webmlive {
+
+FileMediaSource::FileMediaSource()
+    : ptr_audio_callback_(NULL),
+      ptr_video_callback_(NULL),
+      paced_(true),
+      video_file_(NULL),
+      audio_file_(NULL),
+      video_is_y4m_(false),
+      video_file_frame_rate_(0),
+      video_frame_size_(0),
+      audio_bytes_left_(0),
+      video_frames_read_(0),
+      audio_samples_read_(0),
+      read_failed_(false),
+      stop_(false),
+      input_ended_(false),
+      read_error_(false) {
+}
+
+FileMediaSource::~FileMediaSource() {
+  if (delivery_thread_) {
+    Stop();
+  }
+  if (video_file_) {
+    fclose(video_file_);
+  }
+  if (audio_file_) {
+    fclose(audio_file_);
+  }
+}
+
+int FileMediaSource::Init(const WebmEncoderConfig& config,
+                          AudioSamplesCallbackInterface* ptr_audio_callback,
+                          VideoFrameCallbackInterface* ptr_video_callback) {
+  if (config.input_video_file.empty() && config.input_audio_file.empty()) {
+    LOG(ERROR) << "FileMediaSource has no input files.";
+    return WebmEncoder::kInvalidArg;
+  }
+  paced_ = config.input_paced;
+
+  if (!config.input_video_file.empty()) {
+    if (!ptr_video_callback) {
+      LOG(ERROR) << "FileMediaSource NULL video callback.";
+      return WebmEncoder::kInvalidArg;
+    }
+    if (!OpenVideoFile(config.input_video_file,
+                       config.requested_video_config)) {
+      LOG(ERROR) << "FileMediaSource cannot use video file "
+                 << config.input_video_file;
+      return WebmEncoder::kNoVideoSource;
+    }
+    video_file_frame_rate_ = actual_video_config_.frame_rate;
+    const double frame_rate = FrameRateLimiter::OutputFrameRate(
+        video_file_frame_rate_, config.max_video_frame_rate,
+        config.vpx_config.decimate);
+    if (frame_rate < video_file_frame_rate_) {
+      frame_rate_limiter_.Init(frame_rate);
+      actual_video_config_.frame_rate = frame_rate;
+    }
+    ptr_video_callback_ = ptr_video_callback;
+  }
+
+  if (!config.input_audio_file.empty()) {
+    if (!ptr_audio_callback) {
+      LOG(ERROR) << "FileMediaSource NULL audio callback.";
+      return WebmEncoder::kInvalidArg;
+    }
+    if (!OpenAudioFile(config.input_audio_file)) {
+      LOG(ERROR) << "FileMediaSource cannot use audio file "
+                 << config.input_audio_file;
+      return WebmEncoder::kNoAudioSource;
+    }
+    ptr_audio_callback_ = ptr_audio_callback;
+  }
+  return WebmEncoder::kSuccess;
+}
+
+int FileMediaSource::Run() {
+  if (delivery_thread_) {
+    LOG(ERROR) << "FileMediaSource already running.";
+    return WebmEncoder::kRunFailed;
+  }
+  start_time_ = std::chrono::steady_clock::now();
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  delivery_thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&FileMediaSource::DeliveryThread,  // NOLINT
+                                this)));
+  if (!delivery_thread_) {
+    LOG(ERROR) << "FileMediaSource cannot construct thread.";
+    return WebmEncoder::kRunFailed;
+  }
+  return WebmEncoder::kSuccess;
+}
+
+int FileMediaSource::CheckStatus() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (read_error_) {
+    return WebmEncoder::kAVCaptureStopped;
+  }
+  return input_ended_ ? kInputEnded : kSuccess;
+}
+
+void FileMediaSource::Stop() {
+  if (!delivery_thread_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_event_.notify_all();
+  delivery_thread_->join();
+  delivery_thread_.reset();
+}
+
+bool FileMediaSource::OpenVideoFile(const std::string& file_name,
+                                    const VideoConfig& requested_config) {
+  video_file_ = fopen(file_name.c_str(), "rb");
+  if (!video_file_) {
+    LOG(ERROR) << "FileMediaSource cannot open " << file_name;
+    return false;
+  }
+  return ReadVideoFileHeader(video_file_, file_name, requested_config,
+                             &actual_video_config_, &video_is_y4m_,
+                             &video_frame_size_);
+}
+
+bool FileMediaSource::ReadVideoFileHeader(FILE* file,
+                                          const std::string& file_name,
+                                          const VideoConfig& requested_config,
+                                          VideoConfig* ptr_config,
+                                          bool* ptr_is_y4m,
+                                          int32* ptr_frame_size) {
+  if (!file || !ptr_config || !ptr_is_y4m || !ptr_frame_size) {
+    LOG(ERROR) << "FileMediaSource NULL video header argument.";
+    return false;
+  }
+  VideoConfig& config = *ptr_config;
+  config.format = kVideoFormatI420;
+  config.width = requested_config.width;
+  config.height = requested_config.height;
+  config.frame_rate = requested_config.frame_rate > 0 ?
+      requested_config.frame_rate : kDefaultFrameRate;
+
+  *ptr_is_y4m = IsY4mFileName(file_name);
+  if (*ptr_is_y4m) {
+    std::string header;
+    if (!ReadLine(file, &header) ||
+        header.compare(0, sizeof(kY4mMagic) - 1, kY4mMagic) != 0) {
+      LOG(ERROR) << "FileMediaSource invalid Y4M header in " << file_name;
+      return false;
+    }
+    std::istringstream tokens(header.substr(sizeof(kY4mMagic) - 1));
+    std::string token;
+    while (tokens >> token) {
+      const char* const ptr_value = token.c_str() + 1;
+      switch (token[0]) {
+        case 'W':
+          config.width = atoi(ptr_value);
+          break;
+        case 'H':
+          config.height = atoi(ptr_value);
+          break;
+        case 'F': {
+          const int numerator = atoi(ptr_value);
+          const char* const ptr_colon = strchr(ptr_value, ':');
+          const int denominator = ptr_colon ? atoi(ptr_colon + 1) : 1;
+          if (numerator > 0 && denominator > 0) {
+            config.frame_rate =
+                static_cast<double>(numerator) / denominator;
+          }
+          break;
+        }
+        case 'C':
+          if (token.compare(1, 3, "420") != 0) {
+            LOG(ERROR) << "FileMediaSource unsupported Y4M colorspace "
+                       << token;
+            return false;
+          }
+          break;
+        default:
+          // Interlacing, aspect ratio and extension fields are not used.
+          break;
+      }
+    }
+  }
+
+  if (config.width <= 0 || config.height <= 0 ||
+      (config.width & 1) || (config.height & 1)) {
+    LOG(ERROR) << "FileMediaSource invalid video size " << config.width
+               << "x" << config.height << " (must be even).";
+    return false;
+  }
+  config.stride = config.width;
+  *ptr_frame_size = VideoFrame::PlanarFrameSize(config.stride,
+                                                config.height);
+  LOG(INFO) << "FileMediaSource video " << file_name << ": " << config.width
+            << "x" << config.height << " @ " << config.frame_rate << " fps "
+            << (*ptr_is_y4m ? "(Y4M)" : "(raw I420)");
+  return true;
+}
+
+bool FileMediaSource::ReadY4mFrameHeader(FILE* file, bool* ptr_invalid) {
+  *ptr_invalid = false;
+  std::string frame_header;
+  if (!ReadLine(file, &frame_header)) {
+    return false;
+  }
+  if (frame_header.compare(0, sizeof(kY4mFrameMagic) - 1,
+                           kY4mFrameMagic) != 0) {
+    LOG(ERROR) << "FileMediaSource invalid Y4M frame header.";
+    *ptr_invalid = true;
+    return false;
+  }
+  return true;
+}
+
+bool FileMediaSource::OpenAudioFile(const std::string& file_name) {
+  audio_file_ = fopen(file_name.c_str(), "rb");
+  if (!audio_file_) {
+    LOG(ERROR) << "FileMediaSource cannot open " << file_name;
+    return false;
+  }
+
+  uint8 riff_header[12];
+  if (fread(riff_header, 1, sizeof(riff_header), audio_file_) !=
+          sizeof(riff_header) ||
+      memcmp(riff_header, "RIFF", 4) != 0 ||
+      memcmp(riff_header + 8, "WAVE", 4) != 0) {
+    LOG(ERROR) << "FileMediaSource " << file_name << " is not a WAV file.";
+    return false;
+  }
+
+  // Walk the chunks until the data chunk; the fmt chunk must precede it.
+  AudioConfig& config = actual_audio_config_;
+  bool got_format = false;
+  for (;;) {
+    uint8 chunk_header[8];
+    if (fread(chunk_header, 1, sizeof(chunk_header), audio_file_) !=
+        sizeof(chunk_header)) {
+      LOG(ERROR) << "FileMediaSource " << file_name << " has no data chunk.";
+      return false;
+    }
+    const uint32 chunk_size = ReadLe32(chunk_header + 4);
+    if (memcmp(chunk_header, "data", 4) == 0) {
+      audio_bytes_left_ = chunk_size;
+      break;
+    }
+    // Chunks are padded to an even size.
+    const long padded_size = static_cast<long>(chunk_size + (chunk_size & 1));
+    if (memcmp(chunk_header, "fmt ", 4) == 0) {
+      uint8 format[kWaveFormatExtensibleSize];
+      if (chunk_size < kWaveFormatSize) {
+        LOG(ERROR) << "FileMediaSource fmt chunk too small: " << chunk_size;
+        return false;
+      }
+      const int read_size =
+          std::min<int>(chunk_size, kWaveFormatExtensibleSize);
+      if (fread(format, 1, read_size, audio_file_) !=
+          static_cast<size_t>(read_size)) {
+        LOG(ERROR) << "FileMediaSource cannot read fmt chunk.";
+        return false;
+      }
+      config.format_tag = ReadLe16(format);
+      config.channels = ReadLe16(format + 2);
+      config.sample_rate = ReadLe32(format + 4);
+      config.bytes_per_second = ReadLe32(format + 8);
+      config.block_align = ReadLe16(format + 12);
+      config.bits_per_sample = ReadLe16(format + 14);
+      config.valid_bits_per_sample = 0;
+      config.channel_mask = 0;
+      if (config.format_tag == kWaveFormatExtensible) {
+        if (read_size < kWaveFormatExtensibleSize) {
+          LOG(ERROR) << "FileMediaSource truncated WAVE_FORMAT_EXTENSIBLE.";
+          return false;
+        }
+        config.valid_bits_per_sample = ReadLe16(format + 18);
+        config.channel_mask = ReadLe32(format + 20);
+        // The first two bytes of the SubFormat GUID are the format tag.
+        config.format_tag = ReadLe16(format + 24);
+      }
+      if (fseek(audio_file_, padded_size - read_size, SEEK_CUR)) {
+        LOG(ERROR) << "FileMediaSource cannot skip fmt chunk.";
+        return false;
+      }
+      got_format = true;
+    } else if (fseek(audio_file_, padded_size, SEEK_CUR)) {
+      LOG(ERROR) << "FileMediaSource cannot skip WAV chunk.";
+      return false;
+    }
+  }
+
+  if (!got_format) {
+    LOG(ERROR) << "FileMediaSource " << file_name << " has no fmt chunk.";
+    return false;
+  }
+  const bool pcm16 =
+      config.format_tag == kAudioFormatPcm && config.bits_per_sample == 16;
+  const bool float32 = config.format_tag == kAudioFormatIeeeFloat &&
+                       config.bits_per_sample == 32;
+  if ((!pcm16 && !float32) || config.channels == 0 ||
+      config.sample_rate == 0 ||
+      config.block_align != config.channels * config.bits_per_sample / 8) {
+    LOG(ERROR) << "FileMediaSource unsupported WAV format: format_tag="
+               << config.format_tag << " channels=" << config.channels
+               << " sample_rate=" << config.sample_rate
+               << " bits_per_sample=" << config.bits_per_sample;
+    return false;
+  }
+
+  const int samples_per_buffer =
+      config.sample_rate * kAudioBufferDurationMs / kTimebase;
+  audio_read_buffer_.resize(samples_per_buffer * config.block_align);
+  LOG(INFO) << "FileMediaSource audio " << file_name << ": "
+            << config.channels << " channels @ " << config.sample_rate
+            << " Hz, " << (pcm16 ? "PCM16" : "float");
+  return true;
+}
+
+bool FileMediaSource::ReadVideoFrame() {
+  const double& fps = video_file_frame_rate_;
+  int64 timestamp_us = 0;
+  for (;;) {
+    if (video_is_y4m_) {
+      bool invalid = false;
+      if (!ReadY4mFrameHeader(video_file_, &invalid)) {
+        if (invalid) {
+          read_failed_ = true;
+        }
+        return false;
+      }
+    }
+    timestamp_us =
+        static_cast<int64>(video_frames_read_ * kMicrosecondTimebase / fps);
+    if (!frame_rate_limiter_.ShouldDropFrame(
+            MicrosecondsToMilliseconds(timestamp_us))) {
+      break;
+    }
+    if (fseek(video_file_, video_frame_size_, SEEK_CUR)) {
+      return false;
+    }
+    ++video_frames_read_;
+  }
+
+  // Frames handed to the encoder are swapped for pool frames; make sure the
+  // one we now hold is large enough.
+  if (video_frame_.Allocate(video_frame_size_)) {
+    read_failed_ = true;
+    return false;
+  }
+  const size_t bytes_read =
+      fread(video_frame_.buffer(), 1, video_frame_size_, video_file_);
+  if (bytes_read != static_cast<size_t>(video_frame_size_)) {
+    if (bytes_read > 0 || video_is_y4m_) {
+      LOG(WARNING) << "FileMediaSource truncated last video frame ignored.";
+    }
+    return false;
+  }
+
+  // Limited frames last an output frame interval. Times are computed in
+  // microseconds so that frame rates that do not divide 1000 keep evenly
+  // spaced timestamps.
+  const int64 next_timestamp_us = frame_rate_limiter_.enabled() ?
+      timestamp_us + static_cast<int64>(kMicrosecondTimebase /
+                                        actual_video_config_.frame_rate) :
+      static_cast<int64>((video_frames_read_ + 1) * kMicrosecondTimebase /
+                         fps);
+  if (video_frame_.InitInPlace(actual_video_config_,
+                               true,  // always "keyframes"
+                               0,
+                               0,
+                               video_frame_size_)) {
+    read_failed_ = true;
+    return false;
+  }
+  video_frame_.SetTimeUs(timestamp_us, next_timestamp_us - timestamp_us);
+  ++video_frames_read_;
+  return true;
+}
+
+bool FileMediaSource::ReadAudioBuffer() {
+  const AudioConfig& config = actual_audio_config_;
+  int64 read_size = static_cast<int64>(audio_read_buffer_.size());
+  if (read_size > audio_bytes_left_) {
+    read_size = audio_bytes_left_ - audio_bytes_left_ % config.block_align;
+  }
+  if (read_size <= 0) {
+    return false;
+  }
+  const size_t bytes_read =
+      fread(&audio_read_buffer_[0], 1, static_cast<size_t>(read_size),
+            audio_file_);
+  const int32 samples =
+      static_cast<int32>(bytes_read / config.block_align);
+  if (samples == 0) {
+    return false;
+  }
+  audio_bytes_left_ =
+      bytes_read == static_cast<size_t>(read_size) ?
+      audio_bytes_left_ - read_size : 0;
+
+  const int64 timestamp_us =
+      audio_samples_read_ * kMicrosecondTimebase / config.sample_rate;
+  const int64 next_timestamp_us = (audio_samples_read_ + samples) *
+      kMicrosecondTimebase / config.sample_rate;
+  if (audio_buffer_.Init(config, 0, 0, &audio_read_buffer_[0],
+                         samples * config.block_align)) {
+    read_failed_ = true;
+    return false;
+  }
+  audio_buffer_.SetTimeUs(timestamp_us, next_timestamp_us - timestamp_us);
+  audio_samples_read_ += samples;
+  return true;
+}
+
+bool FileMediaSource::WaitForMediaTime(int64 media_time) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (paced_) {
+    const std::chrono::steady_clock::time_point deadline =
+        start_time_ + std::chrono::milliseconds(media_time);
+    stop_event_.wait_until(lock, deadline, [this] { return stop_; });
+  }
+  return !stop_;
+}
+
+bool FileMediaSource::StopRequested() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stop_;
+}
+
+void FileMediaSource::DeliveryThread() {
+  LOG(INFO) << "FileMediaSource thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kCapture);
+  ScopedCpuStage cpu_stage(kCpuCapture);
+  bool video_pending = video_file_ != NULL && ReadVideoFrame();
+  bool audio_pending = audio_file_ != NULL && ReadAudioBuffer();
+
+  // True while |video_frame_| is offered again after a drop.
+  bool video_retry = false;
+
+  while ((video_pending || audio_pending) && !read_failed_) {
+    // Deliver whichever stream is earliest.
+    const bool deliver_video =
+        video_pending &&
+        (!audio_pending ||
+         video_frame_.timestamp() <= audio_buffer_.timestamp());
+
+    if (deliver_video) {
+      const int64 timestamp = video_frame_.timestamp();
+      if (!WaitForMediaTime(timestamp)) {
+        break;
+      }
+      if (!video_retry) {
+        LatencyTracer::Stamp(LatencyTracer::kCapture, timestamp);
+      }
+      const int status = ptr_video_callback_->OnVideoFrameReceived(
+          &video_frame_);
+      if (status == VideoFrameCallbackInterface::kDropped && !paced_) {
+        // The pool did not take the frame: offer it again shortly.
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(kRetryDelayMs));
+        video_retry = true;
+        continue;
+      } else if (status &&
+                 status != VideoFrameCallbackInterface::kDropped) {
+        LOG(ERROR) << "OnVideoFrameReceived failed, status=" << status;
+      }
+      WEBMLIVE_TRACE_EVERY_N(TraceLog::kFrame, 30, "video_file_read")
+          << " timestamp=" << timestamp;
+      video_retry = false;
+      video_pending = ReadVideoFrame();
+    } else {
+      if (!WaitForMediaTime(audio_buffer_.timestamp())) {
+        break;
+      }
+      const int status = ptr_audio_callback_->OnSamplesReceived(
+          &audio_buffer_);
+      if (status == AudioSamplesCallbackInterface::kDropped && !paced_) {
+        // The pool did not take the buffer: offer it again shortly.
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(kRetryDelayMs));
+        continue;
+      } else if (status &&
+                 status != AudioSamplesCallbackInterface::kDropped) {
+        LOG(ERROR) << "OnSamplesReceived failed, status=" << status;
+      }
+      audio_pending = ReadAudioBuffer();
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  read_error_ = read_failed_;
+  input_ended_ = !stop_ && !read_failed_;
+  LOG(INFO) << "FileMediaSource thread finished: " << video_frames_read_
+            << " video frames, " << audio_samples_read_ << " audio samples.";
+}
+
+}  // namespace webmlive
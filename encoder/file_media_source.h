@@ -0,0 +1,179 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_FILE_MEDIA_SOURCE_H_
+#define WEBMLIVE_ENCODER_FILE_MEDIA_SOURCE_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/frame_rate_limiter.h"
+#include "encoder/media_source.h"
+#include "encoder/video_encoder.h"
+#include "encoder/webm_encoder.h"
+
+namespace webmlive {
+
+// Media source that reads raw audio and video from files instead of capture
+// devices. Used to run the encode pipeline without capture hardware, for
+// benchmarks in particular.
+//
+// Notes
+// - Video is read from |WebmEncoderConfig::input_video_file|: a Y4M file
+//   with 4:2:0 chroma, or raw I420 frames sized by
+//   |WebmEncoderConfig::requested_video_config|. Width and height must be
+//   even.
+// - Audio is read from |WebmEncoderConfig::input_audio_file|: a PCM16 or
+//   32 bit float WAV file, delivered in 10 millisecond buffers.
+// - Timestamps start at 0. Audio and video are interleaved by timestamp.
+// - When |WebmEncoderConfig::input_paced| is true samples are delivered in
+//   real time and dropped video frames are lost, like captured frames.
+//   Otherwise samples are delivered as fast as the encoder takes them, and
+//   dropped frames are delivered again.
+class FileMediaSource : public MediaSourceInterface {
+ public:
+  // Delay between attempts to deliver a frame the encoder dropped when input
+  // is not paced.
+  static const int kRetryDelayMs = 1;
+
+  // Length of the audio buffers delivered to the encoder in milliseconds.
+  static const int kAudioBufferDurationMs = 10;
+
+  FileMediaSource();
+  virtual ~FileMediaSource();
+
+  // Opens the input files and reads their headers. Returns |kSuccess| upon
+  // success, or a |WebmEncoder| status code upon failure.
+  virtual int Init(const WebmEncoderConfig& config,
+                   AudioSamplesCallbackInterface* ptr_audio_callback,
+                   VideoFrameCallbackInterface* ptr_video_callback);
+
+  // Starts the delivery thread. Returns |kSuccess| upon success, or a
+  // |WebmEncoder| status code upon failure.
+  virtual int Run();
+
+  // Returns |kSuccess| while delivering samples, |kInputEnded| once all input
+  // has been delivered, and |WebmEncoder::kAVCaptureStopped| when reading an
+  // input file failed.
+  virtual int CheckStatus();
+
+  // Stops and joins the delivery thread.
+  virtual void Stop();
+
+  virtual AudioConfig actual_audio_config() const {
+    return actual_audio_config_;
+  }
+  virtual VideoConfig actual_video_config() const {
+    return actual_video_config_;
+  }
+
+  // Reads the video settings of |file_name|, open as |file|, into
+  // |ptr_config|: from the Y4M header when the name ends with .y4m, which
+  // leaves |file| at the first frame, or from |requested_config| for raw
+  // I420 files. Sets |ptr_is_y4m|, and stores the size of one frame in
+  // |ptr_frame_size|. Returns true when successful.
+  static bool ReadVideoFileHeader(FILE* file, const std::string& file_name,
+                                  const VideoConfig& requested_config,
+                                  VideoConfig* ptr_config, bool* ptr_is_y4m,
+                                  int32* ptr_frame_size);
+
+  // Reads the Y4M FRAME header at the position of |file|. Returns false at
+  // the end of the file, or when the header is invalid; |ptr_invalid| is set
+  // in the latter case.
+  static bool ReadY4mFrameHeader(FILE* file, bool* ptr_invalid);
+
+ private:
+  // Opens |file_name| and reads its Y4M header, or uses the requested video
+  // settings when it is a raw I420 file. Returns true when successful.
+  bool OpenVideoFile(const std::string& file_name,
+                     const VideoConfig& requested_config);
+
+  // Opens |file_name| and reads WAV chunks up to the start of the sample
+  // data. Returns true when successful.
+  bool OpenAudioFile(const std::string& file_name);
+
+  // Reads the next frame kept by |frame_rate_limiter_| from |video_file_|
+  // into |video_frame_|; dropped frames are skipped unread. Returns
+  // false at the end of the file or when reading fails; |read_failed_| is
+  // set in the latter case.
+  bool ReadVideoFrame();
+
+  // Reads the next |kAudioBufferDurationMs| of samples from |audio_file_|
+  // into |audio_buffer_|. Returns false at the end of the sample data or when
+  // reading fails; |read_failed_| is set in the latter case.
+  bool ReadAudioBuffer();
+
+  // Waits until |media_time| milliseconds after |start_time_| when input is
+  // paced. Returns false when |Stop()| is called first.
+  bool WaitForMediaTime(int64 media_time);
+
+  // Returns true when |Stop()| has been called.
+  bool StopRequested();
+
+  // Delivery thread function.
+  void DeliveryThread();
+
+  AudioSamplesCallbackInterface* ptr_audio_callback_;
+  VideoFrameCallbackInterface* ptr_video_callback_;
+  AudioConfig actual_audio_config_;
+  VideoConfig actual_video_config_;
+  bool paced_;
+
+  // Input files, used only by |DeliveryThread()| once running.
+  FILE* video_file_;
+  FILE* audio_file_;
+
+  // Y4M files prefix each frame with a FRAME header.
+  bool video_is_y4m_;
+
+  // Frame rate of the video file, which timestamps are computed from.
+  // |actual_video_config_| holds the rate after |frame_rate_limiter_|.
+  double video_file_frame_rate_;
+  FrameRateLimiter frame_rate_limiter_;
+
+  // Size in bytes of one raw video frame.
+  int32 video_frame_size_;
+
+  // Sample bytes left in the WAV data chunk.
+  int64 audio_bytes_left_;
+
+  // Number of frames and audio samples read so far, and whether a read
+  // failed.
+  int64 video_frames_read_;
+  int64 audio_samples_read_;
+  bool read_failed_;
+
+  // Sample storage reused by the delivery thread.
+  VideoFrame video_frame_;
+  AudioBuffer audio_buffer_;
+  std::vector<uint8> audio_read_buffer_;
+
+  // Time at which the delivery thread started, used to pace delivery.
+  std::chrono::steady_clock::time_point start_time_;
+
+  // Stop flag, wake up event, and delivery state. All protected by |mutex_|.
+  std::mutex mutex_;
+  std::condition_variable stop_event_;
+  bool stop_;
+  bool input_ended_;
+  bool read_error_;
+
+  std::shared_ptr<std::thread> delivery_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(FileMediaSource);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_FILE_MEDIA_SOURCE_H_
@@ -0,0 +1,44 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/file_util.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace webmlive {
+
+int64 FileSize(const std::string& path) {
+#ifdef _WIN32
+  struct _stat64 info;
+  if (_stat64(path.c_str(), &info))
+    return -1;
+#else
+  struct stat info;
+  if (stat(path.c_str(), &info))
+    return -1;
+#endif
+  return static_cast<int64>(info.st_size);
+}
+
+int SeekFile(FILE* file, int64 offset, int origin) {
+#ifdef _WIN32
+  return _fseeki64(file, offset, origin);
+#else
+  return fseeko(file, offset, origin);
+#endif
+}
+
+int64 TellFile(FILE* file) {
+#ifdef _WIN32
+  return _ftelli64(file);
+#else
+  return ftello(file);
+#endif
+}
+
+}  // namespace webmlive
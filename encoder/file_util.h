@@ -0,0 +1,29 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+//
+// Portable helpers for files larger than 2 GB.
+#ifndef WEBMLIVE_ENCODER_FILE_UTIL_H_
+#define WEBMLIVE_ENCODER_FILE_UTIL_H_
+
+#include <cstdio>
+#include <string>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Returns the size of the file at |path|, or -1 when it does not exist.
+int64 FileSize(const std::string& path);
+
+// 64 bit fseek() and ftell(). |origin| is SEEK_SET, SEEK_CUR or SEEK_END.
+int SeekFile(FILE* file, int64 offset, int origin);
+int64 TellFile(FILE* file);
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_FILE_UTIL_H_
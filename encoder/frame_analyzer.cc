@@ -0,0 +1,161 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/frame_analyzer.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "encoder/video_encoder.h"
+#include "glog/logging.h"
+#include "libyuv/scale.h"
+
+namespace webmlive {
+
+namespace {
+// Downsampled samples per block side.
+const int32 kBlockSamples =
+    FrameAnalyzer::kBlockSize / FrameAnalyzer::kDownsample;
+}  // namespace
+
+FrameAnalyzer::FrameAnalyzer()
+    : detect_scene_cuts_(false),
+      plane_width_(0),
+      plane_height_(0),
+      hint_sequence_(0) {
+}
+
+void FrameAnalyzer::Init(bool detect_scene_cuts) {
+  detect_scene_cuts_ = detect_scene_cuts;
+  scene_cut_detector_.Reset();
+  plane_.clear();
+  previous_plane_.clear();
+  plane_width_ = 0;
+  plane_height_ = 0;
+}
+
+void FrameAnalyzer::Analyze(VideoFrame* ptr_frame) {
+  VideoFrameAnalysis* const ptr_analysis = ptr_frame->mutable_analysis();
+  *ptr_analysis = VideoFrameAnalysis();
+  const int32 plane_width = plane_width_;
+  const int32 plane_height = plane_height_;
+  plane_.swap(previous_plane_);
+  if (!Downsample(*ptr_frame)) {
+    plane_.clear();
+    previous_plane_.clear();
+    return;
+  }
+  ptr_analysis->valid = true;
+  ptr_analysis->scene_cut =
+      detect_scene_cuts_ && scene_cut_detector_.IsSceneCut(*ptr_frame);
+
+  int64 gradient = 0;
+  for (int32 y = 0; y < plane_height_; ++y) {
+    const uint8* const ptr_row = &plane_[y * plane_width_];
+    for (int32 x = 1; x < plane_width_; ++x) {
+      gradient += abs(ptr_row[x] - ptr_row[x - 1]);
+    }
+  }
+  ptr_analysis->complexity =
+      static_cast<double>(gradient) / (plane_width_ * plane_height_);
+
+  if (plane_width != plane_width_ || plane_height != plane_height_ ||
+      previous_plane_.size() != plane_.size()) {
+    return;
+  }
+  VideoRegionHints* const ptr_hints = ptr_frame->mutable_region_hints();
+  const bool make_hints = !ptr_hints->valid;
+  Compare(ptr_frame->width(), ptr_frame->height(), &ptr_analysis->motion,
+          make_hints ? ptr_hints : NULL);
+  if (make_hints) {
+    ptr_hints->valid = true;
+    ptr_hints->sequence = ++hint_sequence_;
+  }
+}
+
+bool FrameAnalyzer::Downsample(const VideoFrame& frame) {
+  const bool high_bit_depth = frame.format() == kVideoFormatI42016;
+  if (!frame.buffer() || frame.width() <= 0 || frame.height() <= 0 ||
+      (frame.format() != kVideoFormatI420 &&
+       frame.format() != kVideoFormatYV12 && !high_bit_depth)) {
+    return false;
+  }
+  plane_width_ = (frame.width() + kDownsample - 1) / kDownsample;
+  plane_height_ = (frame.height() + kDownsample - 1) / kDownsample;
+  const size_t num_samples = plane_width_ * plane_height_;
+  plane_.resize(num_samples);
+  if (!high_bit_depth) {
+    libyuv::ScalePlane(frame.buffer(), frame.stride(),
+                       frame.width(), frame.height(),
+                       &plane_[0], plane_width_,
+                       plane_width_, plane_height_, libyuv::kFilterBox);
+    return true;
+  }
+
+  // 10 bit samples are reduced to 8 bits, as |SceneCutDetector| does.
+  plane_16_.resize(num_samples);
+  libyuv::ScalePlane_16(reinterpret_cast<const uint16*>(frame.buffer()),
+                        frame.stride() / 2,
+                        frame.width(), frame.height(),
+                        &plane_16_[0], plane_width_,
+                        plane_width_, plane_height_, libyuv::kFilterBox);
+  for (size_t i = 0; i < num_samples; ++i) {
+    plane_[i] = static_cast<uint8>(plane_16_[i] >> 2);
+  }
+  return true;
+}
+
+void FrameAnalyzer::Compare(int32 frame_width, int32 frame_height,
+                            double* ptr_motion,
+                            VideoRegionHints* ptr_hints) const {
+  if (ptr_hints) {
+    ptr_hints->changed_regions.clear();
+  }
+  int64 total_difference = 0;
+  for (int32 block_y = 0; block_y < plane_height_;
+       block_y += kBlockSamples) {
+    const int32 end_y = std::min(block_y + kBlockSamples, plane_height_);
+
+    // Start of the run of changed blocks in this block row, or -1.
+    int32 run_x = -1;
+    for (int32 block_x = 0; block_x < plane_width_;
+         block_x += kBlockSamples) {
+      const int32 end_x = std::min(block_x + kBlockSamples, plane_width_);
+      int32 block_difference = 0;
+      for (int32 y = block_y; y < end_y; ++y) {
+        const uint8* const ptr_row = &plane_[y * plane_width_];
+        const uint8* const ptr_previous = &previous_plane_[y * plane_width_];
+        for (int32 x = block_x; x < end_x; ++x) {
+          block_difference += abs(ptr_row[x] - ptr_previous[x]);
+        }
+      }
+      total_difference += block_difference;
+      if (!ptr_hints) {
+        continue;
+      }
+      if (block_difference > 0 && run_x < 0) {
+        run_x = block_x;
+      }
+      const bool run_ends = block_difference == 0 || end_x == plane_width_;
+      if (run_x >= 0 && run_ends) {
+        const int32 run_end_x = block_difference == 0 ? block_x : end_x;
+        const int32 left = run_x * kDownsample;
+        const int32 top = block_y * kDownsample;
+        const int32 right =
+            std::min(run_end_x * kDownsample, frame_width);
+        const int32 bottom = std::min(end_y * kDownsample, frame_height);
+        ptr_hints->changed_regions.push_back(
+            VideoRect(left, top, right - left, bottom - top));
+        run_x = -1;
+      }
+    }
+  }
+  *ptr_motion = static_cast<double>(total_difference) /
+      (plane_width_ * plane_height_);
+}
+
+}  // namespace webmlive
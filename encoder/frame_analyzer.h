@@ -0,0 +1,84 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_FRAME_ANALYZER_H_
+#define WEBMLIVE_ENCODER_FRAME_ANALYZER_H_
+
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/scene_cut_detector.h"
+
+namespace webmlive {
+
+class VideoFrame;
+struct VideoRegionHints;
+
+// Analyzes captured frames once for every representation that encodes them,
+// and stores the results in the frames: |VideoFrame::analysis()| gets the
+// scene cut flag, motion and complexity, and frames without region hints get
+// hints listing the blocks that changed since the previous analyzed frame.
+// Encoders use these for keyframes, speed and their active maps instead of
+// each working them out again at its own size.
+//
+// The analysis runs on a copy of the luma plane downsampled by
+// |kDownsample| in both directions with libyuv's SIMD box filter, so that a
+// 1080p frame costs about 130000 samples.
+//
+// Notes
+// - Not thread safe; |WebmEncoder| uses it only from its encoder thread.
+// - A block is reported unchanged only when its downsampled samples are
+//   identical to the previous frame's, which noisy camera content seldom is.
+class FrameAnalyzer {
+ public:
+  // Factor the luma plane is downsampled by, and the side, in pixels, of
+  // the blocks whose changes are reported.
+  static const int32 kDownsample = 4;
+  static const int32 kBlockSize = 16;
+
+  FrameAnalyzer();
+  ~FrameAnalyzer() {}
+
+  // Forgets the previous frame. |detect_scene_cuts| enables scene cut
+  // detection; see |SceneCutDetector|.
+  void Init(bool detect_scene_cuts);
+
+  // Analyzes |ptr_frame|. Frames other than I420, YV12 and I42016 are left
+  // without analysis.
+  void Analyze(VideoFrame* ptr_frame);
+
+ private:
+  // Downsamples the luma plane of |frame| into |plane_|. Returns false for
+  // unsupported formats.
+  bool Downsample(const VideoFrame& frame);
+
+  // Stores the mean absolute difference of |plane_| and |previous_plane_|
+  // in |ptr_motion|, and lists the blocks of the |frame_width| x
+  // |frame_height| frame that differ in |ptr_hints| when it is not NULL. Both
+  // planes must be of the same size.
+  void Compare(int32 frame_width, int32 frame_height, double* ptr_motion,
+               VideoRegionHints* ptr_hints) const;
+
+  SceneCutDetector scene_cut_detector_;
+  bool detect_scene_cuts_;
+
+  // Downsampled luma of the current and of the previous analyzed frame, the
+  // size of both, and 10 bit samples before their reduction to 8 bits.
+  std::vector<uint8> plane_;
+  std::vector<uint8> previous_plane_;
+  int32 plane_width_;
+  int32 plane_height_;
+  std::vector<uint16> plane_16_;
+
+  // Sequence number of the latest region hints made.
+  int64 hint_sequence_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(FrameAnalyzer);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_FRAME_ANALYZER_H_
@@ -0,0 +1,282 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/frame_overlay.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+#include "encoder/alpha_blend.h"
+#include "encoder/latency_code.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Timecode font: 5 x 7 glyphs, one byte per row, the leftmost pixel in bit
+// 4. Glyphs are one font pixel apart, and the box extends |kBoxMargin| font
+// pixels past them.
+const int kGlyphWidth = 5;
+const int kGlyphHeight = 7;
+const int kBoxMargin = 1;
+const uint8 kDigitGlyphs[10][kGlyphHeight] = {
+  {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E},
+  {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},
+  {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F},
+  {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},
+  {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02},
+  {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},
+  {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E},
+  {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+  {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E},
+  {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C},
+};
+const uint8 kColonGlyph[kGlyphHeight] = {
+  0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00,
+};
+
+// Colors of the timecode: video range white text on a half transparent
+// black box, without chroma.
+const uint8 kTextLuma = 235;
+const uint8 kBoxLuma = 16;
+const uint8 kNeutralChroma = 128;
+const uint8 kTextAlpha = 255;
+const uint8 kBoxAlpha = 128;
+
+int32 RoundDownToEven(int32 value) {
+  return value & ~1;
+}
+
+int32 RoundUpToEven(int32 value) {
+  return (value + 1) & ~1;
+}
+}  // namespace
+
+FrameOverlay::FrameOverlay()
+    : image_x_(0),
+      image_y_(0),
+      timecode_(false),
+      timecode_x_(0),
+      timecode_y_(0),
+      timecode_scale_(FrameOverlayConfig::kDefaultTimecodeScale),
+      frame_rate_(0),
+      latency_code_(false) {
+}
+
+int FrameOverlay::Init(const FrameOverlayConfig& config, double frame_rate) {
+  if (config.timecode && (config.timecode_scale < 1 ||
+                          config.timecode_scale > kMaxTimecodeScale)) {
+    LOG(ERROR) << "FrameOverlay invalid timecode scale "
+               << config.timecode_scale;
+    return kInvalidArg;
+  }
+  image_ = Image();
+  if (!config.image_path.empty()) {
+    const int status = LoadImage(config.image_path, config.image_width,
+                                 config.image_height);
+    if (status) {
+      return status;
+    }
+  }
+  image_x_ = config.image_x;
+  image_y_ = config.image_y;
+  timecode_ = config.timecode;
+  timecode_x_ = config.timecode_x;
+  timecode_y_ = config.timecode_y;
+  timecode_scale_ = config.timecode_scale;
+  frame_rate_ = frame_rate;
+  timecode_text_.clear();
+  timecode_image_ = Image();
+  latency_code_ = config.latency_code;
+  return kSuccess;
+}
+
+void FrameOverlay::Draw(VideoFrame* ptr_frame) {
+  if (!ptr_frame || !enabled()) {
+    return;
+  }
+  VideoRect rect;
+  if (!image_.y.empty()) {
+    DrawImage(image_, image_x_, image_y_, ptr_frame, &rect);
+  }
+  VideoRegionHints* const ptr_hints = ptr_frame->mutable_region_hints();
+  if (timecode_) {
+    DrawTimecode(ptr_frame, ptr_hints);
+  }
+
+  // The latency code changes with every frame.
+  if (latency_code_) {
+    int64 time_ms = ptr_frame->capture_time_ms();
+    if (time_ms <= 0) {
+      time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+    if (DrawLatencyCode(time_ms, ptr_frame, &rect) && ptr_hints->valid) {
+      ptr_hints->changed_regions.push_back(rect);
+    }
+  }
+}
+
+void FrameOverlay::DrawTimecode(VideoFrame* ptr_frame,
+                                VideoRegionHints* ptr_hints) {
+  const int64 time_ms = std::max<int64>(0, ptr_frame->timestamp());
+  const int64 seconds = time_ms / 1000;
+  const int frames = frame_rate_ > 0 ?
+      static_cast<int>((time_ms % 1000) * frame_rate_ / 1000) : 0;
+  char text[32];
+  snprintf(text, sizeof(text), "%02d:%02d:%02d:%02d",
+           static_cast<int>(seconds / 3600),
+           static_cast<int>(seconds / 60 % 60),
+           static_cast<int>(seconds % 60), frames);
+  const bool changed = timecode_text_ != text;
+  if (changed) {
+    RenderTimecode(text);
+  }
+  VideoRect rect;
+  DrawImage(timecode_image_, timecode_x_, timecode_y_, ptr_frame, &rect);
+
+  // The logo is the same on every frame; the timecode is not.
+  if (changed && ptr_hints->valid && rect.width > 0) {
+    ptr_hints->changed_regions.push_back(rect);
+  }
+}
+
+int FrameOverlay::LoadImage(const std::string& path, int32 width,
+                            int32 height) {
+  if (width <= 0 || height <= 0 || (width & 1) || (height & 1)) {
+    LOG(ERROR) << "FrameOverlay image size must be even: " << width << "x"
+               << height;
+    return kInvalidArg;
+  }
+  const size_t luma_size = static_cast<size_t>(width) * height;
+  const size_t chroma_size = luma_size / 4;
+  std::ifstream file(path.c_str(), std::ios::binary);
+  image_.y.resize(luma_size);
+  image_.u.resize(chroma_size);
+  image_.v.resize(chroma_size);
+  image_.alpha.resize(luma_size);
+  file.read(reinterpret_cast<char*>(&image_.y[0]), luma_size);
+  file.read(reinterpret_cast<char*>(&image_.u[0]), chroma_size);
+  file.read(reinterpret_cast<char*>(&image_.v[0]), chroma_size);
+  file.read(reinterpret_cast<char*>(&image_.alpha[0]), luma_size);
+  if (!file) {
+    LOG(ERROR) << "FrameOverlay cannot read a " << width << "x" << height
+               << " I420 image with alpha from " << path;
+    image_ = Image();
+    return kInvalidArg;
+  }
+  image_.width = width;
+  image_.height = height;
+  AverageAlpha(&image_);
+  return kSuccess;
+}
+
+void FrameOverlay::RenderTimecode(const std::string& text) {
+  const int scale = timecode_scale_;
+  const int columns = static_cast<int>(text.size()) * (kGlyphWidth + 1) - 1 +
+                      2 * kBoxMargin;
+  const int rows = kGlyphHeight + 2 * kBoxMargin;
+  Image& image = timecode_image_;
+  image.width = RoundUpToEven(columns * scale);
+  image.height = RoundUpToEven(rows * scale);
+  const size_t luma_size = static_cast<size_t>(image.width) * image.height;
+  image.y.assign(luma_size, kBoxLuma);
+  image.alpha.assign(luma_size, kBoxAlpha);
+  image.u.assign(luma_size / 4, kNeutralChroma);
+  image.v.assign(luma_size / 4, kNeutralChroma);
+
+  for (size_t i = 0; i < text.size(); ++i) {
+    const uint8* glyph = NULL;
+    if (text[i] >= '0' && text[i] <= '9') {
+      glyph = kDigitGlyphs[text[i] - '0'];
+    } else if (text[i] == ':') {
+      glyph = kColonGlyph;
+    } else {
+      continue;
+    }
+    const int left = (kBoxMargin + static_cast<int>(i) * (kGlyphWidth + 1)) *
+                     scale;
+    for (int gy = 0; gy < kGlyphHeight; ++gy) {
+      for (int gx = 0; gx < kGlyphWidth; ++gx) {
+        if (!(glyph[gy] & (0x10 >> gx))) {
+          continue;
+        }
+        const int x = left + gx * scale;
+        const int y = (kBoxMargin + gy) * scale;
+        for (int row = y; row < y + scale; ++row) {
+          const size_t offset = static_cast<size_t>(row) * image.width + x;
+          std::fill(&image.y[offset], &image.y[offset] + scale, kTextLuma);
+          std::fill(&image.alpha[offset], &image.alpha[offset] + scale,
+                    kTextAlpha);
+        }
+      }
+    }
+  }
+  AverageAlpha(&image);
+  timecode_text_ = text;
+}
+
+void FrameOverlay::AverageAlpha(Image* ptr_image) {
+  const int32 width = ptr_image->width;
+  const int32 uv_width = width / 2;
+  const int32 uv_height = ptr_image->height / 2;
+  const std::vector<uint8>& alpha = ptr_image->alpha;
+  ptr_image->uv_alpha.resize(static_cast<size_t>(uv_width) * uv_height);
+  for (int32 y = 0; y < uv_height; ++y) {
+    const uint8* const ptr_row = &alpha[2 * y * width];
+    for (int32 x = 0; x < uv_width; ++x) {
+      const int sum = ptr_row[2 * x] + ptr_row[2 * x + 1] +
+                      ptr_row[width + 2 * x] + ptr_row[width + 2 * x + 1];
+      ptr_image->uv_alpha[y * uv_width + x] = static_cast<uint8>((sum + 2) / 4);
+    }
+  }
+}
+
+void FrameOverlay::DrawImage(const Image& image, int32 x, int32 y,
+                             VideoFrame* ptr_frame, VideoRect* ptr_rect) {
+  *ptr_rect = VideoRect();
+  if ((ptr_frame->format() != kVideoFormatI420 &&
+       ptr_frame->format() != kVideoFormatYV12) || !ptr_frame->buffer()) {
+    return;
+  }
+  const int32 frame_width = ptr_frame->width();
+  const int32 frame_height = ptr_frame->height();
+  const int32 width = std::min(image.width, RoundDownToEven(frame_width));
+  const int32 height = std::min(image.height, RoundDownToEven(frame_height));
+  if (width <= 0 || height <= 0) {
+    return;
+  }
+  int32 left = x >= 0 ? x : frame_width + x - width;
+  int32 top = y >= 0 ? y : frame_height + y - height;
+  left = RoundDownToEven(std::max(0, std::min(left, frame_width - width)));
+  top = RoundDownToEven(std::max(0, std::min(top, frame_height - height)));
+
+  const int32 y_stride = ptr_frame->stride();
+  const int32 uv_stride = y_stride / 2;
+  uint8* const ptr_y = ptr_frame->buffer();
+  uint8* ptr_u = ptr_y + y_stride * frame_height;
+  uint8* ptr_v = ptr_u + uv_stride * ((frame_height + 1) / 2);
+  if (ptr_frame->format() == kVideoFormatYV12) {
+    std::swap(ptr_u, ptr_v);
+  }
+  BlendPlaneWithAlpha(&image.y[0], image.width, &image.alpha[0], image.width,
+                      ptr_y + top * y_stride + left, y_stride, width, height);
+  const int32 image_uv_width = image.width / 2;
+  const int32 chroma_offset = top / 2 * uv_stride + left / 2;
+  BlendPlaneWithAlpha(&image.u[0], image_uv_width, &image.uv_alpha[0],
+                      image_uv_width, ptr_u + chroma_offset, uv_stride,
+                      width / 2, height / 2);
+  BlendPlaneWithAlpha(&image.v[0], image_uv_width, &image.uv_alpha[0],
+                      image_uv_width, ptr_v + chroma_offset, uv_stride,
+                      width / 2, height / 2);
+  *ptr_rect = VideoRect(left, top, width, height);
+}
+
+}  // namespace webmlive
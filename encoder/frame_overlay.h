@@ -0,0 +1,160 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_FRAME_OVERLAY_H_
+#define WEBMLIVE_ENCODER_FRAME_OVERLAY_H_
+
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+struct FrameOverlayConfig {
+  static const int32 kDefaultMargin = 16;
+  static const int kDefaultTimecodeScale = 2;
+
+  FrameOverlayConfig()
+      : image_width(0),
+        image_height(0),
+        image_x(-kDefaultMargin),
+        image_y(kDefaultMargin),
+        timecode(false),
+        timecode_x(kDefaultMargin),
+        timecode_y(-kDefaultMargin),
+        timecode_scale(kDefaultTimecodeScale),
+        latency_code(false) {}
+
+  // Raw image drawn over every frame, a logo for example: the Y, U and V
+  // planes of an |image_width| x |image_height| I420 image followed by a
+  // full resolution alpha plane, where 0 is transparent and 255 opaque, all
+  // without padding. The size must be even. Empty draws no image.
+  std::string image_path;
+  int32 image_width;
+  int32 image_height;
+
+  // Position of the image's top left corner in the frame, in pixels.
+  // Negative values place its right edge |-x| pixels from the right of the
+  // frame, and its bottom edge |-y| pixels from the bottom, as
+  // |PictureInPictureConfig| does. The default is the top right corner.
+  int32 image_x;
+  int32 image_y;
+
+  // Draws the stream time of each frame as HH:MM:SS:FF, white on a half
+  // transparent box, at |timecode_x| and |timecode_y|, placed as the image
+  // is. The default is the bottom left corner. Each pixel of the 5 x 7 font
+  // is |timecode_scale| pixels square.
+  bool timecode;
+  int32 timecode_x;
+  int32 timecode_y;
+  int timecode_scale;
+
+  // Draws the wall clock time at which each frame reached the encoder as a
+  // machine readable |DrawLatencyCode()| grid in the top left corner, for
+  // latency_checker to measure capture to availability latency. Frames
+  // without a capture time get the time they are drawn.
+  bool latency_code;
+};
+
+// Burns a logo and a timecode into raw frames before they are encoded, so
+// that branded streams need no downstream transcode, and a latency code for
+// glass-to-glass measurements.
+//
+// Both are kept as I420 images with alpha, blended in place with
+// |BlendPlaneWithAlpha()| over only the rectangle they cover: the image as
+// loaded by |Init()|, and the timecode rendered again only when its text
+// changes. Chroma is blended with an alpha plane averaged over each 2 x 2
+// block.
+//
+// Notes
+// - Only 8 bit I420 and YV12 frames are drawn on; others pass unchanged.
+// - Drawings are clipped to the frame, and placed on even pixels.
+// - The rectangle of a changed timecode is added to valid region hints.
+// - Not thread safe.
+class FrameOverlay {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Largest |FrameOverlayConfig::timecode_scale|.
+  static const int kMaxTimecodeScale = 16;
+
+  FrameOverlay();
+  ~FrameOverlay() {}
+
+  // Loads the image of |config|, and stores the timecode settings. Frames
+  // are counted at |frame_rate| for the FF field of the timecode. Returns
+  // |kSuccess| when successful, and |kInvalidArg| when the image cannot be
+  // read or does not match its size.
+  int Init(const FrameOverlayConfig& config, double frame_rate);
+
+  // Returns true when |Init()| enabled the image, the timecode or the
+  // latency code.
+  bool enabled() const {
+    return !image_.y.empty() || timecode_ || latency_code_;
+  }
+
+  // Draws the image, the timecode of |ptr_frame|'s timestamp and the
+  // latency code of its capture time over it.
+  void Draw(VideoFrame* ptr_frame);
+
+ private:
+  // An I420 image with a full resolution alpha plane, and the alpha plane
+  // averaged for the chroma planes. |width| and |height| are even.
+  struct Image {
+    Image() : width(0), height(0) {}
+    int32 width;
+    int32 height;
+    std::vector<uint8> y;
+    std::vector<uint8> u;
+    std::vector<uint8> v;
+    std::vector<uint8> alpha;
+    std::vector<uint8> uv_alpha;
+  };
+
+  // Reads |path| into |image_|. Returns |kSuccess| when successful.
+  int LoadImage(const std::string& path, int32 width, int32 height);
+
+  // Draws the timecode of |ptr_frame|'s timestamp over it, and adds its
+  // rectangle to |ptr_hints| when its text changed.
+  void DrawTimecode(VideoFrame* ptr_frame, VideoRegionHints* ptr_hints);
+
+  // Renders |text|, digits and colons, into |timecode_image_|.
+  void RenderTimecode(const std::string& text);
+
+  // Fills |ptr_image|'s |uv_alpha| from its |alpha|.
+  static void AverageAlpha(Image* ptr_image);
+
+  // Blends |image| over |ptr_frame| at |x| and |y|, placed as
+  // |FrameOverlayConfig| describes. Stores the rectangle drawn in
+  // |ptr_rect|; it is empty when the image lies outside the frame.
+  static void DrawImage(const Image& image, int32 x, int32 y,
+                        VideoFrame* ptr_frame, VideoRect* ptr_rect);
+
+  Image image_;
+  int32 image_x_;
+  int32 image_y_;
+
+  bool timecode_;
+  int32 timecode_x_;
+  int32 timecode_y_;
+  int timecode_scale_;
+  double frame_rate_;
+  std::string timecode_text_;
+  Image timecode_image_;
+  bool latency_code_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(FrameOverlay);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_FRAME_OVERLAY_H_
@@ -0,0 +1,65 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/frame_rate_limiter.h"
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+FrameRateLimiter::FrameRateLimiter()
+    : interval_(0),
+      next_frame_time_(0),
+      last_timestamp_(0),
+      started_(false) {
+}
+
+double FrameRateLimiter::OutputFrameRate(double capture_frame_rate,
+                                         double max_frame_rate,
+                                         int decimate) {
+  double frame_rate = capture_frame_rate > 0 ? capture_frame_rate : 0;
+  if (decimate > 1 && frame_rate > 0) {
+    frame_rate /= decimate;
+  }
+  if (max_frame_rate > 0 && (frame_rate <= 0 || max_frame_rate < frame_rate)) {
+    frame_rate = max_frame_rate;
+  }
+  return frame_rate;
+}
+
+void FrameRateLimiter::Init(double frame_rate) {
+  interval_ = frame_rate > 0 ? 1000.0 / frame_rate : 0;
+  started_ = false;
+  if (interval_ > 0) {
+    LOG(INFO) << "FrameRateLimiter limiting frames to " << frame_rate
+              << " fps.";
+  }
+}
+
+bool FrameRateLimiter::ShouldDropFrame(int64 timestamp) {
+  if (interval_ <= 0) {
+    return false;
+  }
+  const double time = static_cast<double>(timestamp);
+  if (!started_ || timestamp < last_timestamp_ ||
+      time >= next_frame_time_ + interval_) {
+    // First frame, timestamps went backwards, or the input stalled: keep the
+    // frame and schedule the next from it.
+    started_ = true;
+    last_timestamp_ = timestamp;
+    next_frame_time_ = time + interval_;
+    return false;
+  }
+  last_timestamp_ = timestamp;
+  if (time + interval_ / 2 < next_frame_time_) {
+    return true;
+  }
+  next_frame_time_ += interval_;
+  return false;
+}
+
+}  // namespace webmlive
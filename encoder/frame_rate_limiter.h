@@ -0,0 +1,62 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_FRAME_RATE_LIMITER_H_
+#define WEBMLIVE_ENCODER_FRAME_RATE_LIMITER_H_
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Reduces a stream of frames to a target frame rate using frame timestamps.
+// Capture sources ask it about each frame before converting or copying the
+// frame, so dropped frames cost nothing.
+//
+// Frames are kept on a schedule of one per target interval: a frame is kept
+// when it is no more than half an interval ahead of the next due time. The
+// output averages the target rate exactly whatever the ratio of input to
+// target rate, and input that is already at or below the target passes
+// through untouched. The schedule restarts after a gap of more than one
+// interval, and when timestamps go backwards.
+class FrameRateLimiter {
+ public:
+  FrameRateLimiter();
+  ~FrameRateLimiter() {}
+
+  // Returns the frame rate of a source capturing at |capture_frame_rate| that
+  // is limited to |max_frame_rate| and decimated by |decimate|. Values <= 0
+  // for |max_frame_rate| and <= 1 for |decimate| disable the corresponding
+  // limit. Returns |capture_frame_rate| when neither applies, and 0 when
+  // |capture_frame_rate| is unknown and there's no |max_frame_rate|.
+  static double OutputFrameRate(double capture_frame_rate,
+                                double max_frame_rate,
+                                int decimate);
+
+  // Sets the target frame rate and restarts the schedule. Values <= 0 disable
+  // the limiter.
+  void Init(double frame_rate);
+
+  // Returns true when the frame stamped |timestamp| milliseconds must be
+  // dropped.
+  bool ShouldDropFrame(int64 timestamp);
+
+  bool enabled() const { return interval_ > 0; }
+
+ private:
+  // Target frame interval in milliseconds; 0 when disabled.
+  double interval_;
+
+  // Time the next frame is due, and whether the schedule has started.
+  double next_frame_time_;
+  int64 last_timestamp_;
+  bool started_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(FrameRateLimiter);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_FRAME_RATE_LIMITER_H_
@@ -0,0 +1,89 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/gop_scheduler.h"
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+GopScheduler::GopScheduler()
+    : keyframe_interval_(0),
+      min_scene_cut_spacing_(0),
+      aligned_(false),
+      last_keyframe_time_(-1),
+      next_segment_(1) {
+}
+
+void GopScheduler::Init(int64 keyframe_interval,
+                        int64 min_scene_cut_spacing) {
+  keyframe_interval_ = keyframe_interval;
+  min_scene_cut_spacing_ = min_scene_cut_spacing;
+  aligned_ = false;
+  last_keyframe_time_ = -1;
+  next_segment_ = 1;
+  segments_.clear();
+}
+
+void GopScheduler::InitAligned(int64 keyframe_interval) {
+  Init(keyframe_interval, 0);
+  aligned_ = keyframe_interval > 0;
+  LOG_IF(ERROR, !aligned_) << "aligned keyframes need a keyframe interval.";
+}
+
+bool GopScheduler::ScheduleFrame(int64 timestamp, bool requested,
+                                 bool scene_cut) {
+  if (aligned_) {
+    const int64 segment = AlignedSegmentNumber(timestamp);
+    if (last_keyframe_time_ >= 0 &&
+        segment == AlignedSegmentNumber(last_keyframe_time_)) {
+      return false;
+    }
+    next_segment_ = segment;
+  }
+  const int64 time_since_keyframe = timestamp - last_keyframe_time_;
+  const bool keyframe = last_keyframe_time_ < 0 || aligned_ || requested ||
+      (keyframe_interval_ > 0 && time_since_keyframe > keyframe_interval_) ||
+      (scene_cut && time_since_keyframe >= min_scene_cut_spacing_);
+  if (!keyframe) {
+    return false;
+  }
+  VLOG(1) << "keyframe scheduled @ " << timestamp << "ms, segment "
+          << next_segment_;
+  last_keyframe_time_ = timestamp;
+  segments_.push_back(std::make_pair(timestamp, next_segment_++));
+  if (segments_.size() > static_cast<size_t>(kMaxSegments)) {
+    segments_.pop_front();
+  }
+  return true;
+}
+
+// Timestamps before 0 belong to segment 0 and earlier.
+int64 GopScheduler::AlignedSegmentNumber(int64 timestamp) const {
+  if (!aligned_) {
+    return -1;
+  }
+  int64 intervals = timestamp / keyframe_interval_;
+  if (timestamp < 0 && timestamp % keyframe_interval_ != 0) {
+    --intervals;
+  }
+  return intervals + 1;
+}
+
+int64 GopScheduler::SegmentNumber(int64 timestamp) const {
+  for (auto it = segments_.rbegin(); it != segments_.rend(); ++it) {
+    if (it->first == timestamp) {
+      return it->second;
+    }
+    if (it->first < timestamp) {
+      break;
+    }
+  }
+  return -1;
+}
+
+}  // namespace webmlive
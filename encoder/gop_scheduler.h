@@ -0,0 +1,93 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_GOP_SCHEDULER_H_
+#define WEBMLIVE_ENCODER_GOP_SCHEDULER_H_
+
+#include <deque>
+#include <utility>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Places the keyframes of every video representation, once per source frame,
+// so that all representations key the same frames and their chunks start at
+// the same times. Each scheduled keyframe starts a segment; segments are
+// numbered from 1 in the order they are scheduled, as |DashWriter| numbers
+// chunks.
+//
+//   scheduler.Init(keyframe_interval, keyframe_interval / 4);
+//   ...
+//   if (scheduler.ScheduleFrame(timestamp, requested, scene_cut))
+//     <request a keyframe at |timestamp| from every representation>
+//   ...
+//   const int64 segment = scheduler.SegmentNumber(chunk_start);
+//
+// Notes
+// - Not thread safe; |WebmEncoder| uses it only from its encoder thread.
+// - Only the latest |kMaxSegments| segment start times are remembered.
+// - |InitAligned()| places keyframes and numbers segments from the source
+//   timestamps alone, so that encoders started at different times on the
+//   same input agree on both.
+class GopScheduler {
+ public:
+  // Segment start times remembered for |SegmentNumber()|.
+  static const int kMaxSegments = 256;
+
+  GopScheduler();
+  ~GopScheduler() {}
+
+  // Forgets every scheduled keyframe, and numbers the next segment 1, as
+  // |DashWriter| does in a new Period. |keyframe_interval| is the time, in
+  // milliseconds, after which a keyframe is scheduled, or 0 for none, and
+  // |min_scene_cut_spacing| the least time after the previous keyframe that
+  // a scene cut must come to be keyed.
+  void Init(int64 keyframe_interval, int64 min_scene_cut_spacing);
+
+  // Like |Init()|, but keys the first frame at or after each multiple of
+  // |keyframe_interval|, which must be positive, and numbers the segment it
+  // starts |AlignedSegmentNumber()|. Requested and scene cut keyframes are
+  // ignored: the other encoders would not place them. The first frame is
+  // still keyed, and starts a partial segment.
+  void InitAligned(int64 keyframe_interval);
+
+  // Returns true when the frame at |timestamp| is a keyframe in every
+  // representation: the first frame, frames more than a nonzero keyframe
+  // interval after the previous keyframe, |requested| frames, and
+  // |scene_cut| frames far enough from the previous keyframe.
+  bool ScheduleFrame(int64 timestamp, bool requested, bool scene_cut);
+
+  // Returns the number of the segment that starts at |timestamp|, or -1 when
+  // no remembered keyframe was scheduled at |timestamp|.
+  int64 SegmentNumber(int64 timestamp) const;
+
+  // Returns the number of the aligned segment holding |timestamp|: 1 plus
+  // the number of whole keyframe intervals before it. Returns -1 unless
+  // |InitAligned()| was called.
+  int64 AlignedSegmentNumber(int64 timestamp) const;
+
+  bool aligned() const { return aligned_; }
+
+  // Time of the latest scheduled keyframe, or -1 before the first.
+  int64 last_keyframe_time() const { return last_keyframe_time_; }
+
+ private:
+  int64 keyframe_interval_;
+  int64 min_scene_cut_spacing_;
+  bool aligned_;
+  int64 last_keyframe_time_;
+  int64 next_segment_;
+
+  // Start time and number of the latest segments, oldest first.
+  std::deque<std::pair<int64, int64>> segments_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(GopScheduler);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_GOP_SCHEDULER_H_
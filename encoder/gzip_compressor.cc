@@ -0,0 +1,114 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/gzip_compressor.h"
+
+#include <cstring>
+#include <new>
+
+#ifdef WEBMLIVE_HAVE_ZLIB
+#include "zlib.h"
+#endif
+#include "glog/logging.h"
+
+namespace webmlive {
+
+#ifdef WEBMLIVE_HAVE_ZLIB
+namespace {
+// Window bits selecting the largest window and a gzip wrapper instead of the
+// zlib one.
+const int kGzipWindowBits = 15 + 16;
+const int kMemoryLevel = 8;
+}  // namespace
+
+GzipCompressor::GzipCompressor() : ptr_stream_(NULL) {
+}
+
+GzipCompressor::~GzipCompressor() {
+  if (ptr_stream_) {
+    deflateEnd(ptr_stream_);
+    delete ptr_stream_;
+  }
+}
+
+int GzipCompressor::Init(int level) {
+  if (ptr_stream_ || level < 1 || level > 9) {
+    return kInvalidArg;
+  }
+  ptr_stream_ = new (std::nothrow) z_stream;  // NOLINT
+  if (!ptr_stream_) {
+    return kNoMemory;
+  }
+  memset(ptr_stream_, 0, sizeof(*ptr_stream_));
+  const int status = deflateInit2(ptr_stream_, level, Z_DEFLATED,
+                                  kGzipWindowBits, kMemoryLevel,
+                                  Z_DEFAULT_STRATEGY);
+  if (status != Z_OK) {
+    LOG(ERROR) << "deflateInit2 failed: " << status;
+    delete ptr_stream_;
+    ptr_stream_ = NULL;
+    return status == Z_MEM_ERROR ? kNoMemory : kZlibError;
+  }
+  return kSuccess;
+}
+
+int GzipCompressor::Compress(const DataChunk& chunk,
+                             std::vector<uint8>* ptr_output) {
+  if (!ptr_stream_ || !ptr_output) {
+    return kInvalidArg;
+  }
+  if (deflateReset(ptr_stream_) != Z_OK) {
+    LOG(ERROR) << "deflateReset failed.";
+    return kZlibError;
+  }
+
+  // deflateBound() covers the whole chunk: one deflate() call per span, and a
+  // final Z_FINISH call, never run out of room.
+  ptr_output->resize(deflateBound(ptr_stream_,
+                                  static_cast<uLong>(chunk.length())));
+  ptr_stream_->next_out = &(*ptr_output)[0];
+  ptr_stream_->avail_out = static_cast<uInt>(ptr_output->size());
+  const std::vector<DataChunk::Span>& spans = chunk.spans();
+  for (size_t i = 0; i < spans.size(); ++i) {
+    if (spans[i].length == 0) {
+      continue;
+    }
+    ptr_stream_->next_in = const_cast<Bytef*>(spans[i].ptr_data);
+    ptr_stream_->avail_in = static_cast<uInt>(spans[i].length);
+    if (deflate(ptr_stream_, Z_NO_FLUSH) != Z_OK ||
+        ptr_stream_->avail_in != 0) {
+      LOG(ERROR) << "deflate failed.";
+      return kZlibError;
+    }
+  }
+  if (deflate(ptr_stream_, Z_FINISH) != Z_STREAM_END) {
+    LOG(ERROR) << "deflate did not finish the gzip member.";
+    return kZlibError;
+  }
+  ptr_output->resize(ptr_stream_->total_out);
+  return kSuccess;
+}
+#else
+GzipCompressor::GzipCompressor() : ptr_stream_(NULL) {
+}
+
+GzipCompressor::~GzipCompressor() {
+}
+
+int GzipCompressor::Init(int /* level */) {
+  LOG(ERROR) << "zlib support was not built; configure with "
+             << "WEBMLIVE_ENABLE_ZLIB.";
+  return kUnsupported;
+}
+
+int GzipCompressor::Compress(const DataChunk& /* chunk */,
+                             std::vector<uint8>* /* ptr_output */) {
+  return kUnsupported;
+}
+#endif  // WEBMLIVE_HAVE_ZLIB
+
+}  // namespace webmlive
@@ -0,0 +1,61 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_GZIP_COMPRESSOR_H_
+#define WEBMLIVE_ENCODER_GZIP_COMPRESSOR_H_
+
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/buffer_util.h"
+
+// zlib deflate stream state.
+struct z_stream_s;
+
+namespace webmlive {
+
+// Compresses chunks to gzip members (RFC 1952) with one zlib deflate stream,
+// which is reset, not reallocated, between chunks.
+//
+// Notes
+// - zlib is optional: without WEBMLIVE_HAVE_ZLIB |Init()| fails.
+// - Not thread safe.
+class GzipCompressor {
+ public:
+  enum {
+    // zlib support was not built.
+    kUnsupported = -4,
+    // A zlib function returned an error.
+    kZlibError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // zlib's default compromise between speed and size.
+  static const int kDefaultLevel = 6;
+
+  GzipCompressor();
+  ~GzipCompressor();
+
+  // Allocates the deflate stream for compression |level|, 1 to 9. Returns
+  // |kSuccess| when successful.
+  int Init(int level);
+
+  // Stores the gzip member holding |chunk| in |ptr_output|. Returns
+  // |kSuccess| when successful.
+  int Compress(const DataChunk& chunk, std::vector<uint8>* ptr_output);
+
+ private:
+  // Deflate stream, allocated by |Init()|.
+  ::z_stream_s* ptr_stream_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(GzipCompressor);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_GZIP_COMPRESSOR_H_
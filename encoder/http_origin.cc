@@ -0,0 +1,577 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/http_origin.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <new>
+
+#include "encoder/dash_writer.h"
+#include "encoder/metrics.h"
+#include "encoder/socket_util.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Interval at which blocked threads check for |Stop()|, and at which
+// streaming responses check for new data.
+const int kPollMs = 100;
+const int kStreamPollMs = 5;
+
+// Connections idle this long are closed, and streaming responses whose
+// segment stops growing this long are ended.
+const int kIdleTimeoutMs = 30000;
+const int kMaxStreamStallMs = 10000;
+
+// Time a send may block on a client that stopped reading.
+const int kSendTimeoutMs = 5000;
+
+// Largest request header accepted, and the size of the reads of streaming
+// chunks.
+const size_t kMaxRequestBytes = 8 * 1024;
+const int32 kStreamReadBytes = 16 * 1024;
+
+const char kHeaderEnd[] = "\r\n\r\n";
+const char kManifestSuffix[] = ".mpd";
+const char kPatchSuffix[] = ".mpp";
+const char kJpegSuffix[] = ".jpg";
+const char kVttSuffix[] = ".vtt";
+
+const char* ContentType(const std::string& id) {
+  if (HasSuffix(id, kManifestSuffix)) {
+    return "application/dash+xml";
+  }
+  if (HasSuffix(id, kPatchSuffix)) {
+    return "application/dash-patch+xml";
+  }
+  if (HasSuffix(id, kJpegSuffix)) {
+    return "image/jpeg";
+  }
+  if (HasSuffix(id, kVttSuffix)) {
+    return "text/vtt";
+  }
+  AdaptationSet::MediaType media_type = AdaptationSet::kVideo;
+  bool init = false;
+  if (DashWriter::ParseChunkId(id, &media_type, &init) &&
+      media_type == AdaptationSet::kAudio) {
+    return "audio/webm";
+  }
+  return "video/webm";
+}
+
+// Returns the status line and headers of a response. |content_length| is
+// omitted when negative.
+std::string ResponseHeader(const char* status, const std::string& id,
+                           int64 content_length, bool chunked,
+                           bool keep_alive) {
+  char length_header[64] = {0};
+  if (content_length >= 0) {
+    snprintf(length_header, sizeof(length_header),
+             "Content-Length: %lld\r\n",
+             static_cast<long long>(content_length));  // NOLINT
+  }
+  std::string header = std::string("HTTP/1.1 ") + status + "\r\n";
+  if (!id.empty()) {
+    header += std::string("Content-Type: ") + ContentType(id) + "\r\n";
+    // The manifest, its patch and the sprite sheet index are rewritten in
+    // place.
+    if (HasSuffix(id, kManifestSuffix) || HasSuffix(id, kPatchSuffix) ||
+        HasSuffix(id, kVttSuffix)) {
+      header += "Cache-Control: no-cache\r\n";
+    }
+  }
+  header += length_header;
+  if (chunked) {
+    header += "Transfer-Encoding: chunked\r\n";
+  }
+  header += "Access-Control-Allow-Origin: *\r\n";
+  header += keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+  header += "\r\n";
+  return header;
+}
+
+// Returns the header of a redirect to |url|, which has no body.
+std::string RedirectHeader(const std::string& url, bool keep_alive) {
+  std::string header = "HTTP/1.1 302 Found\r\n";
+  header += "Location: " + url + "\r\n";
+  header += "Content-Length: 0\r\n";
+  header += "Access-Control-Allow-Origin: *\r\n";
+  header += keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+  header += "\r\n";
+  return header;
+}
+}  // namespace
+
+struct HttpOrigin::Connection {
+  Connection() : socket(kInvalidSocket), done(false) {}
+  NativeSocket socket;
+  std::unique_ptr<std::thread> thread;
+  std::atomic<bool> done;
+
+  // Received bytes not yet parsed as a request.
+  std::string buffer;
+};
+
+HttpOrigin::HttpOrigin()
+    : tiered_(false),
+      stop_(true),
+      listen_socket_(static_cast<SocketHandle>(kInvalidSocket)),
+      ptr_requests_(NULL),
+      ptr_not_found_(NULL),
+      ptr_bytes_sent_(NULL),
+      ptr_clients_(NULL),
+      ptr_cached_bytes_(NULL),
+      ptr_disk_reads_(NULL),
+      ptr_redirects_(NULL) {
+}
+
+HttpOrigin::~HttpOrigin() {
+  Stop();
+}
+
+int HttpOrigin::Init(const HttpOriginSettings& settings) {
+  if (settings.port < 0 || settings.port > 65535 ||
+      settings.max_clients < 1 || settings.request_wait_ms < 0) {
+    LOG(ERROR) << "invalid origin settings, port=" << settings.port
+               << " max_clients=" << settings.max_clients
+               << " request_wait=" << settings.request_wait_ms;
+    return kInvalidArg;
+  }
+  settings_ = settings;
+  if (cache_.Init(settings_.cache_settings)) {
+    return kInvalidArg;
+  }
+  tiered_ = !settings_.dvr_settings.disk_directory.empty();
+  if (tiered_) {
+    DvrTierSettings& dvr_settings = settings_.dvr_settings;
+    if (dvr_settings.metrics_labels.empty()) {
+      dvr_settings.metrics_labels = settings_.metrics_labels;
+    }
+    const int status = tiers_.Init(dvr_settings);
+    if (status) {
+      LOG(ERROR) << "origin DVR tiers Init failed, status=" << status;
+      return status;
+    }
+  }
+  cache_.SetSpillSink(tiered_ ? &tiers_ : NULL);
+
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  ptr_requests_ = registry.GetCounter(
+      "webmlive_origin_requests_total", settings_.metrics_labels,
+      "Requests received by the embedded HTTP origin.");
+  ptr_not_found_ = registry.GetCounter(
+      "webmlive_origin_not_found_total", settings_.metrics_labels,
+      "Requests for chunks not written within the request wait.");
+  ptr_bytes_sent_ = registry.GetCounter(
+      "webmlive_origin_sent_bytes_total", settings_.metrics_labels,
+      "Bytes sent by the embedded HTTP origin.");
+  ptr_clients_ = registry.GetGauge(
+      "webmlive_origin_connections", settings_.metrics_labels,
+      "Open connections to the embedded HTTP origin.");
+  ptr_cached_bytes_ = registry.GetGauge(
+      "webmlive_origin_cached_bytes", settings_.metrics_labels,
+      "Bytes of complete chunks held by the origin's segment cache.");
+  ptr_disk_reads_ = registry.GetCounter(
+      "webmlive_origin_disk_reads_total", settings_.metrics_labels,
+      "Segments served from the DVR disk tier.");
+  ptr_redirects_ = registry.GetCounter(
+      "webmlive_origin_object_redirects_total", settings_.metrics_labels,
+      "Requests redirected to the DVR object tier.");
+  if (!ptr_requests_ || !ptr_not_found_ || !ptr_bytes_sent_ ||
+      !ptr_clients_ || !ptr_cached_bytes_ || !ptr_disk_reads_ ||
+      !ptr_redirects_) {
+    LOG(ERROR) << "cannot create origin metrics.";
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+int HttpOrigin::Run() {
+  if (listen_thread_) {
+    return kInvalidArg;
+  }
+  if (!StartupSockets()) {
+    LOG(ERROR) << "cannot initialize sockets.";
+    return kSocketError;
+  }
+  const NativeSocket listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_socket == kInvalidSocket) {
+    LOG(ERROR) << "cannot create origin socket.";
+    return kSocketError;
+  }
+  listen_socket_ = static_cast<SocketHandle>(listen_socket);
+  const int reuse = 1;
+  setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR,
+             reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(static_cast<uint16>(settings_.port));
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (!settings_.bind_address.empty() &&
+      inet_pton(AF_INET, settings_.bind_address.c_str(),
+                &address.sin_addr) != 1) {
+    LOG(ERROR) << "invalid origin bind address " << settings_.bind_address;
+    Stop();
+    return kInvalidArg;
+  }
+  if (bind(listen_socket, reinterpret_cast<const sockaddr*>(&address),
+           sizeof(address)) ||
+      listen(listen_socket, SOMAXCONN)) {
+    LOG(ERROR) << "cannot listen on origin port " << settings_.port;
+    Stop();
+    return kSocketError;
+  }
+  if (tiered_ && tiers_.Run()) {
+    LOG(ERROR) << "cannot start origin DVR tiers.";
+    Stop();
+    return kThreadError;
+  }
+
+  stop_ = false;
+  listen_thread_.reset(new (std::nothrow) std::thread(  // NOLINT
+      std::bind(&HttpOrigin::ListenThread, this)));
+  if (!listen_thread_) {
+    LOG(ERROR) << "cannot start origin listening thread.";
+    Stop();
+    return kThreadError;
+  }
+  LOG(INFO) << "origin serving on port " << settings_.port;
+  return kSuccess;
+}
+
+void HttpOrigin::Stop() {
+  stop_ = true;
+  cache_.Close();
+  if (listen_thread_) {
+    listen_thread_->join();
+    listen_thread_.reset();
+  }
+  ReapConnections(true);
+  tiers_.Stop();
+  const NativeSocket listen_socket = static_cast<NativeSocket>(listen_socket_);
+  if (listen_socket != kInvalidSocket) {
+    CloseSocket(listen_socket);
+    listen_socket_ = static_cast<SocketHandle>(kInvalidSocket);
+    CleanupSockets();
+  }
+}
+
+bool HttpOrigin::Ready() const {
+  return !stop_;
+}
+
+bool HttpOrigin::WriteData(const uint8* ptr_data, int32 data_length,
+                           const std::string& id) {
+  std::shared_ptr<DataChunk> chunk(new (std::nothrow) DataChunk());  // NOLINT
+  if (!chunk || chunk->Init(ptr_data, data_length)) {
+    LOG(ERROR) << "HttpOrigin cannot copy data for " << id;
+    return false;
+  }
+  return WriteChunk(chunk, id);
+}
+
+bool HttpOrigin::WriteChunk(const SharedDataChunk& chunk,
+                            const std::string& id) {
+  if (!chunk || id.empty() || stop_) {
+    return false;
+  }
+  cache_.Put(id, chunk);
+  ptr_cached_bytes_->Set(cache_.size_bytes());
+  return true;
+}
+
+bool HttpOrigin::WriteStreamingChunk(const SharedStreamingChunk& chunk,
+                                     const std::string& id) {
+  if (!chunk || id.empty() || stop_) {
+    return false;
+  }
+  cache_.PutStreaming(id, chunk);
+  return true;
+}
+
+void HttpOrigin::ListenThread() {
+  const NativeSocket listen_socket = static_cast<NativeSocket>(listen_socket_);
+  while (!stop_) {
+    ReapConnections(false);
+    if (!WaitReadable(listen_socket, kPollMs)) {
+      continue;
+    }
+    const NativeSocket client = accept(listen_socket, NULL, NULL);
+    if (client == kInvalidSocket) {
+      continue;
+    }
+    SetSendTimeout(client, kSendTimeoutMs);
+    // Segments are written as they are produced; do not hold back the tail.
+    SetNoDelay(client);
+    if (connections_.size() >= static_cast<size_t>(settings_.max_clients)) {
+      LOG(WARNING) << "origin connection limit reached, refusing client.";
+      const std::string response =
+          ResponseHeader("503 Service Unavailable", "", 0, false, false);
+      SendAll(client, response);
+      CloseSocket(client);
+      continue;
+    }
+
+    std::unique_ptr<Connection> connection(
+        new (std::nothrow) Connection());  // NOLINT
+    if (!connection) {
+      CloseSocket(client);
+      continue;
+    }
+    connection->socket = client;
+    Connection* const ptr_connection = connection.get();
+    connection->thread.reset(new (std::nothrow) std::thread(  // NOLINT
+        std::bind(&HttpOrigin::ConnectionThread, this, ptr_connection)));
+    if (!connection->thread) {
+      LOG(ERROR) << "cannot start origin connection thread.";
+      CloseSocket(client);
+      continue;
+    }
+    connections_.push_back(std::move(connection));
+    ptr_clients_->Set(static_cast<int64>(connections_.size()));
+  }
+}
+
+// Requests are read until the blank line ending their headers. GET and HEAD
+// have no body, so anything after it is the next request of a pipelining
+// client.
+void HttpOrigin::ConnectionThread(Connection* ptr_connection) {
+  int idle_ms = 0;
+  char buffer[4096];
+  while (!stop_) {
+    const size_t header_end = ptr_connection->buffer.find(kHeaderEnd);
+    if (header_end != std::string::npos) {
+      const std::string request =
+          ptr_connection->buffer.substr(0, header_end);
+      ptr_connection->buffer.erase(0, header_end + sizeof(kHeaderEnd) - 1);
+      if (!ServeRequest(ptr_connection, request)) {
+        break;
+      }
+      idle_ms = 0;
+      continue;
+    }
+    if (ptr_connection->buffer.size() > kMaxRequestBytes) {
+      LOG(WARNING) << "origin request too large, closing connection.";
+      break;
+    }
+    if (!WaitReadable(ptr_connection->socket, kPollMs)) {
+      idle_ms += kPollMs;
+      if (idle_ms >= kIdleTimeoutMs) {
+        break;
+      }
+      continue;
+    }
+    const int bytes_read =
+        recv(ptr_connection->socket, buffer, sizeof(buffer), 0);
+    if (bytes_read <= 0) {
+      break;
+    }
+    ptr_connection->buffer.append(buffer, bytes_read);
+  }
+  CloseSocket(ptr_connection->socket);
+  ptr_connection->socket = kInvalidSocket;
+  ptr_connection->done = true;
+}
+
+bool HttpOrigin::ServeRequest(Connection* ptr_connection,
+                              const std::string& request) {
+  ptr_requests_->Increment(1);
+
+  // Request line: "<method> <target> <version>".
+  const size_t line_end = request.find("\r\n");
+  const std::string request_line = request.substr(0, line_end);
+  const size_t target_pos = request_line.find(' ');
+  const size_t version_pos = request_line.find(' ', target_pos + 1);
+  if (target_pos == std::string::npos || version_pos == std::string::npos) {
+    const std::string response =
+        ResponseHeader("400 Bad Request", "", 0, false, false);
+    Send(ptr_connection, response.data(), response.size());
+    return false;
+  }
+  const std::string method = request_line.substr(0, target_pos);
+  std::string target =
+      request_line.substr(target_pos + 1, version_pos - target_pos - 1);
+  const bool http11 = request_line.compare(version_pos + 1,
+                                           std::string::npos,
+                                           "HTTP/1.1") == 0;
+
+  // HTTP/1.1 connections persist unless closed, and HTTP/1.0 ones end after
+  // the response unless kept alive.
+  const std::string connection =
+      ToLower(HeaderValue(request, ToLower(request), "connection"));
+  bool keep_alive = http11;
+  if (connection.find("close") != std::string::npos) {
+    keep_alive = false;
+  } else if (connection.find("keep-alive") != std::string::npos) {
+    keep_alive = true;
+  }
+
+  const bool head = (method == "HEAD");
+  if (method != "GET" && !head) {
+    const std::string response =
+        ResponseHeader("405 Method Not Allowed", "", 0, false, false);
+    Send(ptr_connection, response.data(), response.size());
+    return false;
+  }
+
+  // Chunk ids are plain file names.
+  target = target.substr(0, target.find('?'));
+  const std::string id = target.empty() ? target : target.substr(1);
+  if (target[0] != '/' || id.empty() ||
+      id.find_first_of("/\\") != std::string::npos ||
+      id.find("..") != std::string::npos) {
+    const std::string response =
+        ResponseHeader("400 Bad Request", "", 0, false, keep_alive);
+    return Send(ptr_connection, response.data(), response.size()) &&
+           keep_alive;
+  }
+
+  SharedDataChunk chunk;
+  SharedStreamingChunk stream;
+  DvrTierStore::Tier tier = DvrTierStore::kNotFound;
+  std::string object_url;
+  if (!cache_.Find(id, settings_.request_wait_ms, &chunk, &stream)) {
+    if (stop_) {
+      return false;
+    }
+    if (tiered_) {
+      tier = tiers_.Find(id, &chunk, &object_url);
+    }
+  }
+  if (tier == DvrTierStore::kObjectStore) {
+    ptr_redirects_->Increment(1);
+    const std::string response = RedirectHeader(object_url, keep_alive);
+    return Send(ptr_connection, response.data(), response.size()) &&
+           keep_alive;
+  }
+  if (tier == DvrTierStore::kDisk) {
+    ptr_disk_reads_->Increment(1);
+  }
+  if (!chunk && !stream) {
+    VLOG(1) << "origin has no chunk " << id;
+    ptr_not_found_->Increment(1);
+    const std::string response =
+        ResponseHeader("404 Not Found", "", 0, false, keep_alive);
+    return Send(ptr_connection, response.data(), response.size()) &&
+           keep_alive;
+  }
+
+  if (chunk) {
+    const std::string response =
+        ResponseHeader("200 OK", id, chunk->length(), false, keep_alive);
+    if (!Send(ptr_connection, response.data(), response.size())) {
+      return false;
+    }
+    if (!head) {
+      const std::vector<DataChunk::Span>& spans = chunk->spans();
+      for (size_t i = 0; i < spans.size(); ++i) {
+        if (!Send(ptr_connection, spans[i].ptr_data, spans[i].length)) {
+          return false;
+        }
+      }
+    }
+    return keep_alive;
+  }
+
+  // The segment is still being written: its length is unknown. HTTP/1.0
+  // clients read it until the connection closes.
+  const bool chunked = http11;
+  if (!chunked) {
+    keep_alive = false;
+  }
+  const std::string response =
+      ResponseHeader("200 OK", id, -1, chunked, keep_alive);
+  if (!Send(ptr_connection, response.data(), response.size())) {
+    return false;
+  }
+  if (head) {
+    return keep_alive;
+  }
+  return SendStreamingChunk(ptr_connection, stream, chunked) && keep_alive;
+}
+
+bool HttpOrigin::SendStreamingChunk(Connection* ptr_connection,
+                                    const SharedStreamingChunk& stream,
+                                    bool chunked) {
+  std::vector<uint8> buffer(kStreamReadBytes);
+  int64 offset = 0;
+  int stall_ms = 0;
+  while (!stop_) {
+    int32 length = 0;
+    const int status =
+        stream->Read(offset, kStreamReadBytes, &buffer[0], &length);
+    if (status == StreamingChunk::kSuccess) {
+      if (chunked) {
+        char size_line[16];
+        snprintf(size_line, sizeof(size_line), "%x\r\n", length);
+        if (!Send(ptr_connection, size_line, strlen(size_line)) ||
+            !Send(ptr_connection, &buffer[0], length) ||
+            !Send(ptr_connection, "\r\n", 2)) {
+          return false;
+        }
+      } else if (!Send(ptr_connection, &buffer[0], length)) {
+        return false;
+      }
+      offset += length;
+      stall_ms = 0;
+    } else if (status == StreamingChunk::kNoData) {
+      // Wait for the writer to append more of the segment.
+      if (stall_ms >= kMaxStreamStallMs) {
+        LOG(WARNING) << "origin streaming chunk stalled, closing connection.";
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(kStreamPollMs));
+      stall_ms += kStreamPollMs;
+    } else if (status == StreamingChunk::kEndOfChunk) {
+      return !chunked || Send(ptr_connection, "0\r\n\r\n", 5);
+    } else {
+      LOG(ERROR) << "origin streaming chunk read failed: " << status;
+      return false;
+    }
+  }
+  return false;
+}
+
+bool HttpOrigin::Send(Connection* ptr_connection, const void* ptr_data,
+                      size_t length) {
+  if (!SendAll(ptr_connection->socket, ptr_data, length)) {
+    VLOG(1) << "origin send failed, closing connection.";
+    return false;
+  }
+  ptr_bytes_sent_->Increment(length);
+  return true;
+}
+
+void HttpOrigin::ReapConnections(bool all) {
+  std::vector<std::unique_ptr<Connection>>::iterator it =
+      connections_.begin();
+  while (it != connections_.end()) {
+    Connection* const ptr_connection = it->get();
+    if (all && !ptr_connection->done) {
+      // Wake the thread from a blocked send; it closes the socket itself.
+      shutdown(ptr_connection->socket, kShutdownBoth);
+    }
+    if (all || ptr_connection->done) {
+      ptr_connection->thread->join();
+      it = connections_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (ptr_clients_) {
+    ptr_clients_->Set(static_cast<int64>(connections_.size()));
+  }
+}
+
+}  // namespace webmlive
@@ -0,0 +1,177 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_HTTP_ORIGIN_H_
+#define WEBMLIVE_ENCODER_HTTP_ORIGIN_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/data_sink.h"
+#include "encoder/dvr_tier_store.h"
+#include "encoder/segment_cache.h"
+
+namespace webmlive {
+
+class Metric;
+
+struct HttpOriginSettings {
+  static const int kDefaultPort = 8080;
+  static const int kDefaultMaxClients = 16;
+  static const int kDefaultRequestWaitMs = 4000;
+
+  HttpOriginSettings()
+      : port(kDefaultPort),
+        max_clients(kDefaultMaxClients),
+        request_wait_ms(kDefaultRequestWaitMs) {}
+
+  // Address and TCP port the server listens on. An empty |bind_address|
+  // listens on all interfaces.
+  std::string bind_address;
+  int port;
+
+  // Time-shift window and memory budget of the chunks kept in memory; see
+  // |SegmentCache|.
+  SegmentCacheSettings cache_settings;
+
+  // Lower tiers of the time-shift window, holding the segments evicted from
+  // memory; see |DvrTierStore|. Disabled when |dvr_settings.disk_directory|
+  // is empty. The metrics labels default to |metrics_labels|.
+  DvrTierSettings dvr_settings;
+
+  // Connections served at once. Further connections are refused with a 503
+  // response.
+  int max_clients;
+
+  // Time a request for a segment not yet written waits for it before the
+  // server answers 404. Players requesting the next segment early get it as
+  // soon as it exists.
+  int request_wait_ms;
+
+  // Labels added to the origin's metrics; see |MetricsRegistry|.
+  std::string metrics_labels;
+};
+
+// Data sink serving the chunks it receives over HTTP, straight from memory.
+// Small deployments get the encoder's manifest and segments to players
+// without a disk round trip or a separate web server.
+//
+// "GET /<id>" and "HEAD /<id>" return the chunk written with |id|:
+// - complete chunks are sent with their length;
+// - segments still being written, received with |WriteStreamingChunk()|
+//   when the encoder runs with |low_latency_upload|, are sent to HTTP/1.1
+//   clients with chunked transfer encoding as the data arrives;
+// - requests for chunks not yet written wait up to |request_wait_ms|;
+// - segments evicted from memory are read from the disk tier, or answered
+//   with a redirect to the object tier, when |dvr_settings| enables them.
+// Connections are kept alive between requests, and every response allows
+// cross origin reads for browser players.
+//
+// Notes
+// - Each connection is served by its own thread; the listening socket by
+//   another.
+// - |Ready()| always returns true while running: writes only store a
+//   reference in the |SegmentCache|.
+class HttpOrigin : public DataSinkInterface {
+ public:
+  enum {
+    // Socket setup failed.
+    kSocketError = -4,
+    // Cannot start the listening thread.
+    kThreadError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  HttpOrigin();
+  virtual ~HttpOrigin();
+
+  // Copies |settings|, and prepares the segment cache. Returns |kSuccess|
+  // when successful.
+  int Init(const HttpOriginSettings& settings);
+
+  // Binds the listening socket and starts serving. Returns |kSuccess| when
+  // successful.
+  int Run();
+
+  // Closes the listening socket and all connections, and joins their
+  // threads.
+  void Stop();
+
+  // Chunks held for the time-shift window. Sinks added to a running stream
+  // can catch up with |SegmentCache::Replay()|.
+  const SegmentCache& cache() const { return cache_; }
+
+  // |DataSinkInterface| methods.
+  virtual bool Ready() const;
+  virtual bool WriteData(const uint8* ptr_data, int32 data_length,
+                         const std::string& id);
+  virtual bool WriteChunk(const SharedDataChunk& chunk,
+                          const std::string& id);
+  virtual bool WriteStreamingChunk(const SharedStreamingChunk& chunk,
+                                   const std::string& id);
+
+ private:
+  struct Connection;
+
+  // Socket handle: a SOCKET on Windows, and a file descriptor elsewhere.
+  typedef std::intptr_t SocketHandle;
+
+  // Accepts connections and reaps the threads of closed ones.
+  void ListenThread();
+
+  // Serves the requests of |ptr_connection| until the client closes it, it
+  // idles, or |Stop()| is called.
+  void ConnectionThread(Connection* ptr_connection);
+
+  // Answers one request. Returns false when the connection must be closed.
+  bool ServeRequest(Connection* ptr_connection, const std::string& request);
+
+  // Sends |stream| as it is written. Returns false when the connection must
+  // be closed.
+  bool SendStreamingChunk(Connection* ptr_connection,
+                          const SharedStreamingChunk& stream, bool chunked);
+
+  // Sends all |length| bytes of |ptr_data|. Returns false on failure.
+  bool Send(Connection* ptr_connection, const void* ptr_data, size_t length);
+
+  // Joins and frees the threads of closed connections. With |all| set,
+  // closes every connection first.
+  void ReapConnections(bool all);
+
+  HttpOriginSettings settings_;
+  SegmentCache cache_;
+  DvrTierStore tiers_;
+  bool tiered_;
+  std::atomic<bool> stop_;
+  SocketHandle listen_socket_;
+  std::unique_ptr<std::thread> listen_thread_;
+
+  // Open connections. Used by the listening thread, and by |Stop()| after
+  // the listening thread is joined.
+  std::vector<std::unique_ptr<Connection>> connections_;
+
+  // Metrics exported through |MetricsRegistry|. Set by |Init|.
+  Metric* ptr_requests_;
+  Metric* ptr_not_found_;
+  Metric* ptr_bytes_sent_;
+  Metric* ptr_clients_;
+  Metric* ptr_cached_bytes_;
+  Metric* ptr_disk_reads_;
+  Metric* ptr_redirects_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(HttpOrigin);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_HTTP_ORIGIN_H_
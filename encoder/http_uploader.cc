@@ -7,20 +7,41 @@
 // be found in the AUTHORS file in the root of the source tree.
 #include "encoder/http_uploader.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <random>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include "encoder/buffer_util.h"
+#include "encoder/cpu_accounting.h"
+#include "encoder/dash_writer.h"
+#include "encoder/gzip_compressor.h"
+#include "encoder/lock_profiler.h"
+#include "encoder/memory_governor.h"
+#include "encoder/metrics.h"
+#include "encoder/status_snapshot.h"
+#include "encoder/thread_placement.h"
+#include "encoder/token_bucket.h"
+#include "encoder/tracepoints.h"
+#include "encoder/upload_spool.h"
 #include "curl/curl.h"
 #include "curl/easy.h"
+#include "curl/multi.h"
 #include "glog/logging.h"
 #include "libwebm/mkvparser.hpp"
 
@@ -29,24 +50,181 @@
              << curl_easy_strerror(CURL_ERR)
 #define LOG_CURLFORM_ERR(CURL_ERR, MSG_STR) \
   LOG(ERROR) << MSG_STR << " err=" << CURL_ERR
+#define LOG_CURLM_ERR(CURLM_ERR, MSG_STR) \
+  LOG(ERROR) << MSG_STR << " err=" << CURLM_ERR << ":" \
+             << curl_multi_strerror(CURLM_ERR)
+
+// libcurl 7.56 added the curl_mime API, which lets a transfer build its form
+// once and set only the size of the file part for each upload.
+#if LIBCURL_VERSION_NUM >= 0x073800
+#define WEBMLIVE_HAVE_CURL_MIME
+#endif
+
+// libcurl 7.66 added HTTP/3 through its QUIC backends. Before 7.88 libcurl
+// fails an HTTP/3 upload the server does not accept instead of falling back
+// to HTTP/2 and HTTP/1.1, and the uploader falls back itself.
+#ifdef CURL_VERSION_HTTP3
+#define WEBMLIVE_HAVE_CURL_HTTP3
+#if LIBCURL_VERSION_NUM < 0x075800
+#define WEBMLIVE_CURL_HTTP3_NO_FALLBACK
+#endif
+#endif
+
+// libcurl 7.50 added CURLINFO_HTTP_VERSION, which reports the HTTP version an
+// upload used.
+#if LIBCURL_VERSION_NUM >= 0x073200
+#define WEBMLIVE_HAVE_CURLINFO_HTTP_VERSION
+#endif
+
+// libcurl 7.75 added AWS Signature Version 4 signing, and 7.86 takes the
+// payload hash from an x-amz-content-sha256 header, which lets uploads read
+// through |ReadCallback| go unsigned.
+#if LIBCURL_VERSION_NUM >= 0x075600
+#define WEBMLIVE_HAVE_CURL_AWS_SIGV4
+#endif
 
 namespace webmlive {
 
 static const char* kExpectHeader = "Expect:";
 static const char* kContentTypeHeader = "Content-Type: video/webm";
+static const char* kBundleContentTypeHeader =
+    "Content-Type: application/x-webmlive-bundle";
+static const char* kChunkedEncodingHeader = "Transfer-Encoding: chunked";
+static const char* kGzipEncodingHeader = "Content-Encoding: gzip";
+static const char* kRangeHeader = "range:";
+static const char* kRangeBytesPrefix = "bytes=";
+static const char* kEtagHeader = "etag:";
+static const char* kUnsignedPayloadHeader =
+    "x-amz-content-sha256: UNSIGNED-PAYLOAD";
 static const char* kFormName = "webm_file";
 static const char* kWebmMimeType = "video/webm";
 static const int kUnknownFileSize = -1;
+// Smallest chunk resumed where the server stopped instead of sent again.
 static const int kBytesRequiredForResume = 32*1024;
+// Response bytes kept for |HttpTransfer::response_body()|; object store
+// responses parsed by the uploader are far smaller.
+static const size_t kMaxResponseBodyBytes = 64*1024;
+
+// Maximum time |UploadThread| waits in |curl_multi_wait|, or for new uploads
+// when libcurl has nothing to wait on. Bounds the delay in starting a queued
+// upload while other transfers are running.
+static const int kMaxTransferWaitMs = 10;
+
+// Returns the steady clock time in milliseconds. Retry and deadline times
+// are on this clock.
+static int64 NowMilliseconds() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
-class HttpUploaderImpl {
+// Returns |value| with all but the unreserved URL characters of RFC 3986
+// percent-encoded.
+static std::string EscapeUrlComponent(const std::string& value) {
+  static const char kHexDigits[] = "0123456789ABCDEF";
+  std::string escaped;
+  for (size_t i = 0; i < value.size(); ++i) {
+    const unsigned char c = static_cast<unsigned char>(value[i]);
+    if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~') {
+      escaped.push_back(static_cast<char>(c));
+    } else {
+      escaped.push_back('%');
+      escaped.push_back(kHexDigits[c >> 4]);
+      escaped.push_back(kHexDigits[c & 0xf]);
+    }
+  }
+  return escaped;
+}
+
+// Returns true when a server response to an upload calls for a retry: the
+// server timed out, is throttling, failed, or reports an incomplete upload
+// (308 Resume Incomplete).
+static bool RetryableResponse(int response_code) {
+  return response_code == 308 || response_code == 408 ||
+         response_code == 429 || response_code >= 500;
+}
+
+// Returns true when one of |headers| has the name of |header|.
+static bool HeaderReplaced(const char* header,
+                           const std::vector<std::string>& headers) {
+  const char* const ptr_colon = strchr(header, ':');
+  if (!ptr_colon) {
+    return false;
+  }
+  const size_t name_length = ptr_colon - header + 1;
+  for (size_t i = 0; i < headers.size(); ++i) {
+    if (headers[i].size() < name_length) {
+      continue;
+    }
+    size_t pos = 0;
+    while (pos < name_length &&
+           tolower(static_cast<unsigned char>(headers[i][pos])) ==
+               tolower(static_cast<unsigned char>(header[pos]))) {
+      ++pos;
+    }
+    if (pos == name_length) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// How long libcurl keeps resolved host names, and the TCP keep-alive idle
+// time and probe interval of upload connections, in seconds. Keep-alive
+// probes hold idle connections open through NAT and proxies between
+// segments.
+static const long kDnsCacheTimeoutSecs = 300;  // NOLINT
+static const long kKeepAliveIdleSecs = 30;  // NOLINT
+static const long kKeepAliveIntervalSecs = 15;  // NOLINT
+
+// Burst allowance of a paced uploader: the bytes sent at its rate in
+// |kPacingBurstMs|, and no less than |kMinPacingBurstBytes|, a libcurl send
+// buffer. Paused transfers resume once |kMinPacedReadBytes| can be sent.
+static const int kPacingBurstMs = 100;
+static const int kMinPacingBurstBytes = 16 * 1024;
+static const int kMinPacedReadBytes = 4 * 1024;
+
+// Window of the send rate in |HttpUploaderStats::current_bytes_per_second|.
+static const int kSendRateWindowMs = 1000;
+
+class HttpUploaderImpl;
+
+// Process wide libcurl share handle. The transfers of every uploader use it
+// to reuse DNS lookups and TLS sessions, so that an HTTPS upload on a new
+// connection resumes the TLS session of an earlier one instead of running a
+// full handshake. Connections are reused through the multi handle of the
+// engine running the transfers.
+class HttpShare {
  public:
-  typedef std::queue<std::string> UrlQueue;
-  enum {
-    // Libcurl reported an unexpected error.
-    kLibCurlError = -401,
-    kSuccess = 0,
+  // Returns the share, creating it on first use.
+  static HttpShare& Instance();
+
+  // Returns the share handle, or NULL when libcurl could not create it.
+  CURLSH* handle() const { return ptr_share_; }
+
+ private:
+  HttpShare();
+  ~HttpShare();
 
+  // Libcurl lock callbacks. Lock |mutexes_[data]|.
+  static void Lock(CURL* ptr_curl, curl_lock_data data,
+                   curl_lock_access access, void* ptr_this);
+  static void Unlock(CURL* ptr_curl, curl_lock_data data, void* ptr_this);
+
+  CURLSH* ptr_share_;
+
+  // One mutex per kind of shared data. Transfers on different engines run on
+  // different threads.
+  std::mutex mutexes_[CURL_LOCK_DATA_LAST];
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(HttpShare);
+};
+
+// A libcurl easy handle, and the state of the upload it is performing. The
+// uploader owns a fixed set of transfers and reuses their handles for every
+// upload; |HttpUploadEngineImpl::UploadThread| runs all of them through one
+// libcurl multi handle.
+class HttpTransfer {
+ public:
+  enum {
     // Constant value used to stop libcurl when |StopRequested| returns true
     // in |WriteCallback|.
     kWriteCallbackStopRequest = 0,
@@ -54,131 +232,654 @@ class HttpUploaderImpl {
     // Constant value used to stop libcurl when |StopRequested| returns true
     // in |ProgressCallback|.
     kProgressCallbackStopRequest = 1,
+  };
+
+  // Requests sent to object stores in |HTTP_PUT| mode.
+  enum ObjectRequest {
+    kPutObject,
+    kPostObject,
+    kDeleteObject,
+  };
+
+  explicit HttpTransfer(HttpUploaderImpl* ptr_uploader);
+  ~HttpTransfer();
+
+  // Configures libcurl. The header lists are owned by the uploader, and must
+  // outlive the transfer. |ptr_stream_headers| is used for streaming uploads.
+  int Init(const HttpUploaderSettings& settings, curl_slist* ptr_headers,
+           curl_slist* ptr_stream_headers);
+
+  // Configures the handle to POST |chunk| to |url|. The upload runs once the
+  // handle is added to a multi handle. A non-zero |resume_offset| sends the
+  // chunk from that offset on, with a Content-Range header. |gzip| marks a
+  // chunk compressed by the uploader with a Content-Encoding header.
+  // |content_type_header|, when not NULL, replaces the Content-Type header
+  // of the user headers.
+  int Start(const std::string& url, const SharedDataChunk& chunk,
+            int64 resume_offset, bool gzip, const char* content_type_header);
+
+  // Configures the handle to POST |stream| to |url| using chunked transfer
+  // encoding.
+  int StartStreaming(const std::string& url,
+                     const SharedStreamingChunk& stream);
+
+  // Configures the handle to send |request| to |url| with bytes |begin| to
+  // |end| of |chunk| as its body. |chunk| is NULL for requests without one.
+  // |content_type|, when not NULL, and |gzip| describe the body with
+  // Content-Type and Content-Encoding headers.
+  int StartObjectRequest(const std::string& url, ObjectRequest request,
+                         const SharedDataChunk& chunk, int64 begin,
+                         int64 end, const char* content_type, bool gzip);
+
+  // Returns true when |ReadCallback| paused the transfer waiting for data
+  // that has since been appended to |stream_|, or for pacing tokens that have
+  // since accrued, and clears the paused flag.
+  bool ReadyToResume();
+
+  // Records the outcome of the upload, updates the uploader's stats, and
+  // releases |chunk_|. Returns |kSuccess| when |result| is |CURLE_OK|.
+  int Finish(CURLcode result);
+
+  // HTTP response code of the last upload, or 0 when there was no response.
+  int response_code() const { return response_code_; }
+
+  // Bytes of the chunk the server reported holding in a Range response
+  // header during the last upload, or 0 when it reported none.
+  int64 confirmed_bytes() const { return confirmed_bytes_; }
+
+  // ETag header and start of the body of the last response.
+  const std::string& etag() const { return etag_; }
+  const std::string& response_body() const { return response_body_; }
+
+  CURL* handle() const { return ptr_curl_; }
+  HttpUploaderImpl* uploader() const { return ptr_uploader_; }
+
+  // Bytes of the current upload sent so far.
+  int64 bytes_sent_current() const { return bytes_sent_current_; }
+
+  // Bytes sent by the last upload, and the time it took in milliseconds; -1
+  // for failed and streaming uploads, whose time says nothing of the uplink.
+  int64 transfer_bytes() const { return transfer_bytes_; }
+  int64 transfer_ms() const { return transfer_ms_; }
+
+  // Requests HTTP/2 instead of HTTP/3 for later uploads. The transfer must be
+  // idle.
+  void DisableHttp3();
+
+ private:
+  // Logs the DNS, connect and TLS times of the finished upload, and updates
+  // the uploader's connection metrics.
+  void RecordConnectionTimes();
+
+  // Adds the time of the finished upload to the metrics of the HTTP version
+  // it used.
+  void RecordTransportTime();
+
+  // Pass our callbacks, |ProgressCallback|, |WriteCallback| and
+  // |ReadCallback|, to libcurl.
+  CURLcode SetCurlCallbacks();
+
+#ifdef WEBMLIVE_HAVE_CURL_MIME
+  // Builds |ptr_mime_|: the user form variables, and a file part whose data
+  // |ReadCallback| reads from |chunk_|.
+  int BuildMimeForm();
+#endif
+
+  // Configures libcurl to POST |chunk_| as file data in a form/multipart
+  // HTTP POST.
+  int SetupFormPost();
+
+  // Configures libcurl to POST |chunk_| or |stream_| as HTTP POST
+  // content-data.
+  int SetupPost();
+
+  // Moves the read position of |chunk_| to |offset|.
+  void SeekChunk(int64 offset);
+
+  // Configures libcurl to send |request| with the |read_remaining_| bytes of
+  // |chunk_| as its body.
+  int SetupObjectRequest(ObjectRequest request);
+
+  // Copies |ptr_headers_| to |ptr_upload_headers_|, adds |extra_headers|,
+  // and passes the list to libcurl. Extra headers replace the headers of the
+  // same name in |ptr_headers_|.
+  int SetUploadHeaders(const std::vector<std::string>& extra_headers);
+
+  // Libcurl progress callback function. Updates the uploader's stats.
+  static int ProgressCallback(void* ptr_this,
+                              double, double,  // we ignore download progress
+                              double upload_total, double upload_current);
+
+  // Records the Range header of responses in |confirmed_bytes_|, and the
+  // ETag header in |etag_|.
+  static size_t HeaderCallback(char* buffer, size_t size, size_t nitems,
+                               void* ptr_this);
+
+  // Logs HTTP response data received by libcurl, and keeps the start of it
+  // in |response_body_|.
+  static size_t WriteCallback(char* buffer, size_t size, size_t nitems,
+                              void* ptr_this);
+
+  // Libcurl read callback. Copies the next part of |chunk_| directly into
+  // libcurl's send buffer.
+  static size_t ReadCallback(char* buffer, size_t size, size_t nitems,
+                             void* ptr_this);
+
+  HttpUploaderImpl* const ptr_uploader_;
+
+  // Libcurl pointer.
+  CURL* ptr_curl_;
+
+#ifdef WEBMLIVE_HAVE_CURL_MIME
+  // Form built once by |Init|, and the part of it holding the chunk.
+  curl_mime* ptr_mime_;
+  curl_mimepart* ptr_file_part_;
+#else
+  // Libcurl form variable/data chain.
+  curl_httppost* ptr_form_;
+
+  // Pointer to end of libcurl form chain.
+  curl_httppost* ptr_form_end_;
+#endif
+
+  // Uploader settings.
+  HttpUploaderSettings settings_;
+
+  // HTTP header lists owned by the uploader.
+  curl_slist* ptr_headers_;
+  curl_slist* ptr_stream_headers_;
+
+  // |ptr_headers_| plus the Content-Range header of a resumed upload and the
+  // Content-Encoding header of a compressed one. Owned by the transfer, and
+  // freed by |Finish|.
+  curl_slist* ptr_upload_headers_;
+
+  // Chunk being uploaded. The transfer holds a reference to it while libcurl
+  // runs.
+  SharedDataChunk chunk_;
+
+  // Read position within |chunk_|, the offset of |chunk_| the upload
+  // started at, and the bytes left to send.
+  size_t read_span_;
+  int32 read_offset_;
+  int64 resume_offset_;
+  int64 read_remaining_;
+
+  // Response of the last upload; see |response_code()|, |confirmed_bytes()|,
+  // |etag()| and |response_body()|.
+  int response_code_;
+  int64 confirmed_bytes_;
+  std::string etag_;
+  std::string response_body_;
+
+  // Streaming chunk being uploaded, the number of bytes of it sent, and
+  // whether |ReadCallback| paused the transfer to wait for more data.
+  SharedStreamingChunk stream_;
+  int64 stream_offset_;
+  bool paused_;
+
+  // Updated by |ProgressCallback| while holding the uploader's mutex.
+  int64 bytes_sent_current_;
+
+  // Set by |Finish|; see |transfer_bytes()|.
+  int64 transfer_bytes_;
+  int64 transfer_ms_;
+
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(HttpTransfer);
+};
+
+// Upload thread and libcurl multi handle shared by one or more
+// |HttpUploaderImpl|s.
+class HttpUploadEngineImpl {
+ public:
+  HttpUploadEngineImpl();
+  ~HttpUploadEngineImpl();
+
+  // Creates |ptr_multi_| and applies the connection settings to it.
+  int Init(int max_connections, bool enable_http2);
+
+  // Runs and stops |UploadThread|.
+  int Run();
+  void Stop();
+
+  // Adds |ptr_uploader| to the uploaders whose queues |UploadThread| serves.
+  void AddUploader(HttpUploaderImpl* ptr_uploader);
+
+  // Aborts the uploads of |ptr_uploader|, and removes it from |uploaders_|.
+  // Blocks until |UploadThread| no longer uses |ptr_uploader|.
+  void RemoveUploader(HttpUploaderImpl* ptr_uploader);
+
+  // Wakes |UploadThread| to start newly queued uploads.
+  void Wake();
+
+  CURLM* multi() const { return ptr_multi_; }
 
-    // Returned by |Upload| when |WaitForUserData| was notified with an
-    // unlocked |upload_buffer_|, which means |Stop| is waiting for
-    // |UploadThread| to exit.
-    kStopping = 2,
+ private:
+  // Returns true when |UploadThread| has work waiting. |mutex_| must be held.
+  bool WakeRequested() const;
+
+  // Aborts the uploads of the uploaders in |removals_|, and removes them.
+  void ProcessRemovals();
+
+  // Removes completed transfers from |ptr_multi_| and returns them to their
+  // uploaders.
+  void FinishCompletedUploads();
+
+  // Thread function. Runs all transfers on |ptr_multi_|: starts queued
+  // uploads as soon as a transfer is idle, and waits on the sockets of all
+  // running transfers at once.
+  void UploadThread();
+
+  // Libcurl multi handle. Drives every running transfer from |UploadThread|,
+  // and keeps connections to servers open between uploads.
+  CURLM* ptr_multi_;
+
+  // Uploaders served by |UploadThread|, uploaders waiting for
+  // |RemoveUploader|, the stop flag, and whether an uploader has queued an
+  // upload since |UploadThread| last looked. Protected by |mutex_|.
+  // |upload_ready_| wakes |UploadThread|, and |uploader_removed_| wakes
+  // |RemoveUploader| callers.
+  std::mutex mutex_;
+  std::condition_variable upload_ready_;
+  std::condition_variable uploader_removed_;
+  std::vector<HttpUploaderImpl*> uploaders_;
+  std::vector<HttpUploaderImpl*> removals_;
+  bool stop_;
+  bool wake_pending_;
+
+  // True from |Run| until |UploadThread| has aborted the uploads of the
+  // uploaders left when it stopped. Protected by |mutex_|.
+  bool thread_running_;
+
+  std::shared_ptr<std::thread> upload_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(HttpUploadEngineImpl);
+};
+
+class HttpUploaderImpl {
+ public:
+  typedef std::queue<std::string> UrlQueue;
+  enum {
+    // Libcurl reported an unexpected error.
+    kLibCurlError = -401,
+    kSuccess = 0,
   };
 
   HttpUploaderImpl();
   ~HttpUploaderImpl();
 
-  // Returns true when the uploader is ready to start an upload. Always returns
-  // true when no uploads have been attempted.
+  // Returns true when the uploader is ready to accept an upload. Always
+  // returns true when no uploads have been attempted.
   bool UploadComplete() const;
 
-  // Copies user settings and configures libcurl.
-  int Init(const HttpUploaderSettings& settings);
+  // Waits on |upload_done_| for up to |timeout_ms| milliseconds, and returns
+  // the value of |UploadComplete()|.
+  bool WaitForUploadComplete(int32 timeout_ms) const;
+
+  // Waits on |upload_done_| for up to |timeout_ms| milliseconds for
+  // |upload_queue_| to empty and the active uploads to end. Returns the
+  // number of uploads left.
+  int Drain(int32 timeout_ms);
+
+  // Copies user settings, creates |private_engine_| when |ptr_engine| is
+  // NULL, and configures |max_concurrent_uploads| |HttpTransfer|s.
+  int Init(const HttpUploaderSettings& settings,
+           HttpUploadEngineImpl* ptr_engine);
 
   // Locks |mutex_| and copies current stats to |ptr_stats|.
   int GetStats(HttpUploaderStats* ptr_stats);
 
-  // Runs |UploadThread|, and starts waiting for user data.
+  // Adds the uploader to |ptr_engine_|, running |private_engine_| first when
+  // the uploader owns it.
   int Run();
 
   // Uploads user data.
-  int UploadBuffer(const uint8* ptr_buffer, int32 length);
+  int UploadBuffer(const uint8* ptr_buffer, int32 length,
+                   const std::string& id);
+
+  // Queues |chunk| for upload without copying it.
+  int UploadChunk(const SharedDataChunk& chunk, const std::string& id);
 
-  // Stops the uploader.
+  // Queues |chunk| for a streaming upload.
+  int UploadStreamingChunk(const SharedStreamingChunk& chunk,
+                           const std::string& id);
+
+  // Stops the uploader, and aborts its uploads.
   int Stop();
 
-  // Adds |target_url| to |url_queue_|. Each time |UploadBuffer| is called, an
-  // URL is popped off the queue and assigned to |target_url_|
+  // Adds |target_url| to |url_queue_|. Each time an upload is queued, an URL
+  // is popped off the queue and assigned to |target_url_|.
   void EnqueueTargetUrl(const std::string& target_url);
 
+  // Stores |kbps| for |ApplyPacingRate|.
+  void SetPacingRate(int kbps);
+
  private:
-  // Used by |UploadThread|. Returns true if user has called |Stop|.
-  bool StopRequested();
+  friend class HttpTransfer;
+  friend class HttpUploadEngineImpl;
+
+  // Steps of an |HTTP_PUT| upload sent as an S3 multipart upload. Each step
+  // is a |PendingUpload| of its own, queued, retried and dropped like other
+  // uploads.
+  enum MultipartStep {
+    kSingleUpload,
+    kInitiateMultipart,
+    kUploadPart,
+    kCompleteMultipart,
+    kAbortMultipart,
+  };
 
-  // Pass our callbacks, |ProgressCallback| and |WriteCallback|, to libcurl.
-  CURLcode SetCurlCallbacks();
+  // State shared by the steps of one multipart upload: the upload id the
+  // store assigned, the ETag of each part, the parts not yet ended, and
+  // whether a step failed for good. Used only by the upload thread once the
+  // upload is queued.
+  struct MultipartUpload {
+    MultipartUpload() : parts_pending(0), failed(false) {}
+    std::string upload_id;
+    std::vector<std::string> etags;
+    int parts_pending;
+    bool failed;
+  };
 
-  // Pass user HTTP headers to libcurl, and disable HTTP 100 responses.
-  CURLcode SetHeaders();
+  // Upload waiting for a transfer. Exactly one of |chunk| and |stream| is
+  // set. |attempts| counts the retries so far; |deadline_ms| and |retry_ms|
+  // are |NowMilliseconds()| times, 0 when unset, at which the upload is
+  // dropped and may start. |resume_offset| is the offset of |chunk| a resumed
+  // upload starts at. |spooled| marks catch-up uploads read from |spool_|,
+  // and |compressed| manifests |CompressManifest| replaced with gzip data.
+  // |bundle| holds the uploads coalesced into a bundle upload, whose |chunk|
+  // is built from theirs by |BuildBundle|.
+  struct PendingUpload {
+    PendingUpload()
+        : attempts(0), deadline_ms(0), retry_ms(0), resume_offset(0),
+          priority(kVideoPriority), media(true), queued_ms(0),
+          spooled(false), compressed(false), multipart_step(kSingleUpload),
+          part_number(0) {}
+    std::string id;
+    std::string url;
+    SharedDataChunk chunk;
+    SharedStreamingChunk stream;
+    int attempts;
+    int64 deadline_ms;
+    int64 retry_ms;
+    int64 resume_offset;
+
+    // Position in |upload_queue_|; see |UploadPriority|. |media| is false for
+    // manifests and initialization segments, which are never dropped as late.
+    // |queued_ms| is the |NowMilliseconds()| time of |QueueUpload|.
+    int priority;
+    bool media;
+    int64 queued_ms;
+    bool spooled;
+    bool compressed;
+
+    // Multipart upload step, the number, from 1, of the part sent by a
+    // |kUploadPart| step, and the state shared with the other steps. |url|
+    // and |chunk| remain those of the whole object.
+    MultipartStep multipart_step;
+    int part_number;
+    std::shared_ptr<MultipartUpload> multipart;
+
+    std::shared_ptr<std::vector<PendingUpload>> bundle;
+  };
 
-  // Configures libcurl to POST data buffers as file data in a form/multipart
-  // HTTP POST.
-  int SetupFormPost(const uint8* const ptr_buffer, int32 length);
+  // HTTP versions of the per transport upload metrics. |kUnknownTransport|
+  // counts uploads when libcurl cannot tell the version.
+  enum Transport {
+    kHttp1Transport,
+    kHttp2Transport,
+    kHttp3Transport,
+    kUnknownTransport,
+    kNumTransports,
+  };
 
-  // Configures libcurl to POST data buffers as HTTP POST content-data.
-  int SetupPost(const uint8* const ptr_buffer, int32 length);
+  // Upload order of the kinds of chunks, most urgent first.
+  enum UploadPriority {
+    kManifestPriority,
+    kInitPriority,
+    kAudioPriority,
+    kVideoPriority,
+    // Preview thumbnails, sprite sheets and their index.
+    kPreviewPriority,
+  };
 
-  // Upload user data with libcurl.
-  int Upload();
+  // Sets the priority and media flag of |ptr_upload| from chunk |id|.
+  static void ClassifyUpload(const std::string& id, PendingUpload* ptr_upload);
 
-  // Wakes up |UploadThread| when users pass data through |UploadBuffer|.
-  int WaitForUserData();
+  // Inserts |upload| into |upload_queue_| behind the uploads of the same or
+  // higher priority, or, for a |retry|, ahead of the uploads of its own
+  // priority. |mutex_| must be held.
+  void InsertUpload(const PendingUpload& upload, bool retry);
 
-  // Libcurl progress callback function.  Acquires |mutex_| and updates
-  // |stats_|.
-  static int ProgressCallback(void* ptr_this,
-                              double, double,  // we ignore download progress
-                              double upload_total, double upload_current);
+  // Adds |upload| to |upload_queue_| when the queue has room, and assigns
+  // it the URL for chunk |id|.
+  int QueueUpload(const std::string& id, PendingUpload* ptr_upload);
 
-  // Logs HTTP response data received by libcurl.
-  static size_t WriteCallback(char* buffer, size_t size, size_t nitems,
-                              void* ptr_this);
+  // Returns |settings_.url_template| expanded for chunk |id|.
+  std::string ExpandUrlTemplate(const std::string& id) const;
 
-  // Acquires |mutex_|, resets |stats_| and sets |start_ticks_|.
-  void ResetStats();
+  // Returns the Content-Type of the object stored for chunk |id| in
+  // |HTTP_PUT| mode.
+  static const char* ObjectContentType(const std::string& id);
 
-  // Thread function. Wakes when |WaitForUserData| is notified by
-  // |UploadBuffer|, and calls |Upload| to POST user data to the HTTP server
-  // using libcurl.
-  void UploadThread();
+  // Used by the engine's upload thread and the libcurl callbacks. Returns
+  // true if user has called |Stop|.
+  bool StopRequested();
 
-  // Stop flag. Internal callers use |StopRequested| to allow for
-  // synchronization via |mutex_|.  Set by |Stop|, and responded to in
-  // |UploadThread|.
-  bool stop_;
+  // Pass user HTTP headers to libcurl, and disable HTTP 100 responses.
+  int SetHeaders();
 
-  // Upload complete/ready to upload flag.  Initializes to true to allow
-  // users of the uploader to base all Upload calls on |UploadComplete|.
-  bool upload_complete_;
+  // Returns true when |upload_queue_| has room. |mutex_| must be held.
+  bool CanQueueUpload() const;
 
-  // Condition variable used to wake |UploadThread| when a user code passes a
-  // buffer to |UploadBuffer|.
-  std::condition_variable buffer_ready_;
+  // Called by |HttpTransfer::ProgressCallback| with |mutex_| held. Updates
+  // |stats_| from the progress of all transfers.
+  void UpdateStats();
 
-  // Mutex for synchronization of public method calls with |UploadThread|
-  // activity. Mutable so |UploadComplete()| can be a const method.
-  mutable std::mutex mutex_;
+  // Copies the |upload_queue_| length and |active_uploads_| to their
+  // metrics, and their sum to |pending_uploads_|, and reports the bytes of
+  // the queued chunks to |ptr_memory_|. |mutex_| must be held.
+  void UpdateQueueMetrics();
 
-  // Thread object.
-  std::shared_ptr<std::thread> upload_thread_;
+  // Copies the estimate of |uplink_estimator_| to |stats_| and to its
+  // metrics. |mutex_| must be held.
+  void UpdateUplinkStats();
 
-  // Uploader start time.  Reset when via |ResetStatts| when |Init| is called.
-  clock_t start_ticks_;
+  // Removes the oldest queued media segments from |upload_queue_| while the
+  // memory of the stream is at its limit, and appends them to
+  // |ptr_dropped|. Multipart uploads are left alone. |mutex_| must be held.
+  void ShedQueuedUploads(std::vector<PendingUpload>* ptr_dropped);
 
-  // Libcurl pointer.
-  CURL* ptr_curl_;
+  // Acquires |mutex_|, resets |stats_| and sets |start_ticks_|.
+  void ResetStats();
 
-  // Libcurl form variable/data chain.
-  curl_httppost* ptr_form_;
+  // The following methods are called by the engine's upload thread.
+
+  // Moves uploads from |upload_queue_| to idle transfers, and adds the
+  // transfers to the engine's multi handle. Returns the number of uploads
+  // started.
+  int StartQueuedUploads();
+
+  // Returns true when |upload| may be coalesced with others into a bundle.
+  bool Coalescable(const PendingUpload& upload) const;
+
+  // Moves the uploads queued behind |ptr_upload| that are ready at |now|
+  // and may be coalesced with it, if any, to |ptr_upload->bundle|, after a
+  // copy of |ptr_upload|, and clears |ptr_upload->chunk| for |BuildBundle|.
+  // |mutex_| must be held.
+  void CollectBundle(int64 now, PendingUpload* ptr_upload);
+
+  // Compresses the manifests of bundle |ptr_upload|, and sets its |chunk| to
+  // the body carrying its uploads.
+  int BuildBundle(PendingUpload* ptr_upload);
+
+  // Configures |ptr_transfer| for |upload|: the request of its multipart
+  // step, or the POST, PUT or streaming POST of its whole chunk.
+  int StartUpload(HttpTransfer* ptr_transfer, const PendingUpload& upload);
+
+  // Checks the response to multipart step |upload| on |ptr_transfer|, and
+  // records the upload id or part ETag it carries. Returns false when the
+  // store refused the step.
+  bool CheckMultipartResponse(const HttpTransfer* ptr_transfer,
+                              const PendingUpload& upload);
+
+  // Ends |upload|, which |succeeded| or failed for good. Multipart steps
+  // queue the steps that follow them: the parts once the upload is
+  // initiated, and once every part has ended, the completion of the upload,
+  // or its abort when a step failed. Returns true when |upload| counts as a
+  // completed, or failed, upload: always for single uploads, and for
+  // multipart uploads only on completion and on their first failure.
+  bool EndUpload(const PendingUpload& upload, bool succeeded);
+
+  // Ends |upload| through |EndUpload|, or each upload of bundle |upload|.
+  // Failed uploads that count are added to |ptr_failures| and spooled.
+  // Returns the number of uploads that count.
+  int EndUploads(const PendingUpload& upload, bool succeeded,
+                 Metric* ptr_failures);
+
+  // Marks the multipart upload of failed step |upload| failed. Returns true
+  // for single uploads, and for the first failed step of a multipart upload:
+  // the failure of an object is counted and spooled once.
+  static bool ClaimFailure(const PendingUpload& upload);
+
+  // Finishes the upload of |ptr_transfer|, which the engine has removed from
+  // its multi handle, and makes the transfer idle. Failed uploads are queued
+  // again through |PrepareRetry|, or dropped.
+  void FinishUpload(HttpTransfer* ptr_transfer, CURLcode result);
+
+  // Sets the attempt count, start time and resume offset of the retry of
+  // |ptr_upload|, which failed on |ptr_transfer|. Returns false when the
+  // upload is out of retries or would miss its deadline.
+  bool PrepareRetry(const HttpTransfer* ptr_transfer,
+                    PendingUpload* ptr_upload);
+
+  // Returns the time at which the retry waiting at the head of
+  // |upload_queue_|, or else the next catch-up upload, may start, or 0 when
+  // there is none.
+  int64 NextRetryTime() const;
+
+  // Replaces the chunk of manifest upload |ptr_upload| with its gzip
+  // compressed form when |gzip_enabled_|. The upload is sent uncompressed
+  // when compression fails.
+  void CompressManifest(PendingUpload* ptr_upload);
+
+  // Appends the chunk of |upload|, which is being dropped, to |spool_|.
+  void SpoolUpload(const PendingUpload& upload);
+
+  // Starts the upload of the oldest spooled chunk on an idle transfer when
+  // no live upload is queued and the catch-up rate allows. Returns true when
+  // the upload started.
+  bool StartCatchUpUpload();
+
+  // Updates the catch-up state after the catch-up upload finished.
+  void FinishCatchUpUpload(const PendingUpload& upload, bool succeeded);
+
+  // Resumes streaming transfers paused waiting for data that has arrived.
+  void ResumePausedUploads();
+
+  // Sets |pacer_| to |kbps|; 0 disables pacing. Used only by the upload
+  // thread once |Run| is called.
+  void InitPacer(int kbps);
+
+  // Applies the rate stored by |SetPacingRate|, if any, to |pacer_|.
+  void ApplyPacingRate();
+
+  // Removes all running transfers from the engine's multi handle.
+  void AbortUploads();
+
+  // Stop flag. Set by |Stop|, and read by internal callers through
+  // |StopRequested| without taking |mutex_|.
+  std::atomic<bool> stop_;
+
+  // True between |Run| and |Stop|.
+  bool running_;
+
+  // Condition variable notified by the upload thread when an upload
+  // completes. Mutable so |WaitForUploadComplete()| can be a const method.
+  mutable std::condition_variable upload_done_;
+
+  // Mutex for synchronization of public method calls with upload thread
+  // activity. Never held while libcurl runs. Mutable so |UploadComplete()| can
+  // be a const method.
+  mutable std::mutex mutex_;
 
-  // Pointer to end of libcurl form chain.
-  curl_httppost* ptr_form_end_;
+  // Engine running the uploads: |private_engine_|, or one shared with other
+  // uploaders.
+  HttpUploadEngineImpl* ptr_engine_;
+  std::unique_ptr<HttpUploadEngineImpl> private_engine_;
+
+  // All transfers, and those not running an upload. |idle_transfers_| is
+  // used only by the upload thread.
+  std::vector<std::unique_ptr<HttpTransfer>> transfers_;
+  std::vector<HttpTransfer*> idle_transfers_;
+
+  // Uploader start time.  Reset when via |ResetStatts| when |Init| is called.
+  clock_t start_ticks_;
 
-  // Pointer to list of user HTTP headers.
+  // Pointer to list of user HTTP headers. Shared by all transfers.
   curl_slist* ptr_headers_;
 
+  // |ptr_headers_| plus the chunked transfer encoding header. Used by
+  // streaming uploads.
+  curl_slist* ptr_stream_headers_;
+
   // Uploader settings.
   HttpUploaderSettings settings_;
 
-  // Basic stats stored by |ProgressCallback|.
+  // Basic stats stored by |HttpTransfer::ProgressCallback|, and the copy of
+  // them read by |GetStats|. |stats_| is protected by |mutex_|, which also
+  // serializes the stores to |stats_snapshot_|.
   HttpUploaderStats stats_;
-
-  // Simple buffer object that remains locked while libcurl uploads data in
-  // |Upload|.  This second locking mechanism is in place to allow |mutex_| to
-  // be unlocked while uploads are in progress (which prevents public methods
-  // from blocking).
-  LockableBuffer upload_buffer_;
-
-  // The name of the file on the local system.  Note that it is not being read,
-  // it's information included within the form data contained within the HTTP
-  // post.
-  std::string local_file_name_;
+  StatusSnapshot<HttpUploaderStats> stats_snapshot_;
+
+  // Start time and byte count of the current send rate window.
+  int64 rate_window_start_ms_;
+  int64 rate_window_start_bytes_;
+
+  // Pacing rate limit shared by the transfers. Used only by the upload
+  // thread.
+  TokenBucket pacer_;
+
+  // Estimate of the uplink, reported in |stats_|. Protected by |mutex_|.
+  UplinkEstimator uplink_estimator_;
+
+  // Uploads waiting for a transfer, by priority and then oldest first.
+  // Retries go ahead of the uploads of their priority to keep uploads in
+  // order.
+  std::deque<PendingUpload> upload_queue_;
+
+  // Uploads being performed by each busy transfer, kept for retries, and
+  // the source of retry delay jitter. Used only by the upload thread.
+  std::map<HttpTransfer*, PendingUpload> running_uploads_;
+  std::minstd_rand retry_random_;
+
+  // Number of uploads being performed by transfers, not counting the
+  // catch-up upload. Protected by |mutex_|.
+  int active_uploads_;
+
+  // Length of |upload_queue_| plus |active_uploads_|, kept by
+  // |UpdateQueueMetrics| for |UploadComplete|, which reads it without taking
+  // |mutex_|.
+  std::atomic<int> pending_uploads_;
+
+  // Pacing rate stored by |SetPacingRate| and not yet applied, or -1.
+  std::atomic<int> requested_pacing_kbps_;
+
+  // Chunks waiting for a catch-up upload, enabled by
+  // |settings_.spool_directory|. |next_catch_up_ms_| is the |NowMilliseconds()|
+  // time at which the next catch-up upload may start, and |catch_up_running_|
+  // is true while one runs. Used only by the upload thread once |Run| is
+  // called.
+  UploadSpool spool_;
+  bool spool_enabled_;
+  bool catch_up_running_;
+  int64 next_catch_up_ms_;
+
+  // Manifest compression, enabled by |settings_.gzip_manifests|. The deflate
+  // stream and output buffer are reused for every manifest. Used only by the
+  // upload thread once |Run| is called.
+  GzipCompressor gzip_;
+  std::vector<uint8> gzip_buffer_;
+  bool gzip_enabled_;
 
   // Last URL read from |url_queue_|. Used repeatedly once |url_queue_| is
   // empty.
@@ -187,9 +888,86 @@ class HttpUploaderImpl {
   // Queue of target URLs.
   UrlQueue url_queue_;
 
+  // Metrics exported through |MetricsRegistry|. Set by |Init|.
+  Metric* ptr_queued_uploads_;
+  Metric* ptr_active_uploads_;
+  Metric* ptr_upload_failures_;
+  Metric* ptr_upload_retries_;
+  Metric* ptr_late_drops_;
+  Metric* ptr_memory_drops_;
+  Metric* ptr_spooled_uploads_;
+  Metric* ptr_catch_up_uploads_;
+  Metric* ptr_spool_bytes_;
+  Metric* ptr_gzip_saved_bytes_;
+  Metric* ptr_bundles_;
+  Metric* ptr_bundled_uploads_;
+  Metric* ptr_bytes_uploaded_;
+  Metric* ptr_bytes_per_second_;
+  Metric* ptr_new_connections_;
+  Metric* ptr_connect_ms_;
+  Metric* ptr_tls_ms_;
+  Metric* ptr_uplink_kbps_;
+  Metric* ptr_uplink_low_kbps_;
+  Metric* ptr_uplink_queue_growth_kbps_;
+
+  // Bytes of the chunks in |upload_queue_|. Set by |Init|.
+  MemoryAccount* ptr_memory_;
+
+  // Stream id passed to the tracepoints. Set by |Init|.
+  int32 trace_stream_id_;
+
+  // Successful uploads and their total time in milliseconds, by the HTTP
+  // version they used; see |Transport|.
+  Metric* ptr_transport_uploads_[kNumTransports];
+  Metric* ptr_transport_upload_ms_[kNumTransports];
+
+  // Set once an HTTP/3 upload fails to connect with a libcurl that does not
+  // fall back by itself: transfers use HTTP/2 from then on. Used only by the
+  // upload thread.
+  bool http3_fallback_;
+
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(HttpUploaderImpl);
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// HttpUploadEngine
+//
+
+HttpUploadEngine::HttpUploadEngine() {
+}
+
+HttpUploadEngine::~HttpUploadEngine() {
+}
+
+int HttpUploadEngine::Init(int max_connections, bool enable_http2) {
+  if (max_connections < 1) {
+    LOG(ERROR) << "invalid engine connection limit: " << max_connections;
+    return kInvalidArg;
+  }
+  ptr_engine_.reset(new (std::nothrow) HttpUploadEngineImpl());  // NOLINT
+  if (!ptr_engine_) {
+    LOG(ERROR) << "can't construct HttpUploadEngineImpl.";
+    return kInitFailed;
+  }
+  if (ptr_engine_->Init(max_connections, enable_http2)) {
+    LOG(ERROR) << "upload engine init failed.";
+    return kInitFailed;
+  }
+  return kSuccess;
+}
+
+int HttpUploadEngine::Run() {
+  if (ptr_engine_->Run()) {
+    return kRunFailed;
+  }
+  return kSuccess;
+}
+
+int HttpUploadEngine::Stop() {
+  ptr_engine_->Stop();
+  return kSuccess;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // HttpUploader
 //
@@ -205,14 +983,34 @@ bool HttpUploader::UploadComplete() const {
   return ptr_uploader_->UploadComplete();
 }
 
+// Return result of |WaitForUploadComplete| on |ptr_uploader_|.
+bool HttpUploader::WaitForUploadComplete(int32 timeout_ms) const {
+  return ptr_uploader_->WaitForUploadComplete(timeout_ms);
+}
+
+// Return result of |Drain| on |ptr_uploader_|.
+int HttpUploader::Drain(int32 timeout_ms) {
+  return ptr_uploader_->Drain(timeout_ms);
+}
+
 // Copy user settings, and setup the internal uploader object.
 int HttpUploader::Init(const HttpUploaderSettings& settings) {
+  return Init(settings, NULL);
+}
+
+int HttpUploader::Init(const HttpUploaderSettings& settings,
+                       HttpUploadEngine* ptr_engine) {
+  if (ptr_engine && !ptr_engine->ptr_engine_) {
+    LOG(ERROR) << "uploader cannot use an engine that is not initialized.";
+    return kInvalidArg;
+  }
   ptr_uploader_.reset(new (std::nothrow) HttpUploaderImpl());  // NOLINT
   if (!ptr_uploader_) {
     LOG(ERROR) << "can't construct HttpUploaderImpl.";
     return kInitFailed;
   }
-  int status = ptr_uploader_->Init(settings);
+  int status = ptr_uploader_->Init(
+      settings, ptr_engine ? ptr_engine->ptr_engine_.get() : NULL);
   if (status) {
     LOG(ERROR) << "uploader init failed. " << status;
     return kInitFailed;
@@ -236,201 +1034,586 @@ int HttpUploader::Stop() {
 }
 
 // Return result of |UploadBuffer| on |ptr_uploader_|.
-int HttpUploader::UploadBuffer(const uint8* ptr_buffer, int32 length) {
-  return ptr_uploader_->UploadBuffer(ptr_buffer, length);
+int HttpUploader::UploadBuffer(const uint8* ptr_buffer, int32 length,
+                               const std::string& id) {
+  return ptr_uploader_->UploadBuffer(ptr_buffer, length, id);
+}
+
+// Return result of |UploadChunk| on |ptr_uploader_|.
+int HttpUploader::UploadChunk(const SharedDataChunk& chunk,
+                              const std::string& id) {
+  return ptr_uploader_->UploadChunk(chunk, id);
+}
+
+// Return result of |UploadStreamingChunk| on |ptr_uploader_|.
+int HttpUploader::UploadStreamingChunk(const SharedStreamingChunk& chunk,
+                                       const std::string& id) {
+  return ptr_uploader_->UploadStreamingChunk(chunk, id);
 }
 
 void HttpUploader::EnqueueTargetUrl(const std::string& target_url) {
   ptr_uploader_->EnqueueTargetUrl(target_url);
 }
 
+void HttpUploader::SetPacingRate(int kbps) {
+  ptr_uploader_->SetPacingRate(kbps);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
-// HttpUploaderImpl
+// HttpShare
 //
 
-HttpUploaderImpl::HttpUploaderImpl()
-    : ptr_curl_(NULL),
+HttpShare& HttpShare::Instance() {
+  static HttpShare share;
+  return share;
+}
+
+HttpShare::HttpShare() : ptr_share_(curl_share_init()) {
+  if (!ptr_share_) {
+    LOG(ERROR) << "curl_share_init failed, uploads will not share DNS and "
+               << "TLS session caches.";
+    return;
+  }
+  CURLSHcode err = curl_share_setopt(ptr_share_, CURLSHOPT_LOCKFUNC, Lock);
+  if (err == CURLSHE_OK) {
+    err = curl_share_setopt(ptr_share_, CURLSHOPT_UNLOCKFUNC, Unlock);
+  }
+  if (err == CURLSHE_OK) {
+    err = curl_share_setopt(ptr_share_, CURLSHOPT_USERDATA,
+                            reinterpret_cast<void*>(this));
+  }
+  if (err == CURLSHE_OK) {
+    err = curl_share_setopt(ptr_share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  }
+  if (err == CURLSHE_OK) {
+    err = curl_share_setopt(ptr_share_, CURLSHOPT_SHARE,
+                            CURL_LOCK_DATA_SSL_SESSION);
+  }
+  if (err != CURLSHE_OK) {
+    LOG(ERROR) << "curl_share_setopt failed, err=" << err << ":"
+               << curl_share_strerror(err);
+    curl_share_cleanup(ptr_share_);
+    ptr_share_ = NULL;
+  }
+}
+
+HttpShare::~HttpShare() {
+  if (ptr_share_) {
+    curl_share_cleanup(ptr_share_);
+    ptr_share_ = NULL;
+  }
+}
+
+void HttpShare::Lock(CURL* ptr_curl, curl_lock_data data,
+                     curl_lock_access access, void* ptr_this) {
+  ptr_curl;
+  access;
+  reinterpret_cast<HttpShare*>(ptr_this)->mutexes_[data].lock();
+}
+
+void HttpShare::Unlock(CURL* ptr_curl, curl_lock_data data, void* ptr_this) {
+  ptr_curl;
+  reinterpret_cast<HttpShare*>(ptr_this)->mutexes_[data].unlock();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// HttpTransfer
+//
+
+HttpTransfer::HttpTransfer(HttpUploaderImpl* ptr_uploader)
+    : ptr_uploader_(ptr_uploader),
+      ptr_curl_(NULL),
+#ifdef WEBMLIVE_HAVE_CURL_MIME
+      ptr_mime_(NULL),
+      ptr_file_part_(NULL),
+#else
       ptr_form_(NULL),
       ptr_form_end_(NULL),
+#endif
       ptr_headers_(NULL),
-      stop_(false),
-      upload_complete_(true) {
+      ptr_stream_headers_(NULL),
+      ptr_upload_headers_(NULL),
+      read_span_(0),
+      read_offset_(0),
+      resume_offset_(0),
+      read_remaining_(0),
+      response_code_(0),
+      confirmed_bytes_(0),
+      stream_offset_(0),
+      paused_(false),
+      bytes_sent_current_(0),
+      transfer_bytes_(0),
+      transfer_ms_(-1) {
 }
 
-HttpUploaderImpl::~HttpUploaderImpl() {
+HttpTransfer::~HttpTransfer() {
   if (ptr_curl_) {
     curl_easy_cleanup(ptr_curl_);
     ptr_curl_ = NULL;
   }
+#ifdef WEBMLIVE_HAVE_CURL_MIME
+  if (ptr_mime_) {
+    curl_mime_free(ptr_mime_);
+    ptr_mime_ = NULL;
+    ptr_file_part_ = NULL;
+  }
+#else
   if (ptr_form_) {
     curl_formfree(ptr_form_);
     ptr_form_ = NULL;
     ptr_form_end_ = NULL;
   }
-  if (ptr_headers_) {
-    curl_slist_free_all(ptr_headers_);
-    ptr_headers_ = NULL;
-  }
-}
-
-// Obtain lock on |mutex_| and return value of |upload_complete_|.
-bool HttpUploaderImpl::UploadComplete() const {
-  bool complete = false;
-  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
-  if (lock.owns_lock()) {
-    complete = upload_complete_;
+#endif
+  if (ptr_upload_headers_) {
+    curl_slist_free_all(ptr_upload_headers_);
+    ptr_upload_headers_ = NULL;
   }
-  return complete;
 }
 
-// Initializes the upload:
+// Initializes the transfer:
 // - copies user settings
-// - sets basic libcurl settings (progress and write callbacks)
-// - calls SetHeaders to pass user headers to libcurl
-int HttpUploaderImpl::Init(const HttpUploaderSettings& settings) {
-  // copy user settings
+// - sets basic libcurl settings (progress, write and read callbacks)
+// - passes the uploader's HTTP headers to libcurl
+int HttpTransfer::Init(const HttpUploaderSettings& settings,
+                       curl_slist* ptr_headers,
+                       curl_slist* ptr_stream_headers) {
   settings_ = settings;
+  ptr_headers_ = ptr_headers;
+  ptr_stream_headers_ = ptr_stream_headers;
 
   // Init libcurl.
   ptr_curl_ = curl_easy_init();
   if (!ptr_curl_) {
     LOG(ERROR) << "curl_easy_init failed!";
-    return kLibCurlError;
+    return HttpUploaderImpl::kLibCurlError;
   }
 
   // Enable progress reports from libcurl.
-  CURLcode curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_NOPROGRESS, FALSE);
+  CURLcode curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_NOPROGRESS, 0L);
   if (curl_ret != CURLE_OK) {
     LOG_CURL_ERR(curl_ret, "curl progress enable failed.");
-    return kLibCurlError;
+    return HttpUploaderImpl::kLibCurlError;
   }
 
   // Set callbacks.
   curl_ret = SetCurlCallbacks();
   if (curl_ret != CURLE_OK) {
     LOG_CURL_ERR(curl_ret, "curl callback setup failed.");
-    return kLibCurlError;
+    return HttpUploaderImpl::kLibCurlError;
   }
 
-  // Disable HTTP 100 responses, and set user HTTP headers.
-  curl_ret = SetHeaders();
-  if (curl_ret) {
-    LOG_CURL_ERR(curl_ret, "unable to set headers.");
+  curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_HTTPHEADER, ptr_headers_);
+  if (curl_ret != CURLE_OK) {
+    LOG_CURL_ERR(curl_ret, "setopt CURLOPT_HTTPHEADER failed.");
     return HttpUploader::kHeaderError;
   }
 
-  local_file_name_ = settings_.local_file;
-  ResetStats();
-  return kSuccess;
-}
-
-// Obtain lock on |mutex_| and copy current stats values from |stats_| to
-// |ptr_stats|.
-int HttpUploaderImpl::GetStats(HttpUploaderStats* ptr_stats) {
-  if (!ptr_stats) {
-    LOG(ERROR) << "NULL ptr_stats";
-    return HttpUploader::kInvalidArg;
+#ifdef WEBMLIVE_HAVE_CURL_HTTP3
+  if (settings_.enable_http3) {
+    // QUIC avoids the head of line blocking of TCP on lossy links. libcurl
+    // 7.88 and later fall back to HTTP/2 and HTTP/1.1 when the server does
+    // not accept HTTP/3.
+    curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_HTTP_VERSION,
+                                CURL_HTTP_VERSION_3);
+    if (curl_ret != CURLE_OK) {
+      LOG_CURL_ERR(curl_ret, "HTTP/3 unavailable, using HTTP/2.");
+      settings_.enable_http3 = false;
+    }
   }
-  std::lock_guard<std::mutex> lock(mutex_);
-  ptr_stats->bytes_per_second = stats_.bytes_per_second;
-  ptr_stats->bytes_sent_current = stats_.bytes_sent_current;
-  ptr_stats->total_bytes_uploaded = stats_.total_bytes_uploaded;
-  return kSuccess;
-}
-
-// Run |UploadThread| using |boost::thread|.
-int HttpUploaderImpl::Run() {
-  assert(!upload_thread_);
-  using std::bind;
-  using std::shared_ptr;
-  using std::thread;
-  using std::nothrow;
-  upload_thread_ = shared_ptr<thread>(
-      new (nothrow) thread(bind(&HttpUploaderImpl::UploadThread,  // NOLINT
-                                this)));
-  return kSuccess;
-}
-
-// Try to obtain lock on |mutex_|, and upload the user buffer stored in
-// |upload_buffer_| if the buffer is unlocked.  If the lock is obtained and the
-// buffer is unlocked, |UploadBuffer| locks the buffer and notifies the upload
-// thread through call to |notify_one| on the |buffer_ready_| condition
-// variable.
-int HttpUploaderImpl::UploadBuffer(const uint8* ptr_buf, int32 length) {
-  int status = HttpUploader::kUploadInProgress;
-  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
-  if (lock.owns_lock() && !upload_buffer_.IsLocked()) {
-    if (!url_queue_.empty()) {
-      target_url_ = url_queue_.front();
+#endif
+  if (settings_.enable_http2 && !settings_.enable_http3) {
+    // libcurl negotiates HTTP/2, and uses HTTP/1.1 when the server refuses.
+    curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_HTTP_VERSION,
+                                CURL_HTTP_VERSION_2_0);
+    if (curl_ret != CURLE_OK) {
+      LOG_CURL_ERR(curl_ret, "HTTP/2 unavailable, using HTTP/1.1.");
     }
-    if (target_url_.empty()) {
-      LOG(ERROR) << "No target URL!";
-      return HttpUploader::kUrlConfigError;
+  }
+  if (settings_.enable_http2) {
+#ifdef CURLPIPE_MULTIPLEX
+    // Wait for the shared connection instead of opening another one.
+    curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_PIPEWAIT, 1L);
+    if (curl_ret != CURLE_OK) {
+      LOG_CURL_ERR(curl_ret, "setopt CURLOPT_PIPEWAIT failed.");
     }
+#endif
+  }
 
-    // Lock obtained; (re)initialize |upload_buffer_| with the user data...
-    status = upload_buffer_.Init(ptr_buf, length);
-    if (status) {
-      LOG(ERROR) << "upload_buffer_ Init failed, status=" << status;
-      return status;
+  // Keep idle connections alive between segments, and reuse DNS lookups and
+  // TLS sessions across all transfers in the process.
+  curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_TCP_KEEPALIVE, 1L);
+  if (curl_ret == CURLE_OK) {
+    curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_TCP_KEEPIDLE,
+                                kKeepAliveIdleSecs);
+  }
+  if (curl_ret == CURLE_OK) {
+    curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_TCP_KEEPINTVL,
+                                kKeepAliveIntervalSecs);
+  }
+  if (curl_ret != CURLE_OK) {
+    LOG_CURL_ERR(curl_ret, "TCP keep-alive unavailable.");
+  }
+  curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_DNS_CACHE_TIMEOUT,
+                              kDnsCacheTimeoutSecs);
+  if (curl_ret != CURLE_OK) {
+    LOG_CURL_ERR(curl_ret, "setopt CURLOPT_DNS_CACHE_TIMEOUT failed.");
+  }
+  curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_SSL_SESSIONID_CACHE, 1L);
+  if (curl_ret != CURLE_OK) {
+    LOG_CURL_ERR(curl_ret, "setopt CURLOPT_SSL_SESSIONID_CACHE failed.");
+  }
+  CURLSH* const ptr_share = HttpShare::Instance().handle();
+  if (ptr_share) {
+    curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_SHARE, ptr_share);
+    if (curl_ret != CURLE_OK) {
+      LOG_CURL_ERR(curl_ret, "setopt CURLOPT_SHARE failed.");
     }
+  }
 
-    // Lock |upload_buffer_|; it's unlocked by |UploadThread| once libcurl
-    // finishes its run.
-    status = upload_buffer_.Lock();
-    if (status) {
-      LOG(ERROR) << "upload_buffer_ Lock failed, status=" << status;
-      return status;
+#ifdef WEBMLIVE_HAVE_CURL_AWS_SIGV4
+  if (!settings_.aws_sigv4.empty()) {
+    // libcurl signs every request, the headers set later included.
+    curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_AWS_SIGV4,
+                                settings_.aws_sigv4.c_str());
+    if (curl_ret == CURLE_OK) {
+      curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_USERPWD,
+                                  settings_.aws_credentials.c_str());
+    }
+    if (curl_ret != CURLE_OK) {
+      LOG_CURL_ERR(curl_ret, "cannot enable AWS SigV4 signing.");
+      return HttpUploader::kHeaderError;
+    }
+  }
+#endif
+
+#ifdef WEBMLIVE_HAVE_CURL_MIME
+  if (settings_.post_mode == webmlive::HTTP_FORM_POST && BuildMimeForm()) {
+    LOG(ERROR) << "BuildMimeForm failed!";
+    return HttpUploader::kFormError;
+  }
+#endif
+
+  // Allows |HttpUploaderImpl| to map completed easy handles to transfers.
+  curl_ret = curl_easy_setopt(ptr_curl_, CURLOPT_PRIVATE,
+                              reinterpret_cast<void*>(this));
+  if (curl_ret != CURLE_OK) {
+    LOG_CURL_ERR(curl_ret, "setopt CURLOPT_PRIVATE failed.");
+    return HttpUploaderImpl::kLibCurlError;
+  }
+  return HttpUploaderImpl::kSuccess;
+}
+
+// Prepare the handle for an upload of |chunk|, starting at |resume_offset|.
+int HttpTransfer::Start(const std::string& url,
+                        const SharedDataChunk& chunk,
+                        int64 resume_offset, bool gzip,
+                        const char* content_type_header) {
+  chunk_ = chunk;
+  resume_offset_ = resume_offset;
+  read_remaining_ = chunk_->length() - resume_offset_;
+  response_code_ = 0;
+  confirmed_bytes_ = 0;
+  etag_.clear();
+  response_body_.clear();
+
+  // Skip the spans the server already holds.
+  SeekChunk(resume_offset_);
+
+  LOG(INFO) << "upload buffer size=" << chunk_->length()
+            << " offset=" << resume_offset_;
+  CURLcode err = curl_easy_setopt(ptr_curl_, CURLOPT_URL, url.c_str());
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "could not pass URL to curl.");
+    chunk_.reset();
+    return HttpUploader::kUrlConfigError;
+  }
+  std::vector<std::string> extra_headers;
+  if (resume_offset_ > 0) {
+    std::ostringstream range_header;
+    range_header << "Content-Range: bytes " << resume_offset_ << "-"
+                 << chunk_->length() - 1 << "/" << chunk_->length();
+    extra_headers.push_back(range_header.str());
+  }
+  if (gzip) {
+    extra_headers.push_back(kGzipEncodingHeader);
+  }
+  if (content_type_header) {
+    extra_headers.push_back(content_type_header);
+  }
+  if (SetUploadHeaders(extra_headers)) {
+    chunk_.reset();
+    return HttpUploader::kHeaderError;
+  }
+
+  if (settings_.post_mode == webmlive::HTTP_FORM_POST) {
+    if (SetupFormPost()) {
+      LOG(ERROR) << "SetupFormPost failed!";
+      chunk_.reset();
+      return HttpUploader::kRunFailed;
     }
-    upload_complete_ = false;
+  } else {
+    if (SetupPost()) {
+      LOG(ERROR) << "SetupPost failed!";
+      chunk_.reset();
+      return HttpUploader::kRunFailed;
+    }
+  }
+  return HttpUploaderImpl::kSuccess;
+}
+
+// Prepare the handle for a chunked transfer encoding upload of |stream|.
+int HttpTransfer::StartStreaming(const std::string& url,
+                                 const SharedStreamingChunk& stream) {
+  stream_ = stream;
+  stream_offset_ = 0;
+  paused_ = false;
+  response_code_ = 0;
+  confirmed_bytes_ = 0;
+  etag_.clear();
+  response_body_.clear();
+
+  LOG(INFO) << "starting streaming upload.";
+  CURLcode err = curl_easy_setopt(ptr_curl_, CURLOPT_URL, url.c_str());
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "could not pass URL to curl.");
+    stream_.reset();
+    return HttpUploader::kUrlConfigError;
+  }
+  err = curl_easy_setopt(ptr_curl_, CURLOPT_HTTPHEADER, ptr_stream_headers_);
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "setopt CURLOPT_HTTPHEADER failed.");
+    stream_.reset();
+    return HttpUploader::kHeaderError;
+  }
+  if (SetupPost()) {
+    LOG(ERROR) << "SetupPost failed!";
+    stream_.reset();
+    return HttpUploader::kRunFailed;
+  }
+  return HttpUploaderImpl::kSuccess;
+}
+
+// Prepare the handle for |request|. The body, when there is one, is read
+// from |chunk| in place like the chunks of other uploads.
+int HttpTransfer::StartObjectRequest(const std::string& url,
+                                     ObjectRequest request,
+                                     const SharedDataChunk& chunk,
+                                     int64 begin, int64 end,
+                                     const char* content_type, bool gzip) {
+  chunk_ = chunk;
+  resume_offset_ = begin;
+  read_remaining_ = end - begin;
+  response_code_ = 0;
+  confirmed_bytes_ = 0;
+  etag_.clear();
+  response_body_.clear();
+  SeekChunk(begin);
+
+  LOG(INFO) << "object request " << request << " size=" << read_remaining_
+            << " offset=" << begin;
+  CURLcode err = curl_easy_setopt(ptr_curl_, CURLOPT_URL, url.c_str());
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "could not pass URL to curl.");
+    chunk_.reset();
+    return HttpUploader::kUrlConfigError;
+  }
+  std::vector<std::string> extra_headers;
+  if (content_type) {
+    extra_headers.push_back(std::string("Content-Type: ") + content_type);
+  }
+  if (gzip) {
+    extra_headers.push_back(kGzipEncodingHeader);
+  }
+  if (SetUploadHeaders(extra_headers)) {
+    chunk_.reset();
+    return HttpUploader::kHeaderError;
+  }
+  if (SetupObjectRequest(request)) {
+    LOG(ERROR) << "SetupObjectRequest failed!";
+    chunk_.reset();
+    return HttpUploader::kRunFailed;
+  }
+  return HttpUploaderImpl::kSuccess;
+}
+
+bool HttpTransfer::ReadyToResume() {
+  if (!paused_ || (stream_ && !stream_->Readable(stream_offset_))) {
+    return false;
+  }
+  TokenBucket& pacer = ptr_uploader_->pacer_;
+  if (pacer.enabled() && pacer.Available() < kMinPacedReadBytes) {
+    return false;
+  }
+  paused_ = false;
+  return true;
+}
+
+int HttpTransfer::Finish(CURLcode result) {
+  int status = HttpUploaderImpl::kSuccess;
+  long resp_code = 0;  // NOLINT
+  curl_easy_getinfo(ptr_curl_, CURLINFO_RESPONSE_CODE, &resp_code);
+  response_code_ = static_cast<int>(resp_code);
+  transfer_ms_ = -1;
+  if (result != CURLE_OK) {
+    LOG_CURL_ERR(result, "upload failed.");
+    status = HttpUploader::kRunFailed;
+  } else {
+    LOG(INFO) << "server response code: " << response_code_;
+    RecordTransportTime();
+  }
+  RecordConnectionTimes();
+
+  // Update total bytes uploaded.
+  double bytes_uploaded = 0;
+  CURLcode err =
+      curl_easy_getinfo(ptr_curl_, CURLINFO_SIZE_UPLOAD, &bytes_uploaded);
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "curl_easy_getinfo CURLINFO_SIZE_UPLOAD failed.");
+  } else {
+    transfer_bytes_ = static_cast<int64>(bytes_uploaded);
+    std::lock_guard<std::mutex> lock(ptr_uploader_->mutex_);
+    bytes_sent_current_ = 0;
+    ptr_uploader_->stats_.total_bytes_uploaded +=
+        static_cast<int64>(bytes_uploaded);
+    ptr_uploader_->ptr_bytes_uploaded_->Increment(
+        static_cast<int64>(bytes_uploaded));
+    ptr_uploader_->UpdateStats();
+  }
 
-    // Wake |UploadThread|.
-    LOG(INFO) << "waking uploader with " << length << " bytes";
-    buffer_ready_.notify_one();
+  chunk_.reset();
+  stream_.reset();
+  paused_ = false;
+  if (ptr_upload_headers_) {
+    curl_slist_free_all(ptr_upload_headers_);
+    ptr_upload_headers_ = NULL;
   }
   return status;
 }
 
-// Stops |UploadThread|. First it wakes the thread by calling |notify_one| on
-// the |buffer_ready_| condition variable without locking |upload_buffer_|,
-// which causes |Upload| to return |kStopping| to |UploadThread|, breaking the
-// loop. This takes care of stopping if the uploader was waiting for user data
-// in |WaitForUserData|.
-// It then obtains lock on |mutex_|, sets |stop_| to true, and releases lock to
-// ensure a running upload stops when |StopRequested| is called within the
-// libcurl callbacks.
-int HttpUploaderImpl::Stop() {
-  assert(upload_thread_);
-  if (UploadComplete()) {
-    // Wake up the upload thread
-    buffer_ready_.notify_one();
-  }
-  mutex_.lock();
-  stop_ = true;
-  mutex_.unlock();
-  upload_thread_->join();
-  return kSuccess;
+// Times reported by libcurl are seconds since the transfer started, and 0
+// for the steps skipped by reusing a connection.
+void HttpTransfer::RecordConnectionTimes() {
+  long num_connects = 0;  // NOLINT
+  double lookup_secs = 0;
+  double connect_secs = 0;
+  double tls_secs = 0;
+  curl_easy_getinfo(ptr_curl_, CURLINFO_NUM_CONNECTS, &num_connects);
+  curl_easy_getinfo(ptr_curl_, CURLINFO_NAMELOOKUP_TIME, &lookup_secs);
+  curl_easy_getinfo(ptr_curl_, CURLINFO_CONNECT_TIME, &connect_secs);
+  curl_easy_getinfo(ptr_curl_, CURLINFO_APPCONNECT_TIME, &tls_secs);
+  if (num_connects == 0) {
+    VLOG(1) << "upload reused a connection.";
+    return;
+  }
+  const int64 connect_ms = static_cast<int64>(connect_secs * 1000);
+  // The TLS handshake follows the TCP connect.
+  const int64 tls_ms =
+      tls_secs > 0 ? static_cast<int64>((tls_secs - connect_secs) * 1000) : 0;
+  VLOG(1) << "upload opened " << num_connects << " connection(s), dns="
+          << static_cast<int64>(lookup_secs * 1000) << "ms connect="
+          << connect_ms << "ms tls=" << tls_ms << "ms";
+  ptr_uploader_->ptr_new_connections_->Increment(num_connects);
+  ptr_uploader_->ptr_connect_ms_->Set(connect_ms);
+  if (tls_secs > 0) {
+    ptr_uploader_->ptr_tls_ms_->Set(tls_ms);
+  }
 }
 
-void HttpUploaderImpl::EnqueueTargetUrl(const std::string& target_url) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  url_queue_.push(target_url);
+void HttpTransfer::RecordTransportTime() {
+  double total_secs = 0;
+  curl_easy_getinfo(ptr_curl_, CURLINFO_TOTAL_TIME, &total_secs);
+  HttpUploaderImpl::Transport transport = HttpUploaderImpl::kUnknownTransport;
+#ifdef WEBMLIVE_HAVE_CURLINFO_HTTP_VERSION
+  long http_version = 0;  // NOLINT
+  curl_easy_getinfo(ptr_curl_, CURLINFO_HTTP_VERSION, &http_version);
+  switch (http_version) {
+    case CURL_HTTP_VERSION_1_0:
+    case CURL_HTTP_VERSION_1_1:
+      transport = HttpUploaderImpl::kHttp1Transport;
+      break;
+    case CURL_HTTP_VERSION_2_0:
+      transport = HttpUploaderImpl::kHttp2Transport;
+      break;
+#ifdef WEBMLIVE_HAVE_CURL_HTTP3
+    case CURL_HTTP_VERSION_3:
+      transport = HttpUploaderImpl::kHttp3Transport;
+      break;
+#endif
+    default:
+      break;
+  }
+#endif
+  const int64 total_ms = static_cast<int64>(total_secs * 1000);
+  VLOG(1) << "upload took " << total_ms << "ms, transport " << transport;
+  if (!stream_) {
+    transfer_ms_ = total_ms;
+  }
+  ptr_uploader_->ptr_transport_uploads_[transport]->Increment(1);
+  ptr_uploader_->ptr_transport_upload_ms_[transport]->Increment(total_ms);
 }
 
-// Try to obtain lock on |mutex_|, and return the value of |stop_| if lock is
-// obtained.  Returns false if unable to obtain the lock.
-bool HttpUploaderImpl::StopRequested() {
-  bool stop_requested = false;
-  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
-  if (lock.owns_lock()) {
-    stop_requested = stop_;
+void HttpTransfer::DisableHttp3() {
+  if (!settings_.enable_http3) {
+    return;
+  }
+  settings_.enable_http3 = false;
+  const CURLcode err = curl_easy_setopt(ptr_curl_, CURLOPT_HTTP_VERSION,
+                                        settings_.enable_http2 ?
+                                        CURL_HTTP_VERSION_2_0 :
+                                        CURL_HTTP_VERSION_1_1);
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "setopt CURLOPT_HTTP_VERSION failed.");
+  }
+}
+
+void HttpTransfer::SeekChunk(int64 offset) {
+  read_span_ = 0;
+  read_offset_ = 0;
+  if (!chunk_) {
+    return;
+  }
+  const std::vector<DataChunk::Span>& spans = chunk_->spans();
+  while (read_span_ < spans.size() && offset >= spans[read_span_].length) {
+    offset -= spans[read_span_].length;
+    ++read_span_;
+  }
+  read_offset_ = static_cast<int32>(offset);
+}
+
+// Uploads without headers of their own share the uploader's list.
+int HttpTransfer::SetUploadHeaders(
+    const std::vector<std::string>& extra_headers) {
+  curl_slist* ptr_headers = ptr_headers_;
+  if (!extra_headers.empty()) {
+    for (curl_slist* ptr_header = ptr_headers_; ptr_header;
+         ptr_header = ptr_header->next) {
+      if (!HeaderReplaced(ptr_header->data, extra_headers)) {
+        ptr_upload_headers_ =
+            curl_slist_append(ptr_upload_headers_, ptr_header->data);
+      }
+    }
+    for (size_t i = 0; i < extra_headers.size(); ++i) {
+      ptr_upload_headers_ =
+          curl_slist_append(ptr_upload_headers_, extra_headers[i].c_str());
+    }
+    if (!ptr_upload_headers_) {
+      LOG(ERROR) << "curl_slist_append failed.";
+      return HttpUploader::kHeaderError;
+    }
+    ptr_headers = ptr_upload_headers_;
+  }
+  const CURLcode err =
+      curl_easy_setopt(ptr_curl_, CURLOPT_HTTPHEADER, ptr_headers);
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "setopt CURLOPT_HTTPHEADER failed.");
+    return HttpUploader::kHeaderError;
   }
-  return stop_requested;
+  return HttpUploaderImpl::kSuccess;
 }
 
-// Pass callback function pointers (|ProgressCallback| and |WriteCallback|),
-// and data, |this|, to libcurl.
-CURLcode HttpUploaderImpl::SetCurlCallbacks() {
+// Pass callback function pointers (|ProgressCallback|, |WriteCallback| and
+// |ReadCallback|), and data, |this|, to libcurl.
+CURLcode HttpTransfer::SetCurlCallbacks() {
   // set the progress callback function pointer
   CURLcode err = curl_easy_setopt(ptr_curl_, CURLOPT_PROGRESSFUNCTION,
                                   ProgressCallback);
@@ -445,6 +1628,19 @@ CURLcode HttpUploaderImpl::SetCurlCallbacks() {
     LOG_CURL_ERR(err, "curl progress callback data setup failed.");
     return err;
   }
+  // set header callback function pointer
+  err = curl_easy_setopt(ptr_curl_, CURLOPT_HEADERFUNCTION, HeaderCallback);
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "curl header callback setup failed.");
+    return err;
+  }
+  // set header callback data pointer
+  err = curl_easy_setopt(ptr_curl_, CURLOPT_HEADERDATA,
+                         reinterpret_cast<void*>(this));
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "curl header callback data setup failed.");
+    return err;
+  }
   // set write callback function pointer
   err = curl_easy_setopt(ptr_curl_, CURLOPT_WRITEFUNCTION, WriteCallback);
   if (err != CURLE_OK) {
@@ -458,38 +1654,93 @@ CURLcode HttpUploaderImpl::SetCurlCallbacks() {
     LOG_CURL_ERR(err, "curl write callback data setup failed.");
     return err;
   }
+  // set read callback function pointer
+  err = curl_easy_setopt(ptr_curl_, CURLOPT_READFUNCTION, ReadCallback);
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "curl read callback setup failed.");
+    return err;
+  }
+  // set read callback data pointer
+  err = curl_easy_setopt(ptr_curl_, CURLOPT_READDATA,
+                         reinterpret_cast<void*>(this));
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "curl read callback data setup failed.");
+    return err;
+  }
   return err;
 }
 
-// Disable HTTP 100 responses (send empty Expect header), and pass user HTTP
-// headers into lib curl.
-CURLcode HttpUploaderImpl::SetHeaders() {
-  // Tell libcurl to omit "Expect: 100-continue" from requests
-  ptr_headers_ = curl_slist_append(ptr_headers_, kExpectHeader);
-  if (settings_.post_mode == webmlive::HTTP_POST) {
-    // In form posts the video/webm mime-type is included in the form itself,
-    // but in plain old HTTP posts the Content-Type must be video/webm.
-    ptr_headers_ = curl_slist_append(ptr_headers_, kContentTypeHeader);
+#ifdef WEBMLIVE_HAVE_CURL_MIME
+// Copies the user form variables into the form once; uploads only update the
+// size and reader of |ptr_file_part_|.
+int HttpTransfer::BuildMimeForm() {
+  ptr_mime_ = curl_mime_init(ptr_curl_);
+  if (!ptr_mime_) {
+    LOG(ERROR) << "curl_mime_init failed.";
+    return HttpUploader::kFormError;
   }
   typedef std::map<std::string, std::string> StringMap;
-  StringMap::const_iterator header_iter = settings_.headers.begin();
-  // add user headers
-  for (; header_iter != settings_.headers.end(); ++header_iter) {
-    std::ostringstream header;
-    header << header_iter->first.c_str() << ":" << header_iter->second.c_str();
-    ptr_headers_ = curl_slist_append(ptr_headers_, header.str().c_str());
+  StringMap::const_iterator var_iter = settings_.form_variables.begin();
+  CURLcode err = CURLE_OK;
+  // add user form variables
+  for (; var_iter != settings_.form_variables.end(); ++var_iter) {
+    curl_mimepart* const ptr_part = curl_mime_addpart(ptr_mime_);
+    if (!ptr_part) {
+      LOG(ERROR) << "curl_mime_addpart failed.";
+      return HttpUploader::kFormError;
+    }
+    err = curl_mime_name(ptr_part, var_iter->first.c_str());
+    if (err == CURLE_OK) {
+      err = curl_mime_data(ptr_part, var_iter->second.c_str(),
+                           CURL_ZERO_TERMINATED);
+    }
+    if (err != CURLE_OK) {
+      LOG_CURL_ERR(err, "cannot add form variable.");
+      return HttpUploader::kFormError;
+    }
+  }
+  // add the part holding the chunk
+  ptr_file_part_ = curl_mime_addpart(ptr_mime_);
+  if (!ptr_file_part_) {
+    LOG(ERROR) << "curl_mime_addpart failed.";
+    return HttpUploader::kFormError;
+  }
+  err = curl_mime_name(ptr_file_part_, kFormName);
+  if (err == CURLE_OK) {
+    err = curl_mime_filename(ptr_file_part_, settings_.local_file.c_str());
+  }
+  if (err == CURLE_OK) {
+    err = curl_mime_type(ptr_file_part_, kWebmMimeType);
   }
-  CURLcode err = curl_easy_setopt(ptr_curl_, CURLOPT_HTTPHEADER, ptr_headers_);
   if (err != CURLE_OK) {
-    LOG_CURL_ERR(err, "setopt CURLOPT_HTTPHEADER failed err=");
+    LOG_CURL_ERR(err, "cannot add form file part.");
+    return HttpUploader::kFormError;
   }
-  return err;
+  return HttpUploaderImpl::kSuccess;
 }
 
+// Points the file part of |ptr_mime_| at |chunk_|; libcurl reads the chunk
+// through |ReadCallback| without copying it.
+int HttpTransfer::SetupFormPost() {
+  CURLcode err = curl_mime_data_cb(ptr_file_part_, chunk_->length(),
+                                   ReadCallback, NULL, NULL,
+                                   reinterpret_cast<void*>(this));
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "curl_mime_data_cb failed.");
+    return err;
+  }
+  err = curl_easy_setopt(ptr_curl_, CURLOPT_MIMEPOST, ptr_mime_);
+  if (err != CURLE_OK) {
+    LOG_CURL_ERR(err, "setopt CURLOPT_MIMEPOST failed.");
+    return err;
+  }
+  return HttpUploaderImpl::kSuccess;
+}
+#else
 // Sets necessary curl options for form based file upload, and adds the user
-// form variables.
-int HttpUploaderImpl::SetupFormPost(const uint8* const ptr_buffer,
-                                    int32 length) {
+// form variables. Form variables point at |settings_| instead of being copied
+// into the form.
+int HttpTransfer::SetupFormPost() {
   if (ptr_form_) {
     curl_formfree(ptr_form_);
     ptr_form_ = NULL;
@@ -501,20 +1752,21 @@ int HttpUploaderImpl::SetupFormPost(const uint8* const ptr_buffer,
   // add user form variables
   for (; var_iter != settings_.form_variables.end(); ++var_iter) {
     err = curl_formadd(&ptr_form_, &ptr_form_end_,
-                       CURLFORM_COPYNAME, var_iter->first.c_str(),
-                       CURLFORM_COPYCONTENTS, var_iter->second.c_str(),
+                       CURLFORM_PTRNAME, var_iter->first.c_str(),
+                       CURLFORM_PTRCONTENTS, var_iter->second.c_str(),
                        CURLFORM_END);
     if (err != CURL_FORMADD_OK) {
       LOG_CURLFORM_ERR(err, "curl_formadd failed.");
       return HttpUploader::kFormError;
     }
   }
-  // add buffer to form
+  // add chunk to form; libcurl reads it through |ReadCallback|
   err = curl_formadd(&ptr_form_, &ptr_form_end_,
-                     CURLFORM_COPYNAME, kFormName,
-                     CURLFORM_BUFFER, local_file_name_.c_str(),
-                     CURLFORM_BUFFERPTR, ptr_buffer,
-                     CURLFORM_BUFFERLENGTH, length,
+                     CURLFORM_PTRNAME, kFormName,
+                     CURLFORM_FILENAME, settings_.local_file.c_str(),
+                     CURLFORM_STREAM, reinterpret_cast<void*>(this),
+                     CURLFORM_CONTENTSLENGTH,
+                     static_cast<long>(chunk_->length()),  // NOLINT
                      CURLFORM_CONTENTTYPE, kWebmMimeType,
                      CURLFORM_END);
   if (err != CURL_FORMADD_OK) {
@@ -528,186 +1780,1979 @@ int HttpUploaderImpl::SetupFormPost(const uint8* const ptr_buffer,
     LOG_CURL_ERR(err_setopt, "setopt CURLOPT_HTTPPOST failed.");
     return err_setopt;
   }
-  return kSuccess;
+  return HttpUploaderImpl::kSuccess;
 }
+#endif
 
-// Configures libcurl to POST data buffers as HTTP POST content-data.
-int HttpUploaderImpl::SetupPost(const uint8* const ptr_buffer, int32 length) {
-  CURLcode err_setopt = curl_easy_setopt(ptr_curl_, CURLOPT_POST, ptr_form_);
+// Configures libcurl to POST |chunk_| or |stream_| as HTTP POST content-data.
+int HttpTransfer::SetupPost() {
+  CURLcode err_setopt = curl_easy_setopt(ptr_curl_, CURLOPT_POST, 1L);
   if (err_setopt != CURLE_OK) {
     LOG_CURL_ERR(err_setopt, "setopt CURLOPT_HTTPPOST failed.");
     return err_setopt;
   }
-  // Pass |ptr_buffer| to libcurl; it's used in the call to |curl_easy_perform|
-  err_setopt = curl_easy_setopt(ptr_curl_, CURLOPT_POSTFIELDS, ptr_buffer);
+  // Clear CURLOPT_POSTFIELDS; libcurl reads the data through |ReadCallback|
+  // while the upload runs.
+  err_setopt = curl_easy_setopt(ptr_curl_, CURLOPT_POSTFIELDS, NULL);
   if (err_setopt != CURLE_OK) {
     LOG_CURL_ERR(err_setopt, "setopt CURLOPT_POSTFIELDS failed.");
     return err_setopt;
   }
-  // Tell libcurl the size of |ptr_buffer|.  If libcurl is not informed of the
-  // size before the call to |curl_easy_perform|, it will use strlen to
-  // determine the length of the data.
-  err_setopt = curl_easy_setopt(ptr_curl_, CURLOPT_POSTFIELDSIZE, length);
+  // Tell libcurl the size of |chunk_| left to send. The size of |stream_| is
+  // unknown (-1), which makes libcurl use chunked transfer encoding.
+  const curl_off_t post_size =
+      stream_ ? -1 : chunk_->length() - resume_offset_;
+  err_setopt = curl_easy_setopt(ptr_curl_, CURLOPT_POSTFIELDSIZE_LARGE,
+                                post_size);
   if (err_setopt != CURLE_OK) {
     LOG_CURL_ERR(err_setopt, "setopt CURLOPT_POSTFIELDSIZE failed.");
     return err_setopt;
   }
-  return kSuccess;
+  return HttpUploaderImpl::kSuccess;
 }
 
-// Upload data using libcurl.
-int HttpUploaderImpl::Upload() {
-  if (!upload_buffer_.IsLocked()) {
-    LOG(INFO) << "woke with unlocked buffer, stopping.";
-    return kStopping;
+// Transfers are reused for every kind of request: the method of the last one
+// is reset first.
+int HttpTransfer::SetupObjectRequest(ObjectRequest request) {
+  CURLcode err = curl_easy_setopt(ptr_curl_, CURLOPT_CUSTOMREQUEST, NULL);
+  if (err == CURLE_OK) {
+    err = curl_easy_setopt(ptr_curl_, CURLOPT_UPLOAD, 0L);
   }
-
-  uint8* ptr_data = NULL;
-  int32 length = 0;
-  int status = upload_buffer_.GetBuffer(&ptr_data, &length);
-  if (status) {
-    LOG(ERROR) << "error, could not get buffer pointer, status=" << status;
-    return HttpUploader::kRunFailed;
-  }
-
-  LOG(INFO) << "upload buffer size=" << length;
-  CURLcode err = curl_easy_setopt(ptr_curl_, CURLOPT_URL,
-                                  target_url_.c_str());
-  if (err != CURLE_OK) {
-    LOG_CURL_ERR(err, "could not pass URL to curl.");
-    return HttpUploader::kUrlConfigError;
-  }
-
-  if (settings_.post_mode == webmlive::HTTP_FORM_POST) {
-    if (SetupFormPost(ptr_data, length)) {
-      LOG(ERROR) << "SetupFormPost failed!";
-      return HttpUploader::kRunFailed;
+  const curl_off_t body_size = read_remaining_;
+  if (err == CURLE_OK && request == kPutObject) {
+    err = curl_easy_setopt(ptr_curl_, CURLOPT_UPLOAD, 1L);
+    if (err == CURLE_OK) {
+      err = curl_easy_setopt(ptr_curl_, CURLOPT_INFILESIZE_LARGE, body_size);
     }
-  } else {
-    if (SetupPost(ptr_data, length)) {
-      LOG(ERROR) << "SetupPost failed!";
-      return HttpUploader::kRunFailed;
+  } else if (err == CURLE_OK && request == kPostObject) {
+    err = curl_easy_setopt(ptr_curl_, CURLOPT_POST, 1L);
+    if (err == CURLE_OK) {
+      err = curl_easy_setopt(ptr_curl_, CURLOPT_POSTFIELDS, NULL);
     }
-  }
-
-  err = curl_easy_perform(ptr_curl_);
-  if (err != CURLE_OK) {
-    LOG_CURL_ERR(err, "curl_easy_perform failed.");
-  } else {
-    int resp_code = 0;
-    curl_easy_getinfo(ptr_curl_, CURLINFO_RESPONSE_CODE, &resp_code);
-    LOG(INFO) << "server response code: " << resp_code;
-
-    // Upload was successful, pop the target url off of the queue.
-    if (!url_queue_.empty()) {
-      url_queue_.pop();
+    if (err == CURLE_OK) {
+      err = curl_easy_setopt(ptr_curl_, CURLOPT_POSTFIELDSIZE_LARGE,
+                             body_size);
+    }
+  } else if (err == CURLE_OK) {
+    err = curl_easy_setopt(ptr_curl_, CURLOPT_HTTPGET, 1L);
+    if (err == CURLE_OK) {
+      err = curl_easy_setopt(ptr_curl_, CURLOPT_CUSTOMREQUEST, "DELETE");
     }
   }
-
-  // Update total bytes uploaded.
-  double bytes_uploaded = 0;
-  err = curl_easy_getinfo(ptr_curl_, CURLINFO_SIZE_UPLOAD, &bytes_uploaded);
   if (err != CURLE_OK) {
-    LOG_CURL_ERR(err, "curl_easy_getinfo CURLINFO_SIZE_UPLOAD failed.");
-  } else {
-    std::lock_guard<std::mutex> lock(mutex_);
-    stats_.bytes_sent_current = 0;
-    stats_.total_bytes_uploaded += static_cast<int64>(bytes_uploaded);
+    LOG_CURL_ERR(err, "cannot set object request method.");
+    return err;
   }
-
-  return kSuccess;
-}
-
-// Idle the upload thread while awaiting user data.
-int HttpUploaderImpl::WaitForUserData() {
-  std::unique_lock<std::mutex> lock(mutex_);
-  buffer_ready_.wait(lock);  // Unlock |mutex_| and idle the thread while we
-                             // wait for the next chunk of user data.
-  return kSuccess;
+  return HttpUploaderImpl::kSuccess;
 }
 
 // Handle libcurl progress updates.
-int HttpUploaderImpl::ProgressCallback(void* ptr_this,
-                                       double download_total,
-                                       double download_current,
-                                       double upload_total,
-                                       double upload_current) {
+int HttpTransfer::ProgressCallback(void* ptr_this,
+                                   double download_total,
+                                   double download_current,
+                                   double upload_total,
+                                   double upload_current) {
   // Ignore the download progress variables.
   download_total;
   download_current;
-  HttpUploaderImpl* ptr_uploader_ =
-    reinterpret_cast<HttpUploaderImpl*>(ptr_this);
+  HttpTransfer* ptr_transfer = reinterpret_cast<HttpTransfer*>(ptr_this);
+  HttpUploaderImpl* ptr_uploader_ = ptr_transfer->ptr_uploader_;
   if (ptr_uploader_->StopRequested()) {
     LOG(ERROR) << "stop requested.";
     return kProgressCallbackStopRequest;
   }
   std::lock_guard<std::mutex> lock(ptr_uploader_->mutex_);
-  HttpUploaderStats& stats = ptr_uploader_->stats_;
-  stats.bytes_sent_current = static_cast<int64>(upload_current);
-  double ticks_elapsed = clock() - ptr_uploader_->start_ticks_;
-  double ticks_per_sec = CLOCKS_PER_SEC;
-  stats.bytes_per_second =
-      (upload_current + stats.total_bytes_uploaded) /
-      (ticks_elapsed / ticks_per_sec);
+  ptr_transfer->bytes_sent_current_ = static_cast<int64>(upload_current);
+  ptr_uploader_->UpdateStats();
   VLOG(4) << "total=" << static_cast<int>(upload_total) << " bytes_per_sec="
-          << static_cast<int>(stats.bytes_per_second);
+          << static_cast<int>(ptr_uploader_->stats_.bytes_per_second);
   return 0;
 }
 
+// Parse "Range: bytes=0-<last>" headers, which servers accepting partial
+// uploads send to report the bytes they hold, and ETag headers, which object
+// stores send to identify the parts of multipart uploads.
+size_t HttpTransfer::HeaderCallback(char* buffer, size_t size,
+                                    size_t nitems,
+                                    void* ptr_this) {
+  HttpTransfer* ptr_transfer = reinterpret_cast<HttpTransfer*>(ptr_this);
+  const std::string header(buffer, size * nitems);
+  const size_t etag_length = strlen(kEtagHeader);
+  if (header.size() > etag_length) {
+    std::string name = header.substr(0, etag_length);
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    if (name == kEtagHeader) {
+      const size_t begin = header.find_first_not_of(" \t", etag_length);
+      const size_t end = header.find_last_not_of(" \t\r\n");
+      if (begin != std::string::npos && end >= begin) {
+        ptr_transfer->etag_ = header.substr(begin, end - begin + 1);
+      }
+      return size * nitems;
+    }
+  }
+  const size_t name_length = strlen(kRangeHeader);
+  if (header.size() > name_length) {
+    std::string name = header.substr(0, name_length);
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    const size_t bytes_pos = header.find(kRangeBytesPrefix);
+    const size_t dash_pos = header.find('-', bytes_pos);
+    if (name == kRangeHeader && bytes_pos != std::string::npos &&
+        dash_pos != std::string::npos) {
+      const int64 last_byte = strtoll(header.c_str() + dash_pos + 1, NULL, 10);
+      ptr_transfer->confirmed_bytes_ = last_byte + 1;
+      VLOG(1) << "server holds " << ptr_transfer->confirmed_bytes_
+              << " bytes.";
+    }
+  }
+  return size * nitems;
+}
+
 // Handle HTTP response data.
-size_t HttpUploaderImpl::WriteCallback(char* buffer, size_t size,
-                                       size_t nitems,
-                                       void* ptr_this) {
+size_t HttpTransfer::WriteCallback(char* buffer, size_t size,
+                                   size_t nitems,
+                                   void* ptr_this) {
   VLOG(4) << "size=" << size << " nitems=" << nitems;
   // TODO(tomfinegan): store response data for users
   std::string tmp;
   tmp.assign(buffer, size*nitems);
   LOG(INFO) << "from server:\n" << tmp.c_str();
-  HttpUploaderImpl* ptr_uploader_ =
-    reinterpret_cast<HttpUploaderImpl*>(ptr_this);
-  if (ptr_uploader_->StopRequested()) {
+  HttpTransfer* ptr_transfer = reinterpret_cast<HttpTransfer*>(ptr_this);
+  std::string& body = ptr_transfer->response_body_;
+  body.append(tmp, 0, kMaxResponseBodyBytes - std::min(body.size(),
+                                                      kMaxResponseBodyBytes));
+  if (ptr_transfer->ptr_uploader_->StopRequested()) {
     LOG(INFO) << "stop requested.";
     return kWriteCallbackStopRequest;
   }
   return size*nitems;
 }
 
-// Reset uploaded byte count, and store upload start time.
-void HttpUploaderImpl::ResetStats() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  stats_.bytes_per_second = 0;
-  stats_.bytes_sent_current = 0;
-  stats_.total_bytes_uploaded = 0;
-  start_ticks_ = clock();
+// Feed |chunk_| to libcurl one span at a time, no faster than the uploader's
+// pacing rate.
+size_t HttpTransfer::ReadCallback(char* buffer, size_t size,
+                                  size_t nitems,
+                                  void* ptr_this) {
+  HttpTransfer* ptr_transfer = reinterpret_cast<HttpTransfer*>(ptr_this);
+  HttpUploaderImpl* const ptr_uploader = ptr_transfer->ptr_uploader_;
+  if (ptr_uploader->StopRequested()) {
+    LOG(INFO) << "stop requested.";
+    return CURL_READFUNC_ABORT;
+  }
+  // Chunk uploads end after |read_remaining_| bytes, which may stop short
+  // of the end of the chunk.
+  int64 wanted = static_cast<int64>(size * nitems);
+  if (!ptr_transfer->stream_) {
+    wanted = std::min(wanted, ptr_transfer->read_remaining_);
+    if (wanted <= 0) {
+      return 0;
+    }
+  }
+  // Send no more than the pacing tokens allow, and pause when there are
+  // none; |UploadThread| resumes the transfer once tokens accrue.
+  const size_t capacity =
+      static_cast<size_t>(ptr_uploader->pacer_.Take(wanted));
+  if (capacity == 0) {
+    ptr_transfer->paused_ = true;
+    return CURL_READFUNC_PAUSE;
+  }
+  if (ptr_transfer->stream_) {
+    // Send what the muxer has written so far, and pause the transfer when
+    // caught up; |UploadThread| resumes it once more data arrives.
+    int32 bytes_read = 0;
+    const int status =
+        ptr_transfer->stream_->Read(ptr_transfer->stream_offset_,
+                                    static_cast<int32>(capacity),
+                                    reinterpret_cast<uint8*>(buffer),
+                                    &bytes_read);
+    ptr_uploader->pacer_.Refund(
+        static_cast<int64>(capacity) -
+        (status == StreamingChunk::kSuccess ? bytes_read : 0));
+    if (status == StreamingChunk::kSuccess) {
+      ptr_transfer->stream_offset_ += bytes_read;
+      return bytes_read;
+    } else if (status == StreamingChunk::kEndOfChunk) {
+      return 0;
+    } else if (status == StreamingChunk::kNoData) {
+      ptr_transfer->paused_ = true;
+      return CURL_READFUNC_PAUSE;
+    }
+    return CURL_READFUNC_ABORT;
+  }
+  if (!ptr_transfer->chunk_) {
+    return CURL_READFUNC_ABORT;
+  }
+  const std::vector<DataChunk::Span>& spans = ptr_transfer->chunk_->spans();
+  size_t bytes_copied = 0;
+  while (bytes_copied < capacity && ptr_transfer->read_span_ < spans.size()) {
+    const DataChunk::Span& span = spans[ptr_transfer->read_span_];
+    const size_t available = span.length - ptr_transfer->read_offset_;
+    const size_t copy_length = std::min(available, capacity - bytes_copied);
+    memcpy(buffer + bytes_copied, span.ptr_data + ptr_transfer->read_offset_,
+           copy_length);
+    bytes_copied += copy_length;
+    ptr_transfer->read_offset_ += static_cast<int32>(copy_length);
+    if (ptr_transfer->read_offset_ == span.length) {
+      ++ptr_transfer->read_span_;
+      ptr_transfer->read_offset_ = 0;
+    }
+  }
+  ptr_uploader->pacer_.Refund(static_cast<int64>(capacity - bytes_copied));
+  ptr_transfer->read_remaining_ -= static_cast<int64>(bytes_copied);
+  return bytes_copied;
 }
 
-// Upload thread.  Wakes when user provides a buffer via call to
-// |UploadBuffer|.
-void HttpUploaderImpl::UploadThread() {
-  LOG(INFO) << "upload thread running...";
-  while (!StopRequested()) {
-    LOG(INFO) << "upload thread waiting for buffer...";
-    WaitForUserData();
-    LOG(INFO) << "uploading buffer...";
-    int status = Upload();
-    if (status == kStopping) {
-      break;
+///////////////////////////////////////////////////////////////////////////////
+// HttpUploaderImpl
+//
+
+HttpUploaderImpl::HttpUploaderImpl()
+    : stop_(false),
+      running_(false),
+      ptr_engine_(NULL),
+      ptr_headers_(NULL),
+      ptr_stream_headers_(NULL),
+      rate_window_start_ms_(0),
+      rate_window_start_bytes_(0),
+      active_uploads_(0),
+      pending_uploads_(0),
+      requested_pacing_kbps_(-1),
+      spool_enabled_(false),
+      catch_up_running_(false),
+      next_catch_up_ms_(0),
+      gzip_enabled_(false),
+      ptr_queued_uploads_(NULL),
+      ptr_active_uploads_(NULL),
+      ptr_upload_failures_(NULL),
+      ptr_upload_retries_(NULL),
+      ptr_late_drops_(NULL),
+      ptr_memory_drops_(NULL),
+      ptr_spooled_uploads_(NULL),
+      ptr_catch_up_uploads_(NULL),
+      ptr_spool_bytes_(NULL),
+      ptr_gzip_saved_bytes_(NULL),
+      ptr_bundles_(NULL),
+      ptr_bundled_uploads_(NULL),
+      ptr_bytes_uploaded_(NULL),
+      ptr_bytes_per_second_(NULL),
+      ptr_new_connections_(NULL),
+      ptr_connect_ms_(NULL),
+      ptr_tls_ms_(NULL),
+      ptr_uplink_kbps_(NULL),
+      ptr_uplink_low_kbps_(NULL),
+      ptr_uplink_queue_growth_kbps_(NULL),
+      ptr_memory_(NULL),
+      trace_stream_id_(0),
+      http3_fallback_(false) {
+  for (int i = 0; i < kNumTransports; ++i) {
+    ptr_transport_uploads_[i] = NULL;
+    ptr_transport_upload_ms_[i] = NULL;
+  }
+}
+
+HttpUploaderImpl::~HttpUploaderImpl() {
+  // Transfers reference |ptr_headers_|: free them first. Transfers are never
+  // attached to the engine's multi handle once |Stop| returns, and must be
+  // freed before |private_engine_| frees the handle.
+  idle_transfers_.clear();
+  transfers_.clear();
+  private_engine_.reset();
+  if (ptr_headers_) {
+    curl_slist_free_all(ptr_headers_);
+    ptr_headers_ = NULL;
+  }
+  if (ptr_stream_headers_) {
+    curl_slist_free_all(ptr_stream_headers_);
+    ptr_stream_headers_ = NULL;
+  }
+}
+
+// Return true when |upload_queue_| has room.
+bool HttpUploaderImpl::UploadComplete() const {
+  return pending_uploads_.load() < settings_.max_pending_uploads;
+}
+
+// Obtain lock on |mutex_| and wait for the upload thread to make room in
+// |upload_queue_|.
+bool HttpUploaderImpl::WaitForUploadComplete(int32 timeout_ms) const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  upload_done_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                        [this] { return CanQueueUpload(); });
+  return CanQueueUpload();
+}
+
+// Obtain lock on |mutex_| and wait for the upload thread to finish every
+// upload.
+int HttpUploaderImpl::Drain(int32 timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  upload_done_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] {
+    return upload_queue_.empty() && active_uploads_ == 0;
+  });
+  return static_cast<int>(upload_queue_.size()) + active_uploads_;
+}
+
+// Initializes the uploader:
+// - copies user settings
+// - creates a private engine when none is shared
+// - calls SetHeaders to build the user header list
+// - constructs and initializes |max_concurrent_uploads| transfers
+int HttpUploaderImpl::Init(const HttpUploaderSettings& settings,
+                           HttpUploadEngineImpl* ptr_engine) {
+  // copy user settings
+  settings_ = settings;
+  if (settings_.max_concurrent_uploads < 1 ||
+      settings_.max_pending_uploads < settings_.max_concurrent_uploads) {
+    LOG(ERROR) << "invalid upload limits, concurrent="
+               << settings_.max_concurrent_uploads
+               << " pending=" << settings_.max_pending_uploads;
+    return HttpUploader::kInvalidArg;
+  }
+  if (settings_.max_upload_retries < 0 || settings_.retry_min_delay_ms < 0 ||
+      settings_.retry_max_delay_ms < settings_.retry_min_delay_ms ||
+      settings_.chunk_deadline_ms < 0) {
+    LOG(ERROR) << "invalid upload retry settings, retries="
+               << settings_.max_upload_retries
+               << " min_delay=" << settings_.retry_min_delay_ms
+               << " max_delay=" << settings_.retry_max_delay_ms
+               << " deadline=" << settings_.chunk_deadline_ms;
+    return HttpUploader::kInvalidArg;
+  }
+  if (settings_.live_window_ms < 0) {
+    LOG(ERROR) << "invalid live window: " << settings_.live_window_ms;
+    return HttpUploader::kInvalidArg;
+  }
+  if (settings_.pacing_kbps < 0) {
+    LOG(ERROR) << "invalid pacing rate: " << settings_.pacing_kbps;
+    return HttpUploader::kInvalidArg;
+  }
+  if (settings_.post_mode == webmlive::HTTP_PUT) {
+    if (settings_.url_template.empty()) {
+      LOG(ERROR) << "HTTP_PUT mode needs an URL template naming each object.";
+      return HttpUploader::kInvalidArg;
     }
-    if (status) {
-      LOG(ERROR) << "buffer upload failed, status=" << status;
-      // TODO(tomfinegan): Report upload failure, and provide access to
-      //                   response code and data.
-    } else {
-      std::lock_guard<std::mutex> lock(mutex_);
-      LOG(INFO) << "unlocking upload buffer...";
-      status = upload_buffer_.Unlock();
-      if (status) {
-        LOG(ERROR) << "unable to unlock buffer, status=" << status;
-        // keep spinning, for now...
-      }
-      upload_complete_ = true;
+    const int64 min_part_bytes = HttpUploaderSettings::kMinMultipartPartBytes;
+    if (settings_.multipart_threshold_bytes > 0 &&
+        settings_.multipart_part_bytes < min_part_bytes) {
+      LOG(ERROR) << "multipart upload parts must be at least "
+                 << min_part_bytes << " bytes, not "
+                 << settings_.multipart_part_bytes;
+      return HttpUploader::kInvalidArg;
+    }
+  }
+  if (!settings_.aws_sigv4.empty()) {
+#ifdef WEBMLIVE_HAVE_CURL_AWS_SIGV4
+    if (settings_.aws_credentials.find(':') == std::string::npos) {
+      LOG(ERROR) << "AWS credentials must be <access key id>:<secret key>.";
+      return HttpUploader::kInvalidArg;
     }
+#else
+    LOG(ERROR) << "libcurl built without AWS SigV4 support, 7.86 needed.";
+    return HttpUploader::kInitFailed;
+#endif
+  }
+  if (settings_.catch_up_kbps < 0) {
+    LOG(ERROR) << "invalid catch-up rate: " << settings_.catch_up_kbps;
+    return HttpUploader::kInvalidArg;
+  }
+  if (settings_.coalesce_max_bytes < 0 ||
+      (settings_.coalesce_max_bytes > 0 &&
+       (settings_.post_mode != webmlive::HTTP_POST ||
+        settings_.url_template.empty() ||
+        settings_.coalesce_max_objects < 2))) {
+    LOG(ERROR) << "upload coalescing needs HTTP_POST mode, an URL template "
+               << "and at least 2 objects, max_bytes="
+               << settings_.coalesce_max_bytes
+               << " max_objects=" << settings_.coalesce_max_objects;
+    return HttpUploader::kInvalidArg;
+  }
+  if (settings_.pacing_kbps > 0) {
+    InitPacer(settings_.pacing_kbps);
+  }
+  retry_random_.seed(static_cast<std::minstd_rand::result_type>(
+      std::random_device()()));
+
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  ptr_queued_uploads_ = registry.GetGauge(
+      "webmlive_upload_queue_depth", settings_.metrics_labels,
+      "Uploads waiting for a transfer.");
+  ptr_active_uploads_ = registry.GetGauge(
+      "webmlive_uploads_active", settings_.metrics_labels,
+      "Uploads being performed by transfers.");
+  ptr_upload_failures_ = registry.GetCounter(
+      "webmlive_upload_failures_total", settings_.metrics_labels,
+      "Uploads dropped after failing, missing their deadline, or being "
+      "aborted.");
+  ptr_upload_retries_ = registry.GetCounter(
+      "webmlive_upload_retries_total", settings_.metrics_labels,
+      "Failed uploads queued again for another attempt.");
+  ptr_late_drops_ = registry.GetCounter(
+      "webmlive_upload_late_drops_total", settings_.metrics_labels,
+      "Media segments dropped for falling out of the live window.");
+  ptr_memory_drops_ = registry.GetCounter(
+      "webmlive_upload_memory_drops_total", settings_.metrics_labels,
+      "Queued media segments dropped at the memory limit of the stream.");
+  ptr_spooled_uploads_ = registry.GetCounter(
+      "webmlive_upload_spooled_total", settings_.metrics_labels,
+      "Dropped uploads written to the spool for a catch-up upload.");
+  ptr_catch_up_uploads_ = registry.GetCounter(
+      "webmlive_upload_catch_up_total", settings_.metrics_labels,
+      "Spooled chunks uploaded by the catch-up upload.");
+  ptr_spool_bytes_ = registry.GetGauge(
+      "webmlive_upload_spool_bytes", settings_.metrics_labels,
+      "Size of the spool files.");
+  ptr_gzip_saved_bytes_ = registry.GetCounter(
+      "webmlive_upload_gzip_saved_bytes_total", settings_.metrics_labels,
+      "Manifest bytes not sent thanks to gzip compression.");
+  ptr_bundles_ = registry.GetCounter(
+      "webmlive_upload_bundles_total", settings_.metrics_labels,
+      "Requests carrying coalesced chunks.");
+  ptr_bundled_uploads_ = registry.GetCounter(
+      "webmlive_upload_bundled_chunks_total", settings_.metrics_labels,
+      "Chunks sent in bundles instead of requests of their own.");
+  ptr_bytes_uploaded_ = registry.GetCounter(
+      "webmlive_uploaded_bytes_total", settings_.metrics_labels,
+      "Bytes sent by completed uploads.");
+  ptr_bytes_per_second_ = registry.GetGauge(
+      "webmlive_upload_bytes_per_second", settings_.metrics_labels,
+      "Average upload rate since the uploader started.");
+  ptr_new_connections_ = registry.GetCounter(
+      "webmlive_upload_connections_total", settings_.metrics_labels,
+      "Connections opened by uploads; uploads reusing a connection open "
+      "none.");
+  ptr_connect_ms_ = registry.GetGauge(
+      "webmlive_upload_connect_milliseconds", settings_.metrics_labels,
+      "DNS and TCP connect time of the last upload opening a connection.");
+  ptr_tls_ms_ = registry.GetGauge(
+      "webmlive_upload_tls_milliseconds", settings_.metrics_labels,
+      "TLS handshake time of the last upload opening an HTTPS connection.");
+  ptr_uplink_kbps_ = registry.GetGauge(
+      "webmlive_uplink_capacity_kbps", settings_.metrics_labels,
+      "Moving average of the throughput of completed uploads.");
+  ptr_uplink_low_kbps_ = registry.GetGauge(
+      "webmlive_uplink_low_capacity_kbps", settings_.metrics_labels,
+      "Low percentile of the throughput of recent uploads.");
+  ptr_uplink_queue_growth_kbps_ = registry.GetGauge(
+      "webmlive_uplink_queue_growth_kbps", settings_.metrics_labels,
+      "Moving average of the growth of the upload queue; negative while it "
+      "drains.");
+  if (!ptr_queued_uploads_ || !ptr_active_uploads_ ||
+      !ptr_upload_failures_ || !ptr_upload_retries_ || !ptr_late_drops_ ||
+      !ptr_memory_drops_ || !ptr_spooled_uploads_ || !ptr_catch_up_uploads_ || !ptr_spool_bytes_ ||
+      !ptr_gzip_saved_bytes_ || !ptr_bundles_ || !ptr_bundled_uploads_ ||
+      !ptr_bytes_uploaded_ ||
+      !ptr_bytes_per_second_ || !ptr_new_connections_ || !ptr_connect_ms_ ||
+      !ptr_tls_ms_ || !ptr_uplink_kbps_ || !ptr_uplink_low_kbps_ ||
+      !ptr_uplink_queue_growth_kbps_) {
+    LOG(ERROR) << "cannot create uploader metrics.";
+    return HttpUploader::kInitFailed;
+  }
+  ptr_memory_ = MemoryGovernor::Instance().GetAccount(
+      kMemoryUploadQueues, settings_.metrics_labels, "");
+  if (!ptr_memory_) {
+    LOG(ERROR) << "cannot create uploader memory account.";
+    return HttpUploader::kInitFailed;
+  }
+  trace_stream_id_ = Tracepoints::StreamId(settings_.metrics_labels);
+  static const char* const kTransportNames[kNumTransports] = {
+    "http1.1", "http2", "http3", "unknown",
+  };
+  for (int i = 0; i < kNumTransports; ++i) {
+    const std::string labels = MetricsRegistry::JoinLabels(
+        settings_.metrics_labels,
+        std::string("transport=\"") + kTransportNames[i] + "\"");
+    ptr_transport_uploads_[i] = registry.GetCounter(
+        "webmlive_transport_uploads_total", labels,
+        "Successful uploads by the HTTP version they used.");
+    ptr_transport_upload_ms_[i] = registry.GetCounter(
+        "webmlive_transport_upload_milliseconds_total", labels,
+        "Total time of the successful uploads by the HTTP version they "
+        "used.");
+    if (!ptr_transport_uploads_[i] || !ptr_transport_upload_ms_[i]) {
+      LOG(ERROR) << "cannot create uploader transport metrics.";
+      return HttpUploader::kInitFailed;
+    }
+  }
+
+  if (settings_.gzip_manifests) {
+    // A form post holds the chunk in a multipart body, which the
+    // Content-Encoding header would describe as a whole.
+    if (settings_.post_mode == webmlive::HTTP_FORM_POST) {
+      LOG(WARNING) << "gzip manifests need HTTP_POST or HTTP_PUT mode, not "
+                   << "compressing.";
+    } else if (gzip_.Init(GzipCompressor::kDefaultLevel) == kSuccess) {
+      gzip_enabled_ = true;
+    } else {
+      LOG(WARNING) << "cannot initialize gzip, not compressing manifests.";
+    }
+  }
+
+  if (!settings_.spool_directory.empty()) {
+    if (spool_.Init(settings_.spool_directory, settings_.spool_max_bytes)) {
+      LOG(ERROR) << "cannot open upload spool in "
+                 << settings_.spool_directory;
+      return HttpUploader::kInitFailed;
+    }
+    spool_enabled_ = true;
+    ptr_spool_bytes_->Set(spool_.size_bytes());
+  }
+
+  const curl_version_info_data* const ptr_version =
+      curl_version_info(CURLVERSION_NOW);
+  if (settings_.enable_http3) {
+    // HTTP/2 is the first fallback.
+    settings_.enable_http2 = true;
+#ifdef WEBMLIVE_HAVE_CURL_HTTP3
+    const bool have_http3 =
+        ptr_version && (ptr_version->features & CURL_VERSION_HTTP3);
+#else
+    const bool have_http3 = false;
+#endif
+    if (!have_http3) {
+      LOG(WARNING) << "libcurl built without HTTP/3 support, using HTTP/2.";
+      settings_.enable_http3 = false;
+    }
+  }
+  if (settings_.enable_http2) {
+    if (!ptr_version || !(ptr_version->features & CURL_VERSION_HTTP2)) {
+      LOG(WARNING) << "libcurl built without HTTP/2 support, using HTTP/1.1.";
+      settings_.enable_http2 = false;
+    }
+  }
+
+  ptr_engine_ = ptr_engine;
+  if (!ptr_engine_) {
+    // Keep one connection per transfer open for reuse by later uploads.
+    private_engine_.reset(new (std::nothrow) HttpUploadEngineImpl());  // NOLINT
+    if (!private_engine_) {
+      LOG(ERROR) << "cannot construct HttpUploadEngineImpl.";
+      return HttpUploader::kInitFailed;
+    }
+    const int status = private_engine_->Init(settings_.max_concurrent_uploads,
+                                             settings_.enable_http2);
+    if (status) {
+      return status;
+    }
+    ptr_engine_ = private_engine_.get();
+  }
+
+  // Disable HTTP 100 responses, and set user HTTP headers.
+  int status = SetHeaders();
+  if (status) {
+    LOG(ERROR) << "unable to set headers.";
+    return HttpUploader::kHeaderError;
+  }
+
+  for (int i = 0; i < settings_.max_concurrent_uploads; ++i) {
+    std::unique_ptr<HttpTransfer> transfer(
+        new (std::nothrow) HttpTransfer(this));  // NOLINT
+    if (!transfer) {
+      LOG(ERROR) << "cannot construct HttpTransfer.";
+      return HttpUploader::kInitFailed;
+    }
+    status = transfer->Init(settings_, ptr_headers_, ptr_stream_headers_);
+    if (status) {
+      LOG(ERROR) << "HttpTransfer Init failed, status=" << status;
+      return status;
+    }
+    idle_transfers_.push_back(transfer.get());
+    transfers_.push_back(std::move(transfer));
+  }
+
+  ResetStats();
+  return kSuccess;
+}
+
+// Copy the stats last published to |stats_snapshot_| to |ptr_stats|.
+int HttpUploaderImpl::GetStats(HttpUploaderStats* ptr_stats) {
+  if (!ptr_stats) {
+    LOG(ERROR) << "NULL ptr_stats";
+    return HttpUploader::kInvalidArg;
+  }
+  *ptr_stats = stats_snapshot_.Load();
+  return kSuccess;
+}
+
+// Run |private_engine_| when the uploader owns it, and start serving
+// |upload_queue_| from the engine's upload thread.
+int HttpUploaderImpl::Run() {
+  assert(!running_);
+  if (private_engine_ && private_engine_->Run()) {
+    LOG(ERROR) << "cannot run upload engine.";
+    return HttpUploader::kRunFailed;
+  }
+  running_ = true;
+  ptr_engine_->AddUploader(this);
+  return kSuccess;
+}
+
+// Copies the user data into a |DataChunk|, and passes it to |UploadChunk|.
+int HttpUploaderImpl::UploadBuffer(const uint8* ptr_buf, int32 length,
+                                   const std::string& id) {
+  if (!UploadComplete()) {
+    return HttpUploader::kUploadInProgress;
+  }
+  std::shared_ptr<DataChunk> chunk(new (std::nothrow) DataChunk());  // NOLINT
+  if (!chunk) {
+    LOG(ERROR) << "cannot construct DataChunk.";
+    return HttpUploader::kRunFailed;
+  }
+  if (chunk->Init(ptr_buf, length)) {
+    LOG(ERROR) << "DataChunk Init failed.";
+    return HttpUploader::kInvalidArg;
+  }
+  return UploadChunk(chunk, id);
+}
+
+// Queues |chunk| through |QueueUpload|.
+int HttpUploaderImpl::UploadChunk(const SharedDataChunk& chunk,
+                                  const std::string& id) {
+  if (!chunk || chunk->length() <= 0) {
+    LOG(ERROR) << "cannot upload NULL or empty chunk.";
+    return HttpUploader::kInvalidArg;
+  }
+  PendingUpload upload;
+  upload.chunk = chunk;
+  return QueueUpload(id, &upload);
+}
+
+// Queues |chunk| through |QueueUpload|. Form posts need the size of the file
+// data up front, so streaming requires |HTTP_POST| mode.
+int HttpUploaderImpl::UploadStreamingChunk(const SharedStreamingChunk& chunk,
+                                           const std::string& id) {
+  if (!chunk) {
+    LOG(ERROR) << "cannot upload NULL streaming chunk.";
+    return HttpUploader::kInvalidArg;
+  }
+  if (settings_.post_mode != webmlive::HTTP_POST) {
+    LOG(ERROR) << "streaming uploads require HTTP_POST mode.";
+    return HttpUploader::kInvalidArg;
+  }
+  PendingUpload upload;
+  upload.stream = chunk;
+  return QueueUpload(id, &upload);
+}
+
+// Try to obtain lock on |mutex_|, and add |ptr_upload| to |upload_queue_| if
+// the queue has room. When the upload is queued, |QueueUpload| releases the
+// lock and wakes the engine's upload thread. Templated URLs are expanded
+// before locking, and leave |url_queue_| untouched.
+int HttpUploaderImpl::QueueUpload(const std::string& id,
+                                  PendingUpload* ptr_upload) {
+  const bool use_template = !settings_.url_template.empty();
+  if (use_template) {
+    ptr_upload->url = ExpandUrlTemplate(id);
+  }
+  ptr_upload->id = id;
+  ClassifyUpload(id, ptr_upload);
+  if (settings_.post_mode == webmlive::HTTP_PUT && ptr_upload->chunk &&
+      settings_.multipart_threshold_bytes > 0 &&
+      ptr_upload->chunk->length() >= settings_.multipart_threshold_bytes) {
+    // Sent whole when the state cannot be allocated.
+    ptr_upload->multipart.reset(
+        new (std::nothrow) MultipartUpload());  // NOLINT
+    if (ptr_upload->multipart) {
+      ptr_upload->multipart_step = kInitiateMultipart;
+    }
+  }
+  int status = HttpUploader::kUploadInProgress;
+  WEBMLIVE_PROFILED_TRY_LOCK(lock, mutex_, "http_uploader");
+  if (lock.owns_lock() && CanQueueUpload()) {
+    if (!use_template) {
+      if (!url_queue_.empty()) {
+        target_url_ = url_queue_.front();
+        url_queue_.pop();
+      }
+      if (target_url_.empty()) {
+        LOG(ERROR) << "No target URL!";
+        return HttpUploader::kUrlConfigError;
+      }
+      ptr_upload->url = target_url_;
+    }
+
+    // Lock obtained; keep a reference to the data until a transfer finishes
+    // uploading it.
+    ptr_upload->queued_ms = NowMilliseconds();
+    if (settings_.chunk_deadline_ms > 0) {
+      ptr_upload->deadline_ms =
+          ptr_upload->queued_ms + settings_.chunk_deadline_ms;
+    }
+    InsertUpload(*ptr_upload, false);
+    UpdateQueueMetrics();
+    std::vector<PendingUpload> dropped;
+    ShedQueuedUploads(&dropped);
+    status = kSuccess;
+
+    // Wake the upload thread.
+    if (ptr_upload->chunk) {
+      LOG(INFO) << "waking uploader with " << ptr_upload->chunk->length()
+                << " bytes";
+    } else {
+      LOG(INFO) << "waking uploader with streaming chunk";
+    }
+    lock.unlock();
+    for (size_t i = 0; i < dropped.size(); ++i) {
+      LOG(WARNING) << "memory limit reached, dropped queued media segment "
+                   << dropped[i].id;
+      ptr_memory_drops_->Increment(1);
+      SpoolUpload(dropped[i]);
+    }
+    ptr_engine_->Wake();
+  }
+  return status;
+}
+
+// Manifests are named "<name>.mpd" and their patches "<name>.mpp", and
+// previews end in ".jpg" or ".vtt". Other
+// ids are parsed by |DashWriter|, and ids it does not recognize, such as those
+// of non-DASH encodes, are media uploaded in order with video.
+void HttpUploaderImpl::ClassifyUpload(const std::string& id,
+                                      PendingUpload* ptr_upload) {
+  const char kManifestSuffix[] = ".mpd";
+  const char kPatchSuffix[] = ".mpp";
+  const char kJpegSuffix[] = ".jpg";
+  const char kVttSuffix[] = ".vtt";
+  // All four suffixes are four characters long.
+  const size_t suffix_length = sizeof(kManifestSuffix) - 1;
+  const std::string suffix = id.size() >= suffix_length ?
+      id.substr(id.size() - suffix_length) : std::string();
+  AdaptationSet::MediaType media_type = AdaptationSet::kVideo;
+  bool init = false;
+  if (suffix == kManifestSuffix || suffix == kPatchSuffix) {
+    ptr_upload->priority = kManifestPriority;
+    ptr_upload->media = false;
+  } else if (suffix == kJpegSuffix || suffix == kVttSuffix) {
+    // Previews may be dropped as late like media.
+    ptr_upload->priority = kPreviewPriority;
+    ptr_upload->media = true;
+  } else if (DashWriter::ParseChunkId(id, &media_type, &init) && init) {
+    ptr_upload->priority = kInitPriority;
+    ptr_upload->media = false;
+  } else {
+    ptr_upload->priority = media_type == AdaptationSet::kAudio ?
+        kAudioPriority : kVideoPriority;
+    ptr_upload->media = true;
+  }
+}
+
+// Matches the types served by |HttpOrigin|, which CDNs in front of the store
+// pass on to players.
+const char* HttpUploaderImpl::ObjectContentType(const std::string& id) {
+  static const struct {
+    const char* suffix;
+    const char* content_type;
+  } kContentTypes[] = {
+    {".mpd", "application/dash+xml"},
+    {".mpp", "application/dash-patch+xml"},
+    {".jpg", "image/jpeg"},
+    {".vtt", "text/vtt"},
+  };
+  for (size_t i = 0; i < sizeof(kContentTypes) / sizeof(kContentTypes[0]);
+       ++i) {
+    const size_t length = strlen(kContentTypes[i].suffix);
+    if (id.size() >= length &&
+        id.compare(id.size() - length, length, kContentTypes[i].suffix) == 0) {
+      return kContentTypes[i].content_type;
+    }
+  }
+  AdaptationSet::MediaType media_type = AdaptationSet::kVideo;
+  bool init = false;
+  if (DashWriter::ParseChunkId(id, &media_type, &init) &&
+      media_type == AdaptationSet::kAudio) {
+    return "audio/webm";
+  }
+  return kWebmMimeType;
+}
+
+void HttpUploaderImpl::InsertUpload(const PendingUpload& upload, bool retry) {
+  std::deque<PendingUpload>::iterator pos = upload_queue_.end();
+  while (pos != upload_queue_.begin()) {
+    const int queued_priority = (pos - 1)->priority;
+    if (queued_priority < upload.priority ||
+        (queued_priority == upload.priority && !retry)) {
+      break;
+    }
+    --pos;
+  }
+  upload_queue_.insert(pos, upload);
+}
+
+// Replaces each "{name}" in the template with the percent-encoded value of
+// |name|. Unknown names are left as they are.
+std::string HttpUploaderImpl::ExpandUrlTemplate(const std::string& id) const {
+  const std::string& url_template = settings_.url_template;
+  std::string url;
+  size_t pos = 0;
+  while (pos < url_template.size()) {
+    const size_t open_pos = url_template.find('{', pos);
+    const size_t close_pos = url_template.find('}', open_pos);
+    if (open_pos == std::string::npos || close_pos == std::string::npos) {
+      url.append(url_template, pos, std::string::npos);
+      break;
+    }
+    url.append(url_template, pos, open_pos - pos);
+    const std::string name =
+        url_template.substr(open_pos + 1, close_pos - open_pos - 1);
+    if (name == "id") {
+      url.append(EscapeUrlComponent(id));
+    } else if (name == "stream_id") {
+      url.append(EscapeUrlComponent(settings_.stream_id));
+    } else if (name == "stream_name") {
+      url.append(EscapeUrlComponent(settings_.stream_name));
+    } else {
+      url.append(url_template, open_pos, close_pos - open_pos + 1);
+    }
+    pos = close_pos + 1;
+  }
+  return url;
+}
+
+// Stops the uploader. Obtains lock on |mutex_| and sets |stop_| to true, so
+// that running uploads stop when |StopRequested| is called within the libcurl
+// callbacks. The engine then aborts the remaining uploads and forgets the
+// uploader, and |private_engine_| stops when the uploader owns it.
+int HttpUploaderImpl::Stop() {
+  assert(running_);
+  {
+    WEBMLIVE_PROFILED_LOCK(lock, mutex_, "http_uploader");
+    stop_ = true;
+  }
+  ptr_engine_->RemoveUploader(this);
+  if (private_engine_) {
+    private_engine_->Stop();
+  }
+  running_ = false;
+  upload_done_.notify_all();
+  return kSuccess;
+}
+
+void HttpUploaderImpl::EnqueueTargetUrl(const std::string& target_url) {
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "http_uploader");
+  url_queue_.push(target_url);
+}
+
+void HttpUploaderImpl::SetPacingRate(int kbps) {
+  requested_pacing_kbps_ = std::max(0, kbps);
+}
+
+void HttpUploaderImpl::InitPacer(int kbps) {
+  const int64 bytes_per_second = static_cast<int64>(kbps) * 1000 / 8;
+  pacer_.Init(bytes_per_second,
+              std::max<int64>(bytes_per_second * kPacingBurstMs / 1000,
+                              kMinPacingBurstBytes));
+  LOG(INFO) << "pacing uploads at " << kbps << " kbps.";
+}
+
+void HttpUploaderImpl::ApplyPacingRate() {
+  const int kbps = requested_pacing_kbps_.exchange(-1);
+  if (kbps < 0 || static_cast<int64>(kbps) * 1000 / 8 ==
+                      pacer_.bytes_per_second()) {
+    return;
+  }
+  InitPacer(kbps);
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "http_uploader");
+  stats_.pacing_bytes_per_second = pacer_.bytes_per_second();
+  stats_snapshot_.Store(stats_);
+}
+
+bool HttpUploaderImpl::StopRequested() {
+  return stop_.load();
+}
+
+// Disable HTTP 100 responses (send empty Expect header), and build the list
+// of user HTTP headers passed to libcurl by each transfer.
+int HttpUploaderImpl::SetHeaders() {
+  // Tell libcurl to omit "Expect: 100-continue" from requests
+  ptr_headers_ = curl_slist_append(ptr_headers_, kExpectHeader);
+  if (settings_.post_mode == webmlive::HTTP_POST) {
+    // In form posts the video/webm mime-type is included in the form itself,
+    // but in plain old HTTP posts the Content-Type must be video/webm.
+    ptr_headers_ = curl_slist_append(ptr_headers_, kContentTypeHeader);
+  }
+  if (!settings_.aws_sigv4.empty()) {
+    // Chunks are read through |ReadCallback| as they are sent, too late to
+    // hash them into the signature.
+    ptr_headers_ = curl_slist_append(ptr_headers_, kUnsignedPayloadHeader);
+  }
+  typedef std::map<std::string, std::string> StringMap;
+  StringMap::const_iterator header_iter = settings_.headers.begin();
+  // add user headers
+  for (; header_iter != settings_.headers.end(); ++header_iter) {
+    std::ostringstream header;
+    header << header_iter->first.c_str() << ":" << header_iter->second.c_str();
+    ptr_headers_ = curl_slist_append(ptr_headers_, header.str().c_str());
+  }
+  if (!ptr_headers_) {
+    LOG(ERROR) << "curl_slist_append failed.";
+    return kLibCurlError;
+  }
+
+  // Streaming uploads use chunked transfer encoding with HTTP/1.1. HTTP/2
+  // frames the data itself and forbids the header.
+  for (curl_slist* ptr_header = ptr_headers_; ptr_header;
+       ptr_header = ptr_header->next) {
+    ptr_stream_headers_ =
+        curl_slist_append(ptr_stream_headers_, ptr_header->data);
+  }
+  if (!settings_.enable_http2) {
+    ptr_stream_headers_ =
+        curl_slist_append(ptr_stream_headers_, kChunkedEncodingHeader);
+  }
+  if (!ptr_stream_headers_) {
+    LOG(ERROR) << "curl_slist_append failed.";
+    return kLibCurlError;
+  }
+  return kSuccess;
+}
+
+bool HttpUploaderImpl::CanQueueUpload() const {
+  const int pending_uploads =
+      static_cast<int>(upload_queue_.size()) + active_uploads_;
+  return pending_uploads < settings_.max_pending_uploads;
+}
+
+void HttpUploaderImpl::UpdateStats() {
+  int64 bytes_sent_current = 0;
+  for (size_t i = 0; i < transfers_.size(); ++i) {
+    bytes_sent_current += transfers_[i]->bytes_sent_current();
+  }
+  stats_.bytes_sent_current = bytes_sent_current;
+  double ticks_elapsed = clock() - start_ticks_;
+  double ticks_per_sec = CLOCKS_PER_SEC;
+  const int64 bytes_sent = bytes_sent_current + stats_.total_bytes_uploaded;
+  stats_.bytes_per_second = bytes_sent / (ticks_elapsed / ticks_per_sec);
+  ptr_bytes_per_second_->Set(static_cast<int64>(stats_.bytes_per_second));
+
+  const int64 now_ms = NowMilliseconds();
+  const int64 window_ms = now_ms - rate_window_start_ms_;
+  if (window_ms >= kSendRateWindowMs) {
+    stats_.current_bytes_per_second =
+        (bytes_sent - rate_window_start_bytes_) * 1000.0 / window_ms;
+    rate_window_start_ms_ = now_ms;
+    rate_window_start_bytes_ = bytes_sent;
+  }
+  stats_snapshot_.Store(stats_);
+}
+
+void HttpUploaderImpl::UpdateQueueMetrics() {
+  ptr_queued_uploads_->Set(static_cast<int64>(upload_queue_.size()));
+  ptr_active_uploads_->Set(active_uploads_);
+  pending_uploads_ =
+      static_cast<int>(upload_queue_.size()) + active_uploads_;
+  int64 queued_bytes = 0;
+  for (size_t i = 0; i < upload_queue_.size(); ++i) {
+    if (upload_queue_[i].chunk)
+      queued_bytes += upload_queue_[i].chunk->length();
+  }
+  ptr_memory_->Set(queued_bytes);
+  uplink_estimator_.AddQueueSample(queued_bytes, NowMilliseconds());
+  UpdateUplinkStats();
+}
+
+void HttpUploaderImpl::UpdateUplinkStats() {
+  const UplinkEstimate& uplink = uplink_estimator_.estimate();
+  stats_.uplink = uplink;
+  ptr_uplink_kbps_->Set(uplink.capacity_kbps);
+  ptr_uplink_low_kbps_->Set(uplink.low_capacity_kbps);
+  ptr_uplink_queue_growth_kbps_->Set(uplink.queue_growth_kbps);
+}
+
+void HttpUploaderImpl::ShedQueuedUploads(
+    std::vector<PendingUpload>* ptr_dropped) {
+  while (ptr_memory_->pressure() == kMemoryCritical) {
+    std::deque<PendingUpload>::iterator oldest = upload_queue_.end();
+    for (std::deque<PendingUpload>::iterator it = upload_queue_.begin();
+         it != upload_queue_.end(); ++it) {
+      if (!it->media || !it->chunk || it->multipart)
+        continue;
+      if (oldest == upload_queue_.end() || it->queued_ms < oldest->queued_ms)
+        oldest = it;
+    }
+    if (oldest == upload_queue_.end())
+      break;
+    ptr_dropped->push_back(*oldest);
+    upload_queue_.erase(oldest);
+    UpdateQueueMetrics();
+  }
+}
+
+// Reset uploaded byte count, and store upload start time.
+void HttpUploaderImpl::ResetStats() {
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "http_uploader");
+  stats_.bytes_per_second = 0;
+  stats_.bytes_sent_current = 0;
+  stats_.total_bytes_uploaded = 0;
+  stats_.current_bytes_per_second = 0;
+  stats_.completed_uploads = 0;
+  stats_.failed_uploads = 0;
+  stats_.upload_latency = LatencyHistogram();
+  uplink_estimator_.Init(UplinkEstimatorConfig());
+  stats_.uplink = UplinkEstimate();
+  stats_.pacing_bytes_per_second = pacer_.bytes_per_second();
+  rate_window_start_ms_ = NowMilliseconds();
+  rate_window_start_bytes_ = 0;
+  start_ticks_ = clock();
+  stats_snapshot_.Store(stats_);
+}
+
+int HttpUploaderImpl::StartQueuedUploads() {
+  int uploads_started = 0;
+  while (!idle_transfers_.empty()) {
+    PendingUpload upload;
+    bool cancelled = false;
+    bool expired = false;
+    bool late = false;
+    {
+      WEBMLIVE_PROFILED_LOCK(lock, mutex_, "http_uploader");
+      if (stop_ || upload_queue_.empty()) {
+        break;
+      }
+      const int64 now = NowMilliseconds();
+      const PendingUpload& next_upload = upload_queue_.front();
+      if (next_upload.multipart_step == kUploadPart &&
+          next_upload.multipart->failed) {
+        cancelled = true;
+      } else if (next_upload.deadline_ms && next_upload.deadline_ms <= now) {
+        expired = true;
+      } else if (next_upload.media && settings_.live_window_ms > 0 &&
+                 now - next_upload.queued_ms > settings_.live_window_ms) {
+        late = true;
+      } else if (next_upload.retry_ms > now) {
+        // Uploads queued behind a retry wait for it.
+        break;
+      }
+      upload = next_upload;
+      upload_queue_.pop_front();
+      if (!cancelled && !expired && !late) {
+        ++active_uploads_;
+        CollectBundle(now, &upload);
+      }
+      UpdateQueueMetrics();
+    }
+    if (cancelled) {
+      // Another part failed; the upload is aborted once its parts end.
+      EndUpload(upload, false);
+      upload_done_.notify_all();
+      continue;
+    }
+    if (expired) {
+      LOG(ERROR) << "upload missed its deadline, dropped after "
+                 << upload.attempts << " retries.";
+      EndUploads(upload, false, ptr_upload_failures_);
+      upload_done_.notify_all();
+      continue;
+    }
+    if (late) {
+      LOG(WARNING) << "media segment fell out of the live window, dropped.";
+      EndUploads(upload, false, ptr_late_drops_);
+      upload_done_.notify_all();
+      continue;
+    }
+
+    int status = kSuccess;
+    if (upload.bundle && !upload.chunk) {
+      status = BuildBundle(&upload);
+    } else if (!upload.bundle && upload.priority == kManifestPriority) {
+      CompressManifest(&upload);
+    }
+    HttpTransfer* const ptr_transfer = idle_transfers_.back();
+    LOG(INFO) << "uploading buffer...";
+    if (status == kSuccess) {
+      status = StartUpload(ptr_transfer, upload);
+    }
+    if (status == kSuccess) {
+      const CURLMcode err =
+          curl_multi_add_handle(ptr_engine_->multi(), ptr_transfer->handle());
+      if (err != CURLM_OK) {
+        LOG_CURLM_ERR(err, "curl_multi_add_handle failed.");
+        ptr_transfer->Finish(CURLE_FAILED_INIT);
+        status = kLibCurlError;
+      }
+    }
+    if (status) {
+      LOG(ERROR) << "buffer upload failed, status=" << status;
+      EndUploads(upload, false, ptr_upload_failures_);
+      {
+        WEBMLIVE_PROFILED_LOCK(lock, mutex_, "http_uploader");
+        --active_uploads_;
+        UpdateQueueMetrics();
+      }
+      upload_done_.notify_all();
+      continue;
+    }
+    WEBMLIVE_TRACE_UPLOAD(upload_start, trace_stream_id_, upload.id.c_str(),
+                          upload.chunk ? upload.chunk->length() : 0);
+    running_uploads_[ptr_transfer] = upload;
+    idle_transfers_.pop_back();
+    ++uploads_started;
+  }
+  if (StartCatchUpUpload()) {
+    ++uploads_started;
+  }
+  return uploads_started;
+}
+
+// Chunks are bundled whole, as first sent: resumed, multipart, streaming and
+// catch-up uploads go alone.
+bool HttpUploaderImpl::Coalescable(const PendingUpload& upload) const {
+  return settings_.coalesce_max_bytes > 0 && upload.chunk &&
+         !upload.bundle && !upload.multipart && !upload.spooled &&
+         upload.resume_offset == 0 &&
+         upload.chunk->length() <= settings_.coalesce_max_bytes;
+}
+
+// Only uploads at the head of |upload_queue_| are taken, which keeps the
+// upload order. The checks of |StartQueuedUploads| are repeated: an upload
+// that must be dropped, or wait for a retry, ends the bundle.
+void HttpUploaderImpl::CollectBundle(int64 now, PendingUpload* ptr_upload) {
+  if (!Coalescable(*ptr_upload) || upload_queue_.empty()) {
+    return;
+  }
+  std::vector<PendingUpload> members(1, *ptr_upload);
+  while (static_cast<int>(members.size()) < settings_.coalesce_max_objects &&
+         !upload_queue_.empty()) {
+    const PendingUpload& next_upload = upload_queue_.front();
+    if (!Coalescable(next_upload) || next_upload.retry_ms > now ||
+        (next_upload.deadline_ms && next_upload.deadline_ms <= now) ||
+        (next_upload.media && settings_.live_window_ms > 0 &&
+         now - next_upload.queued_ms > settings_.live_window_ms)) {
+      break;
+    }
+    members.push_back(next_upload);
+    upload_queue_.pop_front();
+  }
+  if (members.size() < 2) {
+    return;
+  }
+  ptr_upload->bundle.reset(
+      new (std::nothrow) std::vector<PendingUpload>());  // NOLINT
+  if (!ptr_upload->bundle) {
+    // Send the uploads one by one.
+    for (size_t i = members.size() - 1; i > 0; --i) {
+      upload_queue_.push_front(members[i]);
+    }
+    return;
+  }
+  ptr_upload->bundle->swap(members);
+
+  // The bundle is sent as a new upload, and its uploads are checked against
+  // the live window as they are collected. It is dropped at the first
+  // deadline of its uploads.
+  ptr_upload->chunk.reset();
+  ptr_upload->attempts = 0;
+  ptr_upload->retry_ms = 0;
+  ptr_upload->media = false;
+  ptr_upload->compressed = false;
+  const std::vector<PendingUpload>& bundle = *ptr_upload->bundle;
+  for (size_t i = 1; i < bundle.size(); ++i) {
+    if (bundle[i].deadline_ms &&
+        (!ptr_upload->deadline_ms ||
+         bundle[i].deadline_ms < ptr_upload->deadline_ms)) {
+      ptr_upload->deadline_ms = bundle[i].deadline_ms;
+    }
+  }
+}
+
+// See |HttpUploaderSettings::coalesce_max_bytes| for the bundle format.
+int HttpUploaderImpl::BuildBundle(PendingUpload* ptr_upload) {
+  std::vector<PendingUpload>& bundle = *ptr_upload->bundle;
+  std::string body;
+  for (size_t i = 0; i < bundle.size(); ++i) {
+    PendingUpload& upload = bundle[i];
+    if (upload.priority == kManifestPriority) {
+      CompressManifest(&upload);
+    }
+    std::ostringstream object_header;
+    object_header << upload.id << " " << upload.chunk->length() << " "
+                  << (upload.compressed ? "gzip" : "identity") << "\r\n";
+    body.append(object_header.str());
+    const std::vector<DataChunk::Span>& spans = upload.chunk->spans();
+    for (size_t j = 0; j < spans.size(); ++j) {
+      body.append(reinterpret_cast<const char*>(spans[j].ptr_data),
+                  spans[j].length);
+    }
+    body.append("\r\n");
+  }
+  std::shared_ptr<DataChunk> chunk(new (std::nothrow) DataChunk());  // NOLINT
+  if (!chunk || chunk->Init(reinterpret_cast<const uint8*>(body.data()),
+                            static_cast<int32>(body.size()))) {
+    LOG(ERROR) << "cannot store upload bundle.";
+    return HttpUploader::kRunFailed;
+  }
+  VLOG(1) << "bundled " << bundle.size() << " uploads, " << body.size()
+          << " bytes.";
+  ptr_bundles_->Increment(1);
+  ptr_bundled_uploads_->Increment(bundle.size());
+  ptr_upload->chunk = chunk;
+  return kSuccess;
+}
+
+// Multipart uploads run their steps through a single upload path: the steps
+// chain into each other, and each is started, and sent again, on its own.
+int HttpUploaderImpl::StartUpload(HttpTransfer* ptr_transfer,
+                                  const PendingUpload& upload) {
+  if (upload.stream) {
+    return ptr_transfer->StartStreaming(upload.url, upload.stream);
+  }
+  if (settings_.post_mode != webmlive::HTTP_PUT) {
+    return ptr_transfer->Start(
+        upload.url, upload.chunk, upload.resume_offset, upload.compressed,
+        upload.bundle ? kBundleContentTypeHeader : NULL);
+  }
+  const int64 length = upload.chunk->length();
+  const char separator =
+      upload.url.find('?') == std::string::npos ? '?' : '&';
+  if (upload.multipart_step == kSingleUpload) {
+    return ptr_transfer->StartObjectRequest(
+        upload.url, HttpTransfer::kPutObject, upload.chunk, 0, length,
+        ObjectContentType(upload.id), upload.compressed);
+  }
+  if (upload.multipart_step == kInitiateMultipart) {
+    // The object takes its Content-Type from the initiating request.
+    return ptr_transfer->StartObjectRequest(
+        upload.url + separator + "uploads", HttpTransfer::kPostObject,
+        SharedDataChunk(), 0, 0, ObjectContentType(upload.id), false);
+  }
+
+  const MultipartUpload& multipart = *upload.multipart;
+  const std::string upload_id_url =
+      upload.url + separator + "uploadId=" +
+      EscapeUrlComponent(multipart.upload_id);
+  if (upload.multipart_step == kUploadPart) {
+    const int64 begin =
+        (upload.part_number - 1) * settings_.multipart_part_bytes;
+    const int64 end =
+        std::min(begin + settings_.multipart_part_bytes, length);
+    std::ostringstream part_url;
+    part_url << upload.url << separator << "partNumber="
+             << upload.part_number << "&uploadId="
+             << EscapeUrlComponent(multipart.upload_id);
+    return ptr_transfer->StartObjectRequest(
+        part_url.str(), HttpTransfer::kPutObject, upload.chunk, begin, end,
+        NULL, false);
+  }
+  if (upload.multipart_step == kCompleteMultipart) {
+    std::ostringstream xml;
+    xml << "<CompleteMultipartUpload>";
+    for (size_t i = 0; i < multipart.etags.size(); ++i) {
+      xml << "<Part><PartNumber>" << i + 1 << "</PartNumber><ETag>"
+          << multipart.etags[i] << "</ETag></Part>";
+    }
+    xml << "</CompleteMultipartUpload>";
+    const std::string body = xml.str();
+    std::shared_ptr<DataChunk> chunk(new (std::nothrow) DataChunk());  // NOLINT
+    if (!chunk || chunk->Init(reinterpret_cast<const uint8*>(body.data()),
+                              static_cast<int32>(body.size()))) {
+      LOG(ERROR) << "cannot store multipart upload completion.";
+      return HttpUploader::kRunFailed;
+    }
+    return ptr_transfer->StartObjectRequest(
+        upload_id_url, HttpTransfer::kPostObject, chunk, 0, chunk->length(),
+        "application/xml", false);
+  }
+  return ptr_transfer->StartObjectRequest(
+      upload_id_url, HttpTransfer::kDeleteObject, SharedDataChunk(), 0, 0,
+      NULL, false);
+}
+
+bool HttpUploaderImpl::CheckMultipartResponse(
+    const HttpTransfer* ptr_transfer, const PendingUpload& upload) {
+  const int response_code = ptr_transfer->response_code();
+  if (response_code < 200 || response_code >= 300) {
+    LOG(ERROR) << "multipart upload step " << upload.multipart_step
+               << " refused, response=" << response_code;
+    return false;
+  }
+  MultipartUpload& multipart = *upload.multipart;
+  const std::string& body = ptr_transfer->response_body();
+  if (upload.multipart_step == kInitiateMultipart) {
+    const char kUploadIdTag[] = "<UploadId>";
+    const size_t tag_pos = body.find(kUploadIdTag);
+    const size_t end_pos = body.find("</UploadId>", tag_pos);
+    if (tag_pos == std::string::npos || end_pos == std::string::npos) {
+      LOG(ERROR) << "no UploadId in multipart upload response.";
+      return false;
+    }
+    const size_t id_pos = tag_pos + sizeof(kUploadIdTag) - 1;
+    multipart.upload_id = body.substr(id_pos, end_pos - id_pos);
+  } else if (upload.multipart_step == kUploadPart) {
+    if (ptr_transfer->etag().empty()) {
+      LOG(ERROR) << "no ETag for part " << upload.part_number;
+      return false;
+    }
+    multipart.etags[upload.part_number - 1] = ptr_transfer->etag();
+  } else if (upload.multipart_step == kCompleteMultipart &&
+             body.find("<Error>") != std::string::npos) {
+    // S3 reports failures found after it sent 200 OK in the body.
+    LOG(ERROR) << "multipart upload completion failed:\n" << body;
+    return false;
+  }
+  return true;
+}
+
+bool HttpUploaderImpl::EndUpload(const PendingUpload& upload,
+                                 bool succeeded) {
+  if (!upload.multipart) {
+    return true;
+  }
+  const bool first_failure = !succeeded && ClaimFailure(upload);
+  MultipartUpload& multipart = *upload.multipart;
+  PendingUpload next_step = upload;
+  next_step.attempts = 0;
+  next_step.retry_ms = 0;
+  std::vector<PendingUpload> steps;
+  if (upload.multipart_step == kInitiateMultipart && succeeded) {
+    const int64 part_bytes = settings_.multipart_part_bytes;
+    const int num_parts = static_cast<int>(
+        (upload.chunk->length() + part_bytes - 1) / part_bytes);
+    multipart.etags.assign(num_parts, std::string());
+    multipart.parts_pending = num_parts;
+    next_step.multipart_step = kUploadPart;
+    for (int i = 1; i <= num_parts; ++i) {
+      next_step.part_number = i;
+      steps.push_back(next_step);
+    }
+  } else if ((upload.multipart_step == kUploadPart &&
+              --multipart.parts_pending == 0) ||
+             (upload.multipart_step == kCompleteMultipart && !succeeded)) {
+    // Completions and aborts are never dropped: the parts sent are lost, or
+    // left on the store, otherwise.
+    next_step.multipart_step =
+        multipart.failed ? kAbortMultipart : kCompleteMultipart;
+    next_step.deadline_ms = 0;
+    next_step.media = false;
+    steps.push_back(next_step);
+  }
+  if (!steps.empty() && !StopRequested()) {
+    WEBMLIVE_PROFILED_LOCK(lock, mutex_, "http_uploader");
+    // Go ahead of the uploads of the same priority, like retries; inserting
+    // the last step first keeps the parts in order.
+    for (size_t i = steps.size(); i > 0; --i) {
+      InsertUpload(steps[i - 1], true);
+    }
+    UpdateQueueMetrics();
+  }
+  return succeeded ? upload.multipart_step == kCompleteMultipart :
+                     first_failure;
+}
+
+int HttpUploaderImpl::EndUploads(const PendingUpload& upload,
+                                 bool succeeded, Metric* ptr_failures) {
+  if (!upload.bundle) {
+    if (!EndUpload(upload, succeeded)) {
+      return 0;
+    }
+    if (!succeeded) {
+      ptr_failures->Increment(1);
+      SpoolUpload(upload);
+    }
+    return 1;
+  }
+  // Bundled uploads are never multipart, and always count.
+  const std::vector<PendingUpload>& bundle = *upload.bundle;
+  if (!succeeded) {
+    ptr_failures->Increment(bundle.size());
+    for (size_t i = 0; i < bundle.size(); ++i) {
+      SpoolUpload(bundle[i]);
+    }
+  }
+  return static_cast<int>(bundle.size());
+}
+
+bool HttpUploaderImpl::ClaimFailure(const PendingUpload& upload) {
+  if (!upload.multipart) {
+    return true;
+  }
+  if (upload.multipart->failed) {
+    return false;
+  }
+  upload.multipart->failed = true;
+  return true;
+}
+
+void HttpUploaderImpl::FinishUpload(HttpTransfer* ptr_transfer,
+                                    CURLcode result) {
+  int status = ptr_transfer->Finish(result);
+  PendingUpload upload = running_uploads_[ptr_transfer];
+  running_uploads_.erase(ptr_transfer);
+  WEBMLIVE_TRACE_UPLOAD(upload_end, trace_stream_id_, upload.id.c_str(),
+                        status);
+#ifdef WEBMLIVE_CURL_HTTP3_NO_FALLBACK
+  if (status && settings_.enable_http3 && !http3_fallback_ &&
+      ptr_transfer->response_code() == 0) {
+    // No response: assume the server or the network refuses QUIC. Idle
+    // transfers switch now, and running ones as they finish.
+    LOG(WARNING) << "HTTP/3 upload failed, falling back to HTTP/2.";
+    http3_fallback_ = true;
+    for (size_t i = 0; i < idle_transfers_.size(); ++i) {
+      idle_transfers_[i]->DisableHttp3();
+    }
+  }
+#endif
+  if (http3_fallback_) {
+    ptr_transfer->DisableHttp3();
+  }
+  if (upload.spooled) {
+    // Failed catch-up uploads stay in the spool; see |FinishCatchUpUpload|.
+    FinishCatchUpUpload(upload, status == kSuccess &&
+                        !RetryableResponse(ptr_transfer->response_code()));
+    idle_transfers_.push_back(ptr_transfer);
+    return;
+  }
+  if (upload.multipart && !status &&
+      !RetryableResponse(ptr_transfer->response_code()) &&
+      !CheckMultipartResponse(ptr_transfer, upload)) {
+    status = HttpUploader::kRunFailed;
+  }
+  const bool succeeded =
+      !status && !RetryableResponse(ptr_transfer->response_code());
+  bool retry = false;
+  int counted = 0;
+  if (!succeeded) {
+    // TODO(tomfinegan): Report upload failure, and provide access to
+    //                   response code and data.
+    LOG(ERROR) << "buffer upload failed, status=" << status
+               << " response=" << ptr_transfer->response_code();
+    retry = PrepareRetry(ptr_transfer, &upload);
+    if (retry) {
+      ptr_upload_retries_->Increment(1);
+    } else {
+      LOG(ERROR) << "upload dropped after " << upload.attempts << " retries.";
+      counted = EndUploads(upload, false, ptr_upload_failures_);
+    }
+  } else {
+    counted = EndUploads(upload, true, ptr_upload_failures_);
+  }
+  idle_transfers_.push_back(ptr_transfer);
+  {
+    WEBMLIVE_PROFILED_LOCK(lock, mutex_, "http_uploader");
+    LOG(INFO) << "releasing upload chunk...";
+    --active_uploads_;
+    // Retries, and the steps of multipart uploads before the last, are not
+    // counted.
+    // Only media segments are measured: the time of small uploads such as
+    // manifests is mostly round trips. The parts of multipart uploads carry
+    // part of a segment.
+    if (succeeded && upload.media && ptr_transfer->transfer_ms() >= 0) {
+      const int64 media_ms =
+          upload.multipart ? 0 : settings_.segment_duration_ms;
+      uplink_estimator_.AddUpload(ptr_transfer->transfer_bytes(),
+                                  ptr_transfer->transfer_ms(), media_ms);
+      UpdateUplinkStats();
+      stats_snapshot_.Store(stats_);
+    }
+    if (counted && succeeded) {
+      // Each upload of a bundle is measured from its own queueing.
+      const int64 now = NowMilliseconds();
+      stats_.completed_uploads += counted;
+      if (upload.bundle) {
+        for (size_t i = 0; i < upload.bundle->size(); ++i) {
+          stats_.upload_latency.Add(
+              (now - (*upload.bundle)[i].queued_ms) * 1000);
+        }
+      } else {
+        stats_.upload_latency.Add((now - upload.queued_ms) * 1000);
+      }
+      stats_snapshot_.Store(stats_);
+    } else if (counted) {
+      stats_.failed_uploads += counted;
+      stats_snapshot_.Store(stats_);
+    }
+    if (retry) {
+      InsertUpload(upload, true);
+    }
+    UpdateQueueMetrics();
+  }
+  upload_done_.notify_all();
+}
+
+// Retry |ptr_upload| after a delay drawn from the upper half of an interval
+// that doubles with each attempt, so that uploaders failing together do not
+// retry together.
+bool HttpUploaderImpl::PrepareRetry(const HttpTransfer* ptr_transfer,
+                                    PendingUpload* ptr_upload) {
+  if (StopRequested() || ptr_upload->attempts >= settings_.max_upload_retries) {
+    return false;
+  }
+  int64 delay_ms = settings_.retry_min_delay_ms;
+  for (int i = 0; i < ptr_upload->attempts &&
+       delay_ms < settings_.retry_max_delay_ms; ++i) {
+    delay_ms *= 2;
+  }
+  delay_ms = std::min<int64>(delay_ms, settings_.retry_max_delay_ms);
+  delay_ms = delay_ms / 2 +
+      static_cast<int64>(retry_random_()) % (delay_ms / 2 + 1);
+  const int64 retry_ms = NowMilliseconds() + delay_ms;
+  if (ptr_upload->deadline_ms && retry_ms >= ptr_upload->deadline_ms) {
+    return false;
+  }
+  ++ptr_upload->attempts;
+  ptr_upload->retry_ms = retry_ms;
+
+  // Continue where the server stopped when it said so. Without word from the
+  // server, the bytes libcurl sent may not have arrived; the retry keeps the
+  // last offset the server confirmed.
+  if (ptr_upload->chunk && settings_.resume_uploads &&
+      settings_.post_mode == webmlive::HTTP_POST &&
+      ptr_upload->chunk->length() >= kBytesRequiredForResume) {
+    const int64 confirmed_bytes = ptr_transfer->confirmed_bytes();
+    if (confirmed_bytes > ptr_upload->resume_offset &&
+        confirmed_bytes < ptr_upload->chunk->length()) {
+      ptr_upload->resume_offset = confirmed_bytes;
+    }
+  }
+  LOG(WARNING) << "retrying upload in " << delay_ms << "ms, attempt "
+               << ptr_upload->attempts << " offset "
+               << ptr_upload->resume_offset;
+  return true;
+}
+
+int64 HttpUploaderImpl::NextRetryTime() const {
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "http_uploader");
+  if (stop_) {
+    return 0;
+  }
+  if (!upload_queue_.empty()) {
+    return upload_queue_.front().retry_ms;
+  }
+  if (spool_enabled_ && !catch_up_running_ && !spool_.empty()) {
+    return std::max<int64>(next_catch_up_ms_, 1);
+  }
+  return 0;
+}
+
+void HttpUploaderImpl::CompressManifest(PendingUpload* ptr_upload) {
+  if (!gzip_enabled_ || !ptr_upload->chunk || ptr_upload->compressed) {
+    return;
+  }
+  if (gzip_.Compress(*ptr_upload->chunk, &gzip_buffer_) != kSuccess ||
+      gzip_buffer_.empty()) {
+    LOG(WARNING) << "manifest compression failed, sending it uncompressed.";
+    return;
+  }
+  if (static_cast<int64>(gzip_buffer_.size()) >= ptr_upload->chunk->length()) {
+    // Too small to gain from compression.
+    return;
+  }
+  std::shared_ptr<DataChunk> chunk(new (std::nothrow) DataChunk());  // NOLINT
+  if (!chunk || chunk->Init(&gzip_buffer_[0],
+                            static_cast<int32>(gzip_buffer_.size()))) {
+    LOG(WARNING) << "cannot store compressed manifest, sending it "
+                 << "uncompressed.";
+    return;
+  }
+  VLOG(1) << "manifest " << ptr_upload->chunk->length() << " bytes, gzip "
+          << chunk->length() << " bytes.";
+  ptr_gzip_saved_bytes_->Increment(ptr_upload->chunk->length() -
+                                   chunk->length());
+  ptr_upload->chunk = chunk;
+  ptr_upload->compressed = true;
+}
+
+void HttpUploaderImpl::SpoolUpload(const PendingUpload& upload) {
+  if (!spool_enabled_ || !upload.chunk || upload.spooled ||
+      upload.priority == kManifestPriority) {
+    // A spooled manifest would replace a newer one when caught up.
+    return;
+  }
+  if (spool_.Append(upload.id, upload.url, *upload.chunk) == kSuccess) {
+    ptr_spooled_uploads_->Increment(1);
+    ptr_spool_bytes_->Set(spool_.size_bytes());
+  }
+}
+
+// Live uploads come first: the catch-up upload waits for |upload_queue_| to
+// empty, and one runs at a time. It does not count against
+// |max_pending_uploads|.
+bool HttpUploaderImpl::StartCatchUpUpload() {
+  if (!spool_enabled_ || catch_up_running_ || spool_.empty() ||
+      idle_transfers_.empty() || NowMilliseconds() < next_catch_up_ms_) {
+    return false;
+  }
+  {
+    WEBMLIVE_PROFILED_LOCK(lock, mutex_, "http_uploader");
+    if (stop_ || !upload_queue_.empty()) {
+      return false;
+    }
+  }
+  PendingUpload upload;
+  upload.spooled = true;
+  upload.media = false;
+  const int64 now = NowMilliseconds();
+  int status = spool_.ReadFront(&upload.id, &upload.url, &upload.chunk);
+  if (status) {
+    LOG(ERROR) << "cannot read upload spool, status=" << status;
+    next_catch_up_ms_ = now + settings_.retry_max_delay_ms;
+    return false;
+  }
+  if (!settings_.url_template.empty()) {
+    upload.url = ExpandUrlTemplate(upload.id);
+  }
+  upload.queued_ms = now;
+
+  HttpTransfer* const ptr_transfer = idle_transfers_.back();
+  LOG(INFO) << "catching up " << upload.id << ", " << spool_.num_records()
+            << " uploads spooled.";
+  status = StartUpload(ptr_transfer, upload);
+  if (status == kSuccess) {
+    const CURLMcode err =
+        curl_multi_add_handle(ptr_engine_->multi(), ptr_transfer->handle());
+    if (err != CURLM_OK) {
+      LOG_CURLM_ERR(err, "curl_multi_add_handle failed.");
+      ptr_transfer->Finish(CURLE_FAILED_INIT);
+      status = kLibCurlError;
+    }
+  }
+  if (status) {
+    LOG(ERROR) << "catch-up upload failed, status=" << status;
+    next_catch_up_ms_ = now + settings_.retry_max_delay_ms;
+    return false;
+  }
+  running_uploads_[ptr_transfer] = upload;
+  idle_transfers_.pop_back();
+  catch_up_running_ = true;
+  return true;
+}
+
+// Spaces catch-up uploads so that each chunk averages |catch_up_kbps| from
+// the start of its upload, and backs off after failures, which usually mean
+// the outage continues.
+void HttpUploaderImpl::FinishCatchUpUpload(const PendingUpload& upload,
+                                           bool succeeded) {
+  catch_up_running_ = false;
+  if (!succeeded) {
+    LOG(WARNING) << "catch-up upload of " << upload.id << " failed.";
+    next_catch_up_ms_ = NowMilliseconds() + settings_.retry_max_delay_ms;
+    return;
+  }
+  ptr_catch_up_uploads_->Increment(1);
+  spool_.PopFront();
+  ptr_spool_bytes_->Set(spool_.size_bytes());
+  next_catch_up_ms_ = upload.queued_ms;
+  if (settings_.catch_up_kbps > 0) {
+    next_catch_up_ms_ +=
+        upload.chunk->length() * 8 / settings_.catch_up_kbps;
+  }
+  if (spool_.empty()) {
+    LOG(INFO) << "upload spool drained.";
+  }
+}
+
+void HttpUploaderImpl::ResumePausedUploads() {
+  for (size_t i = 0; i < transfers_.size(); ++i) {
+    HttpTransfer* const ptr_transfer = transfers_[i].get();
+    if (ptr_transfer->ReadyToResume()) {
+      const CURLcode err =
+          curl_easy_pause(ptr_transfer->handle(), CURLPAUSE_CONT);
+      if (err != CURLE_OK) {
+        LOG_CURL_ERR(err, "curl_easy_pause(CURLPAUSE_CONT) failed.");
+      }
+    }
+  }
+}
+
+void HttpUploaderImpl::AbortUploads() {
+  for (size_t i = 0; i < transfers_.size(); ++i) {
+    HttpTransfer* const ptr_transfer = transfers_[i].get();
+    if (std::find(idle_transfers_.begin(), idle_transfers_.end(),
+                  ptr_transfer) != idle_transfers_.end()) {
+      continue;
+    }
+    curl_multi_remove_handle(ptr_engine_->multi(), ptr_transfer->handle());
+    ptr_transfer->Finish(CURLE_ABORTED_BY_CALLBACK);
+    const PendingUpload& upload = running_uploads_[ptr_transfer];
+    if (upload.bundle) {
+      EndUploads(upload, false, ptr_upload_failures_);
+    } else if (!upload.spooled && ClaimFailure(upload)) {
+      ptr_upload_failures_->Increment(1);
+      SpoolUpload(upload);
+    }
+    idle_transfers_.push_back(ptr_transfer);
+  }
+  running_uploads_.clear();
+  catch_up_running_ = false;
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "http_uploader");
+  if (spool_enabled_) {
+    // Keep the uploads that never started for the next run.
+    for (size_t i = 0; i < upload_queue_.size(); ++i) {
+      const PendingUpload& upload = upload_queue_[i];
+      if (upload.bundle) {
+        for (size_t j = 0; j < upload.bundle->size(); ++j) {
+          SpoolUpload((*upload.bundle)[j]);
+        }
+      } else if (ClaimFailure(upload)) {
+        SpoolUpload(upload);
+      }
+    }
+  }
+  active_uploads_ = 0;
+  UpdateQueueMetrics();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// HttpUploadEngineImpl
+//
+
+HttpUploadEngineImpl::HttpUploadEngineImpl()
+    : ptr_multi_(NULL),
+      stop_(false),
+      wake_pending_(false),
+      thread_running_(false) {
+}
+
+HttpUploadEngineImpl::~HttpUploadEngineImpl() {
+  if (ptr_multi_) {
+    curl_multi_cleanup(ptr_multi_);
+    ptr_multi_ = NULL;
+  }
+}
+
+int HttpUploadEngineImpl::Init(int max_connections, bool enable_http2) {
+  ptr_multi_ = curl_multi_init();
+  if (!ptr_multi_) {
+    LOG(ERROR) << "curl_multi_init failed!";
+    return HttpUploaderImpl::kLibCurlError;
+  }
+
+  const long max_connects = max_connections;  // NOLINT
+  CURLMcode multi_err =
+      curl_multi_setopt(ptr_multi_, CURLMOPT_MAXCONNECTS, max_connects);
+  if (multi_err != CURLM_OK) {
+    LOG_CURLM_ERR(multi_err, "setopt CURLMOPT_MAXCONNECTS failed.");
+    return HttpUploaderImpl::kLibCurlError;
+  }
+
+  if (enable_http2) {
+#ifdef CURLPIPE_MULTIPLEX
+    // Multiplex all uploads to a server over a single connection.
+    multi_err = curl_multi_setopt(ptr_multi_, CURLMOPT_PIPELINING,
+                                  CURLPIPE_MULTIPLEX);
+    if (multi_err != CURLM_OK) {
+      LOG_CURLM_ERR(multi_err, "setopt CURLMOPT_PIPELINING failed.");
+      return HttpUploaderImpl::kLibCurlError;
+    }
+#else
+    LOG(INFO) << "libcurl lacks HTTP/2 multiplexing; uploads share HTTP/2 "
+              << "connections only sequentially.";
+#endif
+  }
+  return HttpUploaderImpl::kSuccess;
+}
+
+// Run |UploadThread| using |std::thread|.
+int HttpUploadEngineImpl::Run() {
+  assert(!upload_thread_);
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = false;
+    thread_running_ = true;
+  }
+  upload_thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&HttpUploadEngineImpl::UploadThread,  // NOLINT
+                                this)));
+  if (!upload_thread_) {
+    LOG(ERROR) << "cannot construct upload thread.";
+    std::lock_guard<std::mutex> lock(mutex_);
+    thread_running_ = false;
+    return HttpUploader::kRunFailed;
+  }
+  return HttpUploaderImpl::kSuccess;
+}
+
+// Sets |stop_| and joins |UploadThread|, which aborts the uploads of every
+// uploader still using the engine.
+void HttpUploadEngineImpl::Stop() {
+  if (!upload_thread_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  upload_ready_.notify_all();
+  upload_thread_->join();
+  upload_thread_.reset();
+}
+
+void HttpUploadEngineImpl::AddUploader(HttpUploaderImpl* ptr_uploader) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uploaders_.push_back(ptr_uploader);
+    wake_pending_ = true;
+  }
+  upload_ready_.notify_one();
+}
+
+// Hands |ptr_uploader| to |UploadThread|, which aborts its uploads between
+// calls into libcurl. When the thread is not running no transfer can be
+// attached to |ptr_multi_|, and the uploader is simply forgotten.
+void HttpUploadEngineImpl::RemoveUploader(HttpUploaderImpl* ptr_uploader) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!thread_running_) {
+    uploaders_.erase(
+        std::remove(uploaders_.begin(), uploaders_.end(), ptr_uploader),
+        uploaders_.end());
+    return;
+  }
+  removals_.push_back(ptr_uploader);
+  upload_ready_.notify_one();
+  uploader_removed_.wait(lock, [this, ptr_uploader] {
+    return std::find(uploaders_.begin(), uploaders_.end(), ptr_uploader) ==
+        uploaders_.end();
+  });
+}
+
+void HttpUploadEngineImpl::Wake() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    wake_pending_ = true;
+  }
+  upload_ready_.notify_one();
+}
+
+bool HttpUploadEngineImpl::WakeRequested() const {
+  return stop_ || wake_pending_ || !removals_.empty();
+}
+
+void HttpUploadEngineImpl::ProcessRemovals() {
+  std::vector<HttpUploaderImpl*> removals;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    removals.swap(removals_);
+  }
+  if (removals.empty()) {
+    return;
+  }
+
+  // |mutex_| is not held while uploaders take their own mutexes.
+  for (size_t i = 0; i < removals.size(); ++i) {
+    removals[i]->AbortUploads();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < removals.size(); ++i) {
+      uploaders_.erase(
+          std::remove(uploaders_.begin(), uploaders_.end(), removals[i]),
+          uploaders_.end());
+    }
+  }
+  uploader_removed_.notify_all();
+}
+
+void HttpUploadEngineImpl::FinishCompletedUploads() {
+  int messages_left = 0;
+  CURLMsg* ptr_message = NULL;
+  while ((ptr_message = curl_multi_info_read(ptr_multi_, &messages_left))) {
+    if (ptr_message->msg != CURLMSG_DONE) {
+      continue;
+    }
+    CURL* const ptr_curl = ptr_message->easy_handle;
+    const CURLcode result = ptr_message->data.result;
+    HttpTransfer* ptr_transfer = NULL;
+    curl_easy_getinfo(ptr_curl, CURLINFO_PRIVATE, &ptr_transfer);
+    curl_multi_remove_handle(ptr_multi_, ptr_curl);
+    if (!ptr_transfer) {
+      LOG(ERROR) << "completed handle has no transfer.";
+      continue;
+    }
+    ptr_transfer->uploader()->FinishUpload(ptr_transfer, result);
+
+    // The transfer is free for a queued upload: look again before idling.
+    std::lock_guard<std::mutex> lock(mutex_);
+    wake_pending_ = true;
+  }
+}
+
+// Upload thread. Wakes when an uploader queues a chunk, and runs the
+// transfers of all uploaders until their uploads complete or |Stop| is
+// called.
+void HttpUploadEngineImpl::UploadThread() {
+  LOG(INFO) << "upload thread running...";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kUpload);
+  ScopedCpuStage cpu_stage(kCpuUpload);
+  int running_transfers = 0;
+  int64 next_retry_ms = 0;
+  std::vector<HttpUploaderImpl*> uploaders;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (running_transfers == 0 && next_retry_ms) {
+        // Idle until the earliest retry, or new user data.
+        const int64 delay_ms =
+            std::max<int64>(next_retry_ms - NowMilliseconds(), 0);
+        upload_ready_.wait_for(lock, std::chrono::milliseconds(delay_ms),
+                               [this] { return WakeRequested(); });
+      } else if (running_transfers == 0) {
+        // Idle: wait for user data.
+        LOG(INFO) << "upload thread waiting for buffer...";
+        upload_ready_.wait(lock, [this] { return WakeRequested(); });
+      }
+      if (stop_) {
+        break;
+      }
+      wake_pending_ = false;
+    }
+
+    ProcessRemovals();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      uploaders = uploaders_;
+    }
+    for (size_t i = 0; i < uploaders.size(); ++i) {
+      uploaders[i]->ApplyPacingRate();
+      uploaders[i]->StartQueuedUploads();
+      uploaders[i]->ResumePausedUploads();
+    }
+
+    CURLMcode err = curl_multi_perform(ptr_multi_, &running_transfers);
+    if (err != CURLM_OK) {
+      LOG_CURLM_ERR(err, "curl_multi_perform failed.");
+    }
+    FinishCompletedUploads();
+    next_retry_ms = 0;
+    for (size_t i = 0; i < uploaders.size(); ++i) {
+      const int64 retry_ms = uploaders[i]->NextRetryTime();
+      if (retry_ms && (!next_retry_ms || retry_ms < next_retry_ms)) {
+        next_retry_ms = retry_ms;
+      }
+    }
+    if (running_transfers == 0) {
+      continue;
+    }
+
+    int num_fds = 0;
+    err = curl_multi_wait(ptr_multi_, NULL, 0, kMaxTransferWaitMs, &num_fds);
+    if (err != CURLM_OK) {
+      LOG_CURLM_ERR(err, "curl_multi_wait failed.");
+    }
+    if (num_fds == 0) {
+      // libcurl had no sockets to wait on (for example while resolving): wait
+      // here instead of spinning, and wake early for new uploads.
+      std::unique_lock<std::mutex> lock(mutex_);
+      upload_ready_.wait_for(
+          lock, std::chrono::milliseconds(kMaxTransferWaitMs),
+          [this] { return WakeRequested(); });
+    }
+  }
+
+  // Uploaders stay in |uploaders_| until aborted so that |RemoveUploader|
+  // callers wait for them.
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uploaders = uploaders_;
+  }
+  for (size_t i = 0; i < uploaders.size(); ++i) {
+    uploaders[i]->AbortUploads();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uploaders_.clear();
+    removals_.clear();
+    thread_running_ = false;
   }
+  uploader_removed_.notify_all();
   LOG(INFO) << "thread done";
 }
 
@@ -16,12 +16,17 @@
 #include "encoder/basictypes.h"
 #include "encoder/data_sink.h"
 #include "encoder/encoder_base.h"
+#include "encoder/latency_tracer.h"
+#include "encoder/uplink_estimator.h"
 
 namespace webmlive {
 
 enum UploadMode {
   HTTP_POST = 0,
   HTTP_FORM_POST = 1,
+  // Each chunk is PUT as an object of its own, as S3 compatible object stores
+  // take them; see |HttpUploaderSettings::url_template|.
+  HTTP_PUT = 2,
 };
 
 struct HttpUploaderSettings {
@@ -29,6 +34,41 @@ struct HttpUploaderSettings {
   // map<std::string,std::string>.
   typedef std::map<std::string, std::string> StringMap;
 
+  // A few transfers at once keep one slow upload from holding up the chunks
+  // queued behind it. Servers that require uploads in order need
+  // |max_concurrent_uploads| set to 1.
+  static const int kDefaultMaxConcurrentUploads = 4;
+  static const int kDefaultMaxPendingUploads = 8;
+  static const int kDefaultMaxUploadRetries = 4;
+  static const int kDefaultRetryMinDelayMs = 250;
+  static const int kDefaultRetryMaxDelayMs = 4000;
+  static const int64 kDefaultSpoolMaxBytes = 1024 * 1024 * 1024;
+  // Smallest part of an S3 multipart upload, save for the last one.
+  static const int64 kMinMultipartPartBytes = 5 * 1024 * 1024;
+  static const int kDefaultCoalesceMaxObjects = 8;
+
+  HttpUploaderSettings()
+      : post_mode(HTTP_POST),
+        max_concurrent_uploads(kDefaultMaxConcurrentUploads),
+        max_pending_uploads(kDefaultMaxPendingUploads),
+        enable_http2(false),
+        enable_http3(false),
+        max_upload_retries(kDefaultMaxUploadRetries),
+        retry_min_delay_ms(kDefaultRetryMinDelayMs),
+        retry_max_delay_ms(kDefaultRetryMaxDelayMs),
+        chunk_deadline_ms(0),
+        resume_uploads(false),
+        pacing_kbps(0),
+        segment_duration_ms(0),
+        live_window_ms(0),
+        spool_max_bytes(kDefaultSpoolMaxBytes),
+        catch_up_kbps(0),
+        gzip_manifests(false),
+        multipart_threshold_bytes(0),
+        multipart_part_bytes(kMinMultipartPartBytes),
+        coalesce_max_bytes(0),
+        coalesce_max_objects(kDefaultCoalesceMaxObjects) {}
+
   // |local_file| is what the HTTP server sees as the local file name.
   // Assigning a path to a local file and passing the settings struct to
   // |HttpUploader::Init| will not upload an existing file.
@@ -48,29 +88,241 @@ struct HttpUploaderSettings {
 
   // Post mode
   UploadMode post_mode;
+
+  // Number of uploads performed at the same time. All uploads run on one
+  // thread, and connections are reused between uploads.
+  int max_concurrent_uploads;
+
+  // Maximum number of uploads queued or in progress. |HttpUploader::Ready()|
+  // returns false while the limit is reached. Must be at least
+  // |max_concurrent_uploads|.
+  int max_pending_uploads;
+
+  // Requests HTTP/2. Uploads fall back to HTTP/1.1 when libcurl lacks HTTP/2
+  // support or the server does not negotiate it. When libcurl supports
+  // multiplexing, all uploads to a server share one connection.
+  bool enable_http2;
+
+  // Requests HTTP/3 over QUIC, which keeps a lost packet from stalling the
+  // rest of the upload on lossy links. Uploads fall back to HTTP/2, and then
+  // HTTP/1.1, when libcurl lacks HTTP/3 support or the server or network
+  // refuses QUIC. Implies |enable_http2|.
+  bool enable_http3;
+
+  // Number of times a failed upload is retried: after libcurl errors, and
+  // after 408, 429 and 5xx responses. Retries wait for a jittered delay that
+  // doubles with each attempt, from |retry_min_delay_ms| up to
+  // |retry_max_delay_ms|, and go ahead of the uploads queued since.
+  int max_upload_retries;
+  int retry_min_delay_ms;
+  int retry_max_delay_ms;
+
+  // Milliseconds after it is queued at which an upload is dropped instead of
+  // started or retried. 0 disables the deadline.
+  int chunk_deadline_ms;
+
+  // Resumes retried |HTTP_POST| uploads of large chunks where the server
+  // stopped: when a response carries a "Range: bytes=0-<last>" header, the
+  // retry sends the rest of the chunk with a matching Content-Range header.
+  // Requires a server that accepts partial uploads.
+  bool resume_uploads;
+
+  // Upload rate limit in kilobits per second, shared by the uploader's
+  // transfers. Chunks larger than the short burst allowance are sent at this
+  // rate instead of at once, which keeps keyframe clusters from flooding
+  // shared uplinks. 0 disables pacing. Set it above the stream bitrate, or
+  // the upload queue grows without bound.
+  int pacing_kbps;
+
+  // Media duration of each uploaded media segment, in milliseconds, from
+  // which |UplinkEstimate::upload_ratio| is measured. 0 when unknown.
+  int segment_duration_ms;
+
+  // Per upload URL. When set, each upload goes to |url_template| with
+  // "{id}" replaced by the chunk id passed to the |DataSinkInterface|
+  // methods, and "{stream_id}" and "{stream_name}" replaced by the settings
+  // of the same name, for example "https://origin/{stream_name}/{id}".
+  // Replacements are percent-encoded. URLs passed to
+  // |HttpUploader::EnqueueTargetUrl| are ignored. Required by |HTTP_PUT|
+  // mode, where the URL names the object, for example
+  // "https://bucket.s3.us-east-1.amazonaws.com/{stream_name}/{id}".
+  std::string url_template;
+
+  // Age in milliseconds past which queued media segments are dropped instead
+  // of uploaded: segments older than the player's live window are never
+  // played, and skipping them returns the uploader to the live edge after an
+  // outage. Manifests and initialization segments are never dropped. 0
+  // disables dropping.
+  int live_window_ms;
+
+  // Directory, ending with a path separator, of the spool holding chunk
+  // uploads that could not be sent: uploads out of retries, past their
+  // deadline, dropped from the live window, or still pending at |Stop|.
+  // Spooled chunks are uploaded again, oldest first, by a catch-up upload
+  // that runs only while no live upload is waiting, and the spool carries
+  // over to the next run of the uploader. Manifests and streaming chunks are
+  // never spooled. Empty disables the spool.
+  std::string spool_directory;
+
+  // Maximum size of the spool. Uploads that do not fit are dropped.
+  int64 spool_max_bytes;
+
+  // Rate limit of the catch-up upload in kilobits per second, averaged over
+  // each spooled chunk. 0 uploads spooled chunks back to back.
+  int catch_up_kbps;
+
+  // Compresses manifest uploads with gzip and marks them with a
+  // "Content-Encoding: gzip" header. Manifests with long segment timelines
+  // shrink by an order of magnitude. Requires |HTTP_POST| mode and a server
+  // that decodes the request body, or |HTTP_PUT| mode, where the store keeps
+  // the header for the players fetching the manifest, and a build with
+  // WEBMLIVE_ENABLE_ZLIB; manifests are sent uncompressed otherwise.
+  bool gzip_manifests;
+
+  // Signs |HTTP_PUT| requests with AWS Signature Version 4 when set to a
+  // libcurl provider string, "aws:amz:<region>:s3" for S3 and for stores
+  // accepting S3 signatures such as GCS with HMAC keys. |aws_credentials|
+  // holds "<access key id>:<secret access key>". Payloads are sent
+  // unsigned, which keeps chunks streaming from memory. Requires libcurl
+  // 7.86 or later.
+  std::string aws_sigv4;
+  std::string aws_credentials;
+
+  // |HTTP_PUT| chunks of |multipart_threshold_bytes| or more, keyframe heavy
+  // segments of high bitrate streams, are sent as S3 multipart uploads of
+  // |multipart_part_bytes| parts. The parts run in parallel on the
+  // uploader's transfers, and a failed part is retried alone. 0 disables
+  // multipart uploads. Parts must be at least |kMinMultipartPartBytes|.
+  // Uploads aborted by |HttpUploader::Stop()| leave their parts on the
+  // store, which a bucket lifecycle rule should clean up.
+  int64 multipart_threshold_bytes;
+  int64 multipart_part_bytes;
+
+  // Sends small uploads together: queued chunks of |coalesce_max_bytes| or
+  // less that are ready to start at once, such as the audio segments of
+  // several representations and the manifest following them, go out as one
+  // bundle of up to |coalesce_max_objects| chunks. The bundle is POSTed to
+  // the URL of its first chunk with a
+  // "Content-Type: application/x-webmlive-bundle" header, and its body holds
+  // each chunk in turn as
+  //   "<id> <length> <encoding>\r\n<length bytes of data>\r\n"
+  // where <id> is the chunk id, <length> the decimal size of the data, and
+  // <encoding> "gzip" for manifests compressed by |gzip_manifests|, or
+  // "identity". The server stores each chunk as if uploaded on its own, and
+  // answers for the whole bundle. A failed bundle is retried whole, and once
+  // out of retries its chunks are dropped, and spooled, one by one. Requires
+  // |HTTP_POST| mode and |url_template|, whose URLs name the stream. 0
+  // disables coalescing.
+  int coalesce_max_bytes;
+  int coalesce_max_objects;
+
+  // Labels added to the uploader's metrics, in |MetricsRegistry| label
+  // syntax. Distinguishes the uploaders of a process running several
+  // streams.
+  std::string metrics_labels;
 };
 
 struct HttpUploaderStats {
+  HttpUploaderStats()
+      : bytes_per_second(0),
+        current_bytes_per_second(0),
+        pacing_bytes_per_second(0),
+        bytes_sent_current(0),
+        total_bytes_uploaded(0),
+        completed_uploads(0),
+        failed_uploads(0) {}
+
   // Upload average bytes per second.
   double bytes_per_second;
 
+  // Send rate measured over the last second, and the pacing rate limit; 0
+  // when |HttpUploaderSettings::pacing_kbps| is 0.
+  double current_bytes_per_second;
+  int64 pacing_bytes_per_second;
+
   // Bytes sent for current upload.
   int64 bytes_sent_current;
 
   // Total number of bytes uploaded.
   int64 total_bytes_uploaded;
+
+  // Uploads completed, and uploads dropped after their last retry.
+  int64 completed_uploads;
+  int64 failed_uploads;
+
+  // Time from queueing to completion of each completed upload, retries
+  // included.
+  LatencyHistogram upload_latency;
+
+  // Uplink capacity measured from completed uploads and queue growth; see
+  // |UplinkEstimator|.
+  UplinkEstimate uplink;
 };
 
+class HttpUploadEngineImpl;
 class HttpUploaderImpl;
 
+// Runs the transfers of any number of |HttpUploader|s on one thread through
+// one libcurl multi handle, so that the streams of a process share their
+// upload thread and connection cache. An uploader initialized without an
+// engine runs its own.
+//
+// Notes:
+// - |Init| and |Run| must be called before uploaders using the engine are
+//   run, and the engine must outlive them.
+// - |Stop| aborts the uploads of any uploader still using the engine.
+class HttpUploadEngine {
+ public:
+  enum {
+    kInvalidArg = -303,
+    kInitFailed = -302,
+    kRunFailed = -301,
+    kSuccess = 0,
+  };
+  HttpUploadEngine();
+  ~HttpUploadEngine();
+
+  // Creates the multi handle. |max_connections| connections are kept open
+  // for reuse; the sum of the uploaders' |max_concurrent_uploads| keeps one
+  // per transfer. |enable_http2| multiplexes HTTP/2 and HTTP/3 uploads to a
+  // server over one connection. Returns |kSuccess| when successful.
+  int Init(int max_connections, bool enable_http2);
+
+  // Runs the upload thread.
+  int Run();
+
+  // Stops the upload thread.
+  int Stop();
+
+ private:
+  friend class HttpUploader;
+  std::unique_ptr<HttpUploadEngineImpl> ptr_engine_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(HttpUploadEngine);
+};
+
 // Pimpl idiom based HTTP uploader that hides the gory details of libcurl from
 // users of the uploader.
 //
 // Notes:
 // - |Init| must be called before any other method.
-// - |EnqueueTargetUrl| must be used to control target for HTTP requests. URLs
-//   enqueued are used in sequence, and only removed from the queue after
-//   successful uploads.
+// - |EnqueueTargetUrl| must be used to control target for HTTP requests
+//   unless |HttpUploaderSettings::url_template| is set. URLs enqueued are used
+//   in sequence, one per upload, and the last URL is reused once the queue is
+//   empty.
+// - Uploads are queued, and up to |max_concurrent_uploads| of them run at the
+//   same time. Uploads may complete out of order when more than one runs at
+//   once.
+// - Queued uploads are ordered by the kind of chunk their id names: DASH
+//   manifests go first, then initialization segments, audio, and video.
+//   Uploads of one kind keep their order.
+// - All uploaders in the process share DNS and TLS session caches, and keep
+//   their connections alive with TCP keep-alive probes.
+// - In |HTTP_PUT| mode the uploader writes straight to an S3 compatible
+//   object store, with no ingest server in between: each chunk is stored as
+//   the object its templated URL names, with the content type of its kind,
+//   and large chunks are sent as multipart uploads.
+// - Small chunks may be sent together in one request; see
+//   |HttpUploaderSettings::coalesce_max_bytes|.
 class HttpUploader : public DataSinkInterface {
  public:
   enum {
@@ -101,37 +353,83 @@ class HttpUploader : public DataSinkInterface {
   HttpUploader();
   virtual ~HttpUploader();
 
-  // Tests for upload completion. Returns true when the uploader is ready to
-  // start an upload. Always returns true when no uploads have been attempted.
+  // Tests for room in the upload queue. Returns true when the uploader is
+  // ready to accept an upload. Always returns true when no uploads have been
+  // attempted. Takes no locks.
   bool UploadComplete() const;
 
+  // Blocks for up to |timeout_ms| milliseconds waiting for an upload to
+  // complete. Returns true when the uploader is ready to accept an upload.
+  bool WaitForUploadComplete(int32 timeout_ms) const;
+
   // Constructs |HttpUploaderImpl|, which copies |settings|. Returns |kSuccess|
   // upon success.
   int Init(const HttpUploaderSettings& settings);
 
-  // Returns the current upload stats. Note, obtains lock before copying stats
-  // to |ptr_stats|.
+  // As above, but runs uploads on |ptr_engine| instead of a thread of the
+  // uploader's own. |ptr_engine| must be running when |Run| is called.
+  int Init(const HttpUploaderSettings& settings,
+           HttpUploadEngine* ptr_engine);
+
+  // Returns the current upload stats. Never waits for the upload thread; the
+  // stats are those it last published.
   int GetStats(HttpUploaderStats* ptr_stats);
 
-  // Runs the uploader thread.
+  // Runs the uploader thread, or starts running uploads on the engine.
   int Run();
 
-  // Stops the uploader thread.
+  // Stops the uploader thread, or stops using the engine. Uploads in
+  // progress are aborted.
   int Stop();
 
-  // Sends a buffer to the uploader thread using an URL from |url_queue_|. Use
-  // |EnqueueTargetUrl| to set target URLs.
-  int UploadBuffer(const uint8* ptr_buffer, int32 length);
+  // Queues a copy of a buffer for upload using an URL from |url_queue_|, or
+  // the URL template expanded for chunk |id|. Use |EnqueueTargetUrl| to set
+  // target URLs.
+  int UploadBuffer(const uint8* ptr_buffer, int32 length,
+                   const std::string& id);
+
+  // Queues |chunk| for upload like |UploadBuffer|. The uploader keeps a
+  // reference to |chunk| until the upload completes, and sends the chunk data
+  // without copying it.
+  int UploadChunk(const SharedDataChunk& chunk, const std::string& id);
+
+  // Queues |chunk| for a chunked transfer encoding upload that sends data as
+  // it is appended to |chunk|, and completes when |chunk| is finished. Returns
+  // |kInvalidArg| in |HTTP_FORM_POST| and |HTTP_PUT| modes, which require the
+  // upload size.
+  int UploadStreamingChunk(const SharedStreamingChunk& chunk,
+                           const std::string& id);
 
   // Calls |HttpUploaderImpl::EnqueueTargetUrl| to enqueue |target_url|.
   void EnqueueTargetUrl(const std::string& target_url);
 
+  // Changes |HttpUploaderSettings::pacing_kbps| while running; 0 disables
+  // pacing. The upload thread applies the rate before its next transfers.
+  // May be called from any thread.
+  void SetPacingRate(int kbps);
+
   // DataSinkInterface methods.
   virtual bool Ready() const { return UploadComplete(); }
+  virtual bool WaitUntilReady(int32 timeout_ms) const {
+    return WaitForUploadComplete(timeout_ms);
+  }
   virtual bool WriteData(const uint8* ptr_buffer, int32 length,
-                         const std::string& /*id*/) {
-    return (UploadBuffer(ptr_buffer, length) == kSuccess);
+                         const std::string& id) {
+    return (UploadBuffer(ptr_buffer, length, id) == kSuccess);
+  }
+  virtual bool WriteChunk(const SharedDataChunk& chunk,
+                          const std::string& id) {
+    return (UploadChunk(chunk, id) == kSuccess);
   }
+  virtual bool WriteStreamingChunk(const SharedStreamingChunk& chunk,
+                                   const std::string& id) {
+    return (UploadStreamingChunk(chunk, id) == kSuccess);
+  }
+
+  // Waits for the queued and active uploads to end, retries included, and
+  // returns the number left. |Stop()| aborts them, and spools those the
+  // spool directory accepts.
+  virtual int Drain(int32 timeout_ms);
 
  private:
   // Pointer to uploader implementation.
@@ -0,0 +1,814 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/ingest_server.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <sstream>
+
+#include "encoder/socket_util.h"
+#include "encoder/time_util.h"
+#include "encoder/webm_buffer_parser.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Interval at which blocked threads check for |Stop()|.
+const int kPollMs = 100;
+
+// Connections idle this long are closed.
+const int kIdleTimeoutMs = 30000;
+
+// Largest request header, and chunk size line, accepted.
+const size_t kMaxRequestBytes = 8 * 1024;
+
+const char kHeaderEnd[] = "\r\n\r\n";
+const char kLineEnd[] = "\r\n";
+const char kFormName[] = "webm_file";
+const char kBundleContentType[] = "application/x-webmlive-bundle";
+const char kManifestSuffix[] = ".mpd";
+const char kPatchSuffix[] = ".mpp";
+const char kHeaderSuffix[] = ".hdr";
+const char kChunkSuffix[] = ".chk";
+
+// EBML header ID, which begins header chunks.
+const uint8 kEbmlId[] = {0x1A, 0x45, 0xDF, 0xA3};
+
+// Cluster of unknown size appended to media chunks: |WebmBufferParser| ends
+// the unknown size cluster that closes a live chunk at the next top level
+// element.
+const uint8 kClusterSentinel[] = {0x1F, 0x43, 0xB6, 0x75, 0xFF};
+
+// Returns the value of parameter |name| in the query string |query|, or an
+// empty string when it is missing.
+std::string QueryValue(const std::string& query, const std::string& name) {
+  size_t pos = 0;
+  while (pos < query.size()) {
+    size_t end = query.find('&', pos);
+    if (end == std::string::npos) {
+      end = query.size();
+    }
+    const std::string param = query.substr(pos, end - pos);
+    if (param.compare(0, name.size() + 1, name + "=") == 0) {
+      return param.substr(name.size() + 1);
+    }
+    pos = end + 1;
+  }
+  return std::string();
+}
+
+// Returns the representation part of chunk id |id|: "<name>_<rep>" for the
+// DASH ids "<name>_<rep>.hdr" and "<name>_<rep>_<n>.chk", and an empty
+// string for other ids, whose stream has a single header.
+std::string RepresentationKey(const std::string& id) {
+  if (HasSuffix(id, kHeaderSuffix)) {
+    return id.substr(0, id.size() - strlen(kHeaderSuffix));
+  }
+  if (HasSuffix(id, kChunkSuffix)) {
+    const size_t pos = id.rfind('_');
+    if (pos != std::string::npos) {
+      return id.substr(0, pos);
+    }
+  }
+  return std::string();
+}
+
+// Returns |name| with characters other than letters, digits, '.', '-' and
+// '_' replaced by '_', for use in file names.
+std::string FileNamePart(const std::string& name) {
+  std::string part = name;
+  for (size_t i = 0; i < part.size(); ++i) {
+    const unsigned char c = static_cast<unsigned char>(part[i]);
+    if (!isalnum(c) && c != '.' && c != '-' && c != '_') {
+      part[i] = '_';
+    }
+  }
+  return part;
+}
+
+// Replaces |ptr_body| with the "webm_file" part of the multipart form it
+// holds, whose parts are delimited by |boundary|. Returns false when the part
+// is missing.
+bool ExtractFormFile(const std::string& boundary, std::string* ptr_body) {
+  const std::string delimiter = "--" + boundary;
+  size_t pos = ptr_body->find(delimiter);
+  while (pos != std::string::npos) {
+    const size_t headers_begin = pos + delimiter.size();
+    const size_t headers_end = ptr_body->find(kHeaderEnd, headers_begin);
+    if (headers_end == std::string::npos) {
+      return false;
+    }
+    const size_t data_begin = headers_end + strlen(kHeaderEnd);
+    const size_t next = ptr_body->find(kLineEnd + delimiter, data_begin);
+    if (next == std::string::npos) {
+      return false;
+    }
+    const std::string headers =
+        ptr_body->substr(headers_begin, headers_end - headers_begin);
+    if (headers.find(std::string("name=\"") + kFormName + "\"") !=
+        std::string::npos) {
+      *ptr_body = ptr_body->substr(data_begin, next - data_begin);
+      return true;
+    }
+    pos = next + strlen(kLineEnd);
+  }
+  return false;
+}
+
+// Returns true when |body| begins with an XML document, as manifests do.
+bool IsManifest(const std::string& body) {
+  const size_t pos = body.find_first_not_of(" \t\r\n");
+  return pos != std::string::npos && body[pos] == '<';
+}
+
+bool IsHeaderChunk(const std::string& body) {
+  return body.size() >= sizeof(kEbmlId) &&
+         memcmp(body.data(), kEbmlId, sizeof(kEbmlId)) == 0;
+}
+
+// Parses |header| and |chunk| with a |WebmBufferParser|. Returns true when
+// |header| holds the segment headers and |chunk| one or more whole elements,
+// such as clusters. An empty |chunk| checks only the header.
+bool ValidateChunk(const std::vector<uint8>& header,
+                   const std::string& chunk) {
+  WebmBufferParser parser;
+  if (parser.Init()) {
+    return false;
+  }
+  WebmBufferParser::Buffer buffer;
+  buffer.reserve(header.size() + chunk.size() + sizeof(kClusterSentinel));
+  buffer.insert(buffer.end(), header.begin(), header.end());
+  buffer.insert(buffer.end(), chunk.begin(), chunk.end());
+  buffer.insert(buffer.end(), kClusterSentinel,
+                kClusterSentinel + sizeof(kClusterSentinel));
+
+  int32 element_size = 0;
+  if (parser.Parse(buffer, &element_size) != WebmBufferParser::kSuccess ||
+      element_size > static_cast<int32>(header.size())) {
+    return false;
+  }
+  buffer.erase(buffer.begin(), buffer.begin() + element_size);
+  int elements = 0;
+  while (buffer.size() > sizeof(kClusterSentinel)) {
+    if (parser.Parse(buffer, &element_size) != WebmBufferParser::kSuccess ||
+        element_size <= 0) {
+      return false;
+    }
+    buffer.erase(buffer.begin(), buffer.begin() + element_size);
+    ++elements;
+  }
+  return buffer.size() == sizeof(kClusterSentinel) &&
+         (chunk.empty() || elements > 0);
+}
+}  // namespace
+
+std::string IngestStreamStats::ToString() const {
+  const int64 duration_ms = last_upload_ms - first_upload_ms;
+  std::ostringstream out;
+  out << name << ": uploads=" << uploads << " manifests=" << manifests
+      << " headers=" << headers << " chunks=" << chunks
+      << " invalid=" << invalid_chunks << " unvalidated="
+      << unvalidated_chunks << " failed=" << failed_uploads
+      << " bundles=" << bundles << " bytes=" << bytes;
+  if (duration_ms > 0) {
+    out << " kbps=" << bytes * 8 / duration_ms;
+  }
+  if (receive_time.count > 0) {
+    out << " receive_mean_ms="
+        << receive_time.total_us / receive_time.count / 1000.0
+        << " receive_p50<=" << receive_time.Percentile(50) << "ms"
+        << " receive_p99<=" << receive_time.Percentile(99) << "ms"
+        << " receive_max_ms=" << receive_time.max_us / 1000.0;
+  }
+  return out.str();
+}
+
+struct IngestServer::Connection {
+  Connection() : socket(kInvalidSocket), done(false), request_start_us(0) {}
+  NativeSocket socket;
+  std::unique_ptr<std::thread> thread;
+  std::atomic<bool> done;
+
+  // Received bytes not yet consumed by a request, and the time the first of
+  // them arrived.
+  std::string buffer;
+  int64 request_start_us;
+};
+
+struct IngestServer::Upload {
+  Upload()
+      : metadata(false), compressed(false), resumed(false), start_us(0) {}
+
+  // Stream name, and chunk id when the URL carries one.
+  std::string stream;
+  std::string id;
+
+  // Set from the query string of the encoder's first upload.
+  bool metadata;
+
+  // Content-Encoding and Content-Range headers were present.
+  bool compressed;
+  bool resumed;
+
+  int64 start_us;
+  std::string body;
+};
+
+IngestServer::IngestServer()
+    : stop_(true),
+      listen_socket_(static_cast<SocketHandle>(kInvalidSocket)),
+      files_written_(0),
+      writing_files_(false) {
+}
+
+IngestServer::~IngestServer() {
+  Stop();
+}
+
+int IngestServer::Init(const IngestServerSettings& settings) {
+  if (settings.port < 0 || settings.port > 65535 ||
+      settings.max_clients < 1 || settings.max_upload_bytes < 1) {
+    LOG(ERROR) << "invalid ingest settings, port=" << settings.port
+               << " max_clients=" << settings.max_clients
+               << " max_upload_bytes=" << settings.max_upload_bytes;
+    return kInvalidArg;
+  }
+  settings_ = settings;
+  if (!settings_.output_dir.empty()) {
+    FileDataSinkSettings sink_settings;
+    sink_settings.directory = settings_.output_dir;
+    if (!HasSuffix(sink_settings.directory, "/") &&
+        !HasSuffix(sink_settings.directory, "\\")) {
+      sink_settings.directory += "/";
+    }
+    if (file_sink_.Init(sink_settings) || file_sink_.Run()) {
+      LOG(ERROR) << "cannot start ingest file writer.";
+      return kThreadError;
+    }
+    writing_files_ = true;
+  }
+  return kSuccess;
+}
+
+int IngestServer::Run() {
+  if (listen_thread_) {
+    return kInvalidArg;
+  }
+  if (!StartupSockets()) {
+    LOG(ERROR) << "cannot initialize sockets.";
+    return kSocketError;
+  }
+  const NativeSocket listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_socket == kInvalidSocket) {
+    LOG(ERROR) << "cannot create ingest socket.";
+    return kSocketError;
+  }
+  listen_socket_ = static_cast<SocketHandle>(listen_socket);
+  const int reuse = 1;
+  setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR,
+             reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(static_cast<uint16>(settings_.port));
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (!settings_.bind_address.empty() &&
+      inet_pton(AF_INET, settings_.bind_address.c_str(),
+                &address.sin_addr) != 1) {
+    LOG(ERROR) << "invalid ingest bind address " << settings_.bind_address;
+    Stop();
+    return kInvalidArg;
+  }
+  if (bind(listen_socket, reinterpret_cast<const sockaddr*>(&address),
+           sizeof(address)) ||
+      listen(listen_socket, SOMAXCONN)) {
+    LOG(ERROR) << "cannot listen on ingest port " << settings_.port;
+    Stop();
+    return kSocketError;
+  }
+
+  stop_ = false;
+  listen_thread_.reset(new (std::nothrow) std::thread(  // NOLINT
+      std::bind(&IngestServer::ListenThread, this)));
+  if (!listen_thread_) {
+    LOG(ERROR) << "cannot start ingest listening thread.";
+    Stop();
+    return kThreadError;
+  }
+  LOG(INFO) << "ingest server listening on port " << settings_.port;
+  return kSuccess;
+}
+
+void IngestServer::Stop() {
+  stop_ = true;
+  if (listen_thread_) {
+    listen_thread_->join();
+    listen_thread_.reset();
+  }
+  ReapConnections(true);
+  const NativeSocket listen_socket = static_cast<NativeSocket>(listen_socket_);
+  if (listen_socket != kInvalidSocket) {
+    CloseSocket(listen_socket);
+    listen_socket_ = static_cast<SocketHandle>(kInvalidSocket);
+    CleanupSockets();
+  }
+  if (writing_files_) {
+    file_sink_.Stop();
+    writing_files_ = false;
+  }
+}
+
+std::vector<IngestStreamStats> IngestServer::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<IngestStreamStats> stats;
+  for (std::map<std::string, IngestStreamStats>::const_iterator it =
+           streams_.begin();
+       it != streams_.end(); ++it) {
+    stats.push_back(it->second);
+  }
+  return stats;
+}
+
+void IngestServer::ListenThread() {
+  const NativeSocket listen_socket = static_cast<NativeSocket>(listen_socket_);
+  while (!stop_) {
+    ReapConnections(false);
+    if (!WaitReadable(listen_socket, kPollMs)) {
+      continue;
+    }
+    const NativeSocket client = accept(listen_socket, NULL, NULL);
+    if (client == kInvalidSocket) {
+      continue;
+    }
+    if (connections_.size() >= static_cast<size_t>(settings_.max_clients)) {
+      LOG(WARNING) << "ingest connection limit reached, refusing client.";
+      const char kResponse[] =
+          "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n"
+          "Connection: close\r\n\r\n";
+      SendAll(client, kResponse, strlen(kResponse));
+      CloseSocket(client);
+      continue;
+    }
+
+    std::unique_ptr<Connection> connection(
+        new (std::nothrow) Connection());  // NOLINT
+    if (!connection) {
+      CloseSocket(client);
+      continue;
+    }
+    connection->socket = client;
+    Connection* const ptr_connection = connection.get();
+    connection->thread.reset(new (std::nothrow) std::thread(  // NOLINT
+        std::bind(&IngestServer::ConnectionThread, this, ptr_connection)));
+    if (!connection->thread) {
+      LOG(ERROR) << "cannot start ingest connection thread.";
+      CloseSocket(client);
+      continue;
+    }
+    connections_.push_back(std::move(connection));
+  }
+}
+
+void IngestServer::ConnectionThread(Connection* ptr_connection) {
+  while (!stop_) {
+    const size_t header_end = ptr_connection->buffer.find(kHeaderEnd);
+    if (header_end != std::string::npos) {
+      const std::string request =
+          ptr_connection->buffer.substr(0, header_end);
+      ptr_connection->buffer.erase(0, header_end + strlen(kHeaderEnd));
+      if (!ServeRequest(ptr_connection, request)) {
+        break;
+      }
+      // Bytes left belong to the next request of a pipelining client.
+      ptr_connection->request_start_us = SteadyClockMicroseconds();
+      continue;
+    }
+    if (ptr_connection->buffer.size() > kMaxRequestBytes) {
+      LOG(WARNING) << "ingest request header too large, closing connection.";
+      break;
+    }
+    if (!Receive(ptr_connection)) {
+      break;
+    }
+  }
+  CloseSocket(ptr_connection->socket);
+  ptr_connection->socket = kInvalidSocket;
+  ptr_connection->done = true;
+}
+
+bool IngestServer::ServeRequest(Connection* ptr_connection,
+                                const std::string& request) {
+  Upload upload;
+  upload.start_us = ptr_connection->request_start_us;
+
+  // Request line: "<method> <target> <version>".
+  const size_t line_end = request.find(kLineEnd);
+  const std::string request_line = request.substr(0, line_end);
+  const size_t target_pos = request_line.find(' ');
+  const size_t version_pos = request_line.find(' ', target_pos + 1);
+  if (target_pos == std::string::npos || version_pos == std::string::npos) {
+    const char kResponse[] =
+        "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n"
+        "Connection: close\r\n\r\n";
+    Send(ptr_connection, kResponse, strlen(kResponse));
+    return false;
+  }
+  const std::string method = request_line.substr(0, target_pos);
+  const std::string target =
+      request_line.substr(target_pos + 1, version_pos - target_pos - 1);
+  const bool http11 = request_line.compare(version_pos + 1,
+                                           std::string::npos,
+                                           "HTTP/1.1") == 0;
+  const std::string lower_request = ToLower(request);
+  bool keep_alive = http11;
+  const std::string connection =
+      ToLower(HeaderValue(request, lower_request, "connection"));
+  if (connection == "close") {
+    keep_alive = false;
+  } else if (connection == "keep-alive") {
+    keep_alive = true;
+  }
+
+  if (method != "POST" && method != "PUT") {
+    const char kResponse[] =
+        "HTTP/1.1 405 Method Not Allowed\r\nContent-Length: 0\r\n"
+        "Connection: close\r\n\r\n";
+    Send(ptr_connection, kResponse, strlen(kResponse));
+    return false;
+  }
+
+  // Query string URLs name the stream with "ns"; templated URLs end with the
+  // chunk id, after the stream's path.
+  const size_t query_pos = target.find('?');
+  const std::string path = target.substr(0, query_pos);
+  const std::string query = (query_pos == std::string::npos) ?
+      std::string() : target.substr(query_pos + 1);
+  upload.stream = QueryValue(query, "ns");
+  upload.metadata = (QueryValue(query, "metadata") == "1");
+  if (upload.stream.empty()) {
+    const size_t id_pos = path.rfind('/');
+    upload.id = path.substr(id_pos + 1);
+    const size_t name_begin = path.find_first_not_of('/');
+    upload.stream = (name_begin == std::string::npos || id_pos <= name_begin) ?
+        std::string("/") : path.substr(name_begin, id_pos - name_begin);
+  }
+  upload.compressed =
+      !HeaderValue(request, lower_request, "content-encoding").empty();
+  upload.resumed =
+      !HeaderValue(request, lower_request, "content-range").empty();
+
+  // libcurl waits for this before sending large bodies.
+  if (ToLower(HeaderValue(request, lower_request, "expect")) ==
+      "100-continue") {
+    const char kContinue[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    if (!Send(ptr_connection, kContinue, strlen(kContinue))) {
+      CountFailure(upload.stream);
+      return false;
+    }
+  }
+
+  const std::string content_length =
+      HeaderValue(request, lower_request, "content-length");
+  const bool chunked =
+      ToLower(HeaderValue(request, lower_request, "transfer-encoding")) ==
+      "chunked";
+  int64 length = 0;
+  if (!chunked) {
+    char* ptr_end = NULL;
+    length = strtoll(content_length.c_str(), &ptr_end, 10);
+    if (content_length.empty() || *ptr_end != '\0' || length < 0) {
+      const char kResponse[] =
+          "HTTP/1.1 411 Length Required\r\nContent-Length: 0\r\n"
+          "Connection: close\r\n\r\n";
+      Send(ptr_connection, kResponse, strlen(kResponse));
+      CountFailure(upload.stream);
+      return false;
+    }
+  }
+  if (length > settings_.max_upload_bytes) {
+    const char kResponse[] =
+        "HTTP/1.1 413 Payload Too Large\r\nContent-Length: 0\r\n"
+        "Connection: close\r\n\r\n";
+    Send(ptr_connection, kResponse, strlen(kResponse));
+    CountFailure(upload.stream);
+    return false;
+  }
+  if (chunked) {
+    if (!ReadBody(ptr_connection, &upload)) {
+      CountFailure(upload.stream);
+      return false;
+    }
+  } else {
+    while (static_cast<int64>(ptr_connection->buffer.size()) < length) {
+      if (!Receive(ptr_connection)) {
+        CountFailure(upload.stream);
+        return false;
+      }
+    }
+    upload.body = ptr_connection->buffer.substr(0, length);
+    ptr_connection->buffer.erase(0, length);
+  }
+
+  const std::string content_type =
+      HeaderValue(request, lower_request, "content-type");
+  const size_t boundary_pos = content_type.find("boundary=");
+  if (ToLower(content_type).compare(0, 10, "multipart/") == 0 &&
+      boundary_pos != std::string::npos) {
+    std::string boundary = content_type.substr(boundary_pos + 9);
+    boundary = boundary.substr(0, boundary.find(';'));
+    if (boundary.size() > 1 && boundary[0] == '"') {
+      boundary = boundary.substr(1, boundary.size() - 2);
+    }
+    if (!ExtractFormFile(boundary, &upload.body)) {
+      LOG(WARNING) << "ingest form post from " << upload.stream
+                   << " has no " << kFormName << " part.";
+      const std::string response =
+          std::string("HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n") +
+          (keep_alive ? "Connection: keep-alive\r\n\r\n" :
+                        "Connection: close\r\n\r\n");
+      CountFailure(upload.stream);
+      return Send(ptr_connection, response.data(), response.size()) &&
+             keep_alive;
+    }
+  }
+
+  if (ToLower(content_type).compare(0, strlen(kBundleContentType),
+                                   kBundleContentType) == 0) {
+    if (!ProcessBundle(upload)) {
+      LOG(WARNING) << "ingest bundle from " << upload.stream
+                   << " is malformed.";
+      const std::string response =
+          std::string("HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n") +
+          (keep_alive ? "Connection: keep-alive\r\n\r\n" :
+                        "Connection: close\r\n\r\n");
+      CountFailure(upload.stream);
+      return Send(ptr_connection, response.data(), response.size()) &&
+             keep_alive;
+    }
+  } else {
+    ProcessUpload(upload);
+  }
+  const std::string response =
+      std::string("HTTP/1.1 200 OK\r\nContent-Length: 0\r\n") +
+      (keep_alive ? "Connection: keep-alive\r\n\r\n" :
+                    "Connection: close\r\n\r\n");
+  return Send(ptr_connection, response.data(), response.size()) &&
+         keep_alive;
+}
+
+// Chunked bodies are a series of "<hex size>\r\n<data>\r\n" chunks, ended by
+// a zero size chunk and optional trailers.
+bool IngestServer::ReadBody(Connection* ptr_connection, Upload* ptr_upload) {
+  std::string& buffer = ptr_connection->buffer;
+  for (;;) {
+    size_t line_end = buffer.find(kLineEnd);
+    while (line_end == std::string::npos) {
+      if (buffer.size() > kMaxRequestBytes || !Receive(ptr_connection)) {
+        return false;
+      }
+      line_end = buffer.find(kLineEnd);
+    }
+    char* ptr_end = NULL;
+    const int64 size = strtoll(buffer.c_str(), &ptr_end, 16);
+    if (ptr_end == buffer.c_str() || size < 0 ||
+        static_cast<int64>(ptr_upload->body.size()) + size >
+            settings_.max_upload_bytes) {
+      LOG(WARNING) << "ingest chunked body invalid or too large.";
+      return false;
+    }
+    buffer.erase(0, line_end + strlen(kLineEnd));
+    if (size == 0) {
+      break;
+    }
+    const size_t needed = static_cast<size_t>(size) + strlen(kLineEnd);
+    while (buffer.size() < needed) {
+      if (!Receive(ptr_connection)) {
+        return false;
+      }
+    }
+    ptr_upload->body.append(buffer, 0, static_cast<size_t>(size));
+    buffer.erase(0, needed);
+  }
+
+  // Skip the trailers, up to the blank line.
+  for (;;) {
+    size_t line_end = buffer.find(kLineEnd);
+    while (line_end == std::string::npos) {
+      if (buffer.size() > kMaxRequestBytes || !Receive(ptr_connection)) {
+        return false;
+      }
+      line_end = buffer.find(kLineEnd);
+    }
+    buffer.erase(0, line_end + strlen(kLineEnd));
+    if (line_end == 0) {
+      return true;
+    }
+  }
+}
+
+bool IngestServer::Receive(Connection* ptr_connection) {
+  int idle_ms = 0;
+  while (!stop_) {
+    if (!WaitReadable(ptr_connection->socket, kPollMs)) {
+      idle_ms += kPollMs;
+      if (idle_ms >= kIdleTimeoutMs) {
+        return false;
+      }
+      continue;
+    }
+    char buffer[16 * 1024];
+    const int bytes_read =
+        recv(ptr_connection->socket, buffer, sizeof(buffer), 0);
+    if (bytes_read <= 0) {
+      return false;
+    }
+    if (ptr_connection->buffer.empty()) {
+      ptr_connection->request_start_us = SteadyClockMicroseconds();
+    }
+    ptr_connection->buffer.append(buffer, bytes_read);
+    return true;
+  }
+  return false;
+}
+
+void IngestServer::ProcessUpload(const Upload& upload) {
+  const int64 now_us = SteadyClockMicroseconds();
+  enum Kind { kManifest, kHeader, kChunk } kind = kChunk;
+  const bool unvalidated = upload.compressed || upload.resumed;
+  if (upload.compressed) {
+    // Only manifests and their patches are compressed by |HttpUploader|.
+    if (HasSuffix(upload.id, kManifestSuffix) ||
+        HasSuffix(upload.id, kPatchSuffix)) {
+      kind = kManifest;
+    }
+  } else if (IsManifest(upload.body)) {
+    kind = kManifest;
+  } else if (upload.metadata || IsHeaderChunk(upload.body)) {
+    kind = kHeader;
+  }
+  const TrackKey track(upload.stream, RepresentationKey(upload.id));
+
+  // Validate outside the lock against the representation's latest header.
+  std::shared_ptr<std::vector<uint8>> header;
+  if (!unvalidated && kind == kHeader) {
+    header.reset(new (std::nothrow) std::vector<uint8>(  // NOLINT
+        upload.body.begin(), upload.body.end()));
+  } else if (!unvalidated && kind == kChunk) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<TrackKey, std::shared_ptr<std::vector<uint8>>>::const_iterator
+        it = headers_.find(track);
+    if (it != headers_.end()) {
+      header = it->second;
+    }
+  }
+  bool valid = true;
+  if (kind == kHeader && header) {
+    valid = ValidateChunk(*header, std::string());
+  } else if (kind == kChunk && header) {
+    valid = ValidateChunk(*header, upload.body);
+  }
+  if (!valid) {
+    LOG(WARNING) << "ingest " << (kind == kHeader ? "header" : "chunk")
+                 << " from " << upload.stream << " failed validation, id="
+                 << upload.id << " size=" << upload.body.size();
+  }
+
+  int64 file_index = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    IngestStreamStats& stats = streams_[upload.stream];
+    if (stats.uploads == 0) {
+      stats.name = upload.stream;
+      stats.first_upload_ms = now_us / 1000;
+    }
+    ++stats.uploads;
+    stats.bytes += upload.body.size();
+    stats.last_upload_ms = now_us / 1000;
+    if (upload.start_us > 0) {
+      stats.receive_time.Add(now_us - upload.start_us);
+    }
+    if (kind == kManifest) {
+      ++stats.manifests;
+    } else if (kind == kHeader) {
+      ++stats.headers;
+      if (valid && header) {
+        headers_[track] = header;
+      }
+    } else {
+      ++stats.chunks;
+      if (!header) {
+        ++stats.unvalidated_chunks;
+      }
+    }
+    if (!valid) {
+      ++stats.invalid_chunks;
+    }
+    if (writing_files_) {
+      file_index = files_written_++;
+    }
+  }
+
+  if (writing_files_) {
+    // Templated URLs give chunk ids; query string URLs number the uploads.
+    std::ostringstream id;
+    id << FileNamePart(upload.stream) << "_";
+    if (upload.id.empty()) {
+      id << file_index << (kind == kManifest ? kManifestSuffix : ".webm");
+    } else {
+      id << FileNamePart(upload.id);
+    }
+    const uint8* const ptr_data =
+        reinterpret_cast<const uint8*>(upload.body.data());
+    if (!file_sink_.WaitUntilReady(kIdleTimeoutMs) ||
+        !file_sink_.WriteData(ptr_data,
+                              static_cast<int32>(upload.body.size()),
+                              id.str())) {
+      LOG(WARNING) << "ingest cannot write " << id.str();
+    }
+  }
+}
+
+// Each upload is "<id> <length> <encoding>\r\n<data>\r\n".
+bool IngestServer::ProcessBundle(const Upload& upload) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    IngestStreamStats& stats = streams_[upload.stream];
+    stats.name = upload.stream;
+    ++stats.bundles;
+  }
+  const std::string& body = upload.body;
+  size_t pos = 0;
+  while (pos < body.size()) {
+    const size_t line_end = body.find(kLineEnd, pos);
+    if (line_end == std::string::npos) {
+      return false;
+    }
+    std::istringstream line(body.substr(pos, line_end - pos));
+    Upload object;
+    int64 length = -1;
+    std::string encoding;
+    if (!(line >> object.id >> length >> encoding) || length < 0 ||
+        (encoding != "identity" && encoding != "gzip")) {
+      return false;
+    }
+    const size_t data_begin = line_end + strlen(kLineEnd);
+    if (static_cast<int64>(body.size() - data_begin) <
+            length + static_cast<int64>(strlen(kLineEnd)) ||
+        body.compare(data_begin + length, strlen(kLineEnd), kLineEnd) != 0) {
+      return false;
+    }
+    object.stream = upload.stream;
+    object.compressed = encoding == "gzip";
+    object.start_us = upload.start_us;
+    object.body = body.substr(data_begin, static_cast<size_t>(length));
+    ProcessUpload(object);
+    pos = data_begin + length + strlen(kLineEnd);
+  }
+  return true;
+}
+
+void IngestServer::CountFailure(const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  IngestStreamStats& stats = streams_[name];
+  stats.name = name;
+  ++stats.failed_uploads;
+}
+
+bool IngestServer::Send(Connection* ptr_connection, const void* ptr_data,
+                        size_t length) {
+  if (!SendAll(ptr_connection->socket, ptr_data, length)) {
+    VLOG(1) << "ingest send failed, closing connection.";
+    return false;
+  }
+  return true;
+}
+
+void IngestServer::ReapConnections(bool all) {
+  std::vector<std::unique_ptr<Connection>>::iterator it =
+      connections_.begin();
+  while (it != connections_.end()) {
+    Connection* const ptr_connection = it->get();
+    if (all && !ptr_connection->done) {
+      // Wake the thread from a blocked send; it closes the socket itself.
+      shutdown(ptr_connection->socket, kShutdownBoth);
+    }
+    if (all || ptr_connection->done) {
+      ptr_connection->thread->join();
+      it = connections_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+}  // namespace webmlive
@@ -0,0 +1,233 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_INGEST_SERVER_H_
+#define WEBMLIVE_ENCODER_INGEST_SERVER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/file_data_sink.h"
+#include "encoder/latency_tracer.h"
+
+namespace webmlive {
+
+struct IngestServerSettings {
+  static const int kDefaultPort = 8000;
+  static const int kDefaultMaxClients = 256;
+  static const int64 kDefaultMaxUploadBytes = 64 * 1024 * 1024;
+
+  IngestServerSettings()
+      : port(kDefaultPort),
+        max_clients(kDefaultMaxClients),
+        max_upload_bytes(kDefaultMaxUploadBytes) {}
+
+  // Address and TCP port the server listens on. An empty |bind_address|
+  // listens on all interfaces.
+  std::string bind_address;
+  int port;
+
+  // Connections served at once. Further connections are refused with a 503
+  // response.
+  int max_clients;
+
+  // Largest upload body accepted. Larger uploads are answered with 413.
+  int64 max_upload_bytes;
+
+  // Directory receiving every upload as a file of its own, or empty to
+  // discard uploads once they are validated.
+  std::string output_dir;
+};
+
+// What an |IngestServer| received from one stream.
+struct IngestStreamStats {
+  IngestStreamStats()
+      : uploads(0),
+        manifests(0),
+        headers(0),
+        chunks(0),
+        invalid_chunks(0),
+        unvalidated_chunks(0),
+        failed_uploads(0),
+        bundles(0),
+        bytes(0),
+        first_upload_ms(0),
+        last_upload_ms(0) {}
+
+  // Formats the stats as one line.
+  std::string ToString() const;
+
+  // Stream name: the "ns" query parameter of query string URLs, or the path
+  // of templated URLs without the chunk id.
+  std::string name;
+
+  // Complete uploads, by kind. Header chunks are |invalid_chunks| when they
+  // do not hold the segment headers, and media chunks when they do not hold
+  // whole clusters following their header chunk. Media chunks are
+  // |unvalidated_chunks| when they arrive before any header, compressed, or
+  // as resumed parts.
+  int64 uploads;
+  int64 manifests;
+  int64 headers;
+  int64 chunks;
+  int64 invalid_chunks;
+  int64 unvalidated_chunks;
+
+  // Uploads abandoned or rejected before their body was received.
+  int64 failed_uploads;
+
+  // Requests carrying bundles of coalesced uploads. Each upload of a bundle
+  // is counted, and checked, as if uploaded on its own.
+  int64 bundles;
+
+  // Body bytes of complete uploads, and the times, on a monotonic clock in
+  // milliseconds, the first and last of them completed.
+  int64 bytes;
+  int64 first_upload_ms;
+  int64 last_upload_ms;
+
+  // Time from the first byte of each upload's request to the last byte of
+  // its body: the ingest latency the uploader sees before its response.
+  LatencyHistogram receive_time;
+};
+
+// HTTP server that accepts the uploads of |HttpUploader| from many streams at
+// once, checks them, and keeps statistics per stream. It replaces
+// testing/webmstreamserver.py for load tests of the uploader and of ingest
+// setups.
+//
+// Uploads are POST or PUT requests carrying the chunk as the body, sent with
+// a length or with chunked transfer encoding, or as the "webm_file" part of
+// a multipart form when the uploader uses |HTTP_FORM_POST|. Both the query
+// string URLs of the encoder ("?ns=<name>&id=<id>[&metadata=1]") and
+// templated URLs ending in the chunk id ("/<name>/{id}") are understood.
+// Requests with a "Content-Type: application/x-webmlive-bundle" header carry
+// several uploads of the stream at once, in the format described with
+// |HttpUploaderSettings::coalesce_max_bytes|.
+//
+// Uploads are told apart by their bodies: manifests are XML, and header
+// chunks begin with an EBML header. Each media chunk is parsed with
+// |WebmBufferParser| after the latest header chunk of its representation, and
+// must consist of whole clusters: the last may have an unknown size, and ends
+// with the chunk.
+//
+// Notes
+// - Each connection is served by its own thread; the listening socket by
+//   another. Validation runs on the connection threads.
+// - Every upload is answered with 200 once received. Resumed uploads, those
+//   with a Content-Range header, are accepted without validation.
+class IngestServer {
+ public:
+  enum {
+    // Socket setup failed.
+    kSocketError = -4,
+    // Cannot start the listening thread.
+    kThreadError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  IngestServer();
+  ~IngestServer();
+
+  // Copies |settings|, and starts the file writer when
+  // |settings.output_dir| is set. Returns |kSuccess| when successful.
+  int Init(const IngestServerSettings& settings);
+
+  // Binds the listening socket and starts serving. Returns |kSuccess| when
+  // successful.
+  int Run();
+
+  // Closes the listening socket and all connections, joins their threads,
+  // and finishes writing files.
+  void Stop();
+
+  // Returns the stats of every stream seen, ordered by name.
+  std::vector<IngestStreamStats> stats() const;
+
+ private:
+  struct Connection;
+  struct Upload;
+
+  // Header chunk of a representation: its stream, and the representation's
+  // id prefix in the stream's chunk ids.
+  typedef std::pair<std::string, std::string> TrackKey;
+
+  // Socket handle: a SOCKET on Windows, and a file descriptor elsewhere.
+  typedef std::intptr_t SocketHandle;
+
+  // Accepts connections and reaps the threads of closed ones.
+  void ListenThread();
+
+  // Serves the uploads of |ptr_connection| until the client closes it, it
+  // idles, or |Stop()| is called.
+  void ConnectionThread(Connection* ptr_connection);
+
+  // Receives the body of the upload whose header is |request|, and answers
+  // it. Returns false when the connection must be closed.
+  bool ServeRequest(Connection* ptr_connection, const std::string& request);
+
+  // Reads the body of |ptr_upload| into |ptr_upload->body|, with a length or
+  // chunked transfer encoding. Returns false on failure.
+  bool ReadBody(Connection* ptr_connection, Upload* ptr_upload);
+
+  // Reads at least one more byte into the connection buffer. Returns false
+  // when the connection closed, idled, or |Stop()| was called.
+  bool Receive(Connection* ptr_connection);
+
+  // Checks and counts the received |upload|, and writes it to the output
+  // directory.
+  void ProcessUpload(const Upload& upload);
+
+  // Splits bundle |upload| into the uploads it carries, and processes each.
+  // Returns false when the bundle is malformed; the uploads before the
+  // error are processed.
+  bool ProcessBundle(const Upload& upload);
+
+  // Counts a failed upload for stream |name|.
+  void CountFailure(const std::string& name);
+
+  // Sends all |length| bytes of |ptr_data|. Returns false on failure.
+  bool Send(Connection* ptr_connection, const void* ptr_data, size_t length);
+
+  // Joins and frees the threads of closed connections. With |all| set,
+  // closes every connection first.
+  void ReapConnections(bool all);
+
+  IngestServerSettings settings_;
+  std::atomic<bool> stop_;
+  SocketHandle listen_socket_;
+  std::unique_ptr<std::thread> listen_thread_;
+
+  // Open connections. Used by the listening thread, and by |Stop()| after
+  // the listening thread is joined.
+  std::vector<std::unique_ptr<Connection>> connections_;
+
+  // Stats of each stream, the latest header chunk of each representation,
+  // and the number of uploads written to files. Guarded by |mutex_|.
+  mutable std::mutex mutex_;
+  std::map<std::string, IngestStreamStats> streams_;
+  std::map<TrackKey, std::shared_ptr<std::vector<uint8>>> headers_;
+  int64 files_written_;
+
+  // Writes uploads to |settings_.output_dir|, when set.
+  FileDataSink file_sink_;
+  bool writing_files_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(IngestServer);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_INGEST_SERVER_H_
@@ -0,0 +1,241 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+//
+// Ingest load test server: accepts the uploads of any number of encoders,
+// validates their chunks, and reports receive latency and throughput per
+// stream. Stands in for testing/webmstreamserver.py when testing many
+// streams, or an uploader under load. With --impair_port, uploads can also
+// pass through a |NetworkImpairmentProxy| that adds latency, rate limits,
+// loss and resets.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef _WIN32
+#include <conio.h>
+#else
+#include <sys/select.h>
+#include <unistd.h>
+#endif
+
+#include "encoder/basictypes.h"
+#include "encoder/ingest_server.h"
+#include "encoder/network_impairment.h"
+#include "glog/logging.h"
+
+namespace {
+// Interval at which the main thread checks for a key press and the end of
+// the run.
+const int kPollIntervalMs = 100;
+
+// Returns true when input is waiting on the console. Outside Windows the
+// terminal is line buffered, so a key press is seen once Enter is pressed.
+bool key_pressed() {
+#ifdef _WIN32
+  return _kbhit() != 0;
+#else
+  if (!isatty(STDIN_FILENO)) {
+    return false;
+  }
+  fd_set read_fds;
+  FD_ZERO(&read_fds);
+  FD_SET(STDIN_FILENO, &read_fds);
+  timeval timeout = {0, 0};
+  return select(STDIN_FILENO + 1, &read_fds, NULL, NULL, &timeout) > 0;
+#endif
+}
+
+void usage(const char** argv) {
+  printf("Usage: %s [args]\n", argv[0]);
+  printf("  --port <port>                  Listening port. Default is\n");
+  printf("                                 8000.\n");
+  printf("  --bind <address>               Listening address. Default is\n");
+  printf("                                 all interfaces.\n");
+  printf("  --max_clients <count>          Connections served at once.\n");
+  printf("                                 Default is 256.\n");
+  printf("  --max_upload_bytes <bytes>     Largest upload accepted.\n");
+  printf("  --output_dir <dir>             Writes every upload to a file\n");
+  printf("                                 in <dir>.\n");
+  printf("  --report_interval <seconds>    Time between stream reports.\n");
+  printf("                                 Default is 10; 0 reports only\n");
+  printf("                                 at exit.\n");
+  printf("  --duration <seconds>           Stops after <seconds>. Default\n");
+  printf("                                 is to run until a key press.\n");
+  printf("  Network impairment options:\n");
+  printf("  --impair_port <port>           Also accepts uploads on <port>\n");
+  printf("                                 through an impaired network.\n");
+  printf("  --impair_latency_ms <ms>       Delay added each way.\n");
+  printf("  --impair_jitter_ms <ms>        Random delay added each way.\n");
+  printf("  --impair_kbps <kbps>           Rate limit of each connection.\n");
+  printf("  --impair_loss_percent <pct>    Segment loss rate; each loss\n");
+  printf("                                 stalls for 200 ms.\n");
+  printf("  --impair_reset_percent <pct>   Chance of a reset per 64 KiB\n");
+  printf("                                 uploaded.\n");
+}
+
+bool arg_has_value(int arg_index, int argc, const char** argv) {
+  const int val_index = arg_index + 1;
+  const bool has_value = ((val_index < argc) && (argv[val_index] != NULL));
+  if (!has_value) {
+    LOG(WARNING) << "argument missing value: " << argv[arg_index];
+  }
+  return has_value;
+}
+
+// Parses the command line into |ptr_settings|, |ptr_impairment|,
+// |ptr_report_interval| and |ptr_duration|. Returns false when the server
+// cannot run.
+bool parse_command_line(int argc, const char** argv,
+                        webmlive::IngestServerSettings* ptr_settings,
+                        webmlive::NetworkImpairmentSettings* ptr_impairment,
+                        int* ptr_report_interval, int* ptr_duration) {
+  webmlive::IngestServerSettings& settings = *ptr_settings;
+  webmlive::NetworkImpairmentSettings& impairment = *ptr_impairment;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp("-h", argv[i]) || !strcmp("--help", argv[i])) {
+      usage(argv);
+      exit(EXIT_SUCCESS);
+    } else if (!strcmp("--port", argv[i]) && arg_has_value(i, argc, argv)) {
+      settings.port = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--bind", argv[i]) && arg_has_value(i, argc, argv)) {
+      settings.bind_address = argv[++i];
+    } else if (!strcmp("--max_clients", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      settings.max_clients = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--max_upload_bytes", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      settings.max_upload_bytes = strtoll(argv[++i], NULL, 10);
+    } else if (!strcmp("--output_dir", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      settings.output_dir = argv[++i];
+    } else if (!strcmp("--report_interval", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      *ptr_report_interval = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--duration", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      *ptr_duration = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--impair_port", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      impairment.port = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--impair_latency_ms", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      impairment.latency_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--impair_jitter_ms", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      impairment.jitter_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--impair_kbps", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      impairment.bandwidth_kbps = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--impair_loss_percent", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      impairment.loss_percent = strtod(argv[++i], NULL);
+    } else if (!strcmp("--impair_reset_percent", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      impairment.reset_percent = strtod(argv[++i], NULL);
+    } else {
+      LOG(ERROR) << "unknown argument: " << argv[i];
+      return false;
+    }
+  }
+  return true;
+}
+
+void report(const webmlive::IngestServer& server,
+            const webmlive::NetworkImpairmentProxy* ptr_proxy) {
+  const std::vector<webmlive::IngestStreamStats> stats = server.stats();
+  printf("ingest streams=%d\n", static_cast<int>(stats.size()));
+  for (size_t i = 0; i < stats.size(); ++i) {
+    printf("%s\n", stats[i].ToString().c_str());
+  }
+  if (ptr_proxy) {
+    printf("%s\n", ptr_proxy->stats().ToString().c_str());
+  }
+  fflush(stdout);
+}
+
+int ingest_main(const webmlive::IngestServerSettings& settings,
+                webmlive::NetworkImpairmentSettings impairment,
+                int report_interval, int duration) {
+  webmlive::IngestServer server;
+  int status = server.Init(settings);
+  if (status) {
+    LOG(ERROR) << "ingest server Init failed, status=" << status;
+    return EXIT_FAILURE;
+  }
+  status = server.Run();
+  if (status) {
+    LOG(ERROR) << "ingest server Run failed, status=" << status;
+    return EXIT_FAILURE;
+  }
+
+  // The proxy relays to the server over loopback, unless the server is bound
+  // to another address.
+  webmlive::NetworkImpairmentProxy proxy;
+  const bool impaired = impairment.port > 0;
+  if (impaired) {
+    if (!settings.bind_address.empty()) {
+      impairment.target_address = settings.bind_address;
+    }
+    impairment.target_port = settings.port;
+    status = proxy.Init(impairment);
+    if (!status) {
+      status = proxy.Run();
+    }
+    if (status) {
+      LOG(ERROR) << "impairment proxy failed, status=" << status;
+      server.Stop();
+      return EXIT_FAILURE;
+    }
+    printf("Impaired uploads on port %d.\n", proxy.port());
+  }
+  webmlive::NetworkImpairmentProxy* const ptr_proxy =
+      impaired ? &proxy : NULL;
+  printf("Serving uploads on port %d, press a key to stop.\n", settings.port);
+
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point start_time = Clock::now();
+  Clock::time_point report_time = start_time;
+  while (!key_pressed()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(kPollIntervalMs));
+    const Clock::time_point now = Clock::now();
+    if (duration > 0 && now - start_time >= std::chrono::seconds(duration)) {
+      break;
+    }
+    if (report_interval > 0 &&
+        now - report_time >= std::chrono::seconds(report_interval)) {
+      report(server, ptr_proxy);
+      report_time = now;
+    }
+  }
+  proxy.Stop();
+  server.Stop();
+  report(server, ptr_proxy);
+  return EXIT_SUCCESS;
+}
+}  // namespace
+
+int main(int argc, const char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  webmlive::IngestServerSettings settings;
+  webmlive::NetworkImpairmentSettings impairment;
+  int report_interval = 10;
+  int duration = 0;
+  if (!parse_command_line(argc, argv, &settings, &impairment,
+                          &report_interval, &duration)) {
+    usage(argv);
+    return EXIT_FAILURE;
+  }
+  const int exit_code =
+      ingest_main(settings, impairment, report_interval, duration);
+  google::ShutdownGoogleLogging();
+  return exit_code;
+}
@@ -0,0 +1,118 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/init_segment_cache.h"
+
+#include <cstring>
+
+#include "encoder/socket_util.h"
+
+namespace webmlive {
+
+namespace {
+const char kHeaderId[] = "header";
+const char kChunkId[] = "chunk";
+const char kHeaderSuffix[] = ".hdr";
+const char kChunkSuffix[] = ".chk";
+}  // namespace
+
+InitSegmentCache::InitSegmentCache() : max_chunks_(kDefaultMaxChunks) {
+}
+
+void InitSegmentCache::Init(int max_chunks) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  streams_.clear();
+  max_chunks_ = static_cast<size_t>(max_chunks < 1 ? 1 : max_chunks);
+}
+
+bool InitSegmentCache::ParseId(const std::string& id, std::string* ptr_stream,
+                               bool* ptr_header) {
+  if (id == kHeaderId || id == kChunkId) {
+    ptr_stream->clear();
+    *ptr_header = (id == kHeaderId);
+    return true;
+  }
+  if (HasSuffix(id, kHeaderSuffix)) {
+    *ptr_stream = id.substr(0, id.size() - strlen(kHeaderSuffix));
+    *ptr_header = true;
+    return !ptr_stream->empty();
+  }
+  if (HasSuffix(id, kChunkSuffix)) {
+    const size_t num_pos = id.rfind('_');
+    if (num_pos == std::string::npos || num_pos == 0) {
+      return false;
+    }
+    *ptr_stream = id.substr(0, num_pos);
+    *ptr_header = false;
+    return true;
+  }
+  return false;
+}
+
+bool InitSegmentCache::Put(const SharedDataChunk& chunk,
+                           const std::string& id) {
+  std::string stream_name;
+  bool header = false;
+  if (!chunk || !ParseId(id, &stream_name, &header)) {
+    return false;
+  }
+  Entry entry;
+  entry.chunk = chunk;
+  entry.id = id;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stream& stream = streams_[stream_name];
+  if (header) {
+    stream.header = entry;
+    stream.run.clear();
+    stream.run_complete = false;
+    return true;
+  }
+  if (chunk->starts_with_keyframe()) {
+    stream.run.clear();
+    stream.run_complete = true;
+  } else if (!stream.run_complete) {
+    return false;
+  } else if (stream.run.size() >= max_chunks_) {
+    stream.run.clear();
+    stream.run_complete = false;
+    return false;
+  }
+  stream.run.push_back(entry);
+  return true;
+}
+
+void InitSegmentCache::GetEntries(std::vector<Entry>* ptr_entries) const {
+  ptr_entries->clear();
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (std::map<std::string, Stream>::const_iterator it = streams_.begin();
+       it != streams_.end(); ++it) {
+    const Stream& stream = it->second;
+    if (!stream.header.chunk) {
+      continue;
+    }
+    ptr_entries->push_back(stream.header);
+    if (stream.run_complete) {
+      ptr_entries->insert(ptr_entries->end(), stream.run.begin(),
+                          stream.run.end());
+    }
+  }
+}
+
+int InitSegmentCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int chunks = 0;
+  for (std::map<std::string, Stream>::const_iterator it = streams_.begin();
+       it != streams_.end(); ++it) {
+    chunks += (it->second.header.chunk ? 1 : 0) +
+              (it->second.run_complete ?
+                   static_cast<int>(it->second.run.size()) : 0);
+  }
+  return chunks;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,101 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_INIT_SEGMENT_CACHE_H_
+#define WEBMLIVE_ENCODER_INIT_SEGMENT_CACHE_H_
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/buffer_util.h"
+
+namespace webmlive {
+
+// Keeps what a sink joining a running encode needs to start playback right
+// away: the metadata chunk of each muxer, which holds the EBML header and
+// the Segment, Info and Tracks elements, and the chunks written since the
+// muxer's newest chunk that starts with a keyframe. Data sinks fill it from
+// the chunks they are written, so that priming a new sink involves neither
+// the encoder nor a restart.
+//
+// Chunks are grouped by muxer using their ids:
+// - "header" and "chunk" of non-DASH encodes;
+// - <stem>.hdr and <stem>_<n>.chk of DASH encodes, where <stem> names the
+//   representation, as returned by |DashWriter::IdForVideoChunk()| and the
+//   other id methods.
+// Other ids, manifests and cluster indexes for example, are not cached.
+//
+// Notes
+// - A metadata chunk replaces the muxer's cached chunks, since those belong
+//   to the previous header.
+// - When more than |max_chunks| follow the newest keyframe chunk, the muxer
+//   has no complete run to offer until its next keyframe chunk.
+// - Muxers that stop, like representations removed by
+//   |WebmEncoder::Reconfigure()|, stay cached; their chunks remain valid
+//   files of the Period they belong to.
+// - Thread safe.
+class InitSegmentCache {
+ public:
+  static const int kDefaultMaxChunks = 16;
+
+  // A cached chunk and its id.
+  struct Entry {
+    SharedDataChunk chunk;
+    std::string id;
+  };
+
+  InitSegmentCache();
+  ~InitSegmentCache() {}
+
+  // Empties the cache, and limits the chunks kept after each muxer's
+  // keyframe chunk, that chunk included, to |max_chunks|.
+  void Init(int max_chunks);
+
+  // Parses |id|. Returns false when it is not a chunk of a muxer. Otherwise
+  // stores the muxer's name in |ptr_stream|, and whether |id| names its
+  // metadata chunk in |ptr_header|.
+  static bool ParseId(const std::string& id, std::string* ptr_stream,
+                      bool* ptr_header);
+
+  // Records chunk |id| when it belongs to a muxer. Returns true when the
+  // chunk is cached.
+  bool Put(const SharedDataChunk& chunk, const std::string& id);
+
+  // Stores the cached chunks in |ptr_entries| in the order a new sink should
+  // receive them: each muxer's metadata chunk, followed by its chunks from
+  // the newest keyframe chunk on. Muxers without a metadata chunk are left
+  // out.
+  void GetEntries(std::vector<Entry>* ptr_entries) const;
+
+  // Returns the number of cached chunks.
+  int size() const;
+
+ private:
+  // Cached chunks of one muxer.
+  struct Stream {
+    Stream() : run_complete(false) {}
+    Entry header;
+    // Chunks from the newest keyframe chunk on. |run_complete| is false when
+    // no keyframe chunk has been seen since |header|, or when the run grew
+    // beyond |max_chunks_|.
+    std::deque<Entry> run;
+    bool run_complete;
+  };
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Stream> streams_;
+  size_t max_chunks_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(InitSegmentCache);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_INIT_SEGMENT_CACHE_H_
@@ -0,0 +1,180 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/jpeg_encoder.h"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifdef WEBMLIVE_HAVE_LIBJPEG
+#include "jpeglib.h"
+#endif
+#include "glog/logging.h"
+
+namespace webmlive {
+
+#ifdef WEBMLIVE_HAVE_LIBJPEG
+namespace {
+// Luma rows in each call to jpeg_write_raw_data(): one row of 16x16 MCUs.
+const int kMcuRows = 16;
+
+// Error handler that returns to |JpegEncoder::Encode()| instead of exiting,
+// which is what libjpeg's default handler does.
+struct ErrorHandler {
+  // Must be first: libjpeg sees only this part.
+  jpeg_error_mgr manager;
+  jmp_buf jump;
+};
+
+void ReturnOnError(j_common_ptr ptr_info) {
+  char message[JMSG_LENGTH_MAX];
+  (*ptr_info->err->format_message)(ptr_info, message);
+  LOG(ERROR) << "libjpeg error: " << message;
+  longjmp(reinterpret_cast<ErrorHandler*>(ptr_info->err)->jump, 1);
+}
+
+void IgnoreMessage(j_common_ptr /* ptr_info */) {
+}
+}  // namespace
+
+struct JpegEncoder::State {
+  jpeg_compress_struct info;
+  ErrorHandler error;
+
+  // Output of jpeg_mem_dest(), kept here since the error path longjmp()s
+  // past the locals of |Encode()|.
+  unsigned char* ptr_output;
+  unsigned long output_size;  // NOLINT
+};
+
+JpegEncoder::JpegEncoder() : ptr_state_(NULL), quality_(kDefaultQuality) {
+}
+
+JpegEncoder::~JpegEncoder() {
+  if (ptr_state_) {
+    jpeg_destroy_compress(&ptr_state_->info);
+    delete ptr_state_;
+  }
+}
+
+int JpegEncoder::Init(int quality) {
+  if (quality < 1 || quality > 100) {
+    return kInvalidArg;
+  }
+  quality_ = quality;
+  if (ptr_state_) {
+    return kSuccess;
+  }
+  ptr_state_ = new (std::nothrow) State;  // NOLINT
+  if (!ptr_state_) {
+    return kNoMemory;
+  }
+  ptr_state_->info.err = jpeg_std_error(&ptr_state_->error.manager);
+  ptr_state_->error.manager.error_exit = ReturnOnError;
+  ptr_state_->error.manager.output_message = IgnoreMessage;
+  ptr_state_->ptr_output = NULL;
+  ptr_state_->output_size = 0;
+  if (setjmp(ptr_state_->error.jump)) {
+    delete ptr_state_;
+    ptr_state_ = NULL;
+    return kJpegError;
+  }
+  jpeg_create_compress(&ptr_state_->info);
+  return kSuccess;
+}
+
+int JpegEncoder::Encode(const uint8* ptr_y, int32 y_stride,
+                        const uint8* ptr_u, const uint8* ptr_v,
+                        int32 uv_stride, int32 width, int32 height,
+                        std::vector<uint8>* ptr_output) {
+  if (!ptr_state_ || !ptr_y || !ptr_u || !ptr_v || width <= 0 ||
+      height <= 0 || !ptr_output) {
+    return kInvalidArg;
+  }
+  State* const ptr_state = ptr_state_;
+  jpeg_compress_struct* const ptr_info = &ptr_state->info;
+  ptr_state->ptr_output = NULL;
+  ptr_state->output_size = 0;
+  if (setjmp(ptr_state->error.jump)) {
+    jpeg_abort_compress(ptr_info);
+    free(ptr_state->ptr_output);
+    ptr_state->ptr_output = NULL;
+    return kJpegError;
+  }
+
+  jpeg_mem_dest(ptr_info, &ptr_state->ptr_output, &ptr_state->output_size);
+  ptr_info->image_width = width;
+  ptr_info->image_height = height;
+  ptr_info->input_components = 3;
+  ptr_info->in_color_space = JCS_YCbCr;
+  jpeg_set_defaults(ptr_info);
+  jpeg_set_quality(ptr_info, quality_, TRUE);
+  ptr_info->raw_data_in = TRUE;
+  ptr_info->comp_info[0].h_samp_factor = 2;
+  ptr_info->comp_info[0].v_samp_factor = 2;
+  for (int i = 1; i < 3; ++i) {
+    ptr_info->comp_info[i].h_samp_factor = 1;
+    ptr_info->comp_info[i].v_samp_factor = 1;
+  }
+  jpeg_start_compress(ptr_info, TRUE);
+
+  // The last MCU row repeats the bottom rows of the image past its end.
+  JSAMPROW y_rows[kMcuRows];
+  JSAMPROW u_rows[kMcuRows / 2];
+  JSAMPROW v_rows[kMcuRows / 2];
+  JSAMPARRAY planes[3] = {y_rows, u_rows, v_rows};
+  const int32 uv_height = (height + 1) / 2;
+  while (ptr_info->next_scanline < ptr_info->image_height) {
+    const int32 row = ptr_info->next_scanline;
+    for (int i = 0; i < kMcuRows; ++i) {
+      y_rows[i] = const_cast<JSAMPROW>(
+          ptr_y + std::min(row + i, height - 1) * y_stride);
+    }
+    for (int i = 0; i < kMcuRows / 2; ++i) {
+      const int32 uv_row = std::min(row / 2 + i, uv_height - 1);
+      u_rows[i] = const_cast<JSAMPROW>(ptr_u + uv_row * uv_stride);
+      v_rows[i] = const_cast<JSAMPROW>(ptr_v + uv_row * uv_stride);
+    }
+    jpeg_write_raw_data(ptr_info, planes, kMcuRows);
+  }
+  jpeg_finish_compress(ptr_info);
+
+  ptr_output->assign(ptr_state->ptr_output,
+                     ptr_state->ptr_output + ptr_state->output_size);
+  free(ptr_state->ptr_output);
+  ptr_state->ptr_output = NULL;
+  return kSuccess;
+}
+#else
+struct JpegEncoder::State {
+};
+
+JpegEncoder::JpegEncoder() : ptr_state_(NULL), quality_(kDefaultQuality) {
+}
+
+JpegEncoder::~JpegEncoder() {
+}
+
+int JpegEncoder::Init(int /* quality */) {
+  LOG(ERROR) << "libjpeg support was not built; configure with "
+             << "WEBMLIVE_ENABLE_MJPEG.";
+  return kUnsupported;
+}
+
+int JpegEncoder::Encode(const uint8* /* ptr_y */, int32 /* y_stride */,
+                        const uint8* /* ptr_u */, const uint8* /* ptr_v */,
+                        int32 /* uv_stride */, int32 /* width */,
+                        int32 /* height */,
+                        std::vector<uint8>* /* ptr_output */) {
+  return kUnsupported;
+}
+#endif  // WEBMLIVE_HAVE_LIBJPEG
+
+}  // namespace webmlive
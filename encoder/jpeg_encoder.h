@@ -0,0 +1,65 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_JPEG_ENCODER_H_
+#define WEBMLIVE_ENCODER_JPEG_ENCODER_H_
+
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Compresses I420 images to baseline JPEG with libjpeg, reusing one
+// compressor between images. The planes are passed to libjpeg as raw 4:2:0
+// data, so no color conversion or chroma resampling takes place.
+//
+// Notes
+// - libjpeg is optional: without WEBMLIVE_HAVE_LIBJPEG |Init()| fails.
+// - libjpeg reads whole 8x8 blocks: luma rows must be readable to |width|
+//   rounded up to a multiple of 16, and chroma rows to half that. Rows past
+//   the bottom of the image are never read.
+// - Not thread safe.
+class JpegEncoder {
+ public:
+  enum {
+    // libjpeg support was not built.
+    kUnsupported = -4,
+    // libjpeg reported an error.
+    kJpegError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  static const int kDefaultQuality = 75;
+
+  JpegEncoder();
+  ~JpegEncoder();
+
+  // Allocates the compressor, once, and sets the |quality| of the next
+  // images, 1 to 100. Returns |kSuccess| when successful.
+  int Init(int quality);
+
+  // Stores the JPEG image of the |width| x |height| I420 planes in
+  // |ptr_output|. Returns |kSuccess| when successful.
+  int Encode(const uint8* ptr_y, int32 y_stride,
+             const uint8* ptr_u, const uint8* ptr_v, int32 uv_stride,
+             int32 width, int32 height,
+             std::vector<uint8>* ptr_output);
+
+ private:
+  // libjpeg compressor and error handler, allocated by |Init()|.
+  struct State;
+  State* ptr_state_;
+  int quality_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(JpegEncoder);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_JPEG_ENCODER_H_
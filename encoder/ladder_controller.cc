@@ -0,0 +1,137 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/ladder_controller.h"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Orders representation indices by bitrate, then by index.
+struct LowerBitrate {
+  explicit LowerBitrate(const std::vector<int>& kbps) : rep_kbps(kbps) {}
+  bool operator()(int a, int b) const {
+    if (rep_kbps[a] != rep_kbps[b])
+      return rep_kbps[a] < rep_kbps[b];
+    return a < b;
+  }
+  const std::vector<int>& rep_kbps;
+};
+}  // namespace
+
+LadderController::LadderController()
+    : active_count_(0),
+      start_time_ms_(-1),
+      backed_up_(false),
+      change_time_ms_(-1),
+      resume_time_ms_(-1) {
+}
+
+int LadderController::Init(const LadderControllerConfig& config) {
+  bool valid = !config.rep_kbps.empty() && config.base_kbps >= 0 &&
+               config.update_interval_ms > 0 && config.settle_ms >= 0 &&
+               config.resume_hold_ms >= 0 && config.headroom > 0 &&
+               config.headroom <= 1 && config.resume_headroom > 0 &&
+               config.resume_headroom <= config.headroom;
+  for (size_t i = 0; valid && i < config.rep_kbps.size(); ++i)
+    valid = config.rep_kbps[i] > 0;
+  if (!valid) {
+    LOG(ERROR) << "LadderController invalid config.";
+    return kInvalidArg;
+  }
+  config_ = config;
+  order_.clear();
+  for (size_t i = 0; i < config_.rep_kbps.size(); ++i)
+    order_.push_back(static_cast<int>(i));
+  std::sort(order_.begin(), order_.end(), LowerBitrate(config_.rep_kbps));
+  active_count_ = static_cast<int>(order_.size());
+  start_time_ms_ = -1;
+  backed_up_ = false;
+  change_time_ms_ = -1;
+  resume_time_ms_ = -1;
+  return kSuccess;
+}
+
+bool LadderController::Update(int64 time_ms, const UplinkEstimate& uplink,
+                              bool backed_up, int* ptr_active_count) {
+  if (!ptr_active_count || order_.empty()) {
+    return false;
+  }
+  if (start_time_ms_ < 0) {
+    start_time_ms_ = time_ms;
+    return false;
+  }
+  backed_up_ = backed_up_ || backed_up;
+  if (time_ms - start_time_ms_ < config_.update_interval_ms) {
+    return false;
+  }
+  const bool was_backed_up = backed_up_;
+  start_time_ms_ = time_ms;
+  backed_up_ = false;
+  if (uplink.uploads == 0 ||
+      (change_time_ms_ >= 0 && time_ms - change_time_ms_ < config_.settle_ms)) {
+    return false;
+  }
+
+  // The low percentile keeps one fast upload from hiding a congested
+  // uplink; the average stands in until enough uploads were measured.
+  const int64 capacity_kbps = uplink.low_capacity_kbps > 0 ?
+      uplink.low_capacity_kbps : uplink.capacity_kbps;
+  int new_count = active_count_;
+  if (uplink.congested() && was_backed_up) {
+    resume_time_ms_ = -1;
+    const int64 usable_kbps =
+        static_cast<int64>(capacity_kbps * config_.headroom);
+    new_count = std::max(1, active_count_ - 1);
+    while (new_count > 1 && RequiredKbps(new_count) > usable_kbps)
+      --new_count;
+  } else if (!uplink.congested() && !was_backed_up &&
+             active_count_ < static_cast<int>(order_.size()) &&
+             capacity_kbps * config_.resume_headroom >=
+                 RequiredKbps(active_count_ + 1)) {
+    if (resume_time_ms_ < 0)
+      resume_time_ms_ = time_ms;
+    if (time_ms - resume_time_ms_ >= config_.resume_hold_ms)
+      new_count = active_count_ + 1;
+  } else {
+    resume_time_ms_ = -1;
+  }
+
+  VLOG(1) << "LadderController uplink " << capacity_kbps << " kbps, ratio "
+          << uplink.upload_ratio << ", queue growth "
+          << uplink.queue_growth_kbps << " kbps, active " << active_count_
+          << " -> " << new_count;
+
+  if (new_count == active_count_) {
+    return false;
+  }
+  active_count_ = new_count;
+  change_time_ms_ = time_ms;
+  resume_time_ms_ = -1;
+  *ptr_active_count = new_count;
+  return true;
+}
+
+bool LadderController::IsActive(int rep_index) const {
+  for (int i = 0; i < active_count_; ++i) {
+    if (order_[i] == rep_index)
+      return true;
+  }
+  return false;
+}
+
+int64 LadderController::RequiredKbps(int count) const {
+  int64 kbps = config_.base_kbps;
+  for (int i = 0; i < count; ++i)
+    kbps += config_.rep_kbps[order_[i]];
+  return kbps;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,125 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_LADDER_CONTROLLER_H_
+#define WEBMLIVE_ENCODER_LADDER_CONTROLLER_H_
+
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/uplink_estimator.h"
+
+namespace webmlive {
+
+struct LadderControllerConfig {
+  static const int32 kDefaultUpdateIntervalMs = 2000;
+  static const int32 kDefaultSettleMs = 6000;
+  static const int32 kDefaultResumeHoldMs = 20000;
+
+  LadderControllerConfig()
+      : base_kbps(0),
+        update_interval_ms(kDefaultUpdateIntervalMs),
+        settle_ms(kDefaultSettleMs),
+        resume_hold_ms(kDefaultResumeHoldMs),
+        headroom(0.85),
+        resume_headroom(0.7) {}
+
+  // Bitrate of each video representation, in kilobits per second.
+  std::vector<int> rep_kbps;
+
+  // Bitrate uploaded whatever the ladder, audio for example.
+  int base_kbps;
+
+  // Time between decisions.
+  int32 update_interval_ms;
+
+  // Time after a change during which no other change is made, while the
+  // upload queue drains and the estimate follows the new ladder.
+  int32 settle_ms;
+
+  // Time the uplink must leave room for a paused representation before it
+  // resumes.
+  int32 resume_hold_ms;
+
+  // Fractions of the uplink capacity the active representations may use:
+  // representations are paused above |headroom|, and resume only while they
+  // fit within |resume_headroom|. |resume_headroom| must not exceed
+  // |headroom|, which keeps the ladder from flapping.
+  double headroom;
+  double resume_headroom;
+};
+
+// Picks the video representations of a bitrate ladder that the uplink can
+// carry, as estimated by the uploader's |UplinkEstimator|. Representations
+// are paused from the highest bitrate down, and resumed from the lowest
+// paused one up; the lowest representation is never paused.
+//
+// Every |update_interval_ms|:
+// - When the uplink is congested and the uploader was backed up, the highest
+//   representations are paused until the rest fit within |headroom| of the
+//   low percentile of the capacity, and at least one is.
+// - When the uplink is not congested, the uploader was never backed up, and
+//   the lowest paused representation has fit within |resume_headroom| of the
+//   capacity for |resume_hold_ms|, it resumes.
+// Note: uploads limited by pacing measure only the pacing rate, so pacing
+// must leave room for the whole ladder for representations to resume.
+// Note: the class is not thread safe.
+class LadderController {
+ public:
+  enum {
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  LadderController();
+  ~LadderController() {}
+
+  // Starts with every representation active. Returns |kSuccess| when
+  // |config| is valid.
+  int Init(const LadderControllerConfig& config);
+
+  // Reports the |uplink| estimate at |time_ms|, and whether the uploader is
+  // |backed_up|. Returns true and stores the number of active
+  // representations in |ptr_active_count| when the ladder should change.
+  bool Update(int64 time_ms, const UplinkEstimate& uplink, bool backed_up,
+              int* ptr_active_count);
+
+  // Returns true when the representation at |rep_index| in
+  // |LadderControllerConfig::rep_kbps| is active.
+  bool IsActive(int rep_index) const;
+
+  int active_count() const { return active_count_; }
+
+ private:
+  // Returns the bitrate uploaded with the |count| lowest representations
+  // active.
+  int64 RequiredKbps(int count) const;
+
+  LadderControllerConfig config_;
+
+  // Representation indices from the lowest bitrate to the highest; the first
+  // |active_count_| are active.
+  std::vector<int> order_;
+  int active_count_;
+
+  // Start of the current interval. Negative until the first |Update()|.
+  int64 start_time_ms_;
+
+  // Set when the uploader was backed up at any update in the interval.
+  bool backed_up_;
+
+  // Time of the last change, and time since which the next representation
+  // would fit; negative when none.
+  int64 change_time_ms_;
+  int64 resume_time_ms_;
+
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(LadderController);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_LADDER_CONTROLLER_H_
@@ -0,0 +1,485 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+//
+// Glass-to-glass latency checker: follows one video representation of a
+// live DASH stream on an origin from its live edge, decodes each segment as
+// soon as it is available, and reads the capture time the encoder burned
+// into every frame with --latency_code. Reports the latency from capture to
+// the availability of the segment holding the frame, per segment and as a
+// distribution at the end. The encoder's and the checker's clocks must be
+// synchronized, with NTP for example; their offset adds to every latency.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "curl/curl.h"
+#include "curl/easy.h"
+#include "encoder/basictypes.h"
+#include "encoder/ebml_util.h"
+#include "encoder/latency_code.h"
+#include "encoder/socket_util.h"
+#include "encoder/time_util.h"
+#include "glog/logging.h"
+#include "vpx/vp8dx.h"
+#include "vpx/vpx_decoder.h"
+
+namespace {
+using webmlive::kBlockGroupId;
+using webmlive::kBlockId;
+using webmlive::kClusterId;
+using webmlive::kCodecIdId;
+using webmlive::kSegmentId;
+using webmlive::kSimpleBlockId;
+using webmlive::kTrackEntryId;
+using webmlive::kTracksId;
+using webmlive::ReadElementHeader;
+using webmlive::ReadVint;
+using webmlive::ReplaceAll;
+using webmlive::SystemClockMilliseconds;
+
+// Lacing bits of the block header flags.
+const uint8 kLacingMask = 0x06;
+
+struct CheckerConfig {
+  CheckerConfig()
+      : manifest("webmlive.mpd"),
+        rep_id("2"),
+        start_number(-1),
+        num_segments(30),
+        poll_interval(10),
+        timeout(30) {}
+
+  // URL of the directory holding the stream on the origin.
+  std::string url;
+
+  // Manifest name, and id of the video representation followed.
+  std::string manifest;
+  std::string rep_id;
+
+  // First segment number measured; -1 starts at the live edge of the
+  // manifest.
+  int64 start_number;
+
+  // Number of segments measured.
+  int num_segments;
+
+  // Time between requests for a segment not yet available, in
+  // milliseconds, and longest wait for one, in seconds.
+  int poll_interval;
+  int timeout;
+};
+
+// Latencies of the frames read, and the frames decoded without a code.
+struct LatencyStats {
+  LatencyStats() : unreadable_frames(0) {}
+
+  std::vector<int64> latencies_ms;
+  int64 unreadable_frames;
+};
+
+void usage(const char** argv) {
+  printf("Usage: %s --url <url> [args]\n", argv[0]);
+  printf("  Origin options:\n");
+  printf("    --url <url>                    Directory of the stream on the\n");
+  printf("                                   origin; for example\n");
+  printf("                                   http://host/webmlive/\n");
+  printf("    --manifest <name>              Manifest name. Default is\n");
+  printf("                                   webmlive.mpd.\n");
+  printf("    --rep <id>                     Video representation id.\n");
+  printf("                                   Default is 2.\n");
+  printf("  Measurement options:\n");
+  printf("    --start <number>               First segment; default is\n");
+  printf("                                   the live edge.\n");
+  printf("    --segments <count>             Segments measured. Default\n");
+  printf("                                   is 30.\n");
+  printf("    --poll_interval <ms>           Time between requests for a\n");
+  printf("                                   segment. Default is 10.\n");
+  printf("    --timeout <seconds>            Longest wait for a segment.\n");
+  printf("                                   Default is 30.\n");
+  printf("  The encoder must run with --latency_code, and its clock be\n");
+  printf("  synchronized with this one.\n");
+}
+
+bool arg_has_value(int arg_index, int argc, const char** argv) {
+  const int val_index = arg_index + 1;
+  const bool has_value = ((val_index < argc) && (argv[val_index] != NULL));
+  if (!has_value) {
+    LOG(WARNING) << "argument missing value: " << argv[arg_index];
+  }
+  return has_value;
+}
+
+// Parses the command line into |ptr_config|. Returns false when the checker
+// cannot run.
+bool parse_command_line(int argc, const char** argv,
+                        CheckerConfig* ptr_config) {
+  CheckerConfig& config = *ptr_config;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp("-h", argv[i]) || !strcmp("--help", argv[i])) {
+      usage(argv);
+      exit(EXIT_SUCCESS);
+    } else if (!strcmp("--url", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.url = argv[++i];
+    } else if (!strcmp("--manifest", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.manifest = argv[++i];
+    } else if (!strcmp("--rep", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.rep_id = argv[++i];
+    } else if (!strcmp("--start", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.start_number = strtoll(argv[++i], NULL, 10);
+    } else if (!strcmp("--segments", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.num_segments = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--poll_interval", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.poll_interval = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--timeout", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.timeout = strtol(argv[++i], NULL, 10);
+    } else {
+      LOG(ERROR) << "unknown argument: " << argv[i];
+      return false;
+    }
+  }
+  if (config.url.empty() || config.num_segments < 1 ||
+      config.poll_interval < 1 || config.timeout < 1) {
+    LOG(ERROR) << "--url is required, and counts and intervals must be "
+               << "positive.";
+    return false;
+  }
+  if (config.url[config.url.length() - 1] != '/') {
+    config.url += "/";
+  }
+  return true;
+}
+
+size_t AppendToString(char* ptr_data, size_t size, size_t count,
+                      void* ptr_string) {
+  static_cast<std::string*>(ptr_string)->append(ptr_data, size * count);
+  return size * count;
+}
+
+// Fetches |url| into |ptr_body| with |ptr_curl|, and stores the HTTP status
+// in |ptr_status|. Returns false when the request fails before a response.
+bool Fetch(CURL* ptr_curl, const std::string& url, std::string* ptr_body,
+           long* ptr_status) {  // NOLINT
+  ptr_body->clear();
+  *ptr_status = 0;
+  curl_easy_setopt(ptr_curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(ptr_curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(ptr_curl, CURLOPT_WRITEFUNCTION, AppendToString);
+  curl_easy_setopt(ptr_curl, CURLOPT_WRITEDATA, ptr_body);
+  const CURLcode result = curl_easy_perform(ptr_curl);
+  if (result != CURLE_OK) {
+    LOG(ERROR) << "cannot fetch " << url << ": "
+               << curl_easy_strerror(result);
+    return false;
+  }
+  curl_easy_getinfo(ptr_curl, CURLINFO_RESPONSE_CODE, ptr_status);
+  return true;
+}
+
+// Returns the value of attribute |name| of the element starting at |start|
+// in |document|, or an empty string.
+std::string Attribute(const std::string& document, size_t start,
+                      const std::string& name) {
+  const size_t end = document.find('>', start);
+  const size_t pos = document.find(" " + name + "=\"", start);
+  if (pos == std::string::npos || pos > end) {
+    return std::string();
+  }
+  const size_t value = pos + name.length() + 3;
+  return document.substr(value, document.find('"', value) - value);
+}
+
+// Reads the segment template of representation |rep_id| in the last Period
+// of |manifest|: its media and initialization URL templates, and the number
+// of the segment after the last one listed, the live edge. The encoder's
+// timelines list one S element per segment.
+bool ParseManifest(const std::string& manifest, const std::string& rep_id,
+                   std::string* ptr_media, std::string* ptr_initialization,
+                   int64* ptr_edge_number) {
+  const size_t rep = manifest.rfind("<Representation id=\"" + rep_id + "\"");
+  if (rep == std::string::npos) {
+    LOG(ERROR) << "no representation " << rep_id << " in the manifest.";
+    return false;
+  }
+  const size_t set = manifest.rfind("<AdaptationSet", rep);
+  const size_t tmpl = manifest.find("<SegmentTemplate", set);
+  if (set == std::string::npos || tmpl == std::string::npos) {
+    LOG(ERROR) << "no segment template for representation " << rep_id;
+    return false;
+  }
+  *ptr_media = Attribute(manifest, tmpl, "media");
+  *ptr_initialization = Attribute(manifest, tmpl, "initialization");
+  const std::string start_number = Attribute(manifest, tmpl, "startNumber");
+  if (ptr_media->empty() || ptr_initialization->empty() ||
+      start_number.empty()) {
+    LOG(ERROR) << "incomplete segment template for representation "
+               << rep_id;
+    return false;
+  }
+  ReplaceAll("$RepresentationID$", rep_id, ptr_media);
+  ReplaceAll("$RepresentationID$", rep_id, ptr_initialization);
+
+  int64 edge_number = strtoll(start_number.c_str(), NULL, 10);
+  const size_t timeline_end = manifest.find("</SegmentTimeline>", tmpl);
+  for (size_t pos = manifest.find("<S ", tmpl);
+       pos != std::string::npos && pos < timeline_end;
+       pos = manifest.find("<S ", pos + 1)) {
+    ++edge_number;
+  }
+  *ptr_edge_number = edge_number;
+  return true;
+}
+
+//
+// EBML reading.
+//
+// A leaf element of an EBML document.
+struct Element {
+  uint32 id;
+  const uint8* ptr_data;
+  size_t size;
+};
+
+// Appends the leaf elements of |document| to |ptr_elements|, in order.
+// Master elements are entered rather than skipped, so that those of unknown
+// size, as the live muxer writes segments and clusters, need no end.
+// Returns false when |document| is truncated.
+bool ReadElements(const std::string& document,
+                  std::vector<Element>* ptr_elements) {
+  const uint8* ptr_data = reinterpret_cast<const uint8*>(document.data());
+  const uint8* const ptr_end = ptr_data + document.size();
+  while (ptr_data < ptr_end) {
+    uint32 id = 0;
+    int64 size = 0;
+    if (!ReadElementHeader(&ptr_data, ptr_end, &id, &size)) {
+      return false;
+    }
+    if (id == kSegmentId || id == kTracksId || id == kTrackEntryId ||
+        id == kClusterId || id == kBlockGroupId) {
+      continue;
+    }
+    if (size < 0) {
+      return false;
+    }
+    Element element;
+    element.id = id;
+    element.ptr_data = ptr_data;
+    element.size = static_cast<size_t>(size);
+    ptr_elements->push_back(element);
+    ptr_data += size;
+  }
+  return true;
+}
+
+// Returns the latency |p| percent of |sorted| are at or under.
+int64 Percentile(const std::vector<int64>& sorted, double p) {
+  size_t index = static_cast<size_t>(p / 100 * sorted.size());
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+// Prints the distribution of |stats|, prefixed by |label|.
+void report(const std::string& label, const LatencyStats& stats) {
+  std::ostringstream out;
+  out << label << " frames=" << stats.latencies_ms.size()
+      << " unreadable_frames=" << stats.unreadable_frames;
+  if (!stats.latencies_ms.empty()) {
+    std::vector<int64> sorted = stats.latencies_ms;
+    std::sort(sorted.begin(), sorted.end());
+    int64 total = 0;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+      total += sorted[i];
+    }
+    out << " latency_mean_ms=" << total / static_cast<int64>(sorted.size())
+        << " latency_min_ms=" << sorted.front()
+        << " latency_p50_ms=" << Percentile(sorted, 50)
+        << " latency_p90_ms=" << Percentile(sorted, 90)
+        << " latency_p99_ms=" << Percentile(sorted, 99)
+        << " latency_max_ms=" << sorted.back();
+  }
+  printf("%s\n", out.str().c_str());
+  fflush(stdout);
+}
+
+// Decodes the frames of segment |segment| with |ptr_decoder|, and adds the
+// latency of each from its capture to |available_ms| to |ptr_stats|.
+// Returns false when the segment cannot be parsed or decoded.
+bool CheckSegment(const std::string& segment, int64 available_ms,
+                  vpx_codec_ctx_t* ptr_decoder, LatencyStats* ptr_stats) {
+  std::vector<Element> elements;
+  if (!ReadElements(segment, &elements)) {
+    LOG(ERROR) << "truncated segment.";
+    return false;
+  }
+  for (size_t i = 0; i < elements.size(); ++i) {
+    const Element& element = elements[i];
+    if (element.id != kSimpleBlockId && element.id != kBlockId) {
+      continue;
+    }
+    // Track number, relative timecode and flags.
+    const uint8* const ptr_end = element.ptr_data + element.size;
+    int64 track = 0;
+    int32 track_length = 0;
+    if (!ReadVint(element.ptr_data, ptr_end, false, &track, &track_length) ||
+        element.size < static_cast<size_t>(track_length) + 3) {
+      LOG(ERROR) << "invalid block.";
+      return false;
+    }
+    const uint8* const ptr_frame = element.ptr_data + track_length + 3;
+    if (ptr_frame[-1] & kLacingMask) {
+      LOG(ERROR) << "laced video blocks are not supported.";
+      return false;
+    }
+    if (vpx_codec_decode(ptr_decoder, ptr_frame,
+                         static_cast<unsigned int>(ptr_end - ptr_frame),
+                         NULL, 0) != VPX_CODEC_OK) {
+      LOG(ERROR) << "decode failed: " << vpx_codec_error(ptr_decoder);
+      return false;
+    }
+    vpx_codec_iter_t iter = NULL;
+    while (const vpx_image_t* const ptr_image =
+               vpx_codec_get_frame(ptr_decoder, &iter)) {
+      int64 time_ms = 0;
+      if ((ptr_image->fmt & VPX_IMG_FMT_HIGHBITDEPTH) ||
+          !webmlive::ReadLatencyCode(ptr_image->planes[VPX_PLANE_Y],
+                                     ptr_image->stride[VPX_PLANE_Y],
+                                     ptr_image->d_w, ptr_image->d_h,
+                                     &time_ms)) {
+        ++ptr_stats->unreadable_frames;
+        continue;
+      }
+      ptr_stats->latencies_ms.push_back(available_ms - time_ms);
+    }
+  }
+  return true;
+}
+
+int checker_main(const CheckerConfig& config) {
+  CURL* const ptr_curl = curl_easy_init();
+  if (!ptr_curl) {
+    LOG(ERROR) << "cannot init curl.";
+    return EXIT_FAILURE;
+  }
+  std::string body;
+  long status = 0;  // NOLINT
+  std::string media;
+  std::string initialization;
+  int64 number = 0;
+  if (!Fetch(ptr_curl, config.url + config.manifest, &body, &status) ||
+      status != 200 ||
+      !ParseManifest(body, config.rep_id, &media, &initialization,
+                     &number)) {
+    LOG(ERROR) << "cannot read the manifest, status=" << status;
+    curl_easy_cleanup(ptr_curl);
+    return EXIT_FAILURE;
+  }
+  if (config.start_number >= 0) {
+    number = config.start_number;
+  }
+
+  // The initialization segment names the codec.
+  std::vector<Element> elements;
+  if (!Fetch(ptr_curl, config.url + initialization, &body, &status) ||
+      status != 200 || !ReadElements(body, &elements)) {
+    LOG(ERROR) << "cannot read " << initialization << ", status=" << status;
+    curl_easy_cleanup(ptr_curl);
+    return EXIT_FAILURE;
+  }
+  std::string codec;
+  for (size_t i = 0; i < elements.size(); ++i) {
+    if (elements[i].id == kCodecIdId) {
+      codec.assign(reinterpret_cast<const char*>(elements[i].ptr_data),
+                   elements[i].size);
+    }
+  }
+  vpx_codec_iface_t* ptr_iface = NULL;
+  if (codec == "V_VP8") {
+    ptr_iface = vpx_codec_vp8_dx();
+  } else if (codec == "V_VP9") {
+    ptr_iface = vpx_codec_vp9_dx();
+  } else {
+    LOG(ERROR) << "unsupported codec: " << codec;
+    curl_easy_cleanup(ptr_curl);
+    return EXIT_FAILURE;
+  }
+  vpx_codec_ctx_t decoder;
+  if (vpx_codec_dec_init(&decoder, ptr_iface, NULL, 0) != VPX_CODEC_OK) {
+    LOG(ERROR) << "cannot init the " << codec << " decoder.";
+    curl_easy_cleanup(ptr_curl);
+    return EXIT_FAILURE;
+  }
+  printf("Measuring %d segments of representation %s from segment %lld.\n",
+         config.num_segments, config.rep_id.c_str(),
+         static_cast<long long>(number));  // NOLINT
+
+  // A segment is available from the first request that finds it; the
+  // latencies include up to one poll interval of the checker.
+  LatencyStats total;
+  int exit_code = EXIT_SUCCESS;
+  for (int i = 0; i < config.num_segments; ++i, ++number) {
+    std::ostringstream number_text;
+    number_text << number;
+    std::string name = media;
+    ReplaceAll("$Number$", number_text.str(), &name);
+    const int64 deadline_ms = SystemClockMilliseconds() +
+        config.timeout * 1000LL;
+    int64 available_ms = 0;
+    for (;;) {
+      available_ms = SystemClockMilliseconds();
+      if (Fetch(ptr_curl, config.url + name, &body, &status) &&
+          status == 200) {
+        break;
+      }
+      if (available_ms >= deadline_ms) {
+        break;
+      }
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(config.poll_interval));
+    }
+    LatencyStats segment;
+    if (status != 200 ||
+        !CheckSegment(body, available_ms, &decoder, &segment)) {
+      LOG(ERROR) << "cannot check " << name << ", status=" << status;
+      exit_code = EXIT_FAILURE;
+      break;
+    }
+    report("segment=" + number_text.str(), segment);
+    total.latencies_ms.insert(total.latencies_ms.end(),
+                              segment.latencies_ms.begin(),
+                              segment.latencies_ms.end());
+    total.unreadable_frames += segment.unreadable_frames;
+  }
+  report("total", total);
+  vpx_codec_destroy(&decoder);
+  curl_easy_cleanup(ptr_curl);
+  return exit_code;
+}
+}  // namespace
+
+int main(int argc, const char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  CheckerConfig config;
+  if (!parse_command_line(argc, argv, &config)) {
+    usage(argv);
+    return EXIT_FAILURE;
+  }
+  curl_global_init(CURL_GLOBAL_ALL);
+  const int exit_code = checker_main(config);
+  curl_global_cleanup();
+  google::ShutdownGoogleLogging();
+  return exit_code;
+}
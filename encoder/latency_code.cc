@@ -0,0 +1,193 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/latency_code.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace webmlive {
+
+namespace {
+const int kNumCells = kLatencyCodeColumns * kLatencyCodeRows;
+const int kSyncBits = 8;
+const int kTimeBits = 48;
+const int kCrcBits = 8;
+const uint8 kSyncPattern = 0xB2;
+
+// Video range luma of set and clear cells, and neutral chroma.
+const uint8 kWhite = 235;
+const uint8 kBlack = 16;
+const uint8 kNeutralChroma = 128;
+
+// Smallest difference between the averages of set and clear sync cells of
+// a code that is read; compression leaves far more.
+const int kMinContrast = 64;
+
+// Returns the CRC-8, polynomial x^8 + x^2 + x + 1, of the low |kTimeBits|
+// bits of |time_ms|, big endian.
+uint8 TimeCrc(int64 time_ms) {
+  uint8 crc = 0;
+  for (int shift = kTimeBits - 8; shift >= 0; shift -= 8) {
+    crc ^= static_cast<uint8>(time_ms >> shift);
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = static_cast<uint8>((crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1);
+    }
+  }
+  return crc;
+}
+
+// Returns the position of the edge before cell |index| of a frame dimension
+// of |size| pixels split in |cells| cells. The grid starts at cell 1.
+int32 CellEdge(int index, int32 size, int cells) {
+  return static_cast<int32>(static_cast<int64>(index + 1) * size / cells);
+}
+
+// Returns true when the cells of a |width| x |height| frame are at least
+// two pixels square.
+bool CodeFits(int32 width, int32 height) {
+  return width / kLatencyCodeFrameColumns >= 2 &&
+         height / kLatencyCodeFrameRows >= 2;
+}
+}  // namespace
+
+bool DrawLatencyCode(int64 time_ms, VideoFrame* ptr_frame,
+                     VideoRect* ptr_rect) {
+  *ptr_rect = VideoRect();
+  if ((ptr_frame->format() != kVideoFormatI420 &&
+       ptr_frame->format() != kVideoFormatYV12) ||
+      !CodeFits(ptr_frame->width(), ptr_frame->height())) {
+    return false;
+  }
+  const VideoPlane y_plane = ptr_frame->plane(VideoFrame::kPlaneY);
+  const VideoPlane u_plane = ptr_frame->plane(VideoFrame::kPlaneU);
+  const VideoPlane v_plane = ptr_frame->plane(VideoFrame::kPlaneV);
+  if (!y_plane.data || !u_plane.data || !v_plane.data) {
+    return false;
+  }
+
+  bool bits[kNumCells];
+  for (int i = 0; i < kSyncBits; ++i) {
+    bits[i] = (kSyncPattern >> (kSyncBits - 1 - i)) & 1;
+  }
+  for (int i = 0; i < kTimeBits; ++i) {
+    bits[kSyncBits + i] = (time_ms >> (kTimeBits - 1 - i)) & 1;
+  }
+  const uint8 crc = TimeCrc(time_ms);
+  for (int i = 0; i < kCrcBits; ++i) {
+    bits[kSyncBits + kTimeBits + i] = (crc >> (kCrcBits - 1 - i)) & 1;
+  }
+
+  const int32 width = ptr_frame->width();
+  const int32 height = ptr_frame->height();
+  for (int row = 0; row < kLatencyCodeRows; ++row) {
+    const int32 top = CellEdge(row, height, kLatencyCodeFrameRows);
+    const int32 bottom = CellEdge(row + 1, height, kLatencyCodeFrameRows);
+    for (int column = 0; column < kLatencyCodeColumns; ++column) {
+      const int32 left = CellEdge(column, width, kLatencyCodeFrameColumns);
+      const int32 right =
+          CellEdge(column + 1, width, kLatencyCodeFrameColumns);
+      const uint8 value =
+          bits[row * kLatencyCodeColumns + column] ? kWhite : kBlack;
+      for (int32 y = top; y < bottom; ++y) {
+        memset(y_plane.data + y * y_plane.stride + left, value, right - left);
+      }
+    }
+  }
+
+  // Chroma covers the grid, widened to even pixels.
+  const int32 left = CellEdge(0, width, kLatencyCodeFrameColumns) & ~1;
+  const int32 top = CellEdge(0, height, kLatencyCodeFrameRows) & ~1;
+  const int32 right = std::min(
+      (CellEdge(kLatencyCodeColumns, width, kLatencyCodeFrameColumns) + 1) &
+          ~1, width);
+  const int32 bottom = std::min(
+      (CellEdge(kLatencyCodeRows, height, kLatencyCodeFrameRows) + 1) & ~1,
+      height);
+  const int32 uv_width = (right + 1) / 2 - left / 2;
+  for (int32 y = top / 2; y < (bottom + 1) / 2; ++y) {
+    memset(u_plane.data + y * u_plane.stride + left / 2, kNeutralChroma,
+           uv_width);
+    memset(v_plane.data + y * v_plane.stride + left / 2, kNeutralChroma,
+           uv_width);
+  }
+  *ptr_rect = VideoRect(left, top, right - left, bottom - top);
+  return true;
+}
+
+bool ReadLatencyCode(const uint8* ptr_y, int32 stride, int32 width,
+                     int32 height, int64* ptr_time_ms) {
+  if (!ptr_y || !ptr_time_ms || !CodeFits(width, height)) {
+    return false;
+  }
+  int averages[kNumCells];
+  for (int row = 0; row < kLatencyCodeRows; ++row) {
+    int32 top = CellEdge(row, height, kLatencyCodeFrameRows);
+    int32 bottom = CellEdge(row + 1, height, kLatencyCodeFrameRows);
+    const int32 y_inset = (bottom - top) / 4;
+    top += y_inset;
+    bottom -= y_inset;
+    for (int column = 0; column < kLatencyCodeColumns; ++column) {
+      int32 left = CellEdge(column, width, kLatencyCodeFrameColumns);
+      int32 right = CellEdge(column + 1, width, kLatencyCodeFrameColumns);
+      const int32 x_inset = (right - left) / 4;
+      left += x_inset;
+      right -= x_inset;
+      int64 sum = 0;
+      for (int32 y = top; y < bottom; ++y) {
+        const uint8* const ptr_row = ptr_y + y * stride;
+        for (int32 x = left; x < right; ++x) {
+          sum += ptr_row[x];
+        }
+      }
+      averages[row * kLatencyCodeColumns + column] =
+          static_cast<int>(sum / ((bottom - top) * (right - left)));
+    }
+  }
+
+  // The sync cells give the levels of set and clear cells as decoded.
+  int set_sum = 0;
+  int set_count = 0;
+  int clear_sum = 0;
+  int clear_count = 0;
+  for (int i = 0; i < kSyncBits; ++i) {
+    if ((kSyncPattern >> (kSyncBits - 1 - i)) & 1) {
+      set_sum += averages[i];
+      ++set_count;
+    } else {
+      clear_sum += averages[i];
+      ++clear_count;
+    }
+  }
+  const int set_level = set_sum / set_count;
+  const int clear_level = clear_sum / clear_count;
+  if (set_level - clear_level < kMinContrast) {
+    return false;
+  }
+  const int threshold = (set_level + clear_level) / 2;
+
+  uint8 sync = 0;
+  for (int i = 0; i < kSyncBits; ++i) {
+    sync = static_cast<uint8>((sync << 1) | (averages[i] > threshold));
+  }
+  int64 time_ms = 0;
+  for (int i = 0; i < kTimeBits; ++i) {
+    time_ms = (time_ms << 1) | (averages[kSyncBits + i] > threshold);
+  }
+  uint8 crc = 0;
+  for (int i = 0; i < kCrcBits; ++i) {
+    crc = static_cast<uint8>(
+        (crc << 1) | (averages[kSyncBits + kTimeBits + i] > threshold));
+  }
+  if (sync != kSyncPattern || crc != TimeCrc(time_ms)) {
+    return false;
+  }
+  *ptr_time_ms = time_ms;
+  return true;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,48 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_LATENCY_CODE_H_
+#define WEBMLIVE_ENCODER_LATENCY_CODE_H_
+
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+// Machine readable time code burned into video to measure glass-to-glass
+// latency: a grid of |kLatencyCodeColumns| x |kLatencyCodeRows| black and
+// white cells near the top left corner of the frame holding 8 sync bits, a
+// 48 bit wall clock time in milliseconds since the epoch and a CRC-8 of the
+// time, row by row and most significant bit first.
+//
+// Cells are 1/|kLatencyCodeFrameColumns| of the frame width wide and
+// 1/|kLatencyCodeFrameRows| of its height tall, and the grid starts one cell
+// from the frame edges, so that the code keeps its place in scaled
+// representations and is read without knowing the size it was drawn at.
+const int kLatencyCodeColumns = 16;
+const int kLatencyCodeRows = 4;
+const int kLatencyCodeFrameColumns = 80;
+const int kLatencyCodeFrameRows = 45;
+
+// Draws |time_ms| over |ptr_frame|, and stores the rectangle drawn in
+// |ptr_rect|. Luma is black or white and chroma neutral over the rectangle.
+// Returns false, and draws nothing, for frames that are not 8 bit I420 or
+// YV12 in memory, and for frames too small for two pixel cells.
+bool DrawLatencyCode(int64 time_ms, VideoFrame* ptr_frame,
+                     VideoRect* ptr_rect);
+
+// Reads the time drawn by |DrawLatencyCode()| from the |width| x |height|
+// luma plane at |ptr_y| with stride |stride|. Each cell is the average of
+// its central half, compared against the midpoint of the sync cells.
+// Returns false when the sync bits or the CRC do not match, as in frames
+// without a code.
+bool ReadLatencyCode(const uint8* ptr_y, int32 stride, int32 width,
+                     int32 height, int64* ptr_time_ms);
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_LATENCY_CODE_H_
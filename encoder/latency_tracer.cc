@@ -0,0 +1,229 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/latency_tracer.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <vector>
+
+#include "encoder/time_util.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+
+// Single producer, single consumer ring of |LatencyTraceEvent|s. The owning
+// thread writes events and advances |head|; |LatencyCollector| reads them and
+// advances |tail|.
+struct TraceRing {
+  TraceRing() : head(0), tail(0), dropped(0) {}
+  std::atomic<uint32> head;
+  std::atomic<uint32> tail;
+  std::atomic<int64> dropped;
+  LatencyTraceEvent events[LatencyTracer::kRingSize];
+};
+
+// All rings ever created. |mutex| is taken only when a thread stamps its
+// first event, and by |LatencyCollector::Collect()|.
+struct TraceRegistry {
+  std::mutex mutex;
+  std::vector<std::unique_ptr<TraceRing>> rings;
+};
+
+TraceRegistry& Registry() {
+  static TraceRegistry registry;
+  return registry;
+}
+
+std::atomic<bool> g_tracing_enabled(false);
+thread_local TraceRing* t_ring = NULL;
+
+TraceRing* ThreadRing() {
+  if (!t_ring) {
+    std::unique_ptr<TraceRing> ring(new (std::nothrow) TraceRing());  // NOLINT
+    if (!ring)
+      return NULL;
+    TraceRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    t_ring = ring.get();
+    registry.rings.push_back(std::move(ring));
+  }
+  return t_ring;
+}
+
+bool IsCaptureSideStage(int32 stage) {
+  return stage < LatencyTracer::kEncode;
+}
+
+}  // namespace
+
+//
+// LatencyHistogram
+//
+LatencyHistogram::LatencyHistogram() : count(0), total_us(0), max_us(0) {
+  for (int i = 0; i < kNumBuckets; ++i)
+    buckets[i] = 0;
+}
+
+void LatencyHistogram::Add(int64 latency_us) {
+  if (latency_us < 0)
+    latency_us = 0;
+  int bucket = 0;
+  for (int64 latency_ms = latency_us / 1000;
+       latency_ms > 0 && bucket < kNumBuckets - 1; latency_ms >>= 1) {
+    ++bucket;
+  }
+  ++buckets[bucket];
+  ++count;
+  total_us += latency_us;
+  if (latency_us > max_us)
+    max_us = latency_us;
+}
+
+int64 LatencyHistogram::Percentile(double percentile) const {
+  if (count == 0)
+    return 0;
+  const double target = count * percentile / 100.0;
+  int64 seen = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    seen += buckets[i];
+    if (seen >= target && seen > 0)
+      return static_cast<int64>(1) << i;
+  }
+  return static_cast<int64>(1) << (kNumBuckets - 1);
+}
+
+//
+// LatencyTracer
+//
+void LatencyTracer::Enable(bool enable) {
+  g_tracing_enabled.store(enable, std::memory_order_relaxed);
+}
+
+bool LatencyTracer::enabled() {
+  return g_tracing_enabled.load(std::memory_order_relaxed);
+}
+
+void LatencyTracer::Stamp(Stage stage, int64 media_time) {
+  if (!enabled())
+    return;
+  TraceRing* const ring = ThreadRing();
+  if (!ring)
+    return;
+  const uint32 head = ring->head.load(std::memory_order_relaxed);
+  const uint32 tail = ring->tail.load(std::memory_order_acquire);
+  if (head - tail >= static_cast<uint32>(kRingSize)) {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  LatencyTraceEvent& event = ring->events[head % kRingSize];
+  event.stage = stage;
+  event.media_time = media_time;
+  event.time_us = SteadyClockMicroseconds();
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+const char* LatencyTracer::StageName(Stage stage) {
+  switch (stage) {
+    case kCapture: return "capture";
+    case kCommit: return "commit";
+    case kDecommit: return "decommit";
+    case kEncode: return "encode";
+    case kMux: return "mux";
+    case kChunkReady: return "chunk_ready";
+    case kUpload: return "upload";
+    case kNumStages: break;
+  }
+  return "unknown";
+}
+
+//
+// LatencyStats
+//
+std::string LatencyStats::ToString() const {
+  std::ostringstream out;
+  for (int i = 0; i < LatencyTracer::kNumStages; ++i) {
+    const LatencyHistogram& histogram = stages[i];
+    out << LatencyTracer::StageName(static_cast<LatencyTracer::Stage>(i))
+        << ": count=" << histogram.count;
+    if (histogram.count > 0) {
+      out << " mean_ms=" << histogram.total_us / histogram.count / 1000.0
+          << " p50_ms<=" << histogram.Percentile(50)
+          << " p99_ms<=" << histogram.Percentile(99)
+          << " max_ms=" << histogram.max_us / 1000.0;
+    }
+    out << "\n";
+  }
+  out << "dropped_events=" << dropped_events
+      << " unmatched_events=" << unmatched_events << "\n";
+  return out.str();
+}
+
+//
+// LatencyCollector
+//
+
+// Events are drained from all rings before any is matched, and capture
+// stamps are applied first. A stage stamped on one thread can still be
+// drained before the capture stamp it follows when the capture thread's
+// ring was read first; such events wait for one more |Collect()|.
+void LatencyCollector::Collect(int64 timestamp_offset) {
+  std::vector<LatencyTraceEvent> events;
+  events.swap(retry_events_);
+  const size_t num_retries = events.size();
+  {
+    TraceRegistry& registry = Registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (size_t i = 0; i < registry.rings.size(); ++i) {
+      TraceRing& ring = *registry.rings[i];
+      const uint32 head = ring.head.load(std::memory_order_acquire);
+      uint32 tail = ring.tail.load(std::memory_order_relaxed);
+      for (; tail != head; ++tail)
+        events.push_back(ring.events[tail % LatencyTracer::kRingSize]);
+      ring.tail.store(tail, std::memory_order_release);
+      stats_.dropped_events +=
+          ring.dropped.exchange(0, std::memory_order_relaxed);
+    }
+  }
+  for (size_t i = 0; i < events.size(); ++i) {
+    LatencyTraceEvent& event = events[i];
+    if (IsCaptureSideStage(event.stage))
+      event.media_time += timestamp_offset;
+    if (event.stage != LatencyTracer::kCapture)
+      continue;
+    capture_times_[event.media_time] = event.time_us;
+    stats_.stages[LatencyTracer::kCapture].Add(0);
+    while (capture_times_.size() > static_cast<size_t>(kMaxCaptureTimes))
+      capture_times_.erase(capture_times_.begin());
+  }
+
+  for (size_t i = 0; i < events.size(); ++i) {
+    const LatencyTraceEvent& event = events[i];
+    if (event.stage == LatencyTracer::kCapture)
+      continue;
+    const std::map<int64, int64>::const_iterator capture =
+        capture_times_.find(event.media_time);
+    if (capture != capture_times_.end()) {
+      stats_.stages[event.stage].Add(event.time_us - capture->second);
+    } else if (i >= num_retries) {
+      // Undo the offset; it is applied again by the next |Collect()|.
+      LatencyTraceEvent retry = event;
+      if (IsCaptureSideStage(retry.stage))
+        retry.media_time -= timestamp_offset;
+      retry_events_.push_back(retry);
+    } else {
+      ++stats_.unmatched_events;
+    }
+  }
+}
+
+}  // namespace webmlive
@@ -0,0 +1,152 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_LATENCY_TRACER_H_
+#define WEBMLIVE_ENCODER_LATENCY_TRACER_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Distribution of latencies since capture. Bucket 0 counts latencies under
+// 1 millisecond, and bucket N those from 2^(N-1) up to 2^N milliseconds. The
+// last bucket also counts everything longer.
+struct LatencyHistogram {
+  static const int kNumBuckets = 18;
+
+  LatencyHistogram();
+
+  // Adds a latency of |latency_us| microseconds.
+  void Add(int64 latency_us);
+
+  // Returns the upper bound, in milliseconds, of the bucket holding the
+  // |percentile| (0 to 100) latency. Returns 0 when the histogram is empty.
+  int64 Percentile(double percentile) const;
+
+  int64 count;
+  int64 total_us;
+  int64 max_us;
+  int64 buckets[kNumBuckets];
+};
+
+// Tracks video frames and chunks through the encoder. Each thread that
+// calls |Stamp()| gets its own fixed size ring of events that only it writes,
+// so stamping takes no locks and costs a clock read and a few stores. The
+// encoder thread drains the rings through a |LatencyCollector|.
+//
+// Frames and chunks are identified by their media timestamp. Chunks use the
+// timestamp of their first frame, so chunk stages measure the latency of
+// that frame.
+//
+// Notes
+// - Events are dropped when a ring is full; |LatencyStats::dropped_events|
+//   counts them.
+// - Rings are never freed. Encoder threads live as long as the encoder, so
+//   their number is bounded.
+class LatencyTracer {
+ public:
+  enum Stage {
+    // Frame delivered by the capture device.
+    kCapture = 0,
+    // Frame committed to the encoder's input pool.
+    kCommit = 1,
+    // Frame removed from the input pool by the encoder thread.
+    kDecommit = 2,
+    // Frame compressed by a video encoder.
+    kEncode = 3,
+    // Compressed frame written to a muxer.
+    kMux = 4,
+    // Chunk read from a muxer and passed to the data sink.
+    kChunkReady = 5,
+    // Chunk accepted by the data sink's destination, as observed by the
+    // encoder thread when the sink next reports that it is ready.
+    kUpload = 6,
+    kNumStages = 7,
+  };
+
+  // Events held by each thread's ring.
+  static const int kRingSize = 4096;
+
+  // Turns stamping on or off. Off by default.
+  static void Enable(bool enable);
+  static bool enabled();
+
+  // Records that the frame or chunk at |media_time| milliseconds reached
+  // |stage|. Capture side stages, those before |kEncode|, are stamped with
+  // the timestamps delivered by the capture device; see
+  // |LatencyCollector::Collect()|. Does nothing when stamping is disabled.
+  static void Stamp(Stage stage, int64 media_time);
+
+  // Returns the name of |stage|.
+  static const char* StageName(Stage stage);
+
+ private:
+  LatencyTracer();
+  ~LatencyTracer();
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(LatencyTracer);
+};
+
+// One |LatencyTracer::Stamp()| call. |time_us| is the tracer clock, a
+// monotonic clock in microseconds.
+struct LatencyTraceEvent {
+  int32 stage;
+  int64 media_time;
+  int64 time_us;
+};
+
+// Latency of each stage, measured from |LatencyTracer::kCapture|.
+struct LatencyStats {
+  LatencyStats() : dropped_events(0), unmatched_events(0) {}
+
+  // Formats the histograms as one line per stage.
+  std::string ToString() const;
+
+  LatencyHistogram stages[LatencyTracer::kNumStages];
+
+  // Events lost to full rings, and events with no matching capture stamp.
+  int64 dropped_events;
+  int64 unmatched_events;
+};
+
+// Drains the |LatencyTracer| rings and matches each event to the capture
+// stamp of its frame. Only one collector may be in use at a time.
+// Note: the class is not thread safe; it is used by the encoder thread only.
+class LatencyCollector {
+ public:
+  // Capture stamps kept for matching later stages.
+  static const int kMaxCaptureTimes = 1024;
+
+  LatencyCollector() {}
+  ~LatencyCollector() {}
+
+  // Moves events waiting in the rings into |stats()|. |timestamp_offset| is
+  // the offset the encoder adds to capture timestamps; it is applied to the
+  // media times of capture side stages before matching.
+  void Collect(int64 timestamp_offset);
+
+  const LatencyStats& stats() const { return stats_; }
+
+ private:
+  // Capture time, in microseconds of the tracer clock, of each recent frame,
+  // keyed by media time after the timestamp offset.
+  std::map<int64, int64> capture_times_;
+
+  // Events drained before their capture stamp, retried by the next
+  // |Collect()|. Media times of capture side stages are stored without the
+  // timestamp offset.
+  std::vector<LatencyTraceEvent> retry_events_;
+  LatencyStats stats_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(LatencyCollector);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_LATENCY_TRACER_H_
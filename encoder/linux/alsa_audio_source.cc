@@ -0,0 +1,229 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/linux/alsa_audio_source.h"
+
+#include <alsa/asoundlib.h>
+#include <errno.h>
+
+#include <functional>
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/thread_placement.h"
+#include "encoder/time_util.h"
+#include "encoder/trace_log.h"
+#include "glog/logging.h"
+
+namespace {
+
+const int kBitsPerSample = 16;
+
+// Maximum time |snd_pcm_wait()| blocks. Bounds the delay in noticing
+// |Stop()|.
+const int kMaxIdleWaitMs = 100;
+
+}  // anonymous namespace
+
+namespace webmlive {
+
+AlsaAudioSource::AlsaAudioSource()
+    : ptr_pcm_(NULL),
+      ptr_callback_(NULL),
+      start_time_us_(0),
+      first_timestamp_(-1),
+      frames_read_(0),
+      period_frames_(0),
+      stop_(false),
+      status_(kSuccess) {
+}
+
+AlsaAudioSource::~AlsaAudioSource() {
+  Stop();
+  if (ptr_pcm_) {
+    snd_pcm_close(ptr_pcm_);
+  }
+}
+
+int AlsaAudioSource::Init(const std::string& device,
+                          const AudioConfig& requested_config,
+                          AudioSamplesCallbackInterface* ptr_callback) {
+  if (!ptr_callback) {
+    LOG(ERROR) << "AlsaAudioSource NULL callback.";
+    return kInvalidArg;
+  }
+  ptr_callback_ = ptr_callback;
+
+  int result = snd_pcm_open(&ptr_pcm_, device.c_str(), SND_PCM_STREAM_CAPTURE,
+                            SND_PCM_NONBLOCK);
+  if (result < 0) {
+    LOG(ERROR) << "AlsaAudioSource cannot open " << device << ": "
+               << snd_strerror(result);
+    ptr_pcm_ = NULL;
+    return kDeviceError;
+  }
+
+  unsigned int channels = requested_config.channels > 0 ?
+      requested_config.channels : kDefaultChannels;
+  unsigned int sample_rate = requested_config.sample_rate > 0 ?
+      requested_config.sample_rate : kDefaultSampleRate;
+
+  snd_pcm_hw_params_t* ptr_params = NULL;
+  snd_pcm_hw_params_alloca(&ptr_params);
+  snd_pcm_hw_params_any(ptr_pcm_, ptr_params);
+  if (snd_pcm_hw_params_set_access(ptr_pcm_, ptr_params,
+                                   SND_PCM_ACCESS_RW_INTERLEAVED) < 0 ||
+      snd_pcm_hw_params_set_format(ptr_pcm_, ptr_params,
+                                   SND_PCM_FORMAT_S16_LE) < 0 ||
+      snd_pcm_hw_params_set_channels_near(ptr_pcm_, ptr_params,
+                                          &channels) < 0 ||
+      snd_pcm_hw_params_set_rate_near(ptr_pcm_, ptr_params, &sample_rate,
+                                      NULL) < 0) {
+    LOG(ERROR) << "AlsaAudioSource device does not support S16 capture.";
+    return kDeviceError;
+  }
+
+  snd_pcm_uframes_t period_frames = sample_rate * kPeriodMs / 1000;
+  snd_pcm_hw_params_set_period_size_near(ptr_pcm_, ptr_params,
+                                         &period_frames, NULL);
+  snd_pcm_uframes_t buffer_frames = period_frames * 4;
+  snd_pcm_hw_params_set_buffer_size_near(ptr_pcm_, ptr_params,
+                                         &buffer_frames);
+  result = snd_pcm_hw_params(ptr_pcm_, ptr_params);
+  if (result < 0) {
+    LOG(ERROR) << "AlsaAudioSource snd_pcm_hw_params failed: "
+               << snd_strerror(result);
+    return kDeviceError;
+  }
+
+  actual_config_.format_tag = kAudioFormatPcm;
+  actual_config_.channels = static_cast<uint16>(channels);
+  actual_config_.sample_rate = sample_rate;
+  actual_config_.bits_per_sample = kBitsPerSample;
+  actual_config_.valid_bits_per_sample = kBitsPerSample;
+  actual_config_.block_align =
+      static_cast<uint16>(channels * kBitsPerSample / 8);
+  actual_config_.bytes_per_second =
+      actual_config_.block_align * sample_rate;
+
+  period_frames_ = static_cast<int>(period_frames);
+  period_buffer_.resize(period_frames_ * actual_config_.block_align);
+  LOG(INFO) << "AlsaAudioSource " << device << ": " << channels
+            << " channels @ " << sample_rate << " Hz, period "
+            << period_frames_ << " frames";
+  return kSuccess;
+}
+
+int AlsaAudioSource::Run(int64 start_time_us) {
+  if (capture_thread_) {
+    LOG(ERROR) << "AlsaAudioSource already running.";
+    return kThreadError;
+  }
+  start_time_us_ = start_time_us;
+  const int result = snd_pcm_start(ptr_pcm_);
+  if (result < 0) {
+    LOG(ERROR) << "AlsaAudioSource snd_pcm_start failed: "
+               << snd_strerror(result);
+    return kDeviceError;
+  }
+
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  stop_ = false;
+  capture_thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&AlsaAudioSource::CaptureThread,  // NOLINT
+                                this)));
+  if (!capture_thread_) {
+    LOG(ERROR) << "AlsaAudioSource cannot construct thread.";
+    return kThreadError;
+  }
+  return kSuccess;
+}
+
+void AlsaAudioSource::Stop() {
+  if (capture_thread_) {
+    stop_ = true;
+    capture_thread_->join();
+    capture_thread_.reset();
+    snd_pcm_drop(ptr_pcm_);
+  }
+}
+
+int AlsaAudioSource::ReadPeriod() {
+  const int wait_result = snd_pcm_wait(ptr_pcm_, kMaxIdleWaitMs);
+  if (wait_result == 0) {
+    return kSuccess;
+  }
+
+  const snd_pcm_sframes_t frames =
+      wait_result < 0 ? wait_result :
+      snd_pcm_readi(ptr_pcm_, &period_buffer_[0], period_frames_);
+  if (frames == -EAGAIN) {
+    return kSuccess;
+  }
+  if (frames < 0) {
+    // Overruns (-EPIPE) and suspends (-ESTRPIPE) are recoverable; samples
+    // lost to them are not timestamped, so a gap is left in the timeline.
+    const int result = snd_pcm_recover(ptr_pcm_, static_cast<int>(frames), 1);
+    if (result < 0) {
+      LOG(ERROR) << "AlsaAudioSource read failed: " << snd_strerror(result);
+      return kDeviceError;
+    }
+    LOG(WARNING) << "AlsaAudioSource recovered from "
+                 << snd_strerror(static_cast<int>(frames));
+    first_timestamp_ = -1;
+    return snd_pcm_start(ptr_pcm_) < 0 ? kDeviceError : kSuccess;
+  }
+
+  if (first_timestamp_ < 0) {
+    // Anchor the timeline at the capture time of the first sample read.
+    const int64 period_us = frames * 1000000 / actual_config_.sample_rate;
+    first_timestamp_ =
+        (SteadyClockMicroseconds() - period_us - start_time_us_) / 1000;
+    if (first_timestamp_ < 0) {
+      first_timestamp_ = 0;
+    }
+    frames_read_ = 0;
+  }
+  const int64 timestamp =
+      first_timestamp_ + frames_read_ * 1000 / actual_config_.sample_rate;
+  frames_read_ += frames;
+  const int64 duration =
+      first_timestamp_ + frames_read_ * 1000 / actual_config_.sample_rate -
+      timestamp;
+
+  const int32 length =
+      static_cast<int32>(frames * actual_config_.block_align);
+  if (audio_buffer_.Init(actual_config_, timestamp, duration,
+                         &period_buffer_[0], length)) {
+    LOG(ERROR) << "AlsaAudioSource AudioBuffer Init failed.";
+    return kNoMemory;
+  }
+  WEBMLIVE_TRACE_EVERY_N(TraceLog::kFrame, 100, "audio_capture")
+      << " timestamp=" << timestamp << " frames=" << frames;
+  const int status = ptr_callback_->OnSamplesReceived(&audio_buffer_);
+  if (status && status != AudioSamplesCallbackInterface::kDropped) {
+    LOG(ERROR) << "OnSamplesReceived failed, status=" << status;
+  }
+  return kSuccess;
+}
+
+void AlsaAudioSource::CaptureThread() {
+  LOG(INFO) << "AlsaAudioSource thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(
+      ThreadPlacement::kAudioCapture);
+  ScopedCpuStage cpu_stage(kCpuCapture);
+  int status = kSuccess;
+  while (!stop_ && status == kSuccess) {
+    status = ReadPeriod();
+  }
+  status_ = status;
+  LOG(INFO) << "AlsaAudioSource thread finished, status=" << status;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,102 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_LINUX_ALSA_AUDIO_SOURCE_H_
+#define WEBMLIVE_ENCODER_LINUX_ALSA_AUDIO_SOURCE_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+
+typedef struct _snd_pcm snd_pcm_t;
+
+namespace webmlive {
+
+// Captures interleaved 16 bit PCM from an ALSA device. PulseAudio and
+// PipeWire sources are reached through the ALSA "pulse" and "pipewire"
+// plugins, which are what the "default" device routes to on most desktops.
+//
+// Notes
+// - Samples are delivered in |kPeriodMs| buffers.
+// - Timestamps count samples from the first period, which is anchored to the
+//   start time passed to |Run()|, so they never drift from the audio clock.
+class AlsaAudioSource {
+ public:
+  enum {
+    // Capture thread could not be started.
+    kThreadError = -4,
+    // Device open, configuration or read failed.
+    kDeviceError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Duration of each buffer passed to the callback.
+  static const int kPeriodMs = 10;
+
+  // Defaults used when the requested configuration leaves them unset.
+  static const int kDefaultChannels = 2;
+  static const int kDefaultSampleRate = 44100;
+
+  AlsaAudioSource();
+  ~AlsaAudioSource();
+
+  // Opens and configures |device|. Returns |kSuccess| when successful.
+  int Init(const std::string& device, const AudioConfig& requested_config,
+           AudioSamplesCallbackInterface* ptr_callback);
+
+  // Starts the capture thread. |start_time_us| is the
+  // |std::chrono::steady_clock| time, in microseconds, of timestamp 0.
+  // Returns |kSuccess| when successful.
+  int Run(int64 start_time_us);
+
+  // Stops the capture thread.
+  void Stop();
+
+  // Returns |kSuccess| while capturing, or the error that stopped the
+  // capture thread.
+  int status() const { return status_; }
+
+  const AudioConfig& actual_config() const { return actual_config_; }
+
+ private:
+  // Reads one period and delivers it. Returns |kSuccess| when successful,
+  // including when an overrun was recovered.
+  int ReadPeriod();
+
+  // Capture thread function.
+  void CaptureThread();
+
+  snd_pcm_t* ptr_pcm_;
+  AudioConfig actual_config_;
+  AudioSamplesCallbackInterface* ptr_callback_;
+  int64 start_time_us_;
+
+  // Timestamp of the first sample, and the number of sample frames read
+  // since.
+  int64 first_timestamp_;
+  int64 frames_read_;
+
+  int period_frames_;
+  std::vector<uint8> period_buffer_;
+  AudioBuffer audio_buffer_;
+
+  std::atomic<bool> stop_;
+  std::atomic<int> status_;
+  std::shared_ptr<std::thread> capture_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(AlsaAudioSource);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_LINUX_ALSA_AUDIO_SOURCE_H_
@@ -0,0 +1,304 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/linux/media_source_linux.h"
+
+#include <chrono>
+#include <new>
+#include <sstream>
+
+#include "glog/logging.h"
+
+namespace {
+
+const char kDefaultVideoDevice[] = "/dev/video0";
+const char kVideoDevicePrefix[] = "/dev/video";
+const char kDefaultAudioDevice[] = "default";
+const char kAudioDevicePrefix[] = "plughw:";
+
+}  // anonymous namespace
+
+namespace webmlive {
+
+MediaSourceImpl::MediaSourceImpl() {
+}
+
+MediaSourceImpl::~MediaSourceImpl() {
+  Stop();
+}
+
+int MediaSourceImpl::Init(const WebmEncoderConfig& config,
+                          AudioSamplesCallbackInterface* ptr_audio_callback,
+                          VideoFrameCallbackInterface* ptr_video_callback) {
+  if (!config.disable_video) {
+    if (config.video_capture_desktop) {
+      LOG(ERROR) << "desktop capture is not supported on Linux.";
+      return kNoVideoSource;
+    }
+    if (!ptr_video_callback) {
+      LOG(ERROR) << "NULL video callback.";
+      return kInvalidArg;
+    }
+    ptr_video_source_.reset(new (std::nothrow) V4l2VideoSource());  // NOLINT
+    if (!ptr_video_source_) {
+      return kNoMemory;
+    }
+    const bool pip = !config.pip.device_name.empty();
+    if (pip) {
+      ptr_compositor_.reset(new (std::nothrow) PipCompositor());  // NOLINT
+      if (!ptr_compositor_) {
+        return kNoMemory;
+      }
+    }
+    const int status = ptr_video_source_->Init(
+        VideoDevice(config), config.requested_video_config,
+        pip ? ptr_compositor_->main_input() : ptr_video_callback);
+    if (status) {
+      LOG(ERROR) << "video source Init failed " << status;
+      return status == V4l2VideoSource::kDeviceError ?
+          kNoVideoSource : kVideoConfigureError;
+    }
+    ptr_video_source_->LimitFrameRate(config.max_video_frame_rate,
+                                      config.vpx_config.decimate);
+    if (pip) {
+      const int pip_status = InitOverlay(config, ptr_video_callback);
+      if (pip_status) {
+        return pip_status;
+      }
+    }
+  }
+
+  if (!config.disable_audio) {
+    if (!ptr_audio_callback) {
+      LOG(ERROR) << "NULL audio callback.";
+      return kInvalidArg;
+    }
+    const bool mix = !config.audio_mix.inputs.empty();
+    if (mix) {
+      ptr_mixer_.reset(new (std::nothrow) AudioMixer());  // NOLINT
+      if (!ptr_mixer_) {
+        return kNoMemory;
+      }
+      if (ptr_mixer_->Init(config.audio_mix, ptr_audio_callback)) {
+        LOG(ERROR) << "audio mixer Init failed.";
+        return kAudioConfigureError;
+      }
+    }
+    ptr_audio_source_.reset(new (std::nothrow) AlsaAudioSource());  // NOLINT
+    if (!ptr_audio_source_) {
+      return kNoMemory;
+    }
+    const int status = ptr_audio_source_->Init(
+        AudioDevice(config), config.requested_audio_config,
+        mix ? ptr_mixer_->input(0) : ptr_audio_callback);
+    if (status) {
+      LOG(ERROR) << "audio source Init failed " << status;
+      return status == AlsaAudioSource::kDeviceError ?
+          kNoAudioSource : kAudioConfigureError;
+    }
+    if (mix) {
+      const int mix_status = InitMix(config);
+      if (mix_status) {
+        return mix_status;
+      }
+    }
+  }
+  return kSuccess;
+}
+
+int MediaSourceImpl::InitOverlay(
+    const WebmEncoderConfig& config,
+    VideoFrameCallbackInterface* ptr_video_callback) {
+  if (ptr_compositor_->Init(config.pip, ptr_video_source_->actual_config(),
+                            ptr_video_callback)) {
+    LOG(ERROR) << "picture in picture compositor Init failed.";
+    return kVideoConfigureError;
+  }
+  ptr_overlay_source_.reset(new (std::nothrow) V4l2VideoSource());  // NOLINT
+  if (!ptr_overlay_source_) {
+    return kNoMemory;
+  }
+  const int status = ptr_overlay_source_->Init(
+      config.pip.device_name, config.requested_video_config,
+      ptr_compositor_->overlay_input());
+  if (status) {
+    LOG(ERROR) << "overlay video source " << config.pip.device_name
+               << " Init failed " << status;
+    return status == V4l2VideoSource::kDeviceError ?
+        kNoVideoSource : kVideoConfigureError;
+  }
+  ptr_overlay_source_->LimitFrameRate(config.max_video_frame_rate,
+                                      config.vpx_config.decimate);
+  return kSuccess;
+}
+
+int MediaSourceImpl::InitMix(const WebmEncoderConfig& config) {
+  // Mix inputs are opened in the main PCM's format, which ALSA plugins
+  // convert to, so that only the main PCM's rate reaches the mixer.
+  const AudioConfig& main_config = ptr_audio_source_->actual_config();
+  const std::vector<AudioMixInputConfig>& inputs = config.audio_mix.inputs;
+  mix_sources_.clear();
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    if (inputs[i].device_name.empty()) {
+      LOG(ERROR) << "audio mix input " << i << " needs a device.";
+      return kInvalidArg;
+    }
+    std::unique_ptr<AlsaAudioSource> source(
+        new (std::nothrow) AlsaAudioSource());  // NOLINT
+    if (!source) {
+      return kNoMemory;
+    }
+    const int status = source->Init(inputs[i].device_name, main_config,
+                                    ptr_mixer_->input(static_cast<int>(i) + 1));
+    if (status) {
+      LOG(ERROR) << "audio mix source " << inputs[i].device_name
+                 << " Init failed " << status;
+      return status == AlsaAudioSource::kDeviceError ?
+          kNoAudioSource : kAudioConfigureError;
+    }
+    if (source->actual_config().sample_rate != main_config.sample_rate) {
+      LOG(ERROR) << "audio mix source " << inputs[i].device_name
+                 << " cannot capture at " << main_config.sample_rate
+                 << " Hz.";
+      return kAudioConfigureError;
+    }
+    mix_sources_.push_back(std::move(source));
+  }
+  if (ptr_mixer_->SetOutputConfig(main_config)) {
+    LOG(ERROR) << "audio mixer cannot mix the main audio format.";
+    return kAudioConfigureError;
+  }
+  return kSuccess;
+}
+
+int MediaSourceImpl::InitExtraAudio(
+    const WebmEncoderConfig& config,
+    const std::vector<AudioSamplesCallbackInterface*>& callbacks) {
+  const std::vector<AudioTrackConfig>& tracks = config.extra_audio_tracks;
+  if (callbacks.size() != tracks.size()) {
+    LOG(ERROR) << "need one callback per extra audio track.";
+    return kInvalidArg;
+  }
+  extra_audio_sources_.clear();
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    if (tracks[i].device_name.empty() || !callbacks[i]) {
+      LOG(ERROR) << "extra audio track " << i << " needs a device and a "
+                 << "callback.";
+      return kInvalidArg;
+    }
+    std::unique_ptr<AlsaAudioSource> source(
+        new (std::nothrow) AlsaAudioSource());  // NOLINT
+    if (!source) {
+      return kNoMemory;
+    }
+    const int status = source->Init(tracks[i].device_name,
+                                    config.requested_audio_config,
+                                    callbacks[i]);
+    if (status) {
+      LOG(ERROR) << "extra audio source " << tracks[i].device_name
+                 << " Init failed " << status;
+      return status == AlsaAudioSource::kDeviceError ?
+          kNoAudioSource : kAudioConfigureError;
+    }
+    extra_audio_sources_.push_back(std::move(source));
+  }
+  return kSuccess;
+}
+
+int MediaSourceImpl::Run() {
+  // Both sources share timestamp 0 so that audio and video stay in sync.
+  const int64 start_time_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+  if (ptr_video_source_ && ptr_video_source_->Run(start_time_us)) {
+    LOG(ERROR) << "video source Run failed.";
+    return kVideoConfigureError;
+  }
+  if (ptr_overlay_source_ && ptr_overlay_source_->Run(start_time_us)) {
+    LOG(ERROR) << "overlay video source Run failed.";
+    return kVideoConfigureError;
+  }
+  if (ptr_audio_source_ && ptr_audio_source_->Run(start_time_us)) {
+    LOG(ERROR) << "audio source Run failed.";
+    return kAudioConfigureError;
+  }
+  for (size_t i = 0; i < extra_audio_sources_.size(); ++i) {
+    if (extra_audio_sources_[i]->Run(start_time_us)) {
+      LOG(ERROR) << "extra audio source " << i << " Run failed.";
+      return kAudioConfigureError;
+    }
+  }
+  for (size_t i = 0; i < mix_sources_.size(); ++i) {
+    if (mix_sources_[i]->Run(start_time_us)) {
+      LOG(ERROR) << "audio mix source " << i << " Run failed.";
+      return kAudioConfigureError;
+    }
+  }
+  return kSuccess;
+}
+
+int MediaSourceImpl::CheckStatus() {
+  if ((ptr_video_source_ && ptr_video_source_->status()) ||
+      (ptr_audio_source_ && ptr_audio_source_->status())) {
+    return kAVCaptureStopped;
+  }
+  for (size_t i = 0; i < extra_audio_sources_.size(); ++i) {
+    if (extra_audio_sources_[i]->status()) {
+      return kAVCaptureStopped;
+    }
+  }
+  for (size_t i = 0; i < mix_sources_.size(); ++i) {
+    if (mix_sources_[i]->status()) {
+      return kAVCaptureStopped;
+    }
+  }
+  return kSuccess;
+}
+
+void MediaSourceImpl::Stop() {
+  if (ptr_video_source_) {
+    ptr_video_source_->Stop();
+  }
+  if (ptr_overlay_source_) {
+    ptr_overlay_source_->Stop();
+  }
+  if (ptr_audio_source_) {
+    ptr_audio_source_->Stop();
+  }
+  for (size_t i = 0; i < extra_audio_sources_.size(); ++i) {
+    extra_audio_sources_[i]->Stop();
+  }
+  for (size_t i = 0; i < mix_sources_.size(); ++i) {
+    mix_sources_[i]->Stop();
+  }
+}
+
+std::string MediaSourceImpl::VideoDevice(const WebmEncoderConfig& config) {
+  if (!config.video_device_name.empty()) {
+    return config.video_device_name;
+  }
+  if (config.video_device_index == kUseDefaultDevice) {
+    return kDefaultVideoDevice;
+  }
+  std::ostringstream device;
+  device << kVideoDevicePrefix << config.video_device_index;
+  return device.str();
+}
+
+std::string MediaSourceImpl::AudioDevice(const WebmEncoderConfig& config) {
+  if (!config.audio_device_name.empty()) {
+    return config.audio_device_name;
+  }
+  if (config.audio_device_index == kUseDefaultDevice) {
+    return kDefaultAudioDevice;
+  }
+  std::ostringstream device;
+  device << kAudioDevicePrefix << config.audio_device_index;
+  return device.str();
+}
+
+}  // namespace webmlive
@@ -0,0 +1,125 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_LINUX_MEDIA_SOURCE_LINUX_H_
+#define WEBMLIVE_ENCODER_LINUX_MEDIA_SOURCE_LINUX_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/audio_mixer.h"
+#include "encoder/basictypes.h"
+#include "encoder/linux/alsa_audio_source.h"
+#include "encoder/linux/v4l2_video_source.h"
+#include "encoder/media_source.h"
+#include "encoder/pip_compositor.h"
+#include "encoder/video_encoder.h"
+#include "encoder/webm_encoder.h"
+
+namespace webmlive {
+
+// Linux capture source: video from a V4L2 device, audio from an ALSA device.
+//
+// Device selection
+// - Video: |video_device_name| is a device path. When empty,
+//   |video_device_index| selects /dev/video<index>; the default is
+//   /dev/video0.
+// - Audio: |audio_device_name| is an ALSA PCM name, "hw:1,0" or "pulse" for
+//   example. When empty, |audio_device_index| selects plughw:<index>; the
+//   default is the "default" PCM. Each of |extra_audio_tracks| names its own
+//   PCM, captured on its own thread.
+// - Audio mixing: each of |audio_mix.inputs| names a PCM, opened with the
+//   main PCM's rate and channel count and captured on its own thread. An
+//   |AudioMixer| mixes them with the main PCM into the audio callback's
+//   buffers.
+// - Picture in picture: |pip.device_name| is the device path of a second
+//   V4L2 device, captured on its own thread and drawn over the video by a
+//   |PipCompositor|. Losing it is not an error: the video is then passed on
+//   without the overlay.
+class MediaSourceImpl : public MediaSourceInterface {
+ public:
+  enum {
+    kNoMemory = WebmEncoder::kNoMemory,
+    kAudioConfigureError = WebmEncoder::kAudioConfigureError,
+    kVideoConfigureError = WebmEncoder::kVideoConfigureError,
+    kNoAudioSource = WebmEncoder::kNoAudioSource,
+    kNoVideoSource = WebmEncoder::kNoVideoSource,
+    kAVCaptureStopped = WebmEncoder::kAVCaptureStopped,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+  MediaSourceImpl();
+  virtual ~MediaSourceImpl();
+
+  // Opens and configures the capture devices. Returns |kSuccess| upon
+  // success, or a |WebmEncoder| status code upon failure.
+  virtual int Init(const WebmEncoderConfig& config,
+                   AudioSamplesCallbackInterface* ptr_audio_callback,
+                   VideoFrameCallbackInterface* ptr_video_callback);
+
+  // Starts capture. Returns |kSuccess| upon success, or a |WebmEncoder|
+  // status code upon failure.
+  virtual int Run();
+
+  // Returns |kAVCaptureStopped| when a capture thread failed.
+  virtual int CheckStatus();
+
+  // Stops capture.
+  virtual void Stop();
+
+  virtual AudioConfig actual_audio_config() const {
+    if (ptr_mixer_) {
+      return ptr_mixer_->output_config();
+    }
+    return ptr_audio_source_ ? ptr_audio_source_->actual_config() :
+        AudioConfig();
+  }
+  virtual VideoConfig actual_video_config() const {
+    return ptr_video_source_ ? ptr_video_source_->actual_config() :
+        VideoConfig();
+  }
+
+  // Opens an ALSA PCM for each of |config.extra_audio_tracks|.
+  virtual int InitExtraAudio(
+      const WebmEncoderConfig& config,
+      const std::vector<AudioSamplesCallbackInterface*>& callbacks);
+  virtual AudioConfig actual_extra_audio_config(size_t index) const {
+    return index < extra_audio_sources_.size() ?
+        extra_audio_sources_[index]->actual_config() : AudioConfig();
+  }
+
+ private:
+  // Creates the compositor's overlay source, after |ptr_video_source_|.
+  // Returns |kSuccess| upon success, or a |WebmEncoder| status code upon
+  // failure.
+  int InitOverlay(const WebmEncoderConfig& config,
+                  VideoFrameCallbackInterface* ptr_video_callback);
+
+  // Opens the PCMs of |config.audio_mix|, after |ptr_audio_source_|, and
+  // sets the mixer's output format. Returns |kSuccess| upon success, or a
+  // |WebmEncoder| status code upon failure.
+  int InitMix(const WebmEncoderConfig& config);
+
+  // Returns the V4L2 device path or ALSA PCM name selected by |config|.
+  static std::string VideoDevice(const WebmEncoderConfig& config);
+  static std::string AudioDevice(const WebmEncoderConfig& config);
+
+  std::unique_ptr<V4l2VideoSource> ptr_video_source_;
+  std::unique_ptr<V4l2VideoSource> ptr_overlay_source_;
+  std::unique_ptr<PipCompositor> ptr_compositor_;
+  std::unique_ptr<AlsaAudioSource> ptr_audio_source_;
+  std::vector<std::unique_ptr<AlsaAudioSource>> extra_audio_sources_;
+  std::unique_ptr<AudioMixer> ptr_mixer_;
+  std::vector<std::unique_ptr<AlsaAudioSource>> mix_sources_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(MediaSourceImpl);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_LINUX_MEDIA_SOURCE_LINUX_H_
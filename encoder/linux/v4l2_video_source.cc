@@ -0,0 +1,451 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/linux/v4l2_video_source.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/latency_tracer.h"
+#include "encoder/thread_placement.h"
+#include "encoder/time_util.h"
+#include "encoder/trace_log.h"
+#include "glog/logging.h"
+
+namespace {
+
+// V4L2 pixel formats handled by |VideoFrame|. |CaptureFormatPolicy| picks
+// among those the device offers.
+struct PixelFormatMapping {
+  uint32 fourcc;
+  webmlive::VideoFormat format;
+};
+const PixelFormatMapping kPixelFormats[] = {
+  {V4L2_PIX_FMT_YUV420, webmlive::kVideoFormatI420},
+  {V4L2_PIX_FMT_YVU420, webmlive::kVideoFormatYV12},
+  {V4L2_PIX_FMT_NV12, webmlive::kVideoFormatNV12},
+  {V4L2_PIX_FMT_NV21, webmlive::kVideoFormatNV21},
+  {V4L2_PIX_FMT_YUYV, webmlive::kVideoFormatYUYV},
+  {V4L2_PIX_FMT_UYVY, webmlive::kVideoFormatUYVY},
+#ifdef WEBMLIVE_HAVE_MJPEG
+  // Often the only format of the larger sizes of USB cameras.
+  {V4L2_PIX_FMT_MJPEG, webmlive::kVideoFormatMJPEG},
+#endif
+  // Compressed formats of UVC 1.5 cameras, muxed without encoding. Ranked
+  // only when requested.
+#ifdef V4L2_PIX_FMT_VP8
+  {V4L2_PIX_FMT_VP8, webmlive::kVideoFormatVP8},
+#endif
+#ifdef V4L2_PIX_FMT_VP9
+  {V4L2_PIX_FMT_VP9, webmlive::kVideoFormatVP9},
+#endif
+};
+const int kNumPixelFormats = sizeof(kPixelFormats) / sizeof(kPixelFormats[0]);
+
+// Capture size used when none is requested.
+const int kDefaultWidth = 640;
+const int kDefaultHeight = 480;
+
+}  // anonymous namespace
+
+namespace webmlive {
+
+V4l2VideoSource::V4l2VideoSource()
+    : fd_(-1),
+      streaming_(false),
+      ptr_callback_(NULL),
+      start_time_us_(0),
+      stop_(false),
+      status_(kSuccess) {
+}
+
+V4l2VideoSource::~V4l2VideoSource() {
+  Stop();
+  UnmapBuffers();
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+int V4l2VideoSource::Init(const std::string& device,
+                          const VideoConfig& requested_config,
+                          VideoFrameCallbackInterface* ptr_callback) {
+  if (!ptr_callback) {
+    LOG(ERROR) << "V4l2VideoSource NULL callback.";
+    return kInvalidArg;
+  }
+  ptr_callback_ = ptr_callback;
+
+  fd_ = open(device.c_str(), O_RDWR | O_NONBLOCK);
+  if (fd_ < 0) {
+    LOG(ERROR) << "V4l2VideoSource cannot open " << device << ": "
+               << strerror(errno);
+    return kDeviceError;
+  }
+
+  v4l2_capability capability;
+  memset(&capability, 0, sizeof(capability));
+  if (Ioctl(VIDIOC_QUERYCAP, &capability)) {
+    LOG(ERROR) << device << " is not a V4L2 device.";
+    return kDeviceError;
+  }
+  if (!(capability.capabilities & V4L2_CAP_VIDEO_CAPTURE) ||
+      !(capability.capabilities & V4L2_CAP_STREAMING)) {
+    LOG(ERROR) << device << " cannot stream video capture.";
+    return kDeviceError;
+  }
+  LOG(INFO) << "V4l2VideoSource device " << device << ": "
+            << reinterpret_cast<const char*>(capability.card);
+
+  int status = SetFormat(requested_config);
+  if (status) {
+    return status;
+  }
+  return MapBuffers();
+}
+
+void V4l2VideoSource::LimitFrameRate(double max_frame_rate, int decimate) {
+  const double frame_rate = FrameRateLimiter::OutputFrameRate(
+      actual_config_.frame_rate, max_frame_rate, decimate);
+  if (frame_rate <= 0 || frame_rate == actual_config_.frame_rate) {
+    frame_rate_limiter_.Init(0);
+    return;
+  }
+  frame_rate_limiter_.Init(frame_rate);
+  actual_config_.frame_rate = frame_rate;
+}
+
+int V4l2VideoSource::Run(int64 start_time_us) {
+  if (capture_thread_) {
+    LOG(ERROR) << "V4l2VideoSource already running.";
+    return kThreadError;
+  }
+  start_time_us_ = start_time_us;
+  v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  if (Ioctl(VIDIOC_STREAMON, &type)) {
+    LOG(ERROR) << "V4l2VideoSource VIDIOC_STREAMON failed: "
+               << strerror(errno);
+    return kDeviceError;
+  }
+  streaming_ = true;
+
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  stop_ = false;
+  capture_thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&V4l2VideoSource::CaptureThread,  // NOLINT
+                                this)));
+  if (!capture_thread_) {
+    LOG(ERROR) << "V4l2VideoSource cannot construct thread.";
+    return kThreadError;
+  }
+  return kSuccess;
+}
+
+void V4l2VideoSource::Stop() {
+  if (capture_thread_) {
+    stop_ = true;
+    capture_thread_->join();
+    capture_thread_.reset();
+  }
+  if (streaming_) {
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (Ioctl(VIDIOC_STREAMOFF, &type)) {
+      LOG(WARNING) << "V4l2VideoSource VIDIOC_STREAMOFF failed.";
+    }
+    streaming_ = false;
+  }
+}
+
+int V4l2VideoSource::Ioctl(unsigned long request, void* ptr_arg) {  // NOLINT
+  int result;
+  do {
+    result = ioctl(fd_, request, ptr_arg);
+  } while (result == -1 && errno == EINTR);
+  return result;
+}
+
+int V4l2VideoSource::SetFormat(const VideoConfig& requested_config) {
+  // Collect the supported formats the device offers, at every size.
+  std::vector<CaptureFormatCandidate> candidates;
+  v4l2_fmtdesc format_desc;
+  memset(&format_desc, 0, sizeof(format_desc));
+  format_desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  while (Ioctl(VIDIOC_ENUM_FMT, &format_desc) == 0) {
+    for (int i = 0; i < kNumPixelFormats; ++i) {
+      if (format_desc.pixelformat == kPixelFormats[i].fourcc) {
+        AddCandidates(kPixelFormats[i].fourcc, kPixelFormats[i].format,
+                      &candidates);
+        break;
+      }
+    }
+    ++format_desc.index;
+  }
+
+  // Rank for the size that will be requested.
+  VideoConfig ranked_config = requested_config;
+  if (ranked_config.width <= 0)
+    ranked_config.width = kDefaultWidth;
+  if (ranked_config.height <= 0)
+    ranked_config.height = kDefaultHeight;
+  CaptureFormatPolicy::Rank(ranked_config, 8, &candidates);
+  if (candidates.empty()) {
+    LOG(ERROR) << "V4l2VideoSource device offers no supported format.";
+    return kUnsupportedFormat;
+  }
+  const PixelFormatMapping* ptr_mapping = NULL;
+  for (int i = 0; i < kNumPixelFormats && !ptr_mapping; ++i) {
+    if (kPixelFormats[i].format == candidates[0].format)
+      ptr_mapping = &kPixelFormats[i];
+  }
+
+  v4l2_format format;
+  memset(&format, 0, sizeof(format));
+  format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  format.fmt.pix.width =
+      requested_config.width > 0 ? requested_config.width : kDefaultWidth;
+  format.fmt.pix.height =
+      requested_config.height > 0 ? requested_config.height : kDefaultHeight;
+  format.fmt.pix.pixelformat = ptr_mapping->fourcc;
+  format.fmt.pix.field = V4L2_FIELD_NONE;
+  if (Ioctl(VIDIOC_S_FMT, &format)) {
+    LOG(ERROR) << "V4l2VideoSource VIDIOC_S_FMT failed: " << strerror(errno);
+    return kDeviceError;
+  }
+  if (format.fmt.pix.pixelformat != ptr_mapping->fourcc) {
+    LOG(ERROR) << "V4l2VideoSource driver changed the pixel format.";
+    return kUnsupportedFormat;
+  }
+
+  if (requested_config.frame_rate > 0) {
+    v4l2_streamparm parm;
+    memset(&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    parm.parm.capture.timeperframe.numerator = 1000;
+    parm.parm.capture.timeperframe.denominator =
+        static_cast<uint32>(requested_config.frame_rate * 1000 + 0.5);
+    if (Ioctl(VIDIOC_S_PARM, &parm)) {
+      LOG(WARNING) << "V4l2VideoSource cannot set the frame rate.";
+    }
+  }
+
+  v4l2_streamparm parm;
+  memset(&parm, 0, sizeof(parm));
+  parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  double frame_rate = requested_config.frame_rate;
+  if (Ioctl(VIDIOC_G_PARM, &parm) == 0 &&
+      parm.parm.capture.timeperframe.numerator > 0) {
+    frame_rate = static_cast<double>(
+        parm.parm.capture.timeperframe.denominator) /
+        parm.parm.capture.timeperframe.numerator;
+  }
+
+  actual_config_.format = ptr_mapping->format;
+  actual_config_.width = format.fmt.pix.width;
+  actual_config_.height = format.fmt.pix.height;
+  actual_config_.stride = format.fmt.pix.bytesperline;
+  actual_config_.frame_rate = frame_rate;
+  LOG(INFO) << "V4l2VideoSource format " << actual_config_.format << " "
+            << actual_config_.width << "x" << actual_config_.height
+            << " stride " << actual_config_.stride << " @ "
+            << actual_config_.frame_rate << " fps";
+  LOG(INFO) << "V4l2VideoSource capture path "
+            << CaptureFormatPolicy::DescribePath(actual_config_.format);
+  return kSuccess;
+}
+
+void V4l2VideoSource::AddCandidates(
+    uint32 fourcc, VideoFormat format,
+    std::vector<CaptureFormatCandidate>* ptr_candidates) {
+  v4l2_frmsizeenum size;
+  memset(&size, 0, sizeof(size));
+  size.pixel_format = fourcc;
+  bool discrete = false;
+  while (Ioctl(VIDIOC_ENUM_FRAMESIZES, &size) == 0 &&
+         size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+    discrete = true;
+    ptr_candidates->push_back(CaptureFormatCandidate(
+        format, size.discrete.width, size.discrete.height,
+        MaxFrameRate(fourcc, size.discrete.width, size.discrete.height)));
+    ++size.index;
+  }
+  if (!discrete) {
+    ptr_candidates->push_back(CaptureFormatCandidate(format, 0, 0, 0));
+  }
+}
+
+double V4l2VideoSource::MaxFrameRate(uint32 fourcc, uint32 width,
+                                     uint32 height) {
+  v4l2_frmivalenum interval;
+  memset(&interval, 0, sizeof(interval));
+  interval.pixel_format = fourcc;
+  interval.width = width;
+  interval.height = height;
+  double max_frame_rate = 0;
+  while (Ioctl(VIDIOC_ENUM_FRAMEINTERVALS, &interval) == 0) {
+    // Stepwise and continuous intervals are reported once, with the shortest
+    // in |stepwise.min|.
+    const v4l2_fract& shortest = interval.type == V4L2_FRMIVAL_TYPE_DISCRETE ?
+        interval.discrete : interval.stepwise.min;
+    if (shortest.numerator > 0) {
+      max_frame_rate = std::max(
+          max_frame_rate,
+          static_cast<double>(shortest.denominator) / shortest.numerator);
+    }
+    if (interval.type != V4L2_FRMIVAL_TYPE_DISCRETE)
+      break;
+    ++interval.index;
+  }
+  return max_frame_rate;
+}
+
+int V4l2VideoSource::MapBuffers() {
+  v4l2_requestbuffers request;
+  memset(&request, 0, sizeof(request));
+  request.count = kNumBuffers;
+  request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  request.memory = V4L2_MEMORY_MMAP;
+  if (Ioctl(VIDIOC_REQBUFS, &request) || request.count == 0) {
+    LOG(ERROR) << "V4l2VideoSource VIDIOC_REQBUFS failed: "
+               << strerror(errno);
+    return kDeviceError;
+  }
+
+  buffers_.resize(request.count);
+  for (uint32 i = 0; i < request.count; ++i) {
+    v4l2_buffer buffer;
+    memset(&buffer, 0, sizeof(buffer));
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index = i;
+    if (Ioctl(VIDIOC_QUERYBUF, &buffer)) {
+      LOG(ERROR) << "V4l2VideoSource VIDIOC_QUERYBUF failed.";
+      return kDeviceError;
+    }
+    void* const ptr_data = mmap(NULL, buffer.length, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd_, buffer.m.offset);
+    if (ptr_data == MAP_FAILED) {
+      LOG(ERROR) << "V4l2VideoSource mmap failed: " << strerror(errno);
+      return kNoMemory;
+    }
+    buffers_[i].ptr_data = ptr_data;
+    buffers_[i].length = buffer.length;
+    if (Ioctl(VIDIOC_QBUF, &buffer)) {
+      LOG(ERROR) << "V4l2VideoSource VIDIOC_QBUF failed.";
+      return kDeviceError;
+    }
+  }
+  return kSuccess;
+}
+
+void V4l2VideoSource::UnmapBuffers() {
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    if (buffers_[i].ptr_data) {
+      munmap(buffers_[i].ptr_data, buffers_[i].length);
+    }
+  }
+  buffers_.clear();
+}
+
+int V4l2VideoSource::ReadFrame() {
+  pollfd poll_fd;
+  poll_fd.fd = fd_;
+  poll_fd.events = POLLIN;
+  poll_fd.revents = 0;
+  const int result = poll(&poll_fd, 1, kMaxIdleWaitMs);
+  if (result < 0 && errno != EINTR) {
+    LOG(ERROR) << "V4l2VideoSource poll failed: " << strerror(errno);
+    return kDeviceError;
+  }
+  if (result <= 0) {
+    return kSuccess;
+  }
+
+  v4l2_buffer buffer;
+  memset(&buffer, 0, sizeof(buffer));
+  buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buffer.memory = V4L2_MEMORY_MMAP;
+  if (Ioctl(VIDIOC_DQBUF, &buffer)) {
+    if (errno == EAGAIN) {
+      return kSuccess;
+    }
+    LOG(ERROR) << "V4l2VideoSource VIDIOC_DQBUF failed: " << strerror(errno);
+    return kDeviceError;
+  }
+
+  int64 capture_time_us = SteadyClockMicroseconds();
+  if ((buffer.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) ==
+      V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+    capture_time_us = static_cast<int64>(buffer.timestamp.tv_sec) * 1000000 +
+                      buffer.timestamp.tv_usec;
+  }
+  const int64 timestamp_us = capture_time_us - start_time_us_;
+  const int64 duration_us = actual_config_.frame_rate > 0 ?
+      static_cast<int64>(kMicrosecondTimebase / actual_config_.frame_rate) :
+      0;
+  const int64 timestamp = MicrosecondsToMilliseconds(timestamp_us);
+
+  int status = kSuccess;
+  if (!(buffer.flags & V4L2_BUF_FLAG_ERROR) && timestamp >= 0 &&
+      !frame_rate_limiter_.ShouldDropFrame(timestamp)) {
+    const uint8* const ptr_data =
+        reinterpret_cast<const uint8*>(buffers_[buffer.index].ptr_data);
+    if (frame_.Init(actual_config_,
+                    true,  // always "keyframes"
+                    0,
+                    0,
+                    ptr_data,
+                    buffer.bytesused)) {
+      LOG(ERROR) << "V4l2VideoSource frame Init failed.";
+      status = kNoMemory;
+    } else {
+      frame_.SetTimeUs(timestamp_us, duration_us);
+      WEBMLIVE_TRACE_EVERY_N(TraceLog::kFrame, 30, "video_capture")
+          << " timestamp=" << timestamp << " size=" << buffer.bytesused;
+      LatencyTracer::Stamp(LatencyTracer::kCapture, timestamp);
+      const int frame_status = ptr_callback_->OnVideoFrameReceived(&frame_);
+      if (frame_status &&
+          frame_status != VideoFrameCallbackInterface::kDropped) {
+        LOG(ERROR) << "OnVideoFrameReceived failed, status=" << frame_status;
+      }
+    }
+  }
+
+  // Give the buffer back to the driver.
+  if (Ioctl(VIDIOC_QBUF, &buffer)) {
+    LOG(ERROR) << "V4l2VideoSource VIDIOC_QBUF failed: " << strerror(errno);
+    return kDeviceError;
+  }
+  return status;
+}
+
+void V4l2VideoSource::CaptureThread() {
+  LOG(INFO) << "V4l2VideoSource thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kCapture);
+  ScopedCpuStage cpu_stage(kCpuCapture);
+  int status = kSuccess;
+  while (!stop_ && status == kSuccess) {
+    status = ReadFrame();
+  }
+  status_ = status;
+  LOG(INFO) << "V4l2VideoSource thread finished, status=" << status;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,146 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_LINUX_V4L2_VIDEO_SOURCE_H_
+#define WEBMLIVE_ENCODER_LINUX_V4L2_VIDEO_SOURCE_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/capture_format_policy.h"
+#include "encoder/frame_rate_limiter.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+// Captures video from a Video4Linux2 device using memory mapped driver
+// buffers. Each dequeued buffer is converted (or, for planar formats, copied)
+// straight from the mapping into the |VideoFrame| passed to the callback, and
+// is then queued back to the driver; frames are never staged in between.
+// Planar frames are copied once rather than delivered in place: the encoder
+// pools own the storage of the frames they hold, and a frame may stay there
+// for several frame intervals, which would keep the driver short of its few
+// buffers.
+//
+// Notes
+// - The format is the one |CaptureFormatPolicy| ranks first among the
+//   formats, sizes and frame intervals the device offers: the cheapest to
+//   convert that delivers the requested size and frame rate. The driver may
+//   adjust the requested size and frame rate; |actual_config()| holds what it
+//   chose.
+// - Frame timestamps are the driver's monotonic timestamps, in milliseconds
+//   since the start time passed to |Run()|.
+class V4l2VideoSource {
+ public:
+  enum {
+    // Capture thread could not be started.
+    kThreadError = -5,
+    // Device open, ioctl or mmap failed.
+    kDeviceError = -4,
+    // Device supports none of the formats handled by |VideoFrame|.
+    kUnsupportedFormat = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Number of driver buffers requested.
+  static const int kNumBuffers = 4;
+
+  // Maximum time the capture thread waits for a frame. Bounds the delay in
+  // noticing |Stop()|.
+  static const int kMaxIdleWaitMs = 100;
+
+  V4l2VideoSource();
+  ~V4l2VideoSource();
+
+  // Opens |device|, negotiates a format as close as possible to
+  // |requested_config|, and maps the driver buffers. Returns |kSuccess| when
+  // successful.
+  int Init(const std::string& device, const VideoConfig& requested_config,
+           VideoFrameCallbackInterface* ptr_callback);
+
+  // Limits delivery to the rate |FrameRateLimiter::OutputFrameRate()| returns
+  // for the negotiated frame rate, and updates |actual_config()| to match.
+  // Excess buffers are queued back to the driver without being read. Must be
+  // called after |Init()| and before |Run()|.
+  void LimitFrameRate(double max_frame_rate, int decimate);
+
+  // Starts streaming and the capture thread. |start_time_us| is the
+  // |std::chrono::steady_clock| time, in microseconds, of timestamp 0.
+  // Returns |kSuccess| when successful.
+  int Run(int64 start_time_us);
+
+  // Stops the capture thread and streaming.
+  void Stop();
+
+  // Returns |kSuccess| while capturing, or the error that stopped the
+  // capture thread.
+  int status() const { return status_; }
+
+  const VideoConfig& actual_config() const { return actual_config_; }
+
+ private:
+  struct MappedBuffer {
+    MappedBuffer() : ptr_data(NULL), length(0) {}
+    void* ptr_data;
+    size_t length;
+  };
+
+  // Calls ioctl(), restarting it when interrupted by a signal.
+  int Ioctl(unsigned long request, void* ptr_arg);  // NOLINT
+
+  // Negotiates the pixel format, size and frame rate.
+  int SetFormat(const VideoConfig& requested_config);
+
+  // Appends a candidate to |ptr_candidates| for each frame size the device
+  // offers in |fourcc|. Devices with stepwise or continuous sizes get a single
+  // candidate of size 0, which matches any size.
+  void AddCandidates(uint32 fourcc, VideoFormat format,
+                     std::vector<CaptureFormatCandidate>* ptr_candidates);
+
+  // Returns the highest frame rate the device offers in |fourcc| at |width|
+  // by |height|, or 0 when it does not say.
+  double MaxFrameRate(uint32 fourcc, uint32 width, uint32 height);
+
+  // Requests, maps and queues |kNumBuffers| driver buffers.
+  int MapBuffers();
+  void UnmapBuffers();
+
+  // Dequeues one buffer, delivers it, and queues it back. Returns |kSuccess|
+  // when successful, including when no frame arrived in time.
+  int ReadFrame();
+
+  // Capture thread function.
+  void CaptureThread();
+
+  int fd_;
+  bool streaming_;
+  std::vector<MappedBuffer> buffers_;
+  VideoConfig actual_config_;
+  VideoFrameCallbackInterface* ptr_callback_;
+  int64 start_time_us_;
+
+  // Frame storage used by the capture thread.
+  VideoFrame frame_;
+
+  // Drops frames beyond the rate set by |LimitFrameRate()|.
+  FrameRateLimiter frame_rate_limiter_;
+
+  std::atomic<bool> stop_;
+  std::atomic<int> status_;
+  std::shared_ptr<std::thread> capture_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(V4l2VideoSource);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_LINUX_V4L2_VIDEO_SOURCE_H_
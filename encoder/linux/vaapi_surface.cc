@@ -0,0 +1,330 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/linux/vaapi_surface.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <va/va_drm.h>
+
+#include <new>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+const char VaapiDevice::kRenderNode[] = "/dev/dri/renderD128";
+
+VaapiDevice::VaapiDevice()
+    : drm_fd_(-1),
+      display_(NULL),
+      processing_checked_(false),
+      processing_config_(VA_INVALID_ID),
+      processing_context_(VA_INVALID_ID) {
+}
+
+VaapiDevice::~VaapiDevice() {
+  if (display_) {
+    if (processing_context_ != VA_INVALID_ID)
+      vaDestroyContext(display_, processing_context_);
+    if (processing_config_ != VA_INVALID_ID)
+      vaDestroyConfig(display_, processing_config_);
+    vaTerminate(display_);
+  }
+  if (drm_fd_ >= 0) {
+    close(drm_fd_);
+  }
+}
+
+std::shared_ptr<VaapiDevice> VaapiDevice::Open() {
+  // The device closes with the last stage holding it.
+  static std::mutex open_mutex;
+  static std::weak_ptr<VaapiDevice> open_device;
+  std::lock_guard<std::mutex> lock(open_mutex);
+  std::shared_ptr<VaapiDevice> device = open_device.lock();
+  if (device) {
+    return device;
+  }
+
+  device.reset(new (std::nothrow) VaapiDevice());  // NOLINT
+  if (!device) {
+    return device;
+  }
+  device->drm_fd_ = open(kRenderNode, O_RDWR);
+  if (device->drm_fd_ < 0) {
+    LOG(WARNING) << "VaapiDevice cannot open " << kRenderNode;
+    return std::shared_ptr<VaapiDevice>();
+  }
+  device->display_ = vaGetDisplayDRM(device->drm_fd_);
+  int major_version = 0;
+  int minor_version = 0;
+  if (!device->display_ ||
+      vaInitialize(device->display_, &major_version, &minor_version) !=
+          VA_STATUS_SUCCESS) {
+    LOG(WARNING) << "VaapiDevice vaInitialize failed.";
+    device->display_ = NULL;
+    return std::shared_ptr<VaapiDevice>();
+  }
+  LOG(INFO) << "VaapiDevice VA-API " << major_version << "."
+            << minor_version << ": " << vaQueryVendorString(device->display_);
+  open_device = device;
+  return device;
+}
+
+int VaapiDevice::InitProcessing() {
+  processing_checked_ = true;
+  std::vector<VAEntrypoint> entrypoints(vaMaxNumEntrypoints(display_));
+  int num_entrypoints = 0;
+  if (vaQueryConfigEntrypoints(display_, VAProfileNone, &entrypoints[0],
+                               &num_entrypoints) != VA_STATUS_SUCCESS) {
+    num_entrypoints = 0;
+  }
+  bool video_proc = false;
+  for (int i = 0; i < num_entrypoints; ++i) {
+    video_proc = video_proc || entrypoints[i] == VAEntrypointVideoProc;
+  }
+  if (!video_proc) {
+    LOG(WARNING) << "VaapiDevice has no video processing; surfaces are "
+                 << "scaled in memory.";
+    return VideoSurface::kNotSupported;
+  }
+  VAStatus status = vaCreateConfig(display_, VAProfileNone,
+                                   VAEntrypointVideoProc, NULL, 0,
+                                   &processing_config_);
+  if (status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "vaCreateConfig (video processing) failed: "
+               << vaErrorStr(status);
+    processing_config_ = VA_INVALID_ID;
+    return VideoSurface::kNotSupported;
+  }
+  status = vaCreateContext(display_, processing_config_, 0, 0, 0, NULL, 0,
+                           &processing_context_);
+  if (status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "vaCreateContext (video processing) failed: "
+               << vaErrorStr(status);
+    processing_context_ = VA_INVALID_ID;
+    return VideoSurface::kNotSupported;
+  }
+  return VideoSurface::kSuccess;
+}
+
+int VaapiDevice::Process(VASurfaceID output,
+                         const VAProcPipelineParameterBuffer* ptr_pipelines,
+                         int count) {
+  if (!ptr_pipelines || count <= 0) {
+    return VideoSurface::kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!processing_checked_) {
+    InitProcessing();
+  }
+  if (processing_context_ == VA_INVALID_ID) {
+    return VideoSurface::kNotSupported;
+  }
+
+  std::vector<VABufferID> buffers;
+  VAStatus status = VA_STATUS_SUCCESS;
+  for (int i = 0; i < count && status == VA_STATUS_SUCCESS; ++i) {
+    VABufferID buffer_id = VA_INVALID_ID;
+    status = vaCreateBuffer(
+        display_, processing_context_, VAProcPipelineParameterBufferType,
+        sizeof(ptr_pipelines[i]), 1,
+        const_cast<VAProcPipelineParameterBuffer*>(&ptr_pipelines[i]),
+        &buffer_id);
+    if (status == VA_STATUS_SUCCESS)
+      buffers.push_back(buffer_id);
+  }
+  if (status == VA_STATUS_SUCCESS) {
+    status = vaBeginPicture(display_, processing_context_, output);
+    if (status == VA_STATUS_SUCCESS) {
+      status = vaRenderPicture(display_, processing_context_, &buffers[0],
+                               static_cast<int>(buffers.size()));
+      const VAStatus end_status = vaEndPicture(display_, processing_context_);
+      if (status == VA_STATUS_SUCCESS) {
+        status = end_status;
+      }
+    }
+  }
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    vaDestroyBuffer(display_, buffers[i]);
+  }
+  if (status == VA_STATUS_SUCCESS) {
+    status = vaSyncSurface(display_, output);
+  }
+  if (status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "VaapiDevice video processing failed: "
+               << vaErrorStr(status);
+    return VideoSurface::kDeviceError;
+  }
+  return VideoSurface::kSuccess;
+}
+
+VaapiSurface::VaapiSurface(const std::shared_ptr<VaapiDevice>& device,
+                           VASurfaceID surface_id, int32 width, int32 height)
+    : device_(device),
+      surface_id_(surface_id),
+      width_(width),
+      height_(height) {
+}
+
+VaapiSurface::~VaapiSurface() {
+  VASurfaceID surface_id = surface_id_;
+  vaDestroySurfaces(device_->display(), &surface_id, 1);
+}
+
+int VaapiSurface::Create(const std::shared_ptr<VaapiDevice>& device,
+                         int32 width, int32 height,
+                         std::shared_ptr<VideoSurface>* ptr_surface) {
+  if (!device || width <= 0 || height <= 0 || !ptr_surface) {
+    return kInvalidArg;
+  }
+  VASurfaceID surface_id = VA_INVALID_SURFACE;
+  const VAStatus status =
+      vaCreateSurfaces(device->display(), VA_RT_FORMAT_YUV420, width, height,
+                       &surface_id, 1, NULL, 0);
+  if (status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "vaCreateSurfaces failed: " << vaErrorStr(status);
+    return kDeviceError;
+  }
+  ptr_surface->reset(
+      new (std::nothrow) VaapiSurface(device, surface_id, width,  // NOLINT
+                                      height));
+  if (!*ptr_surface) {
+    vaDestroySurfaces(device->display(), &surface_id, 1);
+    return kDeviceError;
+  }
+  return kSuccess;
+}
+
+VASurfaceID VaapiSurface::SurfaceOf(const VideoSurface& surface,
+                                    const VaapiDevice* device) {
+  // Only |VaapiSurface|s report a |VaapiDevice|.
+  if (!device || surface.device() != device) {
+    return VA_INVALID_SURFACE;
+  }
+  return static_cast<const VaapiSurface&>(surface).surface_id();
+}
+
+int VaapiSurface::Read(uint8* ptr_y, int32 y_stride, uint8* ptr_u,
+                       uint8* ptr_v, int32 uv_stride) const {
+  if (!ptr_y || !ptr_u || !ptr_v || y_stride < width_ ||
+      uv_stride < (width_ + 1) / 2) {
+    return kInvalidArg;
+  }
+  const VADisplay display = device_->display();
+  VAStatus status = vaSyncSurface(display, surface_id_);
+  VAImage image;
+  if (status == VA_STATUS_SUCCESS) {
+    status = vaDeriveImage(display, surface_id_, &image);
+  }
+  if (status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "vaDeriveImage failed: " << vaErrorStr(status);
+    return kDeviceError;
+  }
+  if (image.format.fourcc != VA_FOURCC_NV12) {
+    LOG(ERROR) << "VaapiSurface image is not NV12.";
+    vaDestroyImage(display, image.image_id);
+    return kNotSupported;
+  }
+  void* ptr_image_data = NULL;
+  status = vaMapBuffer(display, image.buf, &ptr_image_data);
+  if (status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "vaMapBuffer (image) failed: " << vaErrorStr(status);
+    vaDestroyImage(display, image.image_id);
+    return kDeviceError;
+  }
+
+  // Copy luma, then split the UV plane into the chroma planes.
+  const uint8* const ptr_base = reinterpret_cast<const uint8*>(ptr_image_data);
+  for (int32 row = 0; row < height_; ++row) {
+    memcpy(ptr_y + row * y_stride,
+           ptr_base + image.offsets[0] + row * image.pitches[0], width_);
+  }
+  const int32 uv_width = (width_ + 1) / 2;
+  const int32 uv_height = (height_ + 1) / 2;
+  for (int32 row = 0; row < uv_height; ++row) {
+    const uint8* const ptr_uv =
+        ptr_base + image.offsets[1] + row * image.pitches[1];
+    uint8* const ptr_u_row = ptr_u + row * uv_stride;
+    uint8* const ptr_v_row = ptr_v + row * uv_stride;
+    for (int32 col = 0; col < uv_width; ++col) {
+      ptr_u_row[col] = ptr_uv[col * 2];
+      ptr_v_row[col] = ptr_uv[col * 2 + 1];
+    }
+  }
+
+  vaUnmapBuffer(display, image.buf);
+  vaDestroyImage(display, image.image_id);
+  return kSuccess;
+}
+
+int VaapiSurface::Scale(int32 width, int32 height,
+                        std::shared_ptr<VideoSurface>* ptr_scaled) const {
+  if (!ptr_scaled) {
+    return kInvalidArg;
+  }
+  std::shared_ptr<VideoSurface> scaled;
+  int status = Create(device_, width, height, &scaled);
+  if (status) {
+    return status;
+  }
+  VAProcPipelineParameterBuffer pipeline;
+  memset(&pipeline, 0, sizeof(pipeline));
+  pipeline.surface = surface_id_;
+  pipeline.filter_flags = VA_FILTER_SCALING_DEFAULT;
+  status = device_->Process(
+      static_cast<const VaapiSurface&>(*scaled).surface_id(), &pipeline, 1);
+  if (status) {
+    return status;
+  }
+  ptr_scaled->swap(scaled);
+  return kSuccess;
+}
+
+int VaapiSurface::Compose(const VideoSurface& overlay, const VideoRect& rect,
+                          double opacity,
+                          std::shared_ptr<VideoSurface>* ptr_composed) const {
+  const VASurfaceID overlay_id = SurfaceOf(overlay, device_.get());
+  if (!ptr_composed || overlay_id == VA_INVALID_SURFACE || rect.width <= 0 ||
+      rect.height <= 0 || opacity < 0 || opacity > 1) {
+    return kInvalidArg;
+  }
+  std::shared_ptr<VideoSurface> composed;
+  int status = Create(device_, width_, height_, &composed);
+  if (status) {
+    return status;
+  }
+
+  // The frame is copied whole, then the overlay is drawn over |rect|.
+  VARectangle overlay_region;
+  overlay_region.x = static_cast<int16>(rect.x);
+  overlay_region.y = static_cast<int16>(rect.y);
+  overlay_region.width = static_cast<uint16>(rect.width);
+  overlay_region.height = static_cast<uint16>(rect.height);
+  VABlendState blend_state;
+  memset(&blend_state, 0, sizeof(blend_state));
+  blend_state.flags = VA_BLEND_GLOBAL_ALPHA;
+  blend_state.global_alpha = static_cast<float>(opacity);
+  VAProcPipelineParameterBuffer pipelines[2];
+  memset(pipelines, 0, sizeof(pipelines));
+  pipelines[0].surface = surface_id_;
+  pipelines[1].surface = overlay_id;
+  pipelines[1].output_region = &overlay_region;
+  pipelines[1].filter_flags = VA_FILTER_SCALING_DEFAULT;
+  pipelines[1].blend_state = &blend_state;
+  status = device_->Process(
+      static_cast<const VaapiSurface&>(*composed).surface_id(), pipelines, 2);
+  if (status) {
+    return status;
+  }
+  ptr_composed->swap(composed);
+  return kSuccess;
+}
+
+}  // namespace webmlive
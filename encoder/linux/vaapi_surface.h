@@ -0,0 +1,116 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_LINUX_VAAPI_SURFACE_H_
+#define WEBMLIVE_ENCODER_LINUX_VAAPI_SURFACE_H_
+
+#include <memory>
+#include <mutex>
+
+#include <va/va.h>
+#include <va/va_vpp.h>
+
+#include "encoder/basictypes.h"
+#include "encoder/video_surface.h"
+
+namespace webmlive {
+
+// VA-API display of the DRM render node. One device is shared by every
+// VA-API stage of the process, so that their surfaces pass between them.
+class VaapiDevice {
+ public:
+  // DRM render node opened for VA-API.
+  static const char kRenderNode[];
+
+  // Returns the device, opening it when no stage holds it. Returns NULL
+  // when the render node cannot be opened or initialized.
+  static std::shared_ptr<VaapiDevice> Open();
+
+  ~VaapiDevice();
+
+  VADisplay display() const { return display_; }
+
+  // Runs |count| video processing pipelines of |ptr_pipelines| into
+  // |output|, in order, so that later pipelines draw over earlier ones.
+  // Returns |VideoSurface::kNotSupported| when the device has no video
+  // processing. Thread safe.
+  int Process(VASurfaceID output,
+              const VAProcPipelineParameterBuffer* ptr_pipelines,
+              int count);
+
+ private:
+  VaapiDevice();
+
+  // Creates the video processing config and context on first use. Called
+  // with |mutex_| held.
+  int InitProcessing();
+
+  int drm_fd_;
+  VADisplay display_;
+
+  // Video processing state, created by |Process()|. Protected by |mutex_|.
+  std::mutex mutex_;
+  bool processing_checked_;
+  VAConfigID processing_config_;
+  VAContextID processing_context_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VaapiDevice);
+};
+
+// 4:2:0 VA-API surface of a |VaapiDevice|, destroyed with the last frame
+// holding it.
+//
+//   std::shared_ptr<VideoSurface> surface;
+//   VaapiSurface::Create(device, width, height, &surface);
+//   ... fill the surface on the GPU ...
+//   frame.InitSurface(config, false, timestamp, duration, surface);
+//
+// Notes
+// - |Read()| copies through an image derived from the surface, which the
+//   driver must offer as NV12.
+// - |Scale()| and |Compose()| use VA-API video processing.
+class VaapiSurface : public VideoSurface {
+ public:
+  // Creates a |width| x |height| surface of |device| in |ptr_surface|.
+  // Returns |kSuccess| when successful.
+  static int Create(const std::shared_ptr<VaapiDevice>& device, int32 width,
+                    int32 height, std::shared_ptr<VideoSurface>* ptr_surface);
+
+  // Returns the VA-API surface of |surface| when it is a |VaapiSurface| of
+  // |device|, or |VA_INVALID_SURFACE|.
+  static VASurfaceID SurfaceOf(const VideoSurface& surface,
+                               const VaapiDevice* device);
+
+  virtual ~VaapiSurface();
+
+  // |VideoSurface| methods.
+  virtual const void* device() const { return device_.get(); }
+  virtual int32 width() const { return width_; }
+  virtual int32 height() const { return height_; }
+  virtual int Read(uint8* ptr_y, int32 y_stride, uint8* ptr_u, uint8* ptr_v,
+                   int32 uv_stride) const;
+  virtual int Scale(int32 width, int32 height,
+                    std::shared_ptr<VideoSurface>* ptr_scaled) const;
+  virtual int Compose(const VideoSurface& overlay, const VideoRect& rect,
+                      double opacity,
+                      std::shared_ptr<VideoSurface>* ptr_composed) const;
+
+  VASurfaceID surface_id() const { return surface_id_; }
+
+ private:
+  VaapiSurface(const std::shared_ptr<VaapiDevice>& device,
+               VASurfaceID surface_id, int32 width, int32 height);
+
+  const std::shared_ptr<VaapiDevice> device_;
+  const VASurfaceID surface_id_;
+  const int32 width_;
+  const int32 height_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VaapiSurface);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_LINUX_VAAPI_SURFACE_H_
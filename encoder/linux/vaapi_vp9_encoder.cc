@@ -0,0 +1,519 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/linux/vaapi_vp9_encoder.h"
+
+#include <string.h>
+#include <va/va_enc_vp9.h>
+
+#include "encoder/webm_encoder.h"
+#include "glog/logging.h"
+
+namespace {
+
+// VP9 frame types, as coded in the uncompressed header.
+const uint32 kVp9KeyFrame = 0;
+const uint32 kVp9InterFrame = 1;
+
+// Number of VP9 reference slots.
+const int kVp9NumRefSlots = 8;
+
+// Reference control bit selecting the LAST reference.
+const uint32 kVp9RefLast = 1;
+
+// Starting quantizer and loop filter level; the driver's rate control takes
+// over from the first frame.
+const uint8 kInitialQIndex = 60;
+const uint8 kFilterLevel = 10;
+
+// Rate control buffer window, in milliseconds, and the share of the target
+// bitrate used as the VBR average.
+const uint32 kRateControlWindowMs = 1000;
+const uint32 kTargetPercentage = 95;
+
+}  // anonymous namespace
+
+namespace webmlive {
+
+VaapiVp9Encoder::VaapiVp9Encoder()
+    : frames_in_(0),
+      frames_out_(0),
+      last_keyframe_time_(0),
+      last_timestamp_(0),
+      width_(0),
+      height_(0),
+      frame_rate_(0),
+      bitrate_(0),
+      requested_bitrate_(0),
+      display_(NULL),
+      config_id_(VA_INVALID_ID),
+      context_id_(VA_INVALID_ID),
+      coded_buffer_(VA_INVALID_ID),
+      coded_buffer_size_(0),
+      rate_control_mode_(VA_RC_CBR),
+      reference_surface_(0),
+      frame_capacity_(0) {
+  for (int i = 0; i < kNumSurfaces; ++i) {
+    surfaces_[i] = VA_INVALID_SURFACE;
+  }
+}
+
+VaapiVp9Encoder::~VaapiVp9Encoder() {
+  if (display_) {
+    DestroyParameterBuffers();
+    if (coded_buffer_ != VA_INVALID_ID)
+      vaDestroyBuffer(display_, coded_buffer_);
+    if (context_id_ != VA_INVALID_ID)
+      vaDestroyContext(display_, context_id_);
+    if (surfaces_[0] != VA_INVALID_SURFACE)
+      vaDestroySurfaces(display_, surfaces_, kNumSurfaces);
+    if (config_id_ != VA_INVALID_ID)
+      vaDestroyConfig(display_, config_id_);
+  }
+}
+
+int VaapiVp9Encoder::Init(const WebmEncoderConfig& user_config) {
+  if (user_config.vpx_config.codec != kVideoFormatVP9) {
+    LOG(ERROR) << "VaapiVp9Encoder supports only VP9.";
+    return kInvalidArg;
+  }
+  if (user_config.vpx_config.bit_depth != 8) {
+    LOG(ERROR) << "VaapiVp9Encoder supports only 8 bit encode.";
+    return kInvalidArg;
+  }
+  config_ = user_config.vpx_config;
+  width_ = user_config.actual_video_config.width;
+  height_ = user_config.actual_video_config.height;
+  frame_rate_ = user_config.actual_video_config.frame_rate;
+  bitrate_ = config_.bitrate;
+  if (width_ <= 0 || height_ <= 0) {
+    LOG(ERROR) << "VaapiVp9Encoder invalid frame size.";
+    return kInvalidArg;
+  }
+
+  device_ = VaapiDevice::Open();
+  if (!device_) {
+    return kEncoderError;
+  }
+  display_ = device_->display();
+
+  // Prefer the low power entry point; some devices offer only that one.
+  std::vector<VAEntrypoint> entrypoints(vaMaxNumEntrypoints(display_));
+  int num_entrypoints = 0;
+  if (vaQueryConfigEntrypoints(display_, VAProfileVP9Profile0,
+                               &entrypoints[0], &num_entrypoints) !=
+      VA_STATUS_SUCCESS) {
+    LOG(WARNING) << "VaapiVp9Encoder device has no VP9 profile 0 support.";
+    return kEncoderError;
+  }
+  entrypoints.resize(num_entrypoints);
+  VAEntrypoint entrypoint = VAEntrypointVLD;
+  for (size_t i = 0; i < entrypoints.size(); ++i) {
+    if (entrypoints[i] == VAEntrypointEncSliceLP) {
+      entrypoint = VAEntrypointEncSliceLP;
+      break;
+    } else if (entrypoints[i] == VAEntrypointEncSlice) {
+      entrypoint = VAEntrypointEncSlice;
+    }
+  }
+  if (entrypoint == VAEntrypointVLD) {
+    LOG(WARNING) << "VaapiVp9Encoder device cannot encode VP9.";
+    return kEncoderError;
+  }
+
+  VAConfigAttrib attributes[2];
+  attributes[0].type = VAConfigAttribRTFormat;
+  attributes[1].type = VAConfigAttribRateControl;
+  if (vaGetConfigAttributes(display_, VAProfileVP9Profile0, entrypoint,
+                            attributes, 2) != VA_STATUS_SUCCESS ||
+      !(attributes[0].value & VA_RT_FORMAT_YUV420)) {
+    LOG(WARNING) << "VaapiVp9Encoder device lacks 4:2:0 encode.";
+    return kEncoderError;
+  }
+  if (attributes[1].value & VA_RC_CBR) {
+    rate_control_mode_ = VA_RC_CBR;
+  } else if (attributes[1].value & VA_RC_VBR) {
+    rate_control_mode_ = VA_RC_VBR;
+  } else {
+    LOG(WARNING) << "VaapiVp9Encoder device lacks bitrate control.";
+    return kEncoderError;
+  }
+  attributes[0].value = VA_RT_FORMAT_YUV420;
+  attributes[1].value = rate_control_mode_;
+  VAStatus status = vaCreateConfig(display_, VAProfileVP9Profile0, entrypoint,
+                                   attributes, 2, &config_id_);
+  if (status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "vaCreateConfig failed: " << vaErrorStr(status);
+    return kCodecError;
+  }
+
+  status = vaCreateSurfaces(display_, VA_RT_FORMAT_YUV420, width_, height_,
+                            surfaces_, kNumSurfaces, NULL, 0);
+  if (status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "vaCreateSurfaces failed: " << vaErrorStr(status);
+    surfaces_[0] = VA_INVALID_SURFACE;
+    return kCodecError;
+  }
+  status = vaCreateContext(display_, config_id_, width_, height_,
+                           VA_PROGRESSIVE, surfaces_, kNumSurfaces,
+                           &context_id_);
+  if (status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "vaCreateContext failed: " << vaErrorStr(status);
+    return kCodecError;
+  }
+
+  // A compressed frame is never larger than the raw frame.
+  coded_buffer_size_ = width_ * height_ * 3 / 2;
+  frame_capacity_ = CompressedFrameCapacity(config_,
+                                            user_config.actual_video_config);
+  status = vaCreateBuffer(display_, context_id_, VAEncCodedBufferType,
+                          coded_buffer_size_, 1, NULL, &coded_buffer_);
+  if (status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "vaCreateBuffer (coded) failed: " << vaErrorStr(status);
+    return kCodecError;
+  }
+  LOG(INFO) << "VaapiVp9Encoder " << width_ << "x" << height_ << " @ "
+            << bitrate_ << " kbps, "
+            << (entrypoint == VAEntrypointEncSliceLP ? "low power" : "full")
+            << " entry point.";
+  return kSuccess;
+}
+
+int VaapiVp9Encoder::EncodeFrame(const VideoFrame& raw_frame,
+                                 VideoFrame* ptr_vpx_frame) {
+  if (!display_ || context_id_ == VA_INVALID_ID) {
+    LOG(ERROR) << "VaapiVp9Encoder not Init'd.";
+    return kEncoderError;
+  }
+  if (raw_frame.empty() || !ptr_vpx_frame) {
+    LOG(ERROR) << "NULL raw VideoFrame buffer!";
+    return kInvalidArg;
+  }
+  if (raw_frame.format() != kVideoFormatI420 &&
+      raw_frame.format() != kVideoFormatYV12) {
+    LOG(ERROR) << "Unsupported VideoFrame format!";
+    return kInvalidArg;
+  }
+  ++frames_in_;
+
+  if (config_.decimate > 1 && (frames_in_ % config_.decimate) &&
+      !keyframe_request_.Pending(raw_frame.timestamp())) {
+    return kDropped;
+  }
+
+  const int kbps = requested_bitrate_.exchange(0);
+  const bool bitrate_changed = kbps > 0 && kbps != bitrate_;
+  if (bitrate_changed) {
+    bitrate_ = kbps;
+  }
+
+  const bool keyframe_requested =
+      keyframe_request_.Take(raw_frame.timestamp());
+  const bool keyframe = reference_surface_ == 0 || keyframe_requested ||
+      (!config_.scheduled_keyframes &&
+       raw_frame.timestamp() - last_keyframe_time_ >
+           config_.keyframe_interval);
+
+  // Frames held in a surface of the device are encoded from it.
+  VASurfaceID input_surface = surfaces_[kInputSurface];
+  int status = kSuccess;
+  if (raw_frame.surface()) {
+    if (!EncodesSurface(*raw_frame.surface())) {
+      LOG(ERROR) << "VaapiVp9Encoder cannot encode from foreign surface.";
+      return kInvalidArg;
+    }
+    input_surface =
+        VaapiSurface::SurfaceOf(*raw_frame.surface(), device_.get());
+  } else {
+    status = UploadFrame(raw_frame);
+    if (status) {
+      return status;
+    }
+  }
+
+  // Output goes to the recon surface not holding the reference.
+  const int recon_surface = reference_surface_ == 1 ? 2 : 1;
+
+  if (keyframe || bitrate_changed) {
+    status = CreateSequenceBuffers();
+    if (status) {
+      DestroyParameterBuffers();
+      return status;
+    }
+  }
+
+  VAEncPictureParameterBufferVP9 picture;
+  memset(&picture, 0, sizeof(picture));
+  picture.frame_width_src = width_;
+  picture.frame_height_src = height_;
+  picture.frame_width_dst = width_;
+  picture.frame_height_dst = height_;
+  picture.reconstructed_frame = surfaces_[recon_surface];
+  picture.coded_buf = coded_buffer_;
+  for (int i = 0; i < kVp9NumRefSlots; ++i) {
+    picture.reference_frames[i] = keyframe ?
+        VA_INVALID_SURFACE : surfaces_[reference_surface_];
+  }
+  picture.ref_flags.bits.force_kf = keyframe ? 1 : 0;
+  if (!keyframe) {
+    picture.ref_flags.bits.ref_frame_ctrl_l0 = kVp9RefLast;
+    picture.ref_flags.bits.ref_last_idx = 0;
+    picture.ref_flags.bits.ref_gf_idx = 0;
+    picture.ref_flags.bits.ref_arf_idx = 0;
+  }
+  picture.pic_flags.bits.frame_type = keyframe ? kVp9KeyFrame : kVp9InterFrame;
+  picture.pic_flags.bits.show_frame = 1;
+  picture.pic_flags.bits.error_resilient_mode =
+      config_.error_resilient ? 1 : 0;
+  picture.pic_flags.bits.refresh_frame_context = 1;
+  picture.pic_flags.bits.frame_context_idx = 0;
+  // Keyframes refresh every slot; inter frames replace the one reference.
+  picture.refresh_frame_flags = keyframe ? 0xff : 0x01;
+  picture.luma_ac_qindex = kInitialQIndex;
+  picture.filter_level = kFilterLevel;
+  picture.sharpness_level = static_cast<uint8>(config_.sharpness);
+  status = CreateParameterBuffer(VAEncPictureParameterBufferType, &picture,
+                                 sizeof(picture));
+  if (status) {
+    DestroyParameterBuffers();
+    return status;
+  }
+
+  VAStatus va_status = vaBeginPicture(display_, context_id_, input_surface);
+  if (va_status == VA_STATUS_SUCCESS) {
+    va_status = vaRenderPicture(display_, context_id_, &parameter_buffers_[0],
+                                static_cast<int>(parameter_buffers_.size()));
+    const VAStatus end_status = vaEndPicture(display_, context_id_);
+    if (va_status == VA_STATUS_SUCCESS) {
+      va_status = end_status;
+    }
+  }
+  DestroyParameterBuffers();
+  if (va_status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "VaapiVp9Encoder encode failed: " << vaErrorStr(va_status);
+    return kCodecError;
+  }
+
+  status = ReadCodedBuffer(raw_frame, keyframe, ptr_vpx_frame);
+  if (status) {
+    return status;
+  }
+  reference_surface_ = recon_surface;
+  return kSuccess;
+}
+
+bool VaapiVp9Encoder::EncodesSurface(const VideoSurface& surface) const {
+  return VaapiSurface::SurfaceOf(surface, device_.get()) !=
+      VA_INVALID_SURFACE && surface.width() == width_ &&
+      surface.height() == height_;
+}
+
+int VaapiVp9Encoder::SetTargetBitrate(int kbps) {
+  if (kbps <= 0) {
+    LOG(ERROR) << "invalid target bitrate " << kbps;
+    return kInvalidArg;
+  }
+  requested_bitrate_.store(kbps);
+  return kSuccess;
+}
+
+int VaapiVp9Encoder::UploadFrame(const VideoFrame& raw_frame) {
+  VAImage image;
+  VAStatus status =
+      vaDeriveImage(display_, surfaces_[kInputSurface], &image);
+  if (status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "vaDeriveImage failed: " << vaErrorStr(status);
+    return kCodecError;
+  }
+  if (image.format.fourcc != VA_FOURCC_NV12) {
+    LOG(ERROR) << "VaapiVp9Encoder surface is not NV12.";
+    vaDestroyImage(display_, image.image_id);
+    return kEncoderError;
+  }
+  void* ptr_surface_data = NULL;
+  status = vaMapBuffer(display_, image.buf, &ptr_surface_data);
+  if (status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "vaMapBuffer (image) failed: " << vaErrorStr(status);
+    vaDestroyImage(display_, image.image_id);
+    return kCodecError;
+  }
+
+  // Copy luma, then interleave the chroma planes into the UV plane.
+  const VideoPlane y_plane = raw_frame.plane(VideoFrame::kPlaneY);
+  const VideoPlane u_plane = raw_frame.plane(VideoFrame::kPlaneU);
+  const VideoPlane v_plane = raw_frame.plane(VideoFrame::kPlaneV);
+  const int32 uv_width = (width_ + 1) / 2;
+  const int32 uv_height = (height_ + 1) / 2;
+
+  uint8* const ptr_base = reinterpret_cast<uint8*>(ptr_surface_data);
+  for (int32 row = 0; row < height_; ++row) {
+    memcpy(ptr_base + image.offsets[0] + row * image.pitches[0],
+           y_plane.data + row * y_plane.stride, width_);
+  }
+  for (int32 row = 0; row < uv_height; ++row) {
+    uint8* const ptr_uv =
+        ptr_base + image.offsets[1] + row * image.pitches[1];
+    const uint8* const ptr_u_row = u_plane.data + row * u_plane.stride;
+    const uint8* const ptr_v_row = v_plane.data + row * v_plane.stride;
+    for (int32 col = 0; col < uv_width; ++col) {
+      ptr_uv[col * 2] = ptr_u_row[col];
+      ptr_uv[col * 2 + 1] = ptr_v_row[col];
+    }
+  }
+
+  vaUnmapBuffer(display_, image.buf);
+  vaDestroyImage(display_, image.image_id);
+  return kSuccess;
+}
+
+int VaapiVp9Encoder::CreateParameterBuffer(VABufferType type,
+                                           const void* ptr_data,
+                                           size_t size) {
+  VABufferID buffer_id = VA_INVALID_ID;
+  const VAStatus status = vaCreateBuffer(
+      display_, context_id_, type, static_cast<unsigned int>(size), 1,
+      const_cast<void*>(ptr_data), &buffer_id);
+  if (status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "vaCreateBuffer failed: " << vaErrorStr(status);
+    return kCodecError;
+  }
+  parameter_buffers_.push_back(buffer_id);
+  return kSuccess;
+}
+
+int VaapiVp9Encoder::CreateSequenceBuffers() {
+  const uint32 bits_per_second = static_cast<uint32>(bitrate_) * 1000;
+  const uint32 keyframe_distance = frame_rate_ > 0 ?
+      static_cast<uint32>(config_.keyframe_interval * frame_rate_ / 1000) : 0;
+
+  VAEncSequenceParameterBufferVP9 sequence;
+  memset(&sequence, 0, sizeof(sequence));
+  sequence.max_frame_width = width_;
+  sequence.max_frame_height = height_;
+  sequence.kf_auto = 0;
+  sequence.kf_min_dist = 1;
+  sequence.kf_max_dist = keyframe_distance;
+  sequence.bits_per_second = bits_per_second;
+  sequence.intra_period = keyframe_distance;
+  int status = CreateParameterBuffer(VAEncSequenceParameterBufferType,
+                                     &sequence, sizeof(sequence));
+  if (status) {
+    return status;
+  }
+
+  // Misc parameters are a type tag followed by the parameter structure.
+  std::vector<uint8> rate_control(sizeof(VAEncMiscParameterBuffer) +
+                                  sizeof(VAEncMiscParameterRateControl));
+  VAEncMiscParameterBuffer* const ptr_misc =
+      reinterpret_cast<VAEncMiscParameterBuffer*>(&rate_control[0]);
+  ptr_misc->type = VAEncMiscParameterTypeRateControl;
+  VAEncMiscParameterRateControl* const ptr_rate_control =
+      reinterpret_cast<VAEncMiscParameterRateControl*>(ptr_misc->data);
+  ptr_rate_control->bits_per_second = bits_per_second;
+  ptr_rate_control->target_percentage =
+      rate_control_mode_ == VA_RC_CBR ? 100 : kTargetPercentage;
+  ptr_rate_control->window_size = kRateControlWindowMs;
+  status = CreateParameterBuffer(VAEncMiscParameterBufferType,
+                                 &rate_control[0], rate_control.size());
+  if (status || frame_rate_ <= 0) {
+    return status;
+  }
+
+  std::vector<uint8> frame_rate(sizeof(VAEncMiscParameterBuffer) +
+                                sizeof(VAEncMiscParameterFrameRate));
+  VAEncMiscParameterBuffer* const ptr_misc_fps =
+      reinterpret_cast<VAEncMiscParameterBuffer*>(&frame_rate[0]);
+  ptr_misc_fps->type = VAEncMiscParameterTypeFrameRate;
+  VAEncMiscParameterFrameRate* const ptr_frame_rate =
+      reinterpret_cast<VAEncMiscParameterFrameRate*>(ptr_misc_fps->data);
+  // The frame rate is a fraction: numerator in the low 16 bits, denominator
+  // in the high 16 bits.
+  const uint32 kFrameRateDenominator = 100;
+  ptr_frame_rate->framerate =
+      (kFrameRateDenominator << 16) |
+      (static_cast<uint32>(frame_rate_ * kFrameRateDenominator) & 0xffff);
+  return CreateParameterBuffer(VAEncMiscParameterBufferType, &frame_rate[0],
+                               frame_rate.size());
+}
+
+void VaapiVp9Encoder::DestroyParameterBuffers() {
+  for (size_t i = 0; i < parameter_buffers_.size(); ++i) {
+    vaDestroyBuffer(display_, parameter_buffers_[i]);
+  }
+  parameter_buffers_.clear();
+}
+
+int VaapiVp9Encoder::ReadCodedBuffer(const VideoFrame& raw_frame,
+                                     bool keyframe,
+                                     VideoFrame* ptr_vpx_frame) {
+  VAStatus status = vaSyncSurface(display_, surfaces_[kInputSurface]);
+  if (status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "vaSyncSurface failed: " << vaErrorStr(status);
+    return kCodecError;
+  }
+  void* ptr_coded = NULL;
+  status = vaMapBuffer(display_, coded_buffer_, &ptr_coded);
+  if (status != VA_STATUS_SUCCESS) {
+    LOG(ERROR) << "vaMapBuffer (coded) failed: " << vaErrorStr(status);
+    return kCodecError;
+  }
+
+  // The coded buffer is a list of segments; a frame normally fits in one.
+  // Segments are copied straight into |ptr_vpx_frame|.
+  int32 frame_size = 0;
+  for (VACodedBufferSegment* ptr_segment =
+           reinterpret_cast<VACodedBufferSegment*>(ptr_coded);
+       ptr_segment != NULL;
+       ptr_segment =
+           reinterpret_cast<VACodedBufferSegment*>(ptr_segment->next)) {
+    frame_size += static_cast<int32>(ptr_segment->size);
+  }
+  if (frame_size == 0) {
+    vaUnmapBuffer(display_, coded_buffer_);
+    LOG(ERROR) << "VaapiVp9Encoder produced no data.";
+    return kEncoderError;
+  }
+  if (frame_size > frame_capacity_) {
+    frame_capacity_ = frame_size + frame_size / 2;
+  }
+  if (ptr_vpx_frame->Allocate(frame_capacity_)) {
+    vaUnmapBuffer(display_, coded_buffer_);
+    LOG(ERROR) << "cannot allocate compressed frame storage.";
+    return kEncoderError;
+  }
+  uint8* ptr_write = ptr_vpx_frame->buffer();
+  for (VACodedBufferSegment* ptr_segment =
+           reinterpret_cast<VACodedBufferSegment*>(ptr_coded);
+       ptr_segment != NULL;
+       ptr_segment =
+           reinterpret_cast<VACodedBufferSegment*>(ptr_segment->next)) {
+    memcpy(ptr_write, ptr_segment->buf, ptr_segment->size);
+    ptr_write += ptr_segment->size;
+  }
+  vaUnmapBuffer(display_, coded_buffer_);
+
+  VideoConfig vpx_config = raw_frame.config();
+  vpx_config.format = kVideoFormatVP9;
+  const int32 frame_status = ptr_vpx_frame->InitInPlace(
+      vpx_config, keyframe, raw_frame.timestamp(), raw_frame.duration(),
+      frame_size);
+  if (frame_status) {
+    LOG(ERROR) << "VideoFrame InitInPlace failed: " << frame_status;
+    return kEncoderError;
+  }
+  ptr_vpx_frame->SetTimeUs(raw_frame.timestamp_us(), raw_frame.duration_us());
+  if (keyframe) {
+    last_keyframe_time_ = ptr_vpx_frame->timestamp();
+    LOG(INFO) << "keyframe @ " << last_keyframe_time_ / 1000.0 << "sec ("
+              << last_keyframe_time_ << "ms)";
+  }
+  ++frames_out_;
+  last_timestamp_ = ptr_vpx_frame->timestamp();
+  return kSuccess;
+}
+
+}  // namespace webmlive
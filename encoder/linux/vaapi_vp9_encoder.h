@@ -0,0 +1,149 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_LINUX_VAAPI_VP9_ENCODER_H_
+#define WEBMLIVE_ENCODER_LINUX_VAAPI_VP9_ENCODER_H_
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <va/va.h>
+
+#include "encoder/basictypes.h"
+#include "encoder/linux/vaapi_surface.h"
+#include "encoder/video_encoder.h"
+#include "encoder/video_encoder_backend.h"
+
+namespace webmlive {
+
+// VP9 encoder using VA-API hardware encode (Intel Quick Sync and AMD VCN
+// through Mesa).
+//
+// Notes
+// - Raw frames are uploaded into an NV12 surface; the driver writes the
+//   frame headers and runs rate control. Frames held in a |VaapiSurface| of
+//   the same |VaapiDevice| and size are encoded from it without a copy.
+// - Each inter frame references only the previous frame, which minimizes
+//   surface memory and latency.
+// - Only |keyframe_interval|, |bitrate|, |decimate|, |sharpness|,
+//   |error_resilient| and |scheduled_keyframes| from |VpxConfig| apply.
+class VaapiVp9Encoder : public VideoEncoderBackendInterface {
+ public:
+  enum {
+    // VA-API reported an error.
+    kCodecError = VideoEncoder::kCodecError,
+    // Error within |VaapiVp9Encoder|, or no VP9 encode support.
+    kEncoderError = VideoEncoder::kEncoderError,
+    kNoMemory = VideoEncoder::kNoMemory,
+    kInvalidArg = VideoEncoder::kInvalidArg,
+    kSuccess = VideoEncoder::kSuccess,
+    kDropped = VideoEncoder::kDropped,
+    kNoFrame = VideoEncoder::kNoFrame,
+  };
+
+  VaapiVp9Encoder();
+  virtual ~VaapiVp9Encoder();
+
+  // Opens the |VaapiDevice| and creates the VP9 encode context. Returns
+  // |kEncoderError| when the device cannot encode VP9.
+  virtual int Init(const WebmEncoderConfig& config);
+
+  // Encodes |raw_frame| and returns the compressed data via |ptr_vpx_frame|.
+  virtual int EncodeFrame(const VideoFrame& raw_frame,
+                          VideoFrame* ptr_vpx_frame);
+
+  // Frames are returned by |EncodeFrame()| as they are encoded: nothing is
+  // ever queued, and there is nothing to flush.
+  virtual int ReadQueuedFrame(VideoFrame* ptr_vpx_frame) { return kNoFrame; }
+  virtual int Flush() { return kSuccess; }
+
+  // Requests a new target bitrate in kilobits per second. Applied with the
+  // next frame encoded.
+  virtual int SetTargetBitrate(int kbps);
+
+  // Forces a keyframe at the first frame at or after |timestamp|. May be
+  // called from any thread.
+  virtual void RequestKeyframe(int64 timestamp) {
+    keyframe_request_.Request(timestamp);
+  }
+
+  // Returns true for |VaapiSurface|s of the encoder's device and size.
+  virtual bool EncodesSurface(const VideoSurface& surface) const;
+
+  // Accessors.
+  virtual int64 frames_in() const { return frames_in_; }
+  virtual int64 frames_out() const { return frames_out_; }
+  virtual int64 last_keyframe_time() const { return last_keyframe_time_; }
+  virtual int64 last_timestamp() const { return last_timestamp_; }
+
+ private:
+  // Surfaces: the upload target, and two reconstructed frames used in turn
+  // as reference and output.
+  enum {
+    kInputSurface = 0,
+    kNumReconSurfaces = 2,
+    kNumSurfaces = 1 + kNumReconSurfaces,
+  };
+
+  // Copies |raw_frame| into the input surface, converting it to NV12.
+  int UploadFrame(const VideoFrame& raw_frame);
+
+  // Creates a parameter buffer holding |size| bytes of |ptr_data|, and
+  // records it for release after the frame is encoded.
+  int CreateParameterBuffer(VABufferType type, const void* ptr_data,
+                            size_t size);
+
+  // Creates the sequence and rate control buffers sent with keyframes and
+  // bitrate changes.
+  int CreateSequenceBuffers();
+
+  // Destroys the buffers made by |CreateParameterBuffer()|.
+  void DestroyParameterBuffers();
+
+  // Copies the coded buffer into |ptr_vpx_frame|.
+  int ReadCodedBuffer(const VideoFrame& raw_frame, bool keyframe,
+                      VideoFrame* ptr_vpx_frame);
+
+  int64 frames_in_;
+  int64 frames_out_;
+  int64 last_keyframe_time_;
+  int64 last_timestamp_;
+  VpxConfig config_;
+  int32 width_;
+  int32 height_;
+  double frame_rate_;
+
+  // Target bitrate in kilobits per second, and the pending request from
+  // |SetTargetBitrate()|, or 0.
+  int bitrate_;
+  std::atomic<int> requested_bitrate_;
+  KeyframeRequest keyframe_request_;
+
+  std::shared_ptr<VaapiDevice> device_;
+  VADisplay display_;
+  VAConfigID config_id_;
+  VAContextID context_id_;
+  VASurfaceID surfaces_[kNumSurfaces];
+  VABufferID coded_buffer_;
+  uint32 coded_buffer_size_;
+  uint32 rate_control_mode_;
+
+  // Index into |surfaces_| of the reference frame, or 0 before the first
+  // frame.
+  int reference_surface_;
+
+  std::vector<VABufferID> parameter_buffers_;
+
+  // Storage reserved in output frames; grows when a frame does not fit.
+  int32 frame_capacity_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VaapiVp9Encoder);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_LINUX_VAAPI_VP9_ENCODER_H_
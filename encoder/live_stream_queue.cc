@@ -0,0 +1,206 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/live_stream_queue.h"
+
+#include <chrono>
+#include <vector>
+
+#include "encoder/socket_util.h"
+
+namespace webmlive {
+
+namespace {
+const char kHeaderId[] = "header";
+const char kChunkId[] = "chunk";
+const char kMuxedHeaderSuffix[] = "_muxed.hdr";
+const char kMuxedChunkSuffix[] = ".chk";
+const char kMuxedChunkInfix[] = "_muxed_";
+}  // namespace
+
+LiveStreamQueue::LiveStreamQueue()
+    : max_queued_chunks_(1),
+      header_pending_(false),
+      connected_(false),
+      closed_(false),
+      streamed_chunks_(0) {
+}
+
+void LiveStreamQueue::Init(int max_queued_chunks) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  max_queued_chunks_ = max_queued_chunks < 1 ? 1 : max_queued_chunks;
+  header_.reset();
+  header_pending_ = false;
+  connected_ = false;
+  closed_ = false;
+  streamed_chunks_ = 0;
+  streaming_entry_ = Entry();
+  rejoin_cache_.Init(max_queued_chunks_);
+}
+
+bool LiveStreamQueue::IsStreamChunk(const std::string& id, bool* ptr_header) {
+  if (id == kHeaderId || HasSuffix(id, kMuxedHeaderSuffix)) {
+    *ptr_header = true;
+    return true;
+  }
+  *ptr_header = false;
+  return id == kChunkId ||
+         (HasSuffix(id, kMuxedChunkSuffix) &&
+          id.find(kMuxedChunkInfix) != std::string::npos);
+}
+
+int LiveStreamQueue::PutChunk(const SharedDataChunk& chunk,
+                              const std::string& id) {
+  Entry entry;
+  if (!chunk || !IsStreamChunk(id, &entry.header)) {
+    return 0;
+  }
+  entry.chunk = chunk;
+  return Put(entry, id);
+}
+
+int LiveStreamQueue::PutStreamingChunk(const SharedStreamingChunk& chunk,
+                                       const std::string& id) {
+  Entry entry;
+  if (!chunk || !IsStreamChunk(id, &entry.header) || entry.header) {
+    return 0;
+  }
+  entry.stream = chunk;
+  return Put(entry, id);
+}
+
+int LiveStreamQueue::Connected() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const int dropped = static_cast<int>(entries_.size());
+  entries_.clear();
+
+  // Rejoin at the cached keyframe chunk when nothing separates the cached
+  // chunks from the next one: at most the chunk still being streamed, which
+  // is queued from its start.
+  std::vector<InitSegmentCache::Entry> cached;
+  rejoin_cache_.GetEntries(&cached);
+  if (cached.size() > 1 && streamed_chunks_ <= 1) {
+    for (size_t i = 1; i < cached.size(); ++i) {
+      Entry entry;
+      entry.chunk = cached[i].chunk;
+      entries_.push_back(entry);
+    }
+    if (streamed_chunks_ == 1) {
+      entries_.push_back(streaming_entry_);
+    }
+    entry_queued_.notify_one();
+  }
+  header_pending_ = true;
+  connected_ = true;
+  entry_taken_.notify_all();
+  return dropped;
+}
+
+void LiveStreamQueue::Disconnected() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  connected_ = false;
+}
+
+bool LiveStreamQueue::Take(Entry* ptr_entry) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  entry_queued_.wait(lock, [this] {
+    return closed_ || (header_ && (header_pending_ || !entries_.empty()));
+  });
+  if (closed_) {
+    return false;
+  }
+  if (header_pending_) {
+    *ptr_entry = Entry();
+    ptr_entry->chunk = header_;
+    ptr_entry->header = true;
+    header_pending_ = false;
+  } else {
+    *ptr_entry = entries_.front();
+    entries_.pop_front();
+  }
+  entry_taken_.notify_all();
+  return true;
+}
+
+int64 LiveStreamQueue::queued_bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return QueuedBytes();
+}
+
+bool LiveStreamQueue::WaitForQueuedBytes(int64 max_bytes,
+                                         int32 timeout_ms) const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return entry_taken_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                               [this, max_bytes] {
+    return closed_ || QueuedBytes() <= max_bytes;
+  });
+}
+
+void LiveStreamQueue::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    entries_.clear();
+    header_.reset();
+    header_pending_ = false;
+    connected_ = false;
+    streaming_entry_ = Entry();
+    rejoin_cache_.Init(max_queued_chunks_);
+  }
+  entry_queued_.notify_all();
+  entry_taken_.notify_all();
+}
+
+int64 LiveStreamQueue::QueuedBytes() const {
+  int64 bytes = 0;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    bytes += entries_[i].stream ? entries_[i].stream->length() :
+                                  entries_[i].chunk->length();
+  }
+  return bytes;
+}
+
+int LiveStreamQueue::Put(const Entry& entry, const std::string& id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (closed_) {
+    return 0;
+  }
+  if (entry.chunk) {
+    rejoin_cache_.Put(entry.chunk, id);
+  }
+  if (entry.stream) {
+    ++streamed_chunks_;
+    streaming_entry_ = entry;
+  } else if (!entry.header && streamed_chunks_ > 0) {
+    // The complete copy of a chunk already streamed.
+    --streamed_chunks_;
+    return 0;
+  }
+  if (entry.header) {
+    // Taken first on the next connection, or on this one when the sender has
+    // yet to take a header; otherwise it follows the clusters already queued.
+    header_ = entry.chunk;
+    if (!connected_ || header_pending_) {
+      entry_queued_.notify_one();
+      return 0;
+    }
+  }
+  int dropped = 0;
+  if (static_cast<int>(entries_.size()) >= max_queued_chunks_) {
+    std::deque<Entry>::iterator it = entries_.begin();
+    while (it != entries_.end() && it->header)
+      ++it;
+    entries_.erase(it == entries_.end() ? entries_.begin() : it);
+    dropped = 1;
+  }
+  entries_.push_back(entry);
+  entry_queued_.notify_one();
+  return dropped;
+}
+
+}  // namespace webmlive
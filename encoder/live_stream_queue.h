@@ -0,0 +1,136 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_LIVE_STREAM_QUEUE_H_
+#define WEBMLIVE_ENCODER_LIVE_STREAM_QUEUE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "encoder/basictypes.h"
+#include "encoder/buffer_util.h"
+#include "encoder/init_segment_cache.h"
+
+namespace webmlive {
+
+// Chunks of one live WebM byte stream, queued by a data sink for the thread
+// sending them over a long-lived connection. Picks the chunks of the stream
+// out of everything the encoder writes, and orders them so that every
+// connection carries a playable stream:
+// - the metadata chunk is kept, and taken first on each connection;
+// - chunks queued before a connection are dropped. The connection rejoins
+//   at the newest chunk that starts with a keyframe, kept with the chunks
+//   after it by an |InitSegmentCache|, so that playback starts right away;
+//   without one it starts at the next cluster chunk written;
+// - cluster chunks beyond the queue limit drop the oldest one.
+//
+// The stream is:
+// - "header" and "chunk" of non-DASH encodes;
+// - <name>_muxed.hdr and <name>_muxed_<n>.chk of DASH encodes, which need
+//   |WebmEncoderConfig::dash_muxed_output|.
+//
+//   LiveStreamQueue queue;
+//   queue.Init(max_queued_chunks);
+//   ...
+//   queue.PutChunk(chunk, id);  // from |DataSinkInterface::WriteChunk()|
+//   ...
+//   queue.Connected();          // sender thread, after connecting
+//   LiveStreamQueue::Entry entry;
+//   while (queue.Take(&entry)) {
+//     ...  // send |entry|
+//   }
+//
+// Notes
+// - With |WebmEncoderConfig::low_latency_upload| cluster chunks come through
+//   |PutStreamingChunk()| as they are muxed, and the complete copies the
+//   encoder writes afterwards are ignored. Metadata chunks are always taken
+//   from the complete copy.
+// - Thread safe.
+class LiveStreamQueue {
+ public:
+  // A chunk to send: complete, or still being muxed.
+  struct Entry {
+    Entry() : header(false) {}
+    SharedDataChunk chunk;
+    SharedStreamingChunk stream;
+    bool header;
+  };
+
+  LiveStreamQueue();
+  ~LiveStreamQueue() {}
+
+  // Empties the queue, and limits it to |max_queued_chunks|. Must be called
+  // before the queue is used.
+  void Init(int max_queued_chunks);
+
+  // Returns true when |id| names a chunk of the stream, and stores whether
+  // it is the metadata chunk in |ptr_header|.
+  static bool IsStreamChunk(const std::string& id, bool* ptr_header);
+
+  // Queue chunk |id| when it belongs to the stream. Return the number of
+  // chunks dropped to make room.
+  int PutChunk(const SharedDataChunk& chunk, const std::string& id);
+  int PutStreamingChunk(const SharedStreamingChunk& chunk,
+                        const std::string& id);
+
+  // Mark the start and the end of a connection. |Connected()| drops the
+  // queued chunks, queues the cached chunks the connection rejoins at, and
+  // returns the number dropped.
+  int Connected();
+  void Disconnected();
+
+  // Waits for the next chunk to send on the current connection, and moves it
+  // to |ptr_entry|. Returns false once |Close()| is called.
+  bool Take(Entry* ptr_entry);
+
+  // Returns the bytes queued and not yet taken, counting chunks still being
+  // muxed at their current length.
+  int64 queued_bytes() const;
+
+  // Waits up to |timeout_ms| for |queued_bytes()| to be |max_bytes| or less,
+  // and returns whether it is.
+  bool WaitForQueuedBytes(int64 max_bytes, int32 timeout_ms) const;
+
+  // Wakes the sender from |Take()|, and empties the queue. |Init()| opens it
+  // again.
+  void Close();
+
+ private:
+  // Returns |queued_bytes()|. |mutex_| must be held.
+  int64 QueuedBytes() const;
+
+  // Queues |entry|, chunk |id|, and returns the number of chunks dropped.
+  int Put(const Entry& entry, const std::string& id);
+
+  mutable std::mutex mutex_;
+  std::condition_variable entry_queued_;
+  mutable std::condition_variable entry_taken_;
+  std::deque<Entry> entries_;
+  int max_queued_chunks_;
+
+  // Latest metadata chunk, and whether the sender has yet to take it on the
+  // current connection.
+  SharedDataChunk header_;
+  bool header_pending_;
+  bool connected_;
+  bool closed_;
+
+  // Streamed cluster chunks whose complete copy has yet to be written, and
+  // the newest streamed chunk.
+  int64 streamed_chunks_;
+  Entry streaming_entry_;
+
+  // Complete chunks from the newest keyframe chunk on, for |Connected()|.
+  InitSegmentCache rejoin_cache_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(LiveStreamQueue);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_LIVE_STREAM_QUEUE_H_
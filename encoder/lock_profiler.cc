@@ -0,0 +1,103 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/lock_profiler.h"
+
+#include <cstdio>
+
+#include "encoder/metrics.h"
+
+namespace webmlive {
+
+LockSite::LockSite(const char* lock_name, const char* function, int line) {
+  char labels[256] = {0};
+  snprintf(labels, sizeof(labels), "lock=\"%s\",site=\"%s:%d\"", lock_name,
+           function, line);
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  ptr_acquisitions_ = registry.GetCounter(
+      "webmlive_lock_acquisitions_total", labels,
+      "Profiled mutex acquisitions, by lock and call site.");
+  ptr_contended_ = registry.GetCounter(
+      "webmlive_lock_contended_total", labels,
+      "Profiled mutex acquisitions that waited for another holder.");
+  ptr_wait_ns_ = registry.GetCounter(
+      "webmlive_lock_wait_nanoseconds_total", labels,
+      "Time spent waiting for profiled mutexes.");
+  ptr_hold_ns_ = registry.GetCounter(
+      "webmlive_lock_hold_nanoseconds_total", labels,
+      "Time profiled mutexes were held.");
+  ptr_try_failures_ = registry.GetCounter(
+      "webmlive_lock_try_failures_total", labels,
+      "try_lock calls on profiled mutexes that failed.");
+}
+
+void LockSite::RecordAcquire(int64 wait_ns) {
+  if (ptr_acquisitions_) {
+    ptr_acquisitions_->Increment(1);
+  }
+  if (wait_ns > 0 && ptr_contended_ && ptr_wait_ns_) {
+    ptr_contended_->Increment(1);
+    ptr_wait_ns_->Increment(wait_ns);
+  }
+}
+
+void LockSite::RecordRelease(int64 hold_ns) {
+  if (ptr_hold_ns_) {
+    ptr_hold_ns_->Increment(hold_ns);
+  }
+}
+
+void LockSite::RecordTryFailure() {
+  if (ptr_try_failures_) {
+    ptr_try_failures_->Increment(1);
+  }
+}
+
+ProfiledLock::ProfiledLock(std::mutex& mutex, LockSite* ptr_site)
+    : mutex_(mutex), ptr_site_(ptr_site), owns_lock_(false) {
+  int64 wait_ns = 0;
+  if (!mutex_.try_lock()) {
+    const Clock::time_point wait_start = Clock::now();
+    mutex_.lock();
+    acquire_time_ = Clock::now();
+    wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        acquire_time_ - wait_start).count();
+  } else {
+    acquire_time_ = Clock::now();
+  }
+  owns_lock_ = true;
+  ptr_site_->RecordAcquire(wait_ns);
+}
+
+ProfiledLock::ProfiledLock(std::mutex& mutex, std::try_to_lock_t,
+                           LockSite* ptr_site)
+    : mutex_(mutex), ptr_site_(ptr_site), owns_lock_(false) {
+  if (!mutex_.try_lock()) {
+    ptr_site_->RecordTryFailure();
+    return;
+  }
+  acquire_time_ = Clock::now();
+  owns_lock_ = true;
+  ptr_site_->RecordAcquire(0);
+}
+
+ProfiledLock::~ProfiledLock() {
+  unlock();
+}
+
+void ProfiledLock::unlock() {
+  if (!owns_lock_) {
+    return;
+  }
+  const int64 hold_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now() - acquire_time_).count();
+  owns_lock_ = false;
+  mutex_.unlock();
+  ptr_site_->RecordRelease(hold_ns);
+}
+
+}  // namespace webmlive
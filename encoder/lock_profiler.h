@@ -0,0 +1,114 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_LOCK_PROFILER_H_
+#define WEBMLIVE_ENCODER_LOCK_PROFILER_H_
+
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#include "encoder/basictypes.h"
+
+// Contention profiling of the hot mutexes, for measuring lock-free rework
+// before and after. Compiled in by the WEBMLIVE_ENABLE_LOCK_PROFILING build
+// option, which defines WEBMLIVE_HAVE_LOCK_PROFILING. Each call site taking a
+// profiled mutex exports, through |MetricsRegistry|, with labels naming the
+// lock and the site:
+//   webmlive_lock_acquisitions_total           locks taken;
+//   webmlive_lock_contended_total              locks found held, waited for;
+//   webmlive_lock_wait_nanoseconds_total       time spent waiting;
+//   webmlive_lock_hold_nanoseconds_total       time the lock was held;
+//   webmlive_lock_try_failures_total           try_lock attempts that failed,
+//                                              and skipped the work they
+//                                              guarded.
+// Without the option the macros expand to the plain std::lock_guard and
+// std::unique_lock declarations they replace.
+//
+//   WEBMLIVE_PROFILED_LOCK(lock, mutex_, "buffer_pool");
+//   WEBMLIVE_PROFILED_TRY_LOCK(lock, mutex_, "http_uploader");
+//   if (lock.owns_lock()) { ... }
+//
+// Sites waiting on a condition variable keep a plain std::unique_lock: their
+// hold time would include the wait.
+
+namespace webmlive {
+
+class Metric;
+
+// Counters of one call site. Created once per site, as a function static, by
+// the macros below; the counters are shared by every object whose mutex the
+// site locks.
+class LockSite {
+ public:
+  // |lock_name| names the mutex, |function| and |line| the site.
+  LockSite(const char* lock_name, const char* function, int line);
+  ~LockSite() {}
+
+  // Records a lock taken after waiting |wait_ns|, 0 when it was free.
+  void RecordAcquire(int64 wait_ns);
+
+  // Records a lock released after being held |hold_ns|.
+  void RecordRelease(int64 hold_ns);
+
+  // Records a failed try_lock.
+  void RecordTryFailure();
+
+ private:
+  Metric* ptr_acquisitions_;
+  Metric* ptr_contended_;
+  Metric* ptr_wait_ns_;
+  Metric* ptr_hold_ns_;
+  Metric* ptr_try_failures_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(LockSite);
+};
+
+// Scoped lock of a std::mutex that reports to a |LockSite|. Tries the mutex
+// first, so an uncontended lock costs two clock reads more than a plain one.
+class ProfiledLock {
+ public:
+  // Locks |mutex|, waiting for it.
+  ProfiledLock(std::mutex& mutex, LockSite* ptr_site);  // NOLINT
+
+  // Tries to lock |mutex|; see |owns_lock()|.
+  ProfiledLock(std::mutex& mutex, std::try_to_lock_t try_to_lock,  // NOLINT
+               LockSite* ptr_site);
+
+  ~ProfiledLock();
+
+  // Releases the mutex before the end of the scope.
+  void unlock();
+
+  bool owns_lock() const { return owns_lock_; }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  std::mutex& mutex_;
+  LockSite* const ptr_site_;
+  bool owns_lock_;
+  Clock::time_point acquire_time_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(ProfiledLock);
+};
+
+}  // namespace webmlive
+
+#ifdef WEBMLIVE_HAVE_LOCK_PROFILING
+#define WEBMLIVE_PROFILED_LOCK(lock, mu, lock_name)                      \
+  static webmlive::LockSite lock##_site(lock_name, __func__, __LINE__);  \
+  webmlive::ProfiledLock lock(mu, &lock##_site)
+#define WEBMLIVE_PROFILED_TRY_LOCK(lock, mu, lock_name)                  \
+  static webmlive::LockSite lock##_site(lock_name, __func__, __LINE__);  \
+  webmlive::ProfiledLock lock(mu, std::try_to_lock, &lock##_site)
+#else
+#define WEBMLIVE_PROFILED_LOCK(lock, mu, lock_name) \
+  std::lock_guard<std::mutex> lock(mu)
+#define WEBMLIVE_PROFILED_TRY_LOCK(lock, mu, lock_name) \
+  std::unique_lock<std::mutex> lock(mu, std::try_to_lock)
+#endif
+
+#endif  // WEBMLIVE_ENCODER_LOCK_PROFILER_H_
@@ -0,0 +1,722 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/mapped_archive_file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <new>
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/ebml_util.h"
+#include "encoder/thread_placement.h"
+#include "glog/logging.h"
+#include "libwebm/mkvmuxerutil.hpp"
+#include "libwebm/mkvwriter.hpp"
+#include "libwebm/webmids.hpp"
+
+namespace webmlive {
+
+const char MappedArchiveFile::kIndexSuffix[] = ".index";
+
+#ifdef __linux__
+
+namespace {
+// Index layout, all integers little endian 64 bit: |kIndexMagic|, then the
+// file offsets of the Segment, the SeekHead reservation, the Info, the
+// Duration and the Tracks, and the Cues track. One record per cluster
+// follows: its offset, size, timecode, and flags.
+const char kIndexMagic[8] = {'W', 'L', 'A', 'R', 'C', 'I', 'X', '1'};
+const int kIndexHeaderFields = 6;
+const int64 kIndexHeaderSize = 8 + kIndexHeaderFields * 8;
+const int kIndexRecordFields = 4;
+const int64 kIndexRecordSize = kIndexRecordFields * 8;
+const uint64 kClusterStartsCue = 1;
+
+// Children of a cluster read to find its timecode and its first block of
+// the Cues track.
+const int kMaxClusterScanElements = 256;
+
+const uint8 kSimpleBlockKeyframe = 0x80;
+
+// Longest EBML ID and size.
+const int kMaxIdLength = 4;
+const int kMaxSizeLength = 8;
+
+void PutLe64(uint64 value, std::vector<uint8>* ptr_out) {
+  for (int i = 0; i < 8; ++i) {
+    ptr_out->push_back(static_cast<uint8>(value >> (i * 8)));
+  }
+}
+
+uint64 GetLe64(const uint8* ptr_data) {
+  uint64 value = 0;
+  for (int i = 7; i >= 0; --i) {
+    value = (value << 8) | ptr_data[i];
+  }
+  return value;
+}
+
+bool ReadAll(int fd, int64 offset, void* ptr_data, size_t length) {
+  uint8* ptr_bytes = reinterpret_cast<uint8*>(ptr_data);
+  while (length > 0) {
+    const ssize_t bytes_read = pread(fd, ptr_bytes, length, offset);
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read <= 0) {
+      return false;
+    }
+    ptr_bytes += bytes_read;
+    offset += bytes_read;
+    length -= bytes_read;
+  }
+  return true;
+}
+
+bool WriteAll(int fd, int64 offset, const void* ptr_data, size_t length) {
+  const uint8* ptr_bytes = reinterpret_cast<const uint8*>(ptr_data);
+  while (length > 0) {
+    const ssize_t bytes_written = pwrite(fd, ptr_bytes, length, offset);
+    if (bytes_written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_written <= 0) {
+      return false;
+    }
+    ptr_bytes += bytes_written;
+    offset += bytes_written;
+    length -= bytes_written;
+  }
+  return true;
+}
+
+// Reads the header of the EBML element at |offset|: its ID, with the length
+// marker bits as in webmids.hpp, its size, -1 when unknown, and the length
+// of the header. Returns false when it cannot be read or is malformed. The
+// payload is not read, so its size is not checked against the file.
+bool ReadElementHeaderAt(int fd, int64 offset, uint64* ptr_id,
+                         int64* ptr_size, int* ptr_length) {
+  uint8 header[kMaxIdLength + kMaxSizeLength];
+  const ssize_t bytes_read = pread(fd, header, sizeof(header), offset);
+  if (bytes_read < 2) {
+    return false;
+  }
+  const uint8* const ptr_end = header + bytes_read;
+  int64 id = 0;
+  int32 id_length = 0;
+  int32 size_length = 0;
+  if (!ReadVint(header, ptr_end, true, &id, &id_length) ||
+      id_length > kMaxIdLength ||
+      !ReadVint(header + id_length, ptr_end, false, ptr_size,
+                &size_length)) {
+    return false;
+  }
+  *ptr_id = static_cast<uint64>(id);
+  *ptr_length = id_length + size_length;
+  return true;
+}
+
+// What the index and |Recover()| need to know about a cluster.
+struct ClusterInfo {
+  ClusterInfo() : timecode(-1), starts_cue(false), last_block_time(0) {}
+  int64 timecode;
+  bool starts_cue;
+  // Largest block timecode relative to the cluster's; set only by a
+  // |ScanCluster()| of the whole cluster.
+  int64 last_block_time;
+};
+
+// Reads the cluster of |size| bytes at |offset|. Stops at its first block of
+// |cues_track| unless |whole| is true. Returns false when the cluster cannot
+// be read or has no timecode.
+bool ScanCluster(int fd, int64 offset, int64 size, uint64 cues_track,
+                 bool whole, ClusterInfo* ptr_info) {
+  uint64 id = 0;
+  int64 payload_size = 0;
+  int header_length = 0;
+  if (!ReadElementHeaderAt(fd, offset, &id, &payload_size, &header_length) ||
+      id != mkvmuxer::kMkvCluster) {
+    return false;
+  }
+  const int64 end = offset + size;
+  bool first_block_read = false;
+  int64 position = offset + header_length;
+  for (int i = 0; position < end && (whole || i < kMaxClusterScanElements);
+       ++i) {
+    if (!ReadElementHeaderAt(fd, position, &id, &payload_size,
+                             &header_length) || payload_size < 0) {
+      return false;
+    }
+    const int64 payload = position + header_length;
+    if (id == mkvmuxer::kMkvTimecode && payload_size <= 8) {
+      uint8 value[8];
+      if (!ReadAll(fd, payload, value, static_cast<size_t>(payload_size))) {
+        return false;
+      }
+      ptr_info->timecode =
+          static_cast<int64>(ReadUnsigned(value, payload_size));
+    } else if (id == mkvmuxer::kMkvSimpleBlock) {
+      // Track number, relative timecode and flags.
+      uint8 block[kMaxSizeLength + 3];
+      const size_t length = static_cast<size_t>(
+          std::min<int64>(payload_size, sizeof(block)));
+      if (!ReadAll(fd, payload, block, length)) {
+        return false;
+      }
+      int64 track = 0;
+      int32 track_length = 0;
+      if (!ReadVint(block, block + length, false, &track, &track_length) ||
+          static_cast<size_t>(track_length + 3) > length) {
+        return false;
+      }
+      const int16 block_time = static_cast<int16>(
+          (block[track_length] << 8) | block[track_length + 1]);
+      ptr_info->last_block_time =
+          std::max<int64>(ptr_info->last_block_time, block_time);
+      if (!first_block_read &&
+          (cues_track == 0 || static_cast<uint64>(track) == cues_track)) {
+        first_block_read = true;
+        ptr_info->starts_cue =
+            (block[track_length + 2] & kSimpleBlockKeyframe) != 0;
+        if (!whole && ptr_info->timecode >= 0) {
+          break;
+        }
+      }
+    }
+    position = payload + payload_size;
+  }
+  return ptr_info->timecode >= 0;
+}
+}  // namespace
+
+MappedArchiveFile::MappedArchiveFile()
+    : fd_(-1),
+      index_fd_(-1),
+      position_(0),
+      end_(0),
+      allocated_(0),
+      ptr_window_(NULL),
+      window_offset_(0),
+      cluster_start_(-1),
+      write_failed_(false),
+      stop_(false),
+      indexed_clusters_(0),
+      index_failed_(false) {
+}
+
+MappedArchiveFile::~MappedArchiveFile() {
+  if (fd_ >= 0) {
+    Close(false);
+  }
+}
+
+int MappedArchiveFile::Open(const std::string& path) {
+  if (fd_ >= 0) {
+    LOG(ERROR) << "MappedArchiveFile already open.";
+    return kInvalidArg;
+  }
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    LOG(ERROR) << "MappedArchiveFile cannot open " << path;
+    return kFileError;
+  }
+  const std::string index_path = path + kIndexSuffix;
+  index_fd_ = open(index_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644);
+  if (index_fd_ < 0) {
+    LOG(ERROR) << "MappedArchiveFile cannot open " << index_path;
+    close(fd_);
+    fd_ = -1;
+    return kFileError;
+  }
+  path_ = path;
+  position_ = 0;
+  end_ = 0;
+  allocated_ = 0;
+  cluster_start_ = -1;
+  write_failed_ = false;
+  layout_ = Layout();
+  completed_clusters_.clear();
+  stop_ = false;
+  indexed_clusters_ = 0;
+  index_failed_ = false;
+  index_thread_.reset(new (std::nothrow) std::thread(
+      std::bind(&MappedArchiveFile::IndexThread, this)));  // NOLINT
+  if (!index_thread_) {
+    LOG(ERROR) << "MappedArchiveFile cannot construct thread.";
+    close(index_fd_);
+    close(fd_);
+    index_fd_ = fd_ = -1;
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+int MappedArchiveFile::Close(bool complete) {
+  if (fd_ < 0) {
+    return kInvalidArg;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_requested_.notify_one();
+  index_thread_->join();
+  index_thread_.reset();
+
+  UnmapWindow();
+  bool failed = write_failed_ || index_failed_;
+  if (ftruncate(fd_, end_) || fdatasync(fd_)) {
+    LOG(ERROR) << "MappedArchiveFile cannot complete " << path_;
+    failed = true;
+  }
+  close(fd_);
+  close(index_fd_);
+  fd_ = index_fd_ = -1;
+  if (complete && !failed) {
+    unlink((path_ + kIndexSuffix).c_str());
+  }
+  return failed ? kFileError : kSuccess;
+}
+
+uint64 MappedArchiveFile::cues_track() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return layout_.cues_track;
+}
+
+void MappedArchiveFile::set_cues_track(uint64 track) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  layout_.cues_track = track;
+}
+
+int32 MappedArchiveFile::Write(const void* ptr_buffer,
+                               uint32 buffer_length) {
+  if (!ptr_buffer || !buffer_length) {
+    return kInvalidArg;
+  }
+  if (write_failed_) {
+    return kFileError;
+  }
+  const uint8* ptr_data = reinterpret_cast<const uint8*>(ptr_buffer);
+  int64 remaining = buffer_length;
+  while (remaining > 0) {
+    if (!ptr_window_ || position_ < window_offset_ ||
+        position_ >= window_offset_ + kWindowSize) {
+      if (!MapWindow(position_)) {
+        write_failed_ = true;
+        return kFileError;
+      }
+    }
+    const int64 length = std::min(remaining,
+                                  window_offset_ + kWindowSize - position_);
+    memcpy(ptr_window_ + (position_ - window_offset_), ptr_data,
+           static_cast<size_t>(length));
+    ptr_data += length;
+    position_ += length;
+    remaining -= length;
+  }
+  end_ = std::max(end_, position_);
+  return kSuccess;
+}
+
+int32 MappedArchiveFile::Position(int64 position) {
+  if (position < 0) {
+    return kInvalidArg;
+  }
+  position_ = position;
+  return kSuccess;
+}
+
+// Clusters end where the next cluster, or the Cues, begin; libwebm has
+// written a cluster's size by then. Only the first Void, the SeekHead
+// reservation, and the first Info, Duration and Tracks are recorded:
+// libwebm writes them again when it finalizes the segment.
+void MappedArchiveFile::ElementStartNotify(uint64 element_id,
+                                           int64 position) {
+  switch (element_id) {
+    case mkvmuxer::kMkvCluster:
+    case mkvmuxer::kMkvCues: {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (cluster_start_ >= 0 && position > cluster_start_) {
+        const Cluster cluster = {cluster_start_, position - cluster_start_};
+        completed_clusters_.push_back(cluster);
+      }
+      cluster_start_ =
+          element_id == mkvmuxer::kMkvCluster ? position : -1;
+      break;
+    }
+    case mkvmuxer::kMkvSegment:
+    case mkvmuxer::kMkvVoid:
+    case mkvmuxer::kMkvInfo:
+    case mkvmuxer::kMkvDuration:
+    case mkvmuxer::kMkvTracks: {
+      std::lock_guard<std::mutex> lock(mutex_);
+      Layout& layout = layout_;
+      if (element_id == mkvmuxer::kMkvSegment && layout.segment < 0) {
+        layout.segment = position;
+      } else if (element_id == mkvmuxer::kMkvVoid && layout.segment >= 0 &&
+                 layout.seek_head < 0 && layout.info < 0) {
+        layout.seek_head = position;
+      } else if (element_id == mkvmuxer::kMkvInfo && layout.info < 0) {
+        layout.info = position;
+      } else if (element_id == mkvmuxer::kMkvDuration &&
+                 layout.duration < 0) {
+        layout.duration = position;
+      } else if (element_id == mkvmuxer::kMkvTracks && layout.tracks < 0) {
+        layout.tracks = position;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+// The file is allocated with fallocate() so that writes through the window
+// cannot fail for lack of space; on file systems without it the file is
+// extended sparse, and a full disk faults the muxing thread instead.
+bool MappedArchiveFile::MapWindow(int64 position) {
+  UnmapWindow();
+  const int64 offset = position - position % kWindowSize;
+  while (allocated_ < offset + kWindowSize) {
+    if (fallocate(fd_, 0, allocated_, kExtentSize)) {
+      if (errno != EOPNOTSUPP ||
+          ftruncate(fd_, allocated_ + kExtentSize)) {
+        LOG(ERROR) << "MappedArchiveFile cannot allocate " << path_ << " to "
+                   << allocated_ + kExtentSize << " bytes.";
+        return false;
+      }
+      VLOG(1) << "MappedArchiveFile preallocation unavailable.";
+    }
+    allocated_ += kExtentSize;
+  }
+  void* const ptr_window = mmap(NULL, kWindowSize, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd_, offset);
+  if (ptr_window == MAP_FAILED) {
+    LOG(ERROR) << "MappedArchiveFile cannot map " << path_ << " at "
+               << offset;
+    return false;
+  }
+  ptr_window_ = reinterpret_cast<uint8*>(ptr_window);
+  window_offset_ = offset;
+  return true;
+}
+
+void MappedArchiveFile::UnmapWindow() {
+  if (ptr_window_) {
+    munmap(ptr_window_, kWindowSize);
+    ptr_window_ = NULL;
+  }
+}
+
+bool MappedArchiveFile::FlushIndex(const Layout& layout,
+                                   const std::vector<Cluster>& clusters) {
+  // Pages written through the window are in the page cache; syncing the
+  // file descriptor writes them.
+  if (fdatasync(fd_)) {
+    LOG(ERROR) << "MappedArchiveFile cannot sync " << path_;
+    return false;
+  }
+  std::vector<uint8> index;
+  if (indexed_clusters_ == 0) {
+    index.insert(index.end(), kIndexMagic, kIndexMagic + sizeof(kIndexMagic));
+    PutLe64(layout.segment, &index);
+    PutLe64(layout.seek_head, &index);
+    PutLe64(layout.info, &index);
+    PutLe64(layout.duration, &index);
+    PutLe64(layout.tracks, &index);
+    PutLe64(layout.cues_track, &index);
+  }
+  for (size_t i = 0; i < clusters.size(); ++i) {
+    ClusterInfo info;
+    if (!ScanCluster(fd_, clusters[i].offset, clusters[i].size,
+                     layout.cues_track, false, &info)) {
+      LOG(ERROR) << "MappedArchiveFile cannot read the cluster at "
+                 << clusters[i].offset;
+      return false;
+    }
+    PutLe64(clusters[i].offset, &index);
+    PutLe64(clusters[i].size, &index);
+    PutLe64(info.timecode, &index);
+    PutLe64(info.starts_cue ? kClusterStartsCue : 0, &index);
+  }
+  const int64 offset = indexed_clusters_ == 0 ? 0 :
+      kIndexHeaderSize + indexed_clusters_ * kIndexRecordSize;
+  if (!WriteAll(index_fd_, offset, &index[0], index.size()) ||
+      fdatasync(index_fd_)) {
+    LOG(ERROR) << "MappedArchiveFile cannot write the index of " << path_;
+    return false;
+  }
+  indexed_clusters_ += static_cast<int64>(clusters.size());
+  return true;
+}
+
+void MappedArchiveFile::IndexThread() {
+  LOG(INFO) << "MappedArchiveFile index thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kUpload);
+  ScopedCpuStage cpu_stage(kCpuUpload);
+  for (;;) {
+    Layout layout;
+    std::vector<Cluster> clusters;
+    bool stop = false;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      const std::chrono::milliseconds interval(
+          static_cast<int64>(kIndexFlushIntervalMs));
+      stop_requested_.wait_for(lock, interval, [this] { return stop_; });
+      stop = stop_;
+      layout = layout_;
+      clusters.swap(completed_clusters_);
+    }
+    if (!clusters.empty() && !index_failed_ &&
+        !FlushIndex(layout, clusters)) {
+      index_failed_ = true;
+    }
+    if (stop) {
+      break;
+    }
+  }
+  LOG(INFO) << "MappedArchiveFile index thread finished.";
+}
+
+int MappedArchiveFile::Recover(const std::string& path) {
+  const std::string index_path = path + kIndexSuffix;
+  std::vector<uint8> index;
+  {
+    FILE* const index_file = fopen(index_path.c_str(), "rb");
+    if (!index_file) {
+      LOG(ERROR) << "MappedArchiveFile no index " << index_path;
+      return kInvalidArg;
+    }
+    uint8 buffer[4096];
+    size_t bytes_read = 0;
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), index_file)) > 0) {
+      index.insert(index.end(), buffer, buffer + bytes_read);
+    }
+    fclose(index_file);
+  }
+  if (static_cast<int64>(index.size()) < kIndexHeaderSize ||
+      memcmp(&index[0], kIndexMagic, sizeof(kIndexMagic))) {
+    LOG(ERROR) << "MappedArchiveFile invalid index " << index_path;
+    return kInvalidArg;
+  }
+  Layout layout;
+  const uint8* const ptr_header = &index[sizeof(kIndexMagic)];
+  layout.segment = static_cast<int64>(GetLe64(ptr_header));
+  layout.seek_head = static_cast<int64>(GetLe64(ptr_header + 8));
+  layout.info = static_cast<int64>(GetLe64(ptr_header + 16));
+  layout.duration = static_cast<int64>(GetLe64(ptr_header + 24));
+  layout.tracks = static_cast<int64>(GetLe64(ptr_header + 32));
+  layout.cues_track = GetLe64(ptr_header + 40);
+
+  const int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+  struct stat file_stat;
+  if (fd < 0 || fstat(fd, &file_stat)) {
+    LOG(ERROR) << "MappedArchiveFile cannot open " << path;
+    if (fd >= 0) {
+      close(fd);
+    }
+    return kFileError;
+  }
+
+  // Keep the clusters that follow one another and lie in the file; a
+  // record cut short by the crash is ignored.
+  struct Record {
+    int64 offset;
+    int64 size;
+    int64 timecode;
+    bool starts_cue;
+  };
+  std::vector<Record> records;
+  int64 end = 0;
+  for (int64 offset = kIndexHeaderSize;
+       offset + kIndexRecordSize <= static_cast<int64>(index.size());
+       offset += kIndexRecordSize) {
+    const uint8* const ptr_record = &index[static_cast<size_t>(offset)];
+    Record record;
+    record.offset = static_cast<int64>(GetLe64(ptr_record));
+    record.size = static_cast<int64>(GetLe64(ptr_record + 8));
+    record.timecode = static_cast<int64>(GetLe64(ptr_record + 16));
+    record.starts_cue = (GetLe64(ptr_record + 24) & kClusterStartsCue) != 0;
+    if (record.offset < end || record.size <= 0 ||
+        record.offset + record.size > file_stat.st_size) {
+      break;
+    }
+    records.push_back(record);
+    end = record.offset + record.size;
+  }
+
+  uint64 id = 0;
+  int64 size = 0;
+  int segment_header_length = 0;
+  ClusterInfo last_cluster;
+  if (records.empty() || layout.segment < 0 ||
+      !ReadElementHeaderAt(fd, layout.segment, &id, &size,
+                           &segment_header_length) ||
+      id != mkvmuxer::kMkvSegment ||
+      !ScanCluster(fd, records.back().offset, records.back().size,
+                   layout.cues_track, true, &last_cluster)) {
+    LOG(ERROR) << "MappedArchiveFile " << path << " has no usable index.";
+    close(fd);
+    return kInvalidArg;
+  }
+  const int64 payload_start = layout.segment + segment_header_length;
+  const bool patch_segment_size =
+      segment_header_length == kMaxIdLength + kMaxSizeLength;
+  int duration_header_length = 0;
+  const bool patch_duration = layout.duration >= 0 &&
+      ReadElementHeaderAt(fd, layout.duration, &id, &size,
+                          &duration_header_length) &&
+      id == mkvmuxer::kMkvDuration && size == sizeof(float);  // NOLINT
+  const int truncate_status = ftruncate(fd, end);
+  close(fd);
+  if (truncate_status) {
+    LOG(ERROR) << "MappedArchiveFile cannot truncate " << path;
+    return kFileError;
+  }
+
+  FILE* const file = fopen(path.c_str(), "r+b");
+  if (!file) {
+    LOG(ERROR) << "MappedArchiveFile cannot open " << path;
+    return kFileError;
+  }
+  bool ok = true;
+  {
+    mkvmuxer::MkvWriter writer(file);
+    bool any_cue = false;
+    for (size_t i = 0; i < records.size(); ++i) {
+      any_cue = any_cue || records[i].starts_cue;
+    }
+    mkvmuxer::Cues cues;
+    for (size_t i = 0; ok && i < records.size(); ++i) {
+      if (any_cue && !records[i].starts_cue) {
+        continue;
+      }
+      mkvmuxer::CuePoint* const ptr_cue =
+          new (std::nothrow) mkvmuxer::CuePoint();  // NOLINT
+      if (!ptr_cue) {
+        ok = false;
+        break;
+      }
+      ptr_cue->set_time(records[i].timecode);
+      ptr_cue->set_track(layout.cues_track ? layout.cues_track : 1);
+      ptr_cue->set_cluster_pos(records[i].offset - payload_start);
+      if (!cues.AddCue(ptr_cue)) {
+        delete ptr_cue;
+        ok = false;
+      }
+    }
+    ok = ok && !writer.Position(end) && cues.Write(&writer);
+    const int64 segment_end = writer.Position();
+
+    if (ok && layout.seek_head >= 0) {
+      mkvmuxer::SeekHead seek_head;
+      ok = !writer.Position(layout.seek_head) && seek_head.Write(&writer) &&
+           (layout.info < 0 ||
+            seek_head.AddSeekEntry(mkvmuxer::kMkvInfo,
+                                   layout.info - payload_start)) &&
+           (layout.tracks < 0 ||
+            seek_head.AddSeekEntry(mkvmuxer::kMkvTracks,
+                                   layout.tracks - payload_start)) &&
+           seek_head.AddSeekEntry(mkvmuxer::kMkvCues, end - payload_start) &&
+           seek_head.Finalize(&writer);
+    }
+    if (ok && patch_duration) {
+      const float duration = static_cast<float>(
+          records.back().timecode + last_cluster.last_block_time);
+      ok = !writer.Position(layout.duration) &&
+           mkvmuxer::WriteEbmlElement(&writer, mkvmuxer::kMkvDuration,
+                                      duration);
+    }
+    if (ok && patch_segment_size) {
+      ok = !writer.Position(layout.segment + kMaxIdLength) &&
+           !mkvmuxer::WriteUIntSize(&writer, segment_end - payload_start,
+                                    kMaxSizeLength);
+    }
+  }
+  if (fflush(file) || fsync(fileno(file))) {
+    ok = false;
+  }
+  fclose(file);
+  if (!ok) {
+    LOG(ERROR) << "MappedArchiveFile cannot repair " << path;
+    return kFileError;
+  }
+  unlink(index_path.c_str());
+  LOG(INFO) << "MappedArchiveFile recovered " << records.size()
+            << " clusters of " << path << ".";
+  return kSuccess;
+}
+
+#else  // __linux__
+
+MappedArchiveFile::MappedArchiveFile()
+    : fd_(-1),
+      index_fd_(-1),
+      position_(0),
+      end_(0),
+      allocated_(0),
+      ptr_window_(NULL),
+      window_offset_(0),
+      cluster_start_(-1),
+      write_failed_(false),
+      stop_(false),
+      indexed_clusters_(0),
+      index_failed_(false) {
+}
+
+MappedArchiveFile::~MappedArchiveFile() {
+}
+
+int MappedArchiveFile::Open(const std::string&) {
+  LOG(ERROR) << "MappedArchiveFile is available on Linux only.";
+  return kInvalidArg;
+}
+
+int MappedArchiveFile::Close(bool) {
+  return kInvalidArg;
+}
+
+uint64 MappedArchiveFile::cues_track() const {
+  return layout_.cues_track;
+}
+
+void MappedArchiveFile::set_cues_track(uint64 track) {
+  layout_.cues_track = track;
+}
+
+int32 MappedArchiveFile::Write(const void*, uint32) {
+  return kFileError;
+}
+
+int32 MappedArchiveFile::Position(int64) {
+  return kFileError;
+}
+
+void MappedArchiveFile::ElementStartNotify(uint64, int64) {
+}
+
+int MappedArchiveFile::Recover(const std::string&) {
+  LOG(ERROR) << "MappedArchiveFile is available on Linux only.";
+  return kInvalidArg;
+}
+
+#endif  // __linux__
+
+}  // namespace webmlive
@@ -0,0 +1,163 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_MAPPED_ARCHIVE_FILE_H_
+#define WEBMLIVE_ENCODER_MAPPED_ARCHIVE_FILE_H_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "libwebm/mkvmuxer.hpp"
+
+namespace webmlive {
+
+// Seekable libwebm writer for archives that must survive a crash or a power
+// loss. libwebm's writes are copied into a memory mapped window of the file,
+// so writing costs a memcpy; the kernel writes the pages back.
+//
+// The file is allocated |kExtentSize| bytes at a time, and the window, of
+// |kWindowSize| bytes, moves when libwebm writes outside it. A side index,
+// the archive path followed by |kIndexSuffix|, lists the clusters libwebm
+// has completed. About every |kIndexFlushIntervalMs| an index thread syncs
+// the file, and only then appends the clusters completed before the sync to
+// the index and syncs it, so the index never lists a cluster that is not on
+// disk. |Close()| removes the index of a complete archive.
+//
+// After a crash, |Recover()| cuts the file after the last indexed cluster,
+// and writes the Cues, SeekHead, Duration and Segment size libwebm would
+// have written, from the index, without scanning the clusters.
+//
+// Notes
+// - Linux only: |Open()| returns |kInvalidArg| elsewhere.
+// - The index thread reads each completed cluster's timecode and first
+//   block from the file; libwebm's writes are not parsed on the muxing
+//   thread.
+// - Cues point at clusters that start with a keyframe of |cues_track()|, as
+//   libwebm's do; libwebm starts a cluster at each of them.
+class MappedArchiveFile : public mkvmuxer::IMkvWriter {
+ public:
+  enum {
+    kFileError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Allocation step of the file, and size of the mapped window.
+  static const int64 kExtentSize = 64 * 1024 * 1024;
+  static const int64 kWindowSize = 16 * 1024 * 1024;
+
+  static const int kIndexFlushIntervalMs = 1000;
+  static const char kIndexSuffix[];
+
+  MappedArchiveFile();
+  virtual ~MappedArchiveFile();
+
+  // Creates |path| and its index, and starts the index thread. Returns
+  // |kSuccess| when successful.
+  int Open(const std::string& path);
+
+  // Stops the index thread, unmaps the window, cuts the file to the bytes
+  // written, and syncs it. Removes the index when |complete| is true and
+  // every write succeeded, and keeps it for |Recover()| otherwise. Returns
+  // |kSuccess| when every write succeeded.
+  int Close(bool complete);
+
+  // Track whose keyframes the Cues point at.
+  uint64 cues_track() const;
+  void set_cues_track(uint64 track);
+
+  // Repairs the archive at |path| that was not closed, from its index.
+  // Returns |kSuccess| when the archive was repaired, |kInvalidArg| when it
+  // has no usable index, and |kFileError| when it cannot be read or written.
+  static int Recover(const std::string& path);
+
+  // mkvmuxer::IMkvWriter methods.
+  virtual int32 Write(const void* ptr_buffer, uint32 buffer_length);
+  virtual int64 Position() const { return position_; }
+  virtual int32 Position(int64 position);
+  virtual bool Seekable() const { return true; }
+  virtual void ElementStartNotify(uint64 element_id, int64 position);
+
+ private:
+  // A completed cluster: its offset in the file and its size, header
+  // included.
+  struct Cluster {
+    int64 offset;
+    int64 size;
+  };
+
+  // File offsets of the elements |Recover()| rewrites, -1 until libwebm
+  // writes them.
+  struct Layout {
+    Layout()
+        : segment(-1),
+          seek_head(-1),
+          info(-1),
+          duration(-1),
+          tracks(-1),
+          cues_track(0) {}
+    int64 segment;
+    int64 seek_head;
+    int64 info;
+    int64 duration;
+    int64 tracks;
+    uint64 cues_track;
+  };
+
+  // Maps the window that holds |position|, allocating the file as needed.
+  // Returns false on failure.
+  bool MapWindow(int64 position);
+
+  // Unmaps the window.
+  void UnmapWindow();
+
+  // Syncs the file, and appends |clusters| to the index with |layout|.
+  // Called by the index thread only. Returns false on failure.
+  bool FlushIndex(const Layout& layout, const std::vector<Cluster>& clusters);
+
+  // Syncs the index every |kIndexFlushIntervalMs| until |stop_| is set.
+  void IndexThread();
+
+  std::string path_;
+  int fd_;
+  int index_fd_;
+
+  // Muxing thread state: the position libwebm writes at, the end of the
+  // data written, the bytes allocated to the file, the window, and the
+  // start of the cluster being written, or -1.
+  int64 position_;
+  int64 end_;
+  int64 allocated_;
+  uint8* ptr_window_;
+  int64 window_offset_;
+  int64 cluster_start_;
+  bool write_failed_;
+
+  // Shared with the index thread.
+  mutable std::mutex mutex_;
+  std::condition_variable stop_requested_;
+  Layout layout_;
+  std::vector<Cluster> completed_clusters_;
+  bool stop_;
+
+  // Index thread state: the number of clusters in the index, and whether
+  // indexing failed.
+  int64 indexed_clusters_;
+  bool index_failed_;
+  std::unique_ptr<std::thread> index_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(MappedArchiveFile);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_MAPPED_ARCHIVE_FILE_H_
@@ -0,0 +1,94 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_MEDIA_SOURCE_H_
+#define WEBMLIVE_ENCODER_MEDIA_SOURCE_H_
+
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+#include "encoder/webm_encoder.h"
+
+namespace webmlive {
+
+// Source of raw audio and video for |WebmEncoder|. Sources deliver samples
+// from threads of their own through the callbacks passed to |Init()|.
+class MediaSourceInterface {
+ public:
+  enum {
+    kSuccess = 0,
+
+    // Returned by |CheckStatus()| once a source with finite input, a file for
+    // example, has delivered all of it.
+    kInputEnded = 1,
+  };
+  virtual ~MediaSourceInterface() {}
+
+  // Prepares the source for |config|. Returns |kSuccess| upon success, or a
+  // |WebmEncoder| status code upon failure.
+  virtual int Init(const WebmEncoderConfig& config,
+                   AudioSamplesCallbackInterface* ptr_audio_callback,
+                   VideoFrameCallbackInterface* ptr_video_callback) = 0;
+
+  // Starts delivering samples. Returns |kSuccess| upon success, or a
+  // |WebmEncoder| status code upon failure.
+  virtual int Run() = 0;
+
+  // Returns |kSuccess| while the source is delivering samples, |kInputEnded|
+  // when it has no more to deliver, or a |WebmEncoder| status code when it
+  // failed.
+  virtual int CheckStatus() = 0;
+
+  // Stops delivering samples.
+  virtual void Stop() = 0;
+
+  // Reopens the capture devices of a running source after a failure or a
+  // stall, with the settings passed to |Init()|, and runs the source again.
+  // Samples go to the same callbacks, and their timestamps may restart.
+  // Returns |kSuccess| upon success, or a |WebmEncoder| status code upon
+  // failure, after which the source may be restarted again. Sources that
+  // cannot reopen their input return |WebmEncoder::kNotImplemented|.
+  virtual int Restart() {
+    return WebmEncoder::kNotImplemented;
+  }
+
+  // Makes a source opened in standby, |WebmEncoderConfig::standby|, take
+  // over the input from the encoder it was watching, so that no sample is
+  // delivered twice or lost in the switch. Returns |kSuccess| upon success.
+  // Sources that cannot share their input return
+  // |WebmEncoder::kNotImplemented|.
+  virtual int Promote() {
+    return WebmEncoder::kNotImplemented;
+  }
+
+  // Settings of the samples delivered by the source. Valid after |Init()|.
+  virtual AudioConfig actual_audio_config() const = 0;
+  virtual VideoConfig actual_video_config() const = 0;
+
+  // Opens the inputs of |config.extra_audio_tracks|, after |Init()|. Samples
+  // of track |i| are delivered through |callbacks[i]|, timestamped on the
+  // clock of the other streams. Returns |kSuccess| upon success, or a
+  // |WebmEncoder| status code upon failure. Sources without extra audio
+  // inputs return |WebmEncoder::kNotImplemented|.
+  virtual int InitExtraAudio(
+      const WebmEncoderConfig& config,
+      const std::vector<AudioSamplesCallbackInterface*>& callbacks) {
+    return WebmEncoder::kNotImplemented;
+  }
+
+  // Settings of the samples delivered for extra audio track |index|. Valid
+  // after |InitExtraAudio()|.
+  virtual AudioConfig actual_extra_audio_config(size_t index) const {
+    return AudioConfig();
+  }
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_MEDIA_SOURCE_H_
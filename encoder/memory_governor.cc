@@ -0,0 +1,316 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/memory_governor.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <cstdio>
+#include <new>
+#include <sstream>
+
+#include "encoder/metrics.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+const char* const kSubsystemNames[kNumMemorySubsystems] = {
+  "capture_pools",
+  "muxer_buffers",
+  "upload_queues",
+  "codec_arenas",
+};
+
+// Raises |ptr_value| to |value| when |value| is larger.
+void RaiseTo(std::atomic<int64>* ptr_value, int64 value) {
+  int64 current = ptr_value->load(std::memory_order_relaxed);
+  while (value > current &&
+         !ptr_value->compare_exchange_weak(current, value)) {
+  }
+}
+}  // namespace
+
+// Bytes held by the accounts of one stream.
+struct MemoryAccount::StreamUsage {
+  StreamUsage() : bytes(0), ptr_pressure(NULL) {}
+  std::string labels;
+  std::atomic<int64> bytes;
+  Metric* ptr_pressure;
+};
+
+MemoryAccount::MemoryAccount(MemoryGovernor* ptr_governor,
+                             MemorySubsystem subsystem,
+                             const std::string& owner,
+                             StreamUsage* ptr_stream, Metric* ptr_bytes,
+                             Metric* ptr_peak_bytes, Metric* ptr_refusals)
+    : ptr_governor_(ptr_governor),
+      subsystem_(subsystem),
+      owner_(owner),
+      ptr_stream_(ptr_stream),
+      bytes_(0),
+      peak_bytes_(0),
+      ptr_bytes_(ptr_bytes),
+      ptr_peak_bytes_(ptr_peak_bytes),
+      ptr_refusals_(ptr_refusals) {
+}
+
+void MemoryAccount::Set(int64 bytes) {
+  const int64 delta = bytes - bytes_.exchange(bytes);
+  if (delta == 0) {
+    return;
+  }
+  ptr_bytes_->Set(bytes);
+  if (bytes > peak_bytes()) {
+    RaiseTo(&peak_bytes_, bytes);
+    ptr_peak_bytes_->Set(peak_bytes());
+  }
+  const int64 stream_bytes = ptr_stream_->bytes.fetch_add(delta) + delta;
+  ptr_governor_->Add(delta);
+  ptr_stream_->ptr_pressure->Set(ptr_governor_->Pressure(stream_bytes));
+}
+
+bool MemoryAccount::MayGrow() {
+  if (pressure() != kMemoryCritical) {
+    return true;
+  }
+  ptr_refusals_->Increment(1);
+  return false;
+}
+
+MemoryPressure MemoryAccount::pressure() const {
+  return ptr_governor_->Pressure(ptr_stream_->bytes.load());
+}
+
+MemoryGovernor::MemoryGovernor()
+    : process_limit_bytes_(0),
+      stream_limit_bytes_(0),
+      soft_limit_percent_(MemoryGovernorSettings::kDefaultSoftLimitPercent),
+      total_bytes_(0),
+      peak_total_bytes_(0),
+      ptr_total_bytes_(NULL),
+      ptr_peak_total_bytes_(NULL),
+      ptr_limit_bytes_(NULL),
+      ptr_resident_bytes_(NULL),
+      ptr_peak_resident_bytes_(NULL),
+      ptr_untracked_bytes_(NULL) {
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  ptr_total_bytes_ = registry.GetGauge(
+      "webmlive_memory_total_bytes", "",
+      "Bytes held by all the subsystems tracked by the memory governor.");
+  ptr_peak_total_bytes_ = registry.GetGauge(
+      "webmlive_memory_peak_total_bytes", "",
+      "Most bytes held at once by the tracked subsystems.");
+  ptr_limit_bytes_ = registry.GetGauge(
+      "webmlive_memory_limit_bytes", "",
+      "Process memory limit of the tracked subsystems; 0 when unlimited.");
+  ptr_resident_bytes_ = registry.GetGauge(
+      "webmlive_process_resident_bytes", "",
+      "Resident size of the process.");
+  ptr_peak_resident_bytes_ = registry.GetGauge(
+      "webmlive_process_peak_resident_bytes", "",
+      "Largest resident size of the process seen by the memory governor.");
+  ptr_untracked_bytes_ = registry.GetGauge(
+      "webmlive_memory_untracked_bytes", "",
+      "Resident bytes not held by a tracked subsystem: libraries, code, "
+      "and heap fragmentation.");
+}
+
+MemoryGovernor::~MemoryGovernor() {
+}
+
+MemoryGovernor& MemoryGovernor::Instance() {
+  static MemoryGovernor governor;
+  return governor;
+}
+
+int MemoryGovernor::Configure(const MemoryGovernorSettings& settings) {
+  if (settings.process_limit_bytes < 0 || settings.stream_limit_bytes < 0 ||
+      settings.soft_limit_percent < 1 || settings.soft_limit_percent > 100) {
+    LOG(ERROR) << "invalid memory limits, process="
+               << settings.process_limit_bytes
+               << " stream=" << settings.stream_limit_bytes
+               << " soft_limit_percent=" << settings.soft_limit_percent;
+    return kInvalidArg;
+  }
+  process_limit_bytes_ = settings.process_limit_bytes;
+  stream_limit_bytes_ = settings.stream_limit_bytes;
+  soft_limit_percent_ = settings.soft_limit_percent;
+  if (ptr_limit_bytes_)
+    ptr_limit_bytes_->Set(settings.process_limit_bytes);
+  return kSuccess;
+}
+
+MemoryAccount* MemoryGovernor::GetAccount(MemorySubsystem subsystem,
+                                          const std::string& labels,
+                                          const std::string& owner) {
+  if (subsystem < 0 || subsystem >= kNumMemorySubsystems) {
+    return NULL;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  MemoryAccount::StreamUsage* ptr_stream = NULL;
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    if (streams_[i]->labels == labels) {
+      ptr_stream = streams_[i].get();
+      break;
+    }
+  }
+  if (ptr_stream) {
+    for (size_t i = 0; i < accounts_.size(); ++i) {
+      if (accounts_[i]->ptr_stream_ == ptr_stream &&
+          accounts_[i]->subsystem_ == subsystem &&
+          accounts_[i]->owner_ == owner)
+        return accounts_[i].get();
+    }
+  }
+
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  if (!ptr_stream) {
+    std::unique_ptr<MemoryAccount::StreamUsage> stream(
+        new (std::nothrow) MemoryAccount::StreamUsage());  // NOLINT
+    if (!stream) {
+      LOG(ERROR) << "out of memory creating memory account.";
+      return NULL;
+    }
+    stream->labels = labels;
+    stream->ptr_pressure = registry.GetGauge(
+        "webmlive_memory_pressure", labels,
+        "Memory pressure of the stream: 0 normal, 1 high, 2 critical.");
+    if (!stream->ptr_pressure) {
+      return NULL;
+    }
+    streams_.push_back(std::move(stream));
+    ptr_stream = streams_.back().get();
+  }
+  const std::string account_labels = MetricsRegistry::JoinLabels(
+      MetricsRegistry::JoinLabels(
+          std::string("subsystem=\"") + kSubsystemNames[subsystem] + "\"",
+          owner),
+      labels);
+  Metric* const ptr_bytes = registry.GetGauge(
+      "webmlive_memory_bytes", account_labels,
+      "Bytes held by a subsystem tracked by the memory governor.");
+  Metric* const ptr_peak_bytes = registry.GetGauge(
+      "webmlive_memory_peak_bytes", account_labels,
+      "Most bytes held at once by a subsystem tracked by the memory "
+      "governor.");
+  Metric* const ptr_refusals = registry.GetCounter(
+      "webmlive_memory_refusals_total", account_labels,
+      "Allocations refused by the memory governor at the memory limit.");
+  if (!ptr_bytes || !ptr_peak_bytes || !ptr_refusals) {
+    return NULL;
+  }
+  std::unique_ptr<MemoryAccount> account(
+      new (std::nothrow) MemoryAccount(this, subsystem, owner,  // NOLINT
+                                       ptr_stream, ptr_bytes, ptr_peak_bytes,
+                                       ptr_refusals));
+  if (!account) {
+    LOG(ERROR) << "out of memory creating memory account.";
+    return NULL;
+  }
+  accounts_.push_back(std::move(account));
+  return accounts_.back().get();
+}
+
+void MemoryGovernor::UpdateProcessMetrics() {
+  const int64 resident_bytes = ResidentBytes();
+  if (resident_bytes <= 0 || !ptr_resident_bytes_) {
+    return;
+  }
+  ptr_resident_bytes_->Set(resident_bytes);
+  if (resident_bytes > ptr_peak_resident_bytes_->value())
+    ptr_peak_resident_bytes_->Set(resident_bytes);
+  ptr_untracked_bytes_->Set(resident_bytes - total_bytes());
+}
+
+void MemoryGovernor::WriteReport(std::string* ptr_text) {
+  if (!ptr_text) {
+    return;
+  }
+  UpdateProcessMetrics();
+  std::ostringstream report;
+  report << "memory report (bytes / peak bytes / refusals):\n";
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = 0; i < accounts_.size(); ++i) {
+      const MemoryAccount& account = *accounts_[i];
+      report << "  " << kSubsystemNames[account.subsystem_];
+      if (!account.owner_.empty())
+        report << " {" << account.owner_ << "}";
+      if (!account.ptr_stream_->labels.empty())
+        report << " {" << account.ptr_stream_->labels << "}";
+      report << ": " << account.bytes() << " / " << account.peak_bytes()
+             << " / " << account.ptr_refusals_->value() << "\n";
+    }
+  }
+  report << "  tracked: " << total_bytes() << " / "
+         << peak_total_bytes() << "\n";
+  if (ptr_resident_bytes_ && ptr_resident_bytes_->value() > 0) {
+    report << "  resident: " << ptr_resident_bytes_->value() << " / "
+           << ptr_peak_resident_bytes_->value() << "\n"
+           << "  untracked: " << ptr_untracked_bytes_->value() << "\n";
+  }
+  ptr_text->append(report.str());
+}
+
+int64 MemoryGovernor::ResidentBytes() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                               sizeof(counters))) {
+    return 0;
+  }
+  return static_cast<int64>(counters.WorkingSetSize);
+#else
+  // The second field of statm is the resident set, in pages.
+  FILE* const statm = fopen("/proc/self/statm", "r");
+  if (!statm) {
+    return 0;
+  }
+  long long size_pages = 0;  // NOLINT
+  long long resident_pages = 0;  // NOLINT
+  const int fields = fscanf(statm, "%lld %lld", &size_pages, &resident_pages);
+  fclose(statm);
+  if (fields != 2) {
+    return 0;
+  }
+  return resident_pages * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+MemoryPressure MemoryGovernor::Pressure(int64 stream_bytes) const {
+  const int64 limits[2] = {stream_limit_bytes_.load(),
+                           process_limit_bytes_.load()};
+  const int64 usage[2] = {stream_bytes, total_bytes_.load()};
+  const int soft_limit_percent = soft_limit_percent_.load();
+  MemoryPressure pressure = kMemoryNormal;
+  for (int i = 0; i < 2; ++i) {
+    if (limits[i] <= 0)
+      continue;
+    if (usage[i] >= limits[i])
+      return kMemoryCritical;
+    if (usage[i] * 100 >= limits[i] * soft_limit_percent)
+      pressure = kMemoryHigh;
+  }
+  return pressure;
+}
+
+void MemoryGovernor::Add(int64 delta) {
+  const int64 total_bytes = total_bytes_.fetch_add(delta) + delta;
+  RaiseTo(&peak_total_bytes_, total_bytes);
+  if (ptr_total_bytes_) {
+    ptr_total_bytes_->Set(total_bytes);
+    ptr_peak_total_bytes_->Set(peak_total_bytes());
+  }
+}
+
+}  // namespace webmlive
@@ -0,0 +1,229 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_MEMORY_GOVERNOR_H_
+#define WEBMLIVE_ENCODER_MEMORY_GOVERNOR_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+class MemoryGovernor;
+class Metric;
+
+// Owners of the memory tracked by |MemoryGovernor|.
+enum MemorySubsystem {
+  // Raw sample pools filled by the capture threads.
+  kMemoryCapturePools = 0,
+
+  // Muxer output waiting for the data sink, and remuxer input waiting to be
+  // parsed.
+  kMemoryMuxerBuffers = 1,
+
+  // Chunks queued for upload.
+  kMemoryUploadQueues = 2,
+
+  // Compressed frame storage of the video encode workers. Memory libvpx
+  // allocates internally is not visible here; it shows up as untracked
+  // memory in |MemoryGovernor::WriteReport()|.
+  kMemoryCodecArenas = 3,
+
+  kNumMemorySubsystems = 4,
+};
+
+// How close the memory of a stream, or of the process, is to its limit.
+enum MemoryPressure {
+  kMemoryNormal = 0,
+
+  // Past |MemoryGovernorSettings::soft_limit_percent| of a limit.
+  kMemoryHigh = 1,
+
+  // At or past a limit.
+  kMemoryCritical = 2,
+};
+
+struct MemoryGovernorSettings {
+  static const int kDefaultSoftLimitPercent = 80;
+
+  MemoryGovernorSettings()
+      : process_limit_bytes(0),
+        stream_limit_bytes(0),
+        soft_limit_percent(kDefaultSoftLimitPercent) {}
+
+  // Bytes the tracked subsystems of all streams, and of each stream, may
+  // hold. 0 removes the limit.
+  int64 process_limit_bytes;
+  int64 stream_limit_bytes;
+
+  // Share of a limit, in percent, past which memory is |kMemoryHigh|.
+  int soft_limit_percent;
+};
+
+// Bytes held by one subsystem of one stream, or by one owner within it.
+// Obtained from
+// |MemoryGovernor::GetAccount()|; updates are atomic, and may be made from
+// any thread.
+class MemoryAccount {
+ public:
+  // Sets the bytes held to |bytes|. Owners that know their size, such as
+  // buffers and queues, set it after each change instead of adding and
+  // removing amounts.
+  void Set(int64 bytes);
+
+  // Returns true when the owner may allocate more memory: the stream and the
+  // process are below their limits. Counts a refusal otherwise.
+  bool MayGrow();
+
+  // Returns the pressure on the stream of the account: the larger of the
+  // stream's and the process's.
+  MemoryPressure pressure() const;
+
+  int64 bytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+  // Returns the most bytes held since the account was created.
+  int64 peak_bytes() const {
+    return peak_bytes_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  friend class MemoryGovernor;
+  struct StreamUsage;
+
+  MemoryAccount(MemoryGovernor* ptr_governor, MemorySubsystem subsystem,
+                const std::string& owner, StreamUsage* ptr_stream,
+                Metric* ptr_bytes, Metric* ptr_peak_bytes,
+                Metric* ptr_refusals);
+
+  MemoryGovernor* const ptr_governor_;
+  const MemorySubsystem subsystem_;
+  const std::string owner_;
+  StreamUsage* const ptr_stream_;
+  std::atomic<int64> bytes_;
+  std::atomic<int64> peak_bytes_;
+  Metric* const ptr_bytes_;
+  Metric* const ptr_peak_bytes_;
+  Metric* const ptr_refusals_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(MemoryAccount);
+};
+
+// Process wide memory budget. The owners of large, growable memory report
+// the bytes they hold through a |MemoryAccount| per subsystem and stream, and
+// ask the governor before growing. The governor compares the totals of each
+// stream, and of the process, against the configured limits, and the owners
+// shed load as the pressure rises:
+// - |kMemoryHigh|: the encoder decimates frames, halving its output rate;
+// - |kMemoryCritical|: the encoder drops GOPs, so its muxer buffers stop
+//   growing; the uploader drops its oldest queued media segments; the
+//   capture pools refuse to grow, dropping samples instead.
+// Without limits every account is |kMemoryNormal|, and only the usage is
+// tracked.
+//
+// Streams are identified by their metrics labels, so the accounts of one
+// encoder, uploader and remuxer add up to one stream total. Usage is
+// exported through |MetricsRegistry| as webmlive_memory_bytes and
+// webmlive_memory_peak_bytes, per subsystem, owner and stream, and
+// webmlive_memory_refusals_total. |UpdateProcessMetrics()| adds the resident
+// size of the process, and the part of it no account explains: growth there,
+// with flat accounts, points at libraries (libvpx, libcurl, glog) or heap
+// fragmentation rather than at the encoder's own buffers.
+//
+// Notes
+// - Accounts are never removed. Pointers returned by |GetAccount()| stay
+//   valid for the life of the process; an owner initialized again gets its
+//   account back, and sets it from its new state.
+// - Memory is tracked at the sizes the owners report: pools count their
+//   buffers at the size of the last sample, and queues count the bytes of
+//   the chunks they hold.
+class MemoryGovernor {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  static MemoryGovernor& Instance();
+
+  // Sets the limits. May be called at any time; the pressure follows the new
+  // limits on the next check. Returns |kSuccess| when successful.
+  int Configure(const MemoryGovernorSettings& settings);
+
+  // Returns the account of |subsystem| for the stream labelled |labels|, and
+  // creates it when it does not exist. |owner| holds extra labels telling
+  // apart owners sharing a subsystem within a stream, such as the
+  // representations of a DASH encode; empty when the stream has one owner.
+  // Returns NULL when out of memory.
+  MemoryAccount* GetAccount(MemorySubsystem subsystem,
+                            const std::string& labels,
+                            const std::string& owner);
+
+  // Returns the bytes held by all accounts.
+  int64 total_bytes() const {
+    return total_bytes_.load(std::memory_order_relaxed);
+  }
+
+  // Returns the most bytes held by all accounts at once.
+  int64 peak_total_bytes() const {
+    return peak_total_bytes_.load(std::memory_order_relaxed);
+  }
+
+  // Sets the process gauges: the resident size of the process, its peak,
+  // and the resident bytes not held by any account. Call before writing the
+  // metrics.
+  void UpdateProcessMetrics();
+
+  // Appends a table of every account to |ptr_text|: its live and peak bytes
+  // and refusals, followed by the totals, the resident size and the
+  // untracked bytes.
+  void WriteReport(std::string* ptr_text);
+
+  // Returns the resident size of the process in bytes, or 0 when the
+  // platform does not report it.
+  static int64 ResidentBytes();
+
+ private:
+  friend class MemoryAccount;
+
+  MemoryGovernor();
+  ~MemoryGovernor();
+
+  // Returns the pressure of |stream_bytes| and of |total_bytes_| against
+  // their limits.
+  MemoryPressure Pressure(int64 stream_bytes) const;
+
+  // Adds |delta| bytes to |total_bytes_|.
+  void Add(int64 delta);
+
+  std::atomic<int64> process_limit_bytes_;
+  std::atomic<int64> stream_limit_bytes_;
+  std::atomic<int> soft_limit_percent_;
+  std::atomic<int64> total_bytes_;
+  std::atomic<int64> peak_total_bytes_;
+  Metric* ptr_total_bytes_;
+  Metric* ptr_peak_total_bytes_;
+  Metric* ptr_limit_bytes_;
+  Metric* ptr_resident_bytes_;
+  Metric* ptr_peak_resident_bytes_;
+  Metric* ptr_untracked_bytes_;
+
+  // Accounts, and the usage of their streams. Protected by |mutex_|; the
+  // objects themselves are updated without it.
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<MemoryAccount::StreamUsage>> streams_;
+  std::vector<std::unique_ptr<MemoryAccount>> accounts_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(MemoryGovernor);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_MEMORY_GOVERNOR_H_
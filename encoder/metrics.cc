@@ -0,0 +1,139 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <new>
+#include <sstream>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+const char kTempFileSuffix[] = ".tmp";
+}  // namespace
+
+Metric::Metric(Type type, const std::string& name, const std::string& labels,
+               const std::string& help)
+    : type_(type), name_(name), labels_(labels), help_(help), value_(0) {}
+
+MetricsRegistry& MetricsRegistry::Instance() {
+  static MetricsRegistry registry;
+  return registry;
+}
+
+std::string MetricsRegistry::JoinLabels(const std::string& first,
+                                        const std::string& second) {
+  if (first.empty()) {
+    return second;
+  } else if (second.empty()) {
+    return first;
+  }
+  return first + "," + second;
+}
+
+Metric* MetricsRegistry::GetCounter(const std::string& name,
+                                    const std::string& labels,
+                                    const std::string& help) {
+  return GetMetric(Metric::kCounter, name, labels, help);
+}
+
+Metric* MetricsRegistry::GetGauge(const std::string& name,
+                                  const std::string& labels,
+                                  const std::string& help) {
+  return GetMetric(Metric::kGauge, name, labels, help);
+}
+
+Metric* MetricsRegistry::GetMetric(Metric::Type type, const std::string& name,
+                                   const std::string& labels,
+                                   const std::string& help) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < metrics_.size(); ++i) {
+    Metric* const ptr_metric = metrics_[i].get();
+    if (ptr_metric->name() != name)
+      continue;
+    if (ptr_metric->type() != type) {
+      LOG(ERROR) << "metric " << name << " exists with another type.";
+      return NULL;
+    }
+    if (ptr_metric->labels() == labels)
+      return ptr_metric;
+  }
+  std::unique_ptr<Metric> metric(
+      new (std::nothrow) Metric(type, name, labels, help));  // NOLINT
+  if (!metric) {
+    LOG(ERROR) << "out of memory creating metric " << name;
+    return NULL;
+  }
+  metrics_.push_back(std::move(metric));
+  return metrics_.back().get();
+}
+
+void MetricsRegistry::WriteText(std::string* ptr_text) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // Exports list each metric name once, followed by all of its label sets.
+  std::vector<const Metric*> sorted;
+  for (size_t i = 0; i < metrics_.size(); ++i)
+    sorted.push_back(metrics_[i].get());
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Metric* a, const Metric* b) {
+                     return a->name() < b->name();
+                   });
+
+  std::ostringstream text;
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    const Metric& metric = *sorted[i];
+    if (i == 0 || sorted[i - 1]->name() != metric.name()) {
+      text << "# HELP " << metric.name() << " " << metric.help() << "\n"
+           << "# TYPE " << metric.name() << " "
+           << (metric.type() == Metric::kCounter ? "counter" : "gauge")
+           << "\n";
+    }
+    text << metric.name();
+    if (!metric.labels().empty())
+      text << "{" << metric.labels() << "}";
+    text << " " << metric.value() << "\n";
+  }
+  *ptr_text = text.str();
+}
+
+int MetricsRegistry::WriteFile(const std::string& file_name) const {
+  if (file_name.empty()) {
+    LOG(ERROR) << "metrics file name empty.";
+    return kInvalidArg;
+  }
+  std::string text;
+  WriteText(&text);
+
+  const std::string temp_name = file_name + kTempFileSuffix;
+  FILE* const file = fopen(temp_name.c_str(), "wb");
+  if (!file) {
+    LOG(ERROR) << "cannot open metrics file " << temp_name;
+    return kFileError;
+  }
+  const size_t bytes_written = fwrite(text.data(), 1, text.length(), file);
+  const bool close_ok = (fclose(file) == 0);
+  if (!close_ok || bytes_written != text.length()) {
+    LOG(ERROR) << "metrics file write failed for " << temp_name;
+    remove(temp_name.c_str());
+    return kFileError;
+  }
+
+  // rename() does not replace existing files on all platforms.
+  remove(file_name.c_str());
+  if (rename(temp_name.c_str(), file_name.c_str())) {
+    LOG(ERROR) << "cannot rename metrics file " << temp_name;
+    return kFileError;
+  }
+  return kSuccess;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,119 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_METRICS_H_
+#define WEBMLIVE_ENCODER_METRICS_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Counter or gauge owned by |MetricsRegistry|. Updates are single atomic
+// operations and may be made from any thread.
+class Metric {
+ public:
+  enum Type {
+    // Value only grows.
+    kCounter = 0,
+    // Value may go up and down.
+    kGauge = 1,
+  };
+
+  void Increment(int64 amount) {
+    value_.fetch_add(amount, std::memory_order_relaxed);
+  }
+  void Decrement(int64 amount) {
+    value_.fetch_sub(amount, std::memory_order_relaxed);
+  }
+  void Set(int64 value) { value_.store(value, std::memory_order_relaxed); }
+  int64 value() const { return value_.load(std::memory_order_relaxed); }
+
+  Type type() const { return type_; }
+  const std::string& name() const { return name_; }
+  const std::string& labels() const { return labels_; }
+  const std::string& help() const { return help_; }
+
+ private:
+  friend class MetricsRegistry;
+  Metric(Type type, const std::string& name, const std::string& labels,
+         const std::string& help);
+
+  const Type type_;
+  const std::string name_;
+  const std::string labels_;
+  const std::string help_;
+  std::atomic<int64> value_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(Metric);
+};
+
+// Process wide set of named metrics. Components look their metrics up once,
+// usually from their |Init()| methods, and keep the returned pointers; only
+// lookups and exports take the registry lock.
+//
+// Metrics are identified by |name| and |labels|. |labels| is either empty or
+// a list of Prometheus style label pairs without braces, for example
+// 'muxer="video"'.
+//
+// Notes
+// - Metrics are never removed. Pointers returned by |GetCounter()| and
+//   |GetGauge()| stay valid for the life of the process.
+// - A component that is initialized again gets the same metric back, so
+//   counters keep growing across encoder restarts.
+class MetricsRegistry {
+ public:
+  enum {
+    kFileError = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  static MetricsRegistry& Instance();
+
+  // Returns |first| and |second| joined into one label list. Either may be
+  // empty.
+  static std::string JoinLabels(const std::string& first,
+                                const std::string& second);
+
+  // Returns the metric named |name| with |labels|, and creates it when it
+  // does not exist. |help| describes the metric in exports; the first value
+  // passed for a name is used. Returns NULL when out of memory, or when the
+  // metric exists with a different type.
+  Metric* GetCounter(const std::string& name, const std::string& labels,
+                     const std::string& help);
+  Metric* GetGauge(const std::string& name, const std::string& labels,
+                   const std::string& help);
+
+  // Writes all metrics to |ptr_text| in the Prometheus text exposition
+  // format.
+  void WriteText(std::string* ptr_text) const;
+
+  // Writes |WriteText()| output to a temporary file, and then renames it to
+  // |file_name| so that readers never see a partial file. Returns |kSuccess|
+  // when successful.
+  int WriteFile(const std::string& file_name) const;
+
+ private:
+  MetricsRegistry() {}
+  ~MetricsRegistry() {}
+
+  Metric* GetMetric(Metric::Type type, const std::string& name,
+                    const std::string& labels, const std::string& help);
+
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Metric>> metrics_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(MetricsRegistry);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_METRICS_H_
@@ -0,0 +1,537 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+//
+// Micro-benchmarks for the encoder hot paths: |BufferPool<VideoFrame>| under
+// contention, clear and encrypted |LiveWebmMuxer| chunk writes, |VideoFrame|
+// color conversion, the picture in picture and overlay blends, the audio mix
+// and the PCM deinterleave loops used by the audio encoders. Results are
+// written as a JSON array, one object per benchmark, to stdout or to
+// --output.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/aes_ctr.h"
+#include "encoder/alpha_blend.h"
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/buffer_pool-inl.h"
+#include "encoder/buffer_pool.h"
+#include "encoder/buffer_util.h"
+#include "encoder/field_interpolate.h"
+#include "encoder/pcm_deinterleave.h"
+#include "encoder/pcm_mix.h"
+#include "encoder/v210_unpack.h"
+#include "encoder/video_encoder.h"
+#include "encoder/webm_mux.h"
+#include "glog/logging.h"
+
+namespace {
+
+using webmlive::VideoConfig;
+using webmlive::VideoFrame;
+
+// Default minimum run time of each benchmark.
+const int kDefaultMinTimeMs = 500;
+
+// Compressed frame size and frame interval used by the muxer benchmarks.
+const int kMuxFrameSize = 16 * 1024;
+const int kMuxFrameDurationMs = 33;
+const int kMuxKeyframeInterval = 30;
+
+// Audio frames per deinterleave call; a 20 ms buffer at 48 kHz.
+const int kDeinterleaveFrames = 960;
+
+struct BenchmarkResult {
+  BenchmarkResult() : iterations(0), elapsed_ns(0), bytes(0) {}
+
+  std::string name;
+  int64 iterations;
+  int64 elapsed_ns;
+
+  // Bytes processed by all iterations, or 0 when not meaningful.
+  int64 bytes;
+};
+
+// Benchmark body: runs |iterations| operations and returns the number of
+// bytes they processed.
+typedef std::function<int64(int64 iterations)> BenchmarkFunction;
+
+// Values the benchmarks store so that the compiler keeps their work.
+std::atomic<int64> g_sink(0);
+
+struct BenchmarkOptions {
+  BenchmarkOptions() : min_time_ms(kDefaultMinTimeMs) {}
+
+  std::string filter;
+  std::string output;
+  int min_time_ms;
+};
+
+// Runs |function| with growing iteration counts until one run lasts
+// |options.min_time_ms|, and appends the result of that run to |ptr_results|.
+void RunBenchmark(const BenchmarkOptions& options, const std::string& name,
+                  const BenchmarkFunction& function,
+                  std::vector<BenchmarkResult>* ptr_results) {
+  if (!options.filter.empty() && name.find(options.filter) == std::string::npos)
+    return;
+  const int64 min_time_ns = static_cast<int64>(options.min_time_ms) * 1000000;
+  BenchmarkResult result;
+  result.name = name;
+  int64 iterations = 1;
+  for (;;) {
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    const int64 bytes = function(iterations);
+    const int64 elapsed_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    if (elapsed_ns >= min_time_ns || iterations >= (1LL << 40)) {
+      result.iterations = iterations;
+      result.elapsed_ns = elapsed_ns;
+      result.bytes = bytes;
+      break;
+    }
+    // Aim past the minimum time, growing by at most 10x per run.
+    const int64 target =
+        elapsed_ns > 0 ? iterations * min_time_ns * 3 / (elapsed_ns * 2) : 0;
+    iterations = std::min(iterations * 10, std::max(target, iterations + 1));
+  }
+  LOG(INFO) << name << ": " << result.iterations << " iterations in "
+            << result.elapsed_ns / 1000000.0 << " ms";
+  ptr_results->push_back(result);
+}
+
+// Formats |results| as a JSON array.
+std::string ResultsToJson(const std::vector<BenchmarkResult>& results) {
+  std::ostringstream json;
+  json << "[\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchmarkResult& r = results[i];
+    const double seconds = r.elapsed_ns / 1000000000.0;
+    json << "  {\"name\": \"" << r.name << "\", "
+         << "\"iterations\": " << r.iterations << ", "
+         << "\"ns_per_op\": "
+         << static_cast<double>(r.elapsed_ns) / r.iterations << ", "
+         << "\"ops_per_second\": "
+         << (seconds > 0 ? r.iterations / seconds : 0.0);
+    if (r.bytes > 0) {
+      json << ", \"bytes_per_second\": "
+           << (seconds > 0 ? r.bytes / seconds : 0.0);
+    }
+    json << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  json << "]\n";
+  return json.str();
+}
+
+// Returns an I420 |width| x |height| frame filled with mid gray.
+bool InitI420Frame(int32 width, int32 height, VideoFrame* ptr_frame) {
+  VideoConfig config;
+  config.format = webmlive::kVideoFormatI420;
+  config.width = width;
+  config.height = height;
+  config.stride = width;
+  const int32 size = VideoFrame::PlanarFrameSize(width, height);
+  std::vector<uint8> data(size, 0x80);
+  return ptr_frame->Init(config, true, 0, 0, &data[0], size) ==
+         VideoFrame::kSuccess;
+}
+
+//
+// BufferPool<VideoFrame> benchmarks.
+//
+
+// A producer thread commits frames while the calling thread decommits them.
+// Each iteration is one frame passed through the pool; frames the pool
+// refuses are committed again.
+int64 BufferPoolContended(bool lock_free, int64 iterations) {
+  const int kNumBuffers = 4;
+  webmlive::BufferPool<VideoFrame> pool;
+  const int status = lock_free ? pool.InitLockFree(kNumBuffers) :
+                                 pool.Init(false, kNumBuffers);
+  if (status) {
+    LOG(ERROR) << "BufferPool Init failed: " << status;
+    return 0;
+  }
+
+  std::thread producer([&pool, iterations] {
+    VideoFrame frame;
+    if (!InitI420Frame(64, 64, &frame))
+      return;
+    for (int64 i = 0; i < iterations;) {
+      frame.set_timestamp(i);
+      if (pool.Commit(&frame) == webmlive::BufferPool<VideoFrame>::kSuccess)
+        ++i;
+      else
+        std::this_thread::yield();
+    }
+  });
+
+  VideoFrame frame;
+  InitI420Frame(64, 64, &frame);
+  int64 checksum = 0;
+  for (int64 i = 0; i < iterations;) {
+    if (pool.Decommit(&frame) == webmlive::BufferPool<VideoFrame>::kSuccess) {
+      checksum += frame.timestamp();
+      ++i;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  g_sink += checksum;
+  return 0;
+}
+
+//
+// LiveWebmMuxer benchmarks.
+//
+
+// Writes |iterations| VP9 frames to a video muxer, encrypted when |encrypt|
+// is true, and removes each chunk as it completes: erased by
+// |DiscardChunk()| when |detach| is false, and moved into a |DataChunk| by
+// |ReadChunk()| otherwise. Returns the number of chunk bytes produced.
+int64 MuxerWrite(bool detach, bool encrypt, int64 iterations) {
+  webmlive::LiveWebmMuxer muxer;
+  VideoConfig video_config;
+  video_config.format = webmlive::kVideoFormatVP9;
+  video_config.width = 1280;
+  video_config.height = 720;
+  video_config.frame_rate = 1000.0 / kMuxFrameDurationMs;
+  const std::string key(webmlive::AesCtr::kKeySize, '\x2b');
+  if (muxer.Init(0, "video", "") ||
+      (encrypt && muxer.EnableEncryption("key", key)) ||
+      muxer.AddTrack(video_config)) {
+    LOG(ERROR) << "LiveWebmMuxer setup failed.";
+    return 0;
+  }
+
+  std::vector<uint8> payload(kMuxFrameSize);
+  for (size_t i = 0; i < payload.size(); ++i)
+    payload[i] = static_cast<uint8>(i * 31);
+  VideoFrame frame;
+  int64 chunk_bytes = 0;
+  for (int64 i = 0; i < iterations; ++i) {
+    const bool keyframe = (i % kMuxKeyframeInterval) == 0;
+    if (frame.Init(video_config, keyframe, i * kMuxFrameDurationMs,
+                   kMuxFrameDurationMs, &payload[0], kMuxFrameSize) ||
+        muxer.WriteVideoFrame(frame)) {
+      LOG(ERROR) << "LiveWebmMuxer write failed.";
+      return chunk_bytes;
+    }
+    int32 chunk_length = 0;
+    if (muxer.ChunkReady(&chunk_length)) {
+      chunk_bytes += chunk_length;
+      if (detach) {
+        webmlive::SharedDataChunk chunk;
+        muxer.ReadChunk(&chunk);
+      } else {
+        muxer.DiscardChunk();
+      }
+    }
+  }
+  return chunk_bytes;
+}
+
+//
+// VideoFrame color conversion benchmarks.
+//
+
+// Returns the size of a |format| frame of |width| x |height| pixels.
+int32 PackedFrameSize(webmlive::VideoFormat format, int32 width,
+                      int32 height) {
+  switch (format) {
+    case webmlive::kVideoFormatRGB:
+      return width * height * 3;
+    case webmlive::kVideoFormatRGBA:
+      return width * height * 4;
+    case webmlive::kVideoFormatNV12:
+    case webmlive::kVideoFormatNV21:
+      return width * height * 3 / 2;
+    case webmlive::kVideoFormatV210:
+      return webmlive::V210Stride(width) * height;
+    default:
+      return width * height * 2;
+  }
+}
+
+// Converts a |format| frame to I420 |iterations| times. Returns the number of
+// source bytes converted.
+int64 ConvertToI420(webmlive::VideoFormat format, int32 width, int32 height,
+                    int64 iterations) {
+  VideoConfig config;
+  config.format = format;
+  config.width = width;
+  config.height = height;
+  const int32 size = PackedFrameSize(format, width, height);
+  config.stride = (format == webmlive::kVideoFormatNV12 ||
+                   format == webmlive::kVideoFormatNV21) ?
+      width : size / height;
+  std::vector<uint8> data(size);
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = static_cast<uint8>(i * 7);
+
+  VideoFrame frame;
+  for (int64 i = 0; i < iterations; ++i) {
+    if (frame.Init(config, true, i, 0, &data[0], size)) {
+      LOG(ERROR) << "VideoFrame Init failed for format " << format;
+      return 0;
+    }
+  }
+  g_sink += frame.buffer()[0];
+  return iterations * size;
+}
+
+//
+// Alpha blend benchmark.
+//
+
+// Blends a |width| x |height| plane at |alpha| over another |iterations|
+// times. Returns the number of destination bytes blended.
+int64 Blend(int32 width, int32 height, int alpha, int64 iterations) {
+  std::vector<uint8> src(width * height);
+  std::vector<uint8> dst(width * height);
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = static_cast<uint8>(i * 7);
+    dst[i] = static_cast<uint8>(i * 13);
+  }
+  for (int64 i = 0; i < iterations; ++i) {
+    webmlive::BlendPlane(&src[0], width, &dst[0], width, width, height,
+                         alpha);
+  }
+  g_sink += dst[1];
+  return iterations * width * height;
+}
+
+// As |Blend()|, with per sample alpha, the logo of |FrameOverlay|.
+int64 BlendWithAlpha(int32 width, int32 height, int64 iterations) {
+  std::vector<uint8> src(width * height);
+  std::vector<uint8> alpha(width * height);
+  std::vector<uint8> dst(width * height);
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = static_cast<uint8>(i * 7);
+    alpha[i] = static_cast<uint8>(i * 3);
+    dst[i] = static_cast<uint8>(i * 13);
+  }
+  for (int64 i = 0; i < iterations; ++i) {
+    webmlive::BlendPlaneWithAlpha(&src[0], width, &alpha[0], width, &dst[0],
+                                  width, width, height);
+  }
+  g_sink += dst[1];
+  return iterations * width * height;
+}
+
+//
+// Deinterlace benchmark.
+//
+
+// Interpolates the odd rows of a |width| x |height| plane from its even
+// rows and the previous frame, as |Deinterlacer| does for the luma of a
+// frame, |iterations| times. Returns the number of bytes written.
+int64 InterpolateField(int32 width, int32 height, int64 iterations) {
+  std::vector<uint8> cur(width * height);
+  std::vector<uint8> prev(width * height);
+  std::vector<uint8> dst(width * height);
+  for (size_t i = 0; i < cur.size(); ++i) {
+    cur[i] = static_cast<uint8>(i * 7 + (i / width) * 5);
+    prev[i] = static_cast<uint8>(i * 7 + (i / width) * 3);
+  }
+  for (int64 i = 0; i < iterations; ++i) {
+    for (int32 y = 1; y + 1 < height; y += 2) {
+      webmlive::FieldRows rows;
+      rows.above = &cur[(y - 1) * width];
+      rows.below = &cur[(y + 1) * width];
+      rows.cur = &cur[y * width];
+      rows.prev = &prev[y * width];
+      rows.prev_above = &prev[(y - 1) * width];
+      rows.prev_below = &prev[(y + 1) * width];
+      webmlive::InterpolateFieldRow(rows, true, &dst[y * width], width);
+    }
+  }
+  g_sink += dst[width];
+  return iterations * width * (height / 2);
+}
+
+//
+// PCM deinterleave benchmarks.
+//
+
+// Deinterleaves |kDeinterleaveFrames| frames of |channels| channel audio
+// |iterations| times. Returns the number of input bytes processed.
+int64 Deinterleave(bool s16, int channels, int64 iterations) {
+  const int num_samples = kDeinterleaveFrames * channels;
+  std::vector<int16> s16_input(num_samples);
+  std::vector<float> float_input(num_samples);
+  for (int i = 0; i < num_samples; ++i) {
+    s16_input[i] = static_cast<int16>(i * 97);
+    float_input[i] = s16_input[i] / 32768.0f;
+  }
+  std::vector<std::vector<float> > planes(
+      channels, std::vector<float>(kDeinterleaveFrames));
+  std::vector<float*> plane_pointers(channels);
+  for (int c = 0; c < channels; ++c)
+    plane_pointers[c] = &planes[c][0];
+
+  for (int64 i = 0; i < iterations; ++i) {
+    if (s16) {
+      webmlive::DeinterleaveS16ToFloat(&s16_input[0], kDeinterleaveFrames,
+                                       channels, &plane_pointers[0]);
+    } else {
+      webmlive::DeinterleaveFloat(&float_input[0], kDeinterleaveFrames,
+                                  channels, &plane_pointers[0]);
+    }
+  }
+  g_sink += static_cast<int64>(planes[0][1] * 1000);
+  const int sample_size = s16 ? sizeof(int16) : sizeof(float);
+  return iterations * num_samples * sample_size;
+}
+
+//
+// Audio mix benchmark.
+//
+
+// Mixes |inputs| planes of |kDeinterleaveFrames| samples into one and clamps
+// it |iterations| times, the work of one channel of an |AudioMixer| buffer.
+// Returns the number of input bytes mixed.
+int64 Mix(int inputs, int64 iterations) {
+  std::vector<float> src(kDeinterleaveFrames);
+  for (int i = 0; i < kDeinterleaveFrames; ++i)
+    src[i] = static_cast<int16>(i * 97) / 32768.0f;
+  std::vector<float> mix(kDeinterleaveFrames);
+  for (int64 i = 0; i < iterations; ++i) {
+    memset(&mix[0], 0, mix.size() * sizeof(mix[0]));
+    for (int n = 0; n < inputs; ++n)
+      webmlive::MixPlane(&src[0], 0.5f, &mix[0], kDeinterleaveFrames);
+    webmlive::ClampPlane(&mix[0], kDeinterleaveFrames);
+  }
+  g_sink += static_cast<int64>(mix[1] * 1000);
+  return iterations * inputs * kDeinterleaveFrames *
+         static_cast<int64>(sizeof(float));
+}
+
+void usage(const char** argv) {
+  printf("Usage: %s [args]\n", argv[0]);
+  printf("  --filter <substring>       Runs benchmarks whose names contain\n");
+  printf("                             substring.\n");
+  printf("  --min_time_ms <ms>         Minimum run time of each benchmark.\n");
+  printf("                             Default is %d.\n", kDefaultMinTimeMs);
+  printf("  --output <file>            Writes JSON results to file instead\n");
+  printf("                             of stdout.\n");
+}
+
+}  // anonymous namespace
+
+int main(int argc, const char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  BenchmarkOptions options;
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (!strcmp("-h", argv[i]) || !strcmp("--help", argv[i])) {
+      usage(argv);
+      return EXIT_SUCCESS;
+    } else if (!strcmp("--filter", argv[i]) && has_value) {
+      options.filter = argv[++i];
+    } else if (!strcmp("--min_time_ms", argv[i]) && has_value) {
+      options.min_time_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--output", argv[i]) && has_value) {
+      options.output = argv[++i];
+    } else {
+      LOG(WARNING) << "argument unknown or unparseable: " << argv[i];
+    }
+  }
+
+  using std::placeholders::_1;
+  std::vector<BenchmarkResult> results;
+  RunBenchmark(options, "buffer_pool/locking/contended",
+               std::bind(BufferPoolContended, false, _1), &results);
+  RunBenchmark(options, "buffer_pool/lock_free/contended",
+               std::bind(BufferPoolContended, true, _1), &results);
+  RunBenchmark(options, "muxer/write_discard",
+               std::bind(MuxerWrite, false, false, _1), &results);
+  RunBenchmark(options, "muxer/write_detach",
+               std::bind(MuxerWrite, true, false, _1), &results);
+  RunBenchmark(options, "muxer/write_discard_encrypted",
+               std::bind(MuxerWrite, false, true, _1), &results);
+
+  struct ConversionCase {
+    webmlive::VideoFormat format;
+    const char* name;
+  };
+  const ConversionCase kFormats[] = {
+    {webmlive::kVideoFormatYUY2, "yuy2"},
+    {webmlive::kVideoFormatYUYV, "yuyv"},
+    {webmlive::kVideoFormatUYVY, "uyvy"},
+    {webmlive::kVideoFormatNV12, "nv12"},
+    {webmlive::kVideoFormatNV21, "nv21"},
+    {webmlive::kVideoFormatRGB, "rgb24"},
+    {webmlive::kVideoFormatRGBA, "rgba"},
+    // Unpacked to I42016.
+    {webmlive::kVideoFormatV210, "v210"},
+  };
+  const int32 kSizes[][2] = {{640, 480}, {1280, 720}, {1920, 1080}};
+  for (size_t f = 0; f < sizeof(kFormats) / sizeof(kFormats[0]); ++f) {
+    for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); ++s) {
+      std::ostringstream name;
+      name << "convert_to_i420/" << kFormats[f].name << "/" << kSizes[s][0]
+           << "x" << kSizes[s][1];
+      RunBenchmark(options, name.str(),
+                   std::bind(ConvertToI420, kFormats[f].format, kSizes[s][0],
+                             kSizes[s][1], _1),
+                   &results);
+    }
+  }
+
+  // A quarter width overlay of a 1080p frame, luma plane.
+  RunBenchmark(options, "blend_plane/480x270",
+               std::bind(Blend, 480, 270, 192, _1), &results);
+  RunBenchmark(options, "blend_plane_alpha/256x128",
+               std::bind(BlendWithAlpha, 256, 128, _1), &results);
+  RunBenchmark(options, "interpolate_field/1920x1080",
+               std::bind(InterpolateField, 1920, 1080, _1), &results);
+
+  const int kChannels[] = {1, 2, 6};
+  for (size_t c = 0; c < sizeof(kChannels) / sizeof(kChannels[0]); ++c) {
+    std::ostringstream s16_name;
+    s16_name << "deinterleave/s16/" << kChannels[c] << "ch";
+    RunBenchmark(options, s16_name.str(),
+                 std::bind(Deinterleave, true, kChannels[c], _1), &results);
+    std::ostringstream float_name;
+    float_name << "deinterleave/float/" << kChannels[c] << "ch";
+    RunBenchmark(options, float_name.str(),
+                 std::bind(Deinterleave, false, kChannels[c], _1), &results);
+  }
+
+  RunBenchmark(options, "mix_plane/2in", std::bind(Mix, 2, _1), &results);
+
+  const std::string json = ResultsToJson(results);
+  if (options.output.empty()) {
+    fputs(json.c_str(), stdout);
+  } else {
+    FILE* const file = fopen(options.output.c_str(), "w");
+    if (!file || fputs(json.c_str(), file) < 0) {
+      LOG(ERROR) << "cannot write " << options.output;
+      if (file)
+        fclose(file);
+      return EXIT_FAILURE;
+    }
+    fclose(file);
+  }
+  LOG(INFO) << "checksum " << g_sink.load();
+  google::ShutdownGoogleLogging();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,144 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/mux_reorder_queue.h"
+
+#include "encoder/buffer_pool-inl.h"
+#include "encoder/webm_mux.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+MuxReorderQueue::MuxReorderQueue()
+    : audio_enabled_(false),
+      video_enabled_(false),
+      max_queued_packets_(kDefaultMaxQueuedPackets),
+      last_timestamp_(0),
+      late_packets_dropped_(0) {
+}
+
+MuxReorderQueue::~MuxReorderQueue() {
+  audio_queue_.ReleaseBatch(&audio_batch_);
+  video_queue_.ReleaseBatch(&video_batch_);
+}
+
+int MuxReorderQueue::Init(bool audio_enabled, bool video_enabled,
+                          int max_queued_packets) {
+  if ((!audio_enabled && !video_enabled) || max_queued_packets < 1) {
+    LOG(ERROR) << "MuxReorderQueue invalid config.";
+    return kInvalidArg;
+  }
+  audio_enabled_ = audio_enabled;
+  video_enabled_ = video_enabled;
+  max_queued_packets_ = max_queued_packets;
+  if ((audio_enabled_ && audio_queue_.Init(true, max_queued_packets_)) ||
+      (video_enabled_ && video_queue_.Init(true, max_queued_packets_))) {
+    LOG(ERROR) << "MuxReorderQueue queue Init failed.";
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+int MuxReorderQueue::PushAudio(AudioBuffer* ptr_buffer) {
+  if (!audio_enabled_ || !ptr_buffer) {
+    return kInvalidArg;
+  }
+  if (audio_queue_.Commit(ptr_buffer)) {
+    LOG(ERROR) << "MuxReorderQueue audio Commit failed.";
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+int MuxReorderQueue::PushVideo(VideoFrame* ptr_frame) {
+  if (!video_enabled_ || !ptr_frame) {
+    return kInvalidArg;
+  }
+  if (video_queue_.Commit(ptr_frame)) {
+    LOG(ERROR) << "MuxReorderQueue video Commit failed.";
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+int MuxReorderQueue::Mux(bool flush, PacketMuxerInterface* ptr_muxer) {
+  if (!ptr_muxer) {
+    return kInvalidArg;
+  }
+
+  // Take everything queued at once, and plan the interleave on the batches
+  // rather than peeking at the queues under their locks for each packet.
+  audio_queue_.DecommitBatch(&audio_batch_);
+  video_queue_.DecommitBatch(&video_batch_);
+
+  int status = kSuccess;
+  for (;;) {
+    const bool have_audio = !audio_batch_.empty();
+    const bool have_video = !video_batch_.empty();
+    if (have_audio && have_video) {
+      status = (audio_batch_.front()->timestamp() <=
+                video_batch_.front()->timestamp()) ?
+          MuxAudio(ptr_muxer) : MuxVideo(ptr_muxer);
+    } else if (have_audio &&
+               (flush || !video_enabled_ ||
+                static_cast<int>(audio_batch_.size()) > max_queued_packets_)) {
+      status = MuxAudio(ptr_muxer);
+    } else if (have_video &&
+               (flush || !audio_enabled_ ||
+                static_cast<int>(video_batch_.size()) > max_queued_packets_)) {
+      status = MuxVideo(ptr_muxer);
+    } else {
+      break;
+    }
+    if (status) {
+      break;
+    }
+  }
+  audio_queue_.ReleaseBatch(&audio_done_);
+  video_queue_.ReleaseBatch(&video_done_);
+  return status;
+}
+
+int MuxReorderQueue::MuxAudio(PacketMuxerInterface* ptr_muxer) {
+  const AudioBuffer& audio_buffer = *audio_batch_.front();
+  audio_done_.push_back(audio_batch_.front());
+  audio_batch_.pop_front();
+  if (audio_buffer.timestamp() < last_timestamp_) {
+    ++late_packets_dropped_;
+    LOG(WARNING) << "MuxReorderQueue dropped late audio "
+                 << audio_buffer.timestamp() << " < " << last_timestamp_;
+    return kSuccess;
+  }
+  if (ptr_muxer->WriteAudioBuffer(audio_buffer)) {
+    LOG(ERROR) << "MuxReorderQueue audio mux failed.";
+    return kMuxerError;
+  }
+  last_timestamp_ = audio_buffer.timestamp();
+  VLOG(4) << "muxed (A) " << last_timestamp_ / 1000.0;
+  return kSuccess;
+}
+
+int MuxReorderQueue::MuxVideo(PacketMuxerInterface* ptr_muxer) {
+  const VideoFrame& video_frame = *video_batch_.front();
+  video_done_.push_back(video_batch_.front());
+  video_batch_.pop_front();
+  if (video_frame.timestamp() < last_timestamp_) {
+    ++late_packets_dropped_;
+    LOG(WARNING) << "MuxReorderQueue dropped late video "
+                 << video_frame.timestamp() << " < " << last_timestamp_;
+    return kSuccess;
+  }
+  if (ptr_muxer->WriteVideoFrame(video_frame)) {
+    LOG(ERROR) << "MuxReorderQueue video mux failed.";
+    return kMuxerError;
+  }
+  last_timestamp_ = video_frame.timestamp();
+  VLOG(3) << "muxed (V) " << last_timestamp_ / 1000.0;
+  return kSuccess;
+}
+
+}  // namespace webmlive
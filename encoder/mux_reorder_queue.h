@@ -0,0 +1,92 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_MUX_REORDER_QUEUE_H_
+#define WEBMLIVE_ENCODER_MUX_REORDER_QUEUE_H_
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/buffer_pool.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+class PacketMuxerInterface;
+
+// Interleaves compressed audio and video produced on separate threads into
+// one muxer in timestamp order. Packets wait in per stream FIFOs until the
+// other stream has a packet with an equal or later timestamp; audio is
+// written first on ties.
+//
+// A stream that stalls would hold up the other one forever, so a stream is
+// also written once more than |max_queued_packets| of its packets wait.
+// Packets of the stalled stream that arrive later than what was already
+// muxed are dropped: libwebm requires timestamps that do not go back past
+// the start of the current cluster.
+//
+// Note: the class is not thread safe; it is used by the encoder thread only.
+class MuxReorderQueue {
+ public:
+  enum {
+    kMuxerError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // About half a second of vorbis packets, and a second of 30 fps video.
+  static const int kDefaultMaxQueuedPackets = 32;
+
+  MuxReorderQueue();
+  ~MuxReorderQueue();
+
+  // Prepares the queue for the enabled streams. Returns |kSuccess| when
+  // successful.
+  int Init(bool audio_enabled, bool video_enabled, int max_queued_packets);
+
+  // Queue a compressed packet. The contents of |ptr_buffer| and |ptr_frame|
+  // are swapped into the queue. Return |kSuccess| when successful.
+  int PushAudio(AudioBuffer* ptr_buffer);
+  int PushVideo(VideoFrame* ptr_frame);
+
+  // Writes the packets that are ready to |ptr_muxer|. When |flush| is true
+  // every queued packet is written. Returns |kSuccess| when successful.
+  int Mux(bool flush, PacketMuxerInterface* ptr_muxer);
+
+  // Packets dropped because they arrived after later packets were muxed.
+  int64 late_packets_dropped() const { return late_packets_dropped_; }
+
+ private:
+  // Writes the next packet of one stream to |ptr_muxer|.
+  int MuxAudio(PacketMuxerInterface* ptr_muxer);
+  int MuxVideo(PacketMuxerInterface* ptr_muxer);
+
+  bool audio_enabled_;
+  bool video_enabled_;
+  int max_queued_packets_;
+
+  // Timestamp of the last packet written to the muxer.
+  int64 last_timestamp_;
+  int64 late_packets_dropped_;
+
+  BufferPool<AudioBuffer> audio_queue_;
+  BufferPool<VideoFrame> video_queue_;
+
+  // Packets taken from the queues in one batch by |Mux()| and not written
+  // yet, oldest first, and the packets written by the current |Mux()| call,
+  // which go back to the queues in one batch when it returns.
+  BufferPool<AudioBuffer>::Batch audio_batch_;
+  BufferPool<VideoFrame>::Batch video_batch_;
+  BufferPool<AudioBuffer>::Batch audio_done_;
+  BufferPool<VideoFrame>::Batch video_done_;
+
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(MuxReorderQueue);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_MUX_REORDER_QUEUE_H_
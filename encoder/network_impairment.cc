@@ -0,0 +1,383 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/network_impairment.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <new>
+#include <random>
+#include <sstream>
+
+#include "encoder/socket_util.h"
+#include "encoder/time_util.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Interval at which blocked threads check for |Stop()| and resets.
+const int kPollMs = 100;
+
+// Data received by a relay thread, and the time it is due at the other end.
+struct Segment {
+  int64 due_us;
+  std::string data;
+};
+}  // namespace
+
+std::string NetworkImpairmentStats::ToString() const {
+  std::ostringstream out;
+  out << "impairment connections=" << connections << " resets=" << resets
+      << " lost_segments=" << lost_segments << " client_bytes="
+      << client_bytes << " origin_bytes=" << origin_bytes;
+  return out.str();
+}
+
+struct NetworkImpairmentProxy::Connection {
+  Connection()
+      : client(kInvalidSocket), origin(kInvalidSocket), seed(0), running(2),
+        reset(false), done(false) {}
+  NativeSocket client;
+  NativeSocket origin;
+  uint32 seed;
+  std::unique_ptr<std::thread> client_thread;
+  std::unique_ptr<std::thread> origin_thread;
+
+  // Relay threads still running; the last one closes the sockets.
+  std::atomic<int> running;
+  std::atomic<bool> reset;
+  std::atomic<bool> done;
+};
+
+NetworkImpairmentProxy::NetworkImpairmentProxy()
+    : stop_(true),
+      listen_socket_(static_cast<SocketHandle>(kInvalidSocket)),
+      port_(0),
+      connection_count_(0),
+      resets_(0),
+      lost_segments_(0),
+      client_bytes_(0),
+      origin_bytes_(0) {
+}
+
+NetworkImpairmentProxy::~NetworkImpairmentProxy() {
+  Stop();
+}
+
+int NetworkImpairmentProxy::Init(const NetworkImpairmentSettings& settings) {
+  if (settings.port < 0 || settings.port > 65535 ||
+      settings.target_port <= 0 || settings.target_port > 65535 ||
+      settings.target_address.empty() || settings.latency_ms < 0 ||
+      settings.jitter_ms < 0 ||
+      settings.bandwidth_kbps < 0 || settings.loss_percent < 0 ||
+      settings.loss_percent >= 100 || settings.retransmit_timeout_ms < 0 ||
+      settings.reset_percent < 0 || settings.queue_bytes < kSegmentBytes) {
+    LOG(ERROR) << "invalid impairment settings, port=" << settings.port
+               << " target=" << settings.target_address << ":"
+               << settings.target_port;
+    return kInvalidArg;
+  }
+  settings_ = settings;
+  return kSuccess;
+}
+
+int NetworkImpairmentProxy::Run() {
+  if (listen_thread_) {
+    return kInvalidArg;
+  }
+  if (!StartupSockets()) {
+    LOG(ERROR) << "cannot initialize sockets.";
+    return kSocketError;
+  }
+  in_addr target;
+  if (inet_pton(AF_INET, settings_.target_address.c_str(), &target) != 1) {
+    LOG(ERROR) << "invalid impairment target " << settings_.target_address;
+    CleanupSockets();
+    return kInvalidArg;
+  }
+  const NativeSocket listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_socket == kInvalidSocket) {
+    LOG(ERROR) << "cannot create impairment proxy socket.";
+    return kSocketError;
+  }
+  listen_socket_ = static_cast<SocketHandle>(listen_socket);
+  const int reuse = 1;
+  setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR,
+             reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(static_cast<uint16>(settings_.port));
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  socklen_t address_length = sizeof(address);
+  if (bind(listen_socket, reinterpret_cast<const sockaddr*>(&address),
+           sizeof(address)) ||
+      listen(listen_socket, SOMAXCONN) ||
+      getsockname(listen_socket, reinterpret_cast<sockaddr*>(&address),
+                  &address_length)) {
+    LOG(ERROR) << "cannot listen on impairment proxy port " << settings_.port;
+    Stop();
+    return kSocketError;
+  }
+  port_ = ntohs(address.sin_port);
+
+  stop_ = false;
+  listen_thread_.reset(new (std::nothrow) std::thread(  // NOLINT
+      std::bind(&NetworkImpairmentProxy::ListenThread, this)));
+  if (!listen_thread_) {
+    LOG(ERROR) << "cannot start impairment proxy thread.";
+    Stop();
+    return kThreadError;
+  }
+  LOG(INFO) << "impairment proxy listening on port " << port_
+            << ", relaying to " << settings_.target_address << ":"
+            << settings_.target_port;
+  return kSuccess;
+}
+
+void NetworkImpairmentProxy::Stop() {
+  stop_ = true;
+  if (listen_thread_) {
+    listen_thread_->join();
+    listen_thread_.reset();
+  }
+  ReapConnections(true);
+  const NativeSocket listen_socket = static_cast<NativeSocket>(listen_socket_);
+  if (listen_socket != kInvalidSocket) {
+    CloseSocket(listen_socket);
+    listen_socket_ = static_cast<SocketHandle>(kInvalidSocket);
+    CleanupSockets();
+  }
+}
+
+NetworkImpairmentStats NetworkImpairmentProxy::stats() const {
+  NetworkImpairmentStats stats;
+  stats.connections = connection_count_;
+  stats.resets = resets_;
+  stats.lost_segments = lost_segments_;
+  stats.client_bytes = client_bytes_;
+  stats.origin_bytes = origin_bytes_;
+  return stats;
+}
+
+void NetworkImpairmentProxy::ListenThread() {
+  const NativeSocket listen_socket = static_cast<NativeSocket>(listen_socket_);
+  sockaddr_in target;
+  memset(&target, 0, sizeof(target));
+  target.sin_family = AF_INET;
+  target.sin_port = htons(static_cast<uint16>(settings_.target_port));
+  inet_pton(AF_INET, settings_.target_address.c_str(), &target.sin_addr);
+
+  while (!stop_) {
+    ReapConnections(false);
+    if (!WaitReadable(listen_socket, kPollMs)) {
+      continue;
+    }
+    const NativeSocket client = accept(listen_socket, NULL, NULL);
+    if (client == kInvalidSocket) {
+      continue;
+    }
+    const NativeSocket origin = socket(AF_INET, SOCK_STREAM, 0);
+    if (origin == kInvalidSocket ||
+        connect(origin, reinterpret_cast<const sockaddr*>(&target),
+                sizeof(target))) {
+      LOG(WARNING) << "impairment proxy cannot connect to the origin.";
+      if (origin != kInvalidSocket) {
+        CloseSocket(origin);
+      }
+      CloseSocket(client);
+      continue;
+    }
+    SetNoDelay(client);
+    SetNoDelay(origin);
+
+    std::unique_ptr<Connection> connection(
+        new (std::nothrow) Connection());  // NOLINT
+    if (!connection) {
+      CloseSocket(origin);
+      CloseSocket(client);
+      continue;
+    }
+    connection->client = client;
+    connection->origin = origin;
+    connection->seed = settings_.seed + static_cast<uint32>(
+        connection_count_.fetch_add(1));
+    Connection* const ptr_connection = connection.get();
+    connection->client_thread.reset(new (std::nothrow) std::thread(  // NOLINT
+        std::bind(&NetworkImpairmentProxy::RelayThread, this, ptr_connection,
+                  true)));
+    if (connection->client_thread) {
+      connection->origin_thread.reset(
+          new (std::nothrow) std::thread(  // NOLINT
+              std::bind(&NetworkImpairmentProxy::RelayThread, this,
+                        ptr_connection, false)));
+    }
+    if (!connection->origin_thread) {
+      LOG(ERROR) << "cannot start impairment relay thread.";
+      connection->reset = true;
+      if (connection->client_thread) {
+        connection->client_thread->join();
+      }
+      CloseSocket(origin);
+      CloseSocket(client);
+      continue;
+    }
+    connections_.push_back(std::move(connection));
+  }
+}
+
+void NetworkImpairmentProxy::RelayThread(Connection* ptr_connection,
+                                         bool from_client) {
+  Connection& connection = *ptr_connection;
+  const NativeSocket source =
+      from_client ? connection.client : connection.origin;
+  const NativeSocket destination =
+      from_client ? connection.origin : connection.client;
+  std::atomic<int64>& relayed_bytes =
+      from_client ? client_bytes_ : origin_bytes_;
+
+  std::mt19937 random(connection.seed * 2 + (from_client ? 1 : 0));
+  std::uniform_real_distribution<double> percent(0, 100);
+  std::uniform_int_distribution<int64> jitter_us(
+      0, settings_.jitter_ms * 1000LL);
+  const int64 latency_us = settings_.latency_ms * 1000LL;
+  const int64 retransmit_us = settings_.retransmit_timeout_ms * 1000LL;
+
+  // Time the rate limited link is free to send, the due time of the last
+  // segment queued, and the client bytes left before the next reset
+  // decision.
+  int64 link_free_us = 0;
+  int64 last_due_us = 0;
+  int64 reset_countdown = kResetBytes;
+
+  std::deque<Segment> queue;
+  size_t queued_bytes = 0;
+  bool source_open = true;
+  bool failed = false;
+  while (!stop_ && !connection.reset) {
+    int64 now_us = SteadyClockMicroseconds();
+    while (!queue.empty() && queue.front().due_us <= now_us) {
+      if (!SendAll(destination, queue.front().data)) {
+        failed = true;
+        break;
+      }
+      relayed_bytes += queue.front().data.size();
+      queued_bytes -= queue.front().data.size();
+      queue.pop_front();
+    }
+    if (failed || (!source_open && queue.empty())) {
+      break;
+    }
+
+    int wait_ms = kPollMs;
+    if (!queue.empty()) {
+      const int64 due_ms = (queue.front().due_us - now_us + 999) / 1000;
+      wait_ms = static_cast<int>(std::min<int64>(wait_ms, due_ms));
+    }
+    if (!source_open ||
+        queued_bytes >= static_cast<size_t>(settings_.queue_bytes)) {
+      // The link's buffer is full: let the sender's TCP back off.
+      std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
+      continue;
+    }
+    if (!WaitReadable(source, wait_ms)) {
+      continue;
+    }
+    char buffer[16 * 1024];
+    const int bytes_read = recv(source, buffer, sizeof(buffer), 0);
+    if (bytes_read <= 0) {
+      source_open = false;
+      continue;
+    }
+
+    now_us = SteadyClockMicroseconds();
+    for (int offset = 0; offset < bytes_read; offset += kSegmentBytes) {
+      const int length = std::min(kSegmentBytes, bytes_read - offset);
+      link_free_us = std::max(link_free_us, now_us);
+      if (settings_.bandwidth_kbps > 0) {
+        link_free_us += length * 8000LL / settings_.bandwidth_kbps;
+      }
+      int64 due_us = link_free_us + latency_us;
+      if (settings_.jitter_ms > 0) {
+        due_us += jitter_us(random);
+      }
+      if (settings_.loss_percent > 0 &&
+          percent(random) < settings_.loss_percent) {
+        due_us += retransmit_us;
+        ++lost_segments_;
+      }
+      // TCP delivers in order: nothing overtakes a delayed segment.
+      last_due_us = std::max(last_due_us, due_us);
+      Segment segment;
+      segment.due_us = last_due_us;
+      segment.data.assign(buffer + offset, length);
+      queue.push_back(segment);
+      queued_bytes += length;
+    }
+
+    if (from_client && settings_.reset_percent > 0) {
+      for (reset_countdown -= bytes_read; reset_countdown <= 0;
+           reset_countdown += kResetBytes) {
+        if (percent(random) < settings_.reset_percent) {
+          VLOG(1) << "impairment proxy resetting a connection.";
+          ++resets_;
+          connection.reset = true;
+          break;
+        }
+      }
+    }
+  }
+
+  if (connection.reset) {
+    // Closing with a zero linger time sends a RST instead of a FIN.
+    linger reset_linger;
+    reset_linger.l_onoff = 1;
+    reset_linger.l_linger = 0;
+    setsockopt(connection.client, SOL_SOCKET, SO_LINGER,
+               reinterpret_cast<const char*>(&reset_linger),
+               sizeof(reset_linger));
+    shutdown(connection.origin, kShutdownBoth);
+  } else if (!failed && !source_open) {
+    // Pass the end of the stream on, and keep relaying the other direction.
+    shutdown(destination, kShutdownSend);
+  } else {
+    shutdown(connection.client, kShutdownBoth);
+    shutdown(connection.origin, kShutdownBoth);
+  }
+  if (--connection.running == 0) {
+    CloseSocket(connection.client);
+    CloseSocket(connection.origin);
+    connection.done = true;
+  }
+}
+
+void NetworkImpairmentProxy::ReapConnections(bool all) {
+  std::vector<std::unique_ptr<Connection>>::iterator it =
+      connections_.begin();
+  while (it != connections_.end()) {
+    Connection* const ptr_connection = it->get();
+    if (all && !ptr_connection->done) {
+      // Wake the threads from blocked sends; they close the sockets.
+      shutdown(ptr_connection->client, kShutdownBoth);
+      shutdown(ptr_connection->origin, kShutdownBoth);
+    }
+    if (all || ptr_connection->done) {
+      ptr_connection->client_thread->join();
+      ptr_connection->origin_thread->join();
+      it = connections_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+}  // namespace webmlive
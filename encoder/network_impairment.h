@@ -0,0 +1,174 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_NETWORK_IMPAIRMENT_H_
+#define WEBMLIVE_ENCODER_NETWORK_IMPAIRMENT_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+struct NetworkImpairmentSettings {
+  static const int kDefaultRetransmitTimeoutMs = 200;
+  static const int kDefaultQueueBytes = 1024 * 1024;
+
+  NetworkImpairmentSettings()
+      : port(0),
+        target_address("127.0.0.1"),
+        target_port(0),
+        latency_ms(0),
+        jitter_ms(0),
+        bandwidth_kbps(0),
+        loss_percent(0),
+        retransmit_timeout_ms(kDefaultRetransmitTimeoutMs),
+        reset_percent(0),
+        queue_bytes(kDefaultQueueBytes),
+        seed(1) {}
+
+  // Port the proxy listens on, 0 to pick a free one, and the IPv4 address
+  // and port of the origin it connects each client to.
+  int port;
+  std::string target_address;
+  int target_port;
+
+  // Delay added to data in each direction, plus a random delay of up to
+  // |jitter_ms|. Data is never reordered by the jitter.
+  int latency_ms;
+  int jitter_ms;
+
+  // Rate limit of each direction of each connection, 0 for none.
+  int bandwidth_kbps;
+
+  // Chance of losing each segment, of up to |kSegmentBytes|, in either
+  // direction. As with TCP, a lost segment holds up its direction until it
+  // is retransmitted |retransmit_timeout_ms| later.
+  double loss_percent;
+  int retransmit_timeout_ms;
+
+  // Chance, for each |kResetBytes| sent by the client, that the connection is
+  // reset.
+  double reset_percent;
+
+  // Bytes held in each direction before the proxy stops reading: the buffer
+  // of the bottleneck link. Senders see the rate limit through it.
+  int queue_bytes;
+
+  // Seed of the loss, jitter and reset decisions.
+  uint32 seed;
+};
+
+struct NetworkImpairmentStats {
+  NetworkImpairmentStats()
+      : connections(0), resets(0), lost_segments(0), client_bytes(0),
+        origin_bytes(0) {}
+
+  // Formats the stats as one line.
+  std::string ToString() const;
+
+  int64 connections;
+  int64 resets;
+  int64 lost_segments;
+
+  // Bytes relayed from the client to the origin, and back.
+  int64 client_bytes;
+  int64 origin_bytes;
+};
+
+// TCP proxy that degrades the connections passing through it with latency,
+// jitter, rate limits, segment loss and connection resets. Placed between
+// |HttpUploader| and an origin, or |IngestServer|, it lets upload benchmarks
+// measure retries, pacing and transport changes under bad networks.
+//
+// Notes
+// - Loss is simulated above TCP: lost segments are delayed by the
+//   retransmit timeout instead of being dropped, which is what the
+//   application sees of a loss.
+// - Resets close the client connection with a TCP RST, and the origin
+//   connection with it.
+// - Each direction of each connection is relayed by a thread of its own.
+class NetworkImpairmentProxy {
+ public:
+  enum {
+    // Socket setup failed.
+    kSocketError = -4,
+    // Cannot start the listening thread.
+    kThreadError = -3,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Size of the segments loss applies to: a typical TCP payload.
+  static const int kSegmentBytes = 1448;
+
+  // Client bytes between reset decisions.
+  static const int kResetBytes = 64 * 1024;
+
+  NetworkImpairmentProxy();
+  ~NetworkImpairmentProxy();
+
+  // Copies |settings|. Returns |kSuccess| when successful.
+  int Init(const NetworkImpairmentSettings& settings);
+
+  // Binds the listening socket and starts relaying. Returns |kSuccess| when
+  // successful.
+  int Run();
+
+  // Closes the listening socket and all connections, and joins their
+  // threads.
+  void Stop();
+
+  // Port the proxy listens on. Valid after |Run()|.
+  int port() const { return port_; }
+
+  NetworkImpairmentStats stats() const;
+
+ private:
+  struct Connection;
+
+  // Socket handle: a SOCKET on Windows, and a file descriptor elsewhere.
+  typedef std::intptr_t SocketHandle;
+
+  // Accepts clients, connects them to the origin, and reaps the threads of
+  // closed connections.
+  void ListenThread();
+
+  // Relays what |ptr_connection| receives from the client when
+  // |from_client| is true, and from the origin otherwise.
+  void RelayThread(Connection* ptr_connection, bool from_client);
+
+  // Joins and frees the threads of closed connections. With |all| set,
+  // closes every connection first.
+  void ReapConnections(bool all);
+
+  NetworkImpairmentSettings settings_;
+  std::atomic<bool> stop_;
+  SocketHandle listen_socket_;
+  int port_;
+  std::unique_ptr<std::thread> listen_thread_;
+
+  // Open connections. Used by the listening thread, and by |Stop()| after
+  // the listening thread is joined.
+  std::vector<std::unique_ptr<Connection>> connections_;
+
+  std::atomic<int64> connection_count_;
+  std::atomic<int64> resets_;
+  std::atomic<int64> lost_segments_;
+  std::atomic<int64> client_bytes_;
+  std::atomic<int64> origin_bytes_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(NetworkImpairmentProxy);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_NETWORK_IMPAIRMENT_H_
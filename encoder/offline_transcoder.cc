@@ -0,0 +1,368 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/offline_transcoder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <thread>
+#include <utility>
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/encoder_base.h"
+#include "encoder/file_media_source.h"
+#include "encoder/file_util.h"
+#include "encoder/resource_planner.h"
+#include "encoder/thread_placement.h"
+#include "encoder/webm_archive_writer.h"
+#include "encoder/webm_encoder.h"
+#include "encoder/webm_mux.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Cluster duration of the muxer the output tracks are copied from. Only its
+// tracks are used; the archive sizes its own clusters.
+const int32 kTrackMuxerClusterMs = 1000;
+
+// Ranges waiting to be written, per encode thread.
+const size_t kPendingRangesPerThread = 2;
+}  // namespace
+
+OfflineTranscoder::OfflineTranscoder()
+    : input_is_y4m_(false),
+      frame_size_(0),
+      num_threads_(0),
+      encode_cores_(0),
+      next_range_(0),
+      muxed_ranges_(0),
+      max_pending_ranges_(0),
+      failed_(false) {
+}
+
+OfflineTranscoder::~OfflineTranscoder() {
+}
+
+int OfflineTranscoder::Init(const OfflineTranscoderConfig& config) {
+  if (config.input_file.empty() || config.output_file.empty() ||
+      config.gop_frames <= 0 || config.num_threads < 0) {
+    LOG(ERROR) << "OfflineTranscoder invalid config.";
+    return kInvalidArg;
+  }
+  config_ = config;
+
+  FILE* const file = fopen(config_.input_file.c_str(), "rb");
+  if (!file) {
+    LOG(ERROR) << "OfflineTranscoder cannot open " << config_.input_file;
+    return kFileError;
+  }
+  if (!FileMediaSource::ReadVideoFileHeader(file, config_.input_file,
+                                            config_.requested_video_config,
+                                            &video_config_, &input_is_y4m_,
+                                            &frame_size_)) {
+    fclose(file);
+    return kFileError;
+  }
+
+  // Index the frames so that each range can seek to its first frame. Y4M
+  // frame headers may carry parameters, so their lengths vary.
+  int64 position = TellFile(file);
+  int64 file_size = 0;
+  if (position < 0 || SeekFile(file, 0, SEEK_END) ||
+      (file_size = TellFile(file)) < 0 ||
+      SeekFile(file, position, SEEK_SET)) {
+    LOG(ERROR) << "OfflineTranscoder cannot size " << config_.input_file;
+    fclose(file);
+    return kFileError;
+  }
+  frame_offsets_.clear();
+  for (;;) {
+    if (input_is_y4m_) {
+      bool invalid = false;
+      if (!FileMediaSource::ReadY4mFrameHeader(file, &invalid)) {
+        if (invalid) {
+          fclose(file);
+          return kFileError;
+        }
+        break;
+      }
+      position = TellFile(file);
+    }
+    if (position + frame_size_ > file_size) {
+      if (position < file_size) {
+        LOG(WARNING) << "OfflineTranscoder truncated last frame ignored.";
+      }
+      break;
+    }
+    frame_offsets_.push_back(position);
+    position += frame_size_;
+    if (input_is_y4m_ && SeekFile(file, position, SEEK_SET)) {
+      fclose(file);
+      return kFileError;
+    }
+  }
+  fclose(file);
+  if (frame_offsets_.empty()) {
+    LOG(ERROR) << "OfflineTranscoder found no frames in "
+               << config_.input_file;
+    return kFileError;
+  }
+
+  const int64 num_frames = static_cast<int64>(frame_offsets_.size());
+  ranges_.clear();
+  for (int64 first = 0; first < num_frames; first += config_.gop_frames) {
+    Range range;
+    range.first_frame = first;
+    range.num_frames = static_cast<int32>(
+        std::min<int64>(config_.gop_frames, num_frames - first));
+    ranges_.push_back(std::move(range));
+  }
+
+  const int num_cores = AvailableCpuThreads();
+  num_threads_ = config_.num_threads > 0 ? config_.num_threads : num_cores;
+  num_threads_ = std::min(num_threads_, static_cast<int>(ranges_.size()));
+  encode_cores_ = std::max(1, num_cores / num_threads_);
+  max_pending_ranges_ = kPendingRangesPerThread * num_threads_;
+  next_range_ = 0;
+  muxed_ranges_ = 0;
+  failed_ = false;
+  stats_ = OfflineTranscodeStats();
+  stats_.frames_in = num_frames;
+  LOG(INFO) << "OfflineTranscoder " << num_frames << " frames in "
+            << ranges_.size() << " ranges on " << num_threads_
+            << " threads.";
+  return kSuccess;
+}
+
+int OfflineTranscoder::Run() {
+  if (ranges_.empty()) {
+    LOG(ERROR) << "OfflineTranscoder not Init'd.";
+    return kInvalidArg;
+  }
+  std::vector<std::unique_ptr<std::thread>> threads;
+  for (int i = 0; i < num_threads_; ++i) {
+    std::unique_ptr<std::thread> thread(
+        new (std::nothrow) std::thread(  // NOLINT
+            std::bind(&OfflineTranscoder::EncodeThread, this)));
+    if (!thread) {
+      LOG(ERROR) << "OfflineTranscoder cannot construct thread.";
+      break;
+    }
+    threads.push_back(std::move(thread));
+  }
+
+  int status = threads.empty() ? kNoMemory : MuxRanges();
+  if (status) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_ = true;
+  }
+  range_muxed_.notify_all();
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i]->join();
+  }
+  return status;
+}
+
+void OfflineTranscoder::EncodeThread() {
+  ThreadPlacement::Instance().PlaceCurrentThread(
+      ThreadPlacement::kVideoEncode);
+  ScopedCpuStage cpu_stage(kCpuVideoEncode);
+  FILE* const file = fopen(config_.input_file.c_str(), "rb");
+  if (!file) {
+    LOG(ERROR) << "OfflineTranscoder cannot open " << config_.input_file;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      failed_ = true;
+    }
+    range_done_.notify_all();
+    return;
+  }
+  for (;;) {
+    Range* ptr_range = NULL;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      range_muxed_.wait(lock, [this] {
+        return failed_ || next_range_ >= ranges_.size() ||
+               next_range_ < muxed_ranges_ + max_pending_ranges_;
+      });
+      if (failed_ || next_range_ >= ranges_.size()) {
+        break;
+      }
+      ptr_range = &ranges_[next_range_++];
+    }
+    const int status = EncodeRange(file, ptr_range);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ptr_range->status = status;
+      ptr_range->done = true;
+      if (status) {
+        failed_ = true;
+      }
+    }
+    range_done_.notify_all();
+    if (status) {
+      break;
+    }
+  }
+  fclose(file);
+}
+
+int OfflineTranscoder::EncodeRange(FILE* file, Range* ptr_range) {
+  // Each range gets a fresh encoder, which starts with a keyframe and
+  // places no other periodic keyframe within the range.
+  WebmEncoderConfig encoder_config = WebmEncoder::DefaultConfig();
+  encoder_config.actual_video_config = video_config_;
+  encoder_config.encode_cores = encode_cores_;
+  encoder_config.vpx_config = config_.vpx_config;
+  encoder_config.vpx_config.thread_count = VpxConfig::kUseDefault;
+  encoder_config.vpx_config.keyframe_interval = static_cast<int>(
+      config_.gop_frames * 1000 / video_config_.frame_rate) + 1;
+  VideoEncoder encoder;
+  int status = encoder.Init(encoder_config);
+  if (status) {
+    LOG(ERROR) << "OfflineTranscoder encoder Init failed: " << status;
+    return kEncoderError;
+  }
+
+  VideoFrame raw_frame;
+  if (raw_frame.Allocate(frame_size_)) {
+    return kNoMemory;
+  }
+  const double frame_rate = video_config_.frame_rate;
+  for (int32 i = 0; i < ptr_range->num_frames; ++i) {
+    const int64 frame_num = ptr_range->first_frame + i;
+    if (SeekFile(file, frame_offsets_[frame_num], SEEK_SET) ||
+        fread(raw_frame.buffer(), 1, frame_size_, file) !=
+            static_cast<size_t>(frame_size_)) {
+      LOG(ERROR) << "OfflineTranscoder cannot read frame " << frame_num;
+      return kFileError;
+    }
+    if (raw_frame.InitInPlace(video_config_,
+                              true,  // always "keyframes"
+                              0,
+                              0,
+                              frame_size_)) {
+      return kEncoderError;
+    }
+    // Times are computed in microseconds so that frame rates that do not
+    // divide 1000 keep evenly spaced timestamps.
+    const int64 timestamp_us =
+        static_cast<int64>(frame_num * kMicrosecondTimebase / frame_rate);
+    const int64 next_timestamp_us = static_cast<int64>(
+        (frame_num + 1) * kMicrosecondTimebase / frame_rate);
+    raw_frame.SetTimeUs(timestamp_us, next_timestamp_us - timestamp_us);
+
+    std::unique_ptr<VideoFrame> vpx_frame(
+        new (std::nothrow) VideoFrame());  // NOLINT
+    if (!vpx_frame) {
+      return kNoMemory;
+    }
+    status = encoder.EncodeFrame(raw_frame, vpx_frame.get());
+    if (status == VideoEncoder::kSuccess) {
+      ptr_range->frames.push_back(std::move(vpx_frame));
+    } else if (status != VideoEncoder::kDropped) {
+      LOG(ERROR) << "OfflineTranscoder EncodeFrame failed: " << status;
+      return kEncoderError;
+    }
+    status = ReadEncodedFrames(&encoder, ptr_range);
+    if (status) {
+      return status;
+    }
+  }
+  if (encoder.Flush()) {
+    LOG(ERROR) << "OfflineTranscoder encoder Flush failed.";
+    return kEncoderError;
+  }
+  status = ReadEncodedFrames(&encoder, ptr_range);
+  if (status) {
+    return status;
+  }
+  if (ptr_range->frames.empty() || !ptr_range->frames[0]->keyframe()) {
+    LOG(ERROR) << "OfflineTranscoder range at frame "
+               << ptr_range->first_frame << " does not start with a keyframe.";
+    return kEncoderError;
+  }
+  return kSuccess;
+}
+
+int OfflineTranscoder::ReadEncodedFrames(VideoEncoder* ptr_encoder,
+                                         Range* ptr_range) {
+  for (;;) {
+    std::unique_ptr<VideoFrame> vpx_frame(
+        new (std::nothrow) VideoFrame());  // NOLINT
+    if (!vpx_frame) {
+      return kNoMemory;
+    }
+    const int status = ptr_encoder->ReadQueuedFrame(vpx_frame.get());
+    if (status == VideoEncoder::kNoFrame) {
+      return kSuccess;
+    } else if (status) {
+      LOG(ERROR) << "OfflineTranscoder ReadQueuedFrame failed: " << status;
+      return kEncoderError;
+    }
+    ptr_range->frames.push_back(std::move(vpx_frame));
+  }
+}
+
+int OfflineTranscoder::MuxRanges() {
+  LiveWebmMuxer track_muxer;
+  VideoConfig track_config = video_config_;
+  track_config.format = config_.vpx_config.codec;
+  if (track_muxer.Init(kTrackMuxerClusterMs, "offline", "") ||
+      track_muxer.AddTrack(track_config)) {
+    LOG(ERROR) << "OfflineTranscoder cannot set up the video track.";
+    return kEncoderError;
+  }
+  WebmArchiveWriter writer;
+  if (writer.Init(config_.output_file, false) ||
+      writer.AddTracks(track_muxer)) {
+    LOG(ERROR) << "OfflineTranscoder cannot create " << config_.output_file;
+    return kFileError;
+  }
+
+  for (size_t i = 0; i < ranges_.size(); ++i) {
+    std::vector<std::unique_ptr<VideoFrame>> frames;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      range_done_.wait(lock, [this, i] {
+        return failed_ || ranges_[i].done;
+      });
+      if (!ranges_[i].done) {
+        return kEncoderError;
+      }
+      if (ranges_[i].status) {
+        return ranges_[i].status;
+      }
+      frames.swap(ranges_[i].frames);
+    }
+    for (size_t j = 0; j < frames.size(); ++j) {
+      if (writer.WriteVideoFrame(*frames[j])) {
+        LOG(ERROR) << "OfflineTranscoder cannot write to "
+                   << config_.output_file;
+        return kFileError;
+      }
+      stats_.bytes += frames[j]->buffer_length();
+    }
+    stats_.frames_out += frames.size();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++muxed_ranges_;
+      ++stats_.ranges;
+    }
+    range_muxed_.notify_all();
+  }
+  if (writer.Finalize()) {
+    LOG(ERROR) << "OfflineTranscoder cannot finalize "
+               << config_.output_file;
+    return kFileError;
+  }
+  return kSuccess;
+}
+
+}  // namespace webmlive
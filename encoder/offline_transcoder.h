@@ -0,0 +1,160 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_OFFLINE_TRANSCODER_H_
+#define WEBMLIVE_ENCODER_OFFLINE_TRANSCODER_H_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+struct OfflineTranscoderConfig {
+  static const int32 kDefaultGopFrames = 150;
+
+  OfflineTranscoderConfig() : gop_frames(kDefaultGopFrames), num_threads(0) {
+    vpx_config.profile = kVideoEncodeProfileBroadcast;
+    vpx_config.speed = 2;
+  }
+
+  // Y4M file, or raw I420 file sized by |requested_video_config|, as read by
+  // |FileMediaSource|.
+  std::string input_file;
+  VideoConfig requested_video_config;
+
+  // Seekable WebM file written, replacing any existing file.
+  std::string output_file;
+
+  // Encoder settings. |VpxConfig::keyframe_interval| and
+  // |VpxConfig::thread_count| are ignored: every range starts with a
+  // keyframe, and the cores are shared between ranges.
+  VpxConfig vpx_config;
+
+  // Frames per independently encoded range, and so the keyframe interval.
+  int32 gop_frames;
+
+  // Ranges encoded at once. 0 uses one per core.
+  int num_threads;
+};
+
+// Counts reported by |OfflineTranscoder::Run()|.
+struct OfflineTranscodeStats {
+  OfflineTranscodeStats() : ranges(0), frames_in(0), frames_out(0), bytes(0) {}
+  int64 ranges;
+  int64 frames_in;
+  int64 frames_out;
+  int64 bytes;
+};
+
+// Encodes a raw video file to a seekable WebM file faster than real time by
+// splitting the input into ranges of |gop_frames| frames and encoding the
+// ranges in parallel, each with a |VideoEncoder| of its own. Every encoder
+// starts with a keyframe, so the ranges are independent GOPs, and their
+// frames are muxed in order through a |WebmArchiveWriter|. Throughput then
+// scales with the number of cores instead of with the threading of one
+// encoder.
+//
+// Notes
+// - Frames are encoded with |VpxConfig::profile| as configured, which
+//   defaults to |kVideoEncodeProfileBroadcast|: lookahead, VBR or
+//   constrained quality, and the good quality deadline. Each encoder is
+//   flushed at the end of its range.
+// - Rate control restarts with every range; ranges much shorter than the
+//   lookahead lose quality.
+// - At most two ranges per thread are held in memory, compressed, waiting
+//   for the ranges before them to be muxed.
+// - Video only.
+class OfflineTranscoder {
+ public:
+  enum {
+    // The input or output file could not be read or written.
+    kFileError = -4,
+    kEncoderError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  OfflineTranscoder();
+  ~OfflineTranscoder();
+
+  // Opens the input, indexes its frames, and splits them into ranges.
+  // Returns |kSuccess| when successful.
+  int Init(const OfflineTranscoderConfig& config);
+
+  // Encodes every range and writes the output file. Blocks until the file is
+  // complete. Returns |kSuccess| when successful.
+  int Run();
+
+  const VideoConfig& video_config() const { return video_config_; }
+  const OfflineTranscodeStats& stats() const { return stats_; }
+
+ private:
+  // Frames |first_frame| to |first_frame| + |num_frames| - 1 of the input,
+  // and their compressed frames once |done|.
+  struct Range {
+    Range() : first_frame(0), num_frames(0), done(false), status(kSuccess) {}
+    int64 first_frame;
+    int32 num_frames;
+    std::vector<std::unique_ptr<VideoFrame>> frames;
+    bool done;
+    int status;
+  };
+
+  // Encodes ranges until none are left, or until an error.
+  void EncodeThread();
+
+  // Reads and encodes the frames of |ptr_range| from |file|. Returns
+  // |kSuccess| when successful.
+  int EncodeRange(FILE* file, Range* ptr_range);
+
+  // Moves the compressed frames |encoder| has ready into |ptr_range|.
+  int ReadEncodedFrames(VideoEncoder* ptr_encoder, Range* ptr_range);
+
+  // Waits for each range in turn and writes its frames to the output.
+  // Returns |kSuccess| when every range was written.
+  int MuxRanges();
+
+  OfflineTranscoderConfig config_;
+  VideoConfig video_config_;
+  bool input_is_y4m_;
+  int32 frame_size_;
+
+  // File offset of the data of every input frame.
+  std::vector<int64> frame_offsets_;
+
+  // Threads encoding ranges, and the cores left to each encoder.
+  int num_threads_;
+  int encode_cores_;
+
+  // Range state. |next_range_| is the next range to encode, and
+  // |muxed_ranges_| the number written; ranges are only started while fewer
+  // than |max_pending_ranges_| are waiting to be written. All protected by
+  // |mutex_|; |range_done_| is signaled when a range is encoded, and
+  // |range_muxed_| when one is written or on failure.
+  std::mutex mutex_;
+  std::condition_variable range_done_;
+  std::condition_variable range_muxed_;
+  std::vector<Range> ranges_;
+  size_t next_range_;
+  size_t muxed_ranges_;
+  size_t max_pending_ranges_;
+  bool failed_;
+
+  OfflineTranscodeStats stats_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(OfflineTranscoder);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_OFFLINE_TRANSCODER_H_
@@ -0,0 +1,400 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/opus_encoder.h"
+
+#include <cstring>
+
+#ifdef WEBMLIVE_HAVE_OPUS
+#include "opus.h"
+#endif
+#include "encoder/pcm_silence.h"
+#include "glog/logging.h"
+
+namespace {
+
+// Size recommended by the libopus documentation for a single packet.
+const int kMaxPacketBytes = 4000;
+
+// OpusHead is 8 bytes of magic, followed by version, channel count, pre-skip,
+// input sample rate, output gain, and channel mapping family.
+const char kOpusHeadMagic[] = "OpusHead";
+const int kOpusHeadMagicLength = 8;
+const int kOpusHeadLength = 19;
+
+// Frames of this size or smaller need not be transmitted, according to the
+// libopus documentation: they are what DTX sends for silence.
+const int32 kMaxDtxFrameBytes = 2;
+
+}  // namespace
+
+namespace webmlive {
+
+bool ValidOpusSampleRate(uint32 sample_rate) {
+  return sample_rate == 8000 || sample_rate == 12000 ||
+         sample_rate == 16000 || sample_rate == 24000 ||
+         sample_rate == 48000;
+}
+
+OpusAudioEncoder::OpusAudioEncoder()
+    : ptr_encoder_(NULL),
+      ptr_repacketizer_(NULL),
+      frame_size_(0),
+      frame_bytes_(0),
+      pending_offset_(0),
+      codec_delay_ns_(0),
+      first_input_timestamp_(-1),
+      samples_encoded_(0),
+      last_timestamp_(0),
+      dtx_active_(false) {
+}
+
+OpusAudioEncoder::~OpusAudioEncoder() {
+  DestroyEncoder();
+}
+
+// Bitrate values are multiplied by 1000. |WebmEncoderConfig| and its children
+// express bitrates in kilobits. Libopus bitrates are in bits.
+int OpusAudioEncoder::Init(const AudioConfig& audio_config,
+                           const OpusConfig& opus_config) {
+  if (audio_config.channels <= 0 || audio_config.channels > 2) {
+    LOG(ERROR) << "invalid/unsupported number of audio channels.";
+    return kUnsupportedFormat;
+  }
+  if (!ValidOpusSampleRate(audio_config.sample_rate)) {
+    LOG(ERROR) << "unsupported Opus input sample rate: "
+               << audio_config.sample_rate;
+    return kUnsupportedFormat;
+  }
+  const uint16& format_tag = audio_config.format_tag;
+  if (format_tag != kAudioFormatPcm && format_tag != kAudioFormatIeeeFloat) {
+    LOG(ERROR) << "input must be uncompressed.";
+    return kUnsupportedFormat;
+  }
+  if (format_tag == kAudioFormatPcm && audio_config.bits_per_sample != 16) {
+    LOG(ERROR) << "PCM input must be 16 bits per sample.";
+    return kUnsupportedFormat;
+  }
+  const int kBitsPerIeeeFloat = sizeof(float) * 8;  // NOLINT(runtime/sizeof)
+  if (format_tag == kAudioFormatIeeeFloat &&
+      audio_config.bits_per_sample != kBitsPerIeeeFloat) {
+    LOG(ERROR) << "IEEE floating point input must be 32 bits per sample.";
+    return kUnsupportedFormat;
+  }
+  if (opus_config.frame_duration != 10 && opus_config.frame_duration != 20) {
+    LOG(ERROR) << "Opus frame duration must be 10 or 20 milliseconds.";
+    return kUnsupportedFormat;
+  }
+  if (opus_config.frames_per_packet < 1 ||
+      opus_config.frames_per_packet * opus_config.frame_duration >
+          kMaxPacketDurationMs) {
+    LOG(ERROR) << "Opus packets must hold 1 to "
+               << kMaxPacketDurationMs / opus_config.frame_duration
+               << " frames.";
+    return kUnsupportedFormat;
+  }
+  if (opus_config.bitrate <= 0) {
+    LOG(ERROR) << "invalid Opus bitrate.";
+    return kInvalidArg;
+  }
+  input_config_ = audio_config;
+  opus_config_ = opus_config;
+  frame_size_ = audio_config.sample_rate * opus_config.frame_duration / 1000;
+  frame_bytes_ = frame_size_ * audio_config.channels *
+      (audio_config.bits_per_sample / 8);
+
+  int lookahead = 0;
+  const int status = CreateEncoder(&lookahead);
+  if (status) {
+    return status;
+  }
+
+  // OpusHead and CodecDelay are expressed at 48 kHz regardless of the input
+  // rate.
+  const int pre_skip = static_cast<int>(
+      static_cast<int64>(lookahead) * kOpusSampleRate /
+      audio_config.sample_rate);
+  WriteCodecPrivate(pre_skip);
+  codec_delay_ns_ = static_cast<int64>(pre_skip) * 1000000000 /
+      kOpusSampleRate;
+
+  const int frames_per_packet = opus_config.frames_per_packet;
+  pending_.reserve(frame_bytes_ * frames_per_packet * 4);
+  packet_.resize(kMaxPacketBytes * frames_per_packet);
+  if (frames_per_packet > 1) {
+    frame_storage_.resize(kMaxPacketBytes * frames_per_packet);
+    frame_lengths_.resize(frames_per_packet);
+  }
+  audio_config_ = audio_config;
+  audio_config_.format_tag = kAudioFormatOpus;
+  LOG(INFO) << "OpusAudioEncoder frame_size=" << frame_size_
+            << " pre_skip=" << pre_skip
+            << " codec_delay_ns=" << codec_delay_ns_;
+  return kSuccess;
+}
+
+int OpusAudioEncoder::Encode(const AudioBuffer& input_buffer) {
+  if (!input_buffer.buffer()) {
+    LOG(ERROR) << "cannot Encode empty input buffer!";
+    return kInvalidArg;
+  }
+  if (!ptr_encoder_) {
+    LOG(ERROR) << "cannot Encode before Init.";
+    return kEncoderError;
+  }
+  if (input_buffer.planar()) {
+    LOG(ERROR) << "OpusAudioEncoder requires interleaved input.";
+    return kUnsupportedFormat;
+  }
+  if (first_input_timestamp_ == -1) {
+    first_input_timestamp_ = input_buffer.timestamp();
+    LOG(INFO) << "OpusAudioEncoder first_input_timestamp_="
+              << first_input_timestamp_;
+  }
+
+  // Drop consumed input before appending so that |pending_| stays near its
+  // reserved size instead of growing.
+  if (pending_offset_ > 0) {
+    pending_.erase(pending_.begin(), pending_.begin() + pending_offset_);
+    pending_offset_ = 0;
+  }
+  const uint8* const ptr_data = input_buffer.buffer();
+  pending_.insert(pending_.end(), ptr_data,
+                  ptr_data + input_buffer.buffer_length());
+  return kSuccess;
+}
+
+int OpusAudioEncoder::ReadCompressedAudio(AudioBuffer* ptr_buffer) {
+  if (!ptr_buffer) {
+    LOG(ERROR) << "ReadCompressedAudio requires a non-NULL ptr_buffer.";
+    return kInvalidArg;
+  }
+  const int frames_per_packet = opus_config_.frames_per_packet;
+  const size_t packet_input_bytes =
+      static_cast<size_t>(frame_bytes_) * frames_per_packet;
+  if (pending_.size() - pending_offset_ < packet_input_bytes) {
+    return kNoSamples;
+  }
+
+  // With DTX, a digitally silent packet repeats the one libopus sent for
+  // silence, once it has sent one since the input fell silent.
+  const bool silent = opus_config_.dtx &&
+      IsSilentInput(&pending_[pending_offset_], packet_input_bytes);
+  if (!silent) {
+    dtx_active_ = false;
+  }
+  int32 packet_length = 0;
+  int status = kSuccess;
+  if (silent && dtx_active_) {
+    packet_length = static_cast<int32>(silent_packet_.size());
+    memcpy(&packet_[0], &silent_packet_[0], silent_packet_.size());
+  } else if (frames_per_packet == 1) {
+    status = EncodeFrame(&pending_[pending_offset_], &packet_[0],
+                         &packet_length);
+  } else {
+    for (int i = 0; i < frames_per_packet && status == kSuccess; ++i) {
+      status = EncodeFrame(&pending_[pending_offset_ + i * frame_bytes_],
+                           &frame_storage_[i * kMaxPacketBytes],
+                           &frame_lengths_[i]);
+    }
+    if (status == kSuccess) {
+      status = Repacketize(&packet_length);
+    }
+  }
+  if (status) {
+    return status;
+  }
+  if (silent && !dtx_active_ && DtxPacket(packet_length)) {
+    silent_packet_.assign(packet_.begin(), packet_.begin() + packet_length);
+    dtx_active_ = true;
+    VLOG(1) << "OpusAudioEncoder skipping silence.";
+  }
+  pending_offset_ += packet_input_bytes;
+
+  const int64 timestamp = first_input_timestamp_ +
+      samples_encoded_ * 1000 / input_config_.sample_rate;
+  status = ptr_buffer->Init(audio_config_,
+                            timestamp,
+                            opus_config_.frame_duration * frames_per_packet,
+                            &packet_[0],
+                            packet_length);
+  if (status) {
+    LOG(ERROR) << "AudioBuffer Init failed: " << status;
+    return kEncoderError;
+  }
+  VLOG(4) << "OpusAudioEncoder packet timestamp=" << timestamp
+          << " length=" << packet_length;
+  last_timestamp_ = timestamp;
+  samples_encoded_ += frame_size_ * frames_per_packet;
+  return kSuccess;
+}
+
+bool OpusAudioEncoder::IsSilentInput(const uint8* ptr_samples,
+                                     size_t length) const {
+  if (input_config_.format_tag == kAudioFormatPcm) {
+    return IsSilentS16(reinterpret_cast<const int16*>(ptr_samples),
+                       static_cast<int>(length / sizeof(int16)));
+  }
+  return IsSilentFloat(reinterpret_cast<const float*>(ptr_samples),
+                       static_cast<int>(length / sizeof(float)));
+}
+
+bool OpusAudioEncoder::DtxPacket(int32 packet_length) const {
+  if (opus_config_.frames_per_packet == 1) {
+    return packet_length <= kMaxDtxFrameBytes;
+  }
+  for (size_t i = 0; i < frame_lengths_.size(); ++i) {
+    if (frame_lengths_[i] > kMaxDtxFrameBytes)
+      return false;
+  }
+  return true;
+}
+
+void OpusAudioEncoder::WriteCodecPrivate(int pre_skip) {
+  codec_private_.assign(kOpusHeadLength, 0);
+  uint8* const p = &codec_private_[0];
+  memcpy(p, kOpusHeadMagic, kOpusHeadMagicLength);
+  p[8] = 1;  // Version.
+  p[9] = static_cast<uint8>(input_config_.channels);
+  p[10] = static_cast<uint8>(pre_skip & 0xff);
+  p[11] = static_cast<uint8>((pre_skip >> 8) & 0xff);
+  const uint32 rate = input_config_.sample_rate;
+  p[12] = static_cast<uint8>(rate & 0xff);
+  p[13] = static_cast<uint8>((rate >> 8) & 0xff);
+  p[14] = static_cast<uint8>((rate >> 16) & 0xff);
+  p[15] = static_cast<uint8>((rate >> 24) & 0xff);
+  // Bytes 16 and 17 are the output gain, and byte 18 is channel mapping
+  // family 0 (mono or stereo): all zero.
+}
+
+#ifdef WEBMLIVE_HAVE_OPUS
+int OpusAudioEncoder::CreateEncoder(int* ptr_lookahead) {
+  const int application = opus_config_.low_delay ?
+      OPUS_APPLICATION_RESTRICTED_LOWDELAY : OPUS_APPLICATION_AUDIO;
+  int status = OPUS_OK;
+  ptr_encoder_ = opus_encoder_create(input_config_.sample_rate,
+                                     input_config_.channels,
+                                     application,
+                                     &status);
+  if (!ptr_encoder_ || status != OPUS_OK) {
+    LOG(ERROR) << "opus_encoder_create failed: " << opus_strerror(status);
+    ptr_encoder_ = NULL;
+    return kCodecError;
+  }
+  status = opus_encoder_ctl(ptr_encoder_,
+                            OPUS_SET_BITRATE(opus_config_.bitrate * 1000));
+  if (status != OPUS_OK) {
+    LOG(ERROR) << "OPUS_SET_BITRATE failed: " << opus_strerror(status);
+    return kCodecError;
+  }
+  if (opus_config_.complexity != OpusConfig::kUseDefault) {
+    status = opus_encoder_ctl(ptr_encoder_,
+                              OPUS_SET_COMPLEXITY(opus_config_.complexity));
+    if (status != OPUS_OK) {
+      LOG(ERROR) << "OPUS_SET_COMPLEXITY failed: " << opus_strerror(status);
+      return kCodecError;
+    }
+  }
+  if (opus_config_.dtx) {
+    status = opus_encoder_ctl(ptr_encoder_, OPUS_SET_DTX(1));
+    if (status != OPUS_OK) {
+      LOG(ERROR) << "OPUS_SET_DTX failed: " << opus_strerror(status);
+      return kCodecError;
+    }
+  }
+  opus_int32 lookahead = 0;
+  status = opus_encoder_ctl(ptr_encoder_, OPUS_GET_LOOKAHEAD(&lookahead));
+  if (status != OPUS_OK) {
+    LOG(ERROR) << "OPUS_GET_LOOKAHEAD failed: " << opus_strerror(status);
+    return kCodecError;
+  }
+  *ptr_lookahead = lookahead;
+  if (opus_config_.frames_per_packet > 1) {
+    ptr_repacketizer_ = opus_repacketizer_create();
+    if (!ptr_repacketizer_) {
+      LOG(ERROR) << "opus_repacketizer_create failed.";
+      return kNoMemory;
+    }
+  }
+  return kSuccess;
+}
+
+int OpusAudioEncoder::EncodeFrame(const uint8* ptr_samples,
+                                  uint8* ptr_frame,
+                                  int32* ptr_frame_length) {
+  opus_int32 length = 0;
+  if (input_config_.format_tag == kAudioFormatPcm) {
+    length = opus_encode(ptr_encoder_,
+                         reinterpret_cast<const opus_int16*>(ptr_samples),
+                         frame_size_, ptr_frame, kMaxPacketBytes);
+  } else {
+    length = opus_encode_float(ptr_encoder_,
+                               reinterpret_cast<const float*>(ptr_samples),
+                               frame_size_, ptr_frame, kMaxPacketBytes);
+  }
+  if (length < 0) {
+    LOG(ERROR) << "opus_encode failed: " << opus_strerror(length);
+    return kCodecError;
+  }
+  *ptr_frame_length = length;
+  return kSuccess;
+}
+
+int OpusAudioEncoder::Repacketize(int32* ptr_packet_length) {
+  opus_repacketizer_init(ptr_repacketizer_);
+  for (size_t i = 0; i < frame_lengths_.size(); ++i) {
+    const uint8* const ptr_frame = &frame_storage_[i * kMaxPacketBytes];
+    const int status = opus_repacketizer_cat(ptr_repacketizer_, ptr_frame,
+                                             frame_lengths_[i]);
+    if (status != OPUS_OK) {
+      LOG(ERROR) << "opus_repacketizer_cat failed: " << opus_strerror(status);
+      return kCodecError;
+    }
+  }
+  const opus_int32 length =
+      opus_repacketizer_out(ptr_repacketizer_, &packet_[0],
+                            static_cast<opus_int32>(packet_.size()));
+  if (length < 0) {
+    LOG(ERROR) << "opus_repacketizer_out failed: " << opus_strerror(length);
+    return kCodecError;
+  }
+  *ptr_packet_length = length;
+  return kSuccess;
+}
+
+void OpusAudioEncoder::DestroyEncoder() {
+  if (ptr_repacketizer_) {
+    opus_repacketizer_destroy(ptr_repacketizer_);
+    ptr_repacketizer_ = NULL;
+  }
+  if (ptr_encoder_) {
+    opus_encoder_destroy(ptr_encoder_);
+    ptr_encoder_ = NULL;
+  }
+}
+#else
+int OpusAudioEncoder::CreateEncoder(int* /* ptr_lookahead */) {
+  LOG(ERROR) << "Opus support was not built; configure with "
+             << "WEBMLIVE_ENABLE_OPUS.";
+  return kUnsupportedFormat;
+}
+
+int OpusAudioEncoder::EncodeFrame(const uint8* /* ptr_samples */,
+                                  uint8* /* ptr_frame */,
+                                  int32* /* ptr_frame_length */) {
+  return kUnsupportedFormat;
+}
+
+int OpusAudioEncoder::Repacketize(int32* /* ptr_packet_length */) {
+  return kUnsupportedFormat;
+}
+
+void OpusAudioEncoder::DestroyEncoder() {
+}
+#endif  // WEBMLIVE_HAVE_OPUS
+
+}  // namespace webmlive
@@ -0,0 +1,153 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_OPUS_ENCODER_H_
+#define WEBMLIVE_ENCODER_OPUS_ENCODER_H_
+
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+
+// libopus encoder and repacketizer state.
+struct OpusEncoder;
+struct OpusRepacketizer;
+
+namespace webmlive {
+
+// Returns true when libopus encodes at |sample_rate|: 8, 12, 16, 24 or
+// 48 kHz.
+bool ValidOpusSampleRate(uint32 sample_rate);
+
+// Libopus wrapper class with the same interface as |VorbisEncoder|. Input is
+// collected until a whole packet of |OpusConfig::frames_per_packet| frames is
+// available, and each |ReadCompressedAudio()| call encodes one packet. The
+// frames of a packet are combined with the libopus repacketizer.
+//
+// Notes
+// - libopus is optional: without WEBMLIVE_HAVE_OPUS |Init()| fails.
+// - Only 8, 12, 16, 24 and 48 kHz mono or stereo input is supported.
+class OpusAudioEncoder {
+ public:
+  enum {
+    // A libopus function returned an error.
+    kCodecError = -202,
+
+    // Internal error within |OpusAudioEncoder|.
+    kEncoderError = -201,
+
+    // |audio_config| or |opus_config| format is not supported.
+    kUnsupportedFormat = -200,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+
+    // |ReadCompressedAudio()| has no samples available.
+    kNoSamples = 1,
+  };
+
+  // Opus always decodes at 48 kHz; WebM timing values use this rate.
+  static const int kOpusSampleRate = 48000;
+
+  // Time a decoder must decode before a seek point to converge, as
+  // recommended for the WebM SeekPreRoll element.
+  static const int64 kSeekPreRollNs = 80000000;
+
+  // Longest packet allowed by the Opus specification.
+  static const int kMaxPacketDurationMs = 120;
+
+  OpusAudioEncoder();
+  ~OpusAudioEncoder();
+
+  // Initializes libopus using the settings stored in |audio_config| and
+  // |opus_config|. Returns |kSuccess| when successful.
+  int Init(const AudioConfig& audio_config, const OpusConfig& opus_config);
+
+  // Stores the samples in |uncompressed_buffer| until a whole packet can be
+  // encoded. Returns |kSuccess| when successful.
+  int Encode(const AudioBuffer& uncompressed_buffer);
+
+  // Encodes one packet into |ptr_buffer|. Returns |kNoSamples| when less than
+  // a packet of input is stored. Returns |kSuccess| when a packet is written
+  // to |ptr_buffer|.
+  int ReadCompressedAudio(AudioBuffer* ptr_buffer);
+
+  // OpusHead structure stored in the WebM CodecPrivate element.
+  const uint8* codec_private() const { return &codec_private_[0]; }
+  int32 codec_private_length() const {
+    return static_cast<int32>(codec_private_.size());
+  }
+
+  // Encoder lookahead, in nanoseconds for the WebM CodecDelay element, and in
+  // milliseconds.
+  int64 codec_delay_ns() const { return codec_delay_ns_; }
+  int64 audio_delay() const { return codec_delay_ns_ / 1000000; }
+
+  // Timestamp of the most recent packet.
+  int64 last_timestamp() const { return last_timestamp_; }
+
+ private:
+  // Writes the OpusHead structure for |pre_skip| samples to
+  // |codec_private_|.
+  void WriteCodecPrivate(int pre_skip);
+
+  // Returns true when the |length| bytes of interleaved input at
+  // |ptr_samples| are digital silence.
+  bool IsSilentInput(const uint8* ptr_samples, size_t length) const;
+
+  // Returns true when the packet just encoded, |packet_length| bytes, holds
+  // only frames DTX sends for silence.
+  bool DtxPacket(int32 packet_length) const;
+
+  // libopus calls. Without WEBMLIVE_HAVE_OPUS these fail. |EncodeFrame()|
+  // compresses one frame into |ptr_frame|; |Repacketize()| combines the
+  // frames in |frame_storage_| into |packet_|.
+  int CreateEncoder(int* ptr_lookahead);
+  int EncodeFrame(const uint8* ptr_samples, uint8* ptr_frame,
+                  int32* ptr_frame_length);
+  int Repacketize(int32* ptr_packet_length);
+  void DestroyEncoder();
+
+  ::OpusEncoder* ptr_encoder_;
+  ::OpusRepacketizer* ptr_repacketizer_;
+  AudioConfig input_config_;
+  AudioConfig audio_config_;
+  OpusConfig opus_config_;
+
+  // Samples per channel in each packet, and the input bytes they occupy.
+  int frame_size_;
+  int32 frame_bytes_;
+
+  // Interleaved input waiting to be encoded starts at |pending_offset_|.
+  std::vector<uint8> pending_;
+  size_t pending_offset_;
+
+  // Storage for the frames of the packet being encoded, |kMaxPacketBytes|
+  // each, and their lengths. Unused when each packet is a single frame.
+  std::vector<uint8> frame_storage_;
+  std::vector<int32> frame_lengths_;
+
+  // Storage for the packet being encoded.
+  std::vector<uint8> packet_;
+
+  std::vector<uint8> codec_private_;
+  int64 codec_delay_ns_;
+  int64 first_input_timestamp_;
+  int64 samples_encoded_;
+  int64 last_timestamp_;
+
+  // The packet libopus sent for silence with |OpusConfig::dtx|, and whether
+  // it was sent since the input last held sound. While it was, silent
+  // packets repeat it instead of calling libopus.
+  std::vector<uint8> silent_packet_;
+  bool dtx_active_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(OpusAudioEncoder);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_OPUS_ENCODER_H_
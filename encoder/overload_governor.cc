@@ -0,0 +1,83 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/overload_governor.h"
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+OverloadGovernor::OverloadGovernor()
+    : level_(kNormal),
+      level_time_ms_(0),
+      last_late_ms_(0),
+      frame_count_(0) {
+}
+
+int OverloadGovernor::Init(const OverloadGovernorConfig& config) {
+  if (config.audio_deadline_ms < 0 || config.escalate_hold_ms < 0 ||
+      config.recover_ms < 0 || config.speed_boost < 0) {
+    LOG(ERROR) << "OverloadGovernor invalid config.";
+    return kInvalidArg;
+  }
+  config_ = config;
+  level_ = kNormal;
+  level_time_ms_ = 0;
+  last_late_ms_ = 0;
+  frame_count_ = 0;
+  stats_ = OverloadStats();
+  return kSuccess;
+}
+
+bool OverloadGovernor::Update(int64 audio_lag_ms, int64 now_ms) {
+  if (!enabled())
+    return false;
+  if (audio_lag_ms > stats_.max_audio_lag_ms)
+    stats_.max_audio_lag_ms = audio_lag_ms;
+  if (audio_lag_ms >= config_.audio_deadline_ms / 2)
+    last_late_ms_ = now_ms;
+
+  const Level old_level = level_;
+  if (audio_lag_ms > config_.audio_deadline_ms) {
+    if (level_ < kDropFrames &&
+        now_ms - level_time_ms_ >= config_.escalate_hold_ms) {
+      SetLevel(static_cast<Level>(level_ + 1), now_ms);
+    }
+  } else if (level_ > kNormal &&
+             now_ms - last_late_ms_ >= config_.recover_ms &&
+             now_ms - level_time_ms_ >= config_.recover_ms) {
+    SetLevel(static_cast<Level>(level_ - 1), now_ms);
+  }
+  return level_ != old_level;
+}
+
+bool OverloadGovernor::ShouldSkipRawFrame() {
+  if (level_ < kDecimate) {
+    frame_count_ = 0;
+    return false;
+  }
+  // Keeps the first frame of every two, or of every four.
+  const uint32 period = level_ == kDecimate ? 2 : 4;
+  const bool skip = (frame_count_ % period) != 0;
+  ++frame_count_;
+  if (skip)
+    ++stats_.frames_skipped;
+  return skip;
+}
+
+int OverloadGovernor::speed_boost() const {
+  return level_ >= kFasterVideo ? config_.speed_boost : 0;
+}
+
+void OverloadGovernor::SetLevel(Level level, int64 now_ms) {
+  LOG(INFO) << "OverloadGovernor level " << level_ << " -> " << level;
+  level_ = level;
+  level_time_ms_ = now_ms;
+  ++stats_.level_changes;
+}
+
+}  // namespace webmlive
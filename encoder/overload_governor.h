@@ -0,0 +1,126 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_OVERLOAD_GOVERNOR_H_
+#define WEBMLIVE_ENCODER_OVERLOAD_GOVERNOR_H_
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+struct OverloadGovernorConfig {
+  static const int32 kDefaultEscalateHoldMs = 500;
+  static const int32 kDefaultRecoverMs = 3000;
+  static const int kDefaultSpeedBoost = 4;
+
+  OverloadGovernorConfig()
+      : audio_deadline_ms(0),
+        escalate_hold_ms(kDefaultEscalateHoldMs),
+        recover_ms(kDefaultRecoverMs),
+        speed_boost(kDefaultSpeedBoost) {}
+
+  // Time, in milliseconds, by which captured audio must be muxed. The
+  // governor degrades video while audio lags further behind capture. 0
+  // disables the governor.
+  int32 audio_deadline_ms;
+
+  // Minimum time at a level before the next, more severe, one.
+  int32 escalate_hold_ms;
+
+  // Time the audio lag must stay below half of |audio_deadline_ms| before
+  // the level drops by one.
+  int32 recover_ms;
+
+  // Encoder speed steps added to video encoding from |kFasterVideo| up.
+  int speed_boost;
+};
+
+// Counts of the decisions made by |OverloadGovernor|.
+struct OverloadStats {
+  OverloadStats() : level_changes(0), frames_skipped(0), max_audio_lag_ms(0) {}
+
+  int64 level_changes;
+
+  // Raw video frames skipped to free CPU time for audio.
+  int64 frames_skipped;
+
+  // Largest audio lag reported to |Update()|.
+  int64 max_audio_lag_ms;
+};
+
+// Keeps audio ahead of its deadline when the encoder is short of CPU time.
+// The encoder thread reports how far muxed audio lags behind captured audio,
+// and the governor degrades video, one level at a time, until audio catches
+// up:
+// - |kNormal|: video is encoded as configured.
+// - |kFasterVideo|: video encoders run |speed_boost| speed steps faster.
+// - |kDecimate|: as |kFasterVideo|, and every other raw video frame is
+//   skipped.
+// - |kDropFrames|: as |kFasterVideo|, and three of every four raw video
+//   frames are skipped.
+// Each level is held for |escalate_hold_ms| so the previous one can take
+// effect, and is left once the lag stays below half the deadline for
+// |recover_ms|, so video regains quality no faster than audio stays on time.
+//
+// Note: the class is not thread safe; it is used by the encoder thread only.
+class OverloadGovernor {
+ public:
+  enum Level {
+    kNormal = 0,
+    kFasterVideo = 1,
+    kDecimate = 2,
+    kDropFrames = 3,
+  };
+  enum {
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  OverloadGovernor();
+  ~OverloadGovernor() {}
+
+  // Configures the governor. Returns |kSuccess| when successful.
+  int Init(const OverloadGovernorConfig& config);
+
+  // Returns true when |Init()| enabled the governor.
+  bool enabled() const { return config_.audio_deadline_ms > 0; }
+
+  // Updates the level from |audio_lag_ms|, the time captured audio has waited
+  // to be muxed, at |now_ms| on a monotonic clock. Returns true when the
+  // level changed.
+  bool Update(int64 audio_lag_ms, int64 now_ms);
+
+  // Returns true when the next raw video frame should be skipped.
+  bool ShouldSkipRawFrame();
+
+  // Returns the speed steps video encoders should add at the current level.
+  int speed_boost() const;
+
+  Level level() const { return level_; }
+  const OverloadStats& stats() const { return stats_; }
+
+ private:
+  void SetLevel(Level level, int64 now_ms);
+
+  OverloadGovernorConfig config_;
+  Level level_;
+  OverloadStats stats_;
+
+  // Time of the last level change, and the last time the lag was at or above
+  // half the deadline.
+  int64 level_time_ms_;
+  int64 last_late_ms_;
+
+  // Counts raw frames to pick the ones to skip.
+  uint32 frame_count_;
+
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(OverloadGovernor);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_OVERLOAD_GOVERNOR_H_
@@ -0,0 +1,200 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/pcm_deinterleave.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WEBMLIVE_HAVE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define WEBMLIVE_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace webmlive {
+
+namespace {
+// Converts 16 bit samples to floats in [-1, 1). A power of two, so the
+// product matches division by 32768 exactly.
+const float kS16Scale = 1.0f / 32768.0f;
+
+// Scalar loops. |kChannels| is a compile time constant so that the inner
+// loop is unrolled.
+template <int kChannels>
+void DeinterleaveS16Scalar(const int16* ptr_input, int first_frame,
+                           int num_frames, float* const* ptr_planes) {
+  for (int i = first_frame; i < num_frames; ++i) {
+    for (int c = 0; c < kChannels; ++c) {
+      ptr_planes[c][i] = ptr_input[i * kChannels + c] * kS16Scale;
+    }
+  }
+}
+
+template <int kChannels>
+void DeinterleaveFloatScalar(const float* ptr_input, int first_frame,
+                             int num_frames, float* const* ptr_planes) {
+  for (int i = first_frame; i < num_frames; ++i) {
+    for (int c = 0; c < kChannels; ++c) {
+      ptr_planes[c][i] = ptr_input[i * kChannels + c];
+    }
+  }
+}
+
+// Vector loops. Each returns the number of frames it converted; the caller
+// finishes the remainder with the scalar loop.
+#if defined(WEBMLIVE_HAVE_SSE2)
+int DeinterleaveS16Mono(const int16* ptr_input, int num_frames,
+                        float* ptr_plane) {
+  const __m128 scale = _mm_set1_ps(kS16Scale);
+  int i = 0;
+  for (; i + 8 <= num_frames; i += 8) {
+    const __m128i s =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_input + i));
+    // Duplicate each sample into a 32 bit lane, and sign extend it.
+    const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+    const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+    _mm_storeu_ps(ptr_plane + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+    _mm_storeu_ps(ptr_plane + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+  }
+  return i;
+}
+
+int DeinterleaveS16Stereo(const int16* ptr_input, int num_frames,
+                          float* ptr_left, float* ptr_right) {
+  const __m128 scale = _mm_set1_ps(kS16Scale);
+  int i = 0;
+  for (; i + 4 <= num_frames; i += 4) {
+    const __m128i s =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_input + i * 2));
+    // Each 32 bit lane holds one frame: left in the low half.
+    const __m128i left = _mm_srai_epi32(_mm_slli_epi32(s, 16), 16);
+    const __m128i right = _mm_srai_epi32(s, 16);
+    _mm_storeu_ps(ptr_left + i, _mm_mul_ps(_mm_cvtepi32_ps(left), scale));
+    _mm_storeu_ps(ptr_right + i, _mm_mul_ps(_mm_cvtepi32_ps(right), scale));
+  }
+  return i;
+}
+
+int DeinterleaveFloatStereo(const float* ptr_input, int num_frames,
+                            float* ptr_left, float* ptr_right) {
+  int i = 0;
+  for (; i + 4 <= num_frames; i += 4) {
+    const __m128 a = _mm_loadu_ps(ptr_input + i * 2);
+    const __m128 b = _mm_loadu_ps(ptr_input + i * 2 + 4);
+    _mm_storeu_ps(ptr_left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+    _mm_storeu_ps(ptr_right + i,
+                  _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+  }
+  return i;
+}
+#elif defined(WEBMLIVE_HAVE_NEON)
+int DeinterleaveS16Mono(const int16* ptr_input, int num_frames,
+                        float* ptr_plane) {
+  int i = 0;
+  for (; i + 8 <= num_frames; i += 8) {
+    const int16x8_t s = vld1q_s16(ptr_input + i);
+    const int32x4_t lo = vmovl_s16(vget_low_s16(s));
+    const int32x4_t hi = vmovl_s16(vget_high_s16(s));
+    vst1q_f32(ptr_plane + i, vmulq_n_f32(vcvtq_f32_s32(lo), kS16Scale));
+    vst1q_f32(ptr_plane + i + 4, vmulq_n_f32(vcvtq_f32_s32(hi), kS16Scale));
+  }
+  return i;
+}
+
+int DeinterleaveS16Stereo(const int16* ptr_input, int num_frames,
+                          float* ptr_left, float* ptr_right) {
+  int i = 0;
+  for (; i + 4 <= num_frames; i += 4) {
+    const int16x4x2_t s = vld2_s16(ptr_input + i * 2);
+    const int32x4_t left = vmovl_s16(s.val[0]);
+    const int32x4_t right = vmovl_s16(s.val[1]);
+    vst1q_f32(ptr_left + i, vmulq_n_f32(vcvtq_f32_s32(left), kS16Scale));
+    vst1q_f32(ptr_right + i, vmulq_n_f32(vcvtq_f32_s32(right), kS16Scale));
+  }
+  return i;
+}
+
+int DeinterleaveFloatStereo(const float* ptr_input, int num_frames,
+                            float* ptr_left, float* ptr_right) {
+  int i = 0;
+  for (; i + 4 <= num_frames; i += 4) {
+    const float32x4x2_t s = vld2q_f32(ptr_input + i * 2);
+    vst1q_f32(ptr_left + i, s.val[0]);
+    vst1q_f32(ptr_right + i, s.val[1]);
+  }
+  return i;
+}
+#else
+int DeinterleaveS16Mono(const int16*, int, float*) {
+  return 0;
+}
+
+int DeinterleaveS16Stereo(const int16*, int, float*, float*) {
+  return 0;
+}
+
+int DeinterleaveFloatStereo(const float*, int, float*, float*) {
+  return 0;
+}
+#endif
+}  // namespace
+
+void DeinterleaveS16ToFloat(const int16* ptr_input, int num_frames,
+                            int channels, float* const* ptr_planes) {
+  int done = 0;
+  switch (channels) {
+    case 1:
+      done = DeinterleaveS16Mono(ptr_input, num_frames, ptr_planes[0]);
+      DeinterleaveS16Scalar<1>(ptr_input, done, num_frames, ptr_planes);
+      break;
+    case 2:
+      done = DeinterleaveS16Stereo(ptr_input, num_frames, ptr_planes[0],
+                                   ptr_planes[1]);
+      DeinterleaveS16Scalar<2>(ptr_input, done, num_frames, ptr_planes);
+      break;
+    case 6:
+      DeinterleaveS16Scalar<6>(ptr_input, 0, num_frames, ptr_planes);
+      break;
+    default:
+      for (int i = 0; i < num_frames; ++i) {
+        for (int c = 0; c < channels; ++c) {
+          ptr_planes[c][i] = ptr_input[i * channels + c] * kS16Scale;
+        }
+      }
+      break;
+  }
+}
+
+void DeinterleaveFloat(const float* ptr_input, int num_frames, int channels,
+                       float* const* ptr_planes) {
+  int done = 0;
+  switch (channels) {
+    case 1:
+      memcpy(ptr_planes[0], ptr_input, num_frames * sizeof(*ptr_input));
+      break;
+    case 2:
+      done = DeinterleaveFloatStereo(ptr_input, num_frames, ptr_planes[0],
+                                     ptr_planes[1]);
+      DeinterleaveFloatScalar<2>(ptr_input, done, num_frames, ptr_planes);
+      break;
+    case 6:
+      DeinterleaveFloatScalar<6>(ptr_input, 0, num_frames, ptr_planes);
+      break;
+    default:
+      for (int i = 0; i < num_frames; ++i) {
+        for (int c = 0; c < channels; ++c) {
+          ptr_planes[c][i] = ptr_input[i * channels + c];
+        }
+      }
+      break;
+  }
+}
+
+}  // namespace webmlive
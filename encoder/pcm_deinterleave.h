@@ -0,0 +1,28 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_PCM_DEINTERLEAVE_H_
+#define WEBMLIVE_ENCODER_PCM_DEINTERLEAVE_H_
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Splits |num_frames| frames of interleaved |channels| channel audio at
+// |ptr_input| into the per channel buffers in |ptr_planes|. 16 bit samples
+// are scaled to floats in [-1, 1).
+//
+// Mono, stereo and 5.1 layouts use loops specialized for the channel count;
+// mono and stereo also use SSE2 or NEON when the target supports them.
+void DeinterleaveS16ToFloat(const int16* ptr_input, int num_frames,
+                            int channels, float* const* ptr_planes);
+void DeinterleaveFloat(const float* ptr_input, int num_frames, int channels,
+                       float* const* ptr_planes);
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_PCM_DEINTERLEAVE_H_
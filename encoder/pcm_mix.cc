@@ -0,0 +1,102 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/pcm_mix.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WEBMLIVE_HAVE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define WEBMLIVE_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace webmlive {
+
+namespace {
+// Vector loops. Each returns the number of samples it processed; the caller
+// finishes the remainder with a scalar loop. The multiply and add are kept
+// separate, as in the scalar loop, so that both round the same way.
+#if defined(WEBMLIVE_HAVE_SSE2)
+int MixPlaneVector(const float* ptr_src, float gain, float* ptr_dst,
+                   int num_samples) {
+  const __m128 g = _mm_set1_ps(gain);
+  int i = 0;
+  for (; i + 8 <= num_samples; i += 8) {
+    const __m128 s0 = _mm_mul_ps(_mm_loadu_ps(ptr_src + i), g);
+    const __m128 s1 = _mm_mul_ps(_mm_loadu_ps(ptr_src + i + 4), g);
+    _mm_storeu_ps(ptr_dst + i, _mm_add_ps(_mm_loadu_ps(ptr_dst + i), s0));
+    _mm_storeu_ps(ptr_dst + i + 4,
+                  _mm_add_ps(_mm_loadu_ps(ptr_dst + i + 4), s1));
+  }
+  return i;
+}
+
+int ClampPlaneVector(float* ptr_samples, int num_samples) {
+  const __m128 lo = _mm_set1_ps(-1.0f);
+  const __m128 hi = _mm_set1_ps(1.0f);
+  int i = 0;
+  for (; i + 4 <= num_samples; i += 4) {
+    const __m128 s = _mm_loadu_ps(ptr_samples + i);
+    _mm_storeu_ps(ptr_samples + i, _mm_min_ps(_mm_max_ps(s, lo), hi));
+  }
+  return i;
+}
+#elif defined(WEBMLIVE_HAVE_NEON)
+int MixPlaneVector(const float* ptr_src, float gain, float* ptr_dst,
+                   int num_samples) {
+  int i = 0;
+  for (; i + 8 <= num_samples; i += 8) {
+    const float32x4_t s0 = vmulq_n_f32(vld1q_f32(ptr_src + i), gain);
+    const float32x4_t s1 = vmulq_n_f32(vld1q_f32(ptr_src + i + 4), gain);
+    vst1q_f32(ptr_dst + i, vaddq_f32(vld1q_f32(ptr_dst + i), s0));
+    vst1q_f32(ptr_dst + i + 4, vaddq_f32(vld1q_f32(ptr_dst + i + 4), s1));
+  }
+  return i;
+}
+
+int ClampPlaneVector(float* ptr_samples, int num_samples) {
+  const float32x4_t lo = vdupq_n_f32(-1.0f);
+  const float32x4_t hi = vdupq_n_f32(1.0f);
+  int i = 0;
+  for (; i + 4 <= num_samples; i += 4) {
+    const float32x4_t s = vld1q_f32(ptr_samples + i);
+    vst1q_f32(ptr_samples + i, vminq_f32(vmaxq_f32(s, lo), hi));
+  }
+  return i;
+}
+#else
+int MixPlaneVector(const float*, float, float*, int) {
+  return 0;
+}
+
+int ClampPlaneVector(float*, int) {
+  return 0;
+}
+#endif
+}  // namespace
+
+void MixPlane(const float* ptr_src, float gain, float* ptr_dst,
+              int num_samples) {
+  for (int i = MixPlaneVector(ptr_src, gain, ptr_dst, num_samples);
+       i < num_samples; ++i) {
+    const float s = ptr_src[i] * gain;
+    ptr_dst[i] += s;
+  }
+}
+
+void ClampPlane(float* ptr_samples, int num_samples) {
+  for (int i = ClampPlaneVector(ptr_samples, num_samples); i < num_samples;
+       ++i) {
+    ptr_samples[i] = std::min(1.0f, std::max(-1.0f, ptr_samples[i]));
+  }
+}
+
+}  // namespace webmlive
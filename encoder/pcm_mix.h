@@ -0,0 +1,27 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_PCM_MIX_H_
+#define WEBMLIVE_ENCODER_PCM_MIX_H_
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Adds the |num_samples| float samples at |ptr_src|, scaled by |gain|, to
+// those at |ptr_dst|: dst += src * gain. Uses SSE2 or NEON when the target
+// supports them; the vector and scalar loops give identical results.
+void MixPlane(const float* ptr_src, float gain, float* ptr_dst,
+              int num_samples);
+
+// Limits the |num_samples| float samples at |ptr_samples| to [-1, 1], the
+// range of the encoders' input. Uses SSE2 or NEON as |MixPlane()| does.
+void ClampPlane(float* ptr_samples, int num_samples);
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_PCM_MIX_H_
@@ -0,0 +1,119 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/pcm_silence.h"
+
+#include <cstring>
+
+#include "encoder/audio_encoder.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WEBMLIVE_HAVE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define WEBMLIVE_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace webmlive {
+
+namespace {
+// Clears the sign bit of a float, so that -0.0f compares as zero.
+const uint32 kFloatMagnitudeMask = 0x7fffffff;
+
+// Vector loops. Each returns the number of 32 bit words it checked, or -1
+// when it found a non-zero one; the caller checks the remainder.
+#if defined(WEBMLIVE_HAVE_SSE2)
+int CheckZeroWords(const uint32* ptr_words, int num_words, uint32 mask) {
+  const __m128i vmask = _mm_set1_epi32(static_cast<int>(mask));
+  const __m128i zero = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 16 <= num_words; i += 16) {
+    const __m128i* const p = reinterpret_cast<const __m128i*>(ptr_words + i);
+    __m128i bits = _mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p + 1));
+    bits = _mm_or_si128(bits, _mm_loadu_si128(p + 2));
+    bits = _mm_or_si128(bits, _mm_loadu_si128(p + 3));
+    bits = _mm_and_si128(bits, vmask);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(bits, zero)) != 0xffff)
+      return -1;
+  }
+  return i;
+}
+#elif defined(WEBMLIVE_HAVE_NEON)
+int CheckZeroWords(const uint32* ptr_words, int num_words, uint32 mask) {
+  const uint32x4_t vmask = vdupq_n_u32(mask);
+  int i = 0;
+  for (; i + 16 <= num_words; i += 16) {
+    uint32x4_t bits = vorrq_u32(vld1q_u32(ptr_words + i),
+                                vld1q_u32(ptr_words + i + 4));
+    bits = vorrq_u32(bits, vld1q_u32(ptr_words + i + 8));
+    bits = vorrq_u32(bits, vld1q_u32(ptr_words + i + 12));
+    bits = vandq_u32(bits, vmask);
+    const uint32x2_t half = vorr_u32(vget_low_u32(bits), vget_high_u32(bits));
+    if (vget_lane_u32(vpmax_u32(half, half), 0) != 0)
+      return -1;
+  }
+  return i;
+}
+#else
+int CheckZeroWords(const uint32*, int, uint32) {
+  return 0;
+}
+#endif
+
+// Returns true when every 32 bit word at |ptr_data|, masked with |mask|, is
+// zero. The words need not be aligned.
+bool ZeroWords(const void* ptr_data, int num_words, uint32 mask) {
+  const uint32* const ptr_words = static_cast<const uint32*>(ptr_data);
+  int i = CheckZeroWords(ptr_words, num_words, mask);
+  if (i < 0)
+    return false;
+  uint32 bits = 0;
+  for (; i < num_words; ++i) {
+    uint32 word = 0;
+    memcpy(&word, ptr_words + i, sizeof(word));
+    bits |= word;
+  }
+  return (bits & mask) == 0;
+}
+}  // namespace
+
+bool IsSilentS16(const int16* ptr_samples, int num_samples) {
+  // Pairs of samples are checked as 32 bit words, and an odd one alone.
+  if (num_samples % 2 && ptr_samples[num_samples - 1] != 0)
+    return false;
+  return ZeroWords(ptr_samples, num_samples / 2, 0xffffffff);
+}
+
+bool IsSilentFloat(const float* ptr_samples, int num_samples) {
+  return ZeroWords(ptr_samples, num_samples, kFloatMagnitudeMask);
+}
+
+bool IsSilentBuffer(const AudioBuffer& buffer) {
+  if (!buffer.buffer())
+    return false;
+  const AudioConfig& config = buffer.config();
+  if (buffer.planar()) {
+    for (int c = 0; c < config.channels; ++c) {
+      if (!IsSilentFloat(buffer.plane(c), buffer.num_frames()))
+        return false;
+    }
+    return true;
+  }
+  if (config.format_tag == kAudioFormatPcm && config.bits_per_sample == 16) {
+    return IsSilentS16(reinterpret_cast<const int16*>(buffer.buffer()),
+                       buffer.buffer_length() / 2);
+  }
+  if (config.format_tag == kAudioFormatIeeeFloat) {
+    return IsSilentFloat(reinterpret_cast<const float*>(buffer.buffer()),
+                         buffer.buffer_length() / 4);
+  }
+  return false;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,30 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_PCM_SILENCE_H_
+#define WEBMLIVE_ENCODER_PCM_SILENCE_H_
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+class AudioBuffer;
+
+// Returns true when the |num_samples| samples at |ptr_samples| are digital
+// silence: every sample is zero. Negative zero floats count as zero. The
+// loops use SSE2 or NEON when the target supports them, and stop at the
+// first non-zero vector, so loud input costs little to reject.
+bool IsSilentS16(const int16* ptr_samples, int num_samples);
+bool IsSilentFloat(const float* ptr_samples, int num_samples);
+
+// Returns true when every sample of |buffer|, 16 bit PCM or 32 bit float,
+// interleaved or planar, is zero.
+bool IsSilentBuffer(const AudioBuffer& buffer);
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_PCM_SILENCE_H_
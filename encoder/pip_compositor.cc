@@ -0,0 +1,292 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/pip_compositor.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "encoder/alpha_blend.h"
+#include "encoder/video_surface.h"
+#include "glog/logging.h"
+#include "libyuv/scale.h"
+
+namespace webmlive {
+
+namespace {
+// Smallest overlay drawn, in pixels.
+const int32 kMinOverlaySize = 16;
+
+int32 RoundDownToEven(int32 value) {
+  return value & ~1;
+}
+}  // namespace
+
+int PipCompositor::Input::OnVideoFrameReceived(VideoFrame* ptr_frame) {
+  if (!ptr_frame || ptr_frame->empty()) {
+    return kInvalidArg;
+  }
+  return overlay_ ? ptr_compositor_->OnOverlayFrame(ptr_frame) :
+                    ptr_compositor_->OnMainFrame(ptr_frame);
+}
+
+PipCompositor::PipCompositor()
+    : main_input_(this, false),
+      overlay_input_(this, true),
+      ptr_callback_(NULL),
+      x_(0),
+      y_(0),
+      width_(0),
+      height_(0),
+      main_width_(0),
+      main_height_(0),
+      alpha_(kOpaqueAlpha),
+      max_skew_ms_(PictureInPictureConfig::kDefaultMaxSkewMs),
+      overlay_missing_(false) {
+}
+
+int PipCompositor::Init(const PictureInPictureConfig& config,
+                        const VideoConfig& main_config,
+                        VideoFrameCallbackInterface* ptr_callback) {
+  if (!ptr_callback || main_config.width < kMinOverlaySize ||
+      main_config.height < kMinOverlaySize || config.width < 0 ||
+      config.height < 0 || config.opacity_percent < 0 ||
+      config.opacity_percent > 100 || config.max_skew_ms < 0) {
+    LOG(ERROR) << "PipCompositor invalid config.";
+    return kInvalidArg;
+  }
+  ptr_callback_ = ptr_callback;
+  main_width_ = main_config.width;
+  main_height_ = std::abs(main_config.height);
+  const int32 width = config.width > 0 ? config.width : main_width_ / 4;
+  width_ = RoundDownToEven(
+      std::max(kMinOverlaySize, std::min(width, main_width_)));
+  height_ = config.height > 0 ?
+      RoundDownToEven(std::max(kMinOverlaySize,
+                               std::min(config.height, main_height_))) : 0;
+  x_ = config.x;
+  y_ = config.y;
+  alpha_ = (config.opacity_percent * kOpaqueAlpha + 50) / 100;
+  max_skew_ms_ = config.max_skew_ms;
+  overlay_missing_ = false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  overlays_.clear();
+  return kSuccess;
+}
+
+bool PipCompositor::GetPlanes(const VideoFrame& frame, Planes* ptr_planes) {
+  if ((frame.format() != kVideoFormatI420 &&
+       frame.format() != kVideoFormatYV12) ||
+      frame.width() <= 0 || frame.height() <= 0) {
+    return false;
+  }
+  const VideoPlane y_plane = frame.plane(VideoFrame::kPlaneY);
+  const VideoPlane u_plane = frame.plane(VideoFrame::kPlaneU);
+  const VideoPlane v_plane = frame.plane(VideoFrame::kPlaneV);
+  if (!y_plane.data || u_plane.stride != v_plane.stride) {
+    return false;
+  }
+  ptr_planes->y = y_plane.data;
+  ptr_planes->u = u_plane.data;
+  ptr_planes->v = v_plane.data;
+  ptr_planes->y_stride = y_plane.stride;
+  ptr_planes->uv_stride = u_plane.stride;
+  return true;
+}
+
+int PipCompositor::OnMainFrame(VideoFrame* ptr_frame) {
+  const SharedVideoFrame overlay = FindOverlay(ptr_frame->timestamp());
+  if (!overlay || alpha_ == 0 || !Composite(*overlay, ptr_frame)) {
+    if (!overlay_missing_) {
+      LOG(INFO) << "PipCompositor passing frames without overlay from "
+                << ptr_frame->timestamp() << " ms.";
+      overlay_missing_ = true;
+    }
+    return ptr_callback_->OnVideoFrameReceived(ptr_frame);
+  }
+  if (overlay_missing_) {
+    LOG(INFO) << "PipCompositor compositing from "
+              << ptr_frame->timestamp() << " ms.";
+    overlay_missing_ = false;
+  }
+  ptr_frame->mutable_region_hints()->valid = false;
+  return ptr_callback_->OnVideoFrameReceived(ptr_frame);
+}
+
+bool PipCompositor::Composite(const VideoFrame& overlay,
+                              VideoFrame* ptr_frame) {
+  // Overlay frames are scaled for the configured main frame size; clip them
+  // to the frame actually captured.
+  const int32 width = std::min(overlay.width(),
+                               RoundDownToEven(ptr_frame->width()));
+  const int32 height = std::min(overlay.height(),
+                                RoundDownToEven(ptr_frame->height()));
+  int32 left = 0;
+  int32 top = 0;
+  PlaceOverlay(width, height, ptr_frame->width(), ptr_frame->height(),
+               &left, &top);
+
+  const std::shared_ptr<VideoSurface>& main_surface = ptr_frame->surface();
+  const std::shared_ptr<VideoSurface>& overlay_surface = overlay.surface();
+  if (main_surface && overlay_surface &&
+      main_surface->device() == overlay_surface->device()) {
+    std::shared_ptr<VideoSurface> composed;
+    const int status = main_surface->Compose(
+        *overlay_surface, VideoRect(left, top, width, height),
+        static_cast<double>(alpha_) / kOpaqueAlpha, &composed);
+    if (status == VideoSurface::kSuccess) {
+      const VideoConfig config = ptr_frame->config();
+      const int64 timestamp_us = ptr_frame->timestamp_us();
+      const int64 duration_us = ptr_frame->duration_us();
+      if (ptr_frame->InitSurface(config, ptr_frame->keyframe(),
+                                 ptr_frame->timestamp(),
+                                 ptr_frame->duration(), composed)) {
+        return false;
+      }
+      ptr_frame->SetTimeUs(timestamp_us, duration_us);
+      return true;
+    } else if (status != VideoSurface::kNotSupported) {
+      LOG_FIRST_N(WARNING, 1) << "PipCompositor surface Compose failed: "
+                              << status << "; compositing in memory.";
+    }
+  }
+
+  // Blend in memory, reading back whichever frame is held in a surface.
+  const VideoFrame* ptr_overlay = &overlay;
+  if (overlay_surface) {
+    if (overlay.Clone(&overlay_readback_) || overlay_readback_.Pack()) {
+      return false;
+    }
+    ptr_overlay = &overlay_readback_;
+  }
+  Planes main_planes;
+  Planes overlay_planes;
+  if (ptr_frame->Pack() || !GetPlanes(*ptr_frame, &main_planes) ||
+      !GetPlanes(*ptr_overlay, &overlay_planes)) {
+    return false;
+  }
+  BlendPlane(overlay_planes.y, overlay_planes.y_stride,
+             main_planes.y + top * main_planes.y_stride + left,
+             main_planes.y_stride, width, height, alpha_);
+  const int32 chroma_offset = top / 2 * main_planes.uv_stride + left / 2;
+  BlendPlane(overlay_planes.u, overlay_planes.uv_stride,
+             main_planes.u + chroma_offset, main_planes.uv_stride,
+             width / 2, height / 2, alpha_);
+  BlendPlane(overlay_planes.v, overlay_planes.uv_stride,
+             main_planes.v + chroma_offset, main_planes.uv_stride,
+             width / 2, height / 2, alpha_);
+  return true;
+}
+
+int PipCompositor::OnOverlayFrame(VideoFrame* ptr_frame) {
+  const VideoFrame& frame = *ptr_frame;
+  if (frame.width() <= 0 || frame.height() <= 0) {
+    return VideoFrameCallbackInterface::kDropped;
+  }
+  const int32 height = height_ > 0 ? height_ : RoundDownToEven(
+      std::max(kMinOverlaySize,
+               std::min<int32>(main_height_, static_cast<int32>(
+                   static_cast<int64>(width_) * frame.height() /
+                   frame.width()))));
+  const int32 width = width_;
+  VideoConfig config;
+  config.format = kVideoFormatI420;
+  config.width = width;
+  config.height = height;
+  config.frame_rate = frame.config().frame_rate;
+
+  // Overlays held in a surface are scaled by its device when it can.
+  if (frame.surface()) {
+    std::shared_ptr<VideoSurface> scaled_surface;
+    const int status =
+        frame.surface()->Scale(width, height, &scaled_surface);
+    if (status == VideoSurface::kSuccess) {
+      if (scaled_frame_.InitSurface(config, false, frame.timestamp(),
+                                    frame.duration(), scaled_surface)) {
+        return VideoFrameCallbackInterface::kDropped;
+      }
+      return AddOverlay();
+    } else if (status != VideoSurface::kNotSupported) {
+      LOG_FIRST_N(WARNING, 1) << "PipCompositor surface Scale failed: "
+                              << status << "; scaling in memory.";
+    }
+    if (ptr_frame->Pack()) {
+      return VideoFrameCallbackInterface::kDropped;
+    }
+  }
+
+  Planes src_planes;
+  if (!GetPlanes(frame, &src_planes)) {
+    LOG_FIRST_N(WARNING, 1) << "PipCompositor drops overlay frames of format "
+                            << frame.format() << ".";
+    return VideoFrameCallbackInterface::kDropped;
+  }
+
+  // Scale into |scaled_frame_|, then trade its storage with the pool.
+  const int32 stride = VideoFrame::AlignedStride(width);
+  const int32 size = VideoFrame::PlanarFrameSize(stride, height);
+  if (scaled_frame_.Allocate(size)) {
+    LOG(ERROR) << "PipCompositor cannot allocate overlay frame.";
+    return VideoFrameCallbackInterface::kDropped;
+  }
+  config.stride = stride;
+  if (scaled_frame_.InitInPlace(config, false, frame.timestamp(),
+                                frame.duration(), size)) {
+    return VideoFrameCallbackInterface::kDropped;
+  }
+  Planes dst_planes;
+  GetPlanes(scaled_frame_, &dst_planes);
+  const int status = libyuv::I420Scale(
+      src_planes.y, src_planes.y_stride, src_planes.u, src_planes.uv_stride,
+      src_planes.v, src_planes.uv_stride, frame.width(), frame.height(),
+      dst_planes.y, dst_planes.y_stride, dst_planes.u, dst_planes.uv_stride,
+      dst_planes.v, dst_planes.uv_stride, width, height, libyuv::kFilterBox);
+  if (status) {
+    LOG(ERROR) << "PipCompositor I420Scale failed: " << status;
+    return VideoFrameCallbackInterface::kDropped;
+  }
+  return AddOverlay();
+}
+
+int PipCompositor::AddOverlay() {
+  SharedVideoFrame shared;
+  if (pool_.Share(&scaled_frame_, &shared)) {
+    return VideoFrameCallbackInterface::kDropped;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  overlays_.push_back(shared);
+  while (overlays_.size() > static_cast<size_t>(kMaxOverlayFrames))
+    overlays_.pop_front();
+  return kSuccess;
+}
+
+void PipCompositor::PlaceOverlay(int32 width, int32 height,
+                                 int32 frame_width, int32 frame_height,
+                                 int32* ptr_left, int32* ptr_top) const {
+  const int32 left = x_ >= 0 ? x_ : frame_width - width + x_;
+  const int32 top = y_ >= 0 ? y_ : frame_height - height + y_;
+  *ptr_left = RoundDownToEven(
+      std::max<int32>(0, std::min(left, frame_width - width)));
+  *ptr_top = RoundDownToEven(
+      std::max<int32>(0, std::min(top, frame_height - height)));
+}
+
+SharedVideoFrame PipCompositor::FindOverlay(int64 timestamp) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  SharedVideoFrame closest;
+  int64 closest_skew = max_skew_ms_;
+  for (size_t i = 0; i < overlays_.size(); ++i) {
+    const int64 skew = std::abs(overlays_[i]->timestamp() - timestamp);
+    if (skew <= closest_skew) {
+      closest = overlays_[i];
+      closest_skew = skew;
+    }
+  }
+  return closest;
+}
+
+}  // namespace webmlive
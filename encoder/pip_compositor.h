@@ -0,0 +1,195 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_PIP_COMPOSITOR_H_
+#define WEBMLIVE_ENCODER_PIP_COMPOSITOR_H_
+
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+#include "encoder/video_frame_pool.h"
+
+namespace webmlive {
+
+// Second video input drawn over the main one, a presenter camera over a
+// screen capture for example.
+struct PictureInPictureConfig {
+  static const int32 kDefaultMargin = -16;
+  static const int kDefaultMaxSkewMs = 500;
+
+  PictureInPictureConfig()
+      : x(kDefaultMargin),
+        y(kDefaultMargin),
+        width(0),
+        height(0),
+        opacity_percent(100),
+        max_skew_ms(kDefaultMaxSkewMs) {}
+
+  // Capture device of the overlay. Empty disables picture in picture.
+  std::string device_name;
+
+  // Position of the overlay's top left corner in the main frame, in pixels.
+  // Negative values place its right edge |-x| pixels from the right of the
+  // frame, and its bottom edge |-y| pixels from the bottom.
+  int32 x;
+  int32 y;
+
+  // Size of the overlay in the main frame. A |width| of 0 is a quarter of
+  // the main frame's width, and a |height| of 0 keeps the overlay's aspect
+  // ratio.
+  int32 width;
+  int32 height;
+
+  // Opacity of the overlay, from 0 to 100.
+  int opacity_percent;
+
+  // Largest difference between the timestamps of a main frame and the
+  // overlay frame drawn over it. Main frames without an overlay frame that
+  // close, while the overlay source starts or after it stalls, are passed on
+  // as captured.
+  int max_skew_ms;
+};
+
+// Composites two video sources into the frames passed to one frame callback.
+// Main frames drive the output: each is passed on once the overlay frame
+// closest to it in time is blended over it in place, so the output has the
+// main source's size and frame rate. Overlay frames are scaled to the
+// overlay rectangle when they arrive, on the overlay source's thread, into
+// pooled frames that stay shared until a newer frame replaces them.
+//
+//   PipCompositor compositor;
+//   compositor.Init(pip_config, main_source_config, ptr_encoder_callback);
+//   main_source.Init(..., compositor.main_input());
+//   overlay_source.Init(..., compositor.overlay_input());
+//
+// Notes
+// - Both sources must timestamp frames on the same clock.
+// - Only 8 bit I420 and YV12 frames are composited. Main frames of other
+//   formats pass through, and overlay frames of other formats are dropped.
+// - Frames held in |VideoSurface|s are scaled and composited by their
+//   device when main and overlay share one. Otherwise they are read back
+//   and composited in memory.
+// - Composited frames lose their region hints.
+// - Thread safe: each input may be called from its own thread.
+class PipCompositor {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Scaled overlay frames kept for matching with main frames.
+  static const int kMaxOverlayFrames = 4;
+
+  PipCompositor();
+  ~PipCompositor() {}
+
+  // Sizes the overlay of |config| for frames of |main_config| size, and
+  // stores |ptr_callback|, which receives the composited frames. The overlay
+  // is kept within the main frame, with its edges on even pixels. Returns
+  // |kSuccess| when successful.
+  int Init(const PictureInPictureConfig& config, const VideoConfig& main_config,
+           VideoFrameCallbackInterface* ptr_callback);
+
+  // Frame callbacks of the two sources.
+  VideoFrameCallbackInterface* main_input() { return &main_input_; }
+  VideoFrameCallbackInterface* overlay_input() { return &overlay_input_; }
+
+ private:
+  // Routes the frames of one source to the compositor.
+  class Input : public VideoFrameCallbackInterface {
+   public:
+    Input(PipCompositor* ptr_compositor, bool overlay)
+        : ptr_compositor_(ptr_compositor), overlay_(overlay) {}
+    virtual ~Input() {}
+    virtual int OnVideoFrameReceived(VideoFrame* ptr_frame);
+
+   private:
+    PipCompositor* const ptr_compositor_;
+    const bool overlay_;
+  };
+
+  // Plane pointers and strides of an I420 or YV12 frame, U and V in I420
+  // order.
+  struct Planes {
+    uint8* y;
+    uint8* u;
+    uint8* v;
+    int32 y_stride;
+    int32 uv_stride;
+  };
+
+  // Returns true when |frame| is 8 bit I420 or YV12 in memory, with chroma
+  // planes of equal stride, and stores its planes in |ptr_planes|.
+  static bool GetPlanes(const VideoFrame& frame, Planes* ptr_planes);
+
+  // Blends the matching overlay frame over |ptr_frame|, and passes it on.
+  int OnMainFrame(VideoFrame* ptr_frame);
+
+  // Draws |overlay| over |ptr_frame|. Returns false when either frame cannot
+  // be composited.
+  bool Composite(const VideoFrame& overlay, VideoFrame* ptr_frame);
+
+  // Scales |ptr_frame| to the overlay size, and adds it to |overlays_|.
+  int OnOverlayFrame(VideoFrame* ptr_frame);
+
+  // Shares |scaled_frame_| through |pool_| and adds it to |overlays_|.
+  int AddOverlay();
+
+  // Stores the position of a |width| x |height| overlay in a main frame of
+  // |frame_width| x |frame_height| in |ptr_left| and |ptr_top|.
+  void PlaceOverlay(int32 width, int32 height, int32 frame_width,
+                    int32 frame_height, int32* ptr_left,
+                    int32* ptr_top) const;
+
+  // Returns the overlay frame closest in time to |timestamp|, or NULL when
+  // none is within |max_skew_ms|.
+  SharedVideoFrame FindOverlay(int64 timestamp);
+
+  Input main_input_;
+  Input overlay_input_;
+  VideoFrameCallbackInterface* ptr_callback_;
+
+  // Overlay placement from |PictureInPictureConfig|, with |width_| and the
+  // main frame size resolved; |height_| is 0 to keep the aspect ratio.
+  // |alpha_| is the opacity in [0, |kOpaqueAlpha|].
+  int32 x_;
+  int32 y_;
+  int32 width_;
+  int32 height_;
+  int32 main_width_;
+  int32 main_height_;
+  int alpha_;
+  int max_skew_ms_;
+
+  // Storage of the frame being scaled, which |pool_| exchanges for that of
+  // a released overlay frame. Used only by the overlay source's thread.
+  // Declared before |overlays_| so that the pool outlives its handles.
+  VideoFramePool pool_;
+  VideoFrame scaled_frame_;
+
+  // Overlay frames read back from surfaces. Used only by the main source's
+  // thread.
+  VideoFrame overlay_readback_;
+
+  // Scaled overlay frames, oldest first. Protected by |mutex_|.
+  std::mutex mutex_;
+  std::deque<SharedVideoFrame> overlays_;
+
+  // True while main frames are passed on without an overlay. Used only by
+  // the main source's thread, to log changes.
+  bool overlay_missing_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(PipCompositor);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_PIP_COMPOSITOR_H_
@@ -0,0 +1,81 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/pool_sizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+PoolSizer::PoolSizer()
+    : min_buffers_(0),
+      max_buffers_(0),
+      buffers_per_second_(0),
+      limit_(0),
+      window_peak_(0),
+      window_start_ms_(-1) {
+}
+
+int PoolSizer::Init(int32 min_buffers, int32 initial_buffers,
+                    int32 max_buffers, double buffers_per_second) {
+  if (min_buffers <= 0 || initial_buffers < min_buffers ||
+      max_buffers < initial_buffers || buffers_per_second <= 0) {
+    LOG(ERROR) << "invalid pool sizes: min=" << min_buffers << " initial="
+               << initial_buffers << " max=" << max_buffers << " rate="
+               << buffers_per_second;
+    return kInvalidArg;
+  }
+  min_buffers_ = min_buffers;
+  max_buffers_ = max_buffers;
+  buffers_per_second_ = buffers_per_second;
+  limit_ = initial_buffers;
+  window_peak_ = 0;
+  window_start_ms_ = -1;
+  return kSuccess;
+}
+
+bool PoolSizer::Update(int64 time_ms, int64 service_time_ms, int32 queued,
+                       bool dropped) {
+  if (limit_ <= 0) {
+    return false;
+  }
+  const int32 arrivals = static_cast<int32>(
+      std::ceil(service_time_ms * buffers_per_second_ / 1000.0));
+  const int32 needed = std::max(queued, arrivals);
+  int32 wanted = needed + needed / 2 + 1;
+  if (dropped) {
+    wanted = std::max(wanted, limit_ * 2);
+  }
+  wanted = std::max(min_buffers_, std::min(wanted, max_buffers_));
+
+  if (window_start_ms_ < 0) {
+    window_start_ms_ = time_ms;
+  }
+  window_peak_ = std::max(window_peak_, wanted);
+
+  const int32 old_limit = limit_;
+  if (wanted > limit_) {
+    limit_ = wanted;
+  } else if (time_ms - window_start_ms_ >= kShrinkWindowMs) {
+    limit_ = window_peak_;
+  }
+  if (time_ms - window_start_ms_ >= kShrinkWindowMs) {
+    window_start_ms_ = time_ms;
+    window_peak_ = 0;
+  }
+  if (limit_ != old_limit) {
+    VLOG(1) << "pool limit " << old_limit << " -> " << limit_
+            << " (queued=" << queued << " service_time_ms="
+            << service_time_ms << (dropped ? " dropped)" : ")");
+  }
+  return limit_ != old_limit;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,67 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_POOL_SIZER_H_
+#define WEBMLIVE_ENCODER_POOL_SIZER_H_
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Chooses the |BufferPool::SetLimit()| value for a pool filled by a capture
+// thread and drained by the encoder thread.
+//
+// The pool must hold the buffers that arrive while the encoder thread is busy,
+// so each drain reports how long the thread's previous pass took and how many
+// buffers were waiting. The limit covers the larger of the two with 50%
+// headroom, and doubles when buffers were dropped. It grows at once, and
+// shrinks back to the peak of the last |kShrinkWindowMs| when that is lower.
+// The limit always stays within [min_buffers, max_buffers]; |max_buffers| is
+// derived from a memory budget by the caller.
+class PoolSizer {
+ public:
+  enum {
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Time the limit must be too large for before it shrinks.
+  static const int64 kShrinkWindowMs = 10000;
+
+  PoolSizer();
+  ~PoolSizer() {}
+
+  // Sets the limit bounds and the rate at which buffers arrive. The limit
+  // starts at |initial_buffers|. Returns |kSuccess| when successful.
+  int Init(int32 min_buffers, int32 initial_buffers, int32 max_buffers,
+           double buffers_per_second);
+
+  // Records a drain of the pool at |time_ms| that found |queued| buffers,
+  // after a pass of the encoder thread that took |service_time_ms|. |dropped|
+  // is true when buffers were dropped since the previous drain. Returns true
+  // when |limit()| changed.
+  bool Update(int64 time_ms, int64 service_time_ms, int32 queued,
+              bool dropped);
+
+  int32 limit() const { return limit_; }
+  int32 max_buffers() const { return max_buffers_; }
+
+ private:
+  int32 min_buffers_;
+  int32 max_buffers_;
+  double buffers_per_second_;
+  int32 limit_;
+
+  // Largest limit wanted since |window_start_ms_|.
+  int32 window_peak_;
+  int64 window_start_ms_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(PoolSizer);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_POOL_SIZER_H_
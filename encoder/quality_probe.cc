@@ -0,0 +1,377 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/quality_probe.h"
+
+#include <cmath>
+#include <functional>
+#include <new>
+
+#include "encoder/metrics.h"
+#include "glog/logging.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WEBMLIVE_HAVE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define WEBMLIVE_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+namespace webmlive {
+
+namespace {
+// PSNR reported for identical planes.
+const double kMaxPsnr = 100.0;
+
+// SSIM window size and spacing, and the window's sample count.
+const int32 kSsimWindow = 8;
+const int32 kSsimStep = 4;
+const int64 kSsimCount = kSsimWindow * kSsimWindow;
+
+// SSIM stabilizing constants, (0.01 * 255)^2 and (0.03 * 255)^2, scaled by
+// the square of |kSsimCount| for use with sums rather than means.
+const double kSsimC1 = 6.5025 * kSsimCount * kSsimCount;
+const double kSsimC2 = 58.5225 * kSsimCount * kSsimCount;
+
+// Sums over an SSIM window of two planes.
+struct WindowSums {
+  uint32 sum_a;
+  uint32 sum_b;
+  uint32 sum_sq_a;
+  uint32 sum_sq_b;
+  uint32 sum_ab;
+};
+
+// Vector loops. |RowSquaredError()| returns the squared error of the first
+// multiple of 16 samples of a row, and stores their count in |ptr_done|; the
+// caller measures the remainder. |SumWindow()| measures a whole window.
+#if defined(WEBMLIVE_HAVE_SSE2)
+uint32 HorizontalSum(__m128i sums) {
+  sums = _mm_add_epi32(sums, _mm_srli_si128(sums, 8));
+  sums = _mm_add_epi32(sums, _mm_srli_si128(sums, 4));
+  return static_cast<uint32>(_mm_cvtsi128_si32(sums));
+}
+
+uint32 RowSquaredError(const uint8* ptr_a, const uint8* ptr_b, int32 width,
+                       int32* ptr_done) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sums = zero;
+  int32 i = 0;
+  for (; i + 16 <= width; i += 16) {
+    const __m128i a =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_a + i));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr_b + i));
+    const __m128i diff_lo = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero),
+                                          _mm_unpacklo_epi8(b, zero));
+    const __m128i diff_hi = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero),
+                                          _mm_unpackhi_epi8(b, zero));
+    sums = _mm_add_epi32(sums, _mm_madd_epi16(diff_lo, diff_lo));
+    sums = _mm_add_epi32(sums, _mm_madd_epi16(diff_hi, diff_hi));
+  }
+  *ptr_done = i;
+  return HorizontalSum(sums);
+}
+
+void SumWindow(const uint8* ptr_a, int32 a_stride,
+               const uint8* ptr_b, int32 b_stride, WindowSums* ptr_sums) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sum_a = zero;
+  __m128i sum_b = zero;
+  __m128i sum_sq_a = zero;
+  __m128i sum_sq_b = zero;
+  __m128i sum_ab = zero;
+  for (int32 row = 0; row < kSsimWindow; ++row) {
+    const __m128i a = _mm_unpacklo_epi8(
+        _mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(ptr_a + row * a_stride)),
+        zero);
+    const __m128i b = _mm_unpacklo_epi8(
+        _mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(ptr_b + row * b_stride)),
+        zero);
+    sum_a = _mm_add_epi16(sum_a, a);
+    sum_b = _mm_add_epi16(sum_b, b);
+    sum_sq_a = _mm_add_epi32(sum_sq_a, _mm_madd_epi16(a, a));
+    sum_sq_b = _mm_add_epi32(sum_sq_b, _mm_madd_epi16(b, b));
+    sum_ab = _mm_add_epi32(sum_ab, _mm_madd_epi16(a, b));
+  }
+  const __m128i ones = _mm_set1_epi16(1);
+  ptr_sums->sum_a = HorizontalSum(_mm_madd_epi16(sum_a, ones));
+  ptr_sums->sum_b = HorizontalSum(_mm_madd_epi16(sum_b, ones));
+  ptr_sums->sum_sq_a = HorizontalSum(sum_sq_a);
+  ptr_sums->sum_sq_b = HorizontalSum(sum_sq_b);
+  ptr_sums->sum_ab = HorizontalSum(sum_ab);
+}
+#elif defined(WEBMLIVE_HAVE_NEON)
+uint32 HorizontalSum(uint32x4_t sums) {
+  const uint64x2_t pairs = vpaddlq_u32(sums);
+  return static_cast<uint32>(vgetq_lane_u64(pairs, 0) +
+                             vgetq_lane_u64(pairs, 1));
+}
+
+uint32 RowSquaredError(const uint8* ptr_a, const uint8* ptr_b, int32 width,
+                       int32* ptr_done) {
+  uint32x4_t sums = vdupq_n_u32(0);
+  int32 i = 0;
+  for (; i + 16 <= width; i += 16) {
+    const uint8x16_t diff = vabdq_u8(vld1q_u8(ptr_a + i), vld1q_u8(ptr_b + i));
+    sums = vpadalq_u16(sums, vmull_u8(vget_low_u8(diff), vget_low_u8(diff)));
+    sums = vpadalq_u16(sums,
+                       vmull_u8(vget_high_u8(diff), vget_high_u8(diff)));
+  }
+  *ptr_done = i;
+  return HorizontalSum(sums);
+}
+
+void SumWindow(const uint8* ptr_a, int32 a_stride,
+               const uint8* ptr_b, int32 b_stride, WindowSums* ptr_sums) {
+  uint16x8_t sum_a = vdupq_n_u16(0);
+  uint16x8_t sum_b = vdupq_n_u16(0);
+  uint32x4_t sum_sq_a = vdupq_n_u32(0);
+  uint32x4_t sum_sq_b = vdupq_n_u32(0);
+  uint32x4_t sum_ab = vdupq_n_u32(0);
+  for (int32 row = 0; row < kSsimWindow; ++row) {
+    const uint8x8_t a = vld1_u8(ptr_a + row * a_stride);
+    const uint8x8_t b = vld1_u8(ptr_b + row * b_stride);
+    sum_a = vaddw_u8(sum_a, a);
+    sum_b = vaddw_u8(sum_b, b);
+    sum_sq_a = vpadalq_u16(sum_sq_a, vmull_u8(a, a));
+    sum_sq_b = vpadalq_u16(sum_sq_b, vmull_u8(b, b));
+    sum_ab = vpadalq_u16(sum_ab, vmull_u8(a, b));
+  }
+  ptr_sums->sum_a = HorizontalSum(vpaddlq_u16(sum_a));
+  ptr_sums->sum_b = HorizontalSum(vpaddlq_u16(sum_b));
+  ptr_sums->sum_sq_a = HorizontalSum(sum_sq_a);
+  ptr_sums->sum_sq_b = HorizontalSum(sum_sq_b);
+  ptr_sums->sum_ab = HorizontalSum(sum_ab);
+}
+#else
+uint32 RowSquaredError(const uint8*, const uint8*, int32, int32* ptr_done) {
+  *ptr_done = 0;
+  return 0;
+}
+
+void SumWindow(const uint8* ptr_a, int32 a_stride,
+               const uint8* ptr_b, int32 b_stride, WindowSums* ptr_sums) {
+  WindowSums sums = {0};
+  for (int32 row = 0; row < kSsimWindow; ++row) {
+    const uint8* const a = ptr_a + row * a_stride;
+    const uint8* const b = ptr_b + row * b_stride;
+    for (int32 col = 0; col < kSsimWindow; ++col) {
+      sums.sum_a += a[col];
+      sums.sum_b += b[col];
+      sums.sum_sq_a += a[col] * a[col];
+      sums.sum_sq_b += b[col] * b[col];
+      sums.sum_ab += a[col] * b[col];
+    }
+  }
+  *ptr_sums = sums;
+}
+#endif
+
+// Returns the SSIM of a window from its sums.
+double WindowSsim(const WindowSums& sums) {
+  const double sum_a = sums.sum_a;
+  const double sum_b = sums.sum_b;
+  const double count = static_cast<double>(kSsimCount);
+  const double numerator =
+      (2 * sum_a * sum_b + kSsimC1) *
+      (2 * count * sums.sum_ab - 2 * sum_a * sum_b + kSsimC2);
+  const double denominator =
+      (sum_a * sum_a + sum_b * sum_b + kSsimC1) *
+      (count * sums.sum_sq_a + count * sums.sum_sq_b - sum_a * sum_a -
+       sum_b * sum_b + kSsimC2);
+  return numerator / denominator;
+}
+}  // namespace
+
+int64 PlaneSquaredError(const uint8* ptr_a, int32 a_stride,
+                        const uint8* ptr_b, int32 b_stride,
+                        int32 width, int32 height) {
+  int64 squared_error = 0;
+  for (int32 row = 0; row < height; ++row) {
+    const uint8* const a = ptr_a + row * a_stride;
+    const uint8* const b = ptr_b + row * b_stride;
+    int32 col = 0;
+    squared_error += RowSquaredError(a, b, width, &col);
+    for (; col < width; ++col) {
+      const int32 diff = a[col] - b[col];
+      squared_error += diff * diff;
+    }
+  }
+  return squared_error;
+}
+
+double PlanePsnr(int64 squared_error, int64 num_samples) {
+  if (squared_error <= 0 || num_samples <= 0)
+    return kMaxPsnr;
+  const double psnr = 10.0 * std::log10(255.0 * 255.0 * num_samples /
+                                        squared_error);
+  return psnr < kMaxPsnr ? psnr : kMaxPsnr;
+}
+
+double PlaneSsim(const uint8* ptr_a, int32 a_stride,
+                 const uint8* ptr_b, int32 b_stride,
+                 int32 width, int32 height) {
+  double total = 0;
+  int64 num_windows = 0;
+  for (int32 row = 0; row + kSsimWindow <= height; row += kSsimStep) {
+    for (int32 col = 0; col + kSsimWindow <= width; col += kSsimStep) {
+      WindowSums sums;
+      SumWindow(ptr_a + row * a_stride + col, a_stride,
+                ptr_b + row * b_stride + col, b_stride, &sums);
+      total += WindowSsim(sums);
+      ++num_windows;
+    }
+  }
+  if (num_windows == 0) {
+    return PlaneSquaredError(ptr_a, a_stride, ptr_b, b_stride, width,
+                             height) == 0 ? 1.0 : 0.0;
+  }
+  return total / num_windows;
+}
+
+QualityProbe::QualityProbe()
+    : state_(kIdle),
+      stop_(false),
+      ptr_psnr_(NULL),
+      ptr_ssim_(NULL),
+      ptr_samples_(NULL),
+      ptr_skipped_(NULL) {
+}
+
+QualityProbe::~QualityProbe() {
+  if (probe_thread_) {
+    Stop();
+  }
+}
+
+int QualityProbe::Init(const std::string& labels) {
+  if (probe_thread_) {
+    LOG(ERROR) << "QualityProbe already running.";
+    return kThreadError;
+  }
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  ptr_psnr_ = registry.GetGauge(
+      "webmlive_video_quality_psnr_centidecibels", labels,
+      "Luma PSNR of the latest sampled frame, in hundredths of a dB.");
+  ptr_ssim_ = registry.GetGauge(
+      "webmlive_video_quality_ssim_ten_thousandths", labels,
+      "Luma SSIM of the latest sampled frame, in ten thousandths.");
+  ptr_samples_ = registry.GetCounter(
+      "webmlive_video_quality_samples_total", labels,
+      "Frames measured by the quality probe.");
+  ptr_skipped_ = registry.GetCounter(
+      "webmlive_video_quality_samples_skipped_total", labels,
+      "Frames not measured because the quality probe was busy.");
+  if (!ptr_psnr_ || !ptr_ssim_ || !ptr_samples_ || !ptr_skipped_) {
+    LOG(ERROR) << "QualityProbe cannot create metrics.";
+    return kNoMemory;
+  }
+
+  stop_ = false;
+  state_ = kIdle;
+  using std::bind;
+  using std::nothrow;
+  using std::thread;
+  probe_thread_.reset(
+      new (nothrow) thread(bind(&QualityProbe::ProbeThread, this)));  // NOLINT
+  if (!probe_thread_) {
+    LOG(ERROR) << "QualityProbe cannot construct thread.";
+    return kThreadError;
+  }
+  return kSuccess;
+}
+
+QualityProbe::Planes* QualityProbe::AcquirePlanes(int32 width,
+                                                  int32 height) {
+  if (width <= 0 || height <= 0) {
+    return NULL;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_ || state_ != kIdle) {
+      if (ptr_skipped_)
+        ptr_skipped_->Increment(1);
+      return NULL;
+    }
+    state_ = kAcquired;
+  }
+
+  // The thread leaves |planes_| alone until |SubmitPlanes()|.
+  const size_t luma_size = static_cast<size_t>(width) * height;
+  const size_t chroma_size =
+      static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2);
+  planes_.width = width;
+  planes_.height = height;
+  planes_.raw.resize(luma_size);
+  planes_.reconstructed.resize(luma_size + 2 * chroma_size);
+  return &planes_;
+}
+
+void QualityProbe::SubmitPlanes() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CHECK_EQ(state_, kAcquired);
+    state_ = kPending;
+  }
+  planes_submitted_.notify_one();
+}
+
+void QualityProbe::DiscardPlanes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK_EQ(state_, kAcquired);
+  state_ = kIdle;
+}
+
+void QualityProbe::Stop() {
+  CHECK(probe_thread_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  planes_submitted_.notify_one();
+  probe_thread_->join();
+  probe_thread_.reset();
+}
+
+void QualityProbe::ProbeThread() {
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      planes_submitted_.wait(
+          lock, [this] { return stop_ || state_ == kPending; });
+      if (state_ != kPending)
+        return;
+      state_ = kMeasuring;
+    }
+
+    const int32 width = planes_.width;
+    const int32 height = planes_.height;
+    const uint8* const ptr_raw = &planes_.raw[0];
+    const uint8* const ptr_reconstructed = &planes_.reconstructed[0];
+    const int64 squared_error = PlaneSquaredError(
+        ptr_raw, width, ptr_reconstructed, width, width, height);
+    const double psnr =
+        PlanePsnr(squared_error, static_cast<int64>(width) * height);
+    const double ssim =
+        PlaneSsim(ptr_raw, width, ptr_reconstructed, width, width, height);
+    ptr_psnr_->Set(static_cast<int64>(psnr * 100 + 0.5));
+    ptr_ssim_->Set(static_cast<int64>(ssim * 10000 + 0.5));
+    ptr_samples_->Increment(1);
+    VLOG(2) << "quality @ " << planes_.timestamp << "ms: PSNR " << psnr
+            << " dB, SSIM " << ssim;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    state_ = kIdle;
+  }
+}
+
+}  // namespace webmlive
@@ -0,0 +1,123 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_QUALITY_PROBE_H_
+#define WEBMLIVE_ENCODER_QUALITY_PROBE_H_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+class Metric;
+
+// Returns the sum of squared differences between the |width| by |height|
+// 8 bit planes at |ptr_a| and |ptr_b|. Uses SSE2 or NEON when the target
+// supports them.
+int64 PlaneSquaredError(const uint8* ptr_a, int32 a_stride,
+                        const uint8* ptr_b, int32 b_stride,
+                        int32 width, int32 height);
+
+// Returns the PSNR, in dB, of a plane of |num_samples| 8 bit samples with
+// |squared_error|. Identical planes return 100 dB, as libvpx reports them.
+double PlanePsnr(int64 squared_error, int64 num_samples);
+
+// Returns the mean SSIM of the |width| by |height| 8 bit planes at |ptr_a| and
+// |ptr_b|, over 8x8 windows placed every 4 samples like libvpx's. Planes
+// smaller than a window return 1 when identical, and 0 otherwise.
+double PlaneSsim(const uint8* ptr_a, int32 a_stride,
+                 const uint8* ptr_b, int32 b_stride,
+                 int32 width, int32 height);
+
+// Measures encode quality in a live pipeline: the PSNR and SSIM of the luma
+// plane of the encoder's reconstruction of a frame against the raw frame.
+// The encoder copies both planes into storage from |AcquirePlanes()|, and
+// a thread of the probe's own measures them and sets the metrics.
+//
+// Notes
+// - One sample is measured at a time. |AcquirePlanes()| returns NULL while
+//   the thread is busy, and the encoder skips the sample rather than wait.
+// - Metrics are gauges holding the latest sample: PSNR in hundredths of a
+//   dB, and SSIM in ten thousandths.
+class QualityProbe {
+ public:
+  enum {
+    kThreadError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Luma planes of a sample, stored without row padding. |reconstructed| is
+  // sized for a whole I420 frame, since libvpx copies reference frames
+  // complete.
+  struct Planes {
+    Planes() : width(0), height(0), timestamp(0) {}
+    int32 width;
+    int32 height;
+    int64 timestamp;
+    std::vector<uint8> raw;
+    std::vector<uint8> reconstructed;
+  };
+
+  QualityProbe();
+  ~QualityProbe();
+
+  // Creates the metrics with |labels| and starts the thread. Returns
+  // |kSuccess| when successful.
+  int Init(const std::string& labels);
+
+  // Returns storage for the planes of a |width| by |height| sample, or NULL
+  // when the previous sample is still being measured. The caller fills the
+  // planes, and passes them to |SubmitPlanes()|.
+  Planes* AcquirePlanes(int32 width, int32 height);
+
+  // Queues the planes returned by |AcquirePlanes()| for measurement.
+  void SubmitPlanes();
+
+  // Returns the planes from |AcquirePlanes()| unmeasured, for samples the
+  // encoder could not complete.
+  void DiscardPlanes();
+
+  // Stops the thread. The sample being measured is completed first.
+  void Stop();
+
+ private:
+  enum State {
+    kIdle = 0,
+    // Returned by |AcquirePlanes()|, and being filled.
+    kAcquired = 1,
+    kPending = 2,
+    kMeasuring = 3,
+  };
+
+  // Waits for submitted planes and measures them until |Stop()|.
+  void ProbeThread();
+
+  std::mutex mutex_;
+  std::condition_variable planes_submitted_;
+  State state_;
+  bool stop_;
+  Planes planes_;
+  std::unique_ptr<std::thread> probe_thread_;
+
+  Metric* ptr_psnr_;
+  Metric* ptr_ssim_;
+  Metric* ptr_samples_;
+  Metric* ptr_skipped_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(QualityProbe);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_QUALITY_PROBE_H_
@@ -0,0 +1,321 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/rate_control_telemetry.h"
+
+#include <atomic>
+#include <new>
+#include <sstream>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+// Single producer, single consumer queue of |VideoFrameStats|. The encoder
+// writes records and advances |head|; |Collect()| reads them and advances
+// |tail|. The other members belong to |Collect()|, and are guarded by the
+// telemetry's mutex.
+class RateControlTelemetry::Queue {
+ public:
+  Queue(int32 width, int32 height, int32 target_kbps)
+      : width(width),
+        height(height),
+        target_kbps(target_kbps),
+        head(0),
+        tail(0),
+        dropped(0),
+        released(false),
+        representation(-1),
+        quantizer_anchor(-1),
+        quantizer_direction(0) {}
+
+  const int32 width;
+  const int32 height;
+  const int32 target_kbps;
+  std::atomic<uint32> head;
+  std::atomic<uint32> tail;
+  std::atomic<int64> dropped;
+  VideoFrameStats records[RateControlTelemetry::kQueueSize];
+
+  // Set by |RemoveProducer()|.
+  bool released;
+
+  // Index of the queue's stats in |RateControlStats::representations|, or
+  // -1 before the first record.
+  int representation;
+
+  // Quantizer at the end of the latest move, and the direction of that
+  // move: 1 up, -1 down, or 0 before the first.
+  int32 quantizer_anchor;
+  int32 quantizer_direction;
+};
+
+namespace {
+// Returns the upper bound of the quantizer bucket holding the |percentile|
+// quantizer of |stats|.
+int QuantizerPercentile(const RepresentationRateStats& stats,
+                        double percentile) {
+  if (stats.quantizer_count == 0)
+    return 0;
+  const double target = stats.quantizer_count * percentile / 100.0;
+  int64 seen = 0;
+  for (int i = 0; i < RepresentationRateStats::kNumQuantizerBuckets; ++i) {
+    seen += stats.quantizer_buckets[i];
+    if (seen >= target && seen > 0)
+      return i * 4 + 3;
+  }
+  return RepresentationRateStats::kNumQuantizerBuckets * 4 - 1;
+}
+}  // namespace
+
+//
+// PercentHistogram
+//
+const int32 PercentHistogram::kUpperBounds[kNumBuckets - 1] = {
+  25, 50, 75, 90, 110, 125, 150, 200, 300,
+};
+
+PercentHistogram::PercentHistogram() : count(0), total(0), max(0) {
+  for (int i = 0; i < kNumBuckets; ++i)
+    buckets[i] = 0;
+}
+
+void PercentHistogram::Add(int64 percent) {
+  if (percent < 0)
+    percent = 0;
+  int bucket = 0;
+  while (bucket < kNumBuckets - 1 && percent >= kUpperBounds[bucket])
+    ++bucket;
+  ++buckets[bucket];
+  ++count;
+  total += percent;
+  if (percent > max)
+    max = percent;
+}
+
+int64 PercentHistogram::Percentile(double percentile) const {
+  if (count == 0)
+    return 0;
+  const double target = count * percentile / 100.0;
+  int64 seen = 0;
+  for (int i = 0; i < kNumBuckets - 1; ++i) {
+    seen += buckets[i];
+    if (seen >= target && seen > 0)
+      return kUpperBounds[i] < max ? kUpperBounds[i] : max;
+  }
+  return max;
+}
+
+//
+// RepresentationRateStats
+//
+RepresentationRateStats::RepresentationRateStats()
+    : width(0),
+      height(0),
+      target_kbps(0),
+      frames(0),
+      dropped_frames(0),
+      decimated_frames(0),
+      static_frames(0),
+      keyframes(0),
+      forced_keyframes(0),
+      quantizer_total(0),
+      quantizer_count(0),
+      quantizer_reversals(0) {
+  for (int i = 0; i < kNumQuantizerBuckets; ++i)
+    quantizer_buckets[i] = 0;
+}
+
+std::string RepresentationRateStats::ToString() const {
+  std::ostringstream out;
+  out << width << "x" << height << "@" << target_kbps << "kbps: frames="
+      << frames << " dropped=" << dropped_frames << " decimated="
+      << decimated_frames << " static=" << static_frames << " keyframes="
+      << keyframes << " forced=" << forced_keyframes;
+  if (quantizer_count > 0) {
+    out << " q_mean=" << quantizer_total / static_cast<double>(quantizer_count)
+        << " q_p50<=" << QuantizerPercentile(*this, 50)
+        << " q_p95<=" << QuantizerPercentile(*this, 95)
+        << " q_reversals=" << quantizer_reversals;
+  }
+  if (size_to_target.count > 0) {
+    out << " size_p50<=" << size_to_target.Percentile(50) << "%"
+        << " size_p95<=" << size_to_target.Percentile(95) << "%"
+        << " size_max=" << size_to_target.max << "%";
+  }
+  if (encode_time_to_duration.count > 0) {
+    out << " encode_p50<=" << encode_time_to_duration.Percentile(50) << "%"
+        << " encode_p99<=" << encode_time_to_duration.Percentile(99) << "%"
+        << " encode_max=" << encode_time_to_duration.max << "%";
+  }
+  return out.str();
+}
+
+//
+// RateControlStats
+//
+std::string RateControlStats::ToString() const {
+  std::ostringstream out;
+  for (int i = 0; i < num_representations; ++i)
+    out << representations[i].ToString() << "\n";
+  out << "dropped_records=" << dropped_records << "\n";
+  return out.str();
+}
+
+//
+// RateControlTelemetry
+//
+RateControlTelemetry::RateControlTelemetry() {
+}
+
+RateControlTelemetry::~RateControlTelemetry() {
+}
+
+RateControlTelemetry::Queue* RateControlTelemetry::AddProducer(
+    int32 width, int32 height, int32 target_kbps) {
+  std::unique_ptr<Queue> queue(
+      new (std::nothrow) Queue(width, height, target_kbps));  // NOLINT
+  if (!queue) {
+    LOG(ERROR) << "RateControlTelemetry cannot allocate queue.";
+    return NULL;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  queues_.push_back(std::move(queue));
+  return queues_.back().get();
+}
+
+void RateControlTelemetry::RemoveProducer(Queue* ptr_queue) {
+  if (!ptr_queue)
+    return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  ptr_queue->released = true;
+}
+
+void RateControlTelemetry::Record(Queue* ptr_queue,
+                                  const VideoFrameStats& stats) {
+  const uint32 head = ptr_queue->head.load(std::memory_order_relaxed);
+  const uint32 tail = ptr_queue->tail.load(std::memory_order_acquire);
+  if (head - tail >= static_cast<uint32>(kQueueSize)) {
+    ptr_queue->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  ptr_queue->records[head % kQueueSize] = stats;
+  ptr_queue->head.store(head + 1, std::memory_order_release);
+}
+
+void RateControlTelemetry::Collect() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < queues_.size();) {
+    Queue* const ptr_queue = queues_[i].get();
+
+    // A released queue gets no more records once this one is seen.
+    const bool released = ptr_queue->released;
+    const uint32 head = ptr_queue->head.load(std::memory_order_acquire);
+    uint32 tail = ptr_queue->tail.load(std::memory_order_relaxed);
+    for (; tail != head; ++tail)
+      AddRecord(ptr_queue, ptr_queue->records[tail % kQueueSize]);
+    ptr_queue->tail.store(tail, std::memory_order_release);
+    stats_.dropped_records +=
+        ptr_queue->dropped.exchange(0, std::memory_order_relaxed);
+    if (released) {
+      queues_.erase(queues_.begin() + i);
+    } else {
+      ++i;
+    }
+  }
+}
+
+RateControlStats RateControlTelemetry::stats() {
+  Collect();
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void RateControlTelemetry::AddRecord(Queue* ptr_queue,
+                                     const VideoFrameStats& record) {
+  if (ptr_queue->representation < 0) {
+    for (int i = 0; i < stats_.num_representations; ++i) {
+      const RepresentationRateStats& stats = stats_.representations[i];
+      if (stats.width == ptr_queue->width &&
+          stats.height == ptr_queue->height &&
+          stats.target_kbps == ptr_queue->target_kbps) {
+        ptr_queue->representation = i;
+        break;
+      }
+    }
+  }
+  if (ptr_queue->representation < 0) {
+    if (stats_.num_representations == RateControlStats::kMaxRepresentations) {
+      ++stats_.dropped_records;
+      return;
+    }
+    ptr_queue->representation = stats_.num_representations++;
+    RepresentationRateStats& stats =
+        stats_.representations[ptr_queue->representation];
+    stats.width = ptr_queue->width;
+    stats.height = ptr_queue->height;
+    stats.target_kbps = ptr_queue->target_kbps;
+  }
+
+  RepresentationRateStats& stats =
+      stats_.representations[ptr_queue->representation];
+  ++stats.frames;
+  if (record.flags & VideoFrameStats::kDecimated) {
+    ++stats.decimated_frames;
+    return;
+  }
+  if (record.flags & VideoFrameStats::kStatic) {
+    ++stats.static_frames;
+    return;
+  }
+  if (record.flags & VideoFrameStats::kDropped)
+    ++stats.dropped_frames;
+  if (record.flags & VideoFrameStats::kKeyframe)
+    ++stats.keyframes;
+  if (record.flags & VideoFrameStats::kForcedKeyframe)
+    ++stats.forced_keyframes;
+  if (record.duration > 0) {
+    stats.encode_time_to_duration.Add(record.encode_time_us /
+                                      (10 * static_cast<int64>(
+                                          record.duration)));
+  }
+  if (record.frame_bytes > 0 && record.target_bytes > 0) {
+    stats.size_to_target.Add(record.frame_bytes * static_cast<int64>(100) /
+                             record.target_bytes);
+  }
+
+  const int32 quantizer = record.quantizer;
+  if (quantizer < 0)
+    return;
+  int bucket = quantizer / 4;
+  if (bucket >= RepresentationRateStats::kNumQuantizerBuckets)
+    bucket = RepresentationRateStats::kNumQuantizerBuckets - 1;
+  ++stats.quantizer_buckets[bucket];
+  stats.quantizer_total += quantizer;
+  ++stats.quantizer_count;
+
+  // Follow the quantizer's moves: extend the latest one, or start a new one
+  // once the quantizer has moved |kQuantizerSwing| the other way.
+  if (ptr_queue->quantizer_anchor < 0) {
+    ptr_queue->quantizer_anchor = quantizer;
+    return;
+  }
+  const int32 delta = quantizer - ptr_queue->quantizer_anchor;
+  const int32 direction = delta > 0 ? 1 : (delta < 0 ? -1 : 0);
+  if (direction == 0)
+    return;
+  if (direction == ptr_queue->quantizer_direction) {
+    ptr_queue->quantizer_anchor = quantizer;
+  } else if (delta * direction >= kQuantizerSwing) {
+    if (ptr_queue->quantizer_direction != 0)
+      ++stats.quantizer_reversals;
+    ptr_queue->quantizer_direction = direction;
+    ptr_queue->quantizer_anchor = quantizer;
+  }
+}
+
+}  // namespace webmlive
@@ -0,0 +1,188 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_RATE_CONTROL_TELEMETRY_H_
+#define WEBMLIVE_ENCODER_RATE_CONTROL_TELEMETRY_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Rate control decisions for one input frame of a video encoder.
+struct VideoFrameStats {
+  enum {
+    // The compressed frame is a keyframe.
+    kKeyframe = 1,
+    // The keyframe was forced by the interval or a request.
+    kForcedKeyframe = 2,
+    // Rate control dropped the frame.
+    kDropped = 4,
+    // Decimation dropped the frame before it reached the encoder.
+    kDecimated = 8,
+    // The frame repeated the last frame encoded, and was skipped.
+    kStatic = 16,
+  };
+
+  VideoFrameStats()
+      : timestamp(0), duration(0), flags(0), quantizer(-1), frame_bytes(0),
+        target_bytes(0), encode_time_us(0) {}
+
+  // Input frame time and duration, in milliseconds.
+  int64 timestamp;
+  int32 duration;
+  int32 flags;
+
+  // Quantizer of the compressed frame, 0-63, or -1 when there is none.
+  int32 quantizer;
+
+  // Compressed bytes produced for the frame, and the bytes the target
+  // bitrate allows for its duration. With lookahead, the bytes are those of
+  // the frames libvpx returned for the input frame.
+  int32 frame_bytes;
+  int32 target_bytes;
+
+  // Time spent in the encoder.
+  int32 encode_time_us;
+};
+
+// Distribution of ratios in percent. Bucket N counts values below
+// |kUpperBounds[N]|; the last bucket counts everything larger.
+struct PercentHistogram {
+  static const int kNumBuckets = 10;
+  static const int32 kUpperBounds[kNumBuckets - 1];
+
+  PercentHistogram();
+
+  void Add(int64 percent);
+
+  // Returns the upper bound of the bucket holding the |percentile| (0 to 100)
+  // value, limited to |max|. Returns 0 when empty.
+  int64 Percentile(double percentile) const;
+
+  int64 count;
+  int64 total;
+  int64 max;
+  int64 buckets[kNumBuckets];
+};
+
+// Rate control behaviour of one video encoder.
+struct RepresentationRateStats {
+  // Quantizer buckets, each 4 values wide.
+  static const int kNumQuantizerBuckets = 16;
+
+  RepresentationRateStats();
+
+  // Formats the stats as one line.
+  std::string ToString() const;
+
+  // Encoder output size and target bitrate, in kilobits per second, when it
+  // started.
+  int32 width;
+  int32 height;
+  int32 target_kbps;
+
+  // Input frames, and those dropped, skipped as static or keyed.
+  int64 frames;
+  int64 dropped_frames;
+  int64 decimated_frames;
+  int64 static_frames;
+  int64 keyframes;
+  int64 forced_keyframes;
+
+  // Quantizers of the compressed frames. |quantizer_reversals| counts frames
+  // where the quantizer turned around, after moving by at least
+  // |RateControlTelemetry::kQuantizerSwing| each way; a high rate of them
+  // shows rate control oscillating.
+  int64 quantizer_buckets[kNumQuantizerBuckets];
+  int64 quantizer_total;
+  int64 quantizer_count;
+  int64 quantizer_reversals;
+
+  // Compressed frame size against the target, and encode time against the
+  // frame duration. Encode times over 100% mean the encoder cannot keep up.
+  PercentHistogram size_to_target;
+  PercentHistogram encode_time_to_duration;
+};
+
+// Stats of every video encoder of a |RateControlTelemetry|.
+struct RateControlStats {
+  static const int kMaxRepresentations = 16;
+
+  RateControlStats() : num_representations(0), dropped_records(0) {}
+
+  // Formats the stats as one line per representation.
+  std::string ToString() const;
+
+  int num_representations;
+  RepresentationRateStats representations[kMaxRepresentations];
+
+  // Records lost to full queues, or to representations past
+  // |kMaxRepresentations|.
+  int64 dropped_records;
+};
+
+// Collects a |VideoFrameStats| record for every frame passed to the video
+// encoders of a |WebmEncoder| and aggregates them into |RateControlStats|.
+//
+// Each encoder gets a fixed size single producer, single consumer queue from
+// |AddProducer()|, so recording takes no locks and costs a few stores. The
+// encode loop drains the queues with |Collect()|, and |stats()| may be read
+// from any thread.
+//
+// Notes
+// - Records are dropped when a queue is full.
+// - Encoders restarted with the same size and target bitrate add to the
+//   stats of their predecessor.
+class RateControlTelemetry {
+ public:
+  // Records held by each queue.
+  static const int kQueueSize = 1024;
+
+  // Quantizer movement counted by |quantizer_reversals|.
+  static const int kQuantizerSwing = 4;
+
+  // Queue of an encoder; see |AddProducer()|.
+  class Queue;
+
+  RateControlTelemetry();
+  ~RateControlTelemetry();
+
+  // Returns a queue for an encoder of |width| by |height| frames at
+  // |target_kbps|, or NULL when out of memory. The queue stays valid until
+  // passed to |RemoveProducer()|.
+  Queue* AddProducer(int32 width, int32 height, int32 target_kbps);
+
+  // Releases |ptr_queue|; records already in it are still collected.
+  void RemoveProducer(Queue* ptr_queue);
+
+  // Adds |stats| to |ptr_queue|. Called only by the queue's encoder thread.
+  static void Record(Queue* ptr_queue, const VideoFrameStats& stats);
+
+  // Moves waiting records into the stats.
+  void Collect();
+
+  // Collects, and returns the stats.
+  RateControlStats stats();
+
+ private:
+  // Adds |record| to the stats of |ptr_queue|'s representation.
+  void AddRecord(Queue* ptr_queue, const VideoFrameStats& record);
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Queue>> queues_;
+  RateControlStats stats_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(RateControlTelemetry);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_RATE_CONTROL_TELEMETRY_H_
@@ -0,0 +1,345 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/resource_planner.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include "encoder/webm_encoder.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+const double kMaxHeadroom = 0.9;
+
+// Output size and frame rate planned for streams that do not set them.
+const int32 kDefaultWidth = 1920;
+const int32 kDefaultHeight = 1080;
+const double kDefaultFrameRate = 30;
+
+// CPU nanoseconds per pixel encoded by libvpx or libaom at a speed
+// magnitude, on one x86-64 core encoding 1080p camera content in real time
+// mode. Faster speeds than the last entry cost what it does; slower ones what
+// the first does.
+struct SpeedCost {
+  int magnitude;
+  double ns_per_pixel;
+};
+const SpeedCost kVp8Costs[] = {
+  {4, 40}, {6, 24}, {8, 16}, {10, 12}, {12, 9}, {16, 6},
+};
+const SpeedCost kVp9Costs[] = {
+  {5, 60}, {6, 40}, {7, 28}, {8, 20}, {9, 14},
+};
+
+// libaom realtime speeds; |AomEncoder| runs slower settings at the first.
+const SpeedCost kAv1Costs[] = {
+  {7, 45}, {8, 32}, {9, 24}, {10, 18},
+};
+const int kNumVp8Costs = sizeof(kVp8Costs) / sizeof(kVp8Costs[0]);
+const int kNumVp9Costs = sizeof(kVp9Costs) / sizeof(kVp9Costs[0]);
+const int kNumAv1Costs = sizeof(kAv1Costs) / sizeof(kAv1Costs[0]);
+
+// Speed libvpx runs at when |VpxConfig::speed| is left to it.
+const int kDefaultSpeed = -6;
+
+int SpeedOf(const WebmEncoderConfig& config) {
+  return config.vpx_config.speed == VpxConfig::kUseDefault ?
+      kDefaultSpeed : config.vpx_config.speed;
+}
+
+void CostsOf(VideoFormat codec, const SpeedCost** ptr_costs,
+             int* ptr_num_costs) {
+  if (codec == kVideoFormatVP9) {
+    *ptr_costs = kVp9Costs;
+    *ptr_num_costs = kNumVp9Costs;
+  } else if (codec == kVideoFormatAV1) {
+    *ptr_costs = kAv1Costs;
+    *ptr_num_costs = kNumAv1Costs;
+  } else {
+    *ptr_costs = kVp8Costs;
+    *ptr_num_costs = kNumVp8Costs;
+  }
+}
+
+double NsPerPixel(VideoFormat codec, int speed) {
+  const SpeedCost* costs = NULL;
+  int num_costs = 0;
+  CostsOf(codec, &costs, &num_costs);
+  const int magnitude = std::abs(speed);
+  double ns_per_pixel = costs[0].ns_per_pixel;
+  for (int i = 0; i < num_costs && costs[i].magnitude <= magnitude; ++i) {
+    ns_per_pixel = costs[i].ns_per_pixel;
+  }
+  return ns_per_pixel;
+}
+
+#ifdef __linux__
+const char kCgroupRoot[] = "/sys/fs/cgroup";
+
+// Reads the CPU quota of the cgroup directory |dir|, in CPUs, from cpu.max
+// when |v2| is true, and from cpu.cfs_quota_us and cpu.cfs_period_us
+// otherwise. Returns 0 without a quota.
+double ReadCgroupQuota(const std::string& dir, bool v2) {
+  double quota = 0;
+  double period = 0;
+  if (v2) {
+    std::ifstream cpu_max((dir + "/cpu.max").c_str());
+    std::string quota_text;
+    if (!(cpu_max >> quota_text >> period) || quota_text == "max") {
+      return 0;
+    }
+    quota = strtod(quota_text.c_str(), NULL);
+  } else {
+    std::ifstream quota_file((dir + "/cpu.cfs_quota_us").c_str());
+    std::ifstream period_file((dir + "/cpu.cfs_period_us").c_str());
+    if (!(quota_file >> quota) || !(period_file >> period)) {
+      return 0;
+    }
+  }
+  return quota > 0 && period > 0 ? quota / period : 0;
+}
+
+// Returns the lowest quota of the cgroup |path| under the hierarchy mounted
+// at |mount| and of its ancestors, or 0 when none has one. Containers with
+// a cgroup namespace see their own cgroup at |mount| itself.
+double LowestCgroupQuota(const std::string& mount, std::string path,
+                         bool v2) {
+  double lowest = 0;
+  for (;;) {
+    const double quota = ReadCgroupQuota(mount + path, v2);
+    if (quota > 0 && (lowest == 0 || quota < lowest)) {
+      lowest = quota;
+    }
+    const size_t slash = path.find_last_of('/');
+    if (path.empty() || slash == std::string::npos) {
+      break;
+    }
+    path.erase(slash);
+  }
+  return lowest;
+}
+
+// Returns the CPU quota of the process from the cgroups listed in
+// /proc/self/cgroup, or 0 when it has none.
+double ReadProcessQuota() {
+  std::ifstream cgroups("/proc/self/cgroup");
+  std::string line;
+  double lowest = 0;
+  while (std::getline(cgroups, line)) {
+    // hierarchy-ID:controller-list:cgroup-path
+    const size_t first = line.find(':');
+    const size_t second =
+        first == std::string::npos ? first : line.find(':', first + 1);
+    if (second == std::string::npos) {
+      continue;
+    }
+    const std::string controllers = line.substr(first + 1,
+                                                second - first - 1);
+    std::string path = line.substr(second + 1);
+    if (path == "/") {
+      path.clear();
+    }
+    double quota = 0;
+    if (controllers.empty()) {
+      quota = LowestCgroupQuota(kCgroupRoot, path, true);
+    } else if (("," + controllers + ",").find(",cpu,") != std::string::npos) {
+      quota = LowestCgroupQuota(std::string(kCgroupRoot) + "/cpu,cpuacct",
+                                path, false);
+      if (quota == 0) {
+        quota = LowestCgroupQuota(std::string(kCgroupRoot) + "/cpu", path,
+                                  false);
+      }
+    }
+    if (quota > 0 && (lowest == 0 || quota < lowest)) {
+      lowest = quota;
+    }
+  }
+  return lowest;
+}
+#endif  // __linux__
+}  // namespace
+
+double CpuCapacity::usable_cpus() const {
+  const double affinity = std::max(1, affinity_cpus);
+  return quota_cpus > 0 && quota_cpus < affinity ? quota_cpus : affinity;
+}
+
+int CpuCapacity::threads() const {
+  return std::max(1, static_cast<int>(std::ceil(usable_cpus())));
+}
+
+CpuCapacity ReadCpuCapacity() {
+  CpuCapacity capacity;
+  capacity.num_cores =
+      std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  capacity.affinity_cpus = capacity.num_cores;
+#ifdef _WIN32
+  DWORD_PTR process_mask = 0;
+  DWORD_PTR system_mask = 0;
+  if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask,
+                             &system_mask)) {
+    int num_cpus = 0;
+    for (; process_mask; process_mask &= process_mask - 1) {
+      ++num_cpus;
+    }
+    capacity.affinity_cpus = std::max(1, num_cpus);
+  }
+  JOBOBJECT_CPU_RATE_CONTROL_INFORMATION rate;
+  ZeroMemory(&rate, sizeof(rate));
+  if (QueryInformationJobObject(NULL, JobObjectCpuRateControlInformation,
+                                &rate, sizeof(rate), NULL) &&
+      (rate.ControlFlags & JOB_OBJECT_CPU_RATE_CONTROL_ENABLE) &&
+      (rate.ControlFlags & JOB_OBJECT_CPU_RATE_CONTROL_HARD_CAP)) {
+    // The rate is in hundredths of a percent of all processors.
+    capacity.quota_cpus = rate.CpuRate / 10000.0 * capacity.num_cores;
+  }
+#elif defined(__linux__)
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (!sched_getaffinity(0, sizeof(cpus), &cpus)) {
+    capacity.affinity_cpus = std::max(1, CPU_COUNT(&cpus));
+  }
+  capacity.quota_cpus = ReadProcessQuota();
+#endif
+  return capacity;
+}
+
+int AvailableCpuThreads() {
+  static const int threads = ReadCpuCapacity().threads();
+  return threads;
+}
+
+const double ResourcePlanner::kStreamOverheadCpus = 0.15;
+
+ResourcePlanner::ResourcePlanner()
+    : budget_cpus_(0), planned_cpus_(0), cost_scale_(1), threads_(1) {
+}
+
+int ResourcePlanner::Init(double cpus, double headroom) {
+  if (cpus < 0 || headroom < 0 || headroom > kMaxHeadroom) {
+    LOG(ERROR) << "ResourcePlanner invalid cpus " << cpus << " or headroom "
+               << headroom;
+    return kInvalidArg;
+  }
+  if (cpus == 0) {
+    const CpuCapacity capacity = ReadCpuCapacity();
+    cpus = capacity.usable_cpus();
+    LOG(INFO) << "ResourcePlanner cores=" << capacity.num_cores
+              << " affinity=" << capacity.affinity_cpus
+              << " quota=" << capacity.quota_cpus;
+  }
+  threads_ = std::max(1, static_cast<int>(std::ceil(cpus)));
+  budget_cpus_ = cpus * (1 - headroom);
+  planned_cpus_ = 0;
+  LOG(INFO) << "ResourcePlanner budget " << budget_cpus_ << " CPUs, "
+            << threads_ << " threads.";
+  return kSuccess;
+}
+
+double ResourcePlanner::EstimateCpus(const WebmEncoderConfig& config,
+                                     int speed) const {
+  if (config.disable_video || !config.remux_input.empty()) {
+    return kStreamOverheadCpus;
+  }
+  const VideoConfig& video = config.requested_video_config;
+  const int32 width = video.width > 0 ? video.width : kDefaultWidth;
+  const int32 height = video.height > 0 ? video.height : kDefaultHeight;
+  const double frame_rate =
+      video.frame_rate > 0 ? video.frame_rate : kDefaultFrameRate;
+  double ns_per_frame = 0;
+  if (config.video_representations.empty()) {
+    ns_per_frame = static_cast<double>(width) * height *
+                   NsPerPixel(config.vpx_config.codec, speed);
+  }
+  for (size_t i = 0; i < config.video_representations.size(); ++i) {
+    const VideoRepresentationConfig& rep = config.video_representations[i];
+    const double pixels =
+        static_cast<double>(rep.width > 0 ? rep.width : width) *
+        (rep.height > 0 ? rep.height : height);
+    ns_per_frame += pixels * NsPerPixel(
+        RepresentationCodec(rep, config.vpx_config), speed);
+  }
+  const double ns_per_second = ns_per_frame * frame_rate;
+  return kStreamOverheadCpus + cost_scale_ * ns_per_second / 1e9;
+}
+
+int ResourcePlanner::Admit(const std::string& name,
+                           const WebmEncoderConfig& config,
+                           StreamBudget* ptr_budget) {
+  if (!ptr_budget) {
+    return kInvalidArg;
+  }
+  const double available = budget_cpus_ - planned_cpus_;
+
+  // The configured speed, then the faster speeds with a cost of their own,
+  // in real time mode when the configured speed is.
+  const int configured_speed = SpeedOf(config);
+  const int sign = configured_speed < 0 ? -1 : 1;
+  std::vector<int> speeds(1, configured_speed);
+  const SpeedCost* costs = NULL;
+  int num_costs = 0;
+  CostsOf(config.vpx_config.codec, &costs, &num_costs);
+  for (int i = 0; i < num_costs; ++i) {
+    if (costs[i].magnitude > std::abs(configured_speed))
+      speeds.push_back(sign * costs[i].magnitude);
+  }
+
+  for (size_t i = 0; i < speeds.size(); ++i) {
+    const double cpus = EstimateCpus(config, speeds[i]);
+    if (cpus > available) {
+      continue;
+    }
+    StreamBudget budget;
+    budget.cpus = cpus;
+    budget.threads = config.encode_cores > 0 ?
+        config.encode_cores :
+        std::min(threads_, std::max(1, static_cast<int>(
+            std::ceil(cpus - kStreamOverheadCpus))));
+    budget.speed = i == 0 ? config.vpx_config.speed : speeds[i];
+    budget.degraded = i > 0;
+    planned_cpus_ += cpus;
+    *ptr_budget = budget;
+    LOG(INFO) << "ResourcePlanner admitted " << name << ": " << cpus
+              << " CPUs, " << budget.threads << " threads, speed "
+              << speeds[i] << (budget.degraded ? " (degraded)" : "")
+              << "; " << budget_cpus_ - planned_cpus_ << " CPUs left.";
+    return budget.degraded ? kDegraded : kSuccess;
+  }
+  LOG(WARNING) << "ResourcePlanner refused " << name << ": needs "
+               << EstimateCpus(config, speeds.back()) << " CPUs at speed "
+               << speeds.back() << ", " << available << " CPUs left.";
+  return kNoCapacity;
+}
+
+void ResourcePlanner::Release(const StreamBudget& budget) {
+  planned_cpus_ = std::max(0.0, planned_cpus_ - budget.cpus);
+}
+
+void ResourcePlanner::Apply(const StreamBudget& budget,
+                            WebmEncoderConfig* ptr_config) {
+  if (!ptr_config) {
+    return;
+  }
+  ptr_config->encode_cores = budget.threads;
+  ptr_config->vpx_config.speed = budget.speed;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,159 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_RESOURCE_PLANNER_H_
+#define WEBMLIVE_ENCODER_RESOURCE_PLANNER_H_
+
+#include <string>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+struct WebmEncoderConfig;
+
+// CPU the process may use, as its container or job object allows it.
+struct CpuCapacity {
+  CpuCapacity() : num_cores(1), affinity_cpus(1), quota_cpus(0) {}
+
+  // Returns the CPUs the process can keep busy: |quota_cpus| when set and
+  // lower than |affinity_cpus|, and |affinity_cpus| otherwise.
+  double usable_cpus() const;
+
+  // Returns the threads worth running at once: |usable_cpus()| rounded up.
+  int threads() const;
+
+  // Logical processors of the machine.
+  int num_cores;
+
+  // Processors the affinity mask of the process allows, as set by
+  // taskset, cpusets, or Docker's --cpuset-cpus.
+  int affinity_cpus;
+
+  // CPU time the cgroup or job object allows per unit of time, in CPUs: 2.5
+  // for a quota of 250 ms per 100 ms period. 0 without a quota.
+  double quota_cpus;
+};
+
+// Reads the CPU capacity of the process.
+// - Linux: the affinity mask, and the lowest CPU quota of the cgroup of the
+//   process and its ancestors, from cpu.max with cgroup v2, or from
+//   cpu.cfs_quota_us and cpu.cfs_period_us with cgroup v1.
+// - Windows: the process affinity mask, and the CPU rate limit of the job
+//   object of the process.
+CpuCapacity ReadCpuCapacity();
+
+// Returns |ReadCpuCapacity().threads()|, read once per process. Thread
+// counts of libvpx, the task scheduler and the worker pools follow it rather
+// than |std::thread::hardware_concurrency()|, which counts the cores of the
+// machine whatever the container allows, and so oversubscribes the quota
+// until the kernel throttles the process.
+int AvailableCpuThreads();
+
+// The CPU granted to a stream by |ResourcePlanner::Admit()|.
+struct StreamBudget {
+  StreamBudget() : cpus(0), threads(0), speed(0), degraded(false) {}
+
+  // CPUs the stream is expected to use.
+  double cpus;
+
+  // Encode threads of the stream, for |WebmEncoderConfig::encode_cores|.
+  int threads;
+
+  // libvpx speed of the stream, for |VpxConfig::speed|.
+  int speed;
+
+  // True when |speed| is faster than the speed the stream asked for.
+  bool degraded;
+};
+
+// Plans the CPU of the streams of host mode against the capacity of the
+// process, so that streams admitted together encode in real time instead of
+// being throttled by the container's CPU quota.
+//
+// Each stream's CPU use is estimated from the pixels its video
+// representations encode per second, at a cost per pixel for the codec and
+// libvpx speed, plus a fixed cost for capture, audio, muxing and upload.
+// |Admit()| grants a stream its configured speed when that fits in what the
+// streams admitted before it leave of the budget, the next faster speed that
+// fits otherwise, and refuses it when even the fastest speed does not: the
+// streams already running keep real time.
+//
+// Notes
+// - The budget is the usable CPUs less |headroom|, left for bursts, the
+//   keyframes and the scene changes the estimate averages out.
+// - The costs per pixel are those of one x86-64 core encoding 1080p camera
+//   content; use |set_cost_scale()| for slower or faster CPUs, or for
+//   content harder or easier to encode.
+// - Streams without an output size are planned at 1080p, and those without a
+//   frame rate at 30 frames per second.
+// - Thread counts are the stream's share of the CPUs, rounded up; libvpx
+//   threads wait on each other, so a stream with fewer threads than its CPU
+//   estimate would not reach it.
+// - Not thread safe.
+class ResourcePlanner {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+    // Returned by |Admit()| when the stream was admitted at a faster speed
+    // than configured.
+    kDegraded = 1,
+    // Returned by |Admit()| when the stream does not fit at any speed.
+    kNoCapacity = 2,
+  };
+
+  // CPUs assumed for the capture, audio, muxing and upload of a stream.
+  static const double kStreamOverheadCpus;
+
+  ResourcePlanner();
+  ~ResourcePlanner() {}
+
+  // Plans against |cpus| CPUs, or the |ReadCpuCapacity()| of the process
+  // when |cpus| is 0, less |headroom|, a share of them from 0 to 0.9.
+  // Returns |kSuccess| when successful.
+  int Init(double cpus, double headroom);
+
+  // Multiplies the CPU estimates by |scale|. Defaults to 1.
+  void set_cost_scale(double scale) { cost_scale_ = scale; }
+
+  // Returns the CPUs |config| is estimated to use at libvpx speed |speed|.
+  double EstimateCpus(const WebmEncoderConfig& config, int speed) const;
+
+  // Admits the stream of |config| named |name|, and stores its budget in
+  // |ptr_budget|. Returns |kSuccess| when the stream fits at its configured
+  // speed, |kDegraded| when it fits at a faster one, and |kNoCapacity| when
+  // it does not fit; |ptr_budget| is unchanged then.
+  int Admit(const std::string& name, const WebmEncoderConfig& config,
+            StreamBudget* ptr_budget);
+
+  // Returns the CPUs of a stream admitted with |budget| to the budget.
+  void Release(const StreamBudget& budget);
+
+  // Applies |budget| to |ptr_config|.
+  static void Apply(const StreamBudget& budget, WebmEncoderConfig* ptr_config);
+
+  // CPUs planned, and CPUs granted to the streams admitted.
+  double budget_cpus() const { return budget_cpus_; }
+  double planned_cpus() const { return planned_cpus_; }
+
+  // Threads worth running for the whole process: the usable CPUs rounded
+  // up.
+  int threads() const { return threads_; }
+
+ private:
+  double budget_cpus_;
+  double planned_cpus_;
+  double cost_scale_;
+  int threads_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(ResourcePlanner);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_RESOURCE_PLANNER_H_
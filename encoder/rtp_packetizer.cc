@@ -0,0 +1,280 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/rtp_packetizer.h"
+
+#include <cstring>
+#include <random>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+const uint8 kRtpVersion = 0x80;
+
+// Longest payload descriptors: VP8 with picture id and layer indices, and
+// VP9 with picture id, layer indices and a one layer scalability structure.
+const int32 kMaxVp8DescriptorSize = 6;
+const int32 kMaxVp9DescriptorSize = 10;
+
+// RTCP packet types and feedback message types.
+const uint8 kRtcpSenderReport = 200;
+const uint8 kRtcpTransportFeedback = 205;
+const uint8 kRtcpPayloadFeedback = 206;
+const uint8 kRtcpGenericNack = 1;
+const uint8 kRtcpPictureLoss = 1;
+const uint8 kRtcpFullIntraRequest = 4;
+
+// Seconds from the NTP epoch, 1900, to the Unix epoch.
+const int64 kNtpEpochOffset = 2208988800LL;
+
+void WriteUint16(uint16 value, uint8* ptr_data) {
+  ptr_data[0] = static_cast<uint8>(value >> 8);
+  ptr_data[1] = static_cast<uint8>(value);
+}
+
+void WriteUint32(uint32 value, uint8* ptr_data) {
+  ptr_data[0] = static_cast<uint8>(value >> 24);
+  ptr_data[1] = static_cast<uint8>(value >> 16);
+  ptr_data[2] = static_cast<uint8>(value >> 8);
+  ptr_data[3] = static_cast<uint8>(value);
+}
+
+uint16 ReadUint16(const uint8* ptr_data) {
+  return static_cast<uint16>((ptr_data[0] << 8) | ptr_data[1]);
+}
+
+uint32 ReadUint32(const uint8* ptr_data) {
+  return (static_cast<uint32>(ptr_data[0]) << 24) |
+         (static_cast<uint32>(ptr_data[1]) << 16) |
+         (static_cast<uint32>(ptr_data[2]) << 8) | ptr_data[3];
+}
+}  // namespace
+
+RtpPacketizer::RtpPacketizer()
+    : codec_(kRtpCodecVP8),
+      payload_type_(0),
+      ssrc_(0),
+      layered_(false),
+      sequence_number_(0),
+      timestamp_offset_(0),
+      picture_id_(0),
+      tl0_pic_idx_(0) {
+}
+
+int RtpPacketizer::Init(RtpCodec codec, int payload_type, uint32 ssrc,
+                        int temporal_layers) {
+  if (payload_type < 0 || payload_type > 127) {
+    LOG(ERROR) << "invalid RTP payload type " << payload_type;
+    return kInvalidArg;
+  }
+  codec_ = codec;
+  payload_type_ = payload_type;
+  ssrc_ = ssrc;
+  layered_ = codec != kRtpCodecOpus && temporal_layers > 1;
+  std::random_device random;
+  sequence_number_ = static_cast<uint16>(random());
+  timestamp_offset_ = static_cast<uint32>(random());
+  picture_id_ = static_cast<uint16>(random() & 0x7FFF);
+  tl0_pic_idx_ = static_cast<uint8>(random());
+  return kSuccess;
+}
+
+int RtpPacketizer::PacketizeVideoFrame(const VideoFrame& frame,
+                                       std::vector<RtpPacket>* ptr_packets) {
+  const VideoFormat format =
+      codec_ == kRtpCodecVP8 ? kVideoFormatVP8 : kVideoFormatVP9;
+  if (codec_ == kRtpCodecOpus || frame.format() != format ||
+      !frame.buffer() || frame.buffer_length() <= 0) {
+    return kInvalidArg;
+  }
+  ptr_packets->clear();
+  picture_id_ = (picture_id_ + 1) & 0x7FFF;
+  if (frame.temporal_layer() == 0) {
+    ++tl0_pic_idx_;
+  }
+
+  // Spread the frame evenly over as few packets as the largest descriptor
+  // allows, rather than leaving a small last packet.
+  const int32 max_payload = kMaxPacketSize - kHeaderSize -
+      (codec_ == kRtpCodecVP8 ? kMaxVp8DescriptorSize :
+                                kMaxVp9DescriptorSize);
+  const int32 length = frame.buffer_length();
+  const int32 num_packets = (length + max_payload - 1) / max_payload;
+  const uint32 timestamp = RtpTimestamp(frame.timestamp_us());
+  uint8 descriptor[kMaxVp9DescriptorSize];
+  int32 offset = 0;
+  for (int32 i = 0; i < num_packets; ++i) {
+    const int32 end = static_cast<int32>(
+        static_cast<int64>(length) * (i + 1) / num_packets);
+    const bool first = i == 0;
+    const bool last = i + 1 == num_packets;
+    const int32 descriptor_length = codec_ == kRtpCodecVP8 ?
+        WriteVp8Descriptor(frame, first, descriptor) :
+        WriteVp9Descriptor(frame, first, last, descriptor);
+    AddPacket(timestamp, last, descriptor, descriptor_length,
+              frame.buffer() + offset, end - offset, ptr_packets);
+    offset = end;
+  }
+  return kSuccess;
+}
+
+int RtpPacketizer::PacketizeAudioBuffer(const AudioBuffer& buffer,
+                                        std::vector<RtpPacket>* ptr_packets) {
+  if (codec_ != kRtpCodecOpus || !buffer.buffer() ||
+      buffer.buffer_length() <= 0 ||
+      buffer.buffer_length() > kMaxPacketSize - kHeaderSize) {
+    return kInvalidArg;
+  }
+  ptr_packets->clear();
+  AddPacket(RtpTimestamp(buffer.timestamp_us()), false, NULL, 0,
+            buffer.buffer(), buffer.buffer_length(), ptr_packets);
+  return kSuccess;
+}
+
+uint32 RtpPacketizer::RtpTimestamp(int64 timestamp_us) const {
+  return timestamp_offset_ +
+         static_cast<uint32>(timestamp_us * clock_rate() / 1000000);
+}
+
+void RtpPacketizer::AddPacket(uint32 timestamp, bool marker,
+                              const uint8* ptr_descriptor,
+                              int32 descriptor_length,
+                              const uint8* ptr_payload, int32 length,
+                              std::vector<RtpPacket>* ptr_packets) {
+  ptr_packets->push_back(RtpPacket());
+  RtpPacket& packet = ptr_packets->back();
+  packet.sequence_number = sequence_number_++;
+  packet.marker = marker;
+  packet.data.resize(kHeaderSize + descriptor_length + length);
+  uint8* const ptr_data = &packet.data[0];
+  ptr_data[0] = kRtpVersion;
+  ptr_data[1] = static_cast<uint8>((marker ? 0x80 : 0) | payload_type_);
+  WriteUint16(packet.sequence_number, ptr_data + 2);
+  WriteUint32(timestamp, ptr_data + 4);
+  WriteUint32(ssrc_, ptr_data + 8);
+  if (descriptor_length > 0) {
+    memcpy(ptr_data + kHeaderSize, ptr_descriptor, descriptor_length);
+  }
+  memcpy(ptr_data + kHeaderSize + descriptor_length, ptr_payload, length);
+}
+
+int32 RtpPacketizer::WriteVp8Descriptor(const VideoFrame& frame, bool first,
+                                        uint8* ptr_descriptor) const {
+  // X, and S with partition index 0 on the first packet; then I, and L and
+  // T with layers.
+  uint8* ptr = ptr_descriptor;
+  *ptr++ = static_cast<uint8>(0x80 | (first ? 0x10 : 0));
+  *ptr++ = static_cast<uint8>(0x80 | (layered_ ? 0x60 : 0));
+  WriteUint16(static_cast<uint16>(0x8000 | picture_id_), ptr);
+  ptr += 2;
+  if (layered_) {
+    *ptr++ = tl0_pic_idx_;
+    *ptr++ = static_cast<uint8>((frame.temporal_layer() & 0x03) << 6);
+  }
+  return static_cast<int32>(ptr - ptr_descriptor);
+}
+
+int32 RtpPacketizer::WriteVp9Descriptor(const VideoFrame& frame, bool first,
+                                        bool last,
+                                        uint8* ptr_descriptor) const {
+  // I, P for inter frames, L with layers, B and E at the frame edges, and V
+  // with the scalability structure on the first packet of keyframes.
+  const bool keyframe = frame.keyframe();
+  const bool structure = keyframe && first;
+  uint8* ptr = ptr_descriptor;
+  *ptr++ = static_cast<uint8>(0x80 | (keyframe ? 0 : 0x40) |
+                              (layered_ ? 0x20 : 0) | (first ? 0x08 : 0) |
+                              (last ? 0x04 : 0) | (structure ? 0x02 : 0));
+  WriteUint16(static_cast<uint16>(0x8000 | picture_id_), ptr);
+  ptr += 2;
+  if (layered_) {
+    // TID, U and D clear, and spatial layer 0.
+    *ptr++ = static_cast<uint8>((frame.temporal_layer() & 0x07) << 5);
+    *ptr++ = tl0_pic_idx_;
+  }
+  if (structure) {
+    // One spatial layer, with its resolution and no picture group.
+    *ptr++ = 0x10;
+    WriteUint16(static_cast<uint16>(frame.width()), ptr);
+    WriteUint16(static_cast<uint16>(frame.height()), ptr + 2);
+    ptr += 4;
+  }
+  return static_cast<int32>(ptr - ptr_descriptor);
+}
+
+bool ParseRtcpFeedback(const uint8* ptr_data, int32 length, uint32 ssrc,
+                       RtcpFeedback* ptr_feedback) {
+  // RTCP packet types are 192 to 223 (RFC 5761).
+  if (length < 8 || (ptr_data[0] & 0xC0) != kRtpVersion ||
+      ptr_data[1] < 192 || ptr_data[1] > 223) {
+    return false;
+  }
+  while (length >= 4) {
+    const uint8 format = ptr_data[0] & 0x1F;
+    const uint8 type = ptr_data[1];
+    const int32 size = (ReadUint16(ptr_data + 2) + 1) * 4;
+    if (size > length) {
+      break;
+    }
+    if (size >= 12 && (type == kRtcpTransportFeedback ||
+                       type == kRtcpPayloadFeedback)) {
+      const uint32 media_ssrc = ReadUint32(ptr_data + 8);
+      if (type == kRtcpTransportFeedback && format == kRtcpGenericNack &&
+          media_ssrc == ssrc) {
+        // Each entry is a lost packet and a mask of the 16 following it.
+        for (int32 entry = 12; entry + 4 <= size; entry += 4) {
+          const uint16 lost = ReadUint16(ptr_data + entry);
+          const uint16 mask = ReadUint16(ptr_data + entry + 2);
+          ptr_feedback->lost_sequence_numbers.push_back(lost);
+          for (int bit = 0; bit < 16; ++bit) {
+            if (mask & (1 << bit)) {
+              ptr_feedback->lost_sequence_numbers.push_back(
+                  static_cast<uint16>(lost + bit + 1));
+            }
+          }
+        }
+      } else if (type == kRtcpPayloadFeedback &&
+                 format == kRtcpPictureLoss && media_ssrc == ssrc) {
+        ptr_feedback->keyframe_requested = true;
+      } else if (type == kRtcpPayloadFeedback &&
+                 format == kRtcpFullIntraRequest) {
+        // The SSRCs of FIRs are in their entries.
+        for (int32 entry = 12; entry + 8 <= size; entry += 8) {
+          if (ReadUint32(ptr_data + entry) == ssrc) {
+            ptr_feedback->keyframe_requested = true;
+          }
+        }
+      }
+    }
+    ptr_data += size;
+    length -= size;
+  }
+  return true;
+}
+
+void BuildSenderReport(uint32 ssrc, int64 wall_time_us, uint32 rtp_timestamp,
+                       uint32 packet_count, uint32 octet_count,
+                       std::vector<uint8>* ptr_report) {
+  const int32 kSize = 28;
+  ptr_report->resize(kSize);
+  uint8* const ptr_data = &(*ptr_report)[0];
+  ptr_data[0] = kRtpVersion;
+  ptr_data[1] = kRtcpSenderReport;
+  WriteUint16(kSize / 4 - 1, ptr_data + 2);
+  WriteUint32(ssrc, ptr_data + 4);
+  const int64 seconds = wall_time_us / 1000000;
+  const int64 fraction = ((wall_time_us % 1000000) << 32) / 1000000;
+  WriteUint32(static_cast<uint32>(seconds + kNtpEpochOffset), ptr_data + 8);
+  WriteUint32(static_cast<uint32>(fraction), ptr_data + 12);
+  WriteUint32(rtp_timestamp, ptr_data + 16);
+  WriteUint32(packet_count, ptr_data + 20);
+  WriteUint32(octet_count, ptr_data + 24);
+}
+
+}  // namespace webmlive
@@ -0,0 +1,153 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_RTP_PACKETIZER_H_
+#define WEBMLIVE_ENCODER_RTP_PACKETIZER_H_
+
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+// Payload formats |RtpPacketizer| produces.
+enum RtpCodec {
+  kRtpCodecVP8 = 0,  // RFC 7741.
+  kRtpCodecVP9 = 1,  // RFC 9628, non-flexible mode.
+  kRtpCodecOpus = 2,  // RFC 7587.
+};
+
+// One RTP packet, header included.
+struct RtpPacket {
+  RtpPacket() : sequence_number(0), marker(false) {}
+
+  std::vector<uint8> data;
+  uint16 sequence_number;
+
+  // Set on the last packet of a video frame.
+  bool marker;
+};
+
+// Splits compressed frames into RTP packets of one stream, with the payload
+// descriptors SFUs use to forward them: picture ids, and with temporal
+// layers the temporal layer and base layer index of each frame, so that
+// layers can be dropped per receiver. Opus buffers are sent one per packet.
+//
+// Notes
+// - RTP timestamps derive from the microsecond times of the frames, so that
+//   every stream of an encoder shares one media clock.
+// - Not thread safe.
+class RtpPacketizer {
+ public:
+  enum {
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Largest packet produced, which leaves room for SRTP, UDP, IP and TURN
+  // headers within common path MTUs.
+  static const int32 kMaxPacketSize = 1200;
+
+  // Size of the RTP headers written.
+  static const int32 kHeaderSize = 12;
+
+  static const int kVideoClockRate = 90000;
+  static const int kOpusClockRate = 48000;
+
+  RtpPacketizer();
+  ~RtpPacketizer() {}
+
+  // Starts a stream of |codec| frames with payload type |payload_type| and
+  // SSRC |ssrc|. |temporal_layers| is |VpxConfig::temporal_layers|; layer
+  // information is sent when it is above 1. The sequence numbers and the
+  // timestamp offset start at random values. Returns |kSuccess| when
+  // successful.
+  int Init(RtpCodec codec, int payload_type, uint32 ssrc,
+           int temporal_layers);
+
+  // Replaces the contents of |ptr_packets| with the packets of |frame|.
+  // Returns |kInvalidArg| when |frame| is empty or not of the stream's
+  // codec.
+  int PacketizeVideoFrame(const VideoFrame& frame,
+                          std::vector<RtpPacket>* ptr_packets);
+
+  // Replaces the contents of |ptr_packets| with the packet of the Opus
+  // buffer |buffer|. Returns |kInvalidArg| when |buffer| is empty or too
+  // large for one packet.
+  int PacketizeAudioBuffer(const AudioBuffer& buffer,
+                           std::vector<RtpPacket>* ptr_packets);
+
+  // Returns the RTP timestamp of media time |timestamp_us|.
+  uint32 RtpTimestamp(int64 timestamp_us) const;
+
+  RtpCodec codec() const { return codec_; }
+  uint32 ssrc() const { return ssrc_; }
+  int clock_rate() const {
+    return codec_ == kRtpCodecOpus ? kOpusClockRate : kVideoClockRate;
+  }
+
+ private:
+  // Appends a packet holding the RTP header, the |descriptor_length| byte
+  // descriptor at |ptr_descriptor| and |length| bytes at |ptr_payload| to
+  // |ptr_packets|.
+  void AddPacket(uint32 timestamp, bool marker, const uint8* ptr_descriptor,
+                 int32 descriptor_length, const uint8* ptr_payload,
+                 int32 length, std::vector<RtpPacket>* ptr_packets);
+
+  // Writes the payload descriptor of a packet of |frame| to
+  // |ptr_descriptor|, and returns its length. |first| and |last| are true
+  // for the first and the last packet of the frame.
+  int32 WriteVp8Descriptor(const VideoFrame& frame, bool first,
+                           uint8* ptr_descriptor) const;
+  int32 WriteVp9Descriptor(const VideoFrame& frame, bool first, bool last,
+                           uint8* ptr_descriptor) const;
+
+  RtpCodec codec_;
+  int payload_type_;
+  uint32 ssrc_;
+  bool layered_;
+  uint16 sequence_number_;
+  uint32 timestamp_offset_;
+
+  // 15 bit picture id of the last frame, and index of the last base layer
+  // frame.
+  uint16 picture_id_;
+  uint8 tl0_pic_idx_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(RtpPacketizer);
+};
+
+// RTCP feedback received from a receiver or SFU about one media stream.
+struct RtcpFeedback {
+  RtcpFeedback() : keyframe_requested(false) {}
+
+  // Sequence numbers reported lost by generic NACKs (RFC 4585).
+  std::vector<uint16> lost_sequence_numbers;
+
+  // Set by picture loss indications (RFC 4585) and full intra requests
+  // (RFC 5104).
+  bool keyframe_requested;
+};
+
+// Adds the feedback about media SSRC |ssrc| in the compound RTCP packet of
+// |length| bytes at |ptr_data| to |ptr_feedback|. Returns false when the
+// packet is not RTCP.
+bool ParseRtcpFeedback(const uint8* ptr_data, int32 length, uint32 ssrc,
+                       RtcpFeedback* ptr_feedback);
+
+// Replaces the contents of |ptr_report| with an RTCP sender report of SSRC
+// |ssrc| mapping wall clock time |wall_time_us|, in microseconds since the
+// epoch, to RTP timestamp |rtp_timestamp|, and counting |packet_count|
+// packets and |octet_count| payload octets sent.
+void BuildSenderReport(uint32 ssrc, int64 wall_time_us, uint32 rtp_timestamp,
+                       uint32 packet_count, uint32 octet_count,
+                       std::vector<uint8>* ptr_report);
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_RTP_PACKETIZER_H_
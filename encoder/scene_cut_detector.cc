@@ -0,0 +1,92 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/scene_cut_detector.h"
+
+#include <cstdlib>
+
+#include "encoder/video_encoder.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Distance between luma samples, in pixels, in both directions. At 1080p this
+// compares about 32000 samples per frame.
+const int32 kSampleStep = 8;
+
+// Mean absolute luma difference a cut must exceed, and the multiple of the
+// running average it must exceed.
+const double kMinCutDifference = 24.0;
+const double kCutToAverageRatio = 3.0;
+
+// Weight of the newest frame in |average_difference_|.
+const double kAverageWeight = 0.1;
+}  // namespace
+
+SceneCutDetector::SceneCutDetector()
+    : width_(0),
+      height_(0),
+      average_difference_(0) {
+}
+
+bool SceneCutDetector::IsSceneCut(const VideoFrame& frame) {
+  const bool high_bit_depth = frame.format() == kVideoFormatI42016;
+  if (!frame.buffer() || (frame.format() != kVideoFormatI420 &&
+                          frame.format() != kVideoFormatYV12 &&
+                          !high_bit_depth)) {
+    return false;
+  }
+  if (frame.width() != width_ || frame.height() != height_) {
+    Reset();
+    width_ = frame.width();
+    height_ = frame.height();
+  }
+
+  samples_.clear();
+  const uint8* const ptr_luma = frame.buffer();
+  const int32 stride = frame.stride();
+  for (int32 y = kSampleStep / 2; y < height_; y += kSampleStep) {
+    const uint8* const ptr_row = ptr_luma + y * stride;
+    const uint16* const ptr_row_16 = reinterpret_cast<const uint16*>(ptr_row);
+    for (int32 x = kSampleStep / 2; x < width_; x += kSampleStep) {
+      // 10 bit samples are reduced to 8 bits to keep the thresholds.
+      samples_.push_back(high_bit_depth ?
+          static_cast<uint8>(ptr_row_16[x] >> 2) : ptr_row[x]);
+    }
+  }
+  if (samples_.empty() || previous_samples_.size() != samples_.size()) {
+    samples_.swap(previous_samples_);
+    return false;
+  }
+
+  int64 total_difference = 0;
+  for (size_t i = 0; i < samples_.size(); ++i) {
+    total_difference += abs(samples_[i] - previous_samples_[i]);
+  }
+  samples_.swap(previous_samples_);
+
+  const double difference =
+      static_cast<double>(total_difference) / previous_samples_.size();
+  const bool cut = difference > kMinCutDifference &&
+      difference > kCutToAverageRatio * average_difference_;
+  if (cut) {
+    VLOG(1) << "scene cut @ " << frame.timestamp() << "ms, difference "
+            << difference << " average " << average_difference_;
+  } else {
+    average_difference_ += kAverageWeight * (difference - average_difference_);
+  }
+  return cut;
+}
+
+void SceneCutDetector::Reset() {
+  samples_.clear();
+  previous_samples_.clear();
+  average_difference_ = 0;
+}
+
+}  // namespace webmlive
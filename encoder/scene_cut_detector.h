@@ -0,0 +1,54 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_SCENE_CUT_DETECTOR_H_
+#define WEBMLIVE_ENCODER_SCENE_CUT_DETECTOR_H_
+
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+class VideoFrame;
+
+// Detects scene cuts in raw I420, YV12 and I42016 frames so that keyframes can
+// be placed where the content changes.
+//
+// Each frame is reduced to a sparse grid of luma samples, and compared with
+// the grid of the previous frame. A frame is a cut when the mean absolute
+// difference is large, and also several times the recent average, so that
+// steady high motion does not read as a cut.
+class SceneCutDetector {
+ public:
+  SceneCutDetector();
+  ~SceneCutDetector() {}
+
+  // Returns true when |frame| begins a new scene. Always false for the first
+  // frame, after a size change, and for formats other than I420, YV12 and
+  // I42016.
+  bool IsSceneCut(const VideoFrame& frame);
+
+  // Forgets the previous frame.
+  void Reset();
+
+ private:
+  // Luma samples of the previous frame, and its size.
+  std::vector<uint8> samples_;
+  std::vector<uint8> previous_samples_;
+  int32 width_;
+  int32 height_;
+
+  // Running average of the mean absolute difference of frames that were not
+  // cuts.
+  double average_difference_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(SceneCutDetector);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_SCENE_CUT_DETECTOR_H_
@@ -0,0 +1,384 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/segment_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "encoder/data_sink.h"
+#include "encoder/ebml_util.h"
+#include "encoder/socket_util.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+const char kManifestSuffix[] = ".mpd";
+const char kPatchSuffix[] = ".mpp";
+const char kSegmentSuffix[] = ".chk";
+
+// Bytes of a chunk searched for the cluster timecode. The muxer writes the
+// timecode first, in milliseconds; see |LiveWebmMuxer::kTimecodeScale|.
+const size_t kMaxTimecodeOffset = 64;
+
+struct ReplayChunk {
+  ReplayChunk() : media_time_ms(-1) {}
+  std::string id;
+  SharedDataChunk chunk;
+  int64 media_time_ms;
+};
+
+bool EarlierReplayChunk(const ReplayChunk& a, const ReplayChunk& b) {
+  return a.media_time_ms < b.media_time_ms;
+}
+}  // namespace
+
+SegmentCache::SegmentCache()
+    : size_bytes_(0),
+      num_segments_(0),
+      closed_(false),
+      ptr_spill_sink_(NULL) {
+}
+
+int SegmentCache::Init(const SegmentCacheSettings& settings) {
+  if (settings.window_ms < 1 || settings.max_bytes < 1) {
+    LOG(ERROR) << "invalid segment cache settings, window="
+               << settings.window_ms << " max_bytes=" << settings.max_bytes;
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  settings_ = settings;
+  entries_.clear();
+  representations_.clear();
+  size_bytes_ = 0;
+  num_segments_ = 0;
+  closed_ = false;
+  return kSuccess;
+}
+
+void SegmentCache::SetSpillSink(DataSinkInterface* ptr_sink) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ptr_spill_sink_ = ptr_sink;
+}
+
+void SegmentCache::Put(const std::string& id, const SharedDataChunk& chunk) {
+  if (!chunk) {
+    return;
+  }
+  Entry entry;
+  entry.chunk = chunk;
+  entry.media_time_ms = ReadMediaTime(*chunk);
+  bool stored = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stored = Store(id, entry, false);
+  }
+  if (stored) {
+    entry_stored_.notify_all();
+  }
+}
+
+void SegmentCache::PutStreaming(const std::string& id,
+                                const SharedStreamingChunk& stream) {
+  if (!stream) {
+    return;
+  }
+  Entry entry;
+  entry.stream = stream;
+  bool stored = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stored = Store(id, entry, true);
+  }
+  if (stored) {
+    entry_stored_.notify_all();
+  }
+}
+
+bool SegmentCache::Find(const std::string& id, int32 timeout_ms,
+                        SharedDataChunk* ptr_chunk,
+                        SharedStreamingChunk* ptr_stream) {
+  if (!ptr_chunk || !ptr_stream) {
+    return false;
+  }
+  const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(timeout_ms);
+  std::unique_lock<std::mutex> lock(mutex_);
+  bool evicted = false;
+  const Entry* ptr_entry = Lookup(id, &evicted);
+  while (!closed_ && !ptr_entry && !evicted &&
+         entry_stored_.wait_until(lock, deadline) !=
+             std::cv_status::timeout) {
+    ptr_entry = Lookup(id, &evicted);
+  }
+  ptr_entry = Lookup(id, &evicted);
+  if (closed_ || !ptr_entry) {
+    return false;
+  }
+  *ptr_chunk = ptr_entry->chunk;
+  *ptr_stream = ptr_entry->stream;
+  return true;
+}
+
+int SegmentCache::Replay(DataSinkInterface* ptr_sink) const {
+  if (!ptr_sink) {
+    return 0;
+  }
+  std::vector<ReplayChunk> headers;
+  std::vector<ReplayChunk> segments;
+  std::vector<ReplayChunk> manifests;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::map<std::string, Entry>::const_iterator it = entries_.begin();
+         it != entries_.end(); ++it) {
+      if (!it->second.chunk) {
+        continue;
+      }
+      ReplayChunk chunk;
+      chunk.id = it->first;
+      chunk.chunk = it->second.chunk;
+      if (HasSuffix(it->first, kManifestSuffix) ||
+          HasSuffix(it->first, kPatchSuffix))
+        manifests.push_back(chunk);
+      else
+        headers.push_back(chunk);
+    }
+    for (RepresentationMap::const_iterator rep = representations_.begin();
+         rep != representations_.end(); ++rep) {
+      const std::map<int64, Entry>& rep_segments = rep->second.segments;
+      for (std::map<int64, Entry>::const_iterator it = rep_segments.begin();
+           it != rep_segments.end(); ++it) {
+        if (!it->second.chunk) {
+          continue;
+        }
+        ReplayChunk chunk;
+        chunk.id = SegmentId(rep->first, it->first);
+        chunk.chunk = it->second.chunk;
+        chunk.media_time_ms = it->second.media_time_ms;
+        segments.push_back(chunk);
+      }
+    }
+  }
+
+  // Segments of each representation were added in number order, which the
+  // stable sort keeps for segments of equal or unknown time.
+  std::stable_sort(segments.begin(), segments.end(), EarlierReplayChunk);
+  headers.insert(headers.end(), segments.begin(), segments.end());
+  headers.insert(headers.end(), manifests.begin(), manifests.end());
+  int num_written = 0;
+  for (size_t i = 0; i < headers.size(); ++i) {
+    if (!ptr_sink->WriteChunk(headers[i].chunk, headers[i].id)) {
+      LOG(WARNING) << "segment cache replay failed for " << headers[i].id;
+      continue;
+    }
+    ++num_written;
+  }
+  return num_written;
+}
+
+void SegmentCache::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  entry_stored_.notify_all();
+}
+
+int SegmentCache::num_entries() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return static_cast<int>(entries_.size()) + num_segments_;
+}
+
+int64 SegmentCache::size_bytes() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return size_bytes_;
+}
+
+bool SegmentCache::ParseSegmentId(const std::string& id,
+                                  std::string* ptr_representation,
+                                  int64* ptr_number) {
+  if (!HasSuffix(id, kSegmentSuffix)) {
+    return false;
+  }
+  const std::string stem =
+      id.substr(0, id.size() - (sizeof(kSegmentSuffix) - 1));
+  const size_t number_pos = stem.rfind('_');
+  if (number_pos == std::string::npos || number_pos == 0 ||
+      number_pos + 1 == stem.size() ||
+      stem.find_first_not_of("0123456789", number_pos + 1) !=
+          std::string::npos) {
+    return false;
+  }
+  *ptr_representation = stem.substr(0, number_pos);
+  *ptr_number = strtoll(stem.c_str() + number_pos + 1, NULL, 10);
+  return true;
+}
+
+int64 SegmentCache::ReadMediaTime(const DataChunk& chunk) {
+  uint8 buf[kMaxTimecodeOffset];
+  size_t length = 0;
+  const std::vector<DataChunk::Span>& spans = chunk.spans();
+  for (size_t i = 0; i < spans.size() && length < sizeof(buf); ++i) {
+    const size_t copy_length =
+        std::min(sizeof(buf) - length, static_cast<size_t>(spans[i].length));
+    memcpy(buf + length, spans[i].ptr_data, copy_length);
+    length += copy_length;
+  }
+
+  // The cluster extends past |buf|; read its header without checking its
+  // size.
+  const uint8* ptr_pos = buf;
+  const uint8* const ptr_end = buf + length;
+  int64 cluster_id = 0;
+  int64 size = 0;
+  int32 id_length = 0;
+  int32 size_length = 0;
+  if (!ReadVint(ptr_pos, ptr_end, true, &cluster_id, &id_length) ||
+      cluster_id != kClusterId ||
+      !ReadVint(ptr_pos + id_length, ptr_end, false, &size, &size_length)) {
+    return -1;
+  }
+  ptr_pos += id_length + size_length;
+  uint32 id = 0;
+  while (ReadElementHeader(&ptr_pos, ptr_end, &id, &size) && size >= 0) {
+    if (id == kTimecodeId) {
+      return size > 8 ? -1 : static_cast<int64>(ReadUnsigned(ptr_pos, size));
+    }
+    ptr_pos += size;
+  }
+  return -1;
+}
+
+const SegmentCache::Entry* SegmentCache::Lookup(const std::string& id,
+                                                bool* ptr_evicted) const {
+  *ptr_evicted = false;
+  std::string rep_id;
+  int64 number = 0;
+  if (!ParseSegmentId(id, &rep_id, &number)) {
+    std::map<std::string, Entry>::const_iterator it = entries_.find(id);
+    return it == entries_.end() ? NULL : &it->second;
+  }
+  RepresentationMap::const_iterator rep = representations_.find(rep_id);
+  if (rep == representations_.end()) {
+    return NULL;
+  }
+  *ptr_evicted = number <= rep->second.evicted_number;
+  std::map<int64, Entry>::const_iterator it = rep->second.segments.find(number);
+  return it == rep->second.segments.end() ? NULL : &it->second;
+}
+
+bool SegmentCache::Store(const std::string& id, const Entry& entry,
+                         bool keep_complete) {
+  std::string rep_id;
+  int64 number = 0;
+  Entry* ptr_stored = NULL;
+  Representation* ptr_rep = NULL;
+  if (!ParseSegmentId(id, &rep_id, &number)) {
+    ptr_stored = &entries_[id];
+  } else {
+    ptr_rep = &representations_[rep_id];
+    if (number <= ptr_rep->evicted_number) {
+      // Late segment already out of the window.
+      return false;
+    }
+    std::map<int64, Entry>::iterator it = ptr_rep->segments.find(number);
+    if (it == ptr_rep->segments.end()) {
+      it = ptr_rep->segments.insert(std::make_pair(number, Entry())).first;
+      ++num_segments_;
+    }
+    ptr_stored = &it->second;
+  }
+  if (keep_complete && ptr_stored->chunk) {
+    return false;
+  }
+  if (ptr_stored->chunk) {
+    size_bytes_ -= ptr_stored->chunk->length();
+  }
+  *ptr_stored = entry;
+  if (entry.chunk) {
+    size_bytes_ += entry.chunk->length();
+  }
+  if (ptr_rep) {
+    Evict(rep_id, ptr_rep);
+  }
+  return true;
+}
+
+// Readers still sending an evicted segment keep their own reference.
+void SegmentCache::Evict(const std::string& rep_id,
+                         Representation* ptr_rep) {
+  std::map<int64, Entry>& segments = ptr_rep->segments;
+  int64 newest_ms = -1;
+  for (std::map<int64, Entry>::reverse_iterator it = segments.rbegin();
+       it != segments.rend() && newest_ms < 0; ++it) {
+    newest_ms = it->second.media_time_ms;
+  }
+  if (newest_ms >= 0) {
+    while (segments.size() > 1 &&
+           segments.begin()->second.media_time_ms >= 0 &&
+           segments.begin()->second.media_time_ms <
+               newest_ms - settings_.window_ms) {
+      EvictOldest(rep_id, ptr_rep);
+    }
+  }
+
+  // Over budget: evict the oldest complete segment of the stream, segments
+  // of unknown time first. Segments still being written hold no bytes here.
+  while (size_bytes_ > settings_.max_bytes) {
+    RepresentationMap::iterator oldest = representations_.end();
+    int64 oldest_ms = 0;
+    for (RepresentationMap::iterator rep = representations_.begin();
+         rep != representations_.end(); ++rep) {
+      if (rep->second.segments.empty()) {
+        continue;
+      }
+      const Entry& front = rep->second.segments.begin()->second;
+      if (front.chunk && (oldest == representations_.end() ||
+                          front.media_time_ms < oldest_ms)) {
+        oldest = rep;
+        oldest_ms = front.media_time_ms;
+      }
+    }
+    if (oldest == representations_.end()) {
+      break;
+    }
+    EvictOldest(oldest->first, &oldest->second);
+  }
+}
+
+void SegmentCache::EvictOldest(const std::string& rep_id,
+                               Representation* ptr_rep) {
+  std::map<int64, Entry>::iterator it = ptr_rep->segments.begin();
+  if (it->second.chunk) {
+    size_bytes_ -= it->second.chunk->length();
+    if (ptr_spill_sink_ &&
+        !ptr_spill_sink_->WriteChunk(it->second.chunk,
+                                     SegmentId(rep_id, it->first))) {
+      LOG(WARNING) << "segment cache spill failed for " << rep_id << " "
+                   << it->first;
+    }
+  }
+  ptr_rep->evicted_number = it->first;
+  ptr_rep->segments.erase(it);
+  --num_segments_;
+}
+
+std::string SegmentCache::SegmentId(const std::string& rep_id,
+                                    int64 number) {
+  char number_str[32];
+  snprintf(number_str, sizeof(number_str), "_%lld",
+           static_cast<long long>(number));  // NOLINT
+  return rep_id + number_str + kSegmentSuffix;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,174 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_SEGMENT_CACHE_H_
+#define WEBMLIVE_ENCODER_SEGMENT_CACHE_H_
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "encoder/basictypes.h"
+#include "encoder/buffer_util.h"
+
+namespace webmlive {
+
+class DataSinkInterface;
+
+struct SegmentCacheSettings {
+  static const int kDefaultWindowMs = 60000;
+  static const int64 kDefaultMaxBytes = 256LL * 1024 * 1024;
+
+  SegmentCacheSettings()
+      : window_ms(kDefaultWindowMs), max_bytes(kDefaultMaxBytes) {}
+
+  // Media time each representation keeps, usually the DASH time shift
+  // buffer depth: segments starting more than |window_ms| before the newest
+  // segment of their representation are evicted.
+  int window_ms;
+
+  // Bytes the complete segments of the stream may hold. The segments with the
+  // oldest media time are evicted first, across representations, when a new
+  // one would exceed it.
+  int64 max_bytes;
+};
+
+// Time-shift (DVR) window of a stream's chunks, kept in memory for readers
+// such as |HttpOrigin| and sinks joining after the stream started. Entries
+// hold references to the writer's chunks; no data is copied.
+//
+// Media segments, "<name>_<rep_id>_<number>.chk", are stored per
+// representation by number, along with the media time of their first
+// cluster, and evicted by media time and |SegmentCacheSettings::max_bytes|.
+// Other chunks, such as manifests and initialization segments, are kept
+// until replaced by a chunk of the same id. A segment still being written is
+// stored as a |StreamingChunk|, and replaced by the complete chunk once it
+// arrives. Complete segments evicted are passed to the spill sink when one is
+// set, such as a |DvrTierStore| holding the older part of a long DVR window.
+//
+// Notes
+// - Thread safe.
+class SegmentCache {
+ public:
+  enum {
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  SegmentCache();
+  ~SegmentCache() {}
+
+  // Empties the cache and applies |settings|. Returns |kSuccess| when
+  // successful.
+  int Init(const SegmentCacheSettings& settings);
+
+  // Writes the complete media segments evicted from now on to |ptr_sink|
+  // instead of dropping them. |ptr_sink| is called with the cache locked, so
+  // its |WriteChunk()| must only queue the segment, and must not call back
+  // into the cache. NULL drops evicted segments, the default.
+  void SetSpillSink(DataSinkInterface* ptr_sink);
+
+  // Stores complete |chunk| as |id|, and wakes the |Find()| calls waiting
+  // for it.
+  void Put(const std::string& id, const SharedDataChunk& chunk);
+
+  // Stores |stream|, which its writer is still appending to, as |id|. A
+  // complete chunk already stored as |id| is kept instead.
+  void PutStreaming(const std::string& id, const SharedStreamingChunk& stream);
+
+  // Looks up |id|, waiting up to |timeout_ms| for it to be stored. Returns
+  // true with |ptr_chunk| set for complete chunks and |ptr_stream| set for
+  // chunks still being written. Returns false when |id| is not stored in
+  // time, at once for segments already evicted, and once |Close()| is
+  // called.
+  bool Find(const std::string& id, int32 timeout_ms,
+            SharedDataChunk* ptr_chunk, SharedStreamingChunk* ptr_stream);
+
+  // Writes the complete chunks in the cache to |ptr_sink|: initialization
+  // segments, media segments in media time order, then manifests. Lets a
+  // sink added to a running stream start with the whole time-shift window.
+  // Returns the number of chunks written.
+  int Replay(DataSinkInterface* ptr_sink) const;
+
+  // Wakes all |Find()| calls, and makes later calls fail.
+  void Close();
+
+  // Number of entries, and the bytes held by the complete ones.
+  int num_entries() const;
+  int64 size_bytes() const;
+
+  // Splits the id of a media segment into its representation, "<name>_<rep>",
+  // and number. Returns false for other ids.
+  static bool ParseSegmentId(const std::string& id,
+                             std::string* ptr_representation,
+                             int64* ptr_number);
+
+  // Reads the timecode of the cluster |chunk| starts with. Returns -1 when
+  // |chunk| does not start with a cluster timecode.
+  static int64 ReadMediaTime(const DataChunk& chunk);
+
+ private:
+  struct Entry {
+    Entry() : media_time_ms(-1) {}
+    SharedDataChunk chunk;
+    SharedStreamingChunk stream;
+
+    // Start of the first cluster of |chunk|, or -1 when unknown.
+    int64 media_time_ms;
+  };
+
+  // Media segments of one representation by number, and the newest number
+  // evicted.
+  struct Representation {
+    Representation() : evicted_number(-1) {}
+    std::map<int64, Entry> segments;
+    int64 evicted_number;
+  };
+  typedef std::map<std::string, Representation> RepresentationMap;
+
+  // Returns the entry stored as |id|, or NULL. Sets |ptr_evicted| when |id|
+  // is a media segment already evicted. |mutex_| must be held.
+  const Entry* Lookup(const std::string& id, bool* ptr_evicted) const;
+
+  // Stores |entry| as |id|, and evicts what falls out of the window or the
+  // byte budget. Keeps a complete entry instead of a streaming |entry| when
+  // |keep_complete| is true. Returns false when nothing is stored. |mutex_|
+  // must be held.
+  bool Store(const std::string& id, const Entry& entry, bool keep_complete);
+
+  // Evicts the segments of |ptr_rep|, named |rep_id|, older than the window,
+  // then the oldest segments of the stream while over |max_bytes|. |mutex_|
+  // must be held.
+  void Evict(const std::string& rep_id, Representation* ptr_rep);
+
+  // Removes the oldest segment of |ptr_rep|, named |rep_id|, and writes it to
+  // |ptr_spill_sink_| when complete. |mutex_| must be held.
+  void EvictOldest(const std::string& rep_id, Representation* ptr_rep);
+
+  // Returns the id of segment |number| of representation |rep_id|.
+  static std::string SegmentId(const std::string& rep_id, int64 number);
+
+  SegmentCacheSettings settings_;
+
+  // Entries that are not media segments, media segments by representation,
+  // and the bytes held by complete entries. Protected by |mutex_|;
+  // |entry_stored_| is notified for each |Store()| and by |Close()|.
+  mutable std::mutex mutex_;
+  std::condition_variable entry_stored_;
+  std::map<std::string, Entry> entries_;
+  RepresentationMap representations_;
+  int64 size_bytes_;
+  int num_segments_;
+  bool closed_;
+  DataSinkInterface* ptr_spill_sink_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(SegmentCache);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_SEGMENT_CACHE_H_
@@ -0,0 +1,456 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/shared_memory_source.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/latency_tracer.h"
+#include "encoder/thread_placement.h"
+#include "encoder/trace_log.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+SharedMemorySource::SharedMemorySource()
+    : ptr_audio_callback_(NULL),
+      ptr_video_callback_(NULL),
+      ptr_header_(NULL),
+      region_size_(0),
+#ifdef _WIN32
+      mapping_(NULL),
+#else
+      fd_(-1),
+#endif
+      video_frame_size_(0),
+      standby_(false),
+      watching_(false),
+      promote_(false),
+      video_cursor_(0),
+      audio_cursor_(0),
+      slots_lost_(0),
+      stop_(false),
+      status_(kSuccess) {
+}
+
+SharedMemorySource::~SharedMemorySource() {
+  Stop();
+  UnmapRegion();
+}
+
+int SharedMemorySource::Init(const WebmEncoderConfig& config,
+                             AudioSamplesCallbackInterface* ptr_audio_callback,
+                             VideoFrameCallbackInterface* ptr_video_callback) {
+  if (config.input_shared_memory.empty()) {
+    LOG(ERROR) << "SharedMemorySource has no region name.";
+    return WebmEncoder::kInvalidArg;
+  }
+  if (!MapRegion(config.input_shared_memory)) {
+    LOG(ERROR) << "SharedMemorySource cannot map "
+               << config.input_shared_memory;
+    return WebmEncoder::kInitFailed;
+  }
+  const SharedMemoryHeader& header = *ptr_header_;
+  if (header.magic != SharedMemoryHeader::kMagic ||
+      header.version != SharedMemoryHeader::kVersion) {
+    LOG(ERROR) << "SharedMemorySource region has no valid header.";
+    return WebmEncoder::kInitFailed;
+  }
+
+  if (!config.disable_video) {
+    if (!ptr_video_callback) {
+      LOG(ERROR) << "SharedMemorySource NULL video callback.";
+      return WebmEncoder::kInvalidArg;
+    }
+    const VideoFormat format = static_cast<VideoFormat>(header.video_format);
+    if ((format != kVideoFormatI420 && format != kVideoFormatNV12) ||
+        header.width <= 0 || header.height <= 0 || header.width & 1 ||
+        header.height & 1 || header.frame_rate <= 0) {
+      LOG(ERROR) << "SharedMemorySource unsupported video format.";
+      return WebmEncoder::kNoVideoSource;
+    }
+    video_frame_size_ = header.width * header.height * 3 / 2;
+    if (!ValidRing(header.video_ring) ||
+        header.video_ring.slot_size - sizeof(SharedMemorySlotHeader) <
+            static_cast<uint32>(video_frame_size_)) {
+      LOG(ERROR) << "SharedMemorySource has no usable video ring.";
+      return WebmEncoder::kNoVideoSource;
+    }
+    actual_video_config_.format = format;
+    actual_video_config_.width = header.width;
+    actual_video_config_.height = header.height;
+    actual_video_config_.stride = header.width;
+    actual_video_config_.frame_rate = header.frame_rate;
+    ptr_video_callback_ = ptr_video_callback;
+  }
+
+  if (!config.disable_audio) {
+    if (!ptr_audio_callback) {
+      LOG(ERROR) << "SharedMemorySource NULL audio callback.";
+      return WebmEncoder::kInvalidArg;
+    }
+    const int bits_per_sample = header.audio_bits_per_sample;
+    if (header.audio_channels <= 0 || header.audio_channels > 2 ||
+        header.audio_sample_rate <= 0 ||
+        (bits_per_sample != 16 && bits_per_sample != 32)) {
+      LOG(ERROR) << "SharedMemorySource unsupported audio format.";
+      return WebmEncoder::kNoAudioSource;
+    }
+    if (!ValidRing(header.audio_ring)) {
+      LOG(ERROR) << "SharedMemorySource has no usable audio ring.";
+      return WebmEncoder::kNoAudioSource;
+    }
+    AudioConfig& ac = actual_audio_config_;
+    ac.format_tag =
+        bits_per_sample == 16 ? kAudioFormatPcm : kAudioFormatIeeeFloat;
+    ac.channels = static_cast<uint16>(header.audio_channels);
+    ac.sample_rate = header.audio_sample_rate;
+    ac.bits_per_sample = static_cast<uint16>(bits_per_sample);
+    ac.block_align = ac.channels * ac.bits_per_sample / 8;
+    ac.bytes_per_second = ac.block_align * ac.sample_rate;
+    ptr_audio_callback_ = ptr_audio_callback;
+  }
+  standby_ = config.standby;
+  LOG(INFO) << "SharedMemorySource mapped " << config.input_shared_memory
+            << ", " << region_size_ << " bytes"
+            << (standby_ ? ", in standby." : ".");
+  return WebmEncoder::kSuccess;
+}
+
+int SharedMemorySource::Run() {
+  if (delivery_thread_) {
+    LOG(ERROR) << "SharedMemorySource already running.";
+    return WebmEncoder::kRunFailed;
+  }
+  stop_ = false;
+  watching_ = standby_ && !promote_;
+  if (watching_) {
+    video_cursor_ =
+        ptr_header_->video_ring.read_count.load(std::memory_order_acquire);
+    audio_cursor_ =
+        ptr_header_->audio_ring.read_count.load(std::memory_order_acquire);
+  }
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  delivery_thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&SharedMemorySource::DeliveryThread,  // NOLINT
+                                this)));
+  if (!delivery_thread_) {
+    LOG(ERROR) << "SharedMemorySource cannot construct thread.";
+    return WebmEncoder::kRunFailed;
+  }
+  return WebmEncoder::kSuccess;
+}
+
+int SharedMemorySource::CheckStatus() {
+  const int status = status_;
+  if (status == kBadSlot) {
+    return WebmEncoder::kAVCaptureStopped;
+  }
+  return status;
+}
+
+void SharedMemorySource::Stop() {
+  if (!delivery_thread_) {
+    return;
+  }
+  stop_ = true;
+  delivery_thread_->join();
+  delivery_thread_.reset();
+}
+
+int SharedMemorySource::Promote() {
+  if (!standby_) {
+    LOG(ERROR) << "SharedMemorySource not in standby.";
+    return WebmEncoder::kInvalidArg;
+  }
+  promote_.store(true, std::memory_order_release);
+  return WebmEncoder::kSuccess;
+}
+
+bool SharedMemorySource::MapRegion(const std::string& name) {
+#ifdef _WIN32
+  mapping_ = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+  if (!mapping_) {
+    LOG(ERROR) << "OpenFileMapping failed: " << GetLastError();
+    return false;
+  }
+  void* const ptr_view = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+  if (!ptr_view) {
+    LOG(ERROR) << "MapViewOfFile failed: " << GetLastError();
+    return false;
+  }
+  ptr_header_ = reinterpret_cast<SharedMemoryHeader*>(ptr_view);
+  MEMORY_BASIC_INFORMATION info = {0};
+  if (!VirtualQuery(ptr_view, &info, sizeof(info))) {
+    LOG(ERROR) << "VirtualQuery failed: " << GetLastError();
+    return false;
+  }
+  region_size_ = info.RegionSize;
+#else
+  fd_ = shm_open(name.c_str(), O_RDWR, 0);
+  if (fd_ < 0) {
+    LOG(ERROR) << "shm_open failed: " << strerror(errno);
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd_, &file_stat) || file_stat.st_size <= 0) {
+    LOG(ERROR) << "shared memory region is empty.";
+    return false;
+  }
+  void* const ptr_view = mmap(NULL, file_stat.st_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED, fd_, 0);
+  if (ptr_view == MAP_FAILED) {
+    LOG(ERROR) << "mmap failed: " << strerror(errno);
+    return false;
+  }
+  ptr_header_ = reinterpret_cast<SharedMemoryHeader*>(ptr_view);
+  region_size_ = file_stat.st_size;
+#endif
+  if (region_size_ < sizeof(SharedMemoryHeader)) {
+    LOG(ERROR) << "shared memory region too small for its header.";
+    return false;
+  }
+  return true;
+}
+
+void SharedMemorySource::UnmapRegion() {
+#ifdef _WIN32
+  if (ptr_header_) {
+    UnmapViewOfFile(ptr_header_);
+  }
+  if (mapping_) {
+    CloseHandle(mapping_);
+    mapping_ = NULL;
+  }
+#else
+  if (ptr_header_) {
+    munmap(ptr_header_, region_size_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+#endif
+  ptr_header_ = NULL;
+  region_size_ = 0;
+}
+
+bool SharedMemorySource::ValidRing(const SharedMemoryRingHeader& ring) const {
+  if (ring.slot_count == 0 ||
+      ring.slot_size <= sizeof(SharedMemorySlotHeader) ||
+      ring.offset < sizeof(SharedMemoryHeader) ||
+      ring.offset % sizeof(int64) || ring.slot_size % sizeof(int64)) {
+    return false;
+  }
+  const uint64 ring_end =
+      ring.offset + static_cast<uint64>(ring.slot_count) * ring.slot_size;
+  return ring_end <= region_size_;
+}
+
+const SharedMemorySlotHeader* SharedMemorySource::Slot(
+    const SharedMemoryRingHeader& ring, uint32 count) const {
+  const uint8* const ptr_region = reinterpret_cast<const uint8*>(ptr_header_);
+  const uint64 slot_offset =
+      ring.offset + static_cast<uint64>(count % ring.slot_count) *
+      ring.slot_size;
+  return reinterpret_cast<const SharedMemorySlotHeader*>(ptr_region +
+                                                         slot_offset);
+}
+
+uint32 SharedMemorySource::NextSlot(const SharedMemoryRingHeader& ring,
+                                    uint32 cursor) const {
+  return watching_ ? cursor : ring.read_count.load(std::memory_order_relaxed);
+}
+
+bool SharedMemorySource::Release(SharedMemoryRingHeader* ptr_ring,
+                                 uint32 count, uint32* ptr_cursor) {
+  if (!watching_) {
+    ptr_ring->read_count.store(count + 1, std::memory_order_release);
+    return true;
+  }
+
+  // The producer reuses slot |count| only once |write_count| has reached
+  // |count + slot_count|. Order the copy before the check.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  const uint32 write_count =
+      ptr_ring->write_count.load(std::memory_order_relaxed);
+  if (write_count - count < ptr_ring->slot_count) {
+    *ptr_cursor = count + 1;
+    return true;
+  }
+  *ptr_cursor = ptr_ring->read_count.load(std::memory_order_acquire);
+  ++slots_lost_;
+  LOG_EVERY_N(WARNING, 100) << "SharedMemorySource standby fell behind the "
+                            << "producer; " << slots_lost_ << " slots lost.";
+  return false;
+}
+
+void SharedMemorySource::TakeOverRings() {
+  SharedMemoryRingHeader* const rings[] = {
+    &ptr_header_->video_ring, &ptr_header_->audio_ring,
+  };
+  const uint32 cursors[] = {video_cursor_, audio_cursor_};
+  const bool delivered[] = {ptr_video_callback_ != NULL,
+                            ptr_audio_callback_ != NULL};
+  for (int i = 0; i < 2; ++i) {
+    if (!delivered[i]) {
+      continue;
+    }
+    SharedMemoryRingHeader& ring = *rings[i];
+    // Keep the consumer's position unless the cursor is ahead of it and
+    // still within the published slots.
+    const uint32 read_count = ring.read_count.load(std::memory_order_acquire);
+    const uint32 write_count =
+        ring.write_count.load(std::memory_order_acquire);
+    if (cursors[i] - read_count <= write_count - read_count) {
+      ring.read_count.store(cursors[i], std::memory_order_release);
+    } else {
+      slots_lost_ += read_count - cursors[i];
+    }
+  }
+  watching_ = false;
+  LOG(INFO) << "SharedMemorySource took over the rings; " << slots_lost_
+            << " slots lost in standby.";
+}
+
+int SharedMemorySource::DeliverVideo() {
+  SharedMemoryRingHeader& ring = ptr_header_->video_ring;
+  const uint32 read_count = NextSlot(ring, video_cursor_);
+  if (ring.write_count.load(std::memory_order_acquire) == read_count) {
+    return kEmpty;
+  }
+  const SharedMemorySlotHeader* const ptr_slot = Slot(ring, read_count);
+  if (ptr_slot->length != video_frame_size_) {
+    if (watching_ && !Release(&ring, read_count, &video_cursor_)) {
+      return kSuccess;
+    }
+    LOG(ERROR) << "SharedMemorySource video slot length " << ptr_slot->length
+               << ", expected " << video_frame_size_;
+    return kBadSlot;
+  }
+  const int64 timestamp = ptr_slot->timestamp;
+  const int status = video_frame_.Init(
+      actual_video_config_, true,  // always "keyframes"
+      timestamp, ptr_slot->duration,
+      reinterpret_cast<const uint8*>(ptr_slot + 1), ptr_slot->length);
+
+  // The slot has been copied, or the frame is lost: hand it back.
+  if (!Release(&ring, read_count, &video_cursor_)) {
+    return kSuccess;
+  }
+  if (status) {
+    LOG(ERROR) << "SharedMemorySource video frame Init failed: " << status;
+    return kSuccess;
+  }
+  LatencyTracer::Stamp(LatencyTracer::kCapture, timestamp);
+  const int callback_status =
+      ptr_video_callback_->OnVideoFrameReceived(&video_frame_);
+  if (callback_status &&
+      callback_status != VideoFrameCallbackInterface::kDropped) {
+    LOG(ERROR) << "OnVideoFrameReceived failed, status=" << callback_status;
+  }
+  WEBMLIVE_TRACE_EVERY_N(TraceLog::kFrame, 30, "video_shm_read")
+      << " timestamp=" << timestamp;
+  return kSuccess;
+}
+
+int SharedMemorySource::DeliverAudio() {
+  SharedMemoryRingHeader& ring = ptr_header_->audio_ring;
+  const uint32 read_count = NextSlot(ring, audio_cursor_);
+  if (ring.write_count.load(std::memory_order_acquire) == read_count) {
+    return kEmpty;
+  }
+  const SharedMemorySlotHeader* const ptr_slot = Slot(ring, read_count);
+  const int32 max_length =
+      static_cast<int32>(ring.slot_size - sizeof(SharedMemorySlotHeader));
+  if (ptr_slot->length <= 0 || ptr_slot->length > max_length ||
+      ptr_slot->length % actual_audio_config_.block_align) {
+    if (watching_ && !Release(&ring, read_count, &audio_cursor_)) {
+      return kSuccess;
+    }
+    LOG(ERROR) << "SharedMemorySource audio slot length " << ptr_slot->length
+               << " invalid.";
+    return kBadSlot;
+  }
+  const int status = audio_buffer_.Init(
+      actual_audio_config_, ptr_slot->timestamp, ptr_slot->duration,
+      reinterpret_cast<const uint8*>(ptr_slot + 1), ptr_slot->length);
+  if (!Release(&ring, read_count, &audio_cursor_)) {
+    return kSuccess;
+  }
+  if (status) {
+    LOG(ERROR) << "SharedMemorySource audio buffer Init failed: " << status;
+    return kSuccess;
+  }
+  const int callback_status =
+      ptr_audio_callback_->OnSamplesReceived(&audio_buffer_);
+  if (callback_status &&
+      callback_status != AudioSamplesCallbackInterface::kDropped) {
+    LOG(ERROR) << "OnSamplesReceived failed, status=" << callback_status;
+  }
+  return kSuccess;
+}
+
+void SharedMemorySource::DeliveryThread() {
+  LOG(INFO) << "SharedMemorySource thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kCapture);
+  ScopedCpuStage cpu_stage(kCpuCapture);
+  int64 video_frames = 0;
+  int64 audio_buffers = 0;
+  while (!stop_) {
+    if (watching_ && promote_.load(std::memory_order_acquire)) {
+      TakeOverRings();
+    }
+
+    // Check |ended| before the rings, so that slots published before it was
+    // set are always drained.
+    const bool ended =
+        ptr_header_->ended.load(std::memory_order_acquire) != 0;
+    int video_status = kEmpty;
+    int audio_status = kEmpty;
+    if (ptr_video_callback_) {
+      video_status = DeliverVideo();
+      video_frames += video_status == kSuccess;
+    }
+    if (ptr_audio_callback_ && video_status != kBadSlot) {
+      audio_status = DeliverAudio();
+      audio_buffers += audio_status == kSuccess;
+    }
+    if (video_status == kBadSlot || audio_status == kBadSlot) {
+      status_ = kBadSlot;
+      break;
+    }
+    if (video_status == kEmpty && audio_status == kEmpty) {
+      if (ended) {
+        status_ = kInputEnded;
+        break;
+      }
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(kPollIntervalMs));
+    }
+  }
+  LOG(INFO) << "SharedMemorySource thread finished: " << video_frames
+            << " video frames, " << audio_buffers << " audio buffers.";
+}
+
+}  // namespace webmlive
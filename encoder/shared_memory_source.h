@@ -0,0 +1,230 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_SHARED_MEMORY_SOURCE_H_
+#define WEBMLIVE_ENCODER_SHARED_MEMORY_SOURCE_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/media_source.h"
+#include "encoder/video_encoder.h"
+#include "encoder/webm_encoder.h"
+
+namespace webmlive {
+
+// Single producer, single consumer ring of fixed size slots within the shared
+// memory region. Each slot starts with a |SharedMemorySlotHeader| followed by
+// the payload.
+struct SharedMemoryRingHeader {
+  // Number of slots, size in bytes of each slot including its header, and
+  // offset of the first slot from the start of the region. |slot_count| 0
+  // means the stream is absent.
+  uint32 slot_count;
+  uint32 slot_size;
+  uint32 offset;
+  uint32 reserved;
+
+  // Slots written by the producer and slots read by the encoder since the
+  // region was created. Both only grow, wrapping at 2^32, and slot
+  // |count % slot_count| is the next one to write or read. The producer
+  // writes a slot and then increments |write_count|; the encoder reads it and
+  // then increments |read_count|. The ring is full when the counts differ by
+  // |slot_count|.
+  std::atomic<uint32> write_count;
+  std::atomic<uint32> read_count;
+};
+
+struct SharedMemorySlotHeader {
+  // Timestamp and duration of the payload, in milliseconds.
+  int64 timestamp;
+  int64 duration;
+
+  // Payload bytes following the header.
+  int32 length;
+  int32 reserved;
+};
+
+// Header at the start of the shared memory region. The producer creates the
+// region, and fills in every field other than the ring counts before setting
+// |magic|.
+struct SharedMemoryHeader {
+  static const uint32 kMagic = 0x4d534c57;  // "WLSM"
+  static const uint32 kVersion = 1;
+
+  uint32 magic;
+  uint32 version;
+
+  // Video frames: |kVideoFormatI420| or |kVideoFormatNV12|, packed with no
+  // padding between rows or planes.
+  int32 video_format;
+  int32 width;
+  int32 height;
+  int32 reserved0;
+  double frame_rate;
+
+  // Audio blocks: interleaved 16 bit PCM, or 32 bit float when
+  // |audio_bits_per_sample| is 32.
+  int32 audio_channels;
+  int32 audio_sample_rate;
+  int32 audio_bits_per_sample;
+
+  // Set to 1 by the producer after its last slot.
+  std::atomic<uint32> ended;
+
+  SharedMemoryRingHeader video_ring;
+  SharedMemoryRingHeader audio_ring;
+};
+
+// Media source that reads raw video frames and audio blocks written by
+// another process into a named shared memory region, laid out as described
+// by |SharedMemoryHeader|.
+//
+// Notes
+// - The region is named by |WebmEncoderConfig::input_shared_memory|: a file
+//   mapping name on Windows, and a POSIX shared memory object name
+//   elsewhere. The producer must create it before |Init()|.
+// - Slots are copied straight into the frames and buffers passed to the
+//   callbacks, converting NV12 to I420 in the same pass, and released to the
+//   producer at once. No other copy is made.
+// - The delivery thread polls the rings every |kPollIntervalMs| while both
+//   are empty.
+// - Producer timestamps are passed through unchanged.
+// - With |WebmEncoderConfig::standby| the source only watches the rings
+//   while another encoder consumes them: it copies each slot the producer
+//   publishes without releasing it, and drops the slots the producer reuses
+//   before the copy completes. |Promote()| makes it the consumer, starting
+//   at the first slot it has not delivered.
+class SharedMemorySource : public MediaSourceInterface {
+ public:
+  // Longest delay between a slot being published and the delivery thread
+  // noticing it.
+  static const int kPollIntervalMs = 1;
+
+  SharedMemorySource();
+  virtual ~SharedMemorySource();
+
+  // Maps the region and validates its header. Streams disabled in |config|
+  // are ignored; enabled streams must be present in the region. Returns
+  // |kSuccess| upon success, or a |WebmEncoder| status code upon failure.
+  virtual int Init(const WebmEncoderConfig& config,
+                   AudioSamplesCallbackInterface* ptr_audio_callback,
+                   VideoFrameCallbackInterface* ptr_video_callback);
+
+  // Starts the delivery thread. Returns |kSuccess| upon success, or a
+  // |WebmEncoder| status code upon failure.
+  virtual int Run();
+
+  // Returns |kSuccess| while delivering samples, |kInputEnded| once the
+  // producer has ended and the rings are drained, and
+  // |WebmEncoder::kAVCaptureStopped| when a slot is malformed.
+  virtual int CheckStatus();
+
+  // Stops and joins the delivery thread.
+  virtual void Stop();
+
+  // Makes a standby source the consumer of the rings on the next pass of the
+  // delivery thread. Returns |WebmEncoder::kInvalidArg| when the source was
+  // not opened in standby.
+  virtual int Promote();
+
+  virtual AudioConfig actual_audio_config() const {
+    return actual_audio_config_;
+  }
+  virtual VideoConfig actual_video_config() const {
+    return actual_video_config_;
+  }
+
+ private:
+  enum {
+    kSuccess = 0,
+    // Returned by |Deliver*()| when the ring is empty.
+    kEmpty = 1,
+    // Returned by |Deliver*()| when the slot is malformed.
+    kBadSlot = -1,
+  };
+
+  // Opens and maps the region named |name|. Returns true when successful.
+  bool MapRegion(const std::string& name);
+  void UnmapRegion();
+
+  // Returns true when |ring| lies within the mapped region and its slots can
+  // hold a header.
+  bool ValidRing(const SharedMemoryRingHeader& ring) const;
+
+  // Returns the slot |count| of |ring|.
+  const SharedMemorySlotHeader* Slot(const SharedMemoryRingHeader& ring,
+                                     uint32 count) const;
+
+  // Returns the count of the next slot of |ring| to read: its |read_count|,
+  // or |cursor| while watching in standby.
+  uint32 NextSlot(const SharedMemoryRingHeader& ring, uint32 cursor) const;
+
+  // Releases slot |count| of |ptr_ring| once it has been copied: hands it
+  // back to the producer, or in standby moves |*ptr_cursor| past it. Returns
+  // false when, in standby, the producer may have reused the slot during the
+  // copy; |*ptr_cursor| then moves to the oldest slot the producer still
+  // holds for the consumer.
+  bool Release(SharedMemoryRingHeader* ptr_ring, uint32 count,
+               uint32* ptr_cursor);
+
+  // Makes the delivery thread the consumer of the rings, from the first slot
+  // it has not delivered, or from |read_count| when the consumer was ahead.
+  void TakeOverRings();
+
+  // Deliver the oldest slot of the video or audio ring, and release it.
+  int DeliverVideo();
+  int DeliverAudio();
+
+  // Delivery thread function.
+  void DeliveryThread();
+
+  AudioSamplesCallbackInterface* ptr_audio_callback_;
+  VideoFrameCallbackInterface* ptr_video_callback_;
+  AudioConfig actual_audio_config_;
+  VideoConfig actual_video_config_;
+
+  // Mapped region.
+  SharedMemoryHeader* ptr_header_;
+  uint64 region_size_;
+#ifdef _WIN32
+  void* mapping_;
+#else
+  int fd_;
+#endif
+
+  // Size in bytes of one video frame.
+  int32 video_frame_size_;
+
+  // Sample storage reused by the delivery thread.
+  VideoFrame video_frame_;
+  AudioBuffer audio_buffer_;
+
+  // Standby state. |watching_| is true from |Run()| until the delivery
+  // thread takes over the rings after |Promote()|, and the cursors are the
+  // next slots it delivers meanwhile. Owned by the delivery thread, except
+  // |standby_| and |promote_|.
+  bool standby_;
+  bool watching_;
+  std::atomic<bool> promote_;
+  uint32 video_cursor_;
+  uint32 audio_cursor_;
+  int64 slots_lost_;
+
+  std::atomic<bool> stop_;
+  std::atomic<int> status_;
+  std::shared_ptr<std::thread> delivery_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(SharedMemorySource);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_SHARED_MEMORY_SOURCE_H_
@@ -0,0 +1,321 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/slab_allocator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Smallest class, and the largest; larger requests are not cached.
+const size_t kMinBlockSize = 1024;
+const size_t kMaxBlockSize = 256 * 1024 * 1024;
+
+enum BlockBacking {
+  kBackingHeap = 0,
+  kBackingMapped = 1,
+  kBackingHugePages = 2,
+};
+
+// Stored in the |SlabAllocator::kAlignment| bytes that precede each block.
+struct BlockHeader {
+  // Payload size, and the size of the system allocation holding the header
+  // and payload.
+  uint64 block_size;
+  uint64 system_size;
+
+  // Index of the block's size class, or -1 for uncached blocks.
+  int32 size_class;
+  int32 backing;
+};
+
+size_t RoundUp(size_t value, size_t multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+BlockHeader* HeaderOf(uint8* ptr_block) {
+  return reinterpret_cast<BlockHeader*>(ptr_block - SlabAllocator::kAlignment);
+}
+
+#ifdef _WIN32
+// Commits |size| bytes, on NUMA node |numa_node| unless it is -1.
+uint8* VirtualAllocOnNode(size_t size, DWORD allocation_type, int numa_node) {
+  void* ptr_memory = NULL;
+  if (numa_node < 0) {
+    ptr_memory = VirtualAlloc(NULL, size, allocation_type, PAGE_READWRITE);
+  } else {
+    ptr_memory = VirtualAllocExNuma(GetCurrentProcess(), NULL, size,
+                                    allocation_type, PAGE_READWRITE,
+                                    static_cast<DWORD>(numa_node));
+  }
+  return reinterpret_cast<uint8*>(ptr_memory);
+}
+#else
+// Prefers NUMA node |numa_node| for the untouched mapping at |ptr_map|. Uses
+// the system call directly so that libnuma is not needed.
+void BindToNode(void* ptr_map, size_t size, int numa_node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  const int kMpolPreferred = 1;
+  const int kMaxNode = 1024;
+  if (numa_node < 0 || numa_node >= kMaxNode) {
+    return;
+  }
+  uint64 node_mask[kMaxNode / 64] = {0};
+  node_mask[numa_node / 64] = static_cast<uint64>(1) << (numa_node % 64);
+  if (syscall(SYS_mbind, ptr_map, size, kMpolPreferred, node_mask,
+              kMaxNode + 1, 0)) {
+    LOG_FIRST_N(WARNING, 1) << "SlabAllocator cannot bind to NUMA node "
+                            << numa_node << ".";
+  }
+#else
+  (void)ptr_map;
+  (void)size;
+  (void)numa_node;
+#endif
+}
+#endif
+}  // namespace
+
+SlabAllocator& SlabAllocator::Instance() {
+  // Deliberately leaked: static storage |VideoFrame|s may free their buffers
+  // after a static allocator would have been destroyed.
+  static SlabAllocator* const allocator =
+      new (std::nothrow) SlabAllocator();  // NOLINT
+  CHECK_NOTNULL(allocator);
+  return *allocator;
+}
+
+SlabAllocator::SlabAllocator()
+    : system_allocations_(0),
+      system_frees_(0),
+      cache_hits_(0),
+      cached_bytes_(0),
+      huge_page_blocks_(0),
+      numa_node_(-1) {
+  static_assert(sizeof(BlockHeader) <= kAlignment,
+                "BlockHeader must fit in the alignment padding.");
+  std::vector<size_t> sizes;
+  for (size_t base = kMinBlockSize; base < kHugePageSize; base *= 2) {
+    for (size_t quarter = 4; quarter < 8; ++quarter) {
+      const size_t size = base * quarter / 4;
+      if (size < kHugePageSize) {
+        sizes.push_back(size);
+      }
+    }
+  }
+  for (size_t size = kHugePageSize; size <= kMaxBlockSize;
+       size += kHugePageSize) {
+    // Mapped blocks fill whole huge pages, header included.
+    sizes.push_back(size - kAlignment);
+  }
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    std::unique_ptr<SizeClass> size_class(
+        new (std::nothrow) SizeClass());  // NOLINT
+    CHECK_NOTNULL(size_class.get());
+    size_class->block_size = sizes[i];
+    classes_.push_back(std::move(size_class));
+  }
+}
+
+uint8* SlabAllocator::Allocate(int32 size) {
+  if (size <= 0) {
+    return NULL;
+  }
+  const int index = SizeClassIndex(static_cast<size_t>(size));
+  if (index < 0) {
+    return SystemAllocate(static_cast<size_t>(size), -1);
+  }
+  SizeClass& size_class = *classes_[index];
+  {
+    std::lock_guard<std::mutex> lock(size_class.mutex);
+    if (!size_class.free_blocks.empty()) {
+      uint8* const ptr_block = size_class.free_blocks.back();
+      size_class.free_blocks.pop_back();
+      cached_bytes_.fetch_sub(size_class.block_size,
+                              std::memory_order_relaxed);
+      cache_hits_.fetch_add(1, std::memory_order_relaxed);
+      return ptr_block;
+    }
+  }
+  return SystemAllocate(size_class.block_size, index);
+}
+
+void SlabAllocator::Free(uint8* ptr_block) {
+  if (!ptr_block) {
+    return;
+  }
+  const BlockHeader* const ptr_header = HeaderOf(ptr_block);
+  const int index = ptr_header->size_class;
+  const int64 block_size = static_cast<int64>(ptr_header->block_size);
+  if (index >= 0 && cached_bytes_.fetch_add(block_size) + block_size <=
+                        kMaxCachedBytes) {
+    SizeClass& size_class = *classes_[index];
+    std::lock_guard<std::mutex> lock(size_class.mutex);
+    size_class.free_blocks.push_back(ptr_block);
+    return;
+  }
+  if (index >= 0) {
+    cached_bytes_.fetch_sub(block_size);
+  }
+  SystemFree(ptr_block);
+}
+
+void SlabAllocator::ReleaseCache() {
+  for (size_t i = 0; i < classes_.size(); ++i) {
+    std::vector<uint8*> blocks;
+    {
+      std::lock_guard<std::mutex> lock(classes_[i]->mutex);
+      blocks.swap(classes_[i]->free_blocks);
+    }
+    for (size_t j = 0; j < blocks.size(); ++j) {
+      cached_bytes_.fetch_sub(classes_[i]->block_size);
+      SystemFree(blocks[j]);
+    }
+  }
+}
+
+SlabAllocator::Stats SlabAllocator::stats() const {
+  Stats stats;
+  stats.system_allocations = system_allocations_.load();
+  stats.system_frees = system_frees_.load();
+  stats.cache_hits = cache_hits_.load();
+  stats.cached_bytes = cached_bytes_.load();
+  stats.huge_page_blocks = huge_page_blocks_.load();
+  return stats;
+}
+
+int SlabAllocator::SizeClassIndex(size_t size) const {
+  // |classes_| is short; a binary search keeps lookups to a few compares.
+  size_t low = 0;
+  size_t high = classes_.size();
+  while (low < high) {
+    const size_t middle = (low + high) / 2;
+    if (classes_[middle]->block_size < size) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low < classes_.size() ? static_cast<int>(low) : -1;
+}
+
+uint8* SlabAllocator::SystemAllocate(size_t block_size, int size_class) {
+  const size_t total_size = kAlignment + block_size;
+  uint8* ptr_memory = NULL;
+  size_t system_size = total_size;
+  int32 backing = kBackingHeap;
+
+  if (total_size >= kHugePageSize) {
+    const int numa_node = numa_node_.load(std::memory_order_relaxed);
+    system_size = RoundUp(total_size, kHugePageSize);
+#ifdef _WIN32
+    // Large pages need the lock pages privilege; fall back to normal pages.
+    const SIZE_T large_page_size = GetLargePageMinimum();
+    if (large_page_size > 0) {
+      const size_t large_size = RoundUp(total_size, large_page_size);
+      ptr_memory = VirtualAllocOnNode(
+          large_size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, numa_node);
+      if (ptr_memory) {
+        system_size = large_size;
+        backing = kBackingHugePages;
+      }
+    }
+    if (!ptr_memory) {
+      ptr_memory = VirtualAllocOnNode(system_size, MEM_RESERVE | MEM_COMMIT,
+                                      numa_node);
+      backing = kBackingMapped;
+    }
+#else
+    void* ptr_map = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    ptr_map = mmap(NULL, system_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    backing = kBackingHugePages;
+#endif
+    if (ptr_map == MAP_FAILED) {
+      // No reserved huge pages: ask for transparent huge pages instead.
+      ptr_map = mmap(NULL, system_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      backing = kBackingMapped;
+#ifdef MADV_HUGEPAGE
+      if (ptr_map != MAP_FAILED) {
+        madvise(ptr_map, system_size, MADV_HUGEPAGE);
+      }
+#endif
+    }
+    if (ptr_map != MAP_FAILED) {
+      BindToNode(ptr_map, system_size, numa_node);
+      ptr_memory = reinterpret_cast<uint8*>(ptr_map);
+    }
+#endif
+  } else {
+#ifdef _WIN32
+    ptr_memory = reinterpret_cast<uint8*>(
+        _aligned_malloc(total_size, kAlignment));
+#else
+    void* ptr_heap = NULL;
+    if (posix_memalign(&ptr_heap, kAlignment, total_size) == 0) {
+      ptr_memory = reinterpret_cast<uint8*>(ptr_heap);
+    }
+#endif
+  }
+  if (!ptr_memory) {
+    LOG(ERROR) << "SlabAllocator cannot allocate " << block_size << " bytes.";
+    return NULL;
+  }
+
+  BlockHeader* const ptr_header = reinterpret_cast<BlockHeader*>(ptr_memory);
+  ptr_header->block_size = block_size;
+  ptr_header->system_size = system_size;
+  ptr_header->size_class = size_class;
+  ptr_header->backing = backing;
+  system_allocations_.fetch_add(1, std::memory_order_relaxed);
+  if (backing == kBackingHugePages) {
+    huge_page_blocks_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return ptr_memory + kAlignment;
+}
+
+void SlabAllocator::SystemFree(uint8* ptr_block) {
+  BlockHeader* const ptr_header = HeaderOf(ptr_block);
+  uint8* const ptr_memory = reinterpret_cast<uint8*>(ptr_header);
+  const int32 backing = ptr_header->backing;
+  if (backing == kBackingHugePages) {
+    huge_page_blocks_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  system_frees_.fetch_add(1, std::memory_order_relaxed);
+  if (backing == kBackingHeap) {
+#ifdef _WIN32
+    _aligned_free(ptr_memory);
+#else
+    free(ptr_memory);
+#endif
+    return;
+  }
+#ifdef _WIN32
+  VirtualFree(ptr_memory, 0, MEM_RELEASE);
+#else
+  munmap(ptr_memory, ptr_header->system_size);
+#endif
+}
+
+}  // namespace webmlive
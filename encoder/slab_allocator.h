@@ -0,0 +1,131 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_SLAB_ALLOCATOR_H_
+#define WEBMLIVE_ENCODER_SLAB_ALLOCATOR_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Size class allocator for sample payloads: the storage of |VideoFrame|s and
+// |AudioBuffer|s. Freed blocks are kept on a free list per size class and
+// handed out again, so a stream whose buffer sizes are steady stops calling
+// the system allocator once its pools are populated, and long running
+// processes do not fragment the heap with large short lived blocks.
+//
+// Notes
+// - Blocks are aligned to |kAlignment| bytes.
+// - Size classes are spaced a quarter power of two apart below
+//   |kHugePageSize|, and are whole multiples of |kHugePageSize| above it.
+//   Large blocks are mapped directly from the system, backed by huge pages
+//   where the system provides them: MAP_HUGETLB falling back to transparent
+//   huge pages on Linux, and MEM_LARGE_PAGES on Windows when the process
+//   holds the lock pages privilege.
+// - At most |kMaxCachedBytes| of free blocks are kept; past that, and for
+//   requests larger than the largest class, blocks go back to the system.
+// - Mapped blocks can be bound to a NUMA node; see |set_numa_node()|.
+// - |Instance()| is never destroyed, so buffers freed during process exit
+//   are safe.
+class SlabAllocator {
+ public:
+  // Alignment of returned blocks.
+  static const size_t kAlignment = 64;
+
+  // Huge page size, and the boundary between the two kinds of size class.
+  static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+  // Bytes of free blocks kept for reuse.
+  static const int64 kMaxCachedBytes = 512 * 1024 * 1024;
+
+  struct Stats {
+    Stats()
+        : system_allocations(0), system_frees(0), cache_hits(0),
+          cached_bytes(0), huge_page_blocks(0) {}
+
+    // Blocks obtained from and returned to the system.
+    int64 system_allocations;
+    int64 system_frees;
+
+    // Allocations served from a free list.
+    int64 cache_hits;
+
+    // Bytes held in free lists.
+    int64 cached_bytes;
+
+    // Blocks currently backed by huge pages.
+    int64 huge_page_blocks;
+  };
+
+  static SlabAllocator& Instance();
+
+  // Returns a block of at least |size| bytes, or NULL when |size| is <= 0 or
+  // memory is exhausted.
+  uint8* Allocate(int32 size);
+
+  // Returns |ptr_block| to its free list. |ptr_block| must come from
+  // |Allocate()|, or be NULL.
+  void Free(uint8* ptr_block);
+
+  // Returns every cached block to the system.
+  void ReleaseCache();
+
+  // Binds blocks mapped from now on to NUMA node |numa_node|, or to none
+  // when |numa_node| is -1. Heap backed blocks, those below |kHugePageSize|,
+  // are left to the system.
+  void set_numa_node(int numa_node) { numa_node_ = numa_node; }
+
+  Stats stats() const;
+
+ private:
+  struct SizeClass {
+    SizeClass() : block_size(0) {}
+    size_t block_size;
+    std::mutex mutex;
+    std::vector<uint8*> free_blocks;
+  };
+
+  SlabAllocator();
+  ~SlabAllocator() {}
+
+  // Returns the index of the smallest class holding |size| bytes, or -1 when
+  // |size| exceeds the largest class.
+  int SizeClassIndex(size_t size) const;
+
+  // Obtains a block with a |block_size| byte payload from the system, and
+  // writes its header. Blocks of |kHugePageSize| or more are mapped.
+  uint8* SystemAllocate(size_t block_size, int size_class);
+  void SystemFree(uint8* ptr_block);
+
+  // Classes in increasing |block_size| order.
+  std::vector<std::unique_ptr<SizeClass>> classes_;
+
+  std::atomic<int64> system_allocations_;
+  std::atomic<int64> system_frees_;
+  std::atomic<int64> cache_hits_;
+  std::atomic<int64> cached_bytes_;
+  std::atomic<int64> huge_page_blocks_;
+  std::atomic<int> numa_node_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(SlabAllocator);
+};
+
+// Deleter for |std::unique_ptr|s holding |SlabAllocator| blocks.
+struct SlabDeleter {
+  void operator()(uint8* ptr_block) const {
+    SlabAllocator::Instance().Free(ptr_block);
+  }
+};
+typedef std::unique_ptr<uint8[], SlabDeleter> SlabBuffer;
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_SLAB_ALLOCATOR_H_
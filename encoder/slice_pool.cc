@@ -0,0 +1,150 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/slice_pool.h"
+
+#include <algorithm>
+#include <new>
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/resource_planner.h"
+#include "encoder/thread_placement.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+SlicePool& SlicePool::Instance() {
+  static SlicePool pool;
+  return pool;
+}
+
+SlicePool::SlicePool() : stop_(false) {
+}
+
+SlicePool::~SlicePool() {
+  Stop();
+}
+
+int SlicePool::Init(int num_threads) {
+  if (num_threads < 0) {
+    LOG(ERROR) << "SlicePool invalid thread count " << num_threads;
+    return kInvalidArg;
+  }
+  if (!threads_.empty()) {
+    return kSuccess;
+  }
+  if (num_threads == 0) {
+    num_threads = AvailableCpuThreads() - 1;
+  }
+  num_threads = std::min(num_threads, static_cast<int>(kMaxThreads));
+  stop_ = false;
+  for (int i = 0; i < num_threads; ++i) {
+    std::unique_ptr<std::thread> thread(
+        new (std::nothrow) std::thread(  // NOLINT
+            &SlicePool::SliceThread, this));
+    if (!thread) {
+      LOG(ERROR) << "SlicePool cannot start helper thread " << i;
+      Stop();
+      return kThreadError;
+    }
+    threads_.push_back(std::move(thread));
+  }
+  LOG(INFO) << "SlicePool started " << threads_.size() << " helper threads.";
+  return kSuccess;
+}
+
+void SlicePool::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  job_queued_.notify_all();
+  for (size_t i = 0; i < threads_.size(); ++i) {
+    threads_[i]->join();
+  }
+  threads_.clear();
+}
+
+int SlicePool::Slices(int64 pixels, int units) const {
+  if (threads_.empty() || pixels < kMinSlicedPixels || units < 2) {
+    return 1;
+  }
+  return std::min(num_threads() + 1, units);
+}
+
+void SlicePool::Run(int num_slices, const SliceFunction& slice_function) {
+  if (num_slices <= 1 || threads_.empty()) {
+    for (int slice = 0; slice < num_slices; ++slice) {
+      slice_function(slice);
+    }
+    return;
+  }
+
+  Job job;
+  job.ptr_function = &slice_function;
+  job.num_slices = num_slices;
+  job.next_slice = 0;
+  job.done_slices = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  jobs_.push_back(&job);
+  job_queued_.notify_all();
+
+  // Run slices of this job until none are left to take; the helper threads
+  // may still be running the last ones.
+  while (job.next_slice < job.num_slices) {
+    const int slice = job.next_slice++;
+    if (job.next_slice == job.num_slices) {
+      jobs_.erase(std::find(jobs_.begin(), jobs_.end(), &job));
+    }
+    RunSlice(&job, slice, &lock);
+  }
+  slice_done_.wait(lock, [&job] {
+    return job.done_slices == job.num_slices;
+  });
+}
+
+SlicePool::Job* SlicePool::TakeSlice(int* ptr_slice) {
+  if (jobs_.empty()) {
+    return NULL;
+  }
+  Job* const ptr_job = jobs_.front();
+  *ptr_slice = ptr_job->next_slice++;
+  if (ptr_job->next_slice == ptr_job->num_slices) {
+    jobs_.pop_front();
+  }
+  return ptr_job;
+}
+
+void SlicePool::RunSlice(Job* ptr_job, int slice,
+                         std::unique_lock<std::mutex>* lock) {
+  lock->unlock();
+  (*ptr_job->ptr_function)(slice);
+  lock->lock();
+
+  // The job's caller cannot return before the count is updated, since it
+  // waits for it under |mutex_|.
+  if (++ptr_job->done_slices == ptr_job->num_slices) {
+    slice_done_.notify_all();
+  }
+}
+
+void SlicePool::SliceThread() {
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kCapture);
+  ScopedCpuStage cpu_stage(kCpuConversion);
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    job_queued_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+    if (stop_) {
+      break;
+    }
+    int slice = 0;
+    Job* const ptr_job = TakeSlice(&slice);
+    RunSlice(ptr_job, slice, &lock);
+  }
+}
+
+}  // namespace webmlive
@@ -0,0 +1,116 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_SLICE_POOL_H_
+#define WEBMLIVE_ENCODER_SLICE_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Process wide helper threads that split the pixel work of one large frame,
+// color conversion and scaling, into row bands run in parallel. Configured
+// once by the application before the encoder starts; without helper threads
+// every band runs on the calling thread, as before.
+//
+//   const int slices = SlicePool::Instance().Slices(width * height, units);
+//   SlicePool::Instance().Run(slices, [&](int slice) { ... });
+//
+// Notes
+// - |Run()| returns once every slice is done. The calling thread runs slices
+//   too, so several threads may call |Run()| at once without starving each
+//   other, and a frame is never slower than on the calling thread alone.
+// - Frames smaller than |kMinSlicedPixels| are always one slice: their
+//   conversion takes too little time to pay for waking helper threads.
+// - Helper threads are placed as |ThreadPlacement::kCapture| threads, since
+//   capture conversion is most of their work.
+class SlicePool {
+ public:
+  enum {
+    // Cannot start a helper thread.
+    kThreadError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+  typedef std::function<void(int slice)> SliceFunction;
+
+  // Most helper threads |Init()| starts.
+  static const int kMaxThreads = 15;
+
+  // Smallest frame, in pixels, split into slices: 1440p and larger.
+  static const int64 kMinSlicedPixels = 2560 * 1440;
+
+  static SlicePool& Instance();
+
+  // Starts |num_threads| helper threads, or one fewer than the number of
+  // hardware threads, up to |kMaxThreads|, when |num_threads| is 0. Returns
+  // |kSuccess| when successful, or when already started.
+  int Init(int num_threads);
+
+  // Stops and joins the helper threads. Called from the destructor.
+  void Stop();
+
+  // Returns the number of slices to split a frame of |pixels| pixels into
+  // when its work divides into |units| independent bands: 1 for small frames
+  // or without helper threads, and otherwise one per thread, calling thread
+  // included, up to |units|.
+  int Slices(int64 pixels, int units) const;
+
+  // Calls |slice_function| once with each slice index from 0 through
+  // |num_slices| - 1, on the calling thread and the helper threads. Returns
+  // after the last call returns.
+  void Run(int num_slices, const SliceFunction& slice_function);
+
+  int num_threads() const { return static_cast<int>(threads_.size()); }
+
+ private:
+  // Slices of one |Run()| call. Lives on the stack of the calling thread;
+  // its counts are protected by |mutex_|.
+  struct Job {
+    const SliceFunction* ptr_function;
+    int num_slices;
+    int next_slice;
+    int done_slices;
+  };
+
+  SlicePool();
+  ~SlicePool();
+
+  // Takes the next slice of the oldest job. Returns the job, or NULL when no
+  // job has slices left. |mutex_| must be held.
+  Job* TakeSlice(int* ptr_slice);
+
+  // Runs |slice| of |ptr_job| unlocked, and counts it done. |lock| must hold
+  // |mutex_|.
+  void RunSlice(Job* ptr_job, int slice, std::unique_lock<std::mutex>* lock);
+
+  // Helper thread function.
+  void SliceThread();
+
+  // Jobs with slices not yet taken, oldest first. Protected by |mutex_|.
+  std::mutex mutex_;
+  std::condition_variable job_queued_;
+  std::condition_variable slice_done_;
+  std::deque<Job*> jobs_;
+  bool stop_;
+
+  std::vector<std::unique_ptr<std::thread>> threads_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(SlicePool);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_SLICE_POOL_H_
@@ -0,0 +1,120 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/socket_util.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace webmlive {
+
+bool StartupSockets() {
+#ifdef _WIN32
+  WSADATA wsa_data;
+  return WSAStartup(MAKEWORD(2, 2), &wsa_data) == 0;
+#else
+  return true;
+#endif
+}
+
+void CleanupSockets() {
+#ifdef _WIN32
+  WSACleanup();
+#endif
+}
+
+void CloseSocket(NativeSocket socket) {
+#ifdef _WIN32
+  closesocket(socket);
+#else
+  close(socket);
+#endif
+}
+
+bool WaitReadable(NativeSocket socket, int timeout_ms) {
+  fd_set read_fds;
+  FD_ZERO(&read_fds);
+  FD_SET(socket, &read_fds);
+  timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+  return select(static_cast<int>(socket) + 1, &read_fds, NULL, NULL,
+                &timeout) > 0;
+}
+
+bool SendAll(NativeSocket socket, const void* ptr_data, size_t length) {
+  const char* ptr_bytes = reinterpret_cast<const char*>(ptr_data);
+  while (length > 0) {
+    const int bytes_sent =
+        send(socket, ptr_bytes, static_cast<int>(length), kSendFlags);
+    if (bytes_sent <= 0) {
+      return false;
+    }
+    ptr_bytes += bytes_sent;
+    length -= bytes_sent;
+  }
+  return true;
+}
+
+bool SendAll(NativeSocket socket, const std::string& data) {
+  return SendAll(socket, data.data(), data.size());
+}
+
+void SetSendTimeout(NativeSocket socket, int timeout_ms) {
+#ifdef _WIN32
+  const DWORD timeout = timeout_ms;
+#else
+  const timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+#endif
+  setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO,
+             reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+}
+
+void SetNoDelay(NativeSocket socket) {
+  const int no_delay = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY,
+             reinterpret_cast<const char*>(&no_delay), sizeof(no_delay));
+}
+
+bool HasSuffix(const std::string& str, const char* suffix) {
+  const size_t length = strlen(suffix);
+  return str.size() >= length &&
+         str.compare(str.size() - length, length, suffix) == 0;
+}
+
+std::string ToLower(std::string str) {
+  for (size_t i = 0; i < str.size(); ++i) {
+    str[i] = static_cast<char>(tolower(static_cast<unsigned char>(str[i])));
+  }
+  return str;
+}
+
+void ReplaceAll(const std::string& from, const std::string& to,
+                std::string* ptr_str) {
+  size_t pos = 0;
+  while ((pos = ptr_str->find(from, pos)) != std::string::npos) {
+    ptr_str->replace(pos, from.size(), to);
+    pos += to.size();
+  }
+}
+
+std::string HeaderValue(const std::string& request,
+                        const std::string& lower_request,
+                        const std::string& name) {
+  const std::string key = "\n" + name + ":";
+  const size_t pos = lower_request.find(key);
+  if (pos == std::string::npos) {
+    return std::string();
+  }
+  size_t begin = pos + key.size();
+  const size_t end = std::min(request.find('\r', begin), request.size());
+  while (begin < end && request[begin] == ' ') {
+    ++begin;
+  }
+  return request.substr(begin, end - begin);
+}
+
+}  // namespace webmlive
@@ -0,0 +1,89 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+//
+// Portable BSD socket helpers shared by the servers and sinks that speak
+// plain TCP, and the HTTP/1.1 header helpers of those that speak HTTP.
+// Classes store sockets as |SocketHandle| in their headers to keep the
+// platform socket headers out of them, and cast to |NativeSocket| here.
+#ifndef WEBMLIVE_ENCODER_SOCKET_UTIL_H_
+#define WEBMLIVE_ENCODER_SOCKET_UTIL_H_
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <cstddef>
+#include <string>
+
+namespace webmlive {
+
+#ifdef _WIN32
+typedef SOCKET NativeSocket;
+const NativeSocket kInvalidSocket = INVALID_SOCKET;
+const int kSendFlags = 0;
+const int kShutdownSend = SD_SEND;
+const int kShutdownBoth = SD_BOTH;
+#else
+typedef int NativeSocket;
+const NativeSocket kInvalidSocket = -1;
+// Report closed connections as send errors instead of raising SIGPIPE.
+const int kSendFlags = MSG_NOSIGNAL;
+const int kShutdownSend = SHUT_WR;
+const int kShutdownBoth = SHUT_RDWR;
+#endif
+
+// Initializes the socket library. Returns false on failure. Each successful
+// call must be matched by a call to |CleanupSockets()|. Both are no-ops
+// outside of Windows.
+bool StartupSockets();
+void CleanupSockets();
+
+void CloseSocket(NativeSocket socket);
+
+// Returns true when |socket| becomes readable, or accepts a connection,
+// within |timeout_ms|.
+bool WaitReadable(NativeSocket socket, int timeout_ms);
+
+// Sends |length| bytes from |ptr_data|, looping over partial sends. Returns
+// false when the connection fails or a send times out.
+bool SendAll(NativeSocket socket, const void* ptr_data, size_t length);
+bool SendAll(NativeSocket socket, const std::string& data);
+
+// Bounds the time a send may block on a peer that stopped reading.
+void SetSendTimeout(NativeSocket socket, int timeout_ms);
+
+// Disables Nagle's algorithm: data is written as it is produced, and the
+// tail must not be held back.
+void SetNoDelay(NativeSocket socket);
+
+bool HasSuffix(const std::string& str, const char* suffix);
+std::string ToLower(std::string str);
+
+// Replaces every |from| in |ptr_str| with |to|, as when expanding URL
+// templates.
+void ReplaceAll(const std::string& from, const std::string& to,
+                std::string* ptr_str);
+
+// Returns the value of header |name|, which must be lower case, in |request|,
+// or an empty string when it is missing. |lower_request| is |request| in
+// lower case; values are returned with their case kept.
+std::string HeaderValue(const std::string& request,
+                        const std::string& lower_request,
+                        const std::string& name);
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_SOCKET_UTIL_H_
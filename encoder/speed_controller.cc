@@ -0,0 +1,108 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/speed_controller.h"
+
+#include <cstdlib>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Weight of the newest frame in |SpeedController::load_|, and in
+// |SpeedController::motion_|.
+const double kLoadWeight = 0.25;
+const double kMotionWeight = 0.1;
+}  // namespace
+
+const double SpeedController::kHighLoad = 0.9;
+const double SpeedController::kLowLoad = 0.6;
+const double SpeedController::kMinSurgeMotion = 4.0;
+const double SpeedController::kMotionSurgeRatio = 2.0;
+
+SpeedController::SpeedController()
+    : configured_speed_(0),
+      max_speed_(0),
+      speed_(0),
+      load_(0),
+      have_load_(false),
+      high_frames_(0),
+      low_frames_(0),
+      hold_frames_(0),
+      motion_(0),
+      have_motion_(false) {
+}
+
+void SpeedController::Init(int speed, int max_speed) {
+  configured_speed_ = speed;
+  max_speed_ = max_speed;
+  speed_ = speed;
+  load_ = 0;
+  have_load_ = false;
+  high_frames_ = 0;
+  low_frames_ = 0;
+  hold_frames_ = 0;
+  motion_ = 0;
+  have_motion_ = false;
+}
+
+bool SpeedController::Update(int64 encode_time_us, int64 duration) {
+  if (duration <= 0) {
+    return false;
+  }
+  const double frame_load = encode_time_us / (duration * 1000.0);
+  load_ = have_load_ ? load_ + kLoadWeight * (frame_load - load_) : frame_load;
+  have_load_ = true;
+
+  high_frames_ = load_ > kHighLoad ? high_frames_ + 1 : 0;
+  low_frames_ = load_ < kLowLoad ? low_frames_ + 1 : 0;
+  if (hold_frames_ > 0) {
+    --hold_frames_;
+    return false;
+  }
+
+  const int magnitude = std::abs(speed_);
+  if (high_frames_ >= kRaiseFrames && magnitude < max_speed_) {
+    return Step(magnitude + 1);
+  }
+  if (low_frames_ >= kLowerFrames && magnitude > std::abs(configured_speed_)) {
+    return Step(magnitude - 1);
+  }
+  return false;
+}
+
+bool SpeedController::NoteMotion(double motion) {
+  const bool surge = have_motion_ && motion > kMinSurgeMotion &&
+      motion > kMotionSurgeRatio * motion_;
+  if (surge) {
+    VLOG(1) << "motion surge " << motion << ", average " << motion_;
+  }
+  motion_ = have_motion_ ? motion_ + kMotionWeight * (motion - motion_) :
+      motion;
+  have_motion_ = true;
+
+  const int magnitude = std::abs(speed_);
+  if (!surge || hold_frames_ > 0 || !have_load_ || load_ < kLowLoad ||
+      magnitude >= max_speed_) {
+    return false;
+  }
+  return Step(magnitude + 1);
+}
+
+bool SpeedController::Step(int magnitude) {
+  const int new_speed = configured_speed_ < 0 ? -magnitude : magnitude;
+  LOG(INFO) << "encode load " << load_ << ", speed " << speed_ << " -> "
+            << new_speed;
+  speed_ = new_speed;
+  high_frames_ = 0;
+  low_frames_ = 0;
+  hold_frames_ = kHoldFrames;
+  return true;
+}
+
+}  // namespace webmlive
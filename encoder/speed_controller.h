@@ -0,0 +1,92 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_SPEED_CONTROLLER_H_
+#define WEBMLIVE_ENCODER_SPEED_CONTROLLER_H_
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Picks the libvpx speed (cpu-used) setting from measured encode times, so
+// that an encoder falling behind real time gives up quality instead of
+// frames.
+//
+// Each frame's encode time is divided by its duration and averaged over
+// recent frames. The speed goes up one step when the average stays above
+// |kHighLoad| for |kRaiseFrames| frames, and down one step when it stays
+// below |kLowLoad| for |kLowerFrames| frames. No further change is made for
+// |kHoldFrames| frames after a step, letting the encoder settle. The speed
+// never drops below the configured speed, and never exceeds the maximum.
+// Only the magnitude changes: the sign of the configured speed is kept.
+//
+// With frame analysis, a surge of motion raises the speed one step ahead of
+// the load it brings, when the encoder already runs above |kLowLoad|.
+class SpeedController {
+ public:
+  // Share of the frame duration spent encoding above which the encoder is
+  // sped up, and below which it is slowed down again.
+  static const double kHighLoad;
+  static const double kLowLoad;
+
+  // Frames the load must stay past a threshold before the speed changes.
+  // Slowing down waits longer, since a wrong step costs frames.
+  static const int kRaiseFrames = 3;
+  static const int kLowerFrames = 60;
+
+  // Frames after a change before the next one.
+  static const int kHoldFrames = 15;
+
+  // Motion, as in |VideoFrameAnalysis::motion|, surges when it exceeds both
+  // |kMinSurgeMotion| and |kMotionSurgeRatio| times its recent average.
+  static const double kMinSurgeMotion;
+  static const double kMotionSurgeRatio;
+
+  SpeedController();
+  ~SpeedController() {}
+
+  // Starts at |speed|, allowing magnitudes up to |max_speed|.
+  void Init(int speed, int max_speed);
+
+  // Records a frame of |duration| milliseconds that took |encode_time_us|
+  // microseconds to encode. Returns true when |speed()| changed. Frames
+  // without a duration are ignored.
+  bool Update(int64 encode_time_us, int64 duration);
+
+  // Records the motion of the frame about to be encoded, from its
+  // |VideoFrameAnalysis|. Returns true when a surge raised |speed()|.
+  bool NoteMotion(double motion);
+
+  int speed() const { return speed_; }
+
+ private:
+  // Sets the speed magnitude to |magnitude|, and holds it. Returns true.
+  bool Step(int magnitude);
+
+  int configured_speed_;
+  int max_speed_;
+  int speed_;
+
+  // Average share of the frame duration spent encoding, and the number of
+  // consecutive frames it has been above |kHighLoad| or below |kLowLoad|.
+  double load_;
+  bool have_load_;
+  int high_frames_;
+  int low_frames_;
+
+  // Frames left before another change is allowed.
+  int hold_frames_;
+
+  // Average motion of recent frames.
+  double motion_;
+  bool have_motion_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(SpeedController);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_SPEED_CONTROLLER_H_
@@ -0,0 +1,479 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/srt_data_sink.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#ifdef WEBMLIVE_HAVE_LIBSRT
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+#include <srt/srt.h>
+#endif
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/metrics.h"
+#include "encoder/thread_placement.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+#ifdef WEBMLIVE_HAVE_LIBSRT
+const int kInvalidSrtSocket = SRT_INVALID_SOCK;
+#else
+const int kInvalidSrtSocket = -1;
+#endif
+
+// Interval at which the sender checks a chunk still being muxed for new
+// data, and the time it waits for the chunk to grow before giving up on the
+// connection.
+const int kStreamPollMs = 5;
+const int kMaxStreamStallMs = 10000;
+
+// Size of the reads of chunks still being muxed.
+const int32 kStreamReadBytes = 16 * 1024;
+
+// Passphrase lengths accepted by SRT.
+const size_t kMinPassphraseLength = 10;
+const size_t kMaxPassphraseLength = 79;
+
+// Retransmission overheads accepted by SRT, in percent.
+const int kMinOverheadPercent = 5;
+const int kMaxOverheadPercent = 100;
+
+#ifdef WEBMLIVE_HAVE_LIBSRT
+// Sets the live mode options of |socket| from |settings|. Returns false on
+// failure.
+bool SetSocketOptions(SRTSOCKET socket, const SrtDataSinkSettings& settings,
+                      bool caller) {
+  const SRT_TRANSTYPE live = SRTT_LIVE;
+  const int latency_ms = settings.latency_ms;
+  // Rate the retransmission overhead against the measured input rate.
+  const int64_t max_bandwidth = 0;
+  const int64_t input_bandwidth = 0;
+  const int overhead = settings.overhead_percent;
+  if (srt_setsockflag(socket, SRTO_TRANSTYPE, &live, sizeof(live)) ||
+      srt_setsockflag(socket, SRTO_LATENCY, &latency_ms,
+                      sizeof(latency_ms)) ||
+      srt_setsockflag(socket, SRTO_MAXBW, &max_bandwidth,
+                      sizeof(max_bandwidth)) ||
+      srt_setsockflag(socket, SRTO_INPUTBW, &input_bandwidth,
+                      sizeof(input_bandwidth)) ||
+      srt_setsockflag(socket, SRTO_OHEADBW, &overhead, sizeof(overhead))) {
+    LOG(ERROR) << "cannot set SRT options: " << srt_getlasterror_str();
+    return false;
+  }
+  if (!settings.passphrase.empty() &&
+      srt_setsockflag(socket, SRTO_PASSPHRASE, settings.passphrase.c_str(),
+                      static_cast<int>(settings.passphrase.size()))) {
+    LOG(ERROR) << "cannot set SRT passphrase: " << srt_getlasterror_str();
+    return false;
+  }
+  if (caller && !settings.stream_id.empty() &&
+      srt_setsockflag(socket, SRTO_STREAMID, settings.stream_id.c_str(),
+                      static_cast<int>(settings.stream_id.size()))) {
+    LOG(ERROR) << "cannot set SRT stream id: " << srt_getlasterror_str();
+    return false;
+  }
+  return true;
+}
+#endif  // WEBMLIVE_HAVE_LIBSRT
+
+}  // namespace
+
+SrtDataSink::SrtDataSink()
+    : stop_(true),
+      listen_socket_(kInvalidSrtSocket),
+      socket_(kInvalidSrtSocket),
+      ptr_bytes_sent_(NULL),
+      ptr_connections_(NULL),
+      ptr_dropped_chunks_(NULL),
+      ptr_retransmitted_packets_(NULL),
+      ptr_rtt_ms_(NULL) {
+}
+
+SrtDataSink::~SrtDataSink() {
+  Stop();
+}
+
+int SrtDataSink::Init(const SrtDataSinkSettings& settings) {
+#ifndef WEBMLIVE_HAVE_LIBSRT
+  (void)settings;
+  LOG(ERROR) << "SRT output was not built; enable WEBMLIVE_ENABLE_SRT.";
+  return kUnsupported;
+#else
+  if (settings.port < 1 || settings.port > 65535 ||
+      settings.latency_ms < 0 ||
+      settings.overhead_percent < kMinOverheadPercent ||
+      settings.overhead_percent > kMaxOverheadPercent ||
+      settings.max_queued_chunks < 1) {
+    LOG(ERROR) << "invalid SRT settings, port=" << settings.port
+               << " latency=" << settings.latency_ms
+               << " overhead=" << settings.overhead_percent
+               << " max_queued_chunks=" << settings.max_queued_chunks;
+    return kInvalidArg;
+  }
+  if (!settings.passphrase.empty() &&
+      (settings.passphrase.size() < kMinPassphraseLength ||
+       settings.passphrase.size() > kMaxPassphraseLength)) {
+    LOG(ERROR) << "SRT passphrases are " << kMinPassphraseLength << " to "
+               << kMaxPassphraseLength << " characters.";
+    return kInvalidArg;
+  }
+  settings_ = settings;
+
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  ptr_bytes_sent_ = registry.GetCounter(
+      "webmlive_srt_sent_bytes_total", settings_.metrics_labels,
+      "Stream bytes sent over SRT, retransmissions excluded.");
+  ptr_connections_ = registry.GetCounter(
+      "webmlive_srt_connections_total", settings_.metrics_labels,
+      "SRT connections established with a receiver.");
+  ptr_dropped_chunks_ = registry.GetCounter(
+      "webmlive_srt_dropped_chunks_total", settings_.metrics_labels,
+      "Chunks dropped while the SRT link was down or behind.");
+  ptr_retransmitted_packets_ = registry.GetCounter(
+      "webmlive_srt_retransmitted_packets_total", settings_.metrics_labels,
+      "SRT packets retransmitted to repair losses.");
+  ptr_rtt_ms_ = registry.GetGauge(
+      "webmlive_srt_rtt_ms", settings_.metrics_labels,
+      "Round trip time of the SRT connection in milliseconds.");
+  if (!ptr_bytes_sent_ || !ptr_connections_ || !ptr_dropped_chunks_ ||
+      !ptr_retransmitted_packets_ || !ptr_rtt_ms_) {
+    LOG(ERROR) << "cannot create SRT metrics.";
+    return kNoMemory;
+  }
+  queue_.Init(settings_.max_queued_chunks);
+  packet_.reserve(kPayloadSize);
+  return kSuccess;
+#endif  // WEBMLIVE_HAVE_LIBSRT
+}
+
+int SrtDataSink::Run() {
+  if (thread_ || !ptr_bytes_sent_) {
+    LOG(ERROR) << "SrtDataSink cannot Run before Init, or twice.";
+    return kInvalidArg;
+  }
+#ifdef WEBMLIVE_HAVE_LIBSRT
+  if (srt_startup() < 0) {
+    LOG(ERROR) << "srt_startup failed: " << srt_getlasterror_str();
+    return kSocketError;
+  }
+#endif
+  stop_ = false;
+  thread_.reset(new (std::nothrow) std::thread(  // NOLINT
+      &SrtDataSink::SendThread, this));
+  if (!thread_) {
+    LOG(ERROR) << "SrtDataSink cannot start its thread.";
+    stop_ = true;
+#ifdef WEBMLIVE_HAVE_LIBSRT
+    srt_cleanup();
+#endif
+    return kThreadError;
+  }
+  return kSuccess;
+}
+
+void SrtDataSink::Stop() {
+  if (!thread_) {
+    return;
+  }
+  {
+    // Closing the sockets wakes the sender from blocking SRT calls.
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+#ifdef WEBMLIVE_HAVE_LIBSRT
+    if (socket_ != kInvalidSrtSocket)
+      srt_close(socket_);
+    if (listen_socket_ != kInvalidSrtSocket)
+      srt_close(listen_socket_);
+#endif
+  }
+  stopped_.notify_all();
+  queue_.Close();
+  thread_->join();
+  thread_.reset();
+#ifdef WEBMLIVE_HAVE_LIBSRT
+  srt_cleanup();
+#endif
+}
+
+bool SrtDataSink::Ready() const {
+  return !stop_;
+}
+
+bool SrtDataSink::WriteData(const uint8* ptr_data, int32 data_length,
+                            const std::string& id) {
+  bool header = false;
+  if (!LiveStreamQueue::IsStreamChunk(id, &header)) {
+    return true;
+  }
+  std::shared_ptr<DataChunk> chunk(new (std::nothrow) DataChunk());  // NOLINT
+  if (!chunk || chunk->Init(ptr_data, data_length)) {
+    LOG(ERROR) << "SrtDataSink cannot copy data for " << id;
+    return false;
+  }
+  return WriteChunk(chunk, id);
+}
+
+bool SrtDataSink::WriteChunk(const SharedDataChunk& chunk,
+                             const std::string& id) {
+  if (!chunk || stop_) {
+    return false;
+  }
+  ptr_dropped_chunks_->Increment(queue_.PutChunk(chunk, id));
+  return true;
+}
+
+bool SrtDataSink::WriteStreamingChunk(const SharedStreamingChunk& chunk,
+                                      const std::string& id) {
+  if (!chunk || stop_) {
+    return false;
+  }
+  ptr_dropped_chunks_->Increment(queue_.PutStreamingChunk(chunk, id));
+  return true;
+}
+
+bool SrtDataSink::Connect() {
+#ifdef WEBMLIVE_HAVE_LIBSRT
+  const bool caller = !settings_.host.empty();
+  if (!caller && listen_socket_ == kInvalidSrtSocket) {
+    const SRTSOCKET listen_socket = srt_create_socket();
+    if (listen_socket == SRT_INVALID_SOCK) {
+      LOG(ERROR) << "cannot create SRT socket: " << srt_getlasterror_str();
+      return false;
+    }
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16>(settings_.port));
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (!SetSocketOptions(listen_socket, settings_, false) ||
+        srt_bind(listen_socket, reinterpret_cast<sockaddr*>(&address),
+                 sizeof(address)) == SRT_ERROR ||
+        srt_listen(listen_socket, 1) == SRT_ERROR) {
+      LOG(ERROR) << "cannot listen for SRT receivers on port "
+                 << settings_.port << ": " << srt_getlasterror_str();
+      srt_close(listen_socket);
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_) {
+      srt_close(listen_socket);
+      return false;
+    }
+    listen_socket_ = listen_socket;
+    LOG(INFO) << "SRT listening on port " << settings_.port;
+  }
+
+  SRTSOCKET socket = SRT_INVALID_SOCK;
+  if (caller) {
+    char port[8];
+    snprintf(port, sizeof(port), "%d", settings_.port);
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* ptr_addresses = NULL;
+    if (getaddrinfo(settings_.host.c_str(), port, &hints, &ptr_addresses)) {
+      LOG(WARNING) << "cannot resolve SRT receiver " << settings_.host;
+      return false;
+    }
+    socket = srt_create_socket();
+    if (socket == SRT_INVALID_SOCK ||
+        !SetSocketOptions(socket, settings_, true)) {
+      freeaddrinfo(ptr_addresses);
+      if (socket != SRT_INVALID_SOCK)
+        srt_close(socket);
+      return false;
+    }
+    {
+      // Published before connecting so that |Stop()| can interrupt it.
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stop_) {
+        freeaddrinfo(ptr_addresses);
+        srt_close(socket);
+        return false;
+      }
+      socket_ = socket;
+    }
+    const int status = srt_connect(socket, ptr_addresses->ai_addr,
+                                   static_cast<int>(ptr_addresses->ai_addrlen));
+    freeaddrinfo(ptr_addresses);
+    if (status == SRT_ERROR) {
+      VLOG(1) << "SRT connection to " << settings_.host << ":"
+              << settings_.port << " failed: " << srt_getlasterror_str();
+      Disconnect(false);
+      return false;
+    }
+  } else {
+    socket = srt_accept(listen_socket_, NULL, NULL);
+    if (socket == SRT_INVALID_SOCK) {
+      if (!stop_) {
+        LOG(ERROR) << "SRT accept failed: " << srt_getlasterror_str();
+        Disconnect(true);
+      }
+      return false;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (stop_) {
+    srt_close(socket);
+    socket_ = SRT_INVALID_SOCK;
+    return false;
+  }
+  socket_ = socket;
+  ptr_dropped_chunks_->Increment(queue_.Connected());
+  ptr_connections_->Increment(1);
+  LOG(INFO) << "SRT receiver connected"
+            << (caller ? " at " + settings_.host : std::string()) << ".";
+  return true;
+#else
+  return false;
+#endif  // WEBMLIVE_HAVE_LIBSRT
+}
+
+void SrtDataSink::Disconnect(bool close_listener) {
+  queue_.Disconnected();
+  std::lock_guard<std::mutex> lock(mutex_);
+#ifdef WEBMLIVE_HAVE_LIBSRT
+  if (socket_ != kInvalidSrtSocket)
+    srt_close(socket_);
+  if (close_listener && listen_socket_ != kInvalidSrtSocket)
+    srt_close(listen_socket_);
+#endif
+  socket_ = kInvalidSrtSocket;
+  if (close_listener)
+    listen_socket_ = kInvalidSrtSocket;
+  packet_.clear();
+}
+
+bool SrtDataSink::SendChunk(const DataChunk& chunk) {
+  const std::vector<DataChunk::Span>& spans = chunk.spans();
+  for (size_t i = 0; i < spans.size(); ++i) {
+    if (!SendBytes(spans[i].ptr_data, spans[i].length, false))
+      return false;
+  }
+  return SendBytes(NULL, 0, true);
+}
+
+bool SrtDataSink::SendStream(const StreamingChunk& stream) {
+  std::vector<uint8> buffer(kStreamReadBytes);
+  int64 offset = 0;
+  int stall_ms = 0;
+  while (!stop_) {
+    int32 length = 0;
+    const int status =
+        stream.Read(offset, kStreamReadBytes, &buffer[0], &length);
+    if (status == StreamingChunk::kSuccess) {
+      if (!SendBytes(&buffer[0], length, false))
+        return false;
+      offset += length;
+      stall_ms = 0;
+    } else if (status == StreamingChunk::kNoData) {
+      // Send what the muxer wrote so far, and wait for more.
+      if (!SendBytes(NULL, 0, true))
+        return false;
+      if (stall_ms >= kMaxStreamStallMs) {
+        LOG(WARNING) << "SRT streaming chunk stalled, reconnecting.";
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(kStreamPollMs));
+      stall_ms += kStreamPollMs;
+    } else if (status == StreamingChunk::kEndOfChunk) {
+      return SendBytes(NULL, 0, true);
+    } else {
+      LOG(ERROR) << "SRT streaming chunk read failed: " << status;
+      return false;
+    }
+  }
+  return false;
+}
+
+bool SrtDataSink::SendBytes(const uint8* ptr_data, int32 length, bool flush) {
+  while (length > 0) {
+    const int32 count = std::min(
+        length, kPayloadSize - static_cast<int32>(packet_.size()));
+    packet_.insert(packet_.end(), ptr_data, ptr_data + count);
+    ptr_data += count;
+    length -= count;
+    if (static_cast<int32>(packet_.size()) == kPayloadSize && !SendPacket())
+      return false;
+  }
+  return !flush || packet_.empty() || SendPacket();
+}
+
+bool SrtDataSink::SendPacket() {
+#ifdef WEBMLIVE_HAVE_LIBSRT
+  const int length = static_cast<int>(packet_.size());
+  if (srt_sendmsg2(socket_, reinterpret_cast<const char*>(&packet_[0]),
+                   length, NULL) == SRT_ERROR) {
+    if (!stop_)
+      LOG(WARNING) << "SRT send failed: " << srt_getlasterror_str();
+    packet_.clear();
+    return false;
+  }
+  ptr_bytes_sent_->Increment(length);
+  packet_.clear();
+  return true;
+#else
+  packet_.clear();
+  return false;
+#endif  // WEBMLIVE_HAVE_LIBSRT
+}
+
+void SrtDataSink::UpdateLinkMetrics() {
+#ifdef WEBMLIVE_HAVE_LIBSRT
+  SRT_TRACEBSTATS stats;
+  // Clearing the interval counters makes |pktRetrans| the retransmissions
+  // since the last update.
+  if (srt_bstats(socket_, &stats, 1) == 0) {
+    ptr_retransmitted_packets_->Increment(stats.pktRetrans);
+    ptr_rtt_ms_->Set(static_cast<int64>(stats.msRTT));
+  }
+#endif
+}
+
+void SrtDataSink::SendThread() {
+  LOG(INFO) << "SrtDataSink thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kUpload);
+  ScopedCpuStage cpu_stage(kCpuUpload);
+  while (!stop_) {
+    if (!Connect()) {
+      const int retry_ms = kReconnectIntervalMs;
+      std::unique_lock<std::mutex> lock(mutex_);
+      stopped_.wait_for(lock, std::chrono::milliseconds(retry_ms),
+                        [this] { return stop_.load(); });
+      continue;
+    }
+    LiveStreamQueue::Entry entry;
+    bool connected = true;
+    while (connected && queue_.Take(&entry)) {
+      connected = entry.stream ? SendStream(*entry.stream) :
+                                 SendChunk(*entry.chunk);
+      UpdateLinkMetrics();
+    }
+    if (!stop_)
+      LOG(WARNING) << "SRT receiver lost; reconnecting.";
+    Disconnect(false);
+  }
+  Disconnect(true);
+  LOG(INFO) << "SrtDataSink thread done.";
+}
+
+}  // namespace webmlive
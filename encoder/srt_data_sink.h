@@ -0,0 +1,190 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_SRT_DATA_SINK_H_
+#define WEBMLIVE_ENCODER_SRT_DATA_SINK_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/buffer_util.h"
+#include "encoder/data_sink.h"
+#include "encoder/live_stream_queue.h"
+
+namespace webmlive {
+
+class Metric;
+
+struct SrtDataSinkSettings {
+  static const int kDefaultPort = 9000;
+  static const int kDefaultLatencyMs = 120;
+  static const int kDefaultOverheadPercent = 25;
+  static const int kDefaultMaxQueuedChunks = 8;
+
+  SrtDataSinkSettings()
+      : port(kDefaultPort),
+        latency_ms(kDefaultLatencyMs),
+        overhead_percent(kDefaultOverheadPercent),
+        max_queued_chunks(kDefaultMaxQueuedChunks) {}
+
+  // Receiver to connect to. An empty |host| listens on |port| on all
+  // interfaces instead, and streams to the first receiver that connects;
+  // a receiver connecting after it leaves takes its place.
+  std::string host;
+  int port;
+
+  // SRT receive latency in milliseconds, offered to the receiver as the
+  // sender's latency too: the time each packet has to be recovered by ARQ
+  // before the receiver must deliver it. A few round trip times is usual.
+  int latency_ms;
+
+  // Bandwidth, as a percentage of the measured input rate, that may be used
+  // on top of it for retransmissions.
+  int overhead_percent;
+
+  // AES passphrase, 10 to 79 characters. Empty disables encryption.
+  std::string passphrase;
+
+  // SRT stream id sent to the receiver, commonly used by servers to pick the
+  // stream or application.
+  std::string stream_id;
+
+  // Chunks queued for sending. Once reached, the oldest cluster chunk is
+  // dropped to make room, which keeps the stream live when the link cannot
+  // keep up.
+  int max_queued_chunks;
+
+  // Labels added to the sink's metrics; see |MetricsRegistry|.
+  std::string metrics_labels;
+};
+
+// Data sink streaming one live WebM byte stream over SRT (Secure Reliable
+// Transport): the metadata chunk, then each cluster chunk as it is written,
+// in SRT live mode packets whose losses are repaired by retransmission
+// within |SrtDataSinkSettings::latency_ms|. This gives contribution links
+// sub-second latency without the per segment requests of HTTP uploads.
+//
+// Only the byte stream picked by |LiveStreamQueue| is sent. Writes of other
+// ids, such as manifests and representation chunks, are accepted and
+// ignored, so the sink can be a |FanOutDataSink| output.
+//
+// Notes
+// - With |WebmEncoderConfig::low_latency_upload| cluster chunks are sent as
+//   they are muxed; otherwise each is sent once complete.
+// - Every connection starts with the metadata chunk, followed by the cached
+//   chunks from the newest keyframe chunk on, or else by the next cluster
+//   chunk written; see |LiveStreamQueue|. The rest of a chunk cut short by a lost
+//   connection is dropped, so receivers always start at a cluster.
+// - Losing the receiver, or failing to connect, is not an error: the sink
+//   retries every |kReconnectIntervalMs|, dropping chunks in the meantime.
+// - |Ready()| always returns true while running; see |max_queued_chunks|.
+// - libsrt is optional: without WEBMLIVE_HAVE_LIBSRT |Init()| fails.
+class SrtDataSink : public DataSinkInterface {
+ public:
+  enum {
+    // libsrt support was not built.
+    kUnsupported = -5,
+    // SRT socket setup failed.
+    kSocketError = -4,
+    // Cannot start the sender thread.
+    kThreadError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  static const int kReconnectIntervalMs = 1000;
+
+  // SRT live mode payload size: seven MPEG-TS packets, the largest payload
+  // that fits an Ethernet MTU.
+  static const int32 kPayloadSize = 1316;
+
+  SrtDataSink();
+  virtual ~SrtDataSink();
+
+  // Copies |settings|. Returns |kSuccess| when successful.
+  int Init(const SrtDataSinkSettings& settings);
+
+  // Starts the sender thread, which connects, or listens, on its own.
+  // Returns |kSuccess| when successful.
+  int Run();
+
+  // Closes the connection and stops the sender thread. Queued chunks are
+  // dropped.
+  void Stop();
+
+  // |DataSinkInterface| methods.
+  virtual bool Ready() const;
+  virtual bool WriteData(const uint8* ptr_data, int32 data_length,
+                         const std::string& id);
+  virtual bool WriteChunk(const SharedDataChunk& chunk,
+                          const std::string& id);
+  virtual bool WriteStreamingChunk(const SharedStreamingChunk& chunk,
+                                   const std::string& id);
+
+ private:
+  // Connects to, or accepts, the receiver. Returns false when |Stop()| is
+  // called first, or on failure.
+  bool Connect();
+
+  // Closes the connection, and the listening socket when |close_listener| is
+  // true.
+  void Disconnect(bool close_listener);
+
+  // Sends |chunk|, and |stream| as it is written, in |kPayloadSize| packets.
+  // Returns false when the connection fails or |Stop()| is called.
+  bool SendChunk(const DataChunk& chunk);
+  bool SendStream(const StreamingChunk& stream);
+
+  // Appends |length| bytes to the packet being filled, sending it each time
+  // it is full, and once more when |flush| is true. Returns false on failure.
+  bool SendBytes(const uint8* ptr_data, int32 length, bool flush);
+
+  // Sends the packet being filled. Returns false on failure.
+  bool SendPacket();
+
+  // Updates the metrics from the connection's SRT statistics.
+  void UpdateLinkMetrics();
+
+  // Sender thread function.
+  void SendThread();
+
+  SrtDataSinkSettings settings_;
+  LiveStreamQueue queue_;
+  std::atomic<bool> stop_;
+
+  // SRT sockets, as ints to keep srt.h out of this header. Written by the
+  // sender thread under |mutex_| so that |Stop()| can close them to unblock
+  // it. |stopped_| is signaled by |Stop()|.
+  std::mutex mutex_;
+  std::condition_variable stopped_;
+  int listen_socket_;
+  int socket_;
+
+  // Packet being filled by the sender thread.
+  std::vector<uint8> packet_;
+
+  std::unique_ptr<std::thread> thread_;
+
+  // Metrics exported through |MetricsRegistry|. Set by |Init|.
+  Metric* ptr_bytes_sent_;
+  Metric* ptr_connections_;
+  Metric* ptr_dropped_chunks_;
+  Metric* ptr_retransmitted_packets_;
+  Metric* ptr_rtt_ms_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(SrtDataSink);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_SRT_DATA_SINK_H_
@@ -0,0 +1,125 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/stall_watchdog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <new>
+
+#include "encoder/thread_placement.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Stalls are detected within this fraction of the deadline.
+const int64 kChecksPerDeadline = 4;
+}  // namespace
+
+StallWatchdog::StallWatchdog()
+    : num_stages_(0),
+      deadline_ms_(0),
+      stop_(false) {
+  for (int i = 0; i < kMaxStages; ++i) {
+    kick_ms_[i] = 0;
+    report_ms_[i] = 0;
+  }
+}
+
+StallWatchdog::~StallWatchdog() {
+  Stop();
+}
+
+int StallWatchdog::Init(int num_stages, int64 deadline_ms,
+                        const StallCallback& callback) {
+  if (num_stages <= 0 || num_stages > kMaxStages || deadline_ms <= 0 ||
+      !callback) {
+    LOG(ERROR) << "invalid StallWatchdog settings: " << num_stages
+               << " stages, deadline " << deadline_ms << " ms.";
+    return kInvalidArg;
+  }
+  num_stages_ = num_stages;
+  deadline_ms_ = deadline_ms;
+  callback_ = callback;
+  return kSuccess;
+}
+
+int StallWatchdog::Start() {
+  if (thread_ || num_stages_ == 0) {
+    return kInvalidArg;
+  }
+  const int64 now_ms = NowMilliseconds();
+  for (int i = 0; i < num_stages_; ++i) {
+    kick_ms_[i] = now_ms;
+    report_ms_[i] = 0;
+  }
+  stop_ = false;
+  thread_.reset(new (std::nothrow) std::thread(  // NOLINT
+      std::bind(&StallWatchdog::WatchThread, this)));
+  if (!thread_) {
+    LOG(ERROR) << "cannot create stall watchdog thread.";
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+void StallWatchdog::Stop() {
+  if (!thread_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_one();
+  if (thread_->joinable())
+    thread_->join();
+  thread_.reset();
+}
+
+void StallWatchdog::Kick(int stage) {
+  if (stage >= 0 && stage < num_stages_)
+    kick_ms_[stage].store(NowMilliseconds(), std::memory_order_relaxed);
+}
+
+int64 StallWatchdog::NowMilliseconds() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void StallWatchdog::WatchThread() {
+  // Not |kBackground|: an idle priority watchdog starves under the very load
+  // that stalls the encoder.
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kCapture);
+  const int64 interval_ms =
+      std::max<int64>(deadline_ms_ / kChecksPerDeadline, 1);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    wake_.wait_for(lock, std::chrono::milliseconds(interval_ms),
+                   [this] { return stop_; });
+    if (stop_) {
+      break;
+    }
+    const int64 now_ms = NowMilliseconds();
+    for (int i = 0; i < num_stages_; ++i) {
+      const int64 kick_ms = kick_ms_[i].load(std::memory_order_relaxed);
+      const int64 stalled_ms = now_ms - kick_ms;
+      if (stalled_ms < deadline_ms_) {
+        continue;
+      }
+      // Report again only after another deadline without progress.
+      if (report_ms_[i] > kick_ms && now_ms - report_ms_[i] < deadline_ms_) {
+        continue;
+      }
+      report_ms_[i] = now_ms;
+      callback_(i, stalled_ms);
+    }
+  }
+}
+
+}  // namespace webmlive
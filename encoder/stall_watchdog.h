@@ -0,0 +1,94 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_STALL_WATCHDOG_H_
+#define WEBMLIVE_ENCODER_STALL_WATCHDOG_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Detects stalled pipeline stages from a thread of its own. Each stage calls
+// |Kick()| whenever it makes progress; once a stage goes |deadline_ms|
+// without a kick the watchdog calls the stall callback, and calls it again
+// every further |deadline_ms| until the stage is kicked. The callback runs
+// on the watchdog thread and must not block: it is expected to flag the
+// stall to the thread that owns the stage.
+//
+//   watchdog.Init(2, 2000, std::bind(&Encoder::OnStall, this, _1, _2));
+//   watchdog.Start();
+//   ...
+//   watchdog.Kick(kCaptureStage);  // From the capture callback.
+class StallWatchdog {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Maximum number of stages.
+  static const int kMaxStages = 4;
+
+  // Receives the stalled stage and the time since its last kick, in
+  // milliseconds.
+  typedef std::function<void(int stage, int64 stalled_ms)> StallCallback;
+
+  StallWatchdog();
+  ~StallWatchdog();
+
+  // Watches stages 0 to |num_stages| - 1 against |deadline_ms|. Returns
+  // |kSuccess|, or |kInvalidArg| when an argument is out of range.
+  int Init(int num_stages, int64 deadline_ms, const StallCallback& callback);
+
+  // Kicks every stage, and starts the watchdog thread. Returns |kSuccess|,
+  // or |kNoMemory| when the thread cannot be created.
+  int Start();
+
+  // Stops the watchdog thread. The callback is not called after |Stop()|
+  // returns.
+  void Stop();
+
+  // Records progress of |stage|. Lock free; may be called from any thread.
+  void Kick(int stage);
+
+  bool running() const { return thread_.get() != NULL; }
+  int64 deadline_ms() const { return deadline_ms_; }
+
+  // Returns the steady clock time in milliseconds, as used for kicks.
+  static int64 NowMilliseconds();
+
+ private:
+  void WatchThread();
+
+  int num_stages_;
+  int64 deadline_ms_;
+  StallCallback callback_;
+
+  // Time of the last kick of each stage.
+  std::atomic<int64> kick_ms_[kMaxStages];
+
+  // Time each stage was last reported stalled. Watchdog thread only.
+  int64 report_ms_[kMaxStages];
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stop_;
+  std::unique_ptr<std::thread> thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(StallWatchdog);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_STALL_WATCHDOG_H_
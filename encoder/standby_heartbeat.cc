@@ -0,0 +1,203 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/standby_heartbeat.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <thread>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+StandbyHeartbeat::StandbyHeartbeat()
+    : ptr_record_(NULL),
+#ifdef _WIN32
+      mapping_(NULL),
+#else
+      fd_(-1),
+#endif
+      token_(0),
+      open_ms_(0) {
+}
+
+StandbyHeartbeat::~StandbyHeartbeat() {
+  Close();
+}
+
+int StandbyHeartbeat::Open(const std::string& name) {
+  if (name.empty()) {
+    LOG(ERROR) << "StandbyHeartbeat has no region name.";
+    return kInvalidArg;
+  }
+  if (ptr_record_) {
+    LOG(ERROR) << "StandbyHeartbeat already open.";
+    return kInvalidArg;
+  }
+  const size_t record_size = sizeof(StandbyHeartbeatRecord);
+#ifdef _WIN32
+  mapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+                                static_cast<DWORD>(record_size),
+                                name.c_str());
+  if (!mapping_) {
+    LOG(ERROR) << "CreateFileMapping failed: " << GetLastError();
+    return kOpenFailed;
+  }
+  void* const ptr_view =
+      MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, record_size);
+  if (!ptr_view) {
+    LOG(ERROR) << "MapViewOfFile failed: " << GetLastError();
+    Close();
+    return kOpenFailed;
+  }
+#else
+  fd_ = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+  if (fd_ < 0) {
+    LOG(ERROR) << "shm_open failed: " << strerror(errno);
+    return kOpenFailed;
+  }
+  // Both processes may size the region; the sizes are equal and new bytes
+  // read as zero.
+  struct stat file_stat;
+  if (fstat(fd_, &file_stat) ||
+      (static_cast<size_t>(file_stat.st_size) < record_size &&
+       ftruncate(fd_, record_size))) {
+    LOG(ERROR) << "cannot size heartbeat region: " << strerror(errno);
+    Close();
+    return kOpenFailed;
+  }
+  void* const ptr_view = mmap(NULL, record_size, PROT_READ | PROT_WRITE,
+                              MAP_SHARED, fd_, 0);
+  if (ptr_view == MAP_FAILED) {
+    LOG(ERROR) << "mmap failed: " << strerror(errno);
+    Close();
+    return kOpenFailed;
+  }
+#endif
+  ptr_record_ = reinterpret_cast<StandbyHeartbeatRecord*>(ptr_view);
+
+  // The first process to open the region initializes it. Others wait for
+  // |magic| rather than read a record being filled in.
+  uint32 magic = 0;
+  if (ptr_record_->magic.compare_exchange_strong(magic, 1)) {
+    ptr_record_->version = StandbyHeartbeatRecord::kVersion;
+    ptr_record_->owner.store(0);
+    ptr_record_->beat_ms.store(0);
+    ptr_record_->last_segment.store(-1);
+    ptr_record_->stream_start.store(0);
+    ptr_record_->magic.store(StandbyHeartbeatRecord::kMagic);
+  } else {
+    for (int i = 0; i < 100 && ptr_record_->magic.load() == 1; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  if (ptr_record_->magic.load() != StandbyHeartbeatRecord::kMagic ||
+      ptr_record_->version != StandbyHeartbeatRecord::kVersion) {
+    LOG(ERROR) << "StandbyHeartbeat region " << name
+               << " has no valid record.";
+    Close();
+    return kOpenFailed;
+  }
+
+  std::random_device random;
+  while (token_ == 0) {
+    token_ = (static_cast<uint64>(random()) << 32) ^ random() ^
+             static_cast<uint64>(NowMilliseconds());
+  }
+  open_ms_ = NowMilliseconds();
+  LOG(INFO) << "StandbyHeartbeat opened " << name << ", owner "
+            << (ptr_record_->owner.load() ? "present." : "absent.");
+  return kSuccess;
+}
+
+int StandbyHeartbeat::TakeOwnership(int64 stream_start,
+                                    int64 last_segment) {
+  if (!ptr_record_) {
+    LOG(ERROR) << "StandbyHeartbeat not open.";
+    return kInvalidArg;
+  }
+  ptr_record_->stream_start.store(stream_start);
+  ptr_record_->owner.store(token_);
+  LOG(INFO) << "StandbyHeartbeat took ownership after segment "
+            << last_segment << ".";
+  return Beat(last_segment);
+}
+
+int StandbyHeartbeat::Beat(int64 last_segment) {
+  if (!ptr_record_) {
+    LOG(ERROR) << "StandbyHeartbeat not open.";
+    return kInvalidArg;
+  }
+  if (ptr_record_->owner.load() != token_) {
+    LOG(ERROR) << "StandbyHeartbeat owned by another encoder.";
+    return kSuperseded;
+  }
+  ptr_record_->last_segment.store(last_segment);
+  ptr_record_->beat_ms.store(NowMilliseconds());
+  return kSuccess;
+}
+
+bool StandbyHeartbeat::OwnerAlive(int64 timeout_ms) const {
+  if (!ptr_record_) {
+    return false;
+  }
+  const int64 beat_ms = std::max(ptr_record_->beat_ms.load(), open_ms_);
+  return NowMilliseconds() - beat_ms <= timeout_ms;
+}
+
+int64 StandbyHeartbeat::last_segment() const {
+  return ptr_record_ ? ptr_record_->last_segment.load() : -1;
+}
+
+int64 StandbyHeartbeat::stream_start() const {
+  return ptr_record_ ? ptr_record_->stream_start.load() : 0;
+}
+
+bool StandbyHeartbeat::owner() const {
+  return ptr_record_ && ptr_record_->owner.load() == token_;
+}
+
+int64 StandbyHeartbeat::NowMilliseconds() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void StandbyHeartbeat::Close() {
+#ifdef _WIN32
+  if (ptr_record_) {
+    UnmapViewOfFile(ptr_record_);
+  }
+  if (mapping_) {
+    CloseHandle(mapping_);
+    mapping_ = NULL;
+  }
+#else
+  if (ptr_record_) {
+    munmap(ptr_record_, sizeof(StandbyHeartbeatRecord));
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+#endif
+  ptr_record_ = NULL;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,121 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_STANDBY_HEARTBEAT_H_
+#define WEBMLIVE_ENCODER_STANDBY_HEARTBEAT_H_
+
+#include <atomic>
+#include <string>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Record shared by a primary encoder and its standbys, at the start of a
+// named shared memory region. Whichever process opens the region first
+// fills in |version| and then sets |magic|; the region starts zeroed.
+struct StandbyHeartbeatRecord {
+  static const uint32 kMagic = 0x42485357;  // "WSHB"
+  static const uint32 kVersion = 1;
+
+  std::atomic<uint32> magic;
+  uint32 version;
+
+  // Random token of the encoder writing the stream, or 0 when none has.
+  std::atomic<uint64> owner;
+
+  // Time of the owner's last beat, in milliseconds of the steady clock,
+  // which is shared by the processes of a host.
+  std::atomic<int64> beat_ms;
+
+  // Number of the newest segment the owner has written, or -1.
+  std::atomic<int64> last_segment;
+
+  // Time the owner's stream became available, in seconds since the epoch,
+  // for encoders taking over to keep it. 0 when unknown.
+  std::atomic<int64> stream_start;
+};
+
+// Liveness signal between a primary encoder and a hot standby on the same
+// host. The encoder writing the stream owns the record and beats every
+// pass of its loop; a standby watches the beats and takes ownership when
+// they stop.
+//
+//   StandbyHeartbeat heartbeat;
+//   heartbeat.Open("/webmlive_hb");
+//   if (!heartbeat.OwnerAlive(timeout_ms)) {
+//     heartbeat.TakeOwnership(heartbeat.stream_start(),
+//                             heartbeat.last_segment());
+//     ... write the segments from heartbeat.last_segment() on ...
+//   }
+//
+// Notes
+// - The region is named like |WebmEncoderConfig::input_shared_memory|: a
+//   file mapping name on Windows, and a POSIX shared memory object name
+//   elsewhere. It is created by the first process to open it.
+// - An owner that finds another token in the record has been replaced, and
+//   |Beat()| tells it to stop writing.
+class StandbyHeartbeat {
+ public:
+  enum {
+    // The record belongs to another encoder.
+    kSuperseded = -3,
+    kOpenFailed = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  StandbyHeartbeat();
+  ~StandbyHeartbeat();
+
+  // Opens or creates the region named |name|. Returns |kSuccess| when
+  // successful.
+  int Open(const std::string& name);
+
+  // Makes this encoder, whose stream became available at |stream_start|,
+  // the owner of the record, and beats with segment |last_segment|. Returns
+  // |kSuccess| when successful.
+  int TakeOwnership(int64 stream_start, int64 last_segment);
+
+  // Beats with segment |last_segment|. Returns |kSuccess| when successful,
+  // or |kSuperseded| when another encoder owns the record.
+  int Beat(int64 last_segment);
+
+  // Returns true when an owner has beaten within |timeout_ms|. Time before
+  // |Open()| does not count, so that a standby started after the primary
+  // failed still waits |timeout_ms| before taking over.
+  bool OwnerAlive(int64 timeout_ms) const;
+
+  // Returns the segment of the owner's last beat, or -1.
+  int64 last_segment() const;
+
+  // Returns the availability start of the owner's stream, or 0.
+  int64 stream_start() const;
+
+  // Returns true when this encoder owns the record.
+  bool owner() const;
+
+  // Returns the steady clock time in milliseconds.
+  static int64 NowMilliseconds();
+
+ private:
+  void Close();
+
+  StandbyHeartbeatRecord* ptr_record_;
+#ifdef _WIN32
+  void* mapping_;
+#else
+  int fd_;
+#endif
+  uint64 token_;
+  int64 open_ms_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(StandbyHeartbeat);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_STANDBY_HEARTBEAT_H_
@@ -0,0 +1,80 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/static_frame_detector.h"
+
+#include <cstring>
+
+#include "encoder/video_encoder.h"
+#include "libyuv/compare.h"
+
+namespace webmlive {
+
+namespace {
+// Largest mean squared error per sample of a sampled row that still counts
+// as unchanged: capture noise of about one level. A 16 pixel cursor moving
+// across a 1080p row exceeds it many times over.
+const uint64 kMaxRowErrorPerSample = 1;
+}  // namespace
+
+StaticFrameDetector::StaticFrameDetector()
+    : row_bytes_(0),
+      width_(0),
+      height_(0) {
+}
+
+bool StaticFrameDetector::IsStatic(const VideoFrame& frame) {
+  const bool high_bit_depth = frame.format() == kVideoFormatI42016;
+  if (!frame.buffer() || (frame.format() != kVideoFormatI420 &&
+                          frame.format() != kVideoFormatYV12 &&
+                          !high_bit_depth)) {
+    Reset();
+    return false;
+  }
+
+  const int32 row_bytes = frame.width() * (high_bit_depth ? 2 : 1);
+  const int32 num_rows = (frame.height() + kRowStep - 1) / kRowStep;
+  const uint8* const ptr_luma = frame.buffer();
+  const int32 stride = frame.stride();
+  const bool same_size = frame.width() == width_ &&
+      frame.height() == height_ && !reference_rows_.empty();
+  if (same_size) {
+    // 10 bit samples are compared as bytes, so only exact repeats of them
+    // pass: a step of one level can change both bytes of a sample.
+    const uint64 max_row_error =
+        high_bit_depth ? 0 : kMaxRowErrorPerSample * row_bytes;
+    bool unchanged = true;
+    for (int32 row = 0; row < num_rows && unchanged; ++row) {
+      const uint64 error = libyuv::ComputeSumSquareError(
+          ptr_luma + row * kRowStep * stride,
+          &reference_rows_[row * row_bytes_], row_bytes);
+      unchanged = error <= max_row_error;
+    }
+    if (unchanged) {
+      return true;
+    }
+  }
+
+  width_ = frame.width();
+  height_ = frame.height();
+  row_bytes_ = row_bytes;
+  reference_rows_.resize(num_rows * row_bytes_);
+  for (int32 row = 0; row < num_rows; ++row) {
+    memcpy(&reference_rows_[row * row_bytes_],
+           ptr_luma + row * kRowStep * stride, row_bytes_);
+  }
+  return false;
+}
+
+void StaticFrameDetector::Reset() {
+  reference_rows_.clear();
+  row_bytes_ = 0;
+  width_ = 0;
+  height_ = 0;
+}
+
+}  // namespace webmlive
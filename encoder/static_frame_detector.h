@@ -0,0 +1,60 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_STATIC_FRAME_DETECTOR_H_
+#define WEBMLIVE_ENCODER_STATIC_FRAME_DETECTOR_H_
+
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+class VideoFrame;
+
+// Detects raw frames that repeat the last frame encoded, such as those of
+// slide and whiteboard streams, so that the encoder can skip them.
+//
+// Every |kRowStep|th luma row of the frame is compared with the same row of
+// the reference frame using libyuv's SIMD sum of squared errors. A frame is
+// static when no sampled row differs by more than capture noise. Frames that
+// are not static become the reference, so that slow changes add up instead
+// of slipping through one small step at a time.
+//
+// Notes
+// - I420, YV12 and I42016 frames only; others are never static. I42016
+//   frames must repeat exactly.
+// - Changes that fall entirely between sampled rows go unseen; they show up
+//   with the next frame that is encoded.
+class StaticFrameDetector {
+ public:
+  // Distance between sampled luma rows.
+  static const int32 kRowStep = 4;
+
+  StaticFrameDetector();
+  ~StaticFrameDetector() {}
+
+  // Returns true when |frame| matches the reference frame. Otherwise stores
+  // |frame| as the reference, and returns false.
+  bool IsStatic(const VideoFrame& frame);
+
+  // Forgets the reference frame.
+  void Reset();
+
+ private:
+  // Sampled luma rows of the reference frame, |row_bytes_| bytes each, and
+  // the size of the frame.
+  std::vector<uint8> reference_rows_;
+  int32 row_bytes_;
+  int32 width_;
+  int32 height_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(StaticFrameDetector);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_STATIC_FRAME_DETECTOR_H_
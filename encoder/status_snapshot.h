@@ -0,0 +1,83 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_STATUS_SNAPSHOT_H_
+#define WEBMLIVE_ENCODER_STATUS_SNAPSHOT_H_
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Copy of a trivially copyable |T| published by a writer and read by other
+// threads without locks. Readers never block the writer: |Load()| retries
+// when it overlaps a |Store()|, which only costs the writer a few atomic
+// stores. Used for the status and stats that |WebmEncoder| and
+// |HttpUploaderImpl| report to the threads polling them.
+//
+// Notes
+// - Stores must not overlap; callers with more than one writer serialize
+//   them, for example under the mutex protecting the source of the values.
+// - The value is held as atomic words so that a torn read is a detected
+//   retry rather than a data race.
+template <typename T>
+class StatusSnapshot {
+ public:
+  StatusSnapshot() : sequence_(0) {
+    Store(T());
+  }
+
+  // Publishes |value|.
+  void Store(const T& value) {
+    uint64 words[kNumWords] = {0};
+    memcpy(words, &value, sizeof(value));
+    const uint32 sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < kNumWords; ++i)
+      words_[i].store(words[i], std::memory_order_relaxed);
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+  // Returns the value last published.
+  T Load() const {
+    uint64 words[kNumWords];
+    for (;;) {
+      const uint32 sequence = sequence_.load(std::memory_order_acquire);
+      if (sequence & 1) {
+        std::this_thread::yield();
+        continue;
+      }
+      for (size_t i = 0; i < kNumWords; ++i)
+        words[i] = words_[i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence_.load(std::memory_order_relaxed) == sequence)
+        break;
+    }
+    T value;
+    memcpy(&value, words, sizeof(value));
+    return value;
+  }
+
+ private:
+  static_assert(std::is_trivially_copyable<T>::value,
+                "StatusSnapshot requires a trivially copyable type.");
+  static const size_t kNumWords = (sizeof(T) + 7) / 8;
+
+  // Odd while a |Store()| is in progress.
+  std::atomic<uint32> sequence_;
+  std::atomic<uint64> words_[kNumWords];
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(StatusSnapshot);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_STATUS_SNAPSHOT_H_
@@ -0,0 +1,525 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/synthetic_media_source.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WEBMLIVE_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/frame_rate_limiter.h"
+#include "encoder/latency_tracer.h"
+#include "encoder/thread_placement.h"
+#include "encoder/trace_log.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+
+// 75% color bars in BT.601 limited range: white, yellow, cyan, green,
+// magenta, red and blue.
+const int kNumBars = 7;
+const uint8 kBarY[kNumBars] = {180, 162, 131, 112, 84, 65, 35};
+const uint8 kBarU[kNumBars] = {128, 44, 156, 72, 184, 100, 212};
+const uint8 kBarV[kNumBars] = {128, 142, 44, 58, 198, 212, 114};
+
+const uint8 kBlack = 16;
+const uint8 kWhite = 235;
+const uint8 kNeutralChroma = 128;
+
+// Scrolling text font: 5 x 7 glyphs, one byte per row, the leftmost pixel
+// in bit 4, as the timecode font of |FrameOverlay|. Glyphs are one font
+// pixel apart. Characters without a glyph are drawn as spaces.
+const int kGlyphWidth = 5;
+const int kGlyphHeight = 7;
+const int kGlyphCellWidth = kGlyphWidth + 1;
+struct Glyph {
+  char character;
+  uint8 rows[kGlyphHeight];
+};
+const Glyph kGlyphs[] = {
+  {'B', {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E}},
+  {'C', {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}},
+  {'E', {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}},
+  {'H', {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}},
+  {'I', {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}},
+  {'L', {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F}},
+  {'M', {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}},
+  {'N', {0x11, 0x19, 0x15, 0x13, 0x11, 0x11, 0x11}},
+  {'O', {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}},
+  {'R', {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11}},
+  {'S', {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}},
+  {'T', {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}},
+  {'U', {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}},
+  {'V', {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04}},
+  {'W', {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A}},
+  {'Y', {0x11, 0x11, 0x0A, 0x04, 0x04, 0x04, 0x04}},
+};
+const int kNumGlyphs = sizeof(kGlyphs) / sizeof(kGlyphs[0]);
+const char kText[] = "WEBMLIVE SYNTHETIC SOURCE   ";
+const int kTextLength = sizeof(kText) - 1;
+
+// Glyph pixels per text band height.
+const int kTextBandGlyphRows = kGlyphHeight + 4;
+
+// Noise: word |i| of a row is |MixNoise(seed + i * kNoiseStep)|, stored
+// little endian, so that words can be computed in any order.
+const uint32 kNoiseStep = 0x9E3779B9u;
+
+// Sine table of the tone: one period, at -12 dBFS.
+const int kSineTableBits = 10;
+const int kSineTableSize = 1 << kSineTableBits;
+const double kToneAmplitude = 8192;
+
+const uint8* GlyphRows(char character) {
+  for (int i = 0; i < kNumGlyphs; ++i) {
+    if (kGlyphs[i].character == character)
+      return kGlyphs[i].rows;
+  }
+  return NULL;
+}
+
+uint32 NoiseSeed(int64 frame_number, int32 row) {
+  uint32 seed = static_cast<uint32>(frame_number) * 0x85EBCA6Bu ^
+                static_cast<uint32>(row) * 0xC2B2AE35u;
+  return seed ^ (seed >> 16);
+}
+
+uint32 MixNoise(uint32 x) {
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  x += kNoiseStep;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+#if defined(WEBMLIVE_HAVE_SSE2)
+__m128i MixNoise(__m128i x) {
+  x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+  x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+  x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+  x = _mm_add_epi32(x, _mm_set1_epi32(static_cast<int>(kNoiseStep)));
+  x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+  x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+  x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+  return x;
+}
+
+// Writes the noise words of whole 16 byte blocks of the |width| byte row
+// at |ptr_row|. Returns the bytes written.
+int32 NoiseRowSse2(uint32 seed, uint8* ptr_row, int32 width) {
+  __m128i words = _mm_setr_epi32(
+      static_cast<int>(seed), static_cast<int>(seed + kNoiseStep),
+      static_cast<int>(seed + 2 * kNoiseStep),
+      static_cast<int>(seed + 3 * kNoiseStep));
+  const __m128i step = _mm_set1_epi32(static_cast<int>(4 * kNoiseStep));
+  int32 x = 0;
+  for (; x + 16 <= width; x += 16) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ptr_row + x),
+                     MixNoise(words));
+    words = _mm_add_epi32(words, step);
+  }
+  return x;
+}
+#endif  // WEBMLIVE_HAVE_SSE2
+
+// Writes the |width| bytes of noise of row |row| of frame |frame_number|.
+void NoiseRow(int64 frame_number, int32 row, uint8* ptr_row, int32 width) {
+  const uint32 seed = NoiseSeed(frame_number, row);
+  int32 x = 0;
+#if defined(WEBMLIVE_HAVE_SSE2)
+  x = NoiseRowSse2(seed, ptr_row, width);
+#endif
+  for (; x < width; x += 4) {
+    const uint32 word = MixNoise(seed + static_cast<uint32>(x / 4) *
+                                        kNoiseStep);
+    for (int32 b = 0; b < 4 && x + b < width; ++b) {
+      ptr_row[x + b] = static_cast<uint8>(word >> (8 * b));
+    }
+  }
+}
+
+// Copies the |width| bytes of |ptr_src| to |rows| rows of |stride| bytes
+// from |ptr_dst| on.
+void CopyRow(const uint8* ptr_src, int32 width, int32 rows, int32 stride,
+             uint8* ptr_dst) {
+  for (int32 y = 0; y < rows; ++y) {
+    memcpy(ptr_dst + y * stride, ptr_src, width);
+  }
+}
+
+const std::vector<int16>& SineTable() {
+  static const std::vector<int16> table = [] {
+    std::vector<int16> sine(kSineTableSize);
+    const double kPi = 3.14159265358979323846;
+    for (int i = 0; i < kSineTableSize; ++i) {
+      sine[i] = static_cast<int16>(
+          std::floor(kToneAmplitude * sin(2 * kPi * i / kSineTableSize) +
+                     0.5));
+    }
+    return sine;
+  }();
+  return table;
+}
+}  // namespace
+
+SyntheticMediaSource::SyntheticMediaSource()
+    : ptr_audio_callback_(NULL),
+      ptr_video_callback_(NULL),
+      paced_(true),
+      duration_us_(0),
+      video_frame_size_(0),
+      video_frames_generated_(0),
+      audio_samples_generated_(0),
+      generate_failed_(false),
+      stop_(false),
+      input_ended_(false),
+      generate_error_(false) {
+}
+
+SyntheticMediaSource::~SyntheticMediaSource() {
+  if (delivery_thread_) {
+    Stop();
+  }
+}
+
+int SyntheticMediaSource::Init(
+    const WebmEncoderConfig& config,
+    AudioSamplesCallbackInterface* ptr_audio_callback,
+    VideoFrameCallbackInterface* ptr_video_callback) {
+  if ((!config.disable_video && !ptr_video_callback) ||
+      (!config.disable_audio && !ptr_audio_callback)) {
+    LOG(ERROR) << "SyntheticMediaSource NULL callback.";
+    return WebmEncoder::kInvalidArg;
+  }
+  if (config.input_synthetic_duration_ms < 0) {
+    LOG(ERROR) << "SyntheticMediaSource invalid duration "
+               << config.input_synthetic_duration_ms;
+    return WebmEncoder::kInvalidArg;
+  }
+  paced_ = config.input_paced;
+  duration_us_ = config.input_synthetic_duration_ms * 1000;
+
+  if (!config.disable_video) {
+    const VideoConfig& requested = config.requested_video_config;
+    VideoConfig& video = actual_video_config_;
+    video = VideoConfig();
+    video.format = kVideoFormatI420;
+    video.width = requested.width > 0 ? requested.width : kDefaultWidth;
+    video.height = requested.height > 0 ? requested.height : kDefaultHeight;
+    video.stride = VideoFrame::AlignedStride(video.width);
+    video.frame_rate = FrameRateLimiter::OutputFrameRate(
+        requested.frame_rate > 0 ? requested.frame_rate : kDefaultFrameRate,
+        config.max_video_frame_rate, config.vpx_config.decimate);
+    video_frame_size_ = VideoFrame::PlanarFrameSize(video.stride,
+                                                    video.height);
+    ptr_video_callback_ = ptr_video_callback;
+    LOG(INFO) << "SyntheticMediaSource video " << video.width << "x"
+              << video.height << " @ " << video.frame_rate << " fps.";
+  }
+
+  if (!config.disable_audio) {
+    const AudioConfig& requested = config.requested_audio_config;
+    AudioConfig& audio = actual_audio_config_;
+    audio = AudioConfig();
+    audio.format_tag = kAudioFormatPcm;
+    audio.channels = requested.channels > 0 ? requested.channels : 2;
+    audio.sample_rate =
+        requested.sample_rate > 0 ? requested.sample_rate : 48000;
+    audio.bits_per_sample = 16;
+    audio.block_align = audio.channels * audio.bits_per_sample / 8;
+    audio.bytes_per_second = audio.sample_rate * audio.block_align;
+    const int samples_per_buffer =
+        audio.sample_rate * kAudioBufferDurationMs / kTimebase;
+    audio_samples_.resize(samples_per_buffer * audio.channels);
+    ptr_audio_callback_ = ptr_audio_callback;
+    LOG(INFO) << "SyntheticMediaSource audio " << audio.channels
+              << " channels @ " << audio.sample_rate << " Hz.";
+  }
+  return WebmEncoder::kSuccess;
+}
+
+int SyntheticMediaSource::Run() {
+  if (delivery_thread_) {
+    LOG(ERROR) << "SyntheticMediaSource already running.";
+    return WebmEncoder::kRunFailed;
+  }
+  start_time_ = std::chrono::steady_clock::now();
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  delivery_thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(  // NOLINT
+          &SyntheticMediaSource::DeliveryThread, this)));
+  if (!delivery_thread_) {
+    LOG(ERROR) << "SyntheticMediaSource cannot construct thread.";
+    return WebmEncoder::kRunFailed;
+  }
+  return WebmEncoder::kSuccess;
+}
+
+int SyntheticMediaSource::CheckStatus() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (generate_error_) {
+    return WebmEncoder::kAVCaptureStopped;
+  }
+  return input_ended_ ? kInputEnded : kSuccess;
+}
+
+void SyntheticMediaSource::Stop() {
+  if (!delivery_thread_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  stop_event_.notify_all();
+  delivery_thread_->join();
+  delivery_thread_.reset();
+}
+
+void SyntheticMediaSource::DrawVideoFrame(int64 frame_number,
+                                          VideoFrame* ptr_frame) {
+  const int32 width = ptr_frame->width();
+  const int32 height = ptr_frame->height();
+  const int32 stride = ptr_frame->stride();
+  const int32 uv_width = (width + 1) / 2;
+  const int32 uv_height = (height + 1) / 2;
+  const int32 uv_stride = stride / 2;
+  uint8* const ptr_y = ptr_frame->buffer();
+  uint8* const ptr_u = ptr_y + stride * height;
+  uint8* const ptr_v = ptr_u + uv_stride * uv_height;
+
+  // Band boundaries, on even rows so that chroma rows follow them.
+  const int32 bars_end = (height * 2 / 3) & ~1;
+  const int32 noise_end = std::max(bars_end, (height * 5 / 6) & ~1);
+  const int32 uv_bars_end = bars_end / 2;
+  const int32 uv_noise_end = noise_end / 2;
+
+  // Bars: one row per plane, copied down the band.
+  std::vector<uint8> row(stride);
+  std::vector<uint8> u_row(uv_stride);
+  std::vector<uint8> v_row(uv_stride);
+  const int64 bars_offset = frame_number * kBarsPixelsPerFrame % width;
+  for (int32 x = 0; x < width; ++x) {
+    const int bar = static_cast<int>((x + bars_offset) % width * kNumBars /
+                                     width);
+    row[x] = kBarY[bar];
+    if ((x & 1) == 0) {
+      u_row[x / 2] = kBarU[bar];
+      v_row[x / 2] = kBarV[bar];
+    }
+  }
+  CopyRow(&row[0], width, bars_end, stride, ptr_y);
+  CopyRow(&u_row[0], uv_width, uv_bars_end, uv_stride, ptr_u);
+  CopyRow(&v_row[0], uv_width, uv_bars_end, uv_stride, ptr_v);
+
+  // Noise, in luma only.
+  for (int32 y = bars_end; y < noise_end; ++y) {
+    NoiseRow(frame_number, y, ptr_y + y * stride, width);
+  }
+  for (int32 y = uv_bars_end; y < uv_noise_end; ++y) {
+    memset(ptr_u + y * uv_stride, kNeutralChroma, uv_width);
+    memset(ptr_v + y * uv_stride, kNeutralChroma, uv_width);
+  }
+
+  // Text, centered vertically in its band, each font pixel |scale| pixels
+  // square.
+  const int32 text_height = height - noise_end;
+  const int32 scale = std::max(1, text_height / kTextBandGlyphRows);
+  const int32 text_top = noise_end + (text_height - kGlyphHeight * scale) / 2;
+  const int32 cell_width = kGlyphCellWidth * scale;
+  const int64 text_offset = frame_number * kTextPixelsPerFrame;
+  memset(&row[0], kBlack, width);
+  CopyRow(&row[0], width, text_height, stride, ptr_y + noise_end * stride);
+  for (int gy = 0; gy < kGlyphHeight; ++gy) {
+    const int32 top = text_top + gy * scale;
+    if (top < noise_end || top + scale > height) {
+      continue;
+    }
+    for (int32 x = 0; x < width; ++x) {
+      const int64 text_x = x + text_offset;
+      const uint8* const glyph =
+          GlyphRows(kText[text_x / cell_width % kTextLength]);
+      const int column = static_cast<int>(text_x % cell_width / scale);
+      row[x] = glyph && column < kGlyphWidth &&
+          (glyph[gy] & (0x10 >> column)) ? kWhite : kBlack;
+    }
+    CopyRow(&row[0], width, scale, stride, ptr_y + top * stride);
+  }
+  for (int32 y = uv_noise_end; y < uv_height; ++y) {
+    memset(ptr_u + y * uv_stride, kNeutralChroma, uv_width);
+    memset(ptr_v + y * uv_stride, kNeutralChroma, uv_width);
+  }
+}
+
+void SyntheticMediaSource::WriteTone(const AudioConfig& config,
+                                     int64 first_sample, int32 num_samples,
+                                     int16* ptr_samples) {
+  const std::vector<int16>& sine = SineTable();
+  const uint64 sample_rate = config.sample_rate;
+  for (int32 i = 0; i < num_samples; ++i) {
+    // Position in the period, computed exactly from the sample number.
+    const uint64 cycle_position =
+        static_cast<uint64>(first_sample + i) * kToneHz % sample_rate;
+    const int16 sample =
+        sine[static_cast<size_t>(cycle_position * kSineTableSize /
+                                 sample_rate)];
+    for (int c = 0; c < config.channels; ++c) {
+      *ptr_samples++ = sample;
+    }
+  }
+}
+
+bool SyntheticMediaSource::GenerateVideoFrame() {
+  const int64 timestamp_us = static_cast<int64>(
+      video_frames_generated_ * kMicrosecondTimebase /
+      actual_video_config_.frame_rate);
+  if (PastDuration(timestamp_us)) {
+    return false;
+  }
+  const int64 next_timestamp_us = static_cast<int64>(
+      (video_frames_generated_ + 1) * kMicrosecondTimebase /
+      actual_video_config_.frame_rate);
+
+  // Frames handed to the encoder are swapped for pool frames; draw into the
+  // one we now hold once it is large enough.
+  if (video_frame_.Allocate(video_frame_size_) ||
+      video_frame_.InitInPlace(actual_video_config_,
+                               true,  // always "keyframes"
+                               0,
+                               0,
+                               video_frame_size_)) {
+    generate_failed_ = true;
+    return false;
+  }
+  DrawVideoFrame(video_frames_generated_, &video_frame_);
+  video_frame_.SetTimeUs(timestamp_us, next_timestamp_us - timestamp_us);
+  ++video_frames_generated_;
+  return true;
+}
+
+bool SyntheticMediaSource::GenerateAudioBuffer() {
+  const AudioConfig& config = actual_audio_config_;
+  const int64 timestamp_us =
+      audio_samples_generated_ * kMicrosecondTimebase / config.sample_rate;
+  if (PastDuration(timestamp_us)) {
+    return false;
+  }
+  const int32 samples =
+      static_cast<int32>(audio_samples_.size() / config.channels);
+  const int64 next_timestamp_us = (audio_samples_generated_ + samples) *
+      kMicrosecondTimebase / config.sample_rate;
+  WriteTone(config, audio_samples_generated_, samples, &audio_samples_[0]);
+  if (audio_buffer_.Init(config, 0, 0,
+                         reinterpret_cast<const uint8*>(&audio_samples_[0]),
+                         samples * config.block_align)) {
+    generate_failed_ = true;
+    return false;
+  }
+  audio_buffer_.SetTimeUs(timestamp_us, next_timestamp_us - timestamp_us);
+  audio_samples_generated_ += samples;
+  return true;
+}
+
+bool SyntheticMediaSource::PastDuration(int64 timestamp_us) const {
+  return duration_us_ > 0 && timestamp_us >= duration_us_;
+}
+
+bool SyntheticMediaSource::WaitForMediaTime(int64 media_time) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (paced_) {
+    const std::chrono::steady_clock::time_point deadline =
+        start_time_ + std::chrono::milliseconds(media_time);
+    stop_event_.wait_until(lock, deadline, [this] { return stop_; });
+  }
+  return !stop_;
+}
+
+void SyntheticMediaSource::DeliveryThread() {
+  LOG(INFO) << "SyntheticMediaSource thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kCapture);
+  ScopedCpuStage cpu_stage(kCpuCapture);
+  bool video_pending = ptr_video_callback_ != NULL && GenerateVideoFrame();
+  bool audio_pending = ptr_audio_callback_ != NULL && GenerateAudioBuffer();
+
+  // True while |video_frame_| is offered again after a drop.
+  bool video_retry = false;
+
+  while ((video_pending || audio_pending) && !generate_failed_) {
+    // Deliver whichever stream is earliest.
+    const bool deliver_video =
+        video_pending &&
+        (!audio_pending ||
+         video_frame_.timestamp() <= audio_buffer_.timestamp());
+
+    if (deliver_video) {
+      const int64 timestamp = video_frame_.timestamp();
+      if (!WaitForMediaTime(timestamp)) {
+        break;
+      }
+      if (!video_retry) {
+        LatencyTracer::Stamp(LatencyTracer::kCapture, timestamp);
+      }
+      const int status = ptr_video_callback_->OnVideoFrameReceived(
+          &video_frame_);
+      if (status == VideoFrameCallbackInterface::kDropped && !paced_) {
+        // The pool did not take the frame: offer it again shortly.
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(kRetryDelayMs));
+        video_retry = true;
+        continue;
+      } else if (status &&
+                 status != VideoFrameCallbackInterface::kDropped) {
+        LOG(ERROR) << "OnVideoFrameReceived failed, status=" << status;
+      }
+      WEBMLIVE_TRACE_EVERY_N(TraceLog::kFrame, 30, "video_synthetic")
+          << " timestamp=" << timestamp;
+      video_retry = false;
+      video_pending = GenerateVideoFrame();
+    } else {
+      if (!WaitForMediaTime(audio_buffer_.timestamp())) {
+        break;
+      }
+      const int status = ptr_audio_callback_->OnSamplesReceived(
+          &audio_buffer_);
+      if (status == AudioSamplesCallbackInterface::kDropped && !paced_) {
+        // The pool did not take the buffer: offer it again shortly.
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(kRetryDelayMs));
+        continue;
+      } else if (status &&
+                 status != AudioSamplesCallbackInterface::kDropped) {
+        LOG(ERROR) << "OnSamplesReceived failed, status=" << status;
+      }
+      audio_pending = GenerateAudioBuffer();
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  generate_error_ = generate_failed_;
+  input_ended_ = !stop_ && !generate_failed_;
+  LOG(INFO) << "SyntheticMediaSource thread finished: "
+            << video_frames_generated_ << " video frames, "
+            << audio_samples_generated_ << " audio samples.";
+}
+
+}  // namespace webmlive
@@ -0,0 +1,166 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_SYNTHETIC_MEDIA_SOURCE_H_
+#define WEBMLIVE_ENCODER_SYNTHETIC_MEDIA_SOURCE_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/media_source.h"
+#include "encoder/video_encoder.h"
+#include "encoder/webm_encoder.h"
+
+namespace webmlive {
+
+// Media source that generates a test pattern and a tone instead of capturing
+// or reading them, so that benchmarks measure the encode pipeline without
+// disk reads, and give the same input on every machine.
+//
+// Each video frame has three bands:
+// - the top two thirds: 75% SMPTE color bars, scrolling left
+//   |kBarsPixelsPerFrame| pixels per frame;
+// - the next sixth: luma noise, new in every frame;
+// - the bottom sixth: white text on black, scrolling left
+//   |kTextPixelsPerFrame| pixels per frame.
+// Audio is a |kToneHz| sine at -12 dBFS on every channel, as PCM16 in
+// |kAudioBufferDurationMs| buffers.
+//
+// Notes
+// - Video is I420 at the size and frame rate of
+//   |WebmEncoderConfig::requested_video_config|, or |kDefaultWidth| x
+//   |kDefaultHeight| at |kDefaultFrameRate| where unset, limited by
+//   |WebmEncoderConfig::max_video_frame_rate|. Any size is accepted. Audio
+//   has the sample rate and channels of
+//   |WebmEncoderConfig::requested_audio_config|.
+// - Frames are drawn straight into the buffer the frame pool handed back for
+//   the previous frame. Bars and text rows are drawn once and copied down
+//   their band; the noise uses SSE2 when the target supports it, with the
+//   same output as the scalar code.
+// - Output depends only on the frame or sample number, so every run, and
+//   every machine, produces the same samples.
+// - |WebmEncoderConfig::input_paced| and the delivery of dropped samples
+//   work as for |FileMediaSource|. Input ends after
+//   |WebmEncoderConfig::input_synthetic_duration_ms|, or runs until stopped
+//   when it is 0.
+class SyntheticMediaSource : public MediaSourceInterface {
+ public:
+  static const int32 kDefaultWidth = 1280;
+  static const int32 kDefaultHeight = 720;
+  static const int kDefaultFrameRate = 30;
+
+  static const int kBarsPixelsPerFrame = 4;
+  static const int kTextPixelsPerFrame = 2;
+
+  static const int kToneHz = 1000;
+  static const int kAudioBufferDurationMs = 10;
+
+  // Delay between attempts to deliver a sample the encoder dropped when
+  // input is not paced.
+  static const int kRetryDelayMs = 1;
+
+  SyntheticMediaSource();
+  virtual ~SyntheticMediaSource();
+
+  // Stores the settings of the samples to generate. Returns |kSuccess| upon
+  // success, or a |WebmEncoder| status code upon failure.
+  virtual int Init(const WebmEncoderConfig& config,
+                   AudioSamplesCallbackInterface* ptr_audio_callback,
+                   VideoFrameCallbackInterface* ptr_video_callback);
+
+  // Starts the delivery thread. Returns |kSuccess| upon success, or a
+  // |WebmEncoder| status code upon failure.
+  virtual int Run();
+
+  // Returns |kSuccess| while delivering samples, |kInputEnded| once the
+  // configured duration has been delivered, and
+  // |WebmEncoder::kAVCaptureStopped| when a buffer could not be allocated.
+  virtual int CheckStatus();
+
+  // Stops and joins the delivery thread.
+  virtual void Stop();
+
+  virtual AudioConfig actual_audio_config() const {
+    return actual_audio_config_;
+  }
+  virtual VideoConfig actual_video_config() const {
+    return actual_video_config_;
+  }
+
+  // Draws frame |frame_number| of the pattern into |ptr_frame|, an I420
+  // frame whose config holds the size and stride.
+  static void DrawVideoFrame(int64 frame_number, VideoFrame* ptr_frame);
+
+  // Writes |num_samples| samples of the tone, from sample |first_sample|
+  // on, to |ptr_samples|: interleaved PCM16 with the channels and sample
+  // rate of |config|.
+  static void WriteTone(const AudioConfig& config, int64 first_sample,
+                        int32 num_samples, int16* ptr_samples);
+
+ private:
+  // Draws the next video frame into |video_frame_|. Returns false past the
+  // configured duration, and when the frame cannot be allocated.
+  bool GenerateVideoFrame();
+
+  // Writes the next audio buffer into |audio_buffer_|. Returns false past
+  // the configured duration, and when it cannot be allocated.
+  bool GenerateAudioBuffer();
+
+  // Returns true when |timestamp_us| lies past the configured duration.
+  bool PastDuration(int64 timestamp_us) const;
+
+  // Waits until |media_time| milliseconds after |start_time_| when input is
+  // paced. Returns false when |Stop()| is called first.
+  bool WaitForMediaTime(int64 media_time);
+
+  // Delivery thread function.
+  void DeliveryThread();
+
+  AudioSamplesCallbackInterface* ptr_audio_callback_;
+  VideoFrameCallbackInterface* ptr_video_callback_;
+  AudioConfig actual_audio_config_;
+  VideoConfig actual_video_config_;
+  bool paced_;
+  int64 duration_us_;
+
+  // Size in bytes of one video frame.
+  int32 video_frame_size_;
+
+  // Frames and audio samples generated so far, and whether allocating a
+  // buffer failed.
+  int64 video_frames_generated_;
+  int64 audio_samples_generated_;
+  bool generate_failed_;
+
+  // Sample storage reused by the delivery thread.
+  VideoFrame video_frame_;
+  AudioBuffer audio_buffer_;
+  std::vector<int16> audio_samples_;
+
+  // Time at which the delivery thread started, used to pace delivery.
+  std::chrono::steady_clock::time_point start_time_;
+
+  // Stop flag, wake up event, and delivery state. All protected by |mutex_|.
+  std::mutex mutex_;
+  std::condition_variable stop_event_;
+  bool stop_;
+  bool input_ended_;
+  bool generate_error_;
+
+  std::shared_ptr<std::thread> delivery_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(SyntheticMediaSource);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_SYNTHETIC_MEDIA_SOURCE_H_
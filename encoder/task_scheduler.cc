@@ -0,0 +1,367 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/task_scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/metrics.h"
+#include "encoder/resource_planner.h"
+#include "encoder/thread_placement.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+thread_local TaskScheduler::Worker* TaskScheduler::current_worker_ = NULL;
+
+TaskScheduler::TaskScheduler()
+    : queued_strands_(0),
+      wake_count_(0),
+      stop_(false),
+      ptr_tasks_run_(NULL),
+      ptr_late_tasks_(NULL),
+      ptr_steals_(NULL) {
+}
+
+TaskScheduler::~TaskScheduler() {
+  Stop();
+}
+
+int TaskScheduler::Init(int num_threads) {
+  if (num_threads < 0 || !workers_.empty()) {
+    LOG(ERROR) << "TaskScheduler invalid thread count or already Init.";
+    return kInvalidArg;
+  }
+  if (num_threads == 0) {
+    num_threads = AvailableCpuThreads();
+  }
+  for (int i = 0; i < num_threads; ++i) {
+    std::unique_ptr<Worker> worker(new (std::nothrow) Worker());  // NOLINT
+    if (!worker) {
+      LOG(ERROR) << "TaskScheduler cannot construct worker.";
+      return kNoMemory;
+    }
+    worker->ptr_scheduler = this;
+    worker->index = i;
+    workers_.push_back(std::move(worker));
+  }
+
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  ptr_tasks_run_ = registry.GetCounter(
+      "webmlive_scheduler_tasks_total", "",
+      "Encode tasks run by the task scheduler.");
+  ptr_late_tasks_ = registry.GetCounter(
+      "webmlive_scheduler_late_tasks_total", "",
+      "Encode tasks started after their deadline.");
+  ptr_steals_ = registry.GetCounter(
+      "webmlive_scheduler_steals_total", "",
+      "Strands taken from the run queue of another scheduler thread.");
+  if (!ptr_tasks_run_ || !ptr_late_tasks_ || !ptr_steals_) {
+    LOG(ERROR) << "TaskScheduler cannot create metrics.";
+    return kNoMemory;
+  }
+  LOG(INFO) << "TaskScheduler using " << num_threads << " threads.";
+  return kSuccess;
+}
+
+int TaskScheduler::Run() {
+  if (workers_.empty() || workers_[0]->thread) {
+    LOG(ERROR) << "TaskScheduler not Init or already running.";
+    return kThreadError;
+  }
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    Worker* const ptr_worker = workers_[i].get();
+    ptr_worker->thread = shared_ptr<thread>(
+        new (nothrow) thread(bind(&TaskScheduler::WorkerThread,  // NOLINT
+                                  this, ptr_worker)));
+    if (!ptr_worker->thread) {
+      LOG(ERROR) << "TaskScheduler cannot construct thread.";
+      Stop();
+      return kThreadError;
+    }
+  }
+  return kSuccess;
+}
+
+void TaskScheduler::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    stop_ = true;
+  }
+  work_ready_.notify_all();
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    if (workers_[i]->thread) {
+      workers_[i]->thread->join();
+      workers_[i]->thread.reset();
+    }
+  }
+}
+
+int64 TaskScheduler::NowMilliseconds() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool TaskScheduler::LaterStrand(const TaskStrand* a, const TaskStrand* b) {
+  return a->deadline_ms_ > b->deadline_ms_;
+}
+
+bool TaskScheduler::LaterTimer(const Timer& a, const Timer& b) {
+  return a.start_ms > b.start_ms;
+}
+
+void TaskScheduler::Schedule(TaskStrand* ptr_strand) {
+  Worker* ptr_worker = current_worker_;
+  if (!ptr_worker || ptr_worker->ptr_scheduler != this) {
+    ptr_worker = workers_[0].get();
+    for (size_t i = 1; i < workers_.size(); ++i) {
+      if (workers_[i]->queued < ptr_worker->queued)
+        ptr_worker = workers_[i].get();
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(ptr_worker->mutex);
+    ptr_worker->strands.push_back(ptr_strand);
+    std::push_heap(ptr_worker->strands.begin(), ptr_worker->strands.end(),
+                   LaterStrand);
+    ++ptr_worker->queued;
+    ++queued_strands_;
+  }
+  {
+    // Taking the lock orders the wake up after an idle thread's check of
+    // |queued_strands_|.
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+  }
+  work_ready_.notify_one();
+}
+
+bool TaskScheduler::Unschedule(TaskStrand* ptr_strand) {
+  {
+    std::lock_guard<std::mutex> lock(timer_mutex_);
+    std::vector<Timer>::iterator end = std::remove_if(
+        timers_.begin(), timers_.end(),
+        [ptr_strand](const Timer& timer) {
+          return timer.ptr_strand == ptr_strand;
+        });
+    if (end != timers_.end()) {
+      timers_.erase(end, timers_.end());
+      std::make_heap(timers_.begin(), timers_.end(), LaterTimer);
+    }
+  }
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    Worker* const ptr_worker = workers_[i].get();
+    std::lock_guard<std::mutex> lock(ptr_worker->mutex);
+    std::vector<TaskStrand*>& strands = ptr_worker->strands;
+    std::vector<TaskStrand*>::iterator it =
+        std::find(strands.begin(), strands.end(), ptr_strand);
+    if (it != strands.end()) {
+      strands.erase(it);
+      std::make_heap(strands.begin(), strands.end(), LaterStrand);
+      --ptr_worker->queued;
+      --queued_strands_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void TaskScheduler::AddTimer(const Timer& timer) {
+  {
+    std::lock_guard<std::mutex> lock(timer_mutex_);
+    timers_.push_back(timer);
+    std::push_heap(timers_.begin(), timers_.end(), LaterTimer);
+  }
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    ++wake_count_;
+  }
+  work_ready_.notify_one();
+}
+
+int64 TaskScheduler::PostDueTimers() {
+  const int64 now = NowMilliseconds();
+  // Posting under |timer_mutex_| keeps |Unschedule()| from returning while a
+  // due timer of its strand is being posted.
+  std::lock_guard<std::mutex> lock(timer_mutex_);
+  while (!timers_.empty() && timers_.front().start_ms <= now) {
+    std::pop_heap(timers_.begin(), timers_.end(), LaterTimer);
+    const Timer timer = timers_.back();
+    timers_.pop_back();
+    timer.ptr_strand->Post(timer.deadline_ms, timer.task);
+  }
+  const int64 next_wake = now + kMaxIdleWaitMs;
+  return timers_.empty() ? next_wake :
+      std::min(next_wake, timers_.front().start_ms);
+}
+
+TaskStrand* TaskScheduler::TakeStrand(Worker* ptr_worker) {
+  Worker* ptr_victim = ptr_worker;
+  if (ptr_worker->queued == 0) {
+    // Steal from the queue whose most urgent strand is the most urgent.
+    ptr_victim = NULL;
+    int64 earliest_deadline = 0;
+    for (size_t i = 0; i < workers_.size(); ++i) {
+      Worker* const ptr_other = workers_[i].get();
+      if (ptr_other == ptr_worker || ptr_other->queued == 0)
+        continue;
+      std::lock_guard<std::mutex> lock(ptr_other->mutex);
+      if (!ptr_other->strands.empty() &&
+          (!ptr_victim ||
+           ptr_other->strands.front()->deadline_ms_ < earliest_deadline)) {
+        ptr_victim = ptr_other;
+        earliest_deadline = ptr_other->strands.front()->deadline_ms_;
+      }
+    }
+    if (!ptr_victim)
+      return NULL;
+  }
+
+  std::lock_guard<std::mutex> lock(ptr_victim->mutex);
+  std::vector<TaskStrand*>& strands = ptr_victim->strands;
+  if (strands.empty())
+    return NULL;
+  std::pop_heap(strands.begin(), strands.end(), LaterStrand);
+  TaskStrand* const ptr_strand = strands.back();
+  strands.pop_back();
+  --ptr_victim->queued;
+  --queued_strands_;
+  if (ptr_victim != ptr_worker)
+    ptr_steals_->Increment(1);
+  return ptr_strand;
+}
+
+void TaskScheduler::WorkerThread(Worker* ptr_worker) {
+  LOG(INFO) << "TaskScheduler thread " << ptr_worker->index << " started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kEncode);
+  ScopedCpuStage cpu_stage(kCpuOther);
+  current_worker_ = ptr_worker;
+
+  for (;;) {
+    int64 wake_count = 0;
+    {
+      std::lock_guard<std::mutex> lock(idle_mutex_);
+      if (stop_)
+        break;
+      wake_count = wake_count_;
+    }
+    const int64 next_wake_ms = PostDueTimers();
+
+    TaskStrand* const ptr_strand = TakeStrand(ptr_worker);
+    if (ptr_strand) {
+      Task task;
+      int64 deadline_ms = 0;
+      if (ptr_strand->StartTask(&task, &deadline_ms)) {
+        if (NowMilliseconds() > deadline_ms)
+          ptr_late_tasks_->Increment(1);
+        task();
+        ptr_tasks_run_->Increment(1);
+        if (ptr_strand->FinishTask())
+          Schedule(ptr_strand);
+      }
+      continue;
+    }
+
+    const int64 wait_ms = std::max<int64>(0, next_wake_ms - NowMilliseconds());
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    work_ready_.wait_for(lock, std::chrono::milliseconds(wait_ms),
+                         [this, wake_count] {
+                           return stop_ || queued_strands_ > 0 ||
+                                  wake_count_ != wake_count;
+                         });
+  }
+
+  current_worker_ = NULL;
+  LOG(INFO) << "TaskScheduler thread " << ptr_worker->index << " finished.";
+}
+
+TaskStrand::TaskStrand(TaskScheduler* ptr_scheduler)
+    : ptr_scheduler_(ptr_scheduler),
+      state_(kIdle),
+      deadline_ms_(0) {
+  CHECK(ptr_scheduler_);
+}
+
+TaskStrand::~TaskStrand() {
+  Cancel();
+}
+
+void TaskStrand::Post(int64 deadline_ms, const TaskScheduler::Task& task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    PendingTask pending;
+    pending.deadline_ms = deadline_ms;
+    pending.task = task;
+    tasks_.push_back(pending);
+    if (state_ != kIdle)
+      return;
+    state_ = kQueued;
+    deadline_ms_ = deadline_ms;
+  }
+  ptr_scheduler_->Schedule(this);
+}
+
+void TaskStrand::PostAt(int64 start_ms, int64 deadline_ms,
+                        const TaskScheduler::Task& task) {
+  TaskScheduler::Timer timer;
+  timer.start_ms = start_ms;
+  timer.deadline_ms = deadline_ms;
+  timer.ptr_strand = this;
+  timer.task = task;
+  ptr_scheduler_->AddTimer(timer);
+}
+
+void TaskStrand::Cancel() {
+  // Clearing the timers and run queues first keeps the scheduler from
+  // posting or starting tasks of the strand afterwards.
+  const bool unscheduled = ptr_scheduler_->Unschedule(this);
+  std::unique_lock<std::mutex> lock(mutex_);
+  tasks_.clear();
+  if (unscheduled) {
+    // Queued and not taken; no scheduler thread refers to the strand.
+    state_ = kIdle;
+    return;
+  }
+
+  // A scheduler thread may hold the strand; it goes idle when the running
+  // task returns, or when the thread finds no task to start.
+  idle_.wait(lock, [this] { return state_ == kIdle; });
+}
+
+bool TaskStrand::StartTask(TaskScheduler::Task* ptr_task,
+                           int64* ptr_deadline_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (tasks_.empty()) {
+    state_ = kIdle;
+    idle_.notify_all();
+    return false;
+  }
+  ptr_task->swap(tasks_.front().task);
+  *ptr_deadline_ms = tasks_.front().deadline_ms;
+  tasks_.pop_front();
+  state_ = kRunning;
+  return true;
+}
+
+bool TaskStrand::FinishTask() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (tasks_.empty()) {
+    state_ = kIdle;
+    idle_.notify_all();
+    return false;
+  }
+  state_ = kQueued;
+  deadline_ms_ = tasks_.front().deadline_ms;
+  return true;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,213 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_TASK_SCHEDULER_H_
+#define WEBMLIVE_ENCODER_TASK_SCHEDULER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+class Metric;
+class TaskStrand;
+
+// Runs the encode work of many streams on one set of threads, so that cores
+// left idle by static streams go to the busy ones.
+//
+// Work is posted as short tasks to a |TaskStrand|, which runs its tasks one
+// at a time in the order they were posted: a stream keeps its frame order
+// without owning a thread. Every task carries a deadline. Each scheduler
+// thread keeps the strands it runs in a queue ordered by the deadline of
+// their next task and runs the most urgent; a thread with nothing queued
+// steals the most urgent strand from the other threads.
+//
+// Notes
+// - Tasks must not wait for other tasks of the scheduler, which may need the
+//   waiting thread to run. Cancel the strand with |TaskStrand::Cancel()|
+//   and finish its work inline instead.
+// - Times are steady clock milliseconds; see |NowMilliseconds()|.
+// - All strands must be cancelled or destroyed before |Stop()|.
+class TaskScheduler {
+ public:
+  enum {
+    // Scheduler thread could not be started.
+    kThreadError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+  typedef std::function<void()> Task;
+
+  // Maximum time an idle scheduler thread sleeps. Bounds the delay in
+  // noticing |Stop()|.
+  static const int kMaxIdleWaitMs = 100;
+
+  TaskScheduler();
+  ~TaskScheduler();
+
+  // Prepares |num_threads| threads, or one per hardware thread when
+  // |num_threads| is 0. Returns |kSuccess| when successful.
+  int Init(int num_threads);
+
+  // Starts the scheduler threads. Returns |kSuccess| when successful.
+  int Run();
+
+  // Stops and joins the scheduler threads. Tasks still queued are not run.
+  void Stop();
+
+  // Returns the current steady clock time in milliseconds.
+  static int64 NowMilliseconds();
+
+  int num_threads() const { return static_cast<int>(workers_.size()); }
+
+ private:
+  friend class TaskStrand;
+
+  // Run queue of one scheduler thread: strands ordered by deadline, earliest
+  // first, in a heap protected by |mutex|.
+  struct Worker {
+    Worker() : ptr_scheduler(NULL), index(0), queued(0) {}
+    TaskScheduler* ptr_scheduler;
+    int index;
+    std::mutex mutex;
+    std::vector<TaskStrand*> strands;
+    std::atomic<int> queued;
+    std::shared_ptr<std::thread> thread;
+  };
+
+  // Task started no earlier than |start_ms|; see |TaskStrand::PostAt()|.
+  struct Timer {
+    int64 start_ms;
+    int64 deadline_ms;
+    TaskStrand* ptr_strand;
+    Task task;
+  };
+
+  // Heap orderings putting the earliest deadline or start time on top.
+  static bool LaterStrand(const TaskStrand* a, const TaskStrand* b);
+  static bool LaterTimer(const Timer& a, const Timer& b);
+
+  // Queues runnable |ptr_strand|: on the calling thread's run queue when
+  // called from a task, and on the shortest run queue otherwise.
+  void Schedule(TaskStrand* ptr_strand);
+
+  // Removes |ptr_strand| from the run queues and timers. Returns true when
+  // it was queued.
+  bool Unschedule(TaskStrand* ptr_strand);
+
+  // Adds a timer, and wakes a thread to wait for it.
+  void AddTimer(const Timer& timer);
+
+  // Posts the timers that are due. Returns the start time of the next timer,
+  // or a time |kMaxIdleWaitMs| away when there are none.
+  int64 PostDueTimers();
+
+  // Takes the most urgent strand from the run queue of |ptr_worker|, or, when
+  // the queue is empty, from the run queue holding the most urgent strand.
+  // Returns NULL when every queue is empty.
+  TaskStrand* TakeStrand(Worker* ptr_worker);
+
+  // Scheduler thread function.
+  void WorkerThread(Worker* ptr_worker);
+
+  // Run queue of the calling thread; NULL outside of scheduler threads.
+  static thread_local Worker* current_worker_;
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  // Timer heap, earliest first, protected by |timer_mutex_|.
+  std::mutex timer_mutex_;
+  std::vector<Timer> timers_;
+
+  // Idle thread wake up: |queued_strands_| counts strands in all run queues,
+  // and |wake_count_| changes when a timer is added. |stop_| and
+  // |wake_count_| are protected by |idle_mutex_|.
+  std::mutex idle_mutex_;
+  std::condition_variable work_ready_;
+  std::atomic<int> queued_strands_;
+  int64 wake_count_;
+  bool stop_;
+
+  // Metrics exported through |MetricsRegistry|: tasks run, tasks started
+  // after their deadline, and strands taken from another thread's queue.
+  Metric* ptr_tasks_run_;
+  Metric* ptr_late_tasks_;
+  Metric* ptr_steals_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(TaskScheduler);
+};
+
+// Serial queue of tasks run by a |TaskScheduler|. Tasks run one at a time,
+// in the order they were posted, on any scheduler thread.
+class TaskStrand {
+ public:
+  // |ptr_scheduler| must outlive the strand.
+  explicit TaskStrand(TaskScheduler* ptr_scheduler);
+
+  // Cancels the strand.
+  ~TaskStrand();
+
+  // Queues |task| to run after the tasks already posted. |deadline_ms|, a
+  // |TaskScheduler::NowMilliseconds()| time, orders the strand against the
+  // other strands while |task| is its next task.
+  void Post(int64 deadline_ms, const TaskScheduler::Task& task);
+
+  // Posts |task| once |start_ms| is reached.
+  void PostAt(int64 start_ms, int64 deadline_ms,
+              const TaskScheduler::Task& task);
+
+  // Discards the tasks not yet started, including those posted while
+  // |Cancel()| runs, and waits for the running task to return. Must not be
+  // called from a task of this strand.
+  void Cancel();
+
+ private:
+  friend class TaskScheduler;
+
+  enum State {
+    kIdle,
+    kQueued,
+    kRunning,
+  };
+
+  struct PendingTask {
+    int64 deadline_ms;
+    TaskScheduler::Task task;
+  };
+
+  // Called by the scheduler thread that took the strand: starts the next
+  // task. Returns false when there is none and the strand is idle.
+  bool StartTask(TaskScheduler::Task* ptr_task, int64* ptr_deadline_ms);
+
+  // Called after the task from |StartTask()| returns. Returns true when the
+  // strand has more tasks and must be queued again.
+  bool FinishTask();
+
+  TaskScheduler* const ptr_scheduler_;
+
+  // Tasks not yet started, run state, and the deadline ordering the strand
+  // while queued. |deadline_ms_| is read by the scheduler only while the
+  // strand is in a run queue. Protected by |mutex_|.
+  std::mutex mutex_;
+  std::condition_variable idle_;
+  std::deque<PendingTask> tasks_;
+  State state_;
+  int64 deadline_ms_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(TaskStrand);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_TASK_SCHEDULER_H_
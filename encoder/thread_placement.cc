@@ -0,0 +1,224 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/thread_placement.h"
+
+#include <cerrno>
+#include <cstdlib>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "encoder/slab_allocator.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Highest CPU index accepted by |ParseCpuList()|.
+const int kMaxCpu = 1023;
+
+const char* const kStageNames[ThreadPlacement::kNumStages] = {
+  "capture", "audio capture", "encode", "upload", "background",
+  "video encode"
+};
+
+// Nice value of |kVideoEncode| threads. Each nice step is a ~1.25x CPU share
+// under CFS, so audio and mux threads at 0 get ~2x the share of a video
+// worker while both are runnable.
+const int kVideoEncodeNice = 3;
+
+// Parses the non-negative integer at |*ptr_pos| in |text|, and advances
+// |*ptr_pos| past it.
+bool ParseCpu(const std::string& text, size_t* ptr_pos, int* ptr_cpu) {
+  const char* const ptr_begin = text.c_str() + *ptr_pos;
+  char* ptr_end = NULL;
+  const long cpu = strtol(ptr_begin, &ptr_end, 10);  // NOLINT
+  if (ptr_end == ptr_begin || cpu < 0 || cpu > kMaxCpu) {
+    return false;
+  }
+  *ptr_pos += ptr_end - ptr_begin;
+  *ptr_cpu = static_cast<int>(cpu);
+  return true;
+}
+
+void SetAffinity(ThreadPlacement::Stage stage, const std::vector<int>& cpus) {
+#ifdef _WIN32
+  DWORD_PTR mask = 0;
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    if (cpus[i] >= static_cast<int>(sizeof(mask) * 8)) {
+      LOG(WARNING) << "CPU " << cpus[i] << " is outside processor group 0.";
+      continue;
+    }
+    mask |= static_cast<DWORD_PTR>(1) << cpus[i];
+  }
+  if (!mask || !SetThreadAffinityMask(GetCurrentThread(), mask)) {
+    LOG(WARNING) << "cannot set " << kStageNames[stage]
+                 << " thread affinity: " << GetLastError();
+  }
+#elif defined(__linux__)
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    CPU_SET(cpus[i], &cpu_set);
+  }
+  const int status =
+      pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (status) {
+    LOG(WARNING) << "cannot set " << kStageNames[stage]
+                 << " thread affinity: " << status;
+  }
+#else
+  LOG(WARNING) << "thread affinity is not supported; " << kStageNames[stage]
+               << " thread not pinned.";
+#endif
+}
+
+void SetRealtimePriority(ThreadPlacement::Stage stage) {
+  // Audio capture outranks video capture: a late audio period is an audible
+  // glitch, a late video frame is one repeated frame.
+  const bool audio = stage == ThreadPlacement::kAudioCapture;
+#ifdef _WIN32
+  const int priority =
+      audio ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST;
+  if (!SetThreadPriority(GetCurrentThread(), priority)) {
+    LOG(WARNING) << "cannot raise " << kStageNames[stage]
+                 << " thread priority: " << GetLastError();
+  }
+#else
+  sched_param param = {0};
+  param.sched_priority = sched_get_priority_min(SCHED_FIFO) + (audio ? 2 : 1);
+  const int status = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+  if (status) {
+    LOG(WARNING) << "cannot raise " << kStageNames[stage]
+                 << " thread to SCHED_FIFO: " << status;
+  }
+#endif
+}
+
+void SetBackgroundPriority(ThreadPlacement::Stage stage) {
+#ifdef _WIN32
+  if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST)) {
+    LOG(WARNING) << "cannot lower " << kStageNames[stage]
+                 << " thread priority: " << GetLastError();
+  }
+#elif defined(SCHED_IDLE)
+  sched_param param = {0};
+  const int status = pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+  if (status) {
+    LOG(WARNING) << "cannot lower " << kStageNames[stage]
+                 << " thread to SCHED_IDLE: " << status;
+  }
+#else
+  VLOG(1) << kStageNames[stage] << " thread keeps its default priority.";
+#endif
+}
+
+void SetBelowNormalPriority(ThreadPlacement::Stage stage) {
+#ifdef _WIN32
+  if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL)) {
+    LOG(WARNING) << "cannot lower " << kStageNames[stage]
+                 << " thread priority: " << GetLastError();
+  }
+#elif defined(__linux__)
+  // Linux applies nice values per thread when given a thread ID.
+  const id_t tid = static_cast<id_t>(syscall(SYS_gettid));
+  if (setpriority(PRIO_PROCESS, tid, kVideoEncodeNice)) {
+    LOG(WARNING) << "cannot lower " << kStageNames[stage]
+                 << " thread priority: " << errno;
+  }
+#else
+  VLOG(1) << kStageNames[stage] << " thread keeps its default priority.";
+#endif
+}
+}  // namespace
+
+ThreadPlacement& ThreadPlacement::Instance() {
+  static ThreadPlacement placement;
+  return placement;
+}
+
+ThreadPlacement::ThreadPlacement() : numa_node_(-1) {
+}
+
+int ThreadPlacement::ParseCpuList(const std::string& cpu_list,
+                                  std::vector<int>* ptr_cpus) {
+  if (!ptr_cpus) {
+    LOG(ERROR) << "cannot parse CPU list into NULL vector.";
+    return kInvalidArg;
+  }
+  std::vector<int> cpus;
+  size_t pos = 0;
+  while (pos < cpu_list.size()) {
+    int first = 0;
+    if (!ParseCpu(cpu_list, &pos, &first)) {
+      LOG(ERROR) << "invalid CPU list: " << cpu_list;
+      return kInvalidArg;
+    }
+    int last = first;
+    if (pos < cpu_list.size() && cpu_list[pos] == '-') {
+      ++pos;
+      if (!ParseCpu(cpu_list, &pos, &last) || last < first) {
+        LOG(ERROR) << "invalid CPU range in list: " << cpu_list;
+        return kInvalidArg;
+      }
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+    if (pos < cpu_list.size()) {
+      if (cpu_list[pos] != ',' || pos + 1 == cpu_list.size()) {
+        LOG(ERROR) << "invalid CPU list: " << cpu_list;
+        return kInvalidArg;
+      }
+      ++pos;
+    }
+  }
+  ptr_cpus->swap(cpus);
+  return kSuccess;
+}
+
+void ThreadPlacement::SetCpus(Stage stage, const std::vector<int>& cpus) {
+  CHECK(stage >= 0 && stage < kNumStages);
+  stages_[stage].cpus = cpus;
+}
+
+void ThreadPlacement::SetRealtime(Stage stage, bool realtime) {
+  CHECK(stage >= 0 && stage < kNumStages);
+  stages_[stage].realtime = realtime;
+}
+
+void ThreadPlacement::SetNumaNode(int numa_node) {
+  numa_node_ = numa_node < 0 ? -1 : numa_node;
+  SlabAllocator::Instance().set_numa_node(numa_node_);
+}
+
+void ThreadPlacement::PlaceCurrentThread(Stage stage) const {
+  CHECK(stage >= 0 && stage < kNumStages);
+  const StageConfig& config = stages_[stage];
+  if (!config.cpus.empty()) {
+    SetAffinity(stage, config.cpus);
+  }
+  if (stage == kBackground) {
+    SetBackgroundPriority(stage);
+  } else if (config.realtime) {
+    SetRealtimePriority(stage);
+  } else if (stage == kVideoEncode) {
+    SetBelowNormalPriority(stage);
+  }
+  VLOG(1) << kStageNames[stage] << " thread placed on "
+          << config.cpus.size() << " CPUs"
+          << (config.realtime ? " at real time priority." : ".");
+}
+
+}  // namespace webmlive
@@ -0,0 +1,104 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_THREAD_PLACEMENT_H_
+#define WEBMLIVE_ENCODER_THREAD_PLACEMENT_H_
+
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Process wide CPU and priority placement of the capture, encode and upload
+// threads. Configured once by the application before the encoder starts, and
+// applied by each thread to itself as its thread function begins:
+//
+//   ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kEncode);
+//
+// Notes
+// - Threads of a stage with no CPUs configured may run on any CPU.
+// - Real time priority is SCHED_FIFO on Linux, which needs CAP_SYS_NICE, and
+//   a raised thread priority on Windows. Failures are logged and the thread
+//   keeps its default priority.
+// - |kBackground| threads run at SCHED_IDLE on Linux and the lowest thread
+//   priority on Windows whatever |SetRealtime()| says, so they only use CPU
+//   time the other stages leave.
+// - |kVideoEncode| threads run slightly below normal priority unless made
+//   real time, so that when the CPU is saturated audio encoding and muxing on
+//   |kEncode| threads are scheduled first. Without contention the priorities
+//   make no difference.
+// - On Windows only the first 64 CPUs, those of processor group 0, can be
+//   named.
+// - Setting a NUMA node makes |SlabAllocator| bind the frame sized blocks it
+//   maps to the node, so raw frames are local to the CPUs that capture and
+//   encode them.
+class ThreadPlacement {
+ public:
+  enum {
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  enum Stage {
+    // Video capture, and file input delivery.
+    kCapture = 0,
+    // Audio capture.
+    kAudioCapture = 1,
+    // Audio encoding, muxing, and video encoding on shared encode threads.
+    kEncode = 2,
+    // HTTP upload and file output.
+    kUpload = 3,
+    // Work the stream does not wait for, such as preview thumbnails. Always
+    // runs below normal priority.
+    kBackground = 4,
+    // Video encode worker threads. Runs below |kEncode| threads.
+    kVideoEncode = 5,
+    kNumStages = 6,
+  };
+
+  static ThreadPlacement& Instance();
+
+  // Parses a CPU list such as "0-3,8,10-11" into |ptr_cpus|. Returns
+  // |kSuccess| when successful.
+  static int ParseCpuList(const std::string& cpu_list,
+                          std::vector<int>* ptr_cpus);
+
+  // Restricts threads of |stage| to |cpus|. An empty list removes the
+  // restriction.
+  void SetCpus(Stage stage, const std::vector<int>& cpus);
+
+  // Runs threads of |stage| at real time priority when |realtime| is true.
+  void SetRealtime(Stage stage, bool realtime);
+
+  // Allocates raw frame storage on NUMA node |numa_node|. -1, the default,
+  // leaves placement to the system.
+  void SetNumaNode(int numa_node);
+  int numa_node() const { return numa_node_; }
+
+  // Applies the placement of |stage| to the calling thread.
+  void PlaceCurrentThread(Stage stage) const;
+
+ private:
+  struct StageConfig {
+    StageConfig() : realtime(false) {}
+    std::vector<int> cpus;
+    bool realtime;
+  };
+
+  ThreadPlacement();
+  ~ThreadPlacement() {}
+
+  StageConfig stages_[kNumStages];
+  int numa_node_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(ThreadPlacement);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_THREAD_PLACEMENT_H_
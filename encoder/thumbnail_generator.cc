@@ -0,0 +1,381 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/thumbnail_generator.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <sstream>
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/thread_placement.h"
+#include "encoder/video_encoder.h"
+#include "glog/logging.h"
+#include "libyuv/planar_functions.h"
+#include "libyuv/scale.h"
+
+namespace webmlive {
+
+namespace {
+// Black in the full range YCbCr of JPEG, the background of sprite sheets.
+const uint8 kBlackLuma = 0;
+const uint8 kBlackChroma = 128;
+
+// Appends |time_ms| to |ptr_stream| as a WebVTT timestamp, HH:MM:SS.mmm.
+void AppendVttTime(int64 time_ms, std::ostringstream* ptr_stream) {
+  char text[32];
+  const int64 time = std::max(time_ms, static_cast<int64>(0));
+  snprintf(text, sizeof(text), "%02lld:%02lld:%02lld.%03lld",
+           static_cast<long long>(time / 3600000),       // NOLINT
+           static_cast<long long>(time / 60000 % 60),    // NOLINT
+           static_cast<long long>(time / 1000 % 60),     // NOLINT
+           static_cast<long long>(time % 1000));         // NOLINT
+  *ptr_stream << text;
+}
+}  // namespace
+
+int ThumbnailGenerator::Image::Allocate(int32 image_width,
+                                        int32 image_height) {
+  if (image_width <= 0 || image_height <= 0) {
+    return kInvalidArg;
+  }
+  width = image_width;
+  height = image_height;
+  y_stride = VideoFrame::AlignedStride(width);
+  uv_stride = VideoFrame::AlignedStride((width + 1) / 2);
+  data.resize(y_stride * height + 2 * uv_stride * ((height + 1) / 2));
+  return kSuccess;
+}
+
+ThumbnailGenerator::ThumbnailGenerator()
+    : width_(0),
+      height_(0),
+      frame_count_(0),
+      sprite_thumbnails_(0),
+      sprite_number_(0),
+      skipped_thumbnails_(0),
+      stop_(false),
+      running_(false) {
+}
+
+ThumbnailGenerator::~ThumbnailGenerator() {
+  Stop();
+}
+
+int ThumbnailGenerator::Init(const ThumbnailConfig& config,
+                             const std::string& name) {
+  if (config.frame_interval < 0 || config.width < 2 || config.height < 0 ||
+      config.height == 1 || config.quality < 1 || config.quality > 100 ||
+      config.sprite_columns < 0 || config.sprite_rows < 0 || name.empty()) {
+    LOG(ERROR) << "ThumbnailGenerator invalid config.";
+    return kInvalidArg;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (running_) {
+    LOG(ERROR) << "ThumbnailGenerator cannot Init while running.";
+    return kInvalidArg;
+  }
+  config_ = config;
+  name_ = name;
+  width_ = 0;
+  height_ = 0;
+  frame_count_ = 0;
+  sprite_ = Image();
+  sprite_thumbnails_ = 0;
+  sprite_number_ = 0;
+  cues_.clear();
+  slots_.clear();
+  queued_slots_.clear();
+  free_slots_.clear();
+  outputs_.clear();
+  skipped_thumbnails_ = 0;
+  if (!config_.frame_interval) {
+    return kSuccess;
+  }
+  const int status = jpeg_encoder_.Init(config_.quality);
+  if (status) {
+    LOG(ERROR) << "ThumbnailGenerator cannot init JPEG encoder: " << status;
+    return status == JpegEncoder::kUnsupported ? kUnsupported :
+        status == JpegEncoder::kNoMemory ? kNoMemory : kInvalidArg;
+  }
+  return kSuccess;
+}
+
+int ThumbnailGenerator::Start() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (running_ || !config_.frame_interval) {
+    return kSuccess;
+  }
+  stop_ = false;
+  thread_.reset(new (std::nothrow) std::thread(  // NOLINT
+      &ThumbnailGenerator::ThumbnailThread, this));
+  if (!thread_) {
+    LOG(ERROR) << "ThumbnailGenerator cannot start its thread.";
+    return kThreadError;
+  }
+  running_ = true;
+  return kSuccess;
+}
+
+void ThumbnailGenerator::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+      return;
+    }
+    stop_ = true;
+  }
+  slot_queued_.notify_all();
+  thread_->join();
+  thread_.reset();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  running_ = false;
+}
+
+void ThumbnailGenerator::AddFrame(const VideoFrame& frame) {
+  if (!config_.frame_interval || frame_count_++ % config_.frame_interval) {
+    return;
+  }
+  const VideoFormat format = frame.format();
+  if ((format != kVideoFormatI420 && format != kVideoFormatYV12) ||
+      !frame.buffer()) {
+    VLOG(1) << "ThumbnailGenerator skipped format " << format;
+    return;
+  }
+
+  int slot = -1;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!running_) {
+      return;
+    }
+    if (!width_ && Allocate(frame.width(), frame.height())) {
+      LOG(ERROR) << "ThumbnailGenerator cannot allocate thumbnails; "
+                 << "thumbnails disabled.";
+      config_.frame_interval = 0;
+      return;
+    }
+    if (free_slots_.empty()) {
+      ++skipped_thumbnails_;
+      VLOG(1) << "ThumbnailGenerator skipped a thumbnail (worker busy).";
+      return;
+    }
+    slot = free_slots_.back();
+    free_slots_.pop_back();
+  }
+
+  // The slot belongs to this thread until it is queued; scale unlocked.
+  Slot& scaled = *slots_[slot];
+  const int32 stride = frame.stride();
+  const int32 uv_stride = stride / 2;
+  const uint8* const ptr_y = frame.buffer();
+  const uint8* ptr_u = ptr_y + stride * frame.height();
+  const uint8* ptr_v = ptr_u + uv_stride * ((frame.height() + 1) / 2);
+  if (format == kVideoFormatYV12) {
+    std::swap(ptr_u, ptr_v);
+  }
+  Image& image = scaled.image;
+  const int status = libyuv::I420Scale(ptr_y, stride,
+                                       ptr_u, uv_stride,
+                                       ptr_v, uv_stride,
+                                       frame.width(), frame.height(),
+                                       image.y(), image.y_stride,
+                                       image.u(), image.uv_stride,
+                                       image.v(), image.uv_stride,
+                                       image.width, image.height,
+                                       libyuv::kFilterBox);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (status) {
+    LOG(ERROR) << "ThumbnailGenerator I420Scale failed: " << status;
+    free_slots_.push_back(slot);
+    return;
+  }
+  scaled.timestamp = frame.timestamp();
+  scaled.duration = frame.duration() * config_.frame_interval;
+  queued_slots_.push_back(slot);
+  slot_queued_.notify_one();
+}
+
+bool ThumbnailGenerator::TakeOutput(SharedDataChunk* ptr_chunk,
+                                    std::string* ptr_id) {
+  if (!ptr_chunk || !ptr_id) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (outputs_.empty()) {
+    return false;
+  }
+  *ptr_chunk = outputs_.front().chunk;
+  ptr_id->swap(outputs_.front().id);
+  outputs_.pop_front();
+  return true;
+}
+
+int64 ThumbnailGenerator::skipped_thumbnails() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return skipped_thumbnails_;
+}
+
+int ThumbnailGenerator::Allocate(int32 frame_width, int32 frame_height) {
+  if (frame_width < 2 || frame_height < 2) {
+    return kInvalidArg;
+  }
+  width_ = std::min(config_.width, frame_width) & ~1;
+  height_ = config_.height ?
+      std::min(config_.height, frame_height) :
+      static_cast<int32>(static_cast<int64>(width_) * frame_height /
+                         frame_width);
+  height_ = std::max(height_ & ~1, 2);
+  for (int i = 0; i < kMaxQueuedThumbnails; ++i) {
+    std::unique_ptr<Slot> slot(new (std::nothrow) Slot());  // NOLINT
+    if (!slot || slot->image.Allocate(width_, height_)) {
+      return kNoMemory;
+    }
+    slots_.push_back(std::move(slot));
+    free_slots_.push_back(i);
+  }
+  if (config_.sprite_columns && config_.sprite_rows &&
+      sprite_.Allocate(width_ * config_.sprite_columns,
+                       height_ * config_.sprite_rows)) {
+    return kNoMemory;
+  }
+  LOG(INFO) << "ThumbnailGenerator making " << width_ << "x" << height_
+            << " thumbnails every " << config_.frame_interval << " frames.";
+  return kSuccess;
+}
+
+void ThumbnailGenerator::ThumbnailThread() {
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kBackground);
+  ScopedCpuStage cpu_stage(kCpuBackground);
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    slot_queued_.wait(lock, [this] {
+      return stop_ || !queued_slots_.empty();
+    });
+    if (queued_slots_.empty()) {
+      break;
+    }
+    const int slot = queued_slots_.front();
+    queued_slots_.pop_front();
+    lock.unlock();
+    Compress(slots_[slot].get());
+    lock.lock();
+    free_slots_.push_back(slot);
+  }
+  lock.unlock();
+  if (sprite_thumbnails_) {
+    FinishSprite();
+  }
+}
+
+void ThumbnailGenerator::Compress(Slot* ptr_slot) {
+  Image& image = ptr_slot->image;
+  if (jpeg_encoder_.Encode(image.y(), image.y_stride,
+                           image.u(), image.v(), image.uv_stride,
+                           image.width, image.height, &jpeg_buffer_)) {
+    LOG(ERROR) << "ThumbnailGenerator cannot compress thumbnail.";
+  } else {
+    std::ostringstream id;
+    id << name_ << "_thumb_" << ptr_slot->timestamp << ".jpg";
+    QueueOutput(jpeg_buffer_, id.str());
+  }
+  if (sprite_.data.empty()) {
+    return;
+  }
+
+  if (!sprite_thumbnails_) {
+    const int32 y_size = sprite_.y_stride * sprite_.height;
+    memset(sprite_.y(), kBlackLuma, y_size);
+    memset(sprite_.u(), kBlackChroma, sprite_.data.size() - y_size);
+  }
+  Cue cue;
+  cue.start_time = ptr_slot->timestamp;
+  cue.end_time = ptr_slot->timestamp + ptr_slot->duration;
+  cue.sprite_number = sprite_number_;
+  cue.x = sprite_thumbnails_ % config_.sprite_columns * width_;
+  cue.y = sprite_thumbnails_ / config_.sprite_columns * height_;
+  libyuv::CopyPlane(image.y(), image.y_stride,
+                    sprite_.y() + cue.y * sprite_.y_stride + cue.x,
+                    sprite_.y_stride, width_, height_);
+  const int32 uv_offset = cue.y / 2 * sprite_.uv_stride + cue.x / 2;
+  libyuv::CopyPlane(image.u(), image.uv_stride,
+                    sprite_.u() + uv_offset, sprite_.uv_stride,
+                    width_ / 2, height_ / 2);
+  libyuv::CopyPlane(image.v(), image.uv_stride,
+                    sprite_.v() + uv_offset, sprite_.uv_stride,
+                    width_ / 2, height_ / 2);
+
+  // A thumbnail stands for the frames until the next one.
+  if (!cues_.empty() && cues_.back().end_time > cue.start_time) {
+    cues_.back().end_time = cue.start_time;
+  }
+  cues_.push_back(cue);
+  if (++sprite_thumbnails_ ==
+      config_.sprite_columns * config_.sprite_rows) {
+    FinishSprite();
+  }
+}
+
+void ThumbnailGenerator::FinishSprite() {
+  // A partial sheet is cut after its last row of thumbnails.
+  const int32 rows = (sprite_thumbnails_ + config_.sprite_columns - 1) /
+                     config_.sprite_columns;
+  std::ostringstream sprite_id;
+  sprite_id << name_ << "_sprite_" << sprite_number_ << ".jpg";
+  if (jpeg_encoder_.Encode(sprite_.y(), sprite_.y_stride,
+                           sprite_.u(), sprite_.v(), sprite_.uv_stride,
+                           sprite_.width, rows * height_, &jpeg_buffer_)) {
+    LOG(ERROR) << "ThumbnailGenerator cannot compress sprite sheet.";
+  } else {
+    QueueOutput(jpeg_buffer_, sprite_id.str());
+  }
+  ++sprite_number_;
+  sprite_thumbnails_ = 0;
+
+  while (!cues_.empty() &&
+         cues_.front().sprite_number < sprite_number_ - kMaxIndexedSprites) {
+    cues_.pop_front();
+  }
+  std::ostringstream vtt;
+  vtt << "WEBVTT\n";
+  for (size_t i = 0; i < cues_.size(); ++i) {
+    const Cue& cue = cues_[i];
+    vtt << "\n";
+    AppendVttTime(cue.start_time, &vtt);
+    vtt << " --> ";
+    AppendVttTime(cue.end_time, &vtt);
+    vtt << "\n" << name_ << "_sprite_" << cue.sprite_number << ".jpg#xywh="
+        << cue.x << "," << cue.y << "," << width_ << "," << height_ << "\n";
+  }
+  const std::string index = vtt.str();
+  QueueOutput(std::vector<uint8>(index.begin(), index.end()),
+              name_ + "_sprites.vtt");
+}
+
+void ThumbnailGenerator::QueueOutput(const std::vector<uint8>& data,
+                                     const std::string& id) {
+  std::shared_ptr<DataChunk> chunk(new (std::nothrow) DataChunk());  // NOLINT
+  if (!chunk || data.empty() ||
+      chunk->Init(&data[0], static_cast<int32>(data.size()))) {
+    LOG(ERROR) << "ThumbnailGenerator cannot store output " << id;
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (outputs_.size() >= static_cast<size_t>(kMaxQueuedOutputs)) {
+    ++skipped_thumbnails_;
+    outputs_.pop_front();
+  }
+  Output output;
+  output.chunk = chunk;
+  output.id = id;
+  outputs_.push_back(output);
+}
+
+}  // namespace webmlive
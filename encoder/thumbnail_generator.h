@@ -0,0 +1,213 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_THUMBNAIL_GENERATOR_H_
+#define WEBMLIVE_ENCODER_THUMBNAIL_GENERATOR_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/buffer_util.h"
+#include "encoder/jpeg_encoder.h"
+
+namespace webmlive {
+
+class VideoFrame;
+
+struct ThumbnailConfig {
+  static const int32 kDefaultWidth = 160;
+  static const int kDefaultSpriteColumns = 10;
+  static const int kDefaultSpriteRows = 10;
+
+  ThumbnailConfig()
+      : frame_interval(0),
+        width(kDefaultWidth),
+        height(0),
+        quality(JpegEncoder::kDefaultQuality),
+        sprite_columns(kDefaultSpriteColumns),
+        sprite_rows(kDefaultSpriteRows) {}
+
+  // A thumbnail is taken of every |frame_interval|th captured frame. 0
+  // disables thumbnails.
+  int frame_interval;
+
+  // Thumbnail size in pixels, rounded down to even sizes. A |height| of 0
+  // keeps the aspect ratio of the first frame.
+  int32 width;
+  int32 height;
+
+  // JPEG quality, 1 to 100.
+  int quality;
+
+  // Thumbnails per row, and rows, of each sprite sheet. 0 in either disables
+  // sprite sheets.
+  int sprite_columns;
+  int sprite_rows;
+};
+
+// Turns every |ThumbnailConfig::frame_interval|th raw frame into a JPEG
+// thumbnail, and tiles the thumbnails into JPEG sprite sheets indexed by a
+// WebVTT file of "#xywh=" cues, the form players use for scrubbing previews.
+// The encoder thread only scales frames down; JPEG compression and tiling
+// run on a |ThreadPlacement::kBackground| worker thread, and the encoder
+// thread publishes the results when its data sink has nothing better to do.
+//
+//   ThumbnailGenerator thumbnails;
+//   thumbnails.Init(config, "webmlive");
+//   thumbnails.Start();
+//   ...
+//   thumbnails.AddFrame(frame);  // every captured frame
+//   while (sink.Ready() && thumbnails.TakeOutput(&chunk, &id))
+//     sink.WriteChunk(chunk, id);
+//   ...
+//   thumbnails.Stop();  // encodes the last, partial, sprite sheet
+//
+// Outputs are named <name>_thumb_<ms>.jpg after the frame time,
+// <name>_sprite_<n>.jpg, and <name>_sprites.vtt, which is rewritten with
+// each sprite sheet and lists the last |kMaxIndexedSprites| of them.
+//
+// Notes
+// - Only I420 and YV12 frames are used; other frames are skipped.
+// - Thumbnails keep the size worked out from the first frame.
+// - Frames due while the worker still has |kMaxQueuedThumbnails| thumbnails
+//   to compress are skipped, as are outputs beyond |kMaxQueuedOutputs| that
+//   the encoder thread has not taken: previews never hold up the stream.
+// - JPEG output needs libjpeg; see |JpegEncoder|. WebP is not supported.
+class ThumbnailGenerator {
+ public:
+  enum {
+    // libjpeg support was not built.
+    kUnsupported = -4,
+    // Cannot start the worker thread.
+    kThreadError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  static const int kMaxQueuedThumbnails = 2;
+  static const int kMaxQueuedOutputs = 16;
+  static const int kMaxIndexedSprites = 60;
+
+  ThumbnailGenerator();
+  ~ThumbnailGenerator();
+
+  // Prepares thumbnails as |config| says, naming outputs after |name|.
+  // Returns |kSuccess| when successful.
+  int Init(const ThumbnailConfig& config, const std::string& name);
+
+  // Starts and stops the worker thread. |Stop()| compresses the thumbnails
+  // still queued and the partial sprite sheet before returning, so their
+  // outputs can still be taken.
+  int Start();
+  void Stop();
+
+  // Scales |frame| into a queued thumbnail when one is due. Called from the
+  // encoder thread with every captured frame.
+  void AddFrame(const VideoFrame& frame);
+
+  // Moves the oldest output into |ptr_chunk| and its id into |ptr_id|.
+  // Returns false when none is waiting.
+  bool TakeOutput(SharedDataChunk* ptr_chunk, std::string* ptr_id);
+
+  // Thumbnails skipped, and outputs dropped, because the worker or the
+  // encoder thread fell behind.
+  int64 skipped_thumbnails() const;
+
+ private:
+  // An I420 image with strides padded as |JpegEncoder| needs.
+  struct Image {
+    Image() : width(0), height(0), y_stride(0), uv_stride(0) {}
+    int Allocate(int32 image_width, int32 image_height);
+    uint8* y() { return &data[0]; }
+    uint8* u() { return y() + y_stride * height; }
+    uint8* v() { return u() + uv_stride * ((height + 1) / 2); }
+    int32 width;
+    int32 height;
+    int32 y_stride;
+    int32 uv_stride;
+    std::vector<uint8> data;
+  };
+
+  // A scaled frame waiting for the worker.
+  struct Slot {
+    Slot() : timestamp(0), duration(0) {}
+    Image image;
+    int64 timestamp;
+    int64 duration;
+  };
+
+  // Position of one thumbnail in a sprite sheet, and its time span.
+  struct Cue {
+    int64 start_time;
+    int64 end_time;
+    int64 sprite_number;
+    int32 x;
+    int32 y;
+  };
+
+  // Works out the thumbnail size from the first |frame_width| x
+  // |frame_height| frame, and allocates slots and the sprite sheet. Returns
+  // |kSuccess| when successful.
+  int Allocate(int32 frame_width, int32 frame_height);
+
+  // Worker thread function.
+  void ThumbnailThread();
+
+  // Compresses |slot|, and tiles it into the sprite sheet. Worker thread.
+  void Compress(Slot* ptr_slot);
+
+  // Compresses the sprite sheet, and rewrites the WebVTT index. Worker
+  // thread.
+  void FinishSprite();
+
+  // Queues |data| as output |id|.
+  void QueueOutput(const std::vector<uint8>& data, const std::string& id);
+
+  ThumbnailConfig config_;
+  std::string name_;
+  int32 width_;
+  int32 height_;
+  int64 frame_count_;
+
+  // Worker state: compressor, sprite sheet, thumbnails in the sheet, and the
+  // cues of the indexed sheets.
+  JpegEncoder jpeg_encoder_;
+  Image sprite_;
+  int sprite_thumbnails_;
+  int64 sprite_number_;
+  std::deque<Cue> cues_;
+  std::vector<uint8> jpeg_buffer_;
+
+  // Slots, queued and free slot indices, and outputs. Protected by
+  // |mutex_|.
+  mutable std::mutex mutex_;
+  std::condition_variable slot_queued_;
+  std::vector<std::unique_ptr<Slot>> slots_;
+  std::deque<int> queued_slots_;
+  std::vector<int> free_slots_;
+  struct Output {
+    SharedDataChunk chunk;
+    std::string id;
+  };
+  std::deque<Output> outputs_;
+  int64 skipped_thumbnails_;
+  bool stop_;
+  bool running_;
+  std::unique_ptr<std::thread> thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(ThumbnailGenerator);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_THUMBNAIL_GENERATOR_H_
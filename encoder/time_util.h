@@ -0,0 +1,29 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+//
+// Clocks shared by the encoder and its tools, so that every component that
+// compares times reads them in the same timebase.
+#ifndef WEBMLIVE_ENCODER_TIME_UTIL_H_
+#define WEBMLIVE_ENCODER_TIME_UTIL_H_
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Returns the |std::chrono::steady_clock| time in milliseconds, and in
+// microseconds. Capture sources stamp frames with the latter.
+int64 SteadyClockMilliseconds();
+int64 SteadyClockMicroseconds();
+
+// Returns the |std::chrono::system_clock| time in milliseconds since the
+// epoch, the clock of latency codes.
+int64 SystemClockMilliseconds();
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_TIME_UTIL_H_
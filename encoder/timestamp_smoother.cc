@@ -0,0 +1,92 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/timestamp_smoother.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Loop gains: the share of each frame's timing error applied to its time,
+// and the share applied to the period. The frequency gain is a quarter of
+// the square of the phase gain, which damps the loop critically; jitter is
+// averaged over roughly 16 frames, and drift over a few hundred.
+const double kPhaseGain = 1.0 / 16;
+const double kFrequencyGain = kPhaseGain * kPhaseGain / 4;
+}  // namespace
+
+TimestampSmoother::TimestampSmoother()
+    : nominal_period_us_(0),
+      period_us_(0),
+      last_time_us_(0),
+      started_(false),
+      missed_frames_(0),
+      restarts_(0) {
+}
+
+void TimestampSmoother::Init(double frame_rate) {
+  nominal_period_us_ = frame_rate > 0 ? 1000000.0 / frame_rate : 0;
+  period_us_ = nominal_period_us_;
+  started_ = false;
+  if (nominal_period_us_ > 0) {
+    LOG(INFO) << "TimestampSmoother locking frame times to " << frame_rate
+              << " fps.";
+  }
+}
+
+int TimestampSmoother::Smooth(int64* ptr_timestamp_us,
+                              int64* ptr_duration_us) {
+  if (nominal_period_us_ <= 0) {
+    return 0;
+  }
+  const double time = static_cast<double>(*ptr_timestamp_us);
+  if (!started_) {
+    Restart(*ptr_timestamp_us);
+    *ptr_duration_us = static_cast<int64>(period_us_ + 0.5);
+    return 0;
+  }
+
+  // Grid slot the frame falls in. Frames arriving early still take the next
+  // slot; later slots mean the device missed frames.
+  const int64 slots = std::max<int64>(
+      1, static_cast<int64>(std::floor((time - last_time_us_) / period_us_ +
+                                       0.5)));
+  const double predicted = last_time_us_ + slots * period_us_;
+  const double error = time - predicted;
+  if (std::fabs(error) > kMaxErrorPeriods * period_us_) {
+    LOG(WARNING) << "TimestampSmoother restarting, frame at " << time
+                 << "us is " << error << "us from its predicted time.";
+    ++restarts_;
+    Restart(*ptr_timestamp_us);
+    *ptr_duration_us = static_cast<int64>(period_us_ + 0.5);
+    return 0;
+  }
+
+  last_time_us_ = predicted + kPhaseGain * error;
+  const double max_drift = nominal_period_us_ * kMaxDriftPerMille / 1000;
+  period_us_ += kFrequencyGain * error / slots;
+  period_us_ = std::min(std::max(period_us_, nominal_period_us_ - max_drift),
+                        nominal_period_us_ + max_drift);
+
+  *ptr_timestamp_us = static_cast<int64>(std::floor(last_time_us_ + 0.5));
+  *ptr_duration_us = static_cast<int64>(period_us_ + 0.5);
+  const int missed = static_cast<int>(slots - 1);
+  missed_frames_ += missed;
+  return missed;
+}
+
+void TimestampSmoother::Restart(int64 timestamp_us) {
+  started_ = true;
+  last_time_us_ = static_cast<double>(timestamp_us);
+  period_us_ = nominal_period_us_;
+}
+
+}  // namespace webmlive
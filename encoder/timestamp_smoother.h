@@ -0,0 +1,79 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_TIMESTAMP_SMOOTHER_H_
+#define WEBMLIVE_ENCODER_TIMESTAMP_SMOOTHER_H_
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Removes capture jitter from video frame times. Each frame is placed on a
+// regular grid of frame periods, locked to the capture times by a second
+// order loop: the phase follows the capture times slowly, and the period
+// follows the capture clock's drift from the nominal frame rate even more
+// slowly. Frames come out one period apart and one period long, so the
+// encoder's rate control and the muxer see a regular cadence.
+//
+// Notes
+// - Frames the capture device missed leave empty grid slots. They are
+//   counted by |missed_frames()|, and the next frame keeps its slot rather
+//   than closing the gap.
+// - Frames more than |kMaxErrorPeriods| periods away from their predicted
+//   time, and frames whose times go backwards, restart the loop at their
+//   capture time.
+// - Times are in microseconds.
+class TimestampSmoother {
+ public:
+  // Distance, in periods, from the predicted time beyond which the loop
+  // restarts.
+  static const int kMaxErrorPeriods = 4;
+
+  // Largest drift of the tracked period from the nominal one, in parts per
+  // thousand.
+  static const int kMaxDriftPerMille = 50;
+
+  TimestampSmoother();
+  ~TimestampSmoother() {}
+
+  // Sets the nominal frame rate and restarts the loop. Values <= 0 disable
+  // the smoother.
+  void Init(double frame_rate);
+
+  // Replaces |*ptr_timestamp_us| with the smoothed time of the frame captured
+  // at |*ptr_timestamp_us|, and sets |*ptr_duration_us| to the tracked
+  // period. Returns the number of capture frames missed just before this
+  // one. Does nothing and returns 0 when disabled.
+  int Smooth(int64* ptr_timestamp_us, int64* ptr_duration_us);
+
+  bool enabled() const { return nominal_period_us_ > 0; }
+
+  // Tracked frame period in microseconds.
+  double period_us() const { return period_us_; }
+
+  int64 missed_frames() const { return missed_frames_; }
+  int64 restarts() const { return restarts_; }
+
+ private:
+  // Starts the loop at |timestamp_us| with the nominal period.
+  void Restart(int64 timestamp_us);
+
+  double nominal_period_us_;
+  double period_us_;
+
+  // Smoothed time of the last frame, and whether there was one.
+  double last_time_us_;
+  bool started_;
+
+  int64 missed_frames_;
+  int64 restarts_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(TimestampSmoother);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_TIMESTAMP_SMOOTHER_H_
@@ -0,0 +1,61 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/token_bucket.h"
+
+#include <algorithm>
+
+namespace webmlive {
+
+TokenBucket::TokenBucket()
+    : bytes_per_second_(0),
+      burst_bytes_(0),
+      tokens_(0) {
+}
+
+void TokenBucket::Init(int64 bytes_per_second, int64 burst_bytes) {
+  bytes_per_second_ = std::max<int64>(bytes_per_second, 0);
+  burst_bytes_ = static_cast<double>(std::max<int64>(burst_bytes, 1));
+  tokens_ = burst_bytes_;
+  refill_time_ = std::chrono::steady_clock::now();
+}
+
+int64 TokenBucket::Take(int64 bytes) {
+  if (!enabled() || bytes <= 0) {
+    return std::max<int64>(bytes, 0);
+  }
+  Refill();
+  const int64 taken = std::min(bytes, static_cast<int64>(tokens_));
+  tokens_ -= taken;
+  return taken;
+}
+
+void TokenBucket::Refund(int64 bytes) {
+  if (enabled() && bytes > 0) {
+    tokens_ = std::min(tokens_ + bytes, burst_bytes_);
+  }
+}
+
+int64 TokenBucket::Available() {
+  if (!enabled()) {
+    return static_cast<int64>(burst_bytes_);
+  }
+  Refill();
+  return static_cast<int64>(tokens_);
+}
+
+void TokenBucket::Refill() {
+  const std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+  const double elapsed_secs =
+      std::chrono::duration<double>(now - refill_time_).count();
+  refill_time_ = now;
+  tokens_ = std::min(tokens_ + elapsed_secs * bytes_per_second_,
+                     burst_bytes_);
+}
+
+}  // namespace webmlive
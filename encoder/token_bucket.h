@@ -0,0 +1,58 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_TOKEN_BUCKET_H_
+#define WEBMLIVE_ENCODER_TOKEN_BUCKET_H_
+
+#include <chrono>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Limits a byte stream to an average rate. Tokens, one per byte, accrue at
+// the configured rate up to |burst_bytes|, and sending takes them: a large
+// chunk goes out spread over time instead of in one burst.
+//
+// Notes
+// - Not thread safe.
+// - A bucket with a rate of 0 is disabled, and grants every request.
+class TokenBucket {
+ public:
+  TokenBucket();
+  ~TokenBucket() {}
+
+  // Sets the rate and bucket size, and fills the bucket.
+  void Init(int64 bytes_per_second, int64 burst_bytes);
+
+  // Removes up to |bytes| tokens. Returns the number removed, which is 0
+  // when the bucket is empty.
+  int64 Take(int64 bytes);
+
+  // Returns |bytes| tokens taken but not used.
+  void Refund(int64 bytes);
+
+  // Returns the tokens in the bucket.
+  int64 Available();
+
+  bool enabled() const { return bytes_per_second_ > 0; }
+  int64 bytes_per_second() const { return bytes_per_second_; }
+
+ private:
+  // Adds the tokens accrued since |refill_time_|.
+  void Refill();
+
+  int64 bytes_per_second_;
+  double burst_bytes_;
+  double tokens_;
+  std::chrono::steady_clock::time_point refill_time_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(TokenBucket);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_TOKEN_BUCKET_H_
@@ -0,0 +1,14 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/trace_log.h"
+
+namespace webmlive {
+
+std::atomic<int> TraceLog::level_(TraceLog::kOff);
+
+}  // namespace webmlive
@@ -0,0 +1,76 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_TRACE_LOG_H_
+#define WEBMLIVE_ENCODER_TRACE_LOG_H_
+
+#include <atomic>
+
+#include "encoder/basictypes.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+// Level gate for events logged from the capture, encode and mux paths, where
+// formatting a glog message per frame is too expensive to leave on. Events
+// are logged through glog at INFO as an event name followed by key=value
+// fields:
+//
+//   WEBMLIVE_TRACE(TraceLog::kChunk, "read_chunk") << " length=" << length;
+//   WEBMLIVE_TRACE_EVERY_N(TraceLog::kFrame, 30, "video_frame")
+//       << " timestamp=" << timestamp;
+//
+// While an event's level is above |TraceLog::level()| the cost of the event
+// is one load and one branch; its fields are not evaluated. Defining
+// WEBMLIVE_DISABLE_TRACE_LOG removes the events at compile time.
+class TraceLog {
+ public:
+  enum Level {
+    // No events. The default.
+    kOff = 0,
+    // Events logged once per chunk or less often.
+    kChunk = 1,
+    // Events logged for each frame, sample buffer or packet.
+    kFrame = 2,
+  };
+
+  static void set_level(int level) {
+    level_.store(level, std::memory_order_relaxed);
+  }
+  static int level() { return level_.load(std::memory_order_relaxed); }
+  static bool IsOn(int level) {
+    return level_.load(std::memory_order_relaxed) >= level;
+  }
+
+ private:
+  TraceLog();
+  ~TraceLog();
+  static std::atomic<int> level_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(TraceLog);
+};
+
+}  // namespace webmlive
+
+#ifdef WEBMLIVE_DISABLE_TRACE_LOG
+#define WEBMLIVE_TRACE(level, event) LOG_IF(INFO, false) << event
+#define WEBMLIVE_TRACE_EVERY_N(level, n, event) WEBMLIVE_TRACE(level, event)
+#else
+#define WEBMLIVE_TRACE(level, event) \
+  LOG_IF(INFO, webmlive::TraceLog::IsOn(level)) << event
+
+// Logs the 1st, (n+1)th, (2n+1)th... enabled occurrences of the event. Each
+// call site keeps its own count, which is advanced only while the event is
+// enabled. |n| must be a constant expression.
+#define WEBMLIVE_TRACE_EVERY_N(level, n, event)                   \
+  LOG_IF(INFO, webmlive::TraceLog::IsOn(level) && []() -> bool {  \
+    static std::atomic<uint32> occurrences(0);                    \
+    return occurrences.fetch_add(1, std::memory_order_relaxed) %  \
+               static_cast<uint32>(n) == 0;                       \
+  }()) << event
+#endif
+
+#endif  // WEBMLIVE_ENCODER_TRACE_LOG_H_
@@ -0,0 +1,54 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/tracepoints.h"
+
+#include "glog/logging.h"
+
+#if defined(WEBMLIVE_HAVE_TRACEPOINTS) && defined(_WIN32)
+// {921ddfb8-b6e0-4240-b0d7-73da937c7560}
+TRACELOGGING_DEFINE_PROVIDER(
+    webmlive_trace_provider, "WebMLive",
+    (0x921ddfb8, 0xb6e0, 0x4240,
+     0xb0, 0xd7, 0x73, 0xda, 0x93, 0x7c, 0x75, 0x60));
+#endif
+
+namespace webmlive {
+
+std::mutex Tracepoints::mutex_;
+std::vector<std::string> Tracepoints::streams_;
+
+void Tracepoints::Register() {
+#if defined(WEBMLIVE_HAVE_TRACEPOINTS) && defined(_WIN32)
+  const HRESULT hr = TraceLoggingRegister(webmlive_trace_provider);
+  if (FAILED(hr)) {
+    LOG(WARNING) << "cannot register the ETW provider: " << hr;
+  }
+#endif
+}
+
+void Tracepoints::Unregister() {
+#if defined(WEBMLIVE_HAVE_TRACEPOINTS) && defined(_WIN32)
+  TraceLoggingUnregister(webmlive_trace_provider);
+#endif
+}
+
+int32 Tracepoints::StreamId(const std::string& labels) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = 0; i < streams_.size(); ++i) {
+    if (streams_[i] == labels)
+      return static_cast<int32>(i);
+  }
+  streams_.push_back(labels);
+  const int32 stream_id = static_cast<int32>(streams_.size() - 1);
+#ifdef WEBMLIVE_HAVE_TRACEPOINTS
+  LOG(INFO) << "tracepoint stream " << stream_id << ": {" << labels << "}";
+#endif
+  return stream_id;
+}
+
+}  // namespace webmlive
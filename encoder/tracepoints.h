@@ -0,0 +1,103 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_TRACEPOINTS_H_
+#define WEBMLIVE_ENCODER_TRACEPOINTS_H_
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+
+// Static tracepoints at the stage boundaries of the pipeline, for lining up
+// encoder stages with OS scheduling in WPA or perf. Compiled in by the
+// WEBMLIVE_ENABLE_TRACEPOINTS build option, which defines
+// WEBMLIVE_HAVE_TRACEPOINTS:
+// - Linux: USDT probes of provider "webmlive" (needs sys/sdt.h), listed by
+//   `perf list sdt_webmlive:*` once the binary is added with
+//   `perf buildid-cache --add`. A probe is a nop until a tracer attaches.
+// - Windows: TraceLogging events of the ETW provider "WebMLive",
+//   {921ddfb8-b6e0-4240-b0d7-73da937c7560}. An event costs one branch while
+//   no session enables the provider.
+// Without the option the macros expand to nothing and their arguments are
+// not evaluated.
+//
+//   WEBMLIVE_TRACE_FRAME(encode_start, stream_id, frame.timestamp());
+//   WEBMLIVE_TRACE_UPLOAD(upload_end, stream_id, id.c_str(), status);
+//
+// Frame events carry the stream id and the media timestamp of the frame, or
+// of the first frame of a chunk, in milliseconds:
+//   frame_received  video frame delivered by the capture source;
+//   frame_commit    frame committed to the encoder's input pool;
+//   frame_decommit  frame taken from the input pool by the encoder thread;
+//   encode_start    frame passed to a video encoder;
+//   encode_end      video encoder returned;
+//   mux_add_frame   compressed frame written to a muxer;
+//   chunk_ready     chunk read from a muxer and written to the data sink.
+// Upload events carry the stream id, the chunk id, and a value: the bytes
+// sent for upload_start, and the upload status, 0 when successful, for
+// upload_end.
+//
+// Stream ids come from |Tracepoints::StreamId()|; each id is logged with the
+// metrics labels it stands for when first handed out.
+
+namespace webmlive {
+
+class Tracepoints {
+ public:
+  // Registers the ETW provider. Does nothing elsewhere. Call once at
+  // start up, before any event.
+  static void Register();
+
+  // Unregisters the ETW provider.
+  static void Unregister();
+
+  // Returns the id of the stream, or encoder representation, with metrics
+  // labels |labels|. The same labels always get the same id.
+  static int32 StreamId(const std::string& labels);
+
+ private:
+  Tracepoints();
+  ~Tracepoints();
+  static std::mutex mutex_;
+  static std::vector<std::string> streams_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(Tracepoints);
+};
+
+}  // namespace webmlive
+
+#if defined(WEBMLIVE_HAVE_TRACEPOINTS) && defined(_WIN32)
+#include <windows.h>
+#include <TraceLoggingProvider.h>
+
+TRACELOGGING_DECLARE_PROVIDER(webmlive_trace_provider);
+
+#define WEBMLIVE_TRACE_FRAME(event, stream, timestamp)       \
+  TraceLoggingWrite(webmlive_trace_provider, #event,         \
+                    TraceLoggingInt32((stream), "stream"),   \
+                    TraceLoggingInt64((timestamp), "timestamp"))
+#define WEBMLIVE_TRACE_UPLOAD(event, stream, id, value)      \
+  TraceLoggingWrite(webmlive_trace_provider, #event,         \
+                    TraceLoggingInt32((stream), "stream"),   \
+                    TraceLoggingString((id), "id"),          \
+                    TraceLoggingInt64((value), "value"))
+#elif defined(WEBMLIVE_HAVE_TRACEPOINTS)
+#include <sys/sdt.h>
+
+#define WEBMLIVE_TRACE_FRAME(event, stream, timestamp)           \
+  DTRACE_PROBE2(webmlive, event, static_cast<int32>(stream),     \
+                static_cast<int64>(timestamp))
+#define WEBMLIVE_TRACE_UPLOAD(event, stream, id, value)          \
+  DTRACE_PROBE3(webmlive, event, static_cast<int32>(stream), (id), \
+                static_cast<int64>(value))
+#else
+#define WEBMLIVE_TRACE_FRAME(event, stream, timestamp) do {} while (0)
+#define WEBMLIVE_TRACE_UPLOAD(event, stream, id, value) do {} while (0)
+#endif
+
+#endif  // WEBMLIVE_ENCODER_TRACEPOINTS_H_
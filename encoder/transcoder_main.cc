@@ -0,0 +1,169 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+//
+// Offline transcoder: encodes a Y4M or raw I420 file to a seekable WebM file
+// for on demand playback, encoding independent GOP ranges in parallel with
+// |OfflineTranscoder|.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+
+#include "encoder/basictypes.h"
+#include "encoder/offline_transcoder.h"
+#include "glog/logging.h"
+
+namespace {
+
+const std::string kCodecVp8 = "vp8";
+const std::string kCodecVp9 = "vp9";
+
+void usage(const char** argv) {
+  printf("Usage: %s --input <file> --output <file> [args]\n", argv[0]);
+  printf("  Input options:\n");
+  printf("    --input <file>                 Y4M, or raw I420 when the name\n");
+  printf("                                   does not end in .y4m.\n");
+  printf("    --width <width>                Raw I420 frame width.\n");
+  printf("    --height <height>              Raw I420 frame height.\n");
+  printf("    --fps <frame rate>             Raw I420 frame rate. Default\n");
+  printf("                                   is 30.\n");
+  printf("  Output options:\n");
+  printf("    --output <file>                WebM file to write.\n");
+  printf("    --gop_frames <frames>          Frames per independently\n");
+  printf("                                   encoded range, and keyframe\n");
+  printf("                                   interval. Default is %d.\n",
+         webmlive::OfflineTranscoderConfig::kDefaultGopFrames);
+  printf("    --threads <num threads>        Ranges encoded at once.\n");
+  printf("                                   Default is one per core.\n");
+  printf("  Encoder options:\n");
+  printf("    --vpx_codec <vp8|vp9>          Video codec.\n");
+  printf("    --vpx_bitrate <kbps>           Video bitrate.\n");
+  printf("    --vpx_cq_level <0-63>          Constrained quality level.\n");
+  printf("    --vpx_speed <speed value>      Speed. Default is 2.\n");
+  printf("    --vpx_lag <frames>             Lookahead frames.\n");
+}
+
+bool arg_has_value(int arg_index, int argc, const char** argv) {
+  const int val_index = arg_index + 1;
+  const bool has_value = ((val_index < argc) && (argv[val_index] != NULL));
+  if (!has_value) {
+    LOG(WARNING) << "argument missing value: " << argv[arg_index];
+  }
+  return has_value;
+}
+
+// Parses the command line into |ptr_config|. Returns false when the
+// transcode cannot run.
+bool parse_command_line(int argc, const char** argv,
+                        webmlive::OfflineTranscoderConfig* ptr_config) {
+  webmlive::OfflineTranscoderConfig& config = *ptr_config;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp("-h", argv[i]) || !strcmp("--help", argv[i])) {
+      usage(argv);
+      exit(EXIT_SUCCESS);
+    } else if (!strcmp("--input", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.input_file = argv[++i];
+    } else if (!strcmp("--width", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.requested_video_config.width = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--height", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.requested_video_config.height = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--fps", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.requested_video_config.frame_rate = strtod(argv[++i], NULL);
+    } else if (!strcmp("--output", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.output_file = argv[++i];
+    } else if (!strcmp("--gop_frames", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.gop_frames = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--threads", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.num_threads = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vpx_codec", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      const std::string codec = argv[++i];
+      if (codec == kCodecVp8) {
+        config.vpx_config.codec = webmlive::kVideoFormatVP8;
+      } else if (codec == kCodecVp9) {
+        config.vpx_config.codec = webmlive::kVideoFormatVP9;
+      } else {
+        LOG(ERROR) << "Invalid --vpx_codec value: " << codec;
+        return false;
+      }
+    } else if (!strcmp("--vpx_bitrate", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.vpx_config.bitrate = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vpx_cq_level", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.vpx_config.cq_level = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vpx_speed", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.vpx_config.speed = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--vpx_lag", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.vpx_config.lag_in_frames = strtol(argv[++i], NULL, 10);
+    } else {
+      LOG(WARNING) << "argument unknown or unparseable: " << argv[i];
+    }
+  }
+  if (config.input_file.empty() || config.output_file.empty()) {
+    LOG(ERROR) << "--input and --output are required.";
+    return false;
+  }
+  return true;
+}
+
+int transcode_main(const webmlive::OfflineTranscoderConfig& config) {
+  webmlive::OfflineTranscoder transcoder;
+  int status = transcoder.Init(config);
+  if (status) {
+    LOG(ERROR) << "OfflineTranscoder Init failed, status=" << status;
+    return EXIT_FAILURE;
+  }
+  const std::chrono::steady_clock::time_point start_time =
+      std::chrono::steady_clock::now();
+  status = transcoder.Run();
+  if (status) {
+    LOG(ERROR) << "OfflineTranscoder Run failed, status=" << status;
+    return EXIT_FAILURE;
+  }
+  const double elapsed_seconds =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start_time).count() / 1000000.0;
+
+  const webmlive::VideoConfig& video_config = transcoder.video_config();
+  const webmlive::OfflineTranscodeStats& stats = transcoder.stats();
+  printf("input:          %s\n", config.input_file.c_str());
+  printf("resolution:     %dx%d @ %.2f fps\n", video_config.width,
+         video_config.height, video_config.frame_rate);
+  printf("output:         %s\n", config.output_file.c_str());
+  printf("elapsed:        %.3f seconds\n", elapsed_seconds);
+  printf("ranges:         %lld\n",
+         static_cast<long long>(stats.ranges));  // NOLINT
+  printf("frames encoded: %lld of %lld (%.2f frames/s)\n",
+         static_cast<long long>(stats.frames_out),  // NOLINT
+         static_cast<long long>(stats.frames_in),  // NOLINT
+         elapsed_seconds > 0 ? stats.frames_in / elapsed_seconds : 0.0);
+  printf("output size:    %lld bytes\n",
+         static_cast<long long>(stats.bytes));  // NOLINT
+  return EXIT_SUCCESS;
+}
+
+}  // anonymous namespace
+
+int main(int argc, const char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  webmlive::OfflineTranscoderConfig config;
+  if (!parse_command_line(argc, argv, &config)) {
+    usage(argv);
+    return EXIT_FAILURE;
+  }
+  const int exit_code = transcode_main(config);
+  google::ShutdownGoogleLogging();
+  return exit_code;
+}
@@ -0,0 +1,103 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/uplink_estimator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Uploads smaller or shorter than this are dominated by request round trips
+// and timer resolution, and say little about throughput.
+const int64 kMinThroughputBytes = 32 * 1024;
+const int64 kMinTransferMs = 10;
+
+// Queue samples closer together than this are skipped.
+const int64 kMinQueueIntervalMs = 100;
+}  // namespace
+
+UplinkEstimator::UplinkEstimator()
+    : queue_bytes_(0),
+      queue_time_ms_(-1),
+      queue_growth_kbps_(0),
+      capacity_kbps_(0) {
+}
+
+int UplinkEstimator::Init(const UplinkEstimatorConfig& config) {
+  if (config.window_uploads < 1 || config.smoothing <= 0 ||
+      config.smoothing > 1 || config.low_percentile < 0 ||
+      config.low_percentile > 100 || config.queue_time_constant_ms <= 0) {
+    LOG(ERROR) << "UplinkEstimator invalid config.";
+    return kInvalidArg;
+  }
+  config_ = config;
+  estimate_ = UplinkEstimate();
+  recent_kbps_.clear();
+  queue_bytes_ = 0;
+  queue_time_ms_ = -1;
+  queue_growth_kbps_ = 0;
+  capacity_kbps_ = 0;
+  return kSuccess;
+}
+
+void UplinkEstimator::AddUpload(int64 bytes, int64 transfer_ms,
+                                int64 media_ms) {
+  if (bytes <= 0 || transfer_ms < 0)
+    return;
+  const double alpha = config_.smoothing;
+  if (media_ms > 0) {
+    const double ratio = static_cast<double>(transfer_ms) / media_ms;
+    estimate_.upload_ratio = estimate_.uploads == 0 ?
+        ratio : alpha * ratio + (1 - alpha) * estimate_.upload_ratio;
+  }
+  ++estimate_.uploads;
+  if (bytes < kMinThroughputBytes || transfer_ms < kMinTransferMs)
+    return;
+
+  // Bytes per millisecond times 8 is kilobits per second.
+  const int64 kbps = bytes * 8 / transfer_ms;
+  capacity_kbps_ = recent_kbps_.empty() ?
+      kbps : alpha * kbps + (1 - alpha) * capacity_kbps_;
+  estimate_.capacity_kbps = static_cast<int64>(capacity_kbps_);
+
+  recent_kbps_.push_back(kbps);
+  while (recent_kbps_.size() > static_cast<size_t>(config_.window_uploads))
+    recent_kbps_.pop_front();
+  std::vector<int64> sorted(recent_kbps_.begin(), recent_kbps_.end());
+  const size_t index = (sorted.size() - 1) * config_.low_percentile / 100;
+  std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+  estimate_.low_capacity_kbps = sorted[index];
+}
+
+void UplinkEstimator::AddQueueSample(int64 queued_bytes, int64 now_ms) {
+  if (queue_time_ms_ < 0) {
+    queue_bytes_ = queued_bytes;
+    queue_time_ms_ = now_ms;
+    return;
+  }
+  const int64 elapsed_ms = now_ms - queue_time_ms_;
+  if (elapsed_ms < kMinQueueIntervalMs)
+    return;
+  // Weighted by the time each sample covers, so that the average does not
+  // depend on how often the queue is sampled.
+  const double growth_kbps =
+      (queued_bytes - queue_bytes_) * 8.0 / elapsed_ms;
+  const double alpha =
+      1 - std::exp(-static_cast<double>(elapsed_ms) /
+                   config_.queue_time_constant_ms);
+  queue_growth_kbps_ = alpha * growth_kbps + (1 - alpha) * queue_growth_kbps_;
+  estimate_.queue_growth_kbps = static_cast<int64>(queue_growth_kbps_);
+  queue_bytes_ = queued_bytes;
+  queue_time_ms_ = now_ms;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,130 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_UPLINK_ESTIMATOR_H_
+#define WEBMLIVE_ENCODER_UPLINK_ESTIMATOR_H_
+
+#include <deque>
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+struct UplinkEstimatorConfig {
+  static const int kDefaultWindowUploads = 20;
+  static const int kDefaultQueueTimeConstantMs = 5000;
+
+  UplinkEstimatorConfig()
+      : window_uploads(kDefaultWindowUploads),
+        smoothing(0.25),
+        low_percentile(20),
+        queue_time_constant_ms(kDefaultQueueTimeConstantMs) {}
+
+  // Uploads over which |UplinkEstimate::low_capacity_kbps| is taken.
+  int window_uploads;
+
+  // Weight of each upload in the moving averages of throughput and upload
+  // ratio, in (0, 1].
+  double smoothing;
+
+  // Percentile of the window reported as |UplinkEstimate::low_capacity_kbps|.
+  int low_percentile;
+
+  // Time constant of the moving average of queue growth. Chunks are queued
+  // in bursts, so it should span several segments.
+  int queue_time_constant_ms;
+};
+
+// Uplink state reported by |UplinkEstimator|.
+struct UplinkEstimate {
+  UplinkEstimate()
+      : uploads(0),
+        capacity_kbps(0),
+        low_capacity_kbps(0),
+        upload_ratio(0),
+        queue_growth_kbps(0) {}
+
+  // Returns true when the uplink does not keep up with the stream: uploads
+  // take longer than the segments they carry, or the queue grows by more
+  // than 5% of the capacity.
+  bool congested() const {
+    return upload_ratio > 1.0 || queue_growth_kbps * 20 > capacity_kbps;
+  }
+
+  // Uploads measured so far. The other values are 0 until the first.
+  int64 uploads;
+
+  // Moving average of the throughput of each upload, and the low percentile
+  // of the recent uploads, in kilobits per second.
+  int64 capacity_kbps;
+  int64 low_capacity_kbps;
+
+  // Moving average of upload time divided by the media duration of the
+  // uploaded segment. Above 1 the uplink falls behind. 0 when segment
+  // durations are unknown.
+  double upload_ratio;
+
+  // Moving average of the rate at which queued upload bytes grow, in
+  // kilobits per second; negative while the queue drains.
+  int64 queue_growth_kbps;
+};
+
+// Estimates what the uplink can carry from the uploads actually made, rather
+// than from the lifetime byte count: the throughput of each upload while it
+// was on the wire, how long each media segment took to upload compared to
+// its duration, and how fast the upload queue grows. Bitrate adaptation,
+// ladder pruning and pacing act on its |UplinkEstimate|, so that they agree
+// on the state of the uplink.
+//
+// Notes
+// - Uploads limited by pacing measure the pacing rate, not the capacity
+//   above it.
+// - Streaming uploads last as long as the media they carry, so callers
+//   report only complete chunks.
+// - Not thread safe.
+class UplinkEstimator {
+ public:
+  enum {
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  UplinkEstimator();
+  ~UplinkEstimator() {}
+
+  // Resets the estimate. Returns |kSuccess| when |config| is valid.
+  int Init(const UplinkEstimatorConfig& config);
+
+  // Reports an upload of |bytes| that spent |transfer_ms| on the wire and
+  // carried |media_ms| of media; 0 when it carried no media or the duration
+  // is unknown.
+  void AddUpload(int64 bytes, int64 transfer_ms, int64 media_ms);
+
+  // Reports |queued_bytes| waiting for upload at |now_ms|.
+  void AddQueueSample(int64 queued_bytes, int64 now_ms);
+
+  const UplinkEstimate& estimate() const { return estimate_; }
+
+ private:
+  UplinkEstimatorConfig config_;
+  UplinkEstimate estimate_;
+
+  // Throughput of the last |window_uploads| uploads, oldest first.
+  std::deque<int64> recent_kbps_;
+
+  // Previous queue sample; |queue_time_ms_| is negative before the first.
+  int64 queue_bytes_;
+  int64 queue_time_ms_;
+  double queue_growth_kbps_;
+  double capacity_kbps_;
+
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(UplinkEstimator);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_UPLINK_ESTIMATOR_H_
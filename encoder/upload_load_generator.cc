@@ -0,0 +1,742 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+//
+// Upload load generator: drives many |HttpUploader|s at once with DASH
+// chunk streams sized and paced like the encoder's, either synthetic or
+// replayed from files written by the encoder, then reports aggregate
+// throughput, upload latency, live edge lag and connection counts. Used to
+// benchmark the uploader, and origins and ingest servers under the load of
+// many encoders; run it against the --impair_port of ingest_server to
+// measure it on a bad network.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/buffer_util.h"
+#include "encoder/ebml_util.h"
+#include "encoder/http_uploader.h"
+#include "encoder/latency_tracer.h"
+#include "encoder/metrics.h"
+#include "glog/logging.h"
+
+namespace {
+using webmlive::AppendId;
+using webmlive::AppendMaster;
+using webmlive::AppendSize;
+using webmlive::AppendUInt;
+
+typedef std::vector<uint8> Buffer;
+
+// Representation ids of the encoder's DASH chunk ids.
+const char kAudioId[] = "1";
+const char kVideoId[] = "2";
+
+// Longest interval the pacing loop sleeps, so that reports and the end of
+// the run are noticed.
+const int kPollIntervalMs = 100;
+
+// Synthetic audio frame duration, and the size of a synthetic keyframe
+// relative to the other frames of its group of pictures.
+const int kAudioFrameMs = 20;
+const int kKeyframeWeight = 8;
+
+// Cluster relative block timecodes are 16 bit.
+const int kMaxChunkMs = 30000;
+
+// EBML IDs of the synthetic streams.
+const uint32 kEbmlHeaderId = 0x1A45DFA3;
+const uint32 kDocTypeId = 0x4282;
+const uint32 kDocTypeVersionId = 0x4287;
+const uint32 kDocTypeReadVersionId = 0x4285;
+const uint32 kSegmentId = 0x18538067;
+const uint32 kInfoId = 0x1549A966;
+const uint32 kTimecodeScaleId = 0x2AD7B1;
+const uint32 kMuxingAppId = 0x4D80;
+const uint32 kTracksId = 0x1654AE6B;
+const uint32 kTrackEntryId = 0xAE;
+const uint32 kTrackNumberId = 0xD7;
+const uint32 kTrackUidId = 0x73C5;
+const uint32 kTrackTypeId = 0x83;
+const uint32 kCodecIdId = 0x86;
+const uint32 kVideoSettingsId = 0xE0;
+const uint32 kPixelWidthId = 0xB0;
+const uint32 kPixelHeightId = 0xBA;
+const uint32 kAudioSettingsId = 0xE1;
+const uint32 kChannelsId = 0x9F;
+const uint32 kClusterId = 0x1F43B675;
+const uint32 kTimecodeId = 0xE7;
+const uint32 kSimpleBlockId = 0xA3;
+
+// Unknown size, as the live muxer writes segments and clusters.
+const uint8 kUnknownSize[] = {0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+struct LoadConfig {
+  LoadConfig()
+      : num_streams(1),
+        stream_prefix("load"),
+        video_kbps(2000),
+        audio_kbps(128),
+        frame_rate(30),
+        keyframe_interval_ms(2000),
+        chunk_ms(2000),
+        duration(60),
+        report_interval(10),
+        max_concurrent_uploads(1),
+        http2(false),
+        shared_engine(false),
+        form_post(false) {}
+
+  // Upload URL; see |HttpUploaderSettings::url_template|.
+  std::string url_template;
+
+  // Number of uploaders, and the prefix of their stream names.
+  int num_streams;
+  std::string stream_prefix;
+
+  // Synthetic stream shape. |audio_kbps| 0 disables audio.
+  int video_kbps;
+  int audio_kbps;
+  int frame_rate;
+  int keyframe_interval_ms;
+  int chunk_ms;
+
+  // Chunk files to replay instead: "<replay_prefix>_<rep>.hdr" and
+  // "<replay_prefix>_<rep>_<n>.chk", as written by the encoder's DASH output.
+  std::string replay_prefix;
+
+  // Run time, and time between reports, in seconds.
+  int duration;
+  int report_interval;
+
+  // Uploader settings.
+  int max_concurrent_uploads;
+  bool http2;
+  bool shared_engine;
+  bool form_post;
+};
+
+// Chunk source of one representation, shared by all streams.
+struct Track {
+  Track() : video(true), kbps(0) {}
+
+  std::string rep_id;
+  bool video;
+  int kbps;
+  webmlive::SharedDataChunk header;
+
+  // Replayed media chunks, uploaded in a loop.
+  std::vector<webmlive::SharedDataChunk> replay_chunks;
+
+  // Synthetic chunks built for the streams at the current chunk number.
+  std::map<int64, webmlive::SharedDataChunk> chunks;
+};
+
+struct LoadStream {
+  LoadStream()
+      : offset_ms(0), next_chunk(1), skipped_chunks(0), startup_uploads(0),
+        finished_chunks(0), edge_due_ms(-1), ptr_connections(NULL),
+        ptr_active_uploads(NULL) {}
+
+  std::string name;
+  std::unique_ptr<webmlive::HttpUploader> uploader;
+
+  // Start of the stream's first chunk, relative to the run; streams are
+  // staggered so that their chunks are not all due at once.
+  int64 offset_ms;
+
+  // Number of the next media chunk, and chunks not queued because the
+  // uploader was still full.
+  int64 next_chunk;
+  int64 skipped_chunks;
+
+  // Due times of the media chunks queued and not yet finished, oldest
+  // first, the manifest and header uploads queued before them, and the
+  // media chunks finished. Uploads are taken to finish in queue order.
+  std::deque<int64> queued_due_ms;
+  int64 startup_uploads;
+  int64 finished_chunks;
+
+  // Due time of the newest media chunk uploaded, the live edge of a player
+  // reading from the origin, or -1 before the first.
+  int64 edge_due_ms;
+
+  // Uploader metrics.
+  webmlive::Metric* ptr_connections;
+  webmlive::Metric* ptr_active_uploads;
+};
+
+void usage(const char** argv) {
+  printf("Usage: %s --url_template <url> [args]\n", argv[0]);
+  printf("  Target options:\n");
+  printf("    --url_template <url>           Upload URL, with {id} and\n");
+  printf("                                   {stream_name}; for example\n");
+  printf("                                   http://host/{stream_name}/{id}\n");
+  printf("    --streams <count>              Number of uploaders. Default\n");
+  printf("                                   is 1.\n");
+  printf("    --stream_prefix <name>         Stream name prefix. Default\n");
+  printf("                                   is load.\n");
+  printf("  Stream options:\n");
+  printf("    --video_kbps <kbps>            Synthetic video bitrate.\n");
+  printf("    --audio_kbps <kbps>            Synthetic audio bitrate; 0\n");
+  printf("                                   disables audio.\n");
+  printf("    --fps <frame rate>             Synthetic video frame rate.\n");
+  printf("    --keyframe_interval <ms>       Time between keyframes.\n");
+  printf("    --chunk_duration <ms>          Media time of each chunk.\n");
+  printf("    --replay <prefix>              Replays <prefix>_<rep>.hdr\n");
+  printf("                                   and <prefix>_<rep>_<n>.chk\n");
+  printf("                                   files instead, one chunk per\n");
+  printf("                                   chunk duration.\n");
+  printf("  Uploader options:\n");
+  printf("    --max_concurrent_uploads <n>   Transfers per uploader.\n");
+  printf("    --http2                        Requests HTTP/2.\n");
+  printf("    --shared_engine                Runs all uploaders on one\n");
+  printf("                                   upload thread.\n");
+  printf("    --form_post                    Uses form posts.\n");
+  printf("  Run options:\n");
+  printf("    --duration <seconds>           Run time. Default is 60.\n");
+  printf("    --report_interval <seconds>    Time between reports; 0\n");
+  printf("                                   reports only at the end.\n");
+}
+
+bool arg_has_value(int arg_index, int argc, const char** argv) {
+  const int val_index = arg_index + 1;
+  const bool has_value = ((val_index < argc) && (argv[val_index] != NULL));
+  if (!has_value) {
+    LOG(WARNING) << "argument missing value: " << argv[arg_index];
+  }
+  return has_value;
+}
+
+// Parses the command line into |ptr_config|. Returns false when the load
+// generator cannot run.
+bool parse_command_line(int argc, const char** argv, LoadConfig* ptr_config) {
+  LoadConfig& config = *ptr_config;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp("-h", argv[i]) || !strcmp("--help", argv[i])) {
+      usage(argv);
+      exit(EXIT_SUCCESS);
+    } else if (!strcmp("--url_template", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.url_template = argv[++i];
+    } else if (!strcmp("--streams", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.num_streams = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--stream_prefix", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.stream_prefix = argv[++i];
+    } else if (!strcmp("--video_kbps", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.video_kbps = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--audio_kbps", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.audio_kbps = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--fps", argv[i]) && arg_has_value(i, argc, argv)) {
+      config.frame_rate = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--keyframe_interval", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.keyframe_interval_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--chunk_duration", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.chunk_ms = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--replay", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.replay_prefix = argv[++i];
+    } else if (!strcmp("--max_concurrent_uploads", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.max_concurrent_uploads = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--http2", argv[i])) {
+      config.http2 = true;
+    } else if (!strcmp("--shared_engine", argv[i])) {
+      config.shared_engine = true;
+    } else if (!strcmp("--form_post", argv[i])) {
+      config.form_post = true;
+    } else if (!strcmp("--duration", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.duration = strtol(argv[++i], NULL, 10);
+    } else if (!strcmp("--report_interval", argv[i]) &&
+               arg_has_value(i, argc, argv)) {
+      config.report_interval = strtol(argv[++i], NULL, 10);
+    } else {
+      LOG(ERROR) << "unknown argument: " << argv[i];
+      return false;
+    }
+  }
+  if (config.url_template.empty() || config.num_streams < 1 ||
+      config.video_kbps < 1 || config.audio_kbps < 0 ||
+      config.frame_rate < 1 || config.keyframe_interval_ms < 1 ||
+      config.chunk_ms < 1 || config.chunk_ms > kMaxChunkMs ||
+      config.duration < 1 || config.max_concurrent_uploads < 1) {
+    LOG(ERROR) << "--url_template is required, and counts, rates and "
+               << "durations must be positive; chunks at most "
+               << kMaxChunkMs << " ms.";
+    return false;
+  }
+  return true;
+}
+
+//
+// EBML writing for the synthetic streams.
+//
+void AppendString(uint32 id, const std::string& value, Buffer* ptr_buffer) {
+  AppendMaster(id, Buffer(value.begin(), value.end()), ptr_buffer);
+}
+
+webmlive::SharedDataChunk MakeChunk(const Buffer& buffer) {
+  std::shared_ptr<webmlive::DataChunk> chunk(
+      new (std::nothrow) webmlive::DataChunk());  // NOLINT
+  if (!chunk || chunk->Init(&buffer[0], static_cast<int32>(buffer.size()))) {
+    LOG(ERROR) << "cannot allocate chunk of " << buffer.size() << " bytes.";
+    return webmlive::SharedDataChunk();
+  }
+  return chunk;
+}
+
+// Returns the header chunk of a synthetic |track|: EBML header, segment of
+// unknown size, segment info and one track.
+webmlive::SharedDataChunk SyntheticHeader(const Track& track) {
+  Buffer buffer;
+  Buffer payload;
+  AppendString(kDocTypeId, "webm", &payload);
+  AppendUInt(kDocTypeVersionId, 4, 0, &payload);
+  AppendUInt(kDocTypeReadVersionId, 2, 0, &payload);
+  AppendMaster(kEbmlHeaderId, payload, &buffer);
+
+  AppendId(kSegmentId, &buffer);
+  buffer.insert(buffer.end(), kUnknownSize,
+                kUnknownSize + sizeof(kUnknownSize));
+  payload.clear();
+  AppendUInt(kTimecodeScaleId, 1000000, 0, &payload);
+  AppendString(kMuxingAppId, "webmlive-load", &payload);
+  AppendMaster(kInfoId, payload, &buffer);
+
+  Buffer entry;
+  AppendUInt(kTrackNumberId, 1, 0, &entry);
+  AppendUInt(kTrackUidId, 1, 0, &entry);
+  AppendUInt(kTrackTypeId, track.video ? 1 : 2, 0, &entry);
+  AppendString(kCodecIdId, track.video ? "V_VP8" : "A_OPUS", &entry);
+  Buffer settings;
+  if (track.video) {
+    AppendUInt(kPixelWidthId, 1280, 0, &settings);
+    AppendUInt(kPixelHeightId, 720, 0, &settings);
+    AppendMaster(kVideoSettingsId, settings, &entry);
+  } else {
+    AppendUInt(kChannelsId, 2, 0, &settings);
+    AppendMaster(kAudioSettingsId, settings, &entry);
+  }
+  payload.clear();
+  AppendMaster(kTrackEntryId, entry, &payload);
+  AppendMaster(kTracksId, payload, &buffer);
+  return MakeChunk(buffer);
+}
+
+// Returns media chunk |chunk_num| of a synthetic |track|: one cluster of
+// unknown size holding the frames of the chunk's |config.chunk_ms|. Video
+// frames share the bitrate of each group of pictures, with keyframes
+// |kKeyframeWeight| times larger than the frames between them.
+webmlive::SharedDataChunk SyntheticChunk(const LoadConfig& config,
+                                         const Track& track,
+                                         int64 chunk_num) {
+  const int64 start_ms = (chunk_num - 1) * config.chunk_ms;
+  const int64 end_ms = start_ms + config.chunk_ms;
+  const int64 frame_rate =
+      track.video ? config.frame_rate : 1000 / kAudioFrameMs;
+  const int64 frames_per_gop =
+      std::max<int64>(1, config.keyframe_interval_ms * frame_rate / 1000);
+  const int64 frame_bytes = track.kbps * 125LL / frame_rate;
+  const int64 gop_weight = kKeyframeWeight + frames_per_gop - 1;
+
+  Buffer buffer;
+  AppendId(kClusterId, &buffer);
+  buffer.insert(buffer.end(), kUnknownSize,
+                kUnknownSize + sizeof(kUnknownSize));
+  AppendUInt(kTimecodeId, start_ms, 0, &buffer);
+  const int64 first_frame = (start_ms * frame_rate + 999) / 1000;
+  for (int64 frame = first_frame; frame * 1000 < end_ms * frame_rate;
+       ++frame) {
+    const bool keyframe = !track.video || frame % frames_per_gop == 0;
+    int64 size = frame_bytes;
+    if (track.video) {
+      size = frame_bytes * frames_per_gop *
+             (keyframe ? kKeyframeWeight : 1) / gop_weight;
+    }
+    size = std::max<int64>(size, 1);
+    const int16 relative_time =
+        static_cast<int16>(frame * 1000 / frame_rate - start_ms);
+    AppendId(kSimpleBlockId, &buffer);
+    AppendSize(4 + size, 0, &buffer);
+    buffer.push_back(0x81);  // Track number 1.
+    buffer.push_back(static_cast<uint8>(relative_time >> 8));
+    buffer.push_back(static_cast<uint8>(relative_time));
+    buffer.push_back(keyframe ? 0x80 : 0x00);
+    for (int64 i = 0; i < size; ++i) {
+      buffer.push_back(static_cast<uint8>(frame + i));
+    }
+  }
+  return MakeChunk(buffer);
+}
+
+// Returns the contents of |file_name| as a chunk, or an empty handle when
+// it cannot be read.
+webmlive::SharedDataChunk ReadChunkFile(const std::string& file_name) {
+  FILE* const ptr_file = fopen(file_name.c_str(), "rb");
+  if (!ptr_file) {
+    return webmlive::SharedDataChunk();
+  }
+  Buffer buffer;
+  uint8 block[64 * 1024];
+  size_t bytes_read = 0;
+  while ((bytes_read = fread(block, 1, sizeof(block), ptr_file)) > 0) {
+    buffer.insert(buffer.end(), block, block + bytes_read);
+  }
+  fclose(ptr_file);
+  if (buffer.empty()) {
+    return webmlive::SharedDataChunk();
+  }
+  return MakeChunk(buffer);
+}
+
+// Sets up the synthetic or replayed tracks of |config| in |ptr_tracks|.
+// Returns false when there is nothing to upload.
+bool LoadTracks(const LoadConfig& config, std::vector<Track>* ptr_tracks) {
+  Track video;
+  video.rep_id = kVideoId;
+  video.video = true;
+  video.kbps = config.video_kbps;
+  Track audio;
+  audio.rep_id = kAudioId;
+  audio.video = false;
+  audio.kbps = config.audio_kbps;
+
+  if (config.replay_prefix.empty()) {
+    ptr_tracks->push_back(video);
+    if (config.audio_kbps > 0) {
+      ptr_tracks->push_back(audio);
+    }
+    for (size_t i = 0; i < ptr_tracks->size(); ++i) {
+      Track& track = (*ptr_tracks)[i];
+      track.header = SyntheticHeader(track);
+      if (!track.header) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const Track candidates[] = {video, audio};
+  for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
+    Track track = candidates[i];
+    const std::string prefix = config.replay_prefix + "_" + track.rep_id;
+    track.header = ReadChunkFile(prefix + ".hdr");
+    if (!track.header) {
+      continue;
+    }
+    for (int64 chunk_num = 1;; ++chunk_num) {
+      std::ostringstream file_name;
+      file_name << prefix << "_" << chunk_num << ".chk";
+      webmlive::SharedDataChunk chunk = ReadChunkFile(file_name.str());
+      if (!chunk) {
+        break;
+      }
+      track.replay_chunks.push_back(chunk);
+    }
+    if (track.replay_chunks.empty()) {
+      continue;
+    }
+    LOG(INFO) << "replaying " << track.replay_chunks.size() << " chunks of "
+              << prefix;
+    ptr_tracks->push_back(track);
+  }
+  if (ptr_tracks->empty()) {
+    LOG(ERROR) << "no chunk files found for " << config.replay_prefix;
+    return false;
+  }
+  return true;
+}
+
+// Returns media chunk |chunk_num| of |ptr_track|. Synthetic chunks are built
+// once and shared by the streams: the staggered streams are never more than
+// one chunk apart, so the older chunks are released.
+webmlive::SharedDataChunk TrackChunk(const LoadConfig& config,
+                                     Track* ptr_track, int64 chunk_num) {
+  if (!ptr_track->replay_chunks.empty()) {
+    return ptr_track->replay_chunks[(chunk_num - 1) %
+                                    ptr_track->replay_chunks.size()];
+  }
+  std::map<int64, webmlive::SharedDataChunk>::iterator it =
+      ptr_track->chunks.find(chunk_num);
+  if (it != ptr_track->chunks.end()) {
+    return it->second;
+  }
+  webmlive::SharedDataChunk chunk =
+      SyntheticChunk(config, *ptr_track, chunk_num);
+  ptr_track->chunks.erase(ptr_track->chunks.begin(),
+                          ptr_track->chunks.lower_bound(chunk_num - 1));
+  ptr_track->chunks[chunk_num] = chunk;
+  return chunk;
+}
+
+std::string ManifestDocument(const std::string& name) {
+  return "<?xml version=\"1.0\"?>\n<MPD type=\"dynamic\" id=\"" + name +
+         "\"/>\n";
+}
+
+// Moves the live edge of |ptr_stream| past the chunks that finished
+// uploading, and adds its lag behind the encoder, at |elapsed_ms|, to
+// |ptr_lag|.
+void update_live_edge(int64 elapsed_ms, LoadStream* ptr_stream,
+                      webmlive::LatencyHistogram* ptr_lag) {
+  webmlive::HttpUploaderStats stats;
+  ptr_stream->uploader->GetStats(&stats);
+  const int64 finished_chunks = stats.completed_uploads +
+                                stats.failed_uploads -
+                                ptr_stream->startup_uploads;
+  while (ptr_stream->finished_chunks < finished_chunks &&
+         !ptr_stream->queued_due_ms.empty()) {
+    ptr_stream->edge_due_ms = ptr_stream->queued_due_ms.front();
+    ptr_stream->queued_due_ms.pop_front();
+    ++ptr_stream->finished_chunks;
+  }
+  if (ptr_stream->edge_due_ms >= 0) {
+    ptr_lag->Add((elapsed_ms - ptr_stream->edge_due_ms) * 1000);
+  }
+}
+
+// Prints the totals of |streams| over |elapsed_ms|, and the distribution of
+// |lag|.
+void report(const std::vector<std::unique_ptr<LoadStream>>& streams,
+            int64 elapsed_ms, const webmlive::LatencyHistogram& lag) {
+  webmlive::LatencyHistogram latency;
+  int64 bytes = 0;
+  int64 completed = 0;
+  int64 failed = 0;
+  int64 skipped = 0;
+  int64 connections = 0;
+  int64 active_uploads = 0;
+  for (size_t i = 0; i < streams.size(); ++i) {
+    const LoadStream& stream = *streams[i];
+    webmlive::HttpUploaderStats stats;
+    stream.uploader->GetStats(&stats);
+    bytes += stats.total_bytes_uploaded;
+    completed += stats.completed_uploads;
+    failed += stats.failed_uploads;
+    latency.count += stats.upload_latency.count;
+    latency.total_us += stats.upload_latency.total_us;
+    latency.max_us = std::max(latency.max_us, stats.upload_latency.max_us);
+    for (int j = 0; j < webmlive::LatencyHistogram::kNumBuckets; ++j) {
+      latency.buckets[j] += stats.upload_latency.buckets[j];
+    }
+    skipped += stream.skipped_chunks;
+    connections += stream.ptr_connections->value();
+    active_uploads += stream.ptr_active_uploads->value();
+  }
+  std::ostringstream out;
+  out << "streams=" << streams.size() << " uploads=" << completed
+      << " failed=" << failed << " skipped_chunks=" << skipped
+      << " bytes=" << bytes;
+  if (elapsed_ms > 0) {
+    out << " kbps=" << bytes * 8 / elapsed_ms;
+  }
+  out << " connections_opened=" << connections
+      << " active_uploads=" << active_uploads;
+  if (latency.count > 0) {
+    out << " latency_mean_ms=" << latency.total_us / latency.count / 1000.0
+        << " latency_p50<=" << latency.Percentile(50) << "ms"
+        << " latency_p95<=" << latency.Percentile(95) << "ms"
+        << " latency_p99<=" << latency.Percentile(99) << "ms"
+        << " latency_max_ms=" << latency.max_us / 1000.0;
+  }
+  if (lag.count > 0) {
+    out << " live_edge_lag_mean_ms=" << lag.total_us / lag.count / 1000.0
+        << " live_edge_lag_p95<=" << lag.Percentile(95) << "ms"
+        << " live_edge_lag_max_ms=" << lag.max_us / 1000.0;
+  }
+  printf("%s\n", out.str().c_str());
+  fflush(stdout);
+}
+
+// Queues the header chunks and the manifest of |ptr_stream|.
+bool start_stream(const std::vector<Track>& tracks, LoadStream* ptr_stream) {
+  ptr_stream->startup_uploads = 1 + static_cast<int64>(tracks.size());
+  const std::string manifest = ManifestDocument(ptr_stream->name);
+  if (ptr_stream->uploader->UploadBuffer(
+          reinterpret_cast<const uint8*>(manifest.data()),
+          static_cast<int32>(manifest.size()),
+          ptr_stream->name + ".mpd") != webmlive::HttpUploader::kSuccess) {
+    return false;
+  }
+  for (size_t i = 0; i < tracks.size(); ++i) {
+    const std::string id = ptr_stream->name + "_" + tracks[i].rep_id + ".hdr";
+    if (ptr_stream->uploader->UploadChunk(tracks[i].header, id) !=
+        webmlive::HttpUploader::kSuccess) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int load_main(const LoadConfig& config) {
+  std::vector<Track> tracks;
+  if (!LoadTracks(config, &tracks)) {
+    return EXIT_FAILURE;
+  }
+
+  webmlive::HttpUploadEngine engine;
+  if (config.shared_engine) {
+    if (engine.Init(config.num_streams * config.max_concurrent_uploads,
+                    config.http2) ||
+        engine.Run()) {
+      LOG(ERROR) << "cannot start the upload engine.";
+      return EXIT_FAILURE;
+    }
+  }
+
+  webmlive::MetricsRegistry& registry = webmlive::MetricsRegistry::Instance();
+  std::vector<std::unique_ptr<LoadStream>> streams;
+  for (int i = 0; i < config.num_streams; ++i) {
+    std::unique_ptr<LoadStream> stream(
+        new (std::nothrow) LoadStream());  // NOLINT
+    webmlive::HttpUploader* const ptr_uploader =
+        new (std::nothrow) webmlive::HttpUploader();  // NOLINT
+    if (!stream || !ptr_uploader) {
+      LOG(ERROR) << "out of memory.";
+      delete ptr_uploader;
+      return EXIT_FAILURE;
+    }
+    stream->uploader.reset(ptr_uploader);
+    std::ostringstream name;
+    name << config.stream_prefix << i;
+    stream->name = name.str();
+    stream->offset_ms =
+        static_cast<int64>(i) * config.chunk_ms / config.num_streams;
+
+    webmlive::HttpUploaderSettings settings;
+    settings.url_template = config.url_template;
+    settings.stream_name = stream->name;
+    settings.stream_id = stream->name;
+    settings.post_mode =
+        config.form_post ? webmlive::HTTP_FORM_POST : webmlive::HTTP_POST;
+    settings.max_concurrent_uploads = config.max_concurrent_uploads;
+    settings.max_pending_uploads =
+        std::max(settings.max_pending_uploads,
+                 config.max_concurrent_uploads + 1 +
+                 static_cast<int>(tracks.size()));
+    settings.enable_http2 = config.http2;
+    settings.metrics_labels = "stream=\"" + stream->name + "\"";
+    const int status = config.shared_engine ?
+        stream->uploader->Init(settings, &engine) :
+        stream->uploader->Init(settings);
+    if (status || stream->uploader->Run()) {
+      LOG(ERROR) << "cannot start uploader " << stream->name
+                 << ", status=" << status;
+      return EXIT_FAILURE;
+    }
+    stream->ptr_connections = registry.GetCounter(
+        "webmlive_upload_connections_total", settings.metrics_labels, "");
+    stream->ptr_active_uploads = registry.GetGauge(
+        "webmlive_uploads_active", settings.metrics_labels, "");
+    if (!stream->ptr_connections || !stream->ptr_active_uploads ||
+        !start_stream(tracks, stream.get())) {
+      LOG(ERROR) << "cannot start stream " << stream->name;
+      return EXIT_FAILURE;
+    }
+    streams.push_back(std::move(stream));
+  }
+  printf("Uploading %d streams for %d seconds.\n", config.num_streams,
+         config.duration);
+
+  // Media chunk N of a stream is due once its media time has passed, at
+  // |offset_ms| + N * |chunk_ms|, as the muxer finishes it.
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point start_time = Clock::now();
+  int64 report_ms = 0;
+  webmlive::LatencyHistogram lag;
+  for (;;) {
+    const int64 elapsed_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            Clock::now() - start_time).count();
+    if (elapsed_ms >= config.duration * 1000LL) {
+      break;
+    }
+    int64 next_due_ms = elapsed_ms + kPollIntervalMs;
+    for (size_t i = 0; i < streams.size(); ++i) {
+      LoadStream& stream = *streams[i];
+      int64 due_ms = stream.offset_ms + stream.next_chunk * config.chunk_ms;
+      while (due_ms <= elapsed_ms) {
+        for (size_t j = 0; j < tracks.size(); ++j) {
+          // A live encoder cannot wait on a full uploader either.
+          if (!stream.uploader->Ready()) {
+            ++stream.skipped_chunks;
+            continue;
+          }
+          std::ostringstream id;
+          id << stream.name << "_" << tracks[j].rep_id << "_"
+             << stream.next_chunk << ".chk";
+          const webmlive::SharedDataChunk chunk =
+              TrackChunk(config, &tracks[j], stream.next_chunk);
+          if (!chunk ||
+              stream.uploader->UploadChunk(chunk, id.str()) !=
+                  webmlive::HttpUploader::kSuccess) {
+            ++stream.skipped_chunks;
+            continue;
+          }
+          stream.queued_due_ms.push_back(due_ms);
+        }
+        ++stream.next_chunk;
+        due_ms += config.chunk_ms;
+      }
+      next_due_ms = std::min(next_due_ms, due_ms);
+      update_live_edge(elapsed_ms, &stream, &lag);
+    }
+    if (config.report_interval > 0 &&
+        elapsed_ms - report_ms >= config.report_interval * 1000LL) {
+      report(streams, elapsed_ms, lag);
+      report_ms = elapsed_ms;
+    }
+    const int64 sleep_ms = next_due_ms - elapsed_ms;
+    if (sleep_ms > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(sleep_ms));
+    }
+  }
+
+  const int64 elapsed_ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          Clock::now() - start_time).count();
+  report(streams, elapsed_ms, lag);
+  for (size_t i = 0; i < streams.size(); ++i) {
+    streams[i]->uploader->Stop();
+  }
+  if (config.shared_engine) {
+    engine.Stop();
+  }
+  return EXIT_SUCCESS;
+}
+}  // namespace
+
+int main(int argc, const char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  LoadConfig config;
+  if (!parse_command_line(argc, argv, &config)) {
+    usage(argv);
+    return EXIT_FAILURE;
+  }
+  const int exit_code = load_main(config);
+  google::ShutdownGoogleLogging();
+  return exit_code;
+}
@@ -0,0 +1,243 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/upload_spool.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+#include "encoder/file_util.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+const char kLogFileName[] = "upload_spool.log";
+const char kIndexFileName[] = "upload_spool.idx";
+const char kHeadFileName[] = "upload_spool.head";
+const char kTempFileSuffix[] = ".tmp";
+
+// Record header: magic, then the lengths of the id, URL and data that follow
+// it, each a little endian uint32.
+const uint32 kRecordMagic = 0x50534c57;  // "WLSP"
+const int kRecordHeaderSize = 16;
+
+void StoreLe32(uint32 value, uint8* ptr_buf) {
+  for (int i = 0; i < 4; ++i) {
+    ptr_buf[i] = static_cast<uint8>(value >> (8 * i));
+  }
+}
+
+uint32 LoadLe32(const uint8* ptr_buf) {
+  uint32 value = 0;
+  for (int i = 0; i < 4; ++i) {
+    value |= static_cast<uint32>(ptr_buf[i]) << (8 * i);
+  }
+  return value;
+}
+}  // namespace
+
+UploadSpool::UploadSpool()
+    : max_bytes_(0),
+      head_(0),
+      log_size_(0) {
+}
+
+int UploadSpool::Init(const std::string& directory, int64 max_bytes) {
+  if (directory.empty() || max_bytes <= 0 || max_bytes > kMaxSpoolBytes) {
+    LOG(ERROR) << "invalid upload spool directory or size: " << max_bytes;
+    return kInvalidArg;
+  }
+  log_name_ = directory + kLogFileName;
+  index_name_ = directory + kIndexFileName;
+  head_name_ = directory + kHeadFileName;
+  max_bytes_ = max_bytes;
+  offsets_.clear();
+  head_ = 0;
+  log_size_ = std::max<int64>(FileSize(log_name_), 0);
+
+  // Load the records of an earlier run. Index entries past the end of the
+  // log belong to records lost before they were written.
+  FILE* const index_file = fopen(index_name_.c_str(), "rb");
+  if (index_file) {
+    int64 offset = 0;
+    while (fread(&offset, sizeof(offset), 1, index_file) == 1) {
+      if (offset < 0 || offset + kRecordHeaderSize > log_size_) {
+        break;
+      }
+      offsets_.push_back(offset);
+    }
+    fclose(index_file);
+  }
+  FILE* const head_file = fopen(head_name_.c_str(), "rb");
+  if (head_file) {
+    long head = 0;  // NOLINT
+    if (fscanf(head_file, "%ld", &head) == 1 && head > 0) {
+      head_ = std::min(static_cast<size_t>(head), offsets_.size());
+    }
+    fclose(head_file);
+  }
+  if (empty()) {
+    Clear();
+  } else {
+    LOG(INFO) << "upload spool holds " << num_records() << " uploads, "
+              << log_size_ << " bytes.";
+  }
+  return kSuccess;
+}
+
+int UploadSpool::Append(const std::string& id, const std::string& url,
+                        const DataChunk& chunk) {
+  const int64 record_size =
+      kRecordHeaderSize + id.length() + url.length() + chunk.length();
+  if (log_size_ + record_size > max_bytes_) {
+    LOG(WARNING) << "upload spool full, " << id << " not spooled.";
+    return kSpoolFull;
+  }
+  uint8 header[kRecordHeaderSize];
+  StoreLe32(kRecordMagic, &header[0]);
+  StoreLe32(static_cast<uint32>(id.length()), &header[4]);
+  StoreLe32(static_cast<uint32>(url.length()), &header[8]);
+  StoreLe32(static_cast<uint32>(chunk.length()), &header[12]);
+
+  FILE* const log_file = fopen(log_name_.c_str(), "ab");
+  if (!log_file) {
+    LOG(ERROR) << "cannot open upload spool " << log_name_;
+    return kIoError;
+  }
+  int64 bytes_written = fwrite(header, 1, sizeof(header), log_file);
+  bytes_written += fwrite(id.data(), 1, id.length(), log_file);
+  bytes_written += fwrite(url.data(), 1, url.length(), log_file);
+  const std::vector<DataChunk::Span>& spans = chunk.spans();
+  for (size_t i = 0; i < spans.size(); ++i) {
+    bytes_written += fwrite(spans[i].ptr_data, 1, spans[i].length, log_file);
+  }
+  const bool close_ok = (fclose(log_file) == 0);
+  if (!close_ok || bytes_written != record_size) {
+    // The partial record is never indexed; later records follow it.
+    LOG(ERROR) << "upload spool write failed for " << id;
+    log_size_ = std::max<int64>(FileSize(log_name_), log_size_);
+    return kIoError;
+  }
+
+  // Index the record once it is in the log.
+  const int64 offset = log_size_;
+  log_size_ += record_size;
+  FILE* const index_file = fopen(index_name_.c_str(), "ab");
+  if (!index_file) {
+    LOG(ERROR) << "cannot open upload spool index " << index_name_;
+    return kIoError;
+  }
+  const size_t entries_written =
+      fwrite(&offset, sizeof(offset), 1, index_file);
+  if (fclose(index_file) != 0 || entries_written != 1) {
+    LOG(ERROR) << "upload spool index write failed for " << id;
+    return kIoError;
+  }
+  offsets_.push_back(offset);
+  VLOG(1) << "spooled " << id << ", " << num_records() << " uploads spooled.";
+  return kSuccess;
+}
+
+int UploadSpool::ReadFront(std::string* ptr_id, std::string* ptr_url,
+                           SharedDataChunk* ptr_chunk) {
+  if (!ptr_id || !ptr_url || !ptr_chunk || empty()) {
+    return kInvalidArg;
+  }
+  FILE* const log_file = fopen(log_name_.c_str(), "rb");
+  if (!log_file) {
+    LOG(ERROR) << "cannot open upload spool " << log_name_;
+    return kIoError;
+  }
+  uint8 header[kRecordHeaderSize];
+  int status = kIoError;
+  if (fseek(log_file, static_cast<long>(offsets_[head_]),  // NOLINT
+            SEEK_SET) == 0 &&
+      fread(header, 1, sizeof(header), log_file) == sizeof(header) &&
+      LoadLe32(&header[0]) == kRecordMagic) {
+    const uint32 id_length = LoadLe32(&header[4]);
+    const uint32 url_length = LoadLe32(&header[8]);
+    const uint32 data_length = LoadLe32(&header[12]);
+    std::vector<uint8> record(id_length + url_length + data_length);
+    if (record.empty() ||
+        fread(&record[0], 1, record.size(), log_file) == record.size()) {
+      std::shared_ptr<DataChunk> chunk(
+          new (std::nothrow) DataChunk());  // NOLINT
+      if (!chunk) {
+        status = kNoMemory;
+      } else if (data_length > 0 &&
+                 chunk->Init(&record[id_length + url_length],
+                             static_cast<int32>(data_length))) {
+        status = kNoMemory;
+      } else {
+        const char* const ptr_record =
+            reinterpret_cast<const char*>(record.data());
+        ptr_id->assign(ptr_record, id_length);
+        ptr_url->assign(ptr_record + id_length, url_length);
+        *ptr_chunk = chunk;
+        status = kSuccess;
+      }
+    }
+  }
+  fclose(log_file);
+  if (status == kIoError) {
+    LOG(ERROR) << "cannot read upload spool record " << head_;
+  }
+  return status;
+}
+
+int UploadSpool::PopFront() {
+  if (empty()) {
+    return kInvalidArg;
+  }
+  ++head_;
+  if (empty()) {
+    Clear();
+    return kSuccess;
+  }
+  return WriteHead();
+}
+
+int UploadSpool::WriteHead() {
+  const std::string temp_name = head_name_ + kTempFileSuffix;
+  FILE* const file = fopen(temp_name.c_str(), "wb");
+  if (!file) {
+    LOG(ERROR) << "cannot open upload spool head " << temp_name;
+    return kIoError;
+  }
+  const int chars_written =
+      fprintf(file, "%ld\n", static_cast<long>(head_));  // NOLINT
+  const bool close_ok = (fclose(file) == 0);
+  if (!close_ok || chars_written <= 0) {
+    LOG(ERROR) << "upload spool head write failed for " << temp_name;
+    remove(temp_name.c_str());
+    return kIoError;
+  }
+
+  // rename() does not replace existing files on all platforms. Losing the
+  // head file uploads the spooled records again, but loses none.
+  remove(head_name_.c_str());
+  if (rename(temp_name.c_str(), head_name_.c_str())) {
+    LOG(ERROR) << "cannot rename upload spool head " << temp_name;
+    return kIoError;
+  }
+  return kSuccess;
+}
+
+void UploadSpool::Clear() {
+  remove(log_name_.c_str());
+  remove(index_name_.c_str());
+  remove(head_name_.c_str());
+  offsets_.clear();
+  head_ = 0;
+  log_size_ = 0;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,92 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_UPLOAD_SPOOL_H_
+#define WEBMLIVE_ENCODER_UPLOAD_SPOOL_H_
+
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/buffer_util.h"
+
+namespace webmlive {
+
+// Bounded on-disk queue of uploads that could not be sent, kept until they
+// are uploaded.
+//
+// Uploads are appended to a log file, and the offset of each record to an
+// index file; a head file counts the records already uploaded. The spool
+// survives restarts: |Init()| picks up the records left by an earlier run.
+// Files are truncated once every record has been uploaded.
+//
+// Notes
+// - Not thread safe.
+// - Records are never removed out of order; the log only shrinks when the
+//   spool empties.
+class UploadSpool {
+ public:
+  enum {
+    // Spool files could not be read or written.
+    kIoError = -4,
+    // The record would grow the log past |max_bytes|.
+    kSpoolFull = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Largest spool; offsets are passed to fseek() as long.
+  static const int64 kMaxSpoolBytes = 0x7fffffff;
+
+  UploadSpool();
+  ~UploadSpool() {}
+
+  // Uses the spool files in |directory|, which must end with a path
+  // separator, and loads the records they hold. The log is limited to
+  // |max_bytes|. Returns |kSuccess| when successful.
+  int Init(const std::string& directory, int64 max_bytes);
+
+  // Appends the upload of |chunk|, named |id|, to |url|. Returns
+  // |kSpoolFull| when the record does not fit.
+  int Append(const std::string& id, const std::string& url,
+             const DataChunk& chunk);
+
+  // Reads the oldest record. Returns |kInvalidArg| when the spool is empty.
+  int ReadFront(std::string* ptr_id, std::string* ptr_url,
+                SharedDataChunk* ptr_chunk);
+
+  // Removes the oldest record.
+  int PopFront();
+
+  bool empty() const { return head_ == offsets_.size(); }
+  int64 size_bytes() const { return log_size_; }
+  size_t num_records() const { return offsets_.size() - head_; }
+
+ private:
+  // Rewrites the head file with |head_|.
+  int WriteHead();
+
+  // Removes the spool files, and forgets all records.
+  void Clear();
+
+  std::string log_name_;
+  std::string index_name_;
+  std::string head_name_;
+  int64 max_bytes_;
+
+  // Offset of every record in the log, the index of the oldest record not
+  // yet uploaded, and the size of the log.
+  std::vector<int64> offsets_;
+  size_t head_;
+  int64 log_size_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(UploadSpool);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_UPLOAD_SPOOL_H_
@@ -0,0 +1,169 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/v210_unpack.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WEBMLIVE_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace webmlive {
+
+namespace {
+// Pixels, and bytes, per V210 group of four 32 bit words.
+const int32 kGroupPixels = 6;
+const int32 kGroupBytes = 16;
+
+// Pixels per padded V210 block.
+const int32 kBlockPixels = 48;
+const int32 kBlockBytes = 128;
+
+const uint32 kSampleMask = 0x3ff;
+
+uint32 ReadWord(const uint8* ptr_src) {
+  return ptr_src[0] | (ptr_src[1] << 8) | (ptr_src[2] << 16) |
+         (static_cast<uint32>(ptr_src[3]) << 24);
+}
+
+// Scalar loop. Unpacks the groups from |first_pixel|, a multiple of
+// |kGroupPixels|, to |width|. With |kAverage| the chroma of the row is
+// averaged with the chroma already in |ptr_u| and |ptr_v|.
+template <bool kAverage>
+void UnpackRowScalar(const uint8* ptr_src, int32 first_pixel, int32 width,
+                     uint16* ptr_y, uint16* ptr_u, uint16* ptr_v) {
+  const int32 chroma_width = (width + 1) / 2;
+  for (int32 x = first_pixel; x < width; x += kGroupPixels) {
+    const uint8* const ptr_group = ptr_src + x / kGroupPixels * kGroupBytes;
+    uint32 samples[12];
+    for (int i = 0; i < 4; ++i) {
+      const uint32 word = ReadWord(ptr_group + i * 4);
+      samples[i * 3] = word & kSampleMask;
+      samples[i * 3 + 1] = (word >> 10) & kSampleMask;
+      samples[i * 3 + 2] = (word >> 20) & kSampleMask;
+    }
+    // Samples are stored Cb0 Y0 Cr0 Y1 Cb1 Y2 Cr1 Y3 Cb2 Y4 Cr2 Y5.
+    for (int i = 0; i < kGroupPixels && x + i < width; ++i) {
+      ptr_y[x + i] = static_cast<uint16>(samples[i * 2 + 1]);
+    }
+    for (int i = 0; i < kGroupPixels / 2 && x / 2 + i < chroma_width; ++i) {
+      const uint32 u = samples[i * 4];
+      const uint32 v = samples[i * 4 + 2];
+      uint16* const ptr_u_out = ptr_u + x / 2 + i;
+      uint16* const ptr_v_out = ptr_v + x / 2 + i;
+      if (kAverage) {
+        *ptr_u_out = static_cast<uint16>((*ptr_u_out + u + 1) >> 1);
+        *ptr_v_out = static_cast<uint16>((*ptr_v_out + v + 1) >> 1);
+      } else {
+        *ptr_u_out = static_cast<uint16>(u);
+        *ptr_v_out = static_cast<uint16>(v);
+      }
+    }
+  }
+}
+
+// Vector loop. Returns the number of pixels it unpacked, a multiple of
+// |kGroupPixels|; the caller finishes the remainder with the scalar loop.
+// Each group stores eight luma and four chroma samples, of which six and
+// three are valid, so groups are unpacked only while the extra samples land
+// within the row. Invalid samples are overwritten by the next group.
+#if defined(WEBMLIVE_HAVE_SSE2)
+template <bool kAverage>
+int32 UnpackRowSimd(const uint8* ptr_src, int32 width,
+                    uint16* ptr_y, uint16* ptr_u, uint16* ptr_v) {
+  const __m128i sample_mask = _mm_set1_epi32(kSampleMask);
+  const __m128i lanes_0_2 = _mm_set_epi32(0, -1, 0, -1);
+  const __m128i lane_0 = _mm_set_epi32(0, 0, 0, -1);
+  const __m128i lane_1 = _mm_set_epi32(0, 0, -1, 0);
+  const __m128i lane_2 = _mm_set_epi32(0, -1, 0, 0);
+  const __m128i lane_3 = _mm_set_epi32(-1, 0, 0, 0);
+  // The fourth U and V samples belong to the next group.
+  const __m128i next_group_chroma = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+  int32 x = 0;
+  for (; x + 8 <= width; x += kGroupPixels) {
+    const __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+        ptr_src + x / kGroupPixels * kGroupBytes));
+    // a = [Cb0 Y1 Cr1 Y4], b = [Y0 Cb1 Y3 Cr2], c = [Cr0 Y2 Cb2 Y5].
+    const __m128i a = _mm_and_si128(words, sample_mask);
+    const __m128i b = _mm_and_si128(_mm_srli_epi32(words, 10), sample_mask);
+    const __m128i c = _mm_and_si128(_mm_srli_epi32(words, 20), sample_mask);
+
+    // [Y0 Y1 Y3 Y4], then [Y2 Y3 Y5 Y4].
+    const __m128i y0134 = _mm_or_si128(_mm_and_si128(lanes_0_2, b),
+                                       _mm_andnot_si128(lanes_0_2, a));
+    const __m128i y2354 = _mm_unpacklo_epi32(
+        _mm_shuffle_epi32(c, _MM_SHUFFLE(3, 3, 3, 1)),
+        _mm_shuffle_epi32(y0134, _MM_SHUFFLE(3, 3, 3, 2)));
+    const __m128i y0123 = _mm_unpacklo_epi64(y0134, y2354);
+    const __m128i y45 = _mm_shuffle_epi32(y2354, _MM_SHUFFLE(3, 3, 2, 3));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(ptr_y + x),
+                     _mm_packs_epi32(y0123, y45));
+
+    // [Cb0 Cb1 Cb2 0] and [Cr0 Cr1 Cr2 Cr2].
+    const __m128i u = _mm_or_si128(
+        _mm_and_si128(lane_0, a),
+        _mm_or_si128(_mm_and_si128(lane_1, b), _mm_and_si128(lane_2, c)));
+    const __m128i v = _mm_shuffle_epi32(
+        _mm_or_si128(
+            _mm_and_si128(lane_0, c),
+            _mm_or_si128(_mm_and_si128(lane_2, a), _mm_and_si128(lane_3, b))),
+        _MM_SHUFFLE(3, 3, 2, 0));
+    __m128i uv = _mm_packs_epi32(u, v);
+    __m128i* const ptr_u_out = reinterpret_cast<__m128i*>(ptr_u + x / 2);
+    __m128i* const ptr_v_out = reinterpret_cast<__m128i*>(ptr_v + x / 2);
+    if (kAverage) {
+      const __m128i previous = _mm_unpacklo_epi64(_mm_loadl_epi64(ptr_u_out),
+                                                   _mm_loadl_epi64(ptr_v_out));
+      uv = _mm_or_si128(_mm_andnot_si128(next_group_chroma, uv),
+                        _mm_and_si128(next_group_chroma, previous));
+      uv = _mm_avg_epu16(uv, previous);
+    }
+    _mm_storel_epi64(ptr_u_out, uv);
+    _mm_storel_epi64(ptr_v_out, _mm_srli_si128(uv, 8));
+  }
+  return x;
+}
+#else
+template <bool kAverage>
+int32 UnpackRowSimd(const uint8*, int32, uint16*, uint16*, uint16*) {
+  return 0;
+}
+#endif
+
+template <bool kAverage>
+void UnpackRow(const uint8* ptr_src, int32 width,
+               uint16* ptr_y, uint16* ptr_u, uint16* ptr_v) {
+  const int32 done =
+      UnpackRowSimd<kAverage>(ptr_src, width, ptr_y, ptr_u, ptr_v);
+  UnpackRowScalar<kAverage>(ptr_src, done, width, ptr_y, ptr_u, ptr_v);
+}
+}  // namespace
+
+int32 V210Stride(int32 width) {
+  return (width + kBlockPixels - 1) / kBlockPixels * kBlockBytes;
+}
+
+void V210ToI42016(const uint8* ptr_src, int32 src_stride,
+                  uint16* ptr_y, int32 y_stride,
+                  uint16* ptr_u, int32 u_stride,
+                  uint16* ptr_v, int32 v_stride,
+                  int32 width, int32 height) {
+  for (int32 row = 0; row < height; row += 2) {
+    UnpackRow<false>(ptr_src, width, ptr_y, ptr_u, ptr_v);
+    if (row + 1 < height) {
+      UnpackRow<true>(ptr_src + src_stride, width, ptr_y + y_stride,
+                      ptr_u, ptr_v);
+    }
+    ptr_src += 2 * src_stride;
+    ptr_y += 2 * y_stride;
+    ptr_u += u_stride;
+    ptr_v += v_stride;
+  }
+}
+
+}  // namespace webmlive
@@ -0,0 +1,34 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_V210_UNPACK_H_
+#define WEBMLIVE_ENCODER_V210_UNPACK_H_
+
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+// Returns the row stride, in bytes, of a V210 frame |width| pixels wide. V210
+// packs three 10 bit samples into each little endian 32 bit word, six 4:2:2
+// pixels per 16 bytes, and rows are padded to multiples of 48 pixels.
+int32 V210Stride(int32 width);
+
+// Unpacks |height| rows of |width| pixel V210 at |ptr_src| to planar 4:2:0,
+// one 10 bit sample per uint16. Chroma of each pair of rows is averaged.
+// |src_stride| is in bytes; the destination strides are in samples. |width|
+// must be even.
+//
+// Uses SSE2 when the target supports it.
+void V210ToI42016(const uint8* ptr_src, int32 src_stride,
+                  uint16* ptr_y, int32 y_stride,
+                  uint16* ptr_u, int32 u_stride,
+                  uint16* ptr_v, int32 v_stride,
+                  int32 width, int32 height);
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_V210_UNPACK_H_
@@ -0,0 +1,411 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/video_encode_worker.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <sstream>
+
+#include "encoder/buffer_pool-inl.h"
+#include "encoder/cpu_accounting.h"
+#include "encoder/latency_tracer.h"
+#include "encoder/memory_governor.h"
+#include "encoder/metrics.h"
+#include "encoder/thread_placement.h"
+#include "encoder/tracepoints.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+VideoEncodeWorker::VideoEncodeWorker()
+    : max_input_frames_(0),
+      block_when_full_(false),
+      stop_(false),
+      busy_(false),
+      worker_done_(false),
+      status_(kSuccess),
+      ptr_frames_encoded_(NULL),
+      ptr_encode_time_us_(NULL),
+      ptr_frames_dropped_(NULL),
+      ptr_memory_(NULL),
+      frame_bytes_(0),
+      trace_stream_id_(0) {
+}
+
+VideoEncodeWorker::~VideoEncodeWorker() {
+  if (worker_thread_ || strand_) {
+    Stop();
+  }
+}
+
+int VideoEncodeWorker::Init(const WebmEncoderConfig& config,
+                            const VideoRepresentationConfig& representation) {
+  const VideoConfig& capture_config = config.actual_video_config;
+  if (capture_config.format != kVideoFormatI420 &&
+      capture_config.format != kVideoFormatYV12 &&
+      capture_config.format != kVideoFormatI42016) {
+    LOG(ERROR) << "VideoEncodeWorker unsupported input format: "
+               << capture_config.format;
+    return kInvalidArg;
+  }
+
+  config_ = config;
+  block_when_full_ = !config.input_paced && !config.task_scheduler;
+  output_config_ = capture_config;
+  if (representation.width > 0)
+    output_config_.width = representation.width;
+  if (representation.height > 0)
+    output_config_.height = representation.height;
+
+  // Frames produced by |VideoScaler| use aligned strides.
+  if (output_config_.width != capture_config.width ||
+      output_config_.height != capture_config.height) {
+    output_config_.stride = VideoFrame::AlignedStride(output_config_.width);
+    if (output_config_.format == kVideoFormatI42016)
+      output_config_.stride *= 2;
+  }
+  if (representation.bitrate > 0)
+    config_.vpx_config.bitrate = representation.bitrate;
+  config_.vpx_config.codec =
+      RepresentationCodec(representation, config.vpx_config);
+  config_.actual_video_config = output_config_;
+
+  if (scaler_.Init(output_config_.width, output_config_.height)) {
+    LOG(ERROR) << "VideoEncodeWorker scaler Init failed.";
+    return kInvalidArg;
+  }
+
+  // Half a second of raw frames, like |WebmEncoder::video_pool_|.
+  const int default_count = BufferPool<VideoFrame>::kDefaultBufferCount;
+  max_input_frames_ =
+      std::max(default_count, static_cast<int>(capture_config.frame_rate / 2));
+
+  // Compressed frames must never be dropped: allow the output pool to grow.
+  if (output_pool_.Init(true, default_count)) {
+    LOG(ERROR) << "VideoEncodeWorker output pool Init failed.";
+    return kNoMemory;
+  }
+
+  const int status = video_encoder_.Init(config_);
+  if (status) {
+    LOG(ERROR) << "VideoEncodeWorker video encoder Init failed: " << status;
+    return kVideoEncoderError;
+  }
+
+  std::ostringstream representation_label;
+  representation_label << "representation=\"" << output_config_.width << "x"
+                       << output_config_.height << "\"";
+  const std::string labels = MetricsRegistry::JoinLabels(
+      config_.metrics_labels, representation_label.str());
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  ptr_frames_encoded_ = registry.GetCounter(
+      "webmlive_video_frames_encoded_total", labels,
+      "Video frames passed to the video encoder.");
+  ptr_encode_time_us_ = registry.GetCounter(
+      "webmlive_video_encode_microseconds_total", labels,
+      "Time spent in the video encoder.");
+  ptr_frames_dropped_ = registry.GetCounter(
+      "webmlive_video_encode_frames_dropped_total", labels,
+      "Raw video frames dropped because the encode worker was behind.");
+  ptr_memory_ = MemoryGovernor::Instance().GetAccount(
+      kMemoryCodecArenas, config_.metrics_labels, representation_label.str());
+  if (!ptr_frames_encoded_ || !ptr_encode_time_us_ || !ptr_frames_dropped_ ||
+      !ptr_memory_) {
+    LOG(ERROR) << "VideoEncodeWorker cannot create metrics.";
+    return kNoMemory;
+  }
+  trace_stream_id_ = Tracepoints::StreamId(labels);
+
+  LOG(INFO) << "VideoEncodeWorker representation " << output_config_.width
+            << "x" << output_config_.height << " @ "
+            << config_.vpx_config.bitrate << " kbps";
+  return kSuccess;
+}
+
+int VideoEncodeWorker::Run() {
+  if (worker_thread_ || strand_) {
+    LOG(ERROR) << "VideoEncodeWorker already running.";
+    return kThreadError;
+  }
+  if (config_.task_scheduler) {
+    strand_.reset(
+        new (std::nothrow) TaskStrand(config_.task_scheduler));  // NOLINT
+    if (!strand_) {
+      LOG(ERROR) << "VideoEncodeWorker cannot construct task strand.";
+      return kThreadError;
+    }
+    return kSuccess;
+  }
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  worker_thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&VideoEncodeWorker::WorkerThread,  // NOLINT
+                                this)));
+  if (!worker_thread_) {
+    LOG(ERROR) << "VideoEncodeWorker cannot construct thread.";
+    return kThreadError;
+  }
+  return kSuccess;
+}
+
+void VideoEncodeWorker::Stop() {
+  CHECK(worker_thread_ || strand_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  input_ready_.notify_one();
+  worker_progress_.notify_all();
+  if (strand_) {
+    // Nothing runs on the strand once it is cancelled; flush here.
+    strand_->Cancel();
+    strand_.reset();
+    FinishEncode(CheckStatus());
+  } else {
+    worker_thread_->join();
+    worker_thread_.reset();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  while (!input_frames_.empty()) {
+    input_frames_.pop();
+  }
+}
+
+int VideoEncodeWorker::EncodeFrame(const SharedVideoFrame& frame) {
+  if (!frame) {
+    LOG(ERROR) << "VideoEncodeWorker cannot encode NULL frame.";
+    return kInvalidArg;
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (block_when_full_) {
+      worker_progress_.wait(lock, [this] {
+        return stop_ || worker_done_ ||
+               input_frames_.size() < max_input_frames_;
+      });
+    }
+    if (input_frames_.size() >= max_input_frames_) {
+      VLOG(1) << "VideoEncodeWorker dropped frame (queue full).";
+      ptr_frames_dropped_->Increment(1);
+      return kDropped;
+    }
+    input_frames_.push(frame);
+  }
+  if (strand_) {
+    strand_->Post(TaskDeadline(),
+                  std::bind(&VideoEncodeWorker::EncodeTask, this));
+  } else {
+    input_ready_.notify_one();
+  }
+  return kSuccess;
+}
+
+void VideoEncodeWorker::Drain() {
+  if (strand_) {
+    // Waiting for tasks could need this thread; take over the queue instead.
+    strand_->Cancel();
+    for (;;) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stop_ || worker_done_ || input_frames_.empty())
+          return;
+      }
+      EncodeTask();
+    }
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  worker_progress_.wait(lock, [this] {
+    return stop_ || worker_done_ || (input_frames_.empty() && !busy_);
+  });
+}
+
+bool VideoEncodeWorker::InputFull() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return input_frames_.size() >= max_input_frames_;
+}
+
+int VideoEncodeWorker::ReadEncodedFrame(VideoFrame* ptr_frame) {
+  const int status = output_pool_.Decommit(ptr_frame);
+  if (status == BufferPool<VideoFrame>::kEmpty) {
+    return kNoFrames;
+  } else if (status) {
+    LOG(ERROR) << "VideoEncodeWorker output Decommit failed: " << status;
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+int VideoEncodeWorker::SetTargetBitrate(int kbps) {
+  if (video_encoder_.SetTargetBitrate(kbps)) {
+    return kInvalidArg;
+  }
+  return kSuccess;
+}
+
+int VideoEncodeWorker::CheckStatus() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return status_;
+}
+
+bool VideoEncodeWorker::StopRequested() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stop_;
+}
+
+SharedVideoFrame VideoEncodeWorker::WaitForInput() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  busy_ = false;
+  worker_progress_.notify_all();
+  input_ready_.wait_for(lock, std::chrono::milliseconds(kMaxIdleWaitMs),
+                        [this] { return stop_ || !input_frames_.empty(); });
+  SharedVideoFrame frame;
+  if (!stop_ && !input_frames_.empty()) {
+    frame = input_frames_.front();
+    input_frames_.pop();
+    busy_ = true;
+    worker_progress_.notify_all();
+  }
+  return frame;
+}
+
+int VideoEncodeWorker::CommitEncodedFrames(bool have_frame) {
+  for (;;) {
+    if (!have_frame) {
+      const int status = video_encoder_.ReadQueuedFrame(&vpx_frame_);
+      if (status == VideoEncoder::kNoFrame) {
+        return kSuccess;
+      } else if (status) {
+        LOG(ERROR) << "VideoEncodeWorker ReadQueuedFrame failed: " << status;
+        return kVideoEncoderError;
+      }
+    }
+    have_frame = false;
+    LatencyTracer::Stamp(LatencyTracer::kEncode, vpx_frame_.timestamp());
+    if (vpx_frame_.buffer_capacity() > frame_bytes_)
+      frame_bytes_ = vpx_frame_.buffer_capacity();
+    const int status = output_pool_.Commit(&vpx_frame_);
+    if (status) {
+      LOG(ERROR) << "VideoEncodeWorker output Commit failed: " << status;
+      return kNoMemory;
+    }
+    ptr_memory_->Set(static_cast<int64>(output_pool_.Capacity() + 1) *
+                     frame_bytes_);
+  }
+}
+
+int VideoEncodeWorker::EncodeRawFrame(SharedVideoFrame raw_frame) {
+  if (scaler_.NeedsScaling(*raw_frame)) {
+    SharedVideoFrame scaled_frame;
+    const int status = scaler_.Scale(*raw_frame, &scaled_frame);
+    if (status) {
+      LOG(ERROR) << "VideoEncodeWorker Scale failed: " << status;
+      return kVideoEncoderError;
+    }
+    raw_frame = scaled_frame;
+  }
+
+  const std::chrono::steady_clock::time_point encode_start =
+      std::chrono::steady_clock::now();
+  WEBMLIVE_TRACE_FRAME(encode_start, trace_stream_id_, raw_frame->timestamp());
+  const int status = video_encoder_.EncodeFrame(*raw_frame, &vpx_frame_);
+  WEBMLIVE_TRACE_FRAME(encode_end, trace_stream_id_, raw_frame->timestamp());
+  ptr_encode_time_us_->Increment(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - encode_start).count());
+  ptr_frames_encoded_->Increment(1);
+  if (status == VideoEncoder::kDropped) {
+    return kSuccess;
+  } else if (status) {
+    LOG(ERROR) << "VideoEncodeWorker EncodeFrame failed: " << status;
+    return kVideoEncoderError;
+  }
+  return CommitEncodedFrames(true);
+}
+
+void VideoEncodeWorker::FinishEncode(int status) {
+  // Compress the frames held back for lookahead.
+  if (status == kSuccess) {
+    if (video_encoder_.Flush()) {
+      LOG(ERROR) << "VideoEncodeWorker encoder Flush failed.";
+      status = kVideoEncoderError;
+    } else {
+      status = CommitEncodedFrames(false);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    status_ = status;
+    busy_ = false;
+    worker_done_ = true;
+  }
+  worker_progress_.notify_all();
+}
+
+void VideoEncodeWorker::EncodeTask() {
+  ScopedCpuStage cpu_stage(kCpuVideoEncode);
+  SharedVideoFrame raw_frame;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_ || worker_done_ || input_frames_.empty()) {
+      return;
+    }
+    raw_frame = input_frames_.front();
+    input_frames_.pop();
+    busy_ = true;
+  }
+
+  const int status = EncodeRawFrame(raw_frame);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    busy_ = false;
+    if (status) {
+      status_ = status;
+      worker_done_ = true;
+    }
+  }
+  worker_progress_.notify_all();
+  if (output_callback_) {
+    output_callback_();
+  }
+}
+
+int64 VideoEncodeWorker::TaskDeadline() const {
+  const double frame_rate = output_config_.frame_rate;
+  const int64 interval_ms = frame_rate > 0 ?
+      static_cast<int64>(1000 / frame_rate) : kMaxIdleWaitMs;
+  return TaskScheduler::NowMilliseconds() + interval_ms;
+}
+
+void VideoEncodeWorker::WorkerThread() {
+  LOG(INFO) << "VideoEncodeWorker thread started for "
+            << output_config_.width << "x" << output_config_.height;
+  ThreadPlacement::Instance().PlaceCurrentThread(
+      ThreadPlacement::kVideoEncode);
+  ScopedCpuStage cpu_stage(kCpuVideoEncode);
+  int status = kSuccess;
+  while (!StopRequested()) {
+    SharedVideoFrame raw_frame = WaitForInput();
+    if (!raw_frame) {
+      continue;
+    }
+    status = EncodeRawFrame(raw_frame);
+    if (status) {
+      break;
+    }
+  }
+  FinishEncode(status);
+  LOG(INFO) << "VideoEncodeWorker thread finished, status="
+            << CheckStatus();
+}
+
+}  // namespace webmlive
@@ -0,0 +1,239 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_VIDEO_ENCODE_WORKER_H_
+#define WEBMLIVE_ENCODER_VIDEO_ENCODE_WORKER_H_
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/buffer_pool.h"
+#include "encoder/encoder_base.h"
+#include "encoder/task_scheduler.h"
+#include "encoder/video_encoder.h"
+#include "encoder/video_frame_pool.h"
+#include "encoder/video_scaler.h"
+#include "encoder/webm_encoder.h"
+
+namespace webmlive {
+
+class MemoryAccount;
+class Metric;
+
+// Encodes one video representation of an encode on its own thread. Shared
+// raw frames are passed in via |EncodeFrame()|, scaled to the representation
+// size when necessary, compressed, and made available to the caller via
+// |ReadEncodedFrame()|. Raw frames are only read, so one
+// |SharedVideoFrame| can be passed to every worker of an encode.
+//
+// Notes
+// - |EncodeFrame()| and |ReadEncodedFrame()| must be called from the same
+//   thread; |WebmEncoder::EncoderThread()| in practice.
+// - Only I420 and YV12 input is supported.
+// - With |WebmEncoderConfig::task_scheduler| set, each frame is compressed
+//   by a task on the scheduler instead of on a worker thread. |EncodeFrame()|
+//   then never waits for room; callers check |InputFull()| instead.
+class VideoEncodeWorker {
+ public:
+  enum {
+    // Worker thread could not be started.
+    kThreadError = -4,
+    // Scaling or encoding a frame failed.
+    kVideoEncoderError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+    // Frame dropped by |EncodeFrame()| because the worker is behind.
+    kDropped = 1,
+    // No compressed frames available from |ReadEncodedFrame()|.
+    kNoFrames = 2,
+  };
+
+  // Maximum time the worker thread sleeps while waiting for input. Bounds
+  // the delay in noticing |Stop()|.
+  static const int kMaxIdleWaitMs = 100;
+
+  VideoEncodeWorker();
+  ~VideoEncodeWorker();
+
+  // Initializes the frame pools and the video encoder for |representation|.
+  // Zero width, height or bitrate values in |representation| are replaced with
+  // the capture width, capture height and |vpx_config.bitrate| values from
+  // |config|, and the codec is |RepresentationCodec()|. Returns |kSuccess|
+  // when successful.
+  int Init(const WebmEncoderConfig& config,
+           const VideoRepresentationConfig& representation);
+
+  // Sets a function called after compressed frames are made available to
+  // |ReadEncodedFrame()|. Only called when the worker runs on a task
+  // scheduler, from its tasks. Must be called before |Run()|.
+  void set_output_callback(const std::function<void()>& callback) {
+    output_callback_ = callback;
+  }
+
+  // Starts the worker thread, or prepares the task strand when running on a
+  // task scheduler. Returns |kSuccess| when successful.
+  int Run();
+
+  // Stops and joins the worker thread. Frames waiting in |input_frames_| are
+  // released.
+  void Stop();
+
+  // Queues |frame| for encoding. The worker holds its reference until the
+  // frame has been encoded. Returns |kSuccess| when the frame is queued, or
+  // |kDropped| when the worker has no room for it. Waits for room instead of
+  // dropping when |WebmEncoderConfig::input_paced| is false.
+  int EncodeFrame(const SharedVideoFrame& frame);
+
+  // Waits until every frame passed to |EncodeFrame()| has been compressed,
+  // or until the worker thread stops. On a task scheduler the frames not yet
+  // started are compressed on the calling thread.
+  void Drain();
+
+  // Returns true when |EncodeFrame()| has no room for another frame.
+  bool InputFull() const;
+
+  // Reads the next compressed frame into |ptr_frame|. Returns |kSuccess| when
+  // a frame is available, and |kNoFrames| when there are none.
+  int ReadEncodedFrame(VideoFrame* ptr_frame);
+
+  // Changes the representation bitrate. Thread safe; see
+  // |VideoEncoder::SetTargetBitrate()|. |bitrate()| keeps the initial value.
+  int SetTargetBitrate(int kbps);
+
+  // Forces a keyframe at the first frame at or after |timestamp|. Thread
+  // safe.
+  void RequestKeyframe(int64 timestamp) {
+    video_encoder_.RequestKeyframe(timestamp);
+  }
+
+  // Trades quality for encode speed; see |VideoEncoder::SetSpeedBoost()|.
+  // Thread safe.
+  void SetSpeedBoost(int steps) {
+    video_encoder_.SetSpeedBoost(steps);
+  }
+
+  // Returns |kSuccess| while the worker thread is healthy, or the error that
+  // stopped it.
+  int CheckStatus() const;
+
+  // Replaces the contents of |ptr_data| with the WebM CodecPrivate of the
+  // representation; see |VideoEncoder::GetCodecPrivate()|.
+  void GetCodecPrivate(std::vector<uint8>* ptr_data) const {
+    video_encoder_.GetCodecPrivate(ptr_data);
+  }
+
+  // Returns the settings actually used for the representation.
+  const VideoConfig& output_config() const { return output_config_; }
+  int bitrate() const { return config_.vpx_config.bitrate; }
+  VideoFormat codec() const { return config_.vpx_config.codec; }
+
+ private:
+  // Returns true when |Stop()| has been called.
+  bool StopRequested() const;
+
+  // Idles the worker thread until |EncodeFrame()| or |Stop()| signals it, or
+  // until |kMaxIdleWaitMs| elapses. Returns the next frame from
+  // |input_frames_|, or an empty handle when none is available.
+  SharedVideoFrame WaitForInput();
+
+  // Moves the compressed frames the encoder has ready into |output_pool_|.
+  // |have_frame| means |vpx_frame_| already holds the first of them.
+  int CommitEncodedFrames(bool have_frame);
+
+  // Scales, compresses and commits |raw_frame|. Returns |kSuccess| when
+  // successful.
+  int EncodeRawFrame(SharedVideoFrame raw_frame);
+
+  // Compresses the frames held back for lookahead when |status| is
+  // |kSuccess|, and records the final status.
+  void FinishEncode(int status);
+
+  // Task scheduler task: compresses the next frame in |input_frames_|.
+  void EncodeTask();
+
+  // Returns the deadline of the task compressing a frame queued now: one
+  // frame interval away.
+  int64 TaskDeadline() const;
+
+  // Worker thread function.
+  void WorkerThread();
+
+  // Copy of the encoder configuration with the representation settings
+  // applied. Passed to |video_encoder_|.
+  WebmEncoderConfig config_;
+
+  // Size and format of frames passed to |video_encoder_|.
+  VideoConfig output_config_;
+
+  // Maximum length of |input_frames_|.
+  size_t max_input_frames_;
+
+  // Compressed frames waiting for the caller.
+  BufferPool<VideoFrame> output_pool_;
+
+  // Scales raw frames to the size in |output_config_|.
+  VideoScaler scaler_;
+
+  // Frame storage owned by the worker thread.
+  VideoFrame vpx_frame_;
+  VideoEncoder video_encoder_;
+
+  // True when |EncodeFrame()| waits for room in |input_frames_| instead of
+  // dropping frames.
+  bool block_when_full_;
+
+  // Raw frames waiting for the worker thread, stop flag, wake up events and
+  // worker status. |busy_| is true while the worker thread compresses a
+  // frame, and |worker_done_| once it has exited. |worker_progress_| is
+  // signaled when the worker thread takes a frame, goes idle, or exits. All
+  // protected by |mutex_|.
+  mutable std::mutex mutex_;
+  std::condition_variable input_ready_;
+  std::condition_variable worker_progress_;
+  std::queue<SharedVideoFrame> input_frames_;
+  bool stop_;
+  bool busy_;
+  bool worker_done_;
+  int status_;
+
+  // Metrics exported through |MetricsRegistry|, labelled with the
+  // representation size: frames compressed, the time spent compressing them
+  // in microseconds, and frames |EncodeFrame()| dropped.
+  Metric* ptr_frames_encoded_;
+  Metric* ptr_encode_time_us_;
+  Metric* ptr_frames_dropped_;
+
+  // Bytes of |output_pool_| and |vpx_frame_|, counted at the capacity of the
+  // largest compressed frame seen in |frame_bytes_|. Used only by the worker
+  // thread once |Run()| is called.
+  MemoryAccount* ptr_memory_;
+  int32 frame_bytes_;
+
+  // Id of the representation passed to the tracepoints.
+  int32 trace_stream_id_;
+
+  // Called after frames are committed to |output_pool_| by |EncodeTask()|.
+  std::function<void()> output_callback_;
+
+  // Runs |EncodeTask()| on |WebmEncoderConfig::task_scheduler|; NULL when
+  // the worker has its own thread.
+  std::unique_ptr<TaskStrand> strand_;
+
+  std::shared_ptr<std::thread> worker_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VideoEncodeWorker);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_VIDEO_ENCODE_WORKER_H_
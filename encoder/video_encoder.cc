@@ -7,11 +7,16 @@
 // be found in the AUTHORS file in the root of the source tree.
 #include "encoder/video_encoder.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <new>
+#include <utility>
+#include <vector>
 
 #include "glog/logging.h"
 #include "libyuv/convert.h"
 #include "libyuv/planar_functions.h"
+#include "libyuv/scale.h"
 #include "libyuv/video_common.h"
 
 #if defined _MSC_VER
@@ -20,10 +25,51 @@
 // vp8.h and vp8cx.h (included by vpx_encoder.h).
 #pragma warning(disable:4505)
 #endif
+#include "encoder/encoder_context_pool.h"
+#include "encoder/slice_pool.h"
+#include "encoder/v210_unpack.h"
+#include "encoder/video_ingest_plan.h"
+#include "encoder/video_surface.h"
 #include "encoder/vpx_encoder.h"
+#include "encoder/webm_encoder.h"
+#if defined WEBMLIVE_HAVE_VAAPI
+#include "encoder/linux/vaapi_vp9_encoder.h"
+#endif
+#if defined WEBMLIVE_HAVE_LIBAOM
+#include "encoder/aom_encoder.h"
+#endif
 
 namespace webmlive {
 
+namespace {
+
+// Minimum number of chroma rows, two luma rows each, converted per slice by
+// |VideoFrame::ConvertToI420()| when the frame is split among |SlicePool|
+// threads.
+const int32 kMinSliceChromaRows = 16;
+
+// Bounds of |CompressedFrameCapacity()|, and the keyframe size, in percent of
+// the average frame size, assumed when |VpxConfig::max_keyframe_bitrate| sets
+// no limit.
+const int32 kMinCompressedFrameCapacity = 16 * 1024;
+const int64 kMaxCompressedFrameCapacity = 16 * 1024 * 1024;
+const int kDefaultKeyframeSizePercent = 300;
+
+// Four character code of V210, which libyuv does not define.
+const uint32 kFourCCV210 = FOURCC('v', '2', '1', '0');
+
+// Returns the greatest common divisor of |a| and |b|.
+int32 GreatestCommonDivisor(int32 a, int32 b) {
+  while (b != 0) {
+    const int32 remainder = a % b;
+    a = b;
+    b = remainder;
+  }
+  return a;
+}
+
+}  // namespace
+
 bool FourCCToVideoFormat(uint32 fourcc,
                          uint16 bits_per_pixel,
                          VideoFormat* ptr_format) {
@@ -51,6 +97,31 @@ bool FourCCToVideoFormat(uint32 fourcc,
           converted = true;
         }
         break;
+      case libyuv::FOURCC_NV12:
+        if (bits_per_pixel == kNV12BitCount) {
+          *ptr_format = kVideoFormatNV12;
+          converted = true;
+        }
+        break;
+      case libyuv::FOURCC_NV21:
+        if (bits_per_pixel == kNV21BitCount) {
+          *ptr_format = kVideoFormatNV21;
+          converted = true;
+        }
+        break;
+#ifdef WEBMLIVE_HAVE_MJPEG
+      // Bit counts of MJPEG media types vary by device, and mean nothing.
+      case libyuv::FOURCC_MJPG:
+        *ptr_format = kVideoFormatMJPEG;
+        converted = true;
+        break;
+#endif
+      // Drivers report 20 or |kV210BitCount| bits per pixel for V210; the four
+      // character code alone describes the layout.
+      case kFourCCV210:
+        *ptr_format = kVideoFormatV210;
+        converted = true;
+        break;
       case libyuv::FOURCC_YUY2:
         if (bits_per_pixel == kYUY2BitCount) {
           *ptr_format = kVideoFormatYUY2;
@@ -76,12 +147,42 @@ bool FourCCToVideoFormat(uint32 fourcc,
   return converted;
 }
 
+int32 CompressedFrameCapacity(const VpxConfig& vpx_config,
+                              const VideoConfig& video_config) {
+  const double frame_rate =
+      video_config.frame_rate > 0 ? video_config.frame_rate : 30.0;
+  const int keyframe_percent =
+      vpx_config.max_keyframe_bitrate > 100 ?
+          vpx_config.max_keyframe_bitrate : kDefaultKeyframeSizePercent;
+
+  // Twice the largest keyframe rate control should allow.
+  int64 capacity = static_cast<int64>(
+      vpx_config.bitrate * 1000.0 / 8 / frame_rate * keyframe_percent / 100 *
+      2);
+  if (video_config.width > 0 && video_config.height > 0) {
+    capacity = std::min<int64>(
+        capacity, VideoFrame::PlanarFrameSize(
+            VideoFrame::AlignedStride(video_config.width),
+            video_config.height));
+  }
+  capacity = std::min(capacity, kMaxCompressedFrameCapacity);
+  return static_cast<int32>(std::max<int64>(capacity,
+                                            kMinCompressedFrameCapacity));
+}
+
 VideoFrame::VideoFrame()
     : keyframe_(false),
+      temporal_layer_(0),
+      spatial_layer_(0),
       timestamp_(0),
       duration_(0),
+      timestamp_us_(0),
+      duration_us_(0),
+      capture_time_ms_(0),
       buffer_capacity_(0),
-      buffer_length_(0) {
+      buffer_length_(0),
+      external_planes_(false),
+      strip_buffer_capacity_(0) {
 }
 
 VideoFrame::~VideoFrame() {
@@ -93,70 +194,465 @@ int VideoFrame::Init(const VideoConfig& config,
                      int64 duration,
                      const uint8* ptr_data,
                      int32 data_length) {
+  VideoIngestPlan plan;
+  if (plan.Init(config, config.width, abs(config.height))) {
+    return kConversionFailed;
+  }
+  return Init(plan, keyframe, timestamp, duration, ptr_data, data_length);
+}
+
+int VideoFrame::InitScaled(const VideoConfig& config,
+                           bool keyframe,
+                           int64 timestamp,
+                           int64 duration,
+                           const uint8* ptr_data,
+                           int32 width,
+                           int32 height) {
+  VideoIngestPlan plan;
+  if (!NeedsConversion(config.format) || plan.Init(config, width, height) ||
+      (plan.action() != VideoIngestPlan::kConvert &&
+       plan.action() != VideoIngestPlan::kConvertScaled)) {
+    LOG(ERROR) << "VideoFrame can't InitScaled format " << config.format
+               << " to " << width << "x" << height;
+    return kInvalidArg;
+  }
+  return Init(plan, keyframe, timestamp, duration, ptr_data, 0);
+}
+
+int VideoFrame::Init(const VideoIngestPlan& plan,
+                     bool keyframe,
+                     int64 timestamp,
+                     int64 duration,
+                     const uint8* ptr_data,
+                     int32 data_length) {
   if (!ptr_data) {
     LOG(ERROR) << "VideoFrame can't Init with NULL data pointer.";
     return kInvalidArg;
   }
 
-  const bool needs_conversion =
-      (config.format != kVideoFormatI420 &&
-       config.format != kVideoFormatYV12 &&
-       config.format != kVideoFormatVP8 &&
-       config.format != kVideoFormatVP9);
-
-  if (needs_conversion) {
-    // Convert the video frame to I420.
-    const int32 status = ConvertToI420(config, ptr_data);
-    if (status) {
-      LOG(ERROR) << "Video format conversion failed " << status;
-      return status;
-    }
-  } else {
-    // Data does not need conversion: copy directly into |buffer_|.
-    if (data_length > buffer_capacity_) {
-      buffer_.reset(new (std::nothrow) uint8[data_length]);  // NOLINT
-      if (!buffer_) {
-        LOG(ERROR) << "VideoFrame Init cannot allocate buffer.";
-        return kNoMemory;
+  const VideoConfig& config = plan.source_config();
+  int32 status = kSuccess;
+  switch (plan.action()) {
+    case VideoIngestPlan::kCopy:
+      // Data does not need conversion: copy directly into |buffer_|.
+      if (data_length > buffer_capacity_) {
+        buffer_.reset(AllocateBuffer(data_length));
+        if (!buffer_) {
+          LOG(ERROR) << "VideoFrame Init cannot allocate buffer.";
+          return kNoMemory;
+        }
+        buffer_capacity_ = data_length;
       }
-      buffer_capacity_ = data_length;
+      memcpy(buffer_.get(), ptr_data, data_length);
+      buffer_length_ = data_length;
+      config_ = config;
+      break;
+    case VideoIngestPlan::kConvert:
+    case VideoIngestPlan::kConvertScaled:
+      status = ConvertToI420(plan, ptr_data);
+      break;
+    case VideoIngestPlan::kDecodeMjpeg:
+      status = DecodeMjpegToI420(config, ptr_data, data_length);
+      break;
+    case VideoIngestPlan::kUnpackV210:
+      status = UnpackV210ToI42016(config, ptr_data, data_length);
+      break;
+  }
+  if (status) {
+    LOG(ERROR) << "Video format conversion failed " << status;
+    return status;
+  }
+  keyframe_ = keyframe || IsVpxKeyframe(config.format, ptr_data, data_length);
+  timestamp_ = timestamp;
+  duration_ = duration;
+  timestamp_us_ = timestamp * 1000;
+  duration_us_ = duration * 1000;
+  temporal_layer_ = 0;
+  spatial_layer_ = 0;
+  region_hints_.valid = false;
+  region_hints_.changed_regions.clear();
+  analysis_.valid = false;
+  capture_time_ms_ = 0;
+  ReleasePlanes();
+  return kSuccess;
+}
+
+int VideoFrame::InitInPlace(const VideoConfig& config,
+                            bool keyframe,
+                            int64 timestamp,
+                            int64 duration,
+                            int32 data_length) {
+  if (!buffer_ || data_length <= 0 || data_length > buffer_capacity_) {
+    LOG(ERROR) << "VideoFrame can't InitInPlace without a large enough buffer.";
+    return kInvalidArg;
+  }
+  if (NeedsConversion(config.format)) {
+    LOG(ERROR) << "VideoFrame can't InitInPlace with format " << config.format;
+    return kInvalidArg;
+  }
+  buffer_length_ = data_length;
+  config_ = config;
+  keyframe_ = keyframe;
+  timestamp_ = timestamp;
+  duration_ = duration;
+  timestamp_us_ = timestamp * 1000;
+  duration_us_ = duration * 1000;
+  temporal_layer_ = 0;
+  spatial_layer_ = 0;
+  region_hints_.valid = false;
+  region_hints_.changed_regions.clear();
+  analysis_.valid = false;
+  capture_time_ms_ = 0;
+  ReleasePlanes();
+  return kSuccess;
+}
+
+int VideoFrame::InitPlanes(const VideoConfig& config,
+                           bool keyframe,
+                           int64 timestamp,
+                           int64 duration,
+                           const VideoPlane* ptr_planes,
+                           const std::shared_ptr<void>& owner) {
+  if (!ptr_planes || (config.format != kVideoFormatI420 &&
+                      config.format != kVideoFormatYV12 &&
+                      config.format != kVideoFormatI42016)) {
+    LOG(ERROR) << "VideoFrame can't InitPlanes with format " << config.format;
+    return kInvalidArg;
+  }
+  const int32 bytes_per_sample = config.format == kVideoFormatI42016 ? 2 : 1;
+  const int32 height = abs(config.height);
+  for (int i = 0; i < kNumPlanes; ++i) {
+    const VideoPlane& plane = ptr_planes[i];
+    const int32 row_bytes = bytes_per_sample *
+        (i == kPlaneY ? config.width : (config.width + 1) / 2);
+    const int32 rows = i == kPlaneY ? height : (height + 1) / 2;
+    if (config.width <= 0 || !plane.data || plane.stride < row_bytes ||
+        static_cast<int64>(plane.stride) * (rows - 1) + row_bytes >
+            plane.size) {
+      LOG(ERROR) << "VideoFrame can't InitPlanes: plane " << i
+                 << " too small for " << config.width << "x" << height;
+      return kInvalidArg;
     }
-    memcpy(buffer_.get(), ptr_data, data_length);
-    buffer_length_ = data_length;
-    config_ = config;
   }
+  for (int i = 0; i < kNumPlanes; ++i) {
+    planes_[i] = ptr_planes[i];
+  }
+  plane_owner_ = owner;
+  external_planes_ = true;
+  buffer_length_ = 0;
+  config_ = config;
+  config_.stride = ptr_planes[kPlaneY].stride;
   keyframe_ = keyframe;
   timestamp_ = timestamp;
   duration_ = duration;
+  timestamp_us_ = timestamp * 1000;
+  duration_us_ = duration * 1000;
+  temporal_layer_ = 0;
+  spatial_layer_ = 0;
+  region_hints_.valid = false;
+  region_hints_.changed_regions.clear();
+  analysis_.valid = false;
+  capture_time_ms_ = 0;
+  surface_.reset();
+  return kSuccess;
+}
+
+int VideoFrame::InitSurface(const VideoConfig& config,
+                            bool keyframe,
+                            int64 timestamp,
+                            int64 duration,
+                            const std::shared_ptr<VideoSurface>& surface) {
+  if (!surface || config.format != kVideoFormatI420 ||
+      config.width != surface->width() ||
+      abs(config.height) != surface->height()) {
+    LOG(ERROR) << "VideoFrame can't InitSurface with format "
+               << config.format << " at " << config.width << "x"
+               << config.height;
+    return kInvalidArg;
+  }
+  ReleasePlanes();
+  surface_ = surface;
+  buffer_length_ = 0;
+  config_ = config;
+  config_.stride = 0;
+  keyframe_ = keyframe;
+  timestamp_ = timestamp;
+  duration_ = duration;
+  timestamp_us_ = timestamp * 1000;
+  duration_us_ = duration * 1000;
+  temporal_layer_ = 0;
+  spatial_layer_ = 0;
+  region_hints_.valid = false;
+  region_hints_.changed_regions.clear();
+  analysis_.valid = false;
+  capture_time_ms_ = 0;
+  return kSuccess;
+}
+
+VideoPlane VideoFrame::plane(int index) const {
+  VideoPlane plane;
+  if (index < 0 || index >= kNumPlanes) {
+    return plane;
+  }
+  if (external_planes_) {
+    return planes_[index];
+  }
+  if (!buffer_ || surface_ || (config_.format != kVideoFormatI420 &&
+                   config_.format != kVideoFormatYV12 &&
+                   config_.format != kVideoFormatI42016)) {
+    return plane;
+  }
+
+  // Chroma planes follow the luma plane, V first for YV12.
+  const int32 y_stride = stride();
+  const int32 height = abs(config_.height);
+  const int32 uv_stride = y_stride / 2;
+  const int32 uv_size = uv_stride * ((height + 1) / 2);
+  const bool u_first = config_.format != kVideoFormatYV12;
+  if (index == kPlaneY) {
+    plane.data = buffer_.get();
+    plane.stride = y_stride;
+    plane.size = y_stride * height;
+  } else {
+    const bool first = (index == kPlaneU) == u_first;
+    plane.data = buffer_.get() + y_stride * height + (first ? 0 : uv_size);
+    plane.stride = uv_stride;
+    plane.size = uv_size;
+  }
+  return plane;
+}
+
+int VideoFrame::Pack() {
+  if (!external_planes_ && !surface_) {
+    return kSuccess;
+  }
+  const int32 bytes_per_sample = config_.format == kVideoFormatI42016 ? 2 : 1;
+  const int32 dest_stride = AlignedStride(config_.width) * bytes_per_sample;
+  const int32 height = abs(config_.height);
+  const int32 size = PlanarFrameSize(dest_stride, height);
+  if (Allocate(size)) {
+    return kNoMemory;
+  }
+  if (surface_) {
+    uint8* const ptr_y = buffer_.get();
+    uint8* const ptr_u = ptr_y + dest_stride * height;
+    uint8* const ptr_v = ptr_u + dest_stride / 2 * ((height + 1) / 2);
+    const int status =
+        surface_->Read(ptr_y, dest_stride, ptr_u, ptr_v, dest_stride / 2);
+    if (status) {
+      LOG(ERROR) << "VideoFrame cannot read surface: " << status;
+      return kConversionFailed;
+    }
+  } else {
+    CopyPlanes(buffer_.get(), dest_stride);
+  }
+  buffer_length_ = size;
+  config_.stride = dest_stride;
+  ReleasePlanes();
   return kSuccess;
 }
 
+void VideoFrame::CopyPlanes(uint8* ptr_dest, int32 dest_stride) const {
+  const int32 bytes_per_sample = config_.format == kVideoFormatI42016 ? 2 : 1;
+  const int32 height = abs(config_.height);
+  const int32 uv_height = (height + 1) / 2;
+  const int32 dest_uv_stride = dest_stride / 2;
+  const bool u_first = config_.format != kVideoFormatYV12;
+  const int kMemoryOrder[kNumPlanes] = {
+    kPlaneY, u_first ? kPlaneU : kPlaneV, u_first ? kPlaneV : kPlaneU,
+  };
+  uint8* ptr_row = ptr_dest;
+  for (int i = 0; i < kNumPlanes; ++i) {
+    const VideoPlane source = plane(kMemoryOrder[i]);
+    const bool luma = i == 0;
+    const int32 rows = luma ? height : uv_height;
+    const int32 row_bytes = bytes_per_sample *
+        (luma ? config_.width : (config_.width + 1) / 2);
+    const int32 stride = luma ? dest_stride : dest_uv_stride;
+    for (int32 row = 0; row < rows; ++row) {
+      memcpy(ptr_row, source.data + row * source.stride, row_bytes);
+      ptr_row += stride;
+    }
+  }
+}
+
+void VideoFrame::ReleasePlanes() {
+  surface_.reset();
+  if (!external_planes_) {
+    return;
+  }
+  external_planes_ = false;
+  for (int i = 0; i < kNumPlanes; ++i) {
+    planes_[i] = VideoPlane();
+  }
+  plane_owner_.reset();
+}
+
+void VideoFrame::Free() {
+  ReleasePlanes();
+  buffer_.reset();
+  buffer_capacity_ = 0;
+  buffer_length_ = 0;
+  strip_buffer_.reset();
+  strip_buffer_capacity_ = 0;
+}
+
+void VideoFrame::SetTimeUs(int64 timestamp_us, int64 duration_us) {
+  timestamp_us_ = timestamp_us;
+  duration_us_ = duration_us;
+  timestamp_ = MicrosecondsToMilliseconds(timestamp_us);
+  duration_ =
+      MicrosecondsToMilliseconds(timestamp_us + duration_us) - timestamp_;
+}
+
+int VideoFrame::Allocate(int32 capacity) {
+  if (capacity <= 0) {
+    LOG(ERROR) << "VideoFrame can't Allocate " << capacity << " bytes.";
+    return kInvalidArg;
+  }
+  if (capacity > buffer_capacity_ || !buffer_) {
+    buffer_.reset(AllocateBuffer(capacity));
+    if (!buffer_) {
+      LOG(ERROR) << "VideoFrame Allocate cannot allocate buffer.";
+      buffer_capacity_ = 0;
+      buffer_length_ = 0;
+      return kNoMemory;
+    }
+    buffer_capacity_ = capacity;
+    buffer_length_ = 0;
+  }
+  return kSuccess;
+}
+
+int32 VideoFrame::AlignedStride(int32 width) {
+  return (width + kVideoStrideAlignment - 1) & ~(kVideoStrideAlignment - 1);
+}
+
+int32 VideoFrame::PlanarFrameSize(int32 stride, int32 height) {
+  return stride * height + 2 * (stride / 2) * ((height + 1) / 2);
+}
+
+void VideoFrame::ScaleStripRows(int32 src_height, int32 dst_height,
+                                int32 min_src_rows,
+                                int32* ptr_src_rows, int32* ptr_dst_rows) {
+  *ptr_src_rows = src_height;
+  *ptr_dst_rows = dst_height;
+  const int32 divisor = GreatestCommonDivisor(src_height, dst_height);
+  const int32 unit_src_rows = src_height / divisor;
+  const int32 unit_dst_rows = dst_height / divisor;
+  for (int32 units = 1; units < divisor; ++units) {
+    const int32 src_rows = unit_src_rows * units;
+    const int32 dst_rows = unit_dst_rows * units;
+    if (divisor % units == 0 && src_rows % 2 == 0 && dst_rows % 2 == 0 &&
+        src_rows >= min_src_rows) {
+      *ptr_src_rows = src_rows;
+      *ptr_dst_rows = dst_rows;
+      return;
+    }
+  }
+}
+
+uint8* VideoFrame::AllocateBuffer(int32 size) {
+  static_assert(SlabAllocator::kAlignment % kVideoBufferAlignment == 0,
+                "SlabAllocator blocks must meet kVideoBufferAlignment.");
+  return SlabAllocator::Instance().Allocate(size);
+}
+
+bool VideoFrame::NeedsConversion(VideoFormat format) {
+  return (format != kVideoFormatI420 &&
+          format != kVideoFormatYV12 &&
+          format != kVideoFormatI42016 &&
+          format != kVideoFormatVP8 &&
+          format != kVideoFormatVP9 &&
+          format != kVideoFormatAV1);
+}
+
+VideoFormat VideoFrame::ConvertedFormat(VideoFormat format) {
+  if (!NeedsConversion(format)) {
+    return format;
+  }
+  return format == kVideoFormatV210 ? kVideoFormatI42016 : kVideoFormatI420;
+}
+
+// VP8 frames begin with a 3 byte frame tag whose lowest bit is 0 for
+// keyframes. VP9 frames begin with an uncompressed header: a 2 bit frame
+// marker, the profile, a reserved bit in profile 3, show_existing_frame, and
+// then frame_type, which is 0 for keyframes. A superframe begins with its
+// first frame, the one a keyframe superframe is keyed by.
+bool VideoFrame::IsVpxKeyframe(VideoFormat format, const uint8* ptr_data,
+                               int32 data_length) {
+  if (!ptr_data || data_length < 1)
+    return false;
+  if (format == kVideoFormatVP8)
+    return data_length >= 3 && (ptr_data[0] & 0x01) == 0;
+  if (format != kVideoFormatVP9)
+    return false;
+  const uint8 header = ptr_data[0];
+  if ((header >> 6) != 2)
+    return false;
+  const int profile = ((header >> 5) & 1) | (((header >> 4) & 1) << 1);
+  // Bit position, from the most significant, of show_existing_frame.
+  const int show_existing_bit = profile == 3 ? 5 : 4;
+  if ((header >> (7 - show_existing_bit)) & 1)
+    return false;
+  return ((header >> (6 - show_existing_bit)) & 1) == 0;
+}
+
 int VideoFrame::Clone(VideoFrame* ptr_frame) const {
   if (!ptr_frame) {
     LOG(ERROR) << "cannot Clone to a NULL VideoFrame.";
     return kInvalidArg;
   }
-  if (buffer_.get() && buffer_capacity_ > 0) {
-    ptr_frame->buffer_.reset(
-        new (std::nothrow) uint8[buffer_capacity_]);  // NOLINT
+  if (external_planes_) {
+    const int32 bytes_per_sample =
+        config_.format == kVideoFormatI42016 ? 2 : 1;
+    const int32 dest_stride = AlignedStride(config_.width) * bytes_per_sample;
+    const int32 size = PlanarFrameSize(dest_stride, abs(config_.height));
+    ptr_frame->buffer_.reset(AllocateBuffer(size));
     if (!ptr_frame->buffer_) {
       LOG(ERROR) << "VideoFrame Clone cannot allocate buffer.";
       return kNoMemory;
     }
-    memcpy(ptr_frame->buffer_.get(), buffer_.get(), buffer_length_);
+    CopyPlanes(ptr_frame->buffer_.get(), dest_stride);
+    ptr_frame->buffer_capacity_ = size;
+    ptr_frame->buffer_length_ = size;
+    ptr_frame->config_ = config_;
+    ptr_frame->config_.stride = dest_stride;
+  } else if (surface_) {
+    // The target keeps its storage for later frames.
+    ptr_frame->buffer_length_ = 0;
+    ptr_frame->config_ = config_;
+  } else {
+    if (buffer_.get() && buffer_capacity_ > 0) {
+      ptr_frame->buffer_.reset(AllocateBuffer(buffer_capacity_));
+      if (!ptr_frame->buffer_) {
+        LOG(ERROR) << "VideoFrame Clone cannot allocate buffer.";
+        return kNoMemory;
+      }
+      memcpy(ptr_frame->buffer_.get(), buffer_.get(), buffer_length_);
+    }
+    ptr_frame->buffer_capacity_ = buffer_capacity_;
+    ptr_frame->buffer_length_ = buffer_length_;
+    ptr_frame->config_ = config_;
   }
-  ptr_frame->buffer_capacity_ = buffer_capacity_;
-  ptr_frame->buffer_length_ = buffer_length_;
-  ptr_frame->config_ = config_;
+  ptr_frame->ReleasePlanes();
+  ptr_frame->surface_ = surface_;
   ptr_frame->keyframe_ = keyframe_;
+  ptr_frame->temporal_layer_ = temporal_layer_;
+  ptr_frame->spatial_layer_ = spatial_layer_;
   ptr_frame->timestamp_ = timestamp_;
   ptr_frame->duration_ = duration_;
+  ptr_frame->timestamp_us_ = timestamp_us_;
+  ptr_frame->duration_us_ = duration_us_;
+  ptr_frame->region_hints_ = region_hints_;
+  ptr_frame->analysis_ = analysis_;
+  ptr_frame->capture_time_ms_ = capture_time_ms_;
   return kSuccess;
 }
 
 void VideoFrame::Swap(VideoFrame* ptr_frame) {
-  CHECK_NOTNULL(buffer_.get());
-  CHECK_NOTNULL(ptr_frame->buffer_.get());
+  CHECK(!empty());
+  CHECK(!ptr_frame->empty());
 
   const VideoConfig temp_config = config_;
   config_ = ptr_frame->config_;
@@ -166,6 +662,14 @@ void VideoFrame::Swap(VideoFrame* ptr_frame) {
   keyframe_ = ptr_frame->keyframe_;
   ptr_frame->keyframe_ = temp_keyframe;
 
+  int32 temp_layer = temporal_layer_;
+  temporal_layer_ = ptr_frame->temporal_layer_;
+  ptr_frame->temporal_layer_ = temp_layer;
+
+  temp_layer = spatial_layer_;
+  spatial_layer_ = ptr_frame->spatial_layer_;
+  ptr_frame->spatial_layer_ = temp_layer;
+
   int64 temp_time = timestamp_;
   timestamp_ = ptr_frame->timestamp_;
   ptr_frame->timestamp_ = temp_time;
@@ -174,6 +678,13 @@ void VideoFrame::Swap(VideoFrame* ptr_frame) {
   duration_ = ptr_frame->duration_;
   ptr_frame->duration_ = temp_time;
 
+  std::swap(timestamp_us_, ptr_frame->timestamp_us_);
+  std::swap(duration_us_, ptr_frame->duration_us_);
+
+  std::swap(region_hints_, ptr_frame->region_hints_);
+  std::swap(analysis_, ptr_frame->analysis_);
+  std::swap(capture_time_ms_, ptr_frame->capture_time_ms_);
+
   buffer_.swap(ptr_frame->buffer_);
 
   int32 temp = buffer_capacity_;
@@ -183,15 +694,21 @@ void VideoFrame::Swap(VideoFrame* ptr_frame) {
   temp = buffer_length_;
   buffer_length_ = ptr_frame->buffer_length_;
   ptr_frame->buffer_length_ = temp;
+
+  std::swap(external_planes_, ptr_frame->external_planes_);
+  for (int i = 0; i < kNumPlanes; ++i) {
+    std::swap(planes_[i], ptr_frame->planes_[i]);
+  }
+  plane_owner_.swap(ptr_frame->plane_owner_);
+  surface_.swap(ptr_frame->surface_);
 }
 
-int VideoFrame::ConvertToI420(const VideoConfig& source_config,
+int VideoFrame::ConvertToI420(const VideoIngestPlan& plan,
                               const uint8* ptr_data) {
   // Allocate storage for the I420 frame.
-  const int32 size_required =
-      source_config.width * source_config.height * 3 / 2;
+  const int32 size_required = plan.output_size();
   if (size_required > buffer_capacity_) {
-    buffer_.reset(new (std::nothrow) uint8[size_required]);  // NOLINT
+    buffer_.reset(AllocateBuffer(size_required));
     if (!buffer_) {
       LOG(ERROR) << "VideoFrame ConvertToI420 cannot allocate buffer.";
       return kNoMemory;
@@ -199,68 +716,219 @@ int VideoFrame::ConvertToI420(const VideoConfig& source_config,
     buffer_capacity_ = size_required;
   }
   buffer_length_ = size_required;
+  config_ = plan.output_config();
 
-  VideoConfig& target_config = config_;
-  target_config.format = kVideoFormatI420;
-  target_config.width = source_config.width;
-  target_config.height = abs(source_config.height);
-  target_config.stride = source_config.width;
-
-  // Calculate length and stride for the I420 planes.
-  const int32 y_length = source_config.width * target_config.height;
-  const int32 uv_stride = target_config.stride / 2;
-  const int32 uv_length = uv_stride * (target_config.height / 2);
-  CHECK_EQ(buffer_length_, y_length + (uv_length * 2));
+  if (plan.action() == VideoIngestPlan::kConvertScaled) {
+    return ConvertAndScaleToI420(plan, ptr_data);
+  }
 
   // Assign the pointers to the I420 planes.
+  const VideoIngestPlan::RowConverter convert_rows = plan.row_converter();
+  const int32 width = config_.width;
+  const int32 height = config_.height;
+  const int32 stride = config_.stride;
+  const int32 uv_stride = plan.uv_stride();
   uint8* const ptr_i420_y = buffer_.get();
-  uint8* const ptr_i420_u = ptr_i420_y + y_length;
-  uint8* const ptr_i420_v = ptr_i420_u + uv_length;
-
-  int status = kConversionFailed;
-  switch (source_config.format) {
-    case kVideoFormatYUY2:
-    case kVideoFormatYUYV:
-      status = libyuv::YUY2ToI420(ptr_data, source_config.stride,
-                                  ptr_i420_y, target_config.stride,
-                                  ptr_i420_u, uv_stride,
-                                  ptr_i420_v, uv_stride,
-                                  source_config.width, target_config.height);
-      break;
-    case kVideoFormatUYVY:
-      status = libyuv::UYVYToI420(ptr_data, source_config.stride,
-                                  ptr_i420_y, target_config.stride,
-                                  ptr_i420_u, uv_stride,
-                                  ptr_i420_v, uv_stride,
-                                  source_config.width, target_config.height);
-      break;
+  uint8* const ptr_i420_u = ptr_i420_y + plan.u_offset();
+  uint8* const ptr_i420_v = ptr_i420_y + plan.v_offset();
 
-    // Note that RGB conversions always negate the height to ensure correct
-    // image orientation.
-    case kVideoFormatRGB:
-      status = libyuv::RGB24ToI420(ptr_data, source_config.stride,
-                                   ptr_i420_y, target_config.stride,
-                                   ptr_i420_u, uv_stride,
-                                   ptr_i420_v, uv_stride,
-                                   source_config.width, -source_config.height);
-      break;
-    case kVideoFormatRGBA:
-      status = libyuv::BGRAToI420(ptr_data, source_config.stride,
-                                  ptr_i420_y, target_config.stride,
-                                  ptr_i420_u, uv_stride,
-                                  ptr_i420_v, uv_stride,
-                                  source_config.width, -source_config.height);
-      break;
+  // Large frames convert in bands of whole chroma rows, one per slice.
+  SlicePool& slice_pool = SlicePool::Instance();
+  const int32 chroma_rows = (height + 1) / 2;
+  const int num_slices = slice_pool.Slices(
+      static_cast<int64>(width) * height, chroma_rows / kMinSliceChromaRows);
+  std::vector<int> slice_status(num_slices, kSuccess);
+  slice_pool.Run(num_slices, [&](int slice) {
+    const int32 first_row = 2 * (chroma_rows * slice / num_slices);
+    const int32 end_row =
+        std::min(height, 2 * (chroma_rows * (slice + 1) / num_slices));
+    const int32 uv_offset = uv_stride * (first_row / 2);
+    slice_status[slice] = convert_rows(
+        plan, ptr_data, first_row, end_row - first_row,
+        ptr_i420_y + stride * first_row, stride,
+        ptr_i420_u + uv_offset, ptr_i420_v + uv_offset, uv_stride);
+  });
+  for (int slice = 0; slice < num_slices; ++slice) {
+    if (slice_status[slice]) {
+      return slice_status[slice];
+    }
+  }
+  return kSuccess;
+}
 
-    case kVideoFormatI420:
-    case kVideoFormatVP8:
-    case kVideoFormatYV12:
-    case kVideoFormatCount:
-      LOG(ERROR) << "Cannot convert to I420: invalid video format.";
-      status = kInvalidArg;
+#ifdef WEBMLIVE_HAVE_MJPEG
+int VideoFrame::DecodeMjpegToI420(const VideoConfig& source_config,
+                                  const uint8* ptr_data,
+                                  int32 data_length) {
+  const int32 width = source_config.width;
+  const int32 height = abs(source_config.height);
+  const int32 stride = AlignedStride(width);
+  const int32 size_required = PlanarFrameSize(stride, height);
+  if (size_required > buffer_capacity_) {
+    buffer_.reset(AllocateBuffer(size_required));
+    if (!buffer_) {
+      LOG(ERROR) << "VideoFrame DecodeMjpegToI420 cannot allocate buffer.";
+      return kNoMemory;
+    }
+    buffer_capacity_ = size_required;
   }
+  buffer_length_ = size_required;
+  config_ = source_config;
+  config_.format = kVideoFormatI420;
+  config_.height = height;
+  config_.stride = stride;
 
-  return status;
+  const int32 uv_stride = stride / 2;
+  uint8* const ptr_y = buffer_.get();
+  uint8* const ptr_u = ptr_y + stride * height;
+  uint8* const ptr_v = ptr_u + uv_stride * ((height + 1) / 2);
+  if (libyuv::MJPGToI420(ptr_data, data_length,
+                         ptr_y, stride,
+                         ptr_u, uv_stride,
+                         ptr_v, uv_stride,
+                         width, height, width, height)) {
+    LOG(ERROR) << "VideoFrame cannot decode " << data_length
+               << " byte MJPEG frame.";
+    return kConversionFailed;
+  }
+  return kSuccess;
+}
+#else
+int VideoFrame::DecodeMjpegToI420(const VideoConfig& /* source_config */,
+                                  const uint8* /* ptr_data */,
+                                  int32 /* data_length */) {
+  LOG(ERROR) << "MJPEG support was not built; configure with "
+             << "WEBMLIVE_ENABLE_MJPEG.";
+  return kConversionFailed;
+}
+#endif  // WEBMLIVE_HAVE_MJPEG
+
+int VideoFrame::UnpackV210ToI42016(const VideoConfig& source_config,
+                                   const uint8* ptr_data,
+                                   int32 data_length) {
+  const int32 width = source_config.width;
+  const int32 height = abs(source_config.height);
+  const int32 src_stride = source_config.stride > 0 ?
+      source_config.stride : V210Stride(width);
+  if (width <= 0 || width % 2 || src_stride < V210Stride(width) ||
+      data_length < src_stride * height) {
+    LOG(ERROR) << "VideoFrame cannot unpack " << data_length << " byte "
+               << width << "x" << height << " V210 frame.";
+    return kInvalidArg;
+  }
+
+  // Two bytes per sample.
+  const int32 stride = AlignedStride(width) * 2;
+  const int32 size_required = PlanarFrameSize(stride, height);
+  if (size_required > buffer_capacity_) {
+    buffer_.reset(AllocateBuffer(size_required));
+    if (!buffer_) {
+      LOG(ERROR) << "VideoFrame UnpackV210ToI42016 cannot allocate buffer.";
+      return kNoMemory;
+    }
+    buffer_capacity_ = size_required;
+  }
+  buffer_length_ = size_required;
+  config_ = source_config;
+  config_.format = kVideoFormatI42016;
+  config_.height = height;
+  config_.stride = stride;
+
+  const int32 y_stride = stride / 2;
+  const int32 uv_stride = y_stride / 2;
+  uint16* const ptr_y = reinterpret_cast<uint16*>(buffer_.get());
+  uint16* const ptr_u = ptr_y + y_stride * height;
+  uint16* const ptr_v = ptr_u + uv_stride * ((height + 1) / 2);
+  V210ToI42016(ptr_data, src_stride,
+               ptr_y, y_stride,
+               ptr_u, uv_stride,
+               ptr_v, uv_stride,
+               width, height);
+  return kSuccess;
+}
+
+int VideoFrame::ConvertAndScaleToI420(const VideoIngestPlan& plan,
+                                      const uint8* ptr_data) {
+  const VideoConfig& source_config = plan.source_config();
+  const VideoIngestPlan::RowConverter convert_rows = plan.row_converter();
+  const int32 src_width = source_config.width;
+  const int32 src_height = abs(source_config.height);
+  const int32 dst_width = config_.width;
+  const int32 src_rows = plan.strip_source_rows();
+  const int32 dst_rows = plan.strip_output_rows();
+
+  // Large frames convert and scale runs of whole strips, one per slice, each
+  // through a strip buffer of its own.
+  SlicePool& slice_pool = SlicePool::Instance();
+  const int num_strips = src_height / src_rows;
+  const int num_slices = slice_pool.Slices(
+      static_cast<int64>(src_width) * src_height, num_strips);
+
+  // Allocate the intermediate strips.
+  const int32 strip_stride = AlignedStride(src_width);
+  const int32 src_uv_stride = strip_stride / 2;
+  const int32 strip_y_length = strip_stride * src_rows;
+  const int32 strip_uv_length = src_uv_stride * ((src_rows + 1) / 2);
+  const int32 strip_size = strip_y_length + strip_uv_length * 2;
+  const int32 strips_size = strip_size * num_slices;
+  if (strips_size > strip_buffer_capacity_) {
+    strip_buffer_.reset(AllocateBuffer(strips_size));
+    if (!strip_buffer_) {
+      LOG(ERROR) << "VideoFrame ConvertAndScaleToI420 cannot allocate strip.";
+      strip_buffer_capacity_ = 0;
+      return kNoMemory;
+    }
+    strip_buffer_capacity_ = strips_size;
+  }
+
+  const int32 dst_stride = config_.stride;
+  const int32 dst_uv_stride = dst_stride / 2;
+  uint8* const ptr_dst_y = buffer_.get();
+  uint8* const ptr_dst_u = ptr_dst_y + plan.u_offset();
+  uint8* const ptr_dst_v = ptr_dst_y + plan.v_offset();
+
+  std::vector<int> slice_status(num_slices, kSuccess);
+  slice_pool.Run(num_slices, [&](int slice) {
+    uint8* const ptr_strip_y = strip_buffer_.get() + strip_size * slice;
+    uint8* const ptr_strip_u = ptr_strip_y + strip_y_length;
+    uint8* const ptr_strip_v = ptr_strip_u + strip_uv_length;
+    const int end_strip = num_strips * (slice + 1) / num_slices;
+    for (int strip = num_strips * slice / num_slices; strip < end_strip;
+         ++strip) {
+      const int32 src_row = src_rows * strip;
+      const int32 dst_row = dst_rows * strip;
+      int status = convert_rows(plan, ptr_data, src_row, src_rows,
+                                ptr_strip_y, strip_stride,
+                                ptr_strip_u, ptr_strip_v, src_uv_stride);
+      if (status) {
+        LOG(ERROR) << "VideoFrame strip conversion failed: " << status;
+        slice_status[slice] = kConversionFailed;
+        return;
+      }
+
+      const int32 dst_uv_offset = dst_uv_stride * (dst_row / 2);
+      status = libyuv::I420Scale(ptr_strip_y, strip_stride,
+                                 ptr_strip_u, src_uv_stride,
+                                 ptr_strip_v, src_uv_stride,
+                                 src_width, src_rows,
+                                 ptr_dst_y + dst_stride * dst_row, dst_stride,
+                                 ptr_dst_u + dst_uv_offset, dst_uv_stride,
+                                 ptr_dst_v + dst_uv_offset, dst_uv_stride,
+                                 dst_width, dst_rows,
+                                 libyuv::kFilterBox);
+      if (status) {
+        LOG(ERROR) << "VideoFrame strip scale failed: " << status;
+        slice_status[slice] = kConversionFailed;
+        return;
+      }
+    }
+  });
+  for (int slice = 0; slice < num_slices; ++slice) {
+    if (slice_status[slice]) {
+      return slice_status[slice];
+    }
+  }
+  return kSuccess;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -274,36 +942,137 @@ VideoEncoder::~VideoEncoder() {
 }
 
 int VideoEncoder::Init(const WebmEncoderConfig& config) {
-  ptr_vpx_encoder_.reset(new (std::nothrow) VpxEncoder());  // NOLINT
-  if (!ptr_vpx_encoder_) {
+  const VideoEncoderBackend backend = config.vpx_config.backend;
+  if (config.vpx_config.codec == kVideoFormatAV1) {
+    // AV1 is encoded in software only, by libaom.
+    if (backend == kVideoEncoderBackendHardware) {
+      LOG(ERROR) << "no hardware encoder available for this codec.";
+      return kEncoderError;
+    }
+#if defined WEBMLIVE_HAVE_LIBAOM
+    ptr_encoder_.reset(new (std::nothrow) AomEncoder());  // NOLINT
+    if (!ptr_encoder_) {
+      return kNoMemory;
+    }
+    return ptr_encoder_->Init(config);
+#else
+    LOG(ERROR) << "AV1 encode was not built; enable WEBMLIVE_ENABLE_AV1.";
+    return kEncoderError;
+#endif
+  }
+  if (backend != kVideoEncoderBackendLibvpx) {
+    if (config.vpx_config.codec == kVideoFormatVP9) {
+#if defined WEBMLIVE_HAVE_VAAPI
+      ptr_encoder_.reset(new (std::nothrow) VaapiVp9Encoder());  // NOLINT
+#endif
+    }
+    if (ptr_encoder_) {
+      const int status = ptr_encoder_->Init(config);
+      if (status == kSuccess) {
+        LOG(INFO) << "VideoEncoder using hardware encode.";
+        return kSuccess;
+      }
+      LOG(WARNING) << "hardware encoder Init failed: " << status;
+      ptr_encoder_.reset();
+    }
+    if (backend == kVideoEncoderBackendHardware) {
+      LOG(ERROR) << "no hardware encoder available for this codec.";
+      return kEncoderError;
+    }
+    LOG(INFO) << "VideoEncoder falling back to libvpx.";
+  }
+
+  ptr_encoder_ = EncoderContextPool::Instance().Take(config);
+  if (!ptr_encoder_) {
+    ptr_encoder_.reset(new (std::nothrow) VpxEncoder());  // NOLINT
+  }
+  if (!ptr_encoder_) {
     return kNoMemory;
   }
-  return ptr_vpx_encoder_->Init(config);
+  return ptr_encoder_->Init(config);
 }
 
 int VideoEncoder::EncodeFrame(const VideoFrame& raw_frame,
                               VideoFrame* ptr_vpx_frame) {
-  if (!ptr_vpx_encoder_) {
+  if (!ptr_encoder_) {
+    LOG(ERROR) << "VideoEncoder has NULL encoder, not Init'd";
+    return kEncoderError;
+  }
+  const std::shared_ptr<VideoSurface>& surface = raw_frame.surface();
+  if (surface && !ptr_encoder_->EncodesSurface(*surface)) {
+    if (raw_frame.Clone(&readback_frame_) || readback_frame_.Pack()) {
+      LOG(ERROR) << "VideoEncoder cannot read back surface frame.";
+      return kEncoderError;
+    }
+    return ptr_encoder_->EncodeFrame(readback_frame_, ptr_vpx_frame);
+  }
+  return ptr_encoder_->EncodeFrame(raw_frame, ptr_vpx_frame);
+}
+
+int32 VideoEncoder::ReadQueuedFrame(VideoFrame* ptr_vpx_frame) {
+  if (!ptr_encoder_) {
     LOG(ERROR) << "VideoEncoder has NULL encoder, not Init'd";
     return kEncoderError;
   }
-  return ptr_vpx_encoder_->EncodeFrame(raw_frame, ptr_vpx_frame);
+  return ptr_encoder_->ReadQueuedFrame(ptr_vpx_frame);
+}
+
+int32 VideoEncoder::Flush() {
+  if (!ptr_encoder_) {
+    LOG(ERROR) << "VideoEncoder has NULL encoder, not Init'd";
+    return kEncoderError;
+  }
+  return ptr_encoder_->Flush();
+}
+
+int32 VideoEncoder::SetTargetBitrate(int kbps) {
+  if (!ptr_encoder_) {
+    LOG(ERROR) << "VideoEncoder has NULL encoder, not Init'd";
+    return kEncoderError;
+  }
+  return ptr_encoder_->SetTargetBitrate(kbps);
+}
+
+int32 VideoEncoder::RequestKeyframe(int64 timestamp) {
+  if (!ptr_encoder_) {
+    LOG(ERROR) << "VideoEncoder has NULL encoder, not Init'd";
+    return kEncoderError;
+  }
+  ptr_encoder_->RequestKeyframe(timestamp);
+  return kSuccess;
+}
+
+int32 VideoEncoder::SetSpeedBoost(int steps) {
+  if (!ptr_encoder_) {
+    LOG(ERROR) << "VideoEncoder has NULL encoder, not Init'd";
+    return kEncoderError;
+  }
+  ptr_encoder_->SetSpeedBoost(steps);
+  return kSuccess;
+}
+
+void VideoEncoder::GetCodecPrivate(std::vector<uint8>* ptr_data) const {
+  if (!ptr_encoder_) {
+    ptr_data->clear();
+    return;
+  }
+  ptr_encoder_->GetCodecPrivate(ptr_data);
 }
 
 int64 VideoEncoder::frames_in() const {
-  return ptr_vpx_encoder_ ? ptr_vpx_encoder_->frames_in() : 0;
+  return ptr_encoder_ ? ptr_encoder_->frames_in() : 0;
 }
 
 int64 VideoEncoder::frames_out() const {
-  return ptr_vpx_encoder_ ? ptr_vpx_encoder_->frames_out() : 0;
+  return ptr_encoder_ ? ptr_encoder_->frames_out() : 0;
 }
 
 int64 VideoEncoder::last_keyframe_time() const {
-  return ptr_vpx_encoder_ ? ptr_vpx_encoder_->last_keyframe_time() : 0;
+  return ptr_encoder_ ? ptr_encoder_->last_keyframe_time() : 0;
 }
 
 int64 VideoEncoder::last_timestamp() const {
-  return ptr_vpx_encoder_ ? ptr_vpx_encoder_->last_timestamp() : 0;
+  return ptr_encoder_ ? ptr_encoder_->last_timestamp() : 0;
 }
 
 }  // namespace webmlive
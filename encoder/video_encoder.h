@@ -11,9 +11,11 @@
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <vector>
 
 #include "encoder/basictypes.h"
 #include "encoder/encoder_base.h"
+#include "encoder/slab_allocator.h"
 
 namespace webmlive {
 
@@ -27,7 +29,50 @@ enum VideoFormat {
   kVideoFormatRGB = 6,
   kVideoFormatRGBA = 7,
   kVideoFormatVP9 = 8,
-  kVideoFormatCount = 9,
+  kVideoFormatNV12 = 9,
+  kVideoFormatNV21 = 10,
+  // Motion JPEG; decoded to I420 when built with WEBMLIVE_ENABLE_MJPEG.
+  kVideoFormatMJPEG = 11,
+  // 10 bit 4:2:2 packed three samples per 32 bit word; converted to
+  // |kVideoFormatI42016|.
+  kVideoFormatV210 = 12,
+  // Planar 4:2:0 with one 10 bit sample per little endian 16 bit word. Strides
+  // are in bytes.
+  kVideoFormatI42016 = 13,
+  kVideoFormatAV1 = 14,
+  kVideoFormatCount = 15,
+};
+
+// Video encode implementations selectable through |VpxConfig::backend|.
+enum VideoEncoderBackend {
+  // Software encode with libvpx, or with libaom for |kVideoFormatAV1|.
+  kVideoEncoderBackendLibvpx = 0,
+  // Hardware encode; |VideoEncoder::Init()| fails when unavailable.
+  kVideoEncoderBackendHardware = 1,
+  // Hardware encode when available, libvpx otherwise.
+  kVideoEncoderBackendAuto = 2,
+};
+
+// Named rate control and latency trade-offs selectable through
+// |VpxConfig::profile|.
+enum VideoEncodeProfile {
+  // Realtime CBR without lookahead; every |VpxConfig| setting applies as
+  // given.
+  kVideoEncodeProfileDefault = 0,
+  // Realtime CBR without lookahead, with cyclic intra refresh in place of
+  // large keyframe restores where the codec supports it. For interactive
+  // streams.
+  kVideoEncodeProfileUltraLowLatency = 1,
+  // Lookahead with alternate reference frames, VBR (or constrained quality
+  // when |VpxConfig::cq_level| is set) and the good quality deadline. Adds
+  // the lookahead to the latency; for streams played with a deep buffer.
+  kVideoEncodeProfileBroadcast = 2,
+  // Realtime constrained quality without lookahead, with |VpxConfig::bitrate|
+  // as a cap rather than a target: easy content is encoded at
+  // |VpxConfig::cq_level| for a fraction of the bitrate, and hard content at
+  // the cap. The rate control buffer spans a DASH segment, so that segments
+  // stay within the cap on average.
+  kVideoEncodeProfileCappedQuality = 3,
 };
 
 // YUV bit count constants.
@@ -69,11 +114,83 @@ struct VideoConfig {
 
   VideoFormat format;   // Video pixel format.
   int32 width;          // Width in pixels.
-  int32 height;         // Height in pixels.
+  // Height in pixels. Positive for bottom-up RGB frames, as in DIBs.
+  int32 height;
+  // Row stride in bytes. Negative for bottom-up packed YUV or RGB frames,
+  // whose first row in memory is the bottom row.
   int32 stride;
   double frame_rate;    // Frame rate in frames per second.
 };
 
+// Alignment, in bytes, of |VideoFrame| storage.
+const int32 kVideoBufferAlignment = 64;
+
+// Alignment, in bytes, of the luma stride of frames produced by conversion or
+// scaling. Chroma strides are half the luma stride, and stay 16 byte aligned.
+const int32 kVideoStrideAlignment = 32;
+
+// One plane of a planar video frame: its first row, its row stride in bytes,
+// and the bytes it spans from |data|.
+struct VideoPlane {
+  VideoPlane() : data(NULL), stride(0), size(0) {}
+
+  uint8* data;
+  int32 stride;
+  int32 size;
+};
+
+// Rectangle within a video frame, in pixels.
+struct VideoRect {
+  VideoRect() : x(0), y(0), width(0), height(0) {}
+  VideoRect(int32 rect_x, int32 rect_y, int32 rect_width, int32 rect_height)
+      : x(rect_x), y(rect_y), width(rect_width), height(rect_height) {}
+
+  int32 x;
+  int32 y;
+  int32 width;
+  int32 height;
+};
+
+// Change information a capture source can attach to a |VideoFrame|. Sources
+// that know exactly what changed (screen capture) use it to let the encoder
+// skip static areas.
+struct VideoRegionHints {
+  VideoRegionHints() : valid(false), sequence(0) {}
+
+  // True when |changed_regions| lists every area that differs from the
+  // previous frame of the same source. An empty list then means the frame
+  // repeats the previous one.
+  bool valid;
+
+  // Increments by one per frame delivered by the source. Consumers that see a
+  // gap missed the changes of the dropped frames and must ignore the hints.
+  int64 sequence;
+
+  std::vector<VideoRect> changed_regions;
+};
+
+// Analysis of a captured frame, made once for every representation that
+// encodes it; see |FrameAnalyzer|.
+struct VideoFrameAnalysis {
+  VideoFrameAnalysis()
+      : valid(false), scene_cut(false), motion(0), complexity(0) {}
+
+  // True when the fields below describe the frame.
+  bool valid;
+
+  // True when the frame begins a new scene.
+  bool scene_cut;
+
+  // Mean absolute luma difference from the previous analyzed frame, 0 for
+  // the first, and mean absolute difference of horizontally adjacent luma
+  // samples. Both are in 8 bit levels, measured on downsampled luma.
+  double motion;
+  double complexity;
+};
+
+class VideoIngestPlan;
+class VideoSurface;
+
 // Storage class for I420, YV12, and VPx video frames. The main idea here is to
 // store frames in such a way that they can easily be obtained from the capture
 // source and passed to the libvpx VPx encoder.
@@ -82,10 +199,36 @@ struct VideoConfig {
 // - Libvpx's VP8 encoder supports only I420 and YV12 input.
 //   |VideoFrame::Init()| converts all uncompressed formats other than
 //   |kVideoFormatI420| and |kVideoFormatYV12| to |kVideoFormatI420|.
+//   |kVideoFormatMJPEG| frames are decoded straight into the frame's own
+//   storage, and cannot be scaled by |InitScaled()|.
+// - |kVideoFormatV210| frames are unpacked to |kVideoFormatI42016| for VP9
+//   profile 2 encode, and cannot be scaled by |InitScaled()| either.
 // - Libvpx's VP9 encoder supports formats beyond those above, but support for
 //   those formats is not implemented here.
+// - I420, YV12 and I42016 frames use |VideoConfig::stride| as luma stride.
+//   Chroma stride is half the luma stride, and chroma planes follow the luma
+//   plane.
+//   Native frames keep the stride of the capture source.
+// - Storage is aligned to |kVideoBufferAlignment|.
+// - |InitPlanes()| describes I420, YV12 and I42016 frames whose planes are
+//   stored elsewhere, at any addresses and strides, without copying them.
+//   |plane()| gives the planes of every planar frame, in either layout, and
+//   is what the encoder and the scaler read. Other stages read |buffer()|,
+//   which such frames fill only once |Pack()| copies the planes in.
+// - |InitSurface()| carries a picture held in GPU memory, a |VideoSurface|,
+//   with no pixels in memory at all. Stages of the surface's device work on
+//   it in place; |Pack()| reads it back for any other stage.
 class VideoFrame {
  public:
+  // Plane indexes for |plane()| and |InitPlanes()|, whatever the order of
+  // the planes in memory.
+  enum {
+    kPlaneY = 0,
+    kPlaneU = 1,
+    kPlaneV = 2,
+    kNumPlanes = 3,
+  };
+
   enum {
     kConversionFailed = -3,
     kNoMemory = -2,
@@ -101,8 +244,10 @@ class VideoFrame {
   // |VideoFormat| enumeration value. Returns |kNoMemory| when unable to
   // allocate storage for |ptr_data|.
   // Note: When format is not one of |kVideoFormatI420|, |kVideoFormatYV12|,
-  //       |kVideoFormatVP8| or |kVideoFormatVP9|, |Init()| converts the frame
-  //       data to I420.
+  //       |kVideoFormatI42016|, |kVideoFormatVP8| or |kVideoFormatVP9|,
+  //       |Init()| converts the frame data to |ConvertedFormat(format)|.
+  //       VP8 and VP9 frames are also keyframes when their bitstream header
+  //       says so, whatever the value of |keyframe|.
   int Init(const VideoConfig& config,
            bool keyframe,
            int64 timestamp,
@@ -110,44 +255,259 @@ class VideoFrame {
            const uint8* ptr_data,
            int32 data_length);
 
+  // Behaves like |Init()| for frames that need conversion to I420, but also
+  // scales the frame to |width| x |height|. Rows are converted and scaled one
+  // strip at a time through a small intermediate buffer, so the full size I420
+  // frame is never written to memory. Returns |kInvalidArg| when
+  // |config.format| does not need conversion, or when |width| or |height| is
+  // not greater than 0.
+  int InitScaled(const VideoConfig& config,
+                 bool keyframe,
+                 int64 timestamp,
+                 int64 duration,
+                 const uint8* ptr_data,
+                 int32 width,
+                 int32 height);
+
+  // Behaves like |Init()| for frames of |plan.source_config()|, converting,
+  // scaling, decoding or copying them as |plan| says without working that
+  // out again; see |VideoIngestPlan|.
+  int Init(const VideoIngestPlan& plan,
+           bool keyframe,
+           int64 timestamp,
+           int64 duration,
+           const uint8* ptr_data,
+           int32 data_length);
+
+  // Sets internal fields for frame data the caller has already written to
+  // |buffer()|, and returns |kSuccess|. Nothing is copied. Returns
+  // |kInvalidArg| when no buffer has been allocated, when |data_length|
+  // exceeds |buffer_capacity()|, or when |config.format| requires conversion.
+  int InitInPlace(const VideoConfig& config,
+                  bool keyframe,
+                  int64 timestamp,
+                  int64 duration,
+                  int32 data_length);
+
+  // Sets internal fields for an I420, YV12 or I42016 frame whose planes,
+  // indexed by |kPlaneY|, |kPlaneU| and |kPlaneV|, are |ptr_planes|. Nothing
+  // is copied: |owner| keeps the plane storage alive until the frame is
+  // initialized again, packed or destroyed, and moves with the planes in
+  // |Swap()|. |buffer()| is not used. Returns |kInvalidArg| for other
+  // formats, and for planes too small for the frame size.
+  int InitPlanes(const VideoConfig& config,
+                 bool keyframe,
+                 int64 timestamp,
+                 int64 duration,
+                 const VideoPlane* ptr_planes,
+                 const std::shared_ptr<void>& owner);
+
+  // Sets internal fields for an I420 frame held in |surface|, which must be
+  // |config.width| x |config.height|. Nothing is copied; |Clone()| shares
+  // the surface, and |Swap()| moves it. Returns |kInvalidArg| for other
+  // formats and sizes.
+  int InitSurface(const VideoConfig& config,
+                  bool keyframe,
+                  int64 timestamp,
+                  int64 duration,
+                  const std::shared_ptr<VideoSurface>& surface);
+
+  // Returns plane |index| of an I420, YV12 or I42016 frame, stored in
+  // |buffer()| or elsewhere. Returns an empty plane for other frames, and
+  // for frames held in a surface.
+  VideoPlane plane(int index) const;
+
+  // Returns true when the planes are stored outside |buffer()|.
+  bool external_planes() const { return external_planes_; }
+
+  // Returns the surface holding the frame, or NULL when it is in memory.
+  const std::shared_ptr<VideoSurface>& surface() const { return surface_; }
+
+  // Copies external planes, or reads the surface, into |buffer()|, in the
+  // contiguous layout with an |AlignedStride()| of the width, and releases
+  // them. Returns |kSuccess| when successful, and does nothing for frames
+  // stored in |buffer()|. Returns |kConversionFailed| when the surface
+  // cannot be read.
+  int Pack();
+
+  // Returns true when the frame has no storage, external planes or surface.
+  bool empty() const { return !buffer_ && !external_planes_ && !surface_; }
+
+  // Frees the frame's storage and releases its external planes and surface,
+  // leaving it |empty()|.
+  void Free();
+
+  // Makes sure |buffer_| can hold |capacity| bytes and returns |kSuccess|.
+  // Existing frame data is discarded when |buffer_| must be reallocated.
+  // Returns |kInvalidArg| when |capacity| is <= 0, and |kNoMemory| when
+  // allocation fails.
+  int Allocate(int32 capacity);
+
+  // Returns true when |format| is converted to I420, or I42016, by |Init()|.
+  static bool NeedsConversion(VideoFormat format);
+
+  // Returns the format of frames |Init()| produces from |format| frames.
+  static VideoFormat ConvertedFormat(VideoFormat format);
+
+  // Returns true when the |kVideoFormatVP8| or |kVideoFormatVP9| frame of
+  // |data_length| bytes at |ptr_data| is a keyframe, according to its frame
+  // header. Returns false for other formats and for truncated frames.
+  static bool IsVpxKeyframe(VideoFormat format, const uint8* ptr_data,
+                            int32 data_length);
+
+  // Returns |width| rounded up to a multiple of |kVideoStrideAlignment|.
+  static int32 AlignedStride(int32 width);
+
+  // Returns the size in bytes of an I420, YV12 or I42016 frame with luma
+  // stride |stride|, in bytes, that is |height| rows tall.
+  static int32 PlanarFrameSize(int32 stride, int32 height);
+
+  // Picks the number of source rows and destination rows per strip when
+  // scaling |src_height| rows to |dst_height| rows in strips of at least
+  // |min_src_rows| source rows. Strip edges land on the same image position
+  // in the source and destination frames so that every strip scales
+  // independently, and both row counts are even to keep I420 chroma rows
+  // aligned with luma rows. Uses the whole frame as one strip when no
+  // smaller strip meets those requirements.
+  static void ScaleStripRows(int32 src_height, int32 dst_height,
+                             int32 min_src_rows,
+                             int32* ptr_src_rows, int32* ptr_dst_rows);
+
   // Copies |VideoFrame| data to |ptr_frame|. Performs allocation if necessary.
+  // External planes are copied in the layout |Pack()| uses; surfaces are
+  // shared, not copied.
   // Returns |kSuccess| when successful. Returns |kInvalidArg| when |ptr_frame|
   // is NULL. Returns |kNoMemory| when memory allocation fails.
   int Clone(VideoFrame* ptr_frame) const;
 
-  // Swaps |VideoFrame| member data with |ptr_frame|'s. The |VideoFrame|s
-  // must have non-NULL buffers.
+  // Swaps |VideoFrame| member data with |ptr_frame|'s. Neither |VideoFrame|
+  // may be |empty()|.
   void Swap(VideoFrame* ptr_frame);
 
+  // Temporal layer of a compressed frame, 0 for the base layer. Frames of
+  // layers above 0 are not referenced by lower layers and may be discarded.
+  // Reset to 0 by |Init()|, |InitScaled()| and |InitInPlace()|.
+  int32 temporal_layer() const { return temporal_layer_; }
+  void set_temporal_layer(int32 layer) { temporal_layer_ = layer; }
+
+  // Spatial layer of a compressed frame of a VP9 spatial SVC encode: the
+  // frame holds the superframe up to and including that layer, which decodes
+  // at the layer's size. Reset to 0 like |temporal_layer()|.
+  int32 spatial_layer() const { return spatial_layer_; }
+  void set_spatial_layer(int32 layer) { spatial_layer_ = layer; }
+
+  // Region hints. |Init()|, |InitScaled()| and |InitInPlace()| invalidate
+  // them; sources that track changes fill them in after initialization.
+  const VideoRegionHints& region_hints() const { return region_hints_; }
+  VideoRegionHints* mutable_region_hints() { return &region_hints_; }
+
+  // Frame analysis, invalidated like the region hints.
+  const VideoFrameAnalysis& analysis() const { return analysis_; }
+  VideoFrameAnalysis* mutable_analysis() { return &analysis_; }
+
+  // Wall clock time at which the encoder received the frame from its
+  // source, in milliseconds since the epoch, or 0 when it was not recorded.
+  // Reset like the region hints.
+  int64 capture_time_ms() const { return capture_time_ms_; }
+  void set_capture_time_ms(int64 time_ms) { capture_time_ms_ = time_ms; }
+
   // Accessors/Mutators.
   bool keyframe() const { return keyframe_; }
   int32 width() const { return config_.width; }
   int32 height() const { return config_.height; }
-  int32 stride() const { return config_.stride; }
+  // Returns the luma stride, or |width()| when the stride is not set.
+  int32 stride() const {
+    return config_.stride > 0 ? config_.stride : config_.width;
+  }
   int64 timestamp() const { return timestamp_; }
-  void set_timestamp(int64 timestamp) { timestamp_ = timestamp; }
+  void set_timestamp(int64 timestamp) {
+    timestamp_us_ += (timestamp - timestamp_) * 1000;
+    timestamp_ = timestamp;
+  }
   int64 duration() const { return duration_; }
   uint8* buffer() const { return buffer_.get(); }
   int32 buffer_length() const { return buffer_length_; }
   int32 buffer_capacity() const { return buffer_capacity_; }
   VideoFormat format() const { return config_.format; }
+
+  // Time and duration of the frame in microseconds. |Init()|,
+  // |InitScaled()| and |InitInPlace()| set them from the millisecond
+  // values; sources with finer clocks then call |SetTimeUs()|, so that
+  // high frame rates keep evenly spaced times through the encoder.
+  int64 timestamp_us() const { return timestamp_us_; }
+  int64 duration_us() const { return duration_us_; }
+
+  // Sets the microsecond time and duration, and the millisecond ones to
+  // them rounded: |duration()| runs to the rounded end of the frame, so that
+  // consecutive frames neither overlap nor leave gaps.
+  void SetTimeUs(int64 timestamp_us, int64 duration_us);
   const VideoConfig& config() const { return config_; }
 
  private:
-  // Converts video frame from |config.format| to I420, and stores the I420
-  // frame in |buffer_|. Returns |kSuccess| when successful. Returns
+  typedef SlabBuffer Buffer;
+
+  // Returns |size| bytes aligned to |kVideoBufferAlignment| from
+  // |SlabAllocator|, or NULL.
+  static uint8* AllocateBuffer(int32 size);
+
+  // Converts the video frame at |ptr_data| to I420 as |plan| says, and stores
+  // the I420 frame in |buffer_|. Returns |kSuccess| when successful. Returns
   // |kNoMemory| if unable to allocate storage for the converted video frame.
-  // Note: Output stride is equal to |config.width| after conversion, and stored
+  // Note: Output stride is |AlignedStride(width)| after conversion, and stored
   //       in |config_.stride|.
-  int ConvertToI420(const VideoConfig& config, const uint8* ptr_data);
+  int ConvertToI420(const VideoIngestPlan& plan, const uint8* ptr_data);
+
+  // Fused path of |ConvertToI420()| used for |VideoIngestPlan::kConvertScaled|
+  // plans. |config_| must already describe the output frame.
+  int ConvertAndScaleToI420(const VideoIngestPlan& plan,
+                            const uint8* ptr_data);
+
+  // Decodes the |data_length| byte MJPEG frame at |ptr_data| to I420 in
+  // |buffer_|. Returns |kConversionFailed| when the frame cannot be decoded,
+  // or when MJPEG support is not built in.
+  int DecodeMjpegToI420(const VideoConfig& config, const uint8* ptr_data,
+                        int32 data_length);
+
+  // Unpacks the V210 frame at |ptr_data| to I42016 in |buffer_|. Returns
+  // |kInvalidArg| when |data_length| is too small for the frame.
+  int UnpackV210ToI42016(const VideoConfig& config, const uint8* ptr_data,
+                         int32 data_length);
+
+  // Copies the planes of the frame to |ptr_dest| in the contiguous layout,
+  // with luma stride |dest_stride|.
+  void CopyPlanes(uint8* ptr_dest, int32 dest_stride) const;
+
+  // Drops the external planes and their owner, and the surface.
+  void ReleasePlanes();
 
   bool keyframe_;
+  int32 temporal_layer_;
+  int32 spatial_layer_;
   int64 timestamp_;
   int64 duration_;
-  std::unique_ptr<uint8[]> buffer_;
+  int64 timestamp_us_;
+  int64 duration_us_;
+  int64 capture_time_ms_;
+  Buffer buffer_;
   int32 buffer_capacity_;
   int32 buffer_length_;
   VideoConfig config_;
+  VideoRegionHints region_hints_;
+  VideoFrameAnalysis analysis_;
+
+  // Planes set by |InitPlanes()|, valid while |external_planes_|, and the
+  // storage they point to.
+  bool external_planes_;
+  VideoPlane planes_[kNumPlanes];
+  std::shared_ptr<void> plane_owner_;
+
+  // Surface set by |InitSurface()|, or NULL.
+  std::shared_ptr<VideoSurface> surface_;
+
+  // Intermediate I420 rows used by |ConvertAndScaleToI420()|, one strip per
+  // |SlicePool| slice. Not exchanged by |Swap()| or copied by |Clone()|.
+  Buffer strip_buffer_;
+  int32 strip_buffer_capacity_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VideoFrame);
 };
 
@@ -195,8 +555,23 @@ struct VpxConfig {
         error_resilient(false),
         goldenframe_cbr_boost(300),
         adaptive_quantization_mode(3),
-        tile_columns(4),
-        frame_parallel_mode(true) {}
+        tile_columns(kUseDefault),
+        row_mt(kUseDefault),
+        frame_parallel_mode(true),
+        screen_content(kUseDefault),
+        temporal_layers(1),
+        lag_in_frames(0),
+        profile(kVideoEncodeProfileDefault),
+        cq_level(kUseDefault),
+        scene_cut_keyframes(false),
+        frame_analysis(false),
+        skip_static_frames(false),
+        intra_refresh(false),
+        scheduled_keyframes(false),
+        adaptive_speed(false),
+        quality_probe_interval(0),
+        bit_depth(8),
+        backend(kVideoEncoderBackendLibvpx) {}
 
   // Time between keyframes, in milliseconds.
   int keyframe_interval;
@@ -204,10 +579,14 @@ struct VpxConfig {
   // Video bitrate, in kilobits.
   int bitrate;
 
-  // Video codec, kVideoFormatVP8 or kVideoFormatVP9.
+  // Video codec, kVideoFormatVP8, kVideoFormatVP9 or kVideoFormatAV1. AV1
+  // requires a build with WEBMLIVE_ENABLE_AV1; see |AomEncoder| for the
+  // settings that apply to it.
   VideoFormat codec;
 
-  // Video frame rate decimation factor.
+  // Video frame rate decimation factor. |WebmEncoder| has its media source
+  // apply it by timestamp, see |FrameRateLimiter|; encoders used directly drop
+  // all but every |decimate|th frame.
   int decimate;
 
   // Minimum quantizer value.
@@ -222,7 +601,8 @@ struct VpxConfig {
   // Threshold at which a macroblock is considered static.
   int static_threshold;
 
-  // Encoder thead count.
+  // Encoder thead count. |kUseDefault| picks a count from the number of
+  // cores, the frame width and the number of representations.
   int thread_count;
 
   // Number of token partitions.
@@ -262,17 +642,102 @@ struct VpxConfig {
   // 3: cyclic refresh (default)
   int adaptive_quantization_mode;
 
-  // Number of tile columns, log2.
+  // Number of tile columns, log2. |kUseDefault| uses as many as the frame
+  // width and the thread count allow.
   int tile_columns;
 
+  // Row based multithreading, 0 or 1. |kUseDefault| enables it when libvpx
+  // supports it and more threads than tile columns are used.
+  int row_mt;
+
   // Enables frame parallel decoding features.
   bool frame_parallel_mode;
+
+  // Screen content tuning, 0 or 1. |kUseDefault| enables it for desktop
+  // capture.
+  int screen_content;
+
+  // Number of temporal layers, 1 to 3. |bitrate| is the total over all
+  // layers.
+  int temporal_layers;
+
+  // Frames of lookahead, which also enables alternate reference frames.
+  // Adds the lookahead to the latency. Not supported with temporal layers,
+  // or by hardware encode.
+  int lag_in_frames;
+
+  // Encode profile. The profile overrides the rate control mode, deadline
+  // and lookahead; |kVideoEncodeProfileBroadcast| uses a lookahead of 25
+  // frames unless |lag_in_frames| is set. |kVideoEncodeProfileCappedQuality|
+  // also overrides the buffer times.
+  VideoEncodeProfile profile;
+
+  // Constrained quality level, 0-63, used by |kVideoEncodeProfileBroadcast|
+  // and |kVideoEncodeProfileCappedQuality|. |kVideoEncodeProfileCappedQuality|
+  // uses 32 when it is |kUseDefault|.
+  int cq_level;
+
+  // Adds keyframes at scene cuts, detected on the captured frames so that
+  // every representation keys the same frame. The keyframe interval then
+  // counts from the cut.
+  bool scene_cut_keyframes;
+
+  // Analyzes each captured frame once for every representation; see
+  // |FrameAnalyzer|. Scene cuts then come from the analysis, adaptive speed
+  // steps up ahead of motion surges, and frames without region hints get
+  // them from the blocks the analysis found changed.
+  bool frame_analysis;
+
+  // Skips encoding frames that repeat the last frame encoded, for up to a
+  // second at a time; see |StaticFrameDetector|. The next frame encoded
+  // keeps its own timestamp, so the last frame shown stays up through the
+  // gap. libvpx encode only.
+  bool skip_static_frames;
+
+  // Replaces periodic keyframes with cyclic refresh, which spreads intra
+  // coding over every frame and keeps the size of clusters flat. Keyframes
+  // are then forced only on request and at scene cuts, and by |WebmEncoder|
+  // at DASH segment boundaries. Not supported by
+  // |kVideoEncodeProfileBroadcast|. libvpx encode only.
+  bool intra_refresh;
+
+  // Keyframes only where |VideoEncoder::RequestKeyframe()| asks for them:
+  // the encoder places none of its own, periodic or automatic. Set by
+  // |WebmEncoder|, whose |GopScheduler| requests every keyframe.
+  bool scheduled_keyframes;
+
+  // Raises |speed| while frames take close to their duration to encode, and
+  // lowers it back toward |speed| once they no longer do. See
+  // |SpeedController|.
+  bool adaptive_speed;
+
+  // Measures the PSNR and SSIM of every |quality_probe_interval|th encoded
+  // frame on a thread of its own, and exports them as metrics; see
+  // |QualityProbe|. 0 disables the probe. libvpx encode of 8 bit frames
+  // only, without lookahead or temporal layers.
+  int quality_probe_interval;
+
+  // Bits per sample, 8 or 10. 10 encodes VP9 profile 2 or AV1 main profile,
+  // and requires |kVideoFormatI42016| input, such as frames captured as V210,
+  // and a libvpx or libaom built with high bit depth support.
+  int bit_depth;
+
+  // Encoder implementation. Hardware encode supports only VP9, and ignores
+  // the libvpx specific tuning settings above.
+  VideoEncoderBackend backend;
 };
 
-// Forward declaration of |VpxEncoder| class for use in |VideoEncoder|. The
-// libvpx implementation details are kept hidden because use of the includes
-// produces C4505 warnings with MSVC at warning level 4.
-class VpxEncoder;
+// Returns the storage, in bytes, to reserve in |VideoFrame|s that receive
+// compressed frames for |vpx_config| and |video_config|. Sized for the
+// largest keyframe rate control should produce so that output buffers keep
+// their capacity as they circulate, and no frame reallocates them.
+int32 CompressedFrameCapacity(const VpxConfig& vpx_config,
+                              const VideoConfig& video_config);
+
+// Forward declaration of the encoder implementation interface for use in
+// |VideoEncoder|. The libvpx implementation details are kept hidden because
+// use of the includes produces C4505 warnings with MSVC at warning level 4.
+class VideoEncoderBackendInterface;
 struct WebmEncoderConfig;
 
 class VideoEncoder {
@@ -286,12 +751,48 @@ class VideoEncoder {
     kInvalidArg = -1,
     kSuccess = 0,
     kDropped = 1,
+    // Returned by |ReadQueuedFrame()| when no compressed frame is queued.
+    kNoFrame = 2,
   };
   VideoEncoder();
   ~VideoEncoder();
   int32 Init(const WebmEncoderConfig& config);
+
+  // Encodes |raw_frame|, and stores the oldest compressed frame ready in
+  // |ptr_vpx_frame|. Returns |kDropped| when no frame is ready. A call may
+  // produce more than one compressed frame, for example once lookahead or
+  // alternate reference frames are enabled; read the others with
+  // |ReadQueuedFrame()| before the next call. Frames held in a surface the
+  // encoder cannot take are read back into memory.
   int32 EncodeFrame(const VideoFrame& raw_frame, VideoFrame* ptr_vpx_frame);
 
+  // Moves the next queued compressed frame into |ptr_vpx_frame|. Returns
+  // |kNoFrame| when the queue is empty.
+  int32 ReadQueuedFrame(VideoFrame* ptr_vpx_frame);
+
+  // Compresses the frames held back for lookahead once input has ended. The
+  // output is read with |ReadQueuedFrame()|.
+  int32 Flush();
+
+  // Changes the target bitrate, in kilobits per second, without restarting
+  // the encoder. Thread safe: the change applies to the next frame passed to
+  // |EncodeFrame()|.
+  int32 SetTargetBitrate(int kbps);
+
+  // Forces a keyframe at the first frame encoded at or after |timestamp|;
+  // pass 0 for the next frame. Thread safe.
+  int32 RequestKeyframe(int64 timestamp);
+
+  // Trades quality for encode speed by |steps| encoder speed steps; 0
+  // restores the normal speed. Thread safe; see
+  // |VideoEncoderBackendInterface::SetSpeedBoost()|.
+  int32 SetSpeedBoost(int steps);
+
+  // Replaces the contents of |ptr_data| with the WebM CodecPrivate of the
+  // stream once |Init()| succeeds: the av1C record of AV1 streams, and
+  // nothing for VP8 and VP9.
+  void GetCodecPrivate(std::vector<uint8>* ptr_data) const;
+
   // Accessors.
   int64 frames_in() const;
   int64 frames_out() const;
@@ -299,7 +800,10 @@ class VideoEncoder {
   int64 last_timestamp() const;
 
  private:
-  std::unique_ptr<VpxEncoder> ptr_vpx_encoder_;
+  std::unique_ptr<VideoEncoderBackendInterface> ptr_encoder_;
+
+  // Frames read back from surfaces for |ptr_encoder_|.
+  VideoFrame readback_frame_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VideoEncoder);
 };
 
@@ -0,0 +1,119 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_VIDEO_ENCODER_BACKEND_H_
+#define WEBMLIVE_ENCODER_VIDEO_ENCODER_BACKEND_H_
+
+#include <atomic>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+class VideoSurface;
+struct WebmEncoderConfig;
+
+// Pending keyframe request shared by the encoder implementations. Requests
+// name the timestamp from which a keyframe is wanted, so that encoders fed
+// the same frames at different paces key the same frame.
+class KeyframeRequest {
+ public:
+  KeyframeRequest() : timestamp_(kNone) {}
+
+  // Requests a keyframe at the first frame at or after |timestamp|. The
+  // earliest of several pending requests wins. May be called from any
+  // thread.
+  void Request(int64 timestamp) {
+    int64 pending = timestamp_.load();
+    while ((pending == kNone || timestamp < pending) &&
+           !timestamp_.compare_exchange_weak(pending, timestamp)) {
+    }
+  }
+
+  // Returns true when a frame at |timestamp| satisfies the request, without
+  // clearing it.
+  bool Pending(int64 timestamp) const {
+    const int64 pending = timestamp_.load();
+    return pending != kNone && timestamp >= pending;
+  }
+
+  // Returns true, and clears the request, when a frame at |timestamp|
+  // satisfies it.
+  bool Take(int64 timestamp) {
+    int64 pending = timestamp_.load();
+    return pending != kNone && timestamp >= pending &&
+           timestamp_.compare_exchange_strong(pending, kNone);
+  }
+
+ private:
+  static const int64 kNone = -1;
+  std::atomic<int64> timestamp_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(KeyframeRequest);
+};
+
+// Pure interface implemented by the encoders |VideoEncoder| delegates to.
+// Implementations return |VideoEncoder| status codes.
+class VideoEncoderBackendInterface {
+ public:
+  virtual ~VideoEncoderBackendInterface() {}
+
+  // Prepares the encoder for |config|. Returns |VideoEncoder::kSuccess| when
+  // successful.
+  virtual int Init(const WebmEncoderConfig& config) = 0;
+
+  // Encodes |raw_frame| and returns the compressed data via |ptr_vpx_frame|.
+  // Returns |VideoEncoder::kDropped| when no compressed frame is ready, and
+  // |VideoEncoder::kSuccess| when |ptr_vpx_frame| holds a compressed frame.
+  // Further frames produced by the call are left for |ReadQueuedFrame()|.
+  virtual int EncodeFrame(const VideoFrame& raw_frame,
+                          VideoFrame* ptr_vpx_frame) = 0;
+
+  // Moves the oldest queued compressed frame into |ptr_vpx_frame|. Returns
+  // |VideoEncoder::kNoFrame| when none is queued.
+  virtual int ReadQueuedFrame(VideoFrame* ptr_vpx_frame) = 0;
+
+  // Compresses the frames the encoder still holds, queueing the output for
+  // |ReadQueuedFrame()|. Called once input has ended.
+  virtual int Flush() = 0;
+
+  // Requests a new target bitrate in kilobits per second. May be called from
+  // any thread; the change applies to the next frame encoded.
+  virtual int SetTargetBitrate(int kbps) = 0;
+
+  // Forces a keyframe at the first frame encoded at or after |timestamp|.
+  // May be called from any thread.
+  virtual void RequestKeyframe(int64 timestamp) = 0;
+
+  // Makes encoding faster by |steps| speed steps beyond the configured or
+  // adaptive speed, trading quality for CPU time; 0 removes the boost. May be
+  // called from any thread; the change applies to the next frame encoded.
+  // Backends without a speed setting ignore the request.
+  virtual void SetSpeedBoost(int /*steps*/) {}
+
+  // Returns true when |EncodeFrame()| takes frames held in |surface| as they
+  // are. |VideoEncoder| reads other surfaces back into memory first.
+  virtual bool EncodesSurface(const VideoSurface& /*surface*/) const {
+    return false;
+  }
+
+  // Replaces the contents of |ptr_data| with the WebM CodecPrivate of the
+  // stream, available once |Init()| succeeds. Empty for codecs without one.
+  virtual void GetCodecPrivate(std::vector<uint8>* ptr_data) const {
+    ptr_data->clear();
+  }
+
+  // Accessors.
+  virtual int64 frames_in() const = 0;
+  virtual int64 frames_out() const = 0;
+  virtual int64 last_keyframe_time() const = 0;
+  virtual int64 last_timestamp() const = 0;
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_VIDEO_ENCODER_BACKEND_H_
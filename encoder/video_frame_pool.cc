@@ -0,0 +1,100 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/video_frame_pool.h"
+
+#include <functional>
+#include <new>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+VideoFramePool::~VideoFramePool() {
+  for (size_t i = 0; i < free_blocks_.size(); ++i) {
+    ::operator delete(free_blocks_[i]);
+  }
+}
+
+int VideoFramePool::Share(VideoFrame* ptr_frame,
+                          SharedVideoFrame* ptr_shared) {
+  if (!ptr_frame || ptr_frame->empty() || !ptr_shared) {
+    LOG(ERROR) << "VideoFramePool cannot share NULL or empty frame.";
+    return kInvalidArg;
+  }
+
+  VideoFrame* ptr_pooled_frame = NULL;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_frames_.empty()) {
+      std::unique_ptr<VideoFrame> frame(
+          new (std::nothrow) VideoFrame());  // NOLINT
+      if (!frame) {
+        LOG(ERROR) << "VideoFramePool cannot allocate frame.";
+        return kNoMemory;
+      }
+      // Reserve the free list slots now; |Release()| and |FreeBlock()| must
+      // not allocate.
+      free_frames_.reserve(frames_.size() + 1);
+      free_blocks_.reserve(frames_.size() + 1);
+      ptr_pooled_frame = frame.get();
+      frames_.push_back(std::move(frame));
+      VLOG(1) << "VideoFramePool grew to " << frames_.size() << " frames.";
+    } else {
+      ptr_pooled_frame = free_frames_.back();
+      free_frames_.pop_back();
+    }
+  }
+
+  // Frames added by growth have no storage yet, and |VideoFrame::Swap()|
+  // requires storage on both sides: copy into those once.
+  if (ptr_pooled_frame->buffer()) {
+    ptr_pooled_frame->Swap(ptr_frame);
+  } else if (ptr_frame->Clone(ptr_pooled_frame)) {
+    LOG(ERROR) << "VideoFramePool cannot copy frame.";
+    Release(ptr_pooled_frame);
+    return kNoMemory;
+  }
+  ptr_shared->reset(ptr_pooled_frame,
+                    std::bind(&VideoFramePool::Release, this,
+                              std::placeholders::_1),
+                    BlockAllocator<VideoFrame>(this));
+  return kSuccess;
+}
+
+void VideoFramePool::Release(const VideoFrame* ptr_frame) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_frames_.push_back(const_cast<VideoFrame*>(ptr_frame));
+}
+
+void* VideoFramePool::AllocateBlock(std::size_t size) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!free_blocks_.empty() && size == block_size_) {
+      void* const ptr_block = free_blocks_.back();
+      free_blocks_.pop_back();
+      return ptr_block;
+    }
+  }
+  return ::operator new(size);
+}
+
+void VideoFramePool::FreeBlock(void* ptr_block, std::size_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Handles all have the same control block type, so the size changes only
+  // from 0 to that of the first block.
+  if (block_size_ == 0) {
+    block_size_ = size;
+  }
+  if (size != block_size_ || free_blocks_.size() == free_blocks_.capacity()) {
+    ::operator delete(ptr_block);
+    return;
+  }
+  free_blocks_.push_back(ptr_block);
+}
+
+}  // namespace webmlive
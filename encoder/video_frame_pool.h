@@ -0,0 +1,116 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_VIDEO_FRAME_POOL_H_
+#define WEBMLIVE_ENCODER_VIDEO_FRAME_POOL_H_
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+// Reference counted read only handle to a pooled |VideoFrame|. Copying the
+// handle never copies the frame. The frame returns to the |VideoFramePool|
+// that produced it when the last handle is released.
+typedef std::shared_ptr<const VideoFrame> SharedVideoFrame;
+
+// Pool of |VideoFrame|s used to share one raw frame between multiple readers,
+// for example the |VideoEncodeWorker|s of a multi-bitrate encode.
+//
+// Notes
+// - |Share()| may be called from one thread while handles are released from
+//   any number of others.
+// - The pool must outlive every handle it produces.
+// - The reference counts of the handles are allocated by the pool too, and
+//   recycled with the frames.
+class VideoFramePool {
+ public:
+  enum {
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  VideoFramePool() : block_size_(0) {}
+  ~VideoFramePool();
+
+  // Moves the contents of |ptr_frame| into a pooled frame, and stores a handle
+  // to the pooled frame in |ptr_shared|. |ptr_frame| receives the storage
+  // previously owned by the pooled frame, so once the pool has grown to cover
+  // the frames in flight nothing is copied or allocated.
+  // Returns |kSuccess| when successful.
+  int Share(VideoFrame* ptr_frame, SharedVideoFrame* ptr_shared);
+
+ private:
+  // Allocator of the control blocks of |SharedVideoFrame|s. Takes blocks from
+  // |free_blocks_|, so that sharing a frame allocates nothing once the pool
+  // covers the frames in flight.
+  template <typename T>
+  class BlockAllocator {
+   public:
+    typedef T value_type;
+
+    explicit BlockAllocator(VideoFramePool* ptr_pool) : ptr_pool_(ptr_pool) {}
+    template <typename U>
+    BlockAllocator(const BlockAllocator<U>& other)  // NOLINT
+        : ptr_pool_(other.ptr_pool_) {}
+
+    T* allocate(std::size_t count) {
+      return static_cast<T*>(ptr_pool_->AllocateBlock(count * sizeof(T)));
+    }
+    void deallocate(T* ptr_block, std::size_t count) {
+      ptr_pool_->FreeBlock(ptr_block, count * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const BlockAllocator<U>& other) const {
+      return ptr_pool_ == other.ptr_pool_;
+    }
+    template <typename U>
+    bool operator!=(const BlockAllocator<U>& other) const {
+      return ptr_pool_ != other.ptr_pool_;
+    }
+
+   private:
+    template <typename U> friend class BlockAllocator;
+    VideoFramePool* ptr_pool_;
+  };
+
+  // Handle deleter: returns |ptr_frame| to |free_frames_|.
+  void Release(const VideoFrame* ptr_frame);
+
+  // Returns a control block of |size| bytes from |free_blocks_|, or a new one
+  // when none is free.
+  void* AllocateBlock(std::size_t size);
+
+  // Returns |ptr_block| to |free_blocks_|.
+  void FreeBlock(void* ptr_block, std::size_t size);
+
+  std::mutex mutex_;
+
+  // Frames not referenced by any handle.
+  std::vector<VideoFrame*> free_frames_;
+
+  // Control blocks not in use by any handle, all of |block_size_| bytes. A
+  // handle has one block, so there are never more blocks than frames.
+  std::vector<void*> free_blocks_;
+  std::size_t block_size_;
+
+  // Storage for all frames owned by the pool.
+  std::vector<std::unique_ptr<VideoFrame>> frames_;
+
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VideoFramePool);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_VIDEO_FRAME_POOL_H_
@@ -0,0 +1,187 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/video_ingest_plan.h"
+
+#include <cstdlib>
+
+#include "glog/logging.h"
+#include "libyuv/convert.h"
+
+namespace webmlive {
+
+namespace {
+
+// Minimum number of source rows converted per strip of |kConvertScaled|
+// frames. A strip of 1080p YUY2 this tall converts to roughly 100 KB of I420,
+// which stays in cache while it is scaled.
+const int32 kMinStripRows = 32;
+
+// libyuv conversions of packed, and of semi-planar, frames to I420.
+typedef int (*PackedToI420)(const uint8* ptr_src, int src_stride,
+                            uint8* ptr_y, int y_stride,
+                            uint8* ptr_u, int u_stride,
+                            uint8* ptr_v, int v_stride,
+                            int width, int height);
+typedef int (*SemiPlanarToI420)(const uint8* ptr_src_y, int src_y_stride,
+                                const uint8* ptr_src_uv, int src_uv_stride,
+                                uint8* ptr_y, int y_stride,
+                                uint8* ptr_u, int u_stride,
+                                uint8* ptr_v, int v_stride,
+                                int width, int height);
+
+// Row converter of packed formats. Bottom-up frames have a negative row
+// stride, which libyuv follows as it reads.
+template <PackedToI420 kConvert>
+int ConvertPackedRows(const VideoIngestPlan& plan, const uint8* ptr_data,
+                      int32 first_row, int32 num_rows,
+                      uint8* ptr_y, int32 y_stride,
+                      uint8* ptr_u, uint8* ptr_v, int32 uv_stride) {
+  const int32 src_stride = plan.source_row_stride();
+  return kConvert(
+      ptr_data + plan.source_top_row_offset() + first_row * src_stride,
+      src_stride,
+      ptr_y, y_stride,
+      ptr_u, uv_stride,
+      ptr_v, uv_stride,
+      plan.source_config().width, num_rows);
+}
+
+// Row converter of NV12 and NV21, which store interleaved chroma, one row per
+// two luma rows, after the luma plane. Always top-down.
+template <SemiPlanarToI420 kConvert>
+int ConvertSemiPlanarRows(const VideoIngestPlan& plan, const uint8* ptr_data,
+                          int32 first_row, int32 num_rows,
+                          uint8* ptr_y, int32 y_stride,
+                          uint8* ptr_u, uint8* ptr_v, int32 uv_stride) {
+  const int32 src_stride = plan.source_row_stride();
+  return kConvert(ptr_data + first_row * src_stride, src_stride,
+                  ptr_data + plan.source_uv_offset() +
+                      first_row / 2 * src_stride,
+                  src_stride,
+                  ptr_y, y_stride,
+                  ptr_u, uv_stride,
+                  ptr_v, uv_stride,
+                  plan.source_config().width, num_rows);
+}
+
+}  // namespace
+
+VideoIngestPlan::VideoIngestPlan()
+    : action_(kCopy),
+      output_size_(0),
+      u_offset_(0),
+      v_offset_(0),
+      uv_stride_(0),
+      row_converter_(NULL),
+      source_top_row_offset_(0),
+      source_row_stride_(0),
+      source_uv_offset_(0),
+      strip_source_rows_(0),
+      strip_output_rows_(0) {
+}
+
+int VideoIngestPlan::Init(const VideoConfig& config, int32 output_width,
+                          int32 output_height) {
+  *this = VideoIngestPlan();
+  source_config_ = config;
+  output_config_ = config;
+  if (!VideoFrame::NeedsConversion(config.format)) {
+    action_ = kCopy;
+    return kSuccess;
+  }
+
+  const int32 width = config.width;
+  const int32 height = abs(config.height);
+  const bool scale = output_width != width || output_height != height;
+  row_converter_ = ResolveRowConverter(config.format);
+  if (config.format == kVideoFormatMJPEG) {
+    action_ = kDecodeMjpeg;
+  } else if (config.format == kVideoFormatV210) {
+    action_ = kUnpackV210;
+  } else if (!row_converter_) {
+    LOG(ERROR) << "VideoIngestPlan cannot convert format " << config.format;
+    return kInvalidArg;
+  } else {
+    action_ = scale ? kConvertScaled : kConvert;
+  }
+  if ((scale && action_ != kConvertScaled) || output_width <= 0 ||
+      output_height <= 0) {
+    LOG(ERROR) << "VideoIngestPlan cannot scale format " << config.format
+               << " to " << output_width << "x" << output_height;
+    return kInvalidArg;
+  }
+
+  // Note that RGB frames with a positive height are bottom-up DIBs, and RGB
+  // frames with a negative height are top-down.
+  const bool semi_planar = config.format == kVideoFormatNV12 ||
+                           config.format == kVideoFormatNV21;
+  const bool rgb = config.format == kVideoFormatRGB ||
+                   config.format == kVideoFormatRGBA;
+  if (semi_planar && config.stride < 0) {
+    LOG(ERROR) << "VideoIngestPlan cannot read bottom-up format "
+               << config.format;
+    return kInvalidArg;
+  }
+  const int32 row_bytes = abs(config.stride);
+  const bool bottom_up = config.stride < 0 || (rgb && config.height > 0);
+  source_row_stride_ = bottom_up ? -row_bytes : row_bytes;
+  source_top_row_offset_ = bottom_up ? (height - 1) * row_bytes : 0;
+  source_uv_offset_ = semi_planar ? row_bytes * height : 0;
+
+  output_config_.format = VideoFrame::ConvertedFormat(config.format);
+  output_config_.width = output_width;
+  output_config_.height = output_height;
+  output_config_.stride = VideoFrame::AlignedStride(output_width);
+  if (action_ == kUnpackV210) {
+    // Two bytes per sample.
+    output_config_.stride *= 2;
+  }
+  output_size_ =
+      VideoFrame::PlanarFrameSize(output_config_.stride, output_height);
+  uv_stride_ = output_config_.stride / 2;
+  u_offset_ = output_config_.stride * output_height;
+  v_offset_ = u_offset_ + uv_stride_ * ((output_height + 1) / 2);
+  if (action_ == kConvertScaled) {
+    VideoFrame::ScaleStripRows(height, output_height, kMinStripRows,
+                               &strip_source_rows_, &strip_output_rows_);
+  }
+  return kSuccess;
+}
+
+VideoIngestPlan::RowConverter VideoIngestPlan::ResolveRowConverter(
+    VideoFormat format) {
+  switch (format) {
+    case kVideoFormatYUY2:
+    case kVideoFormatYUYV:
+      return &ConvertPackedRows<libyuv::YUY2ToI420>;
+    case kVideoFormatUYVY:
+      return &ConvertPackedRows<libyuv::UYVYToI420>;
+    case kVideoFormatNV12:
+      return &ConvertSemiPlanarRows<libyuv::NV12ToI420>;
+    case kVideoFormatNV21:
+      return &ConvertSemiPlanarRows<libyuv::NV21ToI420>;
+    case kVideoFormatRGB:
+      return &ConvertPackedRows<libyuv::RGB24ToI420>;
+    case kVideoFormatRGBA:
+      return &ConvertPackedRows<libyuv::BGRAToI420>;
+
+    case kVideoFormatI420:
+    case kVideoFormatVP8:
+    case kVideoFormatVP9:
+    case kVideoFormatAV1:
+    case kVideoFormatYV12:
+    case kVideoFormatMJPEG:
+    case kVideoFormatV210:
+    case kVideoFormatI42016:
+    case kVideoFormatCount:
+      break;
+  }
+  return NULL;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,130 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_VIDEO_INGEST_PLAN_H_
+#define WEBMLIVE_ENCODER_VIDEO_INGEST_PLAN_H_
+
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+// What |VideoFrame::Init()| does with frames of one capture format, worked
+// out once when the format is negotiated instead of on every frame: whether
+// the frame is copied, converted, scaled, decoded or unpacked, the row
+// converter for its pixel format, the order and spacing of its rows, and the
+// layout of the frame it produces.
+//
+//   VideoIngestPlan plan;
+//   plan.Init(config, output_width, output_height);
+//   frame.Allocate(plan.output_size());
+//   ...
+//   frame.Init(plan, keyframe, timestamp, duration, ptr_data, data_length);
+//
+// Notes
+// - The plan describes frames of exactly |source_config()|. Build a new one
+//   when the capture format changes.
+// - Bottom-up frames, RGB frames with a positive height as in DIBs and
+//   packed frames with a negative stride, are read through a negative row
+//   stride from their last row by the conversion itself; they are never
+//   flipped in a pass of their own.
+// - |VideoFrame::Init()| and |VideoFrame::InitScaled()| taking a
+//   |VideoConfig| build a plan for every frame; sources that know their
+//   format up front keep one instead.
+class VideoIngestPlan {
+ public:
+  enum {
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  enum Action {
+    // Frame data is stored as it is.
+    kCopy = 0,
+    // Converted to I420 at the source size.
+    kConvert = 1,
+    // Converted to I420 and scaled, one strip at a time.
+    kConvertScaled = 2,
+    // MJPEG decoded to I420.
+    kDecodeMjpeg = 3,
+    // V210 unpacked to I42016.
+    kUnpackV210 = 4,
+  };
+
+  // Converts |num_rows| rows of the frame at |ptr_data|, laid out as |plan|
+  // says, to I420, starting with display row |first_row|, which must be
+  // even. Returns |VideoFrame::kSuccess| when successful.
+  typedef int (*RowConverter)(const VideoIngestPlan& plan,
+                              const uint8* ptr_data,
+                              int32 first_row, int32 num_rows,
+                              uint8* ptr_y, int32 y_stride,
+                              uint8* ptr_u, uint8* ptr_v, int32 uv_stride);
+
+  VideoIngestPlan();
+  ~VideoIngestPlan() {}
+
+  // Plans the ingest of |config| frames at |output_width| x |output_height|.
+  // Frames are scaled when the output size differs from the source size,
+  // which only formats converted by row are. Returns |kInvalidArg| when the
+  // format cannot be converted or scaled as asked, and for NV12 and NV21
+  // frames with a negative stride.
+  int Init(const VideoConfig& config, int32 output_width,
+           int32 output_height);
+
+  // Returns the row converter for |format|. Returns NULL for formats that
+  // are not converted by row.
+  static RowConverter ResolveRowConverter(VideoFormat format);
+
+  Action action() const { return action_; }
+  const VideoConfig& source_config() const { return source_config_; }
+
+  // Frame produced by the plan: its config, and the size in bytes of
+  // converted frames. |output_size()| is 0 for |kCopy|, whose frames are the
+  // size of the captured data.
+  const VideoConfig& output_config() const { return output_config_; }
+  int32 output_size() const { return output_size_; }
+
+  // Offsets, in bytes, of the chroma planes of converted frames, and their
+  // stride.
+  int32 u_offset() const { return u_offset_; }
+  int32 v_offset() const { return v_offset_; }
+  int32 uv_stride() const { return uv_stride_; }
+
+  RowConverter row_converter() const { return row_converter_; }
+
+  // Source layout in display order: the offset, in bytes, of the top row,
+  // and the distance from each row to the one below it, negative for
+  // bottom-up frames. |source_uv_offset()| is the offset of the interleaved
+  // chroma plane of NV12 and NV21 frames.
+  int32 source_top_row_offset() const { return source_top_row_offset_; }
+  int32 source_row_stride() const { return source_row_stride_; }
+  int32 source_uv_offset() const { return source_uv_offset_; }
+
+  // Source and output rows of each strip of |kConvertScaled| frames; see
+  // |VideoFrame::ScaleStripRows()|.
+  int32 strip_source_rows() const { return strip_source_rows_; }
+  int32 strip_output_rows() const { return strip_output_rows_; }
+
+ private:
+  Action action_;
+  VideoConfig source_config_;
+  VideoConfig output_config_;
+  int32 output_size_;
+  int32 u_offset_;
+  int32 v_offset_;
+  int32 uv_stride_;
+  RowConverter row_converter_;
+  int32 source_top_row_offset_;
+  int32 source_row_stride_;
+  int32 source_uv_offset_;
+  int32 strip_source_rows_;
+  int32 strip_output_rows_;
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_VIDEO_INGEST_PLAN_H_
@@ -0,0 +1,239 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/video_scaler.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "glog/logging.h"
+#include "libyuv/scale.h"
+#include "encoder/slice_pool.h"
+#include "encoder/video_surface.h"
+
+namespace webmlive {
+
+namespace {
+// Minimum number of source rows per band when a frame is scaled in bands by
+// |SlicePool| threads.
+const int32 kMinBandRows = 32;
+}  // namespace
+
+VideoScaler::VideoScaler() : width_(0), height_(0) {
+}
+
+int VideoScaler::Init(int32 width, int32 height) {
+  if (width <= 0 || height <= 0) {
+    LOG(ERROR) << "VideoScaler invalid output size " << width << "x" << height;
+    return kInvalidArg;
+  }
+  width_ = width;
+  height_ = height;
+  return kSuccess;
+}
+
+void VideoScaler::ScaleRegionHints(const VideoFrame& source,
+                                   VideoRegionHints* ptr_hints) const {
+  const VideoRegionHints& source_hints = source.region_hints();
+  ptr_hints->valid = source_hints.valid;
+  ptr_hints->sequence = source_hints.sequence;
+  ptr_hints->changed_regions.clear();
+  if (!source_hints.valid) {
+    return;
+  }
+  const int64 src_width = source.width();
+  const int64 src_height = source.height();
+  for (const VideoRect& rect : source_hints.changed_regions) {
+    // Round outward, and widen by a pixel for the box filter footprint.
+    int32 left = static_cast<int32>(rect.x * width_ / src_width) - 1;
+    int32 top = static_cast<int32>(rect.y * height_ / src_height) - 1;
+    int32 right = static_cast<int32>(
+        ((rect.x + rect.width) * width_ + src_width - 1) / src_width) + 1;
+    int32 bottom = static_cast<int32>(
+        ((rect.y + rect.height) * height_ + src_height - 1) / src_height) + 1;
+    left = std::max(left, 0);
+    top = std::max(top, 0);
+    right = std::min(right, width_);
+    bottom = std::min(bottom, height_);
+    if (right > left && bottom > top) {
+      ptr_hints->changed_regions.push_back(
+          VideoRect(left, top, right - left, bottom - top));
+    }
+  }
+}
+
+bool VideoScaler::NeedsScaling(const VideoFrame& frame) const {
+  return frame.width() != width_ || frame.height() != height_;
+}
+
+int VideoScaler::Scale(const VideoFrame& source,
+                       SharedVideoFrame* ptr_scaled) {
+  if (source.empty() || !ptr_scaled) {
+    LOG(ERROR) << "VideoScaler cannot scale NULL frame.";
+    return kInvalidArg;
+  }
+  if (source.surface()) {
+    return ScaleSurface(source, ptr_scaled);
+  }
+  const bool high_bit_depth = source.format() == kVideoFormatI42016;
+  if (source.format() != kVideoFormatI420 &&
+      source.format() != kVideoFormatYV12 && !high_bit_depth) {
+    LOG(ERROR) << "VideoScaler unsupported format: " << source.format();
+    return kInvalidArg;
+  }
+
+  // Strides are in bytes; I42016 samples are two bytes.
+  const int32 bytes_per_sample = high_bit_depth ? 2 : 1;
+  const int32 src_width = source.width();
+  const int32 src_height = source.height();
+  const VideoPlane src_y_plane = source.plane(VideoFrame::kPlaneY);
+  const VideoPlane src_u_plane = source.plane(VideoFrame::kPlaneU);
+  const VideoPlane src_v_plane = source.plane(VideoFrame::kPlaneV);
+  const int32 src_stride = src_y_plane.stride;
+  const int32 src_u_stride = src_u_plane.stride;
+  const int32 src_v_stride = src_v_plane.stride;
+  const int32 dst_stride =
+      VideoFrame::AlignedStride(width_) * bytes_per_sample;
+  const int32 dst_uv_stride = dst_stride / 2;
+  const int32 dst_uv_height = (height_ + 1) / 2;
+  const int32 dst_size = VideoFrame::PlanarFrameSize(dst_stride, height_);
+
+  if (scratch_frame_.Allocate(dst_size)) {
+    LOG(ERROR) << "VideoScaler cannot allocate scaled frame.";
+    return kNoMemory;
+  }
+
+  const uint8* const src_y = src_y_plane.data;
+  const uint8* const src_u = src_u_plane.data;
+  const uint8* const src_v = src_v_plane.data;
+  uint8* const dst_y = scratch_frame_.buffer();
+  uint8* const dst_u = dst_y + dst_stride * height_;
+  uint8* const dst_v = dst_u + dst_uv_stride * dst_uv_height;
+
+  // Large frames scale in bands of whole strips, one per slice.
+  int32 src_rows = 0;
+  int32 dst_rows = 0;
+  VideoFrame::ScaleStripRows(src_height, height_, kMinBandRows,
+                             &src_rows, &dst_rows);
+  const int num_strips = src_height / src_rows;
+  SlicePool& slice_pool = SlicePool::Instance();
+  const int num_slices = slice_pool.Slices(
+      static_cast<int64>(src_width) * src_height, num_strips);
+
+  // I420 and YV12 differ only in chroma plane order, which is preserved.
+  std::vector<int> slice_status(num_slices, 0);
+  slice_pool.Run(num_slices, [&](int slice) {
+    const int first_strip = num_strips * slice / num_slices;
+    const int end_strip = num_strips * (slice + 1) / num_slices;
+    const int32 src_row = src_rows * first_strip;
+    const int32 dst_row = dst_rows * first_strip;
+    const int32 src_band_rows = src_rows * (end_strip - first_strip);
+    const int32 dst_band_rows = dst_rows * (end_strip - first_strip);
+    const int32 src_y_offset = src_stride * src_row;
+    const int32 src_u_offset = src_u_stride * (src_row / 2);
+    const int32 src_v_offset = src_v_stride * (src_row / 2);
+    const int32 dst_y_offset = dst_stride * dst_row;
+    const int32 dst_uv_offset = dst_uv_stride * (dst_row / 2);
+    if (high_bit_depth) {
+      // libyuv takes 16 bit strides in samples.
+      slice_status[slice] = libyuv::I420Scale_16(
+          reinterpret_cast<const uint16*>(src_y + src_y_offset),
+          src_stride / 2,
+          reinterpret_cast<const uint16*>(src_u + src_u_offset),
+          src_u_stride / 2,
+          reinterpret_cast<const uint16*>(src_v + src_v_offset),
+          src_v_stride / 2,
+          src_width, src_band_rows,
+          reinterpret_cast<uint16*>(dst_y + dst_y_offset), dst_stride / 2,
+          reinterpret_cast<uint16*>(dst_u + dst_uv_offset),
+          dst_uv_stride / 2,
+          reinterpret_cast<uint16*>(dst_v + dst_uv_offset),
+          dst_uv_stride / 2,
+          width_, dst_band_rows,
+          libyuv::kFilterBox);
+    } else {
+      slice_status[slice] = libyuv::I420Scale(
+          src_y + src_y_offset, src_stride,
+          src_u + src_u_offset, src_u_stride,
+          src_v + src_v_offset, src_v_stride,
+          src_width, src_band_rows,
+          dst_y + dst_y_offset, dst_stride,
+          dst_u + dst_uv_offset, dst_uv_stride,
+          dst_v + dst_uv_offset, dst_uv_stride,
+          width_, dst_band_rows,
+          libyuv::kFilterBox);
+    }
+  });
+  int status = 0;
+  for (int slice = 0; slice < num_slices && !status; ++slice) {
+    status = slice_status[slice];
+  }
+  if (status) {
+    LOG(ERROR) << "VideoScaler I420Scale failed: " << status;
+    return kScaleError;
+  }
+
+  VideoConfig scaled_config = source.config();
+  scaled_config.width = width_;
+  scaled_config.height = height_;
+  scaled_config.stride = dst_stride;
+  if (scratch_frame_.InitInPlace(scaled_config,
+                                 source.keyframe(),
+                                 source.timestamp(),
+                                 source.duration(),
+                                 dst_size)) {
+    LOG(ERROR) << "VideoScaler cannot init scaled frame.";
+    return kScaleError;
+  }
+  return ShareScaledFrame(source, ptr_scaled);
+}
+
+int VideoScaler::ScaleSurface(const VideoFrame& source,
+                              SharedVideoFrame* ptr_scaled) {
+  std::shared_ptr<VideoSurface> scaled_surface;
+  const int status =
+      source.surface()->Scale(width_, height_, &scaled_surface);
+  if (status == VideoSurface::kNotSupported) {
+    // Scale a copy in memory instead.
+    if (source.Clone(&readback_frame_) || readback_frame_.Pack()) {
+      LOG(ERROR) << "VideoScaler cannot read back surface.";
+      return kScaleError;
+    }
+    return Scale(readback_frame_, ptr_scaled);
+  } else if (status) {
+    LOG(ERROR) << "VideoScaler surface Scale failed: " << status;
+    return kScaleError;
+  }
+
+  VideoConfig scaled_config = source.config();
+  scaled_config.width = width_;
+  scaled_config.height = height_;
+  if (scratch_frame_.InitSurface(scaled_config,
+                                 source.keyframe(),
+                                 source.timestamp(),
+                                 source.duration(),
+                                 scaled_surface)) {
+    LOG(ERROR) << "VideoScaler cannot init scaled frame.";
+    return kScaleError;
+  }
+  return ShareScaledFrame(source, ptr_scaled);
+}
+
+int VideoScaler::ShareScaledFrame(const VideoFrame& source,
+                                  SharedVideoFrame* ptr_scaled) {
+  scratch_frame_.SetTimeUs(source.timestamp_us(), source.duration_us());
+  ScaleRegionHints(source, scratch_frame_.mutable_region_hints());
+  *scratch_frame_.mutable_analysis() = source.analysis();
+
+  if (frame_pool_.Share(&scratch_frame_, ptr_scaled)) {
+    LOG(ERROR) << "VideoScaler cannot share scaled frame.";
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+}  // namespace webmlive
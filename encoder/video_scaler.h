@@ -0,0 +1,88 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_VIDEO_SCALER_H_
+#define WEBMLIVE_ENCODER_VIDEO_SCALER_H_
+
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+#include "encoder/video_frame_pool.h"
+
+namespace webmlive {
+
+// Scales raw I420, YV12 and I42016 video frames to a fixed output size using
+// libyuv.
+// Scaled frames are returned as |SharedVideoFrame|s backed by a
+// |VideoFramePool|; once the pool covers the scaled frames in flight no memory
+// is allocated per frame.
+//
+// Notes
+// - Frames use the |VideoFrame| plane layout. Source strides are honored, and
+//   output strides are |VideoFrame::AlignedStride()| of the output width.
+// - Frames held in a |VideoSurface| are scaled by the surface's device into
+//   a new surface. Devices that cannot scale have the frame read back and
+//   scaled in memory.
+// - The scaler must outlive the handles returned by |Scale()|.
+class VideoScaler {
+ public:
+  enum {
+    // libyuv failed to scale a frame.
+    kScaleError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  VideoScaler();
+  ~VideoScaler() {}
+
+  // Sets the output size. Returns |kInvalidArg| when |width| or |height| is
+  // not greater than 0.
+  int Init(int32 width, int32 height);
+
+  // Returns true when |frame| is not already the output size.
+  bool NeedsScaling(const VideoFrame& frame) const;
+
+  // Scales |source| to the output size, and stores a handle to the scaled
+  // frame in |ptr_scaled|. All frame properties except for the dimensions are
+  // copied from |source|; region hints are mapped to the output size.
+  // Returns |kSuccess| when successful.
+  int Scale(const VideoFrame& source, SharedVideoFrame* ptr_scaled);
+
+  int32 width() const { return width_; }
+  int32 height() const { return height_; }
+
+ private:
+  // Scales |source|, which is held in a surface; see |Scale()|.
+  int ScaleSurface(const VideoFrame& source, SharedVideoFrame* ptr_scaled);
+
+  // Gives |scratch_frame_|, scaled from |source|, the times, region hints
+  // and analysis of |source|, and shares it through |ptr_scaled|.
+  int ShareScaledFrame(const VideoFrame& source,
+                       SharedVideoFrame* ptr_scaled);
+
+  // Maps the region hints of |source| to the output size.
+  void ScaleRegionHints(const VideoFrame& source,
+                        VideoRegionHints* ptr_hints) const;
+
+  int32 width_;
+  int32 height_;
+
+  // Scaling destination. |VideoFramePool::Share()| exchanges its storage with
+  // that of a released pooled frame, which keeps the storage in circulation.
+  VideoFrame scratch_frame_;
+  VideoFramePool frame_pool_;
+
+  // Surface frames read back for devices that cannot scale.
+  VideoFrame readback_frame_;
+
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VideoScaler);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_VIDEO_SCALER_H_
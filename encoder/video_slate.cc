@@ -0,0 +1,239 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/video_slate.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+
+#include "encoder/encoder_base.h"
+#include "encoder/file_media_source.h"
+#include "encoder/video_frame_pool.h"
+#include "encoder/video_scaler.h"
+#include "encoder/webm_encoder.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Frame rate of slates for sources that report none.
+const double kDefaultFrameRate = 30.0;
+
+// Reads the frames |ptr_encoder| has queued into |ptr_frames|. Returns
+// |VideoSlate::kSuccess| when successful.
+int ReadQueuedFrames(VideoEncoder* ptr_encoder,
+                     std::vector<std::unique_ptr<VideoFrame>>* ptr_frames) {
+  for (;;) {
+    std::unique_ptr<VideoFrame> vpx_frame(
+        new (std::nothrow) VideoFrame());  // NOLINT
+    if (!vpx_frame) {
+      return VideoSlate::kNoMemory;
+    }
+    const int status = ptr_encoder->ReadQueuedFrame(vpx_frame.get());
+    if (status == VideoEncoder::kNoFrame) {
+      return VideoSlate::kSuccess;
+    } else if (status) {
+      LOG(ERROR) << "VideoSlate ReadQueuedFrame failed: " << status;
+      return VideoSlate::kEncoderError;
+    }
+    ptr_frames->push_back(std::move(vpx_frame));
+  }
+}
+}  // namespace
+
+VideoSlate::VideoSlate() : num_frames_(0), position_(-1) {}
+
+int VideoSlate::Init(const std::string& file_name,
+                     const VideoConfig& requested_config) {
+  frames_.clear();
+  num_frames_ = 0;
+  position_ = -1;
+
+  FILE* const file = fopen(file_name.c_str(), "rb");
+  if (!file) {
+    LOG(ERROR) << "VideoSlate cannot open " << file_name;
+    return kFileError;
+  }
+  VideoConfig config;
+  bool is_y4m = false;
+  int32 frame_size = 0;
+  bool invalid = false;
+  bool read = FileMediaSource::ReadVideoFileHeader(file, file_name,
+                                                   requested_config, &config,
+                                                   &is_y4m, &frame_size);
+  if (read && is_y4m) {
+    read = FileMediaSource::ReadY4mFrameHeader(file, &invalid);
+  }
+  if (read) {
+    read = picture_.Allocate(frame_size) == VideoFrame::kSuccess &&
+        fread(picture_.buffer(), 1, frame_size, file) ==
+            static_cast<size_t>(frame_size);
+  }
+  fclose(file);
+  if (!read) {
+    LOG(ERROR) << "VideoSlate cannot read a picture from " << file_name;
+    return kFileError;
+  }
+  if (picture_.InitInPlace(config, true, 0, 0, frame_size)) {
+    return kInvalidArg;
+  }
+  LOG(INFO) << "VideoSlate picture " << file_name << ": " << config.width
+            << "x" << config.height;
+  return kSuccess;
+}
+
+int VideoSlate::AddRepresentation(const WebmEncoderConfig& config,
+                                  const VideoConfig& output_config,
+                                  int bitrate) {
+  if (!picture_.buffer()) {
+    LOG(ERROR) << "VideoSlate has no picture.";
+    return kInvalidArg;
+  }
+  if (output_config.format == kVideoFormatI42016) {
+    LOG(ERROR) << "VideoSlate pictures are 8 bit; the encode is not.";
+    return kInvalidArg;
+  }
+  if (output_config.width <= 0 || output_config.height <= 0) {
+    LOG(ERROR) << "VideoSlate invalid output size " << output_config.width
+               << "x" << output_config.height;
+    return kInvalidArg;
+  }
+
+  // The scaler must outlive |scaled_picture|.
+  VideoScaler scaler;
+  SharedVideoFrame scaled_picture;
+  if (scaler.Init(output_config.width, output_config.height)) {
+    return kInvalidArg;
+  }
+  VideoFrame raw_frame;
+  int status = kSuccess;
+  if (scaler.NeedsScaling(picture_)) {
+    status = scaler.Scale(picture_, &scaled_picture);
+    if (status) {
+      LOG(ERROR) << "VideoSlate cannot scale the picture: " << status;
+      return kInvalidArg;
+    }
+    status = scaled_picture->Clone(&raw_frame);
+  } else {
+    status = picture_.Clone(&raw_frame);
+  }
+  if (status) {
+    return kNoMemory;
+  }
+
+  // The encoder keys only the first frame, and encodes every frame even
+  // though none changes.
+  const double frame_rate = output_config.frame_rate > 0 ?
+      output_config.frame_rate : kDefaultFrameRate;
+  WebmEncoderConfig encoder_config = config;
+  encoder_config.actual_video_config = raw_frame.config();
+  encoder_config.actual_video_config.frame_rate = frame_rate;
+  if (bitrate > 0)
+    encoder_config.vpx_config.bitrate = bitrate;
+  encoder_config.vpx_config.scheduled_keyframes = true;
+  encoder_config.vpx_config.skip_static_frames = false;
+  encoder_config.vpx_config.intra_refresh = false;
+  encoder_config.vpx_config.frame_analysis = false;
+  encoder_config.video_svc = false;
+  VideoEncoder encoder;
+  status = encoder.Init(encoder_config);
+  if (status) {
+    LOG(ERROR) << "VideoSlate encoder Init failed: " << status;
+    return kEncoderError;
+  }
+
+  // Two keyframe intervals of frames, so that a slate starting partway
+  // through one still reaches the next scheduled keyframe.
+  const int64 interval_ms = config.vpx_config.keyframe_interval;
+  int64 count = kMaxFrames;
+  if (interval_ms > 0) {
+    count = 2 * (static_cast<int64>(interval_ms * frame_rate / kTimebase) + 1);
+  }
+  count = std::min<int64>(std::max<int64>(count, 2), kMaxFrames);
+
+  FrameList frames;
+  for (int64 i = 0; i < count; ++i) {
+    // Times are computed in microseconds so that frame rates that do not
+    // divide 1000 keep evenly spaced timestamps.
+    const int64 timestamp_us =
+        static_cast<int64>(i * kMicrosecondTimebase / frame_rate);
+    const int64 next_timestamp_us =
+        static_cast<int64>((i + 1) * kMicrosecondTimebase / frame_rate);
+    raw_frame.SetTimeUs(timestamp_us, next_timestamp_us - timestamp_us);
+
+    std::unique_ptr<VideoFrame> vpx_frame(
+        new (std::nothrow) VideoFrame());  // NOLINT
+    if (!vpx_frame) {
+      return kNoMemory;
+    }
+    status = encoder.EncodeFrame(raw_frame, vpx_frame.get());
+    if (status == VideoEncoder::kSuccess) {
+      frames.push_back(std::move(vpx_frame));
+    } else if (status != VideoEncoder::kDropped) {
+      LOG(ERROR) << "VideoSlate EncodeFrame failed: " << status;
+      return kEncoderError;
+    }
+    status = ReadQueuedFrames(&encoder, &frames);
+    if (status) {
+      return status;
+    }
+  }
+  if (encoder.Flush()) {
+    LOG(ERROR) << "VideoSlate encoder Flush failed.";
+    return kEncoderError;
+  }
+  status = ReadQueuedFrames(&encoder, &frames);
+  if (status) {
+    return status;
+  }
+  if (frames.empty() || !frames[0]->keyframe()) {
+    LOG(ERROR) << "VideoSlate encode does not start with a keyframe.";
+    return kEncoderError;
+  }
+
+  // A keyframe the encoder placed anyway would start a segment nobody
+  // scheduled; the frames before it stand on their own.
+  for (size_t i = 1; i < frames.size(); ++i) {
+    if (frames[i]->keyframe()) {
+      frames.resize(i);
+      break;
+    }
+  }
+  const int32 num_frames = static_cast<int32>(frames.size());
+  num_frames_ = frames_.empty() ? num_frames : std::min(num_frames_,
+                                                        num_frames);
+  frames_.push_back(std::move(frames));
+  LOG(INFO) << "VideoSlate encoded " << num_frames << " frames at "
+            << output_config.width << "x" << output_config.height << ".";
+  return kSuccess;
+}
+
+void VideoSlate::Advance(bool keyframe) {
+  // Past the last inter frame the last one repeats. It was coded against a
+  // picture that had all but converged, so it shows the same picture.
+  if (keyframe || position_ < 0) {
+    position_ = 0;
+  } else {
+    position_ = std::min(position_ + 1, num_frames_ - 1);
+  }
+}
+
+int VideoSlate::CopyFrame(int index, int64 timestamp_us, int64 duration_us,
+                          VideoFrame* ptr_frame) const {
+  if (!ptr_frame || index < 0 || index >= num_representations() ||
+      position_ < 0) {
+    return kInvalidArg;
+  }
+  if (frames_[index][position_]->Clone(ptr_frame)) {
+    return kNoMemory;
+  }
+  ptr_frame->SetTimeUs(timestamp_us, duration_us);
+  return kSuccess;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,119 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_VIDEO_SLATE_H_
+#define WEBMLIVE_ENCODER_VIDEO_SLATE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+struct WebmEncoderConfig;
+
+// Compressed frames of a still picture shown in place of lost video. The
+// picture is encoded once per representation, at startup, into a keyframe
+// followed by inter frames that repeat it; while capture is down the frames
+// are copied out with new timestamps and muxed, which keeps the stream going
+// without encoding anything.
+//
+//   slate.Init("slate.y4m", requested_config);
+//   slate.AddRepresentation(config, worker.output_config(),
+//                           worker.bitrate());
+//   ...
+//   slate.Restart();
+//   for each frame time while capture is down:
+//     slate.Advance(scheduler.ScheduleFrame(timestamp,
+//                                           slate.KeyframeNeeded(), false));
+//     slate.CopyFrame(0, timestamp_us, duration_us, &frame);
+//
+// Notes
+// - The inter frames only repeat what the frame before them decoded to, so
+//   they must follow each other in order from the keyframe. |Advance()|
+//   starts over at the keyframe whenever one is scheduled.
+// - Every representation holds the same number of frames, so that one
+//   keyframe decision serves them all.
+class VideoSlate {
+ public:
+  enum {
+    // The picture could not be encoded.
+    kEncoderError = -4,
+    // The picture file could not be read.
+    kFileError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Most frames held per representation.
+  static const int32 kMaxFrames = 600;
+
+  VideoSlate();
+  ~VideoSlate() {}
+
+  // Reads the first picture of |file_name|: a Y4M file, or a raw I420 file
+  // sized by |requested_config|, as read by |FileMediaSource|. Discards the
+  // frames of any previous picture. Returns |kSuccess| when successful.
+  int Init(const std::string& file_name, const VideoConfig& requested_config);
+
+  // Encodes the picture for a representation of |output_config| size and
+  // frame rate at |bitrate|, with the codec and settings of |config|. Enough
+  // frames are encoded to reach the next keyframe of a
+  // |VpxConfig::keyframe_interval|, twice over. Returns |kSuccess| when
+  // successful.
+  int AddRepresentation(const WebmEncoderConfig& config,
+                        const VideoConfig& output_config, int bitrate);
+
+  // Returns true when the next frame must be a keyframe: the first frame
+  // after |Restart()|, and the frame after the last inter frame.
+  bool KeyframeNeeded() const {
+    return position_ < 0 || position_ + 1 >= num_frames_;
+  }
+
+  // Moves to the keyframe when |keyframe| is true, and to the next inter
+  // frame otherwise.
+  void Advance(bool keyframe);
+
+  // Copies the current frame of representation |index| to |ptr_frame|, and
+  // stamps it |timestamp_us| and |duration_us|. Returns |kSuccess| when
+  // successful.
+  int CopyFrame(int index, int64 timestamp_us, int64 duration_us,
+                VideoFrame* ptr_frame) const;
+
+  // Starts the next |Advance()| over; the frame after it must be a keyframe.
+  void Restart() { position_ = -1; }
+
+  // Returns the number of representations added.
+  int num_representations() const {
+    return static_cast<int>(frames_.size());
+  }
+
+ private:
+  typedef std::vector<std::unique_ptr<VideoFrame>> FrameList;
+
+  // The picture read by |Init()|.
+  VideoFrame picture_;
+
+  // Compressed frames of each representation, keyframe first.
+  std::vector<FrameList> frames_;
+
+  // Frames of the shortest representation.
+  int32 num_frames_;
+
+  // Index of the current frame, or -1 before the first |Advance()|.
+  int32 position_;
+
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VideoSlate);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_VIDEO_SLATE_H_
@@ -0,0 +1,72 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_VIDEO_SURFACE_H_
+#define WEBMLIVE_ENCODER_VIDEO_SURFACE_H_
+
+#include <memory>
+
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+// Pure interface of a 4:2:0 picture held in GPU memory, a VA-API surface or
+// a D3D11 texture for example, carried through the pipeline by
+// |VideoFrame::InitSurface()|. Stages of the surface's device scale,
+// composite and encode it in place; CPU stages read it back into memory
+// with |VideoFrame::Pack()|.
+//
+// Notes
+// - Surfaces are not written once filled: |Scale()| and |Compose()| make new
+//   ones, so that frames sharing a surface never see it change.
+// - Implementations must be thread safe; workers scale and encode the
+//   frames they share at the same time.
+class VideoSurface {
+ public:
+  enum {
+    // The device cannot do the operation; read the surface back and do it
+    // in memory instead.
+    kNotSupported = -3,
+    // The device reported an error.
+    kDeviceError = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  virtual ~VideoSurface() {}
+
+  // Returns an identifier of the device holding the surface. Surfaces of
+  // the same device pass between its stages without copies.
+  virtual const void* device() const = 0;
+
+  virtual int32 width() const = 0;
+  virtual int32 height() const = 0;
+
+  // Copies the picture to I420 planes in memory: luma at |ptr_y| with
+  // stride |y_stride|, and chroma at |ptr_u| and |ptr_v| with stride
+  // |uv_stride|. Returns |kSuccess| when successful.
+  virtual int Read(uint8* ptr_y, int32 y_stride, uint8* ptr_u, uint8* ptr_v,
+                   int32 uv_stride) const = 0;
+
+  // Scales the picture into a new |width| x |height| surface of the same
+  // device, stored in |ptr_scaled|. Returns |kSuccess| when successful.
+  virtual int Scale(int32 width, int32 height,
+                    std::shared_ptr<VideoSurface>* ptr_scaled) const = 0;
+
+  // Copies the picture into a new surface of the same device, stored in
+  // |ptr_composed|, with |overlay| drawn over |rect| at |opacity|, from 0
+  // to 1. |overlay| must belong to the same device. Returns |kSuccess| when
+  // successful.
+  virtual int Compose(const VideoSurface& overlay, const VideoRect& rect,
+                      double opacity,
+                      std::shared_ptr<VideoSurface>* ptr_composed) const = 0;
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_VIDEO_SURFACE_H_
@@ -0,0 +1,418 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/vod_webm_builder.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#include "encoder/ebml_util.h"
+#include "encoder/file_util.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+
+const char kTempFileSuffix[] = ".tmp";
+
+// Length of the Segment size, and of SeekPosition values. Fixed lengths keep
+// the size of the SeekHead independent of the positions it holds.
+const int32 kSegmentSizeLength = 8;
+const int32 kSeekPositionLength = 8;
+
+const uint64 kDefaultTimecodeScale = 1000000;
+
+// Reads the file at |path| into |ptr_data|. Returns false on failure.
+bool ReadFile(const std::string& path, std::vector<uint8>* ptr_data) {
+  const int64 size = FileSize(path);
+  FILE* const file = size >= 0 ? fopen(path.c_str(), "rb") : NULL;
+  if (!file)
+    return false;
+  ptr_data->resize(static_cast<size_t>(size));
+  const bool read_ok = size == 0 ||
+      fread(&(*ptr_data)[0], 1, ptr_data->size(), file) == ptr_data->size();
+  fclose(file);
+  return read_ok;
+}
+
+}  // namespace
+
+VodWebmBuilder::VodWebmBuilder()
+    : timecode_scale_(kDefaultTimecodeScale), cue_track_(0), file_(NULL) {
+}
+
+VodWebmBuilder::~VodWebmBuilder() {
+  if (file_) {
+    fclose(file_);
+  }
+}
+
+int VodWebmBuilder::Build(const std::string& directory,
+                          const std::string& stream, int64 duration_ms,
+                          const std::string& output_path) {
+  if (stream.empty() || output_path.empty() || file_) {
+    LOG(ERROR) << "invalid VodWebmBuilder arguments.";
+    return kInvalidArg;
+  }
+  const std::chrono::steady_clock::time_point start_time =
+      std::chrono::steady_clock::now();
+  const std::string stem = directory + stream;
+  int status = ReadIndex(stem + ".idx");
+  if (status)
+    return status;
+  if (duration_ms <= 0)
+    duration_ms = index_.back().timecode;
+  status = ReadHeader(stem + ".hdr", duration_ms);
+  if (status)
+    return status;
+
+  // Chunks are numbered from 1 up to the chunk of the last cluster.
+  std::vector<std::string> chunk_paths;
+  std::vector<int64> chunk_sizes;
+  int64 chunks_length = 0;
+  for (int64 chunk = 1; chunk <= index_.back().chunk; ++chunk) {
+    std::ostringstream path;
+    path << stem << "_" << chunk << ".chk";
+    const int64 size = FileSize(path.str());
+    if (size <= 0) {
+      LOG(ERROR) << "missing or empty chunk " << path.str();
+      return kReadError;
+    }
+    chunk_paths.push_back(path.str());
+    chunk_sizes.push_back(size);
+    chunks_length += size;
+  }
+
+  // Build the SeekHead with placeholder positions to learn its size, which
+  // does not depend on them.
+  std::vector<uint8> seek_head;
+  const uint32 seek_ids[] = { kInfoId, kTracksId, kCuesId };
+  int64 seek_positions[] = { 0, 0, 0 };
+  const int32 num_seeks = sizeof(seek_ids) / sizeof(seek_ids[0]);
+  for (int pass = 0; pass < 2; ++pass) {
+    std::vector<uint8> seeks;
+    for (int32 i = 0; i < num_seeks; ++i) {
+      std::vector<uint8> seek;
+      std::vector<uint8> seek_id;
+      AppendId(seek_ids[i], &seek_id);
+      AppendId(kSeekIdId, &seek);
+      AppendSize(seek_id.size(), 0, &seek);
+      seek.insert(seek.end(), seek_id.begin(), seek_id.end());
+      AppendUInt(kSeekPositionId, seek_positions[i], kSeekPositionLength,
+                 &seek);
+      AppendMaster(kSeekId, seek, &seeks);
+    }
+    seek_head.clear();
+    AppendMaster(kSeekHeadId, seeks, &seek_head);
+    seek_positions[0] = static_cast<int64>(seek_head.size());
+    seek_positions[1] = seek_positions[0] + static_cast<int64>(info_.size());
+    seek_positions[2] = seek_positions[1] + static_cast<int64>(tracks_.size()) +
+        chunks_length;
+  }
+  const int64 clusters_start =
+      seek_positions[1] + static_cast<int64>(tracks_.size());
+  status = BuildCues(chunk_sizes, clusters_start);
+  if (status)
+    return status;
+
+  std::vector<uint8> segment_header;
+  AppendId(kSegmentId, &segment_header);
+  AppendSize(seek_positions[2] + cues_.size(), kSegmentSizeLength,
+             &segment_header);
+
+  const std::string temp_path = output_path + kTempFileSuffix;
+  file_ = fopen(temp_path.c_str(), "wb");
+  if (!file_) {
+    LOG(ERROR) << "cannot open " << temp_path;
+    return kWriteError;
+  }
+  bool write_ok = Write(&ebml_header_[0], ebml_header_.size()) &&
+                  Write(&segment_header[0], segment_header.size()) &&
+                  Write(&seek_head[0], seek_head.size()) &&
+                  Write(&info_[0], info_.size()) &&
+                  Write(&tracks_[0], tracks_.size());
+  for (size_t i = 0; write_ok && i < chunk_paths.size(); ++i) {
+    status = CopyChunk(chunk_paths[i], chunk_sizes[i]);
+    write_ok = (status == kSuccess);
+  }
+  write_ok = write_ok && Write(&cues_[0], cues_.size());
+  const bool close_ok = (fclose(file_) == 0);
+  file_ = NULL;
+  if (!write_ok || !close_ok) {
+    LOG(ERROR) << "cannot write " << temp_path;
+    remove(temp_path.c_str());
+    return status == kReadError ? kReadError : kWriteError;
+  }
+  remove(output_path.c_str());
+  if (rename(temp_path.c_str(), output_path.c_str())) {
+    LOG(ERROR) << "cannot rename " << temp_path;
+    return kWriteError;
+  }
+
+  const int64 elapsed_ms =
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now() - start_time).count();
+  LOG(INFO) << "built " << output_path << " from " << chunk_paths.size()
+            << " chunks, " << index_.size() << " clusters, in " << elapsed_ms
+            << "ms.";
+  return kSuccess;
+}
+
+int VodWebmBuilder::ReadIndex(const std::string& path) {
+  std::ifstream file(path.c_str());
+  if (!file) {
+    LOG(ERROR) << "cannot open cluster index " << path;
+    return kReadError;
+  }
+  index_.clear();
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream fields(line);
+    IndexEntry entry;
+    int keyframe = 0;
+    if (!(fields >> entry.chunk >> entry.offset >> entry.timecode >>
+          keyframe) || entry.chunk < 1 ||
+        (!index_.empty() && (entry.chunk < index_.back().chunk ||
+                             entry.offset <= index_.back().offset))) {
+      LOG(ERROR) << "malformed cluster index line: " << line;
+      return kParseError;
+    }
+    entry.keyframe = (keyframe != 0);
+    index_.push_back(entry);
+  }
+  if (index_.empty()) {
+    LOG(ERROR) << "cluster index " << path << " is empty.";
+    return kParseError;
+  }
+  return kSuccess;
+}
+
+int VodWebmBuilder::ReadHeader(const std::string& path, int64 duration_ms) {
+  std::vector<uint8> header;
+  if (!ReadFile(path, &header) || header.empty()) {
+    LOG(ERROR) << "cannot read header chunk " << path;
+    return kReadError;
+  }
+  const uint8* ptr_pos = &header[0];
+  const uint8* const ptr_end = ptr_pos + header.size();
+  while (ptr_pos < ptr_end) {
+    const uint8* const ptr_element = ptr_pos;
+    uint32 id = 0;
+    int64 size = 0;
+    if (!ReadElementHeader(&ptr_pos, ptr_end, &id, &size)) {
+      LOG(ERROR) << "malformed element in header chunk " << path;
+      return kParseError;
+    }
+    if (id == kSegmentId)
+      continue;
+    if (size < 0 || id == kClusterId) {
+      LOG(ERROR) << "unexpected element in header chunk, id=" << std::hex
+                 << id;
+      return kParseError;
+    }
+    if (id == kEbmlId) {
+      ebml_header_.assign(ptr_element, ptr_pos + size);
+    } else if (id == kInfoId) {
+      BuildInfo(ptr_pos, size, duration_ms);
+    } else if (id == kTracksId) {
+      tracks_.assign(ptr_element, ptr_pos + size);
+      FindCueTrack(ptr_pos, size);
+    }
+    // The SeekHead and Void elements of the live header are replaced.
+    ptr_pos += size;
+  }
+  if (ebml_header_.empty() || info_.empty() || tracks_.empty() ||
+      cue_track_ == 0) {
+    LOG(ERROR) << "header chunk " << path << " lacks an element or a track.";
+    return kParseError;
+  }
+  return kSuccess;
+}
+
+void VodWebmBuilder::BuildInfo(const uint8* ptr_info, int64 length,
+                               int64 duration_ms) {
+  std::vector<uint8> payload;
+  const uint8* ptr_pos = ptr_info;
+  const uint8* const ptr_end = ptr_info + length;
+  while (ptr_pos < ptr_end) {
+    const uint8* const ptr_child = ptr_pos;
+    uint32 id = 0;
+    int64 size = 0;
+    if (!ReadElementHeader(&ptr_pos, ptr_end, &id, &size) || size < 0) {
+      LOG(WARNING) << "ignoring malformed Info child.";
+      break;
+    }
+    if (id == kTimecodeScaleId)
+      timecode_scale_ = ReadUnsigned(ptr_pos, size);
+    if (id != kDurationId)
+      payload.insert(payload.end(), ptr_child, ptr_pos + size);
+    ptr_pos += size;
+  }
+  if (timecode_scale_ == 0)
+    timecode_scale_ = kDefaultTimecodeScale;
+
+  // Duration is a float in timecode scale units.
+  const double duration = static_cast<double>(duration_ms) *
+      kDefaultTimecodeScale / static_cast<double>(timecode_scale_);
+  uint64 duration_bits = 0;
+  memcpy(&duration_bits, &duration, sizeof(duration_bits));
+  AppendId(kDurationId, &payload);
+  AppendSize(sizeof(duration), 0, &payload);
+  AppendBigEndian(duration_bits, sizeof(duration), &payload);
+
+  info_.clear();
+  AppendMaster(kInfoId, payload, &info_);
+}
+
+void VodWebmBuilder::FindCueTrack(const uint8* ptr_tracks, int64 length) {
+  uint64 audio_track = 0;
+  uint64 video_track = 0;
+  const uint8* ptr_pos = ptr_tracks;
+  const uint8* const ptr_end = ptr_tracks + length;
+  while (ptr_pos < ptr_end) {
+    uint32 id = 0;
+    int64 size = 0;
+    if (!ReadElementHeader(&ptr_pos, ptr_end, &id, &size) || size < 0)
+      break;
+    const uint8* const ptr_entry_end = ptr_pos + size;
+    uint64 number = 0;
+    uint64 type = 0;
+    while (id == kTrackEntryId && ptr_pos < ptr_entry_end) {
+      uint32 child_id = 0;
+      int64 child_size = 0;
+      if (!ReadElementHeader(&ptr_pos, ptr_entry_end, &child_id,
+                             &child_size) || child_size < 0)
+        break;
+      if (child_id == kTrackNumberId)
+        number = ReadUnsigned(ptr_pos, child_size);
+      else if (child_id == kTrackTypeId)
+        type = ReadUnsigned(ptr_pos, child_size);
+      ptr_pos += child_size;
+    }
+    if (type == kTrackTypeVideo && video_track == 0)
+      video_track = number;
+    else if (type == kTrackTypeAudio && audio_track == 0)
+      audio_track = number;
+    ptr_pos = ptr_entry_end;
+  }
+  cue_track_ = video_track ? video_track : audio_track;
+}
+
+int VodWebmBuilder::BuildCues(const std::vector<int64>& chunk_sizes,
+                              int64 clusters_start) {
+  std::vector<uint8> cue_points;
+  int64 chunk = 0;
+  int64 chunk_start = clusters_start;
+  int64 chunk_first_offset = 0;
+  for (size_t i = 0; i < index_.size(); ++i) {
+    const IndexEntry& entry = index_[i];
+    // Chunks begin with a cluster, which is the first entry of the chunk.
+    while (chunk < entry.chunk) {
+      if (chunk > 0)
+        chunk_start += chunk_sizes[chunk - 1];
+      ++chunk;
+      chunk_first_offset = entry.offset;
+    }
+    const int64 offset_in_chunk = entry.offset - chunk_first_offset;
+    if (offset_in_chunk >= chunk_sizes[chunk - 1]) {
+      LOG(ERROR) << "cluster index offset " << entry.offset
+                 << " is past the end of chunk " << chunk;
+      return kParseError;
+    }
+    if (!entry.keyframe)
+      continue;
+
+    std::vector<uint8> positions;
+    AppendUInt(kCueTrackId, cue_track_, 0, &positions);
+    AppendUInt(kCueClusterPositionId, chunk_start + offset_in_chunk, 0,
+               &positions);
+    std::vector<uint8> cue_point;
+    AppendUInt(kCueTimeId,
+               entry.timecode * kDefaultTimecodeScale / timecode_scale_, 0,
+               &cue_point);
+    AppendMaster(kCueTrackPositionsId, positions, &cue_point);
+    AppendMaster(kCuePointId, cue_point, &cue_points);
+  }
+  if (cue_points.empty()) {
+    LOG(ERROR) << "cluster index has no keyframe cluster.";
+    return kParseError;
+  }
+  cues_.clear();
+  AppendMaster(kCuesId, cue_points, &cues_);
+  return kSuccess;
+}
+
+int VodWebmBuilder::CopyChunk(const std::string& path, int64 size) {
+  FILE* const input = fopen(path.c_str(), "rb");
+  if (!input) {
+    LOG(ERROR) << "cannot open chunk " << path;
+    return kReadError;
+  }
+  int64 copied = 0;
+
+#ifdef __linux__
+  // copy_file_range() copies in the kernel, without a pass through user
+  // space, and shares the blocks on file systems that support reflinks. It
+  // works on descriptors, so stdio buffers are flushed first and |file_| is
+  // repositioned at the end of its new contents afterwards.
+  if (fflush(file_) == 0) {
+    const int input_fd = fileno(input);
+    const int output_fd = fileno(file_);
+    while (copied < size) {
+      const ssize_t result = copy_file_range(
+          input_fd, NULL, output_fd, NULL,
+          static_cast<size_t>(size - copied), 0);
+      if (result <= 0)
+        break;
+      copied += result;
+    }
+    if (SeekFile(file_, 0, SEEK_END) ||
+        (copied < size && SeekFile(input, copied, SEEK_SET))) {
+      LOG(ERROR) << "cannot reposition after copying " << path;
+      fclose(input);
+      return kWriteError;
+    }
+  }
+#endif
+
+  // Copy what the kernel did not through |copy_buffer_|.
+  if (copied < size && copy_buffer_.empty())
+    copy_buffer_.resize(kCopyBufferSize);
+  while (copied < size) {
+    const size_t read_length = fread(&copy_buffer_[0], 1,
+                                     copy_buffer_.size(), input);
+    if (read_length == 0)
+      break;
+    if (!Write(&copy_buffer_[0], read_length)) {
+      fclose(input);
+      return kWriteError;
+    }
+    copied += read_length;
+  }
+  fclose(input);
+  if (copied != size) {
+    LOG(ERROR) << "chunk " << path << " changed size while being copied.";
+    return kReadError;
+  }
+  return kSuccess;
+}
+
+bool VodWebmBuilder::Write(const void* ptr_data, size_t length) {
+  return fwrite(ptr_data, 1, length, file_) == length;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,120 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_VOD_WEBM_BUILDER_H_
+#define WEBMLIVE_ENCODER_VOD_WEBM_BUILDER_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/encoder_base.h"
+
+namespace webmlive {
+
+// Builds a seekable WebM file from the chunks a |LiveWebmMuxer| wrote to a
+// directory, without remuxing them: the header chunk, <stream>.hdr, the
+// cluster chunks, <stream>_<n>.chk, and the cluster index, <stream>.idx,
+// written by |LiveWebmMuxer::WriteClusterIndex()|.
+//
+// The output is the EBML header and the Segment of the header chunk, with a
+// known size, a SeekHead, and a Duration added to its Info. The chunks
+// follow as they are, and Cues built from the keyframe clusters of the index
+// end the file. Only the header chunk and the index are parsed; cluster
+// bytes are copied, in the kernel where possible, so the time taken is that
+// of copying the chunks.
+//
+// Notes
+// - The clusters keep their unknown sizes, which WebM allows in a Segment of
+//   known size.
+// - Cue positions come from the index: each cluster's offset from the first
+//   cluster of its chunk, plus where the chunk lands in the output.
+// - The file is written as <output>.tmp and renamed once complete.
+class VodWebmBuilder {
+ public:
+  enum {
+    // The header chunk or the cluster index is malformed.
+    kParseError = -5,
+    // A chunk or the index could not be read.
+    kReadError = -4,
+    // The output could not be written.
+    kWriteError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Size of the buffer used when chunks cannot be copied by the kernel.
+  static const int32 kCopyBufferSize = 1024 * 1024;
+
+  VodWebmBuilder();
+  ~VodWebmBuilder();
+
+  // Builds |output_path| from the chunks of |stream| in |directory|, which
+  // must end with a path separator. |duration_ms| is the Duration written;
+  // the timecode of the last cluster is used when it is 0 or less. Returns
+  // |kSuccess| when successful.
+  int Build(const std::string& directory, const std::string& stream,
+            int64 duration_ms, const std::string& output_path);
+
+ private:
+  // Cluster of the index.
+  struct IndexEntry {
+    IndexEntry() : chunk(0), offset(0), timecode(0), keyframe(false) {}
+    int64 chunk;
+    int64 offset;
+    int64 timecode;
+    bool keyframe;
+  };
+
+  // Reads the cluster index at |path| into |index_|. Returns |kSuccess|
+  // when successful.
+  int ReadIndex(const std::string& path);
+
+  // Reads the header chunk at |path|, and splits it into |ebml_header_|,
+  // |info_|, with a Duration of |duration_ms|, and |tracks_|. Returns
+  // |kSuccess| when successful.
+  int ReadHeader(const std::string& path, int64 duration_ms);
+
+  // Appends the Info element of |length| bytes at |ptr_info| to |info_|,
+  // replacing its Duration with |duration_ms|.
+  void BuildInfo(const uint8* ptr_info, int64 length, int64 duration_ms);
+
+  // Stores the number of the track cues point at in |cue_track_|: the video
+  // track of the Tracks element of |length| bytes at |ptr_tracks|, or the
+  // audio track when there is no video.
+  void FindCueTrack(const uint8* ptr_tracks, int64 length);
+
+  // Builds |cues_| from |index_|, with the size of each chunk in
+  // |chunk_sizes| and the position of the first chunk in the Segment.
+  // Returns |kSuccess| when successful.
+  int BuildCues(const std::vector<int64>& chunk_sizes, int64 clusters_start);
+
+  // Appends the |size| bytes of the chunk at |path| to |file_|. Returns
+  // |kSuccess| when successful.
+  int CopyChunk(const std::string& path, int64 size);
+
+  // Writes |length| bytes at |ptr_data| to |file_|. Returns false on
+  // failure.
+  bool Write(const void* ptr_data, size_t length);
+
+  std::vector<IndexEntry> index_;
+  std::vector<uint8> ebml_header_;
+  std::vector<uint8> info_;
+  std::vector<uint8> tracks_;
+  std::vector<uint8> cues_;
+  uint64 timecode_scale_;
+  uint64 cue_track_;
+  FILE* file_;
+  std::vector<uint8> copy_buffer_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VodWebmBuilder);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_VOD_WEBM_BUILDER_H_
@@ -12,6 +12,10 @@
 #include <new>
 #include <string>
 
+#include "encoder/audio_resampler.h"
+#include "encoder/pcm_deinterleave.h"
+#include "encoder/pcm_silence.h"
+#include "encoder/trace_log.h"
 #include "glog/logging.h"
 
 namespace {
@@ -45,41 +49,6 @@ int StorePacketPayload(const ogg_packet& packet,
   return VorbisEncoder::kSuccess;
 }
 
-// Stores payload data from |packet| in |ptr_storage|. Returns |kSuccess| after
-// successful allocation of storage and copy of ogg_packet data.
-int StorePacketPayload(const ogg_packet& packet,
-                       std::vector<uint8>* ptr_storage) {
-  using namespace webmlive;
-  if (!ptr_storage) {
-    LOG(ERROR) << "cannot StoreDataPacket with NULL storage.";
-    return VorbisEncoder::kInvalidArg;
-  }
-  if (!ValidOggPacket(packet)) {
-    LOG(ERROR) << "cannot StoreDataPacket with invalid packet.";
-    return VorbisEncoder::kInvalidArg;
-  }
-  std::copy(packet.packet, packet.packet + packet.bytes,
-            std::back_inserter(*ptr_storage));
-  return VorbisEncoder::kSuccess;
-}
-
-// Stores |packet| in |ptr_storage|. Returns |kSuccess| after successful
-// allocation of storage and copy of ogg_packet data.
-int StorePacket(const ogg_packet& packet, std::vector<uint8>* ptr_storage) {
-  using namespace webmlive;
-  if (!ptr_storage) {
-    LOG(ERROR) << "cannot StoreDataPacket with NULL storage.";
-    return VorbisEncoder::kInvalidArg;
-  }
-  if (!ValidOggPacket(packet)) {
-    LOG(ERROR) << "cannot StoreDataPacket with invalid packet.";
-    return VorbisEncoder::kInvalidArg;
-  }
-  const uint8* p = reinterpret_cast<const uint8*>(&packet);
-  std::copy(p, p + sizeof(ogg_packet), std::back_inserter(*ptr_storage));
-  return VorbisEncoder::kSuccess;
-}
-
 }  // namespace
 
 namespace webmlive {
@@ -93,6 +62,16 @@ VorbisEncoder::VorbisEncoder()
       last_timestamp_(0),
       time_encoded_(0),
       first_input_timestamp_(-1),
+      num_pending_packets_(0),
+      first_pending_granulepos_(0),
+      last_pending_granulepos_(0),
+      pending_delay_granulepos_(0),
+      long_block_size_(0),
+      samples_written_(0),
+      last_packet_granulepos_(0),
+      silence_start_(-1),
+      silence_pending_(0),
+      silence_skipped_(0),
       block_initialized_(false),
       dsp_initialized_(false),
       info_initialized_(false) {
@@ -195,6 +174,8 @@ int VorbisEncoder::Init(const AudioConfig& audio_config,
   audio_config_ = audio_config;
   audio_config_.format_tag = kAudioFormatVorbis;
   vorbis_config_ = vorbis_config;
+  vorbis_samples_.reserve(kPacketArenaSize);
+  long_block_size_ = vorbis_info_blocksize(&info_, 1);
   return kSuccess;
 }
 
@@ -210,7 +191,29 @@ int VorbisEncoder::Encode(const AudioBuffer& input_buffer) {
   }
   const AudioConfig& ac = input_buffer.config();
   const AudioBuffer& ib = input_buffer;
-  const int num_blocks = ib.buffer_length() / ac.block_align;
+  const int num_blocks = ib.num_frames();
+
+  // Silence that libvorbis need not analyze waits in |silence_pending_| for
+  // |ReadCompressedAudio()| to send as copies of |silent_packet_|. Sound
+  // ends the wait: the samples left over go to libvorbis first.
+  if (vorbis_config_.skip_silence) {
+    if (!IsSilentBuffer(ib)) {
+      silence_start_ = -1;
+      const int status = WritePendingSilence();
+      if (status) {
+        return status;
+      }
+    } else {
+      if (silence_start_ < 0) {
+        silence_start_ = samples_written_;
+      }
+      if (CanSkipSilence()) {
+        silence_pending_ += num_blocks;
+        return kSuccess;
+      }
+    }
+  }
+
   float** const ptr_encoder_buffer =
       vorbis_analysis_buffer(&dsp_state_, num_blocks);
   if (!ptr_encoder_buffer) {
@@ -222,26 +225,71 @@ int VorbisEncoder::Encode(const AudioBuffer& input_buffer) {
   //                   the ffmpeg libvorbis plugin uses to handle channel order
   //                   differences between uncompressed and vorbis audio.
   const int channels = ac.channels;
-  if (ac.format_tag == kAudioFormatPcm) {
+  if (ib.planar()) {
+    // Already deinterleaved float; copy each channel.
+    for (int i = 0; i < channels; ++i) {
+      memcpy(ptr_encoder_buffer[i], ib.plane(i), num_blocks * sizeof(float));
+    }
+  } else if (ac.format_tag == kAudioFormatPcm) {
     // Deinterleave input samples, convert them to float, and store them in
     // |ptr_encoder_buffer|.
     const int16* const s16_pcm_samples = reinterpret_cast<int16*>(ib.buffer());
-    for (int i = 0; i < num_blocks; ++i) {
-      for (int c = 0; c < channels; ++c) {
-        ptr_encoder_buffer[c][i] = s16_pcm_samples[i * channels + c] / 32768.f;
-      }
-    }
+    DeinterleaveS16ToFloat(s16_pcm_samples, num_blocks, channels,
+                           ptr_encoder_buffer);
   } else {
     // Deinterleave input samples into |ptr_encoder_buffer|.
     const float* const ieee_float_samples =
         reinterpret_cast<float*>(ib.buffer());
-    for (int i = 0; i < num_blocks; ++i) {
-      for (int c = 0; c < channels; ++c) {
-        ptr_encoder_buffer[c][i] = ieee_float_samples[i * channels + c];
-      }
-    }
+    DeinterleaveFloat(ieee_float_samples, num_blocks, channels,
+                      ptr_encoder_buffer);
   }
   vorbis_analysis_wrote(&dsp_state_, num_blocks);
+  samples_written_ += num_blocks;
+  return kSuccess;
+}
+
+int VorbisEncoder::EncodeResampled(const AudioBuffer& input_buffer,
+                                   AudioResampler* ptr_resampler) {
+  if (!input_buffer.buffer() || !ptr_resampler) {
+    LOG(ERROR) << "cannot EncodeResampled empty input buffer!";
+    return kInvalidArg;
+  }
+  if (ptr_resampler->output_rate() !=
+      static_cast<int>(audio_config_.sample_rate)) {
+    LOG(ERROR) << "resampler output rate does not match the encoder's.";
+    return kUnsupportedFormat;
+  }
+  if (first_input_timestamp_ == -1) {
+    first_input_timestamp_ = input_buffer.timestamp();
+    LOG(INFO) << "VorbisEncoder first_input_timestamp_="
+              << first_input_timestamp_;
+  }
+  const int status = WritePendingSilence();
+  if (status) {
+    return status;
+  }
+  const int32 max_frames =
+      ptr_resampler->MaxOutputFrames(input_buffer.num_frames());
+  float** const ptr_encoder_buffer =
+      vorbis_analysis_buffer(&dsp_state_, max_frames);
+  if (!ptr_encoder_buffer) {
+    LOG(ERROR) << "cannot EncodeResampled, no memory from libvorbis.";
+    return kNoMemory;
+  }
+  int32 num_frames = 0;
+  if (ptr_resampler->ResampleToPlanes(input_buffer, max_frames,
+                                      ptr_encoder_buffer, &num_frames)) {
+    return kUnsupportedFormat;
+  }
+
+  // A count of 0 would tell libvorbis the stream has ended.
+  if (num_frames > 0) {
+    vorbis_analysis_wrote(&dsp_state_, num_frames);
+  }
+
+  // Resampled input is not checked for silence.
+  samples_written_ += num_frames;
+  silence_start_ = -1;
   return kSuccess;
 }
 
@@ -265,48 +313,53 @@ int VorbisEncoder::ReadCompressedAudio(AudioBuffer* ptr_buffer) {
       return kCodecError;
     }
     while ((status = vorbis_bitrate_flushpacket(&dsp_state_, &packet)) == 1) {
-      if (StorePacket(packet, &ogg_packets_)) {
-        LOG(ERROR) << "StorePacket failed: " << status;
+      if (!ValidOggPacket(packet)) {
+        LOG(ERROR) << "vorbis_bitrate_flushpacket returned invalid packet.";
         return kCodecError;
       }
-      if (StorePacketPayload(packet, &vorbis_samples_)) {
-        LOG(ERROR) << "StorePacketPayload failed: " << status;
-        return kCodecError;
+      if (num_pending_packets_ == 0) {
+        first_pending_granulepos_ = packet.granulepos;
       }
+      if (audio_delay_ == 0 && pending_delay_granulepos_ <= 0) {
+        pending_delay_granulepos_ = packet.granulepos;
+      }
+      last_pending_granulepos_ = packet.granulepos;
+      ++num_pending_packets_;
+      if (vorbis_config_.skip_silence && silent_packet_.empty()) {
+        FindSilentPacket(packet);
+      }
+      last_packet_granulepos_ = packet.granulepos;
+
+      // |vorbis_samples_| is cleared, not released, after each read: once it
+      // has grown to the largest packet group no further allocations occur.
+      vorbis_samples_.insert(vorbis_samples_.end(), packet.packet,
+                             packet.packet + packet.bytes);
     }
   }
-  if (ogg_packets_.size() < sizeof(packet) || vorbis_samples_.size() == 0) {
-    return kNoSamples;
+  if (num_pending_packets_ == 0 && silence_pending_ >= long_block_size_ / 2) {
+    return ReadSilentPacket(ptr_buffer);
   }
-  if (vorbis_samples_.size() < static_cast<size_t>(packet.bytes)) {
-    LOG(ERROR) << "Error reading packets from libvorbis.";
-    return kEncoderError;
+  if (num_pending_packets_ == 0 || vorbis_samples_.empty()) {
+    return kNoSamples;
   }
 
   // Use first packet with non-zero |granualpos| for delay.
-  if (audio_delay_ == 0) {
-    const int num_packets = ogg_packets_.size() / sizeof(packet);
-    for (int i = 0; i < num_packets; ++i ) {
-      const ogg_packet* const p =
-          reinterpret_cast<ogg_packet*>(&ogg_packets_[i * sizeof(packet)]);
-      if (packet.granulepos > 0) {
-        audio_delay_ = SamplesToMilliseconds(p->granulepos);
-        LOG(INFO) << "VorbisEncoder audio_delay_=" << audio_delay_;
-        break;
-      }
-    }
+  if (audio_delay_ == 0 && pending_delay_granulepos_ > 0) {
+    audio_delay_ = SamplesToMilliseconds(pending_delay_granulepos_);
+    LOG(INFO) << "VorbisEncoder audio_delay_=" << audio_delay_;
   }
 
   // Use |granualpos| from the first packet returned by
-  // |vorbis_bitrate_flushpacket()| to calculate |timestamp|.
-  const ogg_packet* const p = reinterpret_cast<ogg_packet*>(&ogg_packets_[0]);
+  // |vorbis_bitrate_flushpacket()| to calculate |timestamp|. Silence sent
+  // without libvorbis is missing from its positions.
   const int64 timestamp =
-      SamplesToMilliseconds(p->granulepos) + first_input_timestamp_;
+      SamplesToMilliseconds(first_pending_granulepos_ + silence_skipped_) +
+      first_input_timestamp_;
 
-  // |packet.granulepos| is the last complete sample in the packet, use it to
-  // calculate |duration|.
+  // |granulepos| of the last packet is the last complete sample in the
+  // packet, use it to calculate |duration|.
   const int64 duration =
-      SamplesToMilliseconds(packet.granulepos - samples_encoded_);
+      SamplesToMilliseconds(last_pending_granulepos_ - samples_encoded_);
   const int status = ptr_buffer->Init(audio_config_,
                                       timestamp,
                                       duration,
@@ -316,20 +369,92 @@ int VorbisEncoder::ReadCompressedAudio(AudioBuffer* ptr_buffer) {
     LOG(ERROR) << "AudioBuffer Init failed: " << status;
     return kCodecError;
   }
-  LOG(INFO) << "ReadCompressedAudio\n"
-      << "   samples_encoded_=" << samples_encoded_ << "\n"
-      << "   timestamp(sec)=" << (timestamp / 1000.0) << "\n"
-      << "   timestamp="      << timestamp << "\n"
-      << "   duration(sec)= " << (duration / 1000.0) << "\n"
-      << "   duration= "      << duration << "\n";
+  WEBMLIVE_TRACE_EVERY_N(TraceLog::kFrame, 50, "vorbis_packet")
+      << " samples_encoded=" << samples_encoded_
+      << " timestamp=" << timestamp
+      << " duration=" << duration;
   last_timestamp_ = timestamp;
-  samples_encoded_ = packet.granulepos;
-  time_encoded_ = SamplesToMilliseconds(samples_encoded_);
-  ogg_packets_.clear();
+  samples_encoded_ = last_pending_granulepos_;
+  time_encoded_ = SamplesToMilliseconds(samples_encoded_ + silence_skipped_);
+  num_pending_packets_ = 0;
   vorbis_samples_.clear();
   return kSuccess;
 }
 
+bool VorbisEncoder::CanSkipSilence() const {
+  // Every packet libvorbis has yet to send must cover silent input only, so
+  // that the copies sent in their place are indistinguishable from them.
+  return !silent_packet_.empty() && silence_start_ >= 0 &&
+         samples_encoded_ - 2 * long_block_size_ >= silence_start_;
+}
+
+void VorbisEncoder::FindSilentPacket(const ogg_packet& packet) {
+  // A long block between two long blocks decodes to |long_block_size_| / 2
+  // samples. One whose window and both overlaps lie inside the silence holds
+  // only silence, and a copy can follow any long block.
+  const int64 packet_samples = packet.granulepos - last_packet_granulepos_;
+  const bool silent_long_block = silence_start_ >= 0 &&
+      packet_samples == long_block_size_ / 2 &&
+      packet.granulepos - packet_samples - 2 * long_block_size_ >=
+          silence_start_;
+  if (!silent_long_block) {
+    candidate_packet_.clear();
+    return;
+  }
+
+  // The first such packet is kept until the next one shows that it also
+  // ended with a long window.
+  if (!candidate_packet_.empty()) {
+    silent_packet_.swap(candidate_packet_);
+    candidate_packet_.clear();
+    LOG(INFO) << "VorbisEncoder skipping silence with "
+              << silent_packet_.size() << " byte packets.";
+    return;
+  }
+  candidate_packet_.assign(packet.packet, packet.packet + packet.bytes);
+}
+
+int VorbisEncoder::ReadSilentPacket(AudioBuffer* ptr_buffer) {
+  const int64 packet_samples = long_block_size_ / 2;
+  const int64 end = samples_encoded_ + silence_skipped_ + packet_samples;
+  const int64 timestamp = SamplesToMilliseconds(end) + first_input_timestamp_;
+  const int64 duration = SamplesToMilliseconds(packet_samples);
+  const int status = ptr_buffer->Init(audio_config_,
+                                      timestamp,
+                                      duration,
+                                      &silent_packet_[0],
+                                      silent_packet_.size());
+  if (status) {
+    LOG(ERROR) << "AudioBuffer Init failed: " << status;
+    return kCodecError;
+  }
+  last_timestamp_ = timestamp;
+  silence_pending_ -= packet_samples;
+  silence_skipped_ += packet_samples;
+  time_encoded_ = SamplesToMilliseconds(samples_encoded_ + silence_skipped_);
+  return kSuccess;
+}
+
+int VorbisEncoder::WritePendingSilence() {
+  if (silence_pending_ == 0) {
+    return kSuccess;
+  }
+  const int num_frames = static_cast<int>(silence_pending_);
+  float** const ptr_encoder_buffer =
+      vorbis_analysis_buffer(&dsp_state_, num_frames);
+  if (!ptr_encoder_buffer) {
+    LOG(ERROR) << "cannot write silence, no memory from libvorbis.";
+    return kNoMemory;
+  }
+  for (int i = 0; i < audio_config_.channels; ++i) {
+    memset(ptr_encoder_buffer[i], 0, num_frames * sizeof(float));
+  }
+  vorbis_analysis_wrote(&dsp_state_, num_frames);
+  samples_written_ += num_frames;
+  silence_pending_ = 0;
+  return kSuccess;
+}
+
 // Clean up function used by |GenerateHeaders| to avoid having to repeatedly
 // handle clean up of |vorbis_comment|s.
 void ClearVorbisComments(vorbis_comment* ptr_comments) {
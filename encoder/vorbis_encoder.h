@@ -18,6 +18,8 @@
 
 namespace webmlive {
 
+class AudioResampler;
+
 // Libvorbis wrapper class providing a simplified interface to the Vorbis
 // encoding library.
 // Note: users must call |Init()| before any other method.
@@ -40,6 +42,10 @@ class VorbisEncoder {
     kNoSamples = 1,
   };
 
+  // Initial capacity of the storage that compressed packets are collected
+  // in. Enough for several packets at typical streaming bitrates.
+  static const int kPacketArenaSize = 16 * 1024;
+
   VorbisEncoder();
   ~VorbisEncoder();
 
@@ -49,9 +55,17 @@ class VorbisEncoder {
   int Init(const AudioConfig& audio_config, const VorbisConfig& vorbis_config);
 
   // Passes the samples in |uncompressed_buffer| to libvorbis. Returns
-  // |kSuccess| after successful handoff of samples to the encoder.
+  // |kSuccess| after successful handoff of samples to the encoder. Planar
+  // buffers, see |AudioBuffer::InitPlanar()|, are copied into libvorbis one
+  // channel at a time; interleaved buffers are deinterleaved first.
   int Encode(const AudioBuffer& uncompressed_buffer);
 
+  // Resamples |uncompressed_buffer| with |ptr_resampler| straight into the
+  // libvorbis analysis buffer, for input captured at another rate than the
+  // one passed to |Init()|. Returns |kSuccess| after successful handoff.
+  int EncodeResampled(const AudioBuffer& uncompressed_buffer,
+                      AudioResampler* ptr_resampler);
+
   // Returns vorbis audio samples via |ptr_buffer| when libvorbis is able to
   // provide compressed data. Returns |kNoSamples| when libvorbis has no data
   // ready. Returns |kSuccess| when samples are written to |ptr_buffer|.
@@ -90,6 +104,22 @@ class VorbisEncoder {
   // Converts |num_samples| to milliseconds.
   int64 SamplesToMilliseconds(int64 num_samples) const;
 
+  // Silence skipping, for |VorbisConfig::skip_silence|. |CanSkipSilence()|
+  // returns true when silent input can skip libvorbis.
+  bool CanSkipSilence() const;
+
+  // Keeps |packet| in |silent_packet_| once it is known to be a silent long
+  // block between long blocks.
+  void FindSilentPacket(const ogg_packet& packet);
+
+  // Sends a copy of |silent_packet_| in place of |long_block_size_| / 2
+  // samples of |silence_pending_|. Returns |kSuccess| when successful.
+  int ReadSilentPacket(AudioBuffer* ptr_buffer);
+
+  // Passes |silence_pending_| to libvorbis as zeros. Returns |kSuccess| when
+  // successful.
+  int WritePendingSilence();
+
   // Applies libvorbis encoder configuration values. Returns |kSuccess| when
   // libvorbis reports success.
   template <typename T> int CodecControl(int control_id, T val);
@@ -114,8 +144,29 @@ class VorbisEncoder {
   std::unique_ptr<uint8[]> comments_header_;
   std::unique_ptr<uint8[]> setup_header_;
 
-  std::vector<uint8> ogg_packets_;
+  // Packets flushed from libvorbis and not yet read. Only the granule
+  // positions are needed from the ogg_packets; their payloads are appended to
+  // |vorbis_samples_|, which keeps its capacity between reads.
+  int num_pending_packets_;
+  int64 first_pending_granulepos_;
+  int64 last_pending_granulepos_;
+  int64 pending_delay_granulepos_;
   std::vector<uint8> vorbis_samples_;
+
+  // Silence skipping state. Positions are in samples: |samples_written_|
+  // counts those passed to libvorbis, and |silence_start_| is where the
+  // current silent input began, or -1 during sound. |silence_pending_|
+  // counts silent samples neither passed to libvorbis nor sent yet, and
+  // |silence_skipped_| those sent as copies of |silent_packet_|, which
+  // libvorbis positions leave out.
+  int long_block_size_;
+  int64 samples_written_;
+  int64 last_packet_granulepos_;
+  int64 silence_start_;
+  int64 silence_pending_;
+  int64 silence_skipped_;
+  std::vector<uint8> candidate_packet_;
+  std::vector<uint8> silent_packet_;
   bool block_initialized_;
   bool dsp_initialized_;
   bool info_initialized_;
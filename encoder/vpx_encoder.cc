@@ -14,20 +14,272 @@
 #endif
 #include "encoder/vpx_encoder.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include "encoder/buffer_pool-inl.h"
+#include "encoder/metrics.h"
+#include "encoder/resource_planner.h"
 #include "encoder/webm_encoder.h"
 #include "glog/logging.h"
 
 namespace webmlive {
 
+namespace {
+// Automatic threading never uses more threads than this per encoder; libvpx
+// gains little beyond it at live resolutions.
+const int kMaxAutoThreads = 8;
+
+// Frame width handled by each VP8 thread.
+const int kVp8ThreadWidth = 320;
+
+// Narrowest tile column libvpx allows for VP9, in pixels, and the largest
+// tile column count, log2.
+const int kVp9MinTileWidth = 256;
+const int kVp9MaxTileColumnsLog2 = 6;
+
+// Size of the blocks of the libvpx active map, in pixels.
+const int kActiveMapBlockSize = 16;
+
+// Encoded frames a macroblock stays active after its last change, which gives
+// rate control time to refine it before it is frozen.
+const uint8 kActiveMapRefineFrames = 30;
+
+// Longest run of static frames |VpxConfig::skip_static_frames| skips, in
+// milliseconds, so that players and rate control still see a frame a second.
+const int64 kMaxStaticSkipTime = 1000;
+
+// Lookahead used by |kVideoEncodeProfileBroadcast| when none is configured.
+const int kBroadcastLagInFrames = 25;
+
+// Settings of |kVideoEncodeProfileCappedQuality| left at |kUseDefault|:
+// the quality level, and a full undershoot so that easy content can fall
+// far below the cap.
+const int kCappedQualityCqLevel = 32;
+const int kCappedQualityUndershoot = 100;
+const int kCappedQualityOvershoot = 15;
+
+// Largest speed magnitudes libvpx accepts, used by |VpxConfig::adaptive_speed|.
+const int kMaxVp8Speed = 16;
+const int kMaxVp9Speed = 9;
+
+// Largest supported temporal layer count.
+const int kMaxTemporalLayers = 3;
+
+// Largest supported spatial layer count.
+const int kMaxSpatialLayers = 3;
+
+// VP9 superframe index marker: 0b110 in the top bits, then the width of the
+// frame sizes in bytes minus one, and the frame count minus one. The index
+// starts and ends with it. The longest index holds 8 sizes of 4 bytes.
+const uint8 kSuperframeMarkerMask = 0xe0;
+const uint8 kSuperframeMarker = 0xc0;
+const int32 kMaxSuperframeIndexLength = 2 + 8 * 4;
+
+// Temporal layer patterns, indexed by layer count - 1: the layer of each frame
+// in the pattern, the frame rate divisor of each layer, and the cumulative
+// share of the bitrate, in percent, up to each layer.
+struct TemporalLayerPattern {
+  uint32 periodicity;
+  uint32 layer_ids[4];
+  uint32 rate_decimators[kMaxTemporalLayers];
+  uint32 bitrate_percent[kMaxTemporalLayers];
+};
+const TemporalLayerPattern kTemporalLayerPatterns[kMaxTemporalLayers] = {
+  {1, {0}, {1}, {100}},
+  {2, {0, 1}, {2, 1}, {60, 100}},
+  {4, {0, 2, 1, 2}, {4, 2, 1}, {40, 60, 100}},
+};
+
+// Returns the reference and update flags for a frame of |layer| in a stream
+// with |num_layers| temporal layers. The base layer predicts only from and
+// updates only the last frame buffer. The middle layer of three updates the
+// golden frame for the top layer. No layer above 0 changes state that a lower
+// layer depends upon, entropy contexts included.
+vpx_enc_frame_flags_t TemporalLayerFlags(int layer, int num_layers) {
+  if (layer == 0) {
+    return VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF |
+           VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF;
+  }
+  if (layer < num_layers - 1) {
+    return VP8_EFLAG_NO_REF_GF | VP8_EFLAG_NO_REF_ARF |
+           VP8_EFLAG_NO_UPD_LAST | VP8_EFLAG_NO_UPD_ARF |
+           VP8_EFLAG_NO_UPD_ENTROPY;
+  }
+  return VP8_EFLAG_NO_REF_ARF | VP8_EFLAG_NO_UPD_LAST |
+         VP8_EFLAG_NO_UPD_GF | VP8_EFLAG_NO_UPD_ARF |
+         VP8_EFLAG_NO_UPD_ENTROPY;
+}
+
+// Splits |kbps| over the temporal layers configured in |ptr_config|, or over
+// its spatial layers in the proportions of |spatial_kbps|, the bitrates up to
+// and including each spatial layer.
+void SetLayerBitrates(int kbps, const std::vector<int>& spatial_kbps,
+                      vpx_codec_enc_cfg_t* ptr_config) {
+  ptr_config->rc_target_bitrate = kbps;
+  if (ptr_config->ss_number_layers > 1) {
+    const int64 total_kbps = spatial_kbps.back();
+    for (uint32 i = 0; i < ptr_config->ss_number_layers; ++i) {
+      const int64 layer_kbps =
+          spatial_kbps[i] - (i > 0 ? spatial_kbps[i - 1] : 0);
+      ptr_config->ss_target_bitrate[i] =
+          static_cast<unsigned int>(kbps * layer_kbps / total_kbps);
+#if VPX_ENCODER_ABI_VERSION >= (5 + VPX_CODEC_ABI_VERSION)
+      // Later libvpx rate controls each layer from |layer_target_bitrate|.
+      ptr_config->layer_target_bitrate[i] = ptr_config->ss_target_bitrate[i];
+#endif
+    }
+    return;
+  }
+  if (ptr_config->ts_number_layers <= 1) {
+    return;
+  }
+  const TemporalLayerPattern& pattern =
+      kTemporalLayerPatterns[ptr_config->ts_number_layers - 1];
+  for (uint32 i = 0; i < ptr_config->ts_number_layers; ++i) {
+    ptr_config->ts_target_bitrate[i] = kbps * pattern.bitrate_percent[i] / 100;
+  }
+}
+
+// Reads the sizes of the frames of the VP9 superframe of |length| bytes at
+// |ptr_data| from its index into |ptr_sizes|. Returns false when the data
+// does not end with a valid superframe index.
+bool ParseSuperframeIndex(const uint8* ptr_data, int32 length,
+                          std::vector<int32>* ptr_sizes) {
+  ptr_sizes->clear();
+  if (length < 1) {
+    return false;
+  }
+  const uint8 marker = ptr_data[length - 1];
+  if ((marker & kSuperframeMarkerMask) != kSuperframeMarker) {
+    return false;
+  }
+  const int num_frames = (marker & 0x07) + 1;
+  const int size_bytes = ((marker >> 3) & 0x03) + 1;
+  const int32 index_length = 2 + num_frames * size_bytes;
+  if (length < index_length || ptr_data[length - index_length] != marker) {
+    return false;
+  }
+  const uint8* ptr_size = ptr_data + length - index_length + 1;
+  int64 total_size = 0;
+  for (int i = 0; i < num_frames; ++i) {
+    int32 size = 0;
+    for (int byte = 0; byte < size_bytes; ++byte) {
+      size |= static_cast<int32>(*ptr_size++) << (byte * 8);
+    }
+    total_size += size;
+    ptr_sizes->push_back(size);
+  }
+  return total_size <= length - index_length;
+}
+
+// Writes the index of a superframe of the first |num_frames| frames of
+// |sizes| to |ptr_index|, which holds |kMaxSuperframeIndexLength| bytes.
+// Returns the length of the index.
+int32 WriteSuperframeIndex(const std::vector<int32>& sizes, int num_frames,
+                           uint8* ptr_index) {
+  int32 largest_size = 0;
+  for (int i = 0; i < num_frames; ++i) {
+    largest_size = std::max(largest_size, sizes[i]);
+  }
+  int size_bytes = 1;
+  while (size_bytes < 4 && (largest_size >> (size_bytes * 8)) != 0) {
+    ++size_bytes;
+  }
+  const uint8 marker = static_cast<uint8>(
+      kSuperframeMarker | (size_bytes - 1) << 3 | (num_frames - 1));
+  int32 length = 0;
+  ptr_index[length++] = marker;
+  for (int i = 0; i < num_frames; ++i) {
+    for (int byte = 0; byte < size_bytes; ++byte) {
+      ptr_index[length++] = static_cast<uint8>(sizes[i] >> (byte * 8));
+    }
+  }
+  ptr_index[length++] = marker;
+  return length;
+}
+
+// Fills the threading settings left at |VpxConfig::kUseDefault| in
+// |ptr_config| for frames |width| pixels wide, when |num_cores| cores are
+// available to the encoder.
+void ApplyAutoThreading(int width, int num_cores, VpxConfig* ptr_config) {
+  VpxConfig& config = *ptr_config;
+  const int max_threads = std::max(1, std::min(num_cores, kMaxAutoThreads));
+  if (config.codec != kVideoFormatVP9) {
+    if (config.thread_count == VpxConfig::kUseDefault) {
+      config.thread_count =
+          std::min(max_threads, std::max(1, width / kVp8ThreadWidth));
+    }
+    return;
+  }
+
+  // Widest tile layout allowed by |width|.
+  int max_tile_columns_log2 = 0;
+  while (max_tile_columns_log2 < kVp9MaxTileColumnsLog2 &&
+         (kVp9MinTileWidth << (max_tile_columns_log2 + 1)) <= width) {
+    ++max_tile_columns_log2;
+  }
+  if (config.tile_columns == VpxConfig::kUseDefault) {
+    // One tile column per thread.
+    config.tile_columns = 0;
+    while (config.tile_columns < max_tile_columns_log2 &&
+           (2 << config.tile_columns) <= max_threads) {
+      ++config.tile_columns;
+    }
+  }
+  const int tiles =
+      1 << std::max(0, std::min(config.tile_columns, max_tile_columns_log2));
+
+  // Without row based multithreading VP9 threads only work on separate tile
+  // columns, so extra threads would idle.
+  if (config.row_mt == VpxConfig::kUseDefault) {
+#ifdef VPX_CTRL_VP9E_SET_ROW_MT
+    config.row_mt = (max_threads > tiles) ? 1 : 0;
+#else
+    config.row_mt = 0;
+#endif
+  }
+  if (config.thread_count == VpxConfig::kUseDefault) {
+    config.thread_count =
+        (config.row_mt == 1) ? max_threads : std::min(max_threads, tiles);
+  }
+}
+}  // namespace
+
 VpxEncoder::VpxEncoder()
     : frames_in_(0),
       frames_out_(0),
       last_keyframe_time_(0),
-      last_timestamp_(0) {
+      context_codec_(kVideoFormatVP8),
+      requested_bitrate_(0),
+      requested_speed_boost_(0),
+      speed_boost_(0),
+      last_timestamp_(0),
+      last_queued_timestamp_(0),
+      deadline_(VPX_DL_REALTIME),
+      layer_pattern_index_(0),
+      frame_capacity_(0),
+      map_rows_(0),
+      map_cols_(0),
+      active_map_enabled_(false),
+      last_hint_sequence_(-1),
+      unchanged_since_encode_(false),
+      last_encoded_time_(-1),
+      ptr_telemetry_(NULL),
+      ptr_telemetry_queue_(NULL),
+      bytes_queued_(0),
+      keyframes_queued_(0) {
   memset(&vpx_context_, 0, sizeof(vpx_context_));
+  memset(&vpx_config_, 0, sizeof(vpx_config_));
 }
 
 VpxEncoder::~VpxEncoder() {
+  if (ptr_telemetry_) {
+    ptr_telemetry_->RemoveProducer(ptr_telemetry_queue_);
+  }
   vpx_codec_destroy(&vpx_context_);
 }
 
@@ -50,11 +302,118 @@ int VpxEncoder::Init(const WebmEncoderConfig& user_config) {
     return VideoEncoder::kCodecError;
   }
   config_ = user_config.vpx_config;
+  if (config_.bit_depth != 8 && config_.bit_depth != 10) {
+    LOG(ERROR) << "unsupported bit depth " << config_.bit_depth;
+    return VideoEncoder::kInvalidArg;
+  }
+  const bool high_bit_depth = config_.bit_depth > 8;
+  if (high_bit_depth !=
+      (user_config.actual_video_config.format == kVideoFormatI42016)) {
+    LOG(ERROR) << "bit depth " << config_.bit_depth
+               << " does not match input format "
+               << user_config.actual_video_config.format;
+    return VideoEncoder::kInvalidArg;
+  }
+  if (high_bit_depth) {
+    if (config_.codec != kVideoFormatVP9) {
+      LOG(ERROR) << "10 bit encode requires VP9.";
+      return VideoEncoder::kInvalidArg;
+    }
+    if (!(vpx_codec_get_caps(vpx_codec_vp9_cx()) &
+          VPX_CODEC_CAP_HIGHBITDEPTH)) {
+      LOG(ERROR) << "libvpx was built without high bit depth support.";
+      return VideoEncoder::kCodecError;
+    }
+    // Profile 2 is 10 or 12 bit 4:2:0.
+    libvpx_config.g_profile = 2;
+    libvpx_config.g_bit_depth = VPX_BITS_10;
+    libvpx_config.g_input_bit_depth = 10;
+  }
   libvpx_config.g_pass = VPX_RC_ONE_PASS;
   libvpx_config.g_timebase.num = 1;
-  libvpx_config.g_timebase.den = kTimebase;
+  libvpx_config.g_timebase.den = kMicrosecondTimebase;
   libvpx_config.rc_end_usage = VPX_CBR;
+  deadline_ = VPX_DL_REALTIME;
+  switch (config_.profile) {
+    case kVideoEncodeProfileDefault:
+      break;
+    case kVideoEncodeProfileUltraLowLatency:
+      config_.lag_in_frames = 0;
+      if (config_.codec == kVideoFormatVP9) {
+        config_.adaptive_quantization_mode = 3;  // Cyclic refresh.
+      } else {
+        // VP8 enables cyclic refresh with error resilience.
+        config_.error_resilient = true;
+      }
+      break;
+    case kVideoEncodeProfileBroadcast:
+      if (config_.lag_in_frames <= 0) {
+        config_.lag_in_frames = kBroadcastLagInFrames;
+      }
+      if (config_.adaptive_quantization_mode == 3) {
+        // Cyclic refresh is a realtime CBR tool.
+        config_.adaptive_quantization_mode = 0;
+      }
+      libvpx_config.rc_end_usage =
+          (config_.cq_level == VpxConfig::kUseDefault) ? VPX_VBR : VPX_CQ;
+      deadline_ = VPX_DL_GOOD_QUALITY;
+      break;
+    case kVideoEncodeProfileCappedQuality:
+      if (config_.adaptive_quantization_mode == 3) {
+        config_.adaptive_quantization_mode = 0;
+      }
+      if (config_.cq_level == VpxConfig::kUseDefault) {
+        config_.cq_level = kCappedQualityCqLevel;
+      }
+      if (config_.undershoot == VpxConfig::kUseDefault) {
+        config_.undershoot = kCappedQualityUndershoot;
+      }
+      if (config_.overshoot == VpxConfig::kUseDefault) {
+        config_.overshoot = kCappedQualityOvershoot;
+      }
+      // The cap holds over the buffer: a segment long, so that each segment
+      // fits the bitrate players chose it by, with the encode starting and
+      // aiming half full.
+      if (config_.keyframe_interval > 0) {
+        config_.total_buffer_time = config_.keyframe_interval;
+        config_.initial_buffer_time = config_.keyframe_interval / 2;
+        config_.optimal_buffer_time = config_.keyframe_interval / 2;
+      }
+      libvpx_config.rc_end_usage = VPX_CQ;
+      break;
+    default:
+      LOG(ERROR) << "unknown encode profile " << config_.profile;
+      return VideoEncoder::kInvalidArg;
+  }
+  if (config_.intra_refresh) {
+    if (config_.profile == kVideoEncodeProfileBroadcast ||
+        config_.profile == kVideoEncodeProfileCappedQuality) {
+      LOG(ERROR) << "intra refresh requires a CBR encode profile.";
+      return VideoEncoder::kInvalidArg;
+    }
+    // Cyclic refresh recodes a band of blocks in every frame, which spreads
+    // the refresh a keyframe would bring over the frames between them.
+    if (config_.codec == kVideoFormatVP9) {
+      config_.adaptive_quantization_mode = 3;
+    } else {
+      config_.error_resilient = true;
+    }
+  }
   libvpx_config.g_lag_in_frames = 0;
+  if (config_.lag_in_frames > 0) {
+    if (config_.temporal_layers > 1) {
+      LOG(ERROR) << "lookahead is not supported with temporal layers.";
+      return VideoEncoder::kInvalidArg;
+    }
+    libvpx_config.g_lag_in_frames = config_.lag_in_frames;
+  }
+
+  // Scheduled keyframes are all forced; libvpx must not add its own, or the
+  // representations' chunks would no longer line up. Intra refresh keeps
+  // keyframes to those forced.
+  if (config_.scheduled_keyframes || config_.intra_refresh) {
+    libvpx_config.kf_mode = VPX_KF_DISABLED;
+  }
 
   // TODO(tomfinegan): Add user settings validation-- v1 was relying on the
   //                   DShow filter to check settings.
@@ -62,13 +421,54 @@ int VpxEncoder::Init(const WebmEncoderConfig& user_config) {
   // Copy user configuration values into libvpx configuration struct
   libvpx_config.g_h = user_config.actual_video_config.height;
   libvpx_config.g_w = user_config.actual_video_config.width;
-  libvpx_config.rc_target_bitrate = config_.bitrate;
+  if (config_.temporal_layers < 1 ||
+      config_.temporal_layers > kMaxTemporalLayers) {
+    LOG(ERROR) << "unsupported temporal layer count "
+               << config_.temporal_layers;
+    return VideoEncoder::kInvalidArg;
+  }
+  if (config_.temporal_layers > 1) {
+    const TemporalLayerPattern& pattern =
+        kTemporalLayerPatterns[config_.temporal_layers - 1];
+    libvpx_config.ts_number_layers = config_.temporal_layers;
+    libvpx_config.ts_periodicity = pattern.periodicity;
+    for (uint32 i = 0; i < pattern.periodicity; ++i) {
+      libvpx_config.ts_layer_id[i] = pattern.layer_ids[i];
+    }
+    for (int i = 0; i < config_.temporal_layers; ++i) {
+      libvpx_config.ts_rate_decimator[i] = pattern.rate_decimators[i];
+    }
+  }
+  spatial_kbps_.clear();
+  layer_widths_.clear();
+  layer_heights_.clear();
+  if (user_config.video_svc && user_config.video_representations.size() > 1) {
+    const int spatial_status =
+        ConfigureSpatialLayers(user_config, &libvpx_config);
+    if (spatial_status) {
+      return spatial_status;
+    }
+  }
+  SetLayerBitrates(config_.bitrate, spatial_kbps_, &libvpx_config);
   libvpx_config.rc_min_quantizer = config_.min_quantizer;
   libvpx_config.rc_max_quantizer = config_.max_quantizer;
 
-  if (config_.thread_count != VpxConfig::kUseDefault) {
-    libvpx_config.g_threads = config_.thread_count;
-  }
+  // Representations of a multi-bitrate encode share the cores, unless they
+  // are the spatial layers of this encoder.
+  const int num_encoders = user_config.video_svc ? 1 : std::max(
+      1, static_cast<int>(user_config.video_representations.size()));
+  const int num_cores = user_config.encode_cores > 0 ?
+      user_config.encode_cores : AvailableCpuThreads();
+  ApplyAutoThreading(libvpx_config.g_w, num_cores / num_encoders, &config_);
+  libvpx_config.g_threads = config_.thread_count;
+  LOG(INFO) << "VpxEncoder threads=" << config_.thread_count
+            << " tile_columns=" << config_.tile_columns
+            << " row_mt=" << config_.row_mt
+            << " temporal_layers=" << config_.temporal_layers
+            << " spatial_layers=" << layer_widths_.size()
+            << " profile=" << config_.profile
+            << " bit_depth=" << config_.bit_depth
+            << " lag=" << libvpx_config.g_lag_in_frames;
   if (config_.undershoot != VpxConfig::kUseDefault) {
     libvpx_config.rc_undershoot_pct = config_.undershoot;
   }
@@ -88,20 +488,96 @@ int VpxEncoder::Init(const WebmEncoderConfig& user_config) {
     libvpx_config.rc_buf_optimal_sz = config_.optimal_buffer_time;
   }
 
-  // Configure the codec library.
-  status = VPX_CODEC_INVALID_PARAM;
-  if (config_.codec == kVideoFormatVP8) {
+  // Configure the codec library. A context that has not encoded yet is
+  // reconfigured when libvpx can apply |libvpx_config| to it; the fields
+  // compared are fixed by vpx_codec_enc_init().
+  bool reconfigured = false;
+  if (vpx_context_.iface && frames_in_ == 0 &&
+      context_codec_ == config_.codec &&
+      vpx_config_.g_w == libvpx_config.g_w &&
+      vpx_config_.g_h == libvpx_config.g_h &&
+      vpx_config_.g_bit_depth == libvpx_config.g_bit_depth &&
+      vpx_config_.g_threads == libvpx_config.g_threads &&
+      vpx_config_.g_lag_in_frames == libvpx_config.g_lag_in_frames &&
+      vpx_config_.ts_number_layers == libvpx_config.ts_number_layers &&
+      vpx_config_.ss_number_layers == libvpx_config.ss_number_layers) {
+    status = vpx_codec_enc_config_set(&vpx_context_, &libvpx_config);
+    reconfigured = (status == VPX_CODEC_OK);
+    if (!reconfigured) {
+      LOG(WARNING) << "cannot reconfigure the encoder context, recreating "
+                   << "it: " << vpx_codec_err_to_string(status);
+    }
+  }
+  if (!reconfigured && vpx_context_.iface) {
+    vpx_codec_destroy(&vpx_context_);
+    memset(&vpx_context_, 0, sizeof(vpx_context_));
+  }
+  status = reconfigured ? VPX_CODEC_OK : VPX_CODEC_INVALID_PARAM;
+  if (reconfigured) {
+    VLOG(1) << "VpxEncoder reusing an initialized context.";
+  } else if (config_.codec == kVideoFormatVP8) {
     status = vpx_codec_enc_init(&vpx_context_, vpx_codec_vp8_cx(),
                                 &libvpx_config, 0);
   } else if (config_.codec == kVideoFormatVP9) {
     status = vpx_codec_enc_init(&vpx_context_, vpx_codec_vp9_cx(),
-                                &libvpx_config, 0);
+                                &libvpx_config,
+                                high_bit_depth ? VPX_CODEC_USE_HIGHBITDEPTH :
+                                                 0);
   }
   if (status) {
     LOG(ERROR) << "vpx_codec_enc_init failed: "
                << vpx_codec_err_to_string(status);
     return VideoEncoder::kCodecError;
   }
+  vpx_config_ = libvpx_config;
+  context_codec_ = config_.codec;
+  const int queue_status =
+      output_queue_.Init(true, BufferPool<VideoFrame>::kDefaultBufferCount);
+  if (queue_status &&
+      queue_status != BufferPool<VideoFrame>::kAlreadyInitialized) {
+    LOG(ERROR) << "VpxEncoder output queue Init failed.";
+    return VideoEncoder::kNoMemory;
+  }
+  last_queued_timestamp_ = 0;
+  layer_pattern_index_ = 0;
+  frame_capacity_ =
+      CompressedFrameCapacity(config_, user_config.actual_video_config);
+  const bool spatial_layers = libvpx_config.ss_number_layers > 1;
+  if (config_.codec == kVideoFormatVP9 &&
+      (config_.temporal_layers > 1 || spatial_layers) &&
+      vpx_codec_control(&vpx_context_, VP9E_SET_SVC, 1)) {
+    LOG(ERROR) << "cannot enable VP9 SVC.";
+    return VideoEncoder::kCodecError;
+  }
+  if (spatial_layers) {
+    // libvpx scales each layer from the input by |scaling_factor_num| /
+    // |scaling_factor_den|.
+    vpx_svc_extra_cfg_t svc_parameters;
+    memset(&svc_parameters, 0, sizeof(svc_parameters));
+    for (size_t i = 0; i < layer_heights_.size(); ++i) {
+      svc_parameters.max_quantizers[i] = config_.max_quantizer;
+      svc_parameters.min_quantizers[i] = config_.min_quantizer;
+      svc_parameters.scaling_factor_num[i] = layer_heights_[i];
+      svc_parameters.scaling_factor_den[i] = libvpx_config.g_h;
+    }
+    if (vpx_codec_control(&vpx_context_, VP9E_SET_SVC_PARAMETERS,
+                          &svc_parameters)) {
+      LOG(ERROR) << "cannot configure VP9 spatial layers.";
+      return VideoEncoder::kCodecError;
+    }
+  }
+
+  map_rows_ = (libvpx_config.g_h + kActiveMapBlockSize - 1) /
+      kActiveMapBlockSize;
+  map_cols_ = (libvpx_config.g_w + kActiveMapBlockSize - 1) /
+      kActiveMapBlockSize;
+  refine_frames_.assign(map_rows_ * map_cols_, kActiveMapRefineFrames);
+  active_map_.assign(map_rows_ * map_cols_, 1);
+  active_map_enabled_ = false;
+  last_hint_sequence_ = -1;
+  unchanged_since_encode_ = false;
+  last_encoded_time_ = -1;
+  static_frame_detector_.Reset();
 
   // Pass the remaining configuration settings into libvpx, but leave them at
   // the library defaults if not specified by the user or set to a value
@@ -109,6 +585,10 @@ int VpxEncoder::Init(const WebmEncoderConfig& user_config) {
   if (CodecControl(VP8E_SET_CPUUSED, config_.speed, VpxConfig::kUseDefault)) {
     return VideoEncoder::kCodecError;
   }
+  speed_controller_.Init(config_.speed,
+                         config_.codec == kVideoFormatVP9 ? kMaxVp9Speed
+                                                          : kMaxVp8Speed);
+  speed_boost_ = 0;
   if (CodecControl(VP8E_SET_STATIC_THRESHOLD, config_.static_threshold,
                    VpxConfig::kUseDefault)) {
     return VideoEncoder::kCodecError;
@@ -126,6 +606,18 @@ int VpxEncoder::Init(const WebmEncoderConfig& user_config) {
                    VpxConfig::kUseDefault)) {
     return VideoEncoder::kCodecError;
   }
+  if (CodecControl(VP8E_SET_ENABLEAUTOALTREF,
+                   config_.lag_in_frames > 0 ? 1 : 0, 0)) {
+    return VideoEncoder::kCodecError;
+  }
+  if (libvpx_config.rc_end_usage == VPX_CQ &&
+      CodecControl(VP8E_SET_CQ_LEVEL, config_.cq_level,
+                   VpxConfig::kUseDefault)) {
+    return VideoEncoder::kCodecError;
+  }
+  if (config_.screen_content == VpxConfig::kUseDefault) {
+    config_.screen_content = user_config.video_capture_desktop ? 1 : 0;
+  }
 
   // Set VP8 specific options.
   if (config_.codec == kVideoFormatVP8) {
@@ -133,6 +625,10 @@ int VpxEncoder::Init(const WebmEncoderConfig& user_config) {
                      VpxConfig::kUseDefault)) {
       return VideoEncoder::kCodecError;
     }
+    if (CodecControl(VP8E_SET_SCREEN_CONTENT_MODE, config_.screen_content,
+                     0)) {
+      return VideoEncoder::kCodecError;
+    }
   }
 
   // Set VP9 specific options.
@@ -145,6 +641,22 @@ int VpxEncoder::Init(const WebmEncoderConfig& user_config) {
                      VpxConfig::kUseDefault)) {
       return VideoEncoder::kCodecError;
     }
+    if (config_.screen_content == 1 &&
+        CodecControl(VP9E_SET_TUNE_CONTENT,
+                     static_cast<int>(VP9E_CONTENT_SCREEN),
+                     static_cast<int>(VP9E_CONTENT_DEFAULT))) {
+      return VideoEncoder::kCodecError;
+    }
+#ifdef VPX_CTRL_VP9E_SET_ROW_MT
+    if (CodecControl(VP9E_SET_ROW_MT, config_.row_mt,
+                     VpxConfig::kUseDefault)) {
+      return VideoEncoder::kCodecError;
+    }
+#else
+    if (config_.row_mt == 1) {
+      LOG(WARNING) << "row based multithreading unsupported by libvpx.";
+    }
+#endif
     if (CodecControl(VP9E_SET_FRAME_PARALLEL_DECODING,
                      config_.frame_parallel_mode ? 1 : 0,
                      VpxConfig::kUseDefault)) {
@@ -158,6 +670,47 @@ int VpxEncoder::Init(const WebmEncoderConfig& user_config) {
       return VideoEncoder::kCodecError;
     }
   }
+
+  if (config_.quality_probe_interval > 0) {
+    // The probe compares each frame with the last frame reference once the
+    // frame is encoded; lookahead and layers break that pairing.
+    if (high_bit_depth || libvpx_config.g_lag_in_frames > 0 ||
+        config_.temporal_layers > 1 || spatial_layers) {
+      LOG(WARNING) << "quality probe disabled: requires 8 bit encode "
+                   << "without lookahead or layers.";
+    } else {
+      quality_probe_.reset(new (std::nothrow) QualityProbe());  // NOLINT
+      if (!quality_probe_) {
+        LOG(ERROR) << "cannot allocate quality probe.";
+        return VideoEncoder::kNoMemory;
+      }
+      std::ostringstream representation_label;
+      representation_label << "representation=\""
+                           << user_config.actual_video_config.width << "x"
+                           << user_config.actual_video_config.height << "\"";
+      const std::string labels = MetricsRegistry::JoinLabels(
+          user_config.metrics_labels, representation_label.str());
+      if (quality_probe_->Init(labels)) {
+        LOG(ERROR) << "quality probe Init failed.";
+        return VideoEncoder::kEncoderError;
+      }
+    }
+  }
+
+  if (ptr_telemetry_) {
+    ptr_telemetry_->RemoveProducer(ptr_telemetry_queue_);
+    ptr_telemetry_ = NULL;
+    ptr_telemetry_queue_ = NULL;
+  }
+  if (user_config.rate_control_telemetry) {
+    ptr_telemetry_queue_ = user_config.rate_control_telemetry->AddProducer(
+        user_config.actual_video_config.width,
+        user_config.actual_video_config.height, config_.bitrate);
+    if (!ptr_telemetry_queue_) {
+      return VideoEncoder::kNoMemory;
+    }
+    ptr_telemetry_ = user_config.rate_control_telemetry;
+  }
   return kSuccess;
 }
 
@@ -168,58 +721,293 @@ int VpxEncoder::Init(const WebmEncoderConfig& user_config) {
 // to libvpx.
 int VpxEncoder::EncodeFrame(const VideoFrame& raw_frame,
                             VideoFrame* ptr_vpx_frame) {
-  if (!raw_frame.buffer()) {
+  if (raw_frame.empty()) {
     LOG(ERROR) << "NULL raw VideoFrame buffer!";
     return kInvalidArg;
   }
-  if (raw_frame.format() != kVideoFormatI420 &&
-      raw_frame.format() != kVideoFormatYV12) {
+  const bool high_bit_depth = config_.bit_depth > 8;
+  if ((high_bit_depth && raw_frame.format() != kVideoFormatI42016) ||
+      (!high_bit_depth && raw_frame.format() != kVideoFormatI420 &&
+       raw_frame.format() != kVideoFormatYV12)) {
     LOG(ERROR) << "Unsupported VideoFrame format!";
     return kInvalidArg;
   }
   ++frames_in_;
 
-  // If decimation is enabled, determine if it's time to drop a frame.
-  if (config_.decimate > 1) {
+  if (ApplyRequestedBitrate() || ApplyRequestedSpeedBoost()) {
+    return kCodecError;
+  }
+  AccumulateRegionHints(raw_frame);
+
+  VideoFrameStats frame_stats;
+  frame_stats.timestamp = raw_frame.timestamp();
+  frame_stats.duration = static_cast<int32>(raw_frame.duration());
+
+  // If decimation is enabled, determine if it's time to drop a frame. Frames
+  // due to be keyframes are never dropped.
+  if (config_.decimate > 1 &&
+      !keyframe_request_.Pending(raw_frame.timestamp())) {
     const int drop_frame = frames_in_ % config_.decimate;
 
     // Non-zero |drop_frame| values mean drop the frame.
     if (drop_frame) {
+      frame_stats.flags = VideoFrameStats::kDecimated;
+      RecordFrameStats(frame_stats);
       return kDropped;
     }
   }
 
+  if (config_.skip_static_frames && SkipsStaticFrame(raw_frame)) {
+    frame_stats.flags = VideoFrameStats::kStatic;
+    RecordFrameStats(frame_stats);
+    return kDropped;
+  }
+  last_encoded_time_ = raw_frame.timestamp();
+  unchanged_since_encode_ = true;
+
   // Determine if it's time to force a keyframe.
-  const int64 time_since_keyframe =
-      raw_frame.timestamp() - last_keyframe_time_;
-  const bool force_keyframe = time_since_keyframe > config_.keyframe_interval;
+  const VideoFrameAnalysis& analysis = raw_frame.analysis();
+  const bool keyframe_requested =
+      keyframe_request_.Take(raw_frame.timestamp());
+  const bool force_keyframe = keyframe_requested || KeyframeDue(raw_frame);
+
+  // The active map covers the input size only; spatial layers keep every
+  // macroblock active.
+  if (ApplyActiveMap(force_keyframe || vpx_config_.ss_number_layers > 1)) {
+    return kCodecError;
+  }
+  if (config_.adaptive_speed && config_.speed != VpxConfig::kUseDefault &&
+      analysis.valid && speed_controller_.NoteMotion(analysis.motion) &&
+      CodecControl(VP8E_SET_CPUUSED, BoostedSpeed(),
+                   VpxConfig::kUseDefault)) {
+    return kCodecError;
+  }
 
-  // Use the |vpx_img_wrap| to wrap the buffer within |ptr_raw_frame| in
-  // |vpx_image| for passing the buffer to libvpx.
+  // Contiguous frames must hold every row their stride implies; external
+  // planes were checked by |VideoFrame::InitPlanes()|.
+  if (!raw_frame.external_planes() &&
+      VideoFrame::PlanarFrameSize(raw_frame.stride(), raw_frame.height()) >
+          raw_frame.buffer_length()) {
+    LOG(ERROR) << "EncodeFrame frame too small for stride "
+               << raw_frame.stride();
+    return kInvalidArg;
+  }
+
+  // Use the |vpx_img_wrap| to wrap the planes of |ptr_raw_frame| in
+  // |vpx_image| for passing them to libvpx.
   const VideoFormat video_format = raw_frame.format();
-  const vpx_img_fmt vpx_image_format =
-      (video_format == kVideoFormatI420) ? VPX_IMG_FMT_I420 : VPX_IMG_FMT_YV12;
+  vpx_img_fmt vpx_image_format = VPX_IMG_FMT_YV12;
+  if (video_format == kVideoFormatI420) {
+    vpx_image_format = VPX_IMG_FMT_I420;
+  } else if (video_format == kVideoFormatI42016) {
+    vpx_image_format = VPX_IMG_FMT_I42016;
+  }
+  const VideoPlane y_plane = raw_frame.plane(VideoFrame::kPlaneY);
+  const VideoPlane u_plane = raw_frame.plane(VideoFrame::kPlaneU);
+  const VideoPlane v_plane = raw_frame.plane(VideoFrame::kPlaneV);
   vpx_image_t vpx_image;
   vpx_image_t* const ptr_vpx_image = vpx_img_wrap(&vpx_image,
                                                   vpx_image_format,
                                                   raw_frame.width(),
                                                   raw_frame.height(),
                                                   1,  // Alignment.
-                                                  raw_frame.buffer());
+                                                  y_plane.data);
+  if (!ptr_vpx_image) {
+    LOG(ERROR) << "EncodeFrame vpx_img_wrap failed.";
+    return kEncoderError;
+  }
 
-  const vpx_enc_frame_flags_t flags = force_keyframe ? VPX_EFLAG_FORCE_KF : 0;
+  // |vpx_img_wrap| derives plane pointers and strides from the width and
+  // alignment; replace them with the frame's planes so that padded rows and
+  // planes that are not contiguous reach libvpx as they are. Strides are in
+  // bytes for I42016 too.
+  ptr_vpx_image->planes[VPX_PLANE_Y] = y_plane.data;
+  ptr_vpx_image->planes[VPX_PLANE_U] = u_plane.data;
+  ptr_vpx_image->planes[VPX_PLANE_V] = v_plane.data;
+  if (high_bit_depth) {
+    ptr_vpx_image->bit_depth = config_.bit_depth;
+  }
+  ptr_vpx_image->stride[VPX_PLANE_Y] = y_plane.stride;
+  ptr_vpx_image->stride[VPX_PLANE_U] = u_plane.stride;
+  ptr_vpx_image->stride[VPX_PLANE_V] = v_plane.stride;
+
+  vpx_enc_frame_flags_t flags = force_keyframe ? VPX_EFLAG_FORCE_KF : 0;
+  if (force_keyframe) {
+    layer_pattern_index_ = 0;
+  }
+  int temporal_layer = 0;
+  if (config_.temporal_layers > 1) {
+    temporal_layer = static_cast<int>(
+        vpx_config_.ts_layer_id[layer_pattern_index_]);
+    if (SetTemporalLayer(temporal_layer)) {
+      return kCodecError;
+    }
+    flags |= TemporalLayerFlags(temporal_layer, config_.temporal_layers);
+    layer_pattern_index_ =
+        (layer_pattern_index_ + 1) % vpx_config_.ts_periodicity;
+  }
   const uint32 duration = static_cast<uint32>(raw_frame.duration());
 
-  // Pass |ptr_raw_frame|'s data to libvpx.
+  // Pass |ptr_raw_frame|'s data to libvpx. Times are passed in microseconds,
+  // so that rate control sees the true spacing of high frame rate input.
+  const std::chrono::steady_clock::time_point encode_start =
+      std::chrono::steady_clock::now();
   const vpx_codec_err_t vpx_status =
-      vpx_codec_encode(&vpx_context_, ptr_vpx_image, raw_frame.timestamp(),
-                       duration, flags, VPX_DL_REALTIME);
+      vpx_codec_encode(&vpx_context_, ptr_vpx_image, raw_frame.timestamp_us(),
+                       static_cast<uint32>(raw_frame.duration_us()), flags,
+                       deadline_);
   if (vpx_status) {
     LOG(ERROR) << "EncodeFrame vpx_codec_encode failed: "
                << vpx_codec_err_to_string(vpx_status);
     return kCodecError;
   }
+  const int64 encode_time_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - encode_start).count();
+  if (config_.adaptive_speed && config_.speed != VpxConfig::kUseDefault) {
+    if (speed_controller_.Update(encode_time_us, raw_frame.duration()) &&
+        CodecControl(VP8E_SET_CPUUSED, BoostedSpeed(),
+                     VpxConfig::kUseDefault)) {
+      return kCodecError;
+    }
+  }
+
+  last_raw_config_ = raw_frame.config();
+  const int64 frames_out = frames_out_;
+  const int64 bytes_queued = bytes_queued_;
+  const int64 keyframes_queued = keyframes_queued_;
+  const int status = QueuePackets(temporal_layer);
+  if (status) {
+    return status;
+  }
+
+  if (ptr_telemetry_queue_) {
+    // Without lookahead a call that queues nothing is a rate control drop.
+    frame_stats.encode_time_us = static_cast<int32>(encode_time_us);
+    frame_stats.frame_bytes = static_cast<int32>(bytes_queued_ - bytes_queued);
+    frame_stats.target_bytes = static_cast<int32>(
+        static_cast<int64>(vpx_config_.rc_target_bitrate) * duration / 8);
+    if (keyframes_queued_ > keyframes_queued) {
+      frame_stats.flags |= VideoFrameStats::kKeyframe;
+      if (force_keyframe) {
+        frame_stats.flags |= VideoFrameStats::kForcedKeyframe;
+      }
+    }
+    if (frames_out_ > frames_out) {
+      int quantizer = -1;
+      if (vpx_codec_control(&vpx_context_, VP8E_GET_LAST_QUANTIZER_64,
+                            &quantizer) == VPX_CODEC_OK) {
+        frame_stats.quantizer = quantizer;
+      }
+    } else if (vpx_config_.g_lag_in_frames == 0) {
+      frame_stats.flags |= VideoFrameStats::kDropped;
+    }
+    RecordFrameStats(frame_stats);
+  }
 
+  // A frame rate control dropped left the last frame reference unchanged.
+  if (quality_probe_ && frames_out_ > frames_out &&
+      frames_out_ % config_.quality_probe_interval == 0) {
+    SampleQuality(raw_frame);
+  }
+  const int read_status = ReadQueuedFrame(ptr_vpx_frame);
+  return read_status == kNoFrame ? kDropped : read_status;
+}
+
+int VpxEncoder::ReadQueuedFrame(VideoFrame* ptr_vpx_frame) {
+  const int status = output_queue_.Decommit(ptr_vpx_frame);
+  if (status == BufferPool<VideoFrame>::kEmpty) {
+    return kNoFrame;
+  } else if (status) {
+    LOG(ERROR) << "VpxEncoder output Decommit failed: " << status;
+    return kNoMemory;
+  }
+  last_timestamp_ = ptr_vpx_frame->timestamp();
+  return kSuccess;
+}
+
+int VpxEncoder::Flush() {
+  // libvpx returns the held frames over as many calls as it needs; stop once
+  // a call produces nothing.
+  for (;;) {
+    const int64 frames_queued = frames_out_;
+    const vpx_codec_err_t vpx_status =
+        vpx_codec_encode(&vpx_context_, NULL, -1, 1, 0, deadline_);
+    if (vpx_status) {
+      LOG(ERROR) << "Flush vpx_codec_encode failed: "
+                 << vpx_codec_err_to_string(vpx_status);
+      return kCodecError;
+    }
+    const int status = QueuePackets(0);
+    if (status) {
+      return status;
+    }
+    if (frames_out_ == frames_queued) {
+      break;
+    }
+  }
+  return kSuccess;
+}
+
+void VpxEncoder::RecordFrameStats(const VideoFrameStats& stats) {
+  if (ptr_telemetry_queue_) {
+    RateControlTelemetry::Record(ptr_telemetry_queue_, stats);
+  }
+}
+
+void VpxEncoder::SampleQuality(const VideoFrame& raw_frame) {
+  const int32 width = raw_frame.width();
+  const int32 height = raw_frame.height();
+  QualityProbe::Planes* const ptr_planes =
+      quality_probe_->AcquirePlanes(width, height);
+  if (!ptr_planes) {
+    return;
+  }
+  ptr_planes->timestamp = raw_frame.timestamp();
+  const VideoPlane y_plane = raw_frame.plane(VideoFrame::kPlaneY);
+  for (int32 row = 0; row < height; ++row) {
+    memcpy(&ptr_planes->raw[row * width],
+           y_plane.data + row * y_plane.stride, width);
+  }
+
+  // The frame just encoded is now the last frame reference. VP8 copies it
+  // whole into an I420 image; VP9 returns its buffer, in slot 0 when there
+  // is a single layer.
+  uint8* const ptr_reconstructed = &ptr_planes->reconstructed[0];
+  bool copied = false;
+  if (config_.codec == kVideoFormatVP8) {
+    vpx_ref_frame_t reference;
+    reference.frame_type = VP8_LAST_FRAME;
+    copied = vpx_img_wrap(&reference.img, VPX_IMG_FMT_I420, width, height, 1,
+                          ptr_reconstructed) &&
+             vpx_codec_control(&vpx_context_, VP8_COPY_REFERENCE,
+                               &reference) == VPX_CODEC_OK;
+  } else {
+    vp9_ref_frame_t reference;
+    memset(&reference, 0, sizeof(reference));
+    reference.idx = 0;
+    if (vpx_codec_control(&vpx_context_, VP9_GET_REFERENCE, &reference) ==
+            VPX_CODEC_OK &&
+        static_cast<int32>(reference.img.d_w) == width &&
+        static_cast<int32>(reference.img.d_h) == height) {
+      const uint8* const ptr_y = reference.img.planes[VPX_PLANE_Y];
+      const int y_stride = reference.img.stride[VPX_PLANE_Y];
+      for (int32 row = 0; row < height; ++row) {
+        memcpy(ptr_reconstructed + row * width, ptr_y + row * y_stride,
+               width);
+      }
+      copied = true;
+    }
+  }
+  if (!copied) {
+    VLOG(1) << "quality probe cannot read the reconstructed frame.";
+    quality_probe_->DiscardPlanes();
+    return;
+  }
+  quality_probe_->SubmitPlanes();
+}
+
+int VpxEncoder::QueuePackets(int temporal_layer) {
   // Consume output packets from libvpx. Note that the library may emit stats
   // packets in addition to the compressed data.
   vpx_codec_iter_t iter = NULL;
@@ -229,35 +1017,335 @@ int VpxEncoder::EncodeFrame(const VideoFrame& raw_frame,
     if (!pkt) {
       break;
     }
-    const bool compressed_frame_packet = pkt->kind == VPX_CODEC_CX_FRAME_PKT;
+    if (pkt->kind != VPX_CODEC_CX_FRAME_PKT) {
+      continue;
+    }
+    const bool is_keyframe = !!(pkt->data.frame.flags & VPX_FRAME_IS_KEY);
+    const uint8* const ptr_data =
+        static_cast<const uint8*>(pkt->data.frame.buf);
+    const int32 frame_size = static_cast<int32>(pkt->data.frame.sz);
+
+    // Spatial layer packets are superframes holding a frame per layer. Each
+    // layer is queued as the superframe cut after its frame, with an index
+    // of its own, which decodes at the layer's size.
+    const int num_spatial_layers = static_cast<int>(layer_widths_.size());
+    int num_layers = 1;
+    if (num_spatial_layers > 1) {
+      if (!ParseSuperframeIndex(ptr_data, frame_size, &layer_sizes_)) {
+        layer_sizes_.assign(1, frame_size);
+      }
+      num_layers = std::min(static_cast<int>(layer_sizes_.size()),
+                            num_spatial_layers);
+      if (num_layers < num_spatial_layers) {
+        LOG(WARNING) << "superframe holds " << num_layers << " of "
+                     << num_spatial_layers << " spatial layers.";
+      }
+    }
+
+    // Packet times are in microseconds, and differ from the input frame's
+    // once lookahead is enabled. Invisible alternate reference frames have no
+    // duration, and follow the previous frame.
+    int64 timestamp_us = pkt->data.frame.pts;
+    if (frames_out_ > 0 && timestamp_us < last_queued_timestamp_) {
+      timestamp_us = last_queued_timestamp_;
+    }
+    last_queued_timestamp_ = timestamp_us;
+    if (is_keyframe && temporal_layer != 0) {
+      // libvpx placed a keyframe of its own; it refreshes every buffer, so it
+      // begins a new pattern.
+      temporal_layer = 0;
+      layer_pattern_index_ = 1 % vpx_config_.ts_periodicity;
+    }
+
+    for (int layer = 0; layer < num_layers; ++layer) {
+      int32 data_length = frame_size;
+      uint8 index[kMaxSuperframeIndexLength];
+      int32 index_length = 0;
+      if (num_spatial_layers > 1) {
+        data_length = 0;
+        for (int i = 0; i <= layer; ++i) {
+          data_length += layer_sizes_[i];
+        }
+        if (layer > 0) {
+          index_length = WriteSuperframeIndex(layer_sizes_, layer + 1, index);
+        }
+      }
 
-    // Copy the compressed data to |ptr_vpx_frame|.
-    if (compressed_frame_packet) {
-      const bool is_keyframe = !!(pkt->data.frame.flags & VPX_FRAME_IS_KEY);
-      uint8* const ptr_vpx_frame_buf =
-          reinterpret_cast<uint8*>(pkt->data.frame.buf);
-      VideoConfig vpx_config = raw_frame.config();
+      // Copy the compressed data to |packet_frame_|.
+      const int32 packet_size = data_length + index_length;
+      if (packet_size > frame_capacity_) {
+        // Grow ahead of need so that the frames in circulation settle on one
+        // capacity.
+        frame_capacity_ = packet_size + packet_size / 2;
+        VLOG(1) << "compressed frame capacity now " << frame_capacity_;
+      }
+      if (packet_frame_.Allocate(frame_capacity_)) {
+        LOG(ERROR) << "cannot allocate compressed frame storage.";
+        return kEncoderError;
+      }
+      memcpy(packet_frame_.buffer(), ptr_data, data_length);
+      if (index_length > 0) {
+        memcpy(packet_frame_.buffer() + data_length, index, index_length);
+      }
+      VideoConfig vpx_config = last_raw_config_;
       vpx_config.format = config_.codec;
-      const int32 status = ptr_vpx_frame->Init(vpx_config,
-                                               is_keyframe,
-                                               raw_frame.timestamp(),
-                                               raw_frame.duration(),
-                                               ptr_vpx_frame_buf,
-                                               pkt->data.frame.sz);
+      if (num_spatial_layers > 1) {
+        vpx_config.width = layer_widths_[layer];
+        vpx_config.height = layer_heights_[layer];
+      }
+      const int32 status = packet_frame_.InitInPlace(vpx_config,
+                                                     is_keyframe,
+                                                     0,
+                                                     0,
+                                                     packet_size);
       if (status) {
-        LOG(ERROR) << "VideoFrame Init failed: " << status;
+        LOG(ERROR) << "VideoFrame InitInPlace failed: " << status;
         return kEncoderError;
       }
-      if (is_keyframe) {
-        last_keyframe_time_ = ptr_vpx_frame->timestamp();
+      packet_frame_.SetTimeUs(timestamp_us, pkt->data.frame.duration);
+      packet_frame_.set_temporal_layer(temporal_layer);
+      packet_frame_.set_spatial_layer(layer);
+      if (is_keyframe && layer == 0) {
+        last_keyframe_time_ = packet_frame_.timestamp();
         LOG(INFO) << "keyframe @ " << last_keyframe_time_ / 1000.0 << "sec ("
                   << last_keyframe_time_ << "ms)";
       }
-      ++frames_out_;
-      break;
+      if (output_queue_.Commit(&packet_frame_)) {
+        LOG(ERROR) << "VpxEncoder output Commit failed.";
+        return kNoMemory;
+      }
     }
+    ++frames_out_;
+    bytes_queued_ += frame_size;
+    if (is_keyframe)
+      ++keyframes_queued_;
+  }
+  return kSuccess;
+}
+
+int VpxEncoder::ConfigureSpatialLayers(const WebmEncoderConfig& user_config,
+                                       vpx_codec_enc_cfg_t* ptr_config) {
+  const std::vector<VideoRepresentationConfig>& reps =
+      user_config.video_representations;
+  vpx_codec_enc_cfg_t& libvpx_config = *ptr_config;
+  if (config_.codec != kVideoFormatVP9 ||
+      static_cast<int>(reps.size()) > kMaxSpatialLayers) {
+    LOG(ERROR) << "spatial layers require VP9 and at most "
+               << kMaxSpatialLayers << " representations.";
+    return VideoEncoder::kInvalidArg;
+  }
+  if (config_.temporal_layers > 1 || libvpx_config.g_lag_in_frames > 0 ||
+      libvpx_config.rc_end_usage != VPX_CBR) {
+    LOG(ERROR) << "spatial layers require a CBR encode without lookahead or "
+               << "temporal layers.";
+    return VideoEncoder::kInvalidArg;
+  }
+
+  // The input is the top layer. libvpx scales the others from it by their
+  // height, and rounds their sizes up to even values.
+  const int32 input_width = static_cast<int32>(libvpx_config.g_w);
+  const int32 input_height = static_cast<int32>(libvpx_config.g_h);
+  for (size_t i = 0; i < reps.size(); ++i) {
+    const int32 width = reps[i].width > 0 ? reps[i].width : input_width;
+    const int32 height = reps[i].height > 0 ? reps[i].height : input_height;
+    const int kbps = reps[i].bitrate > 0 ? reps[i].bitrate : config_.bitrate;
+    int32 scaled_width = static_cast<int32>(
+        static_cast<int64>(input_width) * height / input_height);
+    scaled_width += scaled_width % 2;
+    const bool top = i + 1 == reps.size();
+    const bool scales = top ?
+        width == input_width && height == input_height &&
+            kbps == config_.bitrate :
+        width == scaled_width && height % 2 == 0;
+    if (!scales ||
+        (i > 0 && (height <= layer_heights_.back() ||
+                   kbps <= spatial_kbps_.back()))) {
+      LOG(ERROR) << "spatial layer " << i << " (" << width << "x" << height
+                 << " @ " << kbps << " kbps) must keep the aspect ratio of "
+                 << "the top layer, and raise the size and bitrate of the "
+                 << "layer below.";
+      return VideoEncoder::kInvalidArg;
+    }
+    layer_widths_.push_back(width);
+    layer_heights_.push_back(height);
+    spatial_kbps_.push_back(kbps);
+  }
+  libvpx_config.ss_number_layers = static_cast<unsigned int>(reps.size());
+  return kSuccess;
+}
+
+int VpxEncoder::SetTargetBitrate(int kbps) {
+  if (kbps <= 0) {
+    LOG(ERROR) << "invalid target bitrate " << kbps;
+    return kInvalidArg;
+  }
+  requested_bitrate_.store(kbps);
+  return kSuccess;
+}
+
+int VpxEncoder::ApplyRequestedBitrate() {
+  const int kbps = requested_bitrate_.exchange(0);
+  if (kbps == 0 || static_cast<unsigned int>(kbps) ==
+      vpx_config_.rc_target_bitrate) {
+    return kSuccess;
+  }
+  vpx_codec_enc_cfg_t libvpx_config = vpx_config_;
+  SetLayerBitrates(kbps, spatial_kbps_, &libvpx_config);
+  const vpx_codec_err_t status =
+      vpx_codec_enc_config_set(&vpx_context_, &libvpx_config);
+  if (status) {
+    LOG(ERROR) << "vpx_codec_enc_config_set failed: "
+               << vpx_codec_err_to_string(status);
+    return kCodecError;
+  }
+  LOG(INFO) << "target bitrate " << vpx_config_.rc_target_bitrate << " -> "
+            << kbps << " kbps";
+  vpx_config_ = libvpx_config;
+  config_.bitrate = kbps;
+  return kSuccess;
+}
+
+int VpxEncoder::BoostedSpeed() const {
+  const int speed =
+      config_.adaptive_speed ? speed_controller_.speed() : config_.speed;
+  const int max_speed =
+      config_.codec == kVideoFormatVP9 ? kMaxVp9Speed : kMaxVp8Speed;
+  // Negative speeds select libvpx's real time mode in VP8; only the magnitude
+  // changes.
+  const int magnitude = std::min(std::abs(speed) + speed_boost_, max_speed);
+  return speed < 0 ? -magnitude : magnitude;
+}
+
+int VpxEncoder::ApplyRequestedSpeedBoost() {
+  const int boost = requested_speed_boost_.load();
+  if (boost == speed_boost_ || config_.speed == VpxConfig::kUseDefault) {
+    return kSuccess;
+  }
+  const int old_speed = BoostedSpeed();
+  speed_boost_ = boost;
+  const int speed = BoostedSpeed();
+  if (speed != old_speed &&
+      CodecControl(VP8E_SET_CPUUSED, speed, VpxConfig::kUseDefault)) {
+    return kCodecError;
+  }
+  LOG(INFO) << "speed boost " << boost << ", speed " << old_speed << " -> "
+            << speed;
+  return kSuccess;
+}
+
+int VpxEncoder::SetTemporalLayer(int layer) {
+  vpx_codec_err_t status = VPX_CODEC_OK;
+  if (config_.codec == kVideoFormatVP9) {
+    vpx_svc_layer_id_t layer_id = {0, layer};
+    status = vpx_codec_control(&vpx_context_, VP9E_SET_SVC_LAYER_ID,
+                               &layer_id);
+  } else {
+    status = vpx_codec_control(&vpx_context_, VP8E_SET_TEMPORAL_LAYER_ID,
+                               layer);
+  }
+  if (status) {
+    LOG(ERROR) << "cannot set temporal layer " << layer << ": "
+               << vpx_codec_err_to_string(status);
+    return kCodecError;
   }
-  last_timestamp_ = ptr_vpx_frame->timestamp();
+  return kSuccess;
+}
+
+void VpxEncoder::AccumulateRegionHints(const VideoFrame& raw_frame) {
+  const VideoRegionHints& hints = raw_frame.region_hints();
+  const bool have_changes = hints.valid &&
+      last_hint_sequence_ >= 0 && hints.sequence == last_hint_sequence_ + 1 &&
+      raw_frame.width() == static_cast<int32>(vpx_config_.g_w) &&
+      raw_frame.height() == static_cast<int32>(vpx_config_.g_h);
+  last_hint_sequence_ = hints.valid ? hints.sequence : -1;
+  unchanged_since_encode_ = unchanged_since_encode_ && have_changes &&
+      hints.changed_regions.empty();
+  if (!have_changes) {
+    std::fill(refine_frames_.begin(), refine_frames_.end(),
+              kActiveMapRefineFrames);
+    return;
+  }
+  for (const VideoRect& rect : hints.changed_regions) {
+    const int32 left = std::max(0, rect.x);
+    const int32 top = std::max(0, rect.y);
+    const int32 right = std::min(raw_frame.width(), rect.x + rect.width);
+    const int32 bottom = std::min(raw_frame.height(), rect.y + rect.height);
+    if (right <= left || bottom <= top) {
+      continue;
+    }
+    const uint32 first_col = left / kActiveMapBlockSize;
+    const uint32 end_col =
+        (right + kActiveMapBlockSize - 1) / kActiveMapBlockSize;
+    const uint32 first_row = top / kActiveMapBlockSize;
+    const uint32 end_row =
+        (bottom + kActiveMapBlockSize - 1) / kActiveMapBlockSize;
+    for (uint32 row = first_row; row < end_row; ++row) {
+      uint8* const ptr_row = &refine_frames_[row * map_cols_];
+      std::fill(ptr_row + first_col, ptr_row + end_col,
+                kActiveMapRefineFrames);
+    }
+  }
+}
+
+bool VpxEncoder::KeyframeDue(const VideoFrame& raw_frame) const {
+  if (config_.scheduled_keyframes) {
+    return false;
+  }
+  const VideoFrameAnalysis& analysis = raw_frame.analysis();
+  const bool periodic = !config_.intra_refresh &&
+      raw_frame.timestamp() - last_keyframe_time_ > config_.keyframe_interval;
+  return periodic || (analysis.valid && analysis.scene_cut);
+}
+
+bool VpxEncoder::SkipsStaticFrame(const VideoFrame& raw_frame) {
+  const int64 timestamp = raw_frame.timestamp();
+  const bool keyframe_due =
+      keyframe_request_.Pending(timestamp) || KeyframeDue(raw_frame);
+  if (last_encoded_time_ < 0 || keyframe_due ||
+      timestamp - last_encoded_time_ >= kMaxStaticSkipTime) {
+    return false;
+  }
+
+  // Region hints tell exactly whether anything changed since the last frame
+  // encoded. Without them the detector compares the frame with the last one
+  // it did not find static; it starts over after hinted frames, whose
+  // encodes it did not see.
+  if (raw_frame.region_hints().valid) {
+    static_frame_detector_.Reset();
+    return unchanged_since_encode_;
+  }
+  return static_frame_detector_.IsStatic(raw_frame);
+}
+
+int VpxEncoder::ApplyActiveMap(bool keyframe) {
+  bool all_active = true;
+  for (size_t i = 0; i < refine_frames_.size(); ++i) {
+    active_map_[i] = refine_frames_[i] > 0 ? 1 : 0;
+    if (refine_frames_[i] > 0) {
+      --refine_frames_[i];
+    } else {
+      all_active = false;
+    }
+  }
+  if (keyframe || all_active) {
+    if (!active_map_enabled_) {
+      return kSuccess;
+    }
+    // A NULL map disables the active map.
+    vpx_active_map_t map = {NULL, map_rows_, map_cols_};
+    if (vpx_codec_control(&vpx_context_, VP8E_SET_ACTIVEMAP, &map)) {
+      LOG(ERROR) << "EncodeFrame cannot disable the active map.";
+      return kCodecError;
+    }
+    active_map_enabled_ = false;
+    return kSuccess;
+  }
+  vpx_active_map_t map = {&active_map_[0], map_rows_, map_cols_};
+  if (vpx_codec_control(&vpx_context_, VP8E_SET_ACTIVEMAP, &map)) {
+    LOG(ERROR) << "EncodeFrame cannot set the active map.";
+    return kCodecError;
+  }
+  active_map_enabled_ = true;
   return kSuccess;
 }
 
@@ -267,15 +1355,22 @@ int VpxEncoder::CodecControl(int control_id, T val, T default_val) {
     vpx_codec_err_t status = VPX_CODEC_OK;
     switch (control_id) {
       case VP8E_SET_CPUUSED:
+      case VP8E_SET_CQ_LEVEL:
+      case VP8E_SET_ENABLEAUTOALTREF:
       case VP8E_SET_GF_CBR_BOOST_PCT:
       case VP8E_SET_MAX_INTRA_BITRATE_PCT:
       case VP8E_SET_NOISE_SENSITIVITY:
+      case VP8E_SET_SCREEN_CONTENT_MODE:
       case VP8E_SET_SHARPNESS:
       case VP8E_SET_STATIC_THRESHOLD:
       case VP8E_SET_TOKEN_PARTITIONS:
       case VP9E_SET_AQ_MODE:
       case VP9E_SET_FRAME_PARALLEL_DECODING:
       case VP9E_SET_TILE_COLUMNS:
+      case VP9E_SET_TUNE_CONTENT:
+#ifdef VPX_CTRL_VP9E_SET_ROW_MT
+      case VP9E_SET_ROW_MT:
+#endif
         status = vpx_codec_control(&vpx_context_, control_id, val);
         break;
       default:
@@ -9,9 +9,19 @@
 #ifndef WEBMLIVE_ENCODER_VPX_ENCODER_H_
 #define WEBMLIVE_ENCODER_VPX_ENCODER_H_
 
+#include <atomic>
+#include <memory>
+#include <vector>
+
 #include "encoder/basictypes.h"
+#include "encoder/buffer_pool.h"
 #include "encoder/encoder_base.h"
+#include "encoder/quality_probe.h"
+#include "encoder/rate_control_telemetry.h"
+#include "encoder/speed_controller.h"
+#include "encoder/static_frame_detector.h"
 #include "encoder/video_encoder.h"
+#include "encoder/video_encoder_backend.h"
 
 #define VPX_CODEC_DISABLE_COMPAT 1
 #define VPX_DISABLE_CTRL_TYPECHECKS 1
@@ -24,7 +34,11 @@ class VideoFrame;
 struct WebmEncoderConfig;
 
 // Simple wrapper class for VP8 encoding using libvpx.
-class VpxEncoder {
+//
+// With |WebmEncoderConfig::video_svc| the representations are encoded as VP9
+// spatial layers, and every input frame yields a compressed frame per layer;
+// see |VideoFrame::spatial_layer()|.
+class VpxEncoder : public VideoEncoderBackendInterface {
  public:
   enum {
     // libvpx reported an error.
@@ -36,29 +50,61 @@ class VpxEncoder {
     kSuccess = VideoEncoder::kSuccess,
     // Frame dropped.
     kDropped = VideoEncoder::kDropped,
+    kNoFrame = VideoEncoder::kNoFrame,
   };
   VpxEncoder();
-  ~VpxEncoder();
+  virtual ~VpxEncoder();
 
   // Initializes libvpx for VPx encoding and returns |kSuccess|. Returns
-  // |kCodecError| if a libvpx operation fails.
-  int Init(const WebmEncoderConfig& config);
+  // |kCodecError| if a libvpx operation fails. An encoder initialized before,
+  // and not used to encode since, keeps its libvpx context when |config|
+  // matches the codec, frame size, bit depth, threads, lookahead and
+  // temporal layers of that context; it is then only reconfigured, which
+  // skips the context allocation. See |EncoderContextPool|.
+  virtual int Init(const WebmEncoderConfig& config);
 
   // Encodes |ptr_raw_frame| using libvpx and returns the compressed data via
   // |ptr_vpx_frame|.
   // Return values:
-  // |kSuccess| - frame encoded successfully.
-  // |kDropped| - decimation is enabled and the frame stored in
-  //              |ptr_raw_frame| was dropped.
+  // |kSuccess| - the oldest compressed frame ready is in |ptr_vpx_frame|.
+  //              Others produced by the call wait for |ReadQueuedFrame()|.
+  // |kDropped| - no compressed frame is ready: decimation or rate control
+  //              dropped the frame, or libvpx holds it for lookahead.
   // |kCodecError| - a libvpx operation failed.
   // |kEncoderError| - compressed data cannot be stored in |ptr_vpx_frame|.
-  int EncodeFrame(const VideoFrame& raw_frame, VideoFrame* ptr_vpx_frame);
+  virtual int EncodeFrame(const VideoFrame& raw_frame,
+                          VideoFrame* ptr_vpx_frame);
+
+  // Moves the oldest compressed frame left queued by |EncodeFrame()| or
+  // |Flush()| into |ptr_vpx_frame|. Returns |kNoFrame| when none is queued.
+  virtual int ReadQueuedFrame(VideoFrame* ptr_vpx_frame);
+
+  // Drains the frames libvpx holds for lookahead into the output queue.
+  virtual int Flush();
+
+  // Requests a new target bitrate in kilobits per second. May be called from
+  // any thread; libvpx is reconfigured before the next frame is encoded.
+  // Returns |kInvalidArg| when |kbps| is not greater than 0.
+  virtual int SetTargetBitrate(int kbps);
+
+  // Forces a keyframe at the first frame at or after |timestamp|. May be
+  // called from any thread.
+  virtual void RequestKeyframe(int64 timestamp) {
+    keyframe_request_.Request(timestamp);
+  }
+
+  // Raises the magnitude of the libvpx speed setting by |steps|, up to the
+  // codec's maximum. Ignored when |VpxConfig::speed| is left to libvpx. May
+  // be called from any thread.
+  virtual void SetSpeedBoost(int steps) {
+    requested_speed_boost_ = steps < 0 ? 0 : steps;
+  }
 
   // Accessors.
-  int64 frames_in() const { return frames_in_; }
-  int64 frames_out() const { return frames_out_; }
-  int64 last_keyframe_time() const { return last_keyframe_time_; }
-  int64 last_timestamp() const { return last_timestamp_; }
+  virtual int64 frames_in() const { return frames_in_; }
+  virtual int64 frames_out() const { return frames_out_; }
+  virtual int64 last_keyframe_time() const { return last_keyframe_time_; }
+  virtual int64 last_timestamp() const { return last_timestamp_; }
 
  private:
   // Utility function for passing values to libvpx's vpx_codec_control
@@ -68,6 +114,63 @@ class VpxEncoder {
   template <typename T> int32 CodecControl(int control_id, T val,
                                            T default_val);
 
+  // Applies |requested_bitrate_| to |vpx_config_| when set. Returns
+  // |kCodecError| when libvpx rejects the change.
+  int ApplyRequestedBitrate();
+
+  // Returns the speed to pass to libvpx: the adaptive speed when enabled, or
+  // the configured one, with its magnitude raised by |speed_boost_|.
+  int BoostedSpeed() const;
+
+  // Applies |requested_speed_boost_| when it differs from |speed_boost_|.
+  // Returns |kCodecError| when libvpx rejects the speed.
+  int ApplyRequestedSpeedBoost();
+
+  // Moves every compressed frame libvpx has ready into |output_queue_|,
+  // tagged with |temporal_layer|. Superframes of spatial layers are queued
+  // once per layer, cut after the layer's frame.
+  int QueuePackets(int temporal_layer);
+
+  // Sets up the spatial layers of a |WebmEncoderConfig::video_svc| encode in
+  // |ptr_config|, from the representations of |user_config|, and fills
+  // |layer_widths_|, |layer_heights_| and |spatial_kbps_|. Returns
+  // |kInvalidArg| when the representations cannot be layers of the input.
+  int ConfigureSpatialLayers(const WebmEncoderConfig& user_config,
+                             vpx_codec_enc_cfg_t* ptr_config);
+
+  // Tells libvpx the temporal layer of the next frame. Returns |kCodecError|
+  // when libvpx rejects it.
+  int SetTemporalLayer(int layer);
+
+  // Marks the macroblocks |raw_frame|'s region hints report as changed for
+  // refinement. Every macroblock is marked when the hints are invalid, or
+  // when frames of the source were lost. Called for every input frame,
+  // including those dropped by decimation.
+  void AccumulateRegionHints(const VideoFrame& raw_frame);
+
+  // Returns true when |raw_frame| is due to be a keyframe without a request:
+  // after the keyframe interval, unless keyframes are scheduled or intra
+  // refresh is on, and at scene cuts found by frame analysis, unless
+  // keyframes are scheduled, in which case those arrive as requests.
+  bool KeyframeDue(const VideoFrame& raw_frame) const;
+
+  // Returns true when |raw_frame| repeats the last frame encoded, and may be
+  // skipped: no keyframe is due, and the last frame encoded is recent.
+  bool SkipsStaticFrame(const VideoFrame& raw_frame);
+
+  // Passes the macroblocks still being refined to libvpx as the active map,
+  // or disables the map when all of them are. |keyframe| disables the map.
+  // Returns |kCodecError| when libvpx rejects the map.
+  int ApplyActiveMap(bool keyframe);
+
+  // Passes the luma planes of |raw_frame| and of libvpx's reconstruction of
+  // it to |quality_probe_|. Skips the sample when the probe is busy, or when
+  // libvpx does not return the reconstruction.
+  void SampleQuality(const VideoFrame& raw_frame);
+
+  // Adds |stats| to |ptr_telemetry_queue_| when telemetry is enabled.
+  void RecordFrameStats(const VideoFrameStats& stats);
+
   // Number of raw frames passed to |EncodeFrame|.
   int64 frames_in_;
 
@@ -80,11 +183,83 @@ class VpxEncoder {
   // Webmlive libvpx settings structure.
   VpxConfig config_;
 
-  // libvpx VPx configuration structure.
+  // libvpx encoder context, the configuration it was last given, and the
+  // codec it was initialized for.
   vpx_codec_ctx_t vpx_context_;
+  vpx_codec_enc_cfg_t vpx_config_;
+  VideoFormat context_codec_;
+
+  // Bitrate requested by |SetTargetBitrate()|, or 0 when there is no pending
+  // request.
+  std::atomic<int> requested_bitrate_;
+  KeyframeRequest keyframe_request_;
 
-  // Timestamp of most recent compressed frame.
+  // Speed boost requested by |SetSpeedBoost()|, and the boost applied.
+  std::atomic<int> requested_speed_boost_;
+  int speed_boost_;
+
+  // Timestamp of most recent compressed frame returned, and of the most
+  // recent one queued in microseconds.
   int64 last_timestamp_;
+  int64 last_queued_timestamp_;
+
+  // Compressed frames not yet returned, the frame packets are copied into
+  // before they are queued, and the configuration of the latest input frame.
+  BufferPool<VideoFrame> output_queue_;
+  VideoFrame packet_frame_;
+  VideoConfig last_raw_config_;
+
+  // Deadline passed to vpx_codec_encode(), from |VpxConfig::profile|.
+  unsigned long deadline_;  // NOLINT
+
+  // Position of the next frame in the temporal layer pattern.
+  uint32 layer_pattern_index_;
+
+  // Size of each spatial layer, smallest first, and the bitrate up to and
+  // including it, in kilobits per second. Empty without spatial layers.
+  // |layer_sizes_| holds the frame sizes of the superframe being queued.
+  std::vector<int32> layer_widths_;
+  std::vector<int32> layer_heights_;
+  std::vector<int> spatial_kbps_;
+  std::vector<int32> layer_sizes_;
+
+  // Storage reserved in output frames, from |CompressedFrameCapacity()|.
+  // Grows when a frame does not fit.
+  int32 frame_capacity_;
+
+  // Active map state, in 16x16 macroblocks. |refine_frames_| counts down the
+  // encoded frames each macroblock stays active after it last changed, and
+  // inactive macroblocks are copied from the previous frame by libvpx.
+  uint32 map_rows_;
+  uint32 map_cols_;
+  std::vector<uint8> refine_frames_;
+  std::vector<uint8> active_map_;
+  bool active_map_enabled_;
+
+  // Sequence number of the last region hints seen, or -1.
+  int64 last_hint_sequence_;
+
+  // Static frame skipping of |VpxConfig::skip_static_frames|: whether every
+  // frame since the last one encoded had hints reporting no change, the time
+  // of the last frame encoded, or -1, and the detector for frames without
+  // hints.
+  bool unchanged_since_encode_;
+  int64 last_encoded_time_;
+  StaticFrameDetector static_frame_detector_;
+
+  // Picks the speed from encode times when |VpxConfig::adaptive_speed| is set.
+  SpeedController speed_controller_;
+
+  // Measures encode quality when |VpxConfig::quality_probe_interval| is set.
+  std::unique_ptr<QualityProbe> quality_probe_;
+
+  // Rate control telemetry of |WebmEncoderConfig::rate_control_telemetry|,
+  // and the queue it gave this encoder, or NULL when disabled. |QueuePackets|
+  // counts the compressed bytes and keyframes it queues for the records.
+  RateControlTelemetry* ptr_telemetry_;
+  RateControlTelemetry::Queue* ptr_telemetry_queue_;
+  int64 bytes_queued_;
+  int64 keyframes_queued_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VpxEncoder);
 };
 
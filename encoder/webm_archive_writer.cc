@@ -0,0 +1,491 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/webm_archive_writer.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/encoder_base.h"
+#include "encoder/file_util.h"
+#include "encoder/mapped_archive_file.h"
+#include "encoder/thread_placement.h"
+#include "glog/logging.h"
+#include "libwebm/mkvmuxer.hpp"
+
+namespace webmlive {
+
+namespace {
+const uint64 kNanosecondsPerMillisecond = 1000000;
+}  // namespace
+
+// Seekable libwebm writer that never touches the disk on the muxing thread.
+// Writes are appended to the current |Run|, a buffer of bytes contiguous in
+// the file. Full runs, and the current run when libwebm seeks, are queued for
+// the I/O thread, which writes them in order, and then returns their buffers
+// for reuse.
+class ArchiveFileWriter : public mkvmuxer::IMkvWriter {
+ public:
+  enum {
+    kFileError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Size at which a run is queued, and the stdio buffer size of the I/O
+  // thread.
+  static const size_t kRunSize = 256 * 1024;
+
+  // Preallocation step of the I/O thread.
+  static const int64 kPreallocateSize = 64 * 1024 * 1024;
+
+  ArchiveFileWriter();
+  virtual ~ArchiveFileWriter();
+
+  // Creates |path| and starts the I/O thread. Returns |kSuccess| when
+  // successful.
+  int Open(const std::string& path);
+
+  // Queues the current run, waits for the I/O thread to write every run, and
+  // closes the file. Returns |kSuccess| when every write succeeded.
+  int Close();
+
+  // mkvmuxer::IMkvWriter methods.
+  virtual int32 Write(const void* ptr_buffer, uint32 buffer_length);
+  virtual int64 Position() const { return position_; }
+  virtual int32 Position(int64 position);
+  virtual bool Seekable() const { return true; }
+  virtual void ElementStartNotify(uint64, int64) {}
+
+ private:
+  struct Run {
+    Run() : offset(0) {}
+    int64 offset;
+    std::vector<uint8> data;
+  };
+
+  // Queues |run_| for the I/O thread when it holds data. Returns false once
+  // the I/O thread has failed.
+  bool QueueRun();
+
+  // Writes |run| to |file_|, and returns true when successful. Called by the
+  // I/O thread only.
+  bool WriteRun(const Run& run);
+
+  // Extends the space allocated to |file_| to cover |end|. Called by the I/O
+  // thread only.
+  void Preallocate(int64 end);
+
+  // Writes queued runs until |stop_| is set and the queue is empty.
+  void IoThread();
+
+  FILE* file_;
+
+  // Muxing thread state: the file position libwebm writes at, and the run
+  // being filled.
+  int64 position_;
+  std::unique_ptr<Run> run_;
+
+  // I/O thread state.
+  int64 file_position_;
+  int64 preallocated_;
+  std::unique_ptr<char[]> write_buffer_;
+
+  std::mutex mutex_;
+  std::condition_variable run_queued_;
+  std::deque<std::unique_ptr<Run>> queued_runs_;
+  std::vector<std::unique_ptr<Run>> free_runs_;
+  bool stop_;
+  bool failed_;
+  std::unique_ptr<std::thread> io_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(ArchiveFileWriter);
+};
+
+ArchiveFileWriter::ArchiveFileWriter()
+    : file_(NULL),
+      position_(0),
+      file_position_(0),
+      preallocated_(0),
+      stop_(false),
+      failed_(false) {
+}
+
+ArchiveFileWriter::~ArchiveFileWriter() {
+  if (file_) {
+    Close();
+  }
+}
+
+int ArchiveFileWriter::Open(const std::string& path) {
+  if (file_) {
+    LOG(ERROR) << "ArchiveFileWriter already open.";
+    return kInvalidArg;
+  }
+  write_buffer_.reset(new (std::nothrow) char[kRunSize]);  // NOLINT
+  if (!write_buffer_) {
+    LOG(ERROR) << "ArchiveFileWriter cannot allocate write buffer.";
+    return kNoMemory;
+  }
+  file_ = fopen(path.c_str(), "wb");
+  if (!file_) {
+    LOG(ERROR) << "ArchiveFileWriter cannot open " << path;
+    return kFileError;
+  }
+  setvbuf(file_, write_buffer_.get(), _IOFBF, kRunSize);
+  using std::bind;
+  using std::nothrow;
+  using std::thread;
+  io_thread_.reset(new (nothrow) thread(
+      bind(&ArchiveFileWriter::IoThread, this)));  // NOLINT
+  if (!io_thread_) {
+    LOG(ERROR) << "ArchiveFileWriter cannot construct thread.";
+    fclose(file_);
+    file_ = NULL;
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+int ArchiveFileWriter::Close() {
+  if (!file_) {
+    return kInvalidArg;
+  }
+  QueueRun();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  run_queued_.notify_one();
+  io_thread_->join();
+  io_thread_.reset();
+  bool failed = failed_;
+  if (fclose(file_)) {
+    failed = true;
+  }
+  file_ = NULL;
+  return failed ? kFileError : kSuccess;
+}
+
+int32 ArchiveFileWriter::Write(const void* ptr_buffer, uint32 buffer_length) {
+  if (!ptr_buffer || !buffer_length) {
+    return kInvalidArg;
+  }
+  if (!run_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!free_runs_.empty()) {
+        run_ = std::move(free_runs_.back());
+        free_runs_.pop_back();
+      }
+    }
+    if (!run_) {
+      run_.reset(new (std::nothrow) Run());  // NOLINT
+      if (!run_) {
+        return kNoMemory;
+      }
+      run_->data.reserve(kRunSize);
+    }
+    run_->offset = position_;
+    run_->data.clear();
+  }
+  const uint8* const ptr_data = reinterpret_cast<const uint8*>(ptr_buffer);
+  run_->data.insert(run_->data.end(), ptr_data, ptr_data + buffer_length);
+  position_ += buffer_length;
+  if (run_->data.size() >= kRunSize && !QueueRun()) {
+    return kFileError;
+  }
+  return kSuccess;
+}
+
+int32 ArchiveFileWriter::Position(int64 position) {
+  if (position < 0) {
+    return kInvalidArg;
+  }
+  if (!QueueRun()) {
+    return kFileError;
+  }
+  position_ = position;
+  return kSuccess;
+}
+
+bool ArchiveFileWriter::QueueRun() {
+  bool failed = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed = failed_;
+    if (run_ && !run_->data.empty() && !failed) {
+      queued_runs_.push_back(std::move(run_));
+    }
+  }
+  run_queued_.notify_one();
+  return !failed;
+}
+
+bool ArchiveFileWriter::WriteRun(const Run& run) {
+  Preallocate(run.offset + static_cast<int64>(run.data.size()));
+  if (run.offset != file_position_) {
+    if (fflush(file_) || SeekFile(file_, run.offset, SEEK_SET)) {
+      LOG(ERROR) << "ArchiveFileWriter cannot seek to " << run.offset;
+      return false;
+    }
+    file_position_ = run.offset;
+  }
+  const size_t written = fwrite(&run.data[0], 1, run.data.size(), file_);
+  file_position_ += written;
+  if (written != run.data.size()) {
+    LOG(ERROR) << "ArchiveFileWriter write failed at " << run.offset;
+    return false;
+  }
+  return true;
+}
+
+// FALLOC_FL_KEEP_SIZE reserves blocks without changing the file size, so an
+// interrupted recording does not end in preallocated zeros. Preallocation is
+// abandoned on file systems that do not support it.
+void ArchiveFileWriter::Preallocate(int64 end) {
+#ifdef __linux__
+  while (preallocated_ < end) {
+    if (fallocate(fileno(file_), FALLOC_FL_KEEP_SIZE, preallocated_,
+                  kPreallocateSize)) {
+      VLOG(1) << "ArchiveFileWriter preallocation unavailable.";
+      preallocated_ = std::numeric_limits<int64>::max();
+      return;
+    }
+    preallocated_ += kPreallocateSize;
+  }
+#else
+  (void)end;
+#endif
+}
+
+void ArchiveFileWriter::IoThread() {
+  LOG(INFO) << "ArchiveFileWriter thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kUpload);
+  ScopedCpuStage cpu_stage(kCpuUpload);
+  for (;;) {
+    std::unique_ptr<Run> run;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      run_queued_.wait(lock,
+                       [this] { return stop_ || !queued_runs_.empty(); });
+      if (queued_runs_.empty()) {
+        // |stop_| is set and every queued run has been written.
+        break;
+      }
+      run = std::move(queued_runs_.front());
+      queued_runs_.pop_front();
+    }
+
+    const bool write_ok = WriteRun(*run);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!write_ok) {
+      failed_ = true;
+      queued_runs_.clear();
+    }
+    free_runs_.push_back(std::move(run));
+  }
+  LOG(INFO) << "ArchiveFileWriter thread finished.";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WebmArchiveWriter
+//
+
+WebmArchiveWriter::WebmArchiveWriter()
+    : audio_track_num_(0), video_track_num_(0), finalized_(false) {
+}
+
+WebmArchiveWriter::~WebmArchiveWriter() {
+  if (ptr_segment_ && !finalized_) {
+    LOG(WARNING) << "archive " << path_ << " destroyed before Finalize.";
+  }
+}
+
+int WebmArchiveWriter::Init(const std::string& path, bool memory_mapped) {
+  if (ptr_segment_) {
+    LOG(ERROR) << "WebmArchiveWriter already initialized.";
+    return kInvalidArg;
+  }
+  mkvmuxer::IMkvWriter* ptr_mkv_writer = NULL;
+  if (memory_mapped) {
+    ptr_mapped_file_.reset(
+        new (std::nothrow) MappedArchiveFile());  // NOLINT
+    if (!ptr_mapped_file_) {
+      LOG(ERROR) << "cannot construct MappedArchiveFile.";
+      return kNoMemory;
+    }
+    if (ptr_mapped_file_->Open(path)) {
+      LOG(ERROR) << "cannot open archive " << path;
+      ptr_mapped_file_.reset();
+      return kFileError;
+    }
+    ptr_mkv_writer = ptr_mapped_file_.get();
+  } else {
+    ptr_writer_.reset(new (std::nothrow) ArchiveFileWriter());  // NOLINT
+    if (!ptr_writer_) {
+      LOG(ERROR) << "cannot construct ArchiveFileWriter.";
+      return kNoMemory;
+    }
+    if (ptr_writer_->Open(path)) {
+      LOG(ERROR) << "cannot open archive " << path;
+      return kFileError;
+    }
+    ptr_mkv_writer = ptr_writer_.get();
+  }
+  path_ = path;
+
+  ptr_segment_.reset(new (std::nothrow) mkvmuxer::Segment());  // NOLINT
+  if (!ptr_segment_) {
+    LOG(ERROR) << "cannot construct archive Segment.";
+    return kNoMemory;
+  }
+  if (!ptr_segment_->Init(ptr_mkv_writer)) {
+    LOG(ERROR) << "cannot Init archive Segment.";
+    return kMuxerError;
+  }
+  ptr_segment_->set_mode(mkvmuxer::Segment::kFile);
+  ptr_segment_->set_max_cluster_duration(kMaxClusterDurationMs *
+                                         kNanosecondsPerMillisecond);
+  mkvmuxer::SegmentInfo* const ptr_segment_info =
+      ptr_segment_->GetSegmentInfo();
+  if (!ptr_segment_info) {
+    LOG(ERROR) << "archive Segment has no SegmentInfo.";
+    return kNoMemory;
+  }
+  ptr_segment_info->set_timecode_scale(LiveWebmMuxer::kTimecodeScale);
+  std::string app_name = kEncoderName;
+  app_name += " v";
+  app_name += kEncoderVersion;
+  ptr_segment_info->set_writing_app(app_name.c_str());
+  return kSuccess;
+}
+
+int WebmArchiveWriter::AddTracks(const LiveWebmMuxer& muxer) {
+  if (!ptr_segment_) {
+    LOG(ERROR) << "WebmArchiveWriter not initialized.";
+    return kInvalidArg;
+  }
+
+  // Copy into a scratch segment first to learn which tracks |muxer| has.
+  mkvmuxer::Segment scratch;
+  uint64 audio_track_num = 0;
+  uint64 video_track_num = 0;
+  if (muxer.CopyTracks(&scratch, false, &audio_track_num, &video_track_num)) {
+    LOG(ERROR) << "cannot read tracks of muxer " << muxer.muxer_id();
+    return kMuxerError;
+  }
+  if ((audio_track_num == 0 || audio_track_num_ != 0) &&
+      (video_track_num == 0 || video_track_num_ != 0)) {
+    return kSuccess;
+  }
+  if (audio_track_num_ != 0 || video_track_num_ != 0) {
+    // The archive already has one of |muxer|'s streams; only muxers with a
+    // single stream can add to it.
+    if (audio_track_num != 0 && video_track_num != 0) {
+      LOG(ERROR) << "archive cannot take both tracks of "
+                 << muxer.muxer_id();
+      return kInvalidArg;
+    }
+  }
+  if (muxer.CopyTracks(ptr_segment_.get(), false, &audio_track_num,
+                       &video_track_num)) {
+    LOG(ERROR) << "cannot copy tracks of muxer " << muxer.muxer_id();
+    return kMuxerError;
+  }
+  if (audio_track_num != 0)
+    audio_track_num_ = audio_track_num;
+  if (video_track_num != 0)
+    video_track_num_ = video_track_num;
+  const uint64 cues_track = video_track_num_ ? video_track_num_ :
+      audio_track_num_;
+  if (!ptr_segment_->CuesTrack(cues_track)) {
+    LOG(ERROR) << "cannot set archive Cues track.";
+    return kMuxerError;
+  }
+  if (ptr_mapped_file_) {
+    ptr_mapped_file_->set_cues_track(cues_track);
+  }
+  return kSuccess;
+}
+
+int WebmArchiveWriter::Finalize() {
+  if (!ptr_segment_ || finalized_) {
+    return kInvalidArg;
+  }
+  finalized_ = true;
+  const bool segment_ok = ptr_segment_->Finalize();
+  const int close_status = ptr_mapped_file_ ?
+      ptr_mapped_file_->Close(segment_ok) : ptr_writer_->Close();
+  if (!segment_ok || close_status) {
+    LOG(ERROR) << "archive " << path_ << " is incomplete.";
+    return segment_ok ? kFileError : kMuxerError;
+  }
+  LOG(INFO) << "archive " << path_ << " complete.";
+  return kSuccess;
+}
+
+int WebmArchiveWriter::Recover(const std::string& path) {
+  switch (MappedArchiveFile::Recover(path)) {
+    case MappedArchiveFile::kSuccess:
+      return kSuccess;
+    case MappedArchiveFile::kInvalidArg:
+      return kInvalidArg;
+    case MappedArchiveFile::kNoMemory:
+      return kNoMemory;
+    default:
+      return kFileError;
+  }
+}
+
+int WebmArchiveWriter::WriteAudioBuffer(const AudioBuffer& buffer) {
+  if (audio_track_num_ == 0 || finalized_) {
+    return kSuccess;
+  }
+  if (!buffer.buffer()) {
+    return kInvalidArg;
+  }
+  if (!ptr_segment_->AddFrame(buffer.buffer(), buffer.buffer_length(),
+                              audio_track_num_,
+                              buffer.timestamp() * kNanosecondsPerMillisecond,
+                              true)) {
+    LOG(ERROR) << "archive AddFrame (audio) failed.";
+    return kMuxerError;
+  }
+  return kSuccess;
+}
+
+int WebmArchiveWriter::WriteVideoFrame(const VideoFrame& frame) {
+  if (video_track_num_ == 0 || finalized_) {
+    return kSuccess;
+  }
+  if (!frame.buffer()) {
+    return kInvalidArg;
+  }
+  if (!ptr_segment_->AddFrame(frame.buffer(), frame.buffer_length(),
+                              video_track_num_,
+                              frame.timestamp() * kNanosecondsPerMillisecond,
+                              frame.keyframe())) {
+    LOG(ERROR) << "archive AddFrame (video) failed.";
+    return kMuxerError;
+  }
+  return kSuccess;
+}
+
+}  // namespace webmlive
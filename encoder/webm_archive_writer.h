@@ -0,0 +1,108 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_WEBM_ARCHIVE_WRITER_H_
+#define WEBMLIVE_ENCODER_WEBM_ARCHIVE_WRITER_H_
+
+#include <memory>
+#include <string>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+#include "encoder/webm_mux.h"
+
+namespace mkvmuxer {
+class Segment;
+}
+
+namespace webmlive {
+
+class ArchiveFileWriter;
+class MappedArchiveFile;
+
+// Records a live encode to a seekable WebM file with Cues and a Duration, so
+// that the recording is ready for on demand playback as soon as the encode
+// ends. It is fed the packets the live muxers receive, through a
+// |MuxReorderQueue|, and libwebm muxes them in file mode into an
+// |ArchiveFileWriter|, which gathers the writes into runs that its own I/O
+// thread writes to disk. The encode thread never waits on the disk.
+//
+// Notes
+// - libwebm seeks back to fill in each cluster's size, and at |Finalize()|
+//   to write the Cues, SeekHead and Duration. A seek only ends the current
+//   run; the I/O thread writes the runs in order.
+// - On Linux the I/O thread preallocates the file |kPreallocateSize| bytes
+//   at a time, without changing its size, to limit fragmentation.
+// - Cues point at video keyframes, or at audio clusters when the archive has
+//   no video. Clusters last at most |kMaxClusterDurationMs|.
+// - Tracks are copied from the live muxers, and must all be added before the
+//   first packet is written.
+// - When |Init()| is asked for a memory mapped archive, a
+//   |MappedArchiveFile| replaces the |ArchiveFileWriter|: libwebm's writes
+//   are copied into mapped pages, and its index lets |Recover()| repair the
+//   archive after a crash or a power loss.
+class WebmArchiveWriter : public PacketMuxerInterface {
+ public:
+  enum {
+    // The file could not be opened or written.
+    kFileError = -4,
+    // Something failed while interacting with libwebm.
+    kMuxerError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  static const int64 kMaxClusterDurationMs = 5000;
+
+  WebmArchiveWriter();
+  virtual ~WebmArchiveWriter();
+
+  // Creates |path|, replacing any existing file, and starts the I/O thread,
+  // or the index thread of a |MappedArchiveFile| when |memory_mapped| is
+  // true. Returns |kSuccess| when successful.
+  int Init(const std::string& path, bool memory_mapped);
+
+  // Copies the tracks of |muxer| into the archive with
+  // |LiveWebmMuxer::CopyTracks()|. Streams the archive already has are
+  // ignored, and a muxer with both streams must be added first. Returns
+  // |kSuccess| when successful.
+  int AddTracks(const LiveWebmMuxer& muxer);
+
+  // Writes the last cluster, the Cues and the Duration, waits for the I/O
+  // thread to write everything, and closes the file. Returns |kSuccess| when
+  // the whole file was written.
+  int Finalize();
+
+  // PacketMuxerInterface methods. Packets of a stream the archive has no
+  // track for are ignored.
+  virtual int WriteAudioBuffer(const AudioBuffer& buffer);
+  virtual int WriteVideoFrame(const VideoFrame& frame);
+
+  const std::string& path() const { return path_; }
+
+  // Repairs the memory mapped archive at |path| that was not finalized, with
+  // |MappedArchiveFile::Recover()|. Returns |kSuccess| when successful,
+  // |kInvalidArg| when |path| has no usable index, and |kFileError| when the
+  // archive cannot be repaired.
+  static int Recover(const std::string& path);
+
+ private:
+  std::string path_;
+  std::unique_ptr<ArchiveFileWriter> ptr_writer_;
+  std::unique_ptr<MappedArchiveFile> ptr_mapped_file_;
+  std::unique_ptr<mkvmuxer::Segment> ptr_segment_;
+  uint64 audio_track_num_;
+  uint64 video_track_num_;
+  bool finalized_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WebmArchiveWriter);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_WEBM_ARCHIVE_WRITER_H_
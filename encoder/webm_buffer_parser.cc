@@ -8,11 +8,43 @@
 #include "encoder/webm_buffer_parser.h"
 
 #include <cassert>
+#include <cstring>
+#include <ios>
 
+#include "encoder/ebml_util.h"
 #include "glog/logging.h"
 #include "libwebm/mkvparser.hpp"
 
 namespace webmlive {
+
+namespace {
+// EBML IDs of the elements that mark the end of a cluster of unknown size:
+// the top level (segment children) elements, and the EBML header and segment
+// that begin a new stream.
+const uint32 kTopLevelIds[] = {
+  kEbmlId,
+  kSegmentId,
+  kSeekHeadId,
+  kInfoId,
+  kTracksId,
+  kClusterId,
+  kCuesId,
+  0x1043A770,  // Chapters.
+  0x1941A469,  // Attachments.
+  0x1254C367,  // Tags.
+};
+
+bool IsTopLevelId(uint32 id) {
+  for (size_t i = 0; i < sizeof(kTopLevelIds) / sizeof(kTopLevelIds[0]);
+       ++i) {
+    if (id == kTopLevelIds[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+}  // namespace
+
 // Provides a moving window into a buffer, and implements libwebm's IMkvReader
 // interface.  |WebmBufferParser| sets the window into a buffer by calling
 // |SetBufferWindow|, and libwebm parses the data using the |Read| and |Length|
@@ -108,8 +140,9 @@ int WebmBufferReader::Length(int64* ptr_total, int64* ptr_available) {
 //
 
 WebmBufferParser::WebmBufferParser()
-    : ptr_cluster_(NULL),
-      cluster_parse_offset_(0),
+    : ptr_buf_(NULL),
+      cluster_scan_pos_(0),
+      cluster_size_(-1),
       total_bytes_parsed_(0),
       parse_func_(&WebmBufferParser::ParseSegmentHeaders) {
 }
@@ -144,7 +177,10 @@ int WebmBufferParser::Parse(const Buffer& buf, int32* ptr_element_size) {
     return kParseError;
   }
   // Just return the result of the parsing attempt.
-  return (this->*parse_func_)(ptr_element_size);
+  ptr_buf_ = &buf;
+  const int status = (this->*parse_func_)(ptr_element_size);
+  ptr_buf_ = NULL;
+  return status;
 }
 
 // Tries to parse the segment headers, segment info and segment tracks.
@@ -211,49 +247,61 @@ int WebmBufferParser::ParseSegmentHeaders(int32* ptr_element_size) {
   return kSuccess;
 }
 
-// Tries to parse a cluster.  Loads and parses the cluster header, and then
-// attempts to walk through the cluster block entries.  Returns |kNeedMoreData|
-// when unable to walk through all blocks in the cluster.  Returns |kSuccess|
-// and sets |ptr_element_size| when successful.
+// Tries to find the end of a cluster by walking EBML element headers. The
+// buffer starts at the cluster, so offsets into it are relative to the cluster
+// start.
 int WebmBufferParser::ParseCluster(int32* ptr_element_size) {
-  // A NULL |ptr_cluster_| means either:
-  // - No clusters have been parsed, or...
-  // - The last cluster was parsed.
-  // In either case it's time to load a new one...
+  uint32 id = 0;
+  int64 size = 0;
+  int32 header_length = 0;
   int status;
-  long length = 0;  // NOLINT
-  if (!ptr_cluster_) {
-    // Load/parse a cluster header...
-    int64 current_pos = total_bytes_parsed_;
-    status = segment_->LoadCluster(current_pos, length);
+  if (cluster_scan_pos_ == 0) {
+    status = ReadElementHeader(0, &id, &size, &header_length);
     if (status) {
-      return kNeedMoreData;
+      return status;
     }
-    const mkvparser::Cluster* ptr_cluster = segment_->GetLast();
-    if (!ptr_cluster || ptr_cluster->EOS()) {
-      return kNeedMoreData;
+    if (id != kClusterId && size < 0) {
+      LOG(ERROR) << "unknown size top level element, id=" << std::hex << id;
+      return kParseError;
     }
-    cluster_parse_offset_ = current_pos;
-    ptr_cluster_ = ptr_cluster;
+    // Elements other than clusters, cues written by |Finalize()| for
+    // example, are returned as chunks of their own.
+    cluster_scan_pos_ = header_length;
+    cluster_size_ = (size < 0) ? -1 : header_length + size;
   }
-  const int kClusterComplete = 1;
-  for (;;) {
-    status = ptr_cluster_->Parse(cluster_parse_offset_, length);
-    if (status == kClusterComplete) {
-      break;
-    }
-    if (status < 0) {
-      return kNeedMoreData;
+
+  const int64 buffer_length = static_cast<int64>(ptr_buf_->size());
+  if (cluster_size_ < 0) {
+    // Unknown size: walk the children until a top level element begins.
+    // Children are skipped using their sizes, so their payloads need not be
+    // buffered until the next element header is read.
+    for (;;) {
+      if (cluster_scan_pos_ > buffer_length) {
+        return kNeedMoreData;
+      }
+      status = ReadElementHeader(cluster_scan_pos_, &id, &size,
+                                 &header_length);
+      if (status) {
+        return status;
+      }
+      if (IsTopLevelId(id)) {
+        cluster_size_ = cluster_scan_pos_;
+        break;
+      }
+      if (size < 0) {
+        LOG(ERROR) << "unknown size cluster child, id=" << std::hex << id;
+        return kParseError;
+      }
+      cluster_scan_pos_ += header_length + size;
     }
   }
-  const int64 cluster_size = ptr_cluster_->GetElementSize();
-  if (cluster_size == -1) {
-    // Should never happen... the parser should never report a complete cluster
-    // without setting its length.
-    return kParseError;
+  if (buffer_length < cluster_size_) {
+    return kNeedMoreData;
   }
-  ptr_cluster_ = NULL;
-  cluster_parse_offset_ = 0;
+
+  const int64 cluster_size = cluster_size_;
+  cluster_scan_pos_ = 0;
+  cluster_size_ = -1;
   total_bytes_parsed_ += cluster_size;
   *ptr_element_size = static_cast<int32>(cluster_size);
   VLOG(4) << "cluster_size=" << cluster_size << " total_bytes_parsed_="
@@ -261,4 +309,41 @@ int WebmBufferParser::ParseCluster(int32* ptr_element_size) {
   return kSuccess;
 }
 
+int WebmBufferParser::ReadElementHeader(int64 pos, uint32* ptr_id,
+                                        int64* ptr_size,
+                                        int32* ptr_header_length) const {
+  const Buffer& buf = *ptr_buf_;
+  const int64 buffer_length = static_cast<int64>(buf.size());
+  if (pos >= buffer_length) {
+    return kNeedMoreData;
+  }
+  // Tell malformed headers from ones not fully buffered before decoding
+  // them. IDs are at most 4 bytes.
+  const int32 id_length = VintLength(buf[pos]);
+  if (id_length == 0 || id_length > 4) {
+    LOG(ERROR) << "invalid EBML ID at " << pos;
+    return kParseError;
+  }
+  const int64 size_pos = pos + id_length;
+  if (size_pos >= buffer_length) {
+    return kNeedMoreData;
+  }
+  const int32 size_length = VintLength(buf[size_pos]);
+  if (size_length == 0) {
+    LOG(ERROR) << "invalid EBML size at " << size_pos;
+    return kParseError;
+  }
+  if (size_pos + size_length > buffer_length) {
+    return kNeedMoreData;
+  }
+  const uint8* const ptr_end = &buf[0] + buffer_length;
+  int64 id = 0;
+  int32 length = 0;
+  ReadVint(&buf[pos], ptr_end, true, &id, &length);
+  ReadVint(&buf[size_pos], ptr_end, false, ptr_size, &length);
+  *ptr_id = static_cast<uint32>(id);
+  *ptr_header_length = id_length + size_length;
+  return kSuccess;
+}
+
 }  // namespace webmlive
@@ -17,7 +17,6 @@
 
 namespace mkvparser {
 
-class Cluster;
 class Segment;
 
 }  // namespace mkvparser
@@ -48,6 +47,8 @@ class WebmBufferParser {
   // |ParseCluster|, depending on the |mode_| value.
   // Returns |kNeedMoreData| when more data is needed. Returns |kSuccess| and
   // sets |ptr_element_size| when all data has been parsed.
+  // Note: |buf| must start at the first byte not yet returned as an element,
+  // and may only grow at its end between calls that return |kNeedMoreData|.
   int Parse(const Buffer& buf, int32* ptr_element_size);
 
  private:
@@ -57,22 +58,33 @@ class WebmBufferParser {
   // Returns |kNeedMoreData| if more data is needed.  Returns |kSuccess| and
   // sets |ptr_element_size| when successful.
   int ParseSegmentHeaders(int32* ptr_element_size);
-  // Tries to parse a cluster.  Returns |kNeedMoreData| when more data is
-  // needed. Returns |kSuccess| and sets |ptr_element_size| when all cluster
-  // data has been parsed.
+  // Tries to find the end of a cluster. Returns |kNeedMoreData| when more data
+  // is needed. Returns |kSuccess| and sets |ptr_element_size| when the whole
+  // cluster is buffered.
+  //
+  // Clusters are delimited using EBML IDs and sizes only; blocks are not
+  // parsed. Clusters of unknown size end where the next top level element
+  // begins. The scan resumes at |cluster_scan_pos_| on each call, so each
+  // buffered byte is examined once.
   int ParseCluster(int32* ptr_element_size);
-  // Pointer to current cluster when |ParseCluster| only partially parses
-  // cluster data.  NULL otherwise. Note that |ptr_cluster_| is memory owned by
-  // libwebm's mkvparser.
-  const mkvparser::Cluster* ptr_cluster_;
-  // Pointer to libwebm segment; needed for cluster parsing operations.
+  // Reads the EBML ID and size at |pos| in the current buffer. Returns
+  // |kNeedMoreData| when the element header is not fully buffered. Sets
+  // |ptr_size| to -1 when the element size is unknown.
+  int ReadElementHeader(int64 pos, uint32* ptr_id, int64* ptr_size,
+                        int32* ptr_header_length) const;
+  // Buffer passed to |Parse()|. Valid only while |Parse()| runs.
+  const Buffer* ptr_buf_;
+  // Offset in the buffer of the next cluster child element to examine, or 0
+  // when no cluster header has been read.
+  int64 cluster_scan_pos_;
+  // Length of the cluster being scanned, or -1 when it is unknown.
+  int64 cluster_size_;
+  // Pointer to libwebm segment; needed for segment header parsing.
   std::unique_ptr<mkvparser::Segment> segment_;
   // Buffer object that implements the IMkvReader interface required by
   // libwebm's mkvparser using a window into the |buf| argument passed to
   // |Parse|.
   std::unique_ptr<WebmBufferReader> reader_;
-  // Bytes read in partially parsed cluster.
-  int64 cluster_parse_offset_;
   // Sum of parsed element lengths.  Used to update |parser_| window.
   int64 total_bytes_parsed_;
   // Parsing function-- either |ParseSegmentHeaders| or |ParseCluster|.
@@ -14,11 +14,37 @@
 #include <cstdlib>
 #include <sstream>
 
+#include "encoder/aes_ctr.h"
+#include "encoder/audio_drift_compensator.h"
+#include "encoder/audio_encode_worker.h"
+#include "encoder/audio_fan_out.h"
 #include "encoder/buffer_pool-inl.h"
+#include "encoder/capture_trace.h"
+#include "encoder/cpu_accounting.h"
 #include "encoder/dash_writer.h"
+#include "encoder/encoded_frame_sink.h"
+#include "encoder/file_media_source.h"
+#include "encoder/latency_tracer.h"
+#include "encoder/lock_profiler.h"
+#include "encoder/media_source.h"
+#include "encoder/memory_governor.h"
+#include "encoder/metrics.h"
+#include "encoder/opus_encoder.h"
+#include "encoder/rate_control_telemetry.h"
+#include "encoder/shared_memory_source.h"
+#include "encoder/synthetic_media_source.h"
+#include "encoder/task_scheduler.h"
+#include "encoder/thread_placement.h"
+#include "encoder/time_util.h"
+#include "encoder/trace_log.h"
+#include "encoder/tracepoints.h"
+#include "encoder/video_encode_worker.h"
+#include "encoder/webm_archive_writer.h"
 #include "encoder/webm_mux.h"
-#ifdef _WIN32
+#if defined _WIN32
 #include "encoder/win/media_source_dshow.h"
+#elif defined __linux__
+#include "encoder/linux/media_source_linux.h"
 #endif
 #include "glog/logging.h"
 
@@ -27,6 +53,18 @@ namespace {
 const char kMuxedId[] = "muxed";
 const char kAudioId[] = "audio";
 const char kVideoId[] = "video";
+const char kClusterIndexId[] = "index";
+const char kClusterIndexSuffix[] = ".idx";
+const char kManifestId[] = "webmlive.mpd";
+
+// Scene cuts less than this fraction of the keyframe interval after the last
+// keyframe do not get a keyframe.
+const int kMinSceneCutSpacingDivisor = 4;
+
+// Longest backlog, in seconds, that |video_pool_| and |audio_pool_| may grow
+// to hold whatever the memory budget.
+const int kMaxVideoPoolSeconds = 2;
+const int kMaxAudioPoolSeconds = 5;
 
 // Adds |timestamp_offset| to the timestamp value of |ptr_sample|, and returns
 // |WebmEncoder::kSuccess|. Returns |WebmEncoder::kInvalidArg| when |ptr_sample|
@@ -43,7 +81,12 @@ int OffsetTimestamp(int64 timestamp_offset, T* ptr_sample) {
   return WebmEncoder::kSuccess;
 }
 
-int InitMuxer(int chunk_duration, const std::string& muxer_id,
+// Creates |muxer| with the given durations and budget, and the metrics
+// labels, streaming, cluster index, native clusters, encryption and standby
+// chunk alignment settings of |config|.
+int InitMuxer(const webmlive::WebmEncoderConfig& config,
+              int cluster_duration, int chunk_duration,
+              int64 chunk_byte_budget, const std::string& muxer_id,
               std::unique_ptr<webmlive::LiveWebmMuxer>* muxer) {
   CHECK_NOTNULL(muxer);
   (*muxer).reset(new (std::nothrow) webmlive::LiveWebmMuxer());  // NOLINT
@@ -51,51 +94,258 @@ int InitMuxer(int chunk_duration, const std::string& muxer_id,
     LOG(ERROR) << "cannot construct live muxer!";
     return webmlive::WebmEncoder::kInitFailed;
   }
-  const int status = (*muxer)->Init(chunk_duration, muxer_id);
+  int status =
+      (*muxer)->Init(cluster_duration, muxer_id, config.metrics_labels);
   if (status) {
     LOG(ERROR) << "live muxer Init failed " << status;
     return webmlive::WebmEncoder::kInitFailed;
   }
+  status = (*muxer)->SetChunkDuration(chunk_duration);
+  if (status) {
+    LOG(ERROR) << "live muxer SetChunkDuration failed " << status;
+    return webmlive::WebmEncoder::kInitFailed;
+  }
+  status = (*muxer)->SetChunkByteBudget(chunk_byte_budget);
+  if (status) {
+    LOG(ERROR) << "live muxer SetChunkByteBudget failed " << status;
+    return webmlive::WebmEncoder::kInitFailed;
+  }
+  if (!config.standby_heartbeat.empty()) {
+    status =
+        (*muxer)->SetChunkAlignment(config.vpx_config.keyframe_interval);
+    if (status) {
+      LOG(ERROR) << "live muxer SetChunkAlignment failed " << status;
+      return webmlive::WebmEncoder::kInitFailed;
+    }
+  }
+  if (config.low_latency_upload) {
+    status = (*muxer)->EnableStreaming();
+    if (status) {
+      LOG(ERROR) << "live muxer EnableStreaming failed " << status;
+      return webmlive::WebmEncoder::kInitFailed;
+    }
+  }
+  if (config.cluster_index) {
+    status = (*muxer)->EnableClusterIndex();
+    if (status) {
+      LOG(ERROR) << "live muxer EnableClusterIndex failed " << status;
+      return webmlive::WebmEncoder::kInitFailed;
+    }
+  }
+  if (config.native_clusters) {
+    status = (*muxer)->EnableNativeClusters();
+    if (status) {
+      LOG(ERROR) << "live muxer EnableNativeClusters failed " << status;
+      return webmlive::WebmEncoder::kInitFailed;
+    }
+  }
+  if (!config.encryption_key.empty()) {
+    status = (*muxer)->EnableEncryption(config.encryption_key_id,
+                                        config.encryption_key);
+    if (status) {
+      LOG(ERROR) << "live muxer EnableEncryption failed " << status;
+      return webmlive::WebmEncoder::kInitFailed;
+    }
+  }
   return status;
 }
 
-bool WriteManifest(const std::string& name, const std::string& manifest) {
-  FILE* manifest_file = fopen(name.c_str(), "w");
-  if (!manifest_file) {
-    LOG(ERROR) << "Unable to open manifest file.";
-    return false;
+// Returns the muxer id used for the video representation at |rep_index|.
+std::string RepresentationMuxerId(size_t rep_index) {
+  std::ostringstream muxer_id;
+  muxer_id << kVideoId;
+  if (rep_index > 0) {
+    muxer_id << "_" << rep_index;
   }
-  const int bytes_written =
-    fprintf(manifest_file, "%s", manifest.c_str());
-  fclose(manifest_file);
-  return (bytes_written == manifest.length());
+  return muxer_id.str();
 }
 
-bool WriteChunkFile(const std::string& chunk_name,
-                    const uint8* chunk_buffer, int32 chunk_length) {
-  FILE* chunk_file = fopen(chunk_name.c_str(), "wb");
-  if (!chunk_file) {
-    LOG(ERROR) << "Unable to open chunk file.";
+// Returns the muxer id used for the extra audio track at |track_index|,
+// counted from 1.
+std::string ExtraAudioMuxerId(int track_index) {
+  std::ostringstream muxer_id;
+  muxer_id << kAudioId << "_" << track_index;
+  return muxer_id.str();
+}
+
+// Returns the muxer id used for the main track's audio representation at
+// |rep_index|, counted from 1.
+std::string AudioRepresentationMuxerId(int rep_index) {
+  std::ostringstream muxer_id;
+  muxer_id << kAudioId << "_rep" << rep_index;
+  return muxer_id.str();
+}
+
+// Returns true for the video codecs the encoders produce.
+bool ValidVideoCodec(webmlive::VideoFormat codec) {
+  return codec == webmlive::kVideoFormatVP8 ||
+         codec == webmlive::kVideoFormatVP9 ||
+         codec == webmlive::kVideoFormatAV1;
+}
+
+// Returns true when |reps| can be the spatial layers of a
+// |WebmEncoderConfig::video_svc| encode with |vpx_config|: 2 or 3 VP9
+// representations with sizes and bitrates, smallest first, for a libvpx CBR
+// encode without temporal layers or lookahead. |VpxEncoder| checks that the
+// sizes scale from the largest.
+bool ValidSvcRepresentations(
+    const std::vector<webmlive::VideoRepresentationConfig>& reps,
+    const webmlive::VpxConfig& vpx_config) {
+  if (reps.size() < 2 || reps.size() > 3 ||
+      vpx_config.backend != webmlive::kVideoEncoderBackendLibvpx ||
+      vpx_config.temporal_layers > 1 || vpx_config.lag_in_frames > 0 ||
+      vpx_config.profile == webmlive::kVideoEncodeProfileBroadcast ||
+      vpx_config.profile == webmlive::kVideoEncodeProfileCappedQuality) {
     return false;
   }
-  const size_t bytes_written =
-      fwrite(reinterpret_cast<const void*>(chunk_buffer),
-             1, chunk_length, chunk_file);
-  fclose(chunk_file);
-  return (bytes_written == chunk_length);
+  for (size_t i = 0; i < reps.size(); ++i) {
+    if (webmlive::RepresentationCodec(reps[i], vpx_config) !=
+            webmlive::kVideoFormatVP9 ||
+        reps[i].width <= 0 || reps[i].height <= 0 || reps[i].bitrate <= 0 ||
+        (i > 0 && (reps[i].height <= reps[i - 1].height ||
+                   reps[i].bitrate <= reps[i - 1].bitrate))) {
+      return false;
+    }
+  }
+  return true;
 }
 
 }  // anonymous namespace
 
 namespace webmlive {
 
+VideoFormat RepresentationCodec(const VideoRepresentationConfig& representation,
+                                const VpxConfig& vpx_config) {
+  return representation.codec == kVideoFormatI420 ? vpx_config.codec :
+                                                    representation.codec;
+}
+
+// One of |WebmEncoderConfig::extra_audio_tracks|. The media source delivers
+// its samples to |OnSamplesReceived()|, which commits them to |pool| and
+// wakes the encode loop. The encode loop passes them through
+// |drift_compensator| to |worker|, and muxes its output with |muxer|.
+struct WebmEncoder::ExtraAudioTrack : public AudioSamplesCallbackInterface {
+  ExtraAudioTrack(WebmEncoder* ptr_encoder, int track_index)
+      : encoder(ptr_encoder), index(track_index) {}
+  virtual ~ExtraAudioTrack() {}
+
+  virtual int OnSamplesReceived(AudioBuffer* ptr_buffer);
+
+  WebmEncoder* const encoder;
+
+  // Index of the track in the manifest; the first extra track is 1.
+  const int index;
+
+  // |WebmEncoder::config_| with the track's input as its
+  // |actual_audio_config|, for |worker|.
+  WebmEncoderConfig config;
+
+  BufferPool<AudioBuffer> pool;
+  BufferPool<AudioBuffer>::Batch batch;
+  AudioBuffer compressed_buffer;
+  std::unique_ptr<AudioEncodeWorker> worker;
+  std::unique_ptr<AudioDriftCompensator> drift_compensator;
+  std::unique_ptr<LiveWebmMuxer> muxer;
+};
+
+int WebmEncoder::ExtraAudioTrack::OnSamplesReceived(AudioBuffer* ptr_buffer) {
+  const int status = pool.Commit(ptr_buffer);
+  if (status == BufferPool<AudioBuffer>::kFull) {
+    VLOG(1) << "AudioBuffer pool (A" << index << ") dropped buffer.";
+    return kDropped;
+  } else if (status) {
+    LOG(ERROR) << "AudioBuffer pool (A" << index << ") Commit failed! "
+               << status;
+    return kNoMemory;
+  }
+  encoder->SignalInput();
+  return kSuccess;
+}
+
+// One of |WebmEncoderConfig::audio_representations|. |audio_fan_out_| passes
+// |worker| the main track's samples, and the encode loop muxes its output
+// with |muxer|.
+struct WebmEncoder::ExtraAudioRepresentation {
+  explicit ExtraAudioRepresentation(int rep_index) : index(rep_index) {}
+
+  // Index of the representation in the manifest; the first extra one is 1.
+  const int index;
+
+  // |WebmEncoder::config_| with the representation's codec and bitrate, for
+  // |worker|.
+  WebmEncoderConfig config;
+
+  AudioBuffer compressed_buffer;
+  std::unique_ptr<AudioEncodeWorker> worker;
+  std::unique_ptr<LiveWebmMuxer> muxer;
+};
+
 WebmEncoder::WebmEncoder()
     : initialized_(false),
       stop_(false),
-      chunk_buffer_size_(0),
+      finished_(false),
+      source_running_(false),
+      reconfigure_pending_(false),
+      pending_codec_(kVideoFormatVP8),
+      encode_task_posted_(false),
+      encode_tick_posted_(false),
+      encode_stage_(kEncodeStarting),
+      input_signaled_(false),
+      video_passthrough_(false),
+      pack_video_frames_(false),
       encoded_duration_(0),
-      ptr_encode_func_(NULL),
-      timestamp_offset_(0) {
+      audio_captured_time_(0),
+      audio_muxed_time_(-1),
+      ptr_overload_level_(NULL),
+      ptr_audio_mux_lag_ms_(NULL),
+      speed_boost_(0),
+      capture_frames_dropped_(0),
+      video_queue_drops_(0),
+      ptr_video_queue_drops_(NULL),
+      keyframe_requested_(false),
+      ptr_video_pool_frames_(NULL),
+      ptr_audio_pool_buffers_(NULL),
+      ptr_capture_frames_dropped_(NULL),
+      ptr_capture_frames_missed_(NULL),
+      ptr_audio_drift_ppm_(NULL),
+      ptr_audio_sync_error_us_(NULL),
+      ptr_capture_memory_(NULL),
+      ptr_muxer_memory_(NULL),
+      video_frame_bytes_(0),
+      audio_buffer_bytes_(0),
+      trace_stream_id_(0),
+      capture_restart_requested_(false),
+      capture_restartable_(true),
+      capture_restart_ms_(-1),
+      ptr_capture_restarts_(NULL),
+      ptr_capture_restart_failures_(NULL),
+      stop_deadline_ms_(0),
+      stop_abandoned_writes_(0),
+      ptr_stop_abandoned_writes_(NULL),
+      capture_resync_pending_(false),
+      capture_offset_us_(0),
+      capture_end_us_(0),
+      capture_end_wall_ms_(0),
+      video_end_us_(0),
+      video_wall_ms_(0),
+      slate_active_(false),
+      slate_start_us_(0),
+      slate_start_ms_(0),
+      slate_frames_(0),
+      slate_next_us_(0),
+      slate_source_failed_(false),
+      ptr_slate_frames_(NULL),
+      encode_pass_time_ms_(0),
+      timestamp_offset_(0),
+      traced_upload_time_(-1),
+      manifest_pending_(false),
+      manifest_time_ms_(0),
+      standby_(false),
+      max_held_chunks_(0),
+      early_headers_sent_(false) {
+  for (int i = 0; i < kNumStallStages; ++i) {
+    ptr_stalls_[i] = NULL;
+  }
 }
 
 WebmEncoder::~WebmEncoder() {
@@ -115,66 +365,276 @@ int WebmEncoder::Init(const WebmEncoderConfig& config,
 
   config_ = config;
   ptr_data_sink_ = ptr_data_sink;
+  LatencyTracer::Enable(config_.latency_trace);
 
-  // Allocate the chunk buffer.
-  chunk_buffer_.reset(
-      new (std::nothrow) uint8[kDefaultChunkBufferSize]);  // NOLINT
-  if (!chunk_buffer_) {
-    LOG(ERROR) << "Unable to allocate chunk buffer!";
-    return kNoMemory;
+  int status = InitMetrics();
+  if (status) {
+    LOG(ERROR) << "InitMetrics failed " << status;
+    return status;
+  }
+  if (config_.capture_stall_timeout_ms > 0) {
+    using std::placeholders::_1;
+    using std::placeholders::_2;
+    status = stall_watchdog_.Init(
+        kNumStallStages, config_.capture_stall_timeout_ms,
+        std::bind(&WebmEncoder::OnStall, this, _1, _2));
+    if (status) {
+      LOG(ERROR) << "stall watchdog Init failed " << status;
+      return kInvalidArg;
+    }
+  }
+
+  // TODO(tomfinegan): Obey the command line instead of hard coding DASH output.
+  config_.dash_encode = true;
+
+  // Single bitrate encodes are a ladder with one representation: video is
+  // always compressed by |rep_workers_|.
+  if (config_.video_representations.empty()) {
+    VideoRepresentationConfig representation;
+    representation.width = std::max(config_.output_video_width, 0);
+    representation.height = std::max(config_.output_video_height, 0);
+    config_.video_representations.push_back(representation);
+  }
+
+  // Multiple video representations are only possible with DASH output.
+  if (!config_.dash_encode && config_.video_representations.size() > 1) {
+    LOG(WARNING) << "extra video representations ignored; DASH output "
+                 << "disabled.";
+    config_.video_representations.resize(1);
+  }
+  if (config_.video_svc && !config_.disable_video &&
+      !ValidSvcRepresentations(config_.video_representations,
+                               config_.vpx_config)) {
+    LOG(ERROR) << "spatial SVC requires 2 or 3 VP9 representations, smallest "
+               << "first, with sizes and increasing bitrates, and a libvpx CBR "
+               << "encode without temporal layers or lookahead.";
+    return kInvalidArg;
+  }
+
+  // Mixed audio is planar float, which Opus encoders do not take.
+  if (!config_.disable_audio && !config_.audio_mix.inputs.empty()) {
+    bool opus = config_.audio_codec == kAudioFormatOpus;
+    for (size_t i = 0; i < config_.audio_representations.size(); ++i) {
+      if (config_.audio_representations[i].codec == kAudioFormatOpus)
+        opus = true;
+    }
+    if (opus) {
+      LOG(ERROR) << "audio mixing requires Vorbis encoding.";
+      return kInvalidArg;
+    }
+  }
+
+  // Byte budget splits give chunks their own timing, which only the
+  // SegmentTimeline describes, and Representations split apart.
+  if (config_.chunk_byte_budget < 0) {
+    LOG(ERROR) << "invalid chunk byte budget: " << config_.chunk_byte_budget;
+    return kInvalidArg;
+  }
+  if (config_.chunk_byte_budget > 0 && config_.dash_encode) {
+    if (!config_.dash_dynamic && !config_.dash_vod_manifest) {
+      LOG(ERROR) << "chunk byte budget requires a dynamic or VOD manifest.";
+      return kInvalidArg;
+    }
+    if (config_.video_representations.size() > 1) {
+      LOG(ERROR) << "chunk byte budget requires one video representation.";
+      return kInvalidArg;
+    }
+  }
+
+  // Encryption keys are AES-128 keys, and players find them by key id.
+  if (!config_.encryption_key.empty() &&
+      (config_.encryption_key.size() != AesCtr::kKeySize ||
+       config_.encryption_key_id.empty())) {
+    LOG(ERROR) << "encryption requires a " << AesCtr::kKeySize
+               << " byte key and a key id.";
+    return kInvalidArg;
+  }
+
+  // Encoders sharing a heartbeat must cut the same segments from the same
+  // input: only keyframes on the grid, only whole chunks, and one manifest
+  // per encoder that the other can replace.
+  if (config_.standby && config_.standby_heartbeat.empty()) {
+    LOG(ERROR) << "standby requires a heartbeat region.";
+    return kInvalidArg;
+  }
+  if (!config_.standby_heartbeat.empty()) {
+    if (config_.standby && config_.input_shared_memory.empty()) {
+      LOG(ERROR) << "standby requires shared memory input.";
+      return kInvalidArg;
+    }
+    if (config_.disable_video || config_.vpx_config.keyframe_interval <= 0 ||
+        config_.standby_timeout_ms <= 0) {
+      LOG(ERROR) << "standby heartbeat requires video, a keyframe interval "
+                 << "and a timeout.";
+      return kInvalidArg;
+    }
+    if (!config_.dash_dynamic || config_.low_latency_upload ||
+        config_.chunk_byte_budget > 0 || config_.publish_headers_early ||
+        !config_.extra_audio_tracks.empty() ||
+        !config_.audio_representations.empty()) {
+      LOG(ERROR) << "standby heartbeat requires a dynamic manifest, and no "
+                 << "low latency upload, chunk byte budget, early headers, "
+                 << "extra audio tracks or audio representations.";
+      return kInvalidArg;
+    }
+  }
+
+  // The slate is keyed by |gop_scheduler_|, which keys only the grid for
+  // encoders sharing a heartbeat.
+  if (!config_.slate_file.empty() &&
+      (config_.disable_video || config_.slate_delay_ms <= 0 ||
+       !config_.standby_heartbeat.empty())) {
+    LOG(ERROR) << "slate requires video, a delay and no standby heartbeat.";
+    return kInvalidArg;
   }
-  chunk_buffer_size_ = kDefaultChunkBufferSize;
 
   // Construct and initialize the media source(s).
-  ptr_media_source_.reset(new (std::nothrow) MediaSourceImpl());  // NOLINT
+  if (!config_.input_video_file.empty() || !config_.input_audio_file.empty()) {
+    config_.disable_video = config_.input_video_file.empty();
+    config_.disable_audio = config_.input_audio_file.empty();
+    ptr_media_source_.reset(new (std::nothrow) FileMediaSource());  // NOLINT
+  } else if (!config_.input_shared_memory.empty()) {
+    ptr_media_source_.reset(
+        new (std::nothrow) SharedMemorySource());  // NOLINT
+  } else if (!config_.input_capture_trace.empty()) {
+    ptr_media_source_.reset(
+        new (std::nothrow) CaptureTraceSource());  // NOLINT
+  } else if (config_.input_synthetic) {
+    ptr_media_source_.reset(
+        new (std::nothrow) SyntheticMediaSource());  // NOLINT
+  } else {
+#if defined _WIN32 || defined __linux__
+    ptr_media_source_.reset(new (std::nothrow) MediaSourceImpl());  // NOLINT
+#else
+    LOG(ERROR) << "no capture implementation; use file input.";
+    return kNotImplemented;
+#endif
+  }
+  if (ptr_media_source_ && !config_.capture_trace_file.empty()) {
+    ptr_media_source_.reset(new (std::nothrow) CaptureTraceRecorder(  // NOLINT
+        std::move(ptr_media_source_)));
+  }
   if (!ptr_media_source_) {
     LOG(ERROR) << "cannot construct media source!";
     return kInitFailed;
   }
-  int status = ptr_media_source_->Init(config_, this, this);
+  if (config_.video_passthrough) {
+    config_.requested_video_config.format = config_.vpx_config.codec;
+  }
+  status = ptr_media_source_->Init(config_, this, this);
   if (status) {
     LOG(ERROR) << "media source Init failed " << status;
     return kInitFailed;
   }
 
-  // TODO(tomfinegan): Obey the command line instead of hard coding DASH output.
-  config_.dash_encode = true;
-
-  // When doing a DASH encode two muxers are used: One for each stream.
-  // Otherwise there's only one. Configure the muxers via local pointers-- the
-  // muxer actually being configured isn't really a concern of the code below as
-  // long as the configuration attempt succeeds.
+  // The media source applies |decimate| by timestamp at capture, and reports
+  // the reduced rate in its actual video config; the encoders must not
+  // decimate again.
+  config_.vpx_config.decimate = VpxConfig::kUseDefault;
+
+  // When doing a DASH encode each stream has its own muxer; the video muxers
+  // are created by |InitVideoRepresentations()|. Otherwise there's only one,
+  // |ptr_muxer_|, which DASH encodes also create for |dash_muxed_output|.
+  // Configure the audio muxer via a local pointer-- the muxer actually being
+  // configured isn't really a concern of the code below as long as the
+  // configuration attempt succeeds.
   LiveWebmMuxer* audio_muxer = NULL;
-  LiveWebmMuxer* video_muxer = NULL;
+
+  // Chunks span a keyframe interval when clusters are shorter than one.
+  const int chunk_duration = config_.cluster_duration > 0 ?
+      config_.vpx_config.keyframe_interval : 0;
 
   // Construct and initialize the muxer(s).
   if (config_.dash_encode) {
-    status = InitMuxer(config_.vpx_config.keyframe_interval, kAudioId,
-                       &ptr_muxer_aud_);
+    // Audio has no keyframes to end its clusters, so without a cluster
+    // duration each audio cluster lasts a keyframe interval.
+    const int audio_cluster_duration = config_.cluster_duration > 0 ?
+        config_.cluster_duration : config_.vpx_config.keyframe_interval;
+    status = InitMuxer(config_, audio_cluster_duration, chunk_duration, 0,
+                       kAudioId, &ptr_muxer_aud_);
     if (status) {
       LOG(ERROR) << "InitMuxer (A) failed: " << status;
       return status;
     }
-    status = InitMuxer(0, kVideoId, &ptr_muxer_vid_);
-    if (status) {
-      LOG(ERROR) << "InitMuxer (V) failed: " << status;
-      return status;
-    }
     audio_muxer = ptr_muxer_aud_.get();
-    video_muxer = ptr_muxer_vid_.get();
-  } else {
-    status = InitMuxer(0, kMuxedId, &ptr_muxer_);
+  }
+  if (!config_.dash_encode || config_.dash_muxed_output) {
+    status = InitMuxer(config_, config_.cluster_duration, chunk_duration,
+                       config_.chunk_byte_budget, kMuxedId, &ptr_muxer_);
     if (status) {
       LOG(ERROR) << "InitMuxer failed: " << status;
       return status;
     }
-    audio_muxer = ptr_muxer_.get();
-    video_muxer = ptr_muxer_.get();
+    if (!audio_muxer)
+      audio_muxer = ptr_muxer_.get();
+
+    status = mux_queue_.Init(!config_.disable_audio, !config_.disable_video,
+                             MuxReorderQueue::kDefaultMaxQueuedPackets);
+    if (status) {
+      LOG(ERROR) << "MuxReorderQueue Init failed: " << status;
+      return kInitFailed;
+    }
   }
 
   if (config_.disable_video == false) {
     config_.actual_video_config = ptr_media_source_->actual_video_config();
 
+    // Sources report the capture format; the encoders receive frames after
+    // |VideoFrame::Init()| converts them.
+    config_.actual_video_config.format = VideoFrame::ConvertedFormat(
+        config_.actual_video_config.format);
+
+    // Compressed frames are muxed as they are, so there is nothing to make
+    // other representations from.
+    const VideoFormat video_format = config_.actual_video_config.format;
+    video_passthrough_ =
+        video_format == kVideoFormatVP8 || video_format == kVideoFormatVP9;
+    if (video_passthrough_ && !config_.standby_heartbeat.empty()) {
+      LOG(ERROR) << "standby heartbeat requires encoded video.";
+      return kInvalidArg;
+    }
+    if (video_passthrough_) {
+      LOG(INFO) << "muxing compressed video from the media source.";
+      config_.vpx_config.codec = video_format;
+      if (config_.video_representations.size() > 1) {
+        LOG(WARNING) << "extra video representations ignored; video is "
+                     << "passed through.";
+        config_.video_representations.resize(1);
+      }
+      config_.video_representations[0].codec = kVideoFormatI420;
+      config_.video_svc = false;
+    }
+
+    // Unpaced file and synthetic input have no capture timing to smooth.
+    if (config_.video_timestamp_smoothing && !UnpacedInput()) {
+      timestamp_smoother_.Init(config_.actual_video_config.frame_rate);
+    }
+
+    if (!video_passthrough_) {
+      if (deinterlacer_.Init(config_.deinterlace,
+                             config_.actual_video_config.frame_rate)) {
+        LOG(ERROR) << "Deinterlacer Init failed.";
+        return kInvalidArg;
+      }
+
+      // Every later stage sees the field rate; |timestamp_smoother_| runs
+      // ahead of |deinterlacer_|, at the capture rate.
+      if (deinterlacer_.field_rate()) {
+        config_.actual_video_config.frame_rate *= 2;
+      }
+    }
+
+    if (!video_passthrough_ && frame_overlay_.Init(
+            config_.overlay, config_.actual_video_config.frame_rate)) {
+      LOG(ERROR) << "FrameOverlay Init failed.";
+      return kInvalidArg;
+    }
+    const VpxConfig& vpx_config = config_.vpx_config;
+    pack_video_frames_ = deinterlacer_.enabled() ||
+        frame_overlay_.enabled() || config_.thumbnails.frame_interval > 0 ||
+        vpx_config.frame_analysis || vpx_config.scene_cut_keyframes ||
+        vpx_config.skip_static_frames;
+
     // Initialize the video frame pool.
     const int default_count = BufferPool<VideoFrame>::kDefaultBufferCount;
     const double& fps = config_.actual_video_config.frame_rate;
@@ -185,30 +645,57 @@ int WebmEncoder::Init(const WebmEncoderConfig& config,
     //                   problem.
     const int num_video_buffers =
         config_.disable_audio ? default_count : static_cast<int>(fps / 2.0);
-    if (video_pool_.Init(false, num_video_buffers)) {
-      LOG(ERROR) << "BufferPool<VideoFrame> Init failed!";
-      return kInitFailed;
-    }
 
-    // Initialize the video encoder.
-    status = video_encoder_.Init(config_);
-    if (status) {
-      LOG(ERROR) << "video encoder Init failed " << status;
-      return kInitFailed;
+    // The pool grows from |num_video_buffers| when the encoder thread falls
+    // behind, up to what |config_.pool_memory_budget_mb| holds. Unpaced file
+    // and synthetic input wait for room in the pool instead, so it keeps a
+    // fixed size.
+    int max_video_buffers = num_video_buffers;
+    const bool adaptive_pools = !UnpacedInput();
+    if (adaptive_pools && fps > 0) {
+      const int64 budget_bytes =
+          static_cast<int64>(config_.pool_memory_budget_mb) * 1024 * 1024;
+      const int32 bytes_per_sample =
+          config_.actual_video_config.format == kVideoFormatI42016 ? 2 : 1;
+      const int64 frame_size = VideoFrame::PlanarFrameSize(
+          config_.actual_video_config.width * bytes_per_sample,
+          abs(config_.actual_video_config.height));
+      const int64 budget_buffers =
+          frame_size > 0 ? budget_bytes / frame_size : 0;
+      const int64 time_buffers = static_cast<int64>(fps * kMaxVideoPoolSeconds);
+      max_video_buffers = std::max(
+          num_video_buffers,
+          static_cast<int>(std::min(budget_buffers, time_buffers)));
+      video_pool_sizing_.enabled =
+          video_pool_sizing_.sizer.Init(
+              std::min(num_video_buffers, default_count), num_video_buffers,
+              max_video_buffers, fps) == PoolSizer::kSuccess;
     }
 
-    // Add the video track.
-    VideoConfig vpx_video_config = config_.actual_video_config;
-    vpx_video_config.format = config_.vpx_config.codec;
-    status = video_muxer->AddTrack(vpx_video_config);
-    if (status) {
-      LOG(ERROR) << "live muxer AddTrack(video) failed " << status;
+    // Frames are committed only by the capture source streaming thread and
+    // decommitted only by |EncoderThread()|, so use the lock free pool to keep
+    // the streaming thread from blocking behind the encoder.
+    if (video_pool_.InitLockFree(num_video_buffers, max_video_buffers)) {
+      LOG(ERROR) << "BufferPool<VideoFrame> Init failed!";
       return kInitFailed;
     }
+    video_pool_.SetPolicy(config_.video_queue_policy,
+                          config_.video_queue_max_age_ms);
   }
 
   if (config_.disable_audio == false) {
     config_.actual_audio_config = ptr_media_source_->actual_audio_config();
+    AudioConfig& audio_config = config_.actual_audio_config;
+    if (config_.audio_encode_sample_rate > 0 &&
+        static_cast<uint32>(config_.audio_encode_sample_rate) !=
+            audio_config.sample_rate) {
+      LOG(INFO) << "WebmEncoder resampling audio from "
+                << audio_config.sample_rate << " Hz to "
+                << config_.audio_encode_sample_rate << " Hz.";
+      audio_config.sample_rate = config_.audio_encode_sample_rate;
+      audio_config.bytes_per_second =
+          audio_config.block_align * audio_config.sample_rate;
+    }
 
     // Initialize the audio buffer pool.
     const int num_audio_buffers = BufferPool<AudioBuffer>::kDefaultBufferCount;
@@ -217,679 +704,2937 @@ int WebmEncoder::Init(const WebmEncoderConfig& config,
       return kInitFailed;
     }
 
-    // Initialize the vorbis encoder.
-    status = vorbis_encoder_.Init(config_.actual_audio_config,
-                                  config_.vorbis_config);
-    if (status) {
-      LOG(ERROR) << "audio encoder Init failed " << status;
-      return kInitFailed;
+    if (!config_.extra_audio_tracks.empty()) {
+      status = InitExtraAudioTracks();
+      if (status) {
+        LOG(ERROR) << "InitExtraAudioTracks failed " << status;
+        return status;
+      }
     }
-
-    // Fill in the private data structure.
-    VorbisCodecPrivate codec_private;
-    codec_private.ptr_ident = vorbis_encoder_.ident_header();
-    codec_private.ident_length = vorbis_encoder_.ident_header_length();
-    codec_private.ptr_comments = vorbis_encoder_.comments_header();
-    codec_private.comments_length = vorbis_encoder_.comments_header_length();
-    codec_private.ptr_setup = vorbis_encoder_.setup_header();
-    codec_private.setup_length = vorbis_encoder_.setup_header_length();
-
-    // Add the vorbis track.
-    status = audio_muxer->AddTrack(config_.actual_audio_config, codec_private);
-    if (status) {
-      LOG(ERROR) << "live muxer AddTrack(audio) failed " << status;
-      return kInitFailed;
+    if (!config_.audio_representations.empty()) {
+      status = InitAudioRepresentations();
+      if (status) {
+        LOG(ERROR) << "InitAudioRepresentations failed " << status;
+        return status;
+      }
+    }
+  } else {
+    if (!config_.extra_audio_tracks.empty()) {
+      LOG(WARNING) << "extra audio tracks ignored; audio disabled.";
+      config_.extra_audio_tracks.clear();
+    }
+    if (!config_.audio_representations.empty()) {
+      LOG(WARNING) << "audio representations ignored; audio disabled.";
+      config_.audio_representations.clear();
     }
   }
 
-  if (config_.dash_encode) {
-    ptr_encode_func_ = &WebmEncoder::DashEncode;
-  } else if (config_.disable_audio) {
-    ptr_encode_func_ = &WebmEncoder::EncodeVideoFrame;
-  } else if (config_.disable_video) {
-    ptr_encode_func_ = &WebmEncoder::EncodeAudioOnly;
-  } else {
-    ptr_encode_func_ = &WebmEncoder::AVEncode;
+  // The pools are ready for samples. A fast start runs the media source now,
+  // so that the device start and the wait for its first samples overlap the
+  // encoder, muxer and manifest setup. Samples wait in the pools for |Run()|.
+  int source_run_status = kSuccess;
+  std::thread source_run_thread;
+  if (config_.fast_start) {
+    source_run_thread = std::thread([this, &source_run_status] {
+      source_run_status = ptr_media_source_->Run();
+    });
+  }
+  status = InitEncodePipeline(audio_muxer);
+  if (source_run_thread.joinable()) {
+    source_run_thread.join();
+    if (source_run_status) {
+      LOG(ERROR) << "media source Run failed " << source_run_status;
+      if (!status)
+        status = kInitFailed;
+    } else if (status) {
+      ptr_media_source_->Stop();
+    } else {
+      source_running_ = true;
+    }
+  }
+  if (status) {
+    return status;
+  }
+  status = InitStandby();
+  if (status) {
+    LOG(ERROR) << "InitStandby failed " << status;
+    return status;
   }
 
   initialized_ = true;
   return kSuccess;
 }
 
-int WebmEncoder::Run() {
-  if (!initialized_) {
-    LOG(ERROR) << "Encoder cannot Run, Init required.";
-    return kRunFailed;
+int WebmEncoder::InitEncodePipeline(LiveWebmMuxer* audio_muxer) {
+  int status = InitEncodeWorkers(true);
+  if (status) {
+    LOG(ERROR) << "InitEncodeWorkers failed " << status;
+    return status;
   }
 
-  if (encode_thread_) {
-    LOG(ERROR) << "non-null encode thread. Already running?";
-    return kRunFailed;
+  if (config_.disable_video == false && config_.thumbnails.frame_interval) {
+    status = thumbnail_generator_.Init(config_.thumbnails, config_.dash_name);
+    if (status) {
+      LOG(ERROR) << "thumbnail generator Init failed " << status;
+      return kInitFailed;
+    }
+    status = thumbnail_generator_.Start();
+    if (status) {
+      LOG(ERROR) << "thumbnail generator Start failed " << status;
+      return kInitFailed;
+    }
   }
 
-  using std::bind;
-  using std::shared_ptr;
-  using std::thread;
-  using std::nothrow;
-  encode_thread_ = shared_ptr<thread>(
-      new (nothrow) thread(bind(&WebmEncoder::EncoderThread,  // NOLINT
-                                this)));
+  if (config_.disable_video == false) {
+    status = InitVideoRepresentations();
+    if (status) {
+      LOG(ERROR) << "InitVideoRepresentations failed " << status;
+      return status;
+    }
 
-  return kSuccess;
-}
+    status = InitCongestionController();
+    if (status) {
+      LOG(ERROR) << "InitCongestionController failed " << status;
+      return kInitFailed;
+    }
+    status = InitOverloadGovernor();
+    if (status) {
+      LOG(ERROR) << "InitOverloadGovernor failed " << status;
+      return kInitFailed;
+    }
+    status = InitSlate();
+    if (status) {
+      LOG(ERROR) << "InitSlate failed " << status;
+      return status;
+    }
+  }
 
-// Sets |stop_| to true and calls join on |encode_thread_| to wait for
-// |EncoderThread| to finish.
-void WebmEncoder::Stop() {
-  CHECK(encode_thread_);
-  mutex_.lock();
-  stop_ = true;
-  mutex_.unlock();
-  encode_thread_->join();
-}
+  if (config_.disable_audio == false) {
+    const AudioConfig& audio_config = config_.actual_audio_config;
+    status = AddAudioTrack(*audio_worker_, audio_config, audio_muxer);
+    if (!status && ptr_muxer_ && audio_muxer != ptr_muxer_.get())
+      status = AddAudioTrack(*audio_worker_, audio_config, ptr_muxer_.get());
+    if (status) {
+      LOG(ERROR) << "live muxer AddTrack(audio) failed " << status;
+      return kInitFailed;
+    }
+    for (size_t i = 0; i < extra_audio_tracks_.size(); ++i) {
+      ExtraAudioTrack& track = *extra_audio_tracks_[i];
+      status = AddAudioTrack(*track.worker, track.config.actual_audio_config,
+                             track.muxer.get());
+      if (status) {
+        LOG(ERROR) << "live muxer AddTrack(audio " << track.index
+                   << ") failed " << status;
+        return kInitFailed;
+      }
+    }
+    for (size_t i = 0; i < audio_representations_.size(); ++i) {
+      ExtraAudioRepresentation& rep = *audio_representations_[i];
+      status = AddAudioTrack(*rep.worker, rep.config.actual_audio_config,
+                             rep.muxer.get());
+      if (status) {
+        LOG(ERROR) << "live muxer AddTrack(audio rep " << rep.index
+                   << ") failed " << status;
+        return kInitFailed;
+      }
+    }
+  }
 
-// Returns encoded duration in seconds.
-int64 WebmEncoder::encoded_duration() const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  return encoded_duration_;
-}
+  if (!config_.archive_path.empty()) {
+    status = InitArchive();
+    if (status) {
+      LOG(ERROR) << "InitArchive failed " << status;
+      return status;
+    }
+  }
 
-// AudioSamplesCallbackInterface
-int WebmEncoder::OnSamplesReceived(AudioBuffer* ptr_buffer) {
-  const int status = audio_pool_.Commit(ptr_buffer);
-  if (status) {
-    LOG(ERROR) << "AudioBuffer pool Commit failed! " << status;
-    return AudioSamplesCallbackInterface::kNoMemory;
+  dash_writer_.reset(new (std::nothrow) DashWriter);  // NOLINT
+  if (!dash_writer_) {
+    LOG(ERROR) << "cannot construct dash writer!";
+    return kNoMemory;
+  }
+  if (!dash_writer_->Init(config_)) {
+    LOG(ERROR) << "DashWriter::Init failed.";
   }
-  LOG(INFO) << "OnSamplesReceived committed an audio buffer.";
-  return kSuccess;
-}
 
-// VideoFrameCallbackInterface
-int WebmEncoder::OnVideoFrameReceived(VideoFrame* ptr_frame) {
-  const int status = video_pool_.Commit(ptr_frame);
-  if (status) {
-    if (status != BufferPool<VideoFrame>::kFull) {
-      LOG(ERROR) << "VideoFrame pool Commit failed: " << status;
+  if (config_.publish_headers_early) {
+    status = PreviewHeaders();
+    if (status) {
+      LOG(ERROR) << "PreviewHeaders failed: " << status;
+      return kInitFailed;
     }
-    LOG(INFO) << "VideoFrame pool dropped frame (no buffers).";
-    return VideoFrameCallbackInterface::kDropped;
   }
-  LOG(INFO) << "OnVideoFrameReceived committed a frame.";
+
   return kSuccess;
 }
 
-// Tries to obtain lock on |mutex_| and returns value of |stop_| if lock is
-// obtained. Assumes no stop requested and returns false if unable to obtain
-// the lock.
-bool WebmEncoder::StopRequested() {
-  bool stop_requested = false;
-  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
-  if (lock.owns_lock()) {
-    stop_requested = stop_;
+int WebmEncoder::AddAudioTrack(const AudioEncodeWorker& worker,
+                               const AudioConfig& audio_config,
+                               LiveWebmMuxer* ptr_muxer) {
+  if (worker.codec() == kAudioFormatOpus) {
+    // Fill in the private data structure and add the opus track.
+    const OpusAudioEncoder& opus_encoder = worker.opus_encoder();
+    OpusCodecPrivate codec_private;
+    codec_private.ptr_data = opus_encoder.codec_private();
+    codec_private.length = opus_encoder.codec_private_length();
+    codec_private.codec_delay_ns = opus_encoder.codec_delay_ns();
+    codec_private.seek_preroll_ns = OpusAudioEncoder::kSeekPreRollNs;
+    return ptr_muxer->AddTrack(audio_config, codec_private);
   }
-  return stop_requested;
+
+  // Fill in the private data structure.
+  const VorbisEncoder& vorbis_encoder = worker.vorbis_encoder();
+  VorbisCodecPrivate codec_private;
+  codec_private.ptr_ident = vorbis_encoder.ident_header();
+  codec_private.ident_length = vorbis_encoder.ident_header_length();
+  codec_private.ptr_comments = vorbis_encoder.comments_header();
+  codec_private.comments_length = vorbis_encoder.comments_header_length();
+  codec_private.ptr_setup = vorbis_encoder.setup_header();
+  codec_private.setup_length = vorbis_encoder.setup_header_length();
+
+  // Add the vorbis track.
+  return ptr_muxer->AddTrack(audio_config, codec_private);
 }
 
-bool WebmEncoder::ReadChunkFromMuxer(std::unique_ptr<LiveWebmMuxer>* muxer,
-                                     int32 chunk_length) {
-  // Confirm that there's enough space in the chunk buffer.
-  if (chunk_length > chunk_buffer_size_) {
-    const int32 new_size = chunk_length * 2;
-    chunk_buffer_.reset(new (std::nothrow) uint8[new_size]);  // NOLINT
-    if (!chunk_buffer_) {
-      LOG(ERROR) << "chunk buffer reallocation failed!";
-      return false;
-    }
-    chunk_buffer_size_ = new_size;
+int WebmEncoder::InitExtraAudioTracks() {
+  const std::vector<AudioTrackConfig>& configs = config_.extra_audio_tracks;
+  if (!config_.dash_encode) {
+    LOG(ERROR) << "extra audio tracks require DASH output.";
+    return kInvalidArg;
+  }
+  if (configs.size() >
+      static_cast<size_t>(WebmEncoderConfig::kMaxExtraAudioTracks)) {
+    LOG(ERROR) << "too many extra audio tracks: " << configs.size();
+    return kInvalidArg;
   }
 
-  // Read the chunk into |chunk_buffer_|.
-  const int status = (*muxer)->ReadChunk(chunk_buffer_size_,
-                                         chunk_buffer_.get());
+  std::vector<AudioSamplesCallbackInterface*> callbacks;
+  for (size_t i = 0; i < configs.size(); ++i) {
+    std::unique_ptr<ExtraAudioTrack> track(
+        new (std::nothrow) ExtraAudioTrack(  // NOLINT
+            this, static_cast<int>(i + 1)));
+    if (!track) {
+      LOG(ERROR) << "cannot construct extra audio track!";
+      return kNoMemory;
+    }
+    if (track->pool.Init(true,
+                         BufferPool<AudioBuffer>::kDefaultBufferCount)) {
+      LOG(ERROR) << "BufferPool<AudioBuffer> Init (A" << i + 1
+                 << ") failed!";
+      return kInitFailed;
+    }
+    callbacks.push_back(track.get());
+    extra_audio_tracks_.push_back(std::move(track));
+  }
+  int status = ptr_media_source_->InitExtraAudio(config_, callbacks);
   if (status) {
-    LOG(ERROR) << "error reading chunk: " << status;
-    return false;
+    LOG(ERROR) << "media source InitExtraAudio failed " << status;
+    return kInitFailed;
   }
 
-  return true;
-}
+  // Each track has a muxer configured as the main audio muxer.
+  const int audio_cluster_duration = config_.cluster_duration > 0 ?
+      config_.cluster_duration : config_.vpx_config.keyframe_interval;
+  const int chunk_duration = config_.cluster_duration > 0 ?
+      config_.vpx_config.keyframe_interval : 0;
+  for (size_t i = 0; i < extra_audio_tracks_.size(); ++i) {
+    ExtraAudioTrack& track = *extra_audio_tracks_[i];
+    AudioConfig& audio_config =
+        config_.extra_audio_tracks[i].actual_audio_config;
+    audio_config = ptr_media_source_->actual_extra_audio_config(i);
+    if (config_.audio_encode_sample_rate > 0) {
+      audio_config.sample_rate = config_.audio_encode_sample_rate;
+      audio_config.bytes_per_second =
+          audio_config.block_align * audio_config.sample_rate;
+    }
+    track.config = config_;
+    track.config.actual_audio_config = audio_config;
 
-void WebmEncoder::EncoderThread() {
-  LOG(INFO) << "EncoderThread started.";
+    track.worker.reset(new (std::nothrow) AudioEncodeWorker());  // NOLINT
+    if (!track.worker) {
+      LOG(ERROR) << "cannot construct audio encode worker!";
+      return kNoMemory;
+    }
+    if (config_.audio_drift_correction) {
+      track.drift_compensator.reset(
+          new (std::nothrow) AudioDriftCompensator());  // NOLINT
+      if (!track.drift_compensator) {
+        LOG(ERROR) << "cannot construct audio drift compensator!";
+        return kNoMemory;
+      }
+    }
+    status = InitMuxer(config_, audio_cluster_duration, chunk_duration, 0,
+                       ExtraAudioMuxerId(track.index), &track.muxer);
+    if (status) {
+      LOG(ERROR) << "InitMuxer (A" << track.index << ") failed: " << status;
+      return status;
+    }
+  }
+  return kSuccess;
+}
 
-  // Set to true the encode loop breaks because |StopRequested()| returns true.
-  bool user_initiated_stop = false;
+int WebmEncoder::InitAudioRepresentations() {
+  const std::vector<AudioRepresentationConfig>& reps =
+      config_.audio_representations;
+  if (!config_.dash_encode) {
+    LOG(ERROR) << "audio representations require DASH output.";
+    return kInvalidArg;
+  }
+  if (reps.size() >
+      static_cast<size_t>(WebmEncoderConfig::kMaxAudioRepresentations)) {
+    LOG(ERROR) << "too many audio representations: " << reps.size();
+    return kInvalidArg;
+  }
+
+  // Each representation has a muxer configured as the main audio muxer.
+  const int audio_cluster_duration = config_.cluster_duration > 0 ?
+      config_.cluster_duration : config_.vpx_config.keyframe_interval;
+  const int chunk_duration = config_.cluster_duration > 0 ?
+      config_.vpx_config.keyframe_interval : 0;
+  for (size_t i = 0; i < reps.size(); ++i) {
+    std::unique_ptr<ExtraAudioRepresentation> rep(
+        new (std::nothrow) ExtraAudioRepresentation(  // NOLINT
+            static_cast<int>(i + 1)));
+    if (!rep) {
+      LOG(ERROR) << "cannot construct audio representation!";
+      return kNoMemory;
+    }
+    rep->config = config_;
+    rep->config.audio_codec = reps[i].codec;
+    if (reps[i].codec == kAudioFormatOpus) {
+      if (reps[i].bitrate > 0)
+        rep->config.opus_config.bitrate = reps[i].bitrate;
+
+      // libopus encodes only at its own rates; the worker resamples others.
+      AudioConfig& audio_config = rep->config.actual_audio_config;
+      if (!ValidOpusSampleRate(audio_config.sample_rate)) {
+        audio_config.sample_rate = 48000;
+        audio_config.bytes_per_second =
+            audio_config.block_align * audio_config.sample_rate;
+      }
+    } else if (reps[i].bitrate > 0) {
+      // Constant bitrate settings stay constant at the new bitrate; other
+      // limits are kept.
+      VorbisConfig& vorbis_config = rep->config.vorbis_config;
+      if (vorbis_config.minimum_bitrate == vorbis_config.average_bitrate)
+        vorbis_config.minimum_bitrate = reps[i].bitrate;
+      if (vorbis_config.maximum_bitrate == vorbis_config.average_bitrate)
+        vorbis_config.maximum_bitrate = reps[i].bitrate;
+      vorbis_config.average_bitrate = reps[i].bitrate;
+    }
+
+    rep->worker.reset(new (std::nothrow) AudioEncodeWorker());  // NOLINT
+    if (!rep->worker) {
+      LOG(ERROR) << "cannot construct audio encode worker!";
+      return kNoMemory;
+    }
+    const int status = InitMuxer(config_, audio_cluster_duration,
+                                 chunk_duration, 0,
+                                 AudioRepresentationMuxerId(rep->index),
+                                 &rep->muxer);
+    if (status) {
+      LOG(ERROR) << "InitMuxer (A rep " << rep->index << ") failed: "
+                 << status;
+      return status;
+    }
+    audio_representations_.push_back(std::move(rep));
+  }
+  return kSuccess;
+}
+
+int WebmEncoder::InitEncodeWorkers(bool init_audio) {
+  const std::vector<VideoRepresentationConfig>& reps =
+      config_.video_representations;
+  if (config_.disable_video == false && !video_passthrough_) {
+    // Keyframes come only from |gop_scheduler_|, which starts over with the
+    // workers so that the first frame they encode is a keyframe, as does
+    // |frame_analyzer_|.
+    config_.vpx_config.scheduled_keyframes = true;
+    // With intra refresh, periodic keyframes only start DASH segments.
+    const bool periodic_keyframes =
+        !config_.vpx_config.intra_refresh || config_.dash_encode;
+    // Encoders sharing a heartbeat key the same frames.
+    if (!config_.standby_heartbeat.empty()) {
+      gop_scheduler_.InitAligned(config_.vpx_config.keyframe_interval);
+    } else {
+      gop_scheduler_.Init(
+          periodic_keyframes ? config_.vpx_config.keyframe_interval : 0,
+          config_.vpx_config.keyframe_interval / kMinSceneCutSpacingDivisor);
+    }
+    frame_analyzer_.Init(config_.vpx_config.scene_cut_keyframes);
+
+    // Spatial SVC encodes every representation on one worker, sized for the
+    // largest.
+    const size_t num_video_workers = config_.video_svc ? 1 : reps.size();
+    for (size_t i = 0; i < num_video_workers; ++i) {
+      std::unique_ptr<VideoEncodeWorker> worker(
+          new (std::nothrow) VideoEncodeWorker());  // NOLINT
+      if (!worker) {
+        LOG(ERROR) << "cannot construct video encode worker!";
+        return kNoMemory;
+      }
+      rep_workers_.push_back(std::move(worker));
+    }
+  }
+  if (config_.disable_audio == false && init_audio) {
+    audio_worker_.reset(new (std::nothrow) AudioEncodeWorker());  // NOLINT
+    if (!audio_worker_) {
+      LOG(ERROR) << "cannot construct audio encode worker!";
+      return kNoMemory;
+    }
+    // |AudioMixer| compensates each of its inputs, and its output follows
+    // the capture clock.
+    if (config_.audio_drift_correction && config_.audio_mix.inputs.empty()) {
+      audio_drift_compensator_.reset(
+          new (std::nothrow) AudioDriftCompensator());  // NOLINT
+      if (!audio_drift_compensator_) {
+        LOG(ERROR) << "cannot construct audio drift compensator!";
+        return kNoMemory;
+      }
+    }
+  }
+
+  // Codec initialization dominates: libvpx allocates its frame buffers and
+  // threads, and Vorbis builds its headers. The workers share nothing until
+  // they run, so a fast start initializes each on its own thread. The audio
+  // worker follows the video workers in |statuses|, the workers of
+  // |extra_audio_tracks_| follow it, and those of |audio_representations_|
+  // come last.
+  const bool audio = audio_worker_ && init_audio;
+  const size_t num_reps = rep_workers_.size();
+  const size_t num_tracks = extra_audio_tracks_.size();
+  const size_t num_workers = num_reps + (audio ?
+      1 + num_tracks + audio_representations_.size() : 0);
+  std::vector<int> statuses(num_workers, kSuccess);
+  const auto init_worker = [this, &reps, &statuses, num_reps,
+                            num_tracks](size_t i) {
+    if (i < num_reps) {
+      statuses[i] =
+          rep_workers_[i]->Init(config_, config_.video_svc ? reps.back() :
+                                                             reps[i]);
+    } else if (i == num_reps) {
+      statuses[i] = audio_worker_->Init(config_);
+    } else if (i <= num_reps + num_tracks) {
+      ExtraAudioTrack& track = *extra_audio_tracks_[i - num_reps - 1];
+      statuses[i] = track.worker->Init(track.config);
+    } else {
+      ExtraAudioRepresentation& rep =
+          *audio_representations_[i - num_reps - num_tracks - 1];
+      statuses[i] = rep.worker->Init(rep.config);
+    }
+  };
+  std::vector<std::thread> init_threads;
+  for (size_t i = 0; i < num_workers; ++i) {
+    if (config_.fast_start) {
+      init_threads.push_back(std::thread(init_worker, i));
+    } else {
+      init_worker(i);
+    }
+  }
+  for (size_t i = 0; i < init_threads.size(); ++i) {
+    init_threads[i].join();
+  }
+  for (size_t i = 0; i < num_workers; ++i) {
+    if (statuses[i] == kSuccess)
+      continue;
+    if (i < num_reps) {
+      LOG(ERROR) << "video encode worker " << i << " Init failed "
+                 << statuses[i];
+    } else {
+      LOG(ERROR) << "audio encoder (A" << i - num_reps << ") Init failed "
+                 << statuses[i];
+    }
+    return kInitFailed;
+  }
+
+  if (config_.task_scheduler) {
+    for (size_t i = 0; i < rep_workers_.size(); ++i) {
+      rep_workers_[i]->set_output_callback(
+          std::bind(&WebmEncoder::PostEncodeTask, this));
+    }
+    if (audio) {
+      audio_worker_->set_output_callback(
+          std::bind(&WebmEncoder::PostEncodeTask, this));
+      for (size_t i = 0; i < extra_audio_tracks_.size(); ++i) {
+        extra_audio_tracks_[i]->worker->set_output_callback(
+            std::bind(&WebmEncoder::PostEncodeTask, this));
+      }
+      for (size_t i = 0; i < audio_representations_.size(); ++i) {
+        audio_representations_[i]->worker->set_output_callback(
+            std::bind(&WebmEncoder::PostEncodeTask, this));
+      }
+    }
+  }
+
+  // The main track's samples reach its representations through
+  // |audio_fan_out_|, which converts them to planar float once for all of
+  // the Vorbis encoders.
+  if (audio && !audio_representations_.empty()) {
+    audio_fan_out_.reset(new (std::nothrow) AudioFanOut());  // NOLINT
+    if (!audio_fan_out_) {
+      LOG(ERROR) << "cannot construct audio fan out!";
+      return kNoMemory;
+    }
+    audio_fan_out_->AddWorker(audio_worker_.get(),
+                              config_.audio_codec != kAudioFormatOpus);
+    for (size_t i = 0; i < audio_representations_.size(); ++i) {
+      ExtraAudioRepresentation& rep = *audio_representations_[i];
+      audio_fan_out_->AddWorker(rep.worker.get(),
+                                rep.config.audio_codec != kAudioFormatOpus);
+    }
+  }
+  return kSuccess;
+}
+
+int WebmEncoder::Run() {
+  if (!initialized_) {
+    LOG(ERROR) << "Encoder cannot Run, Init required.";
+    return kRunFailed;
+  }
+
+  if (encode_thread_ || encode_strand_) {
+    LOG(ERROR) << "non-null encode thread. Already running?";
+    return kRunFailed;
+  }
+
+  if (config_.task_scheduler) {
+    encode_strand_.reset(
+        new (std::nothrow) TaskStrand(config_.task_scheduler));  // NOLINT
+    if (!encode_strand_) {
+      LOG(ERROR) << "cannot construct encode task strand.";
+      return kRunFailed;
+    }
+    PostEncodeTask();
+    return kSuccess;
+  }
+
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  encode_thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&WebmEncoder::EncoderThread,  // NOLINT
+                                this)));
+
+  return kSuccess;
+}
+
+// Sets |stop_| to true and calls join on |encode_thread_| to wait for
+// |EncoderThread| to finish. On a task scheduler waits for the encode task
+// that sees |stop_| to finish the encode instead.
+void WebmEncoder::Stop() {
+  CHECK(encode_thread_ || encode_strand_);
+  stop_ = true;
+  SignalInput();
+  if (encode_thread_) {
+    encode_thread_->join();
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(input_mutex_);
+    encode_finished_.wait(lock, [this] { return finished_.load(); });
+  }
+  encode_strand_->Cancel();
+}
+
+// Returns encoded duration in seconds.
+int64 WebmEncoder::encoded_duration() const {
+  return encoded_duration_.load();
+}
+
+void WebmEncoder::RequestKeyframe() {
+  keyframe_requested_ = true;
+}
+
+int WebmEncoder::SetVideoBitrate(int kbps) {
+  if (!initialized_ || config_.disable_video || kbps <= 0) {
+    LOG(ERROR) << "cannot set video bitrate " << kbps;
+    return kInvalidArg;
+  }
+  int total_kbps = 0;
+  for (size_t i = 0; i < rep_workers_.size(); ++i)
+    total_kbps += rep_workers_[i]->bitrate();
+  const double scale = static_cast<double>(kbps) / total_kbps;
+  for (size_t i = 0; i < rep_workers_.size(); ++i) {
+    const int rep_kbps =
+        std::max(1, static_cast<int>(rep_workers_[i]->bitrate() * scale));
+    if (rep_workers_[i]->SetTargetBitrate(rep_kbps)) {
+      return kVideoEncoderError;
+    }
+  }
+  return kSuccess;
+}
+
+int WebmEncoder::SetVideoSpeedBoost(int steps) {
+  if (!initialized_ || config_.disable_video || steps < 0) {
+    LOG(ERROR) << "cannot set video speed boost " << steps;
+    return kInvalidArg;
+  }
+  speed_boost_ = steps;
+  return kSuccess;
+}
+
+int WebmEncoder::Reconfigure(
+    const std::vector<VideoRepresentationConfig>& representations,
+    VideoFormat codec) {
+  if (!initialized_ || config_.disable_video || video_passthrough_ ||
+      !config_.dash_encode || !config_.dash_dynamic) {
+    LOG(ERROR) << "Reconfigure requires a dynamic DASH encode of video.";
+    return kInvalidArg;
+  }
+  if (!config_.standby_heartbeat.empty()) {
+    LOG(ERROR) << "Reconfigure would break standby segment alignment.";
+    return kInvalidArg;
+  }
+  if (representations.empty() || !ValidVideoCodec(codec)) {
+    LOG(ERROR) << "invalid video reconfiguration.";
+    return kInvalidArg;
+  }
+  VpxConfig new_vpx_config = config_.vpx_config;
+  new_vpx_config.codec = codec;
+  for (const VideoRepresentationConfig& rep : representations) {
+    if (!ValidVideoCodec(RepresentationCodec(rep, new_vpx_config))) {
+      LOG(ERROR) << "invalid video reconfiguration.";
+      return kInvalidArg;
+    }
+  }
+  if (config_.video_svc &&
+      !ValidSvcRepresentations(representations, new_vpx_config)) {
+    LOG(ERROR) << "invalid spatial SVC reconfiguration.";
+    return kInvalidArg;
+  }
+
+  // The muxed output and the archive carry the first representation.
+  const VideoFormat first_codec =
+      RepresentationCodec(representations[0], new_vpx_config);
+  const VideoFormat current_first_codec = RepresentationCodec(
+      config_.video_representations[0], config_.vpx_config);
+  if (ptr_muxer_ && first_codec != current_first_codec) {
+    LOG(ERROR) << "the muxed output cannot change video codec.";
+    return kInvalidArg;
+  }
+  if (archive_writer_ && first_codec != current_first_codec) {
+    LOG(ERROR) << "the archive cannot change video codec.";
+    return kInvalidArg;
+  }
+  WEBMLIVE_PROFILED_LOCK(lock, mutex_, "webm_encoder");
+  pending_representations_ = representations;
+  pending_codec_ = codec;
+  reconfigure_pending_ = true;
+  return kSuccess;
+}
+
+LatencyStats WebmEncoder::latency_stats() const {
+  return latency_stats_.Load();
+}
 
-  if (!ptr_encode_func_) {
-    // NULL encode function pointer; fatal/die:
-    LOG(FATAL) << "NULL encode function pointer!";
+CongestionStats WebmEncoder::congestion_stats() const {
+  CongestionStats stats = congestion_stats_.Load();
+  stats.capture_frames_dropped = capture_frames_dropped_.load();
+  return stats;
+}
+
+// AudioSamplesCallbackInterface
+int WebmEncoder::OnSamplesReceived(AudioBuffer* ptr_buffer) {
+  if (config_.capture_stall_timeout_ms > 0)
+    RetimeCaptureSample(ptr_buffer);
+
+  // At the memory limit the pool stops growing; buffers are dropped instead.
+  audio_buffer_bytes_.store(ptr_buffer->buffer_capacity(),
+                            std::memory_order_relaxed);
+  if (ptr_capture_memory_->pressure() == kMemoryCritical &&
+      audio_pool_.ActiveCount() >= audio_pool_.Capacity() &&
+      !ptr_capture_memory_->MayGrow()) {
+    VLOG(1) << "AudioBuffer pool dropped buffer (memory limit reached).";
+    return AudioSamplesCallbackInterface::kDropped;
+  }
+
+  // |Commit()| swaps the buffer into the pool; keep its timestamp.
+  const int64 timestamp = ptr_buffer->timestamp();
+  const int status = audio_pool_.Commit(ptr_buffer);
+  if (status == BufferPool<AudioBuffer>::kFull) {
+    VLOG(1) << "AudioBuffer pool dropped buffer (limit reached).";
+    return AudioSamplesCallbackInterface::kDropped;
+  } else if (status) {
+    LOG(ERROR) << "AudioBuffer pool Commit failed! " << status;
+    return AudioSamplesCallbackInterface::kNoMemory;
+  }
+  ptr_audio_pool_buffers_->Increment(1);
+  audio_captured_time_.store(timestamp);
+  WEBMLIVE_TRACE_EVERY_N(TraceLog::kFrame, 50, "audio_commit")
+      << " timestamp=" << timestamp;
+  SignalInput();
+  return kSuccess;
+}
+
+// VideoFrameCallbackInterface
+int WebmEncoder::OnVideoFrameReceived(VideoFrame* ptr_frame) {
+  // Latency codes carry the time of arrival from the source.
+  const int64 capture_time_ms =
+      config_.overlay.latency_code ? SystemClockMilliseconds() : 0;
+  if (pack_video_frames_ && ptr_frame->Pack()) {
+    LOG(ERROR) << "cannot pack video frame planes.";
+    ++capture_frames_dropped_;
+    ptr_capture_frames_dropped_->Increment(1);
+    return VideoFrameCallbackInterface::kDropped;
+  }
+
+  if (config_.capture_stall_timeout_ms > 0) {
+    const int64 capture_timestamp = ptr_frame->timestamp();
+    RetimeCaptureSample(ptr_frame);
+    if (ptr_frame->timestamp() != capture_timestamp)
+      LatencyTracer::Stamp(LatencyTracer::kCapture, ptr_frame->timestamp());
+  }
+
+  if (timestamp_smoother_.enabled()) {
+    int64 timestamp_us = ptr_frame->timestamp_us();
+    int64 duration_us = 0;
+    const int missed =
+        timestamp_smoother_.Smooth(&timestamp_us, &duration_us);
+    if (missed > 0) {
+      ptr_capture_frames_missed_->Increment(missed);
+      VLOG(1) << "capture missed " << missed << " frame(s) before "
+              << ptr_frame->timestamp() << "ms.";
+    }
+    const int64 capture_timestamp = ptr_frame->timestamp();
+    ptr_frame->SetTimeUs(timestamp_us, duration_us);
+
+    // The source stamped the capture time; later stages use the new one.
+    if (ptr_frame->timestamp() != capture_timestamp)
+      LatencyTracer::Stamp(LatencyTracer::kCapture, ptr_frame->timestamp());
+  }
+
+  if (deinterlacer_.enabled()) {
+    const int status =
+        deinterlacer_.Deinterlace(ptr_frame, &deinterlaced_field_);
+    if (status) {
+      LOG(ERROR) << "Deinterlace failed: " << status;
+      ++capture_frames_dropped_;
+      ptr_capture_frames_dropped_->Increment(1);
+      return VideoFrameCallbackInterface::kDropped;
+    }
+  }
+
+  ptr_frame->set_capture_time_ms(capture_time_ms);
+  const int status = CommitVideoFrame(ptr_frame);
+  if (deinterlacer_.field_rate()) {
+    LatencyTracer::Stamp(LatencyTracer::kCapture,
+                         deinterlaced_field_.timestamp());
+    deinterlaced_field_.set_capture_time_ms(capture_time_ms);
+    CommitVideoFrame(&deinterlaced_field_);
   }
+  return status;
+}
 
-  // Run the media source to get samples flowing.
-  int status = ptr_media_source_->Run();
+int WebmEncoder::CommitVideoFrame(VideoFrame* ptr_frame) {
+  // |Commit()| swaps the frame into the pool; keep its timestamp.
+  const int64 timestamp = ptr_frame->timestamp();
+  const int64 end_us = ptr_frame->timestamp_us() + ptr_frame->duration_us();
+  WEBMLIVE_TRACE_FRAME(frame_received, trace_stream_id_, timestamp);
+  video_frame_bytes_.store(ptr_frame->buffer_capacity(),
+                           std::memory_order_relaxed);
+  const int status = video_pool_.Commit(ptr_frame);
   if (status) {
-    // media source Run failed; fatal/die:
-    LOG(FATAL) << "Unable to run the media source! " << status;
+    if (status != BufferPool<VideoFrame>::kFull) {
+      LOG(ERROR) << "VideoFrame pool Commit failed: " << status;
+    }
+    ++capture_frames_dropped_;
+    ptr_capture_frames_dropped_->Increment(1);
+    VLOG(1) << "VideoFrame pool dropped frame (no buffers).";
+    return VideoFrameCallbackInterface::kDropped;
   }
+  LatencyTracer::Stamp(LatencyTracer::kCommit, timestamp);
+  WEBMLIVE_TRACE_FRAME(frame_commit, trace_stream_id_, timestamp);
+  if (!config_.slate_file.empty()) {
+    video_end_us_.store(end_us, std::memory_order_relaxed);
+    video_wall_ms_.store(SteadyClockMilliseconds());
+  }
+  ptr_video_pool_frames_->Increment(1);
+  WEBMLIVE_TRACE_EVERY_N(TraceLog::kFrame, 30, "video_commit")
+      << " timestamp=" << timestamp;
+  SignalInput();
+  return kSuccess;
+}
 
-  // Send the DASH manifest.
-  dash_writer_.reset(new (std::nothrow) DashWriter);  // NOLINT
-  if (!dash_writer_) {
-    LOG(FATAL) << "cannot construct dash writer!";
+bool WebmEncoder::StopRequested() {
+  return stop_.load();
+}
+
+bool WebmEncoder::InputAvailable() const {
+  for (size_t i = 0; i < extra_audio_tracks_.size(); ++i) {
+    if (!extra_audio_tracks_[i]->pool.IsEmpty())
+      return true;
   }
-  if (!dash_writer_->Init(config_)) {
-    LOG(ERROR) << "DashWriter::Init failed.";
+  return (!config_.disable_audio && !audio_pool_.IsEmpty()) ||
+      (!config_.disable_video && !video_pool_.IsEmpty());
+}
+
+bool WebmEncoder::UnpacedInput() const {
+  return !config_.input_paced &&
+      (config_.input_synthetic || !config_.input_video_file.empty() ||
+       !config_.input_audio_file.empty());
+}
+
+// Sets |input_signaled_| while holding |input_mutex_| to ensure the wake up is
+// not lost when |EncoderThread()| is between its checks of the pools and its
+// wait on |input_ready_|.
+void WebmEncoder::SignalInput() {
+  {
+    std::lock_guard<std::mutex> lock(input_mutex_);
+    input_signaled_ = true;
   }
-  std::string dash_manifest;
-  if (!dash_writer_->WriteManifest(&dash_manifest)) {
-    LOG(ERROR) << "DashWriter::WriteManifest failed.";
+  input_ready_.notify_one();
+  if (encode_strand_) {
+    PostEncodeTask();
   }
+}
 
-#if 0
-  ptr_data_sink_->WriteData(
-      reinterpret_cast<const uint8*>(dash_manifest.data()),
-      dash_manifest.length(), "manifest");
-#endif
+void WebmEncoder::WaitForInput() {
+  std::unique_lock<std::mutex> lock(input_mutex_);
+  input_ready_.wait_for(lock, std::chrono::milliseconds(IdleWaitMs()),
+                        [this] { return input_signaled_; });
+  input_signaled_ = false;
+}
+
+int64 WebmEncoder::IdleWaitMs() const {
+  const double frame_rate = config_.actual_video_config.frame_rate;
+  if (!slate_active_ || frame_rate <= 0) {
+    return kMaxIdleWaitMs;
+  }
+  return std::max<int64>(static_cast<int64>(kTimebase / frame_rate), 1);
+}
+
+bool WebmEncoder::ReadChunkFromMuxer(std::unique_ptr<LiveWebmMuxer>* muxer,
+                                     SharedDataChunk* ptr_chunk) {
+  // Take ownership of the chunk; its data is not copied.
+  const int status = (*muxer)->ReadChunk(ptr_chunk);
+  if (status) {
+    LOG(ERROR) << "error reading chunk: " << status;
+    return false;
+  }
+
+  return true;
+}
+
+void WebmEncoder::EncoderThread() {
+  LOG(INFO) << "EncoderThread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kEncode);
+  ScopedCpuStage cpu_stage(kCpuMux);
+
+  // Set to true the encode loop breaks because |StopRequested()| returns true.
+  bool user_initiated_stop = false;
 
-  // HACK: HERE BE DRAGONS
-  CHECK(WriteManifest(config_.dash_dir + "webmlive.mpd", dash_manifest));
+  StartEncode();
+
+  // Send the DASH manifest.
+  if (!early_headers_sent_) {
+    while (!StopRequested() &&
+           !ptr_data_sink_->WaitUntilReady(kMaxIdleWaitMs))
+      VLOG(1) << "waiting for data sink before writing manifest.";
+    WriteManifestToDataSink();
+  }
 
   // Wait for an input sample from each input stream-- this sets the
   // |timestamp_offset_| value when one or both streams starts with a negative
   // timestamp to avoid passing negative timestamps to libvpx and libwebm.
-  status = WaitForSamples();
+  int status = WaitForSamples();
   if (status) {
     LOG(ERROR) << "WaitForSamples failed: " << status;
   } else {
+    if (config_.capture_stall_timeout_ms > 0 && stall_watchdog_.Start())
+      LOG(ERROR) << "cannot start the stall watchdog; stalls go undetected.";
+    bool consumed = true;
     for (;;) {
-      if (StopRequested()) {
-        LOG(INFO) << "StopRequested returned true, stopping...";
-        user_initiated_stop = true;
+      if (EncodeShouldStop(&user_initiated_stop)) {
         break;
       }
-      status = ptr_media_source_->CheckStatus();
-      if (status) {
-        LOG(ERROR) << "Media source in a bad state, stopping: " << status;
-        break;
+
+      // Idle until the media source delivers input instead of spinning
+      // through the encode functions, both when the pools are empty and when
+      // the last pass could take nothing from them.
+      if (!consumed || !InputAvailable()) {
+        WaitForInput();
       }
-      status = (this->*ptr_encode_func_)();
-      if (status) {
-        LOG(ERROR) << "encoding failed: " << status;
+      if (EncodePass(&consumed)) {
         break;
       }
-      if (config_.dash_encode) {
-        if (!config_.disable_audio) {
-          status = WriteMuxerChunkToDataSink(&ptr_muxer_aud_);
-          if (status) {
-            LOG(ERROR) << "chunk write (A) failed: " << status;
-            break;
-          }
-        }
-        if (!config_.disable_video) {
-          status = WriteMuxerChunkToDataSink(&ptr_muxer_vid_);
-          if (status) {
-            LOG(ERROR) << "chunk write (V) failed: " << status;
-            break;
-          }
-        }
-      } else {
-        status = WriteMuxerChunkToDataSink(&ptr_muxer_);
-        if (status) {
-          LOG(ERROR) << "muxed chunk write failed: " << status;
-          break;
-        }
+    }
+
+    ptr_media_source_->Stop();
+  }
+
+  // When |user_initiated_stop| is true the encode loop has been broken
+  // cleanly (without error), and the final chunks are written.
+  FinishEncode(user_initiated_stop);
+  LOG(INFO) << "EncoderThread finished.";
+}
+
+void WebmEncoder::StartEncode() {
+  // Publish the manifest and metadata chunks while capture starts up.
+  if (config_.publish_headers_early) {
+    WriteEarlyHeadersToDataSink();
+  }
+
+  // Run the media source to get samples flowing, unless a fast start already
+  // did.
+  int status = kSuccess;
+  if (!source_running_) {
+    status = ptr_media_source_->Run();
+    if (status) {
+      // media source Run failed; fatal/die:
+      LOG(FATAL) << "Unable to run the media source! " << status;
+    }
+  }
+
+  // Start the encoders.
+  if (audio_worker_) {
+    status = audio_worker_->Run();
+    if (status) {
+      // worker Run failed; fatal/die:
+      LOG(FATAL) << "Unable to run audio encode worker: " << status;
+    }
+  }
+  for (size_t i = 0; i < extra_audio_tracks_.size(); ++i) {
+    status = extra_audio_tracks_[i]->worker->Run();
+    if (status) {
+      // worker Run failed; fatal/die:
+      LOG(FATAL) << "Unable to run audio encode worker (A" << i + 1 << "): "
+                 << status;
+    }
+  }
+  for (size_t i = 0; i < audio_representations_.size(); ++i) {
+    status = audio_representations_[i]->worker->Run();
+    if (status) {
+      // worker Run failed; fatal/die:
+      LOG(FATAL) << "Unable to run audio encode worker (A rep " << i + 1
+                 << "): " << status;
+    }
+  }
+  for (size_t i = 0; i < rep_workers_.size(); ++i) {
+    status = rep_workers_[i]->Run();
+    if (status) {
+      // worker Run failed; fatal/die:
+      LOG(FATAL) << "Unable to run video encode worker " << i << ": "
+                 << status;
+    }
+  }
+}
+
+bool WebmEncoder::EncodeShouldStop(bool* ptr_clean_stop) {
+  *ptr_clean_stop = false;
+  if (StopRequested()) {
+    LOG(INFO) << "StopRequested returned true, stopping...";
+    *ptr_clean_stop = true;
+    return true;
+  }
+  int status = ptr_media_source_->CheckStatus();
+  if (status == MediaSourceInterface::kInputEnded) {
+    LOG(INFO) << "Media source input ended, stopping...";
+    status = DrainInput();
+    *ptr_clean_stop = (status == kSuccess);
+    return true;
+  } else if (status) {
+    if (!RestartMediaSource("media source failed")) {
+      if (slate_.num_representations() == 0) {
+        LOG(ERROR) << "Media source in a bad state, stopping: " << status;
+        return true;
       }
+      if (!slate_source_failed_) {
+        LOG(ERROR) << "Media source in a bad state: " << status
+                   << "; showing the slate until stopped.";
+        slate_source_failed_ = true;
+      }
+    }
+  } else if (capture_restart_requested_.exchange(false)) {
+    RestartMediaSource("capture stalled");
+  }
+  if (audio_worker_) {
+    status = audio_worker_->CheckStatus();
+    if (status) {
+      LOG(ERROR) << "Audio encode worker in a bad state, stopping: "
+                 << status;
+      return true;
+    }
+  }
+  for (size_t i = 0; i < extra_audio_tracks_.size(); ++i) {
+    status = extra_audio_tracks_[i]->worker->CheckStatus();
+    if (status) {
+      LOG(ERROR) << "Audio encode worker (A" << i + 1 << ") in a bad state, "
+                 << "stopping: " << status;
+      return true;
+    }
+  }
+  for (size_t i = 0; i < audio_representations_.size(); ++i) {
+    status = audio_representations_[i]->worker->CheckStatus();
+    if (status) {
+      LOG(ERROR) << "Audio encode worker (A rep " << i + 1 << ") in a bad "
+                 << "state, stopping: " << status;
+      return true;
+    }
+  }
+  for (size_t i = 0; i < rep_workers_.size(); ++i) {
+    status = rep_workers_[i]->CheckStatus();
+    if (status) {
+      LOG(ERROR) << "Video encode worker " << i << " in a bad state, "
+                 << "stopping: " << status;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool WebmEncoder::RestartMediaSource(const char* reason) {
+  if (config_.capture_stall_timeout_ms <= 0 || !capture_restartable_) {
+    return false;
+  }
+
+  // A source that failed to reopen is tried again each deadline, not each
+  // pass.
+  const int64 start_ms = SteadyClockMilliseconds();
+  if (capture_restart_ms_ >= 0 &&
+      start_ms - capture_restart_ms_ < config_.capture_stall_timeout_ms) {
+    return true;
+  }
+  capture_restart_ms_ = start_ms;
+  LOG(WARNING) << reason << "; restarting the media source.";
+  capture_resync_pending_ = true;
+  const int status = ptr_media_source_->Restart();
+
+  // Restart the deadline: the watchdog reports the source again, and another
+  // restart is tried, if it stays silent.
+  stall_watchdog_.Kick(kStallCapture);
+  if (status == kNotImplemented) {
+    LOG(WARNING) << "the media source cannot restart.";
+    capture_restartable_ = false;
+    capture_resync_pending_ = false;
+    return false;
+  } else if (status) {
+    LOG(ERROR) << "media source restart failed: " << status
+               << "; retrying in " << config_.capture_stall_timeout_ms
+               << " ms.";
+    ptr_capture_restart_failures_->Increment(1);
+    return true;
+  }
+  ptr_capture_restarts_->Increment(1);
+  LOG(INFO) << "media source restarted in "
+            << SteadyClockMilliseconds() - start_ms << " ms.";
+  return true;
+}
+
+void WebmEncoder::OnStall(int stage, int64 stalled_ms) {
+  ptr_stalls_[stage]->Increment(1);
+  if (stage == kStallCapture) {
+    LOG(WARNING) << "no capture input for " << stalled_ms << " ms.";
+    capture_restart_requested_ = true;
+    SignalInput();
+  } else {
+    LOG(ERROR) << "encode loop made no progress for " << stalled_ms
+               << " ms.";
+  }
+}
+
+template <typename T>
+void WebmEncoder::RetimeCaptureSample(T* ptr_sample) {
+  const int64 now_ms = SteadyClockMilliseconds();
+  if (capture_resync_pending_.load()) {
+    std::lock_guard<std::mutex> lock(capture_resync_mutex_);
+    if (capture_resync_pending_.load()) {
+      // Keep the timeline on the wall clock, so that the outage shows as a
+      // gap and audio and video stay in step.
+      const int64 outage_ms = std::max<int64>(
+          now_ms - capture_end_wall_ms_.load(), 0);
+      capture_offset_us_ = capture_end_us_.load() + outage_ms * 1000 -
+          ptr_sample->timestamp_us();
+      capture_resync_pending_ = false;
+      LOG(INFO) << "capture resumed after " << outage_ms << " ms; offset "
+                << capture_offset_us_.load() << " us.";
+    }
+  }
+  const int64 offset_us = capture_offset_us_.load(std::memory_order_relaxed);
+  if (offset_us != 0) {
+    ptr_sample->SetTimeUs(ptr_sample->timestamp_us() + offset_us,
+                          ptr_sample->duration_us());
+  }
+  const int64 end_us = ptr_sample->timestamp_us() + ptr_sample->duration_us();
+  int64 last_end_us = capture_end_us_.load(std::memory_order_relaxed);
+  while (end_us > last_end_us &&
+         !capture_end_us_.compare_exchange_weak(last_end_us, end_us)) {
+  }
+  capture_end_wall_ms_.store(now_ms, std::memory_order_relaxed);
+  stall_watchdog_.Kick(kStallCapture);
+}
+
+int WebmEncoder::EncodePass(bool* ptr_consumed) {
+  const int64 pass_start_ms = SteadyClockMilliseconds();
+  int status = ApplyReconfigure();
+  if (status) {
+    LOG(ERROR) << "video reconfiguration failed: " << status;
+    return status;
+  }
+  status = FeedEncodeWorkers(ptr_consumed);
+  if (status) {
+    LOG(ERROR) << "encoding failed: " << status;
+    return status;
+  }
+  status = UpdateSlate();
+  if (status) {
+    LOG(ERROR) << "slate failed: " << status;
+    return status;
+  }
+  status = MuxEncodedPackets(false);
+  if (status) {
+    LOG(ERROR) << "muxing failed: " << status;
+    return status;
+  }
+  if (config_.dash_encode) {
+    if (!config_.disable_audio) {
+      status = WriteMuxerChunkToDataSink(&ptr_muxer_aud_);
+      if (status) {
+        LOG(ERROR) << "chunk write (A) failed: " << status;
+        return status;
+      }
+    }
+    for (size_t i = 0; i < extra_audio_tracks_.size(); ++i) {
+      status = WriteMuxerChunkToDataSink(&extra_audio_tracks_[i]->muxer);
+      if (status) {
+        LOG(ERROR) << "chunk write (A" << i + 1 << ") failed: " << status;
+        return status;
+      }
+    }
+    for (size_t i = 0; i < audio_representations_.size(); ++i) {
+      status = WriteMuxerChunkToDataSink(&audio_representations_[i]->muxer);
+      if (status) {
+        LOG(ERROR) << "chunk write (A rep " << i + 1 << ") failed: "
+                   << status;
+        return status;
+      }
+    }
+    for (size_t i = 0; i < rep_muxers_.size(); ++i) {
+      status = WriteMuxerChunkToDataSink(&rep_muxers_[i]);
+      if (status) {
+        LOG(ERROR) << "chunk write (V" << i << ") failed: " << status;
+        return status;
+      }
+    }
+  }
+  if (ptr_muxer_) {
+    status = WriteMuxerChunkToDataSink(&ptr_muxer_);
+    if (status) {
+      LOG(ERROR) << "muxed chunk write failed: " << status;
+      return status;
+    }
+  }
+  status = UpdateStandby();
+  if (status) {
+    return status;
+  }
+  WriteThumbnailsToDataSink(false);
+  UpdateMemoryUsage();
+  if (!config_.disable_video) {
+    UpdateCongestion();
+    UpdateOverload();
+  }
+  UpdateLatencyStats();
+  encode_pass_time_ms_ = SteadyClockMilliseconds() - pass_start_ms;
+  stall_watchdog_.Kick(kStallEncode);
+  return kSuccess;
+}
+
+int WebmEncoder::ApplyReconfigure() {
+  std::vector<VideoRepresentationConfig> representations;
+  VideoFormat codec = kVideoFormatVP8;
+  {
+    WEBMLIVE_PROFILED_LOCK(lock, mutex_, "webm_encoder");
+    if (!reconfigure_pending_)
+      return kSuccess;
+    reconfigure_pending_ = false;
+    representations.swap(pending_representations_);
+    codec = pending_codec_;
+  }
+  LOG(INFO) << "Reconfiguring video: " << representations.size()
+            << " representations.";
+
+  // Drain the current encoders of the frames already passed to them, and
+  // finalize their muxers so that the last chunks end with a whole cluster.
+  // Frames still in |video_pool_| go to the new encoders. Audio goes on
+  // through the same worker and muxer.
+  for (size_t i = 0; i < rep_workers_.size(); ++i) {
+    rep_workers_[i]->Drain();
+    rep_workers_[i]->Stop();
+  }
+  int status = MuxEncodedPackets(false);
+  if (status) {
+    LOG(ERROR) << "cannot mux the last packets before reconfiguring: "
+               << status;
+    return status;
+  }
+  for (size_t i = 0; i < rep_muxers_.size(); ++i) {
+    status = WriteLastMuxerChunkToDataSink(&rep_muxers_[i]);
+    if (status) {
+      LOG(ERROR) << "cannot write the last chunk (V" << i << ") before "
+                 << "reconfiguring: " << status;
+      return kWebmMuxerError;
+    }
+  }
+  rep_muxers_.clear();
+  rep_workers_.clear();
+
+  config_.video_representations = representations;
+  config_.vpx_config.codec = codec;
+  status = InitEncodeWorkers(false);
+  if (status) {
+    LOG(ERROR) << "InitEncodeWorkers failed " << status;
+    return status;
+  }
+  status = InitVideoRepresentations();
+  if (status) {
+    LOG(ERROR) << "InitVideoRepresentations failed " << status;
+    return status;
+  }
+  status = InitCongestionController();
+  if (status) {
+    LOG(ERROR) << "InitCongestionController failed " << status;
+    return kInitFailed;
+  }
+  status = InitSlate();
+  if (status) {
+    LOG(ERROR) << "InitSlate failed " << status;
+    return status;
+  }
+
+  // The new muxers' headers were never previewed; send them as chunk 0.
+  early_headers_.clear();
+  if (!dash_writer_->StartPeriod(config_)) {
+    LOG(ERROR) << "DashWriter::StartPeriod failed.";
+    return kInitFailed;
+  }
+  manifest_pending_ = true;
+
+  for (size_t i = 0; i < rep_workers_.size(); ++i) {
+    status = rep_workers_[i]->Run();
+    if (status) {
+      LOG(ERROR) << "cannot run video encode worker " << i << ": " << status;
+      return kVideoEncoderError;
+    }
+  }
+  return kSuccess;
+}
+
+void WebmEncoder::FinishEncode(bool write_last_chunks) {
+  stall_watchdog_.Stop();
+
+  // A standby stopping has nothing to finish: the stream is not its own.
+  StopEncodeWorkers(write_last_chunks && !standby_);
+  UpdateLatencyStats();
+  {
+    std::lock_guard<std::mutex> lock(input_mutex_);
+    finished_ = true;
+  }
+  encode_finished_.notify_all();
+}
+
+void WebmEncoder::PostEncodeTask() {
+  if (!encode_task_posted_.exchange(true)) {
+    encode_strand_->Post(EncodeTaskDeadline(),
+                         std::bind(&WebmEncoder::EncodeTask, this));
+  }
+}
+
+void WebmEncoder::EncodeTask() {
+  ScopedCpuStage cpu_stage(kCpuMux);
+  // Input arriving from here on posts another task.
+  encode_task_posted_ = false;
+  RunEncodeStage();
+}
+
+void WebmEncoder::EncodeTick() {
+  encode_tick_posted_ = false;
+  RunEncodeStage();
+}
+
+void WebmEncoder::RunEncodeStage() {
+  if (finished_) {
+    return;
+  }
+  if (encode_stage_ == kEncodeStarting) {
+    LOG(INFO) << "Encode task started.";
+    StartEncode();
+    encode_stage_ = early_headers_sent_ ? kEncodeWaitingForSamples :
+        kEncodeWaitingForSink;
+  }
+
+  // The stages below return to wait without holding a scheduler thread;
+  // |EncodeTick()| brings them back.
+  bool clean_stop = false;
+  if (encode_stage_ == kEncodeWaitingForSink) {
+    if (!StopRequested() && !ptr_data_sink_->Ready()) {
+      VLOG(1) << "waiting for data sink before writing manifest.";
+    } else {
+      WriteManifestToDataSink();
+      encode_stage_ = kEncodeWaitingForSamples;
+    }
+  }
+  if (encode_stage_ == kEncodeWaitingForSamples) {
+    if (StopRequested()) {
+      ptr_media_source_->Stop();
+      FinishEncode(true);
+      return;
+    }
+    if (SamplesReceived()) {
+      const int status = InitTimestampOffset();
+      if (status) {
+        LOG(ERROR) << "cannot set timestamp offset: " << status;
+        FinishEncode(false);
+        return;
+      }
+      if (config_.capture_stall_timeout_ms > 0 && stall_watchdog_.Start())
+        LOG(ERROR) << "cannot start the stall watchdog; stalls go undetected.";
+      encode_stage_ = kEncodeRunning;
+    } else {
+      const int status = ptr_media_source_->CheckStatus();
+      if (status) {
+        LOG(ERROR) << "media source stopped before delivering samples: "
+                   << status;
+        FinishEncode(false);
+        return;
+      }
+    }
+  }
+  if (encode_stage_ == kEncodeRunning) {
+    bool consumed = false;
+    if (EncodeShouldStop(&clean_stop) || EncodePass(&consumed)) {
+      ptr_media_source_->Stop();
+      FinishEncode(clean_stop);
+      LOG(INFO) << "Encode task finished.";
+      return;
+    }
+  }
+
+  if (!encode_tick_posted_) {
+    encode_tick_posted_ = true;
+    encode_strand_->PostAt(TaskScheduler::NowMilliseconds() + IdleWaitMs(),
+                           EncodeTaskDeadline(),
+                           std::bind(&WebmEncoder::EncodeTick, this));
+  }
+}
+
+int64 WebmEncoder::EncodeTaskDeadline() const {
+  const double frame_rate = config_.actual_video_config.frame_rate;
+  const int64 interval_ms = config_.disable_video || frame_rate <= 0 ?
+      kMaxIdleWaitMs : static_cast<int64>(kTimebase / frame_rate);
+  return TaskScheduler::NowMilliseconds() + interval_ms;
+}
+
+int WebmEncoder::DrainInput() {
+  // On a task scheduler |FeedEncodeWorkers()| leaves frames in |video_pool_|
+  // while the workers are full, so feed until the pool is empty.
+  for (;;) {
+    bool consumed = false;
+    const int status = FeedEncodeWorkers(&consumed);
+    if (status) {
+      LOG(ERROR) << "encoding failed while draining input: " << status;
+      return status;
+    }
+    for (size_t i = 0; i < rep_workers_.size(); ++i) {
+      rep_workers_[i]->Drain();
+    }
+    if (!config_.task_scheduler || config_.disable_video ||
+        video_pool_.IsEmpty()) {
+      return kSuccess;
+    }
+  }
+}
+
+int WebmEncoder::FeedEncodeWorkers(bool* ptr_consumed) {
+  *ptr_consumed = false;
+  int status = kSuccess;
+  const int64 time_ms = SteadyClockMilliseconds();
+  if (audio_worker_) {
+    if (audio_pool_sizing_.enabled) {
+      UpdatePoolSizing(time_ms, audio_pool_.ActiveCount(),
+                       audio_pool_.stats(), &audio_pool_sizing_);
+      const int32 limit = audio_pool_sizing_.sizer.limit();
+      if (limit != audio_pool_.limit() &&
+          MayResizePool(audio_pool_.limit(), limit)) {
+        audio_pool_.SetLimit(limit);
+      }
+    }
+
+    // Take every buffer waiting in |audio_pool_| in one batch, which locks
+    // the pool once instead of once per buffer, and hand them to
+    // |audio_worker_|. Their contents are swapped into the worker's pool.
+    if (audio_pool_.DecommitBatch(&audio_batch_) == kSuccess) {
+      VLOG(4) << "Encoder thread read " << audio_batch_.size()
+              << " raw audio buffers.";
+      ptr_audio_pool_buffers_->Decrement(
+          static_cast<int64>(audio_batch_.size()));
+      *ptr_consumed |= !audio_batch_.empty();
+    }
+    int audio_status = kSuccess;
+    for (size_t i = 0; i < audio_batch_.size(); ++i) {
+      AudioBuffer* const ptr_buffer = audio_batch_[i];
+      if (!audio_pool_sizing_.enabled && !UnpacedInput()) {
+        InitAudioPoolSizing(*ptr_buffer);
+      }
+      if (audio_drift_compensator_) {
+        status = audio_drift_compensator_->Process(ptr_buffer);
+        if (status == AudioDriftCompensator::kNoOutput) {
+          continue;
+        } else if (status) {
+          // Drift is a slow problem; keep encoding without correction.
+          LOG(ERROR) << "audio drift compensation failed: " << status
+                     << "; disabling it.";
+          audio_drift_compensator_.reset();
+        }
+      }
+      status = OffsetTimestamp(timestamp_offset_, ptr_buffer);
+      if (status) {
+        LOG(ERROR) << "audio timestamp offset failed: " << status;
+        audio_status = kAudioEncoderError;
+        break;
+      }
+      if (audio_fan_out_)
+        status = audio_fan_out_->EncodeBuffer(ptr_buffer);
+      else
+        status = audio_worker_->EncodeBuffer(ptr_buffer);
+      if (status) {
+        LOG(ERROR) << "audio EncodeBuffer failed: " << status;
+        audio_status = kAudioEncoderError;
+        break;
+      }
+    }
+    audio_pool_.ReleaseBatch(&audio_batch_);
+    if (audio_status) {
+      return audio_status;
+    }
+    if (audio_drift_compensator_) {
+      ptr_audio_drift_ppm_->Set(audio_drift_compensator_->drift_ppm());
+      ptr_audio_sync_error_us_->Set(static_cast<int64>(
+          audio_drift_compensator_->sync_error_ms() * 1000));
+    }
+  }
+
+  // Extra audio tracks are fed the same way, each to its own worker.
+  for (size_t t = 0; t < extra_audio_tracks_.size(); ++t) {
+    ExtraAudioTrack& track = *extra_audio_tracks_[t];
+    track.pool.DecommitBatch(&track.batch);
+    *ptr_consumed |= !track.batch.empty();
+    int audio_status = kSuccess;
+    for (size_t i = 0; i < track.batch.size(); ++i) {
+      AudioBuffer* const ptr_buffer = track.batch[i];
+      if (track.drift_compensator) {
+        status = track.drift_compensator->Process(ptr_buffer);
+        if (status == AudioDriftCompensator::kNoOutput) {
+          continue;
+        } else if (status) {
+          LOG(ERROR) << "audio drift compensation (A" << track.index
+                     << ") failed: " << status << "; disabling it.";
+          track.drift_compensator.reset();
+        }
+      }
+      status = OffsetTimestamp(timestamp_offset_, ptr_buffer);
+      if (!status)
+        status = track.worker->EncodeBuffer(ptr_buffer);
+      if (status) {
+        LOG(ERROR) << "audio EncodeBuffer (A" << track.index << ") failed: "
+                   << status;
+        audio_status = kAudioEncoderError;
+        break;
+      }
+    }
+    track.pool.ReleaseBatch(&track.batch);
+    if (audio_status) {
+      return audio_status;
+    }
+  }
+
+  if (config_.disable_video) {
+    return kSuccess;
+  }
+
+  if (video_pool_sizing_.enabled) {
+    UpdatePoolSizing(time_ms, video_pool_.ActiveCount(),
+                     video_pool_.stats(), &video_pool_sizing_);
+    const int32 limit = video_pool_sizing_.sizer.limit();
+    if (limit != video_pool_.limit() &&
+        MayResizePool(video_pool_.limit(), limit)) {
+      video_pool_.SetLimit(limit);
+    }
+  }
+
+  // Hand every frame waiting in |video_pool_| to all of the workers. Workers
+  // on a task scheduler cannot wait for room without holding a scheduler
+  // thread: unpaced input stays in the pool until they have room, and their
+  // output callbacks bring the encode task back.
+  const bool wait_for_room = config_.task_scheduler && !config_.input_paced;
+  for (;;) {
+    if (wait_for_room) {
+      bool full = false;
+      for (size_t i = 0; i < rep_workers_.size() && !full; ++i) {
+        full = rep_workers_[i]->InputFull();
+      }
+      if (full) {
+        break;
+      }
+    }
+    status = video_pool_.Decommit(&raw_frame_);
+    AccountVideoQueueDrops();
+    if (status == BufferPool<VideoFrame>::kEmpty) {
+      break;
+    } else if (status) {
+      LOG(ERROR) << "VideoFrame pool Decommit failed! " << status;
+      return kVideoSinkError;
+    }
+    *ptr_consumed = true;
+    LatencyTracer::Stamp(LatencyTracer::kDecommit, raw_frame_->timestamp());
+    WEBMLIVE_TRACE_FRAME(frame_decommit, trace_stream_id_,
+                         raw_frame_->timestamp());
+    ptr_video_pool_frames_->Decrement(1);
+
+    // Frames that overlap the slate are dropped. Decoders hold the slate
+    // picture, so the first frame after it is a keyframe.
+    bool slate_ended = false;
+    if (slate_active_) {
+      if (raw_frame_->timestamp_us() < slate_next_us_) {
+        VLOG(1) << "slate: dropped frame at " << raw_frame_->timestamp()
+                << "ms.";
+        continue;
+      }
+      LOG(INFO) << "video resumed; the slate showed "
+                << (slate_next_us_ - slate_start_us_) / 1000 << " ms.";
+      slate_active_ = false;
+      slate_ended = true;
+    }
+
+    status = OffsetTimestamp(timestamp_offset_, raw_frame_.get());
+    if (status) {
+      LOG(ERROR) << "Video frame timestamp offset failed: " << status;
+      return kVideoEncoderError;
+    }
+    if (video_passthrough_) {
+      status = MuxPassthroughFrame();
+      if (status) {
+        return status;
+      }
+      continue;
+    }
+    if (congestion_controller_.ShouldSkipRawFrame()) {
+      VLOG(4) << "congestion: skipped raw frame.";
+      continue;
+    }
+    if (overload_governor_.ShouldSkipRawFrame()) {
+      VLOG(4) << "overload: skipped raw frame.";
+      continue;
+    }
+    frame_overlay_.Draw(raw_frame_.get());
+    thumbnail_generator_.AddFrame(*raw_frame_);
+
+    // |gop_scheduler_| places every keyframe, periodic, requested and scene
+    // cut alike, and each is requested from every worker with the frame's
+    // timestamp, so that all representations key this frame and their chunks
+    // stay aligned. The workers place no keyframes of their own.
+    const int64 timestamp = raw_frame_->timestamp();
+    const bool requested =
+        keyframe_requested_.exchange(false) || slate_ended;
+    bool scene_cut = false;
+    if (config_.vpx_config.frame_analysis) {
+      frame_analyzer_.Analyze(raw_frame_.get());
+      scene_cut = raw_frame_->analysis().scene_cut;
+    } else {
+      scene_cut = !requested && config_.vpx_config.scene_cut_keyframes &&
+          scene_cut_detector_.IsSceneCut(*raw_frame_);
+    }
+    if (gop_scheduler_.ScheduleFrame(timestamp, requested, scene_cut)) {
+      for (size_t i = 0; i < rep_workers_.size(); ++i) {
+        rep_workers_[i]->RequestKeyframe(timestamp);
+      }
+    }
+
+    // Move the frame into |rep_frame_pool_|, and hand the same read only
+    // frame to every worker. It returns to the pool when the last worker is
+    // done with it.
+    SharedVideoFrame shared_frame;
+    status = rep_frame_pool_.Share(raw_frame_.get(), &shared_frame);
+    if (status) {
+      LOG(ERROR) << "cannot share frame with representations: " << status;
+      return kNoMemory;
+    }
+    for (size_t i = 0; i < rep_workers_.size(); ++i) {
+      status = rep_workers_[i]->EncodeFrame(shared_frame);
+      if (status < 0) {
+        LOG(ERROR) << "representation " << i << " EncodeFrame failed: "
+                   << status;
+        return kVideoEncoderError;
+      }
+    }
+  }
+  return kSuccess;
+}
+
+int WebmEncoder::MuxPassthroughFrame() {
+  const bool keyframe = raw_frame_->keyframe();
+  if (config_.realtime_sink &&
+      !config_.realtime_sink->WriteVideoFrame(*raw_frame_)) {
+    VLOG(4) << "realtime sink refused passthrough frame.";
+  }
+  if (congestion_controller_.ShouldDropEncodedFrame(0, keyframe)) {
+    VLOG(4) << "congestion: dropped passthrough frame.";
+    return kSuccess;
+  }
+  UpdateEncodedDuration(raw_frame_->timestamp());
+  if (config_.dash_encode) {
+    const int status = rep_muxers_[0]->WriteVideoFrame(*raw_frame_);
+    if (status) {
+      LOG(ERROR) << "Passthrough frame mux failed: " << status;
+      return status;
+    }
+    WEBMLIVE_TRACE_FRAME(mux_add_frame, trace_stream_id_,
+                         raw_frame_->timestamp());
+    VLOG(3) << "muxed (V0) " << raw_frame_->timestamp() / 1000.0;
+  }
+  ArchiveVideoFrame(*raw_frame_);
+  if (ptr_muxer_ && mux_queue_.PushVideo(raw_frame_.get())) {
+    LOG(ERROR) << "cannot queue passthrough video.";
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+int WebmEncoder::MuxEncodedPackets(bool flush) {
+  int status = kSuccess;
+  if (audio_worker_) {
+    AudioBuffer& vorb_buf = vorbis_audio_buffer_;
+    while ((status = audio_worker_->ReadEncodedBuffer(&vorb_buf)) ==
+           kSuccess) {
+      UpdateEncodedDuration(vorb_buf.timestamp());
+      audio_muxed_time_ = vorb_buf.timestamp();
+      if (config_.realtime_sink &&
+          !config_.realtime_sink->WriteAudioBuffer(vorb_buf)) {
+        VLOG(4) << "realtime sink refused audio buffer.";
+      }
+      if (config_.dash_encode) {
+        status = ptr_muxer_aud_->WriteAudioBuffer(vorb_buf);
+        if (status) {
+          LOG(ERROR) << "audio mux failed: " << status;
+          return status;
+        }
+        VLOG(4) << "muxed (A) " << vorb_buf.timestamp() / 1000.0;
+      }
+      ArchiveAudioBuffer(vorb_buf);
+      if (ptr_muxer_ && mux_queue_.PushAudio(&vorb_buf)) {
+        LOG(ERROR) << "cannot queue compressed audio.";
+        return kNoMemory;
+      }
+    }
+    if (status < 0) {
+      LOG(ERROR) << "Error reading vorbis samples: " << status;
+      return kAudioEncoderError;
+    }
+  }
+
+  // Extra audio tracks go only to their DASH muxers.
+  for (size_t i = 0; i < extra_audio_tracks_.size(); ++i) {
+    ExtraAudioTrack& track = *extra_audio_tracks_[i];
+    AudioBuffer& buffer = track.compressed_buffer;
+    while ((status = track.worker->ReadEncodedBuffer(&buffer)) == kSuccess) {
+      status = track.muxer->WriteAudioBuffer(buffer);
+      if (status) {
+        LOG(ERROR) << "audio mux (A" << track.index << ") failed: " << status;
+        return status;
+      }
+      VLOG(4) << "muxed (A" << track.index << ") "
+              << buffer.timestamp() / 1000.0;
+    }
+    if (status < 0) {
+      LOG(ERROR) << "Error reading audio samples (A" << track.index << "): "
+                 << status;
+      return kAudioEncoderError;
+    }
+  }
+
+  // So do the main track's extra representations.
+  for (size_t i = 0; i < audio_representations_.size(); ++i) {
+    ExtraAudioRepresentation& rep = *audio_representations_[i];
+    AudioBuffer& buffer = rep.compressed_buffer;
+    while ((status = rep.worker->ReadEncodedBuffer(&buffer)) == kSuccess) {
+      status = rep.muxer->WriteAudioBuffer(buffer);
+      if (status) {
+        LOG(ERROR) << "audio mux (A rep " << rep.index << ") failed: "
+                   << status;
+        return status;
+      }
+      VLOG(4) << "muxed (A rep " << rep.index << ") "
+              << buffer.timestamp() / 1000.0;
+    }
+    if (status < 0) {
+      LOG(ERROR) << "Error reading audio samples (A rep " << rep.index
+                 << "): " << status;
+      return kAudioEncoderError;
+    }
+  }
+
+  for (size_t i = 0; i < rep_workers_.size(); ++i) {
+    while ((status = rep_workers_[i]->ReadEncodedFrame(&vpx_frame_)) ==
+           kSuccess) {
+      // Spatial SVC frames go to the representation of their layer.
+      const size_t rep_index = config_.video_svc ?
+          static_cast<size_t>(vpx_frame_.spatial_layer()) : i;
+      const int stream = static_cast<int>(rep_index);
+      const bool keyframe = vpx_frame_.keyframe();
+      // The realtime sink paces and drops on its own link's terms.
+      if (rep_index == 0 && config_.realtime_sink &&
+          !config_.realtime_sink->WriteVideoFrame(vpx_frame_)) {
+        VLOG(4) << "realtime sink refused compressed frame.";
+      }
+      if (congestion_controller_.ShouldDropEncodedFrame(stream, keyframe)) {
+        VLOG(4) << "congestion: dropped compressed frame (V" << rep_index
+                << ").";
+        continue;
+      }
+      status = MuxVideoFrame(rep_index, &vpx_frame_);
+      if (status) {
+        return status;
+      }
+    }
+    if (status < 0) {
+      LOG(ERROR) << "representation " << i << " ReadEncodedFrame failed: "
+                 << status;
+      return kVideoEncoderError;
+    }
+  }
+
+  if (ptr_muxer_) {
+    status = mux_queue_.Mux(flush, ptr_muxer_.get());
+    if (status) {
+      LOG(ERROR) << "interleaved mux failed: " << status;
+      return kWebmMuxerError;
+    }
+  }
+  MuxArchive(flush);
+  return kSuccess;
+}
+
+int WebmEncoder::MuxVideoFrame(size_t index, VideoFrame* ptr_frame) {
+  UpdateEncodedDuration(ptr_frame->timestamp());
+  if (config_.dash_encode) {
+    const int status = rep_muxers_[index]->WriteVideoFrame(*ptr_frame);
+    if (status) {
+      LOG(ERROR) << "Video frame mux failed (V" << index << "): " << status;
+      return status;
+    }
+    WEBMLIVE_TRACE_FRAME(mux_add_frame, trace_stream_id_,
+                         ptr_frame->timestamp());
+    VLOG(3) << "muxed (V" << index << ") " << ptr_frame->timestamp() / 1000.0;
+  }
+  if (index == 0)
+    ArchiveVideoFrame(*ptr_frame);
+  if (index == 0 && ptr_muxer_ && mux_queue_.PushVideo(ptr_frame)) {
+    LOG(ERROR) << "cannot queue compressed video.";
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+int WebmEncoder::InitSlate() {
+  if (config_.slate_file.empty()) {
+    return kSuccess;
+  }
+  if (video_passthrough_) {
+    LOG(WARNING) << "slate ignored; passthrough video is not encoded.";
+    return kSuccess;
+  }
+  int status = slate_.Init(config_.slate_file, config_.actual_video_config);
+  const size_t num_reps = config_.video_svc ?
+      config_.video_representations.size() : rep_workers_.size();
+  for (size_t i = 0; i < num_reps && !status; ++i) {
+    const int bitrate = config_.video_svc ?
+        config_.video_representations[i].bitrate : rep_workers_[i]->bitrate();
+    status = slate_.AddRepresentation(config_, RepresentationOutputConfig(i),
+                                      bitrate);
+  }
+  if (status) {
+    LOG(ERROR) << "cannot encode the slate: " << status;
+    return kInitFailed;
+  }
+  return kSuccess;
+}
+
+int WebmEncoder::UpdateSlate() {
+  if (slate_.num_representations() == 0) {
+    return kSuccess;
+  }
+  const int64 now_ms = SteadyClockMilliseconds();
+  const int64 wall_ms = video_wall_ms_.load();
+  if (!slate_active_) {
+    if (wall_ms <= 0 || now_ms - wall_ms < config_.slate_delay_ms ||
+        !video_pool_.IsEmpty()) {
+      return kSuccess;
+    }
+
+    // The frames captured before the loss go out ahead of the slate, which
+    // picks up where the last one ended, as of its arrival.
+    for (size_t i = 0; i < rep_workers_.size(); ++i) {
+      rep_workers_[i]->Drain();
+    }
+    const int status = MuxEncodedPackets(false);
+    if (status) {
+      return status;
+    }
+    LOG(WARNING) << "no video for " << now_ms - wall_ms
+                 << " ms; showing the slate.";
+    slate_active_ = true;
+    slate_.Restart();
+    slate_start_us_ = video_end_us_.load();
+    slate_start_ms_ = wall_ms;
+    slate_frames_ = 0;
+    slate_next_us_ = slate_start_us_;
+  }
+
+  // Frames are muxed once their time has passed, as a capture device would
+  // deliver them. Times are computed in microseconds so that frame rates
+  // that do not divide 1000 keep evenly spaced timestamps.
+  const double frame_rate = config_.actual_video_config.frame_rate;
+  if (frame_rate <= 0) {
+    return kSuccess;
+  }
+  const int64 elapsed_us = (now_ms - slate_start_ms_) * 1000;
+  for (;;) {
+    const int64 timestamp_us = slate_start_us_ + static_cast<int64>(
+        slate_frames_ * kMicrosecondTimebase / frame_rate);
+    const int64 next_timestamp_us = slate_start_us_ + static_cast<int64>(
+        (slate_frames_ + 1) * kMicrosecondTimebase / frame_rate);
+    if (next_timestamp_us - slate_start_us_ > elapsed_us) {
+      break;
+    }
+    const int64 timestamp = timestamp_us / 1000 + timestamp_offset_;
+    slate_.Advance(gop_scheduler_.ScheduleFrame(
+        timestamp, slate_.KeyframeNeeded(), false));
+    for (int i = 0; i < slate_.num_representations(); ++i) {
+      int status = slate_.CopyFrame(i, timestamp_us,
+                                    next_timestamp_us - timestamp_us,
+                                    &slate_frame_);
+      if (!status)
+        status = OffsetTimestamp(timestamp_offset_, &slate_frame_);
+      if (status) {
+        LOG(ERROR) << "cannot copy slate frame (V" << i << "): " << status;
+        return kVideoEncoderError;
+      }
+      status = MuxVideoFrame(i, &slate_frame_);
+      if (status) {
+        return status;
+      }
+    }
+    ++slate_frames_;
+    slate_next_us_ = next_timestamp_us;
+    ptr_slate_frames_->Increment(1);
+  }
+  return kSuccess;
+}
+
+int WebmEncoder::InitArchive() {
+  archive_writer_.reset(new (std::nothrow) WebmArchiveWriter());  // NOLINT
+  if (!archive_writer_) {
+    LOG(ERROR) << "cannot construct archive writer.";
+    return kNoMemory;
+  }
+  int status = archive_writer_->Init(config_.archive_path,
+                                         config_.archive_memory_mapped);
+  if (status) {
+    LOG(ERROR) << "archive Init failed: " << status;
+    return kInitFailed;
+  }
+
+  // DASH encodes archive the audio muxer and the first representation;
+  // otherwise |ptr_muxer_| has every track.
+  std::vector<const LiveWebmMuxer*> muxers;
+  if (config_.dash_encode) {
+    if (ptr_muxer_aud_ && !config_.disable_audio)
+      muxers.push_back(ptr_muxer_aud_.get());
+    if (!rep_muxers_.empty())
+      muxers.push_back(rep_muxers_[0].get());
+  } else {
+    muxers.push_back(ptr_muxer_.get());
+  }
+  for (size_t i = 0; i < muxers.size(); ++i) {
+    status = archive_writer_->AddTracks(*muxers[i]);
+    if (status) {
+      LOG(ERROR) << "archive AddTracks failed: " << status;
+      return kInitFailed;
+    }
+  }
+
+  status = archive_queue_.Init(!config_.disable_audio,
+                               !config_.disable_video,
+                               MuxReorderQueue::kDefaultMaxQueuedPackets);
+  if (status) {
+    LOG(ERROR) << "archive MuxReorderQueue Init failed: " << status;
+    return kInitFailed;
+  }
+  LOG(INFO) << "archiving to " << config_.archive_path;
+  return kSuccess;
+}
+
+void WebmEncoder::ArchiveAudioBuffer(const AudioBuffer& buffer) {
+  if (!archive_writer_)
+    return;
+  if (buffer.Clone(&archive_audio_buffer_) ||
+      archive_queue_.PushAudio(&archive_audio_buffer_)) {
+    StopArchive("cannot queue archive audio.");
+  }
+}
+
+void WebmEncoder::ArchiveVideoFrame(const VideoFrame& frame) {
+  if (!archive_writer_)
+    return;
+  if (frame.Clone(&archive_frame_) ||
+      archive_queue_.PushVideo(&archive_frame_)) {
+    StopArchive("cannot queue archive video.");
+  }
+}
+
+void WebmEncoder::MuxArchive(bool flush) {
+  if (archive_writer_ && archive_queue_.Mux(flush, archive_writer_.get()))
+    StopArchive("archive mux failed.");
+}
+
+void WebmEncoder::FinalizeArchive() {
+  if (!archive_writer_)
+    return;
+  MuxArchive(true);
+  if (archive_writer_ && archive_writer_->Finalize())
+    LOG(ERROR) << "archive " << archive_writer_->path() << " Finalize failed.";
+  archive_writer_.reset();
+}
+
+void WebmEncoder::StopArchive(const char* reason) {
+  LOG(ERROR) << reason << " Archive " << archive_writer_->path()
+             << " stopped; live output continues.";
+  archive_writer_.reset();
+}
+
+void WebmEncoder::UpdateEncodedDuration(int64 timestamp) {
+  if (timestamp > encoded_duration_.load(std::memory_order_relaxed))
+    encoded_duration_.store(timestamp, std::memory_order_relaxed);
+}
+
+int WebmEncoder::WaitForSamples() {
+  // Wait for samples from the input stream(s).
+  for (;;) {
+    if (StopRequested()) {
+      return kSuccess;
+    }
+    if (SamplesReceived()) {
+      break;
+    }
+    const int status = ptr_media_source_->CheckStatus();
+    if (status) {
+      LOG(ERROR) << "media source stopped before delivering samples: "
+                 << status;
+      return kAVCaptureStopped;
+    }
+    WaitForInput();
+  }
+  return InitTimestampOffset();
+}
+
+bool WebmEncoder::SamplesReceived() const {
+  return (config_.disable_audio || !audio_pool_.IsEmpty()) &&
+      (config_.disable_video || !video_pool_.IsEmpty());
+}
+
+int WebmEncoder::InitTimestampOffset() {
+  int64 first_audio_timestamp = 0;
+  if (!config_.disable_audio) {
+    int64& a_ts = first_audio_timestamp;
+    const int status = audio_pool_.ActiveBufferTimestamp(&a_ts);
+    if (status) {
+      LOG(ERROR) << "cannot read first audio timestamp: " << status;
+      return status;
+    }
+  }
+
+  int64 first_video_timestamp = 0;
+  if (!config_.disable_video) {
+    int64& v_ts = first_video_timestamp;
+    const int status = video_pool_.ActiveBufferTimestamp(&v_ts);
+    if (status) {
+      LOG(ERROR) << "cannot read first video timestamp: " << status;
+      return status;
+    }
+  }
+
+  if (first_audio_timestamp < 0 && first_video_timestamp < 0) {
+    const int first_a_ts = std::abs(static_cast<int>(first_audio_timestamp));
+    const int first_v_ts = std::abs(static_cast<int>(first_video_timestamp));
+    timestamp_offset_ = std::max(first_a_ts, first_v_ts);
+  } else if (first_audio_timestamp < 0) {
+    const int first_a_ts = std::abs(static_cast<int>(first_audio_timestamp));
+    timestamp_offset_ = first_a_ts;
+  } else if (first_video_timestamp < 0) {
+    const int first_v_ts = std::abs(static_cast<int>(first_video_timestamp));
+    timestamp_offset_ = first_v_ts;
+  }
+  LOG(INFO) << "WebmEncoder timestamp_offset_=" << timestamp_offset_;
+
+  // The offset depends on when the encoder started reading.
+  if (timestamp_offset_ != 0 && !config_.standby_heartbeat.empty()) {
+    LOG(ERROR) << "standby heartbeat requires non-negative timestamps.";
+    return kInvalidArg;
+  }
+  return kSuccess;
+}
+
+int WebmEncoder::WriteMuxerChunkToDataSink(
+    std::unique_ptr<LiveWebmMuxer>* muxer) {
+  if (standby_) {
+    return HoldMuxerChunk(muxer);
+  }
+  WriteStreamingChunksToDataSink(muxer);
+  if (traced_upload_time_ >= 0 && ptr_data_sink_->Ready()) {
+    LatencyTracer::Stamp(LatencyTracer::kUpload, traced_upload_time_);
+    traced_upload_time_ = -1;
+  }
+  if (manifest_pending_ && ptr_data_sink_->Ready()) {
+    WriteManifestToDataSink();
+  }
+  if (ptr_data_sink_->Ready()) {
+    int32 chunk_length = 0;
+    const bool chunk_ready = (*muxer)->ChunkReady(&chunk_length);
+    if (chunk_ready) {
+      const int64 chunk_num = ReadyChunkNumber(**muxer);
+      std::string id = NextChunkId((*muxer)->muxer_id(), chunk_num);
+      // A complete chunk is waiting in |muxer|'s buffer.
+      SharedDataChunk chunk;
+      if (!ReadChunkFromMuxer(muxer, &chunk)) {
+        LOG(ERROR) << "cannot read WebM chunk from muxer_id: "
+                   << (*muxer)->muxer_id();
+        return kWebmMuxerError;
+      }
+      if (EarlyHeaderSent((*muxer)->muxer_id(), chunk_num)) {
+        return kSuccess;
+      }
+      // Pass the chunk to |ptr_data_sink_|.
+      if (!ptr_data_sink_->WriteChunk(chunk, id)) {
+        LOG(ERROR) << "data sink write failed!";
+        return kDataSinkWriteFail;
+      }
+      TraceChunkWrite(**muxer);
+      AddChunkToManifest(**muxer, chunk_length);
+      written_segments_[(*muxer)->muxer_id()] = chunk_num;
+    }
+  }
+  return kSuccess;
+}
+
+int WebmEncoder::WriteLastMuxerChunkToDataSink(
+    std::unique_ptr<LiveWebmMuxer>* muxer) {
+  const int status = FinalizeMuxer(muxer);
+  if (status) {
+    return status;
+  }
+  WriteFinalChunkToDataSink(muxer);
+  if (manifest_pending_ && WaitForDataSink(kManifestId)) {
+    WriteManifestToDataSink();
+  }
+  if (config_.cluster_index) {
+    WriteClusterIndexToDataSink(**muxer);
+  }
+  return status;
+}
+
+int WebmEncoder::FinalizeMuxer(std::unique_ptr<LiveWebmMuxer>* muxer) {
+  const int status = (*muxer)->Finalize();
+  if (status) {
+    LOG(ERROR) << "muxer Finalize failed, muxer_id: " << (*muxer)->muxer_id()
+               << " status: " << status;
+    return status;
+  }
+  WriteStreamingChunksToDataSink(muxer);
+  return kSuccess;
+}
+
+void WebmEncoder::WriteFinalChunkToDataSink(
+    std::unique_ptr<LiveWebmMuxer>* muxer) {
+  int32 chunk_length = 0;
+  if (!(*muxer)->ChunkReady(&chunk_length)) {
+    return;
+  }
+  LOG(INFO) << "mkvmuxer Finalize produced a chunk.";
+  const int64 chunk_num = ReadyChunkNumber(**muxer);
+  std::string id = NextChunkId((*muxer)->muxer_id(), chunk_num);
+  if (!WaitForDataSink(id)) {
+    return;
+  }
+  SharedDataChunk chunk;
+  if (ReadChunkFromMuxer(muxer, &chunk)) {
+    const bool sink_write_ok = ptr_data_sink_->WriteChunk(chunk, id);
+    if (!sink_write_ok) {
+      LOG(ERROR) << "data sink write fail on final chunk for muxer_id:"
+                 << (*muxer)->muxer_id();
+    } else {
+      LOG(INFO) << "Final chunk upload initiated.";
+      AddChunkToManifest(**muxer, chunk_length);
     }
+  }
+}
 
-    if (user_initiated_stop) {
-      // When |user_initiated_stop| is true the encode loop has been broken
-      // cleanly (without error). Call |LiveWebmMuxer::Finalize()| to flush any
-      // buffered samples, and upload the final chunk if one becomes available.
-      if (config_.dash_encode) {
-        if (!config_.disable_audio) {
-          status = WriteLastMuxerChunkToDataSink(&ptr_muxer_aud_);
-          if (status) {
-            LOG(ERROR) << "Failed to write last dash audio chunk";
-          }
-        }
-        if (!config_.disable_video) {
-          status = WriteLastMuxerChunkToDataSink(&ptr_muxer_vid_);
-          if (status) {
-            LOG(ERROR) << "Failed to write last dash video chunk";
-          }
-        }
-      } else {
-        status = WriteLastMuxerChunkToDataSink(&ptr_muxer_);
-        if (status) {
-          LOG(ERROR) << "Failed to write last non-dash chunk";
-        }
+bool WebmEncoder::WaitForDataSink(const std::string& id) {
+  for (;;) {
+    int64 wait_ms = kMaxIdleWaitMs;
+    if (stop_deadline_ms_ > 0) {
+      wait_ms = std::min<int64>(
+          wait_ms, stop_deadline_ms_ - SteadyClockMilliseconds());
+      if (wait_ms <= 0 && !ptr_data_sink_->Ready()) {
+        LOG(WARNING) << "stop deadline passed; abandoning " << id;
+        ++stop_abandoned_writes_;
+        ptr_stop_abandoned_writes_->Increment(1);
+        return false;
       }
     }
-
-    ptr_media_source_->Stop();
+    if (wait_ms <= 0 ||
+        ptr_data_sink_->WaitUntilReady(static_cast<int32>(wait_ms))) {
+      return true;
+    }
+    VLOG(1) << "waiting for data sink before writing " << id;
   }
-  LOG(INFO) << "EncoderThread finished.";
 }
 
-// On each encoding pass:
-// - Attempts to read one uncompressed audio buffer from |audio_pool_|, and
-//   feeds it |vorbis_encoder_| for compression when successful.
-// - Passes all available compressed audio produced by |vorbis_encoder_| to
-//   |ptr_muxer_| for muxing.
-int WebmEncoder::EncodeAudioOnly() {
-  // Encode a single audio buffer.
-  int status = EncodeAudioBuffer();
-  if (status) {
-    LOG(ERROR) << "EncodeAudioBuffer failed: " << status;
-    return status;
+void WebmEncoder::AddChunkToManifest(const LiveWebmMuxer& muxer,
+                                     int32 chunk_length) {
+  if (!config_.dash_encode || !dash_writer_ ||
+      (!dash_writer_->dynamic() && !config_.dash_vod_manifest))
+    return;
+  int64 start = 0;
+  int64 duration = 0;
+  if (!muxer.ChunkTiming(&start, &duration))
+    return;
+
+  // Every Representation's chunks are measured; |AddChunk()| needs only
+  // one of each AdaptationSet.
+  std::string rep_id;
+  int track_index = -1;
+  for (size_t i = 0; i < extra_audio_tracks_.size(); ++i) {
+    if (extra_audio_tracks_[i]->muxer->muxer_id() == muxer.muxer_id()) {
+      track_index = extra_audio_tracks_[i]->index;
+      rep_id = DashWriter::AudioRepresentationId(track_index);
+    }
+  }
+  for (size_t i = 0; i < audio_representations_.size(); ++i) {
+    if (audio_representations_[i]->muxer->muxer_id() == muxer.muxer_id()) {
+      rep_id = DashWriter::AudioLadderRepresentationId(
+          audio_representations_[i]->index);
+    }
+  }
+  for (size_t i = 0; i < rep_muxers_.size(); ++i) {
+    if (rep_muxers_[i]->muxer_id() == muxer.muxer_id())
+      rep_id = DashWriter::VideoRepresentationId(static_cast<int>(i));
+  }
+  if (muxer.muxer_id() == kAudioId)
+    rep_id = DashWriter::AudioRepresentationId(0);
+  if (!rep_id.empty() &&
+      dash_writer_->MeasureChunk(rep_id, chunk_length, duration) &&
+      dash_writer_->dynamic())
+    manifest_pending_ = true;
+
+  if (track_index >= 0) {
+    if (dash_writer_->AddAudioChunk(track_index, start, duration) &&
+        dash_writer_->dynamic())
+      manifest_pending_ = true;
+    return;
   }
 
-  // Read and mux vorbis data until no more is available from |vorbis_encoder_|.
-  AudioBuffer* vb = &vorbis_audio_buffer_;
-  VorbisEncoder* ve = &vorbis_encoder_;
-  while ((status = ve->ReadCompressedAudio(vb)) == kSuccess) {
-    // Mux the vorbis data.
-    const int mux_status = ptr_muxer_->WriteAudioBuffer(*vb);
-    if (mux_status) {
-      LOG(ERROR) << "Audio buffer mux failed " << mux_status;
-      return mux_status;
-    }
-    VLOG(4) << "muxed (A) " << vorbis_audio_buffer_.timestamp() / 1000.0;
-
-    // Update encoded duration if able to obtain the lock.
-    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
-    if (lock.owns_lock()) {
-      encoded_duration_ = vb->timestamp();
-    }
-  }
-  if (status < 0) {
-    LOG(ERROR) << "Error reading vorbis samples: " << status;
-    return kAudioEncoderError;
-  }
-  return kSuccess;
-}
-
-// On each encoding pass:
-// - Attempts to read an uncompressed audio buffer from |audio_pool_|, and
-//   passes it to |vorbis_encoder_| when a buffer is available.
-// - Stores the timestamp of the first available video frame from |video_pool_|
-//   in |video_timestamp|, or uses the last encoded timestamp added to the
-//   calculated time per frame if no frame is available.
-// - Reads one compressed audio buffer from |vorbis_encoder_| into
-//   |vorbis_audio_buffer_|, and
-//   - Passes it to |ptr_muxer_| when the compressed audio buffer timestamp is
-//     less than the stored video timestamp, or
-//   - Stores the compressed audio buffer and sets the |vorbis_buffered| flag
-//     to true, and then waits to mux the audio until:
-// - When the stored |video_timestamp| is less than or equal to the _estimated_
-//   timestamp of the next compressed audio buffer from |vorbis_encoder_|, calls
-//   |EncodeVideoFrame()| to attempt to read and encode a video frame. This is
-//   repeated until no video frames are available, or the next frame available
-//   would cause video to get ahead of audio.
-// - When the |vorbis_buffered| flag was set because the audio timestamp
-//   produced by |vorbis_encoder_| was greater than |video_timestamp|, passes
-//   |vorbis_audio_buffer_| to |ptr_muxer_|.
-int WebmEncoder::AVEncode() {
-  // Encode a single audio buffer.
-  int status = EncodeAudioBuffer();
-  if (status) {
-    LOG(ERROR) << "EncodeAudioBuffer failed: " << status;
-    return status;
+  // Representations share chunk timing, so only the first one describes the
+  // video SegmentTimeline, and the main audio muxer describes the audio one.
+  AdaptationSet::MediaType media_type = AdaptationSet::kVideo;
+  if (muxer.muxer_id() == kAudioId) {
+    media_type = AdaptationSet::kAudio;
+  } else if (rep_muxers_.empty() ||
+             rep_muxers_[0]->muxer_id() != muxer.muxer_id()) {
+    return;
   }
+  // Aligned timelines start with the number of their first segment on the
+  // grid.
+  if (gop_scheduler_.aligned()) {
+    dash_writer_->SetFirstNumber(media_type,
+                                 gop_scheduler_.AlignedSegmentNumber(start));
+  }
+  if (dash_writer_->AddChunk(media_type, start, duration) &&
+      dash_writer_->dynamic())
+    manifest_pending_ = true;
+}
 
-  // Store the next video timestamp.
-  int64 video_timestamp = 0;
-  status = PeekVideoTimestamp(&video_timestamp);
-  if (status < 0) {
-    LOG(ERROR) << "Video timestamp peek failed: " << status;
-    return status;
+void WebmEncoder::WriteManifestToDataSink() {
+  // A standby's manifest waits for it to take over.
+  if (standby_) {
+    manifest_pending_ = true;
+    return;
   }
 
-  // Read compressed audio until no more remains, or the compressed buffer
-  // timestamp is greater than |video_timestamp|.
-  bool vorbis_buffered = false;
-  AudioBuffer& vorb_buf = vorbis_audio_buffer_;
-  VorbisEncoder& vorb_enc = vorbis_encoder_;
-  if (vorb_enc.time_encoded() <= video_timestamp) {
-    while ((status = vorb_enc.ReadCompressedAudio(&vorb_buf)) == kSuccess) {
-      if (video_timestamp < vorb_buf.timestamp()) {
-        vorbis_buffered = true;
-        break;
-      }
-      status = ptr_muxer_->WriteAudioBuffer(vorb_buf);
-      if (status) {
-        LOG(ERROR) << "audio mux failed: " << status;
-        return status;
-      }
-      vorbis_buffered = false;
-      VLOG(4) << "muxed (A) " << vorbis_audio_buffer_.timestamp() / 1000.0;
+  // Updates the patch describes leave the full manifest as it was until it
+  // is due again.
+  const int64 now_ms = SteadyClockMilliseconds();
+  bool write_manifest = true;
+  if (config_.dash_patch_interval > 0 && dash_writer_->dynamic() &&
+      dash_writer_->WritePatch(&patch_buffer_)) {
+    if (!ptr_data_sink_->WriteData(
+            reinterpret_cast<const uint8*>(patch_buffer_.data()),
+            static_cast<int32>(patch_buffer_.length()),
+            DashWriter::kPatchLocation)) {
+      LOG(ERROR) << "data sink manifest patch write failed!";
+      return;
     }
+    write_manifest = now_ms - manifest_time_ms_ >=
+        static_cast<int64>(config_.dash_patch_interval) * 1000;
   }
-
-  // Attempt to encode video frames when |video_timestamp| is less than the
-  // next estimated compressed audio buffer timestamp.
-  while (status != BufferPool<VideoFrame>::kEmpty &&
-         video_timestamp <= vorb_enc.time_encoded()) {
-    VLOG(3) << "attempting video mux vid_ts=" << video_timestamp
-              << " vorb_enc time_encoded=" << vorb_enc.time_encoded();
-    status = EncodeVideoFrame();
-    if (status) {
-      LOG(ERROR) << "EncodeVideoFrame failed: " << status;
-      return status;
+  if (write_manifest) {
+    if (!dash_writer_->WriteManifest(&manifest_buffer_)) {
+      LOG(ERROR) << "DashWriter::WriteManifest failed.";
+      return;
     }
-    status = PeekVideoTimestamp(&video_timestamp);
-    if (status < 0) {
-      LOG(ERROR) << "Video timestamp peek failed: " << status;
-      return status;
+    if (!ptr_data_sink_->WriteData(
+            reinterpret_cast<const uint8*>(manifest_buffer_.data()),
+            static_cast<int32>(manifest_buffer_.length()), kManifestId)) {
+      LOG(ERROR) << "data sink manifest write failed!";
+      return;
     }
+    manifest_time_ms_ = now_ms;
+  }
+  manifest_pending_ = false;
+}
+
+void WebmEncoder::WriteClusterIndexToDataSink(const LiveWebmMuxer& muxer) {
+  std::string index;
+  if (!muxer.WriteClusterIndex(&index)) {
+    LOG(ERROR) << "cannot write cluster index for muxer_id: "
+               << muxer.muxer_id();
+    return;
+  }
+  const std::string id = config_.dash_encode ?
+      config_.dash_name + "_" + muxer.muxer_id() + kClusterIndexSuffix :
+      kClusterIndexId;
+  if (!WaitForDataSink(id)) {
+    return;
+  }
+  if (!ptr_data_sink_->WriteData(reinterpret_cast<const uint8*>(index.data()),
+                                 static_cast<int32>(index.length()), id)) {
+    LOG(ERROR) << "data sink cluster index write failed for muxer_id: "
+               << muxer.muxer_id();
   }
+}
 
-  // TODO(tomfinegan): Update libwebm to handle non-monotonic timestamps on
-  //                   audio by buffering samples in some way, and get rid
-  //                   of this extra bit of audio handling code.
+void WebmEncoder::WriteThumbnailsToDataSink(bool wait) {
+  SharedDataChunk chunk;
+  std::string id;
+  if (standby_) {
+    while (thumbnail_generator_.TakeOutput(&chunk, &id)) {
+    }
+    return;
+  }
+  while ((wait ? !StopDeadlinePassed() &&
+                     ptr_data_sink_->WaitUntilReady(kMaxIdleWaitMs) :
+                 ptr_data_sink_->Ready()) &&
+         thumbnail_generator_.TakeOutput(&chunk, &id)) {
+    if (!ptr_data_sink_->WriteChunk(chunk, id)) {
+      LOG(ERROR) << "data sink thumbnail write failed: " << id;
+    }
+  }
+}
 
-  // Mux compressed audio stored because its buffer timestamp was greater than
-  // |video_timestamp|.
-  if (vorbis_buffered) {
-    status = ptr_muxer_->WriteAudioBuffer(vorb_buf);
+int WebmEncoder::PreviewHeaders() {
+  std::vector<const LiveWebmMuxer*> muxers;
+  if (ptr_muxer_)
+    muxers.push_back(ptr_muxer_.get());
+  if (ptr_muxer_aud_ && !config_.disable_audio)
+    muxers.push_back(ptr_muxer_aud_.get());
+  for (size_t i = 0; i < extra_audio_tracks_.size(); ++i)
+    muxers.push_back(extra_audio_tracks_[i]->muxer.get());
+  for (size_t i = 0; i < audio_representations_.size(); ++i)
+    muxers.push_back(audio_representations_[i]->muxer.get());
+  for (size_t i = 0; i < rep_muxers_.size(); ++i)
+    muxers.push_back(rep_muxers_[i].get());
+
+  for (size_t i = 0; i < muxers.size(); ++i) {
+    SharedDataChunk header;
+    const int status = muxers[i]->PreviewHeader(&header);
     if (status) {
-      LOG(ERROR) << "buffered audio mux failed: " << status;
-      return status;
+      LOG(ERROR) << "cannot preview header for muxer_id: "
+                 << muxers[i]->muxer_id() << " status: " << status;
+      return kWebmMuxerError;
     }
-    VLOG(4) << "muxed (buf, A) " << vorbis_audio_buffer_.timestamp() / 1000.0;
+    early_headers_[muxers[i]->muxer_id()] = header;
   }
   return kSuccess;
 }
 
-int WebmEncoder::DashEncode() {
-  // Encode a single audio buffer.
-  int status = EncodeAudioBuffer();
-  if (status) {
-    LOG(ERROR) << "EncodeAudioBuffer failed: " << status;
-    return status;
+void WebmEncoder::WriteEarlyHeadersToDataSink() {
+  while (!StopRequested() && !ptr_data_sink_->WaitUntilReady(kMaxIdleWaitMs))
+    VLOG(1) << "waiting for data sink before writing manifest.";
+  WriteManifestToDataSink();
+
+  typedef std::map<std::string, SharedDataChunk>::iterator HeaderIter;
+  HeaderIter it = early_headers_.begin();
+  while (it != early_headers_.end()) {
+    while (!StopRequested() &&
+           !ptr_data_sink_->WaitUntilReady(kMaxIdleWaitMs))
+      VLOG(1) << "waiting for data sink before writing header.";
+    const std::string id = NextChunkId(it->first, 0);
+    if (ptr_data_sink_->WriteChunk(it->second, id)) {
+      ++it;
+    } else {
+      // Forget the header so that the muxer's own copy is sent instead.
+      LOG(ERROR) << "data sink write failed for early header " << id;
+      it = early_headers_.erase(it);
+    }
   }
+  early_headers_sent_ = true;
+}
 
-  int64 video_timestamp;
-  status = PeekVideoTimestamp(&video_timestamp);
-  if (status < 0) {
-    LOG(ERROR) << "Video timestamp peek failed: " << status;
-    return status;
+bool WebmEncoder::EarlyHeaderSent(const std::string& muxer_id,
+                                  int64 chunk_num) const {
+  return early_headers_sent_ && chunk_num == 0 &&
+         early_headers_.find(muxer_id) != early_headers_.end();
+}
+
+VideoConfig WebmEncoder::RepresentationOutputConfig(size_t index) const {
+  if (!config_.video_svc) {
+    return rep_workers_[index]->output_config();
   }
+  VideoConfig output_config = rep_workers_[0]->output_config();
+  output_config.width = config_.video_representations[index].width;
+  output_config.height = config_.video_representations[index].height;
+  return output_config;
+}
 
-  // Read compressed audio until no more remains, or the compressed buffer
-  // timestamp is greater than |video_timestamp|.
-  bool vorbis_buffered = false;
-  AudioBuffer& vorb_buf = vorbis_audio_buffer_;
-  VorbisEncoder& vorb_enc = vorbis_encoder_;
-  while ((status = vorb_enc.ReadCompressedAudio(&vorb_buf)) == kSuccess) {
-    status = ptr_muxer_aud_->WriteAudioBuffer(vorb_buf);
-    if (status) {
-      LOG(ERROR) << "audio mux failed: " << status;
-      return status;
+int WebmEncoder::InitVideoRepresentations() {
+  const std::vector<VideoRepresentationConfig>& reps =
+      config_.video_representations;
+  for (size_t i = 0; i < reps.size(); ++i) {
+    int status = kSuccess;
+    VideoConfig vpx_video_config = config_.actual_video_config;
+    std::vector<uint8> codec_private_data;
+    if (!video_passthrough_) {
+      const size_t worker = config_.video_svc ? 0 : i;
+      vpx_video_config = RepresentationOutputConfig(i);
+      vpx_video_config.format = rep_workers_[worker]->codec();
+      rep_workers_[worker]->GetCodecPrivate(&codec_private_data);
+    }
+    VideoCodecPrivate codec_private;
+    if (!codec_private_data.empty()) {
+      codec_private.ptr_data = &codec_private_data[0];
+      codec_private.length = static_cast<int32>(codec_private_data.size());
     }
-    VLOG(4) << "muxed (A) " << vorbis_audio_buffer_.timestamp() / 1000.0;
 
-    // Keep stream time reasonably close.
-    if (vorb_enc.time_encoded() > video_timestamp)
-      break;
-  }
+    // Without DASH the only representation shares |ptr_muxer_| with audio.
+    // DASH encodes add the first representation to it too, once: a
+    // reconfiguration keeps the track.
+    if (i == 0 && ptr_muxer_ && !initialized_) {
+      status = ptr_muxer_->AddTrack(vpx_video_config, codec_private);
+      if (status) {
+        LOG(ERROR) << "live muxer AddTrack(video) failed " << status;
+        return kInitFailed;
+      }
+    }
+    if (!config_.dash_encode) {
+      continue;
+    }
 
-  // Attempt to encode video frames when |video_timestamp| is less than the
-  // next estimated compressed audio buffer timestamp.
-  while (status != BufferPool<VideoFrame>::kEmpty) {
-    VLOG(3) << "attempting video mux vid_ts=" << video_timestamp
-            << " vorb_enc time_encoded=" << vorb_enc.time_encoded();
-    status = EncodeVideoFrame();
+    std::unique_ptr<LiveWebmMuxer> muxer;
+    const int chunk_duration = config_.cluster_duration > 0 ?
+        config_.vpx_config.keyframe_interval : 0;
+    status = InitMuxer(config_, config_.cluster_duration, chunk_duration,
+                       config_.chunk_byte_budget, RepresentationMuxerId(i),
+                       &muxer);
     if (status) {
-      LOG(ERROR) << "EncodeVideoFrame failed: " << status;
+      LOG(ERROR) << "InitMuxer (V" << i << ") failed: " << status;
       return status;
     }
-    status = PeekVideoTimestamp(&video_timestamp);
-    if (status < 0) {
-      LOG(ERROR) << "Video timestamp peek failed: " << status;
-      return status;
+    status = muxer->AddTrack(vpx_video_config, codec_private);
+    if (status) {
+      LOG(ERROR) << "live muxer AddTrack(video " << i << ") failed " << status;
+      return kInitFailed;
     }
-
-    // Keep stream time reasonably close.
-    if (video_timestamp > vorb_enc.time_encoded())
-      break;
+    rep_muxers_.push_back(std::move(muxer));
   }
   return kSuccess;
 }
 
-
-// Reads, compresses and muxes one video frame.
-// - Attempts to read one frame from |video_pool_|, and compresses it using
-//   |video_encoder_| when a frame is available.
-// - Passes the compressed frame to the video muxer for muxing.
-int WebmEncoder::EncodeVideoFrame() {
-  LiveWebmMuxer* video_muxer;
-  if (config_.dash_encode) {
-    video_muxer = ptr_muxer_vid_.get();
-  } else {
-    video_muxer = ptr_muxer_.get();
+void WebmEncoder::StopEncodeWorkers(bool write_last_chunks) {
+  // The audio worker compresses everything it was given before it exits.
+  if (audio_worker_) {
+    audio_worker_->Stop();
   }
-
-  // Try reading a video frame from the pool.
-  int status = video_pool_.Decommit(&raw_frame_);
-  if (status) {
-    if (status != BufferPool<VideoFrame>::kEmpty) {
-      LOG(ERROR) << "VideoFrame pool Decommit failed! " << status;
-      return kVideoSinkError;
-    }
-    VLOG(4) << "No frames in VideoFrame pool";
-    return kSuccess;
+  for (size_t i = 0; i < extra_audio_tracks_.size(); ++i) {
+    extra_audio_tracks_[i]->worker->Stop();
+  }
+  for (size_t i = 0; i < audio_representations_.size(); ++i) {
+    audio_representations_[i]->worker->Stop();
+  }
+  for (size_t i = 0; i < rep_workers_.size(); ++i) {
+    rep_workers_[i]->Stop();
+  }
+  thumbnail_generator_.Stop();
+  if (!write_last_chunks) {
+    FinalizeArchive();
+    return;
+  }
+  if (config_.stop_timeout_ms > 0) {
+    stop_deadline_ms_ = SteadyClockMilliseconds() + config_.stop_timeout_ms;
   }
 
-  VLOG(4) << "Encoder thread read raw frame.";
-
-  status = OffsetTimestamp(timestamp_offset_, &raw_frame_);
+  // Mux packets compressed after the last encode pass. Then call
+  // |LiveWebmMuxer::Finalize()| on every muxer to flush any buffered samples,
+  // and write the final chunks back to back so that the data sink uploads
+  // them concurrently, before the manifest and the cluster indexes.
+  int status = MuxEncodedPackets(true);
   if (status) {
-    LOG(ERROR) << "Video frame timestamp offset failed: " << status;
-    return kVideoEncoderError;
+    LOG(ERROR) << "Failed to mux the last packets: " << status;
+  }
+  FinalizeArchive();
+  std::vector<std::unique_ptr<LiveWebmMuxer>*> muxers;
+  if (ptr_muxer_) {
+    muxers.push_back(&ptr_muxer_);
+  }
+  if (config_.dash_encode) {
+    if (ptr_muxer_aud_ && !config_.disable_audio)
+      muxers.push_back(&ptr_muxer_aud_);
+    for (size_t i = 0; i < extra_audio_tracks_.size(); ++i)
+      muxers.push_back(&extra_audio_tracks_[i]->muxer);
+    for (size_t i = 0; i < audio_representations_.size(); ++i)
+      muxers.push_back(&audio_representations_[i]->muxer);
+    for (size_t i = 0; i < rep_muxers_.size(); ++i)
+      muxers.push_back(&rep_muxers_[i]);
+  }
+  std::vector<std::unique_ptr<LiveWebmMuxer>*> finalized;
+  for (size_t i = 0; i < muxers.size(); ++i) {
+    if (FinalizeMuxer(muxers[i]) == kSuccess)
+      finalized.push_back(muxers[i]);
+  }
+  for (size_t i = 0; i < finalized.size(); ++i) {
+    WriteFinalChunkToDataSink(finalized[i]);
+  }
+  if (manifest_pending_ && WaitForDataSink(kManifestId)) {
+    WriteManifestToDataSink();
+  }
+  if (config_.cluster_index) {
+    for (size_t i = 0; i < finalized.size(); ++i)
+      WriteClusterIndexToDataSink(**finalized[i]);
   }
 
-  // Encode the video frame, and pass it to the muxer.
-  status = video_encoder_.EncodeFrame(raw_frame_, &vpx_frame_);
-  if (status == kDropped) {
-    return kSuccess;
-  } else if (status) {
-    LOG(ERROR) << "Video frame encode failed: " << status;
-    return kVideoEncoderError;
+  // Every chunk is in the manifest once the last ones are written.
+  if (config_.dash_encode && config_.dash_vod_manifest &&
+      dash_writer_->EndPresentation() && WaitForDataSink(kManifestId)) {
+    WriteManifestToDataSink();
   }
 
-  // Update encoded duration if able to obtain the lock.
-  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
-  if (lock.owns_lock()) {
-    encoded_duration_ = std::max(vpx_frame_.timestamp(), encoded_duration_);
+  // Thumbnails go last: they are not needed to play the stream.
+  WriteThumbnailsToDataSink(true);
+  if (stop_abandoned_writes_ > 0) {
+    LOG(WARNING) << "stop abandoned " << stop_abandoned_writes_
+                 << " final writes after " << config_.stop_timeout_ms
+                 << " ms.";
   }
+}
 
-  status = video_muxer->WriteVideoFrame(vpx_frame_);
-  if (status) {
-    LOG(ERROR) << "Video frame mux failed: " << status;
+bool WebmEncoder::StopDeadlinePassed() const {
+  return stop_deadline_ms_ > 0 &&
+         SteadyClockMilliseconds() >= stop_deadline_ms_;
+}
+
+void WebmEncoder::AccountVideoQueueDrops() {
+  const int64 dropped_count = video_pool_.stats().dropped_count;
+  const int64 new_drops = dropped_count - video_queue_drops_;
+  if (new_drops <= 0) {
+    return;
   }
-  VLOG(3) << "muxed (V) " << vpx_frame_.timestamp() / 1000.0;
-  return status;
+  video_queue_drops_ = dropped_count;
+  capture_frames_dropped_ += new_drops;
+  ptr_capture_frames_dropped_->Increment(new_drops);
+  ptr_video_queue_drops_->Increment(new_drops);
+  ptr_video_pool_frames_->Decrement(new_drops);
+  VLOG(1) << "VideoFrame pool dropped " << new_drops << " stale frames.";
 }
 
-int WebmEncoder::EncodeAudioBuffer() {
-  // Try reading an audio buffer from the pool.
-  int status = audio_pool_.Decommit(&raw_audio_buffer_);
-  if (status) {
-    if (status != BufferPool<AudioBuffer>::kEmpty) {
-      // Really an error; not just an empty pool.
-      LOG(ERROR) << "AudioBuffer pool Decommit failed! " << status;
-      return kAudioSinkError;
+void WebmEncoder::WriteStreamingChunksToDataSink(
+    std::unique_ptr<LiveWebmMuxer>* muxer) {
+  if (!config_.low_latency_upload)
+    return;
+  SharedStreamingChunk chunk;
+  int64 chunk_num = 0;
+  while ((*muxer)->TakeStreamingChunk(&chunk, &chunk_num)) {
+    if (EarlyHeaderSent((*muxer)->muxer_id(), chunk_num))
+      continue;
+    const std::string id = NextChunkId((*muxer)->muxer_id(), chunk_num);
+    if (!ptr_data_sink_->WriteStreamingChunk(chunk, id)) {
+      LOG(WARNING) << "data sink did not accept streaming chunk " << id;
     }
-    VLOG(4) << "No buffers in AudioBuffer pool";
-  } else {
-    VLOG(4) << "Encoder thread read raw audio buffer.";
+  }
+}
 
-    status = OffsetTimestamp(timestamp_offset_, &raw_audio_buffer_);
-    if (status) {
-      LOG(ERROR) << "audio timestamp offset failed: " << status;
-      return kAudioEncoderError;
+int WebmEncoder::InitMetrics() {
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  const std::string& labels = config_.metrics_labels;
+  ptr_video_pool_frames_ = registry.GetGauge(
+      "webmlive_video_pool_frames", labels,
+      "Raw video frames waiting for the encoder thread.");
+  ptr_audio_pool_buffers_ = registry.GetGauge(
+      "webmlive_audio_pool_buffers", labels,
+      "Raw audio buffers waiting for the encoder thread.");
+  ptr_capture_frames_dropped_ = registry.GetCounter(
+      "webmlive_capture_frames_dropped_total", labels,
+      "Raw video frames dropped because the video pool was full, or by its "
+      "queue policy.");
+  ptr_video_queue_drops_ = registry.GetCounter(
+      "webmlive_video_queue_drops_total", labels,
+      "Raw video frames dropped unread by the video queue policy.");
+  ptr_overload_level_ = registry.GetGauge(
+      "webmlive_overload_level", labels,
+      "Video degradation level keeping audio on time: 0 normal, 1 faster "
+      "encoding, 2 decimation, 3 dropping three of four frames.");
+  ptr_audio_mux_lag_ms_ = registry.GetGauge(
+      "webmlive_audio_mux_lag_ms", labels,
+      "Time captured audio waits before it is muxed.");
+  ptr_capture_frames_missed_ = registry.GetCounter(
+      "webmlive_capture_frames_missed_total", labels,
+      "Video frames the capture device missed, found by timestamp smoothing.");
+  ptr_audio_drift_ppm_ = registry.GetGauge(
+      "webmlive_audio_clock_drift_ppm", labels,
+      "Rate of the audio sample clock relative to the capture clock.");
+  ptr_audio_sync_error_us_ = registry.GetGauge(
+      "webmlive_audio_sync_error_us", labels,
+      "Smoothed lag of the audio timeline behind the capture timestamps.");
+  static const char* const kStallStages[kNumStallStages] = {
+    "capture", "encode",
+  };
+  for (int i = 0; i < kNumStallStages; ++i) {
+    ptr_stalls_[i] = registry.GetCounter(
+        "webmlive_stalls_total",
+        MetricsRegistry::JoinLabels(
+            labels, std::string("stage=\"") + kStallStages[i] + "\""),
+        "Stalls found by the stall watchdog.");
+    if (!ptr_stalls_[i]) {
+      return kNoMemory;
     }
+  }
+  ptr_capture_restarts_ = registry.GetCounter(
+      "webmlive_capture_restarts_total", labels,
+      "Media source restarts after a failure or a capture stall.");
+  ptr_capture_restart_failures_ = registry.GetCounter(
+      "webmlive_capture_restart_failures_total", labels,
+      "Media source restarts that failed, and were retried.");
+  ptr_slate_frames_ = registry.GetCounter(
+      "webmlive_slate_frames_total", labels,
+      "Slate frames muxed in place of lost video.");
+  ptr_stop_abandoned_writes_ = registry.GetCounter(
+      "webmlive_stop_abandoned_writes_total", labels,
+      "Final chunks, manifests and indexes abandoned at the stop deadline.");
+  if (!ptr_video_pool_frames_ || !ptr_audio_pool_buffers_ ||
+      !ptr_capture_frames_dropped_ || !ptr_capture_frames_missed_ ||
+      !ptr_video_queue_drops_ ||
+      !ptr_overload_level_ || !ptr_audio_mux_lag_ms_ ||
+      !ptr_audio_drift_ppm_ ||
+      !ptr_audio_sync_error_us_ ||
+      !ptr_capture_restarts_ || !ptr_capture_restart_failures_ ||
+      !ptr_slate_frames_ || !ptr_stop_abandoned_writes_ ||
+      InitPoolMetrics("video", &video_pool_sizing_) ||
+      InitPoolMetrics("audio", &audio_pool_sizing_)) {
+    return kNoMemory;
+  }
+  MemoryGovernor& governor = MemoryGovernor::Instance();
+  ptr_capture_memory_ =
+      governor.GetAccount(kMemoryCapturePools, labels, "");
+  ptr_muxer_memory_ = governor.GetAccount(kMemoryMuxerBuffers, labels, "");
+  if (!ptr_capture_memory_ || !ptr_muxer_memory_) {
+    return kNoMemory;
+  }
+  trace_stream_id_ = Tracepoints::StreamId(labels);
 
-    // Pass the uncompressed audio to libvorbis.
-    status = vorbis_encoder_.Encode(raw_audio_buffer_);
-    if (status) {
-      LOG(ERROR) << "vorbis encode failed " << status;
-      return kAudioEncoderError;
-    }
+  // The pools start empty.
+  ptr_video_pool_frames_->Set(0);
+  ptr_audio_pool_buffers_->Set(0);
+  return kSuccess;
+}
+
+int WebmEncoder::InitPoolMetrics(const std::string& pool,
+                                 RawPoolSizing* ptr_sizing) {
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  const std::string labels = MetricsRegistry::JoinLabels(
+      config_.metrics_labels, "pool=\"" + pool + "\"");
+  ptr_sizing->ptr_limit = registry.GetGauge(
+      "webmlive_raw_pool_limit", labels,
+      "Raw samples the pool may hold before it drops input.");
+  ptr_sizing->ptr_high_water = registry.GetGauge(
+      "webmlive_raw_pool_high_water", labels,
+      "Most raw samples the pool has held at once.");
+  ptr_sizing->ptr_grow_count = registry.GetCounter(
+      "webmlive_raw_pool_grow_total", labels,
+      "Buffers allocated when the pool grew.");
+  ptr_sizing->ptr_shrink_count = registry.GetCounter(
+      "webmlive_raw_pool_shrink_total", labels,
+      "Buffers freed when the pool shrank.");
+  ptr_sizing->ptr_full_count = registry.GetCounter(
+      "webmlive_raw_pool_full_total", labels,
+      "Raw samples dropped because the pool was at its limit.");
+  if (!ptr_sizing->ptr_limit || !ptr_sizing->ptr_high_water ||
+      !ptr_sizing->ptr_grow_count || !ptr_sizing->ptr_shrink_count ||
+      !ptr_sizing->ptr_full_count) {
+    return kNoMemory;
   }
+  ptr_sizing->ptr_limit->Set(0);
+  ptr_sizing->ptr_high_water->Set(0);
   return kSuccess;
 }
 
-int WebmEncoder::WaitForSamples() {
-  // Wait for samples from the input stream(s).
-  bool got_audio = config_.disable_audio;
-  bool got_video = config_.disable_video;
-  for (;;) {
-    if (StopRequested()) {
-      return kSuccess;
-    }
-    if (!got_audio) {
-      got_audio = !audio_pool_.IsEmpty();
-    }
-    if (!got_video) {
-      got_video = !video_pool_.IsEmpty();
+void WebmEncoder::InitAudioPoolSizing(const AudioBuffer& buffer) {
+  if (buffer.duration() <= 0 || buffer.buffer_length() <= 0) {
+    return;
+  }
+  const double buffers_per_second = 1000.0 / buffer.duration();
+  const int64 budget_bytes =
+      static_cast<int64>(config_.pool_memory_budget_mb) * 1024 * 1024;
+  const int64 budget_buffers = budget_bytes / buffer.buffer_length();
+  const int64 time_buffers =
+      static_cast<int64>(buffers_per_second * kMaxAudioPoolSeconds);
+  const int32 min_buffers = BufferPool<AudioBuffer>::kDefaultBufferCount;
+  const int32 initial_buffers =
+      std::max(min_buffers, audio_pool_.Capacity());
+  const int32 max_buffers = std::max(
+      initial_buffers,
+      static_cast<int32>(std::min(budget_buffers, time_buffers)));
+  if (audio_pool_sizing_.sizer.Init(min_buffers, initial_buffers, max_buffers,
+                                    buffers_per_second)) {
+    return;
+  }
+  audio_pool_.SetLimit(initial_buffers);
+  audio_pool_sizing_.enabled = true;
+  LOG(INFO) << "audio pool limit " << initial_buffers << ", at most "
+            << max_buffers << " buffers.";
+}
+
+bool WebmEncoder::UpdatePoolSizing(int64 time_ms, int32 queued,
+                                   const BufferPoolStats& stats,
+                                   RawPoolSizing* ptr_sizing) {
+  const BufferPoolStats& last = ptr_sizing->last_stats;
+  const bool dropped = stats.full_count > last.full_count;
+  ptr_sizing->ptr_grow_count->Increment(stats.grow_count - last.grow_count);
+  ptr_sizing->ptr_shrink_count->Increment(
+      stats.shrink_count - last.shrink_count);
+  ptr_sizing->ptr_full_count->Increment(stats.full_count - last.full_count);
+  ptr_sizing->ptr_high_water->Set(stats.high_water);
+  ptr_sizing->last_stats = stats;
+
+  const bool changed = ptr_sizing->sizer.Update(time_ms, encode_pass_time_ms_,
+                                                queued, dropped);
+  ptr_sizing->ptr_limit->Set(ptr_sizing->sizer.limit());
+  return changed;
+}
+
+int WebmEncoder::InitCongestionController() {
+  // Thresholds are set in time; convert buffered bytes using the combined
+  // bitrate of all video streams.
+  CongestionControllerConfig controller_config;
+  const std::vector<VideoRepresentationConfig>& reps =
+      config_.video_representations;
+  if (reps.empty()) {
+    controller_config.video_bitrate_kbps = config_.vpx_config.bitrate;
+  } else {
+    for (size_t i = 0; i < reps.size(); ++i) {
+      controller_config.video_bitrate_kbps +=
+          reps[i].bitrate > 0 ? reps[i].bitrate : config_.vpx_config.bitrate;
     }
-    if (got_audio && got_video) {
+  }
+  const int num_streams = reps.empty() ? 1 : static_cast<int>(reps.size());
+  return congestion_controller_.Init(controller_config, num_streams);
+}
+
+void WebmEncoder::UpdateCongestion() {
+  int64 backlog_bytes = 0;
+  if (ptr_muxer_)
+    backlog_bytes += ptr_muxer_->buffered_bytes();
+  for (size_t i = 0; i < rep_muxers_.size(); ++i)
+    backlog_bytes += rep_muxers_[i]->buffered_bytes();
+
+  congestion_controller_.Update(backlog_bytes, video_pool_.ActiveCount(),
+                                video_pool_.Capacity());
+  congestion_stats_.Store(congestion_controller_.stats());
+}
+
+int WebmEncoder::InitOverloadGovernor() {
+  OverloadGovernorConfig governor_config;
+  // Without audio there is nothing to protect.
+  if (!config_.disable_audio)
+    governor_config.audio_deadline_ms = config_.audio_deadline_ms;
+  return overload_governor_.Init(governor_config);
+}
+
+void WebmEncoder::UpdateOverload() {
+  if (overload_governor_.enabled() && audio_muxed_time_ >= 0) {
+    const int64 audio_lag_ms = std::max<int64>(
+        audio_captured_time_.load() + timestamp_offset_ - audio_muxed_time_,
+        0);
+    ptr_audio_mux_lag_ms_->Set(audio_lag_ms);
+    overload_governor_.Update(audio_lag_ms, SteadyClockMilliseconds());
+    ptr_overload_level_->Set(overload_governor_.level());
+  }
+
+  // Applied every pass so that workers created by a reconfigure get it too;
+  // encoders act only on changes.
+  const int boost =
+      std::max(overload_governor_.speed_boost(), speed_boost_.load());
+  for (size_t i = 0; i < rep_workers_.size(); ++i)
+    rep_workers_[i]->SetSpeedBoost(boost);
+}
+
+void WebmEncoder::TraceChunkWrite(const LiveWebmMuxer& muxer) {
+  int64 start = 0;
+  int64 duration = 0;
+  if (!muxer.ChunkTiming(&start, &duration))
+    return;
+  WEBMLIVE_TRACE_FRAME(chunk_ready, trace_stream_id_, start);
+  if (!LatencyTracer::enabled())
+    return;
+  LatencyTracer::Stamp(LatencyTracer::kChunkReady, start);
+  traced_upload_time_ = start;
+}
+
+void WebmEncoder::UpdateLatencyStats() {
+  if (config_.rate_control_telemetry)
+    config_.rate_control_telemetry->Collect();
+  if (!LatencyTracer::enabled())
+    return;
+  latency_collector_.Collect(timestamp_offset_);
+  latency_stats_.Store(latency_collector_.stats());
+}
+
+void WebmEncoder::UpdateMemoryUsage() {
+  ptr_capture_memory_->Set(
+      static_cast<int64>(video_pool_.Capacity()) * video_frame_bytes_.load() +
+      static_cast<int64>(audio_pool_.Capacity()) *
+          audio_buffer_bytes_.load());
+
+  int64 muxer_bytes = 0;
+  if (ptr_muxer_)
+    muxer_bytes += ptr_muxer_->buffered_bytes();
+  if (ptr_muxer_aud_)
+    muxer_bytes += ptr_muxer_aud_->buffered_bytes();
+  for (size_t i = 0; i < extra_audio_tracks_.size(); ++i)
+    muxer_bytes += extra_audio_tracks_[i]->muxer->buffered_bytes();
+  for (size_t i = 0; i < audio_representations_.size(); ++i)
+    muxer_bytes += audio_representations_[i]->muxer->buffered_bytes();
+  for (size_t i = 0; i < rep_muxers_.size(); ++i)
+    muxer_bytes += rep_muxers_[i]->buffered_bytes();
+  ptr_muxer_memory_->Set(muxer_bytes);
+
+  // Decimating halves the output rate, and dropping GOPs stops the muxer
+  // buffers from growing.
+  switch (ptr_muxer_memory_->pressure()) {
+    case kMemoryCritical:
+      congestion_controller_.set_min_level(CongestionController::kDropGops);
+      break;
+    case kMemoryHigh:
+      congestion_controller_.set_min_level(CongestionController::kDecimate);
+      break;
+    default:
+      congestion_controller_.set_min_level(CongestionController::kNormal);
       break;
-    }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
   }
+}
 
-  int64 first_audio_timestamp = 0;
-  if (!config_.disable_audio) {
-    int64& a_ts = first_audio_timestamp;
-    const int status = audio_pool_.ActiveBufferTimestamp(&a_ts);
-    if (status) {
-      LOG(ERROR) << "cannot read first audio timestamp: " << status;
-      return status;
-    }
+bool WebmEncoder::MayResizePool(int32 limit, int32 new_limit) {
+  return new_limit <= limit || ptr_capture_memory_->MayGrow();
+}
+
+int64 WebmEncoder::ReadyChunkNumber(const LiveWebmMuxer& muxer) const {
+  const int64 chunk_num = muxer.chunks_read();
+  int64 start = 0;
+  int64 duration = 0;
+  if (chunk_num == 0 || !muxer.ChunkTiming(&start, &duration))
+    return chunk_num;
+  if (gop_scheduler_.aligned())
+    return gop_scheduler_.AlignedSegmentNumber(start);
+  for (size_t i = 0; i < rep_muxers_.size(); ++i) {
+    if (rep_muxers_[i].get() != &muxer)
+      continue;
+    const int64 segment = gop_scheduler_.SegmentNumber(start);
+    if (segment < 0)
+      return chunk_num;
+    LOG_IF(WARNING, segment != chunk_num)
+        << "chunk " << chunk_num << " (V" << i << ") is scheduled segment "
+        << segment;
+    return segment;
   }
+  return chunk_num;
+}
 
-  int64 first_video_timestamp = 0;
-  if (!config_.disable_video) {
-    int64& v_ts = first_video_timestamp;
-    const int status = video_pool_.ActiveBufferTimestamp(&v_ts);
-    if (status) {
-      LOG(ERROR) << "cannot read first video timestamp: " << status;
-      return status;
-    }
+int WebmEncoder::InitStandby() {
+  if (config_.standby_heartbeat.empty()) {
+    return kSuccess;
+  }
+  if (heartbeat_.Open(config_.standby_heartbeat)) {
+    LOG(ERROR) << "cannot open standby heartbeat "
+               << config_.standby_heartbeat;
+    return kInitFailed;
   }
 
-  if (first_audio_timestamp < 0 && first_video_timestamp < 0) {
-    const int first_a_ts = std::abs(static_cast<int>(first_audio_timestamp));
-    const int first_v_ts = std::abs(static_cast<int>(first_video_timestamp));
-    timestamp_offset_ = std::max(first_a_ts, first_v_ts);
-  } else if (first_audio_timestamp < 0) {
-    const int first_a_ts = std::abs(static_cast<int>(first_audio_timestamp));
-    timestamp_offset_ = first_a_ts;
-  } else if (first_video_timestamp < 0) {
-    const int first_v_ts = std::abs(static_cast<int>(first_video_timestamp));
-    timestamp_offset_ = first_v_ts;
+  // Enough chunks for the primary's last segment, and for those completed
+  // while its beats were missed.
+  max_held_chunks_ = static_cast<size_t>(
+      config_.standby_timeout_ms / config_.vpx_config.keyframe_interval) + 2;
+  standby_ = config_.standby;
+  if (standby_) {
+    LOG(INFO) << "on standby for " << config_.standby_heartbeat << ".";
+    return kSuccess;
+  }
+  if (heartbeat_.TakeOwnership(dash_writer_->availability_start_time(),
+                               -1)) {
+    LOG(ERROR) << "cannot own standby heartbeat.";
+    return kInitFailed;
   }
-  LOG(INFO) << "WebmEncoder timestamp_offset_=" << timestamp_offset_;
   return kSuccess;
 }
 
-int WebmEncoder::PeekVideoTimestamp(int64* timestamp) {
-  CHECK_NOTNULL(timestamp);
-  const int status = video_pool_.ActiveBufferTimestamp(timestamp);
-  if (status < 0) {
-    LOG(ERROR) << "VideoFrame pool timestamp check failed: " << status;
-    return kVideoSinkError;
+int WebmEncoder::HoldMuxerChunk(std::unique_ptr<LiveWebmMuxer>* muxer) {
+  int32 chunk_length = 0;
+  if (!(*muxer)->ChunkReady(&chunk_length)) {
+    return kSuccess;
   }
-  if (status == BufferPool<VideoFrame>::kEmpty) {
-    // When |video_pool_| is empty use the timestamp of the last encoded video
-    // frame added to the calculated time per frame.
-    const int time_per_frame =
-        static_cast<int>(kTimebase / config_.actual_video_config.frame_rate);
-    *timestamp = video_encoder_.last_timestamp() + time_per_frame;
-    VLOG(3) << "NO video frame available ts=" << *timestamp;
-  } else {
-    *timestamp += timestamp_offset_;
-    VLOG(3) << "video frame available ts=" << *timestamp;
+  HeldChunk held;
+  held.number = ReadyChunkNumber(**muxer);
+  held.id = NextChunkId((*muxer)->muxer_id(), held.number);
+  if (!ReadChunkFromMuxer(muxer, &held.chunk)) {
+    LOG(ERROR) << "cannot read WebM chunk from muxer_id: "
+               << (*muxer)->muxer_id();
+    return kWebmMuxerError;
   }
-  return status;
+
+  // The first chunk after the metadata chunk starts where the standby began
+  // reading, partway through its segment: the primary's chunk stands.
+  if ((*muxer)->chunks_read() == 2) {
+    return kSuccess;
+  }
+  AddChunkToManifest(**muxer, chunk_length);
+  std::deque<HeldChunk>& chunks = held_chunks_[(*muxer)->muxer_id()];
+  chunks.push_back(held);
+  if (chunks.size() > max_held_chunks_ + 1) {
+    // Keep the metadata chunk.
+    chunks.erase(chunks.begin() + 1);
+  }
+  return kSuccess;
 }
 
-int WebmEncoder::WriteMuxerChunkToDataSink(
-    std::unique_ptr<LiveWebmMuxer>* muxer) {
-  if (ptr_data_sink_->Ready()) {
-    int32 chunk_length = 0;
-    const bool chunk_ready = (*muxer)->ChunkReady(&chunk_length);
-    if (chunk_ready) {
-      const int64 chunk_num = (*muxer)->chunks_read();
-      std::string id = NextChunkId((*muxer)->muxer_id(), chunk_num);
-      // A complete chunk is waiting in |muxer|'s buffer.
-      if (!ReadChunkFromMuxer(muxer, chunk_length)) {
-        LOG(ERROR) << "cannot read WebM chunk from muxer_id: "
-                   << (*muxer)->muxer_id();
-        return kWebmMuxerError;
-      }
-#if 0
-      // Pass the chunk to |ptr_data_sink_|.
-      if (!ptr_data_sink_->WriteData(chunk_buffer_.get(), chunk_length, id)) {
-        LOG(ERROR) << "data sink write failed!";
-        return kDataSinkWriteFail;
-      }
-#endif
-      // HACK: HERE BE DRAGONS
-      CHECK(WriteChunkFile(config_.dash_dir + id,
-                           chunk_buffer_.get(), chunk_length));
+int WebmEncoder::UpdateStandby() {
+  if (config_.standby_heartbeat.empty()) {
+    return kSuccess;
+  }
+  if (standby_) {
+    if (heartbeat_.OwnerAlive(config_.standby_timeout_ms)) {
+      return kSuccess;
     }
+    return TakeOverStream();
+  }
+
+  // A segment is written once every muxer wrote its chunk.
+  int64 last_segment = -1;
+  typedef std::map<std::string, int64>::const_iterator SegmentIter;
+  for (SegmentIter it = written_segments_.begin();
+       it != written_segments_.end(); ++it) {
+    if (last_segment < 0 || it->second < last_segment)
+      last_segment = it->second;
+  }
+  if (heartbeat_.Beat(last_segment) == StandbyHeartbeat::kSuperseded) {
+    LOG(ERROR) << "another encoder took over the stream, stopping...";
+    return kStreamTakenOver;
   }
   return kSuccess;
 }
 
-int WebmEncoder::WriteLastMuxerChunkToDataSink(
-    std::unique_ptr<LiveWebmMuxer>* muxer) {
-  int status = (*muxer)->Finalize();
+int WebmEncoder::TakeOverStream() {
+  const int64 last_segment = heartbeat_.last_segment();
+  LOG(WARNING) << "primary heartbeat stopped after segment " << last_segment
+               << "; taking over the stream.";
+  standby_ = false;
+  int status = ptr_media_source_->Promote();
   if (status) {
-    LOG(ERROR) << "muxer Finalize failed, muxer_id: " << (*muxer)->muxer_id()
-               << " status: " << status;
+    LOG(ERROR) << "media source Promote failed: " << status;
     return status;
   }
-  int32 chunk_length = 0;
-  if ((*muxer)->ChunkReady(&chunk_length)) {
-    LOG(INFO) << "mkvmuxer Finalize produced a chunk.";
-    const int64 chunk_num = (*muxer)->chunks_read();
-    std::string id = NextChunkId((*muxer)->muxer_id(), chunk_num);
-
-    while (!ptr_data_sink_->Ready())
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
-
-    if (ReadChunkFromMuxer(muxer, chunk_length)) {
-#if 0
-      const bool sink_write_ok =
-          ptr_data_sink_->WriteData(chunk_buffer_.get(), chunk_length, id);
-      if (!sink_write_ok) {
-        LOG(ERROR) << "data sink write fail on final chunk for muxer_id:"
-                   << (*muxer)->muxer_id();
-      } else {
-        LOG(INFO) << "Final chunk upload initiated.";
+
+  // Players keep the timing of the primary's manifest.
+  const int64 stream_start = heartbeat_.stream_start();
+  if (stream_start > 0 &&
+      !dash_writer_->SetAvailabilityStartTime(stream_start)) {
+    LOG(ERROR) << "cannot keep the primary's availability start time.";
+  }
+  status = heartbeat_.TakeOwnership(dash_writer_->availability_start_time(),
+                                    last_segment);
+  if (status) {
+    LOG(ERROR) << "cannot own standby heartbeat: " << status;
+    return kRunFailed;
+  }
+
+  // The primary's last segment may not have reached the sink; write it
+  // again along with the metadata chunks and the segments after it.
+  typedef std::map<std::string, std::deque<HeldChunk> >::const_iterator
+      HeldIter;
+  for (HeldIter it = held_chunks_.begin(); it != held_chunks_.end(); ++it) {
+    const std::deque<HeldChunk>& chunks = it->second;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+      const HeldChunk& held = chunks[i];
+      if (held.number > 0 && held.number < last_segment) {
+        continue;
+      }
+      if (!WaitForDataSink(held.id) ||
+          !ptr_data_sink_->WriteChunk(held.chunk, held.id)) {
+        LOG(ERROR) << "data sink write failed for held chunk " << held.id;
+        return kDataSinkWriteFail;
+      }
+      if (held.number > 0) {
+        written_segments_[it->first] = held.number;
       }
-#endif
-      // HACK: HERE BE DRAGONS
-      CHECK(WriteChunkFile(config_.dash_dir + id,
-                           chunk_buffer_.get(), chunk_length));
     }
   }
-  return status;
+  held_chunks_.clear();
+  manifest_pending_ = true;
+  if (WaitForDataSink(kManifestId)) {
+    WriteManifestToDataSink();
+  }
+  return kSuccess;
 }
 
 std::string WebmEncoder::NextChunkId(const std::string& muxer_id,
                                      int64 chunk_num) const {
   std::string id;
-  if (config_.dash_encode) {
+  if (config_.dash_encode && muxer_id == kMuxedId) {
+    std::ostringstream muxed_id;
+    muxed_id << config_.dash_name << "_" << kMuxedId;
+    if (chunk_num == 0)
+      muxed_id << ".hdr";
+    else
+      muxed_id << "_" << chunk_num << ".chk";
+    id = muxed_id.str();
+  } else if (config_.dash_encode) {
     AdaptationSet::MediaType media_type = (muxer_id == kAudioId) ?
         AdaptationSet::kAudio : AdaptationSet::kVideo;
     id = dash_writer_->IdForChunk(media_type, chunk_num);
+    for (size_t i = 0; i < rep_muxers_.size(); ++i) {
+      if (rep_muxers_[i]->muxer_id() == muxer_id) {
+        id = dash_writer_->IdForVideoChunk(static_cast<int>(i), chunk_num);
+        break;
+      }
+    }
+    for (size_t i = 0; i < extra_audio_tracks_.size(); ++i) {
+      if (extra_audio_tracks_[i]->muxer->muxer_id() == muxer_id) {
+        id = dash_writer_->IdForAudioChunk(extra_audio_tracks_[i]->index,
+                                           chunk_num);
+        break;
+      }
+    }
+    for (size_t i = 0; i < audio_representations_.size(); ++i) {
+      if (audio_representations_[i]->muxer->muxer_id() == muxer_id) {
+        id = dash_writer_->IdForAudioRepresentationChunk(
+            audio_representations_[i]->index, chunk_num);
+        break;
+      }
+    }
   } else {
     const char kHeader[] = "header";
     const char kChunk[] = "chunk";
@@ -898,7 +3643,7 @@ std::string WebmEncoder::NextChunkId(const std::string& muxer_id,
     else
       id = kChunk;
   }
-  LOG(INFO) << "chunk id: " << id;
+  WEBMLIVE_TRACE(TraceLog::kChunk, "chunk_id") << " id=" << id;
   return id;
 }
 
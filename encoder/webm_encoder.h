@@ -8,24 +8,98 @@
 #ifndef WEBMLIVE_ENCODER_WEBM_ENCODER_H_
 #define WEBMLIVE_ENCODER_WEBM_ENCODER_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "encoder/audio_encoder.h"
+#include "encoder/audio_mixer.h"
 #include "encoder/basictypes.h"
 #include "encoder/buffer_pool.h"
+#include "encoder/congestion_controller.h"
 #include "encoder/encoder_base.h"
 #include "encoder/data_sink.h"
+#include "encoder/deinterlacer.h"
+#include "encoder/frame_analyzer.h"
+#include "encoder/frame_overlay.h"
+#include "encoder/gop_scheduler.h"
+#include "encoder/latency_tracer.h"
+#include "encoder/mux_reorder_queue.h"
+#include "encoder/overload_governor.h"
+#include "encoder/pip_compositor.h"
+#include "encoder/pool_sizer.h"
+#include "encoder/scene_cut_detector.h"
+#include "encoder/stall_watchdog.h"
+#include "encoder/standby_heartbeat.h"
+#include "encoder/status_snapshot.h"
+#include "encoder/thumbnail_generator.h"
+#include "encoder/timestamp_smoother.h"
 #include "encoder/video_encoder.h"
-#include "encoder/vorbis_encoder.h"
+#include "encoder/video_frame_pool.h"
+#include "encoder/video_slate.h"
 
 namespace webmlive {
-// All timestamps are in milliseconds.
+// All timestamps are in milliseconds. Frames and audio buffers also carry
+// microsecond times, which the VPx encoders use; see |kMicrosecondTimebase|.
 const int kTimebase = 1000;
 // Special value meaning use system default device.
 const int kUseDefaultDevice = -1;
 
+class EncodedFrameSinkInterface;
+class MemoryAccount;
+class RateControlTelemetry;
+class TaskScheduler;
+class TaskStrand;
+
+// Settings for one video representation of a multi-bitrate DASH encode.
+struct VideoRepresentationConfig {
+  VideoRepresentationConfig()
+      : width(0), height(0), bitrate(0), codec(kVideoFormatI420) {}
+
+  int32 width;    // Output width in pixels. 0 means capture width.
+  int32 height;   // Output height in pixels. 0 means capture height.
+  int bitrate;    // Bitrate in kilobits per second. 0 means VpxConfig bitrate.
+
+  // |kVideoFormatVP8|, |kVideoFormatVP9| or |kVideoFormatAV1|, so that a
+  // ladder can mix AV1 and VP9 representations. |kVideoFormatI420| means
+  // the |VpxConfig| codec.
+  VideoFormat codec;
+};
+
+// Returns the codec |representation| is encoded with under |vpx_config|.
+VideoFormat RepresentationCodec(const VideoRepresentationConfig& representation,
+                                const VpxConfig& vpx_config);
+
+// Settings for one extra representation of the main audio track, an audio
+// bitrate ladder step.
+struct AudioRepresentationConfig {
+  AudioRepresentationConfig() : codec(kAudioFormatVorbis), bitrate(0) {}
+
+  AudioFormat codec;  // |kAudioFormatVorbis| or |kAudioFormatOpus|.
+  int bitrate;        // Bitrate in kilobits per second. 0 means the bitrate
+                      // of the codec's |WebmEncoderConfig| settings.
+};
+
+// Settings for an audio input encoded alongside the main one, a commentary
+// in another language or an isolated microphone for example.
+struct AudioTrackConfig {
+  // Capture device; an ALSA PCM name on Linux.
+  std::string device_name;
+
+  // RFC 5646 language of the track, written to its DASH AdaptationSet. None
+  // when empty.
+  std::string language;
+
+  // Actual settings of the samples encoded, set by |WebmEncoder::Init()|.
+  AudioConfig actual_audio_config;
+};
+
 struct WebmEncoderConfig {
   // User interface control structure. |MediaSourceImpl| will attempt to
   // display configuration control dialogs when fields are set to true.
@@ -38,15 +112,90 @@ struct WebmEncoderConfig {
     bool manual_video_config;   // Show video source configuration interface.
   };
 
+  // Default for |pool_memory_budget_mb|.
+  static const int kDefaultPoolMemoryBudgetMb = 256;
+
+  // Default for |capture_trace_max_mb|.
+  static const int kDefaultCaptureTraceMaxMb = 1024;
+
+  // Default for |standby_timeout_ms|.
+  static const int kDefaultStandbyTimeoutMs = 1000;
+
+  // Default for |slate_delay_ms|.
+  static const int kDefaultSlateDelayMs = 1000;
+
+  // Defaults for |audio_buffer_ms| and |audio_buffer_count|.
+  static const int kDefaultAudioBufferMs = 20;
+  static const int kDefaultAudioBufferCount = 8;
+
+  // Maximum size of |extra_audio_tracks|.
+  static const int kMaxExtraAudioTracks = 8;
+
+  // Maximum size of |audio_representations|.
+  static const int kMaxAudioRepresentations = 8;
+
+  // Default for |dash_bandwidth_window|.
+  static const int kDefaultDashBandwidthWindow = 10;
+
   WebmEncoderConfig()
       : disable_audio(false),
         disable_video(false),
         audio_device_index(kUseDefaultDevice),
         video_device_index(kUseDefaultDevice),
+        video_capture_desktop(false),
+        video_capture_media_foundation(false),
+        video_mf_disable_gpu(false),
+        video_async_conversion(false),
+        video_buffer_count(0),
+        audio_capture_wasapi(false),
+        audio_wasapi_exclusive(false),
+        audio_buffer_ms(kDefaultAudioBufferMs),
+        audio_buffer_count(kDefaultAudioBufferCount),
+        audio_drift_correction(false),
+        audio_encode_sample_rate(0),
+        max_video_frame_rate(0),
+        video_timestamp_smoothing(false),
+        pool_memory_budget_mb(kDefaultPoolMemoryBudgetMb),
+        encode_cores(0),
+        task_scheduler(NULL),
+        rate_control_telemetry(NULL),
+        realtime_sink(NULL),
+        audio_codec(kAudioFormatVorbis),
+        output_video_width(0),
+        output_video_height(0),
         dash_encode(false),
         dash_name("webmlive"),
         dash_dir("./"),
-        dash_start_number("1") {}
+        dash_start_number("1"),
+        dash_dynamic(false),
+        dash_time_shift_buffer_depth(0),
+        dash_bandwidth_window(kDefaultDashBandwidthWindow),
+        dash_patch_interval(0),
+        dash_muxed_output(false),
+        dash_vod_manifest(false),
+        publish_headers_early(false),
+        video_svc(false),
+        low_latency_upload(false),
+        cluster_index(false),
+        native_clusters(false),
+        archive_memory_mapped(false),
+        cluster_duration(0),
+        chunk_byte_budget(0),
+        standby(false),
+        standby_timeout_ms(kDefaultStandbyTimeoutMs),
+        latency_trace(false),
+        input_synthetic(false),
+        input_synthetic_duration_ms(0),
+        input_paced(true),
+        capture_trace_max_mb(kDefaultCaptureTraceMaxMb),
+        video_passthrough(false),
+        fast_start(false),
+        capture_stall_timeout_ms(0),
+        slate_delay_ms(kDefaultSlateDelayMs),
+        stop_timeout_ms(0),
+        video_queue_policy(kPoolRejectNewest),
+        video_queue_max_age_ms(0),
+        audio_deadline_ms(0) {}
 
   // Audio/Video disable flags.
   bool disable_audio;
@@ -64,6 +213,97 @@ struct WebmEncoderConfig {
   // Video device index. Leave set to |kUseDefaultDevice| to use system default.
   int video_device_index;
 
+  // Captures a monitor through DXGI Desktop Duplication instead of a video
+  // device; |video_device_index| then selects the monitor, and
+  // |kUseDefaultDevice| the first. Windows only.
+  bool video_capture_desktop;
+
+  // Second video device drawn over the captured video by |PipCompositor|.
+  // Disabled while |pip.device_name| is empty. Linux only.
+  PictureInPictureConfig pip;
+
+  // Logo and timecode burned into the raw video by |FrameOverlay| before it
+  // is encoded. Ignored when video is passed through.
+  FrameOverlayConfig overlay;
+
+  // Deinterlaces captured video with |Deinterlacer| as it enters the raw
+  // frame pool. In |DeinterlaceConfig::kFieldRate| mode, the encoders
+  // receive twice the capture frame rate. Ignored when video is passed
+  // through.
+  DeinterlaceConfig deinterlace;
+
+  // Captures video through a Media Foundation source reader instead of a
+  // DirectShow filter graph. The reader converts frames to NV12 with the
+  // hardware video processor, or on the CPU when |video_mf_disable_gpu| is
+  // set or no D3D11 device is available. |video_device_name| and
+  // |video_device_index| select the device. Windows only.
+  bool video_capture_media_foundation;
+  bool video_mf_disable_gpu;
+
+  // Converts DirectShow frames to I420 on a thread of their own instead of
+  // the graph's streaming thread, so that slow conversions do not hold up
+  // capture; see |AsyncFrameConverter|. Windows only.
+  bool video_async_conversion;
+
+  // Number of frames the DirectShow video sink asks the capture filter's
+  // allocator for. Capture filters discard frames once the encoder holds all
+  // of them; more frames ride out longer stalls at the cost of memory. Values
+  // <= 0 leave the choice to the filter. Windows only.
+  int video_buffer_count;
+
+  // Captures audio through WASAPI instead of a DirectShow filter, in periods
+  // of about 10 ms. |audio_device_name| and |audio_device_index| then select
+  // the endpoint, |kUseDefaultDevice| the default one. Exclusive mode takes
+  // the device from other applications and captures 16 bit PCM without the
+  // audio engine's buffering. Windows only.
+  bool audio_capture_wasapi;
+  bool audio_wasapi_exclusive;
+
+  // Length, in milliseconds, and number of the buffers requested from
+  // DirectShow audio capture filters through IAMBufferNegotiation. Filters
+  // deliver a buffer each time one fills, so the length bounds the latency
+  // audio adds to muxing. The audio sink also asks for |audio_buffer_count|
+  // buffers when its pin connects. Values <= 0 leave the choice to the filter.
+  // Windows only.
+  int audio_buffer_ms;
+  int audio_buffer_count;
+
+  // Resamples captured audio so that its sample count follows the capture
+  // timestamps, which keeps A/V sync and audio buffering constant when the
+  // audio device's clock drifts from the capture clock. See
+  // |AudioDriftCompensator|.
+  bool audio_drift_correction;
+
+  // Sample rate audio is encoded at. Captured audio at another rate is
+  // converted by |AudioResampler| on the audio encode thread, and
+  // |actual_audio_config| reports this rate to the encoders, muxers and
+  // manifest. The capture rate is used when 0.
+  int audio_encode_sample_rate;
+
+  // RFC 5646 language of the main audio track, written to its DASH
+  // AdaptationSet. None when empty.
+  std::string audio_language;
+
+  // Audio inputs encoded besides the main one, each captured with
+  // |requested_audio_config|, compressed on its own |AudioEncodeWorker|
+  // thread with the main track's codec settings, and muxed into its own DASH
+  // AdaptationSet. Requires DASH output and a media source that supports
+  // them; they are not part of |dash_muxed_output| or |archive_path|.
+  std::vector<AudioTrackConfig> extra_audio_tracks;
+
+  // Audio inputs mixed into the main audio track by an |AudioMixer|, each
+  // with its own gain and drift compensation. The mix is planar float, so it
+  // requires Vorbis for the main track and its representations. Linux only.
+  AudioMixConfig audio_mix;
+
+  // Representations of the main audio track encoded besides the one
+  // described by |audio_codec|, each on its own |AudioEncodeWorker| thread
+  // and muxed into its own Representation of the main audio AdaptationSet.
+  // Captured samples are converted to planar float once for all of the
+  // Vorbis encoders; see |AudioFanOut|. Requires DASH output; not part of
+  // |dash_muxed_output| or |archive_path|.
+  std::vector<AudioRepresentationConfig> audio_representations;
+
   // Requested audio capture settings.
   AudioConfig requested_audio_config;
 
@@ -73,15 +313,73 @@ struct WebmEncoderConfig {
   // Requested video capture settings.
   VideoConfig requested_video_config;
 
-  // Actual video capture settings.
+  // Actual video capture settings. |frame_rate| is the rate frames are
+  // delivered at, after |max_video_frame_rate| and |vpx_config.decimate|.
   VideoConfig actual_video_config;
 
+  // Maximum rate, in frames per second, at which the media source delivers
+  // frames. Sources drop the excess by timestamp, before frames are converted
+  // or copied. No limit when <= 0.
+  double max_video_frame_rate;
+
+  // Locks captured frame times to |actual_video_config.frame_rate| with a
+  // |TimestampSmoother|, which removes the jitter of capture timestamps and
+  // counts the frames the device missed. Frames then reach the encoders one
+  // frame period apart.
+  bool video_timestamp_smoothing;
+
+  // Memory, in megabytes, that each of the raw video and audio pools may grow
+  // to while the encoder thread falls behind. The pools are sized from the
+  // measured time the encoder thread takes to service them, within this
+  // budget, and shrink back when it catches up. Pools keep their initial size
+  // for unpaced file input.
+  int pool_memory_budget_mb;
+
+  // CPU cores the video encoders of this encode divide among themselves when
+  // choosing libvpx thread counts. All cores when <= 0. Processes running
+  // several encodes give each a share.
+  int encode_cores;
+
+  // Labels added to every metric of this encode, in |MetricsRegistry| label
+  // syntax; for example 'stream="studio_a"'. Distinguishes the encoders of a
+  // process running several streams.
+  std::string metrics_labels;
+
+  // Scheduler shared by the encodes of a process. When set, the encode loop,
+  // each video frame encode and each audio encode run as tasks on it instead
+  // of on threads of their own, so busy streams use the cores idle streams
+  // leave. Not owned; must outlive the encoder.
+  TaskScheduler* task_scheduler;
+
+  // Receives a record of the rate control decisions for every frame passed
+  // to the libvpx video encoders, which the encode loop aggregates into
+  // histograms. Not owned; must outlive the encoder.
+  RateControlTelemetry* rate_control_telemetry;
+
+  // Receives the compressed frames of the first video representation and
+  // of the main audio track as they leave the encoders, ahead of the muxers
+  // and regardless of congestion drops; for realtime outputs such as
+  // |WhipSender|. Not owned; must outlive the encoder.
+  EncodedFrameSinkInterface* realtime_sink;
+
+  // Audio codec: |kAudioFormatVorbis| or |kAudioFormatOpus|.
+  AudioFormat audio_codec;
+
   // Vorbis audio encoder settings.
   VorbisConfig vorbis_config;
 
+  // Opus audio encoder settings.
+  OpusConfig opus_config;
+
   // VPx encoder settings.
   VpxConfig vpx_config;
 
+  // Encoded video size. Captured frames are scaled when this differs from
+  // |actual_video_config|. Values <= 0 mean use the capture size. Ignored when
+  // |video_representations| is not empty.
+  int32 output_video_width;
+  int32 output_video_height;
+
   // Source device options.
   UserInterfaceOptions ui_opts;
 
@@ -96,20 +394,274 @@ struct WebmEncoderConfig {
 
   // MPD SegmentTemplate startNumber value.
   std::string dash_start_number;
+
+  // Writes a dynamic MPD whose SegmentTimeline gains an entry per finished
+  // chunk, and sends it to the data sink after each chunk.
+  bool dash_dynamic;
+
+  // Seconds of chunks kept in the SegmentTimeline of a dynamic MPD. All
+  // chunks are kept when 0.
+  int dash_time_shift_buffer_depth;
+
+  // Finished chunks over which the bitrate of each Representation is
+  // measured for its MPD bandwidth attribute; see
+  // |DashWriter::MeasureChunk()|. 0 writes the configured bitrates.
+  int dash_bandwidth_window;
+
+  // Also publishes each update of a dynamic MPD as an MPD Patch, sent to the
+  // data sink as |DashWriter::kPatchLocation|, and sends the full MPD only
+  // every |dash_patch_interval| seconds, or when no patch describes the
+  // update. Clients holding the previous version fetch only the patch;
+  // clients joining between full copies start from the last one and catch
+  // up once it is refreshed. Patches are not published when 0.
+  int dash_patch_interval;
+
+  // Also muxes the audio and the first video representation of a DASH encode
+  // into one WebM stream for players without DASH support. The stream reuses
+  // the compressed packets of the DASH muxers, and its chunks are named
+  // <dash_name>_muxed.hdr and <dash_name>_muxed_<n>.chk. |Reconfigure()|
+  // cannot change the codec while it is enabled.
+  bool dash_muxed_output;
+
+  // Replaces the manifest with a static MPD when the encode stops, so that
+  // the chunks already written can be played on demand. The MPD lists every
+  // chunk in SegmentTimelines, except those a dynamic MPD dropped from its
+  // time shift buffer. See |DashWriter::EndPresentation()|.
+  bool dash_vod_manifest;
+
+  // Sends the manifest and each muxer's metadata chunk to the data sink
+  // before capture starts, instead of after the first samples arrive. The
+  // metadata chunks are built by |WebmEncoder::Init()| from the track
+  // configurations; the copies the muxers produce later are not sent.
+  bool publish_headers_early;
+
+  // Video representations produced by DASH encodes. When empty a single
+  // representation is encoded at the capture size using |vpx_config|.
+  // Otherwise each entry is scaled from the same captured frames and encoded
+  // on its own |VideoEncodeWorker| thread.
+  std::vector<VideoRepresentationConfig> video_representations;
+
+  // Encodes |video_representations| as the spatial layers of one VP9 encode
+  // instead of on a worker each: the representations, smallest first, are
+  // predicted from each other, and each one's chunks carry the layers up to
+  // its own. Representation bitrates are then the totals of those layers,
+  // and must increase with the size, which must keep the aspect ratio of the
+  // largest. Requires 2 or 3 VP9 representations, libvpx encode, and no
+  // temporal layers or lookahead.
+  bool video_svc;
+
+  // Sends each chunk to the data sink as it is muxed, instead of after the
+  // muxer completes it. Requires a data sink that supports
+  // |DataSinkInterface::WriteStreamingChunk()|.
+  bool low_latency_upload;
+
+  // Records the position, timecode and keyframe flag of every cluster, and
+  // sends each muxer's index to the data sink after its last chunk. The
+  // index is named <dash_name>_<muxer id>.idx for DASH encodes, and "index"
+  // otherwise. See |LiveWebmMuxer::WriteClusterIndex()| for the format.
+  bool cluster_index;
+
+  // Writes clusters without libwebm. See
+  // |LiveWebmMuxer::EnableNativeClusters()|.
+  bool native_clusters;
+
+  // Records the audio and the first video representation to this path as a
+  // seekable WebM file with Cues, finalized when the encode stops. Live
+  // output is unaffected, and continues when the archive fails. Disabled when
+  // empty. See |WebmArchiveWriter|.
+  std::string archive_path;
+
+  // Writes |archive_path| through a memory mapped window with a crash safe
+  // index, so that |WebmArchiveWriter::Recover()| can repair it after a
+  // crash or a power loss. Linux only. See |MappedArchiveFile|.
+  bool archive_memory_mapped;
+
+  // Maximum cluster duration in milliseconds. When 0, each chunk is one
+  // cluster that lasts a keyframe interval. Otherwise chunks still end at
+  // video keyframes but hold clusters of this duration, which low latency
+  // uploads pass on as each cluster is muxed.
+  int cluster_duration;
+
+  // Ends video and muxed chunks at the next frame once they hold this many
+  // bytes, even without a keyframe. See
+  // |LiveWebmMuxer::SetChunkByteBudget()|. Audio only chunks are never
+  // split. Split chunks have their own SegmentTimeline entries, so DASH
+  // output requires |dash_dynamic| or |dash_vod_manifest|, and a single
+  // video representation. Disabled when 0.
+  int64 chunk_byte_budget;
+
+  // Encrypts every muxer's frames with AES-CTR using |encryption_key|, 16
+  // raw bytes, and names |encryption_key_id|, raw bytes as well, in the track
+  // headers and the DASH manifest. See |LiveWebmMuxer::EnableEncryption()|.
+  // Archives are written in the clear. Disabled when |encryption_key| is
+  // empty.
+  std::string encryption_key_id;
+  std::string encryption_key;
+
+  // Hot standby. Encoders sharing |standby_heartbeat|, the name of a shared
+  // memory region like |input_shared_memory|, place keyframes at the first
+  // frame of each |VpxConfig::keyframe_interval| of source time and number
+  // segments by it, so that their chunks are interchangeable; see
+  // |GopScheduler::InitAligned()|. The encoder writing the stream beats
+  // through |StandbyHeartbeat|. A |standby| encoder reads the input of its
+  // primary through |SharedMemorySource| without consuming it, encodes and
+  // muxes everything, but holds back its latest chunks and manifest. Once
+  // no beat came for |standby_timeout_ms| it takes over the input, writes
+  // its held chunks from the last segment the primary wrote, and carries on
+  // as the primary. Its manifest lists the segments it encoded itself, so it
+  // should run for the time shift buffer depth before it is needed.
+  // Requires a dynamic manifest, and no low latency uploads, chunk byte
+  // budget, early headers, extra audio tracks, audio representations or
+  // negative source timestamps. Disabled when |standby_heartbeat| is empty.
+  bool standby;
+  std::string standby_heartbeat;
+  int standby_timeout_ms;
+
+  // Stamps video frames and chunks at each pipeline stage with
+  // |LatencyTracer|, and gathers latency histograms for
+  // |WebmEncoder::latency_stats()|.
+  bool latency_trace;
+
+  // Files read instead of capture devices. When either is set the encoder
+  // uses |FileMediaSource|, and the stream without a file is disabled.
+  // |input_video_file| is a Y4M file, or raw I420 frames sized by the width,
+  // height and frame rate in |requested_video_config| when its name does not
+  // end in .y4m. |input_audio_file| is a PCM16 or float WAV file.
+  std::string input_video_file;
+  std::string input_audio_file;
+
+  // Name of a shared memory region another process writes raw frames and
+  // audio blocks to, read by |SharedMemorySource| instead of capture
+  // devices. Streams are enabled and disabled as for capture devices.
+  std::string input_shared_memory;
+
+  // Capture trace file written by |CaptureTraceRecorder|, replayed by
+  // |CaptureTraceSource| instead of capture devices. Streams are enabled and
+  // disabled as for capture devices.
+  std::string input_capture_trace;
+
+  // Generates a test pattern and a tone with |SyntheticMediaSource| instead
+  // of capturing, for benchmarks. Streams are enabled and disabled as for
+  // capture devices. Input ends after |input_synthetic_duration_ms|, or runs
+  // until stopped when it is 0.
+  bool input_synthetic;
+  int64 input_synthetic_duration_ms;
+
+  // WebM stream re-segmented by |WebmRemuxer| instead of capturing and
+  // encoding: a file, "-" for standard input, or an http:// or https:// URL.
+  // Requires |dash_encode|.
+  std::string remux_input;
+
+  // Delivers file and synthetic input in real time when true. Otherwise
+  // input is read as fast as the encoder consumes it, and frames wait for
+  // room in the pools instead of being dropped.
+  bool input_paced;
+
+  // Records the samples the media source delivers, and when, to
+  // |capture_trace_file| with |CaptureTraceRecorder|, for replay through
+  // |input_capture_trace|. The file is created |capture_trace_max_mb| long,
+  // and cut to the recorded samples when the encode stops.
+  std::string capture_trace_file;
+  int capture_trace_max_mb;
+
+  // Asks the video capture source for frames already compressed in the
+  // |vpx_config.codec| format, as some UVC 1.5 cameras and capture boxes
+  // deliver them. Compressed frames are muxed as they are, bypassing the
+  // encoder and any extra |video_representations|. Sources that cannot
+  // deliver the format fall back to raw frames, which are encoded.
+  bool video_passthrough;
+
+  // Shortens startup: |WebmEncoder::Init()| runs the media source as soon as
+  // the devices are open, and initializes the encoders concurrently with each
+  // other and with the device start. Samples captured before
+  // |WebmEncoder::Run()| wait in the raw sample pools.
+  bool fast_start;
+
+  // Deadline, in milliseconds, for the media source and the encode loop.
+  // When the source reports a failure, or delivers no samples for this
+  // long, the encoder reopens it with |MediaSourceInterface::Restart()|
+  // instead of stopping, and keeps retrying each deadline while it fails.
+  // Encoders, muxers and the data sink keep running, and sample timestamps
+  // continue across the outage. An encode loop that makes no progress for
+  // this long is logged and counted. Disabled when 0, and for sources that
+  // cannot restart.
+  int capture_stall_timeout_ms;
+
+  // Still picture shown in place of the video once no frame has arrived for
+  // |slate_delay_ms|, whether capture stalled or the media source failed. A
+  // Y4M file, or a raw I420 file of the capture size. It is encoded at
+  // startup for each video representation, and while video is lost its
+  // compressed frames are muxed with new timestamps, at the capture frame
+  // rate, so that players keep playing. The first frame captured after the
+  // slate is a keyframe. A media source that fails for good leaves the
+  // slate up until the encoder is stopped. Audio is not replaced. Requires
+  // 8 bit video that is encoded, and no |standby_heartbeat|. Disabled when
+  // empty.
+  std::string slate_file;
+  int slate_delay_ms;
+
+  // Longest time, in milliseconds, the encoder spends writing the final
+  // chunks, manifests and cluster indexes once it stops. All muxers are
+  // finalized first and their final chunks written back to back, so that
+  // the data sink uploads them concurrently. Writes still waiting for the
+  // data sink at the deadline are abandoned, logged, and counted by
+  // |WebmEncoder::stop_abandoned_writes()|. Unbounded when 0.
+  int stop_timeout_ms;
+
+  // What happens to a captured video frame that arrives while the raw frame
+  // pool is full: it is rejected by default, or the oldest waiting frame is
+  // dropped, or only the latest frame is kept. Interactive streams drop old
+  // frames so that the frame encoded next is always the freshest.
+  BufferPoolPolicy video_queue_policy;
+
+  // Maximum age, in milliseconds, of a frame waiting in the raw frame pool,
+  // relative to the newest captured frame. Older frames are dropped instead
+  // of encoded, which bounds the queueing latency of the encoded frames.
+  // Disabled when 0.
+  int video_queue_max_age_ms;
+
+  // Time, in milliseconds, within which captured audio must be muxed. While
+  // audio lags further behind, the encoder degrades video step by step:
+  // faster encoder speed, then decimation, then dropping three of four raw
+  // frames, until audio is back on time. Video encode threads also run below
+  // the priority of the audio and mux threads. Disabled when 0.
+  int audio_deadline_ms;
+
+  // Preview thumbnails and scrubbing sprite sheets of the captured frames,
+  // sent to the data sink as <dash_name>_thumb_<ms>.jpg,
+  // <dash_name>_sprite_<n>.jpg and <dash_name>_sprites.vtt when the sink is
+  // idle. Disabled while |thumbnails.frame_interval| is 0; see
+  // |ThumbnailGenerator|.
+  ThumbnailConfig thumbnails;
 };
 
+class AudioDriftCompensator;
+class AudioEncodeWorker;
+class AudioFanOut;
 class DashWriter;
-class MediaSourceImpl;
 class LiveWebmMuxer;
+class MediaSourceInterface;
+class Metric;
+class VideoEncodeWorker;
+class WebmArchiveWriter;
 
 // Top level WebM encoder class. Manages capture from A/V input devices, VPx
 // encoding, Vorbis encoding, and muxing into a WebM stream.
+// Audio and each video representation are compressed on worker threads;
+// |EncoderThread()| feeds the workers and muxes what they produce. With
+// |WebmEncoderConfig::task_scheduler| set, the same passes run as tasks;
+// see |EncodeTask()|.
 class WebmEncoder : public AudioSamplesCallbackInterface,
                     public VideoFrameCallbackInterface {
  public:
-  // Default size of |chunk_buffer_|.
-  static const int kDefaultChunkBufferSize = 100 * 1024;
+  // Maximum time |EncoderThread()| sleeps waiting for input samples or for
+  // |ptr_data_sink_| to become ready. Bounds the delay in noticing a stop
+  // request or a media source failure while idle.
+  static const int kMaxIdleWaitMs = 100;
   enum {
+    // Another encoder took over the stream from this one.
+    kStreamTakenOver = -118,
+
     // Data sink write failed.
     kDataSinkWriteFail = -117,
 
@@ -183,9 +735,55 @@ class WebmEncoder : public AudioSamplesCallbackInterface,
   // Stops the encoder.
   void Stop();
 
+  // Returns true once the encoder thread has finished, either because a file
+  // media source delivered all of its input or because of an error. |Stop()|
+  // must still be called.
+  bool Finished() const { return finished_; }
+
   // Returns encoded duration in milliseconds.
   int64 encoded_duration() const;
 
+  // Returns the number of final writes abandoned at
+  // |WebmEncoderConfig::stop_timeout_ms|. Valid once |Stop()| returns.
+  int stop_abandoned_writes() const { return stop_abandoned_writes_; }
+
+  // Changes the total video bitrate, in kilobits per second, without
+  // restarting encoders. Multi-bitrate encodes scale every representation by
+  // the same factor. May be called from any thread while running.
+  int SetVideoBitrate(int kbps);
+
+  // Makes the video encoders faster by |steps| speed steps, trading quality
+  // for CPU time; 0 restores the configured speed. The overload governor
+  // may raise the boost further while audio is late. May be called from any
+  // thread while running.
+  int SetVideoSpeedBoost(int steps);
+
+  // Replaces the video representations and codec of a running dynamic DASH
+  // encode, without restarting capture, audio or the data sink. The change
+  // is applied by the encode thread: the current video encoders are drained,
+  // their muxers finalized so that the last chunks end on a cluster
+  // boundary, and new encoders and muxers start a new manifest Period with
+  // their own initialization segments. |codec| must be |kVideoFormatVP8|,
+  // |kVideoFormatVP9| or |kVideoFormatAV1|, and applies to representations
+  // that do not name their own. Returns |kSuccess| when the change is
+  // queued. May be called from any thread while running; a change queued
+  // before the last one is applied replaces it.
+  int Reconfigure(
+      const std::vector<VideoRepresentationConfig>& representations,
+      VideoFormat codec);
+
+  // Requests a keyframe in every representation as soon as possible, for
+  // example when a viewer joins or a segment was lost. The representations
+  // key the same frame. May be called from any thread while running.
+  void RequestKeyframe();
+
+  // Returns the decisions made by the congestion controller so far.
+  CongestionStats congestion_stats() const;
+
+  // Returns the latency of each pipeline stage since capture, when
+  // |WebmEncoderConfig::latency_trace| is enabled.
+  LatencyStats latency_stats() const;
+
   // Returns |WebmEncoderConfig| with fields set to default values.
   static WebmEncoderConfig DefaultConfig();
   WebmEncoderConfig config() const { return config_; }
@@ -201,40 +799,127 @@ class WebmEncoder : public AudioSamplesCallbackInterface,
   virtual int OnVideoFrameReceived(VideoFrame* ptr_frame);
 
  private:
-  // Function pointer type used for indirect access to the encoder loop
-  // methods from |EncoderThread()|.
-  typedef int (WebmEncoder::*EncoderLoopFunc)();
+  // Stores the raw frame |ptr_frame| in |video_pool_| for |EncoderThread()|.
+  // Returns |kSuccess| when successful, and
+  // |VideoFrameCallbackInterface::kDropped| when the pool is full.
+  int CommitVideoFrame(VideoFrame* ptr_frame);
 
   // Returns true when user wants the encode thread to stop.
   bool StopRequested();
 
-  // Reads chunk from |muxer| and reallocates |chunk_buffer_| when necessary.
-  // Returns true when successful.
+  // Returns true when |audio_pool_| or |video_pool_| holds input samples.
+  bool InputAvailable() const;
+
+  // Returns true when file or synthetic input is delivered as fast as the
+  // encoder consumes it, without capture timing.
+  bool UnpacedInput() const;
+
+  // Sets |input_signaled_| and wakes |EncoderThread()| when it is idle in
+  // |WaitForInput()|.
+  void SignalInput();
+
+  // Idles |EncoderThread()| until |SignalInput()| is called, or until
+  // |IdleWaitMs()| elapses.
+  void WaitForInput();
+
+  // Returns the longest time the encode loop idles: |kMaxIdleWaitMs|, or a
+  // frame interval while the slate is up.
+  int64 IdleWaitMs() const;
+
+  // Moves the ready chunk from |muxer| into |ptr_chunk|. Returns true when
+  // successful.
   bool ReadChunkFromMuxer(std::unique_ptr<LiveWebmMuxer>* muxer,
-                          int32 chunk_length);
+                          SharedDataChunk* ptr_chunk);
 
   // Encoding thread function.
   void EncoderThread();
 
-  // Audio/Video |EncoderLoopFunc|s. Called by |EncoderThread()| via
-  // |ptr_encode_func_|. All loop functions return |kSuccess| when the encode
-  // pass succeeds.
-  int EncodeAudioOnly();
-  int AVEncode();
-  int EncodeVideoFrame();
-  int DashEncode();
-
-  // Utility function used to encode a single audio input buffer.
-  int EncodeAudioBuffer();
+  // Runs the media source and the encode workers, after sending early
+  // headers when configured.
+  void StartEncode();
+
+  // Returns true when |audio_pool_| and |video_pool_| each hold a sample of
+  // their enabled stream.
+  bool SamplesReceived() const;
+
+  // Sets |timestamp_offset_| from the first samples. Returns |kSuccess| when
+  // successful.
+  int InitTimestampOffset();
+
+  // Checks for a stop request, the end of input, and failures of the media
+  // source and encode workers. Returns true when the encode must stop;
+  // |ptr_clean_stop| is set when it stops without error and the last chunks
+  // are to be written.
+  bool EncodeShouldStop(bool* ptr_clean_stop);
+
+  // Reopens the media source for |reason| when
+  // |config_.capture_stall_timeout_ms| allows it. Returns true when the
+  // encode continues: the source restarted, or it failed and is retried after
+  // the next deadline. Returns false when restarts are disabled or the source
+  // does not support them.
+  bool RestartMediaSource(const char* reason);
+
+  // |StallWatchdog| callback. Flags a capture restart, or reports an encode
+  // loop stall. Called on the watchdog thread.
+  void OnStall(int stage, int64 stalled_ms);
+
+  // Continues the timestamps of samples from a restarted media source where
+  // the previous samples ended, plus the time the source was out, and kicks
+  // the capture stage of |stall_watchdog_|. Called from the capture threads.
+  template <typename T>
+  void RetimeCaptureSample(T* ptr_sample);
+
+  // One encode pass: feeds the workers, muxes and writes ready chunks, and
+  // updates congestion and latency state. Sets |ptr_consumed| when the pass
+  // took input from the pools. Returns |kSuccess| when successful.
+  int EncodePass(bool* ptr_consumed);
+
+  // Stops the encode workers, writing the last chunks when
+  // |write_last_chunks| is true, and sets |finished_|.
+  void FinishEncode(bool write_last_chunks);
+
+  // Posts |EncodeTask()| unless it is already posted. Thread safe.
+  void PostEncodeTask();
+
+  // Task scheduler counterpart of |EncoderThread()|: advances through
+  // |encode_stage_| and runs one encode pass. Idle checks of the media
+  // source are posted every |kMaxIdleWaitMs| through |EncodeTick()|.
+  void EncodeTask();
+  void EncodeTick();
+  void RunEncodeStage();
+
+  // Returns the deadline of encode loop tasks posted now: one frame interval
+  // away, or |kMaxIdleWaitMs| for audio only encodes.
+  int64 EncodeTaskDeadline() const;
+
+  // Passes all buffers available in |audio_pool_| to |audio_worker_|, and
+  // all frames available in |video_pool_| to |rep_workers_|. Sets
+  // |ptr_consumed| when any were taken. Returns |kSuccess| when successful.
+  int FeedEncodeWorkers(bool* ptr_consumed);
+
+  // Passes what remains in the pools to the workers once the media source
+  // input has ended, and waits for |rep_workers_| to compress it. Returns
+  // |kSuccess| when successful.
+  int DrainInput();
+
+  // Mux stage: muxes all packets the workers have compressed. DASH encodes
+  // write each stream to its own muxer. Otherwise packets go through
+  // |mux_queue_| to be interleaved by timestamp into |ptr_muxer_|, and
+  // |flush| empties the queue. Returns |kSuccess| when successful.
+  int MuxEncodedPackets(bool flush);
+
+  // Counts the frames |video_pool_| dropped unread since the last call as
+  // dropped capture frames, and removes them from the pool frames gauge.
+  void AccountVideoQueueDrops();
+
+  // Raises |encoded_duration_| to |timestamp|.
+  void UpdateEncodedDuration(int64 timestamp);
 
   // Waits for input samples from |ptr_media_source_| and sets
   // |timestamp_offset_| when one or both streams start with a negative
   // timestamp.
   int WaitForSamples();
 
-  // Returns the timestamp of the next available video frame via |timestamp|.
-  int PeekVideoTimestamp(int64* timestamp);
-
   // Writes |muxer| chunk to |ptr_data_sink_| when |muxer->ChunkReady()|
   // returns true.
   int WriteMuxerChunkToDataSink(std::unique_ptr<LiveWebmMuxer>* muxer);
@@ -242,41 +927,321 @@ class WebmEncoder : public AudioSamplesCallbackInterface,
   // Writes last chunk from |muxer| to |ptr_data_sink_| and finalizes |muxer|.
   int WriteLastMuxerChunkToDataSink(std::unique_ptr<LiveWebmMuxer>* muxer);
 
+  // Finalizes |muxer| and sends its remaining streaming chunks. Returns
+  // |kSuccess|, or the muxer status upon failure.
+  int FinalizeMuxer(std::unique_ptr<LiveWebmMuxer>* muxer);
+
+  // Writes the chunk produced by finalizing |muxer| to |ptr_data_sink_|.
+  void WriteFinalChunkToDataSink(std::unique_ptr<LiveWebmMuxer>* muxer);
+
+  // Waits for |ptr_data_sink_| before writing |id| while stopping: until it
+  // is ready, or until |stop_deadline_ms_| passes when set. Returns false,
+  // and counts the write as abandoned, when the deadline passes first.
+  bool WaitForDataSink(const std::string& id);
+
+  // Returns true once |stop_deadline_ms_| is set and has passed.
+  bool StopDeadlinePassed() const;
+
+  // Sends the cluster index of |muxer| to |ptr_data_sink_|.
+  void WriteClusterIndexToDataSink(const LiveWebmMuxer& muxer);
+
+  // Sends the outputs of |thumbnail_generator_| to |ptr_data_sink_| while it
+  // is ready, waiting up to |kMaxIdleWaitMs| for it per output when |wait|
+  // is true, until |stop_deadline_ms_| passes.
+  void WriteThumbnailsToDataSink(bool wait);
+
+  // Stores the metadata chunk of each muxer in |early_headers_|. Returns
+  // |kSuccess| when successful.
+  int PreviewHeaders();
+
+  // Sends the DASH manifest and |early_headers_| to |ptr_data_sink_|.
+  void WriteEarlyHeadersToDataSink();
+
+  // Returns true when chunk |chunk_num| of |muxer_id| is a metadata chunk
+  // already sent by |WriteEarlyHeadersToDataSink()|.
+  bool EarlyHeaderSent(const std::string& muxer_id, int64 chunk_num) const;
+
+  // Adds the chunk just read from |muxer| to the SegmentTimeline of a dynamic
+  // manifest, measures the bitrate of its Representation from its
+  // |chunk_length| bytes, and sets |manifest_pending_| when the manifest
+  // changed.
+  void AddChunkToManifest(const LiveWebmMuxer& muxer, int32 chunk_length);
+
+  // Sends the DASH manifest to |ptr_data_sink_| and clears
+  // |manifest_pending_|. With |config_.dash_patch_interval|, sends the
+  // patch, and the full manifest only when it is due. The sink must be
+  // ready.
+  void WriteManifestToDataSink();
+
+  // Passes chunks started by |muxer| to |ptr_data_sink_| when
+  // |config_.low_latency_upload| is true. Chunks the sink rejects are not
+  // streamed.
+  void WriteStreamingChunksToDataSink(std::unique_ptr<LiveWebmMuxer>* muxer);
+
+  // Fires the chunk_ready tracepoint and stamps |LatencyTracer::kChunkReady|
+  // for the chunk just passed to |ptr_data_sink_| from |muxer|, and stores
+  // its start in |traced_upload_time_|.
+  void TraceChunkWrite(const LiveWebmMuxer& muxer);
+
+  // Drains |LatencyTracer| events into |latency_stats_|, and the queues of
+  // |config_.rate_control_telemetry| into its stats.
+  void UpdateLatencyStats();
+
+  // Returns the number of the chunk ready in |muxer|. Chunks of video
+  // representations take the number |gop_scheduler_| gave the keyframe they
+  // start with, so that every representation numbers a segment alike; other
+  // chunks, and those starting elsewhere, take |muxer|'s own count. With a
+  // standby heartbeat every chunk after the metadata chunk takes the number
+  // of its aligned segment.
+  int64 ReadyChunkNumber(const LiveWebmMuxer& muxer) const;
+
+  // Opens |heartbeat_| when |config_.standby_heartbeat| is set, and makes a
+  // primary encoder its owner. Returns |kSuccess| when successful.
+  int InitStandby();
+
+  // Keeps the chunk ready in |muxer| in |held_chunks_| instead of writing
+  // it, while on standby, and adds it to the manifest.
+  int HoldMuxerChunk(std::unique_ptr<LiveWebmMuxer>* muxer);
+
+  // Beats as the primary, or on standby takes over when the primary's beats
+  // stopped. Returns |kStreamTakenOver| when another encoder owns the
+  // stream.
+  int UpdateStandby();
+
+  // Takes over the input and the stream from a failed primary: writes the
+  // held metadata chunks, the held chunks from the primary's last segment
+  // on, and the manifest. Returns |kSuccess| when successful.
+  int TakeOverStream();
+
   // Returns a chunk identifier for |chunk_num| from |muxer|.
   std::string NextChunkId(const std::string& muxer_id,
                           int64 chunk_num) const;
 
+  // Everything |Init()| sets up once the pools are ready: the encode workers,
+  // the video muxers and congestion controller, the audio track of
+  // |audio_muxer| and of |ptr_muxer_|, and the manifest. Returns |kSuccess|
+  // when successful.
+  int InitEncodePipeline(LiveWebmMuxer* audio_muxer);
+
+  // Creates |archive_writer_| at |config_.archive_path|, and copies the
+  // tracks of the live muxers into it. Returns |kSuccess| when successful.
+  int InitArchive();
+
+  // Queue copies of compressed packets for |archive_writer_|, when there is
+  // one. Failures stop the archive, not the encode.
+  void ArchiveAudioBuffer(const AudioBuffer& buffer);
+  void ArchiveVideoFrame(const VideoFrame& frame);
+
+  // Writes the packets in |archive_queue_| to |archive_writer_|; |flush|
+  // writes all of them. Stops the archive on failure.
+  void MuxArchive(bool flush);
+
+  // Writes what |archive_queue_| holds, and finalizes and closes
+  // |archive_writer_|.
+  void FinalizeArchive();
+
+  // Logs |reason| and discards |archive_writer_|, leaving its file
+  // incomplete.
+  void StopArchive(const char* reason);
+
+  // Adds the track compressed by |worker| from |audio_config| input to
+  // |ptr_muxer|. Returns |kSuccess| when successful.
+  int AddAudioTrack(const AudioEncodeWorker& worker,
+                    const AudioConfig& audio_config, LiveWebmMuxer* ptr_muxer);
+
+  // Opens |config_.extra_audio_tracks| through |ptr_media_source_|, and
+  // constructs |extra_audio_tracks_| with their pools and muxers. Their
+  // workers are initialized by |InitEncodeWorkers()|. Returns |kSuccess|
+  // when successful.
+  int InitExtraAudioTracks();
+
+  // Constructs |audio_representations_| from
+  // |config_.audio_representations|, with their muxers. Their workers are
+  // initialized by |InitEncodeWorkers()|. Returns |kSuccess| when
+  // successful.
+  int InitAudioRepresentations();
+
+  // Constructs and initializes |rep_workers_| from
+  // |config_.video_representations|, unless video is passed through, and
+  // |audio_worker_| when audio is enabled and |init_audio| is true.
+  // |config_.fast_start| initializes each on its own thread. Returns
+  // |kSuccess| when successful.
+  int InitEncodeWorkers(bool init_audio);
+
+  // Applies the change queued by |Reconfigure()|, if any. Returns |kSuccess|
+  // when successful.
+  int ApplyReconfigure();
+
+  // Returns the size and format of the frames of video representation
+  // |index|: those of its worker, or with spatial SVC those of the layer.
+  VideoConfig RepresentationOutputConfig(size_t index) const;
+
+  // Adds the video tracks of |rep_workers_| to |rep_muxers_| for DASH
+  // encodes, or to |ptr_muxer_|. Passthrough encodes have a muxer but no
+  // worker.
+  int InitVideoRepresentations();
+
+  // Muxes |raw_frame_|, a compressed frame from the media source, as the
+  // output of the first representation. Returns |kSuccess| when successful.
+  int MuxPassthroughFrame();
+
+  // Muxes |ptr_frame|, a compressed frame of representation |index|, and
+  // archives and interleaves the frames of the first. The contents of
+  // |ptr_frame| may be swapped away. Returns |kSuccess| when successful.
+  int MuxVideoFrame(size_t index, VideoFrame* ptr_frame);
+
+  // Encodes |slate_| for every video representation when
+  // |config_.slate_file| is set. Returns |kSuccess| when successful.
+  int InitSlate();
+
+  // Puts the slate up once no video frame arrived for
+  // |config_.slate_delay_ms|, and muxes the slate frames due by the steady
+  // clock. Returns |kSuccess| when successful.
+  int UpdateSlate();
+
+  // Stops |audio_worker_| and |rep_workers_|. When |write_last_chunks| is
+  // true, muxes what they compressed last and writes the final chunks.
+  void StopEncodeWorkers(bool write_last_chunks);
+
+  // Configures |congestion_controller_| for the video streams in |config_|.
+  int InitCongestionController();
+
+  // Configures |overload_governor_| from |config_|.
+  int InitOverloadGovernor();
+
+  // Looks up the metrics exported by the encoder in |MetricsRegistry|.
+  int InitMetrics();
+
+  // Passes the video output backlog and |video_pool_| state to
+  // |congestion_controller_|, and publishes its stats.
+  void UpdateCongestion();
+
+  // Passes the audio mux lag to |overload_governor_|, and applies its speed
+  // boost, or |speed_boost_| when larger, to |rep_workers_|.
+  void UpdateOverload();
+
+  // Reports the bytes held by the raw pools and the muxers to the memory
+  // governor, and sets the least severe congestion level from the memory
+  // pressure.
+  void UpdateMemoryUsage();
+
+  // Returns true when a raw pool may change its limit from |limit| to
+  // |new_limit|: always when it shrinks, and when it grows only while the
+  // memory governor allows it.
+  bool MayResizePool(int32 limit, int32 new_limit);
+
+  // Adaptive sizing state of |video_pool_| or |audio_pool_|, and the metrics
+  // exported for it. Used only by |EncoderThread()|.
+  struct RawPoolSizing {
+    RawPoolSizing()
+        : enabled(false),
+          ptr_limit(NULL),
+          ptr_high_water(NULL),
+          ptr_grow_count(NULL),
+          ptr_shrink_count(NULL),
+          ptr_full_count(NULL) {}
+    bool enabled;
+    PoolSizer sizer;
+    BufferPoolStats last_stats;
+    Metric* ptr_limit;
+    Metric* ptr_high_water;
+    Metric* ptr_grow_count;
+    Metric* ptr_shrink_count;
+    Metric* ptr_full_count;
+  };
+
+  // Looks up the metrics of the pool named |pool| for |ptr_sizing|.
+  int InitPoolMetrics(const std::string& pool, RawPoolSizing* ptr_sizing);
+
+  // Sizes |audio_pool_| from the first buffer decommitted from it, whose
+  // duration gives the rate at which buffers arrive.
+  void InitAudioPoolSizing(const AudioBuffer& buffer);
+
+  // Passes the state of a pool about to be drained to |ptr_sizing|, and
+  // publishes its metrics. |queued| is the number of buffers waiting. Returns
+  // true when the pool limit must change to |ptr_sizing->sizer.limit()|.
+  bool UpdatePoolSizing(int64 time_ms, int32 queued,
+                        const BufferPoolStats& stats,
+                        RawPoolSizing* ptr_sizing);
+
   // Set to true when |Init()| is successful.
   bool initialized_;
 
-  // Flag protected by |mutex_| and used by |EncoderThread()| via
-  // |StopRequested()| to determine when to terminate.
-  bool stop_;
+  // Set by |Stop()|, and used by |EncoderThread()| via |StopRequested()| to
+  // determine when to terminate.
+  std::atomic<bool> stop_;
+
+  // Set when |EncoderThread()| exits.
+  std::atomic<bool> finished_;
 
-  // Temporary storage for chunks about to be passed to |ptr_data_sink_|.
-  std::unique_ptr<uint8[]> chunk_buffer_;
-  int32 chunk_buffer_size_;
+  // Audio/video source: |FileMediaSource| for file input,
+  // |SharedMemorySource| for shared memory input, |CaptureTraceSource| for
+  // trace replay, or the platform specific capture implementation. Wrapped
+  // in a |CaptureTraceRecorder| when recording a capture trace.
+  std::unique_ptr<MediaSourceInterface> ptr_media_source_;
 
-  // Pointer to platform specific audio/video source object implementation.
-  std::unique_ptr<MediaSourceImpl> ptr_media_source_;
+  // Set when a fast start ran |ptr_media_source_| from |Init()|.
+  bool source_running_;
 
   // Pointer to live WebM muxer. |ptr_muxer_| is used for muxed A/V output and
-  // single stream output.
+  // single stream output. DASH encodes have one only with
+  // |dash_muxed_output|, and write the packets of their DASH muxers to it
+  // too.
   std::unique_ptr<LiveWebmMuxer> ptr_muxer_;
 
-  // Pointers to live WebM muxers. |ptr_muxer_aud_| and |ptr_muxer_vid_| are
-  // used for DASH encodes that do not mux audio and video into the same WebM
-  // chunks.
-  // TODO(tomfinegan): Support multiple streams of each media type.
+  // Orders compressed audio and video by timestamp for |ptr_muxer_|.
+  MuxReorderQueue mux_queue_;
+
+  // Archive of the encode when |config_.archive_path| is set, fed through
+  // its own queue. The queues take the contents of the packets they are
+  // given, so the archive receives the copies in |archive_audio_buffer_| and
+  // |archive_frame_|.
+  std::unique_ptr<WebmArchiveWriter> archive_writer_;
+  MuxReorderQueue archive_queue_;
+  AudioBuffer archive_audio_buffer_;
+  VideoFrame archive_frame_;
+
+  // Audio muxer for DASH encodes, which do not mux audio and video into the
+  // same WebM chunks. The video muxers are |rep_muxers_|.
   std::unique_ptr<LiveWebmMuxer> ptr_muxer_aud_;
-  std::unique_ptr<LiveWebmMuxer> ptr_muxer_vid_;
 
-  // Mutex providing synchronization between user interface and encoder thread.
-  mutable std::mutex mutex_;
+  // Mutex providing synchronization between user interface and encoder thread
+  // for changes to encoder state. Status and stats are read through atomics
+  // and |StatusSnapshot|s instead.
+  std::mutex mutex_;
+
+  // Video change queued by |Reconfigure()|. Protected by |mutex_|.
+  bool reconfigure_pending_;
+  std::vector<VideoRepresentationConfig> pending_representations_;
+  VideoFormat pending_codec_;
 
   // Encoder thread object.
   std::shared_ptr<std::thread> encode_thread_;
 
+  // Task scheduler encode state, used instead of |encode_thread_| when
+  // |config_.task_scheduler| is set. |encode_strand_| runs |EncodeTask()|,
+  // which is posted once until it runs: |encode_task_posted_|.
+  // |encode_tick_posted_| and |encode_stage_| are used only by the strand.
+  // |encode_finished_| is signaled, under |input_mutex_|, when |finished_|
+  // is set.
+  enum EncodeStage {
+    kEncodeStarting,
+    kEncodeWaitingForSink,
+    kEncodeWaitingForSamples,
+    kEncodeRunning,
+  };
+  std::unique_ptr<TaskStrand> encode_strand_;
+  std::atomic<bool> encode_task_posted_;
+  bool encode_tick_posted_;
+  EncodeStage encode_stage_;
+  std::condition_variable encode_finished_;
+
+  // Event used to wake |EncoderThread()| when input samples arrive or a stop
+  // is requested. |input_signaled_| is protected by |input_mutex_|.
+  std::mutex input_mutex_;
+  std::condition_variable input_ready_;
+  bool input_signaled_;
+
   // Data sink to which WebM chunks are written.
   DataSinkInterface* ptr_data_sink_;
 
@@ -284,43 +1249,260 @@ class WebmEncoder : public AudioSamplesCallbackInterface,
   // |EncoderThread()|.
   BufferPool<VideoFrame> video_pool_;
 
-  // Most recent frame from |video_pool_|.
-  VideoFrame raw_frame_;
+  // Most recent frame from |video_pool_|, read in place. Released back to the
+  // pool by the next |Decommit()|.
+  BufferPool<VideoFrame>::Lease raw_frame_;
+
+  // True when the media source delivers VP8 or VP9 frames, which are muxed
+  // without encoding.
+  bool video_passthrough_;
+
+  // True when a stage reading raw frames as one contiguous buffer is
+  // enabled; frames of external planes or surfaces are then packed on
+  // arrival, and otherwise reach the encoders as they are.
+  bool pack_video_frames_;
 
-  // Most recent frame from |video_encoder_|.
+  // Most recent frame from |rep_workers_|.
   VideoFrame vpx_frame_;
 
-  // Video encoder.
-  VideoEncoder video_encoder_;
+  // Encoded duration in milliseconds. Written only by |EncoderThread()|.
+  std::atomic<int64> encoded_duration_;
+
+  // Degrades video when the output falls behind. Used only by
+  // |EncoderThread()|; |congestion_stats_| is a copy it publishes.
+  CongestionController congestion_controller_;
+  StatusSnapshot<CongestionStats> congestion_stats_;
+
+  // Degrades video while audio misses |config_.audio_deadline_ms|. Used only
+  // by |EncoderThread()|. |audio_captured_time_| is the timestamp of the
+  // newest buffer |OnSamplesReceived()| committed, before the timestamp
+  // offset, and |audio_muxed_time_| that of the newest compressed audio
+  // muxed, or -1.
+  OverloadGovernor overload_governor_;
+  std::atomic<int64> audio_captured_time_;
+  int64 audio_muxed_time_;
+  Metric* ptr_overload_level_;
+  Metric* ptr_audio_mux_lag_ms_;
+
+  // Speed boost set by |SetVideoSpeedBoost()|.
+  std::atomic<int> speed_boost_;
+
+  // Raw frames |OnVideoFrameReceived()| could not store in |video_pool_|,
+  // and those |video_pool_| dropped unread under
+  // |config_.video_queue_policy|. |video_queue_drops_| is the pool's
+  // |BufferPoolStats::dropped_count| as last accounted by
+  // |AccountVideoQueueDrops()|, and |ptr_video_queue_drops_| counts them.
+  std::atomic<int64> capture_frames_dropped_;
+  int64 video_queue_drops_;
+  Metric* ptr_video_queue_drops_;
+
+  // Smooths capture times when |config_.video_timestamp_smoothing| is set.
+  // Used only by |OnVideoFrameReceived()|, on the video capture thread.
+  TimestampSmoother timestamp_smoother_;
+
+  // Deinterlaces smoothed frames before |OnVideoFrameReceived()| commits
+  // them, and the second fields it stores in |deinterlaced_field_| in field
+  // rate mode. Used only on the video capture thread.
+  Deinterlacer deinterlacer_;
+  VideoFrame deinterlaced_field_;
+
+  // Set by |RequestKeyframe()|; applied by |FeedEncodeWorkers()| to the next
+  // raw frame.
+  std::atomic<bool> keyframe_requested_;
+
+  // Keyframe placement for every representation, scene cut detection for
+  // it, and the frame analysis of |VpxConfig::frame_analysis|, which detects
+  // scene cuts itself. Used only by |EncoderThread()|.
+  SceneCutDetector scene_cut_detector_;
+  GopScheduler gop_scheduler_;
+  FrameAnalyzer frame_analyzer_;
+
+  // Draws |config_.overlay| over raw frames in |FeedEncodeWorkers()|, ahead
+  // of |thumbnail_generator_|, so that thumbnails carry it too.
+  FrameOverlay frame_overlay_;
+
+  // Fed by |FeedEncodeWorkers()| and drained by |EncodePass()| when
+  // |config_.thumbnails| enables it.
+  ThumbnailGenerator thumbnail_generator_;
+
+  // Metrics exported through |MetricsRegistry|: the number of buffers held by
+  // |video_pool_| and |audio_pool_|, |capture_frames_dropped_|, the frames
+  // |timestamp_smoother_| found missing, and the drift and sync error
+  // measured by |audio_drift_compensator_|.
+  Metric* ptr_video_pool_frames_;
+  Metric* ptr_audio_pool_buffers_;
+  Metric* ptr_capture_frames_dropped_;
+  Metric* ptr_capture_frames_missed_;
+  Metric* ptr_audio_drift_ppm_;
+  Metric* ptr_audio_sync_error_us_;
+
+  // Memory governor accounts of the raw pools and of the muxer buffers, and
+  // the sizes of the last video frame and audio buffer captured, at which
+  // the pool buffers are counted.
+  MemoryAccount* ptr_capture_memory_;
+  MemoryAccount* ptr_muxer_memory_;
+  std::atomic<int32> video_frame_bytes_;
+  std::atomic<int32> audio_buffer_bytes_;
+
+  // Stream id passed to the tracepoints; see |Tracepoints::StreamId()|.
+  int32 trace_stream_id_;
+
+  // Stages watched by |stall_watchdog_|.
+  enum {
+    kStallCapture = 0,
+    kStallEncode = 1,
+    kNumStallStages = 2,
+  };
 
-  // Encoded duration in milliseconds.
-  int64 encoded_duration_;
+  // Watches capture input and encode passes when
+  // |config_.capture_stall_timeout_ms| is set. |capture_restart_requested_|
+  // is set by its callback, and handled by |EncodeShouldStop()|.
+  // |capture_restartable_| is cleared when the media source turns out not to
+  // support restarts, and |capture_restart_ms_| is the time of the last
+  // restart, or -1. |ptr_stalls_| counts stalls by stage.
+  StallWatchdog stall_watchdog_;
+  std::atomic<bool> capture_restart_requested_;
+  bool capture_restartable_;
+  int64 capture_restart_ms_;
+  Metric* ptr_stalls_[kNumStallStages];
+  Metric* ptr_capture_restarts_;
+  Metric* ptr_capture_restart_failures_;
+
+  // Steady clock time the final writes must finish by, or 0 when unbounded,
+  // and the number of writes abandoned at it. Set by |StopEncodeWorkers()|
+  // from |config_.stop_timeout_ms|.
+  int64 stop_deadline_ms_;
+  std::atomic<int> stop_abandoned_writes_;
+  Metric* ptr_stop_abandoned_writes_;
+
+  // Timeline of captured samples across media source restarts.
+  // |capture_offset_us_| is added to every sample. |capture_end_us_| is the
+  // end of the latest sample, after the offset, and |capture_end_wall_ms_|
+  // the steady clock time it arrived. |capture_resync_pending_| makes the
+  // next sample set the offset, under |capture_resync_mutex_|.
+  std::mutex capture_resync_mutex_;
+  std::atomic<bool> capture_resync_pending_;
+  std::atomic<int64> capture_offset_us_;
+  std::atomic<int64> capture_end_us_;
+  std::atomic<int64> capture_end_wall_ms_;
+
+  // Slate shown while video is lost; see |WebmEncoderConfig::slate_file|.
+  // |video_end_us_| is the end of the latest video frame captured, before
+  // |timestamp_offset_|, and |video_wall_ms_| the steady clock time it
+  // arrived, or 0. While |slate_active_|, slate frame |slate_frames_| is due
+  // at |slate_start_us_| plus its frame times, once as much time passed
+  // since |slate_start_ms_|. |slate_next_us_| is the end of the slate so
+  // far: earlier captured frames are dropped. |slate_source_failed_| is set
+  // once the media source fails for good. Used only by |EncoderThread()|,
+  // apart from the atomics.
+  VideoSlate slate_;
+  std::atomic<int64> video_end_us_;
+  std::atomic<int64> video_wall_ms_;
+  bool slate_active_;
+  int64 slate_start_us_;
+  int64 slate_start_ms_;
+  int64 slate_frames_;
+  int64 slate_next_us_;
+  bool slate_source_failed_;
+  VideoFrame slate_frame_;
+  Metric* ptr_slate_frames_;
+
+  // Adaptive sizing of |video_pool_| and |audio_pool_|, and the time the
+  // encoder thread's last pass through the encode loop took.
+  RawPoolSizing video_pool_sizing_;
+  RawPoolSizing audio_pool_sizing_;
+  int64 encode_pass_time_ms_;
 
   // Buffer object used to push |AudioBuffer|s from |MediaSourceImpl| into
   // |EncoderThread()|.
   BufferPool<AudioBuffer> audio_pool_;
 
-  // Most recent uncompressed audio buffer from |audio_pool_|.
-  AudioBuffer raw_audio_buffer_;
+  // Uncompressed audio buffers taken from |audio_pool_| by the current
+  // encode pass. Empty between passes.
+  BufferPool<AudioBuffer>::Batch audio_batch_;
 
-  // Most recent vorbis audio buffer from |vorbis_encoder_|.
+  // Most recent vorbis audio buffer from |audio_worker_|.
   AudioBuffer vorbis_audio_buffer_;
 
-  // Vorbis encoder object.
-  VorbisEncoder vorbis_encoder_;
+  // Compresses audio on its own thread.
+  std::unique_ptr<AudioEncodeWorker> audio_worker_;
+
+  // Audio inputs from |config_.extra_audio_tracks|, each with its own pool,
+  // encode worker and DASH muxer. Defined in webm_encoder.cc.
+  struct ExtraAudioTrack;
+  std::vector<std::unique_ptr<ExtraAudioTrack>> extra_audio_tracks_;
+
+  // Representations from |config_.audio_representations|, each with its own
+  // encode worker and DASH muxer, and the stage that feeds them and
+  // |audio_worker_| the main track's samples. Defined in webm_encoder.cc.
+  struct ExtraAudioRepresentation;
+  std::vector<std::unique_ptr<ExtraAudioRepresentation>>
+      audio_representations_;
+  std::unique_ptr<AudioFanOut> audio_fan_out_;
+
+  // Resamples raw audio before |audio_worker_| when
+  // |config_.audio_drift_correction| is set. Used only by the encode thread.
+  std::unique_ptr<AudioDriftCompensator> audio_drift_compensator_;
 
   // Encoder configuration.
   WebmEncoderConfig config_;
 
-  // Encoder loop function pointer.
-  EncoderLoopFunc ptr_encode_func_;
-
   // DASH manifest writer.
   std::unique_ptr<DashWriter> dash_writer_;
 
+  // Raw frames shared by |rep_workers_|. Declared before |rep_workers_| so
+  // that it outlives the frame handles the workers hold.
+  VideoFramePool rep_frame_pool_;
+
+  // Video encoders, one per entry in |config_.video_representations|; single
+  // bitrate encodes have one. DASH encodes also have one muxer per encoder.
+  // |rep_muxers_| are used only by |EncoderThread()|.
+  std::vector<std::unique_ptr<VideoEncodeWorker>> rep_workers_;
+  std::vector<std::unique_ptr<LiveWebmMuxer>> rep_muxers_;
+
   // Timestamp adjustment value. Expressed in milliseconds. Used to change
   // input buffer timestamps when a stream starts with a timestamp less than 0.
   int64 timestamp_offset_;
+
+  // Latency tracing state. |traced_upload_time_| is the start of the last
+  // chunk written to |ptr_data_sink_|, or -1 once its upload has been
+  // stamped. |latency_stats_| is a copy published by |EncoderThread()|.
+  LatencyCollector latency_collector_;
+  int64 traced_upload_time_;
+  StatusSnapshot<LatencyStats> latency_stats_;
+
+  // True when a dynamic manifest has changed since it was last sent. Used
+  // only by |EncoderThread()|.
+  bool manifest_pending_;
+
+  // Storage reused by |WriteManifestToDataSink()|, and the steady clock time
+  // at which it last sent the full manifest.
+  std::string manifest_buffer_;
+  std::string patch_buffer_;
+  int64 manifest_time_ms_;
+
+  // Hot standby state; see |WebmEncoderConfig::standby|. |standby_| is true
+  // until the encoder takes over the stream. |held_chunks_| holds, by muxer
+  // id, the metadata chunk and the latest |max_held_chunks_| chunks not
+  // written while on standby. |written_segments_| is the number of the
+  // latest chunk each muxer wrote, and the primary beats with the lowest.
+  // Used only by |EncoderThread()|.
+  struct HeldChunk {
+    HeldChunk() : number(0) {}
+    SharedDataChunk chunk;
+    std::string id;
+    int64 number;
+  };
+  StandbyHeartbeat heartbeat_;
+  bool standby_;
+  std::map<std::string, std::deque<HeldChunk> > held_chunks_;
+  size_t max_held_chunks_;
+  std::map<std::string, int64> written_segments_;
+
+  // Metadata chunks built by |PreviewHeaders()|, keyed by muxer id, and
+  // whether |WriteEarlyHeadersToDataSink()| sent them.
+  std::map<std::string, SharedDataChunk> early_headers_;
+  bool early_headers_sent_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WebmEncoder);
 };
 
@@ -8,15 +8,80 @@
 
 #include "encoder/webm_mux.h"
 
+#include <algorithm>
 #include <new>
+#include <random>
+#include <sstream>
 #include <vector>
 
+#include "encoder/latency_tracer.h"
+#include "encoder/metrics.h"
+#include "encoder/trace_log.h"
 #include "glog/logging.h"
 #include "libwebm/mkvmuxer.hpp"
 #include "libwebm/webmids.hpp"
 
 namespace {
 const int kAutoAssignTrackNum = 0;
+
+// Codec id of AV1 tracks; the bundled libwebm predates AV1.
+const char kAv1CodecId[] = "V_AV1";
+
+// EBML encoding used by native clusters. Element ids are stored with their
+// length marker bits, as in webmids.hpp.
+const uint8 kClusterId[] = {0x1F, 0x43, 0xB6, 0x75};
+const uint8 kTimecodeId = 0xE7;
+const uint8 kSimpleBlockId = 0xA3;
+const uint64 kUnknownSize = 0x01FFFFFFFFFFFFFFULL;
+const uint8 kSimpleBlockKeyframe = 0x80;
+
+// Largest block timecode relative to its cluster.
+const int64 kMaxBlockTimecode = 32767;
+
+// Longest cluster or block header written by native clusters.
+const int kMaxNativeHeaderLength = 32;
+
+// WebM encryption: encrypted blocks start with a signal byte whose low bit is
+// set, followed by the IV of the frame.
+const uint8 kEncryptedSignal = 0x01;
+const int kEncryptionHeaderLength = 1 + webmlive::AesCtr::kIvSize;
+
+// Returns the bytes needed to store |value| as an unsigned integer.
+int UIntSize(uint64 value) {
+  int size = 1;
+  while (size < 8 && (value >> (size * 8)) != 0) {
+    ++size;
+  }
+  return size;
+}
+
+// Returns the bytes needed to store |value| as an EBML size; the all ones
+// value of each length is reserved.
+int VintSize(uint64 value) {
+  int size = 1;
+  while (size < 8 && value >= (1ULL << (size * 7)) - 1) {
+    ++size;
+  }
+  return size;
+}
+
+// Stores |value| big endian in |size| bytes at |ptr_out|, and returns the
+// position after it.
+uint8* SerializeUInt(uint64 value, int size,
+                               uint8* ptr_out) {
+  for (int i = size - 1; i >= 0; --i) {
+    *ptr_out++ = static_cast<uint8>(value >> (i * 8));
+  }
+  return ptr_out;
+}
+
+// Stores |value| as an EBML size of |size| bytes at |ptr_out|, and returns
+// the position after it.
+uint8* SerializeVint(uint64 value, int size,
+                               uint8* ptr_out) {
+  const uint64 marker = 1ULL << (size * 7);
+  return SerializeUInt(value | marker, size, ptr_out);
+}
 }  // namespace
 
 namespace webmlive {
@@ -26,12 +91,28 @@ T milliseconds_to_timecode_ticks(T milliseconds) {
   return milliseconds * LiveWebmMuxer::kTimecodeScale;
 }
 
+// Copy that encrypts the data it copies with |ptr_cipher|, continuing its key
+// stream.
+class EncryptingCopy : public BlockBuffer::CopyInterface {
+ public:
+  explicit EncryptingCopy(AesCtr* ptr_cipher) : ptr_cipher_(ptr_cipher) {}
+  virtual ~EncryptingCopy() {}
+  virtual void Copy(const uint8* ptr_src, uint8* ptr_dst, int32 length) {
+    ptr_cipher_->Process(ptr_src, ptr_dst, length);
+  }
+
+ private:
+  AesCtr* ptr_cipher_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(EncryptingCopy);
+};
+
 // Buffer object implementing libwebm's IMkvWriter interface. Constructed from
 // user's |WebmChunkBuffer| to store data written by libwebm.
 class WebmMuxWriter : public mkvmuxer::IMkvWriter {
  public:
   enum {
     kNotImplemented = -200,
+    kNoMemory = -3,
     kNotInitialized = -2,
     kInvalidArg = -1,
     kSuccess = 0,
@@ -43,6 +124,19 @@ class WebmMuxWriter : public mkvmuxer::IMkvWriter {
   int32 Init(LiveWebmMuxer::WriteBuffer* ptr_write_buffer,
              const std::string& id);
 
+  // Passes all data written to |ptr_muxer| as it arrives, and notifies
+  // |ptr_muxer| of chunk boundaries. Used in streaming mode.
+  void set_streaming_muxer(LiveWebmMuxer* ptr_muxer) {
+    ptr_streaming_muxer_ = ptr_muxer;
+  }
+
+  // Notifies |ptr_muxer| of each cluster start position, for its chunk
+  // timing and cluster index. |ptr_muxer| decides which clusters end the
+  // current chunk; without it every cluster does.
+  void set_cluster_muxer(LiveWebmMuxer* ptr_muxer) {
+    ptr_cluster_muxer_ = ptr_muxer;
+  }
+
   // Accessors.
   int64 bytes_written() const { return bytes_written_; }
   int64 chunk_end() const { return chunk_end_; }
@@ -51,6 +145,10 @@ class WebmMuxWriter : public mkvmuxer::IMkvWriter {
   // updates |bytes_buffered_|.
   void EraseChunk();
 
+  // Moves chunk from |ptr_write_buffer_| into |ptr_chunk|, resets |chunk_end_|
+  // to 0, and updates |bytes_buffered_|. Returns |kSuccess| when successful.
+  int DetachChunk(DataChunk* ptr_chunk);
+
   // mkvmuxer::IMkvWriter methods
   // Returns total bytes of data passed to |Write|.
   virtual int64 Position() const { return bytes_written_; }
@@ -59,20 +157,52 @@ class WebmMuxWriter : public mkvmuxer::IMkvWriter {
   virtual int32 Position(int64) { return kNotImplemented; }  // NOLINT
 
   // Always returns false: |WebmMuxWriter| is never seekable. Written data
-  // goes into a vector, and data is buffered only until a chunk is completed.
+  // goes into a |BlockBuffer|, and data is buffered only until a chunk is
+  // completed.
   virtual bool Seekable() const { return false; }
 
   // Writes |ptr_buffer| contents to |ptr_write_buffer_|.
   virtual int32 Write(const void* ptr_buffer, uint32 buffer_length);
 
+  // |Write()| through |ptr_copy|, which may transform the data in the pass
+  // that buffers it. Streaming mode receives the transformed data. Behaves
+  // like |Write()| when |ptr_copy| is NULL.
+  int32 WriteWith(const void* ptr_buffer, uint32 buffer_length,
+                  BlockBuffer::CopyInterface* ptr_copy);
+
   // Called by libwebm, and notifies writer of element start position.
   virtual void ElementStartNotify(uint64 element_id, int64 position);
 
  private:
+  // Passes each run written by a |WriteWith()| copy to streaming mode as it
+  // lands in |ptr_write_buffer_|, and keeps the first failure.
+  class StreamingCopy : public BlockBuffer::CopyInterface {
+   public:
+    StreamingCopy(BlockBuffer::CopyInterface* ptr_copy,
+                  LiveWebmMuxer* ptr_muxer)
+        : ptr_copy_(ptr_copy), ptr_muxer_(ptr_muxer), status_(kSuccess) {}
+    virtual ~StreamingCopy() {}
+    virtual void Copy(const uint8* ptr_src, uint8* ptr_dst, int32 length) {
+      ptr_copy_->Copy(ptr_src, ptr_dst, length);
+      if (status_ == kSuccess) {
+        status_ = ptr_muxer_->StreamData(ptr_dst, length);
+      }
+    }
+    int status() const { return status_; }
+
+   private:
+    BlockBuffer::CopyInterface* ptr_copy_;
+    LiveWebmMuxer* ptr_muxer_;
+    int status_;
+    WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(StreamingCopy);
+  };
+
   int64 bytes_buffered_;
   int64 bytes_written_;
   int64 chunk_end_;
   LiveWebmMuxer::WriteBuffer* ptr_write_buffer_;
+  LiveWebmMuxer* ptr_streaming_muxer_;
+  LiveWebmMuxer* ptr_cluster_muxer_;
   std::string id_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WebmMuxWriter);
 };
@@ -81,7 +211,9 @@ WebmMuxWriter::WebmMuxWriter()
     : bytes_buffered_(0),
       bytes_written_(0),
       chunk_end_(0),
-      ptr_write_buffer_(NULL) {
+      ptr_write_buffer_(NULL),
+      ptr_streaming_muxer_(NULL),
+      ptr_cluster_muxer_(NULL) {
 }
 
 WebmMuxWriter::~WebmMuxWriter() {
@@ -100,15 +232,33 @@ int32 WebmMuxWriter::Init(LiveWebmMuxer::WriteBuffer* ptr_write_buffer,
 
 void WebmMuxWriter::EraseChunk() {
   if (ptr_write_buffer_) {
-    LiveWebmMuxer::WriteBuffer::iterator erase_end_pos =
-        ptr_write_buffer_->begin() + static_cast<int32>(chunk_end_);
-    ptr_write_buffer_->erase(ptr_write_buffer_->begin(), erase_end_pos);
+    ptr_write_buffer_->Discard(chunk_end_);
     bytes_buffered_ = ptr_write_buffer_->size();
     chunk_end_ = 0;
   }
 }
 
+int WebmMuxWriter::DetachChunk(DataChunk* ptr_chunk) {
+  if (!ptr_write_buffer_) {
+    LOG(ERROR) << "Cannot DetachChunk, not Initialized.";
+    return kNotInitialized;
+  }
+  const int status = ptr_write_buffer_->Detach(chunk_end_, ptr_chunk);
+  if (status) {
+    LOG(ERROR) << "Cannot detach chunk from write buffer: " << status;
+    return status == BlockBuffer::kNoMemory ? kNoMemory : kInvalidArg;
+  }
+  bytes_buffered_ = ptr_write_buffer_->size();
+  chunk_end_ = 0;
+  return kSuccess;
+}
+
 int32 WebmMuxWriter::Write(const void* ptr_buffer, uint32 buffer_length) {
+  return WriteWith(ptr_buffer, buffer_length, NULL);
+}
+
+int32 WebmMuxWriter::WriteWith(const void* ptr_buffer, uint32 buffer_length,
+                               BlockBuffer::CopyInterface* ptr_copy) {
   if (!ptr_write_buffer_) {
     LOG(ERROR) << "Cannot Write, not Initialized.";
     return kNotInitialized;
@@ -118,19 +268,45 @@ int32 WebmMuxWriter::Write(const void* ptr_buffer, uint32 buffer_length) {
     return kInvalidArg;
   }
   const uint8* ptr_data = reinterpret_cast<const uint8*>(ptr_buffer);
-  ptr_write_buffer_->insert(ptr_write_buffer_->end(),
-                            ptr_data,
-                            ptr_data + buffer_length);
+
+  // Streaming mode must see the data |ptr_copy| writes, not |ptr_data|.
+  StreamingCopy streaming_copy(ptr_copy, ptr_streaming_muxer_);
+  const bool stream_copy = ptr_copy && ptr_streaming_muxer_;
+  if (ptr_write_buffer_->AppendWith(ptr_data, buffer_length,
+                                    stream_copy ? &streaming_copy : ptr_copy)) {
+    LOG(ERROR) << "returning kNoMemory to libwebm: Append failed.";
+    return kNoMemory;
+  }
   bytes_written_ += buffer_length;
   bytes_buffered_ = ptr_write_buffer_->size();
+  if (ptr_streaming_muxer_) {
+    const int status = stream_copy ? streaming_copy.status() :
+        ptr_streaming_muxer_->StreamData(ptr_data, buffer_length);
+    if (status) {
+      LOG(ERROR) << "returning kNoMemory to libwebm: StreamData failed.";
+      return kNoMemory;
+    }
+  }
   return kSuccess;
 }
 
 void WebmMuxWriter::ElementStartNotify(uint64 element_id, int64 position) {
   if (element_id == mkvmuxer::kMkvCluster) {
+    // Clusters that continue the current chunk are left in it.
+    if (ptr_cluster_muxer_ && !ptr_cluster_muxer_->ClusterStarted(position))
+      return;
     chunk_end_ = bytes_buffered_;
+
+    // Keep the cluster out of the chunk's last block so that |DetachChunk()|
+    // can move the chunk without copying any of it.
+    ptr_write_buffer_->EndBlock();
+
+    // The cluster starts the next streaming chunk.
+    if (ptr_streaming_muxer_)
+      ptr_streaming_muxer_->EndStreamingChunk();
     if (id_ == "video") {
-      LOG(INFO) << "video chunk_end_=" << chunk_end_<< " position=" << position;
+      WEBMLIVE_TRACE(TraceLog::kChunk, "video_chunk_end")
+          << " chunk_end=" << chunk_end_ << " position=" << position;
     }
   }
 }
@@ -143,15 +319,50 @@ LiveWebmMuxer::LiveWebmMuxer()
     : audio_track_num_(0),
       video_track_num_(0),
       muxer_time_(0),
-      chunks_read_(0) {
+      chunks_read_(0),
+      ptr_buffered_bytes_(NULL),
+      streaming_chunks_taken_(0),
+      chunk_duration_(0),
+      chunks_started_(0),
+      finalizing_(false),
+      next_block_timestamp_(0),
+      next_block_video_(false),
+      next_block_keyframe_(false),
+      previous_chunk_timecode_(-1),
+      current_chunk_timecode_(-1),
+      chunk_byte_budget_(0),
+      chunk_alignment_(0),
+      chunk_start_offset_(0),
+      forced_split_(false),
+      previous_chunk_keyframe_(false),
+      current_chunk_keyframe_(false),
+      chunk_needs_video_(false),
+      cluster_index_enabled_(false),
+      index_needs_video_(false),
+      native_clusters_(false),
+      cluster_duration_(0),
+      cluster_timecode_(-1),
+      encryption_enabled_(false),
+      next_iv_(0) {
 }
 
 LiveWebmMuxer::~LiveWebmMuxer() {
 }
 
 int LiveWebmMuxer::Init(int32 cluster_duration_milliseconds,
-                        const std::string& muxer_id) {
+                        const std::string& muxer_id,
+                        const std::string& metrics_labels) {
   muxer_id_ = muxer_id;
+  metrics_labels_ = metrics_labels;
+  ptr_buffered_bytes_ = MetricsRegistry::Instance().GetGauge(
+      "webmlive_muxer_buffered_bytes",
+      MetricsRegistry::JoinLabels(metrics_labels,
+                                  "muxer=\"" + muxer_id + "\""),
+      "Bytes held by the muxer and not yet read as chunks.");
+  if (!ptr_buffered_bytes_) {
+    LOG(ERROR) << "cannot create muxer metrics.";
+    return kNoMemory;
+  }
 
   // Construct and Init |WebmMuxWriter|-- it handles writes coming from libwebm.
   ptr_writer_.reset(new (std::nothrow) WebmMuxWriter());  // NOLINT
@@ -163,6 +374,7 @@ int LiveWebmMuxer::Init(int32 cluster_duration_milliseconds,
     LOG(ERROR) << "cannot Init WebmWriteBuffer.";
     return kMuxerError;
   }
+  ptr_writer_->set_cluster_muxer(this);
 
   // Construct and Init |ptr_segment_|, then enable live mode.
   ptr_segment_.reset(new (std::nothrow) mkvmuxer::Segment());  // NOLINT
@@ -178,6 +390,7 @@ int LiveWebmMuxer::Init(int32 cluster_duration_milliseconds,
 
   ptr_segment_->set_mode(mkvmuxer::Segment::kLive);
   if (cluster_duration_milliseconds > 0) {
+    cluster_duration_ = cluster_duration_milliseconds;
     const uint64 max_cluster_duration =
         milliseconds_to_timecode_ticks(cluster_duration_milliseconds);
     ptr_segment_->set_max_cluster_duration(max_cluster_duration);
@@ -265,14 +478,69 @@ int LiveWebmMuxer::AddTrack(const AudioConfig& audio_config,
     LOG(ERROR) << "Unable to write audio track codec private data.";
     return kAudioTrackError;
   }
+  if (encryption_enabled_ &&
+      AddTrackEncryption(ptr_segment_.get(), audio_track_num_)) {
+    return kAudioTrackError;
+  }
+  return kSuccess;
+}
+
+// Opus tracks always declare a 48 kHz sampling frequency; the input rate is
+// stored in the OpusHead structure.
+int LiveWebmMuxer::AddTrack(const AudioConfig& audio_config,
+                            const OpusCodecPrivate& codec_private) {
+  if (audio_track_num_ != 0) {
+    LOG(ERROR) << "Cannot add audio track: it already exists.";
+    return kAudioTrackAlreadyExists;
+  }
+  if (!codec_private.ptr_data || codec_private.length <= 0) {
+    LOG(ERROR) << "Cannot add audio track: NULL private data contents.";
+    return kAudioPrivateDataInvalid;
+  }
+  audio_track_num_ = ptr_segment_->AddAudioTrack(48000,
+                                                 audio_config.channels,
+                                                 kAutoAssignTrackNum);
+  if (!audio_track_num_) {
+    LOG(ERROR) << "cannot AddAudioTrack on segment.";
+    return kAudioTrackError;
+  }
+  mkvmuxer::AudioTrack* const ptr_audio_track =
+      static_cast<mkvmuxer::AudioTrack*>(
+          ptr_segment_->GetTrackByNumber(audio_track_num_));
+  if (!ptr_audio_track) {
+    LOG(ERROR) << "Unable to access audio track.";
+    return kAudioTrackError;
+  }
+  ptr_audio_track->set_codec_id(mkvmuxer::Tracks::kOpusCodecId);
+  ptr_audio_track->set_codec_delay(codec_private.codec_delay_ns);
+  ptr_audio_track->set_seek_pre_roll(codec_private.seek_preroll_ns);
+  if (!ptr_audio_track->SetCodecPrivate(codec_private.ptr_data,
+                                        codec_private.length)) {
+    LOG(ERROR) << "Unable to write audio track codec private data.";
+    return kAudioTrackError;
+  }
+  if (encryption_enabled_ &&
+      AddTrackEncryption(ptr_segment_.get(), audio_track_num_)) {
+    return kAudioTrackError;
+  }
   return kSuccess;
 }
 
 int LiveWebmMuxer::AddTrack(const VideoConfig& video_config) {
+  return AddTrack(video_config, VideoCodecPrivate());
+}
+
+int LiveWebmMuxer::AddTrack(const VideoConfig& video_config,
+                            const VideoCodecPrivate& codec_private) {
   if (video_track_num_ != 0) {
     LOG(ERROR) << "Cannot add video track: it already exists.";
     return kVideoTrackAlreadyExists;
   }
+  const bool av1 = video_config.format == kVideoFormatAV1;
+  if (av1 && (!codec_private.ptr_data || codec_private.length <= 0)) {
+    LOG(ERROR) << "AV1 video track requires codec private data.";
+    return kVideoPrivateDataInvalid;
+  }
   video_track_num_ = ptr_segment_->AddVideoTrack(video_config.width,
                                                  video_config.height,
                                                  kAutoAssignTrackNum);
@@ -289,14 +557,178 @@ int LiveWebmMuxer::AddTrack(const VideoConfig& video_config) {
       LOG(ERROR) << "cannot get video track to set codec.\n";
       return kVideoTrackError;
     }
-    video_track->set_codec_id(mkvmuxer::Tracks::kVp9CodecId);
+    video_track->set_codec_id(av1 ? kAv1CodecId :
+                                    mkvmuxer::Tracks::kVp9CodecId);
+    if (av1 && !video_track->SetCodecPrivate(codec_private.ptr_data,
+                                             codec_private.length)) {
+      LOG(ERROR) << "Unable to write video track codec private data.";
+      return kVideoTrackError;
+    }
+  }
+  if (encryption_enabled_ &&
+      AddTrackEncryption(ptr_segment_.get(), video_track_num_)) {
+    return kVideoTrackError;
+  }
+
+  return kSuccess;
+}
+
+int LiveWebmMuxer::PreviewHeader(SharedDataChunk* ptr_header) const {
+  if (!ptr_header) {
+    LOG(ERROR) << "NULL header pointer.";
+    return kInvalidArg;
+  }
+  if ((audio_track_num_ == 0 && video_track_num_ == 0) ||
+      ptr_writer_->bytes_written() > 0) {
+    return kNoChunkReady;
+  }
+
+  LiveWebmMuxer preview;
+  int status = preview.Init(0, muxer_id_, metrics_labels_);
+  if (status) {
+    LOG(ERROR) << "cannot Init header preview muxer: " << status;
+    return status;
+  }
+
+  // The preview shares this muxer's id; keep it from reporting its buffer.
+  preview.ptr_buffered_bytes_ = NULL;
+
+  status = CopyTracks(preview.ptr_segment_.get(), true,
+                      &preview.audio_track_num_, &preview.video_track_num_);
+  if (status) {
+    return status;
+  }
+  if (encryption_enabled_) {
+    const uint64 track_nums[] = {
+      preview.audio_track_num_, preview.video_track_num_
+    };
+    for (size_t i = 0; i < sizeof(track_nums) / sizeof(track_nums[0]); ++i) {
+      if (track_nums[i] != 0 &&
+          AddTrackEncryption(preview.ptr_segment_.get(), track_nums[i])) {
+        return kMuxerError;
+      }
+    }
+  }
+
+  // libwebm writes the header along with the first frame. The placeholder
+  // frame starts a cluster, which ends the metadata chunk.
+  const uint8 kPlaceholderFrame[1] = {0};
+  const uint64 track_num = preview.video_track_num_ != 0 ?
+      preview.video_track_num_ : preview.audio_track_num_;
+  if (!preview.ptr_segment_->AddFrame(kPlaceholderFrame,
+                                      sizeof(kPlaceholderFrame),
+                                      track_num, 0, true)) {
+    LOG(ERROR) << "cannot write header preview frame.";
+    return kMuxerError;
+  }
+  return preview.ReadChunk(ptr_header);
+}
+
+int LiveWebmMuxer::CopyTracks(mkvmuxer::Segment* ptr_segment,
+                              bool keep_numbers,
+                              uint64* ptr_audio_track_num,
+                              uint64* ptr_video_track_num) const {
+  if (!ptr_segment || !ptr_audio_track_num || !ptr_video_track_num) {
+    LOG(ERROR) << "NULL segment or track number pointer.";
+    return kInvalidArg;
+  }
+  *ptr_audio_track_num = 0;
+  *ptr_video_track_num = 0;
+  using mkvmuxer::AudioTrack;
+  using mkvmuxer::VideoTrack;
+  if (audio_track_num_ != 0) {
+    const AudioTrack* const ptr_track = static_cast<const AudioTrack*>(
+        ptr_segment_->GetTrackByNumber(audio_track_num_));
+    *ptr_audio_track_num = ptr_segment->AddAudioTrack(
+        static_cast<int32>(ptr_track->sample_rate()),
+        static_cast<int32>(ptr_track->channels()),
+        keep_numbers ?
+            static_cast<int32>(ptr_track->number()) : kAutoAssignTrackNum);
+    AudioTrack* const ptr_copy = static_cast<AudioTrack*>(
+        ptr_segment->GetTrackByNumber(*ptr_audio_track_num));
+    if (!ptr_copy) {
+      LOG(ERROR) << "cannot copy audio track.";
+      return kAudioTrackError;
+    }
+    ptr_copy->set_uid(ptr_track->uid());
+    ptr_copy->set_codec_id(ptr_track->codec_id());
+    ptr_copy->set_bit_depth(ptr_track->bit_depth());
+    ptr_copy->set_codec_delay(ptr_track->codec_delay());
+    ptr_copy->set_seek_pre_roll(ptr_track->seek_pre_roll());
+    if (!ptr_copy->SetCodecPrivate(ptr_track->codec_private(),
+                                   ptr_track->codec_private_length())) {
+      LOG(ERROR) << "cannot copy audio codec private data.";
+      return kAudioTrackError;
+    }
+  }
+  if (video_track_num_ != 0) {
+    const VideoTrack* const ptr_track = static_cast<const VideoTrack*>(
+        ptr_segment_->GetTrackByNumber(video_track_num_));
+    *ptr_video_track_num = ptr_segment->AddVideoTrack(
+        static_cast<int32>(ptr_track->width()),
+        static_cast<int32>(ptr_track->height()),
+        keep_numbers ?
+            static_cast<int32>(ptr_track->number()) : kAutoAssignTrackNum);
+    VideoTrack* const ptr_copy = static_cast<VideoTrack*>(
+        ptr_segment->GetTrackByNumber(*ptr_video_track_num));
+    if (!ptr_copy) {
+      LOG(ERROR) << "cannot copy video track.";
+      return kVideoTrackError;
+    }
+    ptr_copy->set_uid(ptr_track->uid());
+    ptr_copy->set_codec_id(ptr_track->codec_id());
+    if (ptr_track->codec_private_length() > 0 &&
+        !ptr_copy->SetCodecPrivate(ptr_track->codec_private(),
+                                   ptr_track->codec_private_length())) {
+      LOG(ERROR) << "cannot copy video codec private data.";
+      return kVideoTrackError;
+    }
+  }
+  return kSuccess;
+}
+
+int LiveWebmMuxer::SetChunkDuration(int32 chunk_duration_milliseconds) {
+  if (chunk_duration_milliseconds < 0) {
+    LOG(ERROR) << "invalid chunk duration: " << chunk_duration_milliseconds;
+    return kInvalidArg;
+  }
+  if (ptr_writer_->bytes_written() > 0) {
+    LOG(ERROR) << "chunk duration must be set before frames are written.";
+    return kMuxerError;
   }
+  chunk_duration_ = chunk_duration_milliseconds;
+  return kSuccess;
+}
+
+int LiveWebmMuxer::SetChunkByteBudget(int64 max_bytes) {
+  if (max_bytes < 0) {
+    LOG(ERROR) << "invalid chunk byte budget: " << max_bytes;
+    return kInvalidArg;
+  }
+  if (ptr_writer_->bytes_written() > 0) {
+    LOG(ERROR) << "chunk byte budget must be set before frames are written.";
+    return kMuxerError;
+  }
+  chunk_byte_budget_ = max_bytes;
+  return kSuccess;
+}
 
+int LiveWebmMuxer::SetChunkAlignment(int64 interval_milliseconds) {
+  if (interval_milliseconds < 0) {
+    LOG(ERROR) << "invalid chunk alignment: " << interval_milliseconds;
+    return kInvalidArg;
+  }
+  if (ptr_writer_->bytes_written() > 0) {
+    LOG(ERROR) << "chunk alignment must be set before frames are written.";
+    return kMuxerError;
+  }
+  chunk_alignment_ = interval_milliseconds;
   return kSuccess;
 }
 
 int LiveWebmMuxer::Finalize() {
-  if (!ptr_segment_->Finalize()) {
+  // Native clusters have unknown sizes, and leave libwebm nothing to flush.
+  if (!native_clusters_ && !ptr_segment_->Finalize()) {
     LOG(ERROR) << "libwebm mkvmuxer Finalize failed.";
     return kMuxerError;
   }
@@ -307,9 +739,11 @@ int LiveWebmMuxer::Finalize() {
     // |ChunkReady()| to return true one final time. This last chunk will
     // contain any data passed to |mkvmuxer::Segment::AddFrame()| since the
     // last call to |WebmMuxWriter::ElementStartNotify()|.
+    finalizing_ = true;
     ptr_writer_->ElementStartNotify(mkvmuxer::kMkvCluster,
                                     ptr_writer_->bytes_written());
   }
+  EndStreamingChunk();
 
   return kSuccess;
 }
@@ -324,12 +758,27 @@ int LiveWebmMuxer::WriteVideoFrame(const VideoFrame& vpx_frame) {
     return kInvalidArg;
   }
   if (vpx_frame.format() != kVideoFormatVP8 &&
-      vpx_frame.format() != kVideoFormatVP9) {
+      vpx_frame.format() != kVideoFormatVP9 &&
+      vpx_frame.format() != kVideoFormatAV1) {
     LOG(ERROR) << "cannot write non-VPx frame.";
     return kInvalidArg;
   }
   const int64 timecode = milliseconds_to_timecode_ticks(vpx_frame.timestamp());
-  if (!ptr_segment_->AddFrame(vpx_frame.buffer(),
+  NextBlock(vpx_frame.timestamp(), true, vpx_frame.keyframe());
+  if (native_clusters_) {
+    if (WriteNativeBlock(vpx_frame.buffer(), vpx_frame.buffer_length(),
+                         video_track_num_, vpx_frame.timestamp(), true,
+                         vpx_frame.keyframe())) {
+      LOG(ERROR) << "native cluster write (video) failed.";
+      return kVideoWriteError;
+    }
+  } else if (encryption_enabled_) {
+    if (!AddEncryptedFrame(vpx_frame.buffer(), vpx_frame.buffer_length(),
+                           video_track_num_, timecode, vpx_frame.keyframe())) {
+      LOG(ERROR) << "AddFrame (encrypted video) failed.";
+      return kVideoWriteError;
+    }
+  } else if (!ptr_segment_->AddFrame(vpx_frame.buffer(),
                               vpx_frame.buffer_length(),
                               video_track_num_,
                               timecode,
@@ -337,6 +786,9 @@ int LiveWebmMuxer::WriteVideoFrame(const VideoFrame& vpx_frame) {
     LOG(ERROR) << "AddFrame (video) failed.";
     return kVideoWriteError;
   }
+  BlockWritten(vpx_frame.timestamp(), true, vpx_frame.keyframe());
+  LatencyTracer::Stamp(LatencyTracer::kMux, vpx_frame.timestamp());
+  UpdateBufferedBytes();
   muxer_time_ = vpx_frame.timestamp();
   return kSuccess;
 }
@@ -350,13 +802,29 @@ int LiveWebmMuxer::WriteAudioBuffer(const AudioBuffer& vorbis_buffer) {
     LOG(ERROR) << "cannot write empty audio buffer.";
     return kInvalidArg;
   }
-  if (vorbis_buffer.config().format_tag != kAudioFormatVorbis) {
-    LOG(ERROR) << "cannot write non-Vorbis audio buffer.";
+  const uint16 format_tag = vorbis_buffer.config().format_tag;
+  if (format_tag != kAudioFormatVorbis && format_tag != kAudioFormatOpus) {
+    LOG(ERROR) << "cannot write non-Vorbis/Opus audio buffer.";
     return kInvalidArg;
   }
   const int64 timecode =
       milliseconds_to_timecode_ticks(vorbis_buffer.timestamp());
-  if (!ptr_segment_->AddFrame(vorbis_buffer.buffer(),
+  NextBlock(vorbis_buffer.timestamp(), false, false);
+  if (native_clusters_) {
+    if (WriteNativeBlock(vorbis_buffer.buffer(),
+                         vorbis_buffer.buffer_length(), audio_track_num_,
+                         vorbis_buffer.timestamp(), false, true)) {
+      LOG(ERROR) << "native cluster write (audio) failed.";
+      return kAudioWriteError;
+    }
+  } else if (encryption_enabled_) {
+    if (!AddEncryptedFrame(vorbis_buffer.buffer(),
+                           vorbis_buffer.buffer_length(), audio_track_num_,
+                           timecode, true)) {
+      LOG(ERROR) << "AddFrame (encrypted audio) failed.";
+      return kAudioWriteError;
+    }
+  } else if (!ptr_segment_->AddFrame(vorbis_buffer.buffer(),
                               vorbis_buffer.buffer_length(),
                               audio_track_num_,
                               timecode,
@@ -364,6 +832,8 @@ int LiveWebmMuxer::WriteAudioBuffer(const AudioBuffer& vorbis_buffer) {
     LOG(ERROR) << "AddFrame (audio) failed.";
     return kAudioWriteError;
   }
+  BlockWritten(vorbis_buffer.timestamp(), false, false);
+  UpdateBufferedBytes();
   muxer_time_ = vorbis_buffer.timestamp();
   return kSuccess;
 }
@@ -381,8 +851,8 @@ bool LiveWebmMuxer::ChunkReady(int32* ptr_chunk_length) {
   return false;
 }
 
-// Copies the buffered chunk data into |ptr_buf|, erases it from |buffer_|, and
-// calls |WebmMuxWriter::ResetChunkEnd()| to zero the chunk end position.
+// Copies the buffered chunk data into |ptr_buf|, and calls |DiscardChunk()| to
+// erase it from |buffer_| and zero the chunk end position.
 int LiveWebmMuxer::ReadChunk(int32 buffer_capacity, uint8* ptr_buf) {
   if (!ptr_buf) {
     LOG(ERROR) << "NULL buffer pointer.";
@@ -402,15 +872,440 @@ int LiveWebmMuxer::ReadChunk(int32 buffer_capacity, uint8* ptr_buf) {
     return kUserBufferTooSmall;
   }
 
-  LOG(INFO) << "ReadChunk capacity=" << buffer_capacity
-            << " length=" << chunk_length
-            << " total buffered=" << buffer_.size();
+  WEBMLIVE_TRACE(TraceLog::kChunk, "read_chunk")
+      << " capacity=" << buffer_capacity
+      << " length=" << chunk_length
+      << " buffered=" << buffer_.size();
 
   // Copy chunk to user buffer, and erase it from |buffer_|.
-  memcpy(ptr_buf, &buffer_[0], chunk_length);
+  if (buffer_.Read(chunk_length, ptr_buf)) {
+    LOG(ERROR) << "Cannot read chunk from buffer.";
+    return kMuxerError;
+  }
+  return DiscardChunk();
+}
+
+int LiveWebmMuxer::ReadChunk(SharedDataChunk* ptr_chunk) {
+  if (!ptr_chunk) {
+    LOG(ERROR) << "NULL chunk pointer.";
+    return kInvalidArg;
+  }
+  if (ptr_writer_->chunk_end() <= 0) {
+    return kNoChunkReady;
+  }
+  std::shared_ptr<DataChunk> chunk(new (std::nothrow) DataChunk());  // NOLINT
+  if (!chunk) {
+    LOG(ERROR) << "Cannot construct DataChunk.";
+    return kNoMemory;
+  }
+  const int status = ptr_writer_->DetachChunk(chunk.get());
+  if (status) {
+    LOG(ERROR) << "Cannot move chunk out of buffer: " << status;
+    return status == WebmMuxWriter::kNoMemory ? kNoMemory : kMuxerError;
+  }
+  chunk->set_starts_with_keyframe(ChunkStartsWithKeyframe());
+  ++chunks_read_;
+  *ptr_chunk = chunk;
+  UpdateBufferedBytes();
+  return kSuccess;
+}
+
+int LiveWebmMuxer::EnableStreaming() {
+  if (!ptr_writer_) {
+    LOG(ERROR) << "Cannot EnableStreaming before Init.";
+    return kMuxerError;
+  }
+  if (ptr_writer_->bytes_written() > 0) {
+    LOG(ERROR) << "Cannot EnableStreaming after data has been written.";
+    return kMuxerError;
+  }
+  ptr_writer_->set_streaming_muxer(this);
+  return kSuccess;
+}
+
+int LiveWebmMuxer::EnableClusterIndex() {
+  if (!ptr_writer_) {
+    LOG(ERROR) << "Cannot EnableClusterIndex before Init.";
+    return kMuxerError;
+  }
+  if (ptr_writer_->bytes_written() > 0) {
+    LOG(ERROR) << "Cannot EnableClusterIndex after data has been written.";
+    return kMuxerError;
+  }
+  cluster_index_enabled_ = true;
+  return kSuccess;
+}
+
+int LiveWebmMuxer::EnableNativeClusters() {
+  if (!ptr_writer_) {
+    LOG(ERROR) << "Cannot EnableNativeClusters before Init.";
+    return kMuxerError;
+  }
+  if (ptr_writer_->bytes_written() > 0) {
+    LOG(ERROR) << "Cannot EnableNativeClusters after data has been written.";
+    return kMuxerError;
+  }
+  native_clusters_ = true;
+  return kSuccess;
+}
+
+int LiveWebmMuxer::EnableEncryption(const std::string& key_id,
+                                    const std::string& key) {
+  if (!ptr_writer_) {
+    LOG(ERROR) << "Cannot EnableEncryption before Init.";
+    return kMuxerError;
+  }
+  if (audio_track_num_ != 0 || video_track_num_ != 0) {
+    LOG(ERROR) << "Cannot EnableEncryption after tracks have been added.";
+    return kMuxerError;
+  }
+  if (key_id.empty()) {
+    LOG(ERROR) << "Cannot EnableEncryption without a key id.";
+    return kInvalidArg;
+  }
+  if (cipher_.Init(reinterpret_cast<const uint8*>(key.data()),
+                   static_cast<int32>(key.size()))) {
+    LOG(ERROR) << "invalid encryption key, length " << key.size() << ".";
+    return kInvalidArg;
+  }
+
+  // A random first IV keeps the IVs of restarted encoders sharing the key
+  // from repeating those already used.
+  std::random_device random;
+  next_iv_ = (static_cast<uint64>(random()) << 32) | random();
+  encryption_key_id_ = key_id;
+  encryption_enabled_ = true;
+  LOG(INFO) << muxer_id_ << " encrypting with AES-CTR"
+            << (cipher_.hardware() ? " (hardware)." : ".");
+  return kSuccess;
+}
+
+bool LiveWebmMuxer::WriteClusterIndex(std::string* ptr_index) const {
+  if (!ptr_index || !cluster_index_enabled_) {
+    return false;
+  }
+  std::ostringstream index;
+  index << "# chunk offset timecode_ms keyframe\n";
+  for (size_t i = 0; i < cluster_index_.size(); ++i) {
+    const ClusterIndexEntry& entry = cluster_index_[i];
+    if (entry.timecode < 0) {
+      continue;
+    }
+    index << entry.chunk << " " << entry.offset << " " << entry.timecode << " "
+          << (entry.keyframe ? 1 : 0) << "\n";
+  }
+  *ptr_index = index.str();
+  return true;
+}
+
+bool LiveWebmMuxer::ChunkTiming(int64* ptr_start, int64* ptr_duration) const {
+  if (!ptr_start || !ptr_duration || previous_chunk_timecode_ < 0) {
+    return false;
+  }
+  // The chunk ends where the next chunk begins. |Finalize()| starts no
+  // cluster with blocks, so the final chunk ends at the last block written.
+  const int64 end = (current_chunk_timecode_ >= 0) ?
+      current_chunk_timecode_ : muxer_time_;
+  *ptr_start = previous_chunk_timecode_;
+  *ptr_duration = std::max<int64>(end - previous_chunk_timecode_, 0);
+  return true;
+}
+
+// Without a chunk duration or alignment every cluster starts a chunk.
+// Otherwise chunks start with video keyframes, or for muxers without video,
+// with the first cluster that begins |chunk_duration_| after the current
+// chunk, or only where |NextBlock()| forces a split when aligned. Clusters
+// started for the chunk byte budget always start a chunk. The metadata chunk
+// always ends at the first cluster, and |Finalize()| always ends the last
+// chunk.
+bool LiveWebmMuxer::ClusterStarted(int64 offset) {
+  bool starts_chunk = true;
+  if ((chunk_duration_ > 0 || chunk_alignment_ > 0) && chunks_started_ > 0 &&
+      !finalizing_ && !forced_split_) {
+    if (video_track_num_ != 0) {
+      starts_chunk = next_block_video_ && next_block_keyframe_;
+    } else {
+      starts_chunk = current_chunk_timecode_ < 0 ||
+          (chunk_alignment_ == 0 &&
+           next_block_timestamp_ - current_chunk_timecode_ >=
+               chunk_duration_);
+    }
+  }
+  forced_split_ = false;
+  if (starts_chunk) {
+    ++chunks_started_;
+    chunk_start_offset_ = offset;
+    previous_chunk_timecode_ = current_chunk_timecode_;
+    current_chunk_timecode_ = -1;
+    previous_chunk_keyframe_ = current_chunk_keyframe_;
+    current_chunk_keyframe_ = (video_track_num_ == 0);
+    chunk_needs_video_ = (video_track_num_ != 0);
+  }
+
+  // The cluster |Finalize()| reports holds no blocks.
+  if (!cluster_index_enabled_ || finalizing_) {
+    return starts_chunk;
+  }
+  ClusterIndexEntry entry;
+  entry.offset = offset;
+  entry.chunk = chunks_started_;
+  entry.keyframe = (video_track_num_ == 0);
+  cluster_index_.push_back(entry);
+  index_needs_video_ = (video_track_num_ != 0);
+  return starts_chunk;
+}
+
+// The budget is checked between blocks, so chunks end at frame boundaries,
+// and a chunk always holds at least one block however large it is.
+void LiveWebmMuxer::NextBlock(int64 timestamp, bool video, bool keyframe) {
+  next_block_timestamp_ = timestamp;
+  next_block_video_ = video;
+  next_block_keyframe_ = keyframe;
+  if (chunk_byte_budget_ > 0 && !forced_split_ && chunks_started_ > 1 &&
+      current_chunk_timecode_ >= 0 &&
+      ptr_writer_->bytes_written() - chunk_start_offset_ >=
+          chunk_byte_budget_) {
+    VLOG(1) << muxer_id_ << " chunk over " << chunk_byte_budget_
+            << " bytes; splitting at " << timestamp << " ms.";
+    ForceChunkSplit();
+  }
+  if (chunk_alignment_ > 0 && video_track_num_ == 0 && !forced_split_ &&
+      chunks_started_ > 1 && current_chunk_timecode_ >= 0 &&
+      timestamp / chunk_alignment_ !=
+          current_chunk_timecode_ / chunk_alignment_) {
+    ForceChunkSplit();
+  }
+}
+
+void LiveWebmMuxer::ForceChunkSplit() {
+  forced_split_ = true;
+  if (!native_clusters_) {
+    ptr_segment_->ForceNewClusterOnNextFrame();
+  }
+}
+
+// libwebm writes a cluster header before the first block of the cluster, so
+// the first block added after |ClusterStarted()| supplies the cluster
+// timecode, and the chunk timecode when the cluster starts a chunk.
+void LiveWebmMuxer::BlockWritten(int64 timestamp, bool video, bool keyframe) {
+  if (current_chunk_timecode_ < 0) {
+    current_chunk_timecode_ = timestamp;
+  }
+  if (video && chunk_needs_video_) {
+    current_chunk_keyframe_ = keyframe;
+    chunk_needs_video_ = false;
+  }
+  if (!cluster_index_enabled_ || cluster_index_.empty()) {
+    return;
+  }
+  ClusterIndexEntry& entry = cluster_index_.back();
+  if (entry.timecode < 0) {
+    entry.timecode = timestamp;
+  }
+  if (video && index_needs_video_) {
+    entry.keyframe = keyframe;
+    index_needs_video_ = false;
+  }
+}
+
+// Cluster start rules follow |mkvmuxer::Segment|, so that native and libwebm
+// output split into the same clusters and chunks. libwebm also rejects blocks
+// older than their cluster.
+int LiveWebmMuxer::WriteNativeBlock(const uint8* ptr_data, int32 length,
+                                    uint64 track_num, int64 timestamp,
+                                    bool video, bool keyframe) {
+  // Track numbers are written as one byte EBML integers.
+  if (length <= 0 || track_num == 0 || track_num > 126) {
+    LOG(ERROR) << "invalid native block.";
+    return kMuxerError;
+  }
+  if (ptr_writer_->bytes_written() == 0 && WriteNativeHeader()) {
+    return kMuxerError;
+  }
+  if (cluster_timecode_ >= 0 && timestamp < cluster_timecode_) {
+    LOG(ERROR) << "block timestamp " << timestamp << " precedes its cluster.";
+    return kMuxerError;
+  }
+  const int64 cluster_time = timestamp - cluster_timecode_;
+  if (cluster_timecode_ < 0 || (video && keyframe) || forced_split_ ||
+      cluster_time > kMaxBlockTimecode ||
+      (cluster_duration_ > 0 && cluster_time >= cluster_duration_)) {
+    if (StartNativeCluster(timestamp)) {
+      return kMuxerError;
+    }
+  }
+
+  // SimpleBlock: track number, timecode relative to the cluster, and flags,
+  // followed by the payload, which is written from |ptr_data| directly.
+  // Encrypted payloads start with the signal byte and IV, and the frame is
+  // encrypted as it is copied into |buffer_|.
+  const int encryption_length =
+      encryption_enabled_ ? kEncryptionHeaderLength : 0;
+  const uint64 block_size = 1 + 2 + 1 + encryption_length + length;
+  uint8 header[kMaxNativeHeaderLength];
+  uint8* ptr_header = header;
+  *ptr_header++ = kSimpleBlockId;
+  ptr_header = SerializeVint(block_size, VintSize(block_size), ptr_header);
+  ptr_header = SerializeVint(track_num, 1, ptr_header);
+  ptr_header = SerializeUInt(timestamp - cluster_timecode_, 2, ptr_header);
+  *ptr_header++ = keyframe ? kSimpleBlockKeyframe : 0;
+  EncryptingCopy encrypting_copy(&cipher_);
+  if (encryption_enabled_) {
+    ptr_header = StartEncryptedFrame(ptr_header);
+  }
+  if (ptr_writer_->Write(header, static_cast<uint32>(ptr_header - header)) ||
+      ptr_writer_->WriteWith(ptr_data, length,
+                             encryption_enabled_ ? &encrypting_copy : NULL)) {
+    return kMuxerError;
+  }
+  return kSuccess;
+}
+
+// libwebm writes the header along with its first frame; |PreviewHeader()|
+// already builds exactly those bytes in a scratch muxer.
+int LiveWebmMuxer::WriteNativeHeader() {
+  SharedDataChunk header;
+  const int status = PreviewHeader(&header);
+  if (status) {
+    LOG(ERROR) << "cannot build native cluster header: " << status;
+    return kMuxerError;
+  }
+  const std::vector<DataChunk::Span>& spans = header->spans();
+  for (size_t i = 0; i < spans.size(); ++i) {
+    if (ptr_writer_->Write(spans[i].ptr_data, spans[i].length)) {
+      return kMuxerError;
+    }
+  }
+  return kSuccess;
+}
+
+// The cluster starts at the current write position, which is where
+// |WebmMuxWriter| ends the previous chunk.
+int LiveWebmMuxer::StartNativeCluster(int64 timestamp) {
+  ptr_writer_->ElementStartNotify(mkvmuxer::kMkvCluster,
+                                  ptr_writer_->bytes_written());
+  cluster_timecode_ = timestamp;
+  const int timecode_size = UIntSize(timestamp);
+  uint8 header[kMaxNativeHeaderLength];
+  uint8* ptr_header = header;
+  memcpy(ptr_header, kClusterId, sizeof(kClusterId));
+  ptr_header += sizeof(kClusterId);
+  ptr_header = SerializeUInt(kUnknownSize, 8, ptr_header);
+  *ptr_header++ = kTimecodeId;
+  ptr_header = SerializeVint(timecode_size, 1, ptr_header);
+  ptr_header = SerializeUInt(timestamp, timecode_size, ptr_header);
+  if (ptr_writer_->Write(header, static_cast<uint32>(ptr_header - header))) {
+    return kMuxerError;
+  }
+  return kSuccess;
+}
+
+int LiveWebmMuxer::AddTrackEncryption(mkvmuxer::Segment* ptr_segment,
+                                      uint64 track_num) const {
+  mkvmuxer::Track* const ptr_track = ptr_segment->GetTrackByNumber(track_num);
+  if (!ptr_track || !ptr_track->AddContentEncoding()) {
+    LOG(ERROR) << "cannot add ContentEncoding to track " << track_num << ".";
+    return kMuxerError;
+  }
+  mkvmuxer::ContentEncoding* const ptr_encoding =
+      ptr_track->GetContentEncodingByIndex(0);
+  if (!ptr_encoding ||
+      !ptr_encoding->SetEncryptionID(
+          reinterpret_cast<const uint8*>(encryption_key_id_.data()),
+          encryption_key_id_.size())) {
+    LOG(ERROR) << "cannot set the encryption key id of track " << track_num
+               << ".";
+    return kMuxerError;
+  }
+  return kSuccess;
+}
+
+uint8* LiveWebmMuxer::StartEncryptedFrame(uint8* ptr_out) {
+  const uint64 iv = next_iv_++;
+  cipher_.Start(iv);
+  *ptr_out++ = kEncryptedSignal;
+  return SerializeUInt(iv, AesCtr::kIvSize, ptr_out);
+}
+
+// libwebm copies every frame it is given, so the encrypted frame is built in
+// |encrypted_frame_|, which keeps its storage from frame to frame.
+bool LiveWebmMuxer::AddEncryptedFrame(const uint8* ptr_data, int32 length,
+                                      uint64 track_num, uint64 timecode,
+                                      bool keyframe) {
+  encrypted_frame_.resize(kEncryptionHeaderLength + length);
+  uint8* const ptr_frame = &encrypted_frame_[0];
+  uint8* const ptr_payload = StartEncryptedFrame(ptr_frame);
+  cipher_.Process(ptr_data, ptr_payload, length);
+  return ptr_segment_->AddFrame(ptr_frame, encrypted_frame_.size(),
+                                track_num, timecode, keyframe);
+}
+
+bool LiveWebmMuxer::TakeStreamingChunk(SharedStreamingChunk* ptr_chunk,
+                                       int64* ptr_chunk_num) {
+  if (!ptr_chunk || !ptr_chunk_num || started_streaming_chunks_.empty()) {
+    return false;
+  }
+  *ptr_chunk = started_streaming_chunks_.front();
+  started_streaming_chunks_.pop();
+  *ptr_chunk_num = streaming_chunks_taken_++;
+  return true;
+}
+
+int LiveWebmMuxer::StreamData(const uint8* ptr_data, int32 length) {
+  if (!streaming_chunk_) {
+    streaming_chunk_.reset(new (std::nothrow) StreamingChunk());  // NOLINT
+    if (!streaming_chunk_) {
+      LOG(ERROR) << "Cannot construct StreamingChunk.";
+      return kNoMemory;
+    }
+    started_streaming_chunks_.push(streaming_chunk_);
+  }
+  if (streaming_chunk_->Append(ptr_data, length)) {
+    LOG(ERROR) << "Cannot append to streaming chunk.";
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+void LiveWebmMuxer::EndStreamingChunk() {
+  if (streaming_chunk_) {
+    streaming_chunk_->Finish();
+    streaming_chunk_.reset();
+  }
+}
+
+int LiveWebmMuxer::GetChunkSpans(
+    std::vector<BlockBuffer::Span>* ptr_spans) const {
+  if (!ptr_spans) {
+    LOG(ERROR) << "NULL span vector pointer.";
+    return kInvalidArg;
+  }
+  const int64 chunk_length = ptr_writer_->chunk_end();
+  if (chunk_length <= 0) {
+    return kNoChunkReady;
+  }
+  if (buffer_.GetSpans(chunk_length, ptr_spans)) {
+    LOG(ERROR) << "Cannot get chunk spans from buffer.";
+    return kMuxerError;
+  }
+  return kSuccess;
+}
+
+// Discarding releases whole blocks of |buffer_|; the data following the chunk
+// is never moved.
+int LiveWebmMuxer::DiscardChunk() {
+  if (ptr_writer_->chunk_end() <= 0) {
+    return kNoChunkReady;
+  }
   ptr_writer_->EraseChunk();
   ++chunks_read_;
+  UpdateBufferedBytes();
   return kSuccess;
 }
 
+void LiveWebmMuxer::UpdateBufferedBytes() {
+  if (ptr_buffered_bytes_)
+    ptr_buffered_bytes_->Set(buffer_.size());
+}
+
 }  // namespace webmlive
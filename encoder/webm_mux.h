@@ -9,9 +9,13 @@
 #define WEBMLIVE_ENCODER_WEBM_MUX_H_
 
 #include <memory>
+#include <queue>
+#include <string>
 #include <vector>
 
+#include "encoder/aes_ctr.h"
 #include "encoder/basictypes.h"
+#include "encoder/buffer_util.h"
 #include "encoder/encoder_base.h"
 #include "encoder/webm_encoder.h"
 
@@ -24,6 +28,7 @@ namespace webmlive {
 
 // Forward declaration of class implementing IMkvWriter interface for libwebm.
 class WebmMuxWriter;
+class Metric;
 
 struct VorbisCodecPrivate {
   VorbisCodecPrivate()
@@ -42,12 +47,70 @@ struct VorbisCodecPrivate {
   int32 setup_length;
 };
 
+struct OpusCodecPrivate {
+  OpusCodecPrivate()
+      : ptr_data(NULL),
+        length(0),
+        codec_delay_ns(0),
+        seek_preroll_ns(0) {}
+
+  // OpusHead structure.
+  const uint8* ptr_data;
+  int32 length;
+
+  // Values of the WebM CodecDelay and SeekPreRoll elements.
+  int64 codec_delay_ns;
+  int64 seek_preroll_ns;
+};
+
+struct VideoCodecPrivate {
+  VideoCodecPrivate() : ptr_data(NULL), length(0) {}
+
+  // CodecPrivate of the track: the av1C record of AV1 tracks. VP8 and VP9
+  // tracks have none.
+  const uint8* ptr_data;
+  int32 length;
+};
+
+// Muxer of compressed packets. |MuxReorderQueue| writes to muxers through
+// this interface, in timestamp order.
+class PacketMuxerInterface {
+ public:
+  virtual ~PacketMuxerInterface() {}
+
+  // Writes |buffer| to the audio track, or |frame| to the video track.
+  // Returns 0 when successful.
+  virtual int WriteAudioBuffer(const AudioBuffer& buffer) = 0;
+  virtual int WriteVideoFrame(const VideoFrame& frame) = 0;
+};
+
+// One cluster recorded by the cluster index of |LiveWebmMuxer|.
+struct ClusterIndexEntry {
+  ClusterIndexEntry() : offset(0), chunk(0), timecode(-1), keyframe(false) {}
+
+  // Position of the cluster in the muxer output, in bytes from the start of
+  // the EBML header.
+  int64 offset;
+
+  // Number of the chunk holding the cluster, as counted by |chunks_read()|.
+  int64 chunk;
+
+  // Timestamp of the first block in the cluster in milliseconds, or -1 until
+  // a block is written to the cluster.
+  int64 timecode;
+
+  // True when the cluster starts with a video keyframe, or when the muxer has
+  // no video track.
+  bool keyframe;
+};
+
 // WebM muxing object built atop libwebm. Provides buffers containing WebM
 // "chunks" of two types:
 //  Metadata Chunk
 //   Contains EBML header, segment info, and segment tracks elements.
 //  Chunk
-//   A complete WebM cluster element.
+//   A complete WebM cluster element, or several clusters when
+//   |SetChunkDuration()| has been called.
 //
 // Notes:
 // - Only the first chunk written is metadata. All other chunks are clusters.
@@ -63,11 +126,34 @@ struct VorbisCodecPrivate {
 // - Users are responsible for keeping memory usage reasonable by calling
 //   |ChunkReady()| periodically-- when |ChunkReady| returns true,
 //   |ReadChunk()| will return the complete chunk and discard it from the
-//   buffer.
+//   buffer. Alternatively, |GetChunkSpans()| exposes the chunk in place, and
+//   |DiscardChunk()| discards it once the user is done with the data, or the
+//   |SharedDataChunk| form of |ReadChunk()| hands the chunk data to the user
+//   without copying it.
+//
+// - In streaming mode each chunk is also made available as a
+//   |StreamingChunk| as soon as its first byte is written, which allows users
+//   to send chunks while libwebm is still producing them.
+//
+// - Live mode output has no Cues element. |EnableClusterIndex()| records the
+//   position of each cluster instead, and |WriteClusterIndex()| formats the
+//   records as a sidecar index.
+//
+// - |EnableNativeClusters()| writes clusters without libwebm, which then
+//   only produces the metadata chunk.
+//
+// - |EnableEncryption()| encrypts every block with AES-CTR, as WebM
+//   encryption specifies.
 //
-class LiveWebmMuxer {
+class LiveWebmMuxer : public PacketMuxerInterface {
  public:
-  typedef std::vector<uint8> WriteBuffer;
+  typedef BlockBuffer WriteBuffer;
+
+  // Block timecodes are in milliseconds. Frames reach the muxer with their
+  // microsecond times rounded to the nearest millisecond (see
+  // |VideoFrame::SetTimeUs()|), which keeps every frame up to 1000 fps on a
+  // distinct timecode, evenly spread. A finer scale would shrink the reach of
+  // the 16 bit block offsets below the cluster durations in use.
   static const uint64 kTimecodeScale = 1000000;
 
   // Status codes returned by class methods.
@@ -75,13 +161,17 @@ class LiveWebmMuxer {
     // Temporary return code for unimplemented operations.
     kNotImplemented = -200,
 
+    // Invalid |VideoCodecPrivate| passed to |AddTrack()|.
+    kVideoPrivateDataInvalid = -14,
+
     // Unable to write audio buffer.
     kAudioWriteError = -13,
 
     // |WriteAudioBuffer()| called without adding an audio track.
     kNoAudioTrack = -12,
 
-    // Invalid |VorbisCodecPrivate| passed to |AddTrack()|.
+    // Invalid |VorbisCodecPrivate| or |OpusCodecPrivate| passed to
+    // |AddTrack()|.
     kAudioPrivateDataInvalid = -11,
 
     // |AddTrack()| called for audio, but the audio track has already been
@@ -119,25 +209,61 @@ class LiveWebmMuxer {
   };
 
   LiveWebmMuxer();
-  ~LiveWebmMuxer();
+  virtual ~LiveWebmMuxer();
 
   // Initializes libwebm for muxing in live mode.
   // Ignores |cluster_duration| when it's less than 1. |muxer_id| is a user data
   // string that can be used to identify the muxer when using multiple
-  // instances of the muxer.
+  // instances of the muxer. |metrics_labels| are added to the muxer's
+  // metrics, and may be empty.
   // Returns |kSuccess| when successful.
-  int Init(int32 cluster_duration_milliseconds, const std::string& muxer_id);
+  int Init(int32 cluster_duration_milliseconds, const std::string& muxer_id,
+           const std::string& metrics_labels);
 
   // Adds an audio track to |ptr_segment_| and returns |kSuccess|. Returns
   // |kAudioTrackAlreadyExists| when the audio track has already been added.
   // Returns |kAudioTrackError| when adding the track to the segment fails.
   int AddTrack(const AudioConfig& audio_config,
                const VorbisCodecPrivate& codec_private);
+  int AddTrack(const AudioConfig& audio_config,
+               const OpusCodecPrivate& codec_private);
 
   // Adds a video track to |ptr_segment_|, and returns |kSuccess|. Returns
   // |kVideoTrackAlreadyExists| when the video track has already been added.
   // Returns |kVideoTrackError| when adding the track to the segment fails.
+  // AV1 tracks require the |VideoCodecPrivate| overload; its
+  // |codec_private| is ignored for VP8 and VP9, and |AddTrack()| returns
+  // |kVideoPrivateDataInvalid| when it is empty for AV1.
   int AddTrack(const VideoConfig& video_config);
+  int AddTrack(const VideoConfig& video_config,
+               const VideoCodecPrivate& codec_private);
+
+  // Groups clusters into chunks of about |chunk_duration_milliseconds|.
+  // Chunks then end only at clusters that start with a video keyframe, or,
+  // for muxers without video, at the first cluster that starts
+  // |chunk_duration_milliseconds| after the chunk began. The |Init()|
+  // cluster duration then sets the size of the clusters inside each chunk,
+  // which streaming mode passes on as they are written. Every cluster is a
+  // chunk when 0, the default. Must be called before frames are written.
+  // Returns |kSuccess| when successful.
+  int SetChunkDuration(int32 chunk_duration_milliseconds);
+
+  // Ends the chunk being written at the next block once it holds |max_bytes|
+  // bytes, so that heavy keyframes do not make chunks too large for CDNs and
+  // players that handle large segments badly. The block starts a cluster,
+  // and the chunk it begins starts with a keyframe only when the block is
+  // one. The metadata chunk is never split. Disabled when 0, the default.
+  // Must be called before frames are written. Returns |kSuccess| when
+  // successful.
+  int SetChunkByteBudget(int64 max_bytes);
+
+  // Starts the chunks of a muxer without video at its first block at or
+  // after each multiple of |interval_milliseconds|, instead of a chunk
+  // duration after the chunk began, so that muxers in separate encoders fed
+  // the same timestamps split audio alike. Muxers with video ignore it:
+  // their chunks start at keyframes. Disabled when 0, the default. Must be
+  // called before frames are written. Returns |kSuccess| when successful.
+  int SetChunkAlignment(int64 interval_milliseconds);
 
   // Flushes any queued frames. Users MUST call this method to ensure that all
   // buffered frames are flushed out of libwebm. To determine if calling
@@ -147,14 +273,15 @@ class LiveWebmMuxer {
   int Finalize();
 
   // Writes |vorbis_buffer| to the audio track and returns |kSuccess|. Returns
-  // |kInvalidArg| when |vorbis_buffer| is empty or contains non-Vorbis audio.
+  // |kInvalidArg| when |vorbis_buffer| is empty or contains audio that is
+  // neither Vorbis nor Opus.
   // Returns |kAudioWriteError| when libwebm returns an error.
-  int WriteAudioBuffer(const AudioBuffer& vorbis_buffer);
+  virtual int WriteAudioBuffer(const AudioBuffer& vorbis_buffer);
 
   // Writes |vpx_frame| to the video track and returns |kSuccess|. Returns
   // |kInvalidArg| when |vpx_frame| is empty or contains a non-VPx frame.
   // Returns |kVideoWriteError| when libwebm returns an error.
-  int WriteVideoFrame(const VideoFrame& vpx_frame);
+  virtual int WriteVideoFrame(const VideoFrame& vpx_frame);
 
   // Returns true and writes chunk length to |ptr_chunk_length| when |buffer_|
   // contains a complete WebM chunk.
@@ -165,12 +292,148 @@ class LiveWebmMuxer {
   // |buffer_capacity| is less than |chunk_length|.
   int ReadChunk(int32 buffer_capacity, uint8* ptr_buf);
 
+  // Moves the ready chunk out of |buffer_| into a new |DataChunk|, and stores
+  // a handle to it in |ptr_chunk|. The chunk data is not copied. Returns
+  // |kNoChunkReady| when no chunk is ready.
+  int ReadChunk(SharedDataChunk* ptr_chunk);
+
+  // Stores the contiguous runs of |buffer_| that make up the ready chunk in
+  // |ptr_spans| without copying the chunk. The spans remain valid until
+  // |DiscardChunk()| is called. Returns |kNoChunkReady| when no chunk is
+  // ready.
+  int GetChunkSpans(std::vector<BlockBuffer::Span>* ptr_spans) const;
+
+  // Discards the ready chunk from |buffer_|. Returns |kNoChunkReady| when no
+  // chunk is ready.
+  int DiscardChunk();
+
+  // Stores the metadata chunk this muxer will produce, the EBML header,
+  // SegmentInfo and Tracks written before the first cluster, in |ptr_header|
+  // without writing a frame to this muxer. Call after all tracks are added.
+  // The chunk is built by a scratch muxer with copies of this muxer's
+  // tracks, UIDs included, so its bytes match those of chunk 0. Returns
+  // |kNoChunkReady| when no tracks have been added or when frames have
+  // already been written.
+  int PreviewHeader(SharedDataChunk* ptr_header) const;
+
+  // Adds copies of this muxer's tracks, UIDs included, to |ptr_segment|, and
+  // stores their numbers in |ptr_audio_track_num| and |ptr_video_track_num|,
+  // or 0 for absent tracks. The copies keep this muxer's track numbers when
+  // |keep_numbers| is true, and are numbered by |ptr_segment| otherwise.
+  // The copies are never encrypted: their frames are written in the clear.
+  // Returns |kSuccess| when successful.
+  int CopyTracks(mkvmuxer::Segment* ptr_segment, bool keep_numbers,
+                 uint64* ptr_audio_track_num,
+                 uint64* ptr_video_track_num) const;
+
+  // Enables streaming mode. Must be called after |Init()| and before tracks
+  // are added. Returns |kSuccess| when successful.
+  int EnableStreaming();
+
+  // Stores the oldest streaming chunk not yet taken in |ptr_chunk|, and its
+  // chunk number in |ptr_chunk_num|. Chunks are numbered from 0, like
+  // |chunks_read()|. Returns false when streaming is disabled or when no new
+  // chunk has been started.
+  bool TakeStreamingChunk(SharedStreamingChunk* ptr_chunk,
+                          int64* ptr_chunk_num);
+
+  // Enables the cluster index. Must be called after |Init()| and before
+  // tracks are added. Returns |kSuccess| when successful.
+  int EnableClusterIndex();
+
+  // Formats the cluster index as text and stores it in |ptr_index|. The first
+  // line is a comment naming the fields; each following line describes one
+  // cluster: the number of its chunk as counted by |chunks_read()|, byte
+  // offset, timecode in milliseconds, and 1 or 0 for the keyframe flag.
+  // Returns false when the index is disabled.
+  bool WriteClusterIndex(std::string* ptr_index) const;
+
+  // Writes Cluster, Timecode and SimpleBlock elements straight into
+  // |buffer_| instead of passing blocks to libwebm, which copies each block
+  // into a queued |mkvmuxer::Frame| before writing it. The metadata chunk is
+  // still built by libwebm, by |PreviewHeader()|, and clusters start where
+  // libwebm would start them: at video keyframes, at the |Init()| cluster
+  // duration, and before block timecodes overflow. Unlike libwebm, audio
+  // blocks are written in the order received rather than held back for the
+  // next video keyframe; |MuxReorderQueue| already orders them. Must be
+  // called after |Init()| and before frames are written. Returns |kSuccess|
+  // when successful.
+  int EnableNativeClusters();
+
+  // Encrypts the payload of every block with |key| in AES-CTR mode, as WebM
+  // encryption describes: each track gets a ContentEncoding element naming
+  // |key_id|, and each block starts with a signal byte and the 8 byte IV of
+  // the frame, followed by the encrypted frame. IVs start at a random value
+  // and count up by one per frame. Frames are encrypted in the pass that
+  // copies them into |buffer_| with native clusters, and in one scratch copy
+  // before libwebm's own otherwise. |key| must be |AesCtr::kKeySize| bytes,
+  // and |key_id| must not be empty. Must be called after |Init()| and before
+  // tracks are added. Returns |kSuccess| when successful.
+  int EnableEncryption(const std::string& key_id, const std::string& key);
+
+  // Stores the timecode of the first block of the ready chunk in |ptr_start|,
+  // and the time until the next chunk begins in |ptr_duration|, both in
+  // milliseconds. Returns false when the ready chunk is not a cluster: the
+  // metadata chunk, for example.
+  bool ChunkTiming(int64* ptr_start, int64* ptr_duration) const;
+
+  // Returns true when the ready chunk is a cluster chunk whose first video
+  // block is a keyframe, or when the muxer has no video track. The
+  // |SharedDataChunk| form of |ReadChunk()| copies it to
+  // |DataChunk::starts_with_keyframe()|.
+  bool ChunkStartsWithKeyframe() const { return previous_chunk_keyframe_; }
+
   // Accessors.
+  const std::vector<ClusterIndexEntry>& cluster_index() const {
+    return cluster_index_;
+  }
   int64 muxer_time() const { return muxer_time_; }
   int64 chunks_read() const { return chunks_read_; }
+  int64 buffered_bytes() const { return buffer_.size(); }
   std::string muxer_id() const { return muxer_id_; }
+  bool encrypted() const { return encryption_enabled_; }
 
  private:
+  // Streaming mode helpers called by |WebmMuxWriter|. |StreamData()| starts a
+  // new streaming chunk when none is open, and appends |ptr_data| to it.
+  // |EndStreamingChunk()| finishes the open chunk.
+  int StreamData(const uint8* ptr_data, int32 length);
+  void EndStreamingChunk();
+
+  // Cluster tracking helpers. |NextBlock()| is called before each block is
+  // passed to libwebm, and |BlockWritten()| after. |ClusterStarted()| is
+  // called by |WebmMuxWriter| when a cluster begins at |offset|; it returns
+  // true when the cluster also begins a chunk.
+  void NextBlock(int64 timestamp, bool video, bool keyframe);
+  bool ClusterStarted(int64 offset);
+
+  // Makes the next block start a cluster, and the cluster start a chunk.
+  void ForceChunkSplit();
+  void BlockWritten(int64 timestamp, bool video, bool keyframe);
+
+  // Native cluster helpers. |WriteNativeBlock()| writes the metadata chunk
+  // before the first block, starts a cluster when needed, and writes a
+  // SimpleBlock holding |length| bytes from |ptr_data|. Returns |kSuccess|
+  // when successful, and |kMuxerError| otherwise.
+  int WriteNativeBlock(const uint8* ptr_data, int32 length, uint64 track_num,
+                       int64 timestamp, bool video, bool keyframe);
+  int WriteNativeHeader();
+  int StartNativeCluster(int64 timestamp);
+
+  // Encryption helpers. |AddTrackEncryption()| adds the ContentEncoding
+  // element to track |track_num| of |ptr_segment|. |StartEncryptedFrame()|
+  // starts the key stream of the next frame, stores the signal byte and IV
+  // at |ptr_out|, and returns the position after them. |AddEncryptedFrame()|
+  // passes the encrypted form of a frame to libwebm.
+  int AddTrackEncryption(mkvmuxer::Segment* ptr_segment,
+                         uint64 track_num) const;
+  uint8* StartEncryptedFrame(uint8* ptr_out);
+  bool AddEncryptedFrame(const uint8* ptr_data, int32 length,
+                         uint64 track_num, uint64 timecode, bool keyframe);
+
+  // Copies |buffer_.size()| to |ptr_buffered_bytes_|.
+  void UpdateBufferedBytes();
+
   std::unique_ptr<WebmMuxWriter> ptr_writer_;
   std::unique_ptr<mkvmuxer::Segment> ptr_segment_;
   uint64 audio_track_num_;
@@ -179,6 +442,69 @@ class LiveWebmMuxer {
   int64 muxer_time_;
   int64 chunks_read_;
   std::string muxer_id_;
+  std::string metrics_labels_;
+
+  // Gauge of |buffer_| size exported through |MetricsRegistry|, labelled
+  // with |metrics_labels_| and |muxer_id_|.
+  Metric* ptr_buffered_bytes_;
+
+  // Streaming mode state: the chunk being written, chunks started but not yet
+  // taken by the user, and the number of chunks taken.
+  SharedStreamingChunk streaming_chunk_;
+  std::queue<SharedStreamingChunk> started_streaming_chunks_;
+  int64 streaming_chunks_taken_;
+
+  // Chunk grouping state. |chunks_started_| counts chunks begun, the
+  // metadata chunk included, and the |next_block_| values describe the block
+  // being passed to libwebm, which may start a cluster.
+  int64 chunk_duration_;
+  int64 chunks_started_;
+  bool finalizing_;
+  int64 next_block_timestamp_;
+  bool next_block_video_;
+  bool next_block_keyframe_;
+
+  // Timecodes of the first blocks of the two newest chunks, or -1 when
+  // unknown. The ready chunk is the one that starts at
+  // |previous_chunk_timecode_|.
+  int64 previous_chunk_timecode_;
+  int64 current_chunk_timecode_;
+
+  // Chunk byte budget and alignment state. |chunk_start_offset_| is the
+  // offset of the newest chunk, and |forced_split_| is true from the block
+  // found over |chunk_byte_budget_|, or past a multiple of
+  // |chunk_alignment_|, until the cluster it starts is reported.
+  int64 chunk_byte_budget_;
+  int64 chunk_alignment_;
+  int64 chunk_start_offset_;
+  bool forced_split_;
+
+  // Whether the same two chunks start with a keyframe. |chunk_needs_video_|
+  // is true while the newest chunk waits for its first video block.
+  bool previous_chunk_keyframe_;
+  bool current_chunk_keyframe_;
+  bool chunk_needs_video_;
+
+  // Cluster index state. |index_needs_video_| is true while the newest entry
+  // still waits for the first video block of its cluster.
+  bool cluster_index_enabled_;
+  bool index_needs_video_;
+  std::vector<ClusterIndexEntry> cluster_index_;
+
+  // Native cluster state. |cluster_duration_| is the |Init()| cluster
+  // duration in milliseconds, or 0, and |cluster_timecode_| is the timecode
+  // of the open cluster, or -1 before the first cluster.
+  bool native_clusters_;
+  int64 cluster_duration_;
+  int64 cluster_timecode_;
+
+  // Encryption state: the key id written to each track, the cipher, the IV
+  // of the next frame, and the scratch frame passed to libwebm.
+  bool encryption_enabled_;
+  std::string encryption_key_id_;
+  AesCtr cipher_;
+  uint64 next_iv_;
+  std::vector<uint8> encrypted_frame_;
   friend class WebmMuxWriter;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(LiveWebmMuxer);
 };
@@ -0,0 +1,704 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/webm_remuxer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "curl/curl.h"
+#include "curl/easy.h"
+#include "glog/logging.h"
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/data_sink.h"
+#include "encoder/ebml_util.h"
+#include "encoder/memory_governor.h"
+#include "encoder/thread_placement.h"
+#include "encoder/webm_mux.h"
+
+namespace {
+
+const char kAudioId[] = "audio";
+const char kVideoId[] = "video";
+const char kManifestId[] = "webmlive.mpd";
+
+// SimpleBlock keyframe flag, and Block lacing bits.
+const uint8 kKeyframeFlag = 0x80;
+const uint8 kLacingMask = 0x06;
+
+// Reads one Xiph lacing size at |*ptr_pos|, before |ptr_end|, and advances
+// |*ptr_pos| past it. Returns -1 when the lacing is truncated.
+int64 ReadXiphLaceSize(const uint8** ptr_pos, const uint8* ptr_end) {
+  int64 size = 0;
+  while (*ptr_pos < ptr_end) {
+    const uint8 byte = *(*ptr_pos)++;
+    size += byte;
+    if (byte != 0xFF)
+      return size;
+  }
+  return -1;
+}
+
+}  // namespace
+
+namespace webmlive {
+
+WebmRemuxer::WebmRemuxer()
+    : ptr_data_sink_(NULL),
+      input_file_(NULL),
+      ptr_memory_(NULL),
+      header_parsed_(false),
+      timecode_scale_(LiveWebmMuxer::kTimecodeScale),
+      stop_(false),
+      finished_(false),
+      status_(kSuccess),
+      remuxed_duration_(0) {
+}
+
+WebmRemuxer::~WebmRemuxer() {
+  Stop();
+  if (input_file_ && input_file_ != stdin)
+    fclose(input_file_);
+}
+
+int WebmRemuxer::Init(const WebmEncoderConfig& config,
+                      DataSinkInterface* ptr_data_sink) {
+  if (!ptr_data_sink || config.remux_input.empty()) {
+    LOG(ERROR) << "remux requires input and a data sink.";
+    return kInvalidArg;
+  }
+  if (!config.dash_encode) {
+    LOG(ERROR) << "remux requires DASH output.";
+    return kInvalidArg;
+  }
+  config_ = config;
+  ptr_data_sink_ = ptr_data_sink;
+  if (chunk_buffer_.Init()) {
+    LOG(ERROR) << "WebmChunkBuffer Init failed.";
+    return kNoMemory;
+  }
+  ptr_memory_ = MemoryGovernor::Instance().GetAccount(
+      kMemoryMuxerBuffers, config_.metrics_labels, "");
+  if (!ptr_memory_) {
+    return kNoMemory;
+  }
+
+  const std::string& input = config_.remux_input;
+  if (input.compare(0, 7, "http://") == 0 ||
+      input.compare(0, 8, "https://") == 0) {
+    return kSuccess;
+  }
+  if (input == "-") {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    input_file_ = stdin;
+  } else {
+    input_file_ = fopen(input.c_str(), "rb");
+    if (!input_file_) {
+      LOG(ERROR) << "cannot open remux input " << input;
+      return kReadError;
+    }
+  }
+  return kSuccess;
+}
+
+int WebmRemuxer::Run() {
+  if (remux_thread_) {
+    LOG(ERROR) << "remux thread already running.";
+    return kInvalidArg;
+  }
+  if (!ptr_data_sink_) {
+    LOG(ERROR) << "cannot Run: remuxer not initialized.";
+    return kInvalidArg;
+  }
+  stop_ = false;
+  finished_ = false;
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  remux_thread_ = shared_ptr<thread>(
+      new (std::nothrow) thread(bind(&WebmRemuxer::RemuxThread,  // NOLINT
+                                     this)));
+  if (!remux_thread_) {
+    LOG(ERROR) << "cannot create remux thread.";
+    return kNoMemory;
+  }
+  return kSuccess;
+}
+
+void WebmRemuxer::Stop() {
+  stop_ = true;
+  if (remux_thread_ && remux_thread_->joinable())
+    remux_thread_->join();
+  remux_thread_.reset();
+}
+
+int WebmRemuxer::OnInputData(const uint8* ptr_data, int32 length) {
+  if (chunk_buffer_.BufferData(ptr_data, length)) {
+    LOG(ERROR) << "WebmChunkBuffer BufferData failed.";
+    return kNoMemory;
+  }
+  int32 chunk_length = 0;
+  while (chunk_buffer_.ChunkReady(&chunk_length)) {
+    chunk_.resize(chunk_length);
+    if (chunk_buffer_.ReadChunk(&chunk_[0], chunk_length)) {
+      LOG(ERROR) << "WebmChunkBuffer ReadChunk failed.";
+      return kParseError;
+    }
+    const int status = header_parsed_ ? RemuxCluster() : ParseHeader();
+    if (status)
+      return status;
+  }
+  int64 bytes = chunk_buffer_.buffered_bytes();
+  if (audio_muxer_)
+    bytes += audio_muxer_->buffered_bytes();
+  if (video_muxer_)
+    bytes += video_muxer_->buffered_bytes();
+  ptr_memory_->Set(bytes);
+  return kSuccess;
+}
+
+int WebmRemuxer::ReadInput() {
+  std::vector<uint8> buffer(kReadSize);
+  while (!stop_) {
+    const size_t bytes_read = fread(&buffer[0], 1, buffer.size(), input_file_);
+    if (bytes_read == 0) {
+      if (ferror(input_file_)) {
+        LOG(ERROR) << "remux input read failed.";
+        return kReadError;
+      }
+      LOG(INFO) << "remux input ended.";
+      break;
+    }
+    const int status =
+        OnInputData(&buffer[0], static_cast<int32>(bytes_read));
+    if (status)
+      return status;
+  }
+  return kSuccess;
+}
+
+int WebmRemuxer::FetchInput() {
+  CURL* const ptr_curl = curl_easy_init();
+  if (!ptr_curl) {
+    LOG(ERROR) << "curl_easy_init failed!";
+    return kNoMemory;
+  }
+  curl_easy_setopt(ptr_curl, CURLOPT_URL, config_.remux_input.c_str());
+  curl_easy_setopt(ptr_curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(ptr_curl, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(ptr_curl, CURLOPT_WRITEFUNCTION, CurlWriteCallback);
+  curl_easy_setopt(ptr_curl, CURLOPT_WRITEDATA, this);
+  curl_easy_setopt(ptr_curl, CURLOPT_NOPROGRESS, 0L);
+  curl_easy_setopt(ptr_curl, CURLOPT_PROGRESSFUNCTION, CurlProgressCallback);
+  curl_easy_setopt(ptr_curl, CURLOPT_PROGRESSDATA, this);
+
+  // |CurlWriteCallback| stores its errors in |status_|.
+  const CURLcode err = curl_easy_perform(ptr_curl);
+  curl_easy_cleanup(ptr_curl);
+  if (status_ != kSuccess)
+    return status_;
+  if (err != CURLE_OK && !(err == CURLE_ABORTED_BY_CALLBACK && stop_)) {
+    LOG(ERROR) << "remux input fetch failed err=" << err << ":"
+               << curl_easy_strerror(err);
+    return kReadError;
+  }
+  LOG(INFO) << "remux input ended.";
+  return kSuccess;
+}
+
+size_t WebmRemuxer::CurlWriteCallback(char* ptr_data, size_t size,
+                                      size_t count, void* ptr_remuxer) {
+  WebmRemuxer* const ptr_this = reinterpret_cast<WebmRemuxer*>(ptr_remuxer);
+  const size_t length = size * count;
+  if (ptr_this->stop_)
+    return 0;
+  const int status = ptr_this->OnInputData(
+      reinterpret_cast<const uint8*>(ptr_data), static_cast<int32>(length));
+  if (status) {
+    ptr_this->status_ = status;
+    return 0;
+  }
+  return length;
+}
+
+int WebmRemuxer::CurlProgressCallback(void* ptr_remuxer,
+                                      double, double, double, double) {
+  return reinterpret_cast<WebmRemuxer*>(ptr_remuxer)->stop_ ? 1 : 0;
+}
+
+int WebmRemuxer::ParseHeader() {
+  const uint8* ptr_pos = &chunk_[0];
+  const uint8* const ptr_end = ptr_pos + chunk_.size();
+  while (ptr_pos < ptr_end) {
+    uint32 id = 0;
+    int64 size = 0;
+    if (!ReadElementHeader(&ptr_pos, ptr_end, &id, &size)) {
+      LOG(ERROR) << "malformed element in remux input header.";
+      return kParseError;
+    }
+    if (id == kSegmentId)
+      continue;
+    if (size < 0) {
+      LOG(ERROR) << "unknown size element in remux input header, id="
+                 << std::hex << id;
+      return kParseError;
+    }
+    const uint8* const ptr_element_end = ptr_pos + size;
+    while ((id == kInfoId || id == kTracksId) && ptr_pos < ptr_element_end) {
+      uint32 child_id = 0;
+      int64 child_size = 0;
+      if (!ReadElementHeader(&ptr_pos, ptr_element_end, &child_id,
+                             &child_size) || child_size < 0) {
+        LOG(ERROR) << "malformed element in remux input header.";
+        return kParseError;
+      }
+      if (child_id == kTimecodeScaleId)
+        timecode_scale_ = ReadUnsigned(ptr_pos, child_size);
+      else if (child_id == kTrackEntryId)
+        ParseTrackEntry(ptr_pos, child_size);
+      ptr_pos += child_size;
+    }
+    ptr_pos = ptr_element_end;
+  }
+  if (timecode_scale_ == 0) {
+    LOG(ERROR) << "invalid remux input timecode scale.";
+    return kParseError;
+  }
+  header_parsed_ = true;
+  return InitMuxers();
+}
+
+void WebmRemuxer::ParseTrackEntry(const uint8* ptr_entry, int64 length) {
+  InputTrack track;
+  const uint8* ptr_pos = ptr_entry;
+  const uint8* const ptr_end = ptr_entry + length;
+  while (ptr_pos < ptr_end) {
+    uint32 id = 0;
+    int64 size = 0;
+    if (!ReadElementHeader(&ptr_pos, ptr_end, &id, &size) || size < 0) {
+      LOG(WARNING) << "ignoring malformed TrackEntry.";
+      return;
+    }
+    switch (id) {
+      case kTrackNumberId:
+        track.number = ReadUnsigned(ptr_pos, size);
+        break;
+      case kTrackTypeId:
+        track.type = ReadUnsigned(ptr_pos, size);
+        break;
+      case kCodecIdId:
+        track.codec_id.assign(reinterpret_cast<const char*>(ptr_pos),
+                              static_cast<size_t>(size));
+        break;
+      case kCodecPrivateId:
+        track.codec_private.assign(ptr_pos, ptr_pos + size);
+        break;
+      case kCodecDelayId:
+        track.codec_delay = ReadUnsigned(ptr_pos, size);
+        break;
+      case kSeekPreRollId:
+        track.seek_preroll = ReadUnsigned(ptr_pos, size);
+        break;
+      case kDefaultDurationId:
+        track.default_duration = ReadUnsigned(ptr_pos, size);
+        break;
+      case kVideoElementId:
+      case kAudioElementId: {
+        // Settings are children of the Video and Audio elements.
+        const uint8* ptr_child = ptr_pos;
+        const uint8* const ptr_child_end = ptr_pos + size;
+        while (ptr_child < ptr_child_end) {
+          uint32 child_id = 0;
+          int64 child_size = 0;
+          if (!ReadElementHeader(&ptr_child, ptr_child_end, &child_id,
+                                 &child_size) || child_size < 0) {
+            LOG(WARNING) << "ignoring malformed TrackEntry.";
+            return;
+          }
+          const int32 value =
+              static_cast<int32>(ReadUnsigned(ptr_child, child_size));
+          if (child_id == kPixelWidthId) {
+            track.width = value;
+          } else if (child_id == kPixelHeightId) {
+            track.height = value;
+          } else if (child_id == kChannelsId) {
+            track.channels = value;
+          } else if (child_id == kSamplingFrequencyId) {
+            track.sample_rate =
+                static_cast<int32>(ReadFloat(ptr_child, child_size));
+          }
+          ptr_child += child_size;
+        }
+        break;
+      }
+      default:
+        break;
+    }
+    ptr_pos += size;
+  }
+
+  if (track.type == kTrackTypeVideo &&
+      (track.codec_id == "V_VP8" || track.codec_id == "V_VP9")) {
+    if (video_track_.number || config_.disable_video)
+      return;
+    video_track_ = track;
+  } else if (track.type == kTrackTypeAudio &&
+             (track.codec_id == "A_VORBIS" || track.codec_id == "A_OPUS")) {
+    if (audio_track_.number || config_.disable_audio)
+      return;
+    audio_track_ = track;
+  } else {
+    LOG(INFO) << "remux ignoring track " << track.number << " ("
+              << track.codec_id << ").";
+    return;
+  }
+  LOG(INFO) << "remuxing track " << track.number << " (" << track.codec_id
+            << ").";
+}
+
+int WebmRemuxer::InitMuxers() {
+  if (!audio_track_.number && !video_track_.number) {
+    LOG(ERROR) << "remux input has no VP8, VP9, Vorbis or Opus track.";
+    return kNoTracks;
+  }
+
+  // Chunks follow the cluster settings of an encode; input keyframes take
+  // the place of encoder keyframes.
+  const int chunk_duration = config_.cluster_duration > 0 ?
+      config_.vpx_config.keyframe_interval : 0;
+  const int audio_cluster_duration = config_.cluster_duration > 0 ?
+      config_.cluster_duration : config_.vpx_config.keyframe_interval;
+
+  // |dash_writer_| describes the input streams instead of the configured
+  // capture and encode settings.
+  WebmEncoderConfig dash_config = config_;
+  dash_config.disable_audio = audio_track_.number == 0;
+  dash_config.disable_video = video_track_.number == 0;
+  // Only full manifests are written.
+  dash_config.dash_patch_interval = 0;
+
+  if (video_track_.number) {
+    video_config_.format = video_track_.codec_id == "V_VP8" ?
+        kVideoFormatVP8 : kVideoFormatVP9;
+    video_config_.width = video_track_.width;
+    video_config_.height = video_track_.height;
+    video_config_.frame_rate = video_track_.default_duration > 0 ?
+        1000000000.0 / video_track_.default_duration :
+        config_.requested_video_config.frame_rate;
+    dash_config.actual_video_config = video_config_;
+    dash_config.vpx_config.codec = video_config_.format;
+
+    video_muxer_.reset(new (std::nothrow) LiveWebmMuxer());  // NOLINT
+    if (!video_muxer_) {
+      LOG(ERROR) << "cannot construct video muxer.";
+      return kNoMemory;
+    }
+    if (video_muxer_->Init(config_.cluster_duration, kVideoId,
+                           config_.metrics_labels) ||
+        video_muxer_->SetChunkDuration(chunk_duration) ||
+        video_muxer_->AddTrack(video_config_)) {
+      LOG(ERROR) << "video muxer setup failed.";
+      return kOutputError;
+    }
+  }
+
+  if (audio_track_.number) {
+    audio_config_.channels = static_cast<uint16>(audio_track_.channels);
+    audio_config_.sample_rate = audio_track_.sample_rate;
+    dash_config.actual_audio_config = audio_config_;
+
+    audio_muxer_.reset(new (std::nothrow) LiveWebmMuxer());  // NOLINT
+    if (!audio_muxer_) {
+      LOG(ERROR) << "cannot construct audio muxer.";
+      return kNoMemory;
+    }
+    if (audio_muxer_->Init(audio_cluster_duration, kAudioId,
+                           config_.metrics_labels) ||
+        audio_muxer_->SetChunkDuration(chunk_duration)) {
+      LOG(ERROR) << "audio muxer setup failed.";
+      return kOutputError;
+    }
+
+    const std::vector<uint8>& private_data = audio_track_.codec_private;
+    int status = kSuccess;
+    if (audio_track_.codec_id == "A_OPUS") {
+      audio_config_.format_tag = kAudioFormatOpus;
+      dash_config.audio_codec = kAudioFormatOpus;
+      OpusCodecPrivate opus_private;
+      opus_private.ptr_data = private_data.empty() ? NULL : &private_data[0];
+      opus_private.length = static_cast<int32>(private_data.size());
+      opus_private.codec_delay_ns = audio_track_.codec_delay;
+      opus_private.seek_preroll_ns = audio_track_.seek_preroll;
+      status = audio_muxer_->AddTrack(audio_config_, opus_private);
+    } else {
+      audio_config_.format_tag = kAudioFormatVorbis;
+      dash_config.audio_codec = kAudioFormatVorbis;
+
+      // Vorbis CodecPrivate holds the three Vorbis headers, Xiph laced.
+      const uint8* ptr_pos = private_data.empty() ? NULL : &private_data[0];
+      const uint8* const ptr_end = ptr_pos + private_data.size();
+      if (private_data.empty() || *ptr_pos++ != 2) {
+        LOG(ERROR) << "invalid Vorbis CodecPrivate in remux input.";
+        return kParseError;
+      }
+      const int64 ident_length = ReadXiphLaceSize(&ptr_pos, ptr_end);
+      const int64 comments_length = ReadXiphLaceSize(&ptr_pos, ptr_end);
+      if (ident_length < 0 || comments_length < 0 ||
+          ident_length + comments_length >= ptr_end - ptr_pos) {
+        LOG(ERROR) << "invalid Vorbis CodecPrivate in remux input.";
+        return kParseError;
+      }
+      VorbisCodecPrivate vorbis_private;
+      vorbis_private.ptr_ident = ptr_pos;
+      vorbis_private.ident_length = static_cast<int32>(ident_length);
+      vorbis_private.ptr_comments = ptr_pos + ident_length;
+      vorbis_private.comments_length = static_cast<int32>(comments_length);
+      vorbis_private.ptr_setup = vorbis_private.ptr_comments + comments_length;
+      vorbis_private.setup_length =
+          static_cast<int32>(ptr_end - vorbis_private.ptr_setup);
+      status = audio_muxer_->AddTrack(audio_config_, vorbis_private);
+    }
+    if (status) {
+      LOG(ERROR) << "audio muxer AddTrack failed: " << status;
+      return kOutputError;
+    }
+  }
+
+  if (!dash_writer_.Init(dash_config)) {
+    LOG(ERROR) << "DashWriter Init failed.";
+    return kOutputError;
+  }
+  return WriteManifest();
+}
+
+int WebmRemuxer::RemuxCluster() {
+  const uint8* ptr_pos = &chunk_[0];
+  const uint8* const ptr_end = ptr_pos + chunk_.size();
+  uint32 id = 0;
+  int64 size = 0;
+  if (!ReadElementHeader(&ptr_pos, ptr_end, &id, &size)) {
+    LOG(ERROR) << "malformed element in remux input.";
+    return kParseError;
+  }
+  if (id != kClusterId) {
+    // Cues and other elements that follow clusters are not remuxed.
+    VLOG(1) << "remux skipping element id=" << std::hex << id;
+    return kSuccess;
+  }
+
+  int64 cluster_timecode = 0;
+  while (ptr_pos < ptr_end) {
+    if (!ReadElementHeader(&ptr_pos, ptr_end, &id, &size) || size < 0) {
+      LOG(ERROR) << "malformed cluster in remux input.";
+      return kParseError;
+    }
+    int status = kSuccess;
+    if (id == kTimecodeId) {
+      cluster_timecode = static_cast<int64>(ReadUnsigned(ptr_pos, size));
+    } else if (id == kSimpleBlockId) {
+      status = RemuxBlock(ptr_pos, size, cluster_timecode, true, false);
+    } else if (id == kBlockGroupId) {
+      // A BlockGroup is a keyframe unless it references another block.
+      const uint8* ptr_child = ptr_pos;
+      const uint8* const ptr_group_end = ptr_pos + size;
+      const uint8* ptr_block = NULL;
+      int64 block_size = 0;
+      bool has_reference = false;
+      while (ptr_child < ptr_group_end) {
+        uint32 child_id = 0;
+        int64 child_size = 0;
+        if (!ReadElementHeader(&ptr_child, ptr_group_end, &child_id,
+                               &child_size) || child_size < 0) {
+          LOG(ERROR) << "malformed BlockGroup in remux input.";
+          return kParseError;
+        }
+        if (child_id == kBlockId) {
+          ptr_block = ptr_child;
+          block_size = child_size;
+        } else if (child_id == kReferenceBlockId) {
+          has_reference = true;
+        }
+        ptr_child += child_size;
+      }
+      if (ptr_block) {
+        status = RemuxBlock(ptr_block, block_size, cluster_timecode, false,
+                            has_reference);
+      }
+    }
+    if (status)
+      return status;
+    ptr_pos += size;
+  }
+  return kSuccess;
+}
+
+int WebmRemuxer::RemuxBlock(const uint8* ptr_block, int64 length,
+                            int64 cluster_timecode, bool simple_block,
+                            bool has_reference) {
+  const uint8* const ptr_end = ptr_block + length;
+  int64 track_number = 0;
+  int32 vint_length = 0;
+  if (!ReadVint(ptr_block, ptr_end, false, &track_number, &vint_length) ||
+      length < vint_length + 3) {
+    LOG(ERROR) << "malformed block in remux input.";
+    return kParseError;
+  }
+  const uint8* ptr_pos = ptr_block + vint_length;
+  const int16 relative_timecode =
+      static_cast<int16>((ptr_pos[0] << 8) | ptr_pos[1]);
+  const uint8 flags = ptr_pos[2];
+  ptr_pos += 3;
+
+  const bool audio =
+      track_number == static_cast<int64>(audio_track_.number);
+  if (!audio && track_number != static_cast<int64>(video_track_.number))
+    return kSuccess;
+  if (flags & kLacingMask) {
+    LOG(WARNING) << "remux dropping laced block on track " << track_number;
+    return kSuccess;
+  }
+  const int32 frame_length = static_cast<int32>(ptr_end - ptr_pos);
+  if (frame_length <= 0)
+    return kSuccess;
+
+  const int64 timestamp = static_cast<int64>(
+      (cluster_timecode + relative_timecode) * timecode_scale_ / 1000000);
+  if (timestamp > remuxed_duration_)
+    remuxed_duration_ = timestamp;
+
+  if (audio) {
+    if (audio_buffer_.Init(audio_config_, timestamp, 0, ptr_pos,
+                           frame_length)) {
+      LOG(ERROR) << "cannot store audio block.";
+      return kNoMemory;
+    }
+    if (audio_muxer_->WriteAudioBuffer(audio_buffer_)) {
+      LOG(ERROR) << "audio muxer WriteAudioBuffer failed.";
+      return kOutputError;
+    }
+    return WriteChunks(audio_muxer_.get(), AdaptationSet::kAudio);
+  }
+
+  const bool keyframe =
+      simple_block ? (flags & kKeyframeFlag) != 0 : !has_reference;
+  if (video_frame_.Init(video_config_, keyframe, timestamp, 0, ptr_pos,
+                        frame_length)) {
+    LOG(ERROR) << "cannot store video block.";
+    return kNoMemory;
+  }
+  if (video_muxer_->WriteVideoFrame(video_frame_)) {
+    LOG(ERROR) << "video muxer WriteVideoFrame failed.";
+    return kOutputError;
+  }
+  return WriteChunks(video_muxer_.get(), AdaptationSet::kVideo);
+}
+
+int WebmRemuxer::WriteChunks(LiveWebmMuxer* ptr_muxer,
+                             AdaptationSet::MediaType type) {
+  int32 chunk_length = 0;
+  while (ptr_muxer->ChunkReady(&chunk_length)) {
+    const std::string id =
+        dash_writer_.IdForChunk(type, ptr_muxer->chunks_read());
+    int64 start = 0;
+    int64 duration = 0;
+    const bool timed = ptr_muxer->ChunkTiming(&start, &duration);
+    SharedDataChunk chunk;
+    if (ptr_muxer->ReadChunk(&chunk)) {
+      LOG(ERROR) << "cannot read chunk from muxer_id: "
+                 << ptr_muxer->muxer_id();
+      return kOutputError;
+    }
+    while (!ptr_data_sink_->WaitUntilReady(kMaxIdleWaitMs))
+      VLOG(1) << "waiting for data sink before writing " << id;
+    if (!ptr_data_sink_->WriteChunk(chunk, id)) {
+      LOG(ERROR) << "data sink write failed!";
+      return kOutputError;
+    }
+    const bool add_chunk =
+        dash_writer_.dynamic() || config_.dash_vod_manifest;
+    if (timed && add_chunk && dash_writer_.AddChunk(type, start, duration) &&
+        dash_writer_.dynamic()) {
+      const int status = WriteManifest();
+      if (status)
+        return status;
+    }
+  }
+  return kSuccess;
+}
+
+int WebmRemuxer::FinalizeMuxers() {
+  LiveWebmMuxer* const muxers[] = { audio_muxer_.get(), video_muxer_.get() };
+  const AdaptationSet::MediaType types[] = {
+    AdaptationSet::kAudio, AdaptationSet::kVideo
+  };
+  int status = kSuccess;
+  for (int i = 0; i < 2; ++i) {
+    if (!muxers[i])
+      continue;
+    if (muxers[i]->Finalize()) {
+      LOG(ERROR) << "muxer Finalize failed, muxer_id: "
+                 << muxers[i]->muxer_id();
+      status = kOutputError;
+      continue;
+    }
+    const int write_status = WriteChunks(muxers[i], types[i]);
+    if (write_status)
+      status = write_status;
+  }
+  if (config_.dash_vod_manifest && dash_writer_.EndPresentation()) {
+    const int manifest_status = WriteManifest();
+    if (manifest_status)
+      status = manifest_status;
+  }
+  return status;
+}
+
+int WebmRemuxer::WriteManifest() {
+  if (!dash_writer_.WriteManifest(&manifest_)) {
+    LOG(ERROR) << "DashWriter::WriteManifest failed.";
+    return kOutputError;
+  }
+  while (!ptr_data_sink_->WaitUntilReady(kMaxIdleWaitMs))
+    VLOG(1) << "waiting for data sink before writing manifest.";
+  if (!ptr_data_sink_->WriteData(reinterpret_cast<const uint8*>(
+                                     manifest_.data()),
+                                 static_cast<int32>(manifest_.length()),
+                                 kManifestId)) {
+    LOG(ERROR) << "data sink manifest write failed!";
+    return kOutputError;
+  }
+  return kSuccess;
+}
+
+void WebmRemuxer::RemuxThread() {
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kEncode);
+  ScopedCpuStage cpu_stage(kCpuMux);
+  LOG(INFO) << "remuxing " << config_.remux_input;
+  int status = input_file_ ? ReadInput() : FetchInput();
+  if (header_parsed_) {
+    const int finalize_status = FinalizeMuxers();
+    if (status == kSuccess)
+      status = finalize_status;
+  } else if (status == kSuccess) {
+    LOG(ERROR) << "remux input ended before its header.";
+    status = kParseError;
+  }
+  status_ = status;
+  finished_ = true;
+  LOG(INFO) << "remux thread finished, status=" << status;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,210 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_WEBM_REMUXER_H_
+#define WEBMLIVE_ENCODER_WEBM_REMUXER_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+#include "encoder/buffer_util.h"
+#include "encoder/dash_writer.h"
+#include "encoder/encoder_base.h"
+#include "encoder/video_encoder.h"
+#include "encoder/webm_encoder.h"
+
+namespace webmlive {
+
+class DataSinkInterface;
+class LiveWebmMuxer;
+class MemoryAccount;
+
+// Re-segments an already encoded live WebM stream into DASH audio and video
+// chunks without decoding it. The input is split into its header and its
+// clusters by |WebmChunkBuffer|, the blocks of each cluster are written to a
+// |LiveWebmMuxer| per stream, and the chunks those produce are passed to a
+// |DataSinkInterface| with the ids and manifest of a DASH encode.
+//
+// Notes
+// - The input is |WebmEncoderConfig::remux_input|: a file, "-" for standard
+//   input, or an http:// or https:// URL fetched with a GET request.
+// - The first VP8 or VP9 track and the first Vorbis or Opus track are
+//   remuxed; other tracks are ignored. Streams disabled in the config are
+//   ignored too.
+// - Laced blocks are not supported and are dropped.
+// - Video chunks end at keyframes, so chunk length follows the keyframe
+//   interval of the input.
+class WebmRemuxer {
+ public:
+  enum {
+    // The input contains no track that can be remuxed.
+    kNoTracks = -6,
+    // The input is not WebM, or is malformed.
+    kParseError = -5,
+    // The input could not be opened or read.
+    kReadError = -4,
+    // A muxer or the data sink failed.
+    kOutputError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Size of the reads from file and pipe input.
+  static const int32 kReadSize = 64 * 1024;
+
+  // Time waited for the data sink between log messages. Chunks are never
+  // dropped: the remux thread waits until the sink accepts them, which also
+  // paces reads of file input.
+  static const int kMaxIdleWaitMs = 100;
+
+  WebmRemuxer();
+  ~WebmRemuxer();
+
+  // Stores |config| and |ptr_data_sink|, and opens file or pipe input.
+  // |config.dash_encode| must be true. Returns |kSuccess| when successful.
+  int Init(const WebmEncoderConfig& config, DataSinkInterface* ptr_data_sink);
+
+  // Starts the remux thread. Returns |kSuccess| when successful.
+  int Run();
+
+  // Stops the remux thread after it writes the chunks still buffered by the
+  // muxers. A blocking read of pipe input delays the stop until it returns.
+  void Stop();
+
+  // Returns true once the remux thread has finished: the input ended, or
+  // remuxing failed.
+  bool Finished() const { return finished_; }
+
+  // Returns |kSuccess|, or the error that stopped remuxing.
+  int status() const { return status_; }
+
+  // Returns the timestamp of the last block remuxed, in milliseconds.
+  int64 remuxed_duration() const { return remuxed_duration_; }
+
+ private:
+  // Track of the input being remuxed.
+  struct InputTrack {
+    InputTrack()
+        : number(0), type(0), width(0), height(0), default_duration(0),
+          sample_rate(0), channels(0), codec_delay(0), seek_preroll(0) {}
+    // Track number in the input, or 0 when the stream is absent.
+    uint64 number;
+    uint64 type;
+    std::string codec_id;
+    std::vector<uint8> codec_private;
+
+    // Video tracks. |default_duration| is in nanoseconds, and 0 when absent.
+    int32 width;
+    int32 height;
+    uint64 default_duration;
+
+    // Audio tracks. |codec_delay| and |seek_preroll| are in nanoseconds.
+    int32 sample_rate;
+    int32 channels;
+    uint64 codec_delay;
+    uint64 seek_preroll;
+  };
+
+  // Feeds |length| bytes of input to |chunk_buffer_|, and remuxes the chunks
+  // that complete. Returns |kSuccess| when successful.
+  int OnInputData(const uint8* ptr_data, int32 length);
+
+  // Reads file or pipe input, or fetches URL input, and passes it to
+  // |OnInputData()|. Returns when the input ends, on error, or on |Stop()|.
+  int ReadInput();
+  int FetchInput();
+
+  // libcurl callbacks used by |FetchInput()|.
+  static size_t CurlWriteCallback(char* ptr_data, size_t size, size_t count,
+                                  void* ptr_remuxer);
+  static int CurlProgressCallback(void* ptr_remuxer,
+                                  double, double, double, double);
+
+  // Reads the timecode scale and the tracks from the header chunk in
+  // |chunk_|, and sets up the muxers and the manifest. Returns |kSuccess|
+  // when successful.
+  int ParseHeader();
+
+  // Parses the TrackEntry element of |length| bytes at |ptr_entry|, and
+  // stores it in |audio_track_| or |video_track_| when it can be remuxed.
+  void ParseTrackEntry(const uint8* ptr_entry, int64 length);
+
+  // Creates the muxers for the streams present, adds their tracks, and
+  // initializes |dash_writer_|. Returns |kSuccess| when successful.
+  int InitMuxers();
+
+  // Writes the blocks of the cluster in |chunk_| to the muxers. Returns
+  // |kSuccess| when successful.
+  int RemuxCluster();
+
+  // Writes the block of |length| bytes at |ptr_block| from a cluster with
+  // timecode |cluster_timecode|. |simple_block| selects the SimpleBlock
+  // keyframe flag; Block elements are keyframes unless |has_reference|.
+  int RemuxBlock(const uint8* ptr_block, int64 length, int64 cluster_timecode,
+                 bool simple_block, bool has_reference);
+
+  // Passes the chunks ready in |ptr_muxer| to |ptr_data_sink_|, and updates
+  // the manifest. Returns |kSuccess| when successful.
+  int WriteChunks(LiveWebmMuxer* ptr_muxer, AdaptationSet::MediaType type);
+
+  // Finalizes the muxers, and passes their last chunks and the manifest to
+  // |ptr_data_sink_|.
+  int FinalizeMuxers();
+
+  // Writes the manifest to |ptr_data_sink_|.
+  int WriteManifest();
+
+  // Remux thread function.
+  void RemuxThread();
+
+  WebmEncoderConfig config_;
+  DataSinkInterface* ptr_data_sink_;
+  FILE* input_file_;
+
+  // Bytes held by |chunk_buffer_| and the muxers, reported to the memory
+  // governor.
+  MemoryAccount* ptr_memory_;
+
+  // Splits the input into its header and its clusters.
+  WebmChunkBuffer chunk_buffer_;
+  std::vector<uint8> chunk_;
+  bool header_parsed_;
+
+  // Nanoseconds per input timecode tick.
+  uint64 timecode_scale_;
+
+  InputTrack audio_track_;
+  InputTrack video_track_;
+  AudioConfig audio_config_;
+  VideoConfig video_config_;
+
+  std::unique_ptr<LiveWebmMuxer> audio_muxer_;
+  std::unique_ptr<LiveWebmMuxer> video_muxer_;
+  DashWriter dash_writer_;
+  std::string manifest_;
+
+  // Block storage passed to the muxers.
+  AudioBuffer audio_buffer_;
+  VideoFrame video_frame_;
+
+  std::atomic<bool> stop_;
+  std::atomic<bool> finished_;
+  std::atomic<int> status_;
+  std::atomic<int64> remuxed_duration_;
+  std::shared_ptr<std::thread> remux_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WebmRemuxer);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_WEBM_REMUXER_H_
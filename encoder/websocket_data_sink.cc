@@ -0,0 +1,559 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/websocket_data_sink.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#ifndef _WIN32
+#include <netdb.h>
+#endif
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/metrics.h"
+#include "encoder/socket_util.h"
+#include "encoder/thread_placement.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Interval at which the sender checks a chunk still being muxed for new
+// data, and the time it waits for the chunk to grow before giving up on the
+// connection.
+const int kStreamPollMs = 5;
+const int kMaxStreamStallMs = 10000;
+
+// Largest handshake response accepted.
+const size_t kMaxResponseBytes = 8 * 1024;
+
+// Largest control frame payload, per RFC 6455.
+const size_t kMaxControlPayload = 125;
+
+const char kWebSocketScheme[] = "ws://";
+const char kHttpScheme[] = "http://";
+const char kHeaderEnd[] = "\r\n\r\n";
+
+// WebSocket opcodes.
+const uint8 kOpcodeBinary = 0x2;
+const uint8 kOpcodeClose = 0x8;
+const uint8 kOpcodePing = 0x9;
+const uint8 kOpcodePong = 0xA;
+
+bool HasPrefix(const std::string& str, const char* prefix) {
+  return str.compare(0, strlen(prefix), prefix) == 0;
+}
+
+std::string Base64Encode(const uint8* ptr_data, size_t length) {
+  static const char kAlphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string encoded;
+  for (size_t i = 0; i < length; i += 3) {
+    const uint32 group = (ptr_data[i] << 16) |
+                         (i + 1 < length ? ptr_data[i + 1] << 8 : 0) |
+                         (i + 2 < length ? ptr_data[i + 2] : 0);
+    encoded += kAlphabet[(group >> 18) & 0x3F];
+    encoded += kAlphabet[(group >> 12) & 0x3F];
+    encoded += i + 1 < length ? kAlphabet[(group >> 6) & 0x3F] : '=';
+    encoded += i + 2 < length ? kAlphabet[group & 0x3F] : '=';
+  }
+  return encoded;
+}
+}  // namespace
+
+WebSocketDataSink::WebSocketDataSink()
+    : websocket_(true),
+      stop_(true),
+      connected_(false),
+      socket_(static_cast<SocketHandle>(kInvalidSocket)),
+      random_(std::random_device()()),
+      ptr_bytes_sent_(NULL),
+      ptr_connections_(NULL),
+      ptr_dropped_chunks_(NULL),
+      ptr_queued_bytes_(NULL) {
+}
+
+WebSocketDataSink::~WebSocketDataSink() {
+  Stop();
+}
+
+int WebSocketDataSink::Init(const WebSocketDataSinkSettings& settings) {
+  std::string rest;
+  if (HasPrefix(settings.url, kWebSocketScheme)) {
+    websocket_ = true;
+    rest = settings.url.substr(strlen(kWebSocketScheme));
+  } else if (HasPrefix(settings.url, kHttpScheme)) {
+    websocket_ = false;
+    rest = settings.url.substr(strlen(kHttpScheme));
+  } else {
+    LOG(ERROR) << "stream URLs start with ws:// or http://, got "
+               << settings.url;
+    return kInvalidArg;
+  }
+  const size_t path_start = rest.find('/');
+  const std::string authority = rest.substr(0, path_start);
+  path_ = path_start == std::string::npos ? "/" : rest.substr(path_start);
+  const size_t port_start = authority.rfind(':');
+  if (port_start == std::string::npos) {
+    host_ = authority;
+    port_ = "80";
+  } else {
+    host_ = authority.substr(0, port_start);
+    port_ = authority.substr(port_start + 1);
+  }
+  const int port = atoi(port_.c_str());
+  if (host_.empty() || port < 1 || port > 65535 ||
+      settings.max_queued_chunks < 1 || settings.max_buffered_bytes < 1 ||
+      settings.send_buffer_bytes < 0) {
+    LOG(ERROR) << "invalid stream sink settings, url=" << settings.url
+               << " max_queued_chunks=" << settings.max_queued_chunks
+               << " max_buffered_bytes=" << settings.max_buffered_bytes
+               << " send_buffer_bytes=" << settings.send_buffer_bytes;
+    return kInvalidArg;
+  }
+  settings_ = settings;
+
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  ptr_bytes_sent_ = registry.GetCounter(
+      "webmlive_stream_sink_sent_bytes_total", settings_.metrics_labels,
+      "Stream bytes pushed over the WebSocket or chunked POST, framing "
+      "excluded.");
+  ptr_connections_ = registry.GetCounter(
+      "webmlive_stream_sink_connections_total", settings_.metrics_labels,
+      "Stream sink connections established.");
+  ptr_dropped_chunks_ = registry.GetCounter(
+      "webmlive_stream_sink_dropped_chunks_total", settings_.metrics_labels,
+      "Chunks dropped while the stream sink was disconnected or behind.");
+  ptr_queued_bytes_ = registry.GetGauge(
+      "webmlive_stream_sink_queued_bytes", settings_.metrics_labels,
+      "Bytes queued behind the stream sink connection.");
+  if (!ptr_bytes_sent_ || !ptr_connections_ || !ptr_dropped_chunks_ ||
+      !ptr_queued_bytes_) {
+    LOG(ERROR) << "cannot create stream sink metrics.";
+    return kNoMemory;
+  }
+  queue_.Init(settings_.max_queued_chunks);
+  return kSuccess;
+}
+
+int WebSocketDataSink::Run() {
+  if (thread_ || !ptr_bytes_sent_) {
+    LOG(ERROR) << "WebSocketDataSink cannot Run before Init, or twice.";
+    return kInvalidArg;
+  }
+  if (!StartupSockets()) {
+    LOG(ERROR) << "cannot initialize sockets.";
+    return kThreadError;
+  }
+  stop_ = false;
+  thread_.reset(new (std::nothrow) std::thread(  // NOLINT
+      &WebSocketDataSink::SendThread, this));
+  if (!thread_) {
+    LOG(ERROR) << "WebSocketDataSink cannot start its thread.";
+    stop_ = true;
+    CleanupSockets();
+    return kThreadError;
+  }
+  return kSuccess;
+}
+
+void WebSocketDataSink::Stop() {
+  if (!thread_) {
+    return;
+  }
+  {
+    // Shutting the socket down wakes the sender from blocked sends.
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    const NativeSocket socket = static_cast<NativeSocket>(socket_);
+    if (socket != kInvalidSocket)
+      shutdown(socket, kShutdownBoth);
+  }
+  stopped_.notify_all();
+  queue_.Close();
+  thread_->join();
+  thread_.reset();
+  CleanupSockets();
+}
+
+bool WebSocketDataSink::Ready() const {
+  return !stop_ &&
+         (!connected_ || queue_.queued_bytes() <= settings_.max_buffered_bytes);
+}
+
+bool WebSocketDataSink::WaitUntilReady(int32 timeout_ms) const {
+  if (stop_) {
+    return false;
+  }
+  if (!connected_) {
+    return true;
+  }
+  return queue_.WaitForQueuedBytes(settings_.max_buffered_bytes, timeout_ms) &&
+         !stop_;
+}
+
+bool WebSocketDataSink::WriteData(const uint8* ptr_data, int32 data_length,
+                                  const std::string& id) {
+  bool header = false;
+  if (!LiveStreamQueue::IsStreamChunk(id, &header)) {
+    return true;
+  }
+  std::shared_ptr<DataChunk> chunk(new (std::nothrow) DataChunk());  // NOLINT
+  if (!chunk || chunk->Init(ptr_data, data_length)) {
+    LOG(ERROR) << "WebSocketDataSink cannot copy data for " << id;
+    return false;
+  }
+  return WriteChunk(chunk, id);
+}
+
+bool WebSocketDataSink::WriteChunk(const SharedDataChunk& chunk,
+                                   const std::string& id) {
+  if (!chunk || stop_) {
+    return false;
+  }
+  ptr_dropped_chunks_->Increment(queue_.PutChunk(chunk, id));
+  ptr_queued_bytes_->Set(queue_.queued_bytes());
+  return true;
+}
+
+bool WebSocketDataSink::WriteStreamingChunk(const SharedStreamingChunk& chunk,
+                                            const std::string& id) {
+  if (!chunk || stop_) {
+    return false;
+  }
+  ptr_dropped_chunks_->Increment(queue_.PutStreamingChunk(chunk, id));
+  return true;
+}
+
+bool WebSocketDataSink::Connect() {
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* ptr_addresses = NULL;
+  if (getaddrinfo(host_.c_str(), port_.c_str(), &hints, &ptr_addresses)) {
+    LOG(WARNING) << "cannot resolve stream server " << host_;
+    return false;
+  }
+  const NativeSocket socket =
+      ::socket(ptr_addresses->ai_family, ptr_addresses->ai_socktype,
+               ptr_addresses->ai_protocol);
+  if (socket == kInvalidSocket) {
+    LOG(ERROR) << "cannot create stream sink socket.";
+    freeaddrinfo(ptr_addresses);
+    return false;
+  }
+  SetSendTimeout(socket, kSendTimeoutMs);
+  // Clusters are pushed as they are produced; do not hold back the tail.
+  SetNoDelay(socket);
+  if (settings_.send_buffer_bytes > 0) {
+    setsockopt(socket, SOL_SOCKET, SO_SNDBUF,
+               reinterpret_cast<const char*>(&settings_.send_buffer_bytes),
+               sizeof(settings_.send_buffer_bytes));
+  }
+  {
+    // Published before connecting so that |Stop()| can interrupt it.
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_) {
+      freeaddrinfo(ptr_addresses);
+      CloseSocket(socket);
+      return false;
+    }
+    socket_ = static_cast<SocketHandle>(socket);
+  }
+  const int status = connect(socket, ptr_addresses->ai_addr,
+                             static_cast<int>(ptr_addresses->ai_addrlen));
+  freeaddrinfo(ptr_addresses);
+  if (status) {
+    VLOG(1) << "stream sink connection to " << host_ << ":" << port_
+            << " failed.";
+    Disconnect();
+    return false;
+  }
+
+  const std::string host_header =
+      port_ == "80" ? host_ : host_ + ":" + port_;
+  std::string request;
+  if (websocket_) {
+    uint8 key[16];
+    for (size_t i = 0; i < sizeof(key); ++i)
+      key[i] = static_cast<uint8>(random_());
+    request = "GET " + path_ + " HTTP/1.1\r\n"
+              "Host: " + host_header + "\r\n"
+              "Upgrade: websocket\r\n"
+              "Connection: Upgrade\r\n"
+              "Sec-WebSocket-Key: " + Base64Encode(key, sizeof(key)) + "\r\n"
+              "Sec-WebSocket-Version: 13\r\n\r\n";
+  } else {
+    request = "POST " + path_ + " HTTP/1.1\r\n"
+              "Host: " + host_header + "\r\n"
+              "Content-Type: video/webm\r\n"
+              "Transfer-Encoding: chunked\r\n\r\n";
+  }
+  if (!Send(request.data(), request.size())) {
+    Disconnect();
+    return false;
+  }
+
+  // The server answers the upgrade before any data flows; POSTs are
+  // answered only when the server is done with the stream.
+  received_.clear();
+  if (websocket_) {
+    std::string response;
+    size_t header_end = std::string::npos;
+    int waited_ms = 0;
+    while (header_end == std::string::npos) {
+      if (stop_ || waited_ms >= kSendTimeoutMs ||
+          response.size() > kMaxResponseBytes) {
+        Disconnect();
+        return false;
+      }
+      if (!WaitReadable(socket, kStreamPollMs * 20)) {
+        waited_ms += kStreamPollMs * 20;
+        continue;
+      }
+      char buffer[1024];
+      const int bytes_read = recv(socket, buffer, sizeof(buffer), 0);
+      if (bytes_read <= 0) {
+        Disconnect();
+        return false;
+      }
+      response.append(buffer, bytes_read);
+      header_end = response.find(kHeaderEnd);
+    }
+    // RFC 6455 clients fail the connection unless the server switches to
+    // the websocket protocol.
+    const std::string header = response.substr(0, header_end);
+    if (response.compare(0, 12, "HTTP/1.1 101") != 0 ||
+        ToLower(HeaderValue(header, ToLower(header), "upgrade")) !=
+            "websocket") {
+      LOG(ERROR) << "stream server refused the WebSocket upgrade: "
+                 << response.substr(0, response.find("\r\n"));
+      Disconnect();
+      return false;
+    }
+    received_.assign(response.begin() + header_end + strlen(kHeaderEnd),
+                     response.end());
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (stop_) {
+    return false;
+  }
+  ptr_dropped_chunks_->Increment(queue_.Connected());
+  connected_ = true;
+  ptr_connections_->Increment(1);
+  LOG(INFO) << "stream sink connected to " << settings_.url;
+  return true;
+}
+
+void WebSocketDataSink::Disconnect() {
+  connected_ = false;
+  queue_.Disconnected();
+  std::lock_guard<std::mutex> lock(mutex_);
+  const NativeSocket socket = static_cast<NativeSocket>(socket_);
+  if (socket != kInvalidSocket)
+    CloseSocket(socket);
+  socket_ = static_cast<SocketHandle>(kInvalidSocket);
+  received_.clear();
+}
+
+bool WebSocketDataSink::SendChunk(const DataChunk& chunk) {
+  const int32 max_length = kMaxMessageBytes;
+  const std::vector<DataChunk::Span>& spans = chunk.spans();
+  for (size_t i = 0; i < spans.size(); ++i) {
+    const uint8* ptr_data = spans[i].ptr_data;
+    int32 length = spans[i].length;
+    while (length > 0) {
+      const int32 count = std::min(length, max_length);
+      if (!SendMessage(ptr_data, count))
+        return false;
+      ptr_data += count;
+      length -= count;
+    }
+  }
+  return ServiceConnection();
+}
+
+bool WebSocketDataSink::SendStream(const StreamingChunk& stream) {
+  std::vector<uint8> buffer(kMaxMessageBytes);
+  int64 offset = 0;
+  int stall_ms = 0;
+  while (!stop_) {
+    int32 length = 0;
+    const int status =
+        stream.Read(offset, kMaxMessageBytes, &buffer[0], &length);
+    if (status == StreamingChunk::kSuccess) {
+      if (!SendMessage(&buffer[0], length))
+        return false;
+      offset += length;
+      stall_ms = 0;
+    } else if (status == StreamingChunk::kNoData) {
+      if (!ServiceConnection())
+        return false;
+      if (stall_ms >= kMaxStreamStallMs) {
+        LOG(WARNING) << "stream sink streaming chunk stalled, reconnecting.";
+        return false;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(kStreamPollMs));
+      stall_ms += kStreamPollMs;
+    } else if (status == StreamingChunk::kEndOfChunk) {
+      return ServiceConnection();
+    } else {
+      LOG(ERROR) << "stream sink streaming chunk read failed: " << status;
+      return false;
+    }
+  }
+  return false;
+}
+
+bool WebSocketDataSink::SendMessage(const uint8* ptr_data, int32 length) {
+  if (websocket_) {
+    if (!SendFrame(kOpcodeBinary, ptr_data, length))
+      return false;
+  } else {
+    char size_line[16];
+    const int size_length = snprintf(size_line, sizeof(size_line), "%x\r\n",
+                                     static_cast<unsigned int>(length));
+    if (!Send(size_line, size_length) || !Send(ptr_data, length) ||
+        !Send("\r\n", 2)) {
+      return false;
+    }
+  }
+  ptr_bytes_sent_->Increment(length);
+  return true;
+}
+
+bool WebSocketDataSink::SendFrame(uint8 opcode, const uint8* ptr_data,
+                                  int32 length) {
+  // Frames from clients are masked, with a fresh key each.
+  frame_.clear();
+  frame_.push_back(0x80 | opcode);
+  if (length < 126) {
+    frame_.push_back(0x80 | static_cast<uint8>(length));
+  } else if (length <= 0xFFFF) {
+    frame_.push_back(0x80 | 126);
+    frame_.push_back(static_cast<uint8>(length >> 8));
+    frame_.push_back(static_cast<uint8>(length));
+  } else {
+    frame_.push_back(0x80 | 127);
+    const uint64 length64 = static_cast<uint64>(length);
+    for (int shift = 56; shift >= 0; shift -= 8)
+      frame_.push_back(static_cast<uint8>(length64 >> shift));
+  }
+  uint8 mask[4];
+  for (int i = 0; i < 4; ++i) {
+    mask[i] = static_cast<uint8>(random_());
+    frame_.push_back(mask[i]);
+  }
+  for (int32 i = 0; i < length; ++i)
+    frame_.push_back(ptr_data[i] ^ mask[i & 3]);
+  return Send(&frame_[0], frame_.size());
+}
+
+bool WebSocketDataSink::ServiceConnection() {
+  const NativeSocket socket = static_cast<NativeSocket>(socket_);
+  while (WaitReadable(socket, 0)) {
+    char buffer[1024];
+    const int bytes_read = recv(socket, buffer, sizeof(buffer), 0);
+    if (bytes_read <= 0) {
+      LOG(WARNING) << "stream server closed the connection.";
+      return false;
+    }
+    if (!websocket_) {
+      LOG(WARNING) << "stream server answered the POST; reconnecting.";
+      return false;
+    }
+    received_.insert(received_.end(), buffer, buffer + bytes_read);
+  }
+
+  // Handle the complete frames received. Servers do not mask their frames.
+  while (received_.size() >= 2) {
+    const uint8 opcode = received_[0] & 0x0F;
+    uint64 length = received_[1] & 0x7F;
+    size_t header_length = 2;
+    if (length == 126) {
+      header_length = 4;
+    } else if (length == 127) {
+      header_length = 10;
+    }
+    if (received_.size() < header_length)
+      break;
+    if (header_length > 2) {
+      length = 0;
+      for (size_t i = 2; i < header_length; ++i)
+        length = (length << 8) | received_[i];
+    }
+    if (opcode >= kOpcodeClose && length > kMaxControlPayload) {
+      LOG(ERROR) << "stream server sent an invalid control frame.";
+      return false;
+    }
+    if (length > kMaxResponseBytes) {
+      // The server has no business sending data; skip what it sent.
+      received_.clear();
+      break;
+    }
+    if (received_.size() < header_length + length)
+      break;
+    const uint8* const ptr_payload = &received_[0] + header_length;
+    if (opcode == kOpcodeClose) {
+      LOG(WARNING) << "stream server closed the WebSocket.";
+      return false;
+    }
+    if (opcode == kOpcodePing &&
+        !SendFrame(kOpcodePong, ptr_payload, static_cast<int32>(length))) {
+      return false;
+    }
+    received_.erase(received_.begin(),
+                    received_.begin() + header_length +
+                        static_cast<size_t>(length));
+  }
+  return true;
+}
+
+bool WebSocketDataSink::Send(const void* ptr_data, size_t length) {
+  if (!SendAll(static_cast<NativeSocket>(socket_), ptr_data, length)) {
+    if (!stop_)
+      LOG(WARNING) << "stream sink send failed or timed out.";
+    return false;
+  }
+  return true;
+}
+
+void WebSocketDataSink::SendThread() {
+  LOG(INFO) << "WebSocketDataSink thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kUpload);
+  ScopedCpuStage cpu_stage(kCpuUpload);
+  while (!stop_) {
+    if (!Connect()) {
+      const int retry_ms = kReconnectIntervalMs;
+      std::unique_lock<std::mutex> lock(mutex_);
+      stopped_.wait_for(lock, std::chrono::milliseconds(retry_ms),
+                        [this] { return stop_.load(); });
+      continue;
+    }
+    LiveStreamQueue::Entry entry;
+    bool connected = true;
+    while (connected && queue_.Take(&entry)) {
+      ptr_queued_bytes_->Set(queue_.queued_bytes());
+      connected = entry.stream ? SendStream(*entry.stream) :
+                                 SendChunk(*entry.chunk);
+    }
+    if (!stop_)
+      LOG(WARNING) << "stream sink connection lost; reconnecting.";
+    Disconnect();
+  }
+  Disconnect();
+  ptr_queued_bytes_->Set(0);
+  LOG(INFO) << "WebSocketDataSink thread done.";
+}
+
+}  // namespace webmlive
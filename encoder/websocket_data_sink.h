@@ -0,0 +1,194 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_WEBSOCKET_DATA_SINK_H_
+#define WEBMLIVE_ENCODER_WEBSOCKET_DATA_SINK_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/buffer_util.h"
+#include "encoder/data_sink.h"
+#include "encoder/live_stream_queue.h"
+
+namespace webmlive {
+
+class Metric;
+
+struct WebSocketDataSinkSettings {
+  static const int kDefaultMaxQueuedChunks = 8;
+  static const int64 kDefaultMaxBufferedBytes = 4 * 1024 * 1024;
+
+  WebSocketDataSinkSettings()
+      : max_queued_chunks(kDefaultMaxQueuedChunks),
+        max_buffered_bytes(kDefaultMaxBufferedBytes),
+        send_buffer_bytes(0) {}
+
+  // Server the stream is pushed to: ws://host[:port]/path opens a WebSocket,
+  // and http://host[:port]/path sends one endless POST with chunked transfer
+  // encoding instead. TLS is not supported.
+  std::string url;
+
+  // Chunks queued for sending; see |LiveStreamQueue|.
+  int max_queued_chunks;
+
+  // Bytes waiting for the socket beyond which |Ready()| returns false while
+  // connected, which holds the encoder's writes until the connection drains.
+  int64 max_buffered_bytes;
+
+  // Size of the socket send buffer. 0 keeps the system default. Smaller
+  // buffers make back-pressure, and the latency it bounds, tighter.
+  int send_buffer_bytes;
+
+  // Labels added to the sink's metrics; see |MetricsRegistry|.
+  std::string metrics_labels;
+};
+
+// Data sink pushing one live WebM byte stream over a single long-lived
+// connection: a WebSocket carrying binary messages, or a chunked HTTP POST.
+// A relay can pass the stream to browsers, which append it to a Media Source
+// without requesting segments one by one.
+//
+// The stream, and what each connection starts with, are as |LiveStreamQueue|
+// says: the metadata chunk, then the cached chunks from the newest keyframe
+// chunk on, or else the next cluster chunk written. Lost
+// connections are reopened every |kReconnectIntervalMs|, dropping chunks in
+// the meantime.
+//
+// Notes
+// - With |WebmEncoderConfig::low_latency_upload| clusters are pushed as they
+//   are muxed; otherwise each chunk once complete.
+// - Back-pressure follows the socket: the sender blocks while the send buffer
+//   is full, chunks queue behind it, and |Ready()| returns false once they
+//   exceed |max_buffered_bytes|. A send blocked longer than |kSendTimeoutMs|
+//   drops the connection.
+// - Pings from WebSocket servers are answered; the server's
+//   Sec-WebSocket-Accept key is not checked.
+// - Writes of ids outside the stream are accepted and ignored, so the sink
+//   can be a |FanOutDataSink| output.
+class WebSocketDataSink : public DataSinkInterface {
+ public:
+  enum {
+    // Cannot start the sender thread.
+    kThreadError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  static const int kReconnectIntervalMs = 1000;
+  static const int kSendTimeoutMs = 5000;
+
+  // Largest WebSocket message, or HTTP chunk, sent.
+  static const int32 kMaxMessageBytes = 16 * 1024;
+
+  WebSocketDataSink();
+  virtual ~WebSocketDataSink();
+
+  // Copies |settings|, and parses |settings.url|. Returns |kSuccess| when
+  // successful.
+  int Init(const WebSocketDataSinkSettings& settings);
+
+  // Starts the sender thread, which connects on its own. Returns |kSuccess|
+  // when successful.
+  int Run();
+
+  // Closes the connection, and stops the sender thread. Queued chunks are
+  // dropped.
+  void Stop();
+
+  // |DataSinkInterface| methods.
+  virtual bool Ready() const;
+  virtual bool WaitUntilReady(int32 timeout_ms) const;
+  virtual bool WriteData(const uint8* ptr_data, int32 data_length,
+                         const std::string& id);
+  virtual bool WriteChunk(const SharedDataChunk& chunk,
+                          const std::string& id);
+  virtual bool WriteStreamingChunk(const SharedStreamingChunk& chunk,
+                                   const std::string& id);
+
+ private:
+  // Socket handle: a SOCKET on Windows, and a file descriptor elsewhere.
+  typedef std::intptr_t SocketHandle;
+
+  // Opens the connection, and completes the WebSocket handshake or sends the
+  // POST request. Returns false on failure, or when |Stop()| is called.
+  bool Connect();
+
+  // Closes the connection.
+  void Disconnect();
+
+  // Send |chunk|, and |stream| as it is written. Return false when the
+  // connection fails or |Stop()| is called.
+  bool SendChunk(const DataChunk& chunk);
+  bool SendStream(const StreamingChunk& stream);
+
+  // Sends |length| bytes of the stream as one message or HTTP chunk. Returns
+  // false on failure.
+  bool SendMessage(const uint8* ptr_data, int32 length);
+
+  // Sends a WebSocket frame of |opcode| carrying |length| bytes. Returns
+  // false on failure.
+  bool SendFrame(uint8 opcode, const uint8* ptr_data, int32 length);
+
+  // Reads what the server sent, if anything: answers WebSocket pings, and
+  // returns false when the server closed the connection or, for POSTs,
+  // answered it.
+  bool ServiceConnection();
+
+  // Sends all |length| bytes of |ptr_data|. Returns false on failure.
+  bool Send(const void* ptr_data, size_t length);
+
+  // Sender thread function.
+  void SendThread();
+
+  WebSocketDataSinkSettings settings_;
+
+  // Parts of |settings_.url|.
+  bool websocket_;
+  std::string host_;
+  std::string port_;
+  std::string path_;
+
+  LiveStreamQueue queue_;
+  std::atomic<bool> stop_;
+  std::atomic<bool> connected_;
+
+  // Connection socket. Written by the sender thread under |mutex_| so that
+  // |Stop()| can shut it down to unblock it. |stopped_| is signaled by
+  // |Stop()|.
+  std::mutex mutex_;
+  std::condition_variable stopped_;
+  SocketHandle socket_;
+
+  // Frame buffer, bytes read from the server, and WebSocket mask keys. Owned
+  // by the sender thread.
+  std::vector<uint8> frame_;
+  std::vector<uint8> received_;
+  std::mt19937 random_;
+
+  std::unique_ptr<std::thread> thread_;
+
+  // Metrics exported through |MetricsRegistry|. Set by |Init|.
+  Metric* ptr_bytes_sent_;
+  Metric* ptr_connections_;
+  Metric* ptr_dropped_chunks_;
+  Metric* ptr_queued_bytes_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WebSocketDataSink);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_WEBSOCKET_DATA_SINK_H_
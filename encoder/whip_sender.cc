@@ -0,0 +1,791 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/whip_sender.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <random>
+#ifdef WEBMLIVE_HAVE_LIBDATACHANNEL
+#include <rtc/rtc.h>
+#endif
+
+#include "curl/curl.h"
+#include "curl/easy.h"
+#include "encoder/cpu_accounting.h"
+#include "encoder/metrics.h"
+#include "encoder/thread_placement.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Payload types offered for the media, as browsers commonly number them.
+const int kVideoPayloadType = 96;
+const int kOpusPayloadType = 111;
+
+// Media stream id of the tracks.
+const char kStreamName[] = "webmlive";
+
+// Longest waits for ICE gathering, for the WHIP endpoint, and for the
+// connection to establish once the answer is applied.
+const int kGatheringTimeoutMs = 5000;
+const int kHttpTimeoutMs = 5000;
+const int kConnectTimeoutMs = 10000;
+
+// Largest SDP offer.
+const int kMaxSdpSize = 16 * 1024;
+
+// Interval at which the pacer checks for budget, and the burst it allows.
+const int kPacingIntervalMs = 2;
+const int kPacingBurstMs = 5;
+
+// Time between RTCP sender reports of a stream.
+const int kSenderReportIntervalMs = 1000;
+
+// Shortest time between two retransmissions of a packet, and between two
+// keyframe requests; SFUs repeat their NACKs and PLIs until served.
+const int kMinRetransmitIntervalMs = 20;
+const int kMinKeyframeIntervalMs = 500;
+
+int64 SteadyMilliseconds() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64 WallClockMicroseconds() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+size_t AppendToString(char* ptr_data, size_t size, size_t count,
+                      void* ptr_string) {
+  static_cast<std::string*>(ptr_string)->append(ptr_data, size * count);
+  return size * count;
+}
+
+// Stores the value of the Location header line at |ptr_data| in
+// |ptr_location|.
+size_t ReadLocation(char* ptr_data, size_t size, size_t count,
+                    void* ptr_location) {
+  const std::string kName = "location:";
+  std::string line(ptr_data, size * count);
+  if (line.size() > kName.size()) {
+    std::string name = line.substr(0, kName.size());
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    if (name == kName) {
+      const size_t begin = line.find_first_not_of(" \t", kName.size());
+      const size_t end = line.find_last_not_of(" \t\r\n");
+      if (begin != std::string::npos && end >= begin) {
+        *static_cast<std::string*>(ptr_location) =
+            line.substr(begin, end - begin + 1);
+      }
+    }
+  }
+  return size * count;
+}
+
+// Returns |location| resolved against |url|.
+std::string ResolveUrl(const std::string& url, const std::string& location) {
+  if (location.find("://") != std::string::npos) {
+    return location;
+  }
+  if (!location.empty() && location[0] == '/') {
+    const size_t host = url.find("://");
+    const size_t path =
+        url.find('/', host == std::string::npos ? 0 : host + 3);
+    return url.substr(0, path) + location;
+  }
+  return url.substr(0, url.rfind('/') + 1) + location;
+}
+
+// Sends a WHIP request for |url| with |ptr_curl|, with the bearer token of
+// |settings|. Returns the HTTP status, or 0 when the request fails.
+long PerformRequest(const WhipSenderSettings& settings,  // NOLINT
+                    const std::string& url, CURL* ptr_curl,
+                    curl_slist* ptr_headers) {
+  if (!settings.bearer_token.empty()) {
+    const std::string authorization =
+        "Authorization: Bearer " + settings.bearer_token;
+    ptr_headers = curl_slist_append(ptr_headers, authorization.c_str());
+  }
+  curl_easy_setopt(ptr_curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(ptr_curl, CURLOPT_HTTPHEADER, ptr_headers);
+  curl_easy_setopt(ptr_curl, CURLOPT_TIMEOUT_MS,
+                   static_cast<long>(kHttpTimeoutMs));  // NOLINT
+  curl_easy_setopt(ptr_curl, CURLOPT_NOSIGNAL, 1L);
+  const CURLcode result = curl_easy_perform(ptr_curl);
+  long status = 0;  // NOLINT
+  if (result != CURLE_OK) {
+    LOG(WARNING) << "WHIP request to " << url << " failed: "
+                 << curl_easy_strerror(result);
+  } else {
+    curl_easy_getinfo(ptr_curl, CURLINFO_RESPONSE_CODE, &status);
+  }
+  curl_slist_free_all(ptr_headers);
+  return status;
+}
+
+// Posts |offer| to the WHIP endpoint of |settings|, and stores the answer in
+// |ptr_answer| and the URL of the resource created in |ptr_resource_url|.
+// Returns false on failure.
+bool PostOffer(const WhipSenderSettings& settings, const std::string& offer,
+               std::string* ptr_answer, std::string* ptr_resource_url) {
+  CURL* const ptr_curl = curl_easy_init();
+  if (!ptr_curl) {
+    return false;
+  }
+  std::string location;
+  curl_easy_setopt(ptr_curl, CURLOPT_POST, 1L);
+  curl_easy_setopt(ptr_curl, CURLOPT_POSTFIELDS, offer.c_str());
+  curl_easy_setopt(ptr_curl, CURLOPT_POSTFIELDSIZE,
+                   static_cast<long>(offer.size()));  // NOLINT
+  curl_easy_setopt(ptr_curl, CURLOPT_WRITEFUNCTION, AppendToString);
+  curl_easy_setopt(ptr_curl, CURLOPT_WRITEDATA, ptr_answer);
+  curl_easy_setopt(ptr_curl, CURLOPT_HEADERFUNCTION, ReadLocation);
+  curl_easy_setopt(ptr_curl, CURLOPT_HEADERDATA, &location);
+  const long status = PerformRequest(  // NOLINT
+      settings, settings.url, ptr_curl,
+      curl_slist_append(NULL, "Content-Type: application/sdp"));
+  curl_easy_cleanup(ptr_curl);
+  if (status != 201 || ptr_answer->empty()) {
+    if (status) {
+      LOG(WARNING) << "WHIP endpoint " << settings.url << " refused the "
+                   << "offer, status=" << status;
+    }
+    return false;
+  }
+  *ptr_resource_url =
+      location.empty() ? std::string() : ResolveUrl(settings.url, location);
+  return true;
+}
+
+// Deletes the WHIP resource at |resource_url|, which ends the session.
+void DeleteResource(const WhipSenderSettings& settings,
+                    const std::string& resource_url) {
+  CURL* const ptr_curl = curl_easy_init();
+  if (!ptr_curl) {
+    return;
+  }
+  curl_easy_setopt(ptr_curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+  const long status =  // NOLINT
+      PerformRequest(settings, resource_url, ptr_curl, NULL);
+  curl_easy_cleanup(ptr_curl);
+  VLOG(1) << "WHIP resource " << resource_url << " deleted, status="
+          << status;
+}
+}  // namespace
+
+WhipSender::WhipSender()
+    : stop_(true),
+      peer_connection_(-1),
+      connected_(false),
+      gathering_done_(false),
+      awaiting_keyframe_(true),
+      keyframe_request_ms_(0),
+      ptr_bytes_sent_(NULL),
+      ptr_connections_(NULL),
+      ptr_dropped_frames_(NULL),
+      ptr_retransmitted_packets_(NULL),
+      ptr_keyframe_requests_(NULL) {
+}
+
+WhipSender::~WhipSender() {
+  Stop();
+}
+
+int WhipSender::Init(const WhipSenderSettings& settings) {
+#ifndef WEBMLIVE_HAVE_LIBDATACHANNEL
+  (void)settings;
+  LOG(ERROR) << "WHIP output was not built; enable WEBMLIVE_ENABLE_WHIP.";
+  return kUnsupported;
+#else
+  if (settings.url.empty() ||
+      (settings.video_codec != kVideoFormatVP8 &&
+       settings.video_codec != kVideoFormatVP9) ||
+      settings.temporal_layers < 1 || settings.bitrate_kbps < 0 ||
+      settings.pacing_percent < 100 || settings.max_queue_delay_ms < 1) {
+    LOG(ERROR) << "invalid WHIP settings, url=" << settings.url
+               << " codec=" << settings.video_codec
+               << " pacing=" << settings.pacing_percent
+               << " max_queue_delay=" << settings.max_queue_delay_ms;
+    return kInvalidArg;
+  }
+  settings_ = settings;
+
+  MetricsRegistry& registry = MetricsRegistry::Instance();
+  ptr_bytes_sent_ = registry.GetCounter(
+      "webmlive_whip_sent_bytes_total", settings_.metrics_labels,
+      "RTP bytes sent over WebRTC, retransmissions included.");
+  ptr_connections_ = registry.GetCounter(
+      "webmlive_whip_connections_total", settings_.metrics_labels,
+      "WebRTC connections established with the WHIP endpoint.");
+  ptr_dropped_frames_ = registry.GetCounter(
+      "webmlive_whip_dropped_frames_total", settings_.metrics_labels,
+      "Video frames dropped while the WebRTC link was down or behind.");
+  ptr_retransmitted_packets_ = registry.GetCounter(
+      "webmlive_whip_retransmitted_packets_total", settings_.metrics_labels,
+      "RTP packets retransmitted in answer to NACKs.");
+  ptr_keyframe_requests_ = registry.GetCounter(
+      "webmlive_whip_keyframe_requests_total", settings_.metrics_labels,
+      "Keyframes requested for WebRTC receivers.");
+  if (!ptr_bytes_sent_ || !ptr_connections_ || !ptr_dropped_frames_ ||
+      !ptr_retransmitted_packets_ || !ptr_keyframe_requests_) {
+    LOG(ERROR) << "cannot create WHIP metrics.";
+    return kNoMemory;
+  }
+
+  std::random_device random;
+  const uint32 video_ssrc = static_cast<uint32>(random()) | 1;
+  const uint32 audio_ssrc = video_ssrc ^ 0x80000000;
+  const RtpCodec video_codec =
+      settings_.video_codec == kVideoFormatVP9 ? kRtpCodecVP9 : kRtpCodecVP8;
+  if (video_.packetizer.Init(video_codec, kVideoPayloadType, video_ssrc,
+                             settings_.temporal_layers) ||
+      audio_.packetizer.Init(kRtpCodecOpus, kOpusPayloadType, audio_ssrc,
+                             1)) {
+    return kInvalidArg;
+  }
+  video_.history.resize(kHistorySize);
+  audio_.history.resize(kHistorySize);
+
+  const int64 pacing_bytes_per_second =
+      static_cast<int64>(settings_.bitrate_kbps) * 1000 / 8 *
+      settings_.pacing_percent / 100;
+  pacer_.Init(pacing_bytes_per_second,
+              std::max<int64>(pacing_bytes_per_second * kPacingBurstMs / 1000,
+                              2 * RtpPacketizer::kMaxPacketSize));
+  return kSuccess;
+#endif  // WEBMLIVE_HAVE_LIBDATACHANNEL
+}
+
+int WhipSender::Run() {
+  if (thread_ || !ptr_bytes_sent_) {
+    LOG(ERROR) << "WhipSender cannot Run before Init, or twice.";
+    return kInvalidArg;
+  }
+  stop_ = false;
+  thread_.reset(new (std::nothrow) std::thread(  // NOLINT
+      &WhipSender::SendThread, this));
+  if (!thread_) {
+    LOG(ERROR) << "WhipSender cannot start its thread.";
+    stop_ = true;
+    return kThreadError;
+  }
+  return kSuccess;
+}
+
+void WhipSender::Stop() {
+  if (!thread_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  state_changed_.notify_all();
+  thread_->join();
+  thread_.reset();
+}
+
+bool WhipSender::WriteVideoFrame(const VideoFrame& frame) {
+  if (stop_) {
+    return false;
+  }
+  bool request_keyframe = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!connected_) {
+      return true;
+    }
+    // Frames after a gap reference what was lost; wait for a keyframe.
+    if (awaiting_keyframe_ && !frame.keyframe()) {
+      ptr_dropped_frames_->Increment(1);
+      return true;
+    }
+    const int64 now_ms = SteadyMilliseconds();
+    const int64 delay_ms = video_queue_.empty() ?
+        0 : now_ms - video_queue_.front().queued_ms;
+    if (delay_ms > settings_.max_queue_delay_ms) {
+      int64 frames = 0;
+      for (size_t i = 0; i < video_queue_.size(); ++i) {
+        frames += video_queue_[i].packet.marker ? 1 : 0;
+      }
+      ptr_dropped_frames_->Increment(frames + 1);
+      video_queue_.clear();
+      awaiting_keyframe_ = !frame.keyframe();
+      request_keyframe = awaiting_keyframe_;
+      if (awaiting_keyframe_) {
+        LOG(WARNING) << "WHIP link " << delay_ms << " ms behind; dropped "
+                     << frames << " frames.";
+      }
+    } else if (frame.temporal_layer() > 0 &&
+               delay_ms > settings_.max_queue_delay_ms / 2) {
+      // Upper layer frames are not referenced by the base layer, so they
+      // are shed first without costing a keyframe.
+      ptr_dropped_frames_->Increment(1);
+      return true;
+    }
+    if (frame.keyframe()) {
+      awaiting_keyframe_ = false;
+    }
+    if (!awaiting_keyframe_) {
+      if (video_.packetizer.PacketizeVideoFrame(frame, &packets_)) {
+        LOG(ERROR) << "cannot packetize video frame.";
+        return false;
+      }
+      QueuedPacket entry;
+      entry.video = true;
+      entry.queued_ms = now_ms;
+      for (size_t i = 0; i < packets_.size(); ++i) {
+        video_queue_.push_back(entry);
+        video_queue_.back().packet.data.swap(packets_[i].data);
+        video_queue_.back().packet.sequence_number =
+            packets_[i].sequence_number;
+        video_queue_.back().packet.marker = packets_[i].marker;
+      }
+      video_.media_time_us = frame.timestamp_us();
+      video_.wall_time_us = WallClockMicroseconds();
+    }
+  }
+  state_changed_.notify_all();
+  if (request_keyframe) {
+    RequestKeyframe();
+  }
+  return true;
+}
+
+bool WhipSender::WriteAudioBuffer(const AudioBuffer& buffer) {
+  if (stop_) {
+    return false;
+  }
+  if (!settings_.audio) {
+    return true;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!connected_) {
+      return true;
+    }
+    if (audio_.packetizer.PacketizeAudioBuffer(buffer, &packets_)) {
+      LOG(ERROR) << "cannot packetize audio buffer.";
+      return false;
+    }
+    QueuedPacket entry;
+    entry.queued_ms = SteadyMilliseconds();
+    entry.packet.data.swap(packets_[0].data);
+    entry.packet.sequence_number = packets_[0].sequence_number;
+    audio_queue_.push_back(entry);
+    audio_.media_time_us = buffer.timestamp_us();
+    audio_.wall_time_us = WallClockMicroseconds();
+  }
+  state_changed_.notify_all();
+  return true;
+}
+
+bool WhipSender::Connect() {
+#ifndef WEBMLIVE_HAVE_LIBDATACHANNEL
+  return false;
+#else
+  std::vector<const char*> ice_servers;
+  for (size_t i = 0; i < settings_.ice_servers.size(); ++i) {
+    ice_servers.push_back(settings_.ice_servers[i].c_str());
+  }
+  rtcConfiguration config;
+  memset(&config, 0, sizeof(config));
+  config.iceServers = ice_servers.empty() ? NULL : &ice_servers[0];
+  config.iceServersCount = static_cast<int>(ice_servers.size());
+  config.disableAutoNegotiation = true;
+  const int pc = rtcCreatePeerConnection(&config);
+  if (pc < 0) {
+    LOG(ERROR) << "cannot create WebRTC peer connection: " << pc;
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    peer_connection_ = pc;
+    connected_ = false;
+    gathering_done_ = false;
+  }
+  rtcSetUserPointer(pc, this);
+  rtcSetStateChangeCallback(pc, [](int id, rtcState state, void* ptr) {
+    OnStateChange(id, state, ptr);
+  });
+  rtcSetGatheringStateChangeCallback(
+      pc, [](int id, rtcGatheringState state, void* ptr) {
+        OnGatheringStateChange(id, state, ptr);
+      });
+
+  // Send only tracks, with the SSRCs of the packetizers.
+  const struct {
+    Stream* ptr_stream;
+    rtcCodec codec;
+    int payload_type;
+    const char* mid;
+  } tracks[] = {
+    {&video_,
+     settings_.video_codec == kVideoFormatVP9 ? RTC_CODEC_VP9 : RTC_CODEC_VP8,
+     kVideoPayloadType, "0"},
+    {&audio_, RTC_CODEC_OPUS, kOpusPayloadType, "1"},
+  };
+  const int num_tracks = settings_.audio ? 2 : 1;
+  for (int i = 0; i < num_tracks; ++i) {
+    rtcTrackInit init;
+    memset(&init, 0, sizeof(init));
+    init.direction = RTC_DIRECTION_SENDONLY;
+    init.codec = tracks[i].codec;
+    init.payloadType = tracks[i].payload_type;
+    init.ssrc = tracks[i].ptr_stream->packetizer.ssrc();
+    init.mid = tracks[i].mid;
+    init.name = kStreamName;
+    init.msid = kStreamName;
+    init.trackId = tracks[i].mid;
+    const int track = rtcAddTrackEx(pc, &init);
+    if (track < 0) {
+      LOG(ERROR) << "cannot add WebRTC track: " << track;
+      return false;
+    }
+    rtcSetUserPointer(track, this);
+    rtcSetMessageCallback(track,
+                          [](int id, const char* ptr_data, int size,
+                             void* ptr) {
+                            OnTrackMessage(id, ptr_data, size, ptr);
+                          });
+    std::lock_guard<std::mutex> lock(mutex_);
+    tracks[i].ptr_stream->track = track;
+  }
+
+  // WHIP offers carry every candidate; there is no trickle.
+  if (rtcSetLocalDescription(pc, "offer") < 0) {
+    LOG(ERROR) << "cannot create WebRTC offer.";
+    return false;
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!state_changed_.wait_for(
+            lock, std::chrono::milliseconds(kGatheringTimeoutMs),
+            [this] { return stop_ || gathering_done_; }) || stop_) {
+      return false;
+    }
+  }
+  std::vector<char> offer(kMaxSdpSize);
+  const int offer_size = rtcGetLocalDescription(pc, &offer[0], kMaxSdpSize);
+  if (offer_size <= 0) {
+    LOG(ERROR) << "cannot read WebRTC offer: " << offer_size;
+    return false;
+  }
+
+  std::string answer;
+  std::string resource_url;
+  if (!PostOffer(settings_, std::string(&offer[0]), &answer,
+                 &resource_url)) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    resource_url_ = resource_url;
+  }
+  if (rtcSetRemoteDescription(pc, answer.c_str(), "answer") < 0) {
+    LOG(ERROR) << "invalid WHIP answer from " << settings_.url;
+    return false;
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!state_changed_.wait_for(
+            lock, std::chrono::milliseconds(kConnectTimeoutMs),
+            [this] { return stop_ || connected_; }) || stop_) {
+      LOG(WARNING) << "WebRTC connection to " << settings_.url
+                   << " timed out.";
+      return false;
+    }
+    awaiting_keyframe_ = true;
+  }
+  LOG(INFO) << "WHIP session established with " << settings_.url;
+  ptr_connections_->Increment(1);
+  keyframe_request_ms_ = 0;
+  RequestKeyframe();
+  return true;
+#endif  // WEBMLIVE_HAVE_LIBDATACHANNEL
+}
+
+void WhipSender::Disconnect() {
+  int pc = -1;
+  std::string resource_url;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pc = peer_connection_;
+    resource_url.swap(resource_url_);
+    peer_connection_ = -1;
+    connected_ = false;
+    video_.track = -1;
+    audio_.track = -1;
+    audio_queue_.clear();
+    retransmit_queue_.clear();
+    video_queue_.clear();
+  }
+#ifdef WEBMLIVE_HAVE_LIBDATACHANNEL
+  if (pc >= 0) {
+    rtcDeletePeerConnection(pc);
+  }
+#endif
+  if (!resource_url.empty()) {
+    DeleteResource(settings_, resource_url);
+  }
+}
+
+void WhipSender::SendPackets() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stream* const streams[] = {&video_, &audio_};
+    for (int i = 0; i < 2; ++i) {
+      Stream& stream = *streams[i];
+      for (size_t j = 0; j < stream.history.size(); ++j) {
+        stream.history[j] = SentPacket();
+      }
+      stream.packets_sent = 0;
+      stream.octets_sent = 0;
+      stream.report_ms = 0;
+    }
+  }
+  for (;;) {
+    QueuedPacket entry;
+    bool retransmission = false;
+    bool paced = false;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      state_changed_.wait_for(
+          lock, std::chrono::milliseconds(kSenderReportIntervalMs),
+          [this] {
+            return stop_ || !connected_ || !audio_queue_.empty() ||
+                   !retransmit_queue_.empty() || !video_queue_.empty();
+          });
+      if (stop_ || !connected_) {
+        return;
+      }
+      std::deque<QueuedPacket>* const ptr_queue =
+          !audio_queue_.empty() ? &audio_queue_ :
+          !retransmit_queue_.empty() ? &retransmit_queue_ :
+          !video_queue_.empty() ? &video_queue_ : NULL;
+      if (ptr_queue) {
+        const int64 size =
+            static_cast<int64>(ptr_queue->front().packet.data.size());
+        if (pacer_.enabled() && pacer_.Available() < size) {
+          paced = true;
+        } else {
+          pacer_.Take(size);
+          std::swap(entry, ptr_queue->front());
+          ptr_queue->pop_front();
+          retransmission = ptr_queue == &retransmit_queue_;
+          if (!retransmission) {
+            Stream& stream = entry.video ? video_ : audio_;
+            SentPacket& sent =
+                stream.history[entry.packet.sequence_number % kHistorySize];
+            sent.packet = entry.packet;
+            sent.retransmit_ms = 0;
+          }
+        }
+      }
+    }
+    if (!entry.packet.data.empty()) {
+      SendPacket(entry.packet, retransmission,
+                 entry.video ? &video_ : &audio_);
+    }
+    SendReports();
+    if (paced) {
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(kPacingIntervalMs));
+    }
+  }
+}
+
+bool WhipSender::SendPacket(const RtpPacket& packet, bool retransmission,
+                            Stream* ptr_stream) {
+#ifndef WEBMLIVE_HAVE_LIBDATACHANNEL
+  (void)packet;
+  (void)retransmission;
+  (void)ptr_stream;
+  return false;
+#else
+  const int size = static_cast<int>(packet.data.size());
+  const int status = rtcSendMessage(
+      ptr_stream->track, reinterpret_cast<const char*>(&packet.data[0]),
+      size);
+  if (status < 0) {
+    VLOG(1) << "cannot send RTP packet " << packet.sequence_number << ": "
+            << status;
+    return false;
+  }
+  ++ptr_stream->packets_sent;
+  ptr_stream->octets_sent += size - RtpPacketizer::kHeaderSize;
+  ptr_bytes_sent_->Increment(size);
+  if (retransmission) {
+    ptr_retransmitted_packets_->Increment(1);
+  }
+  return true;
+#endif  // WEBMLIVE_HAVE_LIBDATACHANNEL
+}
+
+void WhipSender::SendReports() {
+#ifdef WEBMLIVE_HAVE_LIBDATACHANNEL
+  Stream* const streams[] = {&video_, &audio_};
+  const int64 now_ms = SteadyMilliseconds();
+  for (int i = 0; i < 2; ++i) {
+    Stream& stream = *streams[i];
+    if (stream.packets_sent == 0 ||
+        now_ms - stream.report_ms < kSenderReportIntervalMs) {
+      continue;
+    }
+    int track = -1;
+    int64 media_time_us = 0;
+    int64 wall_time_us = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      track = stream.track;
+      media_time_us = stream.media_time_us;
+      wall_time_us = stream.wall_time_us;
+    }
+    if (track < 0 || media_time_us < 0) {
+      continue;
+    }
+    // The media clock runs on from the last frame written.
+    const int64 now_us = WallClockMicroseconds();
+    std::vector<uint8> report;
+    BuildSenderReport(
+        stream.packetizer.ssrc(), now_us,
+        stream.packetizer.RtpTimestamp(media_time_us + now_us - wall_time_us),
+        stream.packets_sent, stream.octets_sent, &report);
+    rtcSendMessage(track, reinterpret_cast<const char*>(&report[0]),
+                   static_cast<int>(report.size()));
+    stream.report_ms = now_ms;
+  }
+#endif  // WEBMLIVE_HAVE_LIBDATACHANNEL
+}
+
+void WhipSender::HandleFeedback(const RtcpFeedback& feedback,
+                                Stream* ptr_stream) {
+  const int64 now_ms = SteadyMilliseconds();
+  for (size_t i = 0; i < feedback.lost_sequence_numbers.size(); ++i) {
+    const uint16 lost = feedback.lost_sequence_numbers[i];
+    SentPacket& sent = ptr_stream->history[lost % kHistorySize];
+    if (sent.packet.data.empty() || sent.packet.sequence_number != lost ||
+        now_ms - sent.retransmit_ms < kMinRetransmitIntervalMs) {
+      continue;
+    }
+    sent.retransmit_ms = now_ms;
+    QueuedPacket entry;
+    entry.packet = sent.packet;
+    entry.video = ptr_stream == &video_;
+    entry.queued_ms = now_ms;
+    retransmit_queue_.push_back(entry);
+  }
+}
+
+void WhipSender::RequestKeyframe() {
+  const int64 now_ms = SteadyMilliseconds();
+  int64 last_ms = keyframe_request_ms_.load();
+  if ((last_ms > 0 && now_ms - last_ms < kMinKeyframeIntervalMs) ||
+      !keyframe_request_ms_.compare_exchange_strong(last_ms, now_ms)) {
+    return;
+  }
+  ptr_keyframe_requests_->Increment(1);
+  if (keyframe_callback_) {
+    keyframe_callback_();
+  }
+}
+
+void WhipSender::OnStateChange(int /*pc*/, int state, void* ptr_sender) {
+#ifdef WEBMLIVE_HAVE_LIBDATACHANNEL
+  WhipSender* const ptr_this = static_cast<WhipSender*>(ptr_sender);
+  {
+    std::lock_guard<std::mutex> lock(ptr_this->mutex_);
+    if (state == RTC_CONNECTED) {
+      ptr_this->connected_ = true;
+    } else if (state == RTC_DISCONNECTED || state == RTC_FAILED ||
+               state == RTC_CLOSED) {
+      ptr_this->connected_ = false;
+    }
+  }
+  ptr_this->state_changed_.notify_all();
+#else
+  (void)state;
+  (void)ptr_sender;
+#endif  // WEBMLIVE_HAVE_LIBDATACHANNEL
+}
+
+void WhipSender::OnGatheringStateChange(int /*pc*/, int state,
+                                        void* ptr_sender) {
+#ifdef WEBMLIVE_HAVE_LIBDATACHANNEL
+  WhipSender* const ptr_this = static_cast<WhipSender*>(ptr_sender);
+  if (state != RTC_GATHERING_COMPLETE) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(ptr_this->mutex_);
+    ptr_this->gathering_done_ = true;
+  }
+  ptr_this->state_changed_.notify_all();
+#else
+  (void)state;
+  (void)ptr_sender;
+#endif  // WEBMLIVE_HAVE_LIBDATACHANNEL
+}
+
+void WhipSender::OnTrackMessage(int track, const char* ptr_data, int size,
+                                void* ptr_sender) {
+  // Negative sizes are text messages, which media tracks do not carry.
+  if (size <= 0) {
+    return;
+  }
+  WhipSender* const ptr_this = static_cast<WhipSender*>(ptr_sender);
+  RtcpFeedback feedback;
+  bool request_keyframe = false;
+  {
+    std::lock_guard<std::mutex> lock(ptr_this->mutex_);
+    Stream* const ptr_stream =
+        track == ptr_this->video_.track ? &ptr_this->video_ :
+        track == ptr_this->audio_.track ? &ptr_this->audio_ : NULL;
+    if (!ptr_stream ||
+        !ParseRtcpFeedback(reinterpret_cast<const uint8*>(ptr_data), size,
+                           ptr_stream->packetizer.ssrc(), &feedback)) {
+      return;
+    }
+    ptr_this->HandleFeedback(feedback, ptr_stream);
+    request_keyframe =
+        feedback.keyframe_requested && ptr_stream == &ptr_this->video_;
+  }
+  if (!feedback.lost_sequence_numbers.empty()) {
+    ptr_this->state_changed_.notify_all();
+  }
+  if (request_keyframe) {
+    ptr_this->RequestKeyframe();
+  }
+}
+
+void WhipSender::SendThread() {
+  LOG(INFO) << "WhipSender thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kUpload);
+  ScopedCpuStage cpu_stage(kCpuUpload);
+  while (!stop_) {
+    if (Connect()) {
+      SendPackets();
+      if (!stop_)
+        LOG(WARNING) << "WHIP connection lost; reconnecting.";
+    }
+    Disconnect();
+    if (!stop_) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      state_changed_.wait_for(lock,
+                              std::chrono::milliseconds(kReconnectIntervalMs),
+                              [this] { return stop_.load(); });
+    }
+  }
+  LOG(INFO) << "WhipSender thread done.";
+}
+
+}  // namespace webmlive
@@ -0,0 +1,269 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_WHIP_SENDER_H_
+#define WEBMLIVE_ENCODER_WHIP_SENDER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/encoded_frame_sink.h"
+#include "encoder/rtp_packetizer.h"
+#include "encoder/token_bucket.h"
+
+namespace webmlive {
+
+class Metric;
+
+struct WhipSenderSettings {
+  static const int kDefaultPacingPercent = 250;
+  static const int kDefaultMaxQueueDelayMs = 300;
+
+  WhipSenderSettings()
+      : video_codec(kVideoFormatVP8),
+        temporal_layers(1),
+        audio(true),
+        bitrate_kbps(0),
+        pacing_percent(kDefaultPacingPercent),
+        max_queue_delay_ms(kDefaultMaxQueueDelayMs) {}
+
+  // WHIP endpoint of the SFU, and the bearer token it expects, if any.
+  std::string url;
+  std::string bearer_token;
+
+  // STUN and TURN servers, as "stun:host:port" or
+  // "turn:user:password@host:port".
+  std::vector<std::string> ice_servers;
+
+  // Codec and |VpxConfig::temporal_layers| of the video frames written.
+  VideoFormat video_codec;
+  int temporal_layers;
+
+  // Adds an Opus track for the main audio track.
+  bool audio;
+
+  // Media bitrate, video and audio, in kilobits per second. Packets leave
+  // at |pacing_percent| of it, so that keyframes are spread over a few
+  // frame intervals instead of bursting into the network. 0 disables
+  // pacing.
+  int bitrate_kbps;
+  int pacing_percent;
+
+  // Longest time video packets wait to be paced out. Once reached, the
+  // queued video is dropped and a keyframe requested, which keeps the
+  // stream realtime when the link cannot keep up.
+  int max_queue_delay_ms;
+
+  // Labels added to the sender's metrics; see |MetricsRegistry|.
+  std::string metrics_labels;
+};
+
+// Realtime output publishing the encoders' frames to an SFU over WebRTC,
+// negotiated with WHIP (WebRTC-HTTP ingestion protocol): VP8 or VP9 frames,
+// and Opus audio, are packetized into RTP as they leave the encoders,
+// without going through |LiveWebmMuxer|, and paced out on a thread of the
+// sender's own. Losses reported by NACKs are retransmitted from a history
+// of the packets sent, and picture loss indications request a keyframe
+// through the keyframe callback.
+//
+//   WhipSender sender;
+//   sender.Init(settings);
+//   sender.set_keyframe_callback([&encoder] { encoder.RequestKeyframe(); });
+//   sender.Run();
+//   config.realtime_sink = &sender;
+//
+// Notes
+// - Temporal layers are signaled in the payload descriptors, so that the
+//   SFU can forward fewer layers to receivers on slower links. With
+//   |VpxConfig::intra_refresh| losses beyond the reach of retransmission
+//   heal over a refresh cycle instead of costing a keyframe for everyone.
+// - Losing the connection, or failing to connect, is not an error: the
+//   sender deletes the WHIP resource and publishes a new one every
+//   |kReconnectIntervalMs|, dropping frames in the meantime.
+// - ICE, DTLS and SRTP come from libdatachannel, which is optional: without
+//   WEBMLIVE_HAVE_LIBDATACHANNEL |Init()| fails.
+class WhipSender : public EncodedFrameSinkInterface {
+ public:
+  enum {
+    // libdatachannel support was not built.
+    kUnsupported = -4,
+    // Cannot start the sender thread.
+    kThreadError = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  static const int kReconnectIntervalMs = 2000;
+
+  // Packets kept for retransmission per stream, a second of video at 10
+  // Mbps.
+  static const int kHistorySize = 1024;
+
+  WhipSender();
+  virtual ~WhipSender();
+
+  // Copies |settings|. Returns |kSuccess| when successful.
+  int Init(const WhipSenderSettings& settings);
+
+  // Starts the sender thread, which publishes the stream on its own.
+  // Returns |kSuccess| when successful.
+  int Run();
+
+  // Deletes the WHIP resource and stops the sender thread. Queued packets
+  // are dropped.
+  void Stop();
+
+  // Sets the function called, on an internal thread, when the SFU asks for
+  // a keyframe, and when a connection starts. Call before |Run()|.
+  void set_keyframe_callback(const std::function<void()>& callback) {
+    keyframe_callback_ = callback;
+  }
+
+  // |EncodedFrameSinkInterface| methods.
+  virtual bool WriteVideoFrame(const VideoFrame& frame);
+  virtual bool WriteAudioBuffer(const AudioBuffer& buffer);
+
+ private:
+  // A packet sent, kept for retransmission.
+  struct SentPacket {
+    SentPacket() : retransmit_ms(0) {}
+
+    RtpPacket packet;
+    int64 retransmit_ms;
+  };
+
+  // A packet waiting for the pacer, and the stream it belongs to.
+  struct QueuedPacket {
+    QueuedPacket() : video(false), queued_ms(0) {}
+
+    RtpPacket packet;
+    bool video;
+    int64 queued_ms;
+  };
+
+  // One RTP stream, and its WebRTC track.
+  struct Stream {
+    Stream()
+        : track(-1),
+          packets_sent(0),
+          octets_sent(0),
+          media_time_us(-1),
+          wall_time_us(0),
+          report_ms(0) {}
+
+    RtpPacketizer packetizer;
+    int track;
+    std::vector<SentPacket> history;
+
+    // Counts of the sender reports.
+    uint32 packets_sent;
+    uint32 octets_sent;
+
+    // Media time of the last frame written, and the wall clock time it was
+    // written at, which map the RTP clock to the wall clock; and the time of
+    // the last sender report.
+    int64 media_time_us;
+    int64 wall_time_us;
+    int64 report_ms;
+  };
+
+  // Creates the peer connection, publishes its offer to the WHIP endpoint
+  // and applies the answer. Returns false when |Stop()| is called first, or
+  // on failure.
+  bool Connect();
+
+  // Closes the peer connection and deletes the WHIP resource.
+  void Disconnect();
+
+  // Paces out the queued packets until the connection is lost or |Stop()|
+  // is called.
+  void SendPackets();
+
+  // Sends |packet| on the track of |ptr_stream|. Returns false on failure.
+  bool SendPacket(const RtpPacket& packet, bool retransmission,
+                  Stream* ptr_stream);
+
+  // Sends the sender reports that are due.
+  void SendReports();
+
+  // Queues the retransmissions and keyframe requests of |feedback| about
+  // |ptr_stream|. Called with |mutex_| held.
+  void HandleFeedback(const RtcpFeedback& feedback, Stream* ptr_stream);
+
+  // Calls the keyframe callback unless it was called within
+  // |kMinKeyframeIntervalMs|.
+  void RequestKeyframe();
+
+  // libdatachannel callbacks.
+  static void OnStateChange(int pc, int state, void* ptr_sender);
+  static void OnGatheringStateChange(int pc, int state, void* ptr_sender);
+  static void OnTrackMessage(int track, const char* ptr_data, int size,
+                             void* ptr_sender);
+
+  // Sender thread function.
+  void SendThread();
+
+  WhipSenderSettings settings_;
+  std::function<void()> keyframe_callback_;
+  std::atomic<bool> stop_;
+
+  // Peer connection state, and the WHIP resource of the connection.
+  // Written by the sender thread and the libdatachannel callbacks under
+  // |mutex_|; |state_changed_| is signaled on every change, by |Stop()|,
+  // and when packets are queued.
+  std::mutex mutex_;
+  std::condition_variable state_changed_;
+  int peer_connection_;
+  bool connected_;
+  bool gathering_done_;
+  std::string resource_url_;
+
+  // Streams, and the packets waiting for the pacer: audio first, then
+  // retransmissions, then video. Protected by |mutex_|.
+  Stream video_;
+  Stream audio_;
+  std::deque<QueuedPacket> audio_queue_;
+  std::deque<QueuedPacket> retransmit_queue_;
+  std::deque<QueuedPacket> video_queue_;
+
+  // Set when video frames are dropped until the next keyframe: at the start
+  // of a connection, and after the video queue overflowed. Protected by
+  // |mutex_|.
+  bool awaiting_keyframe_;
+
+  // Packets of the frame being queued.
+  std::vector<RtpPacket> packets_;
+
+  // Time of the last keyframe request, in steady clock milliseconds.
+  std::atomic<int64> keyframe_request_ms_;
+
+  // Pacing budget, used by the sender thread only.
+  TokenBucket pacer_;
+
+  std::unique_ptr<std::thread> thread_;
+
+  // Metrics exported through |MetricsRegistry|. Set by |Init|.
+  Metric* ptr_bytes_sent_;
+  Metric* ptr_connections_;
+  Metric* ptr_dropped_frames_;
+  Metric* ptr_retransmitted_packets_;
+  Metric* ptr_keyframe_requests_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WhipSender);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_WHIP_SENDER_H_
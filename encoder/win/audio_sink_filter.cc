@@ -11,6 +11,9 @@
 #include <mmreg.h>
 #include <vfwmsgs.h>
 
+#include "encoder/cpu_accounting.h"
+#include "encoder/thread_placement.h"
+#include "encoder/trace_log.h"
 #include "encoder/win/dshow_util.h"
 #include "encoder/win/media_source_dshow.h"
 #include "encoder/win/media_type_dshow.h"
@@ -34,7 +37,8 @@ AudioSinkPin::AudioSinkPin(TCHAR* ptr_object_name,
                            HRESULT* ptr_result,
                            LPCWSTR ptr_pin_name)
     : CBaseInputPin(ptr_object_name, ptr_filter, ptr_filter_lock, ptr_result,
-                    ptr_pin_name) {
+                    ptr_pin_name),
+      allocator_buffers_(0) {
 }
 
 AudioSinkPin::~AudioSinkPin() {
@@ -160,6 +164,36 @@ HRESULT AudioSinkPin::Receive(IMediaSample* ptr_sample) {
   return S_OK;
 }
 
+STDMETHODIMP AudioSinkPin::GetAllocatorRequirements(
+    ALLOCATOR_PROPERTIES* ptr_properties) {
+  if (!ptr_properties) {
+    return E_POINTER;
+  }
+  if (allocator_buffers_ <= 0) {
+    return E_NOTIMPL;
+  }
+  ptr_properties->cBuffers = allocator_buffers_;
+  return S_OK;
+}
+
+STDMETHODIMP AudioSinkPin::NotifyAllocator(IMemAllocator* ptr_allocator,
+                                           BOOL read_only) {
+  const HRESULT hr = CBaseInputPin::NotifyAllocator(ptr_allocator, read_only);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  ALLOCATOR_PROPERTIES properties = {0};
+  if (ptr_allocator && SUCCEEDED(ptr_allocator->GetProperties(&properties))) {
+    LOG(INFO) << "AudioSinkPin allocator has " << properties.cBuffers
+              << " buffer(s) of " << properties.cbBuffer << " bytes.";
+    if (properties.cBuffers < allocator_buffers_) {
+      LOG(WARNING) << "AudioSinkPin requested " << allocator_buffers_
+                   << " buffers; capture drops more likely.";
+    }
+  }
+  return hr;
+}
+
 // Copies |actual_config_| to |ptr_config|. Note that the filter lock is always
 // held by caller, |AudioSinkFilter::config|.
 HRESULT AudioSinkPin::config(AudioConfig* ptr_config) const {
@@ -189,12 +223,18 @@ AudioSinkFilter::AudioSinkFilter(
     : CBaseFilter(ptr_filter_name,
                   ptr_iunknown,
                   &filter_lock_,
-                  CLSID_AudioSinkFilter) {
+                  CLSID_AudioSinkFilter),
+      streaming_thread_id_(0),
+      planar_output_(false) {
   if (!ptr_samples_callback) {
     *ptr_result = E_INVALIDARG;
     return;
   }
   ptr_samples_callback_ = ptr_samples_callback;
+  if (drop_detector_.Init("audio")) {
+    *ptr_result = E_FAIL;
+    return;
+  }
   sink_pin_.reset(
       new (std::nothrow) AudioSinkPin(NAME("AudioSinkInputPin"),  // NOLINT
                                       this, &filter_lock_, ptr_result,
@@ -224,6 +264,40 @@ HRESULT AudioSinkFilter::set_config(const AudioConfig& config) {
   return sink_pin_->set_config(config);
 }
 
+HRESULT AudioSinkFilter::set_planar_output(bool planar_output) {
+  if (m_State != State_Stopped) {
+    return VFW_E_NOT_STOPPED;
+  }
+  CAutoLock lock(&filter_lock_);
+  planar_output_ = planar_output;
+  return S_OK;
+}
+
+HRESULT AudioSinkFilter::set_allocator_buffers(int32 buffers) {
+  if (m_State != State_Stopped) {
+    return VFW_E_NOT_STOPPED;
+  }
+  CAutoLock lock(&filter_lock_);
+  sink_pin_->allocator_buffers_ = buffers > 0 ? buffers : 0;
+  return S_OK;
+}
+
+STDMETHODIMP AudioSinkFilter::Pause() {
+  if (m_State == State_Stopped) {
+    drop_detector_.Reset();
+  }
+  return CBaseFilter::Pause();
+}
+
+STDMETHODIMP AudioSinkFilter::Stop() {
+  const HRESULT hr = CBaseFilter::Stop();
+  LOG(INFO) << "AudioSinkFilter capture lost "
+            << drop_detector_.lost_samples() << " buffer(s) in "
+            << drop_detector_.gaps() << " gap(s), "
+            << drop_detector_.discontinuities() << " discontinuities.";
+  return hr;
+}
+
 // Locks filter and returns AudioSinkPin pointer wrapped by |sink_pin_|.
 CBasePin* AudioSinkFilter::GetPin(int index) {
   CBasePin* ptr_pin = NULL;
@@ -239,6 +313,12 @@ HRESULT AudioSinkFilter::OnSamplesReceived(IMediaSample* ptr_sample) {
   if (!ptr_sample) {
     return E_POINTER;
   }
+  if (streaming_thread_id_ != GetCurrentThreadId()) {
+    streaming_thread_id_ = GetCurrentThreadId();
+    ThreadPlacement::Instance().PlaceCurrentThread(
+        ThreadPlacement::kAudioCapture);
+  }
+  ScopedCpuStage cpu_stage(kCpuCapture);
 
   // Confirm that |ptr_sample| has a buffer.
   BYTE* ptr_sample_buffer = NULL;
@@ -251,8 +331,8 @@ HRESULT AudioSinkFilter::OnSamplesReceived(IMediaSample* ptr_sample) {
   }
 
   // Read |ptr_sample| start time, and calculate duration using end time.
-  int64 timestamp = 0;
-  int64 duration = 0;
+  int64 timestamp_us = 0;
+  int64 duration_us = 0;
   REFERENCE_TIME start_time = 0;
   REFERENCE_TIME end_time = 0;
   hr = ptr_sample->GetTime(&start_time, &end_time);
@@ -261,43 +341,58 @@ HRESULT AudioSinkFilter::OnSamplesReceived(IMediaSample* ptr_sample) {
     return hr;
   }
 
-  timestamp = media_time_to_milliseconds(start_time);
+  timestamp_us = media_time_to_microseconds(start_time);
   if (hr != VFW_S_NO_STOP_TIME) {
-    duration = media_time_to_milliseconds(end_time) - timestamp;
+    duration_us = media_time_to_microseconds(end_time) - timestamp_us;
   } else {
     LOG(WARNING) << "OnSamplesReceived sample has no stop time.";
   }
-
-  // Copy sample data into |sample_buffer_|.
-  int status = sample_buffer_.Init(sink_pin_->actual_config_,
-                                   timestamp,
-                                   duration,
-                                   ptr_sample_buffer,
-                                   sample_length);
+  const int64 timestamp = MicrosecondsToMilliseconds(timestamp_us);
+  const int64 duration =
+      MicrosecondsToMilliseconds(timestamp_us + duration_us) - timestamp;
+  drop_detector_.OnSample(timestamp_us, duration_us,
+                          ptr_sample->IsDiscontinuity() == S_OK);
+
+  // Copy sample data into |sample_buffer_|. Planar output deinterleaves in
+  // the same pass, sparing the encoder a second pass over the samples.
+  int status = AudioBuffer::kInvalidArg;
+  if (planar_output_) {
+    status = sample_buffer_.InitPlanar(sink_pin_->actual_config_,
+                                       timestamp,
+                                       duration,
+                                       ptr_sample_buffer,
+                                       sample_length);
+  }
+  if (status == AudioBuffer::kInvalidArg) {
+    status = sample_buffer_.Init(sink_pin_->actual_config_,
+                                 timestamp,
+                                 duration,
+                                 ptr_sample_buffer,
+                                 sample_length);
+  }
   if (status) {
     LOG(ERROR) << "OnSamplesReceived sample buffer init failed: " << status;
     return E_FAIL;
   }
+  sample_buffer_.SetTimeUs(timestamp_us, duration_us);
 
   const AudioConfig& config = sink_pin_->actual_config_;
-  LOG(INFO)
-      << "OnSamplesReceived\n"
-      << "   format_tag=" << config.format_tag << "\n"
-      << "   channels=" << config.channels << "\n"
-      << "   sample_rate=" << config.sample_rate << "\n"
-      << "   bytes_per_second=" << config.bytes_per_second << "\n"
-      << "   block_align=" << config.block_align << "\n"
-      << "   bits_per_sample=" << config.bits_per_sample << "\n"
-      << "   valid_bits_per_sample=" << config.valid_bits_per_sample << "\n"
-      << "   channel_mask=0x" << (std::hex) << config.channel_mask << "\n"
-      << "   timestamp(sec)=" << (std::dec) << (timestamp / 1000.0) << "\n"
-      << "   timestamp="      << timestamp << "\n"
-      << "   duration(sec)= " << (duration / 1000.0) << "\n"
-      << "   duration= "      << duration << "\n"
-      << "   size=" << sample_buffer_.buffer_length();
+  WEBMLIVE_TRACE_EVERY_N(TraceLog::kFrame, 50, "audio_capture")
+      << " format_tag=" << config.format_tag
+      << " channels=" << config.channels
+      << " sample_rate=" << config.sample_rate
+      << " bytes_per_second=" << config.bytes_per_second
+      << " block_align=" << config.block_align
+      << " bits_per_sample=" << config.bits_per_sample
+      << " valid_bits_per_sample=" << config.valid_bits_per_sample
+      << " channel_mask=0x" << (std::hex) << config.channel_mask << (std::dec)
+      << " timestamp=" << timestamp
+      << " duration=" << duration
+      << " size=" << sample_buffer_.buffer_length()
+      << " planar=" << sample_buffer_.planar();
 
   status = ptr_samples_callback_->OnSamplesReceived(&sample_buffer_);
-  if (status) {
+  if (status && status != AudioSamplesCallbackInterface::kDropped) {
     LOG(ERROR) << "OnSamplesReceived failed, status=" << status;
   }
   return S_OK;
@@ -30,6 +30,7 @@
 #endif  // __STREAMS__
 #include "encoder/audio_encoder.h"
 #include "encoder/basictypes.h"
+#include "encoder/capture_drop_detector.h"
 #include "encoder/encoder_base.h"
 
 
@@ -82,6 +83,15 @@ class AudioSinkPin : public CBaseInputPin {
   // if it fails.
   virtual HRESULT STDMETHODCALLTYPE Receive(IMediaSample* ptr_sample);
 
+  // Asks the upstream filter for |allocator_buffers_| buffers. Returns
+  // E_NOTIMPL, leaving the count to the upstream filter, when
+  // |allocator_buffers_| is 0.
+  STDMETHODIMP GetAllocatorRequirements(ALLOCATOR_PROPERTIES* ptr_properties);
+
+  // Logs the buffers the upstream filter settled on, and warns when they are
+  // fewer than |allocator_buffers_|.
+  STDMETHODIMP NotifyAllocator(IMemAllocator* ptr_allocator, BOOL read_only);
+
  private:
   // Copies |actual_config_| to |ptr_config| and returns S_OK. Returns
   // E_POINTER when |ptr_config| is NULL.
@@ -91,6 +101,10 @@ class AudioSinkPin : public CBaseInputPin {
   // then returns S_OK.
   HRESULT set_config(const AudioConfig& config);
 
+  // Buffers requested from the upstream filter's allocator; 0 leaves the
+  // count to the upstream filter.
+  int32 allocator_buffers_;
+
   // Filter user's requested audio config.
   AudioConfig requested_config_;
 
@@ -126,25 +140,50 @@ class AudioSinkFilter : public CBaseFilter {
   // Sets requested audio configuration and returns S_OK.
   HRESULT set_config(const AudioConfig& config);
 
+  // Delivers samples deinterleaved into planar float buffers, see
+  // |AudioBuffer::InitPlanar()|, when |planar_output| is true. Samples in
+  // formats |InitPlanar()| does not accept are delivered interleaved. Returns
+  // VFW_E_NOT_STOPPED unless the filter is stopped.
+  HRESULT set_planar_output(bool planar_output);
+
+  // Asks the upstream filter for |buffers| buffers when the pin connects.
+  // Capture filters that negotiate buffers through |IAMBufferNegotiation|
+  // may settle on their own count first. Values <= 0 leave the count to the
+  // upstream filter. Returns VFW_E_NOT_STOPPED unless the filter is stopped.
+  HRESULT set_allocator_buffers(int32 buffers);
+
   // IUnknown
   DECLARE_IUNKNOWN;
 
-  // CBaseFilter methods
+  // CBaseFilter methods. Reset |drop_detector_| as the graph starts, and log
+  // the capture drops as it stops.
+  STDMETHODIMP Pause();
+  STDMETHODIMP Stop();
   virtual int GetPinCount() { return 1; }
 
   // Returns the pin at |index|, or NULL. The value of |index| must be 0.
   virtual CBasePin* GetPin(int index);
 
  private:
-  // Copies audio samples from |ptr_sample| to |sample_buffer_|, and passes
+  // Copies audio samples from |ptr_sample| to |sample_buffer_|, deinterleaving
+  // them when |planar_output_| is true, and passes
   // |sample_buffer_| to |AudioSamplesCallbackInterface| for processing.
   // Returns S_OK when successful.
   HRESULT OnSamplesReceived(IMediaSample* ptr_sample);
 
   mutable CCritSec filter_lock_;
+
+  // Thread that last delivered a sample. The graph's streaming thread is
+  // placed by |ThreadPlacement| when first seen.
+  DWORD streaming_thread_id_;
+  bool planar_output_;
   std::unique_ptr<AudioSinkPin> sink_pin_;
   AudioBuffer sample_buffer_;
   AudioSamplesCallbackInterface* ptr_samples_callback_;
+
+  // Counts the buffers lost upstream, from sample times and discontinuity
+  // flags.
+  CaptureDropDetector drop_detector_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(AudioSinkFilter);
 
   // |AudioSinkPin| requires access to |AudioSinkFilter| private member
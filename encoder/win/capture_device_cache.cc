@@ -0,0 +1,135 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/win/capture_device_cache.h"
+
+#include <objbase.h>
+
+#include "glog/logging.h"
+
+namespace webmlive {
+
+namespace {
+// Returns |guid| as a string usable as a map key.
+std::wstring GuidKey(const GUID& guid) {
+  wchar_t key[64] = {0};
+  StringFromGUID2(guid, key, sizeof(key) / sizeof(key[0]));
+  return key;
+}
+}  // namespace
+
+CaptureDeviceCache& CaptureDeviceCache::Instance() {
+  static CaptureDeviceCache cache;
+  return cache;
+}
+
+CaptureDeviceCache::CaptureDeviceCache()
+    : registration_attempted_(false),
+      notification_(NULL) {
+}
+
+CaptureDeviceCache::~CaptureDeviceCache() {
+  if (notification_) {
+    CM_Unregister_Notification(notification_);
+  }
+}
+
+bool CaptureDeviceCache::GetDevices(const CLSID& category,
+                                    std::vector<Device>* ptr_devices) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!EnsureRegistered()) {
+    return false;
+  }
+  const std::map<std::wstring, std::vector<Device>>::const_iterator it =
+      devices_.find(GuidKey(category));
+  if (it == devices_.end()) {
+    return false;
+  }
+  *ptr_devices = it->second;
+  return true;
+}
+
+void CaptureDeviceCache::StoreDevices(const CLSID& category,
+                                      const std::vector<Device>& devices) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (EnsureRegistered()) {
+    devices_[GuidKey(category)] = devices;
+  }
+}
+
+bool CaptureDeviceCache::GetVideoFormat(const std::wstring& path,
+                                        const std::string& config_key,
+                                        VideoFormat* ptr_format) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (path.empty() || !EnsureRegistered()) {
+    return false;
+  }
+  const std::wstring key =
+      path + L"|" + std::wstring(config_key.begin(), config_key.end());
+  const std::map<std::wstring, VideoFormat>::const_iterator it =
+      video_formats_.find(key);
+  if (it == video_formats_.end()) {
+    return false;
+  }
+  *ptr_format = it->second;
+  return true;
+}
+
+void CaptureDeviceCache::StoreVideoFormat(const std::wstring& path,
+                                          const std::string& config_key,
+                                          VideoFormat format) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!path.empty() && EnsureRegistered()) {
+    const std::wstring key =
+        path + L"|" + std::wstring(config_key.begin(), config_key.end());
+    video_formats_[key] = format;
+  }
+}
+
+void CaptureDeviceCache::Invalidate() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  devices_.clear();
+  video_formats_.clear();
+}
+
+bool CaptureDeviceCache::EnsureRegistered() {
+  if (!registration_attempted_) {
+    registration_attempted_ = true;
+
+    // Any device interface change invalidates the cache: capture devices
+    // appear under several interface classes, and spurious invalidation only
+    // costs one enumeration.
+    CM_NOTIFY_FILTER filter = {0};
+    filter.cbSize = sizeof(filter);
+    filter.Flags = CM_NOTIFY_FILTER_FLAG_ALL_INTERFACE_CLASSES;
+    filter.FilterType = CM_NOTIFY_FILTER_TYPE_DEVICEINTERFACE;
+    const CONFIGRET result = CM_Register_Notification(
+        &filter, this, &CaptureDeviceCache::OnDeviceChange, &notification_);
+    if (result != CR_SUCCESS) {
+      LOG(WARNING) << "device change notification unavailable ("
+                   << result << "); capture devices are not cached.";
+      notification_ = NULL;
+    }
+  }
+  return notification_ != NULL;
+}
+
+DWORD CALLBACK CaptureDeviceCache::OnDeviceChange(
+    HCMNOTIFICATION /*notification*/,
+    PVOID ptr_context,
+    CM_NOTIFY_ACTION action,
+    PCM_NOTIFY_EVENT_DATA /*ptr_event_data*/,
+    DWORD /*event_data_size*/) {
+  if (action == CM_NOTIFY_ACTION_DEVICEINTERFACEARRIVAL ||
+      action == CM_NOTIFY_ACTION_DEVICEINTERFACEREMOVAL) {
+    VLOG(1) << "device change; capture device cache invalidated.";
+    static_cast<CaptureDeviceCache*>(ptr_context)->Invalidate();
+  }
+  return ERROR_SUCCESS;
+}
+
+}  // namespace webmlive
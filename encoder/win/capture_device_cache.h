@@ -0,0 +1,89 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_WIN_CAPTURE_DEVICE_CACHE_H_
+#define WEBMLIVE_ENCODER_WIN_CAPTURE_DEVICE_CACHE_H_
+
+#include <windows.h>
+#include <cfgmgr32.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+// Process wide cache of the DirectShow capture devices found by
+// |CaptureSourceLoader|, and of the video format each device last connected
+// with, so that restarting a stream skips device enumeration and format
+// discovery.
+//
+// Notes
+// - Devices are cached with their moniker display name, which binds the
+//   device filter without enumerating again.
+// - Formats are keyed by device path and by the requested video settings.
+//   The device path is the DevicePath property of the moniker, or the display
+//   name for devices without one.
+// - Everything is dropped when a device interface arrives or is removed, as
+//   reported by |CM_Register_Notification()|. When the notification cannot
+//   be registered nothing is cached.
+class CaptureDeviceCache {
+ public:
+  struct Device {
+    std::wstring name;
+    std::wstring display_name;
+    std::wstring path;
+  };
+
+  static CaptureDeviceCache& Instance();
+
+  // Stores the devices of |category| in |ptr_devices|. Returns false when
+  // none are cached.
+  bool GetDevices(const CLSID& category, std::vector<Device>* ptr_devices);
+  void StoreDevices(const CLSID& category, const std::vector<Device>& devices);
+
+  // Stores in |ptr_format| the format the device at |path| last connected
+  // with for |config_key|. Returns false when none is cached.
+  bool GetVideoFormat(const std::wstring& path, const std::string& config_key,
+                      VideoFormat* ptr_format);
+  void StoreVideoFormat(const std::wstring& path,
+                        const std::string& config_key, VideoFormat format);
+
+  // Drops every device and format.
+  void Invalidate();
+
+ private:
+  CaptureDeviceCache();
+  ~CaptureDeviceCache();
+
+  // Registers |OnDeviceChange()| on first use. Returns true when registered.
+  // Must be called with |mutex_| held.
+  bool EnsureRegistered();
+
+  static DWORD CALLBACK OnDeviceChange(HCMNOTIFICATION notification,
+                                       PVOID ptr_context,
+                                       CM_NOTIFY_ACTION action,
+                                       PCM_NOTIFY_EVENT_DATA ptr_event_data,
+                                       DWORD event_data_size);
+
+  std::mutex mutex_;
+  bool registration_attempted_;
+  HCMNOTIFICATION notification_;
+
+  // Devices by category, and formats by path and settings.
+  std::map<std::wstring, std::vector<Device>> devices_;
+  std::map<std::wstring, VideoFormat> video_formats_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(CaptureDeviceCache);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_WIN_CAPTURE_DEVICE_CACHE_H_
@@ -0,0 +1,593 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/win/desktop_capture_source.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/latency_tracer.h"
+#include "encoder/thread_placement.h"
+#include "encoder/time_util.h"
+#include "encoder/trace_log.h"
+#include "encoder/win/dshow_util.h"
+#include "glog/logging.h"
+#include "libyuv/convert.h"
+
+namespace {
+
+// Past this many pending rectangles the whole frame is converted instead.
+const size_t kMaxPendingRects = 64;
+
+// I420 black, used until the first desktop update arrives.
+const uint8 kBlackLuma = 16;
+const uint8 kBlackChroma = 128;
+
+// Clips |rect| to |width| x |height| and grows it to even coordinates, as
+// I420 chroma covers 2x2 pixel blocks. Returns false when nothing is left.
+bool AlignRect(const RECT& rect, int32 width, int32 height,
+               RECT* ptr_aligned) {
+  ptr_aligned->left = std::max<LONG>(0, rect.left) & ~1;
+  ptr_aligned->top = std::max<LONG>(0, rect.top) & ~1;
+  ptr_aligned->right = std::min<LONG>(width, (rect.right + 1) & ~1);
+  ptr_aligned->bottom = std::min<LONG>(height, (rect.bottom + 1) & ~1);
+  return ptr_aligned->right > ptr_aligned->left &&
+         ptr_aligned->bottom > ptr_aligned->top;
+}
+
+}  // anonymous namespace
+
+namespace webmlive {
+
+DesktopCaptureSource::DesktopCaptureSource()
+    : frame_sequence_(0),
+      ptr_callback_(NULL),
+      stop_(false),
+      status_(kSuccess) {
+}
+
+DesktopCaptureSource::~DesktopCaptureSource() {
+  Stop();
+}
+
+int DesktopCaptureSource::Init(int output_index,
+                               const VideoConfig& requested_config,
+                               VideoFrameCallbackInterface* ptr_callback) {
+  if (!ptr_callback || output_index < 0) {
+    LOG(ERROR) << "DesktopCaptureSource invalid argument.";
+    return kInvalidArg;
+  }
+  ptr_callback_ = ptr_callback;
+
+  int status = CreateDevice(output_index);
+  if (status) {
+    return status;
+  }
+  status = CreateDuplication();
+  if (status) {
+    return status;
+  }
+
+  DXGI_OUTDUPL_DESC duplication_desc;
+  duplication_->GetDesc(&duplication_desc);
+  if (duplication_desc.Rotation != DXGI_MODE_ROTATION_IDENTITY &&
+      duplication_desc.Rotation != DXGI_MODE_ROTATION_UNSPECIFIED) {
+    LOG(WARNING) << "DesktopCaptureSource output is rotated; frames are "
+                 << "captured unrotated.";
+  }
+  const uint32 desktop_width = duplication_desc.ModeDesc.Width;
+  const uint32 desktop_height = duplication_desc.ModeDesc.Height;
+
+  actual_config_.format = kVideoFormatI420;
+  actual_config_.width = desktop_width & ~1;
+  actual_config_.height = desktop_height & ~1;
+  actual_config_.stride = actual_config_.width;
+  actual_config_.frame_rate = requested_config.frame_rate > 0 ?
+      requested_config.frame_rate : kDefaultFrameRate;
+
+  D3D11_TEXTURE2D_DESC texture_desc = {0};
+  texture_desc.Width = desktop_width;
+  texture_desc.Height = desktop_height;
+  texture_desc.MipLevels = 1;
+  texture_desc.ArraySize = 1;
+  texture_desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+  texture_desc.SampleDesc.Count = 1;
+  texture_desc.Usage = D3D11_USAGE_DEFAULT;
+  texture_desc.BindFlags = D3D11_BIND_RENDER_TARGET |
+                           D3D11_BIND_SHADER_RESOURCE;
+  HRESULT hr = device_->CreateTexture2D(&texture_desc, NULL,
+                                        &desktop_texture_);
+  if (FAILED(hr)) {
+    LOG(ERROR) << "CreateTexture2D (desktop) failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  texture_desc.Usage = D3D11_USAGE_STAGING;
+  texture_desc.BindFlags = 0;
+  texture_desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+  hr = device_->CreateTexture2D(&texture_desc, NULL, &bgra_staging_);
+  if (FAILED(hr)) {
+    LOG(ERROR) << "CreateTexture2D (staging) failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+
+  if (CreateVideoProcessor()) {
+    LOG(INFO) << "DesktopCaptureSource converting on the CPU.";
+    video_processor_ = 0;
+  } else {
+    LOG(INFO) << "DesktopCaptureSource converting on the GPU.";
+  }
+
+  const int32 frame_size = VideoFrame::PlanarFrameSize(actual_config_.width,
+                                                       actual_config_.height);
+  const int32 luma_size = actual_config_.width * actual_config_.height;
+  i420_buffer_.assign(frame_size, kBlackChroma);
+  std::fill(i420_buffer_.begin(), i420_buffer_.begin() + luma_size,
+            kBlackLuma);
+  LOG(INFO) << "DesktopCaptureSource output " << output_index << ": "
+            << actual_config_.width << "x" << actual_config_.height << " @ "
+            << actual_config_.frame_rate << " fps";
+  return kSuccess;
+}
+
+int DesktopCaptureSource::Run() {
+  if (capture_thread_) {
+    LOG(ERROR) << "DesktopCaptureSource already running.";
+    return kThreadError;
+  }
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  stop_ = false;
+  capture_thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&DesktopCaptureSource::CaptureThread,  // NOLINT
+                                this)));
+  if (!capture_thread_) {
+    LOG(ERROR) << "DesktopCaptureSource cannot construct thread.";
+    return kThreadError;
+  }
+  return kSuccess;
+}
+
+void DesktopCaptureSource::Stop() {
+  if (capture_thread_) {
+    stop_ = true;
+    capture_thread_->join();
+    capture_thread_.reset();
+  }
+}
+
+int DesktopCaptureSource::CreateDevice(int output_index) {
+  IDXGIFactory1Ptr factory;
+  HRESULT hr = CreateDXGIFactory1(__uuidof(IDXGIFactory1),
+                                  reinterpret_cast<void**>(&factory));
+  if (FAILED(hr)) {
+    LOG(ERROR) << "CreateDXGIFactory1 failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+
+  // Outputs are numbered across adapters in enumeration order.
+  IDXGIAdapter1Ptr found_adapter;
+  IDXGIOutputPtr found_output;
+  int index = 0;
+  IDXGIAdapter1Ptr adapter;
+  for (UINT i = 0; !found_output &&
+       factory->EnumAdapters1(i, &adapter) != DXGI_ERROR_NOT_FOUND; ++i) {
+    IDXGIOutputPtr output;
+    for (UINT j = 0; adapter->EnumOutputs(j, &output) != DXGI_ERROR_NOT_FOUND;
+         ++j) {
+      if (index++ == output_index) {
+        found_adapter = adapter;
+        found_output = output;
+        break;
+      }
+    }
+  }
+  if (!found_output) {
+    LOG(ERROR) << "DesktopCaptureSource has no output " << output_index;
+    return kNoOutput;
+  }
+  output_ = found_output;
+  if (!output_) {
+    LOG(ERROR) << "Desktop Duplication requires Windows 8 or later.";
+    return kDeviceError;
+  }
+
+  // Video support enables GPU conversion; retry without it for devices that
+  // lack a video processor.
+  const UINT flags = D3D11_CREATE_DEVICE_BGRA_SUPPORT;
+  hr = D3D11CreateDevice(found_adapter, D3D_DRIVER_TYPE_UNKNOWN, NULL,
+                         flags | D3D11_CREATE_DEVICE_VIDEO_SUPPORT, NULL, 0,
+                         D3D11_SDK_VERSION, &device_, NULL, &context_);
+  if (FAILED(hr)) {
+    hr = D3D11CreateDevice(found_adapter, D3D_DRIVER_TYPE_UNKNOWN, NULL,
+                           flags, NULL, 0, D3D11_SDK_VERSION, &device_, NULL,
+                           &context_);
+  }
+  if (FAILED(hr)) {
+    LOG(ERROR) << "D3D11CreateDevice failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  return kSuccess;
+}
+
+int DesktopCaptureSource::CreateDuplication() {
+  duplication_ = 0;
+  const HRESULT hr = output_->DuplicateOutput(device_, &duplication_);
+  if (FAILED(hr)) {
+    LOG(ERROR) << "DuplicateOutput failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  if (desktop_texture_) {
+    // Recreated after access was lost: the mode must not have changed, and
+    // the whole desktop must be redrawn.
+    DXGI_OUTDUPL_DESC desc;
+    duplication_->GetDesc(&desc);
+    if (static_cast<int32>(desc.ModeDesc.Width & ~1) != actual_config_.width ||
+        static_cast<int32>(desc.ModeDesc.Height & ~1) !=
+            actual_config_.height) {
+      LOG(ERROR) << "DesktopCaptureSource desktop size changed.";
+      return kDeviceError;
+    }
+    const RECT full_rect = {0, 0, actual_config_.width, actual_config_.height};
+    pending_rects_.assign(1, full_rect);
+  }
+  return kSuccess;
+}
+
+int DesktopCaptureSource::CreateVideoProcessor() {
+  video_device_ = device_;
+  video_context_ = context_;
+  if (!video_device_ || !video_context_) {
+    return kDeviceError;
+  }
+  const UINT width = actual_config_.width;
+  const UINT height = actual_config_.height;
+  const UINT frame_rate = static_cast<UINT>(actual_config_.frame_rate + 0.5);
+
+  D3D11_VIDEO_PROCESSOR_CONTENT_DESC content_desc = {};
+  content_desc.InputFrameFormat = D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE;
+  content_desc.InputFrameRate.Numerator = frame_rate;
+  content_desc.InputFrameRate.Denominator = 1;
+  content_desc.InputWidth = width;
+  content_desc.InputHeight = height;
+  content_desc.OutputFrameRate = content_desc.InputFrameRate;
+  content_desc.OutputWidth = width;
+  content_desc.OutputHeight = height;
+  content_desc.Usage = D3D11_VIDEO_USAGE_OPTIMAL_SPEED;
+  HRESULT hr = video_device_->CreateVideoProcessorEnumerator(
+      &content_desc, &processor_enum_);
+  if (FAILED(hr)) {
+    LOG(WARNING) << "CreateVideoProcessorEnumerator failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  UINT input_support = 0;
+  UINT output_support = 0;
+  processor_enum_->CheckVideoProcessorFormat(DXGI_FORMAT_B8G8R8A8_UNORM,
+                                             &input_support);
+  processor_enum_->CheckVideoProcessorFormat(DXGI_FORMAT_NV12,
+                                             &output_support);
+  if (!(input_support & D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_INPUT) ||
+      !(output_support & D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_OUTPUT)) {
+    LOG(WARNING) << "video processor cannot convert BGRA to NV12.";
+    return kDeviceError;
+  }
+  hr = video_device_->CreateVideoProcessor(processor_enum_, 0,
+                                           &video_processor_);
+  if (FAILED(hr)) {
+    LOG(WARNING) << "CreateVideoProcessor failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+
+  D3D11_TEXTURE2D_DESC texture_desc = {0};
+  texture_desc.Width = width;
+  texture_desc.Height = height;
+  texture_desc.MipLevels = 1;
+  texture_desc.ArraySize = 1;
+  texture_desc.Format = DXGI_FORMAT_NV12;
+  texture_desc.SampleDesc.Count = 1;
+  texture_desc.Usage = D3D11_USAGE_DEFAULT;
+  texture_desc.BindFlags = D3D11_BIND_RENDER_TARGET;
+  hr = device_->CreateTexture2D(&texture_desc, NULL, &nv12_texture_);
+  if (FAILED(hr)) {
+    LOG(WARNING) << "CreateTexture2D (NV12) failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  texture_desc.Usage = D3D11_USAGE_STAGING;
+  texture_desc.BindFlags = 0;
+  texture_desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+  hr = device_->CreateTexture2D(&texture_desc, NULL, &nv12_staging_);
+  if (FAILED(hr)) {
+    LOG(WARNING) << "CreateTexture2D (NV12 staging) failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+
+  D3D11_VIDEO_PROCESSOR_INPUT_VIEW_DESC input_desc = {};
+  input_desc.ViewDimension = D3D11_VPIV_DIMENSION_TEXTURE2D;
+  hr = video_device_->CreateVideoProcessorInputView(
+      desktop_texture_, processor_enum_, &input_desc, &input_view_);
+  if (FAILED(hr)) {
+    LOG(WARNING) << "CreateVideoProcessorInputView failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  D3D11_VIDEO_PROCESSOR_OUTPUT_VIEW_DESC output_desc = {};
+  output_desc.ViewDimension = D3D11_VPOV_DIMENSION_TEXTURE2D;
+  hr = video_device_->CreateVideoProcessorOutputView(
+      nv12_texture_, processor_enum_, &output_desc, &output_view_);
+  if (FAILED(hr)) {
+    LOG(WARNING) << "CreateVideoProcessorOutputView failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+
+  // Full range RGB in, BT.601 studio range YUV out: what libvpx expects, and
+  // what the CPU path produces.
+  D3D11_VIDEO_PROCESSOR_COLOR_SPACE input_space = {};
+  input_space.RGB_Range = 0;
+  D3D11_VIDEO_PROCESSOR_COLOR_SPACE output_space = {};
+  output_space.YCbCr_Matrix = 0;
+  output_space.Nominal_Range = D3D11_VIDEO_PROCESSOR_NOMINAL_RANGE_16_235;
+  video_context_->VideoProcessorSetStreamColorSpace(video_processor_, 0,
+                                                    &input_space);
+  video_context_->VideoProcessorSetOutputColorSpace(video_processor_,
+                                                    &output_space);
+  video_context_->VideoProcessorSetStreamFrameFormat(
+      video_processor_, 0, D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE);
+  video_context_->VideoProcessorSetStreamAutoProcessingMode(video_processor_,
+                                                            0, FALSE);
+  // Drops the odd column or row, if any.
+  const RECT source_rect = {0, 0, static_cast<LONG>(width),
+                            static_cast<LONG>(height)};
+  video_context_->VideoProcessorSetStreamSourceRect(video_processor_, 0, TRUE,
+                                                    &source_rect);
+  return kSuccess;
+}
+
+int DesktopCaptureSource::AcquireUpdate(uint32 timeout_ms) {
+  DXGI_OUTDUPL_FRAME_INFO frame_info;
+  IDXGIResourcePtr resource;
+  HRESULT hr = duplication_->AcquireNextFrame(timeout_ms, &frame_info,
+                                              &resource);
+  if (hr == DXGI_ERROR_WAIT_TIMEOUT) {
+    return kSuccess;
+  }
+  if (hr == DXGI_ERROR_ACCESS_LOST) {
+    // Mode changes, and switches to the secure desktop, end duplication.
+    LOG(WARNING) << "DesktopCaptureSource lost access to the desktop.";
+    return CreateDuplication();
+  }
+  if (FAILED(hr)) {
+    LOG(ERROR) << "AcquireNextFrame failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+
+  // A zero present time means only the mouse pointer changed.
+  if (frame_info.LastPresentTime.QuadPart != 0) {
+    ID3D11Texture2DPtr texture = resource;
+    if (!texture) {
+      duplication_->ReleaseFrame();
+      LOG(ERROR) << "DesktopCaptureSource frame is not a texture.";
+      return kDeviceError;
+    }
+
+    std::vector<RECT> rects;
+    bool have_metadata = false;
+    if (frame_info.TotalMetadataBufferSize > 0) {
+      metadata_.resize(frame_info.TotalMetadataBufferSize);
+      UINT move_bytes = 0;
+      UINT dirty_bytes = 0;
+      hr = duplication_->GetFrameMoveRects(
+          static_cast<UINT>(metadata_.size()),
+          reinterpret_cast<DXGI_OUTDUPL_MOVE_RECT*>(&metadata_[0]),
+          &move_bytes);
+      if (SUCCEEDED(hr)) {
+        const DXGI_OUTDUPL_MOVE_RECT* const ptr_moves =
+            reinterpret_cast<const DXGI_OUTDUPL_MOVE_RECT*>(&metadata_[0]);
+        for (UINT i = 0; i < move_bytes / sizeof(*ptr_moves); ++i) {
+          rects.push_back(ptr_moves[i].DestinationRect);
+        }
+        hr = duplication_->GetFrameDirtyRects(
+            static_cast<UINT>(metadata_.size()),
+            reinterpret_cast<RECT*>(&metadata_[0]), &dirty_bytes);
+      }
+      if (SUCCEEDED(hr)) {
+        const RECT* const ptr_dirty =
+            reinterpret_cast<const RECT*>(&metadata_[0]);
+        rects.insert(rects.end(), ptr_dirty,
+                     ptr_dirty + dirty_bytes / sizeof(*ptr_dirty));
+        have_metadata = true;
+      }
+    }
+    if (!have_metadata) {
+      const RECT full_rect = {0, 0, actual_config_.width,
+                              actual_config_.height};
+      rects.assign(1, full_rect);
+    }
+
+    for (size_t i = 0; i < rects.size(); ++i) {
+      RECT rect;
+      if (!AlignRect(rects[i], actual_config_.width, actual_config_.height,
+                     &rect)) {
+        continue;
+      }
+      const D3D11_BOX box = {static_cast<UINT>(rect.left),
+                             static_cast<UINT>(rect.top), 0,
+                             static_cast<UINT>(rect.right),
+                             static_cast<UINT>(rect.bottom), 1};
+      context_->CopySubresourceRegion(desktop_texture_, 0, rect.left,
+                                      rect.top, 0, texture, 0, &box);
+      pending_rects_.push_back(rect);
+    }
+    if (pending_rects_.size() > kMaxPendingRects) {
+      const RECT full_rect = {0, 0, actual_config_.width,
+                              actual_config_.height};
+      pending_rects_.assign(1, full_rect);
+    }
+  }
+  duplication_->ReleaseFrame();
+  return kSuccess;
+}
+
+int DesktopCaptureSource::ConvertOnGpu() {
+  D3D11_VIDEO_PROCESSOR_STREAM stream = {};
+  stream.Enable = TRUE;
+  stream.pInputSurface = input_view_;
+  HRESULT hr = video_context_->VideoProcessorBlt(video_processor_,
+                                                 output_view_, 0, 1, &stream);
+  if (FAILED(hr)) {
+    LOG(ERROR) << "VideoProcessorBlt failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  context_->CopyResource(nv12_staging_, nv12_texture_);
+  D3D11_MAPPED_SUBRESOURCE mapped;
+  hr = context_->Map(nv12_staging_, 0, D3D11_MAP_READ, 0, &mapped);
+  if (FAILED(hr)) {
+    LOG(ERROR) << "Map (NV12) failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  const int32 width = actual_config_.width;
+  const int32 height = actual_config_.height;
+  const uint8* const ptr_src_y = reinterpret_cast<const uint8*>(mapped.pData);
+  const uint8* const ptr_src_uv = ptr_src_y + mapped.RowPitch * height;
+  uint8* const ptr_y = &i420_buffer_[0];
+  uint8* const ptr_u = ptr_y + width * height;
+  uint8* const ptr_v = ptr_u + (width / 2) * (height / 2);
+  const int status = libyuv::NV12ToI420(ptr_src_y, mapped.RowPitch,
+                                        ptr_src_uv, mapped.RowPitch,
+                                        ptr_y, width,
+                                        ptr_u, width / 2,
+                                        ptr_v, width / 2,
+                                        width, height);
+  context_->Unmap(nv12_staging_, 0);
+  return status ? kDeviceError : kSuccess;
+}
+
+int DesktopCaptureSource::ConvertOnCpu() {
+  // Read back only the changed rectangles.
+  for (size_t i = 0; i < pending_rects_.size(); ++i) {
+    const RECT& rect = pending_rects_[i];
+    const D3D11_BOX box = {static_cast<UINT>(rect.left),
+                           static_cast<UINT>(rect.top), 0,
+                           static_cast<UINT>(rect.right),
+                           static_cast<UINT>(rect.bottom), 1};
+    context_->CopySubresourceRegion(bgra_staging_, 0, rect.left, rect.top, 0,
+                                    desktop_texture_, 0, &box);
+  }
+  D3D11_MAPPED_SUBRESOURCE mapped;
+  const HRESULT hr = context_->Map(bgra_staging_, 0, D3D11_MAP_READ, 0,
+                                   &mapped);
+  if (FAILED(hr)) {
+    LOG(ERROR) << "Map (BGRA) failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+
+  // DXGI's B8G8R8A8 is libyuv's ARGB.
+  const int32 width = actual_config_.width;
+  const int32 height = actual_config_.height;
+  const int32 uv_stride = width / 2;
+  uint8* const ptr_y = &i420_buffer_[0];
+  uint8* const ptr_u = ptr_y + width * height;
+  uint8* const ptr_v = ptr_u + uv_stride * (height / 2);
+  const uint8* const ptr_src = reinterpret_cast<const uint8*>(mapped.pData);
+  int status = kSuccess;
+  for (size_t i = 0; i < pending_rects_.size() && !status; ++i) {
+    const RECT& rect = pending_rects_[i];
+    const int32 chroma_offset = (rect.top / 2) * uv_stride + rect.left / 2;
+    status = libyuv::ARGBToI420(
+        ptr_src + rect.top * mapped.RowPitch + rect.left * 4, mapped.RowPitch,
+        ptr_y + rect.top * width + rect.left, width,
+        ptr_u + chroma_offset, uv_stride,
+        ptr_v + chroma_offset, uv_stride,
+        rect.right - rect.left, rect.bottom - rect.top);
+  }
+  context_->Unmap(bgra_staging_, 0);
+  return status ? kDeviceError : kSuccess;
+}
+
+int DesktopCaptureSource::DeliverFrame(int64 timestamp_us) {
+  const int64 duration_us =
+      static_cast<int64>(kMicrosecondTimebase / actual_config_.frame_rate);
+  const int status = frame_.Init(actual_config_,
+                                 true,  // always "keyframes"
+                                 0,
+                                 0,
+                                 &i420_buffer_[0],
+                                 static_cast<int32>(i420_buffer_.size()));
+  if (status) {
+    LOG(ERROR) << "DesktopCaptureSource frame Init failed: " << status;
+    return kNoMemory;
+  }
+  frame_.SetTimeUs(timestamp_us, duration_us);
+  const int64 timestamp = frame_.timestamp();
+  VideoRegionHints* const ptr_hints = frame_.mutable_region_hints();
+  ptr_hints->valid = true;
+  ptr_hints->sequence = frame_sequence_++;
+  ptr_hints->changed_regions.swap(changed_rects_);
+  changed_rects_.clear();
+  WEBMLIVE_TRACE_EVERY_N(TraceLog::kFrame, 30, "desktop_capture")
+      << " timestamp=" << timestamp;
+  LatencyTracer::Stamp(LatencyTracer::kCapture, timestamp);
+  const int frame_status = ptr_callback_->OnVideoFrameReceived(&frame_);
+  if (frame_status && frame_status != VideoFrameCallbackInterface::kDropped) {
+    LOG(ERROR) << "OnVideoFrameReceived failed, status=" << frame_status;
+  }
+  return kSuccess;
+}
+
+void DesktopCaptureSource::CaptureThread() {
+  LOG(INFO) << "DesktopCaptureSource thread started.";
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kCapture);
+  ScopedCpuStage cpu_stage(kCpuCapture);
+  const int64 interval_us =
+      static_cast<int64>(1000000 / actual_config_.frame_rate);
+  const int64 start_time_us = SteadyClockMicroseconds();
+  int64 next_frame_us = start_time_us;
+  bool have_frame = false;
+  int status = kSuccess;
+  while (!stop_ && status == kSuccess) {
+    const int64 now_us = SteadyClockMicroseconds();
+    if (now_us < next_frame_us) {
+      const uint32 timeout_ms =
+          static_cast<uint32>((next_frame_us - now_us + 999) / 1000);
+      status = AcquireUpdate(timeout_ms);
+      continue;
+    }
+
+    if (!pending_rects_.empty()) {
+      status = video_processor_ ? ConvertOnGpu() : ConvertOnCpu();
+      if (status && video_processor_) {
+        LOG(WARNING) << "GPU conversion failed, converting on the CPU.";
+        video_processor_ = 0;
+        const RECT full_rect = {0, 0, actual_config_.width,
+                                actual_config_.height};
+        pending_rects_.assign(1, full_rect);
+        status = ConvertOnCpu();
+      }
+      for (size_t i = 0; i < pending_rects_.size(); ++i) {
+        const RECT& rect = pending_rects_[i];
+        changed_rects_.push_back(VideoRect(rect.left, rect.top,
+                                           rect.right - rect.left,
+                                           rect.bottom - rect.top));
+      }
+      pending_rects_.clear();
+      have_frame = true;
+    }
+    if (have_frame && status == kSuccess) {
+      status = DeliverFrame(next_frame_us - start_time_us);
+    }
+
+    // Skip frame times missed while converting rather than bursting.
+    next_frame_us += interval_us;
+    if (next_frame_us < now_us) {
+      next_frame_us = now_us + interval_us;
+    }
+  }
+  status_ = status;
+  LOG(INFO) << "DesktopCaptureSource thread finished, status=" << status;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,171 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_WIN_DESKTOP_CAPTURE_SOURCE_H_
+#define WEBMLIVE_ENCODER_WIN_DESKTOP_CAPTURE_SOURCE_H_
+
+#include <comdef.h>
+#include <d3d11.h>
+#include <dxgi1_2.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "encoder/basictypes.h"
+#include "encoder/encoder_base.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+_COM_SMARTPTR_TYPEDEF(ID3D11Device, __uuidof(ID3D11Device));
+_COM_SMARTPTR_TYPEDEF(ID3D11DeviceContext, __uuidof(ID3D11DeviceContext));
+_COM_SMARTPTR_TYPEDEF(ID3D11Texture2D, __uuidof(ID3D11Texture2D));
+_COM_SMARTPTR_TYPEDEF(ID3D11VideoContext, __uuidof(ID3D11VideoContext));
+_COM_SMARTPTR_TYPEDEF(ID3D11VideoDevice, __uuidof(ID3D11VideoDevice));
+_COM_SMARTPTR_TYPEDEF(ID3D11VideoProcessor, __uuidof(ID3D11VideoProcessor));
+_COM_SMARTPTR_TYPEDEF(ID3D11VideoProcessorEnumerator,
+                      __uuidof(ID3D11VideoProcessorEnumerator));
+_COM_SMARTPTR_TYPEDEF(ID3D11VideoProcessorInputView,
+                      __uuidof(ID3D11VideoProcessorInputView));
+_COM_SMARTPTR_TYPEDEF(ID3D11VideoProcessorOutputView,
+                      __uuidof(ID3D11VideoProcessorOutputView));
+_COM_SMARTPTR_TYPEDEF(IDXGIAdapter1, __uuidof(IDXGIAdapter1));
+_COM_SMARTPTR_TYPEDEF(IDXGIFactory1, __uuidof(IDXGIFactory1));
+_COM_SMARTPTR_TYPEDEF(IDXGIOutput, __uuidof(IDXGIOutput));
+_COM_SMARTPTR_TYPEDEF(IDXGIOutput1, __uuidof(IDXGIOutput1));
+_COM_SMARTPTR_TYPEDEF(IDXGIOutputDuplication,
+                      __uuidof(IDXGIOutputDuplication));
+_COM_SMARTPTR_TYPEDEF(IDXGIResource, __uuidof(IDXGIResource));
+
+// Captures a monitor with DXGI Desktop Duplication and delivers I420 frames
+// at a fixed rate through |VideoFrameCallbackInterface|.
+//
+// Notes
+// - Desktop updates are copied on the GPU into a texture owned by the
+//   source, limited to the rectangles DXGI reports as dirty or moved. The
+//   latest update is converted when a frame is due, so bursts of updates cost
+//   one conversion.
+// - Conversion to NV12 runs on the GPU video processor when the device has
+//   one; only the NV12 image is read back. Otherwise the changed rectangles are
+//   read back as BGRA and converted on the CPU, so an idle desktop costs
+//   almost nothing.
+// - The previous frame is repeated while the desktop is unchanged so that
+//   the encoder sees a steady frame rate.
+// - Frames carry region hints listing the rectangles changed since the
+//   previous frame; repeated frames list none.
+// - The mouse pointer is not drawn, and rotated outputs are captured
+//   unrotated.
+class DesktopCaptureSource {
+ public:
+  enum {
+    // Capture thread could not be started.
+    kThreadError = -5,
+    // DXGI or D3D11 call failed, or the desktop mode changed.
+    kDeviceError = -4,
+    // |output_index| names no output.
+    kNoOutput = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Frame rate used when none is requested.
+  static const int kDefaultFrameRate = 30;
+
+  DesktopCaptureSource();
+  ~DesktopCaptureSource();
+
+  // Opens output |output_index|, counting outputs across all adapters, and
+  // prepares the conversion resources. Only |frame_rate| is used from
+  // |requested_config|. Returns |kSuccess| when successful.
+  int Init(int output_index, const VideoConfig& requested_config,
+           VideoFrameCallbackInterface* ptr_callback);
+
+  // Starts the capture thread. Returns |kSuccess| when successful.
+  int Run();
+
+  // Stops the capture thread.
+  void Stop();
+
+  // Returns |kSuccess| while capturing, or the error that stopped the
+  // capture thread.
+  int status() const { return status_; }
+
+  const VideoConfig& actual_config() const { return actual_config_; }
+
+ private:
+  // Finds output |output_index| and creates |device_| on its adapter.
+  int CreateDevice(int output_index);
+
+  // (Re)creates |duplication_|. Called again when DXGI reports that access
+  // to the desktop was lost.
+  int CreateDuplication();
+
+  // Creates the GPU BGRA to NV12 conversion resources. Failure only disables
+  // GPU conversion.
+  int CreateVideoProcessor();
+
+  // Waits up to |timeout_ms| for a desktop update and copies it into
+  // |desktop_texture_|.
+  int AcquireUpdate(uint32 timeout_ms);
+
+  // Converts the pending update into |i420_buffer_|.
+  int ConvertOnGpu();
+  int ConvertOnCpu();
+
+  // Delivers |i420_buffer_| stamped with |timestamp_us|, in microseconds.
+  int DeliverFrame(int64 timestamp_us);
+
+  // Capture thread function.
+  void CaptureThread();
+
+  IDXGIOutput1Ptr output_;
+  ID3D11DevicePtr device_;
+  ID3D11DeviceContextPtr context_;
+  IDXGIOutputDuplicationPtr duplication_;
+
+  // Latest desktop image, and the CPU readable copy used by |ConvertOnCpu()|.
+  ID3D11Texture2DPtr desktop_texture_;
+  ID3D11Texture2DPtr bgra_staging_;
+
+  // GPU conversion resources; |video_processor_| is NULL when unavailable.
+  ID3D11VideoDevicePtr video_device_;
+  ID3D11VideoContextPtr video_context_;
+  ID3D11VideoProcessorEnumeratorPtr processor_enum_;
+  ID3D11VideoProcessorPtr video_processor_;
+  ID3D11VideoProcessorInputViewPtr input_view_;
+  ID3D11VideoProcessorOutputViewPtr output_view_;
+  ID3D11Texture2DPtr nv12_texture_;
+  ID3D11Texture2DPtr nv12_staging_;
+
+  // Rectangles updated since the last conversion, and storage for the frame
+  // metadata DXGI returns.
+  std::vector<RECT> pending_rects_;
+  std::vector<uint8> metadata_;
+
+  // Current frame, kept between updates so unchanged regions need no work.
+  std::vector<uint8> i420_buffer_;
+  VideoFrame frame_;
+
+  // Rectangles converted since the last delivered frame, and the region hint
+  // sequence number of the next frame.
+  std::vector<VideoRect> changed_rects_;
+  int64 frame_sequence_;
+
+  VideoConfig actual_config_;
+  VideoFrameCallbackInterface* ptr_callback_;
+  std::atomic<bool> stop_;
+  std::atomic<int> status_;
+  std::shared_ptr<std::thread> capture_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(DesktopCaptureSource);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_WIN_DESKTOP_CAPTURE_SOURCE_H_
@@ -13,9 +13,13 @@
                        // DEFINE_GUID macro.
 #include <vfwmsgs.h>
 
+#include <algorithm>
 #include <memory>
 #include <sstream>
+#include <vector>
 
+#include "encoder/capture_format_policy.h"
+#include "encoder/frame_rate_limiter.h"
 #include "encoder/video_encoder.h"
 #include "encoder/webm_encoder.h"
 #include "encoder/win/audio_sink_filter.h"
@@ -34,6 +38,57 @@ const wchar_t* const kAudioSinkName = L"AudioSink";
 const wchar_t* const kVideoSourceName = L"VideoSource";
 const wchar_t* const kVideoSinkName = L"VideoSink";
 
+// Video formats requested from capture sources that do not report their
+// capabilities, in order of preference. Planar 4:2:0 formats come before
+// packed 4:2:2 and RGB: they need the least memory bandwidth to convert to
+// I420. Sources that report capabilities try those formats first, ranked by
+// |CaptureFormatPolicy|.
+const webmlive::VideoFormat kVideoFormatPreference[] = {
+  webmlive::kVideoFormatI420,
+  webmlive::kVideoFormatVP8,
+  webmlive::kVideoFormatYV12,
+  webmlive::kVideoFormatNV12,
+  webmlive::kVideoFormatNV21,
+  webmlive::kVideoFormatYUY2,
+  webmlive::kVideoFormatYUYV,
+  webmlive::kVideoFormatUYVY,
+  webmlive::kVideoFormatRGB,
+  webmlive::kVideoFormatRGBA,
+  webmlive::kVideoFormatVP9,
+#ifdef WEBMLIVE_HAVE_MJPEG
+  webmlive::kVideoFormatMJPEG,
+#endif
+};
+const int kNumVideoFormats =
+    sizeof(kVideoFormatPreference) / sizeof(kVideoFormatPreference[0]);
+
+// Returns the largest video representation size in |ptr_width| and
+// |ptr_height| when every representation fits within it and every size is
+// explicit. Converted frames can then be scaled to that size by the video sink
+// without losing anything the encoders need. Otherwise 0 is returned.
+void VideoConversionOutputSize(const webmlive::WebmEncoderConfig& config,
+                               int32* ptr_width, int32* ptr_height) {
+  *ptr_width = 0;
+  *ptr_height = 0;
+  const std::vector<webmlive::VideoRepresentationConfig>& reps =
+      config.video_representations;
+  int32 max_width = 0;
+  int32 max_height = 0;
+  for (size_t i = 0; i < reps.size(); ++i) {
+    if (reps[i].width <= 0 || reps[i].height <= 0) {
+      return;
+    }
+    max_width = std::max(max_width, reps[i].width);
+    max_height = std::max(max_height, reps[i].height);
+  }
+  for (size_t i = 0; i < reps.size(); ++i) {
+    if (reps[i].width == max_width && reps[i].height == max_height) {
+      *ptr_width = max_width;
+      *ptr_height = max_height;
+      return;
+    }
+  }
+}
 
 // Converts a std::string to std::wstring.
 std::wstring string_to_wstring(const std::string& str) {
@@ -108,6 +163,11 @@ int64 media_time_to_milliseconds(REFERENCE_TIME media_time) {
   return media_time / 10000;
 }
 
+// Converts media time (100 nanosecond ticks) to microseconds.
+int64 media_time_to_microseconds(REFERENCE_TIME media_time) {
+  return media_time / 10;
+}
+
 // Converts media time (100 nanosecond ticks) to seconds.
 double media_time_to_seconds(REFERENCE_TIME media_time) {
   return media_time / 10000000.0;
@@ -124,21 +184,19 @@ MediaSourceImpl::MediaSourceImpl()
       ptr_audio_callback_(NULL),
       ptr_video_callback_(NULL),
       audio_device_index_(0),
-      video_device_index_(0) {
+      audio_buffer_ms_(0),
+      audio_buffer_count_(0),
+      planar_audio_(false),
+      video_device_index_(0),
+      video_output_width_(0),
+      video_output_height_(0),
+      video_async_conversion_(false),
+      video_buffer_count_(0),
+      video_bit_depth_(8) {
 }
 
 MediaSourceImpl::~MediaSourceImpl() {
-  // Manually release directshow interfaces to avoid problems related to
-  // destruction order of com_ptr_t members.
-  audio_source_ = 0;
-  audio_sink_ = 0;
-  video_source_ = 0;
-  video_sink_ = 0;
-  media_event_handle_ = INVALID_HANDLE_VALUE;
-  media_control_ = 0;
-  media_event_ = 0;
-  capture_graph_builder_ = 0;
-  graph_builder_ = 0;
+  ReleaseGraph();
   CoUninitialize();
 }
 
@@ -159,10 +217,33 @@ int MediaSourceImpl::Init(const WebmEncoderConfig& config,
     LOG(ERROR) << "Audio and video are disabled.";
     return kInvalidArg;
   }
+  if (!config.pip.device_name.empty()) {
+    LOG(ERROR) << "picture in picture is not supported on Windows.";
+    return WebmEncoder::kNoVideoSource;
+  }
+  if (!config.audio_mix.inputs.empty()) {
+    LOG(ERROR) << "audio mixing is not supported on Windows.";
+    return WebmEncoder::kNoAudioSource;
+  }
+  config_ = config;
   ptr_audio_callback_ = ptr_audio_callback;
   ptr_video_callback_ = ptr_video_callback;
   requested_audio_config_ = config.requested_audio_config;
   requested_video_config_ = config.requested_video_config;
+  VideoConversionOutputSize(config, &video_output_width_,
+                            &video_output_height_);
+  video_async_conversion_ = config.video_async_conversion;
+  video_buffer_count_ = config.video_buffer_count;
+  video_bit_depth_ = config.vpx_config.bit_depth;
+  audio_buffer_ms_ = config.audio_buffer_ms;
+  // Opus takes interleaved samples, so planar output needs every audio
+  // representation to be Vorbis.
+  planar_audio_ = config.audio_codec == kAudioFormatVorbis;
+  for (size_t i = 0; i < config.audio_representations.size(); ++i) {
+    if (config.audio_representations[i].codec != kAudioFormatVorbis)
+      planar_audio_ = false;
+  }
+  audio_buffer_count_ = config.audio_buffer_count;
   ui_opts_ = config.ui_opts;
   const HRESULT hr = CoInitialize(NULL);
   if (FAILED(hr)) {
@@ -174,7 +255,46 @@ int MediaSourceImpl::Init(const WebmEncoderConfig& config,
     LOG(ERROR) << "CreateGraphInterfaces failed: " << status;
     return WebmEncoder::kInitFailed;
   }
-  if (config.disable_video == false) {
+  if (config.disable_video == false && config.video_capture_desktop) {
+    desktop_source_.reset(new (std::nothrow) DesktopCaptureSource());  // NOLINT
+    if (!desktop_source_) {
+      return WebmEncoder::kNoMemory;
+    }
+    const int output_index =
+        config.video_device_index == kUseDefaultDevice ?
+        0 : config.video_device_index;
+    // Desktop frames are produced on a timer; run it at the limited rate.
+    VideoConfig desktop_config = requested_video_config_;
+    desktop_config.frame_rate = FrameRateLimiter::OutputFrameRate(
+        desktop_config.frame_rate > 0 ?
+            desktop_config.frame_rate : DesktopCaptureSource::kDefaultFrameRate,
+        config.max_video_frame_rate, config.vpx_config.decimate);
+    status = desktop_source_->Init(output_index, desktop_config,
+                                   ptr_video_callback_);
+    if (status) {
+      LOG(ERROR) << "DesktopCaptureSource Init failed: " << status;
+      return WebmEncoder::kNoVideoSource;
+    }
+    actual_video_config_ = desktop_source_->actual_config();
+  } else if (config.disable_video == false &&
+             config.video_capture_media_foundation) {
+    mf_source_.reset(new (std::nothrow) MfVideoSource());  // NOLINT
+    if (!mf_source_) {
+      return WebmEncoder::kNoMemory;
+    }
+    status = mf_source_->Init(string_to_wstring(config.video_device_name),
+                              config.video_device_index,
+                              requested_video_config_,
+                              config.video_mf_disable_gpu,
+                              ptr_video_callback_);
+    if (status) {
+      LOG(ERROR) << "MfVideoSource Init failed: " << status;
+      return WebmEncoder::kNoVideoSource;
+    }
+    mf_source_->LimitFrameRate(config.max_video_frame_rate,
+                               config.vpx_config.decimate);
+    actual_video_config_ = mf_source_->actual_config();
+  } else if (config.disable_video == false) {
     if (!config.video_device_name.empty()) {
       video_device_name_ = string_to_wstring(config.video_device_name);
     }
@@ -196,8 +316,29 @@ int MediaSourceImpl::Init(const WebmEncoderConfig& config,
       LOG(ERROR) << "ConnectVideoSourceToVideoSink failed: " << status;
       return WebmEncoder::kVideoSinkError;
     }
+    status = LimitVideoSinkFrameRate(config.max_video_frame_rate,
+                                     config.vpx_config.decimate);
+    if (status) {
+      LOG(ERROR) << "LimitVideoSinkFrameRate failed: " << status;
+      return WebmEncoder::kVideoSinkError;
+    }
   }
-  if (config.disable_audio == false) {
+  if (config.disable_audio == false && config.audio_capture_wasapi) {
+    wasapi_source_.reset(new (std::nothrow) WasapiAudioSource());  // NOLINT
+    if (!wasapi_source_) {
+      return WebmEncoder::kNoMemory;
+    }
+    status = wasapi_source_->Init(string_to_wstring(config.audio_device_name),
+                                  config.audio_device_index,
+                                  config.audio_wasapi_exclusive,
+                                  requested_audio_config_,
+                                  ptr_audio_callback_);
+    if (status) {
+      LOG(ERROR) << "WasapiAudioSource Init failed: " << status;
+      return WebmEncoder::kNoAudioSource;
+    }
+    actual_audio_config_ = wasapi_source_->actual_config();
+  } else if (config.disable_audio == false) {
     if (!config.audio_device_name.empty()) {
       audio_device_name_ = string_to_wstring(config.audio_device_name);
     }
@@ -238,6 +379,18 @@ int MediaSourceImpl::Run() {
     LOG(ERROR) << "media control Run failed, cannot run capture!" << HRLOG(hr);
     return WebmEncoder::kRunFailed;
   }
+  if (desktop_source_ && desktop_source_->Run()) {
+    LOG(ERROR) << "DesktopCaptureSource Run failed.";
+    return WebmEncoder::kRunFailed;
+  }
+  if (mf_source_ && mf_source_->Run()) {
+    LOG(ERROR) << "MfVideoSource Run failed.";
+    return WebmEncoder::kRunFailed;
+  }
+  if (wasapi_source_ && wasapi_source_->Run()) {
+    LOG(ERROR) << "WasapiAudioSource Run failed.";
+    return WebmEncoder::kRunFailed;
+  }
   return kSuccess;
 }
 
@@ -252,20 +405,91 @@ int MediaSourceImpl::CheckStatus() {
     LOG(ERROR) << "Capture graph stopped!";
     return WebmEncoder::kAVCaptureStopped;
   }
+  if (desktop_source_ && desktop_source_->status()) {
+    LOG(ERROR) << "Desktop capture stopped!";
+    return WebmEncoder::kAVCaptureStopped;
+  }
+  if (mf_source_ && mf_source_->status()) {
+    LOG(ERROR) << "Media Foundation video capture stopped!";
+    return WebmEncoder::kAVCaptureStopped;
+  }
+  if (wasapi_source_ && wasapi_source_->status()) {
+    LOG(ERROR) << "WASAPI audio capture stopped!";
+    return WebmEncoder::kAVCaptureStopped;
+  }
   return kSuccess;
 }
 
 // Stops the filter graph via call to |IMediaControl::Stop|.
 void MediaSourceImpl::Stop() {
-  const HRESULT hr = media_control_->Stop();
-  if (FAILED(hr)) {
-    LOG(ERROR) << "media control Stop failed! error=" << HRLOG(hr);
-  } else {
-    LOG(INFO) << "graph stopping. status=" << HRLOG(hr);
+  if (desktop_source_) {
+    desktop_source_->Stop();
+  }
+  if (mf_source_) {
+    mf_source_->Stop();
+  }
+  if (wasapi_source_) {
+    wasapi_source_->Stop();
+  }
+  if (media_control_) {
+    const HRESULT hr = media_control_->Stop();
+    if (FAILED(hr)) {
+      LOG(ERROR) << "media control Stop failed! error=" << HRLOG(hr);
+    } else {
+      LOG(INFO) << "graph stopping. status=" << HRLOG(hr);
+    }
   }
   CoUninitialize();
 }
 
+// Rebuilds the graph from |config_|. The encoders, muxers and manifest were
+// set up for the settings of the first graph, so a device that comes back
+// with another frame size or audio format cannot be used.
+int MediaSourceImpl::Restart() {
+  const VideoConfig video_config = actual_video_config_;
+  const AudioConfig audio_config = actual_audio_config_;
+  Stop();
+  ReleaseGraph();
+
+  WebmEncoderConfig config = config_;
+  config.ui_opts = UserInterfaceOptions();
+  int status = Init(config, ptr_audio_callback_, ptr_video_callback_);
+  if (status) {
+    LOG(ERROR) << "capture graph rebuild failed: " << status;
+    ReleaseGraph();
+    return status;
+  }
+  if (!config.disable_video &&
+      (actual_video_config_.width != video_config.width ||
+       actual_video_config_.height != video_config.height)) {
+    LOG(ERROR) << "video device reopened at " << actual_video_config_.width
+               << "x" << actual_video_config_.height << " instead of "
+               << video_config.width << "x" << video_config.height << ".";
+    ReleaseGraph();
+    return WebmEncoder::kVideoConfigureError;
+  }
+  if (!config.disable_audio &&
+      (actual_audio_config_.sample_rate != audio_config.sample_rate ||
+       actual_audio_config_.channels != audio_config.channels)) {
+    LOG(ERROR) << "audio device reopened at "
+               << actual_audio_config_.sample_rate << " Hz, "
+               << actual_audio_config_.channels << " channels instead of "
+               << audio_config.sample_rate << " Hz, "
+               << audio_config.channels << " channels.";
+    ReleaseGraph();
+    return WebmEncoder::kAudioConfigureError;
+  }
+  status = Run();
+  if (status) {
+    LOG(ERROR) << "rebuilt capture graph did not run: " << status;
+    Stop();
+    ReleaseGraph();
+    return status;
+  }
+  LOG(INFO) << "capture graph rebuilt.";
+  return kSuccess;
+}
+
 // Creates the graph builder, |graph_builder_|, and capture graph builder,
 // |capture_graph_builder_|, and passes |graph_builder_| to
 // |capture_graph_builder_|.
@@ -306,6 +530,7 @@ int MediaSourceImpl::CreateVideoSource() {
     video_device_name_ = loader.GetSourceName(video_device_index_);
   }
   video_source_ = loader.GetSource(video_device_name_);
+  video_device_path_ = loader.GetSourcePath(video_device_name_);
   LOG(INFO) << "Using vdev: " << wstring_to_string(video_device_name_);
   if (!video_source_) {
     LOG(ERROR) << "cannot create video source!";
@@ -334,6 +559,27 @@ int MediaSourceImpl::CreateVideoSink() {
     LOG(ERROR) << "VideoSinkFilter construction failed" << HRLOG(status);
     return kVideoSinkCreateError;
   }
+  if (video_output_width_ > 0 && video_output_height_ > 0) {
+    status = ptr_filter->set_output_size(video_output_width_,
+                                         video_output_height_);
+    if (FAILED(status)) {
+      LOG(ERROR) << "cannot set video sink output size" << HRLOG(status);
+      delete ptr_filter;
+      return kVideoSinkCreateError;
+    }
+  }
+  status = ptr_filter->set_async_conversion(video_async_conversion_);
+  if (FAILED(status)) {
+    LOG(ERROR) << "cannot set video sink conversion mode" << HRLOG(status);
+    delete ptr_filter;
+    return kVideoSinkCreateError;
+  }
+  status = ptr_filter->set_allocator_buffers(video_buffer_count_);
+  if (FAILED(status)) {
+    LOG(ERROR) << "cannot set video sink buffer count" << HRLOG(status);
+    delete ptr_filter;
+    return kVideoSinkCreateError;
+  }
   video_sink_ = ptr_filter;
   status = graph_builder_->AddFilter(video_sink_, kVideoSinkName);
   if (FAILED(status)) {
@@ -365,19 +611,51 @@ int MediaSourceImpl::ConnectVideoSourceToVideoSink() {
     LOG(ERROR) << "cannot find video input pin on video sink filter!";
     return kVideoConnectError;
   }
+  // Try the format this device last connected with for the same settings,
+  // and then the formats the source offers, cheapest to convert first, and
+  // the rest of the preference list. A cache hit skips reading the pin's
+  // capabilities, which is slow with some capture cards.
+  const std::string format_key = VideoFormatCacheKey();
+  std::vector<VideoFormat> formats;
+  VideoFormat cached_format = kVideoFormatI420;
+  const bool cached =
+      !ui_opts_.manual_video_config &&
+      CaptureDeviceCache::Instance().GetVideoFormat(
+          video_device_path_, format_key, &cached_format);
+  if (cached) {
+    LOG(INFO) << "Trying cached format " << cached_format << ".";
+    formats.push_back(cached_format);
+  }
   status = kVideoConnectError;
   HRESULT hr = E_FAIL;
-  for (int i = 0; i < kVideoFormatCount && hr != S_OK; ++i) {
-    MediaTypePtr accepted_type;
-    status = ConfigureVideoSource(video_source_pin, i, &accepted_type);
-    if (status == kSuccess) {
-      LOG(INFO) << "Format " << i << " configuration OK.";
-    } else {
-      continue;
+  int connected_format = -1;
+  for (int pass = cached ? 0 : 1; pass < 2 && hr != S_OK; ++pass) {
+    if (pass == 1) {
+      formats.clear();
+      RankVideoFormats(video_source_pin, &formats);
     }
-    hr = graph_builder_->ConnectDirect(video_source_pin, sink_input_pin,
-                                       accepted_type.get());
-    LOG(INFO) << "Format " << i << ((hr == S_OK) ? " connected." : " failed.");
+    for (size_t i = 0; i < formats.size() && hr != S_OK; ++i) {
+      const int format = formats[i];
+      MediaTypePtr accepted_type;
+      status = ConfigureVideoSource(video_source_pin, format, &accepted_type);
+      if (status == kSuccess) {
+        LOG(INFO) << "Format " << format << " configuration OK.";
+      } else {
+        continue;
+      }
+      hr = graph_builder_->ConnectDirect(video_source_pin, sink_input_pin,
+                                         accepted_type.get());
+      LOG(INFO) << "Format " << format
+                << ((hr == S_OK) ? " connected." : " failed.");
+      if (hr == S_OK) {
+        connected_format = format;
+      }
+    }
+  }
+  if (connected_format >= 0) {
+    CaptureDeviceCache::Instance().StoreVideoFormat(
+        video_device_path_, format_key,
+        static_cast<VideoFormat>(connected_format));
   }
   if (status || hr != S_OK) {
     // All previous connection attempts failed. Try one last time using
@@ -414,10 +692,79 @@ int MediaSourceImpl::ConnectVideoSourceToVideoSink() {
       }
     }
     MediaType::FreeMediaTypeData(&media_type);
+
+    // The sink pin parsed the pixel format of the connection.
+    // |video_sink_| is always the |VideoSinkFilter| made by
+    // |CreateVideoSink()|.
+    VideoConfig sink_config;
+    const VideoSinkFilter* const ptr_filter =
+        static_cast<VideoSinkFilter*>(video_sink_.GetInterfacePtr());
+    if (ptr_filter->config(&sink_config) == S_OK) {
+      actual_video_config_.format = sink_config.format;
+      LOG(INFO) << "Video capture path "
+                << CaptureFormatPolicy::DescribePath(sink_config.format);
+    }
   }
   return status;
 }
 
+void MediaSourceImpl::RankVideoFormats(const IPinPtr& pin,
+                                       std::vector<VideoFormat>* ptr_formats) {
+  std::vector<VideoFormat>& formats = *ptr_formats;
+  std::vector<CaptureFormatCandidate> candidates;
+  PinFormat source_formatter(pin);
+  if (source_formatter.GetVideoCandidates(&candidates) == kSuccess) {
+    CaptureFormatPolicy::Rank(requested_video_config_, video_bit_depth_,
+                              &candidates);
+  }
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if (std::find(formats.begin(), formats.end(), candidates[i].format) ==
+        formats.end()) {
+      formats.push_back(candidates[i].format);
+    }
+  }
+  std::vector<VideoFormat> fallback_formats;
+  if (video_bit_depth_ > 8) {
+    fallback_formats.push_back(kVideoFormatV210);
+  }
+  fallback_formats.insert(fallback_formats.end(), kVideoFormatPreference,
+                          kVideoFormatPreference + kNumVideoFormats);
+  for (size_t i = 0; i < fallback_formats.size(); ++i) {
+    if (std::find(formats.begin(), formats.end(), fallback_formats[i]) ==
+        formats.end()) {
+      formats.push_back(fallback_formats[i]);
+    }
+  }
+}
+
+std::string MediaSourceImpl::VideoFormatCacheKey() const {
+  std::ostringstream key;
+  key << requested_video_config_.format << "_"
+      << requested_video_config_.width << "x"
+      << requested_video_config_.height << "@"
+      << requested_video_config_.frame_rate << "_" << video_bit_depth_;
+  return key.str();
+}
+
+int MediaSourceImpl::LimitVideoSinkFrameRate(double max_frame_rate,
+                                             int decimate) {
+  const double frame_rate = FrameRateLimiter::OutputFrameRate(
+      actual_video_config_.frame_rate, max_frame_rate, decimate);
+  if (frame_rate <= 0 || frame_rate == actual_video_config_.frame_rate) {
+    return kSuccess;
+  }
+  // |video_sink_| is always the |VideoSinkFilter| made by |CreateVideoSink()|.
+  VideoSinkFilter* const ptr_filter =
+      static_cast<VideoSinkFilter*>(video_sink_.GetInterfacePtr());
+  const HRESULT hr = ptr_filter->set_max_frame_rate(frame_rate);
+  if (FAILED(hr)) {
+    LOG(ERROR) << "cannot set video sink frame rate" << HRLOG(hr);
+    return kVideoSinkCreateError;
+  }
+  actual_video_config_.frame_rate = frame_rate;
+  return kSuccess;
+}
+
 // Attempts to configure |video_source_pin| media type through use of user
 // settings stored in |config_.requested_video_config| with |VideoMediaType|
 // to produce an AM_MEDIA_TYPE struct suitable for use with
@@ -650,6 +997,9 @@ int MediaSourceImpl::CreateAudioSink() {
     LOG(ERROR) << "AudioSinkFilter construction failed" << HRLOG(status);
     return kAudioSinkCreateError;
   }
+  // Only the Vorbis encoder takes planar input.
+  ptr_filter->set_planar_output(planar_audio_);
+  ptr_filter->set_allocator_buffers(audio_buffer_count_);
   audio_sink_ = ptr_filter;
   status = graph_builder_->AddFilter(audio_sink_, kAudioSinkName);
   if (FAILED(status)) {
@@ -689,6 +1039,7 @@ int MediaSourceImpl::ConnectAudioSourceToAudioSink() {
   status = ConfigureAudioSource(audio_source_pin, &accepted_type);
   if (status == kSuccess) {
     LOG(INFO) << "audio source configuration OK.";
+    SuggestAudioBuffers(audio_source_pin);
     hr = graph_builder_->ConnectDirect(audio_source_pin, sink_input_pin,
                                        accepted_type.get());
     if (hr == S_OK) {
@@ -702,6 +1053,7 @@ int MediaSourceImpl::ConnectAudioSourceToAudioSink() {
     PinFormat formatter(audio_source_pin);
     status = formatter.set_format(NULL);
     if (status == kSuccess) {
+      SuggestAudioBuffers(audio_source_pin);
       hr = graph_builder_->ConnectDirect(audio_source_pin, sink_input_pin,
                                          NULL);
       if (hr == S_OK) {
@@ -748,10 +1100,63 @@ int MediaSourceImpl::ConnectAudioSourceToAudioSink() {
       }
     }
     MediaType::FreeMediaTypeData(&media_type);
+    LogAudioBuffers(audio_source_pin);
   }
   return status;
 }
 
+void MediaSourceImpl::SuggestAudioBuffers(const IPinPtr& pin) {
+  if (audio_buffer_ms_ <= 0 && audio_buffer_count_ <= 0) {
+    return;
+  }
+  const IAMBufferNegotiationPtr negotiation(pin);
+  if (!negotiation) {
+    LOG(INFO) << "audio source pin has no IAMBufferNegotiation interface.";
+    return;
+  }
+  PinFormat formatter(pin);
+  MediaTypePtr format(formatter.format());
+  AudioMediaType audio_format;
+  if (!format.get() || audio_format.Init(*format.get()) != kSuccess ||
+      audio_format.block_align() == 0) {
+    LOG(WARNING) << "cannot size audio buffers: unknown pin format.";
+    return;
+  }
+
+  // -1 means no preference.
+  ALLOCATOR_PROPERTIES properties = {-1, -1, -1, -1};
+  if (audio_buffer_count_ > 0) {
+    properties.cBuffers = audio_buffer_count_;
+  }
+  if (audio_buffer_ms_ > 0) {
+    const int block_align = audio_format.block_align();
+    const int64 bytes =
+        static_cast<int64>(audio_format.bytes_per_second()) *
+        audio_buffer_ms_ / 1000;
+    properties.cbBuffer = std::max<long>(  // NOLINT(runtime/int)
+        block_align, static_cast<long>(bytes / block_align * block_align));
+  }
+  const HRESULT hr = negotiation->SuggestAllocatorProperties(&properties);
+  if (FAILED(hr)) {
+    LOG(WARNING) << "audio source rejected buffer suggestion: " << HRLOG(hr);
+  }
+}
+
+void MediaSourceImpl::LogAudioBuffers(const IPinPtr& pin) {
+  const IAMBufferNegotiationPtr negotiation(pin);
+  ALLOCATOR_PROPERTIES properties = {0};
+  if (!negotiation ||
+      FAILED(negotiation->GetAllocatorProperties(&properties)) ||
+      actual_audio_config_.bytes_per_second == 0) {
+    return;
+  }
+  const double buffer_ms =
+      1000.0 * properties.cbBuffer / actual_audio_config_.bytes_per_second;
+  LOG(INFO) << "audio capture buffers: " << properties.cBuffers << " x "
+            << properties.cbBuffer << " bytes, " << buffer_ms
+            << " ms capture latency.";
+}
+
 // Checks |media_event_handle_| and reads the event from |media_event_| when
 // signaled.  Responds only to completion and error events.
 int MediaSourceImpl::HandleMediaEvent() {
@@ -787,6 +1192,23 @@ int MediaSourceImpl::HandleMediaEvent() {
   return status;
 }
 
+// Releases the directshow interfaces manually to avoid problems related to
+// destruction order of com_ptr_t members.
+void MediaSourceImpl::ReleaseGraph() {
+  desktop_source_.reset();
+  mf_source_.reset();
+  wasapi_source_.reset();
+  audio_source_ = 0;
+  audio_sink_ = 0;
+  video_source_ = 0;
+  video_sink_ = 0;
+  media_event_handle_ = INVALID_HANDLE_VALUE;
+  media_control_ = 0;
+  media_event_ = 0;
+  capture_graph_builder_ = 0;
+  graph_builder_ = 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // CaptureSourceLoader
 //
@@ -798,7 +1220,8 @@ CaptureSourceLoader::CaptureSourceLoader()
 CaptureSourceLoader::~CaptureSourceLoader() {
 }
 
-// Verifies that |source_type| is known and calls |FindAllSources|.
+// Verifies that |source_type| is known, and loads the sources from
+// |CaptureDeviceCache| or calls |FindAllSources|.
 int CaptureSourceLoader::Init(CLSID source_type) {
   if (source_type != CLSID_AudioInputDeviceCategory &&
       source_type != CLSID_VideoInputDeviceCategory) {
@@ -806,29 +1229,29 @@ int CaptureSourceLoader::Init(CLSID source_type) {
     return WebmEncoder::kInvalidArg;
   }
   source_type_ = source_type;
+  if (CaptureDeviceCache::Instance().GetDevices(source_type_, &devices_) &&
+      !devices_.empty()) {
+    for (size_t i = 0; i < devices_.size(); ++i) {
+      sources_[static_cast<int>(i)] = devices_[i].name;
+    }
+    LOG(INFO) << "Using " << devices_.size() << " cached sources.";
+    return kSuccess;
+  }
+  devices_.clear();
   return FindAllSources();
 }
 
 // Enumerates input devices of type |source_type_| and adds them to the map of
 // sources, |sources_|.
 int CaptureSourceLoader::FindAllSources() {
-  ICreateDevEnumPtr sys_enum;
-  HRESULT hr = sys_enum.CreateInstance(CLSID_SystemDeviceEnum);
-  if (FAILED(hr)) {
-    LOG(ERROR) << "source enumerator creation failed." << HRLOG(hr);
-    return kNoDeviceFound;
-  }
-  const DWORD kNoEnumFlags = 0;
-  hr = sys_enum->CreateClassEnumerator(source_type_, &source_enum_,
-                                       kNoEnumFlags);
-  if (FAILED(hr) || hr == S_FALSE) {
-    LOG(ERROR) << "moniker creation failed (no devices)." << HRLOG(hr);
-    return kNoDeviceFound;
+  int status = CreateSourceEnum();
+  if (status) {
+    return status;
   }
   int source_index = 0;
   for (;;) {
     IMonikerPtr source_moniker;
-    hr = source_enum_->Next(1, &source_moniker, NULL);
+    const HRESULT hr = source_enum_->Next(1, &source_moniker, NULL);
     if (FAILED(hr) || hr == S_FALSE || !source_moniker) {
       LOG(INFO) << "Done enumerating sources, found " << source_index
                 << " sources.";
@@ -842,12 +1265,38 @@ int CaptureSourceLoader::FindAllSources() {
     VLOG(4) << "source=" << source_index << " name="
             << wstring_to_string(name.c_str());
     sources_[source_index] = name;
+    CaptureDeviceCache::Device device;
+    device.name = name;
+    device.display_name = GetMonikerDisplayName(source_moniker);
+    device.path = GetMonikerDevicePath(source_moniker);
+    if (device.path.empty()) {
+      device.path = device.display_name;
+    }
+    devices_.push_back(device);
     ++source_index;
   }
   if (sources_.size() == 0) {
     LOG(ERROR) << "No devices found!";
     return kNoDeviceFound;
   }
+  CaptureDeviceCache::Instance().StoreDevices(source_type_, devices_);
+  return kSuccess;
+}
+
+int CaptureSourceLoader::CreateSourceEnum() {
+  ICreateDevEnumPtr sys_enum;
+  HRESULT hr = sys_enum.CreateInstance(CLSID_SystemDeviceEnum);
+  if (FAILED(hr)) {
+    LOG(ERROR) << "source enumerator creation failed." << HRLOG(hr);
+    return kNoDeviceFound;
+  }
+  const DWORD kNoEnumFlags = 0;
+  hr = sys_enum->CreateClassEnumerator(source_type_, &source_enum_,
+                                       kNoEnumFlags);
+  if (FAILED(hr) || hr == S_FALSE) {
+    LOG(ERROR) << "moniker creation failed (no devices)." << HRLOG(hr);
+    return kNoDeviceFound;
+  }
   return kSuccess;
 }
 
@@ -861,13 +1310,60 @@ IBaseFilterPtr CaptureSourceLoader::GetSource(int index) {
   return GetSource(GetSourceName(index));
 }
 
+// Binds the moniker parsed from the display name of the source named |name|,
+// and falls back to |EnumerateSource()| when the name is unknown or stale.
+IBaseFilterPtr CaptureSourceLoader::GetSource(const std::wstring name) {
+  if (name.empty()) {
+    LOG(ERROR) << "empty source name.";
+    return NULL;
+  }
+  for (size_t i = 0; i < devices_.size(); ++i) {
+    if (devices_[i].name != name || devices_[i].display_name.empty()) {
+      continue;
+    }
+    IBindCtx* ptr_bind_context = NULL;
+    HRESULT hr = CreateBindCtx(0, &ptr_bind_context);
+    if (FAILED(hr)) {
+      break;
+    }
+    IMonikerPtr source_moniker;
+    ULONG chars_eaten = 0;
+    hr = MkParseDisplayName(ptr_bind_context,
+                            devices_[i].display_name.c_str(), &chars_eaten,
+                            &source_moniker);
+    IBaseFilterPtr filter = NULL;
+    if (SUCCEEDED(hr)) {
+      hr = source_moniker->BindToObject(ptr_bind_context, NULL,
+                                        IID_IBaseFilter,
+                                        reinterpret_cast<void**>(&filter));
+    }
+    ptr_bind_context->Release();
+    if (SUCCEEDED(hr) && filter) {
+      return filter;
+    }
+    LOG(WARNING) << "cannot bind cached source, enumerating." << HRLOG(hr);
+    CaptureDeviceCache::Instance().Invalidate();
+    break;
+  }
+  return EnumerateSource(name);
+}
+
+std::wstring CaptureSourceLoader::GetSourcePath(
+    const std::wstring& name) const {
+  for (size_t i = 0; i < devices_.size(); ++i) {
+    if (devices_[i].name == name) {
+      return devices_[i].path;
+    }
+  }
+  return std::wstring();
+}
+
 // Resets |source_enum_| and enumerates video input sources until one matching
 // |name| is found. Then creates an instance of the filter by calling
 // |BindToObject| on the device moniker (|source_moniker|) returned by the
 // enumerator.
-IBaseFilterPtr CaptureSourceLoader::GetSource(const std::wstring name) {
-  if (name.empty()) {
-    LOG(ERROR) << "empty source name.";
+IBaseFilterPtr CaptureSourceLoader::EnumerateSource(const std::wstring& name) {
+  if (!source_enum_ && CreateSourceEnum()) {
     return NULL;
   }
   HRESULT hr = source_enum_->Reset();
@@ -931,6 +1427,40 @@ std::wstring CaptureSourceLoader::GetMonikerFriendlyName(
   return name;
 }
 
+// Returns |moniker|'s display name. Returns an empty std::wstring on failure.
+std::wstring CaptureSourceLoader::GetMonikerDisplayName(
+    const IMonikerPtr& moniker) {
+  std::wstring name;
+  IBindCtx* ptr_bind_context = NULL;
+  if (moniker && SUCCEEDED(CreateBindCtx(0, &ptr_bind_context))) {
+    LPOLESTR ptr_name = NULL;
+    if (SUCCEEDED(moniker->GetDisplayName(ptr_bind_context, NULL,
+                                          &ptr_name)) && ptr_name) {
+      name = ptr_name;
+      CoTaskMemFree(ptr_name);
+    }
+    ptr_bind_context->Release();
+  }
+  return name;
+}
+
+// Returns the value of |moniker|'s device path property. Returns an empty
+// std::wstring when the device has none, as some virtual devices do.
+std::wstring CaptureSourceLoader::GetMonikerDevicePath(
+    const IMonikerPtr& moniker) {
+  std::wstring path;
+  if (moniker) {
+    IPropertyBagPtr props;
+    const HRESULT hr = moniker->BindToStorage(
+        0, 0, IID_IPropertyBag, reinterpret_cast<void**>(&props));
+    if (hr == S_OK) {
+      const wchar_t* const kDevicePath = L"DevicePath";
+      path = GetStringProperty(props, kDevicePath);
+    }
+  }
+  return path;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // PinFinder
 //
@@ -1365,6 +1895,49 @@ AM_MEDIA_TYPE* PinFormat::FindMatchingFormat(const VideoConfig& config) {
   return format.Detach();
 }
 
+// Reads each of |pin_|'s stream capabilities. The highest frame rate of a
+// capability is given by its shortest frame interval.
+int PinFormat::GetVideoCandidates(
+    std::vector<CaptureFormatCandidate>* ptr_candidates) {
+  if (!ptr_candidates) {
+    LOG(ERROR) << "NULL candidates output pointer.";
+    return kCannotSetFormat;
+  }
+  const IAMStreamConfigPtr config(pin_);
+  if (!config) {
+    LOG(ERROR) << "pin_ has no IAMStreamConfig interface.";
+    return kCannotSetFormat;
+  }
+  int count = 0;
+  int caps_size = 0;
+  HRESULT hr = config->GetNumberOfCapabilities(&count, &caps_size);
+  if (FAILED(hr) || caps_size != sizeof(VIDEO_STREAM_CONFIG_CAPS)) {
+    LOG(ERROR) << "cannot get pin_ video capabilities: " << HRLOG(hr);
+    return kCannotSetFormat;
+  }
+  for (int i = 0; i < count; ++i) {
+    MediaTypePtr format;
+    VIDEO_STREAM_CONFIG_CAPS caps = {0};
+    hr = config->GetStreamCaps(i, format.GetPtr(),
+                               reinterpret_cast<BYTE*>(&caps));
+    if (hr != S_OK) {
+      continue;
+    }
+    VideoMediaType video_format;
+    VideoFormat pixel_format = kVideoFormatI420;
+    if (video_format.Init(*format.get()) != kSuccess ||
+        !video_format.pixel_format(&pixel_format)) {
+      continue;
+    }
+    const double max_frame_rate = caps.MinFrameInterval > 0 ?
+        1.0 / media_time_to_seconds(caps.MinFrameInterval) : 0;
+    ptr_candidates->push_back(
+        CaptureFormatCandidate(pixel_format, video_format.width(),
+                               video_format.height(), max_frame_rate));
+  }
+  return kSuccess;
+}
+
 // Displays |filter|'s property page.
 HRESULT ShowFilterPropertyPage(const IBaseFilterPtr& filter) {
   if (!filter) {
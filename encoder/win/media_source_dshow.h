@@ -15,15 +15,23 @@
 #include <memory>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "encoder/basictypes.h"
+#include "encoder/capture_format_policy.h"
 #include "encoder/encoder_base.h"
+#include "encoder/media_source.h"
 #include "encoder/webm_encoder.h"
+#include "encoder/win/capture_device_cache.h"
+#include "encoder/win/desktop_capture_source.h"
+#include "encoder/win/mf_video_source.h"
+#include "encoder/win/wasapi_audio_source.h"
 
 namespace webmlive {
 // A slightly more brief version of the com_ptr_t definition macro.
 #define COMPTR_TYPEDEF(InterfaceName) \
   _COM_SMARTPTR_TYPEDEF(InterfaceName, IID_##InterfaceName)
+COMPTR_TYPEDEF(IAMBufferNegotiation);
 COMPTR_TYPEDEF(IAMStreamConfig);
 COMPTR_TYPEDEF(IBaseFilter);
 COMPTR_TYPEDEF(ICaptureGraphBuilder2);
@@ -78,6 +86,7 @@ const CLSID CLSID_VP8Encoder = {
 
 // Utility functions for time conversions.
 int64 media_time_to_milliseconds(REFERENCE_TIME media_time);
+int64 media_time_to_microseconds(REFERENCE_TIME media_time);
 double media_time_to_seconds(REFERENCE_TIME media_time);
 REFERENCE_TIME seconds_to_media_time(double seconds);
 
@@ -89,7 +98,7 @@ class VideoFrameCallbackInterface;
 //
 // Captures video frames using a custom sink filter and passes them back to
 // users through VideoFrameCallbackInterface.
-class MediaSourceImpl {
+class MediaSourceImpl : public MediaSourceInterface {
  public:
   typedef WebmEncoderConfig::UserInterfaceOptions UserInterfaceOptions;
   enum {
@@ -139,23 +148,30 @@ class MediaSourceImpl {
     kGraphCompleted = 1,
   };
   MediaSourceImpl();
-  ~MediaSourceImpl();
+  virtual ~MediaSourceImpl();
 
   // Creates video capture graph. Returns |kSuccess| upon success, or a
   // |WebmEncoder| status code upon failure.
-  int Init(const WebmEncoderConfig& config,
-           AudioSamplesCallbackInterface* ptr_audio_callback,
-           VideoFrameCallbackInterface* ptr_video_callback);
+  virtual int Init(const WebmEncoderConfig& config,
+                   AudioSamplesCallbackInterface* ptr_audio_callback,
+                   VideoFrameCallbackInterface* ptr_video_callback);
 
   // Runs filter graph. Returns |kSuccess| upon success, or a |WebmEncoder|
   // status code upon failure.
-  int Run();
+  virtual int Run();
 
   // Monitors filter graph state.
-  int CheckStatus();
+  virtual int CheckStatus();
 
   // Stops filter graph.
-  void Stop();
+  virtual void Stop();
+
+  // Stops the graph, releases it and its devices, and builds and runs a new
+  // one with the settings passed to |Init()|. Device dialogs are not shown
+  // again. Fails with |WebmEncoder::kVideoConfigureError| or
+  // |WebmEncoder::kAudioConfigureError| when a device reopens with a frame
+  // size or audio format other than the encoders were set up for.
+  virtual int Restart();
 
   // Returns encoded duration in seconds.
   double encoded_duration();
@@ -164,13 +180,13 @@ class MediaSourceImpl {
   AudioConfig requested_audio_config() const {
     return requested_audio_config_;
   };
-  AudioConfig actual_audio_config() const {
+  virtual AudioConfig actual_audio_config() const {
     return actual_audio_config_;
   };
   VideoConfig requested_video_config() const {
     return requested_video_config_;
   };
-  VideoConfig actual_video_config() const {
+  virtual VideoConfig actual_video_config() const {
     return actual_video_config_;
   };
 
@@ -187,6 +203,21 @@ class MediaSourceImpl {
   // Connects the video source and sink filters.
   int ConnectVideoSourceToVideoSink();
 
+  // Appends the formats to try on video source output |pin| to
+  // |ptr_formats|: those it offers, ranked by |CaptureFormatPolicy|, and then
+  // the rest of |kVideoFormatPreference|.
+  void RankVideoFormats(const IPinPtr& pin,
+                        std::vector<VideoFormat>* ptr_formats);
+
+  // Returns the key of the requested video settings in |CaptureDeviceCache|.
+  std::string VideoFormatCacheKey() const;
+
+  // Has the video sink drop frames beyond the rate
+  // |FrameRateLimiter::OutputFrameRate()| returns for the connected frame
+  // rate, and updates |actual_video_config_| to match. Must be called after
+  // |ConnectVideoSourceToVideoSink()|.
+  int LimitVideoSinkFrameRate(double max_frame_rate, int decimate);
+
   // Configures the video capture source using |sub_type| and
   // |config_.requested_video_config|. Returns |kSuccess| and stores
   // |AM_MEDIA_TYPE| accepted by |pin| in |ptr_type|.
@@ -211,9 +242,23 @@ class MediaSourceImpl {
   // Connects the audio source and sink filters.
   int ConnectAudioSourceToAudioSink();
 
+  // Asks |pin| for |audio_buffer_count_| buffers of |audio_buffer_ms_| each,
+  // in its current format. Must be called before |pin| is connected. Filters
+  // without IAMBufferNegotiation keep their own buffers.
+  void SuggestAudioBuffers(const IPinPtr& pin);
+
+  // Logs the buffers |pin| negotiated, and the latency they add.
+  void LogAudioBuffers(const IPinPtr& pin);
+
   // Checks graph media event for error or completion.
   int HandleMediaEvent();
 
+  // Releases the graph, its filters and the non-DirectShow sources.
+  void ReleaseGraph();
+
+  // Settings passed to |Init()|, for |Restart()|.
+  WebmEncoderConfig config_;
+
   // Flag set to true when audio is captured from the same filter as video.
   bool audio_from_video_source_;
 
@@ -242,12 +287,32 @@ class MediaSourceImpl {
   // Audio device index.
   int audio_device_index_;
 
-  // Video device friendly name.
+  // Capture buffer length and count from |WebmEncoderConfig|.
+  int audio_buffer_ms_;
+  int audio_buffer_count_;
+
+  // True when |audio_sink_| delivers planar buffers.
+  bool planar_audio_;
+
+  // Video device friendly name, and its path in |CaptureDeviceCache|.
   std::wstring video_device_name_;
+  std::wstring video_device_path_;
 
   // Video device index.
   int video_device_index_;
 
+  // Screen capture source used instead of |video_source_| when
+  // |WebmEncoderConfig::video_capture_desktop| is set.
+  std::unique_ptr<DesktopCaptureSource> desktop_source_;
+
+  // Media Foundation video source used instead of |video_source_| when
+  // |WebmEncoderConfig::video_capture_media_foundation| is set.
+  std::unique_ptr<MfVideoSource> mf_source_;
+
+  // WASAPI audio source used instead of |audio_source_| when
+  // |WebmEncoderConfig::audio_capture_wasapi| is set.
+  std::unique_ptr<WasapiAudioSource> wasapi_source_;
+
   // Requested audio settings.
   AudioConfig requested_audio_config_;
 
@@ -260,6 +325,21 @@ class MediaSourceImpl {
   // Actual video settings.
   VideoConfig actual_video_config_;
 
+  // Size the video sink scales frames to while converting them to I420. Zero
+  // when frames are converted at capture size.
+  int32 video_output_width_;
+  int32 video_output_height_;
+
+  // |WebmEncoderConfig::video_async_conversion|.
+  bool video_async_conversion_;
+
+  // |WebmEncoderConfig::video_buffer_count|.
+  int video_buffer_count_;
+
+  // |VpxConfig::bit_depth|. V210 capture is negotiated, ahead of every other
+  // format, only when it is above 8.
+  int video_bit_depth_;
+
   // Controls display of device configuration dialogs.
   UserInterfaceOptions ui_opts_;
 
@@ -285,7 +365,8 @@ class CaptureSourceLoader {
   ~CaptureSourceLoader();
 
   // Initialize the loader for audio or video devices.  Must specify either
-  // CLSID_AudioInputDeviceCategory or CLSID_VideoInputDeviceCategory.
+  // CLSID_AudioInputDeviceCategory or CLSID_VideoInputDeviceCategory. Uses
+  // the devices in |CaptureDeviceCache| when present.
   int Init(CLSID source_type);
 
   // Returns number of sources found by Init.
@@ -300,10 +381,23 @@ class CaptureSourceLoader {
   // Returns filter for capture source specified by |name|.
   IBaseFilterPtr GetSource(const std::wstring name);
 
+  // Returns the device path of the source named |name|, which keys its
+  // formats in |CaptureDeviceCache|, or an empty string when |name| is
+  // unknown.
+  std::wstring GetSourcePath(const std::wstring& name) const;
+
  private:
-  // Finds and stores all source devices of |source_type_| in |sources_|.
+  // Finds and stores all source devices of |source_type_| in |sources_| and
+  // |devices_|, and caches them.
   int FindAllSources();
 
+  // Creates |source_enum_|. Returns |kNoDeviceFound| when there are no
+  // devices of |source_type_|.
+  int CreateSourceEnum();
+
+  // Binds the filter of the source named |name| by enumerating |source_enum_|.
+  IBaseFilterPtr EnumerateSource(const std::wstring& name);
+
   // Utility for returning the string property specified by |prop_name| stored
   // in |prop_bag|.
   std::wstring GetStringProperty(const IPropertyBagPtr& prop_bag,
@@ -312,6 +406,11 @@ class CaptureSourceLoader {
   // Returns the value of |moniker|'s friendly name property.
   std::wstring GetMonikerFriendlyName(const IMonikerPtr& moniker);
 
+  // Returns |moniker|'s display name, and the value of its DevicePath
+  // property, or empty strings on failure.
+  std::wstring GetMonikerDisplayName(const IMonikerPtr& moniker);
+  std::wstring GetMonikerDevicePath(const IMonikerPtr& moniker);
+
   // Type of sources to find.
   CLSID source_type_;
 
@@ -320,6 +419,9 @@ class CaptureSourceLoader {
 
   // Map of sources.
   std::map<int, std::wstring> sources_;
+
+  // Sources in enumeration order, with the names used to bind and cache them.
+  std::vector<CaptureDeviceCache::Device> devices_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(CaptureSourceLoader);
 };
 
@@ -453,6 +555,12 @@ class PinFormat {
   AM_MEDIA_TYPE* FindMatchingFormat(const AudioConfig& config);
   AM_MEDIA_TYPE* FindMatchingFormat(const VideoConfig& config);
 
+  // Appends the video capabilities |pin_| reports through
+  // IAMStreamConfig::GetStreamCaps to |ptr_candidates|, skipping formats
+  // |VideoFrame| does not handle. Returns |kCannotSetFormat| when |pin_|
+  // cannot report capabilities.
+  int GetVideoCandidates(std::vector<CaptureFormatCandidate>* ptr_candidates);
+
   // Returns |pin_|.
   IPinPtr pin() const { return pin_; }
 
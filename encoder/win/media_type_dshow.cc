@@ -9,6 +9,7 @@
 
 #include <mmreg.h>
 
+#include "encoder/v210_unpack.h"
 #include "encoder/win/media_source_dshow.h"
 #include "encoder/win/webm_guids.h"
 #include "glog/logging.h"
@@ -31,6 +32,18 @@ bool VideoFormatToSubTypeGuid(VideoFormat format, GUID* ptr_sub_type) {
         *ptr_sub_type = MEDIASUBTYPE_YV12;
         converted = true;
         break;
+      case kVideoFormatNV12:
+        *ptr_sub_type = MEDIASUBTYPE_NV12;
+        converted = true;
+        break;
+      case kVideoFormatNV21:
+        *ptr_sub_type = MEDIASUBTYPE_NV21;
+        converted = true;
+        break;
+      case kVideoFormatV210:
+        *ptr_sub_type = MEDIASUBTYPE_V210;
+        converted = true;
+        break;
       case kVideoFormatYUY2:
         *ptr_sub_type = MEDIASUBTYPE_YUY2;
         converted = true;
@@ -51,6 +64,10 @@ bool VideoFormatToSubTypeGuid(VideoFormat format, GUID* ptr_sub_type) {
         *ptr_sub_type = MEDIASUBTYPE_RGB32;
         converted = true;
         break;
+      case kVideoFormatMJPEG:
+        *ptr_sub_type = MEDIASUBTYPE_MJPG;
+        converted = true;
+        break;
       default:
         LOG(WARNING) << "Unknown video format value.";
     }
@@ -241,8 +258,15 @@ int VideoMediaType::ConfigureSubType(VideoFormat sub_type,
       ptr_type_->bTemporalCompression = TRUE;
       ptr_type_->bFixedSizeSamples = FALSE;
       break;
+    case kVideoFormatMJPEG:
+      ptr_type_->bTemporalCompression = FALSE;
+      ptr_type_->bFixedSizeSamples = FALSE;
+      break;
     case kVideoFormatI420:
     case kVideoFormatYV12:
+    case kVideoFormatNV12:
+    case kVideoFormatNV21:
+    case kVideoFormatV210:
     case kVideoFormatYUY2:
     case kVideoFormatUYVY:
     case kVideoFormatRGB:
@@ -360,6 +384,17 @@ int VideoMediaType::stride() const {
   return stride;
 }
 
+// Maps the biCompression and biBitCount values from BITMAPINFOHEADER to a
+// |VideoFormat|.
+bool VideoMediaType::pixel_format(VideoFormat* ptr_format) const {
+  const BITMAPINFOHEADER* ptr_header = bitmap_header();
+  if (!ptr_header) {
+    return false;
+  }
+  return FourCCToVideoFormat(ptr_header->biCompression, ptr_header->biBitCount,
+                             ptr_format);
+}
+
 // Returns pointer to BITMAPINFOHEADER stored within |ptr_type_|'s format
 // blob.
 const BITMAPINFOHEADER* VideoMediaType::bitmap_header() const {
@@ -404,6 +439,21 @@ int VideoMediaType::ConfigureFormatInfo(const VideoConfig& config,
       header.biCompression = MAKEFOURCC('Y', 'V', '1', '2');
       header.biBitCount = kYV12BitCount;
       break;
+    case kVideoFormatNV12:
+      ptr_type_->subtype = MEDIASUBTYPE_NV12;
+      header.biCompression = MAKEFOURCC('N', 'V', '1', '2');
+      header.biBitCount = kNV12BitCount;
+      break;
+    case kVideoFormatNV21:
+      ptr_type_->subtype = MEDIASUBTYPE_NV21;
+      header.biCompression = MAKEFOURCC('N', 'V', '2', '1');
+      header.biBitCount = kNV21BitCount;
+      break;
+    case kVideoFormatV210:
+      ptr_type_->subtype = MEDIASUBTYPE_V210;
+      header.biCompression = MAKEFOURCC('v', '2', '1', '0');
+      header.biBitCount = kV210BitCount;
+      break;
     case kVideoFormatYUY2:
       ptr_type_->subtype = MEDIASUBTYPE_YUY2;
       header.biCompression = MAKEFOURCC('Y', 'U', 'Y', '2');
@@ -429,10 +479,18 @@ int VideoMediaType::ConfigureFormatInfo(const VideoConfig& config,
       header.biCompression = BI_RGB;
       header.biBitCount = kRGBABitCount;
       break;
+    case kVideoFormatMJPEG:
+      // |biSizeImage| bounds the compressed frames at the size of RGB ones.
+      ptr_type_->subtype = MEDIASUBTYPE_MJPG;
+      header.biCompression = MAKEFOURCC('M', 'J', 'P', 'G');
+      header.biBitCount = kRGBBitCount;
+      break;
     default:
       return kUnsupportedSubType;
   }
-  header.biSizeImage = DIBSIZE(header);
+  // V210 rows are padded to 48 pixel blocks, not to 32 bits.
+  header.biSizeImage = (sub_type == kVideoFormatV210) ?
+      V210Stride(config.width) * config.height : DIBSIZE(header);
   return kSuccess;
 }
 
@@ -106,6 +106,10 @@ class VideoMediaType : public MediaType {
   int height() const;
   int stride() const;
 
+  // Writes the pixel format of the BITMAPINFOHEADER to |ptr_format|. Returns
+  // false when the format is not one |VideoFrame| handles.
+  bool pixel_format(VideoFormat* ptr_format) const;
+
  private:
   // Easy access helper for obtaining values from the BITMAPINFOHEADER within
   // |ptr_type_|'s format blob.
@@ -0,0 +1,542 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/win/mf_video_source.h"
+
+#include <d3d10.h>
+#include <mfapi.h>
+#include <mferror.h>
+
+#include <cmath>
+#include <functional>
+#include <vector>
+
+#include "encoder/capture_format_policy.h"
+#include "encoder/cpu_accounting.h"
+#include "encoder/latency_tracer.h"
+#include "encoder/thread_placement.h"
+#include "encoder/trace_log.h"
+#include "encoder/webm_encoder.h"
+#include "encoder/win/dshow_util.h"
+#include "glog/logging.h"
+
+namespace webmlive {
+
+_COM_SMARTPTR_TYPEDEF(ID3D10Multithread, __uuidof(ID3D10Multithread));
+_COM_SMARTPTR_TYPEDEF(IMFDXGIBuffer, __uuidof(IMFDXGIBuffer));
+_COM_SMARTPTR_TYPEDEF(IMFMediaBuffer, __uuidof(IMFMediaBuffer));
+_COM_SMARTPTR_TYPEDEF(IMFMediaTypeHandler, __uuidof(IMFMediaTypeHandler));
+_COM_SMARTPTR_TYPEDEF(IMFPresentationDescriptor,
+                      __uuidof(IMFPresentationDescriptor));
+_COM_SMARTPTR_TYPEDEF(IMFSample, __uuidof(IMFSample));
+_COM_SMARTPTR_TYPEDEF(IMFStreamDescriptor, __uuidof(IMFStreamDescriptor));
+
+namespace {
+
+// Media Foundation time units, 100 ns, per microsecond.
+const LONGLONG kTicksPerUs = 10;
+
+const DWORD kVideoStream =
+    static_cast<DWORD>(MF_SOURCE_READER_FIRST_VIDEO_STREAM);
+
+// Device subtypes the reader converts, and their |VideoFormat|s.
+struct SubtypeMapping {
+  const GUID* ptr_subtype;
+  VideoFormat format;
+};
+const SubtypeMapping kSubtypes[] = {
+  {&MFVideoFormat_I420, kVideoFormatI420},
+  {&MFVideoFormat_IYUV, kVideoFormatI420},
+  {&MFVideoFormat_YV12, kVideoFormatYV12},
+  {&MFVideoFormat_NV12, kVideoFormatNV12},
+  {&MFVideoFormat_YUY2, kVideoFormatYUY2},
+  {&MFVideoFormat_UYVY, kVideoFormatUYVY},
+  {&MFVideoFormat_RGB24, kVideoFormatRGB},
+  {&MFVideoFormat_RGB32, kVideoFormatRGBA},
+  {&MFVideoFormat_MJPG, kVideoFormatMJPEG},
+};
+const int kNumSubtypes = sizeof(kSubtypes) / sizeof(kSubtypes[0]);
+
+// Describes |ptr_type| in |ptr_candidate|. Returns false when the reader
+// does not convert its subtype.
+bool TypeToCandidate(IMFMediaType* ptr_type,
+                     CaptureFormatCandidate* ptr_candidate) {
+  GUID subtype = GUID_NULL;
+  if (FAILED(ptr_type->GetGUID(MF_MT_SUBTYPE, &subtype))) {
+    return false;
+  }
+  for (int i = 0; i < kNumSubtypes; ++i) {
+    if (subtype == *kSubtypes[i].ptr_subtype) {
+      UINT32 width = 0;
+      UINT32 height = 0;
+      MFGetAttributeSize(ptr_type, MF_MT_FRAME_SIZE, &width, &height);
+      UINT32 numerator = 0;
+      UINT32 denominator = 0;
+      MFGetAttributeRatio(ptr_type, MF_MT_FRAME_RATE, &numerator,
+                          &denominator);
+      ptr_candidate->format = kSubtypes[i].format;
+      ptr_candidate->width = width;
+      ptr_candidate->height = height;
+      ptr_candidate->max_frame_rate =
+          denominator > 0 ? static_cast<double>(numerator) / denominator : 0;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // anonymous namespace
+
+MfVideoSource::MfVideoSource()
+    : mf_started_(false),
+      reset_token_(0),
+      ptr_callback_(NULL),
+      ptr_texture_callback_(NULL),
+      stop_(false),
+      status_(kSuccess) {
+}
+
+MfVideoSource::~MfVideoSource() {
+  Stop();
+  reader_ = 0;
+  if (media_source_) {
+    media_source_->Shutdown();
+    media_source_ = 0;
+  }
+  device_manager_ = 0;
+  device_ = 0;
+  if (mf_started_) {
+    MFShutdown();
+  }
+}
+
+int MfVideoSource::Init(const std::wstring& device_name, int device_index,
+                        const VideoConfig& requested_config, bool disable_gpu,
+                        VideoFrameCallbackInterface* ptr_callback) {
+  if (!ptr_callback) {
+    LOG(ERROR) << "MfVideoSource NULL callback.";
+    return kInvalidArg;
+  }
+  ptr_callback_ = ptr_callback;
+
+  const HRESULT hr = MFStartup(MF_VERSION, MFSTARTUP_LITE);
+  if (FAILED(hr)) {
+    LOG(ERROR) << "MFStartup failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  mf_started_ = true;
+
+  int status = OpenDevice(device_name, device_index);
+  if (status) {
+    return status;
+  }
+  if (!disable_gpu && CreateDeviceManager() != kSuccess) {
+    LOG(WARNING) << "MfVideoSource converting on the CPU.";
+    device_manager_ = 0;
+    device_ = 0;
+  }
+  status = SelectDeviceFormat(requested_config);
+  if (status) {
+    return status;
+  }
+  return CreateReader();
+}
+
+int MfVideoSource::SetTextureCallback(
+    D3D11TextureCallbackInterface* ptr_texture_callback) {
+  if (!device_) {
+    LOG(ERROR) << "MfVideoSource frames are not converted on the GPU.";
+    return kInvalidArg;
+  }
+  ptr_texture_callback_ = ptr_texture_callback;
+  return kSuccess;
+}
+
+void MfVideoSource::LimitFrameRate(double max_frame_rate, int decimate) {
+  const double frame_rate = FrameRateLimiter::OutputFrameRate(
+      actual_config_.frame_rate, max_frame_rate, decimate);
+  if (frame_rate <= 0 || frame_rate == actual_config_.frame_rate) {
+    frame_rate_limiter_.Init(0);
+    return;
+  }
+  frame_rate_limiter_.Init(frame_rate);
+  actual_config_.frame_rate = frame_rate;
+}
+
+int MfVideoSource::Run() {
+  if (capture_thread_) {
+    LOG(ERROR) << "MfVideoSource already running.";
+    return kThreadError;
+  }
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  stop_ = false;
+  capture_thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&MfVideoSource::CaptureThread,  // NOLINT
+                                this)));
+  if (!capture_thread_) {
+    LOG(ERROR) << "MfVideoSource cannot construct thread.";
+    return kThreadError;
+  }
+  return kSuccess;
+}
+
+void MfVideoSource::Stop() {
+  if (capture_thread_) {
+    stop_ = true;
+    capture_thread_->join();
+    capture_thread_.reset();
+  }
+}
+
+int MfVideoSource::OpenDevice(const std::wstring& device_name,
+                              int device_index) {
+  IMFAttributesPtr attributes;
+  HRESULT hr = MFCreateAttributes(&attributes, 1);
+  if (SUCCEEDED(hr)) {
+    hr = attributes->SetGUID(MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE,
+                             MF_DEVSOURCE_ATTRIBUTE_SOURCE_TYPE_VIDCAP_GUID);
+  }
+  IMFActivate** ptr_devices = NULL;
+  UINT32 count = 0;
+  if (SUCCEEDED(hr)) {
+    hr = MFEnumDeviceSources(attributes, &ptr_devices, &count);
+  }
+  if (FAILED(hr)) {
+    LOG(ERROR) << "cannot enumerate video capture devices: " << HRLOG(hr);
+    return kDeviceError;
+  }
+
+  const UINT32 index =
+      device_index == kUseDefaultDevice ? 0 : static_cast<UINT32>(device_index);
+  IMFActivate* ptr_found = NULL;
+  for (UINT32 i = 0; i < count && !ptr_found; ++i) {
+    if (device_name.empty()) {
+      if (i == index) {
+        ptr_found = ptr_devices[i];
+      }
+      continue;
+    }
+    wchar_t* ptr_name = NULL;
+    UINT32 name_length = 0;
+    if (SUCCEEDED(ptr_devices[i]->GetAllocatedString(
+            MF_DEVSOURCE_ATTRIBUTE_FRIENDLY_NAME, &ptr_name, &name_length))) {
+      if (device_name == ptr_name) {
+        ptr_found = ptr_devices[i];
+      }
+      CoTaskMemFree(ptr_name);
+    }
+  }
+  int status = kNoDevice;
+  if (ptr_found) {
+    hr = ptr_found->ActivateObject(__uuidof(IMFMediaSource),
+                                   reinterpret_cast<void**>(&media_source_));
+    status = kSuccess;
+    if (FAILED(hr)) {
+      LOG(ERROR) << "cannot activate video capture device: " << HRLOG(hr);
+      status = kDeviceError;
+    }
+  } else {
+    LOG(ERROR) << "no video capture device matches the requested device.";
+  }
+  for (UINT32 i = 0; i < count; ++i) {
+    ptr_devices[i]->Release();
+  }
+  CoTaskMemFree(ptr_devices);
+  return status;
+}
+
+int MfVideoSource::CreateDeviceManager() {
+  HRESULT hr = D3D11CreateDevice(NULL, D3D_DRIVER_TYPE_HARDWARE, NULL,
+                                 D3D11_CREATE_DEVICE_VIDEO_SUPPORT,
+                                 NULL, 0, D3D11_SDK_VERSION, &device_, NULL,
+                                 NULL);
+  if (FAILED(hr)) {
+    LOG(WARNING) << "cannot create D3D11 video device: " << HRLOG(hr);
+    return kDeviceError;
+  }
+
+  // The reader uses the device from its own threads.
+  const ID3D10MultithreadPtr multithread(device_);
+  if (multithread) {
+    multithread->SetMultithreadProtected(TRUE);
+  }
+  hr = MFCreateDXGIDeviceManager(&reset_token_, &device_manager_);
+  if (SUCCEEDED(hr)) {
+    hr = device_manager_->ResetDevice(device_, reset_token_);
+  }
+  if (FAILED(hr)) {
+    LOG(WARNING) << "cannot create DXGI device manager: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  return kSuccess;
+}
+
+int MfVideoSource::SelectDeviceFormat(const VideoConfig& requested_config) {
+  IMFPresentationDescriptorPtr presentation;
+  HRESULT hr = media_source_->CreatePresentationDescriptor(&presentation);
+  BOOL selected = FALSE;
+  IMFStreamDescriptorPtr stream;
+  if (SUCCEEDED(hr)) {
+    hr = presentation->GetStreamDescriptorByIndex(0, &selected, &stream);
+  }
+  IMFMediaTypeHandlerPtr handler;
+  if (SUCCEEDED(hr)) {
+    hr = stream->GetMediaTypeHandler(&handler);
+  }
+  DWORD num_types = 0;
+  if (SUCCEEDED(hr)) {
+    hr = handler->GetMediaTypeCount(&num_types);
+  }
+  if (FAILED(hr)) {
+    LOG(ERROR) << "cannot get device media types: " << HRLOG(hr);
+    return kDeviceError;
+  }
+
+  std::vector<CaptureFormatCandidate> candidates;
+  for (DWORD i = 0; i < num_types; ++i) {
+    IMFMediaTypePtr type;
+    CaptureFormatCandidate candidate;
+    if (SUCCEEDED(handler->GetMediaTypeByIndex(i, &type)) &&
+        TypeToCandidate(type, &candidate)) {
+      candidates.push_back(candidate);
+    }
+  }
+  CaptureFormatPolicy::Rank(requested_config, 8, &candidates);
+
+  // Find the first device type described by the best candidate.
+  IMFMediaTypePtr device_type;
+  for (DWORD i = 0; i < num_types && !candidates.empty() && !device_type;
+       ++i) {
+    IMFMediaTypePtr type;
+    CaptureFormatCandidate candidate;
+    if (SUCCEEDED(handler->GetMediaTypeByIndex(i, &type)) &&
+        TypeToCandidate(type, &candidate) &&
+        candidate.format == candidates[0].format &&
+        candidate.width == candidates[0].width &&
+        candidate.height == candidates[0].height &&
+        candidate.max_frame_rate == candidates[0].max_frame_rate) {
+      device_type = type;
+    }
+  }
+  if (device_type) {
+    hr = handler->SetCurrentMediaType(device_type);
+    if (FAILED(hr)) {
+      LOG(ERROR) << "cannot set device media type: " << HRLOG(hr);
+      return kDeviceError;
+    }
+    LOG(INFO) << "MfVideoSource device format "
+              << CaptureFormatPolicy::FormatName(candidates[0].format);
+  } else {
+    // Formats the encoders cannot take, such as MJPEG without MJPEG support
+    // built in, are still converted by the reader.
+    LOG(INFO) << "MfVideoSource using the device's current format.";
+    hr = handler->GetCurrentMediaType(&device_type);
+    if (FAILED(hr)) {
+      LOG(ERROR) << "cannot get device media type: " << HRLOG(hr);
+      return kDeviceError;
+    }
+  }
+
+  UINT32 width = 0;
+  UINT32 height = 0;
+  MFGetAttributeSize(device_type, MF_MT_FRAME_SIZE, &width, &height);
+  UINT32 numerator = 0;
+  UINT32 denominator = 0;
+  MFGetAttributeRatio(device_type, MF_MT_FRAME_RATE, &numerator,
+                      &denominator);
+  actual_config_.width = width;
+  actual_config_.height = height;
+  actual_config_.frame_rate =
+      denominator > 0 ? static_cast<double>(numerator) / denominator : 0;
+  return kSuccess;
+}
+
+int MfVideoSource::CreateReader() {
+  IMFAttributesPtr attributes;
+  HRESULT hr = MFCreateAttributes(&attributes, 3);
+  if (SUCCEEDED(hr) && device_manager_) {
+    hr = attributes->SetUnknown(MF_SOURCE_READER_D3D_MANAGER,
+                                device_manager_);
+    if (SUCCEEDED(hr)) {
+      hr = attributes->SetUINT32(MF_READWRITE_ENABLE_HARDWARE_TRANSFORMS,
+                                 TRUE);
+    }
+  }
+  // Inserts the video processor, which converts to NV12 and decodes MJPEG;
+  // on the GPU when |device_manager_| is set.
+  if (SUCCEEDED(hr)) {
+    hr = attributes->SetUINT32(
+        MF_SOURCE_READER_ENABLE_ADVANCED_VIDEO_PROCESSING, TRUE);
+  }
+  if (SUCCEEDED(hr)) {
+    hr = MFCreateSourceReaderFromMediaSource(media_source_, attributes,
+                                             &reader_);
+  }
+  if (FAILED(hr)) {
+    LOG(ERROR) << "cannot create source reader: " << HRLOG(hr);
+    return kDeviceError;
+  }
+
+  IMFMediaTypePtr output_type;
+  hr = MFCreateMediaType(&output_type);
+  if (SUCCEEDED(hr)) {
+    hr = output_type->SetGUID(MF_MT_MAJOR_TYPE, MFMediaType_Video);
+  }
+  if (SUCCEEDED(hr)) {
+    hr = output_type->SetGUID(MF_MT_SUBTYPE, MFVideoFormat_NV12);
+  }
+  if (SUCCEEDED(hr)) {
+    hr = MFSetAttributeSize(output_type, MF_MT_FRAME_SIZE,
+                            actual_config_.width, actual_config_.height);
+  }
+  if (SUCCEEDED(hr)) {
+    hr = reader_->SetCurrentMediaType(kVideoStream, NULL, output_type);
+  }
+  if (FAILED(hr)) {
+    LOG(ERROR) << "source reader cannot output NV12: " << HRLOG(hr);
+    return kDeviceError;
+  }
+
+  // Read back frames keep the reader's default stride; the chroma plane
+  // follows the luma plane.
+  IMFMediaTypePtr current_type;
+  UINT32 stride = 0;
+  if (SUCCEEDED(reader_->GetCurrentMediaType(kVideoStream, &current_type))) {
+    stride = MFGetAttributeUINT32(current_type, MF_MT_DEFAULT_STRIDE, 0);
+  }
+  actual_config_.format = kVideoFormatNV12;
+  actual_config_.stride = static_cast<int32>(stride) > 0 ?
+      static_cast<int32>(stride) : actual_config_.width;
+  LOG(INFO) << "MfVideoSource " << actual_config_.width << "x"
+            << actual_config_.height << " @ " << actual_config_.frame_rate
+            << " fps, converting on the " << (device_ ? "GPU" : "CPU");
+  return kSuccess;
+}
+
+int MfVideoSource::ReadFrame() {
+  DWORD stream_flags = 0;
+  LONGLONG sample_time = 0;
+  IMFSamplePtr sample;
+  const HRESULT hr = reader_->ReadSample(kVideoStream, 0, NULL, &stream_flags,
+                                         &sample_time, &sample);
+  if (FAILED(hr) || (stream_flags & MF_SOURCE_READERF_ERROR)) {
+    LOG(ERROR) << "IMFSourceReader::ReadSample failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  if (stream_flags & MF_SOURCE_READERF_ENDOFSTREAM) {
+    LOG(ERROR) << "MfVideoSource device stopped.";
+    return kDeviceError;
+  }
+  if (!sample) {
+    // Stream ticks mark gaps, and carry no sample.
+    return kSuccess;
+  }
+  const int64 timestamp_us = sample_time / kTicksPerUs;
+  LONGLONG sample_duration = 0;
+  int64 duration_us = actual_config_.frame_rate > 0 ?
+      static_cast<int64>(kMicrosecondTimebase / actual_config_.frame_rate) :
+      0;
+  if (SUCCEEDED(sample->GetSampleDuration(&sample_duration)) &&
+      sample_duration > 0) {
+    duration_us = sample_duration / kTicksPerUs;
+  }
+  const int64 timestamp = MicrosecondsToMilliseconds(timestamp_us);
+  if (timestamp < 0 || frame_rate_limiter_.ShouldDropFrame(timestamp)) {
+    return kSuccess;
+  }
+  if (ptr_texture_callback_) {
+    const int64 duration =
+        MicrosecondsToMilliseconds(timestamp_us + duration_us) - timestamp;
+    return DeliverTexture(sample, timestamp, duration);
+  }
+  return DeliverFrame(sample, timestamp_us, duration_us);
+}
+
+int MfVideoSource::DeliverTexture(IMFSample* ptr_sample, int64 timestamp,
+                                  int64 duration) {
+  IMFMediaBufferPtr buffer;
+  HRESULT hr = ptr_sample->GetBufferByIndex(0, &buffer);
+  const IMFDXGIBufferPtr dxgi_buffer(buffer);
+  if (FAILED(hr) || !dxgi_buffer) {
+    LOG(ERROR) << "MfVideoSource sample is not in GPU memory.";
+    return kDeviceError;
+  }
+  ID3D11Texture2DPtr texture;
+  UINT subresource = 0;
+  hr = dxgi_buffer->GetResource(__uuidof(ID3D11Texture2D),
+                                reinterpret_cast<void**>(&texture));
+  if (SUCCEEDED(hr)) {
+    hr = dxgi_buffer->GetSubresourceIndex(&subresource);
+  }
+  if (FAILED(hr)) {
+    LOG(ERROR) << "cannot get sample texture: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  LatencyTracer::Stamp(LatencyTracer::kCapture, timestamp);
+  const int status = ptr_texture_callback_->OnTextureReceived(
+      texture, subresource, timestamp, duration);
+  if (status && status != D3D11TextureCallbackInterface::kDropped) {
+    LOG(ERROR) << "OnTextureReceived failed, status=" << status;
+  }
+  return kSuccess;
+}
+
+int MfVideoSource::DeliverFrame(IMFSample* ptr_sample, int64 timestamp_us,
+                                int64 duration_us) {
+  // Reads frames in GPU memory back to system memory.
+  IMFMediaBufferPtr buffer;
+  HRESULT hr = ptr_sample->ConvertToContiguousBuffer(&buffer);
+  BYTE* ptr_data = NULL;
+  DWORD length = 0;
+  if (SUCCEEDED(hr)) {
+    hr = buffer->Lock(&ptr_data, NULL, &length);
+  }
+  if (FAILED(hr)) {
+    LOG(ERROR) << "cannot lock sample buffer: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  const int frame_status = frame_.Init(actual_config_,
+                                       true,  // always "keyframes"
+                                       0,
+                                       0,
+                                       ptr_data,
+                                       static_cast<int32>(length));
+  buffer->Unlock();
+  if (frame_status) {
+    LOG(ERROR) << "MfVideoSource frame Init failed.";
+    return kNoMemory;
+  }
+  frame_.SetTimeUs(timestamp_us, duration_us);
+  const int64 timestamp = frame_.timestamp();
+  WEBMLIVE_TRACE_EVERY_N(TraceLog::kFrame, 30, "video_capture")
+      << " timestamp=" << timestamp << " size=" << length;
+  LatencyTracer::Stamp(LatencyTracer::kCapture, timestamp);
+  const int status = ptr_callback_->OnVideoFrameReceived(&frame_);
+  if (status && status != VideoFrameCallbackInterface::kDropped) {
+    LOG(ERROR) << "OnVideoFrameReceived failed, status=" << status;
+  }
+  return kSuccess;
+}
+
+void MfVideoSource::CaptureThread() {
+  LOG(INFO) << "MfVideoSource thread started.";
+  CoInitializeEx(NULL, COINIT_MULTITHREADED);
+  ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kCapture);
+  ScopedCpuStage cpu_stage(kCpuCapture);
+  int status = kSuccess;
+  while (!stop_ && status == kSuccess) {
+    status = ReadFrame();
+  }
+  CoUninitialize();
+  status_ = status;
+  LOG(INFO) << "MfVideoSource thread finished, status=" << status;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,179 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_WIN_MF_VIDEO_SOURCE_H_
+#define WEBMLIVE_ENCODER_WIN_MF_VIDEO_SOURCE_H_
+
+#include <comdef.h>
+#include <d3d11.h>
+#include <mfidl.h>
+#include <mfreadwrite.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "encoder/basictypes.h"
+#include "encoder/frame_rate_limiter.h"
+#include "encoder/video_encoder.h"
+
+namespace webmlive {
+
+_COM_SMARTPTR_TYPEDEF(ID3D11Device, __uuidof(ID3D11Device));
+_COM_SMARTPTR_TYPEDEF(ID3D11Texture2D, __uuidof(ID3D11Texture2D));
+_COM_SMARTPTR_TYPEDEF(IMFAttributes, __uuidof(IMFAttributes));
+_COM_SMARTPTR_TYPEDEF(IMFDXGIDeviceManager, __uuidof(IMFDXGIDeviceManager));
+_COM_SMARTPTR_TYPEDEF(IMFMediaSource, __uuidof(IMFMediaSource));
+_COM_SMARTPTR_TYPEDEF(IMFMediaType, __uuidof(IMFMediaType));
+_COM_SMARTPTR_TYPEDEF(IMFSourceReader, __uuidof(IMFSourceReader));
+
+// Pure interface class that receives captured frames as D3D11 textures, for
+// consumers such as hardware encoders that work on GPU memory.
+class D3D11TextureCallbackInterface {
+ public:
+  enum {
+    kSuccess = 0,
+    // Returned by |OnTextureReceived()| when the frame is dropped.
+    kDropped = 1,
+  };
+  virtual ~D3D11TextureCallbackInterface() {}
+
+  // Passes the NV12 texture holding a frame stamped |timestamp| and lasting
+  // |duration| milliseconds. The frame is subresource |subresource| of
+  // |ptr_texture|, which may be an array texture. The texture belongs to the
+  // source, and is valid only during the call.
+  virtual int OnTextureReceived(ID3D11Texture2D* ptr_texture,
+                                uint32 subresource,
+                                int64 timestamp,
+                                int64 duration) = 0;
+};
+
+// Captures video through a Media Foundation source reader, and delivers NV12
+// frames through |VideoFrameCallbackInterface|.
+//
+// Notes
+// - The device format is the one |CaptureFormatPolicy| ranks first among
+//   those the device offers. The reader converts it to NV12, and decodes
+//   MJPEG, with the hardware video processor of a D3D11 device it shares with
+//   the source. When no D3D11 device is available the reader converts on the
+//   CPU instead.
+// - Frames converted on the GPU are read back into system memory only when
+//   delivered through |VideoFrameCallbackInterface|. With a
+//   |D3D11TextureCallbackInterface| set, frames stay in GPU memory.
+// - Frames are read synchronously; |Stop()| waits for the frame being read.
+class MfVideoSource {
+ public:
+  enum {
+    // Capture thread could not be started.
+    kThreadError = -5,
+    // Media Foundation call failed, or the device was removed.
+    kDeviceError = -4,
+    // No device matches the requested name or index.
+    kNoDevice = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  MfVideoSource();
+  ~MfVideoSource();
+
+  // Opens the video capture device with friendly name |device_name|, or, when
+  // |device_name| is empty, the one at |device_index| in enumeration order;
+  // |kUseDefaultDevice| selects the first. Picks the device format closest to
+  // |requested_config|, and creates the reader. Conversion runs on the GPU
+  // unless |disable_gpu| is true. Returns |kSuccess| when successful.
+  int Init(const std::wstring& device_name, int device_index,
+           const VideoConfig& requested_config, bool disable_gpu,
+           VideoFrameCallbackInterface* ptr_callback);
+
+  // Sends frames to |ptr_texture_callback| instead of reading them back for
+  // the |VideoFrameCallbackInterface|. Returns |kInvalidArg| when frames are
+  // not converted on the GPU. Must be called after |Init()| and before
+  // |Run()|.
+  int SetTextureCallback(D3D11TextureCallbackInterface* ptr_texture_callback);
+
+  // Limits delivery to the rate |FrameRateLimiter::OutputFrameRate()| returns
+  // for the negotiated frame rate, and updates |actual_config()| to match.
+  // Must be called after |Init()| and before |Run()|.
+  void LimitFrameRate(double max_frame_rate, int decimate);
+
+  // Starts the capture thread. Returns |kSuccess| when successful.
+  int Run();
+
+  // Stops the capture thread.
+  void Stop();
+
+  // Returns |kSuccess| while capturing, or the error that stopped the
+  // capture thread.
+  int status() const { return status_; }
+
+  const VideoConfig& actual_config() const { return actual_config_; }
+
+  // Returns the device the reader converts frames with, or NULL when frames
+  // are converted on the CPU. Consumers of textures create their resources
+  // on it.
+  ID3D11Device* device() const { return device_; }
+
+ private:
+  // Finds the device described by |device_name| and |device_index|, and
+  // stores it in |media_source_|.
+  int OpenDevice(const std::wstring& device_name, int device_index);
+
+  // Creates |device_| and |device_manager_|. Failure only disables GPU
+  // conversion.
+  int CreateDeviceManager();
+
+  // Sets the device format of |media_source_| to the best match for
+  // |requested_config|.
+  int SelectDeviceFormat(const VideoConfig& requested_config);
+
+  // Creates |reader_| and sets its NV12 output type.
+  int CreateReader();
+
+  // Reads one sample and delivers it. Returns |kSuccess| when successful,
+  // including when the reader returned no sample.
+  int ReadFrame();
+
+  // Delivers |ptr_sample| through the callback in use. Textures are
+  // delivered with millisecond times, and frames with microsecond times.
+  int DeliverTexture(IMFSample* ptr_sample, int64 timestamp, int64 duration);
+  int DeliverFrame(IMFSample* ptr_sample, int64 timestamp_us,
+                   int64 duration_us);
+
+  // Capture thread function.
+  void CaptureThread();
+
+  bool mf_started_;
+  IMFMediaSourcePtr media_source_;
+  IMFSourceReaderPtr reader_;
+
+  // D3D11 device shared with |reader_|; NULL when converting on the CPU.
+  ID3D11DevicePtr device_;
+  IMFDXGIDeviceManagerPtr device_manager_;
+  UINT reset_token_;
+
+  VideoConfig actual_config_;
+  VideoFrameCallbackInterface* ptr_callback_;
+  D3D11TextureCallbackInterface* ptr_texture_callback_;
+
+  // Frame storage used by the capture thread.
+  VideoFrame frame_;
+
+  // Drops frames beyond the rate set by |LimitFrameRate()|.
+  FrameRateLimiter frame_rate_limiter_;
+
+  std::atomic<bool> stop_;
+  std::atomic<int> status_;
+  std::shared_ptr<std::thread> capture_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(MfVideoSource);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_WIN_MF_VIDEO_SOURCE_H_
@@ -10,6 +10,11 @@
 #include <dvdmedia.h>
 #include <vfwmsgs.h>
 
+#include "encoder/cpu_accounting.h"
+#include "encoder/latency_tracer.h"
+#include "encoder/thread_placement.h"
+#include "encoder/trace_log.h"
+#include "encoder/v210_unpack.h"
 #include "encoder/win/dshow_util.h"
 #include "encoder/win/media_source_dshow.h"
 #include "encoder/win/media_type_dshow.h"
@@ -18,6 +23,108 @@
 
 namespace webmlive {
 
+///////////////////////////////////////////////////////////////////////////////
+// VideoFrameSample
+//
+
+VideoFrameSample::VideoFrameSample(CBaseAllocator* ptr_allocator,
+                                   HRESULT* ptr_result)
+    : CMediaSample(NAME("VideoFrameSample"), ptr_allocator, ptr_result,
+                   NULL, 0) {
+}
+
+VideoFrameSample::~VideoFrameSample() {
+}
+
+HRESULT VideoFrameSample::ResetBuffer(int32 size) {
+  if (frame_.Allocate(size)) {
+    LOG(ERROR) << "VideoFrameSample cannot allocate " << size << " bytes.";
+    return E_OUTOFMEMORY;
+  }
+  return SetPointer(frame_.buffer(), size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// VideoFrameAllocator
+//
+
+VideoFrameAllocator::VideoFrameAllocator(HRESULT* ptr_result)
+    : CBaseAllocator(NAME("VideoFrameAllocator"), NULL, ptr_result),
+      min_buffers_(0) {
+}
+
+VideoFrameAllocator::~VideoFrameAllocator() {
+  Decommit();
+  ReallyFree();
+}
+
+STDMETHODIMP VideoFrameAllocator::SetProperties(
+    ALLOCATOR_PROPERTIES* ptr_request,
+    ALLOCATOR_PROPERTIES* ptr_actual) {
+  if (!ptr_request || !ptr_actual) {
+    return E_POINTER;
+  }
+  if (ptr_request->cbPrefix != 0) {
+    LOG(WARNING) << "VideoFrameAllocator ignoring prefix request of "
+                 << ptr_request->cbPrefix << " bytes.";
+  }
+  ALLOCATOR_PROPERTIES request = *ptr_request;
+  request.cbPrefix = 0;
+  if (request.cBuffers < min_buffers_) {
+    VLOG(1) << "VideoFrameAllocator raising buffer count from "
+            << request.cBuffers << " to " << min_buffers_ << ".";
+    request.cBuffers = min_buffers_;
+  }
+  return CBaseAllocator::SetProperties(&request, ptr_actual);
+}
+
+void VideoFrameAllocator::Free() {
+}
+
+// Mirrors |CMemAllocator::Alloc()|, but gives each sample its own
+// |VideoFrame| storage instead of carving one block into sample buffers.
+HRESULT VideoFrameAllocator::Alloc() {
+  CAutoLock lock(this);
+  HRESULT hr = CBaseAllocator::Alloc();
+  if (FAILED(hr)) {
+    return hr;
+  }
+  if (hr == S_FALSE && m_lAllocated == m_lCount) {
+    // Properties unchanged and samples already allocated.
+    return S_OK;
+  }
+  ReallyFree();
+  for (; m_lAllocated < m_lCount; ++m_lAllocated) {
+    VideoFrameSample* const ptr_sample =
+        new (std::nothrow) VideoFrameSample(this, &hr);  // NOLINT
+    if (!ptr_sample) {
+      return E_OUTOFMEMORY;
+    }
+    if (SUCCEEDED(hr)) {
+      hr = ptr_sample->ResetBuffer(m_lSize);
+    }
+    if (FAILED(hr)) {
+      delete ptr_sample;
+      return hr;
+    }
+    m_lFree.Add(ptr_sample);
+  }
+  m_bChanged = FALSE;
+  return S_OK;
+}
+
+void VideoFrameAllocator::ReallyFree() {
+  CHECK_EQ(m_lAllocated, m_lFree.GetCount());
+  for (;;) {
+    CMediaSample* const ptr_sample = m_lFree.RemoveHead();
+    if (!ptr_sample) {
+      break;
+    }
+    delete ptr_sample;
+  }
+  m_lAllocated = 0;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // VideoSinkPin
 //
@@ -31,10 +138,80 @@ VideoSinkPin::VideoSinkPin(TCHAR* ptr_object_name,
                     ptr_filter,
                     ptr_filter_lock,
                     ptr_result,
-                    ptr_pin_name) {
+                    ptr_pin_name),
+      allocator_buffers_(0),
+      ptr_allocator_(NULL) {
+  if (FAILED(*ptr_result)) {
+    return;
+  }
+  ptr_allocator_ =
+      new (std::nothrow) VideoFrameAllocator(ptr_result);  // NOLINT
+  if (!ptr_allocator_) {
+    *ptr_result = E_OUTOFMEMORY;
+    return;
+  }
+  ptr_allocator_->AddRef();
 }
 
 VideoSinkPin::~VideoSinkPin() {
+  if (ptr_allocator_) {
+    ptr_allocator_->Release();
+    ptr_allocator_ = NULL;
+  }
+}
+
+// Same as |CBaseInputPin::GetAllocator()|, except that |ptr_allocator_| is
+// provided instead of a new |CMemAllocator|.
+STDMETHODIMP VideoSinkPin::GetAllocator(IMemAllocator** ptr_allocator) {
+  if (!ptr_allocator) {
+    return E_POINTER;
+  }
+  CAutoLock lock(m_pLock);
+  if (!m_pAllocator) {
+    if (!ptr_allocator_) {
+      return CBaseInputPin::GetAllocator(ptr_allocator);
+    }
+    m_pAllocator = ptr_allocator_;
+    m_pAllocator->AddRef();
+  }
+  m_pAllocator->AddRef();
+  *ptr_allocator = m_pAllocator;
+  return S_OK;
+}
+
+STDMETHODIMP VideoSinkPin::GetAllocatorRequirements(
+    ALLOCATOR_PROPERTIES* ptr_properties) {
+  if (!ptr_properties) {
+    return E_POINTER;
+  }
+  if (allocator_buffers_ <= 0) {
+    return E_NOTIMPL;
+  }
+  ptr_properties->cBuffers = allocator_buffers_;
+  return S_OK;
+}
+
+STDMETHODIMP VideoSinkPin::NotifyAllocator(IMemAllocator* ptr_allocator,
+                                           BOOL read_only) {
+  const HRESULT hr = CBaseInputPin::NotifyAllocator(ptr_allocator, read_only);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  ALLOCATOR_PROPERTIES properties = {0};
+  if (ptr_allocator && SUCCEEDED(ptr_allocator->GetProperties(&properties))) {
+    LOG(INFO) << "VideoSinkPin allocator has " << properties.cBuffers
+              << " buffer(s) of " << properties.cbBuffer << " bytes.";
+    if (properties.cBuffers < allocator_buffers_) {
+      LOG(WARNING) << "VideoSinkPin requested " << allocator_buffers_
+                   << " buffers; capture drops more likely.";
+    }
+  }
+  return hr;
+}
+
+bool VideoSinkPin::FrameAllocatorInUse() const {
+  return ptr_allocator_ &&
+      m_pAllocator == static_cast<IMemAllocator*>(ptr_allocator_);
 }
 
 // Returns preferred media type.
@@ -155,8 +332,18 @@ HRESULT VideoSinkPin::CheckMediaType(const CMediaType* ptr_media_type) {
       actual_config_.height = ptr_header->biHeight;
 
       // Store the stride for use with |VideoFrame::Init()|-- it's needed for
-      // format conversion.
-      actual_config_.stride = DIBWIDTHBYTES(*ptr_header);
+      // format conversion. |DIBWIDTHBYTES| describes packed formats only: the
+      // luma stride of planar formats is |biWidth|.
+      if (actual_config_.format == kVideoFormatI420 ||
+          actual_config_.format == kVideoFormatYV12 ||
+          actual_config_.format == kVideoFormatNV12 ||
+          actual_config_.format == kVideoFormatNV21) {
+        actual_config_.stride = ptr_header->biWidth;
+      } else if (actual_config_.format == kVideoFormatV210) {
+        actual_config_.stride = V210Stride(ptr_header->biWidth);
+      } else {
+        actual_config_.stride = DIBWIDTHBYTES(*ptr_header);
+      }
     }
   }
 
@@ -168,6 +355,16 @@ HRESULT VideoSinkPin::CheckMediaType(const CMediaType* ptr_media_type) {
   return S_OK;
 }
 
+// Filter lock is held by the caller, |CBasePin::ReceiveConnection|.
+HRESULT VideoSinkPin::SetMediaType(const CMediaType* ptr_media_type) {
+  HRESULT hr = CBaseInputPin::SetMediaType(ptr_media_type);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  VideoSinkFilter* ptr_filter = reinterpret_cast<VideoSinkFilter*>(m_pFilter);
+  return ptr_filter->BuildIngestPlan();
+}
+
 // Calls CBaseInputPin::Receive and then passes |ptr_sample| to
 // |VideoSinkFilter::OnFrameReceived|.
 HRESULT VideoSinkPin::Receive(IMediaSample* ptr_sample) {
@@ -194,10 +391,16 @@ HRESULT VideoSinkPin::Receive(IMediaSample* ptr_sample) {
 bool VideoSinkPin::AcceptableSubType(const GUID& media_sub_type) {
   return (media_sub_type == MEDIASUBTYPE_I420 ||
           media_sub_type == MEDIASUBTYPE_YV12 ||
+          media_sub_type == MEDIASUBTYPE_NV12 ||
+          media_sub_type == MEDIASUBTYPE_NV21 ||
+          media_sub_type == MEDIASUBTYPE_V210 ||
           media_sub_type == MEDIASUBTYPE_YUY2 ||
           media_sub_type == MEDIASUBTYPE_YUYV ||
           media_sub_type == MEDIASUBTYPE_UYVY ||
           media_sub_type == MEDIASUBTYPE_RGB24 ||
+#ifdef WEBMLIVE_HAVE_MJPEG
+          media_sub_type == MEDIASUBTYPE_MJPG ||
+#endif
           media_sub_type == MEDIASUBTYPE_RGB32);
 }
 
@@ -219,6 +422,13 @@ HRESULT VideoSinkPin::set_config(const VideoConfig& config) {
   return S_OK;
 }
 
+void VideoSinkPin::set_allocator_buffers(int32 buffers) {
+  allocator_buffers_ = buffers > 0 ? buffers : 0;
+  if (ptr_allocator_) {
+    ptr_allocator_->set_min_buffers(allocator_buffers_);
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // VideoSinkFilter
 //
@@ -230,12 +440,20 @@ VideoSinkFilter::VideoSinkFilter(
     : CBaseFilter(ptr_filter_name,
                   ptr_iunknown,
                   &filter_lock_,
-                  CLSID_VideoSinkFilter) {
+                  CLSID_VideoSinkFilter),
+      output_width_(0),
+      output_height_(0),
+      async_conversion_(false),
+      streaming_thread_id_(0) {
   if (!ptr_frame_callback) {
     *ptr_result = E_INVALIDARG;
     return;
   }
   ptr_frame_callback_ = ptr_frame_callback;
+  if (drop_detector_.Init("video")) {
+    *ptr_result = E_FAIL;
+    return;
+  }
   sink_pin_.reset(
       new (std::nothrow) VideoSinkPin(NAME("VideoSinkInputPin"),  // NOLINT
                                       this, &filter_lock_, ptr_result,
@@ -265,6 +483,81 @@ HRESULT VideoSinkFilter::set_config(const VideoConfig& config) {
   return sink_pin_->set_config(config);
 }
 
+// Locks filter and stores the conversion output size.
+HRESULT VideoSinkFilter::set_output_size(int32 width, int32 height) {
+  if (m_State != State_Stopped) {
+    return VFW_E_NOT_STOPPED;
+  }
+  CAutoLock lock(&filter_lock_);
+  output_width_ = width;
+  output_height_ = height;
+  if (sink_pin_->IsConnected()) {
+    return BuildIngestPlan();
+  }
+  return S_OK;
+}
+
+HRESULT VideoSinkFilter::set_max_frame_rate(double frame_rate) {
+  if (m_State != State_Stopped) {
+    return VFW_E_NOT_STOPPED;
+  }
+  CAutoLock lock(&filter_lock_);
+  frame_rate_limiter_.Init(frame_rate);
+  return S_OK;
+}
+
+HRESULT VideoSinkFilter::set_async_conversion(bool enable) {
+  if (m_State != State_Stopped) {
+    return VFW_E_NOT_STOPPED;
+  }
+  CAutoLock lock(&filter_lock_);
+  async_conversion_ = enable;
+  return S_OK;
+}
+
+HRESULT VideoSinkFilter::set_allocator_buffers(int32 buffers) {
+  if (m_State != State_Stopped) {
+    return VFW_E_NOT_STOPPED;
+  }
+  CAutoLock lock(&filter_lock_);
+  sink_pin_->set_allocator_buffers(buffers);
+  return S_OK;
+}
+
+// Starts |converter_| before the first sample can arrive.
+STDMETHODIMP VideoSinkFilter::Pause() {
+  if (m_State == State_Stopped) {
+    drop_detector_.Reset();
+  }
+  if (async_conversion_ && m_State == State_Stopped) {
+    if (converter_.Init(ptr_frame_callback_,
+                        AsyncFrameConverter::kDefaultSlots,
+                        output_width_, output_height_) ||
+        converter_.Start()) {
+      LOG(ERROR) << "VideoSinkFilter cannot start frame conversion.";
+      return E_FAIL;
+    }
+  }
+  return CBaseFilter::Pause();
+}
+
+// Stops |converter_| once the streaming thread no longer delivers samples.
+// The converter is stopped without |filter_lock_|, which the streaming
+// thread may be waiting for.
+STDMETHODIMP VideoSinkFilter::Stop() {
+  const HRESULT hr = CBaseFilter::Stop();
+  if (async_conversion_) {
+    converter_.Stop();
+    LOG(INFO) << "VideoSinkFilter conversion dropped "
+              << converter_.dropped_frames() << " frame(s).";
+  }
+  LOG(INFO) << "VideoSinkFilter capture lost "
+            << drop_detector_.lost_samples() << " frame(s) in "
+            << drop_detector_.gaps() << " gap(s), "
+            << drop_detector_.discontinuities() << " discontinuities.";
+  return hr;
+}
+
 // Locks filter and returns VideoSinkPin pointer wrapped by |sink_pin_|.
 CBasePin* VideoSinkFilter::GetPin(int index) {
   CBasePin* ptr_pin = NULL;
@@ -282,6 +575,11 @@ HRESULT VideoSinkFilter::OnFrameReceived(IMediaSample* ptr_sample) {
   if (!ptr_sample) {
     return E_POINTER;
   }
+  if (streaming_thread_id_ != GetCurrentThreadId()) {
+    streaming_thread_id_ = GetCurrentThreadId();
+    ThreadPlacement::Instance().PlaceCurrentThread(ThreadPlacement::kCapture);
+  }
+  ScopedCpuStage cpu_stage(kCpuCapture);
   BYTE* ptr_sample_buffer = NULL;
   HRESULT hr = ptr_sample->GetPointer(&ptr_sample_buffer);
   if (FAILED(hr) || !ptr_sample_buffer) {
@@ -289,8 +587,10 @@ HRESULT VideoSinkFilter::OnFrameReceived(IMediaSample* ptr_sample) {
     hr = (hr == S_OK) ? E_FAIL : hr;
     return hr;
   }
-  int64 timestamp = 0;
-  int64 duration = 0;
+  // Frame times are kept in microseconds; 100 ns media times truncated to
+  // milliseconds would leave 60 and 120 fps frames unevenly spaced.
+  int64 timestamp_us = 0;
+  int64 duration_us = 0;
   REFERENCE_TIME start_time = 0;
   REFERENCE_TIME end_time = 0;
   hr = ptr_sample->GetTime(&start_time, &end_time);
@@ -298,9 +598,9 @@ HRESULT VideoSinkFilter::OnFrameReceived(IMediaSample* ptr_sample) {
     LOG(ERROR) << "OnFrameReceived cannot get media time(s)." << HRLOG(hr);
     return hr;
   }
-  timestamp = media_time_to_milliseconds(start_time);
+  timestamp_us = media_time_to_microseconds(start_time);
   if (hr != VFW_S_NO_STOP_TIME) {
-    duration = media_time_to_milliseconds(end_time) - timestamp;
+    duration_us = media_time_to_microseconds(end_time) - timestamp_us;
   } else {
     LOG(WARNING) << "OnFrameReceived using time per frame for duration.";
     AM_MEDIA_TYPE media_type = {0};
@@ -314,36 +614,142 @@ HRESULT VideoSinkFilter::OnFrameReceived(IMediaSample* ptr_sample) {
       LOG(ERROR) << "OnFrameReceived cannot Init VideoMediaType.";
       return E_FAIL;
     }
-    duration = media_time_to_milliseconds(video_format.avg_time_per_frame());
+    duration_us =
+        media_time_to_microseconds(video_format.avg_time_per_frame());
+  }
+  const int64 timestamp = MicrosecondsToMilliseconds(timestamp_us);
+  const int64 duration =
+      MicrosecondsToMilliseconds(timestamp_us + duration_us) - timestamp;
+
+  // Account for frames the capture filter lost before this one, whether or
+  // not the rate limit drops it.
+  drop_detector_.OnSample(timestamp_us, duration_us,
+                          ptr_sample->IsDiscontinuity() == S_OK);
+
+  // Drop frames beyond the rate limit before any conversion or copy. A
+  // dropped |VideoFrameSample| keeps its buffer and returns to the allocator.
+  if (frame_rate_limiter_.ShouldDropFrame(timestamp)) {
+    return S_OK;
   }
 
-  // TODO(tomfinegan): Write an allocator that retrieves frames from
-  //                   |WebmEncoder::EncoderThread| and avoid this extra copy.
-
-  const int status = frame_.Init(sink_pin_->actual_config_,
-                                 true,  // always "keyframes"
-                                 timestamp,
-                                 duration,
-                                 ptr_sample_buffer,
-                                 ptr_sample->GetActualDataLength());
+  // When the upstream filter writes into |VideoFrameSample|s and the frame
+  // needs no conversion, hand the sample's own |VideoFrame| to the callback.
+  // |BufferPool::Commit()| swaps its storage into the pool, and the sample is
+  // then pointed at the storage it received in exchange.
+  const VideoConfig& config = sink_pin_->actual_config_;
+  if (async_conversion_ && VideoFrame::NeedsConversion(config.format)) {
+    return SubmitForConversion(ptr_sample, ptr_sample_buffer, timestamp_us,
+                               duration_us);
+  }
+  VideoFrameSample* ptr_frame_sample = NULL;
+  if (sink_pin_->FrameAllocatorInUse() &&
+      !VideoFrame::NeedsConversion(config.format)) {
+    ptr_frame_sample = static_cast<VideoFrameSample*>(ptr_sample);
+  }
+  VideoFrame* const ptr_frame =
+      ptr_frame_sample ? ptr_frame_sample->frame() : &frame_;
+
+  int status = VideoFrame::kSuccess;
+  if (ptr_frame_sample) {
+    status = ptr_frame->InitInPlace(config,
+                                    true,  // always "keyframes"
+                                    timestamp,
+                                    duration,
+                                    ptr_sample->GetActualDataLength());
+  } else {
+    status = ptr_frame->Init(ingest_plan_,
+                             true,  // always "keyframes"
+                             timestamp,
+                             duration,
+                             ptr_sample_buffer,
+                             ptr_sample->GetActualDataLength());
+  }
   if (status) {
     LOG(ERROR) << "OnFrameReceived frame init failed: " << status;
     return E_FAIL;
   }
-  LOG(INFO) << "OnFrameReceived received a frame:"
-            << " width="  << sink_pin_->actual_config_.width
-            << " height=" << sink_pin_->actual_config_.height
-            << " format=" << sink_pin_->actual_config_.format
-            << " stride=" << sink_pin_->actual_config_.stride
-            << " timestamp(sec)=" << (timestamp / 1000.0)
-            << " timestamp="      << timestamp
-            << " duration(sec)= " << (duration / 1000.0)
-            << " duration= "      << duration
-            << " size=" << frame_.buffer_length();
-  int frame_status = ptr_frame_callback_->OnVideoFrameReceived(&frame_);
+  ptr_frame->SetTimeUs(timestamp_us, duration_us);
+  WEBMLIVE_TRACE_EVERY_N(TraceLog::kFrame, 30, "video_capture")
+      << " width=" << sink_pin_->actual_config_.width
+      << " height=" << sink_pin_->actual_config_.height
+      << " format=" << sink_pin_->actual_config_.format
+      << " stride=" << sink_pin_->actual_config_.stride
+      << " timestamp=" << timestamp
+      << " duration=" << duration
+      << " size=" << ptr_frame->buffer_length();
+  LatencyTracer::Stamp(LatencyTracer::kCapture, timestamp);
+  int frame_status = ptr_frame_callback_->OnVideoFrameReceived(ptr_frame);
   if (frame_status && frame_status != VideoFrameCallbackInterface::kDropped) {
     LOG(ERROR) << "OnVideoFrameReceived failed, status=" << frame_status;
   }
+  if (ptr_frame_sample) {
+    hr = ptr_frame_sample->ResetBuffer(ptr_sample->GetSize());
+    if (FAILED(hr)) {
+      LOG(ERROR) << "OnFrameReceived cannot reset sample buffer." << HRLOG(hr);
+      return hr;
+    }
+  }
+  return S_OK;
+}
+
+// Frames that must be converted are scaled at the same time when a smaller
+// output size is set; see |VideoFrame::InitScaled()|. MJPEG and V210 frames
+// are converted at full size, and scaled by the encoders.
+HRESULT VideoSinkFilter::BuildIngestPlan() {
+  const VideoConfig& config = sink_pin_->actual_config_;
+  const bool scale_frame =
+      AsyncFrameConverter::ScalesFrame(config, output_width_, output_height_);
+  const int status =
+      ingest_plan_.Init(config,
+                        scale_frame ? output_width_ : config.width,
+                        scale_frame ? output_height_ : abs(config.height));
+  if (status) {
+    LOG(ERROR) << "VideoSinkFilter cannot plan ingest of format "
+               << config.format << ": " << status;
+    return VFW_E_TYPE_NOT_ACCEPTED;
+  }
+  const int32 frame_size = ingest_plan_.output_size();
+  if (frame_size > frame_.buffer_capacity() && frame_.Allocate(frame_size)) {
+    LOG(ERROR) << "VideoSinkFilter cannot allocate " << frame_size
+               << " byte frame.";
+    return E_OUTOFMEMORY;
+  }
+  LOG(INFO) << "VideoSinkFilter ingest plan action=" << ingest_plan_.action()
+            << " output=" << ingest_plan_.output_config().width << "x"
+            << ingest_plan_.output_config().height;
+  return S_OK;
+}
+
+HRESULT VideoSinkFilter::SubmitForConversion(IMediaSample* ptr_sample,
+                                             const BYTE* ptr_sample_buffer,
+                                             int64 timestamp_us,
+                                             int64 duration_us) {
+  const VideoConfig& config = sink_pin_->actual_config_;
+  const int32 length = ptr_sample->GetActualDataLength();
+  LatencyTracer::Stamp(LatencyTracer::kCapture,
+                       MicrosecondsToMilliseconds(timestamp_us));
+  int status = AsyncFrameConverter::kSuccess;
+  VideoFrameSample* ptr_frame_sample = NULL;
+  if (sink_pin_->FrameAllocatorInUse()) {
+    ptr_frame_sample = static_cast<VideoFrameSample*>(ptr_sample);
+    status = converter_.SubmitFrame(config, timestamp_us, duration_us, length,
+                                    ptr_frame_sample->frame());
+  } else {
+    status = converter_.Submit(config, timestamp_us, duration_us,
+                               ptr_sample_buffer, length);
+  }
+  if (status && status != AsyncFrameConverter::kDropped) {
+    LOG(ERROR) << "OnFrameReceived cannot queue frame for conversion: "
+               << status;
+    return E_FAIL;
+  }
+  if (status == AsyncFrameConverter::kSuccess && ptr_frame_sample) {
+    const HRESULT hr = ptr_frame_sample->ResetBuffer(ptr_sample->GetSize());
+    if (FAILED(hr)) {
+      LOG(ERROR) << "OnFrameReceived cannot reset sample buffer." << HRLOG(hr);
+      return hr;
+    }
+  }
   return S_OK;
 }
 
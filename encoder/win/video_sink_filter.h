@@ -28,9 +28,13 @@
 #include "baseclasses/streams.h"
 #pragma warning(pop)
 #endif  // __STREAMS__
+#include "encoder/async_frame_converter.h"
 #include "encoder/basictypes.h"
+#include "encoder/capture_drop_detector.h"
 #include "encoder/encoder_base.h"
+#include "encoder/frame_rate_limiter.h"
 #include "encoder/video_encoder.h"
+#include "encoder/video_ingest_plan.h"
 #include "encoder/webm_encoder.h"
 
 namespace webmlive {
@@ -38,6 +42,60 @@ namespace webmlive {
 // Forward declare |VideoSinkFilter| for use in |VideoSinkPin|.
 class VideoSinkFilter;
 
+// Media sample whose buffer is the storage of a |VideoFrame|. Allows
+// |VideoSinkFilter| to pass captured frames into |WebmEncoder|'s frame pool
+// using |VideoFrame::Swap()| instead of copying the sample data.
+class VideoFrameSample : public CMediaSample {
+ public:
+  VideoFrameSample(CBaseAllocator* ptr_allocator, HRESULT* ptr_result);
+  virtual ~VideoFrameSample();
+
+  // Makes sure |frame_| can hold |size| bytes, and points the sample at the
+  // storage owned by |frame_|. Must be called after |frame_| is swapped with
+  // another |VideoFrame|. Returns S_OK when successful.
+  HRESULT ResetBuffer(int32 size);
+
+  VideoFrame* frame() { return &frame_; }
+
+ private:
+  VideoFrame frame_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VideoFrameSample);
+};
+
+// Allocator offered to the upstream filter by |VideoSinkPin|. Produces
+// |VideoFrameSample|s.
+class VideoFrameAllocator : public CBaseAllocator {
+ public:
+  explicit VideoFrameAllocator(HRESULT* ptr_result);
+  virtual ~VideoFrameAllocator();
+
+  // Rejects prefix bytes: the sample buffer must be the start of the
+  // |VideoFrame| storage, and raises the buffer count to |min_buffers_|.
+  // Otherwise behaves as |CBaseAllocator::SetProperties()|.
+  STDMETHODIMP SetProperties(ALLOCATOR_PROPERTIES* ptr_request,
+                             ALLOCATOR_PROPERTIES* ptr_actual);
+
+  // Sets the fewest samples the allocator agrees to; values <= 0 accept the
+  // count the upstream filter asks for. Applies to later |SetProperties()|
+  // calls.
+  void set_min_buffers(int32 min_buffers) { min_buffers_ = min_buffers; }
+
+ protected:
+  // Memory is kept until destruction or a change in allocator properties;
+  // |Free()| does nothing.
+  virtual void Free();
+
+  // Allocates |m_lCount| |VideoFrameSample|s of |m_lSize| bytes.
+  virtual HRESULT Alloc();
+
+ private:
+  // Deletes all samples. Called from |Alloc()| and the destructor.
+  void ReallyFree();
+
+  int32 min_buffers_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VideoFrameAllocator);
+};
+
 // Pin class used by |VideoSinkFilter|. Accepts only I420 video input.
 class VideoSinkPin : public CBaseInputPin {
  public:
@@ -71,6 +129,11 @@ class VideoSinkPin : public CBaseInputPin {
   // VFW_E_TYPE_NOT_ACCEPTED - |ptr_media_type| is not supported.
   virtual HRESULT CheckMediaType(const CMediaType* ptr_media_type);
 
+  // Stores the connection media type, and has |VideoSinkFilter| plan the
+  // ingest of its frames. Returns VFW_E_TYPE_NOT_ACCEPTED when the frames
+  // cannot be ingested.
+  virtual HRESULT SetMediaType(const CMediaType* ptr_media_type);
+
   //
   // IMemInputPin method(s).
   //
@@ -81,7 +144,24 @@ class VideoSinkPin : public CBaseInputPin {
   // if it fails.
   virtual HRESULT STDMETHODCALLTYPE Receive(IMediaSample* ptr_sample);
 
+  // Returns |ptr_allocator_| to the upstream filter instead of the default
+  // memory allocator. Returns S_OK, or E_POINTER when |ptr_allocator| is NULL.
+  STDMETHODIMP GetAllocator(IMemAllocator** ptr_allocator);
+
+  // Asks the upstream filter for |allocator_buffers_| samples. Returns
+  // E_NOTIMPL, leaving the count to the upstream filter, when
+  // |allocator_buffers_| is 0.
+  STDMETHODIMP GetAllocatorRequirements(ALLOCATOR_PROPERTIES* ptr_properties);
+
+  // Logs the samples the upstream filter settled on, and warns when they are
+  // fewer than |allocator_buffers_|.
+  STDMETHODIMP NotifyAllocator(IMemAllocator* ptr_allocator, BOOL read_only);
+
  private:
+  // Returns true when the upstream filter accepted |ptr_allocator_|, which
+  // means all samples passed to |Receive()| are |VideoFrameSample|s.
+  bool FrameAllocatorInUse() const;
+
   // Copies |actual_config_| to |ptr_config| and returns S_OK. Returns
   // E_POINTER when |ptr_config| is NULL.
   HRESULT config(VideoConfig* ptr_config) const;
@@ -93,11 +173,23 @@ class VideoSinkPin : public CBaseInputPin {
   // Returns true when |media_sub_type| is an acceptable video format.
   bool AcceptableSubType(const GUID& media_sub_type);
 
+  // Sets |allocator_buffers_|, and the minimum count of |ptr_allocator_|.
+  // Filter lock always held by caller, |VideoSinkFilter|.
+  void set_allocator_buffers(int32 buffers);
+
+  // Samples requested from the upstream filter's allocator; 0 leaves the
+  // count to the upstream filter.
+  int32 allocator_buffers_;
+
   // Filter user's requested video config.
   VideoConfig requested_config_;
 
   // Actual video config (from upstream filter).
   VideoConfig actual_config_;
+
+  // Allocator whose samples are backed by |VideoFrame| storage. Reference
+  // counted; released in the destructor.
+  VideoFrameAllocator* ptr_allocator_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VideoSinkPin);
 
   // |VideoSinkFilter| requires access to private member |actual_config_|, and
@@ -128,9 +220,38 @@ class VideoSinkFilter : public CBaseFilter {
   // Sets actual requested video configuration and returns S_OK.
   HRESULT set_config(const VideoConfig& config);
 
+  // Sets the size frames that need format conversion are scaled to while they
+  // are converted. Frames are only scaled down: the size is ignored when it's
+  // larger than the connection size in either dimension. Values <= 0 disable
+  // scaling. Returns S_OK, or VFW_E_NOT_STOPPED when the filter is running.
+  // The ingest plan of a connected pin is rebuilt for the new size.
+  HRESULT set_output_size(int32 width, int32 height);
+
+  // Drops frames beyond |frame_rate| frames per second by timestamp, before
+  // they are converted or copied; see |FrameRateLimiter|. Values <= 0 disable
+  // the limit. Returns S_OK, or VFW_E_NOT_STOPPED when the filter is running.
+  HRESULT set_max_frame_rate(double frame_rate);
+
+  // Converts frames that need format conversion on an |AsyncFrameConverter|
+  // thread instead of the streaming thread, which then only hands frames
+  // over. Returns S_OK, or VFW_E_NOT_STOPPED when the filter is running.
+  HRESULT set_async_conversion(bool enable);
+
+  // Asks the upstream filter for |buffers| samples when the pin connects.
+  // Frames the sink holds while they are processed are samples the capture
+  // filter cannot fill; once they are all held, it discards frames. Values
+  // <= 0 leave the count to the upstream filter. Returns S_OK, or
+  // VFW_E_NOT_STOPPED when the filter is running.
+  HRESULT set_allocator_buffers(int32 buffers);
+
   // IUnknown
   DECLARE_IUNKNOWN;
 
+  // CBaseFilter methods. Start and stop |converter_| with the graph, reset
+  // |drop_detector_| as it starts, and log the capture drops as it stops.
+  STDMETHODIMP Pause();
+  STDMETHODIMP Stop();
+
   // CBaseFilter methods
   virtual int GetPinCount() { return 1; }
 
@@ -138,19 +259,57 @@ class VideoSinkFilter : public CBaseFilter {
   virtual CBasePin* GetPin(int index);
 
  private:
-  // Copes video frame from |ptr_sample| to |frame_|, and passes |frame_| to
-  // |VideoFrameCallbackInterface::OnVideoFrameReceived| for processing.
+  // Copies video frame from |ptr_sample| to |frame_|, and passes |frame_| to
+  // |VideoFrameCallbackInterface::OnVideoFrameReceived| for processing. When
+  // |ptr_sample| is a |VideoFrameSample| that needs no format conversion, its
+  // own |VideoFrame| is passed instead and no copy is made. With
+  // |async_conversion_| set, frames that need conversion are handed to
+  // |converter_| instead; |VideoFrameSample|s without a copy.
   // Returns S_OK when successful.
   HRESULT OnFrameReceived(IMediaSample* ptr_sample);
+
+  // Hands the frame in |ptr_sample|, whose data is at |ptr_sample_buffer|,
+  // to |converter_|. Frames are dropped when the converter is full. Returns
+  // S_OK when successful.
+  HRESULT SubmitForConversion(IMediaSample* ptr_sample,
+                              const BYTE* ptr_sample_buffer,
+                              int64 timestamp_us, int64 duration_us);
+
+  // Plans the ingest of frames of the connection format, scaled as
+  // |set_output_size()| says, and allocates |frame_| for them. Called when
+  // the pin's media type is set. Returns S_OK when successful.
+  HRESULT BuildIngestPlan();
   mutable CCritSec filter_lock_;
   VideoFrame frame_;
+
+  // How frames of the connection format are converted to |frame_|.
+  VideoIngestPlan ingest_plan_;
+
+  // Size set via |set_output_size()|.
+  int32 output_width_;
+  int32 output_height_;
+
+  // Rate limit set via |set_max_frame_rate()|.
+  FrameRateLimiter frame_rate_limiter_;
+
+  // Counts the frames lost upstream, from sample times and discontinuity
+  // flags.
+  CaptureDropDetector drop_detector_;
+
+  // Conversion thread used when |async_conversion_| is set.
+  bool async_conversion_;
+  AsyncFrameConverter converter_;
+
+  // Thread that last delivered a sample. The graph's streaming thread is
+  // placed by |ThreadPlacement| when first seen.
+  DWORD streaming_thread_id_;
   std::unique_ptr<VideoSinkPin> sink_pin_;
   VideoFrameCallbackInterface* ptr_frame_callback_;
   WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(VideoSinkFilter);
 
   // |VideoSinkPin| requires access to private member |filter_lock_|, and
-  // private method |OnFrameReceived| to lock the filter and safely deliver
-  // video frame buffers.
+  // private methods |OnFrameReceived| to lock the filter and safely deliver
+  // video frame buffers, and |BuildIngestPlan| when connected.
   friend class VideoSinkPin;
 };
 
@@ -0,0 +1,473 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#include "encoder/win/wasapi_audio_source.h"
+
+#include <avrt.h>
+#include <functiondiscoverykeys_devpkey.h>
+#include <ksmedia.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "encoder/cpu_accounting.h"
+#include "encoder/thread_placement.h"
+#include "encoder/time_util.h"
+#include "encoder/trace_log.h"
+#include "encoder/webm_encoder.h"
+#include "encoder/win/dshow_util.h"
+#include "glog/logging.h"
+
+namespace {
+
+// REFERENCE_TIME units, 100 ns, per millisecond.
+const REFERENCE_TIME kTicksPerMs = 10000;
+
+const int kBitsPerPcmSample = 16;
+const int kBitsPerFloatSample = 32;
+
+// Fills |ptr_format| with an interleaved |channels| channel format at
+// |sample_rate|, 32 bit float when |ieee_float| is true and 16 bit PCM
+// otherwise.
+void BuildFormat(uint16 channels, uint32 sample_rate, bool ieee_float,
+                 WAVEFORMATEXTENSIBLE* ptr_format) {
+  memset(ptr_format, 0, sizeof(*ptr_format));
+  const uint16 bits = ieee_float ? kBitsPerFloatSample : kBitsPerPcmSample;
+  WAVEFORMATEX& format = ptr_format->Format;
+  format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+  format.nChannels = channels;
+  format.nSamplesPerSec = sample_rate;
+  format.wBitsPerSample = bits;
+  format.nBlockAlign = static_cast<WORD>(channels * bits / 8);
+  format.nAvgBytesPerSec = format.nBlockAlign * sample_rate;
+  format.cbSize = sizeof(*ptr_format) - sizeof(format);
+  ptr_format->Samples.wValidBitsPerSample = bits;
+  ptr_format->dwChannelMask =
+      channels == 1 ? SPEAKER_FRONT_CENTER :
+                      SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT;
+  ptr_format->SubFormat = ieee_float ? KSDATAFORMAT_SUBTYPE_IEEE_FLOAT :
+                                       KSDATAFORMAT_SUBTYPE_PCM;
+}
+
+}  // anonymous namespace
+
+namespace webmlive {
+
+WasapiAudioSource::WasapiAudioSource()
+    : packet_event_(NULL),
+      ptr_callback_(NULL),
+      start_time_us_(0),
+      first_timestamp_(-1),
+      frames_read_(0),
+      stop_(false),
+      status_(kSuccess) {
+}
+
+WasapiAudioSource::~WasapiAudioSource() {
+  Stop();
+  capture_client_ = 0;
+  audio_client_ = 0;
+  device_ = 0;
+  if (packet_event_) {
+    CloseHandle(packet_event_);
+  }
+}
+
+int WasapiAudioSource::Init(const std::wstring& device_name,
+                            int device_index, bool exclusive,
+                            const AudioConfig& requested_config,
+                            AudioSamplesCallbackInterface* ptr_callback) {
+  if (!ptr_callback) {
+    LOG(ERROR) << "WasapiAudioSource NULL callback.";
+    return kInvalidArg;
+  }
+  ptr_callback_ = ptr_callback;
+
+  int status = OpenDevice(device_name, device_index);
+  if (status) {
+    return status;
+  }
+  status = exclusive ? InitExclusiveClient(requested_config) :
+                       InitSharedClient(requested_config);
+  if (status) {
+    return status;
+  }
+
+  packet_event_ = CreateEvent(NULL, FALSE, FALSE, NULL);
+  if (!packet_event_) {
+    LOG(ERROR) << "WasapiAudioSource cannot create event.";
+    return kNoMemory;
+  }
+  HRESULT hr = audio_client_->SetEventHandle(packet_event_);
+  if (FAILED(hr)) {
+    LOG(ERROR) << "IAudioClient::SetEventHandle failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  hr = audio_client_->GetService(__uuidof(IAudioCaptureClient),
+                                 reinterpret_cast<void**>(&capture_client_));
+  if (FAILED(hr)) {
+    LOG(ERROR) << "cannot get IAudioCaptureClient: " << HRLOG(hr);
+    return kDeviceError;
+  }
+
+  REFERENCE_TIME latency = 0;
+  audio_client_->GetStreamLatency(&latency);
+  LOG(INFO) << "WasapiAudioSource " << (exclusive ? "exclusive" : "shared")
+            << ": " << actual_config_.channels << " channels @ "
+            << actual_config_.sample_rate << " Hz, "
+            << actual_config_.bits_per_sample << " bits, stream latency "
+            << latency / kTicksPerMs << " ms";
+  return kSuccess;
+}
+
+int WasapiAudioSource::Run() {
+  if (capture_thread_) {
+    LOG(ERROR) << "WasapiAudioSource already running.";
+    return kThreadError;
+  }
+  start_time_us_ = SteadyClockMicroseconds();
+  first_timestamp_ = -1;
+  const HRESULT hr = audio_client_->Start();
+  if (FAILED(hr)) {
+    LOG(ERROR) << "IAudioClient::Start failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+
+  using std::bind;
+  using std::shared_ptr;
+  using std::thread;
+  using std::nothrow;
+  stop_ = false;
+  capture_thread_ = shared_ptr<thread>(
+      new (nothrow) thread(bind(&WasapiAudioSource::CaptureThread,  // NOLINT
+                                this)));
+  if (!capture_thread_) {
+    LOG(ERROR) << "WasapiAudioSource cannot construct thread.";
+    return kThreadError;
+  }
+  return kSuccess;
+}
+
+void WasapiAudioSource::Stop() {
+  if (capture_thread_) {
+    stop_ = true;
+    capture_thread_->join();
+    capture_thread_.reset();
+    audio_client_->Stop();
+  }
+}
+
+int WasapiAudioSource::OpenDevice(const std::wstring& device_name,
+                                  int device_index) {
+  IMMDeviceEnumeratorPtr enumerator;
+  HRESULT hr = enumerator.CreateInstance(__uuidof(MMDeviceEnumerator));
+  if (FAILED(hr)) {
+    LOG(ERROR) << "cannot create IMMDeviceEnumerator: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  if (device_name.empty() && device_index == kUseDefaultDevice) {
+    hr = enumerator->GetDefaultAudioEndpoint(eCapture, eConsole, &device_);
+    if (FAILED(hr)) {
+      LOG(ERROR) << "no default audio capture endpoint: " << HRLOG(hr);
+      return kNoDevice;
+    }
+    return kSuccess;
+  }
+
+  IMMDeviceCollectionPtr endpoints;
+  hr = enumerator->EnumAudioEndpoints(eCapture, DEVICE_STATE_ACTIVE,
+                                      &endpoints);
+  UINT count = 0;
+  if (FAILED(hr) || FAILED(endpoints->GetCount(&count))) {
+    LOG(ERROR) << "cannot enumerate audio capture endpoints: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  for (UINT i = 0; i < count; ++i) {
+    IMMDevicePtr device;
+    if (FAILED(endpoints->Item(i, &device))) {
+      continue;
+    }
+    if (device_name.empty()) {
+      if (static_cast<int>(i) == device_index) {
+        device_ = device;
+        return kSuccess;
+      }
+      continue;
+    }
+    IPropertyStorePtr properties;
+    if (FAILED(device->OpenPropertyStore(STGM_READ, &properties))) {
+      continue;
+    }
+    PROPVARIANT name;
+    PropVariantInit(&name);
+    const bool found =
+        SUCCEEDED(properties->GetValue(PKEY_Device_FriendlyName, &name)) &&
+        name.vt == VT_LPWSTR && device_name == name.pwszVal;
+    PropVariantClear(&name);
+    if (found) {
+      device_ = device;
+      return kSuccess;
+    }
+  }
+  LOG(ERROR) << "no active audio capture endpoint matches the requested "
+             << "device.";
+  return kNoDevice;
+}
+
+int WasapiAudioSource::InitSharedClient(const AudioConfig& requested_config) {
+  HRESULT hr = device_->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL,
+                                 reinterpret_cast<void**>(&audio_client_));
+  if (FAILED(hr)) {
+    LOG(ERROR) << "cannot activate IAudioClient: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  const REFERENCE_TIME buffer_duration = 2 * kPeriodMs * kTicksPerMs;
+
+  // Ask the engine to convert to the requested format; this avoids a second
+  // resampler in the encoder when the mix format differs.
+  WAVEFORMATEXTENSIBLE format;
+  BuildFormat(requested_config.channels, requested_config.sample_rate, true,
+              &format);
+  hr = audio_client_->Initialize(
+      AUDCLNT_SHAREMODE_SHARED,
+      AUDCLNT_STREAMFLAGS_EVENTCALLBACK |
+          AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM |
+          AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY,
+      buffer_duration, 0, &format.Format, NULL);
+  if (SUCCEEDED(hr)) {
+    return SetActualConfig(&format.Format);
+  }
+  LOG(WARNING) << "audio engine cannot convert to the requested format, "
+               << "using the mix format: " << HRLOG(hr);
+
+  // A failed Initialize() leaves the client unusable.
+  audio_client_ = 0;
+  hr = device_->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL,
+                         reinterpret_cast<void**>(&audio_client_));
+  WAVEFORMATEX* ptr_mix_format = NULL;
+  if (FAILED(hr) || FAILED(hr = audio_client_->GetMixFormat(&ptr_mix_format))) {
+    LOG(ERROR) << "cannot get the mix format: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  int status = SetActualConfig(ptr_mix_format);
+  if (status == kSuccess) {
+    hr = audio_client_->Initialize(AUDCLNT_SHAREMODE_SHARED,
+                                   AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+                                   buffer_duration, 0, ptr_mix_format, NULL);
+    if (FAILED(hr)) {
+      LOG(ERROR) << "IAudioClient::Initialize failed: " << HRLOG(hr);
+      status = kDeviceError;
+    }
+  }
+  CoTaskMemFree(ptr_mix_format);
+  return status;
+}
+
+int WasapiAudioSource::InitExclusiveClient(
+    const AudioConfig& requested_config) {
+  HRESULT hr = device_->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL,
+                                 reinterpret_cast<void**>(&audio_client_));
+  if (FAILED(hr)) {
+    LOG(ERROR) << "cannot activate IAudioClient: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  WAVEFORMATEXTENSIBLE format;
+  BuildFormat(requested_config.channels, requested_config.sample_rate, false,
+              &format);
+  hr = audio_client_->IsFormatSupported(AUDCLNT_SHAREMODE_EXCLUSIVE,
+                                        &format.Format, NULL);
+  if (hr != S_OK) {
+    LOG(ERROR) << "endpoint cannot capture " << requested_config.channels
+               << " channel 16 bit PCM at " << requested_config.sample_rate
+               << " Hz in exclusive mode: " << HRLOG(hr);
+    return kDeviceError;
+  }
+
+  REFERENCE_TIME default_period = 0;
+  REFERENCE_TIME min_period = 0;
+  hr = audio_client_->GetDevicePeriod(&default_period, &min_period);
+  if (FAILED(hr)) {
+    LOG(ERROR) << "IAudioClient::GetDevicePeriod failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  REFERENCE_TIME period = std::max(min_period, kPeriodMs * kTicksPerMs);
+
+  // Event driven exclusive mode requires equal buffer and period durations.
+  hr = audio_client_->Initialize(AUDCLNT_SHAREMODE_EXCLUSIVE,
+                                 AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+                                 period, period, &format.Format, NULL);
+  if (hr == AUDCLNT_E_BUFFER_SIZE_NOT_ALIGNED) {
+    // Retry with the duration of the aligned buffer size the device chose.
+    UINT32 buffer_frames = 0;
+    hr = audio_client_->GetBufferSize(&buffer_frames);
+    if (FAILED(hr)) {
+      LOG(ERROR) << "IAudioClient::GetBufferSize failed: " << HRLOG(hr);
+      return kDeviceError;
+    }
+    period = static_cast<REFERENCE_TIME>(
+        1000.0 * kTicksPerMs * buffer_frames / requested_config.sample_rate +
+        0.5);
+    audio_client_ = 0;
+    hr = device_->Activate(__uuidof(IAudioClient), CLSCTX_ALL, NULL,
+                           reinterpret_cast<void**>(&audio_client_));
+    if (SUCCEEDED(hr)) {
+      hr = audio_client_->Initialize(AUDCLNT_SHAREMODE_EXCLUSIVE,
+                                     AUDCLNT_STREAMFLAGS_EVENTCALLBACK,
+                                     period, period, &format.Format, NULL);
+    }
+  }
+  if (FAILED(hr)) {
+    LOG(ERROR) << "IAudioClient::Initialize failed: " << HRLOG(hr);
+    return kDeviceError;
+  }
+  return SetActualConfig(&format.Format);
+}
+
+int WasapiAudioSource::SetActualConfig(const WAVEFORMATEX* ptr_format) {
+  bool ieee_float = ptr_format->wFormatTag == WAVE_FORMAT_IEEE_FLOAT;
+  bool pcm = ptr_format->wFormatTag == WAVE_FORMAT_PCM;
+  uint16 valid_bits = ptr_format->wBitsPerSample;
+  uint32 channel_mask = 0;
+  if (ptr_format->wFormatTag == WAVE_FORMAT_EXTENSIBLE) {
+    const WAVEFORMATEXTENSIBLE* const ptr_extensible =
+        reinterpret_cast<const WAVEFORMATEXTENSIBLE*>(ptr_format);
+    ieee_float = ptr_extensible->SubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+    pcm = ptr_extensible->SubFormat == KSDATAFORMAT_SUBTYPE_PCM;
+    valid_bits = ptr_extensible->Samples.wValidBitsPerSample;
+    channel_mask = ptr_extensible->dwChannelMask;
+  }
+  if (!(ieee_float && ptr_format->wBitsPerSample == kBitsPerFloatSample) &&
+      !(pcm && ptr_format->wBitsPerSample == kBitsPerPcmSample)) {
+    LOG(ERROR) << "WasapiAudioSource unsupported format: "
+               << ptr_format->wBitsPerSample << " bits, tag "
+               << ptr_format->wFormatTag;
+    return kDeviceError;
+  }
+  actual_config_.format_tag =
+      ieee_float ? kAudioFormatIeeeFloat : kAudioFormatPcm;
+  actual_config_.channels = ptr_format->nChannels;
+  actual_config_.sample_rate = ptr_format->nSamplesPerSec;
+  actual_config_.bits_per_sample = ptr_format->wBitsPerSample;
+  actual_config_.valid_bits_per_sample = valid_bits;
+  actual_config_.block_align = ptr_format->nBlockAlign;
+  actual_config_.bytes_per_second = ptr_format->nAvgBytesPerSec;
+  actual_config_.channel_mask = channel_mask;
+  return kSuccess;
+}
+
+int WasapiAudioSource::ReadPackets() {
+  const DWORD wait_result = WaitForSingleObject(packet_event_, kMaxIdleWaitMs);
+  if (wait_result == WAIT_TIMEOUT) {
+    return kSuccess;
+  }
+  if (wait_result != WAIT_OBJECT_0) {
+    LOG(ERROR) << "WasapiAudioSource wait failed: " << GetLastError();
+    return kDeviceError;
+  }
+  for (;;) {
+    BYTE* ptr_data = NULL;
+    UINT32 frames = 0;
+    DWORD flags = 0;
+    const HRESULT hr =
+        capture_client_->GetBuffer(&ptr_data, &frames, &flags, NULL, NULL);
+    if (hr == AUDCLNT_S_BUFFER_EMPTY) {
+      return kSuccess;
+    }
+    if (FAILED(hr)) {
+      // AUDCLNT_E_DEVICE_INVALIDATED when the endpoint is unplugged.
+      LOG(ERROR) << "IAudioCaptureClient::GetBuffer failed: " << HRLOG(hr);
+      return kDeviceError;
+    }
+    const int status = DeliverPacket(ptr_data, frames, flags);
+    capture_client_->ReleaseBuffer(frames);
+    if (status) {
+      return status;
+    }
+  }
+}
+
+int WasapiAudioSource::DeliverPacket(const uint8* ptr_data, uint32 frames,
+                                     DWORD flags) {
+  if (frames == 0) {
+    return kSuccess;
+  }
+  if (flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) {
+    // Samples were lost; they are not timestamped, so a gap is left in the
+    // timeline.
+    if (first_timestamp_ >= 0) {
+      LOG(WARNING) << "WasapiAudioSource data discontinuity.";
+    }
+    first_timestamp_ = -1;
+  }
+  const int32 length = static_cast<int32>(frames * actual_config_.block_align);
+  if (flags & AUDCLNT_BUFFERFLAGS_SILENT) {
+    if (silence_.size() < static_cast<size_t>(length)) {
+      silence_.resize(length, 0);
+    }
+    ptr_data = &silence_[0];
+  }
+
+  if (first_timestamp_ < 0) {
+    // Anchor the timeline at the capture time of the first sample read.
+    const int64 packet_us = frames * 1000000LL / actual_config_.sample_rate;
+    first_timestamp_ =
+        (SteadyClockMicroseconds() - packet_us - start_time_us_) / 1000;
+    if (first_timestamp_ < 0) {
+      first_timestamp_ = 0;
+    }
+    frames_read_ = 0;
+  }
+  const int64 timestamp =
+      first_timestamp_ + frames_read_ * 1000 / actual_config_.sample_rate;
+  frames_read_ += frames;
+  const int64 duration =
+      first_timestamp_ + frames_read_ * 1000 / actual_config_.sample_rate -
+      timestamp;
+
+  if (audio_buffer_.Init(actual_config_, timestamp, duration, ptr_data,
+                         length)) {
+    LOG(ERROR) << "WasapiAudioSource AudioBuffer Init failed.";
+    return kNoMemory;
+  }
+  WEBMLIVE_TRACE_EVERY_N(TraceLog::kFrame, 100, "audio_capture")
+      << " timestamp=" << timestamp << " frames=" << frames;
+  const int status = ptr_callback_->OnSamplesReceived(&audio_buffer_);
+  if (status && status != AudioSamplesCallbackInterface::kDropped) {
+    LOG(ERROR) << "OnSamplesReceived failed, status=" << status;
+  }
+  return kSuccess;
+}
+
+void WasapiAudioSource::CaptureThread() {
+  LOG(INFO) << "WasapiAudioSource thread started.";
+  CoInitializeEx(NULL, COINIT_MULTITHREADED);
+  ThreadPlacement::Instance().PlaceCurrentThread(
+      ThreadPlacement::kAudioCapture);
+  ScopedCpuStage cpu_stage(kCpuCapture);
+
+  // Lets the multimedia class scheduler raise the thread's priority while it
+  // captures.
+  DWORD task_index = 0;
+  const HANDLE mmcss_task =
+      AvSetMmThreadCharacteristicsW(L"Pro Audio", &task_index);
+  if (!mmcss_task) {
+    LOG(WARNING) << "WasapiAudioSource cannot join MMCSS: " << GetLastError();
+  }
+
+  int status = kSuccess;
+  while (!stop_ && status == kSuccess) {
+    status = ReadPackets();
+  }
+  if (mmcss_task) {
+    AvRevertMmThreadCharacteristics(mmcss_task);
+  }
+  CoUninitialize();
+  status_ = status;
+  LOG(INFO) << "WasapiAudioSource thread finished, status=" << status;
+}
+
+}  // namespace webmlive
@@ -0,0 +1,150 @@
+// Copyright (c) 2015 The WebM project authors. All Rights Reserved.
+//
+// Use of this source code is governed by a BSD-style license
+// that can be found in the LICENSE file in the root of the source
+// tree. An additional intellectual property rights grant can be found
+// in the file PATENTS.  All contributing project authors may
+// be found in the AUTHORS file in the root of the source tree.
+#ifndef WEBMLIVE_ENCODER_WIN_WASAPI_AUDIO_SOURCE_H_
+#define WEBMLIVE_ENCODER_WIN_WASAPI_AUDIO_SOURCE_H_
+
+#include <comdef.h>
+#include <audioclient.h>
+#include <mmdeviceapi.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "encoder/audio_encoder.h"
+#include "encoder/basictypes.h"
+
+namespace webmlive {
+
+_COM_SMARTPTR_TYPEDEF(IAudioCaptureClient, __uuidof(IAudioCaptureClient));
+_COM_SMARTPTR_TYPEDEF(IAudioClient, __uuidof(IAudioClient));
+_COM_SMARTPTR_TYPEDEF(IMMDevice, __uuidof(IMMDevice));
+_COM_SMARTPTR_TYPEDEF(IMMDeviceCollection, __uuidof(IMMDeviceCollection));
+_COM_SMARTPTR_TYPEDEF(IMMDeviceEnumerator, __uuidof(IMMDeviceEnumerator));
+_COM_SMARTPTR_TYPEDEF(IPropertyStore, __uuidof(IPropertyStore));
+
+// Captures audio from a WASAPI endpoint in event driven mode, bypassing the
+// DirectShow audio capture filters and their buffer negotiation.
+//
+// Notes
+// - Shared mode captures 32 bit float at the requested channel count and
+//   sample rate, converted by the audio engine, or in the engine's mix format
+//   when the engine cannot convert. Packets arrive each engine period,
+//   usually 10 ms.
+// - Exclusive mode captures 16 bit PCM straight from the device at a period
+//   of |kPeriodMs|, or the device minimum when that is longer. The device
+//   must support the requested channel count and sample rate.
+// - Each packet is delivered as soon as it is read, so audio is at most one
+//   period behind the device.
+// - Timestamps count samples from the first packet, which is anchored to the
+//   time |Run()| was called, so they never drift from the audio clock.
+//   Discontinuities reported by the engine restart the count, leaving a gap.
+class WasapiAudioSource {
+ public:
+  enum {
+    // Capture thread could not be started.
+    kThreadError = -5,
+    // WASAPI call failed, or the endpoint was removed.
+    kDeviceError = -4,
+    // No endpoint matches the requested name or index.
+    kNoDevice = -3,
+    kNoMemory = -2,
+    kInvalidArg = -1,
+    kSuccess = 0,
+  };
+
+  // Period requested from the device in exclusive mode. Shared mode requests
+  // an engine buffer of twice this length.
+  static const int kPeriodMs = 10;
+
+  // Maximum time the capture thread waits for a packet. Bounds the delay in
+  // noticing |Stop()|.
+  static const int kMaxIdleWaitMs = 100;
+
+  WasapiAudioSource();
+  ~WasapiAudioSource();
+
+  // Opens the active capture endpoint with friendly name |device_name|, or,
+  // when |device_name| is empty, the one at |device_index| in endpoint
+  // enumeration order. |device_index| |kUseDefaultDevice| selects the default
+  // capture endpoint. Initializes the endpoint in exclusive mode when
+  // |exclusive| is true, and in shared mode otherwise. Returns |kSuccess|
+  // when successful.
+  int Init(const std::wstring& device_name, int device_index, bool exclusive,
+           const AudioConfig& requested_config,
+           AudioSamplesCallbackInterface* ptr_callback);
+
+  // Starts the endpoint and the capture thread. Returns |kSuccess| when
+  // successful.
+  int Run();
+
+  // Stops the capture thread and the endpoint.
+  void Stop();
+
+  // Returns |kSuccess| while capturing, or the error that stopped the
+  // capture thread.
+  int status() const { return status_; }
+
+  const AudioConfig& actual_config() const { return actual_config_; }
+
+ private:
+  // Finds the endpoint described by |device_name| and |device_index|, and
+  // stores it in |device_|.
+  int OpenDevice(const std::wstring& device_name, int device_index);
+
+  // Creates |audio_client_| and initializes it for event driven capture.
+  int InitSharedClient(const AudioConfig& requested_config);
+  int InitExclusiveClient(const AudioConfig& requested_config);
+
+  // Stores the format of |ptr_format| in |actual_config_|. Returns
+  // |kDeviceError| when the encoders cannot take it.
+  int SetActualConfig(const WAVEFORMATEX* ptr_format);
+
+  // Waits for the endpoint event, and delivers every packet available.
+  // Returns |kSuccess| when successful, including when no packet arrived in
+  // time.
+  int ReadPackets();
+
+  // Delivers |frames| sample frames at |ptr_data|, or silence when
+  // |flags| has AUDCLNT_BUFFERFLAGS_SILENT.
+  int DeliverPacket(const uint8* ptr_data, uint32 frames, DWORD flags);
+
+  // Capture thread function.
+  void CaptureThread();
+
+  IMMDevicePtr device_;
+  IAudioClientPtr audio_client_;
+  IAudioCaptureClientPtr capture_client_;
+
+  // Signaled by the audio engine when a packet is ready.
+  HANDLE packet_event_;
+
+  AudioConfig actual_config_;
+  AudioSamplesCallbackInterface* ptr_callback_;
+  int64 start_time_us_;
+
+  // Timestamp of the first sample, and the number of sample frames read
+  // since.
+  int64 first_timestamp_;
+  int64 frames_read_;
+
+  // Zeros delivered in place of packets the engine marks silent.
+  std::vector<uint8> silence_;
+  AudioBuffer audio_buffer_;
+
+  std::atomic<bool> stop_;
+  std::atomic<int> status_;
+  std::shared_ptr<std::thread> capture_thread_;
+  WEBMLIVE_DISALLOW_COPY_AND_ASSIGN(WasapiAudioSource);
+};
+
+}  // namespace webmlive
+
+#endif  // WEBMLIVE_ENCODER_WIN_WASAPI_AUDIO_SOURCE_H_
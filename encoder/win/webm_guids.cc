@@ -15,6 +15,22 @@ const GUID webmlive::MEDIASUBTYPE_I420 = {
   { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 }
 };
 
+// 3132564E-0000-0010-8000-00AA00389B71 'NV21'
+const GUID webmlive::MEDIASUBTYPE_NV21 = {
+  0x3132564e,
+  0x0000,
+  0x0010,
+  { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 }
+};
+
+// 30313276-0000-0010-8000-00AA00389B71 'v210'
+const GUID webmlive::MEDIASUBTYPE_V210 = {
+  0x30313276,
+  0x0000,
+  0x0010,
+  { 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71 }
+};
+
 // {D0DBABEA-71A5-40fb-95F1-7E0E3C1407E6}
 const CLSID webmlive::CLSID_VideoSinkFilter =  {
   0xd0dbabea,
@@ -16,6 +16,8 @@ extern const CLSID CLSID_AudioSinkFilter;
 extern const CLSID CLSID_VideoSinkFilter;
 extern const CLSID CLSID_KsDataTypeHandlerVideo;
 extern const GUID MEDIASUBTYPE_I420;
+extern const GUID MEDIASUBTYPE_NV21;
+extern const GUID MEDIASUBTYPE_V210;
 extern const GUID MEDIASUBTYPE_VP80;
 
 }  // namespace webmlive